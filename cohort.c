@@ -0,0 +1,463 @@
+/*
+ * Copyright (C) 2020 by Benedict Paten (benedictpaten@gmail.com)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <time.h>
+#include "marginVersion.h"
+
+#include "margin.h"
+#include "htsIntegration.h"
+
+/*
+ * A sample of the cohort, with its chunks and the output of those phased so far.
+ */
+typedef struct _cohortSample {
+    char *name;
+    char *bamInFile;
+    char *vcfFile;
+    char *outputBase;
+    stHash *vcfEntries;
+    BamChunker *bamChunker;
+    OutputChunkers *outputChunkers;
+    OverlapSupportCache *overlapSupportCache;
+    stList *allReadIdsHap1;
+    stList *allReadIdsHap2;
+    bool *chunkWasSwitched;
+} CohortSample;
+
+static void cohortSample_destruct(CohortSample *sample) {
+    free(sample->name);
+    free(sample->bamInFile);
+    free(sample->vcfFile);
+    free(sample->outputBase);
+    if (sample->vcfEntries != NULL) stHash_destruct(sample->vcfEntries);
+    if (sample->bamChunker != NULL) bamChunker_destruct(sample->bamChunker);
+    if (sample->overlapSupportCache != NULL) overlapSupportCache_destruct(sample->overlapSupportCache);
+    if (sample->allReadIdsHap1 != NULL) stList_destruct(sample->allReadIdsHap1);
+    if (sample->allReadIdsHap2 != NULL) stList_destruct(sample->allReadIdsHap2);
+    if (sample->chunkWasSwitched != NULL) free(sample->chunkWasSwitched);
+    free(sample);
+}
+
+static stList *cohort_readSampleSheet(char *sampleSheetFile, char *outputBase) {
+    /*
+     * Reads the samples of a tab separated sheet of SAMPLE_NAME ALIGN_BAM VARIANT_VCF lines, skipping empty lines and
+     * those starting with '#'.
+     */
+    stList *samples = stList_construct3(0, (void (*)(void *)) cohortSample_destruct);
+    stSet *sampleNames = stSet_construct3(stHash_stringKey, stHash_stringEqualKey, NULL);
+    FILE *fh = safe_fopen(sampleSheetFile, "r");
+    char *line = NULL;
+    while ((line = stFile_getLineFromFile(fh)) != NULL) {
+        if (strlen(line) == 0 || line[0] == '#') {
+            free(line);
+            continue;
+        }
+        stList *parts = stString_splitByString(line, "\t");
+        if (stList_length(parts) != 3) {
+            st_errAbort("Expected SAMPLE_NAME, ALIGN_BAM and VARIANT_VCF separated by tabs in %s: %s\n",
+                        sampleSheetFile, line);
+        }
+        CohortSample *sample = st_calloc(1, sizeof(CohortSample));
+        sample->name = stString_copy(stList_get(parts, 0));
+        sample->bamInFile = stString_copy(stList_get(parts, 1));
+        sample->vcfFile = stString_copy(stList_get(parts, 2));
+        sample->outputBase = stString_print("%s.%s", outputBase, sample->name);
+        if (stSet_search(sampleNames, sample->name) != NULL) {
+            st_errAbort("Sample %s is in %s more than once\n", sample->name, sampleSheetFile);
+        }
+        if (access(sample->bamInFile, R_OK) != 0) {
+            st_errAbort("Could not read from input bam file of sample %s: %s\n", sample->name, sample->bamInFile);
+        }
+        if (access(sample->vcfFile, R_OK) != 0) {
+            st_errAbort("Could not read from vcf file of sample %s: %s\n", sample->name, sample->vcfFile);
+        }
+        stList_append(samples, sample);
+        stSet_insert(sampleNames, sample->name);
+        stList_destruct(parts);
+        free(line);
+    }
+    fclose(fh);
+    stSet_destruct(sampleNames);
+    if (stList_length(samples) == 0) {
+        st_errAbort("Found no samples in %s\n", sampleSheetFile);
+    }
+    return samples;
+}
+
+static int cohort_cmpChunkDepth(const void *a, const void *b, const void *extraArg) {
+    // orders (sample, chunk) pairs by the estimated depth of their chunks
+    stList *samples = (stList *) extraArg;
+    CohortSample *sampleA = stList_get(samples, stIntTuple_get((stIntTuple *) a, 0));
+    CohortSample *sampleB = stList_get(samples, stIntTuple_get((stIntTuple *) b, 0));
+    int64_t depthA = bamChunker_getChunk(sampleA->bamChunker, stIntTuple_get((stIntTuple *) a, 1))->estimatedDepth;
+    int64_t depthB = bamChunker_getChunk(sampleB->bamChunker, stIntTuple_get((stIntTuple *) b, 1))->estimatedDepth;
+    return depthA < depthB ? -1 : depthA > depthB ? 1 : 0;
+}
+
+static void cohort_phaseChunk(CohortSample *sample, int64_t chunkIdx, char *referenceFastaFile, Params *params) {
+    /*
+     * Phases the chunk of the sample with phaseChunk, as phase_main does, passing it to the sample's output chunkers.
+     */
+    time_t chunkStartTime = time(NULL);
+    BamChunk *bamChunk = bamChunker_getChunk(sample->bamChunker, chunkIdx);
+    # ifdef _OPENMP
+    int64_t threadIdx = omp_get_thread_num();
+    char *logIdentifier = stString_print(" T%02d_%s_C%05"PRId64, threadIdx, sample->name, chunkIdx);
+    # else
+    int64_t threadIdx = 0;
+    char *logIdentifier = stString_print(" %s_C%05"PRId64, sample->name, chunkIdx);
+    # endif
+    if (params->polishParams->useChunkArena) {
+        chunkArena_open();
+    }
+    logBuffer_info(">%s Going to process a chunk for reference sequence: %s, starting at: %i and ending at: %i\n",
+                   logIdentifier, bamChunk->refSeqName, (int) bamChunk->chunkOverlapStart,
+                   (int) bamChunk->chunkOverlapEnd);
+
+    // the reference, whose index is cached by the thread across the samples, vcf entries and read substrings
+    PhaseChunkInput *chunkInput = phaseChunkInput_construct(bamChunk, referenceFastaFile, sample->vcfEntries, params);
+
+    // phase and output
+    int64_t readNo = phaseChunk(sample->bamChunker, chunkIdx, chunkInput, params->polishParams->maxDepth,
+                                sample->overlapSupportCache, NULL, sample->outputChunkers, threadIdx, params,
+                                logIdentifier);
+    logBuffer_info(">%s Chunk with ~%"PRId64" reads processed in %d sec\n", logIdentifier, readNo,
+                   (int) (time(NULL) - chunkStartTime));
+
+    // cleanup
+    free(logIdentifier);
+    if (params->polishParams->useChunkArena) {
+        chunkArena_close();
+    }
+}
+
+static void cohort_writeSampleOutput(CohortSample *sample, char *regionStr, Params *params,
+                                     bool shouldOutputHaplotaggedBam, bool shouldOutputPhasedVcf) {
+    // stitch the sample's chunks
+    st_logCritical("> Stitching the %"PRId64" chunks of sample %s\n", (int64_t) sample->bamChunker->chunkCount,
+                   sample->name);
+    outputChunkers_stitchAndTrackExtraData(sample->outputChunkers, TRUE, sample->bamChunker->chunkCount,
+                                           sample->allReadIdsHap1, sample->allReadIdsHap2, sample->chunkWasSwitched);
+    outputChunkers_destruct(sample->outputChunkers);
+    sample->outputChunkers = NULL;
+
+    // maybe write the haplotagged bams
+    if (shouldOutputHaplotaggedBam) {
+        st_logCritical("> Writing haplotagged BAMs of sample %s to %s.*\n", sample->name, sample->outputBase);
+        stSet *readIdsHap1 = stSet_construct3(stHash_stringKey, stHash_stringEqualKey, NULL);
+        stSet *readIdsHap2 = stSet_construct3(stHash_stringKey, stHash_stringEqualKey, NULL);
+        for (int64_t i = 0; i < stList_length(sample->allReadIdsHap1); i++) {
+            stSet_insert(readIdsHap1, stList_get(sample->allReadIdsHap1, i));
+        }
+        for (int64_t i = 0; i < stList_length(sample->allReadIdsHap2); i++) {
+            stSet_insert(readIdsHap2, stList_get(sample->allReadIdsHap2, i));
+        }
+        writeHaplotaggedBam(sample->bamChunker->bamFile, sample->outputBase, regionStr, readIdsHap1, readIdsHap2,
+                            NULL, params, "");
+        stSet_destruct(readIdsHap1);
+        stSet_destruct(readIdsHap2);
+    }
+
+    // maybe write the phased vcf
+    if (shouldOutputPhasedVcf) {
+        char *outputVcfFile = stString_print("%s.phased.vcf%s", sample->outputBase,
+                                             params->phaseParams->compressPhasedVcf ? ".gz" : "");
+        char *outputPhaseSetFile = stString_print("%s.phaseset.bed", sample->outputBase);
+        st_logCritical("> Writing phased VCF of sample %s to %s, phaseset info to %s\n", sample->name,
+                       outputVcfFile, outputPhaseSetFile);
+        updateHaplotypeSwitchingInVcfEntries(sample->bamChunker, sample->chunkWasSwitched, sample->vcfEntries);
+        writePhasedVcf(sample->vcfFile, regionStr, outputVcfFile, outputPhaseSetFile, sample->vcfEntries, params);
+        free(outputVcfFile);
+        free(outputPhaseSetFile);
+    }
+}
+
+/*
+ * Main functions
+ */
+
+void cohort_usage() {
+    fprintf(stderr, "usage: margin cohort <SAMPLE_SHEET> <REFERENCE_FASTA> <PARAMS> [options]\n");
+    fprintf(stderr, "Version: %s \n\n", MARGIN_POLISH_VERSION_H);
+    fprintf(stderr, "Tags the reads and phases the variants of each sample of a cohort, as 'margin phase' does, in\n");
+    fprintf(stderr, "one run sharing the parameters and the reference index, with the chunks of all the samples\n");
+    fprintf(stderr, "processed by one set of threads.\n");
+
+    fprintf(stderr, "\nRequired arguments:\n");
+    fprintf(stderr, "    SAMPLE_SHEET is a file with a line for each sample of its name, the alignment of its reads to\n");
+    fprintf(stderr, "        the reference and its variants, separated by tabs: SAMPLE_NAME ALIGN_BAM VARIANT_VCF.\n");
+    fprintf(stderr, "        Lines starting with '#' are ignored.\n");
+    fprintf(stderr, "    REFERENCE_FASTA is the reference sequence BAM file in fasta format.\n");
+    fprintf(stderr, "    PARAMS is the file with margin parameters.\n");
+
+    fprintf(stderr, "\nDefault options:\n");
+    fprintf(stderr, "    -h --help                : Print this help screen\n");
+    fprintf(stderr, "    -a --logLevel            : Set the log level [default = info]\n");
+# ifdef _OPENMP
+    fprintf(stderr, "    -t --threads             : Set number of concurrent threads [default = 1]\n");
+#endif
+    fprintf(stderr, "    -o --outputBase          : Name to use for output files, those of each sample being named\n");
+    fprintf(stderr, "                                 OUTPUT_BASE.SAMPLE_NAME [default = 'output']\n");
+    fprintf(stderr, "    -r --region              : If set, will only compute for given chromosomal region\n");
+    fprintf(stderr, "                                 Format: chr:start_pos-end_pos (chr3:2000-3000)\n");
+    fprintf(stderr, "    -p --depth               : Will override the downsampling depth set in PARAMS\n");
+    fprintf(stderr, "    -e --seed                : Seed of the per read hashes choosing the reads kept by downsampling.\n");
+    fprintf(stderr, "                                 Overrides downsamplingSeed in PARAMS\n");
+
+    fprintf(stderr, "\nOutput options:\n");
+    fprintf(stderr, "    -M --skipHaplotypeBAM    : Do not write out phased BAMs\n");
+    fprintf(stderr, "    -V --skipPhasedVCF       : Do not write out phased VCFs\n");
+
+    fprintf(stderr, "\n");
+}
+
+int cohort_main(int argc, char *argv[]) {
+
+    // Parameters / arguments
+    char *logLevelString = stString_copy("critical");
+    char *outputBase = stString_copy("output");
+    char *regionStr = NULL;
+    int numThreads = 1;
+    int64_t maxDepth = -1;
+    int64_t downsamplingSeed = -1;
+    bool shouldOutputHaplotaggedBam = TRUE;
+    bool shouldOutputPhasedVcf = TRUE;
+
+    if (argc < 4) {
+        free(outputBase);
+        free(logLevelString);
+        cohort_usage();
+        return 0;
+    }
+
+    char *sampleSheetFile = argv[1];
+    char *referenceFastaFile = argv[2];
+    char *paramsFile = argv[3];
+
+    // Parse the options
+    while (1) {
+        static struct option long_options[] = {
+                { "help", no_argument, 0, 'h' },
+                { "logLevel", required_argument, 0, 'a' },
+# ifdef _OPENMP
+                { "threads", required_argument, 0, 't'},
+#endif
+                { "outputBase", required_argument, 0, 'o'},
+                { "region", required_argument, 0, 'r'},
+                { "depth", required_argument, 0, 'p'},
+                { "seed", required_argument, 0, 'e'},
+                { "skipHaplotypeBAM", no_argument, 0, 'M'},
+                { "skipPhasedVCF", no_argument, 0, 'V'},
+                { 0, 0, 0, 0 } };
+
+        int option_index = 0;
+        int key = getopt_long(argc-3, &argv[3], "ha:o:p:e:t:r:MV", long_options, &option_index);
+
+        if (key == -1) {
+            break;
+        }
+
+        switch (key) {
+        case 'a':
+            free(logLevelString);
+            logLevelString = stString_copy(optarg);
+            break;
+        case 'h':
+            cohort_usage();
+            return 0;
+        case 'o':
+            free(outputBase);
+            outputBase = getFileBase(optarg, "output");
+            break;
+        case 'r':
+            regionStr = stString_copy(optarg);
+            break;
+        case 'p':
+            maxDepth = atoi(optarg);
+            if (maxDepth < 0) {
+                st_errAbort("Invalid maxDepth: %s", optarg);
+            }
+            break;
+        case 'e':
+            downsamplingSeed = atoll(optarg);
+            if (downsamplingSeed < 0) {
+                st_errAbort("Invalid seed: %s", optarg);
+            }
+            break;
+        case 't':
+            numThreads = atoi(optarg);
+            if (numThreads <= 0) {
+                st_errAbort("Invalid thread count: %d", numThreads);
+            }
+            break;
+        case 'M':
+            shouldOutputHaplotaggedBam = FALSE;
+            break;
+        case 'V':
+            shouldOutputPhasedVcf = FALSE;
+            break;
+        default:
+            cohort_usage();
+            free(outputBase);
+            free(logLevelString);
+            return 0;
+        }
+    }
+
+    // sanity checks
+    if (!shouldOutputHaplotaggedBam && !shouldOutputPhasedVcf) {
+        st_errAbort("With --skipHaplotypeBAM and --skipPhasedVCF there will be no output.\n");
+    }
+    if (access(referenceFastaFile, R_OK) != 0) {
+        st_errAbort("Could not read from reference fastafile: %s\n", referenceFastaFile);
+    }
+    if (access(paramsFile, R_OK) != 0) {
+        st_errAbort("Could not read from params file: %s\n", paramsFile);
+    }
+
+    // Initialization from arguments
+    time_t startTime = time(NULL);
+    st_setLogLevelFromString(logLevelString);
+    free(logLevelString);
+    if (st_getLogLevel() >= info) {
+        st_setCallocDebug(true);
+    }
+# ifdef _OPENMP
+    omp_set_num_threads(numThreads);
+    st_logCritical("Running OpenMP with %d threads.\n", omp_get_max_threads());
+    # endif
+
+    // the samples
+    stList *samples = cohort_readSampleSheet(sampleSheetFile, outputBase);
+    st_logCritical("> Phasing %"PRId64" samples from %s\n", stList_length(samples), sampleSheetFile);
+
+    // Parse parameters, once for all the samples
+    st_logCritical("> Parsing model parameters from file: %s\n", paramsFile);
+    Params *params = params_readParams(paramsFile);
+    hugePages_setEnabled(params->polishParams->useHugePages);
+    if (maxDepth >= 0) {
+        st_logCritical("> Changing maxDepth parameter from %"PRId64" to %"PRId64"\n", params->polishParams->maxDepth,
+                       maxDepth);
+        params->polishParams->maxDepth = (uint64_t) maxDepth;
+    }
+    if (downsamplingSeed >= 0) {
+        st_logCritical("> Changing downsamplingSeed parameter from %"PRIu64" to %"PRId64"\n",
+                       params->polishParams->downsamplingSeed, downsamplingSeed);
+        params->polishParams->downsamplingSeed = (uint64_t) downsamplingSeed;
+    }
+
+    // the chunks of the samples are interleaved, so each sample is stitched once all the chunks are done, from
+    // in-memory output whose temporary file names would otherwise be shared between the samples
+    params->polishParams->stitchOnline = FALSE;
+    params->polishParams->maxInMemoryOutputBytes = 0;
+
+    // phasing enumerates the reads as they are chunked, so the alignments have to be read
+    params->polishParams->estimateChunkDepthFromIndex = FALSE;
+    if (params->polishParams->chunkDepthSummaryFile != NULL) {
+        free(params->polishParams->chunkDepthSummaryFile);
+        params->polishParams->chunkDepthSummaryFile = NULL;
+    }
+    if (st_getLogLevel() == debug) {
+        params_printParameters(params, stderr);
+    }
+
+    // the variants and chunks of each sample
+    int64_t chunkCount = 0, maxSampleChunkCount = 0;
+    for (int64_t s = 0; s < stList_length(samples); s++) {
+        CohortSample *sample = stList_get(samples, s);
+        time_t sampleStart = time(NULL);
+        sample->vcfEntries = parseVcf2(sample->vcfFile, regionStr, params);
+        stList *vcfContigsTmp = stHash_getKeys(sample->vcfEntries);
+        stSet *vcfContigs = stSet_construct3(stHash_stringKey, stHash_stringEqualKey, NULL);
+        for (int64_t i = 0; i < stList_length(vcfContigsTmp); i++) {
+            stSet_insert(vcfContigs, stList_get(vcfContigsTmp, i));
+        }
+        sample->bamChunker = bamChunker_construct3(sample->bamInFile, regionStr, vcfContigs, sample->vcfEntries,
+                                                   params->polishParams, TRUE);
+        bamChunker_setCramReference(sample->bamChunker, referenceFastaFile);
+        stList_destruct(vcfContigsTmp);
+        stSet_destruct(vcfContigs);
+        st_logCritical("> Set up sample %s in %"PRId64"s, with %"PRId64" chunks\n", sample->name,
+                       time(NULL) - sampleStart, (int64_t) sample->bamChunker->chunkCount);
+        if (sample->bamChunker->chunkCount == 0) {
+            st_logCritical("> WARNING: Found no valid reads for sample %s\n", sample->name);
+        }
+
+        sample->outputChunkers = outputChunkers_construct(numThreads, params, NULL, NULL, NULL, NULL, ".hap1", ".hap2",
+                                                          TRUE);
+        // the supports of the reads in the chunk overlaps, kept for as many of the sample's chunks as may be in flight
+        sample->overlapSupportCache = params->polishParams->reuseOverlapAlleleSupports ?
+                overlapSupportCache_construct(2 * numThreads) : NULL;
+        sample->allReadIdsHap1 = stList_construct3(0, free);
+        sample->allReadIdsHap2 = stList_construct3(0, free);
+        sample->chunkWasSwitched = st_calloc(sample->bamChunker->chunkCount, sizeof(bool));
+        chunkCount += sample->bamChunker->chunkCount;
+        if (sample->bamChunker->chunkCount > maxSampleChunkCount) {
+            maxSampleChunkCount = sample->bamChunker->chunkCount;
+        }
+    }
+
+    // the (sample, chunk) pairs, with the chunks of the samples interleaved so a small sample does not leave threads
+    // idle, (may) be ordered with the largest first
+    stList *chunkOrder = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
+    for (int64_t i = 0; i < maxSampleChunkCount; i++) {
+        for (int64_t s = 0; s < stList_length(samples); s++) {
+            if (i < ((CohortSample *) stList_get(samples, s))->bamChunker->chunkCount) {
+                stList_append(chunkOrder, stIntTuple_construct2(s, i));
+            }
+        }
+    }
+    if (params->polishParams->shuffleChunks) {
+        if (params->polishParams->shuffleChunksMethod == SCM_RANDOM) {
+            st_logCritical("> Randomly shuffling chunks\n");
+            stList_shuffle(chunkOrder);
+        } else {
+            st_logCritical("> Ordering chunks by estimated depth\n");
+            stList_sort2(chunkOrder, cohort_cmpChunkDepth, samples);
+            stList_reverse(chunkOrder);
+        }
+    }
+
+    // multiproccess the chunks of all the samples
+    st_logCritical("> Setup complete, phasing %"PRId64" chunks\n", chunkCount);
+    if (params->polishParams->bufferedLogging) {
+        logBuffer_start(stderr);
+    }
+    time_t phasingStart = time(NULL);
+    # ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic,1)
+    # endif
+    for (int64_t i = 0; i < stList_length(chunkOrder); i++) {
+        stIntTuple *sampleChunk = stList_get(chunkOrder, i);
+        cohort_phaseChunk(stList_get(samples, stIntTuple_get(sampleChunk, 0)), stIntTuple_get(sampleChunk, 1),
+                          referenceFastaFile, params);
+    }
+    logBuffer_finish();
+    char *tds = getTimeDescriptorFromSeconds((int) (time(NULL) - phasingStart));
+    st_logCritical("> Phased the chunks of all samples in %s\n", tds);
+    free(tds);
+
+    // write the output of each sample
+    for (int64_t s = 0; s < stList_length(samples); s++) {
+        cohort_writeSampleOutput(stList_get(samples, s), regionStr, params, shouldOutputHaplotaggedBam,
+                                 shouldOutputPhasedVcf);
+    }
+
+    // cleanup
+    stList_destruct(chunkOrder);
+    stList_destruct(samples);
+    params_destruct(params);
+    if (regionStr != NULL) free(regionStr);
+    free(outputBase);
+
+    tds = getTimeDescriptorFromSeconds((int) (time(NULL) - startTime));
+    st_logCritical("> Finished phasing the cohort in %s.\n", tds);
+    free(tds);
+    return 0;
+}
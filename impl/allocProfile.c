@@ -0,0 +1,252 @@
+/*
+ * Copyright (C) 2020 by Benedict Paten (benedictpaten@gmail.com)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include <pthread.h>
+#include "margin.h"
+
+/*
+ * Allocation profiling, see allocProfile_scope. The live allocations are kept in a table sharded by address, so the
+ * allocations carry no header and memory allocated or freed outside the profiler is never misread.
+ */
+
+#ifdef MARGIN_ALLOC_PROFILE
+
+// the profiler's own memory is from the heap
+#undef st_malloc
+#undef st_calloc
+#undef st_realloc
+#undef free
+
+static const char *allocProfileTagNames[APT_TAGS] = {"other", "aligner", "poa", "bubbleGraph", "phasing", "io",
+                                                      "stitching"};
+
+typedef struct _allocProfileCounts {
+    int64_t allocations;
+    int64_t bytes;
+    int64_t liveBytes;
+    int64_t peakLiveBytes;
+    int64_t lifetimes[ALLOC_PROFILE_LIFETIME_BUCKETS]; // of the allocations freed, by the thread freeing them
+} AllocProfileCounts;
+
+static void allocProfileCounts_print(FILE *fh, AllocProfileCounts *counts) {
+    fprintf(fh, ", \"allocations\": {");
+    for (int64_t i = 0; i < APT_TAGS; i++) {
+        AllocProfileCounts *c = &counts[i];
+        fprintf(fh, "%s\"%s\": {\"count\": %" PRId64 ", \"bytes\": %" PRId64 ", \"peakLiveBytes\": %" PRId64
+                    ", \"lifetimes\": [", i == 0 ? "" : ", ", allocProfileTagNames[i], c->allocations, c->bytes,
+                c->peakLiveBytes);
+        for (int64_t j = 0; j < ALLOC_PROFILE_LIFETIME_BUCKETS; j++) {
+            fprintf(fh, "%s%" PRId64, j == 0 ? "" : ", ", c->lifetimes[j]);
+        }
+        fprintf(fh, "]}");
+    }
+    fprintf(fh, "}");
+}
+
+// shards of the table of live allocations, each with its own lock
+#define ALLOC_PROFILE_SHARDS 256
+
+typedef struct _allocProfileRecord {
+    size_t size;
+    double time;
+    AllocProfileTag tag;
+} AllocProfileRecord;
+
+typedef struct _allocProfileShard {
+    pthread_mutex_t mutex;
+    stHash *records; // pointers to their AllocProfileRecord
+} AllocProfileShard;
+
+static bool allocProfileStarted = FALSE;
+static AllocProfileShard allocProfileShards[ALLOC_PROFILE_SHARDS];
+static AllocProfileCounts runAllocProfileCounts[APT_TAGS];
+
+static __thread AllocProfileTag threadAllocProfileTag = APT_OTHER;
+static __thread AllocProfileCounts threadAllocProfileCounts[APT_TAGS];
+
+static double allocProfile_getTime() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double) time.tv_sec + (double) time.tv_nsec / 1.0e9;
+}
+
+static AllocProfileShard *allocProfile_getShard(void *ptr) {
+    // the low bits of heap addresses are alignment, so are dropped before hashing
+    uint64_t h = ((uint64_t) ptr >> 4) * 0x9E3779B97F4A7C15ULL;
+    return &allocProfileShards[h >> 56];
+}
+
+static void allocProfile_addLiveBytes(AllocProfileCounts *counts, int64_t bytes, bool atomic) {
+    if (!atomic) {
+        counts->liveBytes += bytes;
+        counts->peakLiveBytes = counts->liveBytes > counts->peakLiveBytes ? counts->liveBytes : counts->peakLiveBytes;
+        return;
+    }
+    int64_t liveBytes = __atomic_add_fetch(&counts->liveBytes, bytes, __ATOMIC_RELAXED);
+    int64_t peakLiveBytes = __atomic_load_n(&counts->peakLiveBytes, __ATOMIC_RELAXED);
+    while (liveBytes > peakLiveBytes && !__atomic_compare_exchange_n(&counts->peakLiveBytes, &peakLiveBytes, liveBytes,
+                                                                      FALSE, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static void allocProfile_recordAllocation(AllocProfileTag tag, int64_t bytes) {
+    AllocProfileCounts *c = &threadAllocProfileCounts[tag];
+    c->allocations++;
+    c->bytes += bytes;
+    allocProfile_addLiveBytes(c, bytes, FALSE);
+    c = &runAllocProfileCounts[tag];
+    __atomic_fetch_add(&c->allocations, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&c->bytes, bytes, __ATOMIC_RELAXED);
+    allocProfile_addLiveBytes(c, bytes, TRUE);
+}
+
+static void allocProfile_recordFree(AllocProfileRecord *record, bool counted) {
+    /*
+     * Takes the record's allocation off the live bytes, counting its lifetime if it was freed by the program rather
+     * than found stale.
+     */
+    allocProfile_addLiveBytes(&threadAllocProfileCounts[record->tag], -((int64_t) record->size), FALSE);
+    allocProfile_addLiveBytes(&runAllocProfileCounts[record->tag], -((int64_t) record->size), TRUE);
+    if (counted) {
+        double lifetime = allocProfile_getTime() - record->time;
+        int64_t bucket = 0;
+        for (double limit = 1.0e-6; bucket < ALLOC_PROFILE_LIFETIME_BUCKETS - 1 && lifetime >= limit; limit *= 10.0) {
+            bucket++;
+        }
+        threadAllocProfileCounts[record->tag].lifetimes[bucket]++;
+        __atomic_fetch_add(&runAllocProfileCounts[record->tag].lifetimes[bucket], 1, __ATOMIC_RELAXED);
+    }
+}
+
+static void allocProfile_insert(void *ptr, size_t size, AllocProfileRecord *record) {
+    /*
+     * Records the allocation, with the given record, or a new one of the thread's tag if NULL.
+     */
+    if (record == NULL) {
+        record = malloc(sizeof(AllocProfileRecord));
+        record->time = allocProfile_getTime();
+        record->tag = threadAllocProfileTag;
+        record->size = 0;
+    }
+    allocProfile_recordAllocation(record->tag, (int64_t) size - (int64_t) record->size);
+    record->size = size;
+    AllocProfileShard *shard = allocProfile_getShard(ptr);
+    pthread_mutex_lock(&shard->mutex);
+    // a record at the address is of memory freed where the profiler could not see it
+    AllocProfileRecord *staleRecord = stHash_remove(shard->records, ptr);
+    stHash_insert(shard->records, ptr, record);
+    pthread_mutex_unlock(&shard->mutex);
+    if (staleRecord != NULL) {
+        allocProfile_recordFree(staleRecord, FALSE);
+        free(staleRecord);
+    }
+}
+
+static AllocProfileRecord *allocProfile_remove(void *ptr) {
+    AllocProfileShard *shard = allocProfile_getShard(ptr);
+    pthread_mutex_lock(&shard->mutex);
+    AllocProfileRecord *record = stHash_remove(shard->records, ptr);
+    pthread_mutex_unlock(&shard->mutex);
+    return record;
+}
+
+AllocProfileTag allocProfile_push(AllocProfileTag tag) {
+    AllocProfileTag previousTag = threadAllocProfileTag;
+    threadAllocProfileTag = tag;
+    return previousTag;
+}
+
+void allocProfile_pop(AllocProfileTag *previousTag) {
+    threadAllocProfileTag = *previousTag;
+}
+
+void *allocProfile_malloc(size_t size) {
+    void *ptr = st_malloc(size);
+    if (allocProfileStarted) allocProfile_insert(ptr, size, NULL);
+    return ptr;
+}
+
+void *allocProfile_calloc(size_t n, size_t size) {
+    void *ptr = st_calloc(n, size);
+    if (allocProfileStarted) allocProfile_insert(ptr, n * size, NULL);
+    return ptr;
+}
+
+void *allocProfile_realloc(void *ptr, size_t size) {
+    // the reallocation keeps the tag and start of the lifetime of the allocation
+    AllocProfileRecord *record = ptr == NULL || !allocProfileStarted ? NULL : allocProfile_remove(ptr);
+    void *newPtr = st_realloc(ptr, size);
+    if (record != NULL) {
+        allocProfile_insert(newPtr, size, record);
+    } else if (allocProfileStarted) {
+        allocProfile_insert(newPtr, size, NULL);
+    }
+    return newPtr;
+}
+
+void allocProfile_free(void *ptr) {
+    if (ptr != NULL && allocProfileStarted) {
+        AllocProfileRecord *record = allocProfile_remove(ptr);
+        if (record != NULL) {
+            allocProfile_recordFree(record, TRUE);
+            free(record);
+        }
+    }
+    free(ptr);
+}
+
+void allocProfile_start() {
+    if (allocProfileStarted) {
+        st_errAbort("The allocation profiler is already started\n");
+    }
+    for (int64_t i = 0; i < ALLOC_PROFILE_SHARDS; i++) {
+        pthread_mutex_init(&allocProfileShards[i].mutex, NULL);
+        allocProfileShards[i].records = stHash_construct2(NULL, free);
+    }
+    memset(runAllocProfileCounts, 0, sizeof(runAllocProfileCounts));
+    allocProfileStarted = TRUE;
+}
+
+void allocProfile_finish() {
+    if (!allocProfileStarted) {
+        return;
+    }
+    allocProfileStarted = FALSE;
+    for (int64_t i = 0; i < ALLOC_PROFILE_SHARDS; i++) {
+        stHash_destruct(allocProfileShards[i].records);
+        pthread_mutex_destroy(&allocProfileShards[i].mutex);
+    }
+}
+
+void allocProfile_startChunk() {
+    memset(threadAllocProfileCounts, 0, sizeof(threadAllocProfileCounts));
+}
+
+void allocProfile_printChunk(FILE *fh) {
+    if (allocProfileStarted) allocProfileCounts_print(fh, threadAllocProfileCounts);
+}
+
+void allocProfile_printRun(FILE *fh) {
+    if (allocProfileStarted) allocProfileCounts_print(fh, runAllocProfileCounts);
+}
+
+#else
+
+void allocProfile_start() {
+}
+
+void allocProfile_finish() {
+}
+
+void allocProfile_startChunk() {
+}
+
+void allocProfile_printChunk(FILE *fh) {
+}
+
+void allocProfile_printRun(FILE *fh) {
+}
+
+#endif
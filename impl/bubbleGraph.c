@@ -23,7 +23,7 @@ int64_t bubble_getReferenceAlleleIndex(Bubble *b) {
 double rleString_calcLogProb(RleString *allele, PolishParams *p) {
     double lProb = 0.0;
     for (int64_t i = 0; i < allele->length; i++) {
-        lProb += log(0.25) + log(0.01) + 2.3025 * p->repeatSubMatrix->baseLogProbs_AT[allele->repeatCounts[i]];
+        lProb += log(0.25) + log(0.01) + 2.3025 * p->repeatSubMatrix->baseLogProbs_AT[rleString_getRepeatCount(allele, i)];
     }
     return lProb;
 }
@@ -311,9 +311,87 @@ bool maxCandidateDeleteLength(PoaNode *node, double candidateWeight) {
     return maxDeleteLength;
 }
 
-static bool containsString(stList *strings, char *s) {
-    for (int64_t i = 0; i < stList_length(strings); i++) {
-        if (stString_eq(stList_get(strings, i), s)) {
+/*
+ * A candidate consensus substring, represented without building it: the string is the node's prefix followed by its
+ * suffix string with the first "skip" characters removed (by a deletion). Suffixes are shared between the candidates
+ * that extend them, and the empty string is represented by NULL.
+ */
+typedef struct _candidateSubstring CandidateSubstring;
+struct _candidateSubstring {
+    char *prefix;
+    int64_t prefixLength;
+    int64_t skip;
+    CandidateSubstring *suffix;
+    int64_t length; // Length of the complete string
+};
+
+static CandidateSubstring *candidateSubstring_construct(char *prefix, int64_t skip, CandidateSubstring *suffix,
+                                                        stList *pool) {
+    /*
+     * Makes a candidate substring, taking ownership of the prefix. The candidate is freed with the pool.
+     */
+    CandidateSubstring *c = st_malloc(sizeof(CandidateSubstring));
+    c->prefix = prefix;
+    c->prefixLength = strlen(prefix);
+    c->skip = skip;
+    c->suffix = suffix;
+    int64_t suffixLength = (suffix == NULL ? 0 : suffix->length) - skip;
+    c->length = c->prefixLength + (suffixLength > 0 ? suffixLength : 0);
+    stList_append(pool, c);
+    return c;
+}
+
+static void candidateSubstring_destruct(CandidateSubstring *c) {
+    free(c->prefix);
+    free(c);
+}
+
+typedef struct _candidateSubstringCursor {
+    CandidateSubstring *node;
+    int64_t i; // Position in the node's prefix, continuing into its suffix if past the end of the prefix
+} CandidateSubstringCursor;
+
+static char candidateSubstringCursor_next(CandidateSubstringCursor *cursor) {
+    /*
+     * Returns the next character of the candidate substring, or '\0' at its end.
+     */
+    while (cursor->node != NULL) {
+        if (cursor->i < cursor->node->prefixLength) {
+            return cursor->node->prefix[cursor->i++];
+        }
+        cursor->i = cursor->i - cursor->node->prefixLength + cursor->node->skip;
+        cursor->node = cursor->node->suffix;
+    }
+    return '\0';
+}
+
+static char *candidateSubstring_getString(CandidateSubstring *c) {
+    char *s = st_malloc(sizeof(char) * ((c == NULL ? 0 : c->length) + 1));
+    CandidateSubstringCursor cursor = { c, 0 };
+    int64_t j = 0;
+    while ((s[j] = candidateSubstringCursor_next(&cursor)) != '\0') {
+        j++;
+    }
+    return s;
+}
+
+static bool candidateSubstring_equal(CandidateSubstring *c1, CandidateSubstring *c2) {
+    if ((c1 == NULL ? 0 : c1->length) != (c2 == NULL ? 0 : c2->length)) {
+        return 0;
+    }
+    CandidateSubstringCursor cursor1 = { c1, 0 }, cursor2 = { c2, 0 };
+    char b;
+    while ((b = candidateSubstringCursor_next(&cursor1)) != '\0') {
+        if (b != candidateSubstringCursor_next(&cursor2)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static bool containsCandidateSubstring(stList *candidates, CandidateSubstring *c) {
+    for (int64_t i = 0; i < stList_length(candidates); i++) {
+        if (candidateSubstring_equal(stList_get(candidates, i), c)) {
             return 1;
         }
     }
@@ -328,118 +406,235 @@ stList *getCandidateConsensusSubstrings(Poa *poa, int64_t from, int64_t to,
      *  string with "high" weight. This function returns all possible combinations of candidate variants,
      *  each as a new consensus substring, for the interval of the reference string from "from" (inclusive)
      *  to "to" (exclusive). Returned list of strings always contains the reference string without edits (the no
-     *  candidate variants string).
+     *  candidate variants string). Returns NULL if there are more than maximumStringNumber combinations.
+     *
+     *  The combinations are extended from the last position backwards, each sharing the suffix it extends, so
+     *  that strings are only built for the returned combinations, and the enumeration stops as soon as there are
+     *  too many.
      */
 
-    // Function is recursive
+    stList *pool = stList_construct3(0, (void (*)(void *)) candidateSubstring_destruct);
 
-    // First get suffix substrings
-    stList *suffixes;
-    if (from + 1 < to) {
-        suffixes = getCandidateConsensusSubstrings(poa, from + 1, to, candidateWeights, weightAdjustment,
-                                                   maximumStringNumber);
+    // Start with the empty string
+    stList *suffixes = stList_construct();
+    stList_append(suffixes, NULL);
 
-        if (suffixes == NULL) { // If too many combinations, return null.
-            return NULL;
-        }
-    } else {
-        suffixes = stList_construct3(0, free);
-        stList_append(suffixes, stString_copy("")); // Start with the empty string
-    }
+    for (int64_t pos = to - 1; pos >= from; pos--) {
+        // Extend the suffixes by adding on prefix variants
+        stList *consensusSubstrings = stList_construct();
 
-    // Now extend by adding on prefix variants
-    stList *consensusSubstrings = stList_construct3(0, free);
+        PoaNode *node = stList_get(poa->nodes, pos);
 
-    PoaNode *node = stList_get(poa->nodes, from);
+        double candidateWeight = candidateWeights[pos] * weightAdjustment;
 
-    double candidateWeight = candidateWeights[from] * weightAdjustment;
+        int64_t i = 0;
+        char base;
+        while ((base = getNextCandidateBase(poa, node, &i, candidateWeight)) !=
+               '-') { // Enumerate the possible bases at the reference node.
 
-    int64_t i = 0;
-    char base;
-    while ((base = getNextCandidateBase(poa, node, &i, candidateWeight)) !=
-           '-') { // Enumerate the possible bases at the reference node.
-
-        int64_t repeatCount, l = 1;
-        while ((repeatCount = getNextCandidateRepeatCount(poa, node, &l, candidateWeight)) !=
-               -1) { // Enumerate the possible repeat counts at the reference node.
-            assert(repeatCount != 0);
-            char *bases = expandChar(base, repeatCount);
-
-            // Create the consensus substrings with no inserts or deletes starting at this node
-            for (int64_t j = 0; j < stList_length(suffixes); j++) {
-                stList_append(consensusSubstrings, stString_print("%s%s", bases, stList_get(suffixes, j)));
-            }
+            int64_t repeatCount, l = 1;
+            while ((repeatCount = getNextCandidateRepeatCount(poa, node, &l, candidateWeight)) !=
+                   -1) { // Enumerate the possible repeat counts at the reference node.
+                assert(repeatCount != 0);
+                char *bases = expandChar(base, repeatCount);
 
-            // Now add insert cases
-            int64_t k = 0;
-            RleString *insert;
-            while ((insert = getNextCandidateInsert(node, &k, candidateWeight)) != NULL) {
-                char *expandedInsert = rleString_expand(insert);
-                assert(strlen(expandedInsert) > 0);
+                // Create the consensus substrings with no inserts or deletes starting at this node
                 for (int64_t j = 0; j < stList_length(suffixes); j++) {
-                    stList_append(consensusSubstrings,
-                                  stString_print("%s%s%s", bases, expandedInsert, stList_get(suffixes, j)));
+                    stList_append(consensusSubstrings, candidateSubstring_construct(stString_copy(bases), 0,
+                                                                                    stList_get(suffixes, j), pool));
                 }
-                free(expandedInsert);
-            }
-
-            // Add then deletes
-            k = 0;
-            int64_t deleteLength;
-            while ((deleteLength = getNextCandidateDelete(node, &k, candidateWeight)) > 0) {
-                for (int64_t j = 0; j < stList_length(suffixes); j++) {
-                    char *suffixHaplotype = stList_get(suffixes, j);
 
-                    // Build new deletion
-                    char *s = stString_print("%s%s", bases,
-                                             ((int64_t) strlen(suffixHaplotype) - deleteLength >= 0)
-                                             ? &(suffixHaplotype[deleteLength]) : "");
+                // Now add insert cases
+                int64_t k = 0;
+                RleString *insert;
+                while ((insert = getNextCandidateInsert(node, &k, candidateWeight)) != NULL) {
+                    char *expandedInsert = rleString_expand(insert);
+                    assert(strlen(expandedInsert) > 0);
+                    for (int64_t j = 0; j < stList_length(suffixes); j++) {
+                        stList_append(consensusSubstrings,
+                                      candidateSubstring_construct(stString_print("%s%s", bases, expandedInsert), 0,
+                                                                   stList_get(suffixes, j), pool));
+                    }
+                    free(expandedInsert);
+                }
 
-                    // Add deletion if not already in the set of consensus strings
-                    if (!containsString(consensusSubstrings, s)) {
-                        stList_append(consensusSubstrings, s);
-                    } else {
-                        free(s);
+                // Add then deletes
+                k = 0;
+                int64_t deleteLength;
+                while ((deleteLength = getNextCandidateDelete(node, &k, candidateWeight)) > 0) {
+                    for (int64_t j = 0; j < stList_length(suffixes); j++) {
+                        // Build new deletion
+                        CandidateSubstring *c = candidateSubstring_construct(stString_copy(bases), deleteLength,
+                                                                             stList_get(suffixes, j), pool);
+
+                        // Add deletion if not already in the set of consensus strings
+                        if (!containsCandidateSubstring(consensusSubstrings, c)) {
+                            stList_append(consensusSubstrings, c);
+                        }
                     }
                 }
+
+                // Cleanup bases
+                free(bases);
             }
+        }
+
+        stList_destruct(suffixes);
+        suffixes = consensusSubstrings;
 
-            // Cleanup bases
-            free(bases);
+        if (stList_length(suffixes) > maximumStringNumber) {
+            // Clean up and return null (too many combinations)
+            stList_destruct(suffixes);
+            stList_destruct(pool);
+            return NULL;
         }
     }
 
+    // Build the strings of the combinations
+    stList *consensusSubstrings = stList_construct3(0, free);
+    for (int64_t j = 0; j < stList_length(suffixes); j++) {
+        stList_append(consensusSubstrings, candidateSubstring_getString(stList_get(suffixes, j)));
+    }
+
     // Clean up
     stList_destruct(suffixes);
+    stList_destruct(pool);
+
+    return consensusSubstrings;
+}
+
+/*
+ * The aligned offset of a read at a poa node.
+ */
+typedef struct _readAnchor {
+    int64_t readNo;
+    int64_t offset;
+} ReadAnchor;
+
+/*
+ * An index of the reads aligned to a poa, made once for the bubbles of a chunk, to get the substrings of the reads
+ * between poa positions. For each node it has the anchors of the reads with base observations at the node, using the
+ * heaviest observation of a read with several, in ascending read order. For each read with qualities it has their
+ * prefix sums, so the mean quality of a substring is a difference of two sums.
+ */
+typedef struct _readSubstringIndex {
+    stList *bamChunkReads;
+    int64_t nodeNo;
+    int64_t *nodeAnchorStarts; // The anchors of node i are nodeAnchorStarts[i] to nodeAnchorStarts[i+1] (exclusive)
+    ReadAnchor *anchors;
+    int64_t **qualityPrefixSums; // For each read, NULL if it has no qualities
+} ReadSubstringIndex;
+
+static ReadSubstringIndex *readSubstringIndex_construct(stList *bamChunkReads, Poa *poa) {
+    ReadSubstringIndex *index = st_malloc(sizeof(ReadSubstringIndex));
+    int64_t readNo = stList_length(bamChunkReads);
+    index->bamChunkReads = bamChunkReads;
+    index->nodeNo = stList_length(poa->nodes);
+
+    // counting sort the observations by read, in node order within each read
+    int64_t *readStarts = st_calloc(readNo + 1, sizeof(int64_t));
+    for (int64_t i = 0; i < index->nodeNo; i++) {
+        int64_t observationNo;
+        PoaBaseObservation *observations = poa_getNodeObservations(poa, i, &observationNo);
+        for (int64_t k = 0; k < observationNo; k++) {
+            readStarts[observations[k].readNo + 1]++;
+        }
+    }
+    for (int64_t r = 0; r < readNo; r++) {
+        readStarts[r + 1] += readStarts[r];
+    }
+    int64_t *readNodes = st_malloc((readStarts[readNo] + 1) * sizeof(int64_t));
+    PoaBaseObservation **readObservations = st_malloc((readStarts[readNo] + 1) * sizeof(PoaBaseObservation *));
+    int64_t *cursors = st_malloc((readNo + 1) * sizeof(int64_t));
+    memcpy(cursors, readStarts, (readNo + 1) * sizeof(int64_t));
+    for (int64_t i = 0; i < index->nodeNo; i++) {
+        int64_t observationNo;
+        PoaBaseObservation *observations = poa_getNodeObservations(poa, i, &observationNo);
+        for (int64_t k = 0; k < observationNo; k++) {
+            int64_t j = cursors[observations[k].readNo]++;
+            readNodes[j] = i;
+            readObservations[j] = &observations[k];
+        }
+    }
+
+    // then by node, taking the reads in order, with one anchor per read at a node
+    index->nodeAnchorStarts = st_calloc(index->nodeNo + 1, sizeof(int64_t));
+    for (int64_t r = 0; r < readNo; r++) {
+        for (int64_t j = readStarts[r]; j < readStarts[r + 1]; j++) {
+            if (j == readStarts[r] || readNodes[j] != readNodes[j - 1]) {
+                index->nodeAnchorStarts[readNodes[j] + 1]++;
+            }
+        }
+    }
+    for (int64_t i = 0; i < index->nodeNo; i++) {
+        index->nodeAnchorStarts[i + 1] += index->nodeAnchorStarts[i];
+    }
+    index->anchors = st_malloc((index->nodeAnchorStarts[index->nodeNo] + 1) * sizeof(ReadAnchor));
+    cursors = st_realloc(cursors, (index->nodeNo + 1) * sizeof(int64_t));
+    memcpy(cursors, index->nodeAnchorStarts, (index->nodeNo + 1) * sizeof(int64_t));
+    for (int64_t r = 0; r < readNo; r++) {
+        double weight = 0.0;
+        for (int64_t j = readStarts[r]; j < readStarts[r + 1]; j++) {
+            PoaBaseObservation *obs = readObservations[j];
+            if (j == readStarts[r] || readNodes[j] != readNodes[j - 1]) {
+                ReadAnchor *anchor = &index->anchors[cursors[readNodes[j]]++];
+                anchor->readNo = r;
+                anchor->offset = obs->offset;
+                weight = obs->weight;
+            } else if (obs->weight > weight) {
+                index->anchors[cursors[readNodes[j]] - 1].offset = obs->offset;
+                weight = obs->weight;
+            }
+        }
+    }
 
-    if (stList_length(consensusSubstrings) > maximumStringNumber) {
-        // Clean up and return null (too many combinations)
-        stList_destruct(consensusSubstrings);
-        return NULL;
+    // the quality prefix sums
+    index->qualityPrefixSums = st_calloc(readNo, sizeof(int64_t *));
+    for (int64_t r = 0; r < readNo; r++) {
+        BamChunkRead *bamChunkRead = stList_get(bamChunkReads, r);
+        if (bamChunkRead->qualities != NULL) {
+            int64_t *sums = st_malloc((bamChunkRead->rleRead->length + 1) * sizeof(int64_t));
+            sums[0] = 0;
+            for (int64_t i = 0; i < bamChunkRead->rleRead->length; i++) {
+                sums[i + 1] = sums[i] + (int64_t) bamChunkRead->qualities[i];
+            }
+            index->qualityPrefixSums[r] = sums;
+        }
     }
 
-    return consensusSubstrings;
+    free(readStarts);
+    free(readNodes);
+    free(readObservations);
+    free(cursors);
+    return index;
 }
 
-BamChunkReadSubstring *
-bamChunkRead_getSubstring(BamChunkRead *bamChunkRead, int64_t start, int64_t length, PolishParams *params) {
+static void readSubstringIndex_destruct(ReadSubstringIndex *index) {
+    for (int64_t r = 0; r < stList_length(index->bamChunkReads); r++) {
+        free(index->qualityPrefixSums[r]);
+    }
+    free(index->qualityPrefixSums);
+    free(index->nodeAnchorStarts);
+    free(index->anchors);
+    free(index);
+}
+
+static BamChunkReadSubstring *readSubstringIndex_getSubstring(ReadSubstringIndex *index, int64_t readNo, int64_t start,
+                                                              int64_t length) {
     assert(length >= 0);
 
-    BamChunkReadSubstring *rs = st_calloc(1, sizeof(BamChunkReadSubstring));
+    BamChunkReadSubstring *rs = chunkArena_calloc(1, sizeof(BamChunkReadSubstring));
 
     // Basic attributes
-    rs->read = bamChunkRead;
+    rs->read = stList_get(index->bamChunkReads, readNo);
     rs->start = start;
     rs->length = length;
     rs->substring = NULL;
 
     // Calculate the qual value
-    if (bamChunkRead->qualities != NULL) {
-        int64_t j = 0;
-        for (int64_t i = 0; i < length; i++) {
-            j += (int64_t) bamChunkRead->qualities[i + start];
-        }
-        rs->qualValue = (double) j / length; // Quals are phred, qual = -10 * log_10(p)
+    int64_t *sums = index->qualityPrefixSums[readNo];
+    if (sums != NULL) {
+        rs->qualValue = (double) (sums[start + length] - sums[start]) / length; // Quals are phred, qual = -10 * log_10(p)
     } else {
         rs->qualValue = -1.0;
     }
@@ -456,40 +651,7 @@ RleString *bamChunkReadSubstring_getRleString(BamChunkReadSubstring *readSubstri
 
 void bamChunkReadSubstring_destruct(BamChunkReadSubstring *rs) {
     if (rs->substring != NULL) rleString_destruct(rs->substring);
-    free(rs);
-}
-
-int poaBaseObservation_cmp(const void *a, const void *b) {
-    PoaBaseObservation *obs1 = (PoaBaseObservation *) a;
-    PoaBaseObservation *obs2 = (PoaBaseObservation *) b;
-    if (obs1->readNo != obs2->readNo) { // Sort first is ascending read number order
-        return obs1->readNo < obs2->readNo ? -1 : 1;
-    }
-    if (obs1->weight != obs2->weight) { // Sort second in descending weight order
-        return obs1->weight > obs2->weight ? -1 : 1;
-    }
-    return 0;
-}
-
-void sortBaseObservations(Poa *poa) {
-    /*
-     * Sort the POA base observations to make them appropriate for getReadSubstrings.
-     */
-    for (int64_t i = 0; i < stList_length(poa->nodes); i++) {
-        PoaNode *node = stList_get(poa->nodes, i);
-        stList_sort(node->observations, poaBaseObservation_cmp);
-    }
-}
-
-int64_t skipDupes(PoaNode *node, int64_t i, int64_t readNo) {
-    while (i < stList_length(node->observations)) {
-        PoaBaseObservation *obs = stList_get(node->observations, i);
-        if (obs->readNo != readNo) {
-            break;
-        }
-        i++;
-    }
-    return i;
+    chunkArena_free(rs);
 }
 
 int readSubstrings_cmpByQual(const void *a, const void *b) {
@@ -520,8 +682,8 @@ stList *filterReadSubstrings(stList *readSubstrings, PolishParams *params) {
     return readSubstrings;
 }
 
-stList *getReadSubstrings2(stList *bamChunkReads, Poa *poa, int64_t from, int64_t to, PolishParams *params,
-        bool shouldFilter) {
+static stList *getReadSubstrings2(ReadSubstringIndex *index, int64_t from, int64_t to, PolishParams *params,
+                                  bool shouldFilter) {
     /*
      * Get the substrings of reads aligned to the interval from (inclusive) to to
      * (exclusive) and their qual values. Adds them to readSubstrings and qualValues, respectively.
@@ -530,74 +692,62 @@ stList *getReadSubstrings2(stList *bamChunkReads, Poa *poa, int64_t from, int64_
 
     // Deal with boundary cases
     if (from == 0) {
-        if (to >= stList_length(poa->nodes)) {
+        if (to >= index->nodeNo) {
             // If from and to reference positions that bound the complete alignment just
             // copy the complete reads
-            for (int64_t i = 0; i < stList_length(bamChunkReads); i++) {
-                BamChunkRead *bamChunkRead = stList_get(bamChunkReads, i);
+            for (int64_t i = 0; i < stList_length(index->bamChunkReads); i++) {
+                BamChunkRead *bamChunkRead = stList_get(index->bamChunkReads, i);
                 stList_append(readSubstrings,
-                              bamChunkRead_getSubstring(bamChunkRead, 0, bamChunkRead->rleRead->length, params));
+                              readSubstringIndex_getSubstring(index, i, 0, bamChunkRead->rleRead->length));
             }
             return shouldFilter ? filterReadSubstrings(readSubstrings, params) : readSubstrings;
         }
 
         // Otherwise, include the read prefixes that end at to
-        PoaNode *node = stList_get(poa->nodes, to);
-        int64_t i = 0;
-        while (i < stList_length(node->observations)) {
-            PoaBaseObservation *obs = stList_get(node->observations, i);
-            BamChunkRead *bamChunkRead = stList_get(bamChunkReads, obs->readNo);
-            // Trim the read substring, copy it and add to the substrings list
-            stList_append(readSubstrings, bamChunkRead_getSubstring(bamChunkRead, 0, obs->offset, params));
-            i = skipDupes(node, ++i, obs->readNo);
+        for (int64_t i = index->nodeAnchorStarts[to]; i < index->nodeAnchorStarts[to + 1]; i++) {
+            ReadAnchor *anchor = &index->anchors[i];
+            stList_append(readSubstrings, readSubstringIndex_getSubstring(index, anchor->readNo, 0, anchor->offset));
         }
         return shouldFilter ? filterReadSubstrings(readSubstrings, params) : readSubstrings;
-    } else if (to >= stList_length(poa->nodes)) {
+    } else if (to >= index->nodeNo) {
         // Finally, include the read suffixs that start at from
-        PoaNode *node = stList_get(poa->nodes, from);
-        int64_t i = 0;
-        while (i < stList_length(node->observations)) {
-            PoaBaseObservation *obs = stList_get(node->observations, i);
-            BamChunkRead *bamChunkRead = stList_get(bamChunkReads, obs->readNo);
-            // Trim the read substring, copy it and add to the substrings list
-            stList_append(readSubstrings, bamChunkRead_getSubstring(bamChunkRead, obs->offset,
-                                                                    bamChunkRead->rleRead->length - obs->offset,
-                                                                    params));
-            i = skipDupes(node, ++i, obs->readNo);
+        for (int64_t i = index->nodeAnchorStarts[from]; i < index->nodeAnchorStarts[from + 1]; i++) {
+            ReadAnchor *anchor = &index->anchors[i];
+            BamChunkRead *bamChunkRead = stList_get(index->bamChunkReads, anchor->readNo);
+            stList_append(readSubstrings, readSubstringIndex_getSubstring(index, anchor->readNo, anchor->offset,
+                                                                          bamChunkRead->rleRead->length -
+                                                                          anchor->offset));
         }
         return shouldFilter ? filterReadSubstrings(readSubstrings, params) : readSubstrings;
     }
 
-    PoaNode *fromNode = stList_get(poa->nodes, from);
-    PoaNode *toNode = stList_get(poa->nodes, to);
+    // merge the anchors of the reads at from and to, both in read order
+    int64_t i = index->nodeAnchorStarts[from], iEnd = index->nodeAnchorStarts[from + 1];
+    int64_t j = index->nodeAnchorStarts[to], jEnd = index->nodeAnchorStarts[to + 1];
+    while (i < iEnd && j < jEnd) {
+        ReadAnchor *anchorFrom = &index->anchors[i];
+        ReadAnchor *anchorTo = &index->anchors[j];
 
-    int64_t i = 0, j = 0;
-    while (i < stList_length(fromNode->observations) && j < stList_length(toNode->observations)) {
-        PoaBaseObservation *obsFrom = stList_get(fromNode->observations, i);
-        PoaBaseObservation *obsTo = stList_get(toNode->observations, j);
-
-        if (obsFrom->readNo == obsTo->readNo) {
-            BamChunkRead *bamChunkRead = stList_get(bamChunkReads, obsFrom->readNo);
-            if (obsTo->offset - obsFrom->offset > 0) { // If a non zero run of bases
+        if (anchorFrom->readNo == anchorTo->readNo) {
+            if (anchorTo->offset - anchorFrom->offset > 0) { // If a non zero run of bases
                 stList_append(readSubstrings,
-                              bamChunkRead_getSubstring(bamChunkRead, obsFrom->offset, obsTo->offset - obsFrom->offset,
-                                                        params));
+                              readSubstringIndex_getSubstring(index, anchorFrom->readNo, anchorFrom->offset,
+                                                              anchorTo->offset - anchorFrom->offset));
             }
-            i = skipDupes(fromNode, ++i, obsFrom->readNo);
-            j = skipDupes(toNode, ++j, obsTo->readNo);
-        } else if (obsFrom->readNo < obsTo->readNo) {
-            i = skipDupes(fromNode, ++i, obsFrom->readNo);
+            i++;
+            j++;
+        } else if (anchorFrom->readNo < anchorTo->readNo) {
+            i++;
         } else {
-            assert(obsFrom->readNo > obsTo->readNo);
-            j = skipDupes(toNode, ++j, obsTo->readNo);
+            j++;
         }
     }
 
     return shouldFilter ? filterReadSubstrings(readSubstrings, params) : readSubstrings;
 }
 
-stList *getReadSubstrings(stList *bamChunkReads, Poa *poa, int64_t from, int64_t to, PolishParams *params) {
-    return getReadSubstrings2(bamChunkReads, poa, from, to, params, TRUE);
+static stList *getReadSubstrings(ReadSubstringIndex *index, int64_t from, int64_t to, PolishParams *params) {
+    return getReadSubstrings2(index, from, to, params, TRUE);
 }
 
 // Code to create anchors
@@ -667,6 +817,23 @@ bool *getCandidateVariantOverlapPositions(Poa *poa, double *candidateWeights) {
     return candidateVariantPositions;
 }
 
+bool *poa_getCandidateVariantPositions(Poa *poa, PolishParams *params) {
+    double *candidateWeights = getCandidateWeights(poa, params);
+    bool *candidateVariantPositions = getCandidateVariantOverlapPositions(poa, candidateWeights);
+    free(candidateWeights);
+    return candidateVariantPositions;
+}
+
+bool poa_hasCandidateVariants(Poa *poa, PolishParams *params) {
+    bool *candidateVariantPositions = poa_getCandidateVariantPositions(poa, params);
+    bool hasCandidateVariants = 0;
+    for (int64_t i = 0; i < stList_length(poa->nodes) && !hasCandidateVariants; i++) {
+        hasCandidateVariants = candidateVariantPositions[i];
+    }
+    free(candidateVariantPositions);
+    return hasCandidateVariants;
+}
+
 bool *expand(bool *b, int64_t length, int64_t expansion) {
     /*
      * Returns a bool array in which a position is non-zero if a position
@@ -790,7 +957,7 @@ int rleString_expandedStringEqualKey(const void *key1, const void *key2) {
         return 0;
     }
     for (int64_t i = 0; i < r1->length; i++) {
-        if (r1->repeatCounts[i] != r2->repeatCounts[i]) {
+        if (rleString_getRepeatCount(r1, i) != rleString_getRepeatCount(r2, i)) {
             return 0;
         }
     }
@@ -834,7 +1001,7 @@ RleString *getConsensusRleString(stList *rleStrings) {
         for (int64_t i = 0; i < stList_length(rleStrings); i++) {
             RleString *s = stList_get(rleStrings, i);
             assert(s->length == r->length);
-            k += s->repeatCounts[j];
+            k += rleString_getRepeatCount(s, j);
         }
         k = roundf(((float) k) / stList_length(rleStrings));
         repeatCounts[j] = k == 0 ? 1 : (k > 255 ? 255 : k);
@@ -882,14 +1049,14 @@ void bubble_destruct(Bubble b) {
     for (int64_t j = 0; j < b.readNo; j++) {
         bamChunkReadSubstring_destruct(b.reads[j]);
     }
-    free(b.reads);
+    chunkArena_free(b.reads);
     // Cleanup the alleles
     for (int64_t j = 0; j < b.alleleNo; j++) {
         rleString_destruct(b.alleles[j]);
     }
-    free(b.alleles);
+    chunkArena_free(b.alleles);
     // Cleanup the allele supports
-    free(b.alleleReadSupports);
+    chunkArena_free(b.alleleReadSupports);
     // Cleanup the reference allele
     rleString_destruct(b.refAllele);
     // cleanup candidate variant positions
@@ -897,14 +1064,359 @@ void bubble_destruct(Bubble b) {
 }
 
 void bubbleGraph_destruct(BubbleGraph *bg) {
-    // Clean up the memory for each bubble
+    // Clean up the memory for each bubble, the allele supports of which are owned by the graph
     for (int64_t i = 0; i < bg->bubbleNo; i++) {
+        bg->bubbles[i].alleleReadSupports = NULL;
         bubble_destruct(bg->bubbles[i]);
     }
     free(bg->bubbles);
+    free(bg->alleleReadSupports);
+    free(bg->reads);
+    free(bg->readIndexOffsets);
+    free(bg->readIndices);
+    free(bg->forwardStrandBits);
     free(bg);
 }
 
+static BubbleGraph *bubbleGraph_construct(RleString *refString, stList *bubbles) {
+    /*
+     * Makes the graph of the given bubbles, whose allele supports have been computed, packing the supports, read
+     * indices and read strands of the bubbles into arrays for the whole graph. Destroys the list of bubbles, but
+     * not the bubbles.
+     */
+    BubbleGraph *bg = st_malloc(sizeof(BubbleGraph));
+    bg->refString = refString;
+
+    // Copy the bubbles
+    bg->bubbleNo = (uint64_t) stList_length(bubbles);
+    bg->bubbles = st_calloc(bg->bubbleNo, sizeof(Bubble)); // allocate bubbles
+    for (int64_t i = 0; i < bg->bubbleNo; i++) {
+        bg->bubbles[i] = *(Bubble *) stList_get(bubbles, i);
+    }
+    stList_destruct(bubbles);
+
+    // Fill in the bubble allele offsets and the offsets of the reads of each bubble
+    uint64_t alleleOffset = 0, supportNo = 0;
+    bg->readIndexOffsets = st_malloc(sizeof(uint64_t) * (bg->bubbleNo + 1));
+    bg->readIndexOffsets[0] = 0;
+    for (int64_t i = 0; i < bg->bubbleNo; i++) {
+        Bubble *b = &(bg->bubbles[i]);
+        b->alleleOffset = alleleOffset;
+        alleleOffset += b->alleleNo;
+        supportNo += b->alleleNo * b->readNo;
+        bg->readIndexOffsets[i + 1] = bg->readIndexOffsets[i] + b->readNo;
+    }
+    bg->totalAlleles = alleleOffset;
+
+    // Move the allele supports into one array, in bubble order
+    bg->alleleReadSupports = st_malloc(sizeof(float) * (supportNo + 1));
+    float *supports = bg->alleleReadSupports;
+    for (int64_t i = 0; i < bg->bubbleNo; i++) {
+        Bubble *b = &(bg->bubbles[i]);
+        memcpy(supports, b->alleleReadSupports, sizeof(float) * b->alleleNo * b->readNo);
+        chunkArena_free(b->alleleReadSupports);
+        b->alleleReadSupports = supports;
+        supports += b->alleleNo * b->readNo;
+    }
+
+    // Give each read a dense index, in the order they are first seen, and record the index of each read of each
+    // bubble
+    bg->readIndices = st_malloc(sizeof(uint64_t) * (bg->readIndexOffsets[bg->bubbleNo] + 1));
+    stHash *readsToIndices = stHash_construct2(NULL, free);
+    stList *reads = stList_construct();
+    for (int64_t i = 0; i < bg->bubbleNo; i++) {
+        Bubble *b = &(bg->bubbles[i]);
+        for (int64_t j = 0; j < b->readNo; j++) {
+            BamChunkRead *read = b->reads[j]->read;
+            assert(read != NULL);
+            uint64_t *k = stHash_search(readsToIndices, read);
+            if (k == NULL) {
+                k = st_malloc(sizeof(uint64_t));
+                *k = stList_length(reads);
+                stHash_insert(readsToIndices, read, k);
+                stList_append(reads, read);
+            }
+            bg->readIndices[bg->readIndexOffsets[i] + j] = *k;
+        }
+    }
+    stHash_destruct(readsToIndices);
+
+    // The reads, by index, and their strands
+    bg->readNo = (uint64_t) stList_length(reads);
+    bg->reads = st_malloc(sizeof(BamChunkRead *) * (bg->readNo + 1));
+    bg->forwardStrandBits = st_calloc(bg->readNo / 64 + 1, sizeof(uint64_t));
+    for (uint64_t i = 0; i < bg->readNo; i++) {
+        bg->reads[i] = stList_get(reads, i);
+        if (bg->reads[i]->forwardStrand) {
+            bg->forwardStrandBits[i / 64] |= ((uint64_t) 1) << (i % 64);
+        }
+    }
+    stList_destruct(reads);
+
+    return bg;
+}
+
+
+/*
+ * Sets the log-likelihoods of the kth read of the bubble for each of the alleles of the bubble.
+ */
+static void bubble_setReadAlleleSupports(Bubble *b, int64_t k, SymbolString *alleleSymbolStrings, SymbolString rS,
+                                         StateMachine *sM, PolishParams *params) {
+    double logProbs[b->alleleNo];
+    computeForwardProbabilities(alleleSymbolStrings, b->alleleNo, rS, params->p, sM, 0, 0,
+                                params->alleleScoringBailOutMargin, logProbs);
+    for (int64_t j = 0; j < b->alleleNo; j++) {
+        b->alleleReadSupports[j * b->readNo + k] = (float) logProbs[j];
+    }
+}
+
+/*
+ * The edit distance between two symbol strings, the cheap score of a read substring against an allele used by
+ * bubble_setAlleleReadSupports.
+ */
+static int64_t symbolString_editDistance(SymbolString s1, SymbolString s2) {
+    int64_t *row = st_malloc((s2.length + 1) * sizeof(int64_t));
+    for (int64_t j = 0; j <= s2.length; j++) {
+        row[j] = j;
+    }
+    for (int64_t i = 1; i <= s1.length; i++) {
+        int64_t diagonal = row[0];
+        row[0] = i;
+        for (int64_t j = 1; j <= s2.length; j++) {
+            int64_t d = diagonal + (s1.sequence[i - 1] != s2.sequence[j - 1] ? 1 : 0);
+            d = row[j] + 1 < d ? row[j] + 1 : d;
+            d = row[j - 1] + 1 < d ? row[j - 1] + 1 : d;
+            diagonal = row[j];
+            row[j] = d;
+        }
+    }
+    int64_t editDistance = row[s2.length];
+    free(row);
+    return editDistance;
+}
+
+/*
+ * Gets the edit distance of the read substring to each of the alleles, returning TRUE if the closest allele is closer
+ * than every other allele by more than params->alleleScoringPrescoreMargin, so the read clearly supports it.
+ */
+static bool bubble_prescoreRead(Bubble *b, SymbolString *alleleSymbolStrings, SymbolString rS, PolishParams *params,
+                                int64_t *editDistances) {
+    int64_t best = 0;
+    for (int64_t j = 0; j < b->alleleNo; j++) {
+        editDistances[j] = symbolString_editDistance(alleleSymbolStrings[j], rS);
+        best = editDistances[j] < editDistances[best] ? j : best;
+    }
+    for (int64_t j = 0; j < b->alleleNo; j++) {
+        if (j != best && editDistances[j] - editDistances[best] <= params->alleleScoringPrescoreMargin) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Sets the alleleReadSupports of the bubble. Reads with the same substring, on the same strand, have
+ * the same supports, so each such substring is only scored once. If supportsSet is not NULL, the reads
+ * it flags already have their supports and are skipped. Returns the number of reads whose supports
+ * were copied from an earlier read, and sets prescoredReads to the number whose supports were calibrated from their
+ * edit distances rather than scored.
+ *
+ * If params->alleleScoringPrescoreMargin is positive each substring is first scored against the alleles by edit
+ * distance. Those whose closest allele is not clear from it, and the first substring, are scored by the forward
+ * algorithm; the others get supports calibrated from these: the mean log-likelihood of their closest allele, less the
+ * mean log-likelihood lost per extra edit for each edit more an allele needs. If the forward scored substrings give
+ * no calibration, as when they are equally distant from every allele, every substring is scored by the forward
+ * algorithm.
+ */
+static int64_t bubble_setAlleleReadSupports(Bubble *b, PolishParams *params, uint64_t maxRepeatCount,
+                                            bool *supportsSet, int64_t *prescoredReads) {
+    SymbolString alleleSymbolStrings[b->alleleNo];
+    for (int64_t j = 0; j < b->alleleNo; j++) {
+        alleleSymbolStrings[j] = rleString_constructSymbolString(b->alleles[j], 0, b->alleles[j]->length,
+                                                                 params->alphabet, params->useRepeatCountsInAlignment,
+                                                                 maxRepeatCount);
+    }
+
+    // Scores cached for read substrings on the reverse and forward strands, respectively
+    stHash *cachedScores[2];
+    for (int64_t i = 0; i < 2; i++) {
+        cachedScores[i] = stHash_construct3(rleString_stringKey, rleString_expandedStringEqualKey,
+                                            (void (*)(void *)) rleString_destruct, free);
+    }
+
+    // With prescoring, the edit distances of each read substring to the alleles, the reads left to score once the
+    // calibration is known, and the sums of the calibration
+    bool prescore = params->alleleScoringPrescoreMargin > 0 && b->alleleNo > 1;
+    int64_t *editDistances = prescore ? st_malloc(b->readNo * b->alleleNo * sizeof(int64_t)) : NULL;
+    bool *prescored = prescore ? st_calloc(b->readNo, sizeof(bool)) : NULL;
+    int64_t scoredNo = 0, calibrationReadNo = 0;
+    double bestLogProbSum = 0.0, lostLogProbSum = 0.0, extraEditSum = 0.0;
+
+    // The read each read's supports are copied from, or -1 if its supports are already set
+    int64_t *sources = st_malloc(b->readNo * sizeof(int64_t));
+
+    int64_t cachedReads = 0;
+    for (int64_t k = 0; k < b->readNo; k++) {
+        sources[k] = -1;
+        if (supportsSet != NULL && supportsSet[k]) continue;
+        bool forwardStrand = b->reads[k]->read->forwardStrand;
+        RleString *readSubstring = bamChunkReadSubstring_getRleString(b->reads[k]);
+
+        uint64_t *index = stHash_search(cachedScores[forwardStrand], readSubstring);
+        if (index != NULL) {
+            sources[k] = (int64_t) *index;
+            rleString_destruct(readSubstring);
+            cachedReads++;
+        } else {
+            sources[k] = k;
+            index = st_malloc(sizeof(uint64_t));
+            *index = (uint64_t) k;
+            stHash_insert(cachedScores[forwardStrand], readSubstring, index);
+            SymbolString rS = rleString_constructSymbolString(readSubstring, 0, readSubstring->length,
+                                                              params->alphabet, params->useRepeatCountsInAlignment,
+                                                              maxRepeatCount);
+            int64_t *d = prescore ? &editDistances[k * b->alleleNo] : NULL;
+            if (prescore && bubble_prescoreRead(b, alleleSymbolStrings, rS, params, d) && scoredNo > 0) {
+                prescored[k] = 1;
+            } else {
+                StateMachine *sM = forwardStrand ? params->stateMachineForForwardStrandRead
+                                                 : params->stateMachineForReverseStrandRead;
+                bubble_setReadAlleleSupports(b, k, alleleSymbolStrings, rS, sM, params);
+                scoredNo++;
+
+                // calibrate the edit distances against the log-likelihoods
+                if (prescore) {
+                    int64_t best = 0;
+                    for (int64_t j = 1; j < b->alleleNo; j++) {
+                        best = d[j] < d[best] ? j : best;
+                    }
+                    float bestLogProb = b->alleleReadSupports[best * b->readNo + k];
+                    bestLogProbSum += bestLogProb;
+                    calibrationReadNo++;
+                    for (int64_t j = 0; j < b->alleleNo; j++) {
+                        if (d[j] > d[best]) {
+                            lostLogProbSum += bestLogProb - b->alleleReadSupports[j * b->readNo + k];
+                            extraEditSum += (double) (d[j] - d[best]);
+                        }
+                    }
+                }
+            }
+            symbolString_destruct(rS);
+        }
+    }
+
+    // Set the supports of the prescored reads, from the calibration if there is one
+    int64_t prescoredNo = 0;
+    if (prescore) {
+        bool calibrated = extraEditSum > 0 && lostLogProbSum > 0;
+        double bestLogProb = bestLogProbSum / (calibrationReadNo > 0 ? calibrationReadNo : 1);
+        double logProbPerEdit = calibrated ? lostLogProbSum / extraEditSum : 0.0;
+        for (int64_t k = 0; k < b->readNo; k++) {
+            if (!prescored[k]) continue;
+            int64_t *d = &editDistances[k * b->alleleNo];
+            if (calibrated) {
+                int64_t bestEditDistance = d[0];
+                for (int64_t j = 1; j < b->alleleNo; j++) {
+                    bestEditDistance = d[j] < bestEditDistance ? d[j] : bestEditDistance;
+                }
+                for (int64_t j = 0; j < b->alleleNo; j++) {
+                    b->alleleReadSupports[j * b->readNo + k] =
+                            (float) (bestLogProb - logProbPerEdit * (double) (d[j] - bestEditDistance));
+                }
+                prescoredNo++;
+            } else {
+                RleString *readSubstring = bamChunkReadSubstring_getRleString(b->reads[k]);
+                SymbolString rS = rleString_constructSymbolString(readSubstring, 0, readSubstring->length,
+                                                                  params->alphabet, params->useRepeatCountsInAlignment,
+                                                                  maxRepeatCount);
+                StateMachine *sM = b->reads[k]->read->forwardStrand ? params->stateMachineForForwardStrandRead
+                                                                    : params->stateMachineForReverseStrandRead;
+                bubble_setReadAlleleSupports(b, k, alleleSymbolStrings, rS, sM, params);
+                symbolString_destruct(rS);
+                rleString_destruct(readSubstring);
+            }
+        }
+    }
+
+    // Copy the supports of the reads with the same substring as an earlier one
+    for (int64_t k = 0; k < b->readNo; k++) {
+        if (sources[k] >= 0 && sources[k] != k) {
+            for (int64_t j = 0; j < b->alleleNo; j++) {
+                b->alleleReadSupports[j * b->readNo + k] = b->alleleReadSupports[j * b->readNo + sources[k]];
+            }
+        }
+    }
+
+    // Cleanup
+    for (int64_t i = 0; i < 2; i++) {
+        stHash_destruct(cachedScores[i]);
+    }
+    for (int64_t j = 0; j < b->alleleNo; j++) {
+        symbolString_destruct(alleleSymbolStrings[j]);
+    }
+    free(sources);
+    if (prescore) {
+        free(editDistances);
+        free(prescored);
+    }
+
+    *prescoredReads = prescoredNo;
+    return cachedReads;
+}
+
+/*
+ * Sets the alleleReadSupports of each of the given list of bubbles, returning the number of reads whose supports were
+ * copied from an earlier read. If supportsSet is not NULL it holds, for each bubble, the supportsSet flags of
+ * bubble_setAlleleReadSupports (or NULL). Each bubble is scored in its own OpenMP task. Called within a parallel region, such as the
+ * loop over chunks, threads that have run out of chunks pick up these tasks while they wait at the end of the region, so
+ * the last, slowest chunks are split across the free threads; otherwise the thread calling this scores all the bubbles
+ * itself. The bubbles are scored independently, so the supports do not depend on which thread scores which bubble.
+ */
+static int64_t bubbles_setAlleleReadSupports(stList *bubbles, PolishParams *params, uint64_t maxRepeatCount,
+                                             stList *supportsSet) {
+    int64_t bubbleNo = stList_length(bubbles);
+    int64_t *cachedReads = st_calloc(bubbleNo, sizeof(int64_t));
+    int64_t *prescoredReads = st_calloc(bubbleNo, sizeof(int64_t));
+    for (int64_t i = 0; i < bubbleNo; i++) {
+        Bubble *b = stList_get(bubbles, i);
+        bool *bubbleSupportsSet = supportsSet == NULL ? NULL : stList_get(supportsSet, i);
+        # ifdef _OPENMP
+        #pragma omp task firstprivate(b, i, bubbleSupportsSet) \
+                shared(cachedReads, prescoredReads, params, maxRepeatCount)
+        # endif
+        cachedReads[i] = bubble_setAlleleReadSupports(b, params, maxRepeatCount, bubbleSupportsSet,
+                                                      &prescoredReads[i]);
+    }
+    # ifdef _OPENMP
+    #pragma omp taskwait
+    # endif
+
+    // the scores are counted by the calling thread, whichever threads computed them
+    int64_t totalCachedReads = 0, alleleReadScores = 0;
+    for (int64_t i = 0; i < bubbleNo; i++) {
+        Bubble *b = stList_get(bubbles, i);
+        bool *bubbleSupportsSet = supportsSet == NULL ? NULL : stList_get(supportsSet, i);
+        int64_t scoredReads = b->readNo - cachedReads[i] - prescoredReads[i];
+        for (int64_t k = 0; bubbleSupportsSet != NULL && k < b->readNo; k++) {
+            scoredReads -= bubbleSupportsSet[k] ? 1 : 0;
+        }
+        totalCachedReads += cachedReads[i];
+        alleleReadScores += b->alleleNo * scoredReads;
+    }
+    free(cachedReads);
+    free(prescoredReads);
+    chunkTelemetry_addCount(CTC_ALLELE_READ_SCORES, alleleReadScores);
+
+    return totalCachedReads;
+}
+
+static void logAlleleReadSupportCaching(int64_t reads, int64_t cachedReads) {
+    char *logIdentifier = getLogIdentifier();
+    st_logInfo(" %s Scored %"PRId64" bubble reads against their alleles, %"PRId64" (%.2f) reused the scores of "
+               "an identical read substring\n", logIdentifier, reads, cachedReads,
+               1.0 * cachedReads / (reads == 0 ? 1 : reads));
+    free(logIdentifier);
+}
 
 BubbleGraph *bubbleGraph_constructFromPoa(Poa *poa, stList *bamChunkReads, PolishParams *params) {
     return bubbleGraph_constructFromPoa2(poa, bamChunkReads, params, FALSE);
@@ -916,6 +1428,7 @@ BubbleGraph *bubbleGraph_constructFromPoa2(Poa *poa, stList *bamChunkReads, Poli
 
 BubbleGraph *bubbleGraph_constructFromPoaAndVCF(Poa *poa, stList *bamChunkReads, stList *vcfEntries,
                                                 PolishParams *params, bool phasing) {
+    allocProfile_scope(APT_BUBBLE_GRAPH);
     // Setup
     double *candidateWeights = getCandidateWeights(poa, params);
 
@@ -931,8 +1444,8 @@ BubbleGraph *bubbleGraph_constructFromPoaAndVCF(Poa *poa, stList *bamChunkReads,
                     totalCandidateWeight / (PAIR_ALIGNMENT_PROB_1 * stList_length(poa->nodes)));
     }
 
-    // Sort the base observations to make the getReadSubstrings function work
-    sortBaseObservations(poa);
+    // Index the reads' positions in the poa and their qualities, to get their substrings for the bubbles
+    ReadSubstringIndex *readSubstringIndex = readSubstringIndex_construct(bamChunkReads, poa);
 
     // Identify anchor points, represented as a binary array, one bit for each POA node
     bool *candidateVariantPositions = NULL;
@@ -940,7 +1453,8 @@ BubbleGraph *bubbleGraph_constructFromPoaAndVCF(Poa *poa, stList *bamChunkReads,
     assert(candidateVariantPositions != NULL);
 
     // Make a list of bubbles
-    stList *bubbles = stList_construct3(0, free);
+    stList *bubbles = stList_construct3(0, chunkArena_free);
+    int64_t scoredReads = 0, cachedScoredReads = 0; // Counts of reads scored, and of those using cached scores
     int64_t pAnchor = 0; // Previous anchor, starting from first position of POA, which is the prefix "N"
     for (int64_t i = 1; i < stList_length(poa->nodes); i++) {
         if (anchors[i]) { // If position i is an anchor
@@ -949,7 +1463,7 @@ BubbleGraph *bubbleGraph_constructFromPoaAndVCF(Poa *poa, stList *bamChunkReads,
                 // with start coordinate on the reference sequence of pAnchor and length pAnchor-i
 
                 // Get read substrings
-                stList *readSubstrings = getReadSubstrings(bamChunkReads, poa, pAnchor+1, i, params);
+                stList *readSubstrings = getReadSubstrings(readSubstringIndex, pAnchor+1, i, params);
 
                 if(stList_length(readSubstrings) > 0) {
                     stList *alleles = NULL;
@@ -987,7 +1501,7 @@ BubbleGraph *bubbleGraph_constructFromPoaAndVCF(Poa *poa, stList *bamChunkReads,
                     // If it is not trivial because it contains more than one allele
                     if (stList_length(alleles) > 1) {
 
-                        Bubble *b = st_malloc(sizeof(Bubble)); // Make a bubble and add to list of bubbles
+                        Bubble *b = chunkArena_malloc(sizeof(Bubble)); // Make a bubble and add to list of bubbles
                         stList_append(bubbles, b);
 
                         // Set the coordinates
@@ -1007,72 +1521,23 @@ BubbleGraph *bubbleGraph_constructFromPoaAndVCF(Poa *poa, stList *bamChunkReads,
 
                         // Add read substrings
                         b->readNo = stList_length(readSubstrings);
-                        b->reads = st_malloc(sizeof(BamChunkReadSubstring *) * b->readNo);
+                        b->reads = chunkArena_malloc(sizeof(BamChunkReadSubstring *) * b->readNo);
                         for (int64_t j = 0; j < b->readNo; j++) {
                             b->reads[j] = stList_pop(readSubstrings);
                         }
 
                         // Now copy the alleles list to the bubble's array of alleles
                         b->alleleNo = stList_length(alleles);
-                        b->alleles = st_malloc(sizeof(RleString *) * b->alleleNo);
+                        b->alleles = chunkArena_malloc(sizeof(RleString *) * b->alleleNo);
                         for (int64_t j = 0; j < b->alleleNo; j++) {
                             b->alleles[j] = params->useRunLengthEncoding ? rleString_construct(stList_get(alleles, j))
                                                                          : rleString_construct_no_rle(
                                             stList_get(alleles, j));
                         }
 
-                        // Get allele supports
-                        b->alleleReadSupports = st_calloc(b->readNo * b->alleleNo, sizeof(float));
-
-                        stList *anchorPairs = stList_construct(); // Currently empty
-
-                        SymbolString alleleSymbolStrings[b->alleleNo];
-                        for (int64_t j = 0; j < b->alleleNo; j++) {
-                            alleleSymbolStrings[j] = rleString_constructSymbolString(b->alleles[j], 0,
-                                                                                     b->alleles[j]->length,
-                                                                                     params->alphabet,
-                                                                                     params->useRepeatCountsInAlignment,
-                                                                                     poa->maxRepeatCount);
-                        }
-
-                        stHash *cachedScores = stHash_construct3(rleString_stringKey, rleString_expandedStringEqualKey,
-                                                                 (void (*)(void *)) rleString_destruct, free);
-
-                        for (int64_t k = 0; k < b->readNo; k++) {
-                            RleString *readSubstring = bamChunkReadSubstring_getRleString(b->reads[k]);
-                            SymbolString rS = rleString_constructSymbolString(readSubstring, 0, readSubstring->length,
-                                                                              params->alphabet,
-                                                                              params->useRepeatCountsInAlignment,
-                                                                              poa->maxRepeatCount);
-                            StateMachine *sM = b->reads[k]->read->forwardStrand
-                                               ? params->stateMachineForForwardStrandRead
-                                               : params->stateMachineForReverseStrandRead;
-
-                            uint64_t *index = stHash_search(cachedScores, readSubstring);
-                            if (index != NULL) {
-                                for (int64_t j = 0; j < b->alleleNo; j++) {
-                                    b->alleleReadSupports[j * b->readNo + k] = b->alleleReadSupports[j * b->readNo +
-                                                                                                     *index];
-                                }
-                                rleString_destruct(readSubstring);
-                            } else {
-                                index = st_malloc(sizeof(uint64_t));
-                                *index = k;
-                                stHash_insert(cachedScores, readSubstring, index);
-                                for (int64_t j = 0; j < b->alleleNo; j++) {
-                                    b->alleleReadSupports[j * b->readNo + k] = computeForwardProbability(
-                                            alleleSymbolStrings[j], rS, anchorPairs, params->p, sM, 0, 0);
-                                }
-                            }
-
-                            symbolString_destruct(rS);
-                        }
-
-                        stHash_destruct(cachedScores);
-                        for (int64_t j = 0; j < b->alleleNo; j++) {
-                            symbolString_destruct(alleleSymbolStrings[j]);
-                        }
-                        stList_destruct(anchorPairs);
+                        // Get allele supports, which are scored once all the bubbles are made
+                        b->alleleReadSupports = chunkArena_calloc(b->readNo * b->alleleNo, sizeof(float));
+                        scoredReads += b->readNo;
                     }
                         // Cleanup
                     else {
@@ -1089,31 +1554,18 @@ BubbleGraph *bubbleGraph_constructFromPoaAndVCF(Poa *poa, stList *bamChunkReads,
         }
     }
 
-    // Build the the graph
+    // Score the reads of the bubbles against their alleles
+    cachedScoredReads = bubbles_setAlleleReadSupports(bubbles, params, poa->maxRepeatCount, NULL);
+    logAlleleReadSupportCaching(scoredReads, cachedScoredReads);
 
-    BubbleGraph *bg = st_malloc(sizeof(BubbleGraph));
-    bg->refString = poa->refString;
-
-    // Copy the bubbles
-    bg->bubbleNo = stList_length(bubbles);
-    bg->bubbles = st_calloc(bg->bubbleNo, sizeof(Bubble)); // allocate bubbles
-    for (int64_t i = 0; i < bg->bubbleNo; i++) {
-        bg->bubbles[i] = *(Bubble *) stList_get(bubbles, i);
-    }
-
-    // Fill in the bubble allele offsets
-    int64_t alleleOffset = 0;
-    for (int64_t i = 0; i < bg->bubbleNo; i++) {
-        bg->bubbles[i].alleleOffset = alleleOffset;
-        alleleOffset += bg->bubbles[i].alleleNo;
-    }
-    bg->totalAlleles = alleleOffset;
+    // Build the the graph
+    BubbleGraph *bg = bubbleGraph_construct(poa->refString, bubbles);
 
     // Cleanup
+    readSubstringIndex_destruct(readSubstringIndex);
     free(anchors);
     free(candidateWeights);
     free(candidateVariantPositions);
-    stList_destruct(bubbles);
 
     return bg;
 }
@@ -1121,11 +1573,14 @@ BubbleGraph *bubbleGraph_constructFromPoaAndVCF(Poa *poa, stList *bamChunkReads,
 
 BubbleGraph *bubbleGraph_constructFromPoaAndVCFOnlyVCFAllele(Poa *poa, stList *bamChunkReads,
                                                              RleString *referenceSeqRLE, stList *vcfEntries, Params *params) {
+    allocProfile_scope(APT_BUBBLE_GRAPH);
     // prep
     char *referenceSeq = rleString_expand(referenceSeqRLE);
+    ReadSubstringIndex *readSubstringIndex = readSubstringIndex_construct(bamChunkReads, poa);
 
     // Make a list of bubbles
-    stList *bubbles = stList_construct3(0, free);
+    stList *bubbles = stList_construct3(0, chunkArena_free);
+    int64_t scoredReads = 0, cachedScoredReads = 0; // Counts of reads scored, and of those using cached scores
     int64_t lastRefEndPos = -1;
     for (int64_t v = 0; v < stList_length(vcfEntries); v++) {
         VcfEntry *vcf = stList_get(vcfEntries, v);
@@ -1142,7 +1597,7 @@ BubbleGraph *bubbleGraph_constructFromPoaAndVCFOnlyVCFAllele(Poa *poa, stList *b
         }*/
 
         // Get read substrings
-        stList *readSubstrings = getReadSubstrings(bamChunkReads, poa, refStartPos, refEndPosIncl, params->polishParams);
+        stList *readSubstrings = getReadSubstrings(readSubstringIndex, refStartPos, refEndPosIncl, params->polishParams);
 
         // nothing to phase with
         if(stList_length(readSubstrings) == 0) {
@@ -1156,7 +1611,7 @@ BubbleGraph *bubbleGraph_constructFromPoaAndVCFOnlyVCFAllele(Poa *poa, stList *b
         char *expandedExistingRefSubstring = rleString_expand(existingRefSubstring);
 
         // make bubble
-        Bubble *b = st_malloc(sizeof(Bubble)); // Make a bubble and add to list of bubbles
+        Bubble *b = chunkArena_malloc(sizeof(Bubble)); // Make a bubble and add to list of bubbles
         stList_append(bubbles, b);
 
         b->refStart = (uint64_t) refStartPos;
@@ -1171,70 +1626,30 @@ BubbleGraph *bubbleGraph_constructFromPoaAndVCFOnlyVCFAllele(Poa *poa, stList *b
 
         // Add read substrings
         b->readNo = (uint64_t ) stList_length(readSubstrings);
-        b->reads = st_malloc(sizeof(BamChunkReadSubstring *) * b->readNo);
+        b->reads = chunkArena_malloc(sizeof(BamChunkReadSubstring *) * b->readNo);
         for (int64_t j = 0; j < b->readNo; j++) {
             b->reads[j] = stList_pop(readSubstrings);
         }
 
         // Now copy the alleles list to the bubble's array of alleles
         b->alleleNo = (uint64_t ) stList_length(alleles);
-        b->alleles = st_malloc(sizeof(RleString *) * b->alleleNo);
+        b->alleles = chunkArena_malloc(sizeof(RleString *) * b->alleleNo);
         for (int64_t j = 0; j < b->alleleNo; j++) {
             b->alleles[j] = rleString_copy(stList_get(alleles, j));
         }
 
         // Get allele supports
-        b->alleleReadSupports = st_calloc(b->readNo * b->alleleNo, sizeof(float));
+        b->alleleReadSupports = chunkArena_calloc(b->readNo * b->alleleNo, sizeof(float));
 
-        stList *anchorPairs = stList_construct(); // Currently empty
 
-        SymbolString alleleSymbolStrings[b->alleleNo];
-        for (int64_t j = 0; j < b->alleleNo; j++) {
-            alleleSymbolStrings[j] = rleString_constructSymbolString(b->alleles[j], 0,
-                                                                     b->alleles[j]->length,
-                                                                     params->polishParams->alphabet,
-                                                                     params->polishParams->useRepeatCountsInAlignment,
-                                                                     poa->maxRepeatCount);
-        }
+        int64_t bubblePrescoredReads;
+        int64_t bubbleCachedReads = bubble_setAlleleReadSupports(b, params->polishParams, poa->maxRepeatCount, NULL,
+                                                                 &bubblePrescoredReads);
+        chunkTelemetry_addCount(CTC_ALLELE_READ_SCORES,
+                                b->alleleNo * (b->readNo - bubbleCachedReads - bubblePrescoredReads));
+        cachedScoredReads += bubbleCachedReads;
+        scoredReads += b->readNo;
 
-        stHash *cachedScores = stHash_construct3(rleString_stringKey, rleString_expandedStringEqualKey,
-                                                 (void (*)(void *)) rleString_destruct, free);
-
-        for (int64_t k = 0; k < b->readNo; k++) {
-            RleString *readSubstring = bamChunkReadSubstring_getRleString(b->reads[k]);
-            SymbolString rS = rleString_constructSymbolString(readSubstring, 0, readSubstring->length,
-                                                              params->polishParams->alphabet,
-                                                              params->polishParams->useRepeatCountsInAlignment,
-                                                              poa->maxRepeatCount);
-            StateMachine *sM = b->reads[k]->read->forwardStrand
-                               ? params->polishParams->stateMachineForForwardStrandRead
-                               : params->polishParams->stateMachineForReverseStrandRead;
-
-            uint64_t *index = stHash_search(cachedScores, readSubstring);
-            if (index != NULL) {
-                for (int64_t j = 0; j < b->alleleNo; j++) {
-                    b->alleleReadSupports[j * b->readNo + k] = b->alleleReadSupports[j * b->readNo +
-                                                                                     *index];
-                }
-                rleString_destruct(readSubstring);
-            } else {
-                index = st_malloc(sizeof(uint64_t));
-                *index = k;
-                stHash_insert(cachedScores, readSubstring, index);
-                for (int64_t j = 0; j < b->alleleNo; j++) {
-                    b->alleleReadSupports[j * b->readNo + k] = (float) computeForwardProbability(
-                            alleleSymbolStrings[j], rS, anchorPairs, params->polishParams->p, sM, 0, 0);
-                }
-            }
-
-            symbolString_destruct(rS);
-        }
-
-        stHash_destruct(cachedScores);
-        for (int64_t j = 0; j < b->alleleNo; j++) {
-            symbolString_destruct(alleleSymbolStrings[j]);
-        }
-        stList_destruct(anchorPairs);
 
         // Cleanup
         rleString_destruct(existingRefSubstring);
@@ -1243,28 +1658,13 @@ BubbleGraph *bubbleGraph_constructFromPoaAndVCFOnlyVCFAllele(Poa *poa, stList *b
         stList_destruct(readSubstrings);
     }
 
-    // Build the the graph
-
-    BubbleGraph *bg = st_malloc(sizeof(BubbleGraph));
-    bg->refString = poa->refString;
-
-    // Copy the bubbles
-    bg->bubbleNo = (uint64_t ) stList_length(bubbles);
-    bg->bubbles = st_calloc(bg->bubbleNo, sizeof(Bubble)); // allocate bubbles
-    for (int64_t i = 0; i < bg->bubbleNo; i++) {
-        bg->bubbles[i] = *(Bubble *) stList_get(bubbles, i);
-    }
+    logAlleleReadSupportCaching(scoredReads, cachedScoredReads);
 
-    // Fill in the bubble allele offsets
-    int64_t alleleOffset = 0;
-    for (int64_t i = 0; i < bg->bubbleNo; i++) {
-        bg->bubbles[i].alleleOffset = (uint64_t ) alleleOffset;
-        alleleOffset += bg->bubbles[i].alleleNo;
-    }
-    bg->totalAlleles = alleleOffset;
+    // Build the the graph
+    BubbleGraph *bg = bubbleGraph_construct(poa->refString, bubbles);
 
     // Cleanup
-    stList_destruct(bubbles);
+    readSubstringIndex_destruct(readSubstringIndex);
     free(referenceSeq);
 
     return bg;
@@ -1283,7 +1683,7 @@ stHash *buildVcfEntryToReadSubstringsMap(stList *bamChunkReads, Params *params)
             uint8_t *qualities = stList_get(bcrves->readSubstringQualities, j);
 
             // get BCRS
-            BamChunkReadSubstring *rs = st_calloc(1, sizeof(BamChunkReadSubstring));
+            BamChunkReadSubstring *rs = chunkArena_calloc(1, sizeof(BamChunkReadSubstring));
             // Basic attributes
             int64_t length = strlen(substring);
             rs->read = bcr;
@@ -1324,12 +1724,183 @@ uint64_t getMaximumRepeatLength(Params *params) {
             maximumRepeatLengthExcl = MAXIMUM_REPEAT_LENGTH;
         }
     }
-    return maximumRepeatLengthExcl;
+    return maximumRepeatLengthExcl;
+}
+
+
+typedef struct _overlapSupport {
+    char *readSubstring; // expanded, the supports are only reused for the same substring and alleles
+    char *alleles; // expanded and comma separated
+    float *supports; // for each allele
+} OverlapSupport;
+
+struct _overlapSupportCache {
+    int64_t maxChunks;
+    stHash *supports; // "vcf entry, read name, strand" keys to OverlapSupports
+    stList *chunkKeys; // for each of the latest chunks to save supports, oldest first, the keys it saved
+};
+
+static void overlapSupport_destruct(OverlapSupport *support) {
+    free(support->readSubstring);
+    free(support->alleles);
+    free(support->supports);
+    free(support);
+}
+
+OverlapSupportCache *overlapSupportCache_construct(int64_t maxChunks) {
+    OverlapSupportCache *cache = st_malloc(sizeof(OverlapSupportCache));
+    cache->maxChunks = maxChunks > 0 ? maxChunks : 1;
+    // the keys are owned by the lists of chunkKeys
+    cache->supports = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, NULL,
+                                        (void (*)(void *)) overlapSupport_destruct);
+    cache->chunkKeys = stList_construct3(0, (void (*)(void *)) stList_destruct);
+    return cache;
+}
+
+void overlapSupportCache_destruct(OverlapSupportCache *cache) {
+    stHash_destruct(cache->supports);
+    stList_destruct(cache->chunkKeys);
+    free(cache);
+}
+
+static bool vcfEntry_isInChunkOverlap(VcfEntry *vcfEntry, BamChunk *bamChunk) {
+    // is the (root) vcf entry also in the previous or the next chunk
+    VcfEntry *rootVcfEntry = vcfEntry->rootVcfEntry == NULL ? vcfEntry : vcfEntry->rootVcfEntry;
+    return rootVcfEntry->refPos < bamChunk->chunkStart + (bamChunk->chunkStart - bamChunk->chunkOverlapStart) ||
+           rootVcfEntry->refPos >= bamChunk->chunkEnd - (bamChunk->chunkOverlapEnd - bamChunk->chunkEnd);
+}
+
+static char *overlapSupport_getKey(VcfEntry *vcfEntry, BamChunkReadSubstring *readSubstring) {
+    VcfEntry *rootVcfEntry = vcfEntry->rootVcfEntry == NULL ? vcfEntry : vcfEntry->rootVcfEntry;
+    return stString_print("%p\t%s\t%d", (void *) rootVcfEntry, readSubstring->read->readName,
+                          (int) readSubstring->read->forwardStrand);
+}
+
+static char *bubble_getExpandedAlleles(Bubble *b) {
+    stList *alleles = stList_construct3(0, free);
+    for (int64_t j = 0; j < b->alleleNo; j++) {
+        stList_append(alleles, rleString_expand(b->alleles[j]));
+    }
+    char *joined = stString_join2(",", alleles);
+    stList_destruct(alleles);
+    return joined;
+}
+
+static int64_t bubbles_reuseOverlapSupports(stList *bubbles, stList *bubbleVcfEntries, BamChunk *bamChunk,
+                                            OverlapSupportCache *cache, stList *supportsSet) {
+    /*
+     * Sets the supports of the reads of the bubbles in the chunk overlaps that a neighbouring chunk saved, for the
+     * same read substrings and alleles, flagging them in supportsSet (which gets an entry for each bubble, NULL if
+     * none are set). The reused supports are taken out of the cache. Returns the number of reads reused.
+     */
+    int64_t reusedReads = 0;
+    for (int64_t i = 0; i < stList_length(bubbles); i++) {
+        Bubble *b = stList_get(bubbles, i);
+        VcfEntry *vcfEntry = stList_get(bubbleVcfEntries, i);
+        if (!vcfEntry_isInChunkOverlap(vcfEntry, bamChunk)) {
+            stList_append(supportsSet, NULL);
+            continue;
+        }
+        bool *bubbleSupportsSet = st_calloc(b->readNo, sizeof(bool));
+        stList_append(supportsSet, bubbleSupportsSet);
+        char *alleles = bubble_getExpandedAlleles(b);
+        for (int64_t k = 0; k < b->readNo; k++) {
+            char *key = overlapSupport_getKey(vcfEntry, b->reads[k]);
+            OverlapSupport *support;
+            # ifdef _OPENMP
+            #pragma omp critical (overlapSupportCache)
+            # endif
+            {
+                support = stHash_remove(cache->supports, key);
+            }
+            free(key);
+            if (support == NULL) continue;
+            RleString *readSubstring = bamChunkReadSubstring_getRleString(b->reads[k]);
+            char *expandedReadSubstring = rleString_expand(readSubstring);
+            if (stString_eq(support->alleles, alleles) && stString_eq(support->readSubstring, expandedReadSubstring)) {
+                for (int64_t j = 0; j < b->alleleNo; j++) {
+                    b->alleleReadSupports[j * b->readNo + k] = support->supports[j];
+                }
+                bubbleSupportsSet[k] = TRUE;
+                reusedReads++;
+            }
+            free(expandedReadSubstring);
+            rleString_destruct(readSubstring);
+            overlapSupport_destruct(support);
+        }
+        free(alleles);
+    }
+    return reusedReads;
+}
+
+static void bubbles_saveOverlapSupports(stList *bubbles, stList *bubbleVcfEntries, BamChunk *bamChunk,
+                                        OverlapSupportCache *cache, stList *supportsSet) {
+    /*
+     * Saves the supports of the reads of the bubbles in the chunk overlaps, other than those just reused, for the
+     * neighbouring chunks. Only the supports saved by the latest maxChunks chunks are kept.
+     */
+    stList *keys = stList_construct3(0, free);
+    stList *supports = stList_construct();
+    for (int64_t i = 0; i < stList_length(bubbles); i++) {
+        Bubble *b = stList_get(bubbles, i);
+        VcfEntry *vcfEntry = stList_get(bubbleVcfEntries, i);
+        bool *bubbleSupportsSet = stList_get(supportsSet, i);
+        if (bubbleSupportsSet == NULL) continue;
+        char *alleles = bubble_getExpandedAlleles(b);
+        for (int64_t k = 0; k < b->readNo; k++) {
+            if (bubbleSupportsSet[k]) continue;
+            OverlapSupport *support = st_malloc(sizeof(OverlapSupport));
+            RleString *readSubstring = bamChunkReadSubstring_getRleString(b->reads[k]);
+            support->readSubstring = rleString_expand(readSubstring);
+            rleString_destruct(readSubstring);
+            support->alleles = stString_copy(alleles);
+            support->supports = st_malloc(sizeof(float) * b->alleleNo);
+            for (int64_t j = 0; j < b->alleleNo; j++) {
+                support->supports[j] = b->alleleReadSupports[j * b->readNo + k];
+            }
+            stList_append(keys, overlapSupport_getKey(vcfEntry, b->reads[k]));
+            stList_append(supports, support);
+        }
+        free(alleles);
+    }
+
+    # ifdef _OPENMP
+    #pragma omp critical (overlapSupportCache)
+    # endif
+    {
+        for (int64_t i = 0; i < stList_length(keys); i++) {
+            if (stHash_search(cache->supports, stList_get(keys, i)) != NULL) {
+                // already saved, for another alignment of the read, so only the first is kept
+                overlapSupport_destruct(stList_get(supports, i));
+                free(stList_remove(keys, i));
+                stList_remove(supports, i--);
+            } else {
+                stHash_insert(cache->supports, stList_get(keys, i), stList_get(supports, i));
+            }
+        }
+        stList_append(cache->chunkKeys, keys);
+        // evict the supports of the oldest chunks
+        while (stList_length(cache->chunkKeys) > cache->maxChunks) {
+            stList *oldKeys = stList_remove(cache->chunkKeys, 0);
+            for (int64_t i = 0; i < stList_length(oldKeys); i++) {
+                OverlapSupport *support = stHash_remove(cache->supports, stList_get(oldKeys, i));
+                if (support != NULL) overlapSupport_destruct(support);
+            }
+            stList_destruct(oldKeys);
+        }
+    }
+    stList_destruct(supports);
 }
 
-
 BubbleGraph *bubbleGraph_constructFromVCFAndBamChunkReadVcfEntrySubstrings(stList *bamChunkReads, stList *vcfEntries,
         Params *params, stList **vcfEntriesToBubbleIdx) {
+    return bubbleGraph_constructFromVCFAndBamChunkReadVcfEntrySubstrings2(bamChunkReads, vcfEntries, NULL, NULL,
+                                                                          params, vcfEntriesToBubbleIdx);
+}
+
+BubbleGraph *bubbleGraph_constructFromVCFAndBamChunkReadVcfEntrySubstrings2(stList *bamChunkReads, stList *vcfEntries,
+        BamChunk *bamChunk, OverlapSupportCache *overlapSupportCache, Params *params, stList **vcfEntriesToBubbleIdx) {
+    allocProfile_scope(APT_BUBBLE_GRAPH);
     // prep
     uint64_t maximumRepeatLengthExcl = getMaximumRepeatLength(params);
 
@@ -1340,7 +1911,8 @@ BubbleGraph *bubbleGraph_constructFromVCFAndBamChunkReadVcfEntrySubstrings(stLis
     *vcfEntriesToBubbleIdx = stList_construct();
 
     // Make a list of bubbles
-    stList *bubbles = stList_construct3(0, free);
+    stList *bubbles = stList_construct3(0, chunkArena_free);
+    int64_t scoredReads = 0, cachedScoredReads = 0; // Counts of reads scored, and of those using cached scores
     int64_t lastRefEndPos = -1;
     int64_t vcfEntriesWithoutSubstrings = 0;
     for (int64_t v = 0; v < stList_length(vcfEntries); v++) {
@@ -1362,7 +1934,7 @@ BubbleGraph *bubbleGraph_constructFromVCFAndBamChunkReadVcfEntrySubstrings(stLis
         char *expandedExistingRefSubstring = stList_get(alleles, 0);
 
         // make bubble
-        Bubble *b = st_malloc(sizeof(Bubble)); // Make a bubble and add to list of bubbles
+        Bubble *b = chunkArena_malloc(sizeof(Bubble)); // Make a bubble and add to list of bubbles
         stList_append(bubbles, b);
         stList_append(*vcfEntriesToBubbleIdx, vcfEntry);
 
@@ -1380,94 +1952,49 @@ BubbleGraph *bubbleGraph_constructFromVCFAndBamChunkReadVcfEntrySubstrings(stLis
 
         // Add read substrings
         b->readNo = (uint64_t ) stList_length(readSubstrings);
-        b->reads = st_malloc(sizeof(BamChunkReadSubstring *) * b->readNo);
+        b->reads = chunkArena_malloc(sizeof(BamChunkReadSubstring *) * b->readNo);
         for (int64_t j = 0; j < b->readNo; j++) {
             b->reads[j] = stList_pop(readSubstrings);
         }
 
         // Now copy the alleles list to the bubble's array of alleles
         b->alleleNo = (uint64_t ) stList_length(alleles);
-        b->alleles = st_malloc(sizeof(RleString *) * b->alleleNo);
+        b->alleles = chunkArena_malloc(sizeof(RleString *) * b->alleleNo);
         for (int64_t j = 0; j < b->alleleNo; j++) {
             b->alleles[j] = rleString_copy(stList_get(alleles, j));
         }
 
-        // Get allele supports
-        b->alleleReadSupports = st_calloc(b->readNo * b->alleleNo, sizeof(float));
-
-        stList *anchorPairs = stList_construct(); // Currently empty
-
-        SymbolString alleleSymbolStrings[b->alleleNo];
-        for (int64_t j = 0; j < b->alleleNo; j++) {
-            alleleSymbolStrings[j] = rleString_constructSymbolString(b->alleles[j], 0,
-                                                                     b->alleles[j]->length,
-                                                                     params->polishParams->alphabet,
-                                                                     params->polishParams->useRepeatCountsInAlignment,
-                                                                     maximumRepeatLengthExcl);
-        }
-
-        stHash *cachedScores = stHash_construct3(rleString_stringKey, rleString_expandedStringEqualKey,
-                                                 (void (*)(void *)) rleString_destruct, free);
-
-        for (int64_t k = 0; k < b->readNo; k++) {
-            RleString *readSubstring = bamChunkReadSubstring_getRleString(b->reads[k]);
-            SymbolString rS = rleString_constructSymbolString(readSubstring, 0, readSubstring->length,
-                                                              params->polishParams->alphabet,
-                                                              params->polishParams->useRepeatCountsInAlignment,
-                                                              maximumRepeatLengthExcl);
-            StateMachine *sM = b->reads[k]->read->forwardStrand
-                               ? params->polishParams->stateMachineForForwardStrandRead
-                               : params->polishParams->stateMachineForReverseStrandRead;
-
-            uint64_t *index = stHash_search(cachedScores, readSubstring);
-            if (index != NULL) {
-                for (int64_t j = 0; j < b->alleleNo; j++) {
-                    b->alleleReadSupports[j * b->readNo + k] = b->alleleReadSupports[j * b->readNo +
-                                                                                     *index];
-                }
-                rleString_destruct(readSubstring);
-            } else {
-                index = st_malloc(sizeof(uint64_t));
-                *index = k;
-                stHash_insert(cachedScores, readSubstring, index);
-                for (int64_t j = 0; j < b->alleleNo; j++) {
-                    b->alleleReadSupports[j * b->readNo + k] = (float) computeForwardProbability(
-                            alleleSymbolStrings[j], rS, anchorPairs, params->polishParams->p, sM, 0, 0);
-                }
-            }
-
-            symbolString_destruct(rS);
-        }
+        // Get allele supports, scored once all the bubbles are made
+        b->alleleReadSupports = chunkArena_calloc(b->readNo * b->alleleNo, sizeof(float));
+        scoredReads += b->readNo;
 
-        stHash_destruct(cachedScores);
-        for (int64_t j = 0; j < b->alleleNo; j++) {
-            symbolString_destruct(alleleSymbolStrings[j]);
-        }
-        stList_destruct(anchorPairs);
     }
 
-    // Build the the graph
-
-    BubbleGraph *bg = st_malloc(sizeof(BubbleGraph));
-    bg->refString = NULL; //poa->refString;
-
-    // Copy the bubbles
-    bg->bubbleNo = (uint64_t ) stList_length(bubbles);
-    bg->bubbles = st_calloc(bg->bubbleNo, sizeof(Bubble)); // allocate bubbles
-    for (int64_t i = 0; i < bg->bubbleNo; i++) {
-        bg->bubbles[i] = *(Bubble *) stList_get(bubbles, i);
+    // reuse the supports of the overlap bubbles' reads scored by a neighbouring chunk
+    stList *supportsSet = NULL;
+    if (overlapSupportCache != NULL) {
+        supportsSet = stList_construct3(0, free);
+        int64_t reusedReads = bubbles_reuseOverlapSupports(bubbles, *vcfEntriesToBubbleIdx, bamChunk,
+                                                           overlapSupportCache, supportsSet);
+        char *logIdentifier = getLogIdentifier();
+        st_logInfo(" %s Reused the supports of %"PRId64" bubble reads scored by neighbouring chunks\n",
+                   logIdentifier, reusedReads);
+        free(logIdentifier);
     }
 
-    // Fill in the bubble allele offsets
-    int64_t alleleOffset = 0;
-    for (int64_t i = 0; i < bg->bubbleNo; i++) {
-        bg->bubbles[i].alleleOffset = (uint64_t ) alleleOffset;
-        alleleOffset += bg->bubbles[i].alleleNo;
+    // the alleles are known, so the bubbles are independent and are scored as tasks, shared with idle threads
+    cachedScoredReads = bubbles_setAlleleReadSupports(bubbles, params->polishParams, maximumRepeatLengthExcl,
+                                                      supportsSet);
+    logAlleleReadSupportCaching(scoredReads, cachedScoredReads);
+    if (overlapSupportCache != NULL) {
+        bubbles_saveOverlapSupports(bubbles, *vcfEntriesToBubbleIdx, bamChunk, overlapSupportCache, supportsSet);
+        stList_destruct(supportsSet);
     }
-    bg->totalAlleles = alleleOffset;
+
+    // Build the the graph
+    BubbleGraph *bg = bubbleGraph_construct(NULL, bubbles);
 
     // Cleanup
-    stList_destruct(bubbles);
     stHash_destruct(vcfEntriesToReadSubstrings);
 
     return bg;
@@ -1478,6 +2005,7 @@ BubbleGraph *bubbleGraph_partitionFilteredReads(Poa *poa, stList *bamChunkReads,
                                                 BubbleGraph *bg, BamChunk *bamChunk, uint64_t *reference_rleToNonRleCoordMap,
                                                 stSet *hap1Reads, stSet *hap2Reads, PolishParams *params, FILE *out,
                                                 char *logIdentifier) {
+    allocProfile_scope(APT_PHASING);
     // our eventual scores
     stHash *totalReadScore_hap1 = stHash_construct2(NULL, free);
     stHash *totalReadScore_hap2 = stHash_construct2(NULL, free);
@@ -1490,7 +2018,11 @@ BubbleGraph *bubbleGraph_partitionFilteredReads(Poa *poa, stList *bamChunkReads,
     if (out != NULL) fprintf(out, ",\n \"filtered\": [");
     bool firstBubble = TRUE;
 
-    // loop over all primary bubbles
+    int64_t scoredReads = 0, cachedScoredReads = 0; // Counts of reads scored, and of those using cached scores
+    ReadSubstringIndex *readSubstringIndex = readSubstringIndex_construct(bamChunkReads, poa);
+
+    // loop over all primary bubbles, making a bubble of the haplotype alleles for each het
+    stList *bubbles = stList_construct3(0, chunkArena_free);
     for (uint64_t primaryBubbleIdx = 0; primaryBubbleIdx < gF->length; primaryBubbleIdx++) {
 
         // bubble and hap info
@@ -1513,8 +2045,8 @@ BubbleGraph *bubbleGraph_partitionFilteredReads(Poa *poa, stList *bamChunkReads,
         stList_append(alleles, rleString_expand(hap2));
 
         // get read substrings
-        stList *readSubstrings = getReadSubstrings2(bamChunkReads, poa, refStart, refStart+primaryBubble->bubbleLength+1,
-                                                    params, FALSE);
+        stList *readSubstrings = getReadSubstrings2(readSubstringIndex, refStart,
+                                                    refStart+primaryBubble->bubbleLength+1, params, FALSE);
 
         // Get existing reference string
         // ref string is 0-based, non-N poa nodes are 1-based
@@ -1543,7 +2075,8 @@ BubbleGraph *bubbleGraph_partitionFilteredReads(Poa *poa, stList *bamChunkReads,
         assert(stList_length(alleles) == 2 || stList_length(alleles) == 3);
 
 
-        Bubble *b = st_malloc(sizeof(Bubble)); // Make a bubble and add to list of bubbles
+        Bubble *b = chunkArena_malloc(sizeof(Bubble)); // Make a bubble and add to list of bubbles
+        stList_append(bubbles, b);
         b->variantPositionOffsets = NULL;
 
         // Set the coordinates
@@ -1554,67 +2087,35 @@ BubbleGraph *bubbleGraph_partitionFilteredReads(Poa *poa, stList *bamChunkReads,
 
         // Add read substrings
         b->readNo = (uint64_t) stList_length(readSubstrings);
-        b->reads = st_malloc(sizeof(BamChunkReadSubstring *) * b->readNo);
+        b->reads = chunkArena_malloc(sizeof(BamChunkReadSubstring *) * b->readNo);
         for (int64_t j = 0; j < b->readNo; j++) {
             b->reads[j] = stList_pop(readSubstrings);
         }
 
         // Now copy the alleles list to the bubble's array of alleles
         b->alleleNo = (uint64_t) stList_length(alleles);
-        b->alleles = st_malloc(sizeof(RleString *) * b->alleleNo);
+        b->alleles = chunkArena_malloc(sizeof(RleString *) * b->alleleNo);
         for (int64_t j = 0; j < b->alleleNo; j++) {
             b->alleles[j] = params->useRunLengthEncoding ? rleString_construct(stList_get(alleles, j))
                                                          : rleString_construct_no_rle(stList_get(alleles, j));
         }
 
-        // Get allele supports
-        b->alleleReadSupports = st_calloc(b->readNo * b->alleleNo, sizeof(float));
-
-        stList *anchorPairs = stList_construct(); // Currently empty
-
-        SymbolString alleleSymbolStrings[b->alleleNo];
-        for (int64_t j = 0; j < b->alleleNo; j++) {
-            alleleSymbolStrings[j] = rleString_constructSymbolString(b->alleles[j], 0,
-                                                                     b->alleles[j]->length,
-                                                                     params->alphabet,
-                                                                     params->useRepeatCountsInAlignment,
-                                                                     poa->maxRepeatCount);
-        }
-
-        // get alignment likelihoods
-        stHash *cachedScores = stHash_construct3(rleString_stringKey, rleString_expandedStringEqualKey,
-                                                 (void (*)(void *)) rleString_destruct, free);
-        for (int64_t k = 0; k < b->readNo; k++) {
-            RleString *readSubstring = bamChunkReadSubstring_getRleString(b->reads[k]);
-            SymbolString rS = rleString_constructSymbolString(readSubstring, 0, readSubstring->length,
-                                                              params->alphabet,
-                                                              params->useRepeatCountsInAlignment,
-                                                              poa->maxRepeatCount);
-            StateMachine *sM = b->reads[k]->read->forwardStrand
-                               ? params->stateMachineForForwardStrandRead
-                               : params->stateMachineForReverseStrandRead;
-
-            uint64_t *index = stHash_search(cachedScores, readSubstring);
-            if (index != NULL) {
-                for (int64_t j = 0; j < b->alleleNo; j++) {
-                    b->alleleReadSupports[j * b->readNo + k] = b->alleleReadSupports[j * b->readNo +
-                                                                                     *index];
-                }
-                rleString_destruct(readSubstring);
-            } else {
-                index = st_malloc(sizeof(uint64_t));
-                *index = (uint64_t) k;
-                stHash_insert(cachedScores, readSubstring, index);
-                for (int64_t j = 0; j < b->alleleNo; j++) {
-                    b->alleleReadSupports[j * b->readNo + k] =
-                            (float) computeForwardProbability(alleleSymbolStrings[j], rS, anchorPairs, params->p, sM, 0, 0);
-                }
-            }
+        // Get allele supports, which are scored once all the bubbles are made
+        b->alleleReadSupports = chunkArena_calloc(b->readNo * b->alleleNo, sizeof(float));
+        scoredReads += b->readNo;
 
-            symbolString_destruct(rS);
-        }
+        // cleanup
+        free(expandedExistingRefSubstring);
+        stList_destruct(alleles);
+        stList_destruct(readSubstrings);
+    }
 
+    // Score the reads of the bubbles against the haplotype alleles
+    cachedScoredReads = bubbles_setAlleleReadSupports(bubbles, params, poa->maxRepeatCount, NULL);
 
+    // loop over the bubbles, in order, ranking reads
+    for (int64_t i = 0; i < stList_length(bubbles); i++) {
+        Bubble *b = stList_get(bubbles, i);
 
         // write to output
         if (out != NULL) {
@@ -1638,9 +2139,9 @@ BubbleGraph *bubbleGraph_partitionFilteredReads(Poa *poa, stList *bamChunkReads,
             float supportHap2 = b->alleleReadSupports[1 * b->readNo + k];
 
             double *currRS = stHash_search(totalReadScore_hap1, bcr);
-            *currRS += supportHap1 - stMath_logAddExact(supportHap1, supportHap2);
+            *currRS += supportHap1 - logAddPrecise(supportHap1, supportHap2);
             currRS = stHash_search(totalReadScore_hap2, bcr);
-            *currRS += supportHap2 - stMath_logAddExact(supportHap2, supportHap1);
+            *currRS += supportHap2 - logAddPrecise(supportHap2, supportHap1);
 
             // write to output
             if (out != NULL) {
@@ -1661,17 +2162,9 @@ BubbleGraph *bubbleGraph_partitionFilteredReads(Poa *poa, stList *bamChunkReads,
         }
 
         // cleanup
-        stHash_destruct(cachedScores);
-        for (int64_t j = 0; j < b->alleleNo; j++) {
-            symbolString_destruct(alleleSymbolStrings[j]);
-        }
-        stList_destruct(anchorPairs);
-        free(expandedExistingRefSubstring);
-        stList_destruct(alleles);
-        stList_destruct(readSubstrings);
         bubble_destruct(*b);
-        free(b);
     }
+    stList_destruct(bubbles);
 
     // write to output
     if (out != NULL) {
@@ -1705,6 +2198,7 @@ BubbleGraph *bubbleGraph_partitionFilteredReads(Poa *poa, stList *bamChunkReads,
     }
 
     // loggit
+    logAlleleReadSupportCaching(scoredReads, cachedScoredReads);
     int64_t length = stList_length(bamChunkReads);
     st_logInfo(" %s Of %"PRId64" filtered reads: %"PRId64" (%.2f) were hap1, %"PRId64" (%.2f) were hap2, %"PRId64" (%.2f) were unclassified with %"PRId64" (%.2f) having no score (avg len %"PRId64").\n",
                logIdentifier, length, hap1Count, 1.0*hap1Count/length, hap2Count, 1.0*hap2Count/length,
@@ -1714,6 +2208,7 @@ BubbleGraph *bubbleGraph_partitionFilteredReads(Poa *poa, stList *bamChunkReads,
 
 
     // other cleanup
+    readSubstringIndex_destruct(readSubstringIndex);
     stHash_destruct(totalReadScore_hap1);
     stHash_destruct(totalReadScore_hap2);
 }
@@ -1723,6 +2218,7 @@ BubbleGraph *bubbleGraph_partitionFilteredReads(Poa *poa, stList *bamChunkReads,
 BubbleGraph *bubbleGraph_partitionFilteredReadsFromVcfEntries(stList *bamChunkReads, stGenomeFragment *gF,
                                                               BubbleGraph *bg, stList *vcfEntriesToBubbles, stSet *hap1Reads,
                                                               stSet *hap2Reads, Params *params, char *logIdentifier) {
+    allocProfile_scope(APT_PHASING);
     // our eventual scores
     stHash *totalReadScore_hap1 = stHash_construct2(NULL, free);
     stHash *totalReadScore_hap2 = stHash_construct2(NULL, free);
@@ -1735,7 +2231,10 @@ BubbleGraph *bubbleGraph_partitionFilteredReadsFromVcfEntries(stList *bamChunkRe
     stHash *vcfEntryToReadSubstrings = buildVcfEntryToReadSubstringsMap(bamChunkReads, params);
     uint64_t maximumRepeatLengthExcl = getMaximumRepeatLength(params);
 
-    // loop over all primary bubbles
+    int64_t scoredReads = 0, cachedScoredReads = 0; // Counts of reads scored, and of those using cached scores
+
+    // loop over all primary bubbles, making a bubble of the haplotype alleles for each het
+    stList *bubbles = stList_construct();
     for (uint64_t primaryBubbleIdx = 0; primaryBubbleIdx < gF->length; primaryBubbleIdx++) {
 
         // bubble and hap info
@@ -1780,7 +2279,7 @@ BubbleGraph *bubbleGraph_partitionFilteredReadsFromVcfEntries(stList *bamChunkRe
             continue;
         }
 
-        Bubble *b = st_malloc(sizeof(Bubble)); // Make a bubble and add to list of bubbles
+        Bubble *b = chunkArena_malloc(sizeof(Bubble)); // Make a bubble and add to list of bubbles
         b->variantPositionOffsets = NULL;
 
         // Set the coordinates
@@ -1793,68 +2292,32 @@ BubbleGraph *bubbleGraph_partitionFilteredReadsFromVcfEntries(stList *bamChunkRe
 
         // Add read substrings
         b->readNo = (uint64_t) stList_length(readSubstrings);
-        b->reads = st_malloc(sizeof(BamChunkReadSubstring *) * b->readNo);
+        b->reads = chunkArena_malloc(sizeof(BamChunkReadSubstring *) * b->readNo);
         for (int64_t j = 0; j < b->readNo; j++) {
             b->reads[j] = stList_pop(readSubstrings);
         }
 
         // Now copy the alleles list to the bubble's array of alleles
         b->alleleNo = (uint64_t) stList_length(alleles);
-        b->alleles = st_malloc(sizeof(RleString *) * b->alleleNo);
+        b->alleles = chunkArena_malloc(sizeof(RleString *) * b->alleleNo);
         for (int64_t j = 0; j < b->alleleNo; j++) {
             b->alleles[j] = params->polishParams->useRunLengthEncoding ?
                             rleString_construct(stList_get(alleles, j)) : rleString_construct_no_rle(stList_get(alleles, j));
         }
 
-        // Get allele supports
-        b->alleleReadSupports = st_calloc(b->readNo * b->alleleNo, sizeof(float));
-
-        stList *anchorPairs = stList_construct(); // Currently empty
-
-        SymbolString alleleSymbolStrings[b->alleleNo];
-        for (int64_t j = 0; j < b->alleleNo; j++) {
-            alleleSymbolStrings[j] = rleString_constructSymbolString(b->alleles[j], 0,
-                                                                     b->alleles[j]->length,
-                                                                     params->polishParams->alphabet,
-                                                                     params->polishParams->useRepeatCountsInAlignment,
-                                                                     maximumRepeatLengthExcl);
-        }
-
-        // get alignment likelihoods
-        stHash *cachedScores = stHash_construct3(rleString_stringKey, rleString_expandedStringEqualKey,
-                                                 (void (*)(void *)) rleString_destruct, free);
-        for (int64_t k = 0; k < b->readNo; k++) {
-            RleString *readSubstring = bamChunkReadSubstring_getRleString(b->reads[k]);
-            SymbolString rS = rleString_constructSymbolString(readSubstring, 0, readSubstring->length,
-                                                              params->polishParams->alphabet,
-                                                              params->polishParams->useRepeatCountsInAlignment,
-                                                              maximumRepeatLengthExcl);
-            StateMachine *sM = b->reads[k]->read->forwardStrand
-                               ? params->polishParams->stateMachineForForwardStrandRead
-                               : params->polishParams->stateMachineForReverseStrandRead;
-
-            uint64_t *index = stHash_search(cachedScores, readSubstring);
-            if (index != NULL) {
-                for (int64_t j = 0; j < b->alleleNo; j++) {
-                    b->alleleReadSupports[j * b->readNo + k] = b->alleleReadSupports[j * b->readNo +
-                                                                                     *index];
-                }
-                rleString_destruct(readSubstring);
-            } else {
-                index = st_malloc(sizeof(uint64_t));
-                *index = (uint64_t) k;
-                stHash_insert(cachedScores, readSubstring, index);
-                for (int64_t j = 0; j < b->alleleNo; j++) {
-                    b->alleleReadSupports[j * b->readNo + k] =
-                            (float) computeForwardProbability(alleleSymbolStrings[j], rS, anchorPairs,
-                                                              params->polishParams->p, sM, 0, 0);
-                }
-            }
+        // Get allele supports, scored once all the bubbles are made
+        b->alleleReadSupports = chunkArena_calloc(b->readNo * b->alleleNo, sizeof(float));
+        scoredReads += b->readNo;
+        stList_append(bubbles, b);
+        stList_destruct(alleles);
+    }
 
-            symbolString_destruct(rS);
-        }
+    // the bubbles are independent, so are scored as tasks, shared with idle threads
+    cachedScoredReads = bubbles_setAlleleReadSupports(bubbles, params->polishParams, maximumRepeatLengthExcl, NULL);
 
-        // rank reads for each bubble
+    // rank reads for each bubble
+    for (int64_t i = 0; i < stList_length(bubbles); i++) {
+        Bubble *b = stList_get(bubbles, i);
         for (int64_t k = 0; k < b->readNo; k++) {
             BamChunkReadSubstring *bcrss = b->reads[k];
             BamChunkRead *bcr = bcrss->read;
@@ -1862,22 +2325,17 @@ BubbleGraph *bubbleGraph_partitionFilteredReadsFromVcfEntries(stList *bamChunkRe
             float supportHap2 = b->alleleReadSupports[1 * b->readNo + k];
 
             double *currRS = stHash_search(totalReadScore_hap1, bcr);
-            *currRS += supportHap1 - stMath_logAddExact(supportHap1, supportHap2);
+            *currRS += supportHap1 - logAddPrecise(supportHap1, supportHap2);
             currRS = stHash_search(totalReadScore_hap2, bcr);
-            *currRS += supportHap2 - stMath_logAddExact(supportHap2, supportHap1);
+            *currRS += supportHap2 - logAddPrecise(supportHap2, supportHap1);
 
         }
 
         // cleanup
-        stHash_destruct(cachedScores);
-        for (int64_t j = 0; j < b->alleleNo; j++) {
-            symbolString_destruct(alleleSymbolStrings[j]);
-        }
-        stList_destruct(anchorPairs);
-        stList_destruct(alleles);
         bubble_destruct(*b);
-        free(b);
+        chunkArena_free(b);
     }
+    stList_destruct(bubbles);
 
     // get scores and save to appropriate sets
     double totalNoScoreVariantsSpanned = 0.0;
@@ -1906,6 +2364,7 @@ BubbleGraph *bubbleGraph_partitionFilteredReadsFromVcfEntries(stList *bamChunkRe
     }
 
     // loggit
+    logAlleleReadSupportCaching(scoredReads, cachedScoredReads);
     int64_t length = stList_length(bamChunkReads);
     st_logInfo(" %s Of %"PRId64" filtered reads: %"PRId64" (%.2f) were hap1, %"PRId64" (%.2f) were hap2, %"PRId64" (%.2f) were unclassified with %"PRId64" (%.2f) having no score (avg spanned variants %.2f).\n",
                logIdentifier, length, hap1Count, 1.0*hap1Count/length, hap2Count, 1.0*hap2Count/length,
@@ -1922,61 +2381,41 @@ BubbleGraph *bubbleGraph_partitionFilteredReadsFromVcfEntries(stList *bamChunkRe
 
 
 
-BubbleGraph *bubbleGraph_partitionFilteredReadsFromPhasedVcfEntries(stList *bamChunkReads, BubbleGraph *bg,
-        stList *vcfEntriesToBubbles, stSet *hap1Reads, stSet *hap2Reads, Params *params, char *logIdentifier) {
-    // our eventual scores
-    stHash *totalReadScore_hap1 = stHash_construct2(NULL, free);
-    stHash *totalReadScore_hap2 = stHash_construct2(NULL, free);
+stHash *bubbleGraph_scoreReadsAgainstPhasedVcfEntries(stList *bamChunkReads, stList *vcfEntries,
+        int64_t scoredRefStart, int64_t scoredRefEnd, Params *params) {
+    // our eventual scores, [hap1, hap2] for each read
+    stHash *readScores = stHash_construct2(NULL, free);
     for (int64_t i = 0; i < stList_length(bamChunkReads); i++) {
-        stHash_insert(totalReadScore_hap1, stList_get(bamChunkReads, i), st_calloc(1, sizeof(double)));
-        stHash_insert(totalReadScore_hap2, stList_get(bamChunkReads, i), st_calloc(1, sizeof(double)));
+        stHash_insert(readScores, stList_get(bamChunkReads, i), st_calloc(2, sizeof(double)));
     }
 
     // prep
     stHash *vcfEntryToReadSubstrings = buildVcfEntryToReadSubstringsMap(bamChunkReads, params);
     uint64_t maximumRepeatLengthExcl = getMaximumRepeatLength(params);
 
-    // loop over all primary bubbles
-    for (uint64_t primaryBubbleIdx = 0; primaryBubbleIdx < bg->bubbleNo; primaryBubbleIdx++) {
-
-        // bubble and hap info
-        Bubble *primaryBubble = &bg->bubbles[primaryBubbleIdx];
-        VcfEntry *vcfEntry = stList_get(vcfEntriesToBubbles, primaryBubbleIdx);
-        int64_t hap1AlleleNo = vcfEntry->gt1;
-        int64_t hap2AlleleNo = vcfEntry->gt2;
-
-        assert(stList_length(primaryBubble->variantPositionOffsets) == 1 &&
-               vcfEntry->refPos == (int64_t) stList_get(primaryBubble->variantPositionOffsets, 0));
-
-        RleString *hap1 = primaryBubble->alleles[hap1AlleleNo];
-        RleString *hap2 = primaryBubble->alleles[hap2AlleleNo];
-
-        // we only care about hets
-        if (hap1 == hap2) continue;
+    int64_t scoredReads = 0, cachedScoredReads = 0; // Counts of reads scored, and of those using cached scores
 
-        // anchor positions
-        uint64_t refStart = primaryBubble->refStart;
-
-        // make allele list from primary haplotype alleles
-        stList *alleles = stList_construct3(0, free);
-        stList_append(alleles, rleString_expand(hap1));
-        stList_append(alleles, rleString_expand(hap2));
+    // loop over all variants, each gets a bubble of just its two phased alleles
+    stList *bubbles = stList_construct();
+    for (int64_t v = 0; v < stList_length(vcfEntries); v++) {
+        VcfEntry *vcfEntry = stList_get(vcfEntries, v);
 
         // get read substrings
         stList *readSubstrings = stHash_search(vcfEntryToReadSubstrings, vcfEntry);
+        if (readSubstrings == NULL) continue;
 
-        // nothing to phase with
-        if(stList_length(readSubstrings) == 0) {
-            stList_destruct(readSubstrings);
-            stList_destruct(alleles);
+        // we only care about hets within the scored region
+        VcfEntry *rootVcfEntry = vcfEntry->rootVcfEntry == NULL ? vcfEntry : vcfEntry->rootVcfEntry;
+        if (vcfEntry->gt1 == vcfEntry->gt2 || stList_length(readSubstrings) == 0 ||
+                rootVcfEntry->refPos < scoredRefStart || rootVcfEntry->refPos >= scoredRefEnd) {
             continue;
         }
 
-        Bubble *b = st_malloc(sizeof(Bubble)); // Make a bubble and add to list of bubbles
+        Bubble *b = chunkArena_malloc(sizeof(Bubble)); // Make a bubble
         b->variantPositionOffsets = NULL;
 
         // Set the coordinates
-        b->refStart = (uint64_t) refStart;
+        b->refStart = (uint64_t) vcfEntry->refAlnStart;
 
         // The reference allele
         b->refAllele = params->polishParams->useRunLengthEncoding ?
@@ -1985,91 +2424,59 @@ BubbleGraph *bubbleGraph_partitionFilteredReadsFromPhasedVcfEntries(stList *bamC
 
         // Add read substrings
         b->readNo = (uint64_t) stList_length(readSubstrings);
-        b->reads = st_malloc(sizeof(BamChunkReadSubstring *) * b->readNo);
+        b->reads = chunkArena_malloc(sizeof(BamChunkReadSubstring *) * b->readNo);
         for (int64_t j = 0; j < b->readNo; j++) {
             b->reads[j] = stList_pop(readSubstrings);
         }
 
-        // Now copy the alleles list to the bubble's array of alleles
-        b->alleleNo = (uint64_t) stList_length(alleles);
-        b->alleles = st_malloc(sizeof(RleString *) * b->alleleNo);
-        for (int64_t j = 0; j < b->alleleNo; j++) {
-            b->alleles[j] = params->polishParams->useRunLengthEncoding ?
-                            rleString_construct(stList_get(alleles, j)) : rleString_construct_no_rle(stList_get(alleles, j));
-        }
-
-        // Get allele supports
-        b->alleleReadSupports = st_calloc(b->readNo * b->alleleNo, sizeof(float));
-
-        stList *anchorPairs = stList_construct(); // Currently empty
+        // The two phased alleles
+        b->alleleNo = 2;
+        b->alleles = chunkArena_malloc(sizeof(RleString *) * b->alleleNo);
+        b->alleles[0] = rleString_copy(stList_get(vcfEntry->alleleSubstrings, vcfEntry->gt1));
+        b->alleles[1] = rleString_copy(stList_get(vcfEntry->alleleSubstrings, vcfEntry->gt2));
 
-        SymbolString alleleSymbolStrings[b->alleleNo];
-        for (int64_t j = 0; j < b->alleleNo; j++) {
-            alleleSymbolStrings[j] = rleString_constructSymbolString(b->alleles[j], 0,
-                                                                     b->alleles[j]->length,
-                                                                     params->polishParams->alphabet,
-                                                                     params->polishParams->useRepeatCountsInAlignment,
-                                                                     maximumRepeatLengthExcl);
-        }
-
-        // get alignment likelihoods
-        stHash *cachedScores = stHash_construct3(rleString_stringKey, rleString_expandedStringEqualKey,
-                                                 (void (*)(void *)) rleString_destruct, free);
-        for (int64_t k = 0; k < b->readNo; k++) {
-            RleString *readSubstring = bamChunkReadSubstring_getRleString(b->reads[k]);
-            SymbolString rS = rleString_constructSymbolString(readSubstring, 0, readSubstring->length,
-                                                              params->polishParams->alphabet,
-                                                              params->polishParams->useRepeatCountsInAlignment,
-                                                              maximumRepeatLengthExcl);
-            StateMachine *sM = b->reads[k]->read->forwardStrand
-                               ? params->polishParams->stateMachineForForwardStrandRead
-                               : params->polishParams->stateMachineForReverseStrandRead;
-
-            uint64_t *index = stHash_search(cachedScores, readSubstring);
-            if (index != NULL) {
-                for (int64_t j = 0; j < b->alleleNo; j++) {
-                    b->alleleReadSupports[j * b->readNo + k] = b->alleleReadSupports[j * b->readNo +
-                                                                                     *index];
-                }
-                rleString_destruct(readSubstring);
-            } else {
-                index = st_malloc(sizeof(uint64_t));
-                *index = (uint64_t) k;
-                stHash_insert(cachedScores, readSubstring, index);
-                for (int64_t j = 0; j < b->alleleNo; j++) {
-                    b->alleleReadSupports[j * b->readNo + k] =
-                            (float) computeForwardProbability(alleleSymbolStrings[j], rS, anchorPairs,
-                                                              params->polishParams->p, sM, 0, 0);
-                }
-            }
+        // Get allele supports, scored once all the bubbles are made
+        b->alleleReadSupports = chunkArena_calloc(b->readNo * b->alleleNo, sizeof(float));
+        scoredReads += b->readNo;
+        stList_append(bubbles, b);
+    }
 
-            symbolString_destruct(rS);
-        }
+    // the bubbles are independent, so are scored as tasks, shared with idle threads
+    cachedScoredReads = bubbles_setAlleleReadSupports(bubbles, params->polishParams, maximumRepeatLengthExcl, NULL);
 
-        // rank reads for each bubble
+    // rank reads for each bubble
+    for (int64_t i = 0; i < stList_length(bubbles); i++) {
+        Bubble *b = stList_get(bubbles, i);
         for (int64_t k = 0; k < b->readNo; k++) {
             BamChunkReadSubstring *bcrss = b->reads[k];
-            BamChunkRead *bcr = bcrss->read;
             float supportHap1 = b->alleleReadSupports[0 * b->readNo + k];
             float supportHap2 = b->alleleReadSupports[1 * b->readNo + k];
 
-            double *currRS = stHash_search(totalReadScore_hap1, bcr);
-            *currRS += supportHap1 - stMath_logAddExact(supportHap1, supportHap2);
-            currRS = stHash_search(totalReadScore_hap2, bcr);
-            *currRS += supportHap2 - stMath_logAddExact(supportHap2, supportHap1);
-
+            double *currRS = stHash_search(readScores, bcrss->read);
+            currRS[0] += supportHap1 - logAddPrecise(supportHap1, supportHap2);
+            currRS[1] += supportHap2 - logAddPrecise(supportHap2, supportHap1);
         }
 
         // cleanup
-        stHash_destruct(cachedScores);
-        for (int64_t j = 0; j < b->alleleNo; j++) {
-            symbolString_destruct(alleleSymbolStrings[j]);
-        }
-        stList_destruct(anchorPairs);
-        stList_destruct(alleles);
         bubble_destruct(*b);
-        free(b);
+        chunkArena_free(b);
     }
+    stList_destruct(bubbles);
+
+    // loggit
+    logAlleleReadSupportCaching(scoredReads, cachedScoredReads);
+
+    // cleanup
+    stHash_destruct(vcfEntryToReadSubstrings);
+
+    return readScores;
+}
+
+void bubbleGraph_partitionFilteredReadsFromPhasedVcfEntries(stList *bamChunkReads, stList *vcfEntries,
+        stSet *hap1Reads, stSet *hap2Reads, Params *params, char *logIdentifier) {
+    // our eventual scores
+    stHash *readScores = bubbleGraph_scoreReadsAgainstPhasedVcfEntries(bamChunkReads, vcfEntries, 0, INT64_MAX,
+                                                                       params);
 
     // get scores and save to appropriate sets
     double totalNoScoreVariantsSpanned = 0.0;
@@ -2079,17 +2486,16 @@ BubbleGraph *bubbleGraph_partitionFilteredReadsFromPhasedVcfEntries(stList *bamC
     int64_t hap2Count = 0;
     for (int i = 0; i < stList_length(bamChunkReads); i++) {
         BamChunkRead *bcr = stList_get(bamChunkReads, i);
-        double *totalSupportH1 = stHash_search(totalReadScore_hap1, bcr);
-        double *totalSupportH2 = stHash_search(totalReadScore_hap2, bcr);
+        double *totalSupport = stHash_search(readScores, bcr);
 
-        if (*totalSupportH1 > *totalSupportH2) {
+        if (totalSupport[0] > totalSupport[1]) {
             stSet_insert(hap1Reads, bcr);
             hap1Count++;
-        } else if (*totalSupportH2 > *totalSupportH1)  {
+        } else if (totalSupport[1] > totalSupport[0])  {
             stSet_insert(hap2Reads, bcr);
             hap2Count++;
         } else {
-            if (*totalSupportH1 == 0) {
+            if (totalSupport[0] == 0) {
                 totalNoScoreVariantsSpanned += stList_length(bcr->bamChunkReadVcfEntrySubstrings->vcfEntries);
                 noScoreCount++;
             }
@@ -2105,101 +2511,104 @@ BubbleGraph *bubbleGraph_partitionFilteredReadsFromPhasedVcfEntries(stList *bamC
                1.0*noScoreCount/(unclassifiedCount == 0 ? 1 : unclassifiedCount),
                totalNoScoreVariantsSpanned / (noScoreCount == 0 ? 1 : noScoreCount));
 
-
     // other cleanup
-    stHash_destruct(totalReadScore_hap1);
-    stHash_destruct(totalReadScore_hap2);
-    stHash_destruct(vcfEntryToReadSubstrings);
+    stHash_destruct(readScores);
 }
 
 
 
 stHash *bubbleGraph_getProfileSeqs(BubbleGraph *bg, stReference *ref) {
-    // First calculate the length of all the profile sequences
-
-    stHash *readEnds = stHash_construct2(NULL, free); // The last bubble the read is observed to be part of
-
-    // For each bubble in the bubble graph
+    /*
+     * The profile sequences are made and filled in by array lookups, using the dense read indices of the graph. The
+     * profile probabilities are computed a bubble at a time, each loop running over the reads of the bubble, which
+     * are contiguous in alleleReadSupports, so that the loops can be vectorized.
+     */
+    uint64_t *readIndexOffsets = bg->readIndexOffsets;
+    uint64_t *bubbleReadIndices = bg->readIndices;
+    uint64_t maxBubbleReadNo = 0;
     for (uint64_t i = 0; i < bg->bubbleNo; i++) {
-        Bubble *b = &(bg->bubbles[i]);
-
-        // For each read aligned to this bubble
-        for (uint64_t j = 0; j < b->readNo; j++) {
-            BamChunkReadSubstring *s = b->reads[j];
-            assert(s->read != NULL);
-
-            // Look up the corresponding profile sequence
-            uint64_t *k = stHash_search(readEnds, s->read);
-
-            if (k == NULL) { // We are starting a new read, so make a new
-                // length entry
-                k = st_calloc(1, sizeof(uint64_t));
-                stHash_insert(readEnds, s->read, k);
-            }
+        maxBubbleReadNo = bg->bubbles[i].readNo > maxBubbleReadNo ? bg->bubbles[i].readNo : maxBubbleReadNo;
+    }
 
-            k[0] = i; // Update last time read observed aligned to a bubble
+    // Calculate the first and last bubble each read is aligned to
+    uint64_t readNo = bg->readNo;
+    uint64_t *firstBubbles = st_malloc(sizeof(uint64_t) * (readNo + 1));
+    uint64_t *lastBubbles = st_malloc(sizeof(uint64_t) * (readNo + 1));
+    for (uint64_t i = bg->bubbleNo; i-- > 0;) {
+        for (uint64_t j = readIndexOffsets[i]; j < readIndexOffsets[i + 1]; j++) {
+            firstBubbles[bubbleReadIndices[j]] = i;
+        }
+    }
+    for (uint64_t i = 0; i < bg->bubbleNo; i++) {
+        for (uint64_t j = readIndexOffsets[i]; j < readIndexOffsets[i + 1]; j++) {
+            lastBubbles[bubbleReadIndices[j]] = i;
         }
     }
 
+    // Make the profile sequences
     stHash *readsToPSeqs = stHash_construct();
-
-    // Now build the profile sequences
-
-    // For each bubble in the bubble graph
+    stProfileSeq **pSeqs = st_malloc(sizeof(stProfileSeq *) * (readNo + 1));
+    for (uint64_t i = 0; i < readNo; i++) {
+        BamChunkRead *read = bg->reads[i];
+        assert(firstBubbles[i] <= lastBubbles[i]);
+        pSeqs[i] = stProfileSeq_constructEmptyProfile(ref, read->readName, firstBubbles[i],
+                                                      lastBubbles[i] - firstBubbles[i] + 1);
+        stHash_insert(readsToPSeqs, read, pSeqs[i]);
+    }
+
+    // For each bubble, fill in the probability of each allele given each read, normalized by the total probability
+    // of the read given the alleles, being max + log(sum_k exp(alleleReadSupport_k - max))
+    double *maxLogProbs = st_malloc(sizeof(double) * (maxBubbleReadNo + 1));
+    double *totalLogProbs = st_malloc(sizeof(double) * (maxBubbleReadNo + 1));
     for (uint64_t i = 0; i < bg->bubbleNo; i++) {
         Bubble *b = &(bg->bubbles[i]);
+        if (b->alleleNo == 0) {
+            continue;
+        }
+        uint64_t *indices = &bubbleReadIndices[readIndexOffsets[i]];
 
-        // For each read aligned to this bubble
+        // The normalizing constants
         for (uint64_t j = 0; j < b->readNo; j++) {
-            BamChunkReadSubstring *s = b->reads[j];
-            assert(stHash_search(readEnds, s->read) != NULL);
-
-            // Look up the corresponding profile sequence
-            stProfileSeq *pSeq = stHash_search(readsToPSeqs, s->read);
-
-            if (pSeq == NULL) { // We are starting a new read, so make a new
-                // profile sequence
-
-                // Calculate the length in bubbles of the profile sequence
-                uint64_t *k = stHash_search(readEnds, s->read);
-                assert(k != NULL);
-                assert(i <= k[0]); // The first bubble the read is part of must precede or be equal to the last
-                uint64_t pSeqLength = k[0] - i + 1;
-                assert(i + pSeqLength <= bg->bubbleNo);
-
-                pSeq = stProfileSeq_constructEmptyProfile(ref, s->read->readName, i, pSeqLength);
-                stHash_insert(readsToPSeqs, s->read, pSeq);
+            maxLogProbs[j] = b->alleleReadSupports[j];
+            totalLogProbs[j] = 0.0;
+        }
+        for (uint64_t k = 1; k < b->alleleNo; k++) {
+            float *logProbs = &b->alleleReadSupports[b->readNo * k];
+            for (uint64_t j = 0; j < b->readNo; j++) {
+                maxLogProbs[j] = logProbs[j] > maxLogProbs[j] ? logProbs[j] : maxLogProbs[j];
             }
-
-            // Sanity check the pSeq
-            assert(b->alleleOffset >= pSeq->alleleOffset);
-            assert(i < pSeq->refStart + pSeq->length);
-
-            // For each allele in bubble add the prob that the read was generated by
-            // the read
-
-            // First calculate the total log probability of the read given the alleles, to normalize
-            // the log probabilities
-            // This acts as a normalizing constant
-            double totalLogProb = LOG_ZERO;
-            for (uint64_t k = 0; k < b->alleleNo; k++) {
-                totalLogProb = stMath_logAddExact(totalLogProb, b->alleleReadSupports[b->readNo * k + j]);
+        }
+        for (uint64_t k = 0; k < b->alleleNo; k++) {
+            float *logProbs = &b->alleleReadSupports[b->readNo * k];
+            for (uint64_t j = 0; j < b->readNo; j++) {
+                totalLogProbs[j] += exp(logProbs[j] - maxLogProbs[j]);
             }
-
-            // Normalize prob by totalLogProb
-            uint64_t alleleOffset = b->alleleOffset - pSeq->alleleOffset;
-            for (uint64_t k = 0; k < b->alleleNo; k++) {
-                float logProb = b->alleleReadSupports[b->readNo * k + j];
-                assert(logProb <= totalLogProb);
-                int64_t l = roundf(PROFILE_PROB_SCALAR * (totalLogProb - logProb));
+        }
+        for (uint64_t j = 0; j < b->readNo; j++) {
+            totalLogProbs[j] = maxLogProbs[j] + log(totalLogProbs[j]);
+        }
+
+        // The quantized, normalized probabilities
+        for (uint64_t k = 0; k < b->alleleNo; k++) {
+            float *logProbs = &b->alleleReadSupports[b->readNo * k];
+            for (uint64_t j = 0; j < b->readNo; j++) {
+                stProfileSeq *pSeq = pSeqs[indices[j]];
+                assert(b->alleleOffset >= pSeq->alleleOffset);
+                assert(i < pSeq->refStart + pSeq->length);
+                assert(logProbs[j] <= totalLogProbs[j]);
+                int64_t l = roundf(PROFILE_PROB_SCALAR * (totalLogProbs[j] - logProbs[j]));
                 assert(l >= 0);
-                pSeq->profileProbs[alleleOffset + k] = l > 255 ? 255 : l;
+                pSeq->profileProbs[b->alleleOffset - pSeq->alleleOffset + k] = l > 255 ? 255 : l;
             }
         }
     }
 
     // Cleanup
-    stHash_destruct(readEnds);
+    free(maxLogProbs);
+    free(totalLogProbs);
+    free(pSeqs);
+    free(firstBubbles);
+    free(lastBubbles);
 
     return readsToPSeqs;
 }
@@ -2279,15 +2688,15 @@ void bubbleGraph_logPhasedBubbleGraph(BubbleGraph *bg, stRPHmm *hmm, stList *pat
                         gF->haplotypeString1[i] != gF->haplotypeString2[i] ? "True" : "False", (int) i,
                         (int) gF->length, (int) b->refStart, (int) b->alleleNo,
                         b->alleles[gF->haplotypeString1[i]]->rleString, (int) gF->haplotypeString1[i],
-                        gF->haplotypeProbs1[i], popcount64(cell->partition),
+                        gF->haplotypeProbs1[i], popcount128(cell->partition),
                         b->alleles[gF->haplotypeString2[i]]->rleString, (int) gF->haplotypeString2[i],
-                        gF->haplotypeProbs2[i], (int) (column->depth - popcount64(cell->partition)),
+                        gF->haplotypeProbs2[i], (int) (column->depth - popcount128(cell->partition)),
                         (int) column->depth,
                         b->alleles[gF->ancestorString[i]]->rleString, (int) gF->ancestorString[i], gF->genotypeProbs[i],
                         (float) strandSkew);
 
                 double strandSkews[b->alleleNo];
-                bubble_calculateStrandSkews(b, strandSkews);
+                bubble_calculateStrandSkews(bg, gF->refStart + i, strandSkews);
 
                 for (uint64_t j = 0; j < b->alleleNo; j++) {
                     st_logDebug("\t>>Allele %i (ref allele: %s)\t strand-skew: %+.5f \t", (int) j,
@@ -2438,6 +2847,8 @@ stGenomeFragment *bubbleGraph_phaseBubbleGraph(BubbleGraph *bg, stReference *ref
      * Splits the forward and reverse strands to phase separately. After phasing them separately
      * joins them into one hmm.
      */
+    allocProfile_scope(APT_PHASING);
+    traceRecorder_begin("bubbleGraph_phaseBubbleGraph");
 
     // for logging
     char *logIdentifier = getLogIdentifier();
@@ -2453,6 +2864,20 @@ stGenomeFragment *bubbleGraph_phaseBubbleGraph(BubbleGraph *bg, stReference *ref
                 logIdentifier, stList_length(reads), stList_length(profileSeqs));
     }
 
+    // Chunks that are homozygous, or have a single contested site, are phased directly, without the hmm
+    stGenomeFragment *trivialGF = stList_length(profileSeqs) == 0 ? NULL :
+                                  stGenomeFragment_constructTrivial(ref, profileSeqs);
+    if (trivialGF != NULL) {
+        st_logInfo(" %s Phased %" PRIi64 " reads over %" PRIi64 " sites without the hmm\n", logIdentifier,
+                   stList_length(profileSeqs), (int64_t) ref->length);
+        stSet_setDestructor(trivialGF->reads1, (void (*)(void *)) stProfileSeq_destruct);
+        stSet_setDestructor(trivialGF->reads2, (void (*)(void *)) stProfileSeq_destruct);
+        stList_destruct(profileSeqs);
+        free(logIdentifier);
+        traceRecorder_end("bubbleGraph_phaseBubbleGraph");
+        return trivialGF;
+    }
+
     // Remove excess coverage reads
     // Filter reads so that the maximum coverage depth does not exceed params->maxCoverageDepth
     st_logInfo(" %s Filtering reads by coverage depth\n", logIdentifier);
@@ -2485,6 +2910,7 @@ stGenomeFragment *bubbleGraph_phaseBubbleGraph(BubbleGraph *bg, stReference *ref
         stList_destruct(reverseStrandProfileSeqs);
         stSet_destruct(discardedReadsSet);
         free(logIdentifier);
+        traceRecorder_end("bubbleGraph_phaseBubbleGraph");
         return gf;
     }
 
@@ -2492,24 +2918,43 @@ stGenomeFragment *bubbleGraph_phaseBubbleGraph(BubbleGraph *bg, stReference *ref
     stRPHmmParameters *phaseParamsCopy = stRPHmmParameters_copy(params->phaseParams);
     phaseParamsCopy->includeAncestorSubProb = 0; // Switch off using ancestor substitution probabilities in calculating the hmm probs
 
-    st_logInfo(" %s Phasing forward strand reads\n", logIdentifier);
-    stList *tilingPathForward = getRPHmms(forwardStrandProfileSeqs, params->phaseParams);
-    stList_setDestructor(tilingPathForward, NULL);
-
-    st_logInfo(" %s Phasing reverse strand reads\n", logIdentifier);
-    stList *tilingPathReverse = getRPHmms(reverseStrandProfileSeqs, params->phaseParams);
-    stList_setDestructor(tilingPathReverse, NULL);
+    // The strands are phased independently, so as tasks that idle threads of an enclosing parallel region can run
+    stList *tilingPathForward, *tilingPathReverse;
+#if defined(_OPENMP)
+#pragma omp task shared(tilingPathForward)
+#endif
+    {
+        st_logInfo(" %s Phasing forward strand reads\n", logIdentifier);
+        tilingPathForward = getRPHmms(forwardStrandProfileSeqs, params->phaseParams);
+        stList_setDestructor(tilingPathForward, NULL);
+    }
+
+#if defined(_OPENMP)
+#pragma omp task shared(tilingPathReverse)
+#endif
+    {
+        st_logInfo(" %s Phasing reverse strand reads\n", logIdentifier);
+        tilingPathReverse = getRPHmms(reverseStrandProfileSeqs, params->phaseParams);
+        stList_setDestructor(tilingPathReverse, NULL);
+    }
+#if defined(_OPENMP)
+#pragma omp taskwait
+#endif
 
     // Join the hmms
     st_logInfo(" %s Joining forward and reverse strand phasing\n", logIdentifier);
     stRPHmm *hmm = fuseTilingPath(mergeTwoTilingPaths(tilingPathForward, tilingPathReverse));
 
-    // Run the forward-backward algorithm
+    // Run the forward-backward algorithm, or only the forward pass if the traceback is of the most probable path
     phaseParamsCopy->includeAncestorSubProb = 1; // Now switch on using ancestor substitution probabilities in calculating the final, root hmm probs
-    stRPHmm_forwardBackward(hmm);
-
-    st_logInfo(" %s Forward probability of the hmm: %f, backward prob: %f\n", logIdentifier, (float) hmm->forwardLogProb,
-               (float) hmm->backwardLogProb);
+    if (phaseParamsCopy->maxNotSumTransitions || phaseParamsCopy->viterbiPhasing) {
+        stRPHmm_viterbi(hmm);
+        st_logInfo(" %s Forward probability of the hmm: %f\n", logIdentifier, (float) hmm->forwardLogProb);
+    } else {
+        stRPHmm_forwardBackward(hmm);
+        st_logInfo(" %s Forward probability of the hmm: %f, backward prob: %f\n", logIdentifier,
+                   (float) hmm->forwardLogProb, (float) hmm->backwardLogProb);
+    }
 
     // Now compute a high probability path through the hmm
     stList *path = stRPHmm_forwardTraceBack(hmm);
@@ -2529,14 +2974,16 @@ stGenomeFragment *bubbleGraph_phaseBubbleGraph(BubbleGraph *bg, stReference *ref
     assert(gF->length == hmm->refLength);
 
     // For reads that exceeded the coverage depth, add them back to the haplotype they fit best
-    stSetIterator *it = stSet_getIterator(discardedReadsSet);
-    stProfileSeq *pSeq = NULL;
-    while ((pSeq = stSet_getNext(it)) != NULL) {
-        double i = getLogProbOfReadGivenHaplotype(gF->haplotypeString1, gF->refStart, gF->length, pSeq, gF->reference);
-        double j = getLogProbOfReadGivenHaplotype(gF->haplotypeString2, gF->refStart, gF->length, pSeq, gF->reference);
-        stSet_insert(i < j ? gF->reads2 : gF->reads1, pSeq);
+    stList *discardedReads = stSet_getList(discardedReadsSet);
+    int64_t discardedReadNo = stList_length(discardedReads);
+    double *logProbs = st_malloc(sizeof(double) * (2 * discardedReadNo + 1));
+    stGenomeFragment_getReadLogProbs(gF, discardedReads, logProbs, logProbs + discardedReadNo);
+    for (int64_t i = 0; i < discardedReadNo; i++) {
+        stSet_insert(logProbs[i] < logProbs[discardedReadNo + i] ? gF->reads2 : gF->reads1,
+                     stList_get(discardedReads, i));
     }
-    stSet_destructIterator(it);
+    free(logProbs);
+    stList_destruct(discardedReads);
 
     // Set any homozygous alts back to being homozygous reference
     // This is really a hack because sometimes the phasing algorithm picks a non-reference allele for a homozygous
@@ -2573,10 +3020,21 @@ stGenomeFragment *bubbleGraph_phaseBubbleGraph(BubbleGraph *bg, stReference *ref
     stList_destruct(path);
     free(logIdentifier);
 
+    traceRecorder_end("bubbleGraph_phaseBubbleGraph");
     return gF;
 }
 
 Poa *bubbleGraph_getNewPoa(BubbleGraph *bg, uint64_t *consensusPath, Poa *poa, stList *reads, Params *params) {
+    return bubbleGraph_getNewPoa2(bg, consensusPath, poa, reads, params, NULL);
+}
+
+Poa *bubbleGraph_getNewPoa2(BubbleGraph *bg, uint64_t *consensusPath, Poa *poa, stList *reads, Params *params,
+                            PoaRealignmentCache *cache) {
+    return bubbleGraph_getNewPoa3(bg, consensusPath, poa, reads, NULL, params, cache);
+}
+
+Poa *bubbleGraph_getNewPoa3(BubbleGraph *bg, uint64_t *consensusPath, Poa *poa, stList *reads,
+                            stSet *excludedReads, Params *params, PoaRealignmentCache *cache) {
 
     // Get new consensus string
     int64_t *poaToConsensusMap;
@@ -2587,22 +3045,71 @@ Poa *bubbleGraph_getNewPoa(BubbleGraph *bg, uint64_t *consensusPath, Poa *poa, s
     stList *anchorAlignments = poa_getAnchorAlignments(poa, poaToConsensusMap, stList_length(reads),
                                                        params->polishParams);
 
+    // Excluded reads have no anchor alignment, so are left out of the poa
+    if (excludedReads != NULL) {
+        stList_setDestructor(anchorAlignments, NULL);
+        for (int64_t i = 0; i < stList_length(reads); i++) {
+            if (stSet_search(excludedReads, stList_get(reads, i)) != NULL) {
+                stList_destruct(stList_get(anchorAlignments, i));
+                stList_set(anchorAlignments, i, NULL);
+            }
+        }
+    }
+
     // Generated updated poa
-    Poa *poa2 = poa_realign(reads, anchorAlignments, newConsensusString, params->polishParams);
+    Poa *poa2 = poa_realign2(reads, anchorAlignments, newConsensusString, params->polishParams, cache);
 
     // Cleanup
     free(poaToConsensusMap);
     rleString_destruct(newConsensusString);
+    if (excludedReads != NULL) {
+        for (int64_t i = 0; i < stList_length(anchorAlignments); i++) {
+            if (stList_get(anchorAlignments, i) != NULL) {
+                stList_destruct(stList_get(anchorAlignments, i));
+            }
+        }
+    }
     stList_destruct(anchorAlignments);
 
     return poa2;
 }
 
+static Poa *bubbleGraph_getHaplotypePoa(BubbleGraph *bg, uint64_t *hap, Poa *poa, stList *reads, stSet *readsInHap,
+                                        stSet *readsInOtherHap, Params *params, PoaRealignmentCache *cache) {
+    Poa *poaHap = bubbleGraph_getNewPoa3(bg, hap, poa, reads,
+                                         params->polishParams->partitionHaplotypePoaReads ? readsInOtherHap : NULL,
+                                         params, cache);
+    if (params->polishParams->useRunLengthEncoding) {
+        poa_estimatePhasedRepeatCountsUsingBayesianModel(poaHap, reads, params->polishParams->repeatSubMatrix,
+                                                         readsInHap, readsInOtherHap, params->polishParams);
+    }
+    return poaHap;
+}
+
+void bubbleGraph_getHaplotypePoas(BubbleGraph *bg, uint64_t *hap1, uint64_t *hap2, Poa *poa, stList *reads,
+                                  stSet *readsInHap1, stSet *readsInHap2, Params *params, PoaRealignmentCache *cache,
+                                  Poa **poaHap1, Poa **poaHap2) {
+    // The haplotypes are independent, sharing only the haploid poa, the reads and the read only cache
+    Poa *poa1, *poa2;
+#if defined(_OPENMP)
+#pragma omp task shared(poa1)
+#endif
+    poa1 = bubbleGraph_getHaplotypePoa(bg, hap1, poa, reads, readsInHap1, readsInHap2, params, cache);
+    poa2 = bubbleGraph_getHaplotypePoa(bg, hap2, poa, reads, readsInHap2, readsInHap1, params, cache);
+#if defined(_OPENMP)
+#pragma omp taskwait
+#endif
+    *poaHap1 = poa1;
+    *poaHap2 = poa2;
+}
+
 /*
  * Stuff to manage allele-strand-skew
  */
 
-void bubble_calculateStrandSkews(Bubble *b, double *skews) {
+void bubble_calculateStrandSkews(BubbleGraph *bg, uint64_t bubbleIndex, double *skews) {
+    Bubble *b = &(bg->bubbles[bubbleIndex]);
+
     // Calculate the strand specific read supports
     double forwardStrandSupports[b->alleleNo];
     double reverseStrandSupports[b->alleleNo];
@@ -2612,9 +3119,8 @@ void bubble_calculateStrandSkews(Bubble *b, double *skews) {
         reverseStrandSupports[j] = 0.0;
     }
     for (int64_t i = 0; i < b->readNo; i++) {
-        BamChunkReadSubstring *r = b->reads[i];
         double *d;
-        if (r->read->forwardStrand) {
+        if (bubbleGraph_isForwardStrand(bg, bubbleGraph_getReadIndex(bg, bubbleIndex, i))) {
             totalForward++;
             d = forwardStrandSupports;
         } else {
@@ -2649,13 +3155,43 @@ uint128_t bionomialCoefficient(int64_t n, int64_t k) {
     return ans;
 }
 
+static double logFactorial(int64_t n) {
+    /*
+     * Returns log(n!), summing the logs for small n and using Stirling's series, which is accurate to double precision
+     * from there, otherwise.
+     */
+    if (n < 32) {
+        double l = 0.0;
+        for (int64_t i = 2; i <= n; i++) {
+            l += log((double) i);
+        }
+        return l;
+    }
+    double x = (double) n, x2 = x * x;
+    return x * log(x) - x + 0.5 * log(2.0 * M_PI * x) + 1.0 / (12.0 * x) - 1.0 / (360.0 * x * x2) +
+           1.0 / (1260.0 * x * x2 * x2);
+}
+
 double binomialPValue(int64_t n, int64_t k) {
-    uint128_t j = 0.0;
+    /*
+     * Returns the probability of at least max(k, n - k) successes (or k, if k is n / 2) in n fair trials.
+     *
+     * The tail's terms are summed relative to its first, each being the one before it times (n - i) / (i + 1), which
+     * is at most one past the middle, so the sum is stable and stops once the terms no longer change it. The first
+     * term is found in log space, so there is no overflow whatever the depth.
+     */
     k = k < n / 2 ? n - k : k;
-    for (int64_t i = k; i <= n; i++) {
-        j += bionomialCoefficient(n, i);
+    if (k > n) {
+        return 0.0;
+    }
+    double sum = 0.0, term = 1.0;
+    for (int64_t i = k; i <= n && term > sum * DBL_EPSILON; i++) {
+        sum += term;
+        term *= (double) (n - i) / (double) (i + 1);
     }
-    return j / pow(2.0, n);
+    double logFirstTerm = logFactorial(n) - logFactorial(k) - logFactorial(n - k) - n * log(2.0);
+    double p = exp(logFirstTerm + log(sum));
+    return p < 1.0 ? p : 1.0;
 }
 
 double bubble_phasedStrandSkew(Bubble *b, stHash *readsToPSeqs, stGenomeFragment *gf) {
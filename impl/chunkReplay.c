@@ -0,0 +1,289 @@
+/*
+ * Copyright (C) 2020 by Benedict Paten (benedictpaten@gmail.com)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include "margin.h"
+
+/*
+ * Chunk replay bundles, the inputs of a single chunk saved to be rerun on their own.
+ *
+ * A bundle file is laid out as:
+ * MAGIC (uint32), VERSION (uint32), PAYLOAD_LENGTH (uint64), COMPRESSED_LENGTH (uint64), PAYLOAD
+ * where the compressed payload is the length-prefixed contig name, the chunk's index and coordinates, the depth it is
+ * downsampled to, whether it is phased, whether its filtered reads are partitioned and the params fingerprint,
+ * followed by the reference, the reads and their alignments, and the filtered reads and their alignments. A run
+ * length encoded string is its length, its characters, and, if its repeat counts are not all one, each count as a
+ * byte, an overflowing count as the byte RLE_STRING_OVERFLOW_COUNT followed by the count. Bundles may be replayed on
+ * another host of the same byte order, and are rejected by one of the other.
+ */
+
+#define CHUNK_REPLAY_MAGIC 0x4250524d
+#define CHUNK_REPLAY_VERSION 2
+
+struct _chunkReplayBundle {
+    char *payload;
+    size_t payloadLength;
+};
+
+static void replayWrite(FILE *fh, const void *data, size_t length) {
+    if (fwrite(data, 1, length, fh) != length) {
+        st_errAbort("Failed to serialize a chunk replay bundle\n");
+    }
+}
+
+static void replayWriteInt(FILE *fh, int64_t i) {
+    replayWrite(fh, &i, sizeof(int64_t));
+}
+
+static void replayWriteString(FILE *fh, char *string, uint64_t length) {
+    replayWrite(fh, &length, sizeof(uint64_t));
+    replayWrite(fh, string, length);
+}
+
+static void replayWriteRleString(FILE *fh, RleString *rleString) {
+    replayWriteString(fh, rleString->rleString, rleString->length);
+    uint8_t hasRepeatCounts = rleString->repeatCounts != NULL;
+    replayWrite(fh, &hasRepeatCounts, sizeof(uint8_t));
+    if (!hasRepeatCounts) {
+        return;
+    }
+    replayWrite(fh, rleString->repeatCounts, rleString->length);
+    for (int64_t i = 0; i < rleString->length; i++) {
+        if (rleString->repeatCounts[i] == RLE_STRING_OVERFLOW_COUNT) {
+            replayWriteInt(fh, rleString_getRepeatCount(rleString, i));
+        }
+    }
+}
+
+static void replayWriteReads(FILE *fh, stList *reads, stList *alignments) {
+    assert(stList_length(reads) == stList_length(alignments));
+    replayWriteInt(fh, stList_length(reads));
+    for (int64_t i = 0; i < stList_length(reads); i++) {
+        BamChunkRead *read = stList_get(reads, i);
+        replayWriteString(fh, read->readName, strlen(read->readName));
+        replayWriteRleString(fh, read->rleRead);
+        uint8_t flags = (read->forwardStrand ? 1 : 0) | (read->qualities != NULL ? 2 : 0);
+        replayWrite(fh, &flags, sizeof(uint8_t));
+        if (read->qualities != NULL) {
+            replayWrite(fh, read->qualities, read->rleRead->length);
+        }
+        replayWriteInt(fh, read->fullReadLength);
+        replayWriteInt(fh, read->source);
+
+        // the aligned pairs, each a tuple of the reference and read positions and the pair's weight
+        stList *alignment = stList_get(alignments, i);
+        replayWriteInt(fh, stList_length(alignment));
+        for (int64_t j = 0; j < stList_length(alignment); j++) {
+            stIntTuple *pair = stList_get(alignment, j);
+            assert(stIntTuple_length(pair) == 3);
+            for (int64_t k = 0; k < 3; k++) {
+                replayWriteInt(fh, stIntTuple_get(pair, k));
+            }
+        }
+    }
+}
+
+ChunkReplayBundle *chunkReplayBundle_construct(BamChunk *bamChunk, BamChunkReads *chunkReads, uint64_t maxDepth,
+                                               bool diploid, bool partitionFilteredReads,
+                                               uint64_t paramsFingerprint) {
+    ChunkReplayBundle *bundle = st_calloc(1, sizeof(ChunkReplayBundle));
+    FILE *fh = open_memstream(&bundle->payload, &bundle->payloadLength);
+    replayWriteString(fh, bamChunk->refSeqName, strlen(bamChunk->refSeqName));
+    replayWriteInt(fh, bamChunk->chunkIdx);
+    replayWriteInt(fh, bamChunk->chunkOverlapStart);
+    replayWriteInt(fh, bamChunk->chunkStart);
+    replayWriteInt(fh, bamChunk->chunkEnd);
+    replayWriteInt(fh, bamChunk->chunkOverlapEnd);
+    replayWriteInt(fh, maxDepth);
+    uint8_t phased[2] = { diploid, partitionFilteredReads };
+    replayWrite(fh, phased, 2 * sizeof(uint8_t));
+    replayWrite(fh, &paramsFingerprint, sizeof(uint64_t));
+    replayWriteRleString(fh, chunkReads->rleReference);
+    replayWriteReads(fh, chunkReads->reads, chunkReads->alignments);
+    replayWriteReads(fh, chunkReads->filteredReads, chunkReads->filteredAlignments);
+    fclose(fh);
+    return bundle;
+}
+
+void chunkReplayBundle_write(ChunkReplayBundle *bundle, char *file) {
+    int64_t compressedLength;
+    char *compressed = stCompression_compress(bundle->payload, bundle->payloadLength, &compressedLength, -1);
+    uint32_t header[2] = { CHUNK_REPLAY_MAGIC, CHUNK_REPLAY_VERSION };
+    uint64_t lengths[2] = { bundle->payloadLength, (uint64_t) compressedLength };
+    FILE *fh = safe_fopen(file, "wb");
+    if (fwrite(header, sizeof(uint32_t), 2, fh) != 2 || fwrite(lengths, sizeof(uint64_t), 2, fh) != 2 ||
+        fwrite(compressed, 1, compressedLength, fh) != (size_t) compressedLength || fclose(fh) != 0) {
+        st_errAbort("Failed to write the chunk replay bundle %s\n", file);
+    }
+    free(compressed);
+}
+
+void chunkReplayBundle_destruct(ChunkReplayBundle *bundle) {
+    free(bundle->payload);
+    free(bundle);
+}
+
+/*
+ * Reading a bundle's payload, aborting if it is truncated.
+ */
+
+typedef struct _replayReader {
+    char *file;
+    char *p;
+    char *end;
+} ReplayReader;
+
+static void replayRead(ReplayReader *reader, void *data, size_t length) {
+    if (length > (size_t) (reader->end - reader->p)) {
+        st_errAbort("Got a malformed chunk replay bundle %s\n", reader->file);
+    }
+    memcpy(data, reader->p, length);
+    reader->p += length;
+}
+
+static int64_t replayReadInt(ReplayReader *reader) {
+    int64_t i;
+    replayRead(reader, &i, sizeof(int64_t));
+    return i;
+}
+
+static char *replayReadString(ReplayReader *reader, uint64_t *length) {
+    replayRead(reader, length, sizeof(uint64_t));
+    if (*length > (uint64_t) (reader->end - reader->p)) {
+        st_errAbort("Got a malformed chunk replay bundle %s\n", reader->file);
+    }
+    char *string = st_malloc(*length + 1);
+    replayRead(reader, string, *length);
+    string[*length] = '\0';
+    return string;
+}
+
+static RleString *replayReadRleString(ReplayReader *reader) {
+    RleString *rleString = st_calloc(1, sizeof(RleString));
+    uint64_t length;
+    rleString->rleString = replayReadString(reader, &length);
+    rleString->length = length;
+    rleString->nonRleLength = length;
+    uint8_t hasRepeatCounts;
+    replayRead(reader, &hasRepeatCounts, sizeof(uint8_t));
+    if (!hasRepeatCounts) {
+        return rleString;
+    }
+    uint8_t *repeatCounts = st_malloc(length);
+    replayRead(reader, repeatCounts, length);
+    for (uint64_t i = 0; i < length; i++) {
+        uint64_t repeatCount = repeatCounts[i] == RLE_STRING_OVERFLOW_COUNT ? replayReadInt(reader) : repeatCounts[i];
+        if (repeatCount == 0) {
+            st_errAbort("Got a malformed chunk replay bundle %s\n", reader->file);
+        }
+        rleString_setRepeatCount(rleString, i, repeatCount);
+        rleString->nonRleLength += repeatCount - 1;
+    }
+    free(repeatCounts);
+    return rleString;
+}
+
+static void replayReadReads(ReplayReader *reader, stList *reads, stList *alignments) {
+    int64_t readNo = replayReadInt(reader);
+    for (int64_t i = 0; i < readNo; i++) {
+        BamChunkRead *read = st_calloc(1, sizeof(BamChunkRead));
+        uint64_t nameLength;
+        read->readName = replayReadString(reader, &nameLength);
+        read->rleRead = replayReadRleString(reader);
+        uint8_t flags;
+        replayRead(reader, &flags, sizeof(uint8_t));
+        read->forwardStrand = (flags & 1) != 0;
+        if (flags & 2) {
+            read->qualities = st_malloc(read->rleRead->length > 0 ? read->rleRead->length : 1);
+            replayRead(reader, read->qualities, read->rleRead->length);
+        }
+        read->fullReadLength = replayReadInt(reader);
+        read->source = replayReadInt(reader);
+        stList_append(reads, read);
+
+        int64_t pairNo = replayReadInt(reader);
+        if (pairNo < 0 || pairNo > (reader->end - reader->p) / (int64_t) (3 * sizeof(int64_t))) {
+            st_errAbort("Got a malformed chunk replay bundle %s\n", reader->file);
+        }
+        stList *alignment = stList_construct3(pairNo, (void (*)(void *)) stIntTuple_destruct);
+        for (int64_t j = 0; j < pairNo; j++) {
+            int64_t refPos = replayReadInt(reader);
+            int64_t readPos = replayReadInt(reader);
+            stList_set(alignment, j, stIntTuple_construct3(refPos, readPos, replayReadInt(reader)));
+        }
+        stList_append(alignments, alignment);
+    }
+}
+
+ChunkReplay *chunkReplay_read(char *file, PolishParams *polishParams) {
+    FILE *fh = safe_fopen(file, "rb");
+    uint32_t header[2];
+    uint64_t lengths[2];
+    bool hasHeader = fread(header, sizeof(uint32_t), 2, fh) == 2;
+    if (hasHeader && header[0] == __builtin_bswap32(CHUNK_REPLAY_MAGIC)) {
+        st_errAbort("The chunk replay bundle %s was written on a host of the other byte order\n", file);
+    }
+    if (!hasHeader || header[0] != CHUNK_REPLAY_MAGIC || fread(lengths, sizeof(uint64_t), 2, fh) != 2) {
+        st_errAbort("%s is not a chunk replay bundle\n", file);
+    }
+    if (header[1] != CHUNK_REPLAY_VERSION) {
+        st_errAbort("The chunk replay bundle %s is of version %" PRIu32 ", expected %d\n", file, header[1],
+                    CHUNK_REPLAY_VERSION);
+    }
+    char *compressed = st_malloc(lengths[1] > 0 ? lengths[1] : 1);
+    if (fread(compressed, 1, lengths[1], fh) != lengths[1]) {
+        st_errAbort("Got a truncated chunk replay bundle %s\n", file);
+    }
+    fclose(fh);
+    int64_t payloadLength;
+    char *payload = stCompression_decompress(compressed, lengths[1], &payloadLength);
+    free(compressed);
+    if ((uint64_t) payloadLength != lengths[0]) {
+        st_errAbort("Got a malformed chunk replay bundle %s\n", file);
+    }
+    ReplayReader reader = { file, payload, payload + payloadLength };
+
+    // the chunk is the only chunk of a chunker without a bam file
+    ChunkReplay *replay = st_calloc(1, sizeof(ChunkReplay));
+    replay->bamChunker = st_calloc(1, sizeof(BamChunker));
+    replay->bamChunker->includeSoftClip = polishParams->includeSoftClipping;
+    replay->bamChunker->params = polishParams;
+    replay->bamChunker->chunks = stList_construct3(0, (void (*)(void *)) bamChunk_destruct);
+    uint64_t nameLength;
+    char *refSeqName = replayReadString(&reader, &nameLength);
+    int64_t coordinates[5];
+    for (int64_t i = 0; i < 5; i++) {
+        coordinates[i] = replayReadInt(&reader);
+    }
+    replay->bamChunk = bamChunk_construct2(refSeqName, coordinates[0], coordinates[1], coordinates[2],
+                                           coordinates[3], coordinates[4], 0, replay->bamChunker);
+    free(refSeqName);
+    stList_append(replay->bamChunker->chunks, replay->bamChunk);
+    replay->bamChunker->chunkCount = 1;
+    replay->maxDepth = replayReadInt(&reader);
+    uint8_t phased[2];
+    replayRead(&reader, phased, 2 * sizeof(uint8_t));
+    replay->diploid = phased[0];
+    replay->partitionFilteredReads = phased[1];
+    replayRead(&reader, &replay->paramsFingerprint, sizeof(uint64_t));
+
+    // the reference, reads and alignments
+    replay->chunkReads = bamChunkReads_construct(replayReadRleString(&reader));
+    replayReadReads(&reader, replay->chunkReads->reads, replay->chunkReads->alignments);
+    replayReadReads(&reader, replay->chunkReads->filteredReads, replay->chunkReads->filteredAlignments);
+    if (reader.p != reader.end) {
+        st_errAbort("Got a malformed chunk replay bundle %s\n", file);
+    }
+    free(payload);
+    return replay;
+}
+
+void chunkReplay_destruct(ChunkReplay *replay) {
+    if (replay->chunkReads != NULL) {
+        bamChunkReads_destruct(replay->chunkReads);
+    }
+    bamChunker_destruct(replay->bamChunker);
+    free(replay);
+}
@@ -71,6 +71,16 @@ BamChunkRead *bamChunkRead_constructCopy(BamChunkRead *copy) {
     return r;
 }
 
+void bamChunkRead_destructSequence(BamChunkRead *r) {
+    if (r->rleRead != NULL) rleString_destruct(r->rleRead);
+    if (r->qualities != NULL) free(r->qualities);
+    if (r->bamChunkReadVcfEntrySubstrings != NULL)
+        bamChunkReadVcfEntrySubstrings_destruct(r->bamChunkReadVcfEntrySubstrings);
+    r->rleRead = NULL;
+    r->qualities = NULL;
+    r->bamChunkReadVcfEntrySubstrings = NULL;
+}
+
 void bamChunkRead_destruct(BamChunkRead *r) {
     if (r->readName != NULL) free(r->readName);
     if (r->rleRead != NULL) rleString_destruct(r->rleRead);
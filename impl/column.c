@@ -41,10 +41,26 @@ void stRPColumn_destruct(stRPColumn *column) {
 
     free(column->seqHeaders);
     free(column->seqs);
+    free(column->bitCountVectors);
+    if (column->emissions != NULL) {
+        stRPColumnEmissions_destruct(column->emissions);
+    }
 
     free(column);
 }
 
+uint64_t *stRPColumn_getBitCountVectors(stRPColumn *column, stReference *ref) {
+    /*
+     * Gets the bit count vectors of the column's sites (see calculateCountBitVectors), calculating them on first use.
+     * The vectors are owned by the column.
+     */
+    if (column->bitCountVectors == NULL) {
+        column->bitCountVectors = calculateCountBitVectors(column->seqs, ref, column->refStart,
+                                                           column->length, column->depth);
+    }
+    return column->bitCountVectors;
+}
+
 void stRPColumn_print(stRPColumn *column, FILE *fileHandle, bool includeCells) {
     /*
      * Print a description of the column. If includeCells is true then print the
@@ -88,7 +104,7 @@ void stRPColumn_split(stRPColumn *column, int64_t firstHalfLength, stRPHmm *hmm)
                                                column->length - firstHalfLength, column->depth, seqHeaders, seqs);
 
     // Create merge column
-    uint64_t acceptMask = makeAcceptMask(column->depth);
+    stRPPartition acceptMask = makeAcceptMask(column->depth);
     stRPMergeColumn *mColumn = stRPMergeColumn_construct(acceptMask, acceptMask);
 
     // Copy cells
@@ -121,6 +137,14 @@ void stRPColumn_split(stRPColumn *column, int64_t firstHalfLength, stRPHmm *hmm)
 
     // Adjust length of previous column
     column->length = firstHalfLength;
+
+    // Any cached bit count vectors and emission tables cover the old length
+    free(column->bitCountVectors);
+    column->bitCountVectors = NULL;
+    if (column->emissions != NULL) {
+        stRPColumnEmissions_destruct(column->emissions);
+        column->emissions = NULL;
+    }
 }
 
 stSet *stRPColumn_getColumnSequencesAsSet(stRPColumn *column) {
@@ -154,14 +178,14 @@ stSet *stRPColumn_getSequencesInCommon(stRPColumn *column1, stRPColumn *column2)
  * Read partitioning hmm state (stRPCell) functions
  */
 
-stRPCell *stRPCell_construct(int64_t partition) {
-    stRPCell *cell = st_calloc(1, sizeof(stRPCell));
+stRPCell *stRPCell_construct(stRPPartition partition) {
+    stRPCell *cell = chunkArena_calloc(1, sizeof(stRPCell));
     cell->partition = partition;
     return cell;
 }
 
 void stRPCell_destruct(stRPCell *cell) {
-    free(cell);
+    chunkArena_free(cell);
 }
 
 void stRPCell_print(stRPCell *cell, FILE *fileHandle) {
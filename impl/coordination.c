@@ -183,6 +183,64 @@ stSet *getOverlappingComponents(stList *tilingPath1, stList *tilingPath2) {
     return components;
 }
 
+TilingPathComponent *getOverlappingComponents2(stList *tilingPath1, stList *tilingPath2, int64_t *componentNumber) {
+    /*
+     * As getOverlappingComponents, but returns the components as an array of length *componentNumber, ordered by
+     * reference coordinate. As the hmms in each tiling path are sorted and do not overlap, the hmms of a component
+     * are contiguous in each path, so each component is given by a range of indices in each path.
+     *
+     * The two paths are merged in reference order. An hmm joins the current component if it starts before the
+     * end of the component, as all the hmms in the component start before it, otherwise it starts a new component.
+     */
+    int64_t length1 = stList_length(tilingPath1), length2 = stList_length(tilingPath2);
+    TilingPathComponent *components = st_malloc(sizeof(TilingPathComponent) *
+                                                (length1 + length2 > 0 ? length1 + length2 : 1));
+    *componentNumber = 0;
+
+    TilingPathComponent *component = NULL;
+    stRPHmm *lastHmm = NULL; // The hmm of the current component with the greatest end coordinate
+    int64_t i = 0, j = 0;
+    while (i < length1 || j < length2) {
+        // Get the next hmm in reference order
+        stRPHmm *hmm1 = i < length1 ? stList_get(tilingPath1, i) : NULL;
+        stRPHmm *hmm2 = j < length2 ? stList_get(tilingPath2, j) : NULL;
+        bool fromPath1 = hmm2 == NULL || (hmm1 != NULL && stRPHmm_cmpFn(hmm1, hmm2) < 0);
+        stRPHmm *hmm = fromPath1 ? hmm1 : hmm2;
+
+        // If it does not overlap the current component start a new one
+        if (lastHmm == NULL || !stRPHmm_overlapOnReference(lastHmm, hmm)) {
+            component = &components[(*componentNumber)++];
+            component->start1 = component->end1 = i;
+            component->start2 = component->end2 = j;
+            component->refLength = 0;
+            lastHmm = hmm;
+        } else if (hmm->refStart + hmm->refLength > lastHmm->refStart + lastHmm->refLength) {
+            lastHmm = hmm;
+        }
+
+        // Add the hmm to the component
+        if (fromPath1) {
+            component->end1 = ++i;
+        } else {
+            component->end2 = ++j;
+        }
+        component->refLength += hmm->refLength;
+    }
+
+    return components;
+}
+
+static stList *getTilingPathRange(stList *tilingPath, int64_t start, int64_t end) {
+    /*
+     * Returns a new tiling path of the hmms in the given range of indices of the tiling path.
+     */
+    stList *subTilingPath = stList_construct();
+    for (int64_t i = start; i < end; i++) {
+        stList_append(subTilingPath, stList_get(tilingPath, i));
+    }
+    return subTilingPath;
+}
+
 stList *getTilingPaths(stSortedSet *hmms) {
     /*
      * Takes set of hmms ordered by reference coordinate (see stRPHmm_cmpFn) and returns
@@ -260,6 +318,17 @@ stRPHmm *fuseTilingPath(stList *tilingPath) {
     return rightHmm;
 }
 
+static int componentSizeCmpFn(const void *a, const void *b) {
+    /*
+     * Sorts components by descending reference length, then by reference coordinate.
+     */
+    TilingPathComponent *c1 = *(TilingPathComponent **) a, *c2 = *(TilingPathComponent **) b;
+    if (c1->refLength != c2->refLength) {
+        return c1->refLength > c2->refLength ? -1 : 1;
+    }
+    return c1 < c2 ? -1 : (c1 > c2 ? 1 : 0);
+}
+
 stList *mergeTwoTilingPaths(stList *tilingPath1, stList *tilingPath2) {
     /*
      *  Takes two lists, tilingPath1 and tilingPath2, each of which is a set of hmms
@@ -270,70 +339,76 @@ stList *mergeTwoTilingPaths(stList *tilingPath1, stList *tilingPath2) {
      *  Destroys the input tilingPaths in the process and cleans them up.
      */
 
-    // Partition of the hmms into overlapping connected components
-    stSet *components = getOverlappingComponents(tilingPath1, tilingPath2);
-    // Cleanup the input tiling paths
-    stList_destruct(tilingPath1);
-    stList_destruct(tilingPath2);
-
-    // The output tiling path, which starts out empty
-    stList *newTilingPath = stList_construct();
+    // Partition of the hmms into overlapping connected components, in reference order
+    int64_t componentNumber;
+    TilingPathComponent *components = getOverlappingComponents2(tilingPath1, tilingPath2, &componentNumber);
 
     // Fuse the hmms
 
-    // For each component of overlapping hmms
-    stList *componentsList = stSet_getList(components);
-    for (int64_t i = 0; i < stList_length(componentsList); i++) {
-        stSortedSet *component = stList_get(componentsList, i);
-        stSet_remove(components, component);
-
-        // Make two sub-tiling paths (there can only be two maximal paths, by definition)
-        stList *tilingPaths = getTilingPaths(component);
-
-        stRPHmm *hmm = NULL;
-
-        if (stList_length(tilingPaths) == 2) {
-            stList *subTilingPath1 = stList_get(tilingPaths, 0);
-            stList *subTilingPath2 = stList_get(tilingPaths, 1);
+    // For each component of overlapping hmms, largest first so that the longest merges are started first when
+    // they are run as tasks
+    TilingPathComponent **componentsBySize = st_malloc(sizeof(TilingPathComponent *) *
+                                                       (componentNumber > 0 ? componentNumber : 1));
+    for (int64_t i = 0; i < componentNumber; i++) {
+        componentsBySize[i] = &components[i];
+    }
+    qsort(componentsBySize, componentNumber, sizeof(TilingPathComponent *), componentSizeCmpFn);
+    stRPHmm **hmms = st_calloc(componentNumber > 0 ? componentNumber : 1, sizeof(stRPHmm *));
+    for (int64_t k = 0; k < componentNumber; k++) {
+        TilingPathComponent *component = componentsBySize[k];
+        int64_t i = component - components; // The index of the component in reference order
+
+        if (component->end1 > component->start1 && component->end2 > component->start2) {
+            // Make the two sub-tiling paths of the component (there can only be two maximal paths, by definition)
+            stList *subTilingPath1 = getTilingPathRange(tilingPath1, component->start1, component->end1);
+            stList *subTilingPath2 = getTilingPathRange(tilingPath2, component->start2, component->end2);
+
+            // The components are independent, so fuse and merge each as a task
+#if defined(_OPENMP)
+#pragma omp task firstprivate(i, subTilingPath1, subTilingPath2) shared(hmms)
+#endif
+            {
+                // Fuse the hmms in each sub tiling path
+                stRPHmm *hmm1 = fuseTilingPath(subTilingPath1);
+                stRPHmm *hmm2 = fuseTilingPath(subTilingPath2);
 
-            // Fuse the hmms in each sub tiling path
-            stRPHmm *hmm1 = fuseTilingPath(subTilingPath1);
-            stRPHmm *hmm2 = fuseTilingPath(subTilingPath2);
+                // Align
+                stRPHmm_alignColumns(hmm1, hmm2);
 
-            // Align
-            stRPHmm_alignColumns(hmm1, hmm2);
+                // Merge
+                stRPHmm *hmm = stRPHmm_createCrossProductOfTwoAlignedHmm(hmm1, hmm2);
+                stRPHmm_destruct(hmm1, 1);
+                stRPHmm_destruct(hmm2, 1);
 
-            // Merge
-            hmm = stRPHmm_createCrossProductOfTwoAlignedHmm(hmm1, hmm2);
-            stRPHmm_destruct(hmm1, 1);
-            stRPHmm_destruct(hmm2, 1);
+                // Prune
+                stRPHmm_forwardBackward(hmm);
+                stRPHmm_prune(hmm);
 
-            // Prune
-            stRPHmm_forwardBackward(hmm);
-            stRPHmm_prune(hmm);
+                hmms[i] = hmm;
+            }
         } else { // Case that component is just one hmm that does not
             // overlap anything else
-            assert(stList_length(tilingPaths) == 1);
-            stList *subTilingPath1 = stList_get(tilingPaths, 0);
-            assert(stList_length(subTilingPath1) == 1);
-
-            hmm = stList_pop(subTilingPath1);
-            stList_destruct(subTilingPath1);
+            assert(component->end1 - component->start1 + component->end2 - component->start2 == 1);
+            hmms[i] = component->end1 > component->start1 ? stList_get(tilingPath1, component->start1) :
+                      stList_get(tilingPath2, component->start2);
         }
+    }
+#if defined(_OPENMP)
+#pragma omp taskwait
+#endif
 
-        // Add to output tiling path
-        stList_append(newTilingPath, hmm);
-
-        stList_destruct(tilingPaths);
+    // Add to output tiling path, which is in reference order as the components are
+    stList *newTilingPath = stList_construct();
+    for (int64_t i = 0; i < componentNumber; i++) {
+        stList_append(newTilingPath, hmms[i]);
     }
 
     //Cleanup
-
-    stList_destruct(componentsList);
-    stSet_destruct(components);
-
-    // Sort new tiling path
-    stList_sort(newTilingPath, stRPHmm_cmpFn);
+    free(hmms);
+    free(componentsBySize);
+    free(components);
+    stList_destruct(tilingPath1);
+    stList_destruct(tilingPath2);
 
     return newTilingPath;
 }
@@ -378,18 +453,15 @@ stList *mergeTilingPaths(stList *tilingPaths) {
         }
 
 #if defined(_OPENMP)
-#pragma omp parallel
-        {
-#pragma omp sections nowait
-        {
-#pragma omp section
-                tilingPath1 = mergeTilingPaths(tilingPaths1);
+        // Merge the first half as a task, which can be picked up by an idle thread of the enclosing parallel
+        // region, while this thread merges the second half. This gives a reduction tree of tasks over the tiling
+        // paths, each merge also running its components as tasks (see mergeTwoTilingPaths)
+#pragma omp task shared(tilingPath1) firstprivate(tilingPaths1)
+        tilingPath1 = mergeTilingPaths(tilingPaths1);
 
-#pragma omp section
-                tilingPath2 = mergeTilingPaths(tilingPaths2);
+        tilingPath2 = mergeTilingPaths(tilingPaths2);
 
-        }
-        }
+#pragma omp taskwait
 #else
         tilingPath1 = mergeTilingPaths(tilingPaths1);
         tilingPath2 = mergeTilingPaths(tilingPaths2);
@@ -408,85 +480,226 @@ stList *mergeTilingPaths(stList *tilingPaths) {
     return mergeTwoTilingPaths(tilingPath1, tilingPath2);
 }
 
-static void getProfileSeqs(stList *tilingPath, stList *pSeqs) {
-    while (stList_length(tilingPath) > 0) {
-        stRPHmm *hmm = stList_pop(tilingPath);
-        assert(stList_length(hmm->profileSeqs) == 1);
-        stProfileSeq *pSeq = stList_peek(hmm->profileSeqs);
-        stRPHmm_destruct(hmm, 1);
-        stList_append(pSeqs, pSeq);
+/*
+ * A read considered by filterReadsByCoverageDepth.
+ */
+typedef struct _coverageFilterRead {
+    stProfileSeq *pSeq;
+    int64_t index; // In the input list, to break ties
+    int64_t informativeSites; // The number of sites at which the read does not support all alleles equally
+    bool discarded;
+} CoverageFilterRead;
+
+static int cmpint64(int64_t i, int64_t j) {
+    return i > j ? 1 : i < j ? -1 : 0;
+}
+
+static int64_t profileSeq_getInformativeSites(stProfileSeq *pSeq) {
+    int64_t informativeSites = 0;
+    for (uint64_t i = 0; i < pSeq->length; i++) {
+        stSite *site = &(pSeq->ref->sites[pSeq->refStart + i]);
+        uint8_t *probs = &(pSeq->profileProbs[site->alleleOffset - pSeq->alleleOffset]);
+        for (uint64_t j = 1; j < site->alleleNumber; j++) {
+            if (probs[j] != probs[0]) {
+                informativeSites++;
+                break;
+            }
+        }
     }
-    stList_destruct(tilingPath);
+    return informativeSites;
 }
 
-static int64_t tilingPathSize(stList *tilingPath) {
-    /*
-     * Returns the sum of the length of the profile sequences the tiling path contains
-     */
-    int64_t totalLength = 0;
-    for (int64_t i = 0; i < stList_length(tilingPath); i++) {
-        stRPHmm *hmm = stList_get(tilingPath, i);
-        assert(stList_length(hmm->profileSeqs) == 1);
-        stProfileSeq *pSeq = stList_peek(hmm->profileSeqs);
-        totalLength += pSeq->length;
+static int coverageFilterRead_cmpByStart(const void *a, const void *b) {
+    CoverageFilterRead *r1 = *(CoverageFilterRead **) a, *r2 = *(CoverageFilterRead **) b;
+    int i = strcmp(r1->pSeq->ref->referenceName, r2->pSeq->ref->referenceName);
+    if (i == 0) {
+        i = cmpint64(r1->pSeq->refStart, r2->pSeq->refStart);
+        if (i == 0) {
+            i = cmpint64(r1->index, r2->index);
+        }
     }
-    return totalLength;
+    return i;
 }
 
-int tilingPathsCmpFn(stList *tilingPath1, stList *tilingPath2, stHash *tilingPathLengths) {
-    int64_t length1 = *(int64_t *) stHash_search(tilingPathLengths, tilingPath1);
-    int64_t length2 = *(int64_t *) stHash_search(tilingPathLengths, tilingPath2);
+static int coverageFilterRead_cmpByEnd(const void *a, const void *b) {
+    CoverageFilterRead *r1 = (CoverageFilterRead *) a, *r2 = (CoverageFilterRead *) b;
+    int i = cmpint64(r1->pSeq->refStart + r1->pSeq->length, r2->pSeq->refStart + r2->pSeq->length);
+    return i == 0 ? cmpint64(r1->index, r2->index) : i;
+}
 
-    return length1 < length2 ? 1 : (length1 > length2 ? -1 : 0);
+static int coverageFilterRead_cmpByInformativeness(const void *a, const void *b) {
+    /*
+     * Orders the reads from the least to the most informative, by the sites they inform then the sites they span.
+     */
+    CoverageFilterRead *r1 = (CoverageFilterRead *) a, *r2 = (CoverageFilterRead *) b;
+    int i = cmpint64(r1->informativeSites, r2->informativeSites);
+    if (i == 0) {
+        i = cmpint64(r1->pSeq->length, r2->pSeq->length);
+        if (i == 0) {
+            i = cmpint64(r2->index, r1->index);
+        }
+    }
+    return i;
 }
 
 stList *filterReadsByCoverageDepth(stList *profileSeqs, stRPHmmParameters *params,
                                    stList *filteredProfileSeqs, stList *discardedProfileSeqs) {
     /*
      * Takes a set of profile sequences and returns a subset such that maximum coverage depth of the subset is
-     * less than or equal to params->maxCoverageDepth. The discarded sequences are placed in the list
-     * "discardedProfileSeqs", the retained sequences are placed in filteredProfileSeqs.
+     * less than or equal to params->maxCoverageDepth, or MAX_READ_PARTITIONING_DEPTH if less. The discarded sequences
+     * are placed in the list "discardedProfileSeqs", the retained sequences are placed in filteredProfileSeqs.
+     *
+     * The reads are swept in reference order, keeping the reads overlapping the current position. Whenever
+     * a read starts where the depth is already the maximum, the least informative of it and the overlapping reads, by
+     * the number of sites each informs, is discarded. Reads are thus only discarded where the coverage is too deep.
+     * The depth is the number of tiling paths made by getRPHmms, so the retained reads are within its maximum.
      */
-
-    // Create a set of tiling paths
     char *logIdentifier = getLogIdentifier();
-    stList *tilingPaths = getTilingPaths2(profileSeqs, params);
-    st_logDebug(" %s Got maximum tiling depth of: %i\n", logIdentifier, (int) stList_length(tilingPaths));
-
-    // Sort tiling paths my numbers of reads included
-    stHash *tilingPathLengths = stHash_construct2(NULL, free);
-    for (int64_t i = 0; i < stList_length(tilingPaths); i++) {
-        stList *tilingPath = stList_get(tilingPaths, i);
-        int64_t *length = st_calloc(1, sizeof(int64_t));
-        *length = tilingPathSize(tilingPath);
-        stHash_insert(tilingPathLengths, tilingPath, length);
+    int64_t maxCoverageDepth = params->maxCoverageDepth < MAX_READ_PARTITIONING_DEPTH ? params->maxCoverageDepth :
+                               MAX_READ_PARTITIONING_DEPTH;
+    int64_t readNo = stList_length(profileSeqs);
+    CoverageFilterRead *reads = st_calloc(readNo > 0 ? readNo : 1, sizeof(CoverageFilterRead));
+    CoverageFilterRead **readsByStart = st_malloc(sizeof(CoverageFilterRead *) * (readNo > 0 ? readNo : 1));
+    for (int64_t i = 0; i < readNo; i++) {
+        reads[i].pSeq = stList_get(profileSeqs, i);
+        reads[i].index = i;
+        reads[i].informativeSites = profileSeq_getInformativeSites(reads[i].pSeq);
+        readsByStart[i] = &reads[i];
     }
-    stList_sort2(tilingPaths, (int (*)(const void *, const void *, const void *)) tilingPathsCmpFn, tilingPathLengths);
-    stHash_destruct(tilingPathLengths);
-
-    // Eliminate reads until the maximum coverage depth to less than the give threshold
-    while (stList_length(tilingPaths) > params->maxCoverageDepth) {
-        stList *tilingPath = stList_pop(tilingPaths);
-        st_logDebug(" %s Discarding %i profiling sequences of total length: %i\n", logIdentifier,
-                (int) stList_length(tilingPath), (int) tilingPathSize(tilingPath));
-        getProfileSeqs(tilingPath, discardedProfileSeqs);
+    qsort(readsByStart, readNo, sizeof(CoverageFilterRead *), coverageFilterRead_cmpByStart);
+
+    // The reads overlapping the current position, ordered by where they end and by how informative they are
+    stSortedSet *activeByEnd = stSortedSet_construct3(coverageFilterRead_cmpByEnd, NULL);
+    stSortedSet *activeByInformativeness = stSortedSet_construct3(coverageFilterRead_cmpByInformativeness, NULL);
+    int64_t maxDepth = 0;
+    char *referenceName = NULL;
+    for (int64_t i = 0; i < readNo; i++) {
+        CoverageFilterRead *read = readsByStart[i];
+
+        // Drop the reads that end before the read starts, or are on an earlier reference sequence
+        if (referenceName != NULL && !stString_eq(referenceName, read->pSeq->ref->referenceName)) {
+            stSortedSet_destruct(activeByEnd);
+            stSortedSet_destruct(activeByInformativeness);
+            activeByEnd = stSortedSet_construct3(coverageFilterRead_cmpByEnd, NULL);
+            activeByInformativeness = stSortedSet_construct3(coverageFilterRead_cmpByInformativeness, NULL);
+        }
+        referenceName = read->pSeq->ref->referenceName;
+        CoverageFilterRead *activeRead;
+        while ((activeRead = stSortedSet_getFirst(activeByEnd)) != NULL &&
+               activeRead->pSeq->refStart + activeRead->pSeq->length <= read->pSeq->refStart) {
+            stSortedSet_remove(activeByEnd, activeRead);
+            stSortedSet_remove(activeByInformativeness, activeRead);
+        }
+
+        // Add the read, then if the depth is too great discard the least informative read
+        stSortedSet_insert(activeByEnd, read);
+        stSortedSet_insert(activeByInformativeness, read);
+        if (stSortedSet_size(activeByEnd) > maxCoverageDepth) {
+            activeRead = stSortedSet_getFirst(activeByInformativeness);
+            stSortedSet_remove(activeByEnd, activeRead);
+            stSortedSet_remove(activeByInformativeness, activeRead);
+            activeRead->discarded = 1;
+        }
+        if (stSortedSet_size(activeByEnd) > maxDepth) {
+            maxDepth = stSortedSet_size(activeByEnd);
+        }
     }
+    st_logDebug(" %s Got maximum coverage depth of: %i after filtering\n", logIdentifier, (int) maxDepth);
 
-    while (stList_length(tilingPaths) > 0) {
-        getProfileSeqs(stList_pop(tilingPaths), filteredProfileSeqs);
+    // The reads retained and discarded, each in the input order
+    for (int64_t i = 0; i < readNo; i++) {
+        stList_append(reads[i].discarded ? discardedProfileSeqs : filteredProfileSeqs, reads[i].pSeq);
     }
 
     st_logInfo(" %s Filtered %" PRIi64 " reads of %" PRIi64 " to achieve maximum coverage depth of %" PRIi64 "\n",
-               logIdentifier, stList_length(discardedProfileSeqs), stList_length(profileSeqs),
-               params->maxCoverageDepth);
+               logIdentifier, stList_length(discardedProfileSeqs), stList_length(profileSeqs), maxCoverageDepth);
 
     // Cleanup
-    stList_destruct(tilingPaths);
+    stSortedSet_destruct(activeByEnd);
+    stSortedSet_destruct(activeByInformativeness);
+    free(readsByStart);
+    free(reads);
     free(logIdentifier);
 
     return filteredProfileSeqs;
 }
 
+static int profileSeq_cmpByStart(const void *a, const void *b) {
+    /*
+     * Sorts profile sequences by reference sequence then by start.
+     */
+    stProfileSeq *pSeq1 = *(stProfileSeq **) a, *pSeq2 = *(stProfileSeq **) b;
+    int i = strcmp(pSeq1->ref->referenceName, pSeq2->ref->referenceName);
+    return i != 0 ? i : cmpint64(pSeq1->refStart, pSeq2->refStart);
+}
+
+static stList *getRPHmmsBySweep(stList *profileSeqs, stRPHmmParameters *params) {
+    /*
+     * As getRPHmms, but making the hmm of each set of overlapping profile sequences directly, see
+     * stRPHmm_constructBySweep.
+     */
+    stList *sortedProfileSeqs = stList_copy(profileSeqs, NULL);
+    stList_sort(sortedProfileSeqs, profileSeq_cmpByStart);
+
+    // Divide the sequences into connected components of sequences overlapping on the reference, in reference order
+    stList *components = stList_construct3(0, (void (*)(void *)) stList_destruct);
+    stList *component = NULL;
+    stProfileSeq *pSeq = NULL;
+    int64_t componentEnd = 0;
+    for (int64_t i = 0; i < stList_length(sortedProfileSeqs); i++) {
+        stProfileSeq *nextPSeq = stList_get(sortedProfileSeqs, i);
+        if (component == NULL || !stString_eq(pSeq->ref->referenceName, nextPSeq->ref->referenceName) ||
+            nextPSeq->refStart >= componentEnd) {
+            component = stList_construct();
+            stList_append(components, component);
+            componentEnd = 0;
+        }
+        pSeq = nextPSeq;
+        stList_append(component, pSeq);
+        if (pSeq->refStart + pSeq->length > componentEnd) {
+            componentEnd = pSeq->refStart + pSeq->length;
+        }
+    }
+
+    // Make the hmm of each component, as a task as they are independent
+    int64_t componentNumber = stList_length(components);
+    stRPHmm **hmms = st_calloc(componentNumber > 0 ? componentNumber : 1, sizeof(stRPHmm *));
+    for (int64_t i = 0; i < componentNumber; i++) {
+        component = stList_get(components, i);
+#if defined(_OPENMP)
+#pragma omp task firstprivate(i, component) shared(hmms)
+#endif
+        {
+            if (stList_length(component) == 1) {
+                hmms[i] = stRPHmm_construct(stList_get(component, 0), params);
+            } else {
+                stRPHmm *hmm = stRPHmm_constructBySweep(component, params);
+
+                // Prune
+                stRPHmm_forwardBackward(hmm);
+                stRPHmm_prune(hmm);
+
+                hmms[i] = hmm;
+            }
+        }
+    }
+#if defined(_OPENMP)
+#pragma omp taskwait
+#endif
+
+    stList *tilingPath = stList_construct3(0, (void (*)(void *)) stRPHmm_destruct2);
+    for (int64_t i = 0; i < componentNumber; i++) {
+        stList_append(tilingPath, hmms[i]);
+    }
+
+    // Cleanup
+    free(hmms);
+    stList_destruct(components);
+    stList_destruct(sortedProfileSeqs);
+
+    return tilingPath;
+}
+
 stList *getRPHmms(stList *profileSeqs, stRPHmmParameters *params) {
     /*
      * Takes a set of profile sequences (stProfileSeq) and returns a list of read partitioning
@@ -494,6 +707,24 @@ stList *getRPHmms(stList *profileSeqs, stRPHmmParameters *params) {
      * referenceNamesToReferencePriors is a map from reference sequence names to corresponding
      * stReferencePriorProbs objects.
      */
+    // Make the hmms directly from the sequences, if configured
+    if (params->sweepHmmConstruction && (params->forwardBeamLogProbMargin > 0 || params->forwardBeamMaxCells > 0)) {
+        stList *tilingPath;
+#if defined(_OPENMP)
+        if (!omp_in_parallel()) {
+            // As for the merge below, open a parallel region for the tasks to run in
+#pragma omp parallel
+#pragma omp single
+            tilingPath = getRPHmmsBySweep(profileSeqs, params);
+        } else {
+            tilingPath = getRPHmmsBySweep(profileSeqs, params);
+        }
+#else
+        tilingPath = getRPHmmsBySweep(profileSeqs, params);
+#endif
+        return tilingPath;
+    }
+
     // Create a read partitioning HMM for every sequence and put in ordered set, ordered by reference coordinate
     stList *tilingPaths = getTilingPaths2(profileSeqs, params);
 
@@ -509,7 +740,20 @@ stList *getRPHmms(stList *profileSeqs, stRPHmmParameters *params) {
 
     // Merge together the tiling paths into one merged tiling path, merging the individual hmms when
     // they overlap on the reference
-    stList *finalTilingPath = mergeTilingPaths(tilingPaths);
+    stList *finalTilingPath;
+#if defined(_OPENMP)
+    if (!omp_in_parallel()) {
+        // Open a parallel region for the merge's tasks to run in. Otherwise, e.g. within the chunk loops of polish
+        // and phase, the tasks are shared with the threads of the enclosing region as they become free
+#pragma omp parallel
+#pragma omp single
+        finalTilingPath = mergeTilingPaths(tilingPaths);
+    } else {
+        finalTilingPath = mergeTilingPaths(tilingPaths);
+    }
+#else
+    finalTilingPath = mergeTilingPaths(tilingPaths);
+#endif
     stList_setDestructor(finalTilingPath, (void (*)(void *)) stRPHmm_destruct2);
 
     return finalTilingPath;
@@ -6,6 +6,24 @@
 
 #include "margin.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__BMI2__)
+#include <immintrin.h>
+#endif
+
+// On x86-64 linux gcc builds the allele probabilities of a site (see alleleLogHapProbabilities) with AVX-512 and
+// with AVX2 as well as without, using whichever the host supports
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && defined(__linux__) && ALLELE_LOG_PROB_BITS == 8
+#define ALLELE_POPCOUNT_DISPATCH 1
+#include <immintrin.h>
+#endif
+
+// Sites with at most this many reads with non-zero allele probabilities get an emission table, see
+// stRPColumn_getEmissions
+#define MAX_EMISSION_TABLE_READS 8
+
 /*
  * Allele alphabet and substitutions
  */
@@ -57,11 +75,9 @@ inline int popcount64(uint64_t x) {
 
 inline int popcount128(uint128_t n) {
     /*
-     *  128 bit popcount. Currently naive. TODO: planning to allow partitions to be up to depth 128
+     * 128 bit popcount, of the two words.
      */
-    uint64_t parts[2];
-    memcpy(parts, &n, sizeof(n));
-    return popcount64(parts[0]) + popcount64(parts[1]);
+    return popcount64((uint64_t) n) + popcount64((uint64_t) (n >> 64));
 }
 
 static inline uint64_t *retrieveBitCountVector(uint64_t *bitCountVector,
@@ -88,10 +104,100 @@ uint64_t calculateBitCountVector(uint8_t **seqs, uint64_t depth,
     return bitCountVector;
 }
 
+#if defined(__SSE2__)
+static inline void addBitPlanes(__m128i v, uint64_t firstRead, uint64_t *bitCountVector) {
+    /*
+     * Adds the ALLELE_LOG_PROB_BITS bits of an allele's probability for sixteen reads, one read per byte of v, to the
+     * allele's bit count vectors. Movemask takes the top bit of each byte and adding the vector to itself then shifts
+     * the next bit up.
+     */
+    for (int64_t k = ALLELE_LOG_PROB_BITS - 1; k >= 0; k--) {
+        bitCountVector[k] |= ((uint64_t) (uint16_t) _mm_movemask_epi8(v)) << firstRead;
+        v = _mm_add_epi8(v, v);
+    }
+}
+
+static inline void transposeTile(__m128i *x) {
+    /*
+     * Transposes a 16 x 16 tile of bytes, one row per vector, by interleaving rows with ever wider elements. Leaves
+     * column j of the tile in x[j'], where j' is j with its four bits reversed.
+     */
+    __m128i y[16];
+    for (int64_t i = 0; i < 8; i++) {
+        y[i] = _mm_unpacklo_epi8(x[2 * i], x[2 * i + 1]);
+        y[i + 8] = _mm_unpackhi_epi8(x[2 * i], x[2 * i + 1]);
+    }
+    for (int64_t i = 0; i < 8; i++) {
+        x[i] = _mm_unpacklo_epi16(y[2 * i], y[2 * i + 1]);
+        x[i + 8] = _mm_unpackhi_epi16(y[2 * i], y[2 * i + 1]);
+    }
+    for (int64_t i = 0; i < 8; i++) {
+        y[i] = _mm_unpacklo_epi32(x[2 * i], x[2 * i + 1]);
+        y[i + 8] = _mm_unpackhi_epi32(x[2 * i], x[2 * i + 1]);
+    }
+    for (int64_t i = 0; i < 8; i++) {
+        x[i] = _mm_unpacklo_epi64(y[2 * i], y[2 * i + 1]);
+        x[i + 8] = _mm_unpackhi_epi64(y[2 * i], y[2 * i + 1]);
+    }
+}
+#endif
+
+static void transposeColumnBits(uint8_t **seqs, uint64_t depth, uint64_t alleleNumber, uint64_t alleleStride,
+                                uint64_t *bitCountVectors) {
+    /*
+     * Adds the ALLELE_LOG_PROB_BITS bit count vectors of each of the first alleleNumber alleles of at most 64
+     * reads, i.e. the transpose of the reads' allele probability bits, to the zeroed vectors, those of allele j
+     * starting at bitCountVectors[j * alleleStride].
+     *
+     * With SSE2 the reads are taken sixteen at a time, reading sixteen consecutive alleles of each read with one
+     * load and transposing the resulting tile in registers, so each read's probabilities are streamed in order.
+     */
+    assert(depth <= NARROW_PARTITIONING_DEPTH);
+    uint64_t i = 0;
+#if defined(__SSE2__)
+    static const int64_t tileColumns[16] = { 0, 8, 4, 12, 2, 10, 6, 14, 1, 9, 5, 13, 3, 11, 7, 15 };
+    for (; i + 16 <= depth; i += 16) {
+        uint64_t j = 0;
+        for (; j + 16 <= alleleNumber; j += 16) {
+            __m128i x[16];
+            for (int64_t k = 0; k < 16; k++) {
+                x[k] = _mm_loadu_si128((const __m128i *) &seqs[i + k][j]);
+            }
+            transposeTile(x);
+            for (int64_t k = 0; k < 16; k++) {
+                addBitPlanes(x[k], i, &bitCountVectors[(j + tileColumns[k]) * alleleStride]);
+            }
+        }
+        // Remaining alleles, gathering the sixteen reads' bytes
+        for (; j < alleleNumber; j++) {
+            uint8_t bytes[16];
+            for (int64_t k = 0; k < 16; k++) {
+                bytes[k] = seqs[i + k][j];
+            }
+            addBitPlanes(_mm_loadu_si128((const __m128i *) bytes), i, &bitCountVectors[j * alleleStride]);
+        }
+    }
+#endif
+    // Remaining reads
+    for (; i < depth; i++) {
+        for (uint64_t j = 0; j < alleleNumber; j++) {
+            uint64_t p = seqs[i][j];
+            for (uint64_t k = 0; k < ALLELE_LOG_PROB_BITS; k++) {
+                bitCountVectors[j * alleleStride + k] |= ((p >> k) & 1) << i;
+            }
+        }
+    }
+}
+
 uint64_t *calculateCountBitVectors(uint8_t **seqs, stReference *ref,
                                    uint64_t firstSite, uint64_t length, uint64_t depth) {
     /*
      * Calculates the bit count vector for every site, allele and bit in the given range of sites.
+     *
+     * Each vector has a bit for each read, so with at most NARROW_PARTITIONING_DEPTH reads it is a word. With more,
+     * each allele's vectors of the first NARROW_PARTITIONING_DEPTH reads are followed by those of the rest, so the two
+     * words of the allele are found as if they were the vectors of two consecutive narrow alleles, see
+     * getLogProbOfAllele.
      */
 
     if (ref->length == 0) {
@@ -104,34 +210,40 @@ uint64_t *calculateCountBitVectors(uint8_t **seqs, stReference *ref,
             firstSite + length < ref->length ? ref->sites[firstSite + length].alleleOffset : ref->totalAlleles;
 
     // Array of bit vectors, for each site, for each allele and for each bit in uint8_t
-    uint64_t *bitCountVectors = st_malloc((lastAllele - firstAllele) * ALLELE_LOG_PROB_BITS * sizeof(uint64_t));
-
-    // For each site
-    for (uint64_t i = firstSite; i < firstSite + length; i++) {
-        // For each allele
-        uint64_t siteOffset = ref->sites[i].alleleOffset - firstAllele;
-        for (uint64_t j = 0; j < ref->sites[i].alleleNumber; j++) {
-            // For each bit
-            for (uint64_t k = 0; k < ALLELE_LOG_PROB_BITS; k++) {
-                *retrieveBitCountVector(bitCountVectors, siteOffset, j, k) =
-                        calculateBitCountVector(seqs, depth, siteOffset, j, k);
-            }
-        }
+    uint64_t alleleStride = (depth > NARROW_PARTITIONING_DEPTH ? 2 : 1) * ALLELE_LOG_PROB_BITS;
+    uint64_t *bitCountVectors = st_calloc((lastAllele - firstAllele) * alleleStride, sizeof(uint64_t));
+
+    // The alleles of the sites are contiguous in each read, so transpose them all together
+    if (depth > NARROW_PARTITIONING_DEPTH) {
+        transposeColumnBits(seqs, NARROW_PARTITIONING_DEPTH, lastAllele - firstAllele, alleleStride,
+                            bitCountVectors);
+        transposeColumnBits(seqs + NARROW_PARTITIONING_DEPTH, depth - NARROW_PARTITIONING_DEPTH,
+                            lastAllele - firstAllele, alleleStride, bitCountVectors + ALLELE_LOG_PROB_BITS);
+    } else {
+        transposeColumnBits(seqs, depth, lastAllele - firstAllele, alleleStride, bitCountVectors);
     }
 
     return bitCountVectors;
 }
 
-uint64_t getLogProbOfAllele(uint64_t *bitCountVectors, uint64_t depth, uint64_t partition,
+uint64_t getLogProbOfAllele(uint64_t *bitCountVectors, uint64_t depth, stRPPartition partition,
                             uint64_t siteOffset, uint64_t allele) {
     /*
-     * Returns the -log prob of the reads in a given partition being generated by a given allele.
+     * Returns the -log prob of the reads in a given partition being generated by a given allele. The depth is that
+     * of the column the bit count vectors were calculated for.
      */
+    if (depth > NARROW_PARTITIONING_DEPTH) {
+        // The allele's two words, see calculateCountBitVectors
+        uint64_t i = 2 * (siteOffset + allele);
+        return getLogProbOfAllele(bitCountVectors, 0, (uint64_t) partition, i, 0) +
+               getLogProbOfAllele(bitCountVectors, 0, (uint64_t) (partition >> 64), i + 1, 0);
+    }
+
     uint64_t *j = retrieveBitCountVector(bitCountVectors, siteOffset, allele, 0);
-    uint64_t negLogProb = popcount64(j[0] & partition);
+    uint64_t negLogProb = popcount64(j[0] & (uint64_t) partition);
 
     for (uint64_t i = 1; i < ALLELE_LOG_PROB_BITS; i++) {
-        negLogProb += (popcount64(j[i] & partition) << i);
+        negLogProb += (popcount64(j[i] & (uint64_t) partition) << i);
     }
 
     return negLogProb;
@@ -141,15 +253,130 @@ static inline uint64_t minP(uint64_t a, uint64_t b) {
     return a < b ? a : b;
 }
 
-static inline void alleleLogHapProbabilities(stRPColumn *column, stSite *site, uint64_t siteOffset,
-                                             uint64_t partition, uint64_t *bitCountVectors,
-                                             uint64_t *alleleLogProbs) {
+static void alleleLogHapProbabilitiesScalar(uint64_t *bitCountVectors, uint64_t siteOffset, uint64_t alleleNumber,
+                                            uint64_t partition, uint64_t *alleleLogProbsHap1,
+                                            uint64_t *alleleLogProbsHap2) {
+    for (uint64_t i = 0; i < alleleNumber; i++) {
+        alleleLogProbsHap1[i] = getLogProbOfAllele(bitCountVectors, 0, partition, siteOffset, i);
+        alleleLogProbsHap2[i] = getLogProbOfAllele(bitCountVectors, 0, ~partition, siteOffset, i);
+    }
+}
+
+#if defined(ALLELE_POPCOUNT_DISPATCH)
+__attribute__((target("avx512f,avx512vpopcntdq")))
+static void alleleLogHapProbabilitiesAvx512(uint64_t *bitCountVectors, uint64_t siteOffset, uint64_t alleleNumber,
+                                            uint64_t partition, uint64_t *alleleLogProbsHap1,
+                                            uint64_t *alleleLogProbsHap2) {
+    /*
+     * The eight bit planes of an allele fill a vector, so each haplotype's probability is one and, popcount and
+     * weighted sum.
+     */
+    const __m512i partition1 = _mm512_set1_epi64((long long) partition);
+    const __m512i partition2 = _mm512_set1_epi64((long long) ~partition);
+    const __m512i weights = _mm512_setr_epi64(0, 1, 2, 3, 4, 5, 6, 7);
+    uint64_t *j = retrieveBitCountVector(bitCountVectors, siteOffset, 0, 0);
+    for (uint64_t i = 0; i < alleleNumber; i++) {
+        __m512i planes = _mm512_loadu_si512(&j[i * ALLELE_LOG_PROB_BITS]);
+        alleleLogProbsHap1[i] = _mm512_reduce_add_epi64(
+                _mm512_sllv_epi64(_mm512_popcnt_epi64(_mm512_and_si512(planes, partition1)), weights));
+        alleleLogProbsHap2[i] = _mm512_reduce_add_epi64(
+                _mm512_sllv_epi64(_mm512_popcnt_epi64(_mm512_and_si512(planes, partition2)), weights));
+    }
+}
+
+__attribute__((target("avx2")))
+static inline __m256i popcount256(__m256i v) {
+    /*
+     * Popcount of each 64 bit lane, looking up the count of each nibble and summing the bytes of each lane.
+     */
+    const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i lowNibbles = _mm256_set1_epi8(0x0f);
+    __m256i counts = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, _mm256_and_si256(v, lowNibbles)),
+                                     _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(v, 4),
+                                                                                  lowNibbles)));
+    return _mm256_sad_epu8(counts, _mm256_setzero_si256());
+}
+
+__attribute__((target("avx2")))
+static inline uint64_t weightedPopcount256(__m256i planesLow, __m256i planesHigh, __m256i partition) {
+    __m256i sums = _mm256_add_epi64(
+            _mm256_sllv_epi64(popcount256(_mm256_and_si256(planesLow, partition)), _mm256_setr_epi64x(0, 1, 2, 3)),
+            _mm256_sllv_epi64(popcount256(_mm256_and_si256(planesHigh, partition)), _mm256_setr_epi64x(4, 5, 6, 7)));
+    __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+    return (uint64_t) _mm_cvtsi128_si64(sum) + (uint64_t) _mm_extract_epi64(sum, 1);
+}
+
+__attribute__((target("avx2")))
+static void alleleLogHapProbabilitiesAvx2(uint64_t *bitCountVectors, uint64_t siteOffset, uint64_t alleleNumber,
+                                          uint64_t partition, uint64_t *alleleLogProbsHap1,
+                                          uint64_t *alleleLogProbsHap2) {
+    /*
+     * The eight bit planes of an allele fill two vectors, popcounted with a lookup table as AVX2 has no popcount.
+     */
+    const __m256i partition1 = _mm256_set1_epi64x((long long) partition);
+    const __m256i partition2 = _mm256_set1_epi64x((long long) ~partition);
+    uint64_t *j = retrieveBitCountVector(bitCountVectors, siteOffset, 0, 0);
+    for (uint64_t i = 0; i < alleleNumber; i++) {
+        __m256i planesLow = _mm256_loadu_si256((__m256i *) &j[i * ALLELE_LOG_PROB_BITS]);
+        __m256i planesHigh = _mm256_loadu_si256((__m256i *) &j[i * ALLELE_LOG_PROB_BITS + 4]);
+        alleleLogProbsHap1[i] = weightedPopcount256(planesLow, planesHigh, partition1);
+        alleleLogProbsHap2[i] = weightedPopcount256(planesLow, planesHigh, partition2);
+    }
+}
+#endif
+
+typedef void (*AlleleLogHapProbabilitiesFn)(uint64_t *bitCountVectors, uint64_t siteOffset, uint64_t alleleNumber,
+                                            uint64_t partition, uint64_t *alleleLogProbsHap1,
+                                            uint64_t *alleleLogProbsHap2);
+
+static AlleleLogHapProbabilitiesFn alleleLogHapProbabilitiesVectorised = alleleLogHapProbabilitiesScalar;
+static AlleleLogHapProbabilitiesFn alleleLogHapProbabilitiesFn = alleleLogHapProbabilitiesScalar;
+
+#if defined(ALLELE_POPCOUNT_DISPATCH)
+__attribute__((constructor))
+static void alleleLogHapProbabilities_resolve(void) {
+    /*
+     * Picks the version for the host when the program is loaded.
+     */
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512vpopcntdq")) {
+        alleleLogHapProbabilitiesVectorised = alleleLogHapProbabilitiesAvx512;
+    } else if (__builtin_cpu_supports("avx2")) {
+        alleleLogHapProbabilitiesVectorised = alleleLogHapProbabilitiesAvx2;
+    }
+    alleleLogHapProbabilitiesFn = alleleLogHapProbabilitiesVectorised;
+}
+#endif
+
+void setEmissionsUseVectorisedPopcount(bool useVectorised) {
+    alleleLogHapProbabilitiesFn = useVectorised ? alleleLogHapProbabilitiesVectorised :
+                                  alleleLogHapProbabilitiesScalar;
+}
+
+static inline void alleleLogHapProbabilities(stSite *site, uint64_t siteOffset, uint64_t depth,
+                                             stRPPartition partition, uint64_t *bitCountVectors,
+                                             uint64_t *alleleLogProbsHap1, uint64_t *alleleLogProbsHap2) {
     /*
      * For each allele calculate the -log probability of the
-     * sub-partition.
+     * sub-partition of each haplotype, the reads in the partition and those not in it.
+     *
+     * For a column of more than NARROW_PARTITIONING_DEPTH reads each word of the allele's bit count vectors is done
+     * as a narrow allele of its own (see calculateCountBitVectors) and the two summed.
      */
+    if (depth <= NARROW_PARTITIONING_DEPTH) {
+        alleleLogHapProbabilitiesFn(bitCountVectors, siteOffset, site->alleleNumber, (uint64_t) partition,
+                                    alleleLogProbsHap1, alleleLogProbsHap2);
+        return;
+    }
     for (uint64_t i = 0; i < site->alleleNumber; i++) {
-        alleleLogProbs[i] = getLogProbOfAllele(bitCountVectors, column->depth, partition, siteOffset, i);
+        uint64_t highLogProbHap1, highLogProbHap2;
+        alleleLogHapProbabilitiesFn(bitCountVectors, 2 * (siteOffset + i), 1, (uint64_t) partition,
+                                    &alleleLogProbsHap1[i], &alleleLogProbsHap2[i]);
+        alleleLogHapProbabilitiesFn(bitCountVectors, 2 * (siteOffset + i) + 1, 1, (uint64_t) (partition >> 64),
+                                    &highLogProbHap1, &highLogProbHap2);
+        alleleLogProbsHap1[i] += highLogProbHap1;
+        alleleLogProbsHap2[i] += highLogProbHap2;
     }
 }
 
@@ -185,7 +412,7 @@ static inline uint64_t getMaxAlleleLogProb(stSite *site, uint64_t *alleleLogProb
 }
 
 static inline uint64_t genotypeLogProbability(stRPColumn *column, stSite *site, uint64_t siteOffset,
-                                              uint64_t partition, uint64_t *bitCountVectors,
+                                              stRPPartition partition, uint64_t *bitCountVectors,
                                               bool includeAncestorSubProb) {
     /*
      * Get the -log probability of the alleles in a given position within a column for a given partition.
@@ -195,9 +422,9 @@ static inline uint64_t genotypeLogProbability(stRPColumn *column, stSite *site,
     // For each allele calculate the log probability of the
     // partition and store counts in an array
     uint64_t alleleLogProbsHap1[site->alleleNumber];
-    alleleLogHapProbabilities(column, site, siteOffset, partition, bitCountVectors, alleleLogProbsHap1);
     uint64_t alleleLogProbsHap2[site->alleleNumber];
-    alleleLogHapProbabilities(column, site, siteOffset, ~partition, bitCountVectors, alleleLogProbsHap2);
+    alleleLogHapProbabilities(site, siteOffset, column->depth, partition, bitCountVectors, alleleLogProbsHap1,
+                              alleleLogProbsHap2);
 
     if (!includeAncestorSubProb) {
         return getMaxAlleleLogProb(site, alleleLogProbsHap1) + getMaxAlleleLogProb(site, alleleLogProbsHap2);
@@ -218,27 +445,183 @@ static inline uint64_t genotypeLogProbability(stRPColumn *column, stSite *site,
     return logGenotypeProb;
 }
 
-double emissionLogProbability(stRPColumn *column,
-                              stRPCell *cell, uint64_t *bitCountVectors, stReference *ref,
-                              stRPHmmParameters *params) {
+static inline uint64_t packPartition(uint64_t partition, uint64_t mask) {
     /*
-     * Get the log probability of a set of reads for a given column.
+     * Packs together the bits of the partition that are in the mask, lowest first.
+     */
+#if defined(__BMI2__)
+    return _pext_u64(partition, mask);
+#else
+    uint64_t packed = 0;
+    for (uint64_t bit = 1; mask != 0; bit <<= 1, mask &= mask - 1) {
+        if (partition & mask & -mask) {
+            packed |= bit;
+        }
+    }
+    return packed;
+#endif
+}
+
+static inline uint64_t unpackPartition(uint64_t packed, uint64_t mask) {
+    /*
+     * Inverse of packPartition, with the bits not in the mask zero.
+     */
+#if defined(__BMI2__)
+    return _pdep_u64(packed, mask);
+#else
+    uint64_t partition = 0;
+    for (; mask != 0; packed >>= 1, mask &= mask - 1) {
+        if (packed & 1) {
+            partition |= mask & -mask;
+        }
+    }
+    return partition;
+#endif
+}
+
+static inline uint64_t packWidePartition(stRPPartition partition, stRPPartition mask) {
+    /*
+     * As packPartition, for the partitions of a column of more than NARROW_PARTITIONING_DEPTH reads: the bits in the
+     * low word of the mask and then those in the high word. Only for masks of at most MAX_EMISSION_TABLE_READS reads.
+     */
+    uint64_t lowMask = (uint64_t) mask;
+    return packPartition((uint64_t) partition, lowMask) |
+           packPartition((uint64_t) (partition >> 64), (uint64_t) (mask >> 64)) << popcount64(lowMask);
+}
+
+static inline stRPPartition unpackWidePartition(uint64_t packed, stRPPartition mask) {
+    /*
+     * Inverse of packWidePartition.
+     */
+    uint64_t lowMask = (uint64_t) mask;
+    return unpackPartition(packed, lowMask) |
+           (stRPPartition) unpackPartition(packed >> popcount64(lowMask), (uint64_t) (mask >> 64)) << 64;
+}
+
+void stRPColumnEmissions_destruct(stRPColumnEmissions *emissions) {
+    for (int64_t i = 0; i < emissions->length; i++) {
+        free(emissions->siteLogProbs[i]);
+    }
+    free(emissions->siteLogProbs);
+    free(emissions->siteReadMasks);
+    free(emissions);
+}
+
+stRPColumnEmissions *stRPColumn_getEmissions(stRPColumn *column, stReference *ref, stRPHmmParameters *params) {
+    /*
+     * Gets the emission tables of the column's sites (see stRPColumnEmissions), making them on first use. A site
+     * gets a table if it has at most MAX_EMISSION_TABLE_READS reads with non-zero allele probabilities and the table
+     * has no more entries than the column has cells, so filling it in costs no more than computing each cell's
+     * probability directly. The tables are owned by the column.
+     *
+     * A partition of the site's reads and its inverse have the same probability, as swapping the haplotypes leaves
+     * the genotype probabilities unchanged, so only the first half of each table, whose inverses are the second half,
+     * is computed.
+     */
+    if (column->emissions != NULL) {
+        if (column->emissions->includeAncestorSubProb == params->includeAncestorSubProb) {
+            return column->emissions;
+        }
+        stRPColumnEmissions_destruct(column->emissions);
+    }
+
+    int64_t cellNumber = 0;
+    for (stRPCell *cell = column->head; cell != NULL; cell = cell->nCell) {
+        cellNumber++;
+    }
+
+    uint64_t *bitCountVectors = stRPColumn_getBitCountVectors(column, ref);
+    stRPColumnEmissions *emissions = st_calloc(1, sizeof(stRPColumnEmissions));
+    emissions->length = column->length;
+    emissions->includeAncestorSubProb = params->includeAncestorSubProb;
+    emissions->siteReadMasks = st_calloc(column->length, sizeof(stRPPartition));
+    emissions->siteLogProbs = st_calloc(column->length, sizeof(uint64_t *));
+
+    bool wide = column->depth > NARROW_PARTITIONING_DEPTH;
+    uint64_t firstAllele = ref->sites[column->refStart].alleleOffset;
+    for (int64_t i = 0; i < column->length; i++) {
+        stSite *site = &(ref->sites[column->refStart + i]);
+        uint64_t siteOffset = site->alleleOffset - firstAllele;
+
+        // The reads with a non-zero bit in any of the site's bit count vectors, whose words alternate between the
+        // low and high reads of a wide column
+        stRPPartition readMask = 0;
+        uint64_t words = wide ? 2 : 1;
+        for (uint64_t j = 0; j < site->alleleNumber * words; j++) {
+            for (uint64_t k = 0; k < ALLELE_LOG_PROB_BITS; k++) {
+                readMask |= (stRPPartition) bitCountVectors[(siteOffset * words + j) * ALLELE_LOG_PROB_BITS + k] <<
+                            (j % words) * 64;
+            }
+        }
+        emissions->siteReadMasks[i] = readMask;
+
+        int64_t reads = popcount128(readMask);
+        if (reads <= MAX_EMISSION_TABLE_READS && ((int64_t) 1 << reads) <= cellNumber) {
+            uint64_t entries = (uint64_t) 1 << reads;
+            uint64_t *logProbs = st_malloc(entries * sizeof(uint64_t));
+            for (uint64_t j = 0; j < (entries + 1) / 2; j++) {
+                stRPPartition partition = wide ? unpackWidePartition(j, readMask) :
+                                          unpackPartition(j, (uint64_t) readMask);
+                logProbs[j] = genotypeLogProbability(column, site, siteOffset, partition,
+                                                     bitCountVectors, params->includeAncestorSubProb);
+                logProbs[(entries - 1) ^ j] = logProbs[j];
+            }
+            emissions->siteLogProbs[i] = logProbs;
+        }
+    }
+
+    column->emissions = emissions;
+    return emissions;
+}
+
+static inline double emissionLogProbability2(stRPColumn *column, stRPCell *cell, uint64_t *bitCountVectors,
+                                             stReference *ref, const bool includeAncestorSubProb) {
+    /*
+     * As emissionLogProbability, for the given includeAncestorSubProb. Called with a constant so the compiler makes
+     * a version of the site loop for each setting, without the branch between the ancestor and direct genotype
+     * calcs.
      */
     assert(column->length > 0);
+    stRPColumnEmissions *emissions = column->emissions;
+    if (emissions != NULL && emissions->includeAncestorSubProb != includeAncestorSubProb) {
+        emissions = NULL;
+    }
+    bool wide = column->depth > NARROW_PARTITIONING_DEPTH;
     uint64_t logPartitionProb = 0;
     uint64_t firstAllele = ref->sites[column->refStart].alleleOffset;
     for (uint64_t i = column->refStart; i < column->refStart + column->length; i++) {
+        if (emissions != NULL && emissions->siteLogProbs[i - column->refStart] != NULL) {
+            stRPPartition readMask = emissions->siteReadMasks[i - column->refStart];
+            logPartitionProb += emissions->siteLogProbs[i - column->refStart][
+                    wide ? packWidePartition(cell->partition, readMask) :
+                    packPartition((uint64_t) cell->partition, (uint64_t) readMask)];
+            continue;
+        }
+
         stSite *site = &(ref->sites[i]);
         uint64_t siteOffset = site->alleleOffset - firstAllele;
 
         // Get the reference prior probabilities
         logPartitionProb += genotypeLogProbability(column, site, siteOffset, cell->partition, bitCountVectors,
-                                                   params->includeAncestorSubProb);
+                                                   includeAncestorSubProb);
     }
 
     return -((double) logPartitionProb);
 }
 
+double emissionLogProbability(stRPColumn *column,
+                              stRPCell *cell, uint64_t *bitCountVectors, stReference *ref,
+                              stRPHmmParameters *params) {
+    /*
+     * Get the log probability of a set of reads for a given column.
+     *
+     * If the column has emission tables (see stRPColumn_getEmissions) made with the same settings they are used
+     * for the sites that have them.
+     */
+    return params->includeAncestorSubProb ? emissionLogProbability2(column, cell, bitCountVectors, ref, TRUE) :
+           emissionLogProbability2(column, cell, bitCountVectors, ref, FALSE);
+}
+
 /*
  * Functions for calculating genotypes/haplotypes
  */
@@ -259,7 +642,7 @@ static uint64_t getMLAllele(stSite *site, uint64_t *alleleLogProbs, uint64_t max
     return maxAllele;
 }
 
-static void fillInPredictedGenomePosition(stGenomeFragment *gF, uint64_t siteIndex, uint64_t partition,
+static void fillInPredictedGenomePosition(stGenomeFragment *gF, uint64_t siteIndex, stRPPartition partition,
                                           stRPColumn *column, uint64_t *bitCountVectors) {
     /*
      * Computes the most probable haplotype alleles / genotype and associated posterior
@@ -276,9 +659,9 @@ static void fillInPredictedGenomePosition(stGenomeFragment *gF, uint64_t siteInd
     // For each allele calculate the log probability of the
     // partition and store counts in an array
     uint64_t alleleLogProbsHap1[site->alleleNumber];
-    alleleLogHapProbabilities(column, site, siteOffset, partition, bitCountVectors, alleleLogProbsHap1);
     uint64_t alleleLogProbsHap2[site->alleleNumber];
-    alleleLogHapProbabilities(column, site, siteOffset, ~partition, bitCountVectors, alleleLogProbsHap2);
+    alleleLogHapProbabilities(site, siteOffset, column->depth, partition, bitCountVectors, alleleLogProbsHap1,
+                              alleleLogProbsHap2);
 
     uint64_t ancestorAlleleProbsHap1[site->alleleNumber];
     ancestorHapProbabilities(site, alleleLogProbsHap1, ancestorAlleleProbsHap1);
@@ -313,14 +696,14 @@ static void fillInPredictedGenomePosition(stGenomeFragment *gF, uint64_t siteInd
     gF->haplotypeProbs2[k] = -(float) alleleLogProbsHap2[hapAllele2];
 
     // Fill in read coverages
-    assert(column->depth >= popcount64(partition));
-    gF->readsSupportingHaplotype1[k] = popcount64(partition);
-    gF->readsSupportingHaplotype2[k] = column->depth - popcount64(partition);
+    assert(column->depth >= popcount128(partition));
+    gF->readsSupportingHaplotype1[k] = popcount128(partition);
+    gF->readsSupportingHaplotype2[k] = column->depth - popcount128(partition);
     //st_uglyf(" Hello %i %i %i %f %f \n", (int)popcount64(partition), (int)column->depth, (int)column->depth - popcount64(partition),
     //		(float)binomialPValue(column->depth, popcount64(partition)), (float)binomialPValue(column->depth, column->depth-popcount64(partition)));
 }
 
-void fillInPredictedGenome(stGenomeFragment *gF, uint64_t partition,
+void fillInPredictedGenome(stGenomeFragment *gF, stRPPartition partition,
                            stRPColumn *column, stRPHmmParameters *params) {
     /*
      * Computes the most probable haplotype alleles / genotypes and associated posterior
@@ -328,16 +711,12 @@ void fillInPredictedGenome(stGenomeFragment *gF, uint64_t partition,
      * genome fragment argument.
      */
 
-    // Calculate the bit vectors
-    uint64_t *bitCountVectors = calculateCountBitVectors(column->seqs, gF->reference, column->refStart,
-                                                         column->length, column->depth);
+    // Get the bit vectors, computed once per column
+    uint64_t *bitCountVectors = stRPColumn_getBitCountVectors(column, gF->reference);
 
     assert(column->length > 0);
     for (uint64_t i = 0; i < column->length; i++) {
         fillInPredictedGenomePosition(gF, i + column->refStart, partition, column,
                                       bitCountVectors);
     }
-
-    // Cleanup
-    free(bitCountVectors);
 }
@@ -68,12 +68,154 @@ stGenomeFragment *stGenomeFragment_construct(stRPHmm *hmm, stList *path) {
     return gF;
 }
 
-double getLogProbOfReadGivenHaplotype(const uint64_t *haplotypeString,
-                                      int64_t start, int64_t length, stProfileSeq *profileSeq, stReference *ref) {
+static uint64_t getSiteConsensusAllele(stReference *ref, stList *profileSeqs, uint64_t siteIndex) {
     /*
-     * Returns the log probability of the read given the haplotype.
+     * Returns the allele with the least summed cost over the reads.
      */
-    double totalProb = 0.0;
+    stSite *site = &(ref->sites[siteIndex]);
+    uint64_t costs[site->alleleNumber];
+    memset(costs, 0, sizeof(costs));
+    for (int64_t i = 0; i < stList_length(profileSeqs); i++) {
+        stProfileSeq *pSeq = stList_get(profileSeqs, i);
+        if (siteIndex >= pSeq->refStart && siteIndex < pSeq->refStart + pSeq->length) {
+            for (uint64_t j = 0; j < site->alleleNumber; j++) {
+                costs[j] += *stProfileSeq_getProb(pSeq, siteIndex, j);
+            }
+        }
+    }
+    uint64_t consensusAllele = 0;
+    for (uint64_t j = 1; j < site->alleleNumber; j++) {
+        if (costs[j] < costs[consensusAllele]) {
+            consensusAllele = j;
+        }
+    }
+    return consensusAllele;
+}
+
+static uint64_t getSiteGenotypeCost(stSite *site, stList *profileSeqs, uint64_t siteIndex, uint64_t ancestorAllele,
+                                    uint64_t otherAllele) {
+    /*
+     * Returns the cost of the genotype of the ancestor allele and the other allele, each read taking the allele it
+     * prefers.
+     */
+    uint64_t cost = site->allelePriorLogProbs[ancestorAllele] +
+                    *stSite_getSubstitutionProb(site, ancestorAllele, otherAllele);
+    for (int64_t i = 0; i < stList_length(profileSeqs); i++) {
+        stProfileSeq *pSeq = stList_get(profileSeqs, i);
+        if (siteIndex >= pSeq->refStart && siteIndex < pSeq->refStart + pSeq->length) {
+            uint64_t c1 = *stProfileSeq_getProb(pSeq, siteIndex, ancestorAllele);
+            uint64_t c2 = *stProfileSeq_getProb(pSeq, siteIndex, otherAllele);
+            cost += c1 < c2 ? c1 : c2;
+        }
+    }
+    return cost;
+}
+
+stGenomeFragment *stGenomeFragment_constructTrivial(stReference *ref, stList *profileSeqs) {
+    /*
+     * Returns a genome fragment covering the reference made without the hmm, or NULL if the reads need the hmm to be
+     * phased.
+     *
+     * A site is contested if a read prefers an allele other than the consensus allele of the reads. Without a
+     * contested site every site is homozygous for its consensus allele, and the reads go to the first haplotype.
+     * With one contested site the other sites are homozygous, and at the contested site the genotype minimising the
+     * cost of the reads plus that of the substitution from the ancestral allele is picked, each read going to the
+     * haplotype whose allele it prefers. With more than one contested site NULL is returned.
+     */
+    uint64_t *consensusAlleles = st_malloc(sizeof(uint64_t) * (ref->length + 1));
+    for (uint64_t i = 0; i < ref->length; i++) {
+        consensusAlleles[i] = getSiteConsensusAllele(ref, profileSeqs, i);
+    }
+
+    // Find the contested site, if any
+    int64_t contestedSite = -1;
+    for (int64_t i = 0; i < stList_length(profileSeqs); i++) {
+        stProfileSeq *pSeq = stList_get(profileSeqs, i);
+        for (uint64_t j = pSeq->refStart; j < pSeq->refStart + pSeq->length; j++) {
+            if (contestedSite == (int64_t) j) {
+                continue;
+            }
+            uint8_t consensusCost = *stProfileSeq_getProb(pSeq, j, consensusAlleles[j]);
+            for (uint64_t k = 0; k < ref->sites[j].alleleNumber; k++) {
+                if (*stProfileSeq_getProb(pSeq, j, k) < consensusCost) {
+                    if (contestedSite != -1) {
+                        free(consensusAlleles);
+                        return NULL;
+                    }
+                    contestedSite = j;
+                    break;
+                }
+            }
+        }
+    }
+
+    // Pick the genotype of the contested site
+    uint64_t contestedHap1 = 0, contestedHap2 = 0;
+    if (contestedSite != -1) {
+        stSite *site = &(ref->sites[contestedSite]);
+        uint64_t minCost = UINT64_MAX;
+        for (uint64_t j = 0; j < site->alleleNumber; j++) {
+            for (uint64_t k = 0; k < site->alleleNumber; k++) {
+                uint64_t cost = getSiteGenotypeCost(site, profileSeqs, contestedSite, j, k);
+                if (cost < minCost) {
+                    minCost = cost;
+                    contestedHap1 = j;
+                    contestedHap2 = k;
+                }
+            }
+        }
+    }
+
+    // Partition the reads
+    stSet *reads1 = stSet_construct(), *reads2 = stSet_construct();
+    for (int64_t i = 0; i < stList_length(profileSeqs); i++) {
+        stProfileSeq *pSeq = stList_get(profileSeqs, i);
+        bool hap2 = contestedSite >= (int64_t) pSeq->refStart &&
+                    contestedSite < (int64_t) (pSeq->refStart + pSeq->length) &&
+                    *stProfileSeq_getProb(pSeq, contestedSite, contestedHap2) <
+                    *stProfileSeq_getProb(pSeq, contestedSite, contestedHap1);
+        stSet_insert(hap2 ? reads2 : reads1, pSeq);
+    }
+
+    // Fill in the genotypes
+    stGenomeFragment *gF = stGenomeFragment_constructEmpty(ref, 0, ref->length, reads1, reads2);
+    for (uint64_t i = 0; i < ref->length; i++) {
+        stSite *site = &(ref->sites[i]);
+        uint64_t hap1 = (int64_t) i == contestedSite ? contestedHap1 : consensusAlleles[i];
+        uint64_t hap2 = (int64_t) i == contestedSite ? contestedHap2 : consensusAlleles[i];
+        gF->ancestorString[i] = hap1;
+        gF->haplotypeString1[i] = hap1;
+        gF->haplotypeString2[i] = hap2;
+        gF->genotypeString[i] = hap1 < hap2 ? hap1 * site->alleleNumber + hap2 : hap2 * site->alleleNumber + hap1;
+        gF->genotypeProbs[i] = -(float) (site->allelePriorLogProbs[hap1] + *stSite_getSubstitutionProb(site, hap1, hap2));
+    }
+    for (int64_t i = 0; i < stList_length(profileSeqs); i++) {
+        stProfileSeq *pSeq = stList_get(profileSeqs, i);
+        bool hap1 = stSet_search(reads1, pSeq) != NULL;
+        for (uint64_t j = pSeq->refStart; j < pSeq->refStart + pSeq->length; j++) {
+            float cost = *stProfileSeq_getProb(pSeq, j, hap1 ? gF->haplotypeString1[j] : gF->haplotypeString2[j]);
+            gF->genotypeProbs[j] -= cost;
+            if (hap1) {
+                gF->haplotypeProbs1[j] -= cost;
+                gF->readsSupportingHaplotype1[j]++;
+            } else {
+                gF->haplotypeProbs2[j] -= cost;
+                gF->readsSupportingHaplotype2[j]++;
+            }
+        }
+    }
+
+    free(consensusAlleles);
+    return gF;
+}
+
+static int64_t getReadCostGivenHaplotype(const uint64_t *haplotypeString,
+                                         int64_t start, int64_t length, stProfileSeq *profileSeq, stReference *ref) {
+    /*
+     * Returns the negated, scaled log probability of the read given the haplotype, summed as integers so that
+     * it can be updated exactly one site at a time.
+     */
+    int64_t totalCost = 0;
 
     uint64_t firstAllele = ref->sites[profileSeq->refStart].alleleOffset;
     for (int64_t i = 0; i < profileSeq->length; i++) {
@@ -82,20 +224,66 @@ double getLogProbOfReadGivenHaplotype(const uint64_t *haplotypeString,
         if (j >= 0 && j < length) {
             uint64_t allele = haplotypeString[j];
             stSite *site = &(ref->sites[i + profileSeq->refStart]);
-            totalProb -= profileSeq->profileProbs[site->alleleOffset - firstAllele + allele];
+            totalCost += profileSeq->profileProbs[site->alleleOffset - firstAllele + allele];
         }
     }
-    return totalProb / PROFILE_PROB_SCALAR;
+    return totalCost;
+}
+
+double getLogProbOfReadGivenHaplotype(const uint64_t *haplotypeString,
+                                      int64_t start, int64_t length, stProfileSeq *profileSeq, stReference *ref) {
+    /*
+     * Returns the log probability of the read given the haplotype.
+     */
+    return -getReadCostGivenHaplotype(haplotypeString, start, length, profileSeq, ref) / PROFILE_PROB_SCALAR;
 }
 
-double getLogProbabilityOfBeingInPartition(stProfileSeq *pSeq, uint64_t *haplotypeString1, uint64_t *haplotypeString2,
-                                           int64_t start, int64_t length, stReference *ref) {
+static void getReadCostsGivenHaplotypes(const uint64_t *haplotypeString1, const uint64_t *haplotypeString2,
+                                        int64_t start, int64_t length, stReference *ref, stList *pSeqs,
+                                        int64_t *costs1, int64_t *costs2) {
     /*
-     * Returns the probability of a read being generated by the first haplotype  of the two haplotype strings.
+     * As getReadCostGivenHaplotype, for each of the reads and both haplotype strings. The index of each haplotype
+     * allele amongst the alleles of the reference is gathered once, so each read is scored against both haplotypes
+     * in one pass over its sites without looking up the sites.
      */
-    double i = getLogProbOfReadGivenHaplotype(haplotypeString1, start, length, pSeq, ref);
-    double j = getLogProbOfReadGivenHaplotype(haplotypeString2, start, length, pSeq, ref);
-    return i - stMath_logAddExact(i, j);
+    uint64_t *alleleIndices1 = st_malloc(sizeof(uint64_t) * (length + 1));
+    uint64_t *alleleIndices2 = st_malloc(sizeof(uint64_t) * (length + 1));
+    for (int64_t j = 0; j < length; j++) {
+        uint64_t alleleOffset = ref->sites[start + j].alleleOffset;
+        alleleIndices1[j] = alleleOffset + haplotypeString1[j];
+        alleleIndices2[j] = alleleOffset + haplotypeString2[j];
+    }
+
+    for (int64_t i = 0; i < stList_length(pSeqs); i++) {
+        stProfileSeq *pSeq = stList_get(pSeqs, i);
+        int64_t from = (int64_t) pSeq->refStart > start ? (int64_t) pSeq->refStart : start;
+        int64_t to = (int64_t) (pSeq->refStart + pSeq->length) < start + length ?
+                     (int64_t) (pSeq->refStart + pSeq->length) : start + length;
+        const uint8_t *profileProbs = pSeq->profileProbs;
+        uint64_t firstAllele = pSeq->alleleOffset;
+        int64_t cost1 = 0, cost2 = 0;
+        for (int64_t j = from - start; j < to - start; j++) {
+            cost1 += profileProbs[alleleIndices1[j] - firstAllele];
+            cost2 += profileProbs[alleleIndices2[j] - firstAllele];
+        }
+        costs1[i] = cost1;
+        costs2[i] = cost2;
+    }
+
+    free(alleleIndices1);
+    free(alleleIndices2);
+}
+
+void stGenomeFragment_getReadLogProbs(stGenomeFragment *gF, stList *pSeqs, double *logProbs1, double *logProbs2) {
+    int64_t readNo = stList_length(pSeqs);
+    int64_t *costs = st_malloc(sizeof(int64_t) * (2 * readNo + 1));
+    getReadCostsGivenHaplotypes(gF->haplotypeString1, gF->haplotypeString2, gF->refStart, gF->length, gF->reference,
+                                pSeqs, costs, costs + readNo);
+    for (int64_t i = 0; i < readNo; i++) {
+        logProbs1[i] = -costs[i] / PROFILE_PROB_SCALAR;
+        logProbs2[i] = -costs[readNo + i] / PROFILE_PROB_SCALAR;
+    }
+    free(costs);
 }
 
 void stGenomeFragment_printPartitionAsCSV(stGenomeFragment *gF, FILE *fh, stRPHmmParameters *params, bool hap1,
@@ -105,20 +293,28 @@ void stGenomeFragment_printPartitionAsCSV(stGenomeFragment *gF, FILE *fh, stRPHm
      */
     // need this for use in writing with filtered reads
     fprintf(fh, "READ_NAME,PHRED_SCORE_OF_BEING_IN_PARTITION\n");
-    stSetIterator *it = stSet_getIterator(hap1 ? gF->reads1 : gF->reads2);
-    stProfileSeq *pSeq;
-    while ((pSeq = stSet_getNext(it)) != NULL) {
-        double p = hap1 ? getLogProbabilityOfBeingInPartition(pSeq, gF->haplotypeString2, gF->haplotypeString1,
-                                                              gF->refStart, gF->length, gF->reference) :
-                   getLogProbabilityOfBeingInPartition(pSeq, gF->haplotypeString1, gF->haplotypeString2, gF->refStart,
-                                                       gF->length, gF->reference);
+    CsvWriter *writer = csvWriter_construct(fh);
+    stList *pSeqs = stSet_getList(hap1 ? gF->reads1 : gF->reads2);
+    int64_t readNo = stList_length(pSeqs);
+    double *logProbs = st_malloc(sizeof(double) * (2 * readNo + 1));
+    stGenomeFragment_getReadLogProbs(gF, pSeqs, logProbs, logProbs + readNo);
+    for (int64_t i = 0; i < readNo; i++) {
+        stProfileSeq *pSeq = stList_get(pSeqs, i);
+        // The log probability of the read being in the other partition
+        double lpOther = hap1 ? logProbs[readNo + i] : logProbs[i];
+        double p = lpOther - logAddPrecise(logProbs[i], logProbs[readNo + i]);
         p = -10 * p / 2.302585;
         if (p > params->minPhredScoreForHaplotypePartition) {
-            fprintf(fh, "%s,%f\n", pSeq->readId, p);
+            csvWriter_string(writer, pSeq->readId);
+            csvWriter_char(writer, ',');
+            csvWriter_float(writer, p, 6);
+            csvWriter_char(writer, '\n');
             if (printedReads != NULL) stSet_insert(printedReads, stString_copy(pSeq->readId));
         }
     }
-    stSet_destructIterator(it);
+    free(logProbs);
+    stList_destruct(pSeqs);
+    csvWriter_destruct(writer);
 }
 
 stSet *findReadsThatWereMoreProbablyGeneratedByTheOtherHaplotype(uint64_t *haplotypeString1, uint64_t *haplotypeString2,
@@ -129,13 +325,17 @@ stSet *findReadsThatWereMoreProbablyGeneratedByTheOtherHaplotype(uint64_t *haplo
      * than the first.
      */
     stSet *subset = stSet_construct();
-    stSetIterator *it = stSet_getIterator(profileSeqs);
-    stProfileSeq *pSeq;
-    while ((pSeq = stSet_getNext(it)) != NULL) {
+    stList *pSeqs = stSet_getList(profileSeqs);
+    int64_t readNo = stList_length(pSeqs);
+    int64_t *costs = st_malloc(sizeof(int64_t) * (2 * readNo + 1));
+    getReadCostsGivenHaplotypes(haplotypeString1, haplotypeString2, start, length, ref, pSeqs, costs,
+                                costs + readNo);
+    for (int64_t k = 0; k < readNo; k++) {
+        stProfileSeq *pSeq = stList_get(pSeqs, k);
 
         // Calculate probability that the read was generated from haplotype1 and haplotype2
-        double i = getLogProbOfReadGivenHaplotype(haplotypeString1, start, length, pSeq, ref);
-        double j = getLogProbOfReadGivenHaplotype(haplotypeString2, start, length, pSeq, ref);
+        double i = -costs[k] / PROFILE_PROB_SCALAR;
+        double j = -costs[readNo + k] / PROFILE_PROB_SCALAR;
 
         if (i < j) {
             // Read is more likely to have been generated by the second haplotype rather than the first
@@ -144,12 +344,13 @@ stSet *findReadsThatWereMoreProbablyGeneratedByTheOtherHaplotype(uint64_t *haplo
                     pSeq->readId, i, j);
         }
     }
-    stSet_destructIterator(it);
+    free(costs);
+    stList_destruct(pSeqs);
 
     return subset;
 }
 
-static uint64_t flipReadsBetweenPartitions(uint64_t partition, stRPColumn *column, stSet *flippingReads) {
+static stRPPartition flipReadsBetweenPartitions(stRPPartition partition, stRPColumn *column, stSet *flippingReads) {
 
     for (uint64_t i = 0; i < column->depth; i++) {
         stProfileSeq *pSeq = column->seqHeaders[i];
@@ -162,30 +363,101 @@ static uint64_t flipReadsBetweenPartitions(uint64_t partition, stRPColumn *colum
     return partition;
 }
 
+typedef struct _stReadRefinement {
+    /*
+     * Per read state used by the iterative refinement: the read's costs (negated, scaled log probs)
+     * given each haplotype string and the haplotype it is currently assigned to.
+     */
+    stProfileSeq *pSeq;
+    int64_t cost1;
+    int64_t cost2;
+    bool inHap1;
+} stReadRefinement;
+
+static bool columnHasFlippingRead(stRPColumn *column, stSet *reads1To2, stSet *reads2To1) {
+    for (uint64_t i = 0; i < column->depth; i++) {
+        if (stSet_search(reads1To2, column->seqHeaders[i]) != NULL ||
+            stSet_search(reads2To1, column->seqHeaders[i]) != NULL) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void updateReadCostsForChangedSite(stGenomeFragment *gF, stRPColumn *column, uint64_t siteIndex,
+                                          uint64_t oldAllele, uint64_t newAllele, bool hap1, stHash *readRefinements) {
+    /*
+     * Applies the change in a haplotype allele at the given site to the costs of the reads in the column
+     * that cover the site.
+     */
+    stSite *site = &(gF->reference->sites[siteIndex]);
+    for (uint64_t i = 0; i < column->depth; i++) {
+        stProfileSeq *pSeq = column->seqHeaders[i];
+        if (siteIndex < pSeq->refStart || siteIndex >= pSeq->refStart + pSeq->length) {
+            continue;
+        }
+        uint64_t siteOffset = site->alleleOffset - gF->reference->sites[pSeq->refStart].alleleOffset;
+        int64_t delta = (int64_t) pSeq->profileProbs[siteOffset + newAllele] -
+                        (int64_t) pSeq->profileProbs[siteOffset + oldAllele];
+        stReadRefinement *r = stHash_search(readRefinements, pSeq);
+        assert(r != NULL);
+        if (hap1) {
+            r->cost1 += delta;
+        } else {
+            r->cost2 += delta;
+        }
+    }
+}
+
 void stGenomeFragment_refineGenomeFragment(stGenomeFragment *gF, stRPHmm *hmm, stList *path, int64_t maxIterations) {
     /*
      * Refines the genome fragment and read partitions by greedily and iteratively
      * moving reads between the two partitions according to which haplotype they best match.
+     *
+     * The cost of each read given each haplotype is computed once, then updated incrementally: only
+     * columns containing a read that switched are refilled, and only the reads covering sites whose
+     * haplotype alleles changed have their costs adjusted.
      */
 
-    // Copy the path as a sequence of unsigned integers, one for each cell on the path
+    // Copy the path as a sequence of partitions, one for each cell on the path
     int64_t pathLength = stList_length(path);
-    uint64_t p[pathLength];
+    stRPPartition p[pathLength];
     for (int64_t i = 0; i < pathLength; i++) {
         p[i] = ((stRPCell *) stList_get(path, i))->partition;
     }
 
+    // Compute the initial costs of each read given each haplotype
+    int64_t readNumber = stList_length(hmm->profileSeqs);
+    stReadRefinement *readRefinements = st_calloc(readNumber, sizeof(stReadRefinement));
+    stHash *readRefinementsBySeq = stHash_construct();
+    int64_t *costs = st_malloc(sizeof(int64_t) * (2 * readNumber + 1));
+    getReadCostsGivenHaplotypes(gF->haplotypeString1, gF->haplotypeString2, gF->refStart, gF->length, gF->reference,
+                                hmm->profileSeqs, costs, costs + readNumber);
+    for (int64_t i = 0; i < readNumber; i++) {
+        stReadRefinement *r = &readRefinements[i];
+        r->pSeq = stList_get(hmm->profileSeqs, i);
+        r->cost1 = costs[i];
+        r->cost2 = costs[readNumber + i];
+        r->inHap1 = stSet_search(gF->reads1, r->pSeq) != NULL;
+        stHash_insert(readRefinementsBySeq, r->pSeq, r);
+    }
+    free(costs);
+
     int64_t iteration = 0;
     while (iteration++ < maxIterations) {
         // Get the subset of reads in each partition that want to switch to the other partition
-        stSet *reads1To2 = findReadsThatWereMoreProbablyGeneratedByTheOtherHaplotype(gF->haplotypeString1,
-                                                                                     gF->haplotypeString2,
-                                                                                     gF->refStart, gF->length,
-                                                                                     gF->reads1, gF->reference);
-        stSet *reads2To1 = findReadsThatWereMoreProbablyGeneratedByTheOtherHaplotype(gF->haplotypeString2,
-                                                                                     gF->haplotypeString1,
-                                                                                     gF->refStart, gF->length,
-                                                                                     gF->reads2, gF->reference);
+        stSet *reads1To2 = stSet_construct();
+        stSet *reads2To1 = stSet_construct();
+        for (int64_t i = 0; i < readNumber; i++) {
+            stReadRefinement *r = &readRefinements[i];
+            if (r->inHap1 ? r->cost1 > r->cost2 : r->cost2 > r->cost1) {
+                stSet_insert(r->inHap1 ? reads1To2 : reads2To1, r->pSeq);
+                st_logDebug("    Recommend swapping read %s between assigned haplotypes (stay %.3f, go %.3f)\n",
+                            r->pSeq->readId, -(r->inHap1 ? r->cost1 : r->cost2) / PROFILE_PROB_SCALAR,
+                            -(r->inHap1 ? r->cost2 : r->cost1) / PROFILE_PROB_SCALAR);
+                r->inHap1 = !r->inHap1;
+            }
+        }
 
         // If there are no reads wanting to switch then break
         st_logDebug(
@@ -209,15 +481,33 @@ void stGenomeFragment_refineGenomeFragment(stGenomeFragment *gF, stRPHmm *hmm, s
 
         assert(stSet_size(gF->reads1) + stSet_size(gF->reads2) == stList_length(hmm->profileSeqs));
 
-        // Update the path and update the genome fragment
+        // Update the path and update the genome fragment, only for columns whose partition changed
         stRPColumn *column = hmm->firstColumn;
         for (int64_t i = 0; i < pathLength; i++) {
-            // Update the partition for the column by shifting the reads accordingly
-            p[i] = flipReadsBetweenPartitions(p[i], column, reads1To2);
-            p[i] = flipReadsBetweenPartitions(p[i], column, reads2To1);
-
-            // Update the genome fragment
-            fillInPredictedGenome(gF, p[i], column, (stRPHmmParameters *) hmm->parameters);
+            if (columnHasFlippingRead(column, reads1To2, reads2To1)) {
+                // Update the partition for the column by shifting the reads accordingly
+                p[i] = flipReadsBetweenPartitions(p[i], column, reads1To2);
+                p[i] = flipReadsBetweenPartitions(p[i], column, reads2To1);
+
+                // Update the genome fragment, remembering the previous haplotype alleles
+                uint64_t offset = column->refStart - gF->refStart;
+                uint64_t oldHap1[column->length], oldHap2[column->length];
+                memcpy(oldHap1, &gF->haplotypeString1[offset], column->length * sizeof(uint64_t));
+                memcpy(oldHap2, &gF->haplotypeString2[offset], column->length * sizeof(uint64_t));
+                fillInPredictedGenome(gF, p[i], column, (stRPHmmParameters *) hmm->parameters);
+
+                // Update the costs of the reads overlapping sites whose haplotype alleles changed
+                for (uint64_t j = 0; j < column->length; j++) {
+                    if (oldHap1[j] != gF->haplotypeString1[offset + j]) {
+                        updateReadCostsForChangedSite(gF, column, column->refStart + j, oldHap1[j],
+                                                      gF->haplotypeString1[offset + j], 1, readRefinementsBySeq);
+                    }
+                    if (oldHap2[j] != gF->haplotypeString2[offset + j]) {
+                        updateReadCostsForChangedSite(gF, column, column->refStart + j, oldHap2[j],
+                                                      gF->haplotypeString2[offset + j], 0, readRefinementsBySeq);
+                    }
+                }
+            }
 
             // Get the next column
             if (i + 1 < pathLength) {
@@ -229,6 +519,9 @@ void stGenomeFragment_refineGenomeFragment(stGenomeFragment *gF, stRPHmm *hmm, s
         stSet_destruct(reads1To2);
         stSet_destruct(reads2To1);
     }
+
+    stHash_destruct(readRefinementsBySeq);
+    free(readRefinements);
 }
 
 void stGenomeFragment_phaseBamChunkReads(stGenomeFragment *gf, stHash *readsToPSeqs, stList *reads,
@@ -239,22 +532,30 @@ void stGenomeFragment_phaseBamChunkReads(stGenomeFragment *gf, stHash *readsToPS
     int64_t discardedForPhredCount = 0;
     int64_t consideredForPhasing = 0;
 
+    // Score the reads that have pSeqs against both haplotypes together
+    stList *pSeqs = stList_construct();
     for (int64_t i = 0; i < stList_length(reads); i++) {
-        BamChunkRead *read = stList_get(reads, i);
-        stProfileSeq *pSeq = stHash_search(readsToPSeqs, read);
+        stProfileSeq *pSeq = stHash_search(readsToPSeqs, stList_get(reads, i));
         if (pSeq != NULL) { // Some reads do not get converted to pSeqs because they are too low quality
             // at every aligned site they overlap
+            stList_append(pSeqs, pSeq);
+        }
+    }
+    int64_t readNo = stList_length(pSeqs);
+    double *logProbs = st_malloc(sizeof(double) * (2 * readNo + 1));
+    stGenomeFragment_getReadLogProbs(gf, pSeqs, logProbs, logProbs + readNo);
 
+    for (int64_t i = 0, k = 0; i < stList_length(reads); i++) {
+        BamChunkRead *read = stList_get(reads, i);
+        stProfileSeq *pSeq = stHash_search(readsToPSeqs, read);
+        if (pSeq != NULL) {
             // Checks
             assert(stSet_search(gf->reads1, pSeq) != NULL || stSet_search(gf->reads2, pSeq) != NULL);
             assert(stSet_search(gf->reads1, pSeq) == NULL || stSet_search(gf->reads2, pSeq) == NULL);
 
+            // The log probability of the read being in the other partition
             bool hap1 = stSet_search(gf->reads1, pSeq) != NULL;
-            double lp = hap1 ?
-                        getLogProbabilityOfBeingInPartition(pSeq, gf->haplotypeString2, gf->haplotypeString1,
-                                                            gf->refStart, gf->length, gf->reference) :
-                        getLogProbabilityOfBeingInPartition(pSeq, gf->haplotypeString1, gf->haplotypeString2,
-                                                            gf->refStart, gf->length, gf->reference);
+            double lp = (hap1 ? logProbs[readNo + k] : logProbs[k]) - logAddPrecise(logProbs[k], logProbs[readNo + k]);
             double phred = -10 * lp / 2.302585;
             if (phred < params->minPhredScoreForHaplotypePartition) {
                 discardedForPhredCount++;
@@ -263,8 +564,11 @@ void stGenomeFragment_phaseBamChunkReads(stGenomeFragment *gf, stHash *readsToPS
                 stSet_insert(hap1 ? *readsBelongingToHap1 : *readsBelongingToHap2, read);
             }
             consideredForPhasing += 1;
+            k++;
         }
     }
+    free(logProbs);
+    stList_destruct(pSeqs);
 
     if (st_getLogLevel() >= info) {
         char *logIdentifier = getLogIdentifier();
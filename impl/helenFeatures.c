@@ -13,6 +13,8 @@
 #define TRUTH_ALN_LOG_LEVEL debug
 #define TRUTH_ALN_IDENTITY_THRESHOLD .99
 #define TRUTH_ALN_MIN_MATCHES 700
+#define TRUTH_ALN_PROJECTION_DEFAULT_MATCH_LENGTH 64
+#define TRUTH_ALN_PROJECTION_FLANK 8
 
 PoaFeatureSimpleWeight *PoaFeature_SimpleWeight_construct(int64_t refPos, int64_t insPos) {
     PoaFeatureSimpleWeight *feature = st_calloc(1, sizeof(PoaFeatureSimpleWeight));
@@ -32,7 +34,9 @@ void PoaFeature_SimpleWeight_destruct(PoaFeatureSimpleWeight *feature) {
 
 PoaFeatureSplitRleWeight *PoaFeature_SplitRleWeight_construct(int64_t refPos, int64_t insPos, int64_t rlPos,
                                                               int64_t maxRunLength) {
-    PoaFeatureSplitRleWeight *feature = st_calloc(1, sizeof(PoaFeatureSplitRleWeight));
+    // the weights are allocated with the feature
+    PoaFeatureSplitRleWeight *feature = st_calloc(1, sizeof(PoaFeatureSplitRleWeight) +
+            ((SYMBOL_NUMBER - 1) * (1 + maxRunLength) + 1) * 2 * sizeof(double));
     feature->refPosition = refPos;
     feature->insertPosition = insPos;
     feature->runLengthPosition = rlPos;
@@ -41,7 +45,6 @@ PoaFeatureSplitRleWeight *PoaFeature_SplitRleWeight_construct(int64_t refPos, in
     feature->nextRunLength = NULL;
     feature->nextInsert = NULL;
     feature->maxRunLength = maxRunLength;
-    feature->weights = st_calloc(((SYMBOL_NUMBER - 1) * (1 + maxRunLength) + 1) * 2, sizeof(double));
     return feature;
 }
 
@@ -52,14 +55,17 @@ void PoaFeature_SplitRleWeight_destruct(PoaFeatureSplitRleWeight *feature) {
     if (feature->nextInsert != NULL) {
         PoaFeature_SplitRleWeight_destruct(feature->nextInsert);
     }
-    free(feature->weights);
     free(feature);
 }
 
 
 PoaFeatureChannelRleWeight *PoaFeature_ChannelRleWeight_construct(int64_t refPos, int64_t insPos, int64_t rlPos,
                                                                   int64_t maxRunLength) {
-    PoaFeatureChannelRleWeight *feature = st_calloc(1, sizeof(PoaFeatureChannelRleWeight));
+    // the nucleotide and then run length weights are allocated with the feature
+    int64_t nucleotideWeightCount = SYMBOL_NUMBER * 2;
+    int64_t runLengthWeightCount = (SYMBOL_NUMBER - 1) * (1 + maxRunLength) * 2;
+    PoaFeatureChannelRleWeight *feature = st_calloc(1, sizeof(PoaFeatureChannelRleWeight) +
+            (nucleotideWeightCount + runLengthWeightCount) * sizeof(double));
     feature->refPosition = refPos;
     feature->insertPosition = insPos;
     feature->runLengthPosition = rlPos;
@@ -68,8 +74,8 @@ PoaFeatureChannelRleWeight *PoaFeature_ChannelRleWeight_construct(int64_t refPos
     feature->nextRunLength = NULL;
     feature->nextInsert = NULL;
     feature->maxRunLength = maxRunLength;
-    feature->nucleotideWeights = st_calloc((SYMBOL_NUMBER) * 2, sizeof(double));
-    feature->runLengthWeights = st_calloc((SYMBOL_NUMBER - 1) * (1 + maxRunLength) * 2, sizeof(double));
+    feature->nucleotideWeights = feature->weights;
+    feature->runLengthWeights = &feature->weights[nucleotideWeightCount];
     return feature;
 }
 
@@ -80,8 +86,6 @@ void PoaFeature_ChannelRleWeight_destruct(PoaFeatureChannelRleWeight *feature) {
     if (feature->nextInsert != NULL) {
         PoaFeature_ChannelRleWeight_destruct(feature->nextInsert);
     }
-    free(feature->nucleotideWeights);
-    free(feature->runLengthWeights);
     free(feature);
 }
 
@@ -198,8 +202,13 @@ void PoaFeature_handleHelenFeatures(
 
             // get alignment
             double score_consensus, alignIdentity;
-            trueRefAlignment = alignConsensusAndTruthRLEWithKmerAnchors(consensusRegion, trueRefRleString,
-                    &score_consensus, params->polishParams);
+            if (params->polishParams->truthProjectionExactMatchLength > 0) {
+                trueRefAlignment = alignConsensusAndTruthRLEWithExactMatchProjection(consensusRegion,
+                        trueRefRleString, &score_consensus, params->polishParams);
+            } else {
+                trueRefAlignment = alignConsensusAndTruthRLEWithKmerAnchors(consensusRegion, trueRefRleString,
+                        &score_consensus, params->polishParams);
+            }
             shiftAlignmentCoords(trueRefAlignment, 0, consensusAlnShift);
             rleString_destruct(consensusRegion);
 
@@ -440,8 +449,6 @@ double calculateAlignIdentity(RleString *XRLE, RleString *YRLE, stList *alignedP
     }
     char *X = XRLE->rleString;
     char *Y = YRLE->rleString;
-    uint64_t *Xrl = XRLE->repeatCounts;
-    uint64_t *Yrl = YRLE->repeatCounts;
 
     // stats to track
     int64_t matches = 0;
@@ -462,36 +469,36 @@ double calculateAlignIdentity(RleString *XRLE, RleString *YRLE, stList *alignedP
         // Y gap / X insert
         if (posX < currAlignPosX) {
             posX++;
-            xInserts += Xrl[posX];
+            xInserts += rleString_getRepeatCount(XRLE, posX);
         }
 
             // X gap / Y insert
         else if (posY < currAlignPosY) {
             posY++;
-            yInserts += Yrl[posY];
+            yInserts += rleString_getRepeatCount(YRLE, posY);
         }
 
             // match
         else if (posX == currAlignPosX && posY == currAlignPosY) {
             if (tolower(X[posX]) == tolower(Y[posY])) {
-                if (Xrl[posX] == Yrl[posY]) {
-                    matches += Yrl[posY];
-                } else if (Xrl[posX] > Yrl[posY]) {
-                    matches += Yrl[posY];
-                    mismatches += Xrl[posX] - Yrl[posY];
+                if (rleString_getRepeatCount(XRLE, posX) == rleString_getRepeatCount(YRLE, posY)) {
+                    matches += rleString_getRepeatCount(YRLE, posY);
+                } else if (rleString_getRepeatCount(XRLE, posX) > rleString_getRepeatCount(YRLE, posY)) {
+                    matches += rleString_getRepeatCount(YRLE, posY);
+                    mismatches += rleString_getRepeatCount(XRLE, posX) - rleString_getRepeatCount(YRLE, posY);
                 } else {
-                    matches += Xrl[posX];
-                    mismatches += Yrl[posY] - Xrl[posX];
+                    matches += rleString_getRepeatCount(XRLE, posX);
+                    mismatches += rleString_getRepeatCount(YRLE, posY) - rleString_getRepeatCount(XRLE, posX);
                 }
             } else {
-                if (Xrl[posX] == Yrl[posY]) {
-                    mismatches += Yrl[posY];
-                } else if (Xrl[posX] > Yrl[posY]) {
-                    mismatches += Yrl[posY];
-                    xInserts += Xrl[posX] - Yrl[posY];
+                if (rleString_getRepeatCount(XRLE, posX) == rleString_getRepeatCount(YRLE, posY)) {
+                    mismatches += rleString_getRepeatCount(YRLE, posY);
+                } else if (rleString_getRepeatCount(XRLE, posX) > rleString_getRepeatCount(YRLE, posY)) {
+                    mismatches += rleString_getRepeatCount(YRLE, posY);
+                    xInserts += rleString_getRepeatCount(XRLE, posX) - rleString_getRepeatCount(YRLE, posY);
                 } else {
-                    mismatches += Xrl[posX];
-                    yInserts += Yrl[posY] - Xrl[posX];
+                    mismatches += rleString_getRepeatCount(XRLE, posX);
+                    yInserts += rleString_getRepeatCount(YRLE, posY) - rleString_getRepeatCount(XRLE, posX);
                 }
             }
             posX++;
@@ -766,7 +773,7 @@ RleString *getConsensusByEstimatedOriginalReferencePositions(RleString *original
             rleEstimatedConsensusEndPos = i;
             break;
         }
-        pos += consensus->repeatCounts[i];
+        pos += rleString_getRepeatCount(consensus, i);
     }
     if (rleEstimatedConsensusEndPos < 0) {
         rleEstimatedConsensusEndPos = consensus->length;
@@ -923,7 +930,7 @@ void poa_addSplitRunLengthFeaturesForObservations(Poa *poa, PoaFeatureSplitRleWe
             RleString *rleString = bamChunkRead->rleRead;
             Symbol symbol = poa->alphabet->convertCharToSymbol(
                     rleString->rleString[observation->offset + observationOffset]);
-            int64_t runLength = rleString->repeatCounts[observation->offset + observationOffset];
+            int64_t runLength = rleString_getRepeatCount(rleString, observation->offset + observationOffset);
             bool forward = bamChunkRead->forwardStrand;
 
             // get correct run length
@@ -1055,7 +1062,7 @@ void poa_addChannelRunLengthFeaturesForObservations(Poa *poa, PoaFeatureChannelR
             RleString *rleString = bamChunkRead->rleRead;
             Symbol symbol = poa->alphabet->convertCharToSymbol(
                     rleString->rleString[observation->offset + observationOffset]);
-            int64_t runLength = rleString->repeatCounts[observation->offset + observationOffset];
+            int64_t runLength = rleString_getRepeatCount(rleString, observation->offset + observationOffset);
             bool forward = bamChunkRead->forwardStrand;
 
             // get correct run length
@@ -1172,7 +1179,13 @@ stList *PoaFeature_getChannelRleWeightFeatures(Poa *poa, stList *bamChunkReads,
 }
 
 void printMEAAlignment2(RleString *X, RleString *Y, stList *alignedPairs) {
-    printMEAAlignment(X->rleString, Y->rleString, X->length, Y->length, alignedPairs, X->repeatCounts, Y->repeatCounts);
+    uint64_t *Xrl = st_malloc(sizeof(uint64_t) * X->length);
+    uint64_t *Yrl = st_malloc(sizeof(uint64_t) * Y->length);
+    for (uint64_t i = 0; i < X->length; i++) Xrl[i] = rleString_getRepeatCount(X, i);
+    for (uint64_t i = 0; i < Y->length; i++) Yrl[i] = rleString_getRepeatCount(Y, i);
+    printMEAAlignment(X->rleString, Y->rleString, X->length, Y->length, alignedPairs, Xrl, Yrl);
+    free(Xrl);
+    free(Yrl);
     fprintf(stderr, "          AlignmentIdentity: %f\n", calculateAlignIdentity(X, Y, alignedPairs));
 }
 
@@ -1391,7 +1404,7 @@ void annotateHelenFeaturesWithTruth(stList *features, HelenFeatureType featureTy
                         break;
                     case HFEAT_SPLIT_RLE_WEIGHT:
                         srlFeature = ((PoaFeatureSplitRleWeight *) feature);
-                        trueRunLength = trueRefRleString->repeatCounts[trueRefPos];
+                        trueRunLength = rleString_getRepeatCount(trueRefRleString, trueRefPos);
                         while (srlFeature != NULL) {
                             srlFeature->labelChar = trueRefRleString->rleString[trueRefPos];
                             if (trueRunLength <= 0) {
@@ -1407,7 +1420,7 @@ void annotateHelenFeaturesWithTruth(stList *features, HelenFeatureType featureTy
                         break;
                     case HFEAT_CHANNEL_RLE_WEIGHT:
                         crlFeature = ((PoaFeatureChannelRleWeight *) feature);
-                        trueRunLength = trueRefRleString->repeatCounts[trueRefPos];
+                        trueRunLength = rleString_getRepeatCount(trueRefRleString, trueRefPos);
                         while (crlFeature != NULL) {
                             crlFeature->labelChar = trueRefRleString->rleString[trueRefPos];
                             if (trueRunLength <= 0) {
@@ -1449,7 +1462,7 @@ void annotateHelenFeaturesWithTruth(stList *features, HelenFeatureType featureTy
                         break;
                     case HFEAT_SPLIT_RLE_WEIGHT:
                         srlFeature = ((PoaFeatureSplitRleWeight *) feature);
-                        trueRunLength = trueRefRleString->repeatCounts[trueRefPos];
+                        trueRunLength = rleString_getRepeatCount(trueRefRleString, trueRefPos);
                         while (srlFeature != NULL) {
                             srlFeature->labelChar = trueRefRleString->rleString[trueRefPos];
                             if (trueRunLength <= 0) {
@@ -1465,7 +1478,7 @@ void annotateHelenFeaturesWithTruth(stList *features, HelenFeatureType featureTy
                         break;
                     case HFEAT_CHANNEL_RLE_WEIGHT:
                         crlFeature = ((PoaFeatureChannelRleWeight *) feature);
-                        trueRunLength = trueRefRleString->repeatCounts[trueRefPos];
+                        trueRunLength = rleString_getRepeatCount(trueRefRleString, trueRefPos);
                         while (crlFeature != NULL) {
                             crlFeature->labelChar = trueRefRleString->rleString[trueRefPos];
                             if (trueRunLength <= 0) {
@@ -1753,6 +1766,137 @@ stList *alignConsensusAndTruthRLEWithKmerAnchors(RleString *consensusStr, RleStr
 }
 
 
+/*
+ * Aligns the region sX[xStart, xEnd) to sY[yStart, yEnd), appending its MEA aligned pairs, in the
+ * (consensusPos, truthPos, score) form, to finalAlignedPairs and returning the MEA score.
+ */
+static double alignConsensusAndTruthRLESegment(SymbolString sX, SymbolString sY, int64_t xStart, int64_t xEnd,
+                                               int64_t yStart, int64_t yEnd, bool raggedLeftEnd, bool raggedRightEnd,
+                                               stList *finalAlignedPairs, PolishParams *polishParams) {
+    if (xStart >= xEnd || yStart >= yEnd) {
+        return 0.0;
+    }
+    SymbolString subX = symbolString_getView(sX, xStart, xEnd - xStart);
+    SymbolString subY = symbolString_getView(sY, yStart, yEnd - yStart);
+
+    stList *alignedPairs = NULL;
+    stList *gapXPairs = NULL;
+    stList *gapYPairs = NULL;
+    stList *anchorPairs = getKmerAlignmentAnchors(subX, subY, (uint64_t) polishParams->p->diagonalExpansion);
+    getAlignedPairsWithIndelsUsingAnchors(polishParams->stateMachineForForwardStrandRead, subX, subY, anchorPairs,
+                                          polishParams->p, &alignedPairs, &gapXPairs, &gapYPairs,
+                                          raggedLeftEnd, raggedRightEnd);
+    double score = 0.0;
+    stList *meaAlignedPairs = getMaximalExpectedAccuracyPairwiseAlignment(alignedPairs, gapXPairs, gapYPairs,
+                                                                          subX.length, subY.length, &score,
+                                                                          polishParams->p);
+    for (int64_t i = 0; i < stList_length(meaAlignedPairs); i++) {
+        stIntTuple *ap = stList_get(meaAlignedPairs, i);
+        stList_append(finalAlignedPairs, stIntTuple_construct3(stIntTuple_get(ap, 1) + xStart,
+                                                               stIntTuple_get(ap, 2) + yStart, stIntTuple_get(ap, 0)));
+    }
+
+    stList_destruct(meaAlignedPairs);
+    stList_destruct(alignedPairs);
+    stList_destruct(gapXPairs);
+    stList_destruct(gapYPairs);
+    stList_destruct(anchorPairs);
+
+    return score;
+}
+
+
+stList *alignConsensusAndTruthRLEWithExactMatchProjection(RleString *consensusStr, RleString *truthStr, double *score,
+                                                          PolishParams *polishParams) {
+    // Symbol strings
+    uint64_t maxRL = polishParams->useRunLengthEncoding ? (uint64_t) polishParams->repeatSubMatrix->maximumRepeatLength : 2;
+    SymbolString sX = rleString_constructSymbolString(consensusStr, 0, consensusStr->length, polishParams->alphabet,
+                                                      TRUE, maxRL);
+    SymbolString sY = rleString_constructSymbolString(truthStr, 0, truthStr->length, polishParams->alphabet,
+                                                      TRUE, maxRL);
+    int64_t minMatchLength = polishParams->truthProjectionExactMatchLength > 0 ?
+            (int64_t) polishParams->truthProjectionExactMatchLength : TRUTH_ALN_PROJECTION_DEFAULT_MATCH_LENGTH;
+
+    // Extend each anchor of the chain to the maximal exact match containing it, keeping the colinear, non-overlapping
+    // matches that are long enough for the projection through them to be unambiguous
+    stList *anchorPairs = getKmerAlignmentAnchors(sX, sY, (uint64_t) polishParams->p->diagonalExpansion);
+    stList *exactMatches = stList_construct3(0, (void(*)(void*))stIntTuple_destruct);
+    int64_t prevX = 0, prevY = 0;
+    for (int64_t i = 0; i < stList_length(anchorPairs); i++) {
+        stIntTuple *anchor = stList_get(anchorPairs, i);
+        int64_t x = stIntTuple_get(anchor, 0), y = stIntTuple_get(anchor, 1);
+        if (x < prevX || y < prevY || sX.sequence[x] != sY.sequence[y]) {
+            continue;
+        }
+        int64_t xStart = x, yStart = y, xEnd = x + 1, yEnd = y + 1;
+        while (xStart > prevX && yStart > prevY && sX.sequence[xStart - 1] == sY.sequence[yStart - 1]) {
+            xStart--;
+            yStart--;
+        }
+        while (xEnd < sX.length && yEnd < sY.length && sX.sequence[xEnd] == sY.sequence[yEnd]) {
+            xEnd++;
+            yEnd++;
+        }
+        // the ends of a match can often be shifted into the neighbouring indel, so leave them to the aligner
+        xStart += TRUTH_ALN_PROJECTION_FLANK;
+        yStart += TRUTH_ALN_PROJECTION_FLANK;
+        xEnd -= TRUTH_ALN_PROJECTION_FLANK;
+        yEnd -= TRUTH_ALN_PROJECTION_FLANK;
+        if (xEnd - xStart >= minMatchLength) {
+            stList_append(exactMatches, stIntTuple_construct3(xStart, yStart, xEnd - xStart));
+            prevX = xEnd;
+            prevY = yEnd;
+        }
+    }
+    stList_destruct(anchorPairs);
+
+    // no usable matches, align the whole thing
+    if (stList_length(exactMatches) == 0) {
+        stList_destruct(exactMatches);
+        symbolString_destruct(sX);
+        symbolString_destruct(sY);
+        return alignConsensusAndTruthRLEWithKmerAnchors(consensusStr, truthStr, score, polishParams);
+    }
+
+    // project through the matches, aligning only the (ambiguous) regions between them
+    stList *finalAlignedPairs = stList_construct3(0, (void(*)(void*))stIntTuple_destruct);
+    int64_t alignedLength = 0;
+    *score = 0.0;
+    prevX = 0;
+    prevY = 0;
+    for (int64_t i = 0; i < stList_length(exactMatches); i++) {
+        stIntTuple *match = stList_get(exactMatches, i);
+        int64_t xStart = stIntTuple_get(match, 0), yStart = stIntTuple_get(match, 1);
+        int64_t length = stIntTuple_get(match, 2);
+        *score += alignConsensusAndTruthRLESegment(sX, sY, prevX, xStart, prevY, yStart, i == 0, FALSE,
+                                                   finalAlignedPairs, polishParams);
+        alignedLength += xStart - prevX;
+        for (int64_t j = 0; j < length; j++) {
+            stList_append(finalAlignedPairs, stIntTuple_construct3(xStart + j, yStart + j, PAIR_ALIGNMENT_PROB_1));
+        }
+        *score += (double) length * PAIR_ALIGNMENT_PROB_1;
+        prevX = xStart + length;
+        prevY = yStart + length;
+    }
+    *score += alignConsensusAndTruthRLESegment(sX, sY, prevX, sX.length, prevY, sY.length, FALSE, TRUE,
+                                               finalAlignedPairs, polishParams);
+    alignedLength += sX.length - prevX;
+
+    char *logIdentifer = getLogIdentifier();
+    st_logInfo(" %s Sequence alignment (seq len %"PRId64") projected through %"PRId64" exact matches, aligning %"PRId64
+               " consensus positions and getting %"PRId64" aligned pairs\n", logIdentifer, sX.length,
+               stList_length(exactMatches), alignedLength, stList_length(finalAlignedPairs));
+
+    // Cleanup
+    stList_destruct(exactMatches);
+    symbolString_destruct(sX);
+    symbolString_destruct(sY);
+    free(logIdentifer);
+
+    return finalAlignedPairs;
+}
+
+
 stList *alignConsensusAndTruthRLEWithSSWAnchors(RleString *consensusStr, RleString *truthStr, double *score,
                                                  PolishParams *polishParams) {
 
@@ -1817,7 +1961,7 @@ stList *alignConsensusAndTruthCPECAN(char *consensusStr, char *truthStr, double
     uint16_t apScore = 0;
 
     // Use default state machine for alignment
-    StateMachine *sM = stateMachine3_constructNucleotide(threeState);
+    StateMachine *sM = polishParams->stateMachineForConsensusAlignment;
 
     // Run the alignment
     stList *alignedPairs = stList_construct3(0, (void(*)(void*))stIntTuple_destruct);
@@ -1844,7 +1988,6 @@ stList *alignConsensusAndTruthCPECAN(char *consensusStr, char *truthStr, double
     stList_destruct(gapYPairs);
     symbolString_destruct(sX);
     symbolString_destruct(sY);
-    stateMachine_destruct(sM);
 
     return finalAlignedPairs;
 }
@@ -1938,6 +2081,26 @@ stList *alignConsensusAndTruthSSW(char *consensusStr, char *truthStr, uint16_t *
 }
 
 #define HDF5_FEATURE_SIZE 1000
+#define HDF5_DEFLATE_LEVEL 1
+#define HDF5_META_BLOCK_SIZE (1 << 20)
+
+static hid_t getCompressedDatasetProperties(hid_t space) {
+    /*
+     * Dataset creation properties for the large feature datasets: each is stored as a single chunk (they are always
+     * written whole) with the byte shuffle and deflate filters, if the library has deflate. The feature counts are
+     * small integers so this shrinks them several fold for little time at the lowest deflate level.
+     */
+    hid_t properties = H5Pcreate(H5P_DATASET_CREATE);
+    if (H5Zfilter_avail(H5Z_FILTER_DEFLATE) > 0) {
+        int rank = H5Sget_simple_extent_ndims(space);
+        hsize_t dims[rank];
+        H5Sget_simple_extent_dims(space, dims, NULL);
+        H5Pset_chunk(properties, rank, dims);
+        H5Pset_shuffle(properties);
+        H5Pset_deflate(properties, HDF5_DEFLATE_LEVEL);
+    }
+    return properties;
+}
 
 double **getTwoDArrayDouble(int64_t rowCount, int64_t columnCount, bool zeroValues) {
     double **array = st_calloc(rowCount, sizeof(double *));
@@ -2124,6 +2287,7 @@ writeSimpleWeightHelenFeaturesHDF5(Alphabet *alphabet, HelenFeatureHDF5FileInfo
     hid_t labelCharacterSpace = H5Screate_simple(2, labelCharacterDimension, NULL);
     hid_t normalizationSpace = H5Screate_simple(2, normalizationDimension, NULL);
     hid_t imageSpace = H5Screate_simple(2, imageDimension, NULL);
+    hid_t imageProperties = getCompressedDatasetProperties(imageSpace);
 
     /*
      * Write features to files
@@ -2180,7 +2344,7 @@ writeSimpleWeightHelenFeaturesHDF5(Alphabet *alphabet, HelenFeatureHDF5FileInfo
 
         // write rle data
         hid_t imageDataset = H5Dcreate(group, "image", hdf5FileInfo->uint8Type, imageSpace,
-                                       H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+                                       H5P_DEFAULT, imageProperties, H5P_DEFAULT);
         status |= H5Dwrite(imageDataset, hdf5FileInfo->uint8Type, H5S_ALL, H5S_ALL, H5P_DEFAULT,
                            imageData[chunkFeatureStartIdx]);
 
@@ -2217,6 +2381,7 @@ writeSimpleWeightHelenFeaturesHDF5(Alphabet *alphabet, HelenFeatureHDF5FileInfo
     status |= H5Sclose(metadataSpace);
     status |= H5Sclose(normalizationSpace);
     status |= H5Sclose(imageSpace);
+    status |= H5Pclose(imageProperties);
     status |= H5Sclose(positionSpace);
     status |= H5Sclose(labelCharacterSpace);
     if (outputLabels) {
@@ -2351,6 +2516,7 @@ writeSplitRleWeightHelenFeaturesHDF5(Alphabet *alphabet, HelenFeatureHDF5FileInf
     hid_t labelRunLengthSpace = H5Screate_simple(2, labelRunLengthDimension, NULL);
     hid_t normalizationSpace = H5Screate_simple(2, normalizationDimension, NULL);
     hid_t imageSpace = H5Screate_simple(2, imageDimension, NULL);
+    hid_t imageProperties = getCompressedDatasetProperties(imageSpace);
 
     hid_t stringType = H5Tcopy(H5T_C_S1);
     H5Tset_size(stringType, strlen(bamChunk->refSeqName) + 1);
@@ -2403,8 +2569,8 @@ writeSplitRleWeightHelenFeaturesHDF5(Alphabet *alphabet, HelenFeatureHDF5FileInf
                            positionData[chunkFeatureStartIdx]);
 
         // write rle data
-        hid_t imageDataset = H5Dcreate(group, "image", hdf5FileInfo->uint8Type, imageSpace, H5P_DEFAULT, H5P_DEFAULT,
-                                       H5P_DEFAULT);
+        hid_t imageDataset = H5Dcreate(group, "image", hdf5FileInfo->uint8Type, imageSpace, H5P_DEFAULT,
+                                       imageProperties, H5P_DEFAULT);
         status |= H5Dwrite(imageDataset, hdf5FileInfo->uint8Type, H5S_ALL, H5S_ALL, H5P_DEFAULT,
                            imageData[chunkFeatureStartIdx]);
         hid_t normalizationDataset = H5Dcreate(group, "normalization", hdf5FileInfo->uint8Type, normalizationSpace,
@@ -2451,6 +2617,7 @@ writeSplitRleWeightHelenFeaturesHDF5(Alphabet *alphabet, HelenFeatureHDF5FileInf
     status |= H5Sclose(metadataSpace);
     status |= H5Sclose(positionSpace);
     status |= H5Sclose(imageSpace);
+    status |= H5Pclose(imageProperties);
     status |= H5Sclose(normalizationSpace);
     status |= H5Sclose(labelRunLengthSpace);
     status |= H5Sclose(labelCharacterSpace);
@@ -2624,6 +2791,8 @@ writeChannelRleWeightHelenFeaturesHDF5(Alphabet *alphabet, HelenFeatureHDF5FileI
     hid_t normalizationSpace = H5Screate_simple(2, normalizationDimension, NULL);
     hid_t nucleotideSpace = H5Screate_simple(2, nucleotideDimension, NULL);
     hid_t runLengthSpace = H5Screate_simple(3, runLengthDimension, NULL);
+    hid_t nucleotideProperties = getCompressedDatasetProperties(nucleotideSpace);
+    hid_t runLengthProperties = getCompressedDatasetProperties(runLengthSpace);
 
     hid_t stringType = H5Tcopy(H5T_C_S1);
     H5Tset_size(stringType, strlen(bamChunk->refSeqName) + 1);
@@ -2677,11 +2846,11 @@ writeChannelRleWeightHelenFeaturesHDF5(Alphabet *alphabet, HelenFeatureHDF5FileI
 
         // write nucl, rl, and norm data
         hid_t nucleotideDataset = H5Dcreate(group, "nucleotide", hdf5FileInfo->uint8Type, nucleotideSpace, H5P_DEFAULT,
-                                            H5P_DEFAULT, H5P_DEFAULT);
+                                            nucleotideProperties, H5P_DEFAULT);
         status |= H5Dwrite(nucleotideDataset, hdf5FileInfo->uint8Type, H5S_ALL, H5S_ALL, H5P_DEFAULT,
                            nucleotideData[chunkFeatureStartIdx]);
         hid_t runLengthDataset = H5Dcreate(group, "runLengths", hdf5FileInfo->uint8Type, runLengthSpace, H5P_DEFAULT,
-                                           H5P_DEFAULT, H5P_DEFAULT);
+                                           runLengthProperties, H5P_DEFAULT);
         status |= H5Dwrite(runLengthDataset, hdf5FileInfo->uint8Type, H5S_ALL, H5S_ALL, H5P_DEFAULT,
                            runLengthData[chunkFeatureStartIdx][0]);
         hid_t normalizationDataset = H5Dcreate(group, "normalization", hdf5FileInfo->uint8Type, normalizationSpace,
@@ -2733,6 +2902,8 @@ writeChannelRleWeightHelenFeaturesHDF5(Alphabet *alphabet, HelenFeatureHDF5FileI
     status |= H5Sclose(positionSpace);
     status |= H5Sclose(nucleotideSpace);
     status |= H5Sclose(runLengthSpace);
+    status |= H5Pclose(nucleotideProperties);
+    status |= H5Pclose(runLengthProperties);
     status |= H5Sclose(normalizationSpace);
     status |= H5Sclose(labelRunLengthSpace);
     status |= H5Sclose(labelCharacterSpace);
@@ -2754,7 +2925,13 @@ writeChannelRleWeightHelenFeaturesHDF5(Alphabet *alphabet, HelenFeatureHDF5FileI
 HelenFeatureHDF5FileInfo *HelenFeatureHDF5FileInfo_construct(char *filename) {
     HelenFeatureHDF5FileInfo *fileInfo = st_calloc(1, sizeof(HelenFeatureHDF5FileInfo));
     fileInfo->filename = stString_copy(filename);
-    fileInfo->file = H5Fcreate(filename, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    // the newest file format's compact groups and large metadata blocks keep the many small per-chunk groups from
+    // fragmenting the file
+    hid_t fileAccessProperties = H5Pcreate(H5P_FILE_ACCESS);
+    H5Pset_libver_bounds(fileAccessProperties, H5F_LIBVER_LATEST, H5F_LIBVER_LATEST);
+    H5Pset_meta_block_size(fileAccessProperties, HDF5_META_BLOCK_SIZE);
+    fileInfo->file = H5Fcreate(filename, H5F_ACC_TRUNC, H5P_DEFAULT, fileAccessProperties);
+    H5Pclose(fileAccessProperties);
     fileInfo->int64Type = H5Tcopy(H5T_NATIVE_UINT32);
     H5Tset_order(fileInfo->int64Type, H5T_ORDER_LE);
     fileInfo->uint32Type = H5Tcopy(H5T_NATIVE_UINT32);
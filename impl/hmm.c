@@ -16,7 +16,7 @@ inline double logAddP(double a, double b, bool maxNotSum) {
     /*
      * Local function for doing addition of logs or (if doing Viterbi style calculation), to take the max.
      */
-    return maxNotSum ? (a > b ? a : b) : stMath_logAddExact(a, b);
+    return maxNotSum ? (a > b ? a : b) : logAddPrecise(a, b);
 }
 
 /*
@@ -58,6 +58,9 @@ void stRPHmmParameters_printParameters(stRPHmmParameters *params, FILE *fH) {
 
     fprintf(fH, "\t\tInclude inverted partitions?: %i\n", (int) params->includeInvertedPartitions);
     fprintf(fH, "\t\tRounds of iterative refinement: %" PRIi64 "\n", params->roundsOfIterativeRefinement);
+    fprintf(fH, "\t\tForward beam log prob margin: %f, max cells: %" PRIi64 "\n",
+            params->forwardBeamLogProbMargin, params->forwardBeamMaxCells);
+    fprintf(fH, "\t\tSweep hmm construction?: %i\n", (int) params->sweepHmmConstruction);
 }
 
 static int cmpint64(int64_t i, int64_t j) {
@@ -196,18 +199,24 @@ stList *stRPHmm_forwardTraceBack(stRPHmm *hmm) {
         // Switch to previous column
         column = column->pColumn->pColumn;
 
-        // Walk through cells in the previous column to find the one with the
-        // highest forward probability that transitions to maxCell
-        cell = column->head;
-        maxCell = NULL;
-        maxProb = ST_MATH_LOG_ZERO;
-        do {
-            // If compatible and has greater probability
-            if (stRPMergeColumn_getNextMergeCell(cell, column->nColumn) == mCell && cell->forwardLogProb > maxProb) {
-                maxProb = cell->forwardLogProb;
-                maxCell = cell;
-            }
-        } while ((cell = cell->nCell) != NULL);
+        if (hmm->hasViterbiPointers) {
+            // The cell the merge cell's max came from
+            maxCell = mCell->maxForwardCell;
+        } else {
+            // Walk through cells in the previous column to find the one with the
+            // highest forward probability that transitions to maxCell
+            cell = column->head;
+            maxCell = NULL;
+            maxProb = ST_MATH_LOG_ZERO;
+            do {
+                // If compatible and has greater probability
+                if (stRPMergeColumn_getNextMergeCell(cell, column->nColumn) == mCell &&
+                    cell->forwardLogProb > maxProb) {
+                    maxProb = cell->forwardLogProb;
+                    maxCell = cell;
+                }
+            } while ((cell = cell->nCell) != NULL);
+        }
 
         assert(maxCell != NULL);
         stList_append(path, maxCell);
@@ -302,7 +311,7 @@ stRPHmm *stRPHmm_fuse(stRPHmm *leftHmm, stRPHmm *rightHmm) {
     }
 
     // Create a new empty hmm
-    stRPHmm *hmm = st_malloc(sizeof(stRPHmm));
+    stRPHmm *hmm = st_calloc(1, sizeof(stRPHmm));
     // Set the reference interval
     hmm->ref = leftHmm->ref;
     hmm->refStart = leftHmm->refStart;
@@ -506,35 +515,196 @@ void stRPHmm_alignColumns(stRPHmm *hmm1, stRPHmm *hmm2) {
     assert(hmm1->columnNumber == hmm2->columnNumber);
 }
 
-static uint64_t intHashFn(const void *a) {
-    return *(uint64_t *) a;
+static int partition_cmp(const void *a, const void *b) {
+    stRPPartition i = *(stRPPartition *) a, j = *(stRPPartition *) b;
+    return i < j ? -1 : (i > j ? 1 : 0);
+}
+
+static stRPPartition *stRPColumn_getSortedPartitions(stRPColumn *column, int64_t *partitionNo) {
+    /*
+     * Returns the partitions of the column's cells in increasing order.
+     */
+    *partitionNo = 0;
+    for (stRPCell *cell = column->head; cell != NULL; cell = cell->nCell) {
+        (*partitionNo)++;
+    }
+    stRPPartition *partitions = st_malloc(sizeof(stRPPartition) * (*partitionNo));
+    int64_t i = 0;
+    for (stRPCell *cell = column->head; cell != NULL; cell = cell->nCell) {
+        partitions[i++] = cell->partition;
+    }
+    qsort(partitions, *partitionNo, sizeof(stRPPartition), partition_cmp);
+    return partitions;
+}
+
+/*
+ * Walks the merged partitions of the cross product of the partitions of two columns in increasing order. As the second
+ * column's partition is in the high bits of a merged partition, this is the first column's partitions in order for
+ * each of the second column's partitions in order.
+ */
+typedef struct _partitionProductCursor {
+    stRPPartition *partitions1, *partitions2; // Each in increasing order
+    int64_t partitionNo1, partitionNo2;
+    int64_t depth1, depth2;
+    uint64_t invert; // If non-zero walks the cross product of the inverted partitions instead
+    int64_t i, j; // The current pair of partitions
+} PartitionProductCursor;
+
+static bool partitionProductCursor_done(PartitionProductCursor *cursor) {
+    return cursor->j == cursor->partitionNo2;
+}
+
+static stRPPartition partitionProductCursor_get(PartitionProductCursor *cursor) {
+    // Inverting reverses the order of the partitions, so the inverted are walked from the last
+    stRPPartition partition1, partition2;
+    if (cursor->invert) {
+        partition1 = invertPartition(cursor->partitions1[cursor->partitionNo1 - 1 - cursor->i], cursor->depth1);
+        partition2 = invertPartition(cursor->partitions2[cursor->partitionNo2 - 1 - cursor->j], cursor->depth2);
+    } else {
+        partition1 = cursor->partitions1[cursor->i];
+        partition2 = cursor->partitions2[cursor->j];
+    }
+    return mergePartitionsOrMasks(partition1, partition2, cursor->depth1, cursor->depth2);
+}
+
+static void partitionProductCursor_next(PartitionProductCursor *cursor) {
+    if (++cursor->i == cursor->partitionNo1) {
+        cursor->i = 0;
+        cursor->j++;
+    }
+}
+
+static void stRPColumn_makeCrossProductCells(stRPColumn *column, stRPColumn *column1, stRPColumn *column2,
+                                             bool includeInvertedPartitions) {
+    /*
+     * Makes the cells of the column for the cross product of the cells of column1 and column2, in increasing order of
+     * partition.
+     *
+     * With includeInvertedPartitions the cells are those of the cross product and their inverses. The inverse of a
+     * merged partition is the merge of the inverted partitions, so they are the union of the cross product with the
+     * cross product of the inverted partitions, which are walked in order together so the union is made without
+     * looking up the partitions already made.
+     */
+    stRPPartition *partitions1, *partitions2;
+    int64_t partitionNo1, partitionNo2;
+    partitions1 = stRPColumn_getSortedPartitions(column1, &partitionNo1);
+    partitions2 = stRPColumn_getSortedPartitions(column2, &partitionNo2);
+    PartitionProductCursor cursor = {partitions1, partitions2, partitionNo1, partitionNo2,
+                                     column1->depth, column2->depth, 0, 0, 0};
+    PartitionProductCursor invertedCursor = cursor;
+    invertedCursor.invert = 1;
+    if (!includeInvertedPartitions) {
+        invertedCursor.j = invertedCursor.partitionNo2; // Nothing to walk
+    }
+
+    stRPCell **pCell = &column->head;
+    while (!partitionProductCursor_done(&cursor) || !partitionProductCursor_done(&invertedCursor)) {
+        stRPPartition partition;
+        if (partitionProductCursor_done(&invertedCursor)) {
+            partition = partitionProductCursor_get(&cursor);
+            partitionProductCursor_next(&cursor);
+        } else if (partitionProductCursor_done(&cursor)) {
+            partition = partitionProductCursor_get(&invertedCursor);
+            partitionProductCursor_next(&invertedCursor);
+        } else {
+            stRPPartition partition1 = partitionProductCursor_get(&cursor);
+            stRPPartition partition2 = partitionProductCursor_get(&invertedCursor);
+            partition = partition1 < partition2 ? partition1 : partition2;
+            if (partition1 == partition) {
+                partitionProductCursor_next(&cursor);
+            }
+            if (partition2 == partition) { // A partition in both is only made once
+                partitionProductCursor_next(&invertedCursor);
+            }
+        }
+
+        // Link cells
+        stRPCell *cell = stRPCell_construct(partition);
+        *pCell = cell;
+        pCell = &cell->nCell;
+    }
+
+    free(partitions1);
+    free(partitions2);
 }
 
-static int intEqualsFn(const void *key1, const void *key2) {
-    return *(uint64_t *) key1 == *(uint64_t *) key2;
+static void stRPHmm_beamPruneColumn(stRPHmm *hmm, stRPColumn *column);
+
+PartitionMap *getLinkedMergeCells(stRPMergeColumn *mColumn,
+                               stRPMergeCell *(*getNCell)(stRPCell *, stRPMergeColumn *),
+                               stList *cells);
+
+void filterMergeCells(stRPMergeColumn *mColumn, PartitionMap *chosenMergeCells);
+
+static bool stRPHmm_hasForwardBeam(stRPHmm *hmm) {
+    return hmm->parameters->forwardBeamLogProbMargin > 0 || hmm->parameters->forwardBeamMaxCells > 0;
 }
 
-stRPCell **makeCell(uint64_t partition, stRPCell **pCell, stHash *seen) {
+static void crossProductColumn_applyForwardBeam(stRPHmm *hmm, stRPColumn *column) {
     /*
-     * Make a cell for a column.
+     * While building a cross product hmm, calculates the forward probabilities of the newly made column's cells from
+     * the previous merge column (see crossProductMergeColumn_applyForwardBeam) and discards the cells outside the
+     * forward beam. Cells without a previous merge cell, because all the cells feeding it were discarded, are
+     * discarded too.
      */
+    uint64_t *bitCountVectors = stRPColumn_getBitCountVectors(column, hmm->ref);
+    stRPColumn_getEmissions(column, hmm->ref, (stRPHmmParameters *) hmm->parameters);
+    stRPCell **pCell = &column->head;
+    while (*pCell != NULL) {
+        stRPCell *cell = *pCell;
+        stRPMergeCell *mCell = NULL;
+        if (column->pColumn != NULL && (mCell = stRPMergeColumn_getPreviousMergeCell(cell, column->pColumn)) == NULL) {
+            *pCell = cell->nCell;
+            stRPCell_destruct(cell);
+            continue;
+        }
+        cell->forwardLogProb = (mCell != NULL ? mCell->forwardLogProb : ST_MATH_LOG_ONE) +
+                               emissionLogProbability(column, cell, bitCountVectors, hmm->ref,
+                                                      (stRPHmmParameters *) hmm->parameters);
+        pCell = &cell->nCell;
+    }
+    assert(column->head != NULL);
+    stRPHmm_beamPruneColumn(hmm, column);
+}
 
-    // Make the cell
-    stRPCell *cell = stRPCell_construct(partition);
+static void crossProductMergeColumn_applyForwardBeam(stRPHmm *hmm, stRPMergeColumn *mColumn) {
+    /*
+     * While building a cross product hmm, removes the newly made merge column's merge cells that are not fed by a
+     * kept cell of the previous column, and calculates the forward probabilities of the others.
+     */
+    stRPColumn *column = mColumn->pColumn;
+    stList *cells = stList_construct();
+    stRPCell *cell = column->head;
+    do {
+        stList_append(cells, cell);
+    } while ((cell = cell->nCell) != NULL);
 
-    // Add the partition to those already seen
-    assert(stHash_search(seen, &cell->partition) == NULL);
-    stHash_insert(seen, &cell->partition, cell);
+    PartitionMap *linkedMergeCells = getLinkedMergeCells(mColumn, stRPMergeColumn_getNextMergeCell, cells);
+    filterMergeCells(mColumn, linkedMergeCells);
+    partitionMap_destruct(linkedMergeCells);
 
-    // Link cells
-    *pCell = cell;
-    return &cell->nCell;
+    uint64_t slot = 0;
+    stRPMergeCell *mCell;
+    while ((mCell = partitionMap_getNext(mColumn->mergeCellsFrom, &slot)) != NULL) {
+        mCell->forwardLogProb = ST_MATH_LOG_ZERO;
+    }
+    for (int64_t i = 0; i < stList_length(cells); i++) {
+        cell = stList_get(cells, i);
+        mCell = stRPMergeColumn_getNextMergeCell(cell, mColumn);
+        mCell->forwardLogProb = logAddP(mCell->forwardLogProb, cell->forwardLogProb,
+                                        hmm->parameters->maxNotSumTransitions);
+    }
+    stList_destruct(cells);
 }
 
 stRPHmm *stRPHmm_createCrossProductOfTwoAlignedHmm(stRPHmm *hmm1, stRPHmm *hmm2) {
     /*
      *  For two aligned hmms (see stRPHmm_alignColumns) returns a new hmm that represents the
      *  cross product of all the states of the two input hmms.
+     *
+     *  If the parameters set a forward beam then it is applied to each column as it is made, so only one column of
+     *  the full cross product is held at a time, bounding memory by the beam rather than the product of the inputs'
+     *  states.
      */
 
     // Do sanity checks that the two hmms have been aligned
@@ -619,52 +789,13 @@ stRPHmm *stRPHmm_createCrossProductOfTwoAlignedHmm(stRPHmm *hmm1, stRPHmm *hmm2)
         }
 
         // Create cross product of columns
-        stRPCell **pCell = &column->head;
-        stRPCell *cell1 = column1->head;
-
         // includeInvertedPartitions forces that the partition and its inverse are included
         // in the resulting combine hmm.
-        if (hmm->parameters->includeInvertedPartitions) {
-            stHash *seen = stHash_construct3(intHashFn, intEqualsFn, NULL, NULL);
-            do {
-                stRPCell *cell2 = column2->head;
-                do {
-                    uint64_t partition = mergePartitionsOrMasks(cell1->partition, cell2->partition,
-                                                                column1->depth, column2->depth);
-
-                    // We have not seen the combined partition before
-                    if (stHash_search(seen, &partition) == NULL) {
-                        // Add the partition to the column
-                        pCell = makeCell(partition, pCell, seen);
-
-                        // Check if the column has non-zero depth and only add the inverse partition if it does
-                        // because if zero length the inverse partition is the same as for the forward, and therefore
-                        // a duplicate
-                        if (newColumnDepth > 0) {
-                            uint64_t invertedPartition = invertPartition(partition, newColumnDepth);
-                            assert(stHash_search(seen, &invertedPartition) == NULL);
-
-                            pCell = makeCell(invertedPartition, pCell, seen);
-                        }
-                    }
-                } while ((cell2 = cell2->nCell) != NULL);
-            } while ((cell1 = cell1->nCell) != NULL);
+        stRPColumn_makeCrossProductCells(column, column1, column2, hmm->parameters->includeInvertedPartitions);
 
-            // Cleanup
-            stHash_destruct(seen);
-        }
-            // If not forcing symmetry
-        else {
-            do {
-                stRPCell *cell2 = column2->head;
-                do {
-                    stRPCell *cell = stRPCell_construct(mergePartitionsOrMasks(cell1->partition, cell2->partition,
-                                                                               column1->depth, column2->depth));
-                    // Link cells
-                    *pCell = cell;
-                    pCell = &cell->nCell;
-                } while ((cell2 = cell2->nCell) != NULL);
-            } while ((cell1 = cell1->nCell) != NULL);
+        // Keep only the column's cells within the forward beam, if any
+        if (stRPHmm_hasForwardBeam(hmm)) {
+            crossProductColumn_applyForwardBeam(hmm, column);
         }
 
         // Get the next merged column
@@ -684,11 +815,11 @@ stRPHmm *stRPHmm_createCrossProductOfTwoAlignedHmm(stRPHmm *hmm1, stRPHmm *hmm2)
         }
 
         // Create new merged column
-        uint64_t fromMask = mergePartitionsOrMasks(mColumn1->maskFrom, mColumn2->maskFrom,
-                                                   mColumn1->pColumn->depth, mColumn2->pColumn->depth);
-        uint64_t toMask = mergePartitionsOrMasks(mColumn1->maskTo, mColumn2->maskTo,
-                                                 mColumn1->nColumn->depth, mColumn2->nColumn->depth);
-        assert(popcount64(fromMask) == popcount64(toMask));
+        stRPPartition fromMask = mergePartitionsOrMasks(mColumn1->maskFrom, mColumn2->maskFrom,
+                                                        mColumn1->pColumn->depth, mColumn2->pColumn->depth);
+        stRPPartition toMask = mergePartitionsOrMasks(mColumn1->maskTo, mColumn2->maskTo,
+                                                      mColumn1->nColumn->depth, mColumn2->nColumn->depth);
+        assert(popcount128(fromMask) == popcount128(toMask));
         mColumn = stRPMergeColumn_construct(fromMask, toMask);
 
         // Connect links
@@ -696,37 +827,37 @@ stRPHmm *stRPHmm_createCrossProductOfTwoAlignedHmm(stRPHmm *hmm1, stRPHmm *hmm2)
         column->nColumn = mColumn;
 
         // Create cross product of merged columns
-        stHashIterator *cellIt1 = stHash_getIterator(mColumn1->mergeCellsFrom);
+        uint64_t slot1 = 0;
         stRPMergeCell *mCell1;
-        while ((mCell1 = stHash_getNext(cellIt1)) != NULL) {
-            stHashIterator *cellIt2 = stHash_getIterator(mColumn2->mergeCellsFrom);
+        while ((mCell1 = partitionMap_getNext(mColumn1->mergeCellsFrom, &slot1)) != NULL) {
+            uint64_t slot2 = 0;
             stRPMergeCell *mCell2;
-            while ((mCell2 = stHash_getNext(cellIt2)) != NULL) {
-                uint64_t fromPartition = mergePartitionsOrMasks(mCell1->fromPartition,
-                                                                mCell2->fromPartition,
-                                                                mColumn1->pColumn->depth, mColumn2->pColumn->depth);
+            while ((mCell2 = partitionMap_getNext(mColumn2->mergeCellsFrom, &slot2)) != NULL) {
+                stRPPartition fromPartition = mergePartitionsOrMasks(mCell1->fromPartition,
+                                                                     mCell2->fromPartition,
+                                                                     mColumn1->pColumn->depth,
+                                                                     mColumn2->pColumn->depth);
 
-                uint64_t toPartition = mergePartitionsOrMasks(mCell1->toPartition,
-                                                              mCell2->toPartition,
-                                                              mColumn1->nColumn->depth, mColumn2->nColumn->depth);
+                stRPPartition toPartition = mergePartitionsOrMasks(mCell1->toPartition,
+                                                                   mCell2->toPartition,
+                                                                   mColumn1->nColumn->depth,
+                                                                   mColumn2->nColumn->depth);
 
-                assert(popcount64(fromPartition) == popcount64(toPartition));
+                assert(popcount128(fromPartition) == popcount128(toPartition));
 
                 // includeInvertedPartitions forces that the partition and its inverse are included
                 // in the resulting combined hmm.
                 if (hmm->parameters->includeInvertedPartitions) {
-                    if (stHash_search(mColumn->mergeCellsFrom, &fromPartition) == NULL) {
+                    if (partitionMap_search(mColumn->mergeCellsFrom, fromPartition) == NULL) {
                         stRPMergeCell_construct(fromPartition, toPartition, mColumn);
 
                         // If the mask includes no sequences then the the inverted will be identical, so we check
                         // to avoid adding the same partition twice
-                        if (popcount64(fromMask) > 0) {
-                            uint64_t invertedFromPartition = mColumn->maskFrom &
-                                                             invertPartition(fromPartition, mColumn1->pColumn->depth +
-                                                                                            mColumn2->pColumn->depth);
-                            uint64_t invertedToPartition = mColumn->maskTo &
-                                                           invertPartition(toPartition, mColumn1->nColumn->depth +
-                                                                                        mColumn2->nColumn->depth);
+                        if (popcount128(fromMask) > 0) {
+                            stRPPartition invertedFromPartition = mColumn->maskFrom &
+                                    invertPartition(fromPartition, mColumn1->pColumn->depth + mColumn2->pColumn->depth);
+                            stRPPartition invertedToPartition = mColumn->maskTo &
+                                    invertPartition(toPartition, mColumn1->nColumn->depth + mColumn2->nColumn->depth);
 
                             stRPMergeCell_construct(invertedFromPartition, invertedToPartition, mColumn);
                         }
@@ -735,9 +866,12 @@ stRPHmm *stRPHmm_createCrossProductOfTwoAlignedHmm(stRPHmm *hmm1, stRPHmm *hmm2)
                     stRPMergeCell_construct(fromPartition, toPartition, mColumn);
                 }
             }
-            stHash_destructIterator(cellIt2);
         }
-        stHash_destructIterator(cellIt1);
+
+        // Keep only the merge cells fed by the cells kept in the forward beam
+        if (stRPHmm_hasForwardBeam(hmm)) {
+            crossProductMergeColumn_applyForwardBeam(hmm, mColumn);
+        }
 
         // Get next column
         column1 = mColumn1->nColumn;
@@ -749,14 +883,265 @@ stRPHmm *stRPHmm_createCrossProductOfTwoAlignedHmm(stRPHmm *hmm1, stRPHmm *hmm2)
     return hmm;
 }
 
+/*
+ * Construction of a read partitioning hmm directly from its profile sequences, see stRPHmm_constructBySweep.
+ */
+
+// The number of reads starting at a column whose partitions are enumerated together before the forward beam is applied
+#define SWEEP_READ_BATCH 4
+
+static int boundary_cmp(const void *a, const void *b) {
+    int64_t i = *(int64_t *) a, j = *(int64_t *) b;
+    return i < j ? -1 : (i > j ? 1 : 0);
+}
+
+static stRPColumn *sweep_constructColumn(stReference *ref, int64_t refStart, int64_t length, int64_t depth,
+                                         stProfileSeq **reads) {
+    /*
+     * Creates a column without cells for the given reads, each of which covers the column's reference interval.
+     */
+    stProfileSeq **seqHeaders = st_malloc(sizeof(stProfileSeq *) * depth);
+    memcpy(seqHeaders, reads, sizeof(stProfileSeq *) * depth);
+    uint8_t **seqs = st_malloc(sizeof(uint8_t *) * depth);
+    uint64_t firstAllele = ref->sites[refStart].alleleOffset;
+    for (int64_t i = 0; i < depth; i++) {
+        assert(reads[i]->refStart <= refStart && reads[i]->refStart + reads[i]->length >= refStart + length);
+        seqs[i] = &(reads[i]->profileProbs[firstAllele - ref->sites[reads[i]->refStart].alleleOffset]);
+    }
+    return stRPColumn_construct(refStart, length, depth, seqHeaders, seqs);
+}
+
+static stRPCell *sweep_extendCells(stRPCell *cells, int64_t depth, int64_t batch) {
+    /*
+     * Returns the cells made by extending the partition of each of the given cells, of the first depth reads of the
+     * column, with each partition of the next batch reads. Each new cell's backwardLogProb holds, temporarily, the
+     * forward probability of the merge cell preceding the cells. Destroys the given cells.
+     */
+    stRPCell *head = NULL;
+    while (cells != NULL) {
+        for (uint64_t i = 0; i < ((uint64_t) 1 << batch); i++) {
+            stRPCell *cell = stRPCell_construct(cells->partition | ((stRPPartition) i << depth));
+            cell->backwardLogProb = cells->backwardLogProb;
+            cell->nCell = head;
+            head = cell;
+        }
+        stRPCell *pCell = cells;
+        cells = cells->nCell;
+        stRPCell_destruct(pCell);
+    }
+    return head;
+}
+
+static void sweep_calculateForwardProbs(stRPHmm *hmm, stRPColumn *column) {
+    uint64_t *bitCountVectors = stRPColumn_getBitCountVectors(column, hmm->ref);
+    stRPCell *cell = column->head;
+    do {
+        cell->forwardLogProb = cell->backwardLogProb +
+                               emissionLogProbability(column, cell, bitCountVectors, hmm->ref,
+                                                      (stRPHmmParameters *) hmm->parameters);
+    } while ((cell = cell->nCell) != NULL);
+}
+
+static void sweep_makeCells(stRPHmm *hmm, stRPColumn *column, int64_t continuingReadNo) {
+    /*
+     * Makes the cells of the column, whose first continuingReadNo reads are those of the previous merge column's
+     * partitions, and calculates their forward probabilities. The partitions of the reads starting at the column are
+     * added a batch at a time, applying the forward beam to the partial partitions after each batch, so the cells
+     * kept never exceed the beam times the partitions of a batch. As in a cross product made with a forward beam,
+     * the beam takes precedence over includeInvertedPartitions.
+     */
+    stRPHmmParameters *params = (stRPHmmParameters *) hmm->parameters;
+
+    // A cell for each partition of the continuing reads
+    stRPCell *cells = NULL;
+    if (column->pColumn == NULL) {
+        cells = stRPCell_construct(0);
+        cells->backwardLogProb = ST_MATH_LOG_ONE;
+    } else {
+        uint64_t slot = 0;
+        stRPMergeCell *mCell;
+        while ((mCell = partitionMap_getNext(column->pColumn->mergeCellsFrom, &slot)) != NULL) {
+            stRPCell *cell = stRPCell_construct(mCell->toPartition);
+            cell->backwardLogProb = mCell->forwardLogProb;
+            cell->nCell = cells;
+            cells = cell;
+        }
+    }
+
+    // Extend them with the partitions of the starting reads
+    int64_t depth = continuingReadNo;
+    do {
+        int64_t batch = column->depth - depth < SWEEP_READ_BATCH ? column->depth - depth : SWEEP_READ_BATCH;
+        cells = sweep_extendCells(cells, depth, batch);
+        depth += batch;
+
+        // The forward probabilities of the partial partitions are those of a column of just their reads
+        stRPColumn *partialColumn = column;
+        if (depth < column->depth) {
+            partialColumn = sweep_constructColumn(hmm->ref, column->refStart, column->length, depth,
+                                                  column->seqHeaders);
+        } else {
+            stRPColumn_getEmissions(column, hmm->ref, params);
+        }
+        partialColumn->head = cells;
+        sweep_calculateForwardProbs(hmm, partialColumn);
+        stRPHmm_beamPruneColumn(hmm, partialColumn);
+        cells = partialColumn->head;
+        if (partialColumn != column) {
+            partialColumn->head = NULL;
+            stRPColumn_destruct(partialColumn);
+        }
+    } while (depth < column->depth);
+
+    // Remove the merge cells of the previous merge column not leading to a kept cell
+    if (column->pColumn != NULL) {
+        stList *cellList = stList_construct();
+        stRPCell *cell = column->head;
+        do {
+            stList_append(cellList, cell);
+        } while ((cell = cell->nCell) != NULL);
+        PartitionMap *linkedMergeCells = getLinkedMergeCells(column->pColumn, stRPMergeColumn_getPreviousMergeCell,
+                                                          cellList);
+        filterMergeCells(column->pColumn, linkedMergeCells);
+        partitionMap_destruct(linkedMergeCells);
+        stList_destruct(cellList);
+    }
+}
+
+static stRPMergeColumn *sweep_makeMergeColumn(stRPHmm *hmm, stRPColumn *column, stRPPartition maskFrom) {
+    /*
+     * Makes the merge column following the column, in which the reads of maskFrom continue, packed into the low bits
+     * of the next column's partitions in the same order, and calculates its forward probabilities.
+     */
+    stRPMergeColumn *mColumn = stRPMergeColumn_construct(maskFrom, makeAcceptMask(popcount128(maskFrom)));
+    mColumn->pColumn = column;
+    column->nColumn = mColumn;
+    stRPCell *cell = column->head;
+    do {
+        stRPPartition fromPartition = cell->partition & maskFrom;
+        stRPMergeCell *mCell = partitionMap_search(mColumn->mergeCellsFrom, fromPartition);
+        if (mCell == NULL) {
+            stRPPartition toPartition = 0, bit = 1;
+            for (stRPPartition mask = maskFrom; mask != 0; mask &= mask - 1, bit <<= 1) {
+                if (fromPartition & mask & -mask) {
+                    toPartition |= bit;
+                }
+            }
+            mCell = stRPMergeCell_construct(fromPartition, toPartition, mColumn);
+            mCell->forwardLogProb = ST_MATH_LOG_ZERO;
+        }
+        mCell->forwardLogProb = logAddP(mCell->forwardLogProb, cell->forwardLogProb,
+                                        hmm->parameters->maxNotSumTransitions);
+    } while ((cell = cell->nCell) != NULL);
+    return mColumn;
+}
+
+stRPHmm *stRPHmm_constructBySweep(stList *profileSeqs, stRPHmmParameters *params) {
+    /*
+     * Creates the read partitioning hmm of a set of profile sequences, ordered by refStart, on one reference sequence
+     * and each overlapping an earlier one, as getRPHmms otherwise makes by merging the hmms of the sequences (see
+     * stRPHmm_createCrossProductOfTwoAlignedHmm).
+     *
+     * The hmm is made in one pass over the sequences, its columns starting and ending wherever a sequence does. The
+     * cells of each column are made directly from those of the previous column, keeping only those in the forward
+     * beam (see stRPHmm_beamPruneColumn), which must be set, as the columns are made. As this prunes on forward
+     * probabilities alone the cells kept are not, in general, those of the merged hmm.
+     */
+    if (params->forwardBeamLogProbMargin <= 0 && params->forwardBeamMaxCells <= 0) {
+        st_errAbort("Constructing an hmm by sweeping its sequences requires a forward beam\n");
+    }
+    int64_t readNo = stList_length(profileSeqs);
+    assert(readNo > 0);
+
+    // Create a new empty hmm
+    stRPHmm *hmm = st_calloc(1, sizeof(stRPHmm));
+    stProfileSeq *firstRead = stList_get(profileSeqs, 0);
+    hmm->ref = firstRead->ref;
+    hmm->refStart = firstRead->refStart;
+    hmm->profileSeqs = stList_copy(profileSeqs, NULL);
+    hmm->parameters = params;
+
+    // The column boundaries, where each read starts and ends
+    int64_t *boundaries = st_malloc(sizeof(int64_t) * 2 * readNo);
+    for (int64_t i = 0; i < readNo; i++) {
+        stProfileSeq *pSeq = stList_get(profileSeqs, i);
+        assert(stString_eq(pSeq->ref->referenceName, hmm->ref->referenceName));
+        assert(i == 0 || ((stProfileSeq *) stList_get(profileSeqs, i - 1))->refStart <= pSeq->refStart);
+        boundaries[2 * i] = pSeq->refStart;
+        boundaries[2 * i + 1] = pSeq->refStart + pSeq->length;
+    }
+    qsort(boundaries, 2 * readNo, sizeof(int64_t), boundary_cmp);
+    hmm->refLength = boundaries[2 * readNo - 1] - hmm->refStart;
+
+    // The reads of the current column, those continuing from the previous column first, in their order in it
+    stProfileSeq *reads[MAX_READ_PARTITIONING_DEPTH];
+    int64_t depth = 0, nextRead = 0;
+    stRPColumn *column = NULL;
+    for (int64_t i = 0; i < 2 * readNo - 1; i++) {
+        int64_t refStart = boundaries[i];
+        if (refStart == boundaries[i + 1]) {
+            continue;
+        }
+
+        // The reads continuing into the column
+        stRPPartition maskFrom = 0;
+        int64_t continuingReadNo = 0;
+        for (int64_t j = 0; j < depth; j++) {
+            if (reads[j]->refStart + reads[j]->length > refStart) {
+                maskFrom |= (stRPPartition) 1 << j;
+                reads[continuingReadNo++] = reads[j];
+            }
+        }
+
+        // The reads starting at the column
+        depth = continuingReadNo;
+        while (nextRead < readNo && ((stProfileSeq *) stList_get(profileSeqs, nextRead))->refStart == refStart) {
+            if (depth == MAX_READ_PARTITIONING_DEPTH || depth == params->maxCoverageDepth) {
+                st_errAbort("\nCoverage depth: read depth exceeds hard maximum of %" PRIi64
+                            " with configured maximum of %" PRIi64 "\n",
+                            MAX_READ_PARTITIONING_DEPTH, params->maxCoverageDepth);
+            }
+            reads[depth++] = stList_get(profileSeqs, nextRead++);
+        }
+        assert(depth > 0);
+        if (depth > hmm->maxDepth) {
+            hmm->maxDepth = depth;
+        }
+
+        // Make the column and the merge column linking it to the previous column
+        stRPColumn *nColumn = sweep_constructColumn(hmm->ref, refStart, boundaries[i + 1] - refStart, depth, reads);
+        if (column != NULL) {
+            stRPMergeColumn *mColumn = sweep_makeMergeColumn(hmm, column, maskFrom);
+            mColumn->nColumn = nColumn;
+            nColumn->pColumn = mColumn;
+        } else {
+            hmm->firstColumn = nColumn;
+        }
+        sweep_makeCells(hmm, nColumn, continuingReadNo);
+        hmm->columnNumber++;
+        column = nColumn;
+    }
+    assert(nextRead == readNo);
+    hmm->lastColumn = column;
+
+    // Cleanup
+    free(boundaries);
+
+    return hmm;
+}
+
 static void stRPHmm_initialiseProbs(stRPHmm *hmm) {
     /*
      * Initialize the forward and backward matrices.
+     *
+     * Also links each cell to the merge cells either side of it, so the forward and backward passes walk pointers
+     * rather than looking merge cells up in the merge columns' hashes.
      */
 
     // Initialize total forward and backward probabilities
     hmm->forwardLogProb = ST_MATH_LOG_ZERO;
     hmm->backwardLogProb = ST_MATH_LOG_ZERO;
+    hmm->hasViterbiPointers = FALSE;
 
     // Iterate through columns from first to last
     stRPColumn *column = hmm->firstColumn;
@@ -769,6 +1154,10 @@ static void stRPHmm_initialiseProbs(stRPHmm *hmm) {
         do {
             cell->forwardLogProb = ST_MATH_LOG_ZERO;
             cell->backwardLogProb = ST_MATH_LOG_ZERO;
+            cell->pMergeCell = column->pColumn != NULL ?
+                               stRPMergeColumn_getPreviousMergeCell(cell, column->pColumn) : NULL;
+            cell->nMergeCell = column->nColumn != NULL ?
+                               stRPMergeColumn_getNextMergeCell(cell, column->nColumn) : NULL;
         } while ((cell = cell->nCell) != NULL);
 
         if (column->nColumn == NULL) {
@@ -776,11 +1165,12 @@ static void stRPHmm_initialiseProbs(stRPHmm *hmm) {
         }
 
         // Initialise cells in the next merge column
-        stList *mergeCells = stHash_getValues(column->nColumn->mergeCellsFrom);
+        stList *mergeCells = partitionMap_getValues(column->nColumn->mergeCellsFrom);
         for (int64_t i = 0; i < stList_length(mergeCells); i++) {
             stRPMergeCell *mergeCell = stList_get(mergeCells, i);
             mergeCell->forwardLogProb = ST_MATH_LOG_ZERO;
             mergeCell->backwardLogProb = ST_MATH_LOG_ZERO;
+            mergeCell->maxForwardCell = NULL;
         }
         stList_destruct(mergeCells);
 
@@ -788,21 +1178,50 @@ static void stRPHmm_initialiseProbs(stRPHmm *hmm) {
     }
 }
 
-static inline void forwardCellCalc1(stRPHmm *hmm, stRPColumn *column, stRPCell *cell, uint64_t *bitCountVectors) {
+static int64_t stRPHmm_getColumnCells(stRPHmm *hmm, stRPColumn *column, stRPCell ***cells, int64_t *maxCellNumber,
+                                      int64_t *emissionCellNumber) {
+    /*
+     * Puts the column's cells in the cells buffer, growing it as needed, and returns their number.
+     *
+     * A partition and its inverse have the same emission probability, as swapping the haplotypes leaves the genotype
+     * probabilities unchanged. With includeInvertedPartitions the cells are made in such pairs, in increasing order of
+     * partition, so the inverse of the i-th cell is the i-th from the end. If so emissionCellNumber is set to half the
+     * cells, whose emissions are shared with their inverses (see forwardCellCalc1), otherwise to all of them.
+     */
+    int64_t cellNumber = 0;
+    stRPCell *cell = column->head;
+    do {
+        if (cellNumber == *maxCellNumber) {
+            *maxCellNumber = *maxCellNumber * 2 + CELL_BUFFER_SIZE;
+            *cells = st_realloc(*cells, *maxCellNumber * sizeof(stRPCell *));
+        }
+        (*cells)[cellNumber++] = cell;
+    } while ((cell = cell->nCell) != NULL);
+
+    *emissionCellNumber = cellNumber;
+    if (hmm->parameters->includeInvertedPartitions && cellNumber % 2 == 0) {
+        int64_t i = 0;
+        while (i < cellNumber / 2 && (*cells)[cellNumber - 1 - i]->partition ==
+                                     invertPartition((*cells)[i]->partition, column->depth)) {
+            i++;
+        }
+        if (i == cellNumber / 2) {
+            *emissionCellNumber = cellNumber / 2;
+        }
+    }
+    return cellNumber;
+}
+
+static inline void forwardCellCalcWithEmission(stRPColumn *column, stRPCell *cell, double emissionProb) {
     // If the previous merge column exists then propagate forward probability from merge state
     if (column->pColumn != NULL) {
-        stRPMergeCell *mCell = stRPMergeColumn_getPreviousMergeCell(cell, column->pColumn);
-        cell->forwardLogProb = mCell->forwardLogProb;
+        cell->forwardLogProb = cell->pMergeCell->forwardLogProb;
     }
         // Otherwise initialize probability with log(1.0)
     else {
         cell->forwardLogProb = ST_MATH_LOG_ONE;
     }
 
-    // Calculate the emission prob
-    double emissionProb = emissionLogProbability(column, cell, bitCountVectors,
-                                                 hmm->ref, (stRPHmmParameters *) hmm->parameters);
-
     // Add emission prob to forward log prob
     cell->forwardLogProb += emissionProb;
 
@@ -811,80 +1230,256 @@ static inline void forwardCellCalc1(stRPHmm *hmm, stRPColumn *column, stRPCell *
     cell->backwardLogProb = emissionProb;
 }
 
-static inline void forwardCellCalc2(stRPHmm *hmm, stRPColumn *column, stRPCell *cell) {
+static inline void forwardCellCalc1(stRPHmm *hmm, stRPColumn *column, stRPCell **cells, int64_t i,
+                                    int64_t cellNumber, int64_t emissionCellNumber, uint64_t *bitCountVectors) {
+    /*
+     * Calculates the emission prob of the i-th of the cells, from stRPHmm_getColumnCells, and the forward prob from it,
+     * and, if the emissions are shared, those of its inverse.
+     */
+    double emissionProb = emissionLogProbability(column, cells[i], bitCountVectors,
+                                                 hmm->ref, (stRPHmmParameters *) hmm->parameters);
+    forwardCellCalcWithEmission(column, cells[i], emissionProb);
+    if (emissionCellNumber < cellNumber) {
+        forwardCellCalcWithEmission(column, cells[cellNumber - 1 - i], emissionProb);
+    }
+}
+
+static inline void forwardCellCalc2(stRPHmm *hmm, stRPColumn *column, stRPCell *cell, const bool viterbi,
+                                    const bool maxNotSum) {
     // If the next merge column exists then propagate forward probability to the merge state
     if (column->nColumn != NULL) {
-        // Add to the next merge cell
-        stRPMergeCell *mCell = stRPMergeColumn_getNextMergeCell(cell, column->nColumn);
-        mCell->forwardLogProb = logAddP(mCell->forwardLogProb, cell->forwardLogProb,
-                                        hmm->parameters->maxNotSumTransitions);
+        stRPMergeCell *mCell = cell->nMergeCell;
+        if (viterbi) {
+            // Take the max, remembering the cell it came from for the traceback
+            if (cell->forwardLogProb > mCell->forwardLogProb) {
+                mCell->forwardLogProb = cell->forwardLogProb;
+                mCell->maxForwardCell = cell;
+            }
+        } else {
+            // Add to the next merge cell
+            mCell->forwardLogProb = logAddP(mCell->forwardLogProb, cell->forwardLogProb, maxNotSum);
+        }
     } else {
         // Else propagate probability to total forward probability of model
-        hmm->forwardLogProb = logAddP(hmm->forwardLogProb, cell->forwardLogProb, hmm->parameters->maxNotSumTransitions);
+        hmm->forwardLogProb = logAddP(hmm->forwardLogProb, cell->forwardLogProb, viterbi || maxNotSum);
     }
 }
 
-static void stRPHmm_forward(stRPHmm *hmm) {
+static int forwardCellCmpFn(const void *a, const void *b) {
     /*
-     * Forward algorithm for hmm.
+     * Sort cells by forward probability in descending order.
      */
-    stRPColumn *column = hmm->firstColumn;
+    double p1 = (*(stRPCell **) a)->forwardLogProb, p2 = (*(stRPCell **) b)->forwardLogProb;
+    return p1 > p2 ? -1 : p1 < p2 ? 1 : 0;
+}
 
-    // Iterate through columns from first to last
-    while (1) {
-        // Get the bit count vectors for the column
-        uint64_t *bitCountVectors = calculateCountBitVectors(column->seqs, hmm->ref,
-                                                             column->refStart, column->length, column->depth);
+static void stRPHmm_beamPruneColumn(stRPHmm *hmm, stRPColumn *column) {
+    /*
+     * Discards the cells of the column whose forward probability (which must have been calculated, but not yet
+     * propagated to the next merge column) is more than forwardBeamLogProbMargin below the most probable cell's, or
+     * that are not among the forwardBeamMaxCells most probable cells. Either filter is off if not positive.
+     */
+    stRPHmmParameters *params = (stRPHmmParameters *) hmm->parameters;
+    if (params->forwardBeamLogProbMargin <= 0 && params->forwardBeamMaxCells <= 0) {
+        return;
+    }
 
-        // Iterate through states in column
-        stRPCell *cell = column->head;
+    // Put the cells in an array, sorted from most to least probable
+    int64_t cellNumber = 0;
+    stRPCell *cell = column->head;
+    do {
+        cellNumber++;
+    } while ((cell = cell->nCell) != NULL);
+    stRPCell **cells = st_malloc(cellNumber * sizeof(stRPCell *));
+    cellNumber = 0;
+    cell = column->head;
+    do {
+        cells[cellNumber++] = cell;
+    } while ((cell = cell->nCell) != NULL);
+    qsort(cells, cellNumber, sizeof(stRPCell *), forwardCellCmpFn);
+
+    // Find how many to keep, always keeping the most probable
+    int64_t keptCellNumber = 1;
+    while (keptCellNumber < cellNumber &&
+           (params->forwardBeamMaxCells <= 0 || keptCellNumber < params->forwardBeamMaxCells) &&
+           (params->forwardBeamLogProbMargin <= 0 ||
+            cells[keptCellNumber]->forwardLogProb >= cells[0]->forwardLogProb - params->forwardBeamLogProbMargin)) {
+        keptCellNumber++;
+    }
+
+    // Relink the kept cells and discard the rest
+    for (int64_t i = 0; i < keptCellNumber; i++) {
+        cells[i]->nCell = i + 1 < keptCellNumber ? cells[i + 1] : NULL;
+    }
+    column->head = cells[0];
+    for (int64_t i = keptCellNumber; i < cellNumber; i++) {
+        stRPCell_destruct(cells[i]);
+    }
+    free(cells);
+}
 
-        // If OpenMP is available then parallelize the calculation of the emission calcs
 #if defined(_OPENMP)
-        stRPCell *cells[CELL_BUFFER_SIZE];
-        do {
-            // Get as many cells as the buffer will fit / there are cells
-            int64_t cellsInBuffer=0;
-            do {
-                cells[cellsInBuffer++] = cell;
-            } while((cell = cell->nCell) != NULL && cellsInBuffer < CELL_BUFFER_SIZE);
+static inline void stRPHmm_forwardInParallel(stRPHmm *hmm, const bool viterbi, const bool maxNotSum) {
+    /*
+     * Forward algorithm for hmm, sharing the emission calcs of each column between the threads of one
+     * parallel region opened for the whole hmm.
+     */
+    stRPCell **cells = NULL;
+    int64_t cellNumber = 0, emissionCellNumber = 0, maxCellNumber = 0, totalCellNumber = 0, totalMergeCellNumber = 0;
+    uint64_t *bitCountVectors = NULL;
 
 #pragma omp parallel
-{
-#pragma omp for
-            for(int64_t i=0; i<cellsInBuffer; i++) {
-                forwardCellCalc1(hmm, column, cells[i], bitCountVectors);
+    {
+        // Each thread walks the columns, which are not changed by the pass
+        stRPColumn *column = hmm->firstColumn;
+        while (1) {
+#pragma omp single
+            {
+                // Get the bit count vectors, emission tables and the cells of the column
+                bitCountVectors = stRPColumn_getBitCountVectors(column, hmm->ref);
+                stRPColumn_getEmissions(column, hmm->ref, (stRPHmmParameters *) hmm->parameters);
+                cellNumber = stRPHmm_getColumnCells(hmm, column, &cells, &maxCellNumber, &emissionCellNumber);
+                totalCellNumber += cellNumber;
+            }
+
+#pragma omp for schedule(static)
+            for (int64_t i = 0; i < emissionCellNumber; i++) {
+                forwardCellCalc1(hmm, column, cells, i, cellNumber, emissionCellNumber, bitCountVectors);
+            }
+
+#pragma omp single
+            {
+                // Discard cells outside the beam, if any, before propagating to the next merge column
+                stRPHmm_beamPruneColumn(hmm, column);
+                stRPCell *cell = column->head;
+                do {
+                    forwardCellCalc2(hmm, column, cell, viterbi, maxNotSum);
+                } while ((cell = cell->nCell) != NULL);
+                if (column->nColumn != NULL) {
+                    totalMergeCellNumber += partitionMap_size(column->nColumn->mergeCellsFrom);
+                }
             }
+
+            if (column->nColumn == NULL) {
+                break;
+            }
+            column = column->nColumn->nColumn;
+        }
+    }
+
+    free(cells);
+    chunkTelemetry_addCount(CTC_HMM_CELLS, totalCellNumber);
+    chunkTelemetry_addCount(CTC_HMM_MERGE_CELLS, totalMergeCellNumber);
+}
+#endif
+
+#if defined(_OPENMP)
+// The cells of a column whose emission calcs are lent to the free threads of the chunk loops as one task
+#define LENT_CELL_BLOCK 32
+
+static void stRPHmm_forwardCellCalc1InTasks(stRPHmm *hmm, stRPColumn *column, uint64_t *bitCountVectors,
+                                            stRPCell **cells, int64_t cellNumber, int64_t emissionCellNumber) {
+    /*
+     * Does the emission calcs of the column's cells, from stRPHmm_getColumnCells, in tasks of LENT_CELL_BLOCK cells,
+     * for the threads that have run out of chunks to take.
+     */
+    for (int64_t i = 0; i < emissionCellNumber; i += LENT_CELL_BLOCK) {
+        int64_t blockEnd = i + LENT_CELL_BLOCK < emissionCellNumber ? i + LENT_CELL_BLOCK : emissionCellNumber;
+#pragma omp task firstprivate(i, blockEnd) shared(hmm, column, cells, bitCountVectors)
+        for (int64_t j = i; j < blockEnd; j++) {
+            forwardCellCalc1(hmm, column, cells, j, cellNumber, emissionCellNumber, bitCountVectors);
+        }
+    }
+#pragma omp taskwait
 }
-            for(int64_t i=0; i<cellsInBuffer; i++) {
-                forwardCellCalc2(hmm, column, cells[i]);
+#endif
+
+static inline void stRPHmm_forward2(stRPHmm *hmm, const bool viterbi, const bool maxNotSum) {
+    /*
+     * As stRPHmm_forward, for the given transitions.
+     */
+
+    // If OpenMP is available and the hmm is not already being run within a parallel region (such as the chunk loops
+    // of polish and phase, which keep their threads busy with other chunks' hmms) then parallelize the emission calcs
+#if defined(_OPENMP)
+    if (!omp_in_parallel() && omp_get_max_threads() > 1) {
+        stRPHmm_forwardInParallel(hmm, viterbi, maxNotSum);
+        return;
+    }
+#endif
+
+    stRPColumn *column = hmm->firstColumn;
+    int64_t totalCellNumber = 0, mergeCellNumber = 0;
+    stRPCell **cells = NULL;
+    int64_t maxCellNumber = 0;
+
+    // Iterate through columns from first to last
+    while (1) {
+        // Get the bit count vectors for the column, these are kept with the column for reuse when
+        // filling in genome fragments
+        uint64_t *bitCountVectors = stRPColumn_getBitCountVectors(column, hmm->ref);
+
+        // Get the emission tables of the column's sites, used by the emission calcs
+        stRPColumn_getEmissions(column, hmm->ref, (stRPHmmParameters *) hmm->parameters);
+
+        // Iterate through states in column, lending the emission calcs to the threads of the chunk loops that have
+        // run out of chunks, if any, as the column is reached
+        int64_t emissionCellNumber;
+        int64_t cellNumber = stRPHmm_getColumnCells(hmm, column, &cells, &maxCellNumber, &emissionCellNumber);
+        totalCellNumber += cellNumber;
+#if defined(_OPENMP)
+        if (chunkScheduler_getIdleThreadNo() > 0) {
+            stRPHmm_forwardCellCalc1InTasks(hmm, column, bitCountVectors, cells, cellNumber, emissionCellNumber);
+        } else
+#endif
+        {
+            for (int64_t i = 0; i < emissionCellNumber; i++) {
+                forwardCellCalc1(hmm, column, cells, i, cellNumber, emissionCellNumber, bitCountVectors);
             }
-        } while(cell != NULL);
-#else
-        // Otherwise do it without the need for the cell buffer
+        }
+
+        // Discard cells outside the beam, if any, before propagating to the next merge column
+        stRPHmm_beamPruneColumn(hmm, column);
+
+        stRPCell *cell = column->head;
         do {
-            forwardCellCalc1(hmm, column, cell, bitCountVectors);
-            forwardCellCalc2(hmm, column, cell);
+            forwardCellCalc2(hmm, column, cell, viterbi, maxNotSum);
         } while ((cell = cell->nCell) != NULL);
-#endif
-
-        // Cleanup the bit count vectors
-        free(bitCountVectors);
 
         if (column->nColumn == NULL) {
             break;
         }
+        mergeCellNumber += partitionMap_size(column->nColumn->mergeCellsFrom);
         column = column->nColumn->nColumn;
     }
+    free(cells);
+    chunkTelemetry_addCount(CTC_HMM_CELLS, totalCellNumber);
+    chunkTelemetry_addCount(CTC_HMM_MERGE_CELLS, mergeCellNumber);
 }
 
-static inline void backwardCellCalc(stRPHmm *hmm, stRPColumn *column, stRPCell *cell) {
+static void stRPHmm_forward(stRPHmm *hmm, bool viterbi) {
+    /*
+     * Forward algorithm for hmm. If viterbi is true the max is taken over transitions, whatever the parameters, and
+     * the merge cells point to the cells their maxes came from.
+     *
+     * The pass is specialised on the transitions, so the cell updates do not branch on them.
+     */
+    if (viterbi) {
+        stRPHmm_forward2(hmm, TRUE, TRUE);
+    } else if (hmm->parameters->maxNotSumTransitions) {
+        stRPHmm_forward2(hmm, FALSE, TRUE);
+    } else {
+        stRPHmm_forward2(hmm, FALSE, FALSE);
+    }
+}
+
+static inline void backwardCellCalc(stRPHmm *hmm, stRPColumn *column, stRPCell *cell, const bool maxNotSum) {
     // Retrieve the emission probability that was stored by the forward pass
     double probabilityToPropagateLogProb = cell->backwardLogProb;
 
     // If the next merge column exists then propagate backward probability from merge state
     if (column->nColumn != NULL) {
-        stRPMergeCell *mCell = stRPMergeColumn_getNextMergeCell(cell, column->nColumn);
+        stRPMergeCell *mCell = cell->nMergeCell;
         cell->backwardLogProb = mCell->backwardLogProb;
         probabilityToPropagateLogProb += mCell->backwardLogProb;
     } else { // Else set the backward prob to log(1)
@@ -894,22 +1489,19 @@ static inline void backwardCellCalc(stRPHmm *hmm, stRPColumn *column, stRPCell *
     // If the previous merge column exists then propagate backward probability to the merge state
     if (column->pColumn != NULL) {
         // Add to the previous merge cell
-        stRPMergeCell *mCell = stRPMergeColumn_getPreviousMergeCell(cell, column->pColumn);
-        mCell->backwardLogProb = logAddP(mCell->backwardLogProb, probabilityToPropagateLogProb,
-                                         hmm->parameters->maxNotSumTransitions);
+        stRPMergeCell *mCell = cell->pMergeCell;
+        mCell->backwardLogProb = logAddP(mCell->backwardLogProb, probabilityToPropagateLogProb, maxNotSum);
     } else {
-        hmm->backwardLogProb = logAddP(hmm->backwardLogProb, probabilityToPropagateLogProb,
-                                       hmm->parameters->maxNotSumTransitions);
+        hmm->backwardLogProb = logAddP(hmm->backwardLogProb, probabilityToPropagateLogProb, maxNotSum);
     }
 
     // Add to column total probability
-    column->totalLogProb = logAddP(column->totalLogProb,
-                                   cell->forwardLogProb + cell->backwardLogProb, hmm->parameters->maxNotSumTransitions);
+    column->totalLogProb = logAddP(column->totalLogProb, cell->forwardLogProb + cell->backwardLogProb, maxNotSum);
 }
 
-static void stRPHmm_backward(stRPHmm *hmm) {
+static inline void stRPHmm_backward2(stRPHmm *hmm, const bool maxNotSum) {
     /*
-     * Backward algorithm for hmm.
+     * As stRPHmm_backward, for the given transitions.
      */
     stRPColumn *column = hmm->lastColumn;
 
@@ -918,7 +1510,7 @@ static void stRPHmm_backward(stRPHmm *hmm) {
         // Iterate through states in column
         stRPCell *cell = column->head;
         do {
-            backwardCellCalc(hmm, column, cell);
+            backwardCellCalc(hmm, column, cell, maxNotSum);
         } while ((cell = cell->nCell) != NULL);
 
         if (column->pColumn == NULL) {
@@ -928,19 +1520,38 @@ static void stRPHmm_backward(stRPHmm *hmm) {
     }
 }
 
+static void stRPHmm_backward(stRPHmm *hmm) {
+    /*
+     * Backward algorithm for hmm, specialised on the transitions as the forward pass is.
+     */
+    if (hmm->parameters->maxNotSumTransitions) {
+        stRPHmm_backward2(hmm, TRUE);
+    } else {
+        stRPHmm_backward2(hmm, FALSE);
+    }
+}
+
 void stRPHmm_forwardBackward(stRPHmm *hmm) {
     /*
      * Runs the forward and backward algorithms and sets the total column probabilities.
      *
      * This function must be run upon an HMM to calculate cell posterior probabilities.
      */
+    allocProfile_scope(APT_PHASING);
     // Initialise state values
     stRPHmm_initialiseProbs(hmm);
     // Run the forward and backward passes
-    stRPHmm_forward(hmm);
+    stRPHmm_forward(hmm, FALSE);
     stRPHmm_backward(hmm);
 }
 
+void stRPHmm_viterbi(stRPHmm *hmm) {
+    allocProfile_scope(APT_PHASING);
+    stRPHmm_initialiseProbs(hmm);
+    stRPHmm_forward(hmm, TRUE);
+    hmm->hasViterbiPointers = TRUE;
+}
+
 static int cellCmpFn(const void *a, const void *b, const void *extraArg) {
     /*
      * Sort cells by posterior probability in descending order.
@@ -961,46 +1572,46 @@ static int mergeCellCmpFn(const void *a, const void *b, const void *extraArg) {
     return p1 > p2 ? -1 : p1 < p2 ? 1 : 0;
 }
 
-void filterMergeCells(stRPMergeColumn *mColumn, stSet *chosenMergeCellsSet) {
+void filterMergeCells(stRPMergeColumn *mColumn, PartitionMap *chosenMergeCells) {
     /*
-     * Removes merge cells from the column that are not in chosenMergeCellsSet
+     * Removes merge cells from the column that are not in chosenMergeCells, a map of merge cells keyed by their
+     * fromPartition.
      */
-    assert(stSet_size(chosenMergeCellsSet) > 0);
-    stList *mergeCells = stHash_getValues(mColumn->mergeCellsFrom);
+    assert(partitionMap_size(chosenMergeCells) > 0);
+    stList *mergeCells = partitionMap_getValues(mColumn->mergeCellsFrom);
     for (int64_t i = 0; i < stList_length(mergeCells); i++) {
         stRPMergeCell *mCell = stList_get(mergeCells, i);
         assert(mCell != NULL);
-        if (stSet_search(chosenMergeCellsSet, mCell) == NULL) {
+        if (partitionMap_search(chosenMergeCells, mCell->fromPartition) == NULL) {
             // Remove the state from the merge column
-            assert(stHash_search(mColumn->mergeCellsFrom, &(mCell->fromPartition)) == mCell);
-            assert(stHash_search(mColumn->mergeCellsTo, &(mCell->toPartition)) == mCell);
-            stHash_remove(mColumn->mergeCellsFrom, &(mCell->fromPartition));
-            stHash_remove(mColumn->mergeCellsTo, &(mCell->toPartition));
+            assert(partitionMap_search(mColumn->mergeCellsFrom, mCell->fromPartition) == mCell);
+            assert(partitionMap_search(mColumn->mergeCellsTo, mCell->toPartition) == mCell);
+            partitionMap_remove(mColumn->mergeCellsFrom, mCell->fromPartition);
+            partitionMap_remove(mColumn->mergeCellsTo, mCell->toPartition);
 
             // Cleanup
             stRPMergeCell_destruct(mCell);
         }
     }
     stList_destruct(mergeCells);
-    assert(stSet_size(chosenMergeCellsSet) == stHash_size(mColumn->mergeCellsFrom));
-    assert(stSet_size(chosenMergeCellsSet) == stHash_size(mColumn->mergeCellsTo));
+    assert(partitionMap_size(chosenMergeCells) == partitionMap_size(mColumn->mergeCellsFrom));
+    assert(partitionMap_size(chosenMergeCells) == partitionMap_size(mColumn->mergeCellsTo));
 }
 
-stSet *getLinkedMergeCells(stRPMergeColumn *mColumn,
-                           stRPMergeCell *(*getNCell)(stRPCell *, stRPMergeColumn *),
-                           stList *cells) {
+PartitionMap *getLinkedMergeCells(stRPMergeColumn *mColumn,
+                               stRPMergeCell *(*getNCell)(stRPCell *, stRPMergeColumn *),
+                               stList *cells) {
     /*
-     * Returns the set of merge cells in the column that are linked to a cell
-     * in cells.
+     * Returns the merge cells in the column that are linked to a cell in cells, keyed by their fromPartition.
      */
-    stSet *chosenMergeCellsSet = stSet_construct();
+    PartitionMap *chosenMergeCells = partitionMap_construct(stList_length(cells));
     for (int64_t i = 0; i < stList_length(cells); i++) {
         stRPMergeCell *mCell = getNCell(stList_get(cells, i), mColumn);
         assert(mCell != NULL);
-        stSet_insert(chosenMergeCellsSet, mCell);
+        partitionMap_insert(chosenMergeCells, mCell->fromPartition, mCell);
     }
-    assert(stSet_size(chosenMergeCellsSet) > 0);
-    return chosenMergeCellsSet;
+    assert(partitionMap_size(chosenMergeCells) > 0);
+    return chosenMergeCells;
 }
 
 void relinkCells(stRPColumn *column, stList *cells) {
@@ -1082,27 +1693,26 @@ void stRPHmm_pruneForwards(stRPHmm *hmm) {
         }
 
         //  Get merge cells that are connected to a cell in the previous column
-        stSet *chosenMergeCellsSet = getLinkedMergeCells(mColumn,
-                                                         stRPMergeColumn_getNextMergeCell, cells);
+        PartitionMap *chosenMergeCells = getLinkedMergeCells(mColumn, stRPMergeColumn_getNextMergeCell, cells);
 
         // Shrink the the number of chosen cells to less than equal to the desired number
-        stList *chosenMergeCellsList = stSet_getList(chosenMergeCellsSet);
+        stList *chosenMergeCellsList = partitionMap_getValues(chosenMergeCells);
         stList_sort2(chosenMergeCellsList, mergeCellCmpFn, mColumn);
         while (stList_length(chosenMergeCellsList) > hmm->parameters->minPartitionsInAColumn &&
                (stList_length(chosenMergeCellsList) > hmm->parameters->maxPartitionsInAColumn ||
                 stRPMergeCell_posteriorProb(stList_peek(chosenMergeCellsList), mColumn) <
                 hmm->parameters->minPosteriorProbabilityForPartition)) {
-            stSet_remove(chosenMergeCellsSet, stList_pop(chosenMergeCellsList));
+            partitionMap_remove(chosenMergeCells, ((stRPMergeCell *) stList_pop(chosenMergeCellsList))->fromPartition);
         }
-        assert(stList_length(chosenMergeCellsList) == stSet_size(chosenMergeCellsSet));
+        assert(stList_length(chosenMergeCellsList) == partitionMap_size(chosenMergeCells));
         stList_destruct(chosenMergeCellsList);
 
         // Get rid of merge cells we don't need
-        filterMergeCells(mColumn, chosenMergeCellsSet);
+        filterMergeCells(mColumn, chosenMergeCells);
 
         // Cleanup
         stList_destruct(cells);
-        stSet_destruct(chosenMergeCellsSet);
+        partitionMap_destruct(chosenMergeCells);
 
         column = mColumn->nColumn;
     }
@@ -1140,24 +1750,25 @@ void stRPHmm_pruneBackwards(stRPHmm *hmm) {
         }
 
         //  Get merge cells that are connected to a cell in the previous column
-        stSet *chosenMergeCellsSet = getLinkedMergeCells(mColumn,
-                                                         stRPMergeColumn_getPreviousMergeCell, cells);
+        PartitionMap *chosenMergeCells = getLinkedMergeCells(mColumn, stRPMergeColumn_getPreviousMergeCell, cells);
 
         // By the same logic, this number if pruned on the forwards pass
-        assert(stSet_size(chosenMergeCellsSet) <= hmm->parameters->maxPartitionsInAColumn);
+        assert(partitionMap_size(chosenMergeCells) <= hmm->parameters->maxPartitionsInAColumn);
 
         // Get rid of merge cells we don't need
-        filterMergeCells(mColumn, chosenMergeCellsSet);
+        filterMergeCells(mColumn, chosenMergeCells);
 
         // Cleanup
         stList_destruct(cells);
-        stSet_destruct(chosenMergeCellsSet);
+        partitionMap_destruct(chosenMergeCells);
 
         column = mColumn->pColumn;
     }
 }
 
 void stRPHmm_prune(stRPHmm *hmm) {
+    allocProfile_scope(APT_PHASING);
+    hmm->hasViterbiPointers = FALSE; // The cells they point to may be discarded
     stRPHmm_pruneForwards(hmm);
     stRPHmm_pruneBackwards(hmm);
 }
@@ -1244,6 +1855,7 @@ stRPHmm *stRPHmm_split(stRPHmm *hmm, int64_t splitPoint) {
     }
 
     stRPHmm *suffixHmm = st_calloc(1, sizeof(stRPHmm));
+    hmm->hasViterbiPointers = FALSE; // The cells of the split column are remade
 
     // Set the reference interval for the two hmms
     suffixHmm->ref = hmm->ref;
@@ -1299,24 +1911,43 @@ stRPHmm *stRPHmm_split(stRPHmm *hmm, int64_t splitPoint) {
     return suffixHmm;
 }
 
-static bool sitesLinkageIsWellSupported(stRPHmm *hmm, int64_t leftSite, int64_t rightSite) {
+static int64_t *getHetSiteLinkageCoverages(stRPHmm *hmm, stList *hetSites) {
     /*
-     * Returns true if the two sites, specified by reference coordinates leftSite and rightSite, are linked by
-     * hmm->parameters->minReadCoverageToSupportPhasingBetweenHeterozygousSites, otherwise false.
+     * For each pair of contiguous het sites, given as the ordered reference coordinates of hetSites, returns the
+     * number of the hmm's profile sequences that span both sites. A sequence covers a contiguous run of the het sites,
+     * and so links each pair of contiguous sites in the run, which is added to a difference array over the pairs, so
+     * the coverages are found in one pass over the sequences and one over the sites.
      */
-    stRPColumn *leftColumn = getColumn(hmm->firstColumn, leftSite);
-    stRPColumn *rightColumn = getColumn(leftColumn, rightSite);
-
-    stSet *sequencesInCommon = stRPColumn_getSequencesInCommon(leftColumn, rightColumn);
-
-    // Condition to determine if well supported by reads
-    bool wellSupported =
-            stSet_size(sequencesInCommon) >= hmm->parameters->minReadCoverageToSupportPhasingBetweenHeterozygousSites;
+    int64_t hetSiteNo = stList_length(hetSites);
+    int64_t *coverages = st_calloc(hetSiteNo > 0 ? hetSiteNo : 1, sizeof(int64_t));
+    for (int64_t i = 0; i < stList_length(hmm->profileSeqs); i++) {
+        stProfileSeq *pSeq = stList_get(hmm->profileSeqs, i);
+        int64_t firstSite = (int64_t) pSeq->refStart, endSite = (int64_t) (pSeq->refStart + pSeq->length);
 
-    // Cleanup
-    stSet_destruct(sequencesInCommon);
+        // The first het site at or after the start of the sequence, and the first at or after its end
+        int64_t min = 0, max = hetSiteNo;
+        while (min < max) {
+            int64_t mid = min + (max - min) / 2;
+            if (stIntTuple_get(stList_get(hetSites, mid), 0) < firstSite) min = mid + 1; else max = mid;
+        }
+        int64_t first = min;
+        max = hetSiteNo;
+        while (min < max) {
+            int64_t mid = min + (max - min) / 2;
+            if (stIntTuple_get(stList_get(hetSites, mid), 0) < endSite) min = mid + 1; else max = mid;
+        }
+        int64_t last = min - 1; // The last het site covered
 
-    return wellSupported;
+        // Links the pairs first to last - 1
+        if (last > first) {
+            coverages[first]++;
+            coverages[last]--;
+        }
+    }
+    for (int64_t i = 1; i < hetSiteNo; i++) {
+        coverages[i] += coverages[i - 1];
+    }
+    return coverages;
 }
 
 stList *stRPHMM_splitWherePhasingIsUncertain(stRPHmm *hmm) {
@@ -1324,12 +1955,17 @@ stList *stRPHMM_splitWherePhasingIsUncertain(stRPHmm *hmm) {
      * Takes the input hmm and splits into a sequence of contiguous fragments covering the same reference interval,
      * returned as an ordered list of hmm fragments.
      * Hmms are split where there is insufficient support between heterozygous
-     * sites to support phasing between the two haplotypes.
-     * See sitesLinkageIsWellSupported for details.
+     * sites to support phasing between the two haplotypes, that is where fewer than
+     * hmm->parameters->minReadCoverageToSupportPhasingBetweenHeterozygousSites reads span two contiguous
+     * heterozygous sites.
      */
 
-    // Run the forward-backward algorithm
-    stRPHmm_forwardBackward(hmm);
+    // Run the forward-backward algorithm, or only the forward pass if the traceback is of the most probable path
+    if (hmm->parameters->maxNotSumTransitions || hmm->parameters->viterbiPhasing) {
+        stRPHmm_viterbi(hmm);
+    } else {
+        stRPHmm_forwardBackward(hmm);
+    }
 
     // Now compute a high probability path through the hmm
     stList *path = stRPHmm_forwardTraceBack(hmm);
@@ -1350,13 +1986,14 @@ stList *stRPHMM_splitWherePhasingIsUncertain(stRPHmm *hmm) {
     stList *splitHmms = stList_construct3(0, (void (*)(void *)) stRPHmm_destruct2);
 
     // For each pair of contiguous het sites if not supported by sufficient reads split the hmm
+    int64_t *linkageCoverages = getHetSiteLinkageCoverages(hmm, hetSites);
     for (int64_t i = 0; i < stList_length(hetSites) - 1; i++) {
         int64_t j = stIntTuple_get(stList_get(hetSites, i), 0);
         int64_t k = stIntTuple_get(stList_get(hetSites, i + 1), 0);
         assert(k > j);
 
         // If not well supported by reads
-        if (!sitesLinkageIsWellSupported(hmm, j, k)) {
+        if (linkageCoverages[i] < hmm->parameters->minReadCoverageToSupportPhasingBetweenHeterozygousSites) {
             // Split hmm
             int64_t splitPoint = j + (k - j + 1) / 2;
             stRPHmm *rightHmm = stRPHmm_split(hmm, splitPoint);
@@ -1375,6 +2012,7 @@ stList *stRPHMM_splitWherePhasingIsUncertain(stRPHmm *hmm) {
     stList_append(splitHmms, hmm);
 
     // Cleanup
+    free(linkageCoverages);
     stList_destruct(hetSites);
     stList_destruct(path);
     stGenomeFragment_destruct(gF);
@@ -4,6 +4,8 @@
 
 #include <htslib/thread_pool.h>
 #include <htslib/faidx.h>
+#include <htslib/kseq.h>
+#include <pthread.h>
 #include "htsIntegration.h"
 #include "margin.h"
 #include "lp_lib.h"
@@ -178,6 +180,69 @@ int64_t saveContigChunks(stList *dest, BamChunker *parent, char *contig, int64_t
     return chunkCount;
 }
 
+static double getEstimatedChunkWork(stList *chunkDepths, int64_t bucketSize, stList *sitePositions, int64_t *siteIdx,
+                                    int64_t startPos, int64_t endPos, uint64_t siteWork) {
+    /*
+     * The estimated work of the reads over [startPos, endPos), each bucket's depth times its length plus siteWork per
+     * site within it. Walks the sorted site positions from siteIdx, so successive calls must be for increasing ranges.
+     */
+    double work = 0;
+    for (int64_t pos = startPos; pos < endPos;) {
+        int64_t bucket = pos / bucketSize;
+        int64_t bucketEnd = (bucket + 1) * bucketSize > endPos ? endPos : (bucket + 1) * bucketSize;
+        int64_t siteNo = 0;
+        while (sitePositions != NULL && *siteIdx < stList_length(sitePositions) &&
+               (int64_t) stList_get(sitePositions, *siteIdx) < bucketEnd) {
+            if ((int64_t) stList_get(sitePositions, *siteIdx) >= pos) siteNo++;
+            (*siteIdx)++;
+        }
+        int64_t depth = chunkDepths != NULL && bucket < stList_length(chunkDepths) ?
+                        (int64_t) stList_get(chunkDepths, bucket) : 0;
+        work += (double) depth * (double) (bucketEnd - pos + (int64_t) siteWork * siteNo);
+        pos = bucketEnd;
+    }
+    return work;
+}
+
+static int64_t saveContigChunksAdaptive(stList *dest, BamChunker *parent, char *contig, int64_t contigStartPos,
+                                        int64_t contigEndPos, uint64_t chunkSize, uint64_t chunkMargin,
+                                        stList *chunkDepths, stList *sitePositions, double targetWork,
+                                        uint64_t minChunkSize, uint64_t maxChunkSize, uint64_t siteWork) {
+    int64_t bucketSize = getReadDepthInfoBucketSize(chunkSize);
+    int64_t siteIdx = 0;
+    int64_t chunkCount = 0;
+    for (int64_t i = contigStartPos; i < contigEndPos;) {
+        // grow the chunk a bucket at a time until it has the target work, within the bounds on its length
+        int64_t chunkEndPos = i;
+        double work = 0;
+        while (chunkEndPos < contigEndPos && chunkEndPos - i < (int64_t) maxChunkSize &&
+               (chunkEndPos - i < (int64_t) minChunkSize || work < targetWork)) {
+            int64_t stepEndPos = (chunkEndPos / bucketSize + 1) * bucketSize;
+            if (stepEndPos > contigEndPos) stepEndPos = contigEndPos;
+            if (stepEndPos > i + (int64_t) maxChunkSize) stepEndPos = i + (int64_t) maxChunkSize;
+            work += getEstimatedChunkWork(chunkDepths, bucketSize, sitePositions, &siteIdx, chunkEndPos, stepEndPos,
+                                          siteWork);
+            chunkEndPos = stepEndPos;
+        }
+        // don't leave a chunk shorter than the minimum at the end of the contig
+        if (contigEndPos - chunkEndPos < (int64_t) minChunkSize && contigEndPos - i <= (int64_t) maxChunkSize) {
+            chunkEndPos = contigEndPos;
+        }
+        int64_t chunkMarginStartPos = i - chunkMargin;
+        chunkMarginStartPos = (chunkMarginStartPos < contigStartPos ? contigStartPos : chunkMarginStartPos);
+        int64_t chunkMarginEndPos = chunkEndPos + chunkMargin;
+        chunkMarginEndPos = (chunkMarginEndPos > contigEndPos ? contigEndPos : chunkMarginEndPos);
+
+        BamChunk *chunk = bamChunk_construct2(contig, stList_length(dest), chunkMarginStartPos, i, chunkEndPos,
+                                              chunkMarginEndPos, getEstimatedChunkDepth(chunkDepths,
+                                                      chunkMarginStartPos, chunkMarginEndPos, chunkSize), parent);
+        stList_append(dest, chunk);
+        chunkCount++;
+        i = chunkEndPos;
+    }
+    return chunkCount;
+}
+
 void storeReadDepthInformation(stList *depthList, int64_t startPos, int64_t endPos, int64_t chunkSize) {
     int64_t bucketSize = getReadDepthInfoBucketSize(chunkSize);
     startPos = startPos/bucketSize;
@@ -196,12 +261,379 @@ void storeReadDepthInformation(stList *depthList, int64_t startPos, int64_t endP
  * first and last aligned location on each contig.  Then it generates a list of chunks based off of these positions,
  * with sizes determined by the parameters.
  */
+/*
+ * Process-wide htslib thread pool, shared by the bam files for BGZF (de)compression, see getHtsThreadPool.
+ */
+static htsThreadPool sharedHtsThreadPool = {NULL, 0};
+
+htsThreadPool *getHtsThreadPool(PolishParams *params) {
+    if (params->htsThreads == 0) {
+        return NULL;
+    }
+    #pragma omp critical(htsThreadPool)
+    {
+        if (sharedHtsThreadPool.pool == NULL &&
+            (sharedHtsThreadPool.pool = hts_tpool_init((int) params->htsThreads)) == NULL) {
+            st_errAbort("ERROR: Could not create htslib thread pool of %"PRIu64" threads\n", params->htsThreads);
+        }
+    }
+    return &sharedHtsThreadPool;
+}
+
+void htsThreadPool_destruct() {
+    if (sharedHtsThreadPool.pool != NULL) {
+        hts_tpool_destroy(sharedHtsThreadPool.pool);
+        sharedHtsThreadPool.pool = NULL;
+    }
+}
+
+/*
+ * The bam index kept by bamIndex_keepIndex, which is used by every load of the index of its bam file rather than
+ * loading it again. Queries only read an index, so it is shared by the threads and never destroyed by them.
+ */
+static char *keptBamIndexFile = NULL;
+static hts_idx_t *keptBamIndex = NULL;
+
+void bamIndex_keepIndex(char *bamFile) {
+    if (keptBamIndex != NULL) {
+        hts_idx_destroy(keptBamIndex);
+        free(keptBamIndexFile);
+        keptBamIndex = NULL;
+        keptBamIndexFile = NULL;
+    }
+    // failing to keep it is left for the loads of the index to report
+    samFile *in = hts_open(bamFile, "r");
+    if (in == NULL) {
+        st_logCritical("> Cannot open bam file %s, not keeping its index\n", bamFile);
+        return;
+    }
+    // a cram index is bound to the handle it was loaded with, so only a bam index can be kept
+    if (hts_get_format(in)->format == bam) {
+        if ((keptBamIndex = sam_index_load(in, bamFile)) == 0) {
+            st_logCritical("> Cannot open index for bam file %s, not keeping it\n", bamFile);
+        } else {
+            keptBamIndexFile = stString_copy(bamFile);
+        }
+    }
+    sam_close(in);
+}
+
+static hts_idx_t *bamIndex_load(samFile *in, char *bamFile) {
+    if (keptBamIndex != NULL && stString_eq(keptBamIndexFile, bamFile)) {
+        return keptBamIndex;
+    }
+    return sam_index_load(in, bamFile);
+}
+
+static void bamIndex_destruct(hts_idx_t *idx) {
+    if (idx != keptBamIndex) {
+        hts_idx_destroy(idx);
+    }
+}
+
+static BamFileHandle *bamFileHandle_open(BamChunker *bamChunker, char *bamFile, int64_t source, bool pooled) {
+    BamFileHandle *fileHandle = st_calloc(1, sizeof(BamFileHandle));
+    fileHandle->pooled = pooled;
+    fileHandle->source = source;
+    // bam file
+    if ((fileHandle->in = hts_open(bamFile, "r")) == 0) {
+        st_errAbort("ERROR: Cannot open bam file %s\n", bamFile);
+    }
+    // decompression threads
+    htsThreadPool *threadPool = getHtsThreadPool(bamChunker->params);
+    if (threadPool != NULL) {
+        hts_set_opt(fileHandle->in, HTS_OPT_THREAD_POOL, threadPool);
+    }
+    // cram slices are decoded against the given reference rather than one resolved from the header
+    if (bamChunker->cramReferenceFile != NULL && hts_get_format(fileHandle->in)->format == cram) {
+        if (hts_set_fai_filename(fileHandle->in, bamChunker->cramReferenceFile) != 0) {
+            st_errAbort("ERROR: Cannot use reference %s for cram file %s\n", bamChunker->cramReferenceFile, bamFile);
+        }
+    }
+    // bam index
+    if ((fileHandle->idx = bamIndex_load(fileHandle->in, bamFile)) == 0) {
+        st_errAbort("ERROR: Cannot open index for bam file %s\n", bamFile);
+    }
+    // header
+    fileHandle->bamHdr = sam_hdr_read(fileHandle->in);
+    return fileHandle;
+}
+
+static BamFileHandle *bamFileHandle_construct(BamChunker *bamChunker, bool pooled) {
+    /*
+     * Opens the chunker's bam file, chaining a handle on each of its secondary bam files to it.
+     */
+    BamFileHandle *fileHandle = bamFileHandle_open(bamChunker, bamChunker->bamFile, 0, pooled);
+    BamFileHandle *last = fileHandle;
+    for (int64_t i = 1; i < bamChunker_getBamFileNo(bamChunker); i++) {
+        last->next = bamFileHandle_open(bamChunker, stList_get(bamChunker->secondaryBamFiles, i - 1), i, pooled);
+        last = last->next;
+    }
+    return fileHandle;
+}
+
+static void bamFileHandle_destruct(BamFileHandle *fileHandle) {
+    while (fileHandle != NULL) {
+        BamFileHandle *next = fileHandle->next;
+        bamIndex_destruct(fileHandle->idx);
+        bam_hdr_destroy(fileHandle->bamHdr);
+        sam_close(fileHandle->in);
+        free(fileHandle);
+        fileHandle = next;
+    }
+}
+
+static void bamChunker_constructFileHandles(BamChunker *chunker) {
+    // One slot per thread, the handles are opened as they are needed
+    # ifdef _OPENMP
+    chunker->fileHandleNo = omp_get_max_threads();
+    # else
+    chunker->fileHandleNo = 1;
+    # endif
+    chunker->fileHandles = st_calloc(chunker->fileHandleNo, sizeof(BamFileHandle *));
+}
+
+static hts_itr_t *bamChunk_getIterator(BamChunk *bamChunk, BamFileHandle *fileHandle) {
+    /*
+     * Gets an iterator over the alignments overlapping the chunk, including its overlaps. The interval is that of
+     * the 1-based region string "contig:chunkOverlapStart-chunkOverlapEnd", which is how the chunk was queried before.
+     */
+    int tid = bam_name2id(fileHandle->bamHdr, bamChunk->refSeqName);
+    hts_itr_t *iter = tid < 0 ? sam_itr_queryi(fileHandle->idx, HTS_IDX_NONE, 0, 0) :
+                      sam_itr_queryi(fileHandle->idx, tid, bamChunk->chunkOverlapStart > 0 ?
+                                     bamChunk->chunkOverlapStart - 1 : 0, bamChunk->chunkOverlapEnd);
+    if (iter == NULL) {
+        st_errAbort("ERROR: Cannot open iterator for region %s:%"PRId64"-%"PRId64" for bam file %s\n",
+                    bamChunk->refSeqName, bamChunk->chunkOverlapStart, bamChunk->chunkOverlapEnd,
+                    fileHandle->source == 0 ? bamChunk->parent->bamFile :
+                    (char *) stList_get(bamChunk->parent->secondaryBamFiles, fileHandle->source - 1));
+    }
+    return iter;
+}
+
+/*
+ * The extent and estimated depth of the alignments on a contig, from which its chunks are made.
+ */
+typedef struct _contigChunkPlan {
+    char *contig;
+    int64_t startPos; // of the first aligned base, -1 if there are no alignments
+    int64_t endPos;
+    stList *depths; // estimated depth in buckets of getReadDepthInfoBucketSize
+    stList *readNames; // the names of the reads aligned to the contig, in file order
+    stSet *readNameSet;
+} ContigChunkPlan;
+
+static ContigChunkPlan *contigChunkPlan_construct(char *contig) {
+    ContigChunkPlan *plan = st_calloc(1, sizeof(ContigChunkPlan));
+    plan->contig = stString_copy(contig);
+    plan->startPos = -1;
+    plan->endPos = -1;
+    plan->depths = stList_construct();
+    plan->readNames = stList_construct3(0, free);
+    plan->readNameSet = stSet_construct3(stHash_stringKey, stHash_stringEqualKey, NULL);
+    return plan;
+}
+
+static void contigChunkPlan_destruct(ContigChunkPlan *plan) {
+    stSet_destruct(plan->readNameSet);
+    stList_destruct(plan->readNames);
+    stList_destruct(plan->depths);
+    free(plan->contig);
+    free(plan);
+}
+
+static void contigChunkPlan_addAlignment(ContigChunkPlan *plan, bam1_t *aln, PolishParams *params,
+                                         bool recordFilteredReads, uint64_t chunkSize) {
+    // basic filtering (no read length, no cigar)
+    if (aln->core.l_qseq <= 0) return;
+    if (aln->core.n_cigar == 0) return;
+    if ((aln->core.flag & (uint16_t) 0x4) != 0)
+        return; //unaligned
+    if (!params->includeSecondaryAlignments && (aln->core.flag & (uint16_t) 0x100) != 0)
+        return; //secondary
+    if (!params->includeSupplementaryAlignments && (aln->core.flag & (uint16_t) 0x800) != 0)
+        return; //supplementary
+    if (aln->core.qual < params->filterAlignmentsWithMapQBelowThisThreshold) { //low mapping quality
+        if (!recordFilteredReads) return;
+    }
+
+    int64_t start_softclip = 0;
+    int64_t end_softclip = 0;
+    int64_t alnReadLength = getAlignedReadLength3(aln, &start_softclip, &end_softclip, FALSE);
+
+    // should never happen
+    if (alnReadLength <= 0) return;
+
+    // get start and stop position
+    int64_t readStartPos = aln->core.pos;           // Left most position of alignment
+    int64_t readEndPos = readStartPos + alnReadLength;
+    if (plan->startPos < 0) {
+        plan->startPos = readStartPos;
+        plan->endPos = readEndPos;
+    } else {
+        plan->startPos = readStartPos < plan->startPos ? readStartPos : plan->startPos;
+        plan->endPos = readEndPos > plan->endPos ? readEndPos : plan->endPos;
+    }
+    storeReadDepthInformation(plan->depths, readStartPos, readEndPos, chunkSize);
+
+    // save for the chunker's readEnumerator
+    char *readName = bam_get_qname(aln);
+    if (stSet_search(plan->readNameSet, readName) == NULL) {
+        readName = stString_copy(readName);
+        stList_append(plan->readNames, readName);
+        stSet_insert(plan->readNameSet, readName);
+    }
+}
+
+static ContigChunkPlan *contigChunkPlan_constructFromReads(BamChunker *chunker, int64_t tid, bool recordFilteredReads) {
+    /*
+     * Plans the contig from all of its alignments, got from the calling thread's handle on the bam.
+     */
+    BamFileHandle *fileHandle = bamChunker_getFileHandle(chunker);
+    ContigChunkPlan *plan = contigChunkPlan_construct(fileHandle->bamHdr->target_name[tid]);
+    hts_itr_t *iter = sam_itr_queryi(fileHandle->idx, (int) tid, 0, fileHandle->bamHdr->target_len[tid]);
+    if (iter == NULL) {
+        st_errAbort("ERROR: Cannot open iterator for contig %s for bam file %s\n", plan->contig, chunker->bamFile);
+    }
+    bam1_t *aln = bam_init1();
+    int result;
+    while ((result = sam_itr_next(fileHandle->in, iter, aln)) >= 0) {
+        chunkTelemetry_addCount(CTC_BAM_BYTES, sizeof(bam1_core_t) + aln->l_data);
+        contigChunkPlan_addAlignment(plan, aln, chunker->params, recordFilteredReads, chunker->chunkSize);
+    }
+    if (result < -1) {
+        st_errAbort("ERROR: Retrieval of contig %s failed due to truncated file or corrupt BAM index file\n",
+                    plan->contig);
+    }
+    bam_destroy1(aln);
+    hts_itr_destroy(iter);
+    bamChunker_releaseFileHandle(chunker, fileHandle);
+    return plan;
+}
+
+static ContigChunkPlan *contigChunkPlan_constructFromIndex(BamChunker *chunker, int64_t tid) {
+    /*
+     * Plans the contig without decoding its alignments. The depth of each window of the contig is estimated from the
+     * span of the compressed file the index gives for it, in bytes per kilobase, so is only comparable between chunks.
+     * The extent is that of the windows the index has any alignments for.
+     */
+    BamFileHandle *fileHandle = bamChunker_getFileHandle(chunker);
+    ContigChunkPlan *plan = contigChunkPlan_construct(fileHandle->bamHdr->target_name[tid]);
+    int64_t contigLength = fileHandle->bamHdr->target_len[tid];
+    int64_t windowSize = chunker->chunkSize == 0 ? contigLength : chunker->chunkSize;
+    int64_t bucketSize = getReadDepthInfoBucketSize(chunker->chunkSize);
+    uint64_t mapped = 0, unmapped = 0;
+    if (windowSize > 0 && (hts_idx_get_stat(fileHandle->idx, (int) tid, &mapped, &unmapped) != 0 || mapped > 0)) {
+        for (int64_t windowStart = 0; windowStart < contigLength; windowStart += windowSize) {
+            int64_t windowEnd = windowStart + windowSize > contigLength ? contigLength : windowStart + windowSize;
+            hts_itr_t *iter = sam_itr_queryi(fileHandle->idx, (int) tid, windowStart, windowEnd);
+            if (iter == NULL) {
+                st_errAbort("ERROR: Cannot open iterator for contig %s for bam file %s\n", plan->contig,
+                            chunker->bamFile);
+            }
+            int64_t bytes = 0;
+            for (int i = 0; i < iter->n_off; i++) {
+                if (iter->off[i].v <= iter->off[i].u) continue;
+                int64_t span = (int64_t) (iter->off[i].v >> 16) - (int64_t) (iter->off[i].u >> 16);
+                bytes += span > 0 ? span : 1; // within a single block
+            }
+            hts_itr_destroy(iter);
+            if (bytes == 0) continue;
+
+            if (plan->startPos < 0) plan->startPos = windowStart;
+            plan->endPos = windowEnd;
+            int64_t depth = bytes * 1000 / (windowEnd - windowStart);
+            while (stList_length(plan->depths) <= windowEnd / bucketSize) {
+                stList_append(plan->depths, (void*) 0);
+            }
+            for (int64_t pos = windowStart / bucketSize; pos < windowEnd / bucketSize; pos++) {
+                stList_set(plan->depths, pos, (void*) depth);
+            }
+        }
+    }
+    bamChunker_releaseFileHandle(chunker, fileHandle);
+    return plan;
+}
+
+static void contigChunkPlans_constructFromSummary(ContigChunkPlan **plans, bam_hdr_t *bamHdr, char *summaryFile,
+                                                  stSet *validContigs, char *regionContig, uint64_t chunkSize) {
+    /*
+     * Plans the contigs from a mosdepth style summary of depth over regions, without reading the bam. Each line of
+     * the (optionally compressed) bed file is "contig start end depth", and the extent of a contig is that of its
+     * regions with non-zero depth.
+     */
+    htsFile *fp = hts_open(summaryFile, "r");
+    if (fp == NULL) {
+        st_errAbort("ERROR: Cannot open depth summary file %s\n", summaryFile);
+    }
+    int64_t bucketSize = getReadDepthInfoBucketSize(chunkSize);
+    kstring_t line = {0, 0, NULL};
+    while (hts_getline(fp, KS_SEP_LINE, &line) >= 0) {
+        if (line.l == 0 || line.s[0] == '#') continue;
+        stList *parts = stString_splitByString(line.s, "\t");
+        if (stList_length(parts) < 4) {
+            st_errAbort("ERROR: Unexpected depth summary line in %s (expected contig, start, end and depth): %s\n",
+                        summaryFile, line.s);
+        }
+        char *contig = stList_get(parts, 0);
+        int tid = bam_name2id(bamHdr, contig);
+        int64_t regStart = atol(stList_get(parts, 1));
+        int64_t regEnd = atol(stList_get(parts, 2));
+        double depth = atof(stList_get(parts, 3));
+        if (tid < 0 || (regionContig != NULL && !stString_eq(contig, regionContig)) ||
+            (validContigs != NULL && stSet_search(validContigs, contig) == NULL) || regEnd <= regStart) {
+            stList_destruct(parts);
+            continue;
+        }
+        if (plans[tid] == NULL) {
+            plans[tid] = contigChunkPlan_construct(contig);
+        }
+        ContigChunkPlan *plan = plans[tid];
+        if (depth > 0) {
+            if (plan->startPos < 0 || regStart < plan->startPos) plan->startPos = regStart;
+            if (regEnd > plan->endPos) plan->endPos = regEnd;
+            while (stList_length(plan->depths) <= regEnd / bucketSize) {
+                stList_append(plan->depths, (void*) 0);
+            }
+            for (int64_t pos = regStart / bucketSize; pos < regEnd / bucketSize; pos++) {
+                stList_set(plan->depths, pos, (void*) (int64_t) depth);
+            }
+        }
+        stList_destruct(parts);
+    }
+    free(line.s);
+    hts_close(fp);
+}
+
 BamChunker *bamChunker_construct(char *bamFile, PolishParams *params) {
     return bamChunker_construct2(bamFile, NULL, NULL, params, false);
 }
 
 BamChunker *bamChunker_construct2(char *bamFile, char *regionStr, stSet *validContigs, PolishParams *params,
         bool recordFilteredReads) {
+    return bamChunker_construct3(bamFile, regionStr, validContigs, NULL, params, recordFilteredReads);
+}
+
+static int cmpSitePositions(const void *a, const void *b) {
+    int64_t positionA = (int64_t) a, positionB = (int64_t) b;
+    return positionA < positionB ? -1 : positionA > positionB ? 1 : 0;
+}
+
+static stList *getContigSitePositions(stHash *vcfEntries, char *contig) {
+    // the sorted positions of the contig's vcf entries, NULL if there are none
+    stList *contigVcfEntries = vcfEntries == NULL ? NULL : stHash_search(vcfEntries, contig);
+    if (contigVcfEntries == NULL) return NULL;
+    stList *sitePositions = stList_construct();
+    for (int64_t i = 0; i < stList_length(contigVcfEntries); i++) {
+        VcfEntry *vcfEntry = stList_get(contigVcfEntries, i);
+        stList_append(sitePositions, (void*) vcfEntry->refPos);
+    }
+    stList_sort(sitePositions, cmpSitePositions);
+    return sitePositions;
+}
+
+BamChunker *bamChunker_construct3(char *bamFile, char *regionStr, stSet *validContigs, stHash *vcfEntries,
+        PolishParams *params, bool recordFilteredReads) {
 
     // are we doing region filtering?
     bool filterByRegion = false;
@@ -233,6 +665,9 @@ BamChunker *bamChunker_construct2(char *bamFile, char *regionStr, stSet *validCo
     chunker->chunks = stList_construct3(0, (void *) bamChunk_destruct);
     chunker->chunkCount = 0;
     chunker->readEnumerator = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, free, NULL);
+    chunker->cramReferenceFile = NULL;
+    chunker->secondaryBamFiles = NULL;
+    bamChunker_constructFileHandles(chunker);
     int64_t readIdx = 1;
 
     // file initialization
@@ -244,7 +679,7 @@ BamChunker *bamChunker_construct2(char *bamFile, char *regionStr, stSet *validCo
         st_errAbort("ERROR: Cannot open bam file %s\n", bamFile);
     }
     // bam index
-    if ((idx = sam_index_load(in, bamFile)) == 0) {
+    if ((idx = bamIndex_load(in, bamFile)) == 0) {
         st_errAbort("ERROR: Cannot open index for bam file %s\n", bamFile);
     }
     // header
@@ -252,17 +687,20 @@ BamChunker *bamChunker_construct2(char *bamFile, char *regionStr, stSet *validCo
     // read object
     bam1_t *aln = bam_init1();
 
-    // thread stuff
+    // thread stuff, using the shared pool if there is one
     htsThreadPool threadPool = {NULL, 0};
-    # ifdef _OPENMP
-    int tc = omp_get_max_threads();
-    # else
-    int tc = 1;
-    # endif
-    if (!(threadPool.pool = hts_tpool_init(tc))) {
-        fprintf(stderr, "Error creating thread pool\n");
+    htsThreadPool *sharedThreadPool = getHtsThreadPool(params);
+    if (sharedThreadPool == NULL) {
+        # ifdef _OPENMP
+        int tc = omp_get_max_threads();
+        # else
+        int tc = 1;
+        # endif
+        if (!(threadPool.pool = hts_tpool_init(tc))) {
+            fprintf(stderr, "Error creating thread pool\n");
+        }
     }
-    hts_set_opt(in, HTS_OPT_THREAD_POOL, &threadPool);
+    hts_set_opt(in, HTS_OPT_THREAD_POOL, sharedThreadPool != NULL ? sharedThreadPool : &threadPool);
 
     // prep for index (not entirely sure what all this does.  see samtools/sam_view.c
     int filter_state = ALL, filter_op = 0;
@@ -284,96 +722,114 @@ BamChunker *bamChunker_construct2(char *bamFile, char *regionStr, stSet *validCo
         }
     }
 
-    // list of chunk boundaries
-    char *currentContig = NULL;
-    int64_t contigStartPos = 0;
-    int64_t contigEndPos = 0;
-    stList *estimatedChunkDepths = stList_construct();
-
-    // get all reads
-    // there is probably a better way (bai?) to find min and max aligned positions (which we need for chunk divisions)
-    while ((regionStr == NULL ? sam_read1(in, bamHdr, aln) : sam_itr_multi_next(in, iter, aln)) > 0) {
-
-        // basic filtering (no read length, no cigar)
-        if (aln->core.l_qseq <= 0) continue;
-        if (aln->core.n_cigar == 0) continue;
-        if ((aln->core.flag & (uint16_t) 0x4) != 0)
-            continue; //unaligned
-        if (!params->includeSecondaryAlignments && (aln->core.flag & (uint16_t) 0x100) != 0)
-            continue; //secondary
-        if (!params->includeSupplementaryAlignments && (aln->core.flag & (uint16_t) 0x800) != 0)
-            continue; //supplementary
-        if (aln->core.qual < params->filterAlignmentsWithMapQBelowThisThreshold) { //low mapping quality
-            if (!recordFilteredReads) continue;
-        }
-
-        //data
-        char *chr = bamHdr->target_name[aln->core.tid];
-        // not present in vcf (for margin phase)
-        // if we want this to be more efficient, we'd need to iterate over valid contigs and fetch from index for each
-        //   for now though, this is fast enough w/ htslib multithreading
-        if (validContigs != NULL && stSet_search(validContigs, chr) == NULL)
-            continue;
+    // each contig's extent and depth, made serially from the region or in parallel over the contigs in the header
+    int64_t contigNo = bamHdr->n_targets;
+    ContigChunkPlan **plans = st_calloc(contigNo, sizeof(ContigChunkPlan *));
+    bool planFromReads = params->chunkDepthSummaryFile == NULL && !params->estimateChunkDepthFromIndex;
+    if (!planFromReads && params->chunkDepthSummaryFile == NULL && hts_get_format(in)->format == cram) {
+        st_logCritical("> Cannot estimate chunk depth from the index of a CRAM, reading its alignments instead\n");
+        planFromReads = TRUE;
+    }
+    if (params->chunkDepthSummaryFile != NULL) {
+        contigChunkPlans_constructFromSummary(plans, bamHdr, params->chunkDepthSummaryFile, validContigs,
+                                              filterByRegion ? regionContig : NULL, chunkSize);
+    } else if (filterByRegion && planFromReads) {
+        // the region is a single contig
+        int tid = bam_name2id(bamHdr, regionContig);
+        if (tid >= 0) {
+            ContigChunkPlan *plan = contigChunkPlan_construct(regionContig);
+            while (sam_itr_multi_next(in, iter, aln) > 0) {
+                // not present in vcf (for margin phase)
+                if (validContigs != NULL && stSet_search(validContigs, bamHdr->target_name[aln->core.tid]) == NULL)
+                    continue;
+                contigChunkPlan_addAlignment(plan, aln, params, recordFilteredReads, chunkSize);
+            }
+            plans[tid] = plan;
+        }
+    } else {
+        # ifdef _OPENMP
+        #pragma omp parallel for schedule(dynamic,1)
+        # endif
+        for (int64_t tid = 0; tid < contigNo; tid++) {
+            char *contig = bamHdr->target_name[tid];
+            if (filterByRegion && !stString_eq(contig, regionContig)) continue;
+            if (validContigs != NULL && stSet_search(validContigs, contig) == NULL) continue;
+            plans[tid] = planFromReads ?
+                    contigChunkPlan_constructFromReads(chunker, tid, recordFilteredReads) :
+                    contigChunkPlan_constructFromIndex(chunker, tid);
+        }
+    }
 
-        int64_t start_softclip = 0;
-        int64_t end_softclip = 0;
-        int64_t alnReadLength = getAlignedReadLength3(aln, &start_softclip, &end_softclip, FALSE);
-
-        // should never happen
-        if (alnReadLength <= 0) continue;
-
-        // get start and stop position
-        int64_t readStartPos = aln->core.pos;           // Left most position of alignment
-        int64_t readEndPos = readStartPos + alnReadLength;
-
-        // get contig
-        char *contig = bamHdr->target_name[aln->core.tid];     // Contig name
-
-        if (currentContig == NULL) {
-            // first read
-            currentContig = stString_copy(contig);
-            contigStartPos = readStartPos;
-            contigEndPos = readEndPos;
-            storeReadDepthInformation(estimatedChunkDepths, readStartPos, readEndPos, chunkSize);
-        } else if (stString_eq(currentContig, contig)) {
-            // continue this contig's reads
-            contigStartPos = readStartPos < contigStartPos ? readStartPos : contigStartPos;
-            contigEndPos = readEndPos > contigEndPos ? readEndPos : contigEndPos;
-            storeReadDepthInformation(estimatedChunkDepths, readStartPos, readEndPos, chunkSize);
-        } else {
-            // new contig (this should never happen if we're filtering by region)
-            assert(!filterByRegion);
-            int64_t savedChunkCount = saveContigChunks(chunker->chunks, chunker, currentContig,
-                                                       contigStartPos, contigEndPos, chunkSize, chunkBoundary,
-                                                       estimatedChunkDepths);
-            chunker->chunkCount += savedChunkCount;
-            free(currentContig);
-            currentContig = stString_copy(contig);
-            contigStartPos = readStartPos;
-            contigEndPos = readEndPos;
-            stList_destruct(estimatedChunkDepths);
-            estimatedChunkDepths = stList_construct();
-        }
-        
-        // save to readEnumerator
-        char *readName = stString_copy(bam_get_qname(aln));
-        if (stHash_search(chunker->readEnumerator, readName) == NULL) {
-            stHash_insert(chunker->readEnumerator, readName, (void*) readIdx++);
-        } else {
-            free(readName);
+    // restrict the contigs to the region
+    for (int64_t tid = 0; tid < contigNo; tid++) {
+        ContigChunkPlan *plan = plans[tid];
+        if (plan != NULL && plan->startPos >= 0 && filterByRegion && regionStart != 0 && regionEnd != 0) {
+            plan->startPos = (plan->startPos < regionStart ? regionStart : plan->startPos);
+            plan->endPos = (plan->endPos > regionEnd ? regionEnd : plan->endPos);
         }
     }
-    // save last contig's chunks
-    if (currentContig != NULL) {
-        if (filterByRegion && regionStart != 0 && regionEnd != 0) {
-            contigStartPos = (contigStartPos < regionStart ? regionStart : contigStartPos);
-            contigEndPos = (contigEndPos > regionEnd ? regionEnd : contigEndPos);
+
+    // for variable length chunks, the bounds on their length and the work each should have
+    bool adaptiveChunkSize = params->adaptiveChunkSize && chunkSize > 0;
+    uint64_t minChunkSize = params->minChunkSize > 0 ? params->minChunkSize : chunkSize / 4;
+    uint64_t maxChunkSize = params->maxChunkSize > 0 ? params->maxChunkSize : chunkSize * 4;
+    if (maxChunkSize < minChunkSize) maxChunkSize = minChunkSize;
+    if (maxChunkSize == 0) maxChunkSize = 1;
+    double targetChunkWork = (double) params->targetChunkWork;
+    if (adaptiveChunkSize && targetChunkWork == 0) {
+        // the work of a chunk of chunkSize at the mean work per base
+        double totalWork = 0;
+        int64_t totalLength = 0;
+        for (int64_t tid = 0; tid < contigNo; tid++) {
+            ContigChunkPlan *plan = plans[tid];
+            if (plan == NULL || plan->startPos < 0) continue;
+            stList *sitePositions = getContigSitePositions(vcfEntries, plan->contig);
+            int64_t siteIdx = 0;
+            totalWork += getEstimatedChunkWork(plan->depths, getReadDepthInfoBucketSize(chunkSize), sitePositions,
+                                               &siteIdx, plan->startPos, plan->endPos, params->chunkSiteWork);
+            totalLength += plan->endPos - plan->startPos;
+            if (sitePositions != NULL) stList_destruct(sitePositions);
         }
-        int64_t savedChunkCount = saveContigChunks(chunker->chunks, chunker, currentContig,
-                                                   contigStartPos, contigEndPos, chunkSize, chunkBoundary,
-                                                   estimatedChunkDepths);
-        chunker->chunkCount += savedChunkCount;
-        free(currentContig);
+        targetChunkWork = totalLength > 0 ? totalWork / totalLength * chunkSize : 0;
+    }
+    if (adaptiveChunkSize) {
+        st_logInfo(" Making chunks of %"PRIu64" to %"PRIu64" bases with an estimated work of %.0f\n", minChunkSize,
+                   maxChunkSize, targetChunkWork);
+    }
+
+    // save the chunks, and enumerate the reads (if they were read), in file order
+    for (int64_t tid = 0; tid < contigNo; tid++) {
+        ContigChunkPlan *plan = plans[tid];
+        if (plan == NULL) continue;
+        if (plan->startPos >= 0) {
+            int64_t savedChunkCount;
+            if (adaptiveChunkSize) {
+                stList *sitePositions = getContigSitePositions(vcfEntries, plan->contig);
+                savedChunkCount = saveContigChunksAdaptive(chunker->chunks, chunker, plan->contig, plan->startPos,
+                                                           plan->endPos, chunkSize, chunkBoundary, plan->depths,
+                                                           sitePositions, targetChunkWork, minChunkSize,
+                                                           maxChunkSize, params->chunkSiteWork);
+                if (sitePositions != NULL) stList_destruct(sitePositions);
+            } else {
+                savedChunkCount = saveContigChunks(chunker->chunks, chunker, plan->contig,
+                                                   plan->startPos, plan->endPos, chunkSize, chunkBoundary,
+                                                   plan->depths);
+            }
+            chunker->chunkCount += savedChunkCount;
+        }
+        for (int64_t i = 0; i < stList_length(plan->readNames); i++) {
+            char *readName = stList_get(plan->readNames, i);
+            if (stHash_search(chunker->readEnumerator, readName) == NULL) {
+                stHash_insert(chunker->readEnumerator, stString_copy(readName), (void*) readIdx++);
+            }
+        }
+        contigChunkPlan_destruct(plan);
+    }
+    free(plans);
+    if (!planFromReads) {
+        // without reading the alignments the reads are not enumerated
+        stHash_destruct(chunker->readEnumerator);
+        chunker->readEnumerator = NULL;
     }
 
     // sanity check
@@ -385,12 +841,11 @@ BamChunker *bamChunker_construct2(char *bamFile, char *regionStr, stSet *validCo
         free(region[0]);
         bed_destroy(settings.bed);
     }
-    hts_idx_destroy(idx);
-    stList_destruct(estimatedChunkDepths);
+    bamIndex_destruct(idx);
     bam_hdr_destroy(bamHdr);
     bam_destroy1(aln);
     sam_close(in);
-    hts_tpool_destroy(threadPool.pool);
+    if (threadPool.pool != NULL) hts_tpool_destroy(threadPool.pool);
 
     return chunker;
 }
@@ -415,6 +870,10 @@ BamChunker *bamChunker_constructFromFasta(char *fastaFile, char *bamFile, char *
     chunker->params = params;
     chunker->chunks = stList_construct3(0, (void *) bamChunk_destruct);
     chunker->chunkCount = 0;
+    chunker->readEnumerator = NULL;
+    chunker->cramReferenceFile = NULL;
+    chunker->secondaryBamFiles = NULL;
+    bamChunker_constructFileHandles(chunker);
 
     if (regionStr != NULL) {
         // prep parsing seq
@@ -456,6 +915,104 @@ BamChunker *bamChunker_constructFromFasta(char *fastaFile, char *bamFile, char *
     return chunker;
 }
 
+BamChunker *bamChunker_constructFromBed(char *bedFile, char *fastaFile, char *bamFile, PolishParams *params) {
+    faidx_t *fai = fai_load_format(fastaFile, FAI_FASTA);
+    if ( !fai ) {
+        st_errAbort("[faidx] Could not load fai index of %s\n", fastaFile);
+    }
+
+    // standard parameters
+    uint64_t chunkSize = params->chunkSize;
+    uint64_t chunkBoundary = params->chunkBoundary;
+    bool includeSoftClip = params->includeSoftClipping;
+
+    // the chunker we're building
+    BamChunker *chunker = malloc(sizeof(BamChunker));
+    chunker->bamFile = stString_copy(bamFile);
+    chunker->chunkSize = chunkSize;
+    chunker->chunkBoundary = chunkBoundary;
+    chunker->includeSoftClip = includeSoftClip;
+    chunker->params = params;
+    chunker->chunks = stList_construct3(0, (void *) bamChunk_destruct);
+    chunker->chunkCount = 0;
+    chunker->readEnumerator = NULL;
+    chunker->cramReferenceFile = NULL;
+    chunker->secondaryBamFiles = NULL;
+    bamChunker_constructFileHandles(chunker);
+
+    // the intervals of each sequence
+    stHash *contigIntervals = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, free,
+                                                (void (*)(void *)) stList_destruct);
+    FILE *fh = safe_fopen(bedFile, "r");
+    char *line = NULL;
+    int64_t intervalCount = 0;
+    while ((line = stFile_getLineFromFile(fh)) != NULL) {
+        if (strlen(line) == 0 || line[0] == '#' || strncmp(line, "track", 5) == 0 ||
+            strncmp(line, "browser", 7) == 0) {
+            free(line);
+            continue;
+        }
+        stList *parts = stString_splitByString(line, "\t");
+        if (stList_length(parts) < 3) st_errAbort("Unexpected bed line in %s: %s\n", bedFile, line);
+        char *contig = stList_get(parts, 0);
+        int64_t start = atoll(stList_get(parts, 1));
+        int64_t end = atoll(stList_get(parts, 2));
+        if (start < 0 || end < start) st_errAbort("Invalid bed interval in %s: %s\n", bedFile, line);
+        if (faidx_has_seq(fai, contig) == 0) {
+            st_errAbort("Bed interval is on a sequence not in %s: %s\n", fastaFile, line);
+        }
+        stList *intervals = stHash_search(contigIntervals, contig);
+        if (intervals == NULL) {
+            intervals = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
+            stHash_insert(contigIntervals, stString_copy(contig), intervals);
+        }
+        stList_append(intervals, stIntTuple_construct2(start, end));
+        intervalCount++;
+        stList_destruct(parts);
+        free(line);
+    }
+    fclose(fh);
+
+    // save the flanked intervals of each sequence, merging those that overlap, in the order of the fasta
+    int64_t runCount = 0;
+    for (int64_t i = 0; i < faidx_nseq(fai); i++) {
+        char *contig = (char *) faidx_iseq(fai, i);
+        stList *intervals = stHash_search(contigIntervals, contig);
+        if (intervals == NULL) continue;
+        stList_sort(intervals, (int (*)(const void *, const void *)) stIntTuple_cmpFn);
+        int64_t contigLength = faidx_seq_len(fai, contig);
+        int64_t runStart = -1, runEnd = -1;
+        for (int64_t j = 0; j <= stList_length(intervals); j++) {
+            int64_t start = -1, end = -1;
+            if (j < stList_length(intervals)) {
+                stIntTuple *interval = stList_get(intervals, j);
+                start = stIntTuple_get(interval, 0) - (int64_t) chunkBoundary;
+                start = start < 0 ? 0 : start;
+                end = stIntTuple_get(interval, 1) + (int64_t) chunkBoundary;
+                end = end > contigLength ? contigLength : end;
+                if (runStart >= 0 && start <= runEnd) {
+                    runEnd = end > runEnd ? end : runEnd;
+                    continue;
+                }
+            }
+            if (runStart >= 0 && runStart < runEnd) {
+                chunker->chunkCount += saveContigChunks(chunker->chunks, chunker, contig, runStart, runEnd,
+                                                        chunkSize, chunkBoundary, NULL);
+                runCount++;
+            }
+            runStart = start;
+            runEnd = end;
+        }
+    }
+    assert(chunker->chunkCount == stList_length(chunker->chunks));
+    st_logInfo(" Made %"PRId64" runs of chunks from %"PRId64" intervals in %s\n", runCount, intervalCount, bedFile);
+
+    // cleanup and close
+    stHash_destruct(contigIntervals);
+    fai_destroy(fai);
+    return chunker;
+}
+
 BamChunker *bamChunker_copyConstruct(BamChunker *toCopy) {
     BamChunker *chunker = malloc(sizeof(BamChunker));
     chunker->bamFile = stString_copy(toCopy->bamFile);
@@ -465,16 +1022,64 @@ BamChunker *bamChunker_copyConstruct(BamChunker *toCopy) {
     chunker->params = toCopy->params;
     chunker->chunks = stList_construct3(0, (void *) bamChunk_destruct);
     chunker->chunkCount = 0;
+    chunker->readEnumerator = NULL;
+    chunker->cramReferenceFile = toCopy->cramReferenceFile == NULL ? NULL : stString_copy(toCopy->cramReferenceFile);
+    chunker->secondaryBamFiles = NULL; // The copy's bam file may be changed, so it reads only the one file
+    bamChunker_constructFileHandles(chunker); // Not shared, as the copy's bam file may be changed
     return chunker;
 }
 
 void bamChunker_destruct(BamChunker *bamChunker) {
+    for (int64_t i = 0; i < bamChunker->fileHandleNo; i++) {
+        if (bamChunker->fileHandles[i] != NULL) bamFileHandle_destruct(bamChunker->fileHandles[i]);
+    }
+    free(bamChunker->fileHandles);
     if (bamChunker->bamFile != NULL) free(bamChunker->bamFile);
+    if (bamChunker->cramReferenceFile != NULL) free(bamChunker->cramReferenceFile);
+    if (bamChunker->secondaryBamFiles != NULL) stList_destruct(bamChunker->secondaryBamFiles);
     if (bamChunker->readEnumerator != NULL) stHash_destruct(bamChunker->readEnumerator);
     stList_destruct(bamChunker->chunks);
     free(bamChunker);
 }
 
+void bamChunker_setCramReference(BamChunker *bamChunker, char *referenceFile) {
+    if (bamChunker->cramReferenceFile != NULL) free(bamChunker->cramReferenceFile);
+    bamChunker->cramReferenceFile = referenceFile == NULL ? NULL : stString_copy(referenceFile);
+}
+
+void bamChunker_addBamFile(BamChunker *bamChunker, char *bamFile) {
+    if (bamChunker->secondaryBamFiles == NULL) {
+        bamChunker->secondaryBamFiles = stList_construct3(0, free);
+    }
+    stList_append(bamChunker->secondaryBamFiles, stString_copy(bamFile));
+}
+
+int64_t bamChunker_getBamFileNo(BamChunker *bamChunker) {
+    return 1 + (bamChunker->secondaryBamFiles == NULL ? 0 : stList_length(bamChunker->secondaryBamFiles));
+}
+
+BamFileHandle *bamChunker_getFileHandle(BamChunker *bamChunker) {
+    int64_t threadNo = 0;
+    # ifdef _OPENMP
+    // Threads of nested regions, and those outside any parallel region such as the chunk prefetcher's, share thread
+    // numbers with those of the outermost region, so don't use the pool
+    threadNo = omp_get_level() == 1 ? omp_get_thread_num() : -1;
+    # endif
+    if (threadNo < 0 || threadNo >= bamChunker->fileHandleNo) {
+        return bamFileHandle_construct(bamChunker, FALSE);
+    }
+    if (bamChunker->fileHandles[threadNo] == NULL) {
+        bamChunker->fileHandles[threadNo] = bamFileHandle_construct(bamChunker, TRUE);
+    }
+    return bamChunker->fileHandles[threadNo];
+}
+
+void bamChunker_releaseFileHandle(BamChunker *bamChunker, BamFileHandle *fileHandle) {
+    if (!fileHandle->pooled) {
+        bamFileHandle_destruct(fileHandle);
+    }
+}
+
 BamChunk *bamChunker_getChunk(BamChunker *bamChunker, int64_t chunkIdx) {
     BamChunk *chunk = stList_get(bamChunker->chunks, chunkIdx);
     return chunk;
@@ -522,344 +1127,607 @@ int compareBamChunkDepthByIndexInList(const void *a, const void *b, const void *
     return chunk1->estimatedDepth < chunk2->estimatedDepth ? -1 : chunk1->estimatedDepth > chunk2->estimatedDepth ? 1 : 0;
 }
 
-/*
- * This generates a set of BamChunkReads (and alignments to the reference) from a BamChunk.  The BamChunk describes
- * positional information within the bam, from which the reads should be extracted.  The bam must be indexed.  Reads
- * which overlap the ends of the chunk are truncated.  A parameter in the BamChunk's parameters determines whether
- * softclipped portions of the reads should be included.
- */
-
-uint32_t convertToReadsAndAlignmentsWithFiltered(BamChunk *bamChunk, RleString *reference, stList *reads,
-        stList *alignments, stList *filteredReads, stList *filteredAlignments, PolishParams *polishParams) {
+static BamChunkRead *bamChunkRead_constructFromBam(bam1_t *aln, int64_t readStart, int64_t readEnd,
+                                                   bool useRunLengthEncoding, uint64_t *nonRleToRleCoordinateMap) {
+    /*
+     * Makes a read of the bases [readStart, readEnd) of the alignment, run-length encoding them (if configured)
+     * directly from the bam record's 4-bit sequence along with their mean qualities, and so without first expanding
+     * the sequence to a string. If nonRleToRleCoordinateMap is not NULL it must have space for readEnd - readStart
+     * entries, and is filled with the rle coordinate of each base.
+     */
+    int64_t nonRleLength = readEnd - readStart;
+    uint8_t *seqBits = bam_get_seq(aln);
+    uint8_t *qualBits = bam_get_qual(aln);
+    bool hasQualities = qualBits[0] != 0xff; //inital score of 255 means qual scores are unavailable
+
+    BamChunkRead *r = st_calloc(1, sizeof(BamChunkRead));
+    r->readName = stString_copy(bam_get_qname(aln));
+    r->forwardStrand = !bam_is_rev(aln);
+    r->fullReadLength = aln->l_data;
+    r->bamChunkReadVcfEntrySubstrings = NULL;
+
+    // sized for the unencoded read, shrunk once the run lengths are known
+    RleString *rleRead = st_calloc(1, sizeof(RleString));
+    rleRead->nonRleLength = nonRleLength;
+    rleRead->rleString = st_malloc(sizeof(char) * (nonRleLength + 1));
+    rleRead->length = nonRleLength;
+    rleRead->repeatCounts = useRunLengthEncoding ? st_calloc(nonRleLength, sizeof(uint8_t)) : NULL;
+    r->qualities = hasQualities ? st_malloc(sizeof(uint8_t) * nonRleLength) : NULL;
+
+    uint64_t j = 0;
+    uint64_t runLength = 0;
+    int64_t qualitySum = 0;
+    for (int64_t i = readStart; i < readEnd; i++) {
+        uint8_t base = bam_seqi(seqBits, i);
+        if (nonRleToRleCoordinateMap != NULL) {
+            nonRleToRleCoordinateMap[i - readStart] = j;
+        }
+        runLength++;
+        if (hasQualities) {
+            qualitySum += qualBits[i];
+        }
+        // end of a run, encoded as in rleString_construct and rleString_rleQualities
+        if (!useRunLengthEncoding || i + 1 == readEnd || base != bam_seqi(seqBits, i + 1)) {
+            rleRead->rleString[j] = seq_nt16_str[base];
+            rleString_setRepeatCount(rleRead, j, runLength);
+            if (hasQualities) {
+                r->qualities[j] = (uint8_t) (qualitySum / runLength);
+            }
+            j++;
+            runLength = 0;
+            qualitySum = 0;
+        }
+    }
+    rleRead->rleString[j] = '\0';
+    rleRead->length = j;
+
+    // shrink to the encoded length
+    if (j < nonRleLength) {
+        rleRead->rleString = st_realloc(rleRead->rleString, sizeof(char) * (j + 1));
+        if (rleRead->repeatCounts != NULL) {
+            rleRead->repeatCounts = st_realloc(rleRead->repeatCounts, sizeof(uint8_t) * j);
+        }
+        if (hasQualities) {
+            r->qualities = st_realloc(r->qualities, sizeof(uint8_t) * j);
+        }
+    }
+    r->rleRead = rleRead;
 
-    // sanity check
-    assert(stList_length(reads) == 0);
-    assert(stList_length(alignments) == 0);
+    return r;
+}
 
-    uint64_t *ref_nonRleToRleCoordinateMap =
-            reference == NULL ? NULL : rleString_getNonRleToRleCoordinateMap(reference);
+typedef struct _bamChunkAlignmentLocation {
+    bool filtered; // the mapping quality is below the threshold
+    int64_t readStartIdxInChunk; // the bases [readStartIdxInChunk, readEndIdxInChunk) of the read are in the chunk
+    int64_t readEndIdxInChunk;
+    int64_t firstAlignedRefPos; // of the first and last aligned reference bases, relative to the chunk overlap start
+    int64_t lastAlignedRefPos;
+} BamChunkAlignmentLocation;
 
-    // prep
+static bool bamChunk_locateAlignment(BamChunk *bamChunk, bam1_t *aln, bam_hdr_t *bamHdr, bool keepFiltered,
+                                     PackedAlignment *cigRepr, BamChunkAlignmentLocation *location,
+                                     PolishParams *polishParams) {
+    /*
+     * Finds the part of the read in the chunk from the alignment's flags and cigar, without decoding its sequence.
+     * If cigRepr is not NULL the aligned pairs in the chunk are added to it, as a run per match operation. Returns TRUE
+     * if the alignment belongs in the chunk (alignments with a low mapping quality belong only if keepFiltered is set).
+     */
     int64_t chunkStart = bamChunk->chunkOverlapStart;
     int64_t chunkEnd = bamChunk->chunkOverlapEnd;
     bool includeSoftClip = bamChunk->parent->params->includeSoftClipping;
-    char *bamFile = bamChunk->parent->bamFile;
     char *contig = bamChunk->refSeqName;
-    uint32_t savedAlignments = 0;
-    double randomDiscardChance = 1.0;
-    //removing reads in filtering step is working, so taking this out for now
-    //  (also removing the check in the loop below)
-    /*if (bamChunk->estimatedDepth > polishParams->excessiveDepthThreshold) {
-        char *logIdentifier = getLogIdentifier();
-        randomDiscardChance = 1.0 * polishParams->excessiveDepthThreshold / bamChunk->estimatedDepth;
-        st_logInfo(" %s Randomly removing reads from excessively deep (%"PRId64"/%"PRId64") chunk with chance %f\n",
-                logIdentifier, bamChunk->estimatedDepth, polishParams->excessiveDepthThreshold, 1.0 - randomDiscardChance);
-    }*/
 
-    // prep for index (not entirely sure what all this does.  see samtools/sam_view.c
-    int filter_state = ALL, filter_op = 0;
-    int result;
-    samview_settings_t settings = {.bed = NULL};
-    char *region[1] = {};
-    region[0] = stString_print("%s:%d-%d", bamChunk->refSeqName, bamChunk->chunkOverlapStart,
-                               bamChunk->chunkOverlapEnd);
-    settings.bed = bed_hash_regions(settings.bed, region, 0, 1,
-                                    &filter_op); //insert(1) or filter out(0) the regions from the command line in the same hash table as the bed file
-    if (!filter_op) filter_state = FILTERED;
-    int regcount = 0;
-    hts_reglist_t *reglist = bed_reglist(settings.bed, filter_state, &regcount);
-    if (!reglist) {
-        st_errAbort("ERROR: Could not create list of regions for read conversion");
+    bool filtered = FALSE;
+    // basic filtering (no read length, no cigar)
+    if (aln->core.l_qseq <= 0) return FALSE;
+    if (aln->core.n_cigar == 0) return FALSE;
+    if ((aln->core.flag & (uint16_t) 0x4) != 0)
+        return FALSE; //unaligned
+    if (!polishParams->includeSecondaryAlignments && (aln->core.flag & (uint16_t) 0x100) != 0)
+        return FALSE; //secondary
+    if (!polishParams->includeSupplementaryAlignments && (aln->core.flag & (uint16_t) 0x800) != 0)
+        return FALSE; //supplementary
+    // see above, taking this out as removal in filtering step is working
+    /*if (st_random() > randomDiscardChance)
+        return FALSE; // chunk is too deep*/
+    if (aln->core.qual < polishParams->filterAlignmentsWithMapQBelowThisThreshold) { //low mapping quality
+        if (!keepFiltered) return FALSE;
+        filtered = TRUE;
     }
 
-    // file initialization
-    samFile *in = NULL;
-    hts_idx_t *idx = NULL;
-    hts_itr_multi_t *iter = NULL;
-    // bam file
-    if ((in = hts_open(bamFile, "r")) == 0) {
-        st_errAbort("ERROR: Cannot open bam file %s\n", bamFile);
-    }
-    // bam index
-    if ((idx = sam_index_load(in, bamFile)) == 0) {
-        st_errAbort("ERROR: Cannot open index for bam file %s\n", bamFile);
-    }
-    // header  //todo samFile *in = hts_open(bamFile, "r");
-    bam_hdr_t *bamHdr = sam_hdr_read(in);
-    // read object
-    bam1_t *aln = bam_init1();
-    // iterator for region
-    if ((iter = sam_itr_regions(idx, bamHdr, reglist, regcount)) == 0) {
-        st_errAbort("ERROR: Cannot open iterator for region %s for bam file %s\n", region[0], bamFile);
-    }
-
-    // fetch alignments //todo while(sam_read1(in,bamHdr,aln) > 0) {
-    while ((result = sam_itr_multi_next(in, iter, aln)) >= 0) {
-        bool filtered = FALSE;
-        // basic filtering (no read length, no cigar)
-        if (aln->core.l_qseq <= 0) continue;
-        if (aln->core.n_cigar == 0) continue;
-        if ((aln->core.flag & (uint16_t) 0x4) != 0)
-            continue; //unaligned
-        if (!polishParams->includeSecondaryAlignments && (aln->core.flag & (uint16_t) 0x100) != 0)
-            continue; //secondary
-        if (!polishParams->includeSupplementaryAlignments && (aln->core.flag & (uint16_t) 0x800) != 0)
-            continue; //supplementary
-        // see above, taking this out as removal in filtering step is working
-        /*if (st_random() > randomDiscardChance)
-            continue; // chunk is too deep*/
-        if (aln->core.qual < polishParams->filterAlignmentsWithMapQBelowThisThreshold) { //low mapping quality
-            if (filteredReads == NULL) continue;
-            filtered = TRUE;
-        }
-
-        //data
-        char *chr = bamHdr->target_name[aln->core.tid];
-        int64_t start_softclip = 0;
-        int64_t end_softclip = 0;
-        int64_t alnReadLength = getAlignedReadLength3(aln, &start_softclip, &end_softclip, FALSE);
-        if (alnReadLength <= 0) continue;
-        int64_t alnStartPos = aln->core.pos;
-        int64_t alnEndPos = alnStartPos + alnReadLength;
-
-        // does this belong in our chunk?
-        if (!stString_eq(contig, chr)) continue;
-        if (alnStartPos >= chunkEnd) continue;
-        if (alnEndPos <= chunkStart) continue;
-
-        // get cigar and rep
-        uint32_t *cigar = bam_get_cigar(aln);
-        stList *cigRepr = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
-
-        // Variables to keep track of position in sequence / cigar operations
-        int64_t cig_idx = 0;
-        int64_t currPosInOp = 0;
-        int64_t cigarOp = -1;
-        int64_t cigarNum = -1;
-        int64_t cigarIdxInSeq = 0;
-        int64_t cigarIdxInRef = alnStartPos;
-
-        // positional modifications
-        int64_t refCigarModification = -1 * chunkStart;
-
-        // we need to calculate:
-        //  a. where in the (potentially softclipped read) to start storing characters
-        //  b. what the alignments are wrt those characters
-        // so we track the first aligned character in the read (for a.) and what alignment modification to make (for b.)
-        int64_t seqCigarModification;
-        int64_t firstNonSoftclipAlignedReadIdxInChunk;
-
-        // the handling changes based on softclip inclusion and where the chunk boundaries are
-        if (includeSoftClip) {
-            if (alnStartPos < chunkStart) {
-                // alignment spans chunkStart (this will not be affected by softclipping)
-                firstNonSoftclipAlignedReadIdxInChunk = -1; //need to find position of first alignment
-                seqCigarModification = 0;
-            } else if (alnStartPos - start_softclip <= chunkStart) {
-                // softclipped bases span chunkStart
-                firstNonSoftclipAlignedReadIdxInChunk = 0;
-                int64_t includedSoftclippedBases = alnStartPos - chunkStart;
-                seqCigarModification = includedSoftclippedBases;
-                assert(includedSoftclippedBases >= 0);
-                assert(start_softclip - includedSoftclippedBases >= 0);
-            } else {
-                // softclipped bases are after chunkStart
-                firstNonSoftclipAlignedReadIdxInChunk = 0;
-                seqCigarModification = start_softclip;
-            }
+    //data
+    char *chr = bamHdr->target_name[aln->core.tid];
+    int64_t start_softclip = 0;
+    int64_t end_softclip = 0;
+    int64_t alnReadLength = getAlignedReadLength3(aln, &start_softclip, &end_softclip, FALSE);
+    if (alnReadLength <= 0) return FALSE;
+    int64_t alnStartPos = aln->core.pos;
+    int64_t alnEndPos = alnStartPos + alnReadLength;
+
+    // does this belong in our chunk?
+    if (!stString_eq(contig, chr)) return FALSE;
+    if (alnStartPos >= chunkEnd) return FALSE;
+    if (alnEndPos <= chunkStart) return FALSE;
+
+    // get cigar
+    uint32_t *cigar = bam_get_cigar(aln);
+    int64_t alignedPairsInChunk = 0;
+    int64_t firstAlignedRefPos = -1;
+    int64_t lastAlignedRefPos = -1;
+
+    // Variables to keep track of position in sequence / cigar operations
+    int64_t cig_idx = 0;
+    int64_t currPosInOp = 0;
+    int64_t cigarOp = -1;
+    int64_t cigarNum = -1;
+    int64_t cigarIdxInSeq = 0;
+    int64_t cigarIdxInRef = alnStartPos;
+
+    // positional modifications
+    int64_t refCigarModification = -1 * chunkStart;
+
+    // we need to calculate:
+    //  a. where in the (potentially softclipped read) to start storing characters
+    //  b. what the alignments are wrt those characters
+    // so we track the first aligned character in the read (for a.) and what alignment modification to make (for b.)
+    int64_t seqCigarModification;
+    int64_t firstNonSoftclipAlignedReadIdxInChunk;
+
+    // the handling changes based on softclip inclusion and where the chunk boundaries are
+    if (includeSoftClip) {
+        if (alnStartPos < chunkStart) {
+            // alignment spans chunkStart (this will not be affected by softclipping)
+            firstNonSoftclipAlignedReadIdxInChunk = -1; //need to find position of first alignment
+            seqCigarModification = 0;
+        } else if (alnStartPos - start_softclip <= chunkStart) {
+            // softclipped bases span chunkStart
+            firstNonSoftclipAlignedReadIdxInChunk = 0;
+            int64_t includedSoftclippedBases = alnStartPos - chunkStart;
+            seqCigarModification = includedSoftclippedBases;
+            assert(includedSoftclippedBases >= 0);
+            assert(start_softclip - includedSoftclippedBases >= 0);
         } else {
-            if (alnStartPos < chunkStart) {
-                // alignment spans chunkStart
-                firstNonSoftclipAlignedReadIdxInChunk = -1;
-                seqCigarModification = 0;
-            } else {
-                // alignment starts after chunkStart
-                firstNonSoftclipAlignedReadIdxInChunk = 0;
-                seqCigarModification = 0;
-            }
+            // softclipped bases are after chunkStart
+            firstNonSoftclipAlignedReadIdxInChunk = 0;
+            seqCigarModification = start_softclip;
+        }
+    } else {
+        if (alnStartPos < chunkStart) {
+            // alignment spans chunkStart
+            firstNonSoftclipAlignedReadIdxInChunk = -1;
+            seqCigarModification = 0;
+        } else {
+            // alignment starts after chunkStart
+            firstNonSoftclipAlignedReadIdxInChunk = 0;
+            seqCigarModification = 0;
         }
+    }
 
-        // track number of characters in aligned portion (will inform softclipping at end of read)
-        int64_t alignedReadLength = 0;
+    // track number of characters in aligned portion (will inform softclipping at end of read)
+    int64_t alignedReadLength = 0;
+
+    // skip the cigar operations ending before the chunk a whole operation at a time, as for reads spanning many
+    // chunks most of the cigar is outside any one of them
+    while (cig_idx < aln->core.n_cigar) {
+        cigarOp = cigar[cig_idx] & BAM_CIGAR_MASK;
+        cigarNum = cigar[cig_idx] >> BAM_CIGAR_SHIFT;
+        int64_t opRefLength = bam_cigar_type(cigarOp) & 2 ? cigarNum : 0;
+        if (cigarIdxInRef + opRefLength >= chunkStart) {
+            break;
+        }
+        if (bam_cigar_type(cigarOp) & 1 && cigarOp != BAM_CSOFT_CLIP) {
+            cigarIdxInSeq += cigarNum;
+        }
+        cigarIdxInRef += opRefLength;
+        cig_idx++;
+    }
 
-        // iterate over cigar operations
-        for (uint32_t i = 0; i <= alnReadLength; i++) {
-            // handles cases where last alignment is an insert or last is match
-            if (cig_idx == aln->core.n_cigar) break;
+    // iterate over cigar operations
+    for (uint32_t i = 0; i <= alnReadLength; i++) {
+        // handles cases where last alignment is an insert or last is match
+        if (cig_idx == aln->core.n_cigar) break;
 
-            // do we need the next cigar operation?
-            if (currPosInOp == 0) {
-                cigarOp = cigar[cig_idx] & BAM_CIGAR_MASK;
-                cigarNum = cigar[cig_idx] >> BAM_CIGAR_SHIFT;
-            }
+        // do we need the next cigar operation?
+        if (currPosInOp == 0) {
+            cigarOp = cigar[cig_idx] & BAM_CIGAR_MASK;
+            cigarNum = cigar[cig_idx] >> BAM_CIGAR_SHIFT;
+        }
 
-            // handle current character
-            if (cigarOp == BAM_CMATCH || cigarOp == BAM_CEQUAL || cigarOp == BAM_CDIFF) {
-                if (cigarIdxInRef >= chunkStart && cigarIdxInRef < chunkEnd) {
-                    stList_append(cigRepr, stIntTuple_construct3(cigarIdxInRef + refCigarModification,
-                                                                 cigarIdxInSeq + seqCigarModification,
-                                                                 polishParams->p->diagonalExpansion));
+        // handle current character
+        if (cigarOp == BAM_CMATCH || cigarOp == BAM_CEQUAL || cigarOp == BAM_CDIFF) {
+            if (cigarIdxInRef >= chunkStart && cigarIdxInRef < chunkEnd) {
+                if (cigRepr != NULL) {
+                    packedAlignment_addPair(cigRepr, cigarIdxInRef + refCigarModification,
+                                            cigarIdxInSeq + seqCigarModification);
+                }
+                if (firstAlignedRefPos < 0) firstAlignedRefPos = cigarIdxInRef + refCigarModification;
+                lastAlignedRefPos = cigarIdxInRef + refCigarModification;
+                alignedPairsInChunk++;
 //                                                                 polishParams != NULL && polishParams->p != NULL ?
 //                                                                 polishParams->p->diagonalExpansion : 10)); //TODO: Tidy up so polish params is not optional
-                    alignedReadLength++;
-                }
-                cigarIdxInSeq++;
-                cigarIdxInRef++;
-            } else if (cigarOp == BAM_CDEL || cigarOp == BAM_CREF_SKIP) {
-                //delete
-                cigarIdxInRef++;
-            } else if (cigarOp == BAM_CINS) {
-                //insert
-                cigarIdxInSeq++;
-                if (cigarIdxInRef >= chunkStart && cigarIdxInRef < chunkEnd) {
-                    alignedReadLength++;
-                }
-                i--;
-            } else if (cigarOp == BAM_CSOFT_CLIP || cigarOp == BAM_CHARD_CLIP || cigarOp == BAM_CPAD) {
-                // nothing to do here. skip to next cigar operation
-                currPosInOp = cigarNum - 1;
-                i--;
-            } else {
-                st_logCritical("Unidentifiable cigar operation!\n");
+                alignedReadLength++;
+            }
+            cigarIdxInSeq++;
+            cigarIdxInRef++;
+        } else if (cigarOp == BAM_CDEL || cigarOp == BAM_CREF_SKIP) {
+            //delete
+            cigarIdxInRef++;
+        } else if (cigarOp == BAM_CINS) {
+            //insert
+            cigarIdxInSeq++;
+            if (cigarIdxInRef >= chunkStart && cigarIdxInRef < chunkEnd) {
+                alignedReadLength++;
             }
+            i--;
+        } else if (cigarOp == BAM_CSOFT_CLIP || cigarOp == BAM_CHARD_CLIP || cigarOp == BAM_CPAD) {
+            // nothing to do here. skip to next cigar operation
+            currPosInOp = cigarNum - 1;
+            i--;
+        } else {
+            st_logCritical("Unidentifiable cigar operation!\n");
+        }
 
-            // document read index in the chunk (for reads that span chunk boundary, used in read construction)
-            if (firstNonSoftclipAlignedReadIdxInChunk < 0 && cigarIdxInRef >= chunkStart) {
-                firstNonSoftclipAlignedReadIdxInChunk = cigarIdxInSeq;
-                seqCigarModification = -1 * (firstNonSoftclipAlignedReadIdxInChunk + seqCigarModification);
+        // document read index in the chunk (for reads that span chunk boundary, used in read construction)
+        if (firstNonSoftclipAlignedReadIdxInChunk < 0 && cigarIdxInRef >= chunkStart) {
+            firstNonSoftclipAlignedReadIdxInChunk = cigarIdxInSeq;
+            seqCigarModification = -1 * (firstNonSoftclipAlignedReadIdxInChunk + seqCigarModification);
 
-            }
+        }
 
-            // have we finished this last cigar
-            currPosInOp++;
-            if (currPosInOp == cigarNum) {
-                cig_idx++;
-                currPosInOp = 0;
-            }
+        // have we finished this last cigar
+        currPosInOp++;
+        if (currPosInOp == cigarNum) {
+            cig_idx++;
+            currPosInOp = 0;
         }
 
-        // get sequence positions
-        int64_t seqLen = alignedReadLength;
+        // the rest of the alignment is after the chunk
+        if (cigarIdxInRef >= chunkEnd) break;
+    }
 
-        // modify start indices
-        int64_t readStartIdxInChunk = firstNonSoftclipAlignedReadIdxInChunk;
-        if (firstNonSoftclipAlignedReadIdxInChunk != 0) {
-            // the aligned portion spans chunkStart, so no softclipped bases are included
-            readStartIdxInChunk += start_softclip;
-        } else if (!includeSoftClip) {
-            // configured to not handle softclipped bases
-            readStartIdxInChunk += start_softclip;
-        } else if (alnStartPos - start_softclip <= chunkStart) {
-            // configured to handle softclipped bases; softclipped bases span chunkStart
-            int64_t includedSoftclippedBases = alnStartPos - chunkStart;
-            seqLen += includedSoftclippedBases;
-            readStartIdxInChunk += (start_softclip - includedSoftclippedBases);
+    // get sequence positions
+    int64_t seqLen = alignedReadLength;
+
+    // modify start indices
+    int64_t readStartIdxInChunk = firstNonSoftclipAlignedReadIdxInChunk;
+    if (firstNonSoftclipAlignedReadIdxInChunk != 0) {
+        // the aligned portion spans chunkStart, so no softclipped bases are included
+        readStartIdxInChunk += start_softclip;
+    } else if (!includeSoftClip) {
+        // configured to not handle softclipped bases
+        readStartIdxInChunk += start_softclip;
+    } else if (alnStartPos - start_softclip <= chunkStart) {
+        // configured to handle softclipped bases; softclipped bases span chunkStart
+        int64_t includedSoftclippedBases = alnStartPos - chunkStart;
+        seqLen += includedSoftclippedBases;
+        readStartIdxInChunk += (start_softclip - includedSoftclippedBases);
+    } else {
+        // configured to handle softclipped bases; softclipped bases all occur after chunkStart
+        seqLen += start_softclip;
+        readStartIdxInChunk = 0;
+    }
+
+    // modify end indices
+    int64_t readEndIdxInChunk = readStartIdxInChunk + seqLen;
+    if (alnEndPos < chunkEnd && includeSoftClip) {
+        // all other cases mean we don't need to handle softclip (by config or aln extends past chunk end)
+        if (alnEndPos + end_softclip <= chunkEnd) {
+            // all softclipped bases fit in chunk
+            readEndIdxInChunk += end_softclip;
+            seqLen += end_softclip;
         } else {
-            // configured to handle softclipped bases; softclipped bases all occur after chunkStart
-            seqLen += start_softclip;
-            readStartIdxInChunk = 0;
-        }
-
-        // modify end indices
-        int64_t readEndIdxInChunk = readStartIdxInChunk + seqLen;
-        if (alnEndPos < chunkEnd && includeSoftClip) {
-            // all other cases mean we don't need to handle softclip (by config or aln extends past chunk end)
-            if (alnEndPos + end_softclip <= chunkEnd) {
-                // all softclipped bases fit in chunk
-                readEndIdxInChunk += end_softclip;
-                seqLen += end_softclip;
-            } else {
-                // softclipping spands chunkEnd
-                int64_t includedSoftclippedBases = chunkEnd - alnEndPos;
-                seqLen += includedSoftclippedBases;
-                readEndIdxInChunk += includedSoftclippedBases;
-            }
+            // softclipping spands chunkEnd
+            int64_t includedSoftclippedBases = chunkEnd - alnEndPos;
+            seqLen += includedSoftclippedBases;
+            readEndIdxInChunk += includedSoftclippedBases;
         }
+    }
 
-        // get sequence - all data we need is encoded in readStartIdxInChunk (start), readEnd idx, and seqLen
-        char *seq = st_calloc(seqLen + 1, sizeof(char));
-        uint8_t *seqBits = bam_get_seq(aln);
-        int64_t idxInOutputSeq = 0;
-        int64_t idxInBamRead = readStartIdxInChunk;
-        while (idxInBamRead < readEndIdxInChunk) {
-            seq[idxInOutputSeq] = seq_nt16_str[bam_seqi(seqBits, idxInBamRead)];
-            idxInBamRead++;
-            idxInOutputSeq++;
-        }
-        seq[seqLen] = '\0';
-
-        // get sequence qualities (if exists)
-        char *readName = stString_copy(bam_get_qname(aln));
-        uint8_t *qualBits = bam_get_qual(aln);
-        uint8_t *qual = NULL;
-        if (qualBits[0] != 0xff) { //inital score of 255 means qual scores are unavailable
-            idxInOutputSeq = 0;
-            idxInBamRead = readStartIdxInChunk;
-            qual = st_calloc(seqLen, sizeof(uint8_t));
-            while (idxInBamRead < readEndIdxInChunk) {
-                qual[idxInOutputSeq] = qualBits[idxInBamRead];
-                idxInBamRead++;
-                idxInOutputSeq++;
+    // failure case
+    if (alignedPairsInChunk == 0 || seqLen <= 0) {
+        return FALSE;
+    }
 
-            }
-            assert(idxInOutputSeq == strlen(seq));
-        };
-
-        // failure case
-        if (stList_length(cigRepr) == 0 || strlen(seq) == 0) {
-            stList_destruct(cigRepr);
-            free(readName);
-            free(seq);
-            if (qual != NULL) free(qual);
-            continue;
+    // sanity check
+    assert(cigRepr == NULL ||
+           cigRepr->runs[cigRepr->runNo - 1].y + cigRepr->runs[cigRepr->runNo - 1].length <= seqLen);
+
+    location->filtered = filtered;
+    location->readStartIdxInChunk = readStartIdxInChunk;
+    location->readEndIdxInChunk = readEndIdxInChunk;
+    location->firstAlignedRefPos = firstAlignedRefPos;
+    location->lastAlignedRefPos = lastAlignedRefPos;
+    return TRUE;
+}
+
+static bool bamChunk_convertAlignment(BamChunk *bamChunk, bam1_t *aln, bam_hdr_t *bamHdr, int64_t source,
+                                      uint64_t *ref_nonRleToRleCoordinateMap, stList *reads, stList *alignments,
+                                      stList *filteredReads, stList *filteredAlignments, PolishParams *polishParams) {
+    /*
+     * Converts the alignment to a read and an alignment to the chunk's reference, appending them to reads and
+     * alignments (or filteredReads and filteredAlignments if its mapping quality is too low). Returns TRUE if the
+     * alignment belongs in the chunk and so was saved. The read is tagged with source, the index of the bam file the
+     * alignment was read from.
+     */
+    // get cigar and rep, as runs of aligned pairs until the alignment is saved
+    PackedAlignment *cigRepr = packedAlignment_construct();
+    BamChunkAlignmentLocation location;
+    if (!bamChunk_locateAlignment(bamChunk, aln, bamHdr, filteredReads != NULL, cigRepr, &location, polishParams)) {
+        packedAlignment_destruct(cigRepr);
+        return FALSE;
+    }
+    bool filtered = location.filtered;
+    int64_t seqLen = location.readEndIdxInChunk - location.readStartIdxInChunk;
+
+    // save to read, decoding the sequence straight from the bam record
+    // (ref_nonRleToRleCoordinateMap should only be null w/ RLE in tests)
+    bool rleAlignment = polishParams->useRunLengthEncoding && ref_nonRleToRleCoordinateMap != NULL;
+    uint64_t *read_nonRleToRleCoordinateMap = rleAlignment ? st_malloc(sizeof(uint64_t) * seqLen) : NULL;
+    BamChunkRead *chunkRead = bamChunkRead_constructFromBam(aln, location.readStartIdxInChunk,
+                                                            location.readEndIdxInChunk,
+                                                            polishParams->useRunLengthEncoding,
+                                                            read_nonRleToRleCoordinateMap);
+    chunkRead->source = source;
+    stList_append(filtered ? filteredReads: reads, chunkRead);
+
+    // save alignment, expanding its runs only once they are in the final (possibly run length encoded) coordinates
+    int64_t weight = polishParams->p->diagonalExpansion;
+    if (polishParams->useRunLengthEncoding) {
+        if (rleAlignment) {
+            // rle the alignment and save it
+            PackedAlignment *rleCigRepr = packedAlignment_runLengthEncode(cigRepr, ref_nonRleToRleCoordinateMap,
+                                                                          read_nonRleToRleCoordinateMap);
+            stList_append(filtered ? filteredAlignments : alignments,
+                          packedAlignment_getAlignedPairs(rleCigRepr, weight));
+            packedAlignment_destruct(rleCigRepr);
+            free(read_nonRleToRleCoordinateMap);
         }
+    } else {
+        stList_append(filtered ? filteredAlignments : alignments, packedAlignment_getAlignedPairs(cigRepr, weight));
+    }
+    packedAlignment_destruct(cigRepr);
 
-        // sanity check
-        assert(stIntTuple_get((stIntTuple *) stList_peek(cigRepr), 1) < strlen(seq));
-
-        // save to read
-        bool forwardStrand = !bam_is_rev(aln);
-        BamChunkRead *chunkRead = bamChunkRead_construct3(readName, seq, qual, forwardStrand, aln->l_data,
-                                                          polishParams->useRunLengthEncoding);
-        stList_append(filtered ? filteredReads: reads, chunkRead);
-
-        // save alignment
-        if (polishParams->useRunLengthEncoding) {
-            // ref_nonRleToRleCoordinateMap should only be null w/ RLE in tests
-            if (ref_nonRleToRleCoordinateMap != NULL) {
-                // rle the alignment and save it
-                uint64_t *read_nonRleToRleCoordinateMap = rleString_getNonRleToRleCoordinateMap(chunkRead->rleRead);
-                stList_append(filtered ? filteredAlignments : alignments,
-                        runLengthEncodeAlignment(cigRepr, ref_nonRleToRleCoordinateMap, read_nonRleToRleCoordinateMap));
-                stList_destruct(cigRepr);
-                free(read_nonRleToRleCoordinateMap);
-            }
-        } else {
-            stList_append(filtered ? filteredAlignments : alignments, cigRepr);
+    return TRUE;
+}
+
+static int64_t bamChunk_getReadLengthInChunk(bam1_t *aln, BamChunkAlignmentLocation *location, bool useRunLengthEncoding) {
+    // the length the read will have once decoded, counting the runs of the 4-bit sequence if run-length encoding
+    if (!useRunLengthEncoding) {
+        return location->readEndIdxInChunk - location->readStartIdxInChunk;
+    }
+    uint8_t *seqBits = bam_get_seq(aln);
+    int64_t runs = 0;
+    for (int64_t i = location->readStartIdxInChunk; i < location->readEndIdxInChunk; i++) {
+        if (i + 1 == location->readEndIdxInChunk || bam_seqi(seqBits, i) != bam_seqi(seqBits, i + 1)) {
+            runs++;
         }
-        savedAlignments++;
+    }
+    return runs;
+}
 
-        // cleanup
-        free(readName);
-        free(seq);
-        if (qual != NULL) free(qual);
+/*
+ * A bounded intake of a chunk's alignments, keeping the (still encoded) alignments of the highest priority until the
+ * total length of their reads in the chunk reaches excessiveDepthThreshold times the chunk's length, so that the memory
+ * taken by a chunk's reads does not grow with its depth. The primary and the filtered reads are kept separately. The
+ * priority of a read is that downsampling would give it: its draw if sampled uniformly, or its full length per base in
+ * the chunk if longer reads are preferred (as they are of the filtered reads), so the reads kept by downsampling to a
+ * depth below the threshold are among those the reservoir keeps.
+ */
+typedef struct _readReservoirEntry {
+    bam1_t *aln;
+    bam_hdr_t *bamHdr;
+    int64_t source; // the index of the bam file the alignment was read from
+    int64_t order; // the index of the alignment among those offered, so the kept ones are converted in bam order
+    int64_t length; // the length of the read in the chunk
+    double priority; // the reads of the lowest priority are discarded first
+    double draw; // of the read from downsampling_getReadDraw, the read with the lower draw kept at equal priority
+} ReadReservoirEntry;
+
+typedef struct _readReservoir {
+    BamChunk *bamChunk;
+    bool byFullReadLength; // the priority of the primary reads
+    int64_t budget; // the total length of the primary, or filtered, reads kept, or 0 to keep all of them
+    stSortedSet *entries[2]; // of the primary and of the filtered reads, by priority, lowest first
+    int64_t totalLengths[2];
+    int64_t offeredNos[2];
+} ReadReservoir;
+
+static void readReservoirEntry_destruct(ReadReservoirEntry *entry) {
+    if (entry->aln != NULL) {
+        bam_destroy1(entry->aln);
     }
-    // the status from "get reads from iterator"
-    if (result < -1) {
-        st_errAbort("ERROR: Retrieval of region %d failed due to truncated file or corrupt BAM index file\n",
-                    iter->curr_tid);
+    free(entry);
+}
+
+static int readReservoirEntry_cmp(const void *a, const void *b) {
+    const ReadReservoirEntry *entry1 = a, *entry2 = b;
+    if (entry1->priority != entry2->priority) {
+        return entry1->priority < entry2->priority ? -1 : 1;
     }
+    if (entry1->draw != entry2->draw) {
+        return entry1->draw > entry2->draw ? -1 : 1;
+    }
+    return entry1->order < entry2->order ? 1 : entry1->order > entry2->order ? -1 : 0;
+}
 
-    // close it all down
+static int readReservoirEntry_cmpOrder(const void *a, const void *b) {
+    const ReadReservoirEntry *entry1 = a, *entry2 = b;
+    return entry1->order < entry2->order ? -1 : entry1->order > entry2->order ? 1 : 0;
+}
 
+static ReadReservoir *readReservoir_construct(BamChunk *bamChunk, bool byFullReadLength, PolishParams *polishParams) {
+    ReadReservoir *reservoir = st_calloc(1, sizeof(ReadReservoir));
+    reservoir->bamChunk = bamChunk;
+    reservoir->byFullReadLength = byFullReadLength;
+    reservoir->budget = (int64_t) polishParams->excessiveDepthThreshold *
+                        (bamChunk->chunkOverlapEnd - bamChunk->chunkOverlapStart);
+    for (int64_t i = 0; i < 2; i++) {
+        reservoir->entries[i] = stSortedSet_construct3(readReservoirEntry_cmp,
+                                                       (void (*)(void *)) readReservoirEntry_destruct);
+    }
+    return reservoir;
+}
 
-    hts_itr_multi_destroy(iter);
-    hts_idx_destroy(idx);
-    free(region[0]);
-    bed_destroy(settings.bed);
-    bam_hdr_destroy(bamHdr);
+static void readReservoir_destruct(ReadReservoir *reservoir) {
+    for (int64_t i = 0; i < 2; i++) {
+        stSortedSet_destruct(reservoir->entries[i]);
+    }
+    free(reservoir);
+}
+
+static void readReservoir_offer(ReadReservoir *reservoir, bam1_t *aln, bam_hdr_t *bamHdr, int64_t source,
+                                BamChunkAlignmentLocation *location, PolishParams *polishParams) {
+    /*
+     * Offers the located alignment to the reservoir, which copies it if its priority is high enough for it to be kept.
+     */
+    int64_t filtered = location->filtered ? 1 : 0;
+    ReadReservoirEntry probe;
+    probe.aln = NULL;
+    probe.bamHdr = bamHdr;
+    probe.source = source;
+    probe.order = reservoir->offeredNos[0] + reservoir->offeredNos[1];
+    probe.length = bamChunk_getReadLengthInChunk(aln, location, polishParams->useRunLengthEncoding);
+    probe.draw = downsampling_getReadDraw(reservoir->bamChunk, bam_get_qname(aln));
+    probe.priority = !(filtered || reservoir->byFullReadLength) ? 1.0 - probe.draw :
+                     (double) aln->l_data / (double) (probe.length > 0 ? probe.length : 1);
+    reservoir->offeredNos[filtered]++;
+    stSortedSet *entries = reservoir->entries[filtered];
+    if (reservoir->budget > 0 && reservoir->totalLengths[filtered] >= reservoir->budget &&
+        readReservoirEntry_cmp(&probe, stSortedSet_getFirst(entries)) < 0) {
+        return;
+    }
+    ReadReservoirEntry *entry = st_malloc(sizeof(ReadReservoirEntry));
+    *entry = probe;
+    entry->aln = bam_dup1(aln);
+    stSortedSet_insert(entries, entry);
+    reservoir->totalLengths[filtered] += entry->length;
+
+    // discard the reads of lowest priority not needed to reach the budget
+    while (reservoir->budget > 0) {
+        ReadReservoirEntry *lowest = stSortedSet_getFirst(entries);
+        if (reservoir->totalLengths[filtered] - lowest->length < reservoir->budget) {
+            break;
+        }
+        stSortedSet_remove(entries, lowest);
+        reservoir->totalLengths[filtered] -= lowest->length;
+        readReservoirEntry_destruct(lowest);
+    }
+}
+
+static void readReservoir_offerAlignment(ReadReservoir *reservoir, bam1_t *aln, bam_hdr_t *bamHdr, int64_t source,
+                                         bool keepFiltered, PolishParams *polishParams) {
+    // offers the alignment if it belongs in the chunk
+    BamChunkAlignmentLocation location;
+    if (bamChunk_locateAlignment(reservoir->bamChunk, aln, bamHdr, keepFiltered, NULL, &location, polishParams)) {
+        readReservoir_offer(reservoir, aln, bamHdr, source, &location, polishParams);
+    }
+}
+
+static stList *readReservoir_getEntries(ReadReservoir *reservoir, bool filtered) {
+    // the kept entries of the primary or filtered reads, in the order they were offered, still owned by the reservoir
+    stList *entries = stSortedSet_getList(reservoir->entries[filtered ? 1 : 0]);
+    stList_sort(entries, readReservoirEntry_cmpOrder);
+    return entries;
+}
+
+static uint32_t readReservoir_convert(ReadReservoir *reservoir, bool *keep, uint64_t *ref_nonRleToRleCoordinateMap,
+                                      stList *reads, stList *alignments, stList *filteredReads,
+                                      stList *filteredAlignments, PolishParams *polishParams) {
+    /*
+     * Converts the kept alignments, in the order they were offered, as bamChunk_convertAlignment would have converted
+     * them when offered. If keep is not NULL only the primary reads it marks, by their index in
+     * readReservoir_getEntries, are converted. Returns the number of alignments saved.
+     */
+    for (int64_t i = 0; i < 2; i++) {
+        int64_t keptNo = stSortedSet_size(reservoir->entries[i]);
+        if (keptNo < reservoir->offeredNos[i]) {
+            char *logIdentifier = getLogIdentifier();
+            st_logInfo(" %s Kept %"PRId64" of %"PRId64" %s reads of excessively deep chunk before decoding them\n",
+                       logIdentifier, keptNo, reservoir->offeredNos[i], i == 0 ? "primary" : "filtered");
+            free(logIdentifier);
+        }
+    }
+    uint32_t savedAlignments = 0;
+    for (int64_t i = 0; i < 2; i++) {
+        stList *entries = readReservoir_getEntries(reservoir, i == 1);
+        for (int64_t j = 0; j < stList_length(entries); j++) {
+            if (i == 0 && keep != NULL && !keep[j]) continue;
+            ReadReservoirEntry *entry = stList_get(entries, j);
+            if (bamChunk_convertAlignment(reservoir->bamChunk, entry->aln, entry->bamHdr, entry->source,
+                                          ref_nonRleToRleCoordinateMap, reads, alignments, filteredReads,
+                                          filteredAlignments, polishParams)) {
+                savedAlignments++;
+            }
+        }
+        stList_destruct(entries);
+    }
+    return savedAlignments;
+}
+
+/*
+ * This generates a set of BamChunkReads (and alignments to the reference) from a BamChunk.  The BamChunk describes
+ * positional information within the bam, from which the reads should be extracted.  The bam must be indexed.  Reads
+ * which overlap the ends of the chunk are truncated.  A parameter in the BamChunk's parameters determines whether
+ * softclipped portions of the reads should be included.
+ */
+
+uint32_t convertToReadsAndAlignmentsWithFiltered2(BamChunk *bamChunk, uint64_t *ref_nonRleToRleCoordinateMap,
+        stList *reads, stList *alignments, stList *filteredReads, stList *filteredAlignments,
+        PolishParams *polishParams) {
+    allocProfile_scope(APT_IO);
+
+    // sanity check
+    assert(stList_length(reads) == 0);
+    assert(stList_length(alignments) == 0);
+    traceRecorder_begin("convertToReadsAndAlignments");
+
+    // prep, keeping the reads of up to excessiveDepthThreshold depth, and as much of the filtered reads, so that the
+    // discarded reads are never decoded
+    ReadReservoir *reservoir = readReservoir_construct(bamChunk, FALSE, polishParams);
+
+    // file initialization, reusing this thread's open bam files and indexes
+    int result;
+    BamFileHandle *fileHandle = bamChunker_getFileHandle(bamChunk->parent);
+    // read object
+    bam1_t *aln = bam_init1();
+
+    // fetch alignments, from each of the bam files in turn
+    for (BamFileHandle *sourceHandle = fileHandle; sourceHandle != NULL; sourceHandle = sourceHandle->next) {
+        // iterator for region
+        hts_itr_t *iter = bamChunk_getIterator(bamChunk, sourceHandle);
+        while ((result = sam_itr_next(sourceHandle->in, iter, aln)) >= 0) {
+            chunkTelemetry_addCount(CTC_BAM_BYTES, sizeof(bam1_core_t) + aln->l_data);
+            readReservoir_offerAlignment(reservoir, aln, sourceHandle->bamHdr, sourceHandle->source,
+                                         filteredReads != NULL, polishParams);
+        }
+        // the status from "get reads from iterator"
+        if (result < -1) {
+            st_errAbort("ERROR: Retrieval of region %s:%"PRId64"-%"PRId64" failed due to truncated file or corrupt "
+                        "BAM index file\n", bamChunk->refSeqName, bamChunk->chunkOverlapStart,
+                        bamChunk->chunkOverlapEnd);
+        }
+        hts_itr_destroy(iter);
+    }
+
+    // decode the kept reads
+    uint32_t savedAlignments = readReservoir_convert(reservoir, NULL, ref_nonRleToRleCoordinateMap, reads, alignments,
+                                                     filteredReads, filteredAlignments, polishParams);
+
+    // close it all down
+    readReservoir_destruct(reservoir);
     bam_destroy1(aln);
-    sam_close(in);
+    bamChunker_releaseFileHandle(bamChunk->parent, fileHandle);
+    traceRecorder_end("convertToReadsAndAlignments");
+    return savedAlignments;
+}
+
+uint32_t convertToReadsAndAlignmentsWithFiltered(BamChunk *bamChunk, RleString *reference, stList *reads,
+        stList *alignments, stList *filteredReads, stList *filteredAlignments, PolishParams *polishParams) {
+    uint64_t *ref_nonRleToRleCoordinateMap =
+            reference == NULL ? NULL : rleString_getNonRleToRleCoordinateMap(reference);
+    uint32_t savedAlignments = convertToReadsAndAlignmentsWithFiltered2(bamChunk, ref_nonRleToRleCoordinateMap, reads,
+                                                                        alignments, filteredReads, filteredAlignments,
+                                                                        polishParams);
     if (ref_nonRleToRleCoordinateMap != NULL)
         free(ref_nonRleToRleCoordinateMap);
     return savedAlignments;
@@ -870,42 +1738,73 @@ uint32_t convertToReadsAndAlignments(BamChunk *bamChunk, RleString *reference, s
     return convertToReadsAndAlignmentsWithFiltered(bamChunk, reference, reads, alignments, NULL, NULL, polishParams);
 }
 
-bool downsampleViaReadLikelihood(int64_t intendedDepth, BamChunk *bamChunk, stList *inputReads, stList *inputAlignments,
-                                 stList *maintainedReads, stList *maintainedAlignments, stList *discardedReads,
-                                 stList *discardedAlignments) {
-
-    // calculate depth
-    int64_t totalNucleotides = 0;
-    for (int64_t i = 0; i < stList_length(inputReads); i++) {
-        BamChunkRead *bcr = stList_get(inputReads, i);
-        totalNucleotides += bcr->rleRead->length;
-    }
-    int64_t chunkSize = bamChunk->chunkOverlapEnd - bamChunk->chunkOverlapStart;
-    double averageDepth = 1.0 * totalNucleotides / (chunkSize);
-
-    // do we need to downsample?
-    if (averageDepth < intendedDepth) {
-        return FALSE;
+static uint64_t fingerprintBytes(uint64_t fingerprint, const void *bytes, size_t length) {
+    // FNV-1a, as chunkJournal_fingerprintString
+    for (size_t i = 0; i < length; i++) {
+        fingerprint = (fingerprint ^ ((const uint8_t *) bytes)[i]) * 1099511628211ULL;
     }
+    return fingerprint;
+}
 
-    // we do need to downsample
-    char *logIdentifier = getLogIdentifier();
-    st_logInfo(" %s Downsampling chunk with average depth %.2fx to %dx \n", logIdentifier, averageDepth, intendedDepth);
-    free(logIdentifier);
+uint64_t bamChunk_getInputFingerprint(BamChunk *bamChunk, char *referenceFile, uint64_t fingerprint) {
+    // the reference substring
+    char *reference = getSequenceFromReference(referenceFile, bamChunk->refSeqName, bamChunk->chunkOverlapStart,
+                                               bamChunk->chunkOverlapEnd);
+    fingerprint = chunkJournal_fingerprintString(fingerprint, reference);
+    free(reference);
 
-    // keep some ratio of reads
-    double ratioToKeep = intendedDepth / averageDepth;
-    for (int64_t i = 0; i < stList_length(inputReads); i++) {
-        if (st_random() < ratioToKeep) {
-            stList_append(maintainedReads, stList_get(inputReads, i));
-            stList_append(maintainedAlignments, stList_get(inputAlignments, i));
-        } else {
-            stList_append(discardedReads, stList_get(inputReads, i));
-            stList_append(discardedAlignments, stList_get(inputAlignments, i));
+    // the alignments overlapping it, combined by summing so that the order of alignments at the same position
+    // (which may differ between merges of the same reads) does not matter
+    int result;
+    BamFileHandle *fileHandle = bamChunker_getFileHandle(bamChunk->parent);
+    bam1_t *aln = bam_init1();
+    for (BamFileHandle *sourceHandle = fileHandle; sourceHandle != NULL; sourceHandle = sourceHandle->next) {
+        hts_itr_t *iter = bamChunk_getIterator(bamChunk, sourceHandle);
+        uint64_t alignmentsFingerprint = 0, alignmentNo = 0;
+        while ((result = sam_itr_next(sourceHandle->in, iter, aln)) >= 0) {
+            chunkTelemetry_addCount(CTC_BAM_BYTES, sizeof(bam1_core_t) + aln->l_data);
+            uint64_t alignmentFingerprint = fingerprintBytes(CHUNK_JOURNAL_FINGERPRINT_SEED, &aln->core.pos,
+                                                             sizeof(aln->core.pos));
+            alignmentFingerprint = fingerprintBytes(alignmentFingerprint, &aln->core.flag, sizeof(aln->core.flag));
+            alignmentFingerprint = fingerprintBytes(alignmentFingerprint, &aln->core.qual, sizeof(aln->core.qual));
+            alignmentFingerprint = fingerprintBytes(alignmentFingerprint, aln->data, aln->l_data);
+            alignmentsFingerprint += alignmentFingerprint;
+            alignmentNo++;
         }
+        if (result < -1) {
+            st_errAbort("ERROR: Retrieval of region %s:%"PRId64"-%"PRId64" failed due to truncated file or corrupt "
+                        "BAM index file\n", bamChunk->refSeqName, bamChunk->chunkOverlapStart,
+                        bamChunk->chunkOverlapEnd);
+        }
+        // each file in order, as the reads are tagged with the file they came from
+        fingerprint = fingerprintBytes(fingerprint, &alignmentsFingerprint, sizeof(uint64_t));
+        fingerprint = fingerprintBytes(fingerprint, &alignmentNo, sizeof(uint64_t));
+        hts_itr_destroy(iter);
     }
 
-    return TRUE;
+    // close it all down
+    bam_destroy1(aln);
+    bamChunker_releaseFileHandle(bamChunk->parent, fileHandle);
+    return fingerprint;
+}
+
+double downsampling_getReadDraw(BamChunk *bamChunk, char *readName) {
+    // fnv-1a over the read name and the chunk's contig, mixed with the chunk's start and the seed by splitmix64
+    uint64_t h = 14695981039346656037ULL;
+    for (char *c = readName; *c != '\0'; c++) {
+        h = (h ^ (uint8_t) *c) * 1099511628211ULL;
+    }
+    h = (h ^ (uint8_t) '\t') * 1099511628211ULL;
+    for (char *c = bamChunk->refSeqName; *c != '\0'; c++) {
+        h = (h ^ (uint8_t) *c) * 1099511628211ULL;
+    }
+    h ^= (uint64_t) bamChunk->chunkOverlapStart * 0x9E3779B97F4A7C15ULL;
+    h += bamChunk->parent->params->downsamplingSeed * 0xBF58476D1CE4E5B9ULL + 0x9E3779B97F4A7C15ULL;
+    h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+    h ^= h >> 31;
+    // the top 53 bits, as a double in [0, 1)
+    return (double) (h >> 11) * (1.0 / 9007199254740992.0);
 }
 
 #define HET_SITE_SCALE 2
@@ -1032,7 +1931,7 @@ bool downsampleViaHetSpanLikelihood(int64_t intendedDepth, BamChunk *bamChunk, s
     int64_t totalKeptNucleotides = 0;
     for (int64_t i = 0; i < stList_length(inputReads); i++) {
         BamChunkRead *bcr = stList_get(inputReads, i);
-        if (st_random() < probs[i]) {
+        if (downsampling_getReadDraw(bamChunk, bcr->readName) < probs[i]) {
             stList_append(maintainedReads, stList_get(inputReads, i));
             stList_append(maintainedAlignments, stList_get(inputAlignments, i));
             totalKeptNucleotides += bcr->rleRead->length;
@@ -1051,69 +1950,226 @@ bool downsampleViaHetSpanLikelihood(int64_t intendedDepth, BamChunk *bamChunk, s
     return TRUE;
 }
 
-bool downsampleViaFullReadLengthLikelihood(int64_t intendedDepth, BamChunk *bamChunk, stList *inputReads,
-        stList *inputAlignments, stList *maintainedReads, stList *maintainedAlignments,
-        stList *discardedReads, stList *discardedAlignments) {
+static bool downsample_chooseReads(int64_t intendedDepth, BamChunk *bamChunk, char **readNames, int *readLengths,
+                                   int *readFullLengths, int64_t readCount, bool *keep) {
+    /*
+     * Chooses the reads to keep to bring the chunk down to the intended depth, given the lengths of the reads in the
+     * chunk. If readFullLengths is NULL the reads are sampled uniformly, otherwise longer reads are preferred. Returns
+     * FALSE if the chunk is not deep enough to downsample, in which case keep is not set. Each read is kept or not by
+     * its own draw, from downsampling_getReadDraw, so the choice does not depend on the order or the thread.
+     */
 
-    // calculate depth, generate bcrwhs list
+    // calculate depth
     int64_t totalNucleotides = 0;
-
-    int *readLengths = st_calloc(stList_length(inputReads), sizeof(int));
-    int *readFullLengths = st_calloc(stList_length(inputReads), sizeof(int));
-
-    for (int64_t i = 0; i < stList_length(inputReads); i++) {
-        BamChunkRead *bcr = stList_get(inputReads, i);
-        totalNucleotides += bcr->rleRead->length;
-        readLengths[i] = (int) bcr->rleRead->length;
-        // give reads a pseudocount
-        readFullLengths[i] = (int) bcr->fullReadLength;
+    for (int64_t i = 0; i < readCount; i++) {
+        totalNucleotides += readLengths[i];
     }
     int64_t chunkSize = bamChunk->chunkOverlapEnd - bamChunk->chunkOverlapStart;
     double averageDepth = 1.0 * totalNucleotides / (chunkSize);
 
     // do we need to downsample?
     if (averageDepth < intendedDepth) {
-        free(readLengths);
-        free(readFullLengths);
         return FALSE;
     }
 
     // we do need to downsample
     char *logIdentifier = getLogIdentifier();
-    st_logInfo(" %s Downsampling chunk via full read length with average depth %.2fx to %dx.\n",
-               logIdentifier, averageDepth, intendedDepth);
-
-    // get likelihood of keeping each read
-    double *probs = computeReadProbsByLengthAndSecondMetric(readLengths, readFullLengths,
-                                                            (int) stList_length(inputReads),
-                                                            intendedDepth, (int) chunkSize);
-
-    // keep some ratio of reads
-    int64_t totalKeptNucleotides = 0;
-    for (int64_t i = 0; i < stList_length(inputReads); i++) {
-        BamChunkRead *bcr = stList_get(inputReads, i);
-        if (st_random() < probs[i]) {
-            stList_append(maintainedReads, stList_get(inputReads, i));
-            stList_append(maintainedAlignments, stList_get(inputAlignments, i));
-            totalKeptNucleotides += bcr->rleRead->length;
-        } else {
-            stList_append(discardedReads, stList_get(inputReads, i));
-            stList_append(discardedAlignments, stList_get(inputAlignments, i));
+    if (readFullLengths == NULL) {
+        st_logInfo(" %s Downsampling chunk with average depth %.2fx to %dx \n", logIdentifier, averageDepth,
+                   intendedDepth);
+
+        // keep some ratio of reads
+        double ratioToKeep = intendedDepth / averageDepth;
+        for (int64_t i = 0; i < readCount; i++) {
+            keep[i] = downsampling_getReadDraw(bamChunk, readNames[i]) < ratioToKeep;
+        }
+    } else {
+        st_logInfo(" %s Downsampling chunk via full read length with average depth %.2fx to %dx.\n",
+                   logIdentifier, averageDepth, intendedDepth);
+
+        // get likelihood of keeping each read
+        double *probs = computeReadProbsByLengthAndSecondMetric(readLengths, readFullLengths, (int) readCount,
+                                                                intendedDepth, (int) chunkSize);
+
+        // keep some ratio of reads
+        int64_t totalKeptNucleotides = 0;
+        for (int64_t i = 0; i < readCount; i++) {
+            keep[i] = downsampling_getReadDraw(bamChunk, readNames[i]) < probs[i];
+            if (keep[i]) {
+                totalKeptNucleotides += readLengths[i];
+            }
         }
+        st_logInfo(" %s Downsampled chunk via full read length to average depth %.2fx (expected %dx)\n",
+                   logIdentifier, 1.0 * totalKeptNucleotides / chunkSize, intendedDepth);
+        free(probs);
     }
-    st_logInfo(" %s Downsampled chunk via full read length to average depth %.2fx (expected %dx)\n",
-               logIdentifier, 1.0 * totalKeptNucleotides / chunkSize, intendedDepth);
-
-    free(probs);
-    free(readLengths);
-    free(readFullLengths);
     free(logIdentifier);
     return TRUE;
 }
 
-
-
-bool downsampleBamChunkReadWithVcfEntrySubstringsViaFullReadLengthLikelihood(int64_t intendedDepth,
+static bool downsampleReads(int64_t intendedDepth, BamChunk *bamChunk, bool byFullReadLength, stList *inputReads,
+                            stList *inputAlignments, stList *maintainedReads, stList *maintainedAlignments,
+                            stList *discardedReads, stList *discardedAlignments) {
+    int64_t readCount = stList_length(inputReads);
+    char **readNames = st_calloc(readCount, sizeof(char *));
+    int *readLengths = st_calloc(readCount, sizeof(int));
+    int *readFullLengths = byFullReadLength ? st_calloc(readCount, sizeof(int)) : NULL;
+    bool *keep = st_calloc(readCount, sizeof(bool));
+    for (int64_t i = 0; i < readCount; i++) {
+        BamChunkRead *bcr = stList_get(inputReads, i);
+        readNames[i] = bcr->readName;
+        readLengths[i] = (int) bcr->rleRead->length;
+        if (byFullReadLength) {
+            readFullLengths[i] = (int) bcr->fullReadLength;
+        }
+    }
+
+    bool downsampled = downsample_chooseReads(intendedDepth, bamChunk, readNames, readLengths, readFullLengths,
+                                              readCount, keep);
+    if (downsampled) {
+        for (int64_t i = 0; i < readCount; i++) {
+            stList_append(keep[i] ? maintainedReads : discardedReads, stList_get(inputReads, i));
+            stList_append(keep[i] ? maintainedAlignments : discardedAlignments, stList_get(inputAlignments, i));
+        }
+    }
+
+    free(readNames);
+    free(readLengths);
+    free(readFullLengths);
+    free(keep);
+    return downsampled;
+}
+
+bool downsampleViaReadLikelihood(int64_t intendedDepth, BamChunk *bamChunk, stList *inputReads, stList *inputAlignments,
+                                 stList *maintainedReads, stList *maintainedAlignments, stList *discardedReads,
+                                 stList *discardedAlignments) {
+    return downsampleReads(intendedDepth, bamChunk, FALSE, inputReads, inputAlignments, maintainedReads,
+                           maintainedAlignments, discardedReads, discardedAlignments);
+}
+
+bool downsampleViaFullReadLengthLikelihood(int64_t intendedDepth, BamChunk *bamChunk, stList *inputReads,
+        stList *inputAlignments, stList *maintainedReads, stList *maintainedAlignments,
+        stList *discardedReads, stList *discardedAlignments) {
+    return downsampleReads(intendedDepth, bamChunk, TRUE, inputReads, inputAlignments, maintainedReads,
+                           maintainedAlignments, discardedReads, discardedAlignments);
+}
+
+
+
+uint32_t convertToReadsAndAlignmentsWithDownsampling2(BamChunk *bamChunk, uint64_t *ref_nonRleToRleCoordinateMap,
+                                                      int64_t intendedDepth, bool byFullReadLength, stList *reads,
+                                                      stList *alignments, stList *filteredReads,
+                                                      stList *filteredAlignments, bool *downsampled,
+                                                      PolishParams *polishParams) {
+    allocProfile_scope(APT_IO);
+
+    // sanity check
+    assert(stList_length(reads) == 0);
+    assert(stList_length(alignments) == 0);
+    traceRecorder_begin("convertToReadsAndAlignmentsWithDownsampling");
+
+    bool rleAlignment = polishParams->useRunLengthEncoding && ref_nonRleToRleCoordinateMap != NULL;
+    int64_t chunkStart = bamChunk->chunkStart - bamChunk->chunkOverlapStart;
+    int64_t chunkEnd = bamChunk->chunkEnd - bamChunk->chunkOverlapStart;
+
+    // file initialization, reusing this thread's open bam files and indexes
+    int result;
+    BamFileHandle *fileHandle = bamChunker_getFileHandle(bamChunk->parent);
+    bam1_t *aln = bam_init1();
+
+    // first pass, keeping the (still encoded) alignments in the chunk, up to excessiveDepthThreshold depth of those
+    // downsampling would prefer, and as much of the filtered reads
+    ReadReservoir *reservoir = readReservoir_construct(bamChunk, byFullReadLength, polishParams);
+    for (BamFileHandle *sourceHandle = fileHandle; sourceHandle != NULL; sourceHandle = sourceHandle->next) {
+        hts_itr_t *iter = bamChunk_getIterator(bamChunk, sourceHandle);
+        while ((result = sam_itr_next(sourceHandle->in, iter, aln)) >= 0) {
+            chunkTelemetry_addCount(CTC_BAM_BYTES, sizeof(bam1_core_t) + aln->l_data);
+            BamChunkAlignmentLocation location;
+            if (!bamChunk_locateAlignment(bamChunk, aln, sourceHandle->bamHdr, filteredReads != NULL, NULL, &location,
+                                          polishParams)) {
+                continue;
+            }
+            if (!location.filtered) {
+                // drop the reads only in the chunk boundary, as removeReadsOnlyInChunkBoundary would
+                int64_t firstAlignPos = rleAlignment ?
+                        (int64_t) ref_nonRleToRleCoordinateMap[location.firstAlignedRefPos] :
+                        location.firstAlignedRefPos;
+                int64_t lastAlignPos = rleAlignment ?
+                        (int64_t) ref_nonRleToRleCoordinateMap[location.lastAlignedRefPos] :
+                        location.lastAlignedRefPos;
+                if (lastAlignPos < chunkStart || firstAlignPos >= chunkEnd) {
+                    continue;
+                }
+            }
+            readReservoir_offer(reservoir, aln, sourceHandle->bamHdr, sourceHandle->source, &location, polishParams);
+        }
+        // the status from "get reads from iterator"
+        if (result < -1) {
+            st_errAbort("ERROR: Retrieval of region %s:%"PRId64"-%"PRId64" failed due to truncated file or corrupt "
+                        "BAM index file\n", bamChunk->refSeqName, bamChunk->chunkOverlapStart,
+                        bamChunk->chunkOverlapEnd);
+        }
+        hts_itr_destroy(iter);
+    }
+    bam_destroy1(aln);
+
+    // choose the maintained reads
+    stList *candidates = readReservoir_getEntries(reservoir, FALSE);
+    int64_t readCount = stList_length(candidates);
+    char **names = st_calloc(readCount, sizeof(char *));
+    int *lengths = st_calloc(readCount, sizeof(int));
+    int *fullLengths = st_calloc(readCount, sizeof(int));
+    bool *keep = st_calloc(readCount, sizeof(bool));
+    for (int64_t i = 0; i < readCount; i++) {
+        ReadReservoirEntry *candidate = stList_get(candidates, i);
+        names[i] = bam_get_qname(candidate->aln);
+        lengths[i] = (int) candidate->length;
+        fullLengths[i] = candidate->aln->l_data;
+    }
+    *downsampled = intendedDepth > 0 && downsample_chooseReads(intendedDepth, bamChunk, names, lengths,
+                                                               byFullReadLength ? fullLengths : NULL, readCount, keep);
+
+    // second pass, decoding only the maintained (and filtered) reads
+    uint32_t savedAlignments = readReservoir_convert(reservoir, *downsampled ? keep : NULL,
+                                                     ref_nonRleToRleCoordinateMap, reads, alignments, filteredReads,
+                                                     filteredAlignments, polishParams);
+    if (*downsampled) {
+        char *logIdentifier = getLogIdentifier();
+        st_logInfo(" %s Downsampled from %"PRId64" to %"PRId64" reads before decoding them\n", logIdentifier,
+                   readCount, stList_length(reads));
+        free(logIdentifier);
+    }
+
+    // close it all down
+    bamChunker_releaseFileHandle(bamChunk->parent, fileHandle);
+    free(names);
+    free(lengths);
+    free(fullLengths);
+    free(keep);
+    stList_destruct(candidates);
+    readReservoir_destruct(reservoir);
+    traceRecorder_end("convertToReadsAndAlignmentsWithDownsampling");
+    return savedAlignments;
+}
+
+uint32_t convertToReadsAndAlignmentsWithDownsampling(BamChunk *bamChunk, RleString *reference, int64_t intendedDepth,
+                                                     bool byFullReadLength, stList *reads, stList *alignments,
+                                                     stList *filteredReads, stList *filteredAlignments,
+                                                     bool *downsampled, PolishParams *polishParams) {
+    uint64_t *ref_nonRleToRleCoordinateMap =
+            reference == NULL ? NULL : rleString_getNonRleToRleCoordinateMap(reference);
+    uint32_t savedAlignments = convertToReadsAndAlignmentsWithDownsampling2(bamChunk, ref_nonRleToRleCoordinateMap,
+                                                                            intendedDepth, byFullReadLength, reads,
+                                                                            alignments, filteredReads,
+                                                                            filteredAlignments, downsampled,
+                                                                            polishParams);
+    if (ref_nonRleToRleCoordinateMap != NULL)
+        free(ref_nonRleToRleCoordinateMap);
+    return savedAlignments;
+}
+
+bool downsampleBamChunkReadWithVcfEntrySubstringsViaFullReadLengthLikelihood(int64_t intendedDepth,
+                                                                             BamChunk *bamChunk,
                                                                              stList *chunkVcfEntries,
                                                                              stList *inputReads,
                                                                              stList *maintainedReads,
@@ -1173,7 +2229,7 @@ bool downsampleBamChunkReadWithVcfEntrySubstringsViaFullReadLengthLikelihood(int
     int64_t totalKeptVariants = 0;
     for (int64_t i = 0; i < stList_length(inputReads); i++) {
         BamChunkRead *bcr = stList_get(inputReads, i);
-        if (st_random() < probs[i]) {
+        if (downsampling_getReadDraw(bamChunk, bcr->readName) < probs[i]) {
             stList_append(maintainedReads, stList_get(inputReads, i));
             totalKeptVariants += stList_length(bcr->bamChunkReadVcfEntrySubstrings->readSubstrings);
         } else {
@@ -1191,6 +2247,175 @@ bool downsampleBamChunkReadWithVcfEntrySubstringsViaFullReadLengthLikelihood(int
 }
 
 
+static int64_t haplotagRead(bam1_t *aln, stSet *readsInH1, stSet *readsInH2, Params *params) {
+    /*
+     * Sets the HP tag of the alignment from the haplotype its read is in, returning the haplotype (0 if in neither or
+     * both) or -1 if the alignment is filtered out of the haplotagged bam.
+     */
+    // basic filtering (no read length, no cigar)
+    if (aln->core.l_qseq <= 0) return -1;
+    if (aln->core.n_cigar == 0) return -1;
+    if ((aln->core.flag & (uint16_t) 0x4) != 0)
+        return -1; //unaligned
+    if (!params->polishParams->includeSecondaryAlignments && (aln->core.flag & (uint16_t) 0x100) != 0)
+        return -1; //secondary
+    if (!params->polishParams->includeSupplementaryAlignments && (aln->core.flag & (uint16_t) 0x800) != 0)
+        return -1; //supplementary
+
+    char *readName = bam_get_qname(aln);
+    bool has_tag = bam_aux_get(aln, "HP") != NULL;
+    bool inH1 = stSet_search(readsInH1, readName);
+    bool inH2 = stSet_search(readsInH2, readName);
+    int32_t ht = (inH1 & !inH2) ? 1 : (!inH1 & inH2) ? 2 : 0;
+    if (has_tag) {
+        bam_aux_update_int(aln, "HP", ht);
+    } else {
+        bam_aux_append(aln, "HP", 'i', sizeof(ht), (uint8_t*) &ht);
+    }
+    return ht;
+}
+
+static void haplotaggedBam_buildIndex(samFile *out, bam_hdr_t *bamHdr, char *haplotaggedBamOutFile,
+                                      char **indexFile) {
+    /*
+     * Starts building the bai index of the output as it is written, the output is in the (sorted) order of the input.
+     */
+    *indexFile = stString_print("%s.bai", haplotaggedBamOutFile);
+    if (sam_idx_init(out, bamHdr, 0, *indexFile) < 0) {
+        st_logCritical("  Could not build index %s while writing haplotagged bam\n", *indexFile);
+        free(*indexFile);
+        *indexFile = NULL;
+    }
+}
+
+static void haplotaggedBam_saveIndex(samFile *out, char *indexFile) {
+    if (indexFile != NULL) {
+        if (sam_idx_save(out) < 0) {
+            st_logCritical("  Could not save index %s of haplotagged bam\n", indexFile);
+        }
+        free(indexFile);
+    }
+}
+
+static stList *getHaplotaggingWindows(bam_hdr_t *bamHdr, char *regionStr, int64_t windowSize) {
+    /*
+     * Splits the contigs (or the region) into consecutive windows of the given size, as stIntTuples of
+     * (tid, start, end, first window of the contig), with 0-based half-open coordinates.
+     */
+    char regionContig[128] = "";
+    int regionStart = 0;
+    int regionEnd = 0;
+    int scanRet = 0;
+    if (regionStr != NULL) {
+        scanRet = sscanf(regionStr, "%[^:]:%d-%d", regionContig, &regionStart, &regionEnd);
+        if (scanRet != 3 && scanRet != 1) {
+            st_errAbort("Region in unexpected format (expected %%s:%%d-%%d or %%s)): %s", regionStr);
+        }
+    }
+    stList *windows = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
+    for (int64_t tid = 0; tid < bamHdr->n_targets; tid++) {
+        int64_t start = 0, end = bamHdr->target_len[tid];
+        if (regionStr != NULL) {
+            if (!stString_eq(regionContig, bamHdr->target_name[tid])) continue;
+            if (scanRet == 3) {
+                // region is 1-based and closed
+                start = regionStart > 0 ? regionStart - 1 : 0;
+                end = regionEnd < end ? regionEnd : end;
+            }
+        }
+        for (int64_t i = start; i < end; i += windowSize) {
+            stList_append(windows, stIntTuple_construct4(tid, i, i + windowSize < end ? i + windowSize : end,
+                                                         i == start));
+        }
+    }
+    return windows;
+}
+
+static void writeHaplotaggedBamInParallel(char *inputBamLocation, samFile *out, bam_hdr_t *bamHdr, char *regionStr,
+                                          stSet *readsInH1, stSet *readsInH2, Params *params, int64_t *hapCounts) {
+    /*
+     * Tags the reads of consecutive windows of the genome in parallel, each thread reading its windows with its own
+     * handle on the input, and writes them in window order. A read is written in the window containing its start, or
+     * in the first window of its contig if it starts before it, so the output has the order of the input.
+     */
+    stList *windows = getHaplotaggingWindows(bamHdr, regionStr, params->polishParams->chunkSize > 0 ?
+                                                                 params->polishParams->chunkSize : 1000000);
+    int64_t h0Count = 0, h1Count = 0, h2Count = 0;
+
+    # ifdef _OPENMP
+    #pragma omp parallel reduction(+:h0Count,h1Count,h2Count)
+    # endif
+    {
+        // handle on the input for this thread
+        samFile *in = hts_open(inputBamLocation, "r");
+        hts_idx_t *idx = NULL;
+        if (in == NULL || (idx = bamIndex_load(in, inputBamLocation)) == 0) {
+            st_errAbort("ERROR: Cannot open bam file %s and its index\n", inputBamLocation);
+        }
+        htsThreadPool *sharedThreadPool = getHtsThreadPool(params->polishParams);
+        if (sharedThreadPool != NULL) {
+            hts_set_opt(in, HTS_OPT_THREAD_POOL, sharedThreadPool);
+        }
+        bam_hdr_t *inHdr = sam_hdr_read(in);
+        bam1_t *aln = bam_init1();
+
+        # ifdef _OPENMP
+        #pragma omp for schedule(dynamic, 1) ordered
+        # endif
+        for (int64_t w = 0; w < stList_length(windows); w++) {
+            stIntTuple *window = stList_get(windows, w);
+            int64_t windowStart = stIntTuple_get(window, 1);
+            bool firstWindow = stIntTuple_get(window, 3);
+
+            // tag the reads starting in the window
+            stList *taggedAlns = stList_construct3(0, (void (*)(void *)) bam_destroy1);
+            hts_itr_t *iter = sam_itr_queryi(idx, (int) stIntTuple_get(window, 0), windowStart,
+                                             stIntTuple_get(window, 2));
+            if (iter == NULL) {
+                st_errAbort("ERROR: Cannot open iterator for bam file %s\n", inputBamLocation);
+            }
+            while (sam_itr_next(in, iter, aln) >= 0) {
+                if (!firstWindow && aln->core.pos < windowStart) continue; // written with an earlier window
+                int64_t ht = haplotagRead(aln, readsInH1, readsInH2, params);
+                if (ht < 0) continue;
+                if (ht == 1) {
+                    h1Count++;
+                } else if (ht == 2) {
+                    h2Count++;
+                } else {
+                    h0Count++;
+                }
+                stList_append(taggedAlns, bam_dup1(aln));
+            }
+            hts_itr_destroy(iter);
+
+            // write in window order
+            # ifdef _OPENMP
+            #pragma omp ordered
+            # endif
+            {
+                for (int64_t i = 0; i < stList_length(taggedAlns); i++) {
+                    if (sam_write1(out, bamHdr, stList_get(taggedAlns, i)) < 0) {
+                        st_errAbort("ERROR: Could not write haplotagged read\n");
+                    }
+                }
+            }
+            stList_destruct(taggedAlns);
+        }
+
+        // cleanup
+        bam_destroy1(aln);
+        bam_hdr_destroy(inHdr);
+        bamIndex_destruct(idx);
+        sam_close(in);
+    }
+
+    stList_destruct(windows);
+    hapCounts[0] = h0Count;
+    hapCounts[1] = h1Count;
+    hapCounts[2] = h2Count;
+}
+
 void writeHaplotaggedBam(char *inputBamLocation, char *outputBamFileBase, char *regionStr, stSet *readsInH1, stSet *readsInH2,
                          BamChunk *bamChunk, Params *params, char *logIdentifier) {
     /*
@@ -1221,7 +2446,7 @@ void writeHaplotaggedBam(char *inputBamLocation, char *outputBamFileBase, char *
         st_errAbort("ERROR: Cannot open bam file %s\n", inputBamLocation);
     }
     // bam index
-    if ((idx = sam_index_load(in, inputBamLocation)) == 0) {
+    if ((idx = bamIndex_load(in, inputBamLocation)) == 0) {
         st_errAbort("ERROR: Cannot open index for bam file %s\n", inputBamLocation);
     }
     bam_hdr_t *bamHdr = sam_hdr_read(in);
@@ -1236,18 +2461,48 @@ void writeHaplotaggedBam(char *inputBamLocation, char *outputBamFileBase, char *
     }
     FILE *readOut = NULL;
 
-    // thread stuff
+    // thread stuff, using the shared pool if there is one
     htsThreadPool threadPool = {NULL, 0};
+    htsThreadPool *sharedThreadPool = getHtsThreadPool(params->polishParams);
+    if (sharedThreadPool == NULL) {
+        # ifdef _OPENMP
+        int tc = omp_get_max_threads();
+        # else
+        int tc = 1;
+        # endif
+        if (!(threadPool.pool = hts_tpool_init(tc))) {
+            fprintf(stderr, "Error creating thread pool\n");
+        }
+    }
+    hts_set_opt(in, HTS_OPT_THREAD_POOL, sharedThreadPool != NULL ? sharedThreadPool : &threadPool);
+    hts_set_opt(out, HTS_OPT_THREAD_POOL, sharedThreadPool != NULL ? sharedThreadPool : &threadPool);
+
+    // the output is indexed as it is written
+    char *indexFile = NULL;
+    if (out != NULL) {
+        haplotaggedBam_buildIndex(out, bamHdr, haplotaggedBamOutFile, &indexFile);
+    }
+
+    // whole genome output is tagged in parallel by window
     # ifdef _OPENMP
-    int tc = omp_get_max_threads();
-    # else
-    int tc = 1;
-    # endif
-    if (!(threadPool.pool = hts_tpool_init(tc))) {
-        fprintf(stderr, "Error creating thread pool\n");
+    if (bamChunk == NULL && out != NULL && omp_get_max_threads() > 1 && !omp_in_parallel()) {
+        int64_t hapCounts[3];
+        writeHaplotaggedBamInParallel(inputBamLocation, out, bamHdr, regionStr, readsInH1, readsInH2, params,
+                                      hapCounts);
+        st_logCritical(" %s Separated reads with divisions: H1 %"PRId64", H2 %"PRId64", and H0 %"PRId64"\n",
+                       logIdentifier, hapCounts[1], hapCounts[2], hapCounts[0]);
+        haplotaggedBam_saveIndex(out, indexFile);
+        bamIndex_destruct(idx);
+        bam_destroy1(aln);
+        bam_hdr_destroy(bamHdr);
+        sam_close(in);
+        sam_close(out);
+        if (threadPool.pool != NULL) hts_tpool_destroy(threadPool.pool);
+        free(chunkIdentifier);
+        free(haplotaggedBamOutFile);
+        return;
     }
-    hts_set_opt(in, HTS_OPT_THREAD_POOL, &threadPool);
-    hts_set_opt(out, HTS_OPT_THREAD_POOL, &threadPool);
+    # endif
 
     // prep for index (not entirely sure what all this does.  see samtools/sam_view.c
     int filter_state = ALL, filter_op = 0;
@@ -1290,43 +2545,13 @@ void writeHaplotaggedBam(char *inputBamLocation, char *outputBamFileBase, char *
 
     // fetch alignments (either all reads or without reads)
     while ((!useRegion ? sam_read1(in,bamHdr,aln) : sam_itr_multi_next(in, iter, aln)) >= 0) {
-        // basic filtering (no read length, no cigar)
-        if (aln->core.l_qseq <= 0) continue;
-        if (aln->core.n_cigar == 0) continue;
-        if ((aln->core.flag & (uint16_t) 0x4) != 0)
-            continue; //unaligned
-        if (!params->polishParams->includeSecondaryAlignments && (aln->core.flag & (uint16_t) 0x100) != 0)
-            continue; //secondary
-        if (!params->polishParams->includeSupplementaryAlignments && (aln->core.flag & (uint16_t) 0x800) != 0)
-            continue; //supplementary
-
-        char *readName = bam_get_qname(aln);
-        bool has_tag = bam_aux_get(aln, "HP") != NULL;
-        bool inH1 = stSet_search(readsInH1, readName);
-        bool inH2 = stSet_search(readsInH2, readName);
-        if (inH1 & !inH2) {
-            int32_t ht = 1;
-            if (has_tag) {
-                bam_aux_update_int(aln, "HP", ht);
-            } else {
-                bam_aux_append(aln, "HP", 'i', sizeof(ht), (uint8_t*) &ht);
-            }
+        int64_t ht = haplotagRead(aln, readsInH1, readsInH2, params);
+        if (ht < 0) continue;
+        if (ht == 1) {
             h1Count++;
-        } else if (!inH1 & inH2) {
-            int32_t ht = 2;
-            if (has_tag) {
-                bam_aux_update_int(aln, "HP", ht);
-            } else {
-                bam_aux_append(aln, "HP", 'i', sizeof(ht), (uint8_t*) &ht);
-            }
+        } else if (ht == 2) {
             h2Count++;
         } else {
-            int32_t ht = 0;
-            if (has_tag) {
-                bam_aux_update_int(aln, "HP", ht);
-            } else {
-                bam_aux_append(aln, "HP", 'i', sizeof(ht), (uint8_t*) &ht);
-            }
             h0Count++;
         }
         r = sam_write1(out, bamHdr, aln);
@@ -1340,12 +2565,15 @@ void writeHaplotaggedBam(char *inputBamLocation, char *outputBamFileBase, char *
         free(region[0]);
         bed_destroy(settings.bed);
     }
-    hts_idx_destroy(idx);
+    if (out != NULL) {
+        haplotaggedBam_saveIndex(out, indexFile);
+    }
+    bamIndex_destruct(idx);
     bam_destroy1(aln);
     bam_hdr_destroy(bamHdr);
     sam_close(in);
     sam_close(out);
-    hts_tpool_destroy(threadPool.pool);
+    if (threadPool.pool != NULL) hts_tpool_destroy(threadPool.pool);
     free(chunkIdentifier);
     free(haplotaggedBamOutFile);
 }
@@ -1530,241 +2758,331 @@ uint32_t extractReadSubstringsAtVariantPositions(BamChunk *bamChunk, stList *vcf
     // prep
     int64_t chunkOverlapStart = bamChunk->chunkOverlapStart;
     int64_t chunkOverlapEnd = bamChunk->chunkOverlapEnd;
-    char *bamFile = bamChunk->parent->bamFile;
     char *contig = bamChunk->refSeqName;
     uint32_t savedAlignments = 0;
 
-    // prep for index (not entirely sure what all this does.  see samtools/sam_view.c
-    int filter_state = ALL, filter_op = 0;
+    // file initialization, reusing this thread's open bam files and indexes
     int result;
-    samview_settings_t settings = {.bed = NULL};
-    char *region[1] = {};
-    region[0] = stString_print("%s:%d-%d", bamChunk->refSeqName, bamChunk->chunkOverlapStart,
-                               bamChunk->chunkOverlapEnd);
-    settings.bed = bed_hash_regions(settings.bed, region, 0, 1,
-                                    &filter_op); //insert(1) or filter out(0) the regions from the command line in the same hash table as the bed file
-    if (!filter_op) filter_state = FILTERED;
-    int regcount = 0;
-    hts_reglist_t *reglist = bed_reglist(settings.bed, filter_state, &regcount);
-    if (!reglist) {
-        st_errAbort("ERROR: Could not create list of regions for read conversion");
-    }
-
-    // file initialization
-    samFile *in = NULL;
-    hts_idx_t *idx = NULL;
-    hts_itr_multi_t *iter = NULL;
-    // bam file
-    if ((in = hts_open(bamFile, "r")) == 0) {
-        st_errAbort("ERROR: Cannot open bam file %s\n", bamFile);
-    }
-    // bam index
-    if ((idx = sam_index_load(in, bamFile)) == 0) {
-        st_errAbort("ERROR: Cannot open index for bam file %s\n", bamFile);
-    }
-    // header  //todo samFile *in = hts_open(bamFile, "r");
-    bam_hdr_t *bamHdr = sam_hdr_read(in);
+    BamFileHandle *fileHandle = bamChunker_getFileHandle(bamChunk->parent);
     // read object
     bam1_t *aln = bam_init1();
-    // iterator for region
-    if ((iter = sam_itr_regions(idx, bamHdr, reglist, regcount)) == 0) {
-        st_errAbort("ERROR: Cannot open iterator for region %s for bam file %s\n", region[0], bamFile);
-    }
-
-    // fetch alignments //todo while(sam_read1(in,bamHdr,aln) > 0) {
-    while ((result = sam_itr_multi_next(in, iter, aln)) >= 0) {
-        bool filtered = FALSE;
-        // basic filtering (no read length, no cigar)
-        if (aln->core.l_qseq <= 0) continue;
-        if (aln->core.n_cigar == 0) continue;
-        if ((aln->core.flag & (uint16_t) 0x4) != 0)
-            continue; //unaligned
-        if (!polishParams->includeSecondaryAlignments && (aln->core.flag & (uint16_t) 0x100) != 0)
-            continue; //secondary
-        if (!polishParams->includeSupplementaryAlignments && (aln->core.flag & (uint16_t) 0x800) != 0)
-            continue; //supplementary
-        if (aln->core.qual < polishParams->filterAlignmentsWithMapQBelowThisThreshold) { //low mapping quality
-            if (filteredReads == NULL) continue;
-            filtered = TRUE;
-        }
-
-        // data
-        char *chr = bamHdr->target_name[aln->core.tid];
-        int64_t start_softclip = 0;
-        int64_t end_softclip = 0;
-        int64_t alnReadLength = getAlignedReadLength3(aln, &start_softclip, &end_softclip, FALSE);
-        if (alnReadLength <= 0) continue;
-        int64_t alnStartPos = aln->core.pos;
-        int64_t alnEndPos = alnStartPos + alnReadLength;
-
-        // does this belong in our chunk?
-        assert(stString_eq(contig, chr));
-        // excludes reads starting before nominal chunk start, and after chunk end
-        if (alnStartPos >= bamChunk->chunkEnd) continue;
-        if (alnEndPos <= bamChunk->chunkStart) continue;
-
-        // get read data
-        uint8_t *seqBits = bam_get_seq(aln);
-        char *readName = bam_get_qname(aln);
-        uint8_t *qualBits = bam_get_qual(aln);
-        bool forwardStrand = !bam_is_rev(aln);
-
-        // for vcf tracking at local level
-        // +1 because vcf->refPos is in 1-based space, and this reference position is in 0-based
-        int64_t nextVcfEntriesIndex = binarySearchVcfListForFirstIndexAtOrAfterRefPos(vcfEntries,
-                                                                                      alnStartPos - chunkOverlapStart +
-                                                                                      1);
-        if (nextVcfEntriesIndex == -1) continue; // all vcf entries are before this read's start
-        stHash *currentVcfEntries = stHash_construct(); // current vcf entries to read start pos
-        // the bcrves we will be populating with vcf substrings
-        BamChunkReadVcfEntrySubstrings *bcrves = bamChunkReadVcfEntrySubstrings_construct();
-        BamChunkRead *bcr = bamChunkRead_constructWithVcfEntrySubstrings(readName, forwardStrand, alnReadLength, bcrves);
-
-        // get cigar and rep
-        uint32_t *cigar = bam_get_cigar(aln);
-
-        // Variables to keep track of position in sequence / cigar operations
-        int64_t cig_idx = 0;
-        int64_t currPosInOp = 0;
-        int64_t cigarOp = -1;
-        int64_t cigarNum = -1;
-        int64_t cigarIdxInSeq = 0;
-        int64_t cigarIdxInRef = alnStartPos;
-
-        // positional modifications
-        int64_t refCigarModification = -1 * chunkOverlapStart;
-
-        // we need to calculate:
-        //  a. where in the (potentially softclipped read) to start storing characters
-        //  b. what the alignments are wrt those characters
-        // so we track the first aligned character in the read (for a.) and what alignment modification to make (for b.)
-        int64_t firstNonSoftclipAlignedReadIdxInChunk;
-
-        // the handling changes based on softclip inclusion and where the chunk boundaries are
-        if (alnStartPos < chunkOverlapStart) {
-            // alignment spans chunkStart
-            firstNonSoftclipAlignedReadIdxInChunk = -1;
-        } else {
-            // alignment starts after chunkStart
-            firstNonSoftclipAlignedReadIdxInChunk = 0;
-        }
 
-        // start with any vcf entries that may coincide with the beginning of the read
-        if (start_softclip == 0) {
-            saveStartingVcfEntries(vcfEntries, currentVcfEntries, &nextVcfEntriesIndex, cigarIdxInRef,
-                                   refCigarModification, firstNonSoftclipAlignedReadIdxInChunk,
-                                   cigarIdxInSeq, start_softclip);
-        }
-
-        // track number of characters in aligned portion (will inform softclipping at end of read)
-        int64_t alignedReadLength = 0;
+    // fetch alignments, from each of the bam files in turn
+    for (BamFileHandle *sourceHandle = fileHandle; sourceHandle != NULL; sourceHandle = sourceHandle->next) {
+        bam_hdr_t *bamHdr = sourceHandle->bamHdr;
+        // iterator for region
+        hts_itr_t *iter = bamChunk_getIterator(bamChunk, sourceHandle);
+        while ((result = sam_itr_next(sourceHandle->in, iter, aln)) >= 0) {
+            chunkTelemetry_addCount(CTC_BAM_BYTES, sizeof(bam1_core_t) + aln->l_data);
+            bool filtered = FALSE;
+            // basic filtering (no read length, no cigar)
+            if (aln->core.l_qseq <= 0) continue;
+            if (aln->core.n_cigar == 0) continue;
+            if ((aln->core.flag & (uint16_t) 0x4) != 0)
+                continue; //unaligned
+            if (!polishParams->includeSecondaryAlignments && (aln->core.flag & (uint16_t) 0x100) != 0)
+                continue; //secondary
+            if (!polishParams->includeSupplementaryAlignments && (aln->core.flag & (uint16_t) 0x800) != 0)
+                continue; //supplementary
+            if (aln->core.qual < polishParams->filterAlignmentsWithMapQBelowThisThreshold) { //low mapping quality
+                if (filteredReads == NULL) continue;
+                filtered = TRUE;
+            }
 
-        // iterate over cigar operations
-        for (uint32_t i = 0; i <= alnReadLength; i++) {
-            // handles cases where last alignment is an insert or last is match
-            if (cig_idx == aln->core.n_cigar) break;
+            // data
+            char *chr = bamHdr->target_name[aln->core.tid];
+            int64_t start_softclip = 0;
+            int64_t end_softclip = 0;
+            int64_t alnReadLength = getAlignedReadLength3(aln, &start_softclip, &end_softclip, FALSE);
+            if (alnReadLength <= 0) continue;
+            int64_t alnStartPos = aln->core.pos;
+            int64_t alnEndPos = alnStartPos + alnReadLength;
+
+            // does this belong in our chunk?
+            assert(stString_eq(contig, chr));
+            // excludes reads starting before nominal chunk start, and after chunk end
+            if (alnStartPos >= bamChunk->chunkEnd) continue;
+            if (alnEndPos <= bamChunk->chunkStart) continue;
+
+            // get read data
+            uint8_t *seqBits = bam_get_seq(aln);
+            char *readName = bam_get_qname(aln);
+            uint8_t *qualBits = bam_get_qual(aln);
+            bool forwardStrand = !bam_is_rev(aln);
+
+            // for vcf tracking at local level
+            // +1 because vcf->refPos is in 1-based space, and this reference position is in 0-based
+            int64_t nextVcfEntriesIndex = binarySearchVcfListForFirstIndexAtOrAfterRefPos(vcfEntries,
+                                                                                          alnStartPos -
+                                                                                          chunkOverlapStart + 1);
+            if (nextVcfEntriesIndex == -1) continue; // all vcf entries are before this read's start
+            stHash *currentVcfEntries = stHash_construct(); // current vcf entries to read start pos
+            // the bcrves we will be populating with vcf substrings
+            BamChunkReadVcfEntrySubstrings *bcrves = bamChunkReadVcfEntrySubstrings_construct();
+            BamChunkRead *bcr = bamChunkRead_constructWithVcfEntrySubstrings(readName, forwardStrand, alnReadLength,
+                                                                             bcrves);
+            bcr->source = sourceHandle->source;
+
+            // get cigar and rep
+            uint32_t *cigar = bam_get_cigar(aln);
+
+            // Variables to keep track of position in sequence / cigar operations
+            int64_t cig_idx = 0;
+            int64_t currPosInOp = 0;
+            int64_t cigarOp = -1;
+            int64_t cigarNum = -1;
+            int64_t cigarIdxInSeq = 0;
+            int64_t cigarIdxInRef = alnStartPos;
+
+            // positional modifications
+            int64_t refCigarModification = -1 * chunkOverlapStart;
+
+            // we need to calculate:
+            //  a. where in the (potentially softclipped read) to start storing characters
+            //  b. what the alignments are wrt those characters
+            // so we track the first aligned character in the read (for a.) and what alignment modification to make
+            // (for b.)
+            int64_t firstNonSoftclipAlignedReadIdxInChunk;
+
+            // the handling changes based on softclip inclusion and where the chunk boundaries are
+            if (alnStartPos < chunkOverlapStart) {
+                // alignment spans chunkStart
+                firstNonSoftclipAlignedReadIdxInChunk = -1;
+            } else {
+                // alignment starts after chunkStart
+                firstNonSoftclipAlignedReadIdxInChunk = 0;
+            }
 
-            // do we need the next cigar operation?
-            if (currPosInOp == 0) {
-                cigarOp = cigar[cig_idx] & BAM_CIGAR_MASK;
-                cigarNum = cigar[cig_idx] >> BAM_CIGAR_SHIFT;
+            // start with any vcf entries that may coincide with the beginning of the read
+            if (start_softclip == 0) {
+                saveStartingVcfEntries(vcfEntries, currentVcfEntries, &nextVcfEntriesIndex, cigarIdxInRef,
+                                       refCigarModification, firstNonSoftclipAlignedReadIdxInChunk,
+                                       cigarIdxInSeq, start_softclip);
             }
 
-            // handle current character
-            if (cigarOp == BAM_CMATCH || cigarOp == BAM_CEQUAL || cigarOp == BAM_CDIFF) {
-                if (cigarIdxInRef >= chunkOverlapStart && cigarIdxInRef < chunkOverlapEnd) {
-                    alignedReadLength++;
+            // track number of characters in aligned portion (will inform softclipping at end of read)
+            int64_t alignedReadLength = 0;
+
+            // iterate over cigar operations
+            for (uint32_t i = 0; i <= alnReadLength; i++) {
+                // handles cases where last alignment is an insert or last is match
+                if (cig_idx == aln->core.n_cigar) break;
+
+                // do we need the next cigar operation?
+                if (currPosInOp == 0) {
+                    cigarOp = cigar[cig_idx] & BAM_CIGAR_MASK;
+                    cigarNum = cigar[cig_idx] >> BAM_CIGAR_SHIFT;
                 }
-                cigarIdxInSeq++;
-                cigarIdxInRef++;
-            } else if (cigarOp == BAM_CDEL || cigarOp == BAM_CREF_SKIP) {
-                //delete
-                cigarIdxInRef++;
-            } else if (cigarOp == BAM_CINS) {
-                //insert
-                cigarIdxInSeq++;
-                if (cigarIdxInRef >= chunkOverlapStart && cigarIdxInRef < chunkOverlapEnd) {
-                    alignedReadLength++;
+
+                // handle current character
+                if (cigarOp == BAM_CMATCH || cigarOp == BAM_CEQUAL || cigarOp == BAM_CDIFF) {
+                    if (cigarIdxInRef >= chunkOverlapStart && cigarIdxInRef < chunkOverlapEnd) {
+                        alignedReadLength++;
+                    }
+                    cigarIdxInSeq++;
+                    cigarIdxInRef++;
+                } else if (cigarOp == BAM_CDEL || cigarOp == BAM_CREF_SKIP) {
+                    //delete
+                    cigarIdxInRef++;
+                } else if (cigarOp == BAM_CINS) {
+                    //insert
+                    cigarIdxInSeq++;
+                    if (cigarIdxInRef >= chunkOverlapStart && cigarIdxInRef < chunkOverlapEnd) {
+                        alignedReadLength++;
+                    }
+                    i--;
+                } else if (cigarOp == BAM_CSOFT_CLIP) {
+                    // nothing to do here. skip to next cigar operation
+                    currPosInOp = cigarNum - 1;
+                    i--;
+                } else if (cigarOp == BAM_CHARD_CLIP || cigarOp == BAM_CPAD) {
+                    // nothing to do here. skip to next cigar operation
+                    currPosInOp = cigarNum - 1;
+                    i--;
+                } else {
+                    st_logCritical("Unidentifiable cigar operation!\n");
                 }
-                i--;
-            } else if (cigarOp == BAM_CSOFT_CLIP) {
-                // nothing to do here. skip to next cigar operation
-                currPosInOp = cigarNum - 1;
-                i--;
-            } else if (cigarOp == BAM_CHARD_CLIP || cigarOp == BAM_CPAD) {
-                // nothing to do here. skip to next cigar operation
-                currPosInOp = cigarNum - 1;
-                i--;
-            } else {
-                st_logCritical("Unidentifiable cigar operation!\n");
-            }
 
-            // document read index in the chunk (for reads that span chunk boundary, used in read construction)
-            if (firstNonSoftclipAlignedReadIdxInChunk < 0 && cigarIdxInRef >= chunkOverlapStart) {
-                firstNonSoftclipAlignedReadIdxInChunk = cigarIdxInSeq;
-            }
+                // document read index in the chunk (for reads that span chunk boundary, used in read construction)
+                if (firstNonSoftclipAlignedReadIdxInChunk < 0 && cigarIdxInRef >= chunkOverlapStart) {
+                    firstNonSoftclipAlignedReadIdxInChunk = cigarIdxInSeq;
+                }
 
-            //  add new vcf entries
-            saveStartingVcfEntries(vcfEntries, currentVcfEntries, &nextVcfEntriesIndex, cigarIdxInRef,
-                    refCigarModification, firstNonSoftclipAlignedReadIdxInChunk, cigarIdxInSeq, start_softclip);
-            // remove old vcf entries
-            saveFinishedVcfEntries(currentVcfEntries, cigarIdxInRef + refCigarModification,
-                    cigarIdxInSeq, start_softclip, seqBits, qualBits, bcrves, FALSE);
-
-            // have we finished this last cigar
-            currPosInOp++;
-            if (currPosInOp == cigarNum) {
-                cig_idx++;
-                currPosInOp = 0;
+                //  add new vcf entries
+                saveStartingVcfEntries(vcfEntries, currentVcfEntries, &nextVcfEntriesIndex, cigarIdxInRef,
+                        refCigarModification, firstNonSoftclipAlignedReadIdxInChunk, cigarIdxInSeq, start_softclip);
+                // remove old vcf entries
+                saveFinishedVcfEntries(currentVcfEntries, cigarIdxInRef + refCigarModification,
+                        cigarIdxInSeq, start_softclip, seqBits, qualBits, bcrves, FALSE);
+
+                // have we finished this last cigar
+                currPosInOp++;
+                if (currPosInOp == cigarNum) {
+                    cig_idx++;
+                    currPosInOp = 0;
+                }
             }
-        }
 
-        // finish final vcf stuff
-        saveFinishedVcfEntries(currentVcfEntries, cigarIdxInRef + refCigarModification, cigarIdxInSeq, start_softclip,
-                seqBits, qualBits, bcrves, TRUE);
-        assert(stHash_size(currentVcfEntries) == 0);
+            // finish final vcf stuff
+            saveFinishedVcfEntries(currentVcfEntries, cigarIdxInRef + refCigarModification, cigarIdxInSeq,
+                    start_softclip, seqBits, qualBits, bcrves, TRUE);
+            assert(stHash_size(currentVcfEntries) == 0);
 
-        // save
-        stList_append(filtered ? filteredReads: reads, bcr);
+            // save
+            stList_append(filtered ? filteredReads: reads, bcr);
 
-        savedAlignments++;
+            savedAlignments++;
 
-        // cleanup
-        stHash_destruct(currentVcfEntries);
-    }
-    // the status from "get reads from iterator"
-    if (result < -1) {
-        st_errAbort("ERROR: Retrieval of region %d failed due to truncated file or corrupt BAM index file\n",
-                    iter->curr_tid);
+            // cleanup
+            stHash_destruct(currentVcfEntries);
+        }
+        // the status from "get reads from iterator"
+        if (result < -1) {
+            st_errAbort("ERROR: Retrieval of region %s:%"PRId64"-%"PRId64" failed due to truncated file or corrupt "
+                        "BAM index file\n", bamChunk->refSeqName, bamChunk->chunkOverlapStart,
+                        bamChunk->chunkOverlapEnd);
+        }
+        hts_itr_destroy(iter);
     }
 
     // close it all down
-    hts_itr_multi_destroy(iter);
-    hts_idx_destroy(idx);
-    free(region[0]);
-    bed_destroy(settings.bed);
-    bam_hdr_destroy(bamHdr);
     bam_destroy1(aln);
-    sam_close(in);
+    bamChunker_releaseFileHandle(bamChunk->parent, fileHandle);
 
     return savedAlignments;
 }
 
 
-char *getSequenceFromReference(char *fastaFile, char *contig, int64_t startPos, int64_t endPosExcl) {
+/*
+ * Process-wide cache of loaded fasta indices, with one slot per thread of the outermost parallel region, so that
+ * getSequenceFromReference loads the index once per thread rather than once per call.
+ */
+typedef struct _referenceCacheEntry {
+    char *fastaFile;
+    faidx_t *fai;
+} ReferenceCacheEntry;
+
+static ReferenceCacheEntry *referenceCache = NULL;
+static int64_t referenceCacheLength = 0;
+
+static faidx_t *referenceCache_loadFai(char *fastaFile) {
     faidx_t *fai = fai_load_format(fastaFile, FAI_FASTA);
     if ( !fai ) {
         st_errAbort("[faidx] Could not load fai index of %s\n", fastaFile);
     }
-    // the faidx api is 1 based, tolerates use of idx 0 (ignores it), and is inclusive
-    // this effectively makes it 0-based and exclusive
-    startPos++;
-    char *regionStr = stString_print("%s:%"PRId64"-%"PRId64, contig, startPos, endPosExcl);
+    return fai;
+}
+
+static ReferenceCacheEntry *referenceCache_getEntry() {
+    #pragma omp critical(referenceCache)
+    {
+        if (referenceCache == NULL) {
+            # ifdef _OPENMP
+            referenceCacheLength = omp_get_max_threads();
+            # else
+            referenceCacheLength = 1;
+            # endif
+            referenceCache = st_calloc(referenceCacheLength, sizeof(ReferenceCacheEntry));
+        }
+    }
+    int64_t threadNo = 0;
+    # ifdef _OPENMP
+    // As in bamChunker_getFileHandle, only the threads of the outermost parallel region use the cache
+    threadNo = omp_get_level() == 1 ? omp_get_thread_num() : -1;
+    # endif
+    return threadNo < 0 || threadNo >= referenceCacheLength ? NULL : &referenceCache[threadNo];
+}
+
+void referenceCache_destruct() {
+    for (int64_t i = 0; i < referenceCacheLength; i++) {
+        if (referenceCache[i].fai != NULL) {
+            fai_destroy(referenceCache[i].fai);
+            free(referenceCache[i].fastaFile);
+        }
+    }
+    free(referenceCache);
+    referenceCache = NULL;
+    referenceCacheLength = 0;
+}
+
+/*
+ * The upper-cased sequence of one contig kept by referenceCache_keepContig, which getSequenceFromReference reads
+ * rather than the fasta. It is only read, so it is shared by the threads.
+ */
+static char *keptReferenceFile = NULL;
+static char *keptReferenceContig = NULL;
+static char *keptReferenceSequence = NULL;
+static int64_t keptReferenceLength = 0;
+
+void referenceCache_keepContig(char *fastaFile, char *contig) {
+    if (keptReferenceSequence != NULL) {
+        free(keptReferenceFile);
+        free(keptReferenceContig);
+        free(keptReferenceSequence);
+        keptReferenceFile = NULL;
+        keptReferenceContig = NULL;
+        keptReferenceSequence = NULL;
+    }
+    // failing to keep it is left for getSequenceFromReference to report
+    faidx_t *fai = fai_load_format(fastaFile, FAI_FASTA);
+    if (fai == NULL) {
+        st_logCritical("> Could not load fai index of %s, not keeping contig %s\n", fastaFile, contig);
+        return;
+    }
+    int seqLen = faidx_seq_len(fai, contig);
+    if (seqLen < 0) {
+        st_logCritical("> Contig %s is not in %s, not keeping its sequence\n", contig, fastaFile);
+        fai_destroy(fai);
+        return;
+    }
+    keptReferenceSequence = faidx_fetch_seq(fai, contig, 0, seqLen - 1, &seqLen);
+    fai_destroy(fai);
+    if (keptReferenceSequence == NULL) {
+        st_logCritical("> Could not fetch %s from %s, not keeping it\n", contig, fastaFile);
+        return;
+    }
+    for (int i = 0; i < seqLen; i++) {
+        keptReferenceSequence[i] = (char) toupper(keptReferenceSequence[i]);
+    }
+    keptReferenceLength = seqLen;
+    keptReferenceFile = stString_copy(fastaFile);
+    keptReferenceContig = stString_copy(contig);
+}
+
+char *getSequenceFromReference(char *fastaFile, char *contig, int64_t startPos, int64_t endPosExcl) {
+    // the kept contig needs no index
+    if (keptReferenceSequence != NULL && stString_eq(keptReferenceContig, contig) &&
+            stString_eq(keptReferenceFile, fastaFile) && startPos >= 0 && startPos <= endPosExcl &&
+            endPosExcl <= keptReferenceLength) {
+        return stString_getSubString(keptReferenceSequence, startPos, endPosExcl - startPos);
+    }
+
+    // get this thread's index, loading it if this thread has not used this reference before
+    ReferenceCacheEntry *entry = referenceCache_getEntry();
+    faidx_t *fai;
+    if (entry == NULL) {
+        fai = referenceCache_loadFai(fastaFile);
+    } else {
+        if (entry->fai == NULL || !stString_eq(entry->fastaFile, fastaFile)) {
+            if (entry->fai != NULL) {
+                fai_destroy(entry->fai);
+                free(entry->fastaFile);
+            }
+            entry->fai = referenceCache_loadFai(fastaFile);
+            entry->fastaFile = stString_copy(fastaFile);
+        }
+        fai = entry->fai;
+    }
+
+    // the faidx api is 0 based and exclusive of the end
     int seqLen;
-    char *seq = fai_fetch(fai, regionStr, &seqLen);
+    char *seq = faidx_fetch_seq(fai, contig, (int) startPos, (int) endPosExcl - 1, &seqLen);
+    if (seq == NULL) {
+        st_errAbort("ERROR: Could not fetch %s:%"PRId64"-%"PRId64" from %s\n", contig, startPos, endPosExcl, fastaFile);
+    }
 
     // sanity check
-    assert(seqLen == endPosExcl - startPos + 1); // this sequence is 1-based (but tolerates idx 0)
+    assert(seqLen == endPosExcl - startPos);
     assert(seqLen == strlen(seq)); // seq len returns size of seq w/ \0-termination
 
     // convert to upper
@@ -1773,7 +3091,1037 @@ char *getSequenceFromReference(char *fastaFile, char *contig, int64_t startPos,
     }
 
     // close and return
-    free(regionStr);
-    fai_destroy(fai);
+    if (entry == NULL) {
+        fai_destroy(fai);
+    }
     return seq;
 }
+
+
+/*
+ * Chunk prefetching
+ */
+
+enum ChunkPrefetchState {
+    CPS_QUEUED, // Not yet loaded
+    CPS_LOADING, // Being loaded by an I/O thread
+    CPS_LOADED, // Loaded by an I/O thread, waiting to be taken
+    CPS_TAKEN // Taken, or being loaded, by the thread processing the chunk
+};
+
+typedef struct _chunkPrefetchSlot {
+    ChunkPrefetcher *prefetcher;
+    int64_t i;
+    enum ChunkPrefetchState state;
+    void *chunk;
+    int64_t telemetryCounts[CTC_COUNTS]; // counted loading the chunk, for the thread that takes it
+} ChunkPrefetchSlot;
+
+struct _chunkPrefetcher {
+    int64_t chunkNo;
+    int64_t depth;
+    void *(*loadChunk)(int64_t i, void *extraArg);
+    void *extraArg;
+    ChunkPrefetchSlot *slots;
+    hts_tpool *pool;
+    hts_tpool_process *queue;
+    pthread_mutex_t mutex;
+    pthread_cond_t loaded;
+};
+
+static void *chunkPrefetcher_loadJob(void *arg) {
+    ChunkPrefetchSlot *slot = arg;
+    ChunkPrefetcher *prefetcher = slot->prefetcher;
+
+    // don't load chunks which have already been taken
+    pthread_mutex_lock(&prefetcher->mutex);
+    bool load = slot->state == CPS_QUEUED;
+    if (load) slot->state = CPS_LOADING;
+    pthread_mutex_unlock(&prefetcher->mutex);
+    if (!load) return NULL;
+
+    chunkTelemetry_captureCounts(slot->telemetryCounts);
+    void *chunk = prefetcher->loadChunk(slot->i, prefetcher->extraArg);
+    chunkTelemetry_captureCounts(NULL);
+
+    pthread_mutex_lock(&prefetcher->mutex);
+    slot->chunk = chunk;
+    slot->state = CPS_LOADED;
+    pthread_cond_broadcast(&prefetcher->loaded);
+    pthread_mutex_unlock(&prefetcher->mutex);
+    return NULL;
+}
+
+static void chunkPrefetcher_dispatch(ChunkPrefetcher *prefetcher, int64_t i) {
+    // if the queue is full the chunk is left to be loaded by the thread that takes it
+    if (i < prefetcher->chunkNo) {
+        hts_tpool_dispatch2(prefetcher->pool, prefetcher->queue, chunkPrefetcher_loadJob, &prefetcher->slots[i], 1);
+    }
+}
+
+ChunkPrefetcher *chunkPrefetcher_construct(int64_t chunkNo, int64_t threadNo, int64_t depth,
+                                           void *(*loadChunk)(int64_t i, void *extraArg), void *extraArg) {
+    ChunkPrefetcher *prefetcher = st_calloc(1, sizeof(ChunkPrefetcher));
+    prefetcher->chunkNo = chunkNo;
+    prefetcher->depth = depth;
+    prefetcher->loadChunk = loadChunk;
+    prefetcher->extraArg = extraArg;
+    # ifndef _OPENMP
+    threadNo = 0; // the per thread bam handles and reference cache assume that only one thread reads without OpenMP
+    # endif
+    if (threadNo <= 0 || depth <= 0) {
+        return prefetcher;
+    }
+
+    prefetcher->slots = st_calloc(chunkNo, sizeof(ChunkPrefetchSlot));
+    for (int64_t i = 0; i < chunkNo; i++) {
+        prefetcher->slots[i].prefetcher = prefetcher;
+        prefetcher->slots[i].i = i;
+        prefetcher->slots[i].state = CPS_QUEUED;
+    }
+    pthread_mutex_init(&prefetcher->mutex, NULL);
+    pthread_cond_init(&prefetcher->loaded, NULL);
+    if ((prefetcher->pool = hts_tpool_init((int) threadNo)) == NULL ||
+        (prefetcher->queue = hts_tpool_process_init(prefetcher->pool, (int) (2 * depth), 1)) == NULL) {
+        st_errAbort("ERROR: Could not create the thread pool for prefetching chunks\n");
+    }
+
+    // start loading the first chunks
+    for (int64_t i = 0; i < depth; i++) {
+        chunkPrefetcher_dispatch(prefetcher, i);
+    }
+    return prefetcher;
+}
+
+void *chunkPrefetcher_getChunk(ChunkPrefetcher *prefetcher, int64_t i) {
+    if (prefetcher->pool == NULL) {
+        return prefetcher->loadChunk(i, prefetcher->extraArg);
+    }
+
+    // keep depth chunks ahead of the chunks being processed
+    chunkPrefetcher_dispatch(prefetcher, i + prefetcher->depth);
+
+    // take the chunk, waiting for it if it is being loaded
+    ChunkPrefetchSlot *slot = &prefetcher->slots[i];
+    pthread_mutex_lock(&prefetcher->mutex);
+    while (slot->state == CPS_LOADING) {
+        pthread_cond_wait(&prefetcher->loaded, &prefetcher->mutex);
+    }
+    enum ChunkPrefetchState state = slot->state;
+    slot->state = CPS_TAKEN;
+    void *chunk = slot->chunk;
+    slot->chunk = NULL;
+    pthread_mutex_unlock(&prefetcher->mutex);
+
+    // not prefetched, so load it here
+    if (state == CPS_QUEUED) {
+        chunk = prefetcher->loadChunk(i, prefetcher->extraArg);
+    } else {
+        chunkTelemetry_addCounts(slot->telemetryCounts);
+    }
+    assert(state != CPS_TAKEN);
+    return chunk;
+}
+
+void chunkPrefetcher_destruct(ChunkPrefetcher *prefetcher) {
+    if (prefetcher->pool != NULL) {
+        // all chunks have been taken, so any jobs left in the queue do nothing
+        hts_tpool_process_flush(prefetcher->queue);
+        hts_tpool_process_destroy(prefetcher->queue);
+        hts_tpool_destroy(prefetcher->pool);
+        pthread_mutex_destroy(&prefetcher->mutex);
+        pthread_cond_destroy(&prefetcher->loaded);
+        free(prefetcher->slots);
+    }
+    free(prefetcher);
+}
+
+
+/*
+ * Single pass bam streaming
+ */
+
+BamChunkReads *bamChunkReads_construct(RleString *rleReference) {
+    BamChunkReads *chunkReads = st_malloc(sizeof(BamChunkReads));
+    chunkReads->rleReference = rleReference;
+    // without run length encoding the map is not used, so is not built
+    chunkReads->rleReferenceCoordinateMap = rleReference != NULL && rleReference->repeatCounts != NULL ?
+                                            rleString_getNonRleToRleCoordinateMap(rleReference) : NULL;
+    chunkReads->reads = stList_construct3(0, (void (*)(void *)) bamChunkRead_destruct);
+    chunkReads->alignments = stList_construct3(0, (void (*)(void *)) stList_destruct);
+    chunkReads->filteredReads = stList_construct3(0, (void (*)(void *)) bamChunkRead_destruct);
+    chunkReads->filteredAlignments = stList_construct3(0, (void (*)(void *)) stList_destruct);
+    chunkReads->downsampled = FALSE;
+    return chunkReads;
+}
+
+void bamChunkReads_destruct(BamChunkReads *chunkReads) {
+    if (chunkReads->rleReference != NULL) rleString_destruct(chunkReads->rleReference);
+    if (chunkReads->rleReferenceCoordinateMap != NULL) free(chunkReads->rleReferenceCoordinateMap);
+    stList_destruct(chunkReads->reads);
+    stList_destruct(chunkReads->alignments);
+    stList_destruct(chunkReads->filteredReads);
+    stList_destruct(chunkReads->filteredAlignments);
+    free(chunkReads);
+}
+
+BamChunkReads *bamChunkReads_constructFromAlignedReads(BamChunk *bamChunk, RleString *rleReference,
+                                                       AlignedRead *alignedReads, int64_t alignedReadNo,
+                                                       bool withFilteredReads, PolishParams *polishParams) {
+    allocProfile_scope(APT_IO);
+    // a header with just the chunk's contig, of unknown length, to parse the reads' records with
+    char *headerText = stString_print("@SQ\tSN:%s\tLN:%d\n", bamChunk->refSeqName, INT32_MAX);
+    bam_hdr_t *bamHdr = sam_hdr_parse(strlen(headerText), headerText);
+    if (bamHdr == NULL) {
+        st_logCritical("> Could not make a header for contig %s\n", bamChunk->refSeqName);
+        free(headerText);
+        return NULL;
+    }
+    BamChunkReads *chunkReads = bamChunkReads_construct(rleReference);
+
+    // each read is converted from its sam record, as if it were read from a bam file
+    bam1_t *aln = bam_init1();
+    kstring_t line = {0, 0, NULL};
+    for (int64_t i = 0; i < alignedReadNo; i++) {
+        AlignedRead *r = &alignedReads[i];
+        uint16_t flag = (r->forwardStrand ? 0 : 0x10) | (r->secondary ? 0x100 : 0) | (r->supplementary ? 0x800 : 0);
+        line.l = 0;
+        ksprintf(&line, "%s\t%d\t%s\t%"PRId64"\t%d\t%s\t*\t0\t0\t%s\t", r->readName, (int) flag,
+                 bamChunk->refSeqName, r->refStart + 1, (int) r->mapQ, r->cigar, r->nucleotides);
+        if (r->qualities == NULL) {
+            kputc('*', &line);
+        } else {
+            for (int64_t j = 0; r->nucleotides[j] != '\0'; j++) {
+                kputc((char) (r->qualities[j] + 33), &line);
+            }
+        }
+        if (sam_parse1(&line, bamHdr, aln) < 0) {
+            // such as a malformed CIGAR, or one whose length differs from the read's, which is the caller's to report
+            st_logCritical("> Could not parse the alignment of read %s\n", r->readName);
+            chunkReads->rleReference = NULL; // the reference is left with the caller
+            bamChunkReads_destruct(chunkReads);
+            chunkReads = NULL;
+            break;
+        }
+        bamChunk_convertAlignment(bamChunk, aln, bamHdr, 0, chunkReads->rleReferenceCoordinateMap, chunkReads->reads,
+                                  chunkReads->alignments, withFilteredReads ? chunkReads->filteredReads : NULL,
+                                  withFilteredReads ? chunkReads->filteredAlignments : NULL, polishParams);
+    }
+
+    // cleanup
+    free(line.s);
+    bam_destroy1(aln);
+    bam_hdr_destroy(bamHdr);
+    free(headerText);
+    return chunkReads;
+}
+
+typedef struct _bamChunkStreamEntry {
+    BamChunk *bamChunk;
+    int64_t tid; // of the chunk's contig in the bam header, -1 if it has no alignments
+    BamChunkReads *chunkReads; // NULL until the chunk is opened
+    ReadReservoir *reservoir; // the chunk's alignments, from when it is opened until it is complete
+    bool complete;
+} BamChunkStreamEntry;
+
+struct _bamChunkStream {
+    BamChunker *bamChunker;
+    char *referenceFile;
+    Params *params;
+    bool withFilteredReads;
+    samFile *in;
+    bam_hdr_t *bamHdr;
+    bam1_t *aln;
+    int64_t lastTid;
+    int64_t lastPos;
+    int64_t chunkNo;
+    BamChunkStreamEntry *entries;
+    int64_t firstIncomplete; // chunks before this are complete
+    int64_t nextToOpen; // chunks from this on have not been opened
+    pthread_mutex_t mutex;
+};
+
+static int64_t bamChunkStreamEntry_tid(bam_hdr_t *bamHdr, BamChunk *bamChunk) {
+    int tid = bam_name2id(bamHdr, bamChunk->refSeqName);
+    return tid < 0 ? -1 : tid;
+}
+
+static int bamChunkStreamEntry_cmp(const void *a, const void *b, const void *extraArg) {
+    // chunks of contigs missing from the header come first, then by position in the file
+    BamChunkStream *stream = (BamChunkStream *) extraArg;
+    BamChunk *chunkA = bamChunker_getChunk(stream->bamChunker, stIntTuple_get((stIntTuple *) a, 0));
+    BamChunk *chunkB = bamChunker_getChunk(stream->bamChunker, stIntTuple_get((stIntTuple *) b, 0));
+    int64_t tidA = bamChunkStreamEntry_tid(stream->bamHdr, chunkA);
+    int64_t tidB = bamChunkStreamEntry_tid(stream->bamHdr, chunkB);
+    if (tidA != tidB) return tidA < tidB ? -1 : 1;
+    if (chunkA->chunkOverlapStart != chunkB->chunkOverlapStart)
+        return chunkA->chunkOverlapStart < chunkB->chunkOverlapStart ? -1 : 1;
+    return chunkA->chunkOverlapEnd < chunkB->chunkOverlapEnd ? -1 : (chunkA->chunkOverlapEnd > chunkB->chunkOverlapEnd ? 1 : 0);
+}
+
+BamChunkStream *bamChunkStream_construct(BamChunker *bamChunker, stList *chunkOrder, char *referenceFile,
+                                         Params *params, bool withFilteredReads) {
+    BamChunkStream *stream = st_calloc(1, sizeof(BamChunkStream));
+    stream->bamChunker = bamChunker;
+    stream->referenceFile = referenceFile;
+    stream->params = params;
+    stream->withFilteredReads = withFilteredReads;
+    stream->lastTid = -1;
+    stream->lastPos = -1;
+
+    // bam file, no index is needed
+    if ((stream->in = hts_open(bamChunker->bamFile, "r")) == 0) {
+        st_errAbort("ERROR: Cannot open bam file %s\n", bamChunker->bamFile);
+    }
+    htsThreadPool *threadPool = getHtsThreadPool(bamChunker->params);
+    if (threadPool != NULL) {
+        hts_set_opt(stream->in, HTS_OPT_THREAD_POOL, threadPool);
+    }
+    if (bamChunker->cramReferenceFile != NULL && hts_get_format(stream->in)->format == cram) {
+        if (hts_set_fai_filename(stream->in, bamChunker->cramReferenceFile) != 0) {
+            st_errAbort("ERROR: Cannot use reference %s for cram file %s\n", bamChunker->cramReferenceFile,
+                        bamChunker->bamFile);
+        }
+    }
+    if ((stream->bamHdr = sam_hdr_read(stream->in)) == NULL) {
+        st_errAbort("ERROR: Cannot read header of bam file %s\n", bamChunker->bamFile);
+    }
+    stream->aln = bam_init1();
+
+    // chunks are taken in file order
+    stList_sort2(chunkOrder, bamChunkStreamEntry_cmp, stream);
+    stream->chunkNo = stList_length(chunkOrder);
+    stream->entries = st_calloc(stream->chunkNo, sizeof(BamChunkStreamEntry));
+    for (int64_t i = 0; i < stream->chunkNo; i++) {
+        BamChunkStreamEntry *entry = &stream->entries[i];
+        entry->bamChunk = bamChunker_getChunk(bamChunker, stIntTuple_get(stList_get(chunkOrder, i), 0));
+        entry->tid = bamChunkStreamEntry_tid(stream->bamHdr, entry->bamChunk);
+    }
+    pthread_mutex_init(&stream->mutex, NULL);
+    return stream;
+}
+
+static void bamChunkStream_openEntry(BamChunkStream *stream, BamChunkStreamEntry *entry) {
+    RleString *rleReference = bamChunk_getReferenceSubstring(entry->bamChunk, stream->referenceFile, stream->params);
+    entry->chunkReads = bamChunkReads_construct(rleReference);
+    entry->reservoir = readReservoir_construct(entry->bamChunk, FALSE, stream->params->polishParams);
+}
+
+static void bamChunkStream_completeEntry(BamChunkStream *stream, BamChunkStreamEntry *entry) {
+    if (entry->chunkReads == NULL) {
+        bamChunkStream_openEntry(stream, entry);
+    }
+    BamChunkReads *chunkReads = entry->chunkReads;
+    readReservoir_convert(entry->reservoir, NULL, chunkReads->rleReferenceCoordinateMap, chunkReads->reads,
+                          chunkReads->alignments, stream->withFilteredReads ? chunkReads->filteredReads : NULL,
+                          stream->withFilteredReads ? chunkReads->filteredAlignments : NULL,
+                          stream->params->polishParams);
+    readReservoir_destruct(entry->reservoir);
+    entry->reservoir = NULL;
+    entry->complete = TRUE;
+}
+
+static void bamChunkStream_readAlignment(BamChunkStream *stream) {
+    // get the next alignment
+    int result = sam_read1(stream->in, stream->bamHdr, stream->aln);
+    if (result < -1) {
+        st_errAbort("ERROR: Reading bam file %s failed due to truncated or corrupt file\n", stream->bamChunker->bamFile);
+    }
+    if (result >= 0) {
+        chunkTelemetry_addCount(CTC_BAM_BYTES, sizeof(bam1_core_t) + stream->aln->l_data);
+    }
+    if (result == -1) {
+        // end of file, so all chunks are complete
+        for (; stream->firstIncomplete < stream->chunkNo; stream->firstIncomplete++) {
+            bamChunkStream_completeEntry(stream, &stream->entries[stream->firstIncomplete]);
+        }
+        return;
+    }
+
+    // unplaced reads are sorted to the end of the file, past all chunks
+    bam1_t *aln = stream->aln;
+    int64_t tid = aln->core.tid;
+    int64_t pos = aln->core.pos;
+    if (tid < 0) tid = INT64_MAX;
+    if (tid < stream->lastTid || (tid == stream->lastTid && pos < stream->lastPos)) {
+        st_errAbort("ERROR: Streamed bam file %s is not sorted by coordinate (at read %s)\n",
+                    stream->bamChunker->bamFile, bam_get_qname(aln));
+    }
+    stream->lastTid = tid;
+    stream->lastPos = pos;
+    // the interval the index would test for overlap with a chunk
+    int64_t end = pos + (aln->core.n_cigar > 0 ? bam_cigar2rlen(aln->core.n_cigar, bam_get_cigar(aln)) : 1);
+
+    // complete the chunks the stream has passed, as no later alignment can overlap them
+    while (stream->firstIncomplete < stream->chunkNo) {
+        BamChunkStreamEntry *entry = &stream->entries[stream->firstIncomplete];
+        if (entry->tid >= 0 && entry->tid == tid && pos < entry->bamChunk->chunkOverlapEnd) break;
+        if (entry->tid > tid) break;
+        bamChunkStream_completeEntry(stream, entry);
+        stream->firstIncomplete++;
+    }
+    if (stream->nextToOpen < stream->firstIncomplete) {
+        stream->nextToOpen = stream->firstIncomplete;
+    }
+
+    // open the chunks the alignment may overlap
+    while (stream->nextToOpen < stream->chunkNo) {
+        BamChunkStreamEntry *entry = &stream->entries[stream->nextToOpen];
+        int64_t chunkBeg = entry->bamChunk->chunkOverlapStart > 0 ? entry->bamChunk->chunkOverlapStart - 1 : 0;
+        if (entry->tid > tid || (entry->tid == tid && chunkBeg >= end)) break;
+        bamChunkStream_openEntry(stream, entry);
+        stream->nextToOpen++;
+    }
+
+    // save the alignment in each open chunk it overlaps
+    for (int64_t i = stream->firstIncomplete; i < stream->nextToOpen; i++) {
+        BamChunkStreamEntry *entry = &stream->entries[i];
+        int64_t chunkBeg = entry->bamChunk->chunkOverlapStart > 0 ? entry->bamChunk->chunkOverlapStart - 1 : 0;
+        if (entry->complete || entry->tid != tid || pos >= entry->bamChunk->chunkOverlapEnd || end <= chunkBeg) {
+            continue;
+        }
+        readReservoir_offerAlignment(entry->reservoir, aln, stream->bamHdr, 0, stream->withFilteredReads,
+                                     stream->params->polishParams);
+    }
+}
+
+BamChunkReads *bamChunkStream_getChunk(BamChunkStream *stream, int64_t i) {
+    assert(i >= 0 && i < stream->chunkNo);
+    pthread_mutex_lock(&stream->mutex);
+    BamChunkStreamEntry *entry = &stream->entries[i];
+    while (!entry->complete) {
+        bamChunkStream_readAlignment(stream);
+    }
+    BamChunkReads *chunkReads = entry->chunkReads;
+    entry->chunkReads = NULL;
+    pthread_mutex_unlock(&stream->mutex);
+    assert(chunkReads != NULL);
+    return chunkReads;
+}
+
+void bamChunkStream_destruct(BamChunkStream *stream) {
+    for (int64_t i = 0; i < stream->chunkNo; i++) {
+        BamChunkStreamEntry *entry = &stream->entries[i];
+        if (entry->chunkReads != NULL) {
+            bamChunkReads_destruct(entry->chunkReads);
+        }
+        if (entry->reservoir != NULL) {
+            readReservoir_destruct(entry->reservoir);
+        }
+    }
+    free(stream->entries);
+    pthread_mutex_destroy(&stream->mutex);
+    bam_destroy1(stream->aln);
+    bam_hdr_destroy(stream->bamHdr);
+    sam_close(stream->in);
+    free(stream);
+}
+
+typedef struct _bamChunkGroup {
+    int64_t first, length; // The positions of the group's chunks in the chunk order
+    BamChunkReads **chunkReads; // NULL until the group is loaded
+    pthread_mutex_t mutex;
+} BamChunkGroup;
+
+struct _bamChunkGroups {
+    BamChunker *bamChunker;
+    stList *chunkOrder;
+    char *referenceFile;
+    Params *params;
+    bool withFilteredReads;
+    int64_t *groupOfPosition; // The group of each position of the chunk order, -1 if it is not in a group
+    BamChunkGroup *groups;
+    int64_t groupNo;
+};
+
+BamChunkGroups *bamChunkGroups_construct(BamChunker *bamChunker, stList *chunkOrder, uint64_t maxGroupLength,
+                                         char *referenceFile, Params *params, bool withFilteredReads) {
+    BamChunkGroups *groups = st_calloc(1, sizeof(BamChunkGroups));
+    groups->bamChunker = bamChunker;
+    groups->chunkOrder = chunkOrder;
+    groups->referenceFile = referenceFile;
+    groups->params = params;
+    groups->withFilteredReads = withFilteredReads;
+    int64_t chunkNo = stList_length(chunkOrder);
+    groups->groupOfPosition = st_malloc(chunkNo * sizeof(int64_t));
+    groups->groups = st_calloc(chunkNo, sizeof(BamChunkGroup));
+
+    // runs of small chunks, split when they reach the group length
+    int64_t groupedChunkNo = 0;
+    BamChunkGroup *group = NULL;
+    uint64_t groupLength = 0;
+    for (int64_t i = 0; i < chunkNo; i++) {
+        BamChunk *bamChunk = bamChunker_getChunk(bamChunker, stIntTuple_get(stList_get(chunkOrder, i), 0));
+        uint64_t length = (uint64_t) (bamChunk->chunkOverlapEnd - bamChunk->chunkOverlapStart);
+        groups->groupOfPosition[i] = -1;
+        if (4 * length > maxGroupLength) {
+            group = NULL;
+            continue;
+        }
+        if (group == NULL || groupLength + length > maxGroupLength) {
+            group = &groups->groups[groups->groupNo++];
+            group->first = i;
+            pthread_mutex_init(&group->mutex, NULL);
+            groupLength = 0;
+        }
+        group->length++;
+        groupLength += length;
+        groups->groupOfPosition[i] = groups->groupNo - 1;
+        groupedChunkNo++;
+    }
+    st_logCritical("> Loading %"PRId64" small chunks in %"PRId64" groups of up to %"PRIu64" bases\n", groupedChunkNo,
+                   groups->groupNo, maxGroupLength);
+    return groups;
+}
+
+static void bamChunkGroup_load(BamChunkGroups *groups, BamChunkGroup *group) {
+    /*
+     * Loads the reads of each chunk of the group with one iterator over the regions of all of them.
+     */
+    traceRecorder_begin("bamChunkGroup_load");
+    BamChunk **bamChunks = st_malloc(group->length * sizeof(BamChunk *));
+    int64_t *tids = st_malloc(group->length * sizeof(int64_t));
+    char **regions = st_malloc(group->length * sizeof(char *));
+    group->chunkReads = st_malloc(group->length * sizeof(BamChunkReads *));
+    ReadReservoir **reservoirs = st_malloc(group->length * sizeof(ReadReservoir *));
+
+    // the references, and the regions of the chunks as they are queried one by one
+    BamFileHandle *fileHandle = bamChunker_getFileHandle(groups->bamChunker);
+    int64_t regionNo = 0;
+    for (int64_t j = 0; j < group->length; j++) {
+        BamChunk *bamChunk = bamChunker_getChunk(groups->bamChunker,
+                                                 stIntTuple_get(stList_get(groups->chunkOrder, group->first + j), 0));
+        bamChunks[j] = bamChunk;
+        RleString *rleReference = bamChunk_getReferenceSubstring(bamChunk, groups->referenceFile, groups->params);
+        group->chunkReads[j] = bamChunkReads_construct(rleReference);
+        reservoirs[j] = readReservoir_construct(bamChunk, FALSE, groups->params->polishParams);
+        tids[j] = bam_name2id(fileHandle->bamHdr, bamChunk->refSeqName);
+        if (tids[j] >= 0) {
+            regions[regionNo++] = stString_print("%s:%"PRId64"-%"PRId64, bamChunk->refSeqName,
+                                                 bamChunk->chunkOverlapStart, bamChunk->chunkOverlapEnd);
+        }
+    }
+
+    // each alignment is converted for every chunk of its contig it belongs in
+    if (regionNo > 0) {
+        int filter_state = ALL, filter_op = 0;
+        samview_settings_t settings = {.bed = NULL};
+        settings.bed = bed_hash_regions(settings.bed, regions, 0, regionNo, &filter_op);
+        if (!filter_op) filter_state = FILTERED;
+        int regcount = 0;
+        hts_reglist_t *reglist = bed_reglist(settings.bed, filter_state, &regcount);
+        if (!reglist) {
+            st_errAbort("ERROR: Could not create list of regions for a group of chunks");
+        }
+        hts_itr_t *iter = sam_itr_regions(fileHandle->idx, fileHandle->bamHdr, reglist, regcount);
+        if (iter == NULL) {
+            st_errAbort("ERROR: Cannot open iterator for the regions of %"PRId64" chunks starting with %s for bam "
+                        "file %s\n", regionNo, regions[0], groups->bamChunker->bamFile);
+        }
+        bam1_t *aln = bam_init1();
+        int result;
+        while ((result = sam_itr_next(fileHandle->in, iter, aln)) >= 0) {
+            chunkTelemetry_addCount(CTC_BAM_BYTES, sizeof(bam1_core_t) + aln->l_data);
+            for (int64_t j = 0; j < group->length; j++) {
+                if (tids[j] != aln->core.tid) {
+                    continue;
+                }
+                readReservoir_offerAlignment(reservoirs[j], aln, fileHandle->bamHdr, fileHandle->source,
+                                             groups->withFilteredReads, groups->params->polishParams);
+            }
+        }
+        if (result < -1) {
+            st_errAbort("ERROR: Retrieval of the regions of %"PRId64" chunks starting with %s failed due to truncated "
+                        "file or corrupt BAM index file\n", regionNo, regions[0]);
+        }
+        bam_destroy1(aln);
+        hts_itr_multi_destroy(iter);
+        bed_destroy(settings.bed);
+    }
+
+    // decode the kept reads of each chunk
+    for (int64_t j = 0; j < group->length; j++) {
+        BamChunkReads *chunkReads = group->chunkReads[j];
+        readReservoir_convert(reservoirs[j], NULL, chunkReads->rleReferenceCoordinateMap, chunkReads->reads,
+                              chunkReads->alignments, groups->withFilteredReads ? chunkReads->filteredReads : NULL,
+                              groups->withFilteredReads ? chunkReads->filteredAlignments : NULL,
+                              groups->params->polishParams);
+        readReservoir_destruct(reservoirs[j]);
+    }
+
+    // Cleanup
+    bamChunker_releaseFileHandle(groups->bamChunker, fileHandle);
+    for (int64_t j = 0; j < regionNo; j++) {
+        free(regions[j]);
+    }
+    free(regions);
+    free(tids);
+    free(reservoirs);
+    free(bamChunks);
+    traceRecorder_end("bamChunkGroup_load");
+}
+
+BamChunkReads *bamChunkGroups_getChunk(BamChunkGroups *groups, int64_t i) {
+    if (groups->groupOfPosition[i] < 0) {
+        return NULL;
+    }
+    BamChunkGroup *group = &groups->groups[groups->groupOfPosition[i]];
+    pthread_mutex_lock(&group->mutex);
+    if (group->chunkReads == NULL) {
+        bamChunkGroup_load(groups, group);
+    }
+    BamChunkReads *chunkReads = group->chunkReads[i - group->first];
+    group->chunkReads[i - group->first] = NULL;
+    pthread_mutex_unlock(&group->mutex);
+    assert(chunkReads != NULL);
+    return chunkReads;
+}
+
+void bamChunkGroups_destruct(BamChunkGroups *groups) {
+    for (int64_t g = 0; g < groups->groupNo; g++) {
+        BamChunkGroup *group = &groups->groups[g];
+        if (group->chunkReads != NULL) {
+            for (int64_t j = 0; j < group->length; j++) {
+                BamChunkReads *chunkReads = group->chunkReads[j];
+                if (chunkReads != NULL) {
+                    bamChunkReads_destruct(chunkReads);
+                }
+            }
+            free(group->chunkReads);
+        }
+        pthread_mutex_destroy(&group->mutex);
+    }
+    free(groups->groups);
+    free(groups->groupOfPosition);
+    free(groups);
+}
+
+
+/*
+ * Chunk scheduling
+ */
+
+#define CHUNK_COST_FEATURES 3
+#define CHUNK_COST_FIRST_REFIT 8
+#define CHUNK_PROGRESS_WORK_SCALE 1.0e6 // Fixed point scale of the chunks' estimated work, so it can be counted atomically
+
+// The initial cost model, which is also the estimated work of a chunk for the progress reports
+static const double chunkScheduler_initialWeights[CHUNK_COST_FEATURES] = {1.0, 0.1, 0.0};
+
+typedef struct _chunkQueue {
+    stList *positions; // into the chunk order, sorted so the longest predicted chunk is last
+    double remainingCost;
+    int64_t generation; // of the cost model the queue was last sorted with
+    pthread_mutex_t mutex;
+} ChunkQueue;
+
+struct _chunkScheduler {
+    int64_t chunkNo;
+    bool predictCost;
+    double *features; // CHUNK_COST_FEATURES for each position, normalized by their means
+    double *startTimes;
+    ChunkQueue *queues;
+    int64_t queueNo;
+    // the cost model, a ridge regression (towards the initial model) of the seconds taken by chunks on their features
+    pthread_mutex_t modelMutex;
+    double weights[CHUNK_COST_FEATURES];
+    double xtx[CHUNK_COST_FEATURES][CHUNK_COST_FEATURES];
+    double xty[CHUNK_COST_FEATURES];
+    int64_t finishedNo;
+    int64_t nextRefit;
+    int64_t generation;
+    // the memory budget, if maxMemory is non-zero
+    uint64_t maxMemory;
+    uint64_t *predictedMemories; // for each position
+    uint64_t *memoryDepthLimits; // for each position, zero if the chunk fits
+    uint64_t memoryInFlight;
+    int64_t chunksInFlight;
+    pthread_mutex_t memoryMutex;
+    pthread_cond_t memoryCond;
+    // the progress, the finished counts being updated atomically so the threads don't wait on each other
+    uint64_t *works; // the estimated work of each position, scaled by CHUNK_PROGRESS_WORK_SCALE
+    uint64_t *bases; // the reference bases of each position
+    uint64_t totalWork;
+    uint64_t totalBases;
+    uint64_t finishedWork;
+    uint64_t finishedBases;
+    uint64_t finishedChunkNo;
+    char *progressStage;
+    double progressStartTime;
+    double progressInterval;
+    int64_t lastProgressReport; // in milliseconds since progressStartTime, claimed by the thread reporting
+};
+
+// The threads of the running chunk loop that have run out of chunks, counted as they leave the loop
+static int64_t chunkScheduler_idleThreadNo = 0;
+
+typedef struct _chunkCostCmpArgs {
+    double *features;
+    double *weights;
+} ChunkCostCmpArgs;
+
+static double chunkScheduler_getTime() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1.0e9;
+}
+
+static double chunkScheduler_predictCost(double *weights, double *features) {
+    double cost = 0.0;
+    for (int64_t j = 0; j < CHUNK_COST_FEATURES; j++) {
+        cost += weights[j] * features[j];
+    }
+    return cost > 0.0 ? cost : 0.0;
+}
+
+static int chunkScheduler_cmpChunksByPredictedCostDesc(const void *a, const void *b, const void *extraArg) {
+    // for stIntTuple chunk indices, ties keep the chunk order
+    const ChunkCostCmpArgs *args = extraArg;
+    int64_t i = stIntTuple_get((stIntTuple *) a, 0), j = stIntTuple_get((stIntTuple *) b, 0);
+    double costI = chunkScheduler_predictCost(args->weights, &args->features[i * CHUNK_COST_FEATURES]);
+    double costJ = chunkScheduler_predictCost(args->weights, &args->features[j * CHUNK_COST_FEATURES]);
+    return costI > costJ ? -1 : (costI < costJ ? 1 : (i < j ? -1 : (i > j ? 1 : 0)));
+}
+
+static int chunkScheduler_cmpPositionsByPredictedCost(const void *a, const void *b, const void *extraArg) {
+    // for positions, ties put the earlier position last, so it is taken first
+    const ChunkCostCmpArgs *args = extraArg;
+    int64_t i = (int64_t) a, j = (int64_t) b;
+    double costI = chunkScheduler_predictCost(args->weights, &args->features[i * CHUNK_COST_FEATURES]);
+    double costJ = chunkScheduler_predictCost(args->weights, &args->features[j * CHUNK_COST_FEATURES]);
+    return costI < costJ ? -1 : (costI > costJ ? 1 : (i > j ? -1 : (i < j ? 1 : 0)));
+}
+
+static int64_t chunkScheduler_getWeights(ChunkScheduler *scheduler, double *weights) {
+    pthread_mutex_lock(&scheduler->modelMutex);
+    memcpy(weights, scheduler->weights, CHUNK_COST_FEATURES * sizeof(double));
+    int64_t generation = scheduler->generation;
+    pthread_mutex_unlock(&scheduler->modelMutex);
+    return generation;
+}
+
+static bool chunkQueue_take(ChunkScheduler *scheduler, ChunkQueue *queue, int64_t *i) {
+    pthread_mutex_lock(&queue->mutex);
+    if (scheduler->predictCost) {
+        // resort the queue if the model has been refit since it was last sorted
+        double weights[CHUNK_COST_FEATURES];
+        int64_t generation = chunkScheduler_getWeights(scheduler, weights);
+        if (queue->generation != generation) {
+            ChunkCostCmpArgs args = {scheduler->features, weights};
+            stList_sort2(queue->positions, chunkScheduler_cmpPositionsByPredictedCost, &args);
+            queue->remainingCost = 0.0;
+            for (int64_t k = 0; k < stList_length(queue->positions); k++) {
+                queue->remainingCost += chunkScheduler_predictCost(weights,
+                        &scheduler->features[(int64_t) stList_get(queue->positions, k) * CHUNK_COST_FEATURES]);
+            }
+            queue->generation = generation;
+        }
+        if (stList_length(queue->positions) > 0) {
+            queue->remainingCost -= chunkScheduler_predictCost(weights,
+                    &scheduler->features[(int64_t) stList_peek(queue->positions) * CHUNK_COST_FEATURES]);
+        }
+    }
+    bool taken = stList_length(queue->positions) > 0;
+    if (taken) {
+        *i = (int64_t) stList_pop(queue->positions);
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return taken;
+}
+
+ChunkScheduler *chunkScheduler_construct(BamChunker *bamChunker, stList *chunkOrder, int64_t threadNo,
+                                         bool predictCost) {
+    ChunkScheduler *scheduler = st_calloc(1, sizeof(ChunkScheduler));
+    scheduler->chunkNo = stList_length(chunkOrder);
+    scheduler->predictCost = predictCost;
+    scheduler->startTimes = st_calloc(scheduler->chunkNo, sizeof(double));
+    scheduler->queueNo = predictCost && threadNo > 1 ? threadNo : 1;
+    pthread_mutex_init(&scheduler->modelMutex, NULL);
+    pthread_mutex_init(&scheduler->memoryMutex, NULL);
+    pthread_cond_init(&scheduler->memoryCond, NULL);
+    __atomic_store_n(&chunkScheduler_idleThreadNo, 0, __ATOMIC_RELAXED);
+
+    // the features of each chunk, normalized so that the initial model (cost proportional to depth times
+    // length) and the regularization towards it are on the same scale
+    double *chunkFeatures = st_calloc(bamChunker->chunkCount * CHUNK_COST_FEATURES, sizeof(double));
+    double means[CHUNK_COST_FEATURES] = {0.0, 0.0, 0.0};
+    for (int64_t c = 0; c < bamChunker->chunkCount; c++) {
+        BamChunk *bamChunk = bamChunker_getChunk(bamChunker, c);
+        double length = (double) (bamChunk->chunkOverlapEnd - bamChunk->chunkOverlapStart);
+        double *features = &chunkFeatures[c * CHUNK_COST_FEATURES];
+        features[0] = length * (double) bamChunk->estimatedDepth;
+        features[1] = length;
+        features[2] = 1.0;
+        for (int64_t j = 0; j < CHUNK_COST_FEATURES; j++) means[j] += features[j] / bamChunker->chunkCount;
+    }
+    for (int64_t c = 0; c < bamChunker->chunkCount; c++) {
+        for (int64_t j = 0; j < CHUNK_COST_FEATURES; j++) {
+            if (means[j] > 0.0) chunkFeatures[c * CHUNK_COST_FEATURES + j] /= means[j];
+        }
+    }
+
+    if (predictCost) {
+        memcpy(scheduler->weights, chunkScheduler_initialWeights, CHUNK_COST_FEATURES * sizeof(double));
+        for (int64_t j = 0; j < CHUNK_COST_FEATURES; j++) {
+            scheduler->xtx[j][j] = 1.0;
+            scheduler->xty[j] = scheduler->weights[j];
+        }
+        scheduler->nextRefit = CHUNK_COST_FIRST_REFIT;
+
+        // longest predicted first (LPT), so the positions the prefetcher reads ahead are those taken next
+        ChunkCostCmpArgs args = {chunkFeatures, scheduler->weights};
+        stList_sort2(chunkOrder, chunkScheduler_cmpChunksByPredictedCostDesc, &args);
+        scheduler->features = st_malloc(scheduler->chunkNo * CHUNK_COST_FEATURES * sizeof(double));
+        for (int64_t i = 0; i < scheduler->chunkNo; i++) {
+            memcpy(&scheduler->features[i * CHUNK_COST_FEATURES],
+                   &chunkFeatures[stIntTuple_get(stList_get(chunkOrder, i), 0) * CHUNK_COST_FEATURES],
+                   CHUNK_COST_FEATURES * sizeof(double));
+        }
+    }
+
+    // the progress is counted in the estimated work of the finished chunks, not their number, as their costs vary
+    // widely and the most costly chunks may be taken first
+    scheduler->works = st_malloc(scheduler->chunkNo * sizeof(uint64_t));
+    scheduler->bases = st_malloc(scheduler->chunkNo * sizeof(uint64_t));
+    for (int64_t i = 0; i < scheduler->chunkNo; i++) {
+        int64_t c = stIntTuple_get(stList_get(chunkOrder, i), 0);
+        BamChunk *bamChunk = bamChunker_getChunk(bamChunker, c);
+        scheduler->works[i] = (uint64_t) (CHUNK_PROGRESS_WORK_SCALE *
+                chunkScheduler_predictCost((double *) chunkScheduler_initialWeights,
+                                           &chunkFeatures[c * CHUNK_COST_FEATURES]));
+        scheduler->bases[i] = (uint64_t) (bamChunk->chunkEnd - bamChunk->chunkStart);
+        scheduler->totalWork += scheduler->works[i];
+        scheduler->totalBases += scheduler->bases[i];
+    }
+    free(chunkFeatures);
+
+    // the positions are dealt out round robin, so each thread's queue is also longest predicted first
+    scheduler->queues = st_calloc(scheduler->queueNo, sizeof(ChunkQueue));
+    for (int64_t q = 0; q < scheduler->queueNo; q++) {
+        ChunkQueue *queue = &scheduler->queues[q];
+        queue->positions = stList_construct();
+        queue->generation = -1;
+        pthread_mutex_init(&queue->mutex, NULL);
+    }
+    for (int64_t i = scheduler->chunkNo - 1; i >= 0; i--) {
+        stList_append(scheduler->queues[i % scheduler->queueNo].positions, (void *) i);
+    }
+    return scheduler;
+}
+
+bool chunkScheduler_next(ChunkScheduler *scheduler, int64_t *i) {
+    # ifdef _OPENMP
+    int64_t threadIdx = omp_get_thread_num();
+    # else
+    int64_t threadIdx = 0;
+    # endif
+
+    // take from this thread's queue
+    bool taken = chunkQueue_take(scheduler, &scheduler->queues[threadIdx % scheduler->queueNo], i);
+
+    // otherwise steal the longest predicted chunk of the queue with the most predicted work left
+    while (!taken) {
+        ChunkQueue *victim = NULL;
+        double victimCost = 0.0;
+        for (int64_t q = 0; q < scheduler->queueNo; q++) {
+            ChunkQueue *queue = &scheduler->queues[q];
+            pthread_mutex_lock(&queue->mutex);
+            if (stList_length(queue->positions) > 0 && (victim == NULL || queue->remainingCost > victimCost)) {
+                victim = queue;
+                victimCost = queue->remainingCost;
+            }
+            pthread_mutex_unlock(&queue->mutex);
+        }
+        if (victim == NULL) {
+            // the queues are never refilled, so all the chunks have been taken and the thread is free to be lent
+            // to the chunks still in flight
+            __atomic_add_fetch(&chunkScheduler_idleThreadNo, 1, __ATOMIC_RELAXED);
+            return FALSE;
+        }
+        taken = chunkQueue_take(scheduler, victim, i);
+    }
+
+    // wait until the chunk fits in the memory budget, or until it is the only chunk in flight
+    if (scheduler->maxMemory > 0) {
+        uint64_t predictedMemory = scheduler->predictedMemories[*i];
+        pthread_mutex_lock(&scheduler->memoryMutex);
+        if (scheduler->chunksInFlight > 0 && scheduler->memoryInFlight + predictedMemory > scheduler->maxMemory) {
+            st_logInfo("  Waiting for memory to start chunk %"PRId64", predicted to need %"PRIu64" bytes with "
+                       "%"PRIu64" bytes predicted for the %"PRId64" chunks in flight\n", *i, predictedMemory,
+                       scheduler->memoryInFlight, scheduler->chunksInFlight);
+        }
+        while (scheduler->chunksInFlight > 0 && scheduler->memoryInFlight + predictedMemory > scheduler->maxMemory) {
+            pthread_cond_wait(&scheduler->memoryCond, &scheduler->memoryMutex);
+        }
+        scheduler->memoryInFlight += predictedMemory;
+        scheduler->chunksInFlight++;
+        pthread_mutex_unlock(&scheduler->memoryMutex);
+    }
+
+    scheduler->startTimes[*i] = chunkScheduler_getTime();
+    return TRUE;
+}
+
+void chunkScheduler_setMemoryBudget(ChunkScheduler *scheduler, BamChunker *bamChunker, stList *chunkOrder,
+                                    uint64_t maxMemory, uint64_t bytesPerReadBase) {
+    assert(stList_length(chunkOrder) == scheduler->chunkNo);
+    scheduler->maxMemory = maxMemory;
+    scheduler->predictedMemories = st_calloc(scheduler->chunkNo, sizeof(uint64_t));
+    scheduler->memoryDepthLimits = st_calloc(scheduler->chunkNo, sizeof(uint64_t));
+    int64_t downsampledNo = 0;
+    for (int64_t i = 0; i < scheduler->chunkNo; i++) {
+        BamChunk *bamChunk = bamChunker_getChunk(bamChunker, stIntTuple_get(stList_get(chunkOrder, i), 0));
+        uint64_t length = (uint64_t) (bamChunk->chunkOverlapEnd - bamChunk->chunkOverlapStart);
+        uint64_t depth = bamChunk->estimatedDepth > 0 ? (uint64_t) bamChunk->estimatedDepth : 0;
+        uint64_t predictedMemory = CHUNK_MEMORY_OVERHEAD + bytesPerReadBase * depth * length;
+        if (predictedMemory > maxMemory && bytesPerReadBase * length > 0) {
+            // the depth at which the chunk would fit, at least one
+            uint64_t depthLimit = maxMemory > CHUNK_MEMORY_OVERHEAD ?
+                                  (maxMemory - CHUNK_MEMORY_OVERHEAD) / (bytesPerReadBase * length) : 0;
+            scheduler->memoryDepthLimits[i] = depthLimit > 0 ? depthLimit : 1;
+            predictedMemory = CHUNK_MEMORY_OVERHEAD + bytesPerReadBase * scheduler->memoryDepthLimits[i] * length;
+            downsampledNo++;
+        }
+        scheduler->predictedMemories[i] = predictedMemory;
+    }
+    st_logCritical("> Limiting chunks in flight to %"PRIu64" bytes of predicted memory, %"PRId64" of %"PRId64
+                   " chunks are predicted to need more on their own and will be downsampled\n", maxMemory,
+                   downsampledNo, scheduler->chunkNo);
+}
+
+uint64_t chunkScheduler_getPredictedMemory(ChunkScheduler *scheduler, int64_t i) {
+    return scheduler->maxMemory > 0 ? scheduler->predictedMemories[i] : 0;
+}
+
+uint64_t chunkScheduler_getMemoryDepthLimit(ChunkScheduler *scheduler, int64_t i) {
+    return scheduler->maxMemory > 0 ? scheduler->memoryDepthLimits[i] : 0;
+}
+
+static void chunkScheduler_refit(ChunkScheduler *scheduler) {
+    // must hold the model's lock, solves xtx * weights = xty by gaussian elimination with partial pivoting
+    double a[CHUNK_COST_FEATURES][CHUNK_COST_FEATURES + 1];
+    for (int64_t r = 0; r < CHUNK_COST_FEATURES; r++) {
+        for (int64_t c = 0; c < CHUNK_COST_FEATURES; c++) a[r][c] = scheduler->xtx[r][c];
+        a[r][CHUNK_COST_FEATURES] = scheduler->xty[r];
+    }
+    for (int64_t c = 0; c < CHUNK_COST_FEATURES; c++) {
+        int64_t pivot = c;
+        for (int64_t r = c + 1; r < CHUNK_COST_FEATURES; r++) {
+            if (fabs(a[r][c]) > fabs(a[pivot][c])) pivot = r;
+        }
+        if (fabs(a[pivot][c]) < 1.0e-12) return; // keep the current model
+        for (int64_t k = 0; k <= CHUNK_COST_FEATURES; k++) {
+            double t = a[c][k];
+            a[c][k] = a[pivot][k];
+            a[pivot][k] = t;
+        }
+        for (int64_t r = 0; r < CHUNK_COST_FEATURES; r++) {
+            if (r == c) continue;
+            double f = a[r][c] / a[c][c];
+            for (int64_t k = c; k <= CHUNK_COST_FEATURES; k++) a[r][k] -= f * a[c][k];
+        }
+    }
+    for (int64_t r = 0; r < CHUNK_COST_FEATURES; r++) {
+        scheduler->weights[r] = a[r][CHUNK_COST_FEATURES] / a[r][r];
+    }
+    scheduler->generation++;
+    st_logInfo("  Refit chunk cost model on %"PRId64" chunks: %.4f * depth x length + %.4f * length + %.4f\n",
+               scheduler->finishedNo, scheduler->weights[0], scheduler->weights[1], scheduler->weights[2]);
+}
+
+void chunkScheduler_startProgress(ChunkScheduler *scheduler, char *stage, uint64_t interval) {
+    scheduler->progressStage = stage;
+    scheduler->progressInterval = (double) interval;
+    scheduler->progressStartTime = chunkScheduler_getTime();
+    scheduler->lastProgressReport = 0;
+}
+
+static void chunkScheduler_reportProgress(ChunkScheduler *scheduler, uint64_t finishedChunkNo) {
+    // rate limited, bar the report of the last chunk, the thread that moves the time of the last report on reporting
+    double elapsed = chunkScheduler_getTime() - scheduler->progressStartTime;
+    int64_t now = (int64_t) (1000.0 * elapsed);
+    int64_t lastReport = __atomic_load_n(&scheduler->lastProgressReport, __ATOMIC_RELAXED);
+    if (finishedChunkNo < (uint64_t) scheduler->chunkNo &&
+        (now - lastReport < (int64_t) (1000.0 * scheduler->progressInterval) ||
+         !__atomic_compare_exchange_n(&scheduler->lastProgressReport, &lastReport, now, FALSE,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))) {
+        return;
+    }
+
+    // the counts may be a chunk or two ahead of each other, which is fine for a report
+    uint64_t finishedWork = __atomic_load_n(&scheduler->finishedWork, __ATOMIC_RELAXED);
+    uint64_t finishedBases = __atomic_load_n(&scheduler->finishedBases, __ATOMIC_RELAXED);
+    double fraction = scheduler->totalWork > 0 ? (double) finishedWork / scheduler->totalWork :
+                      (double) finishedChunkNo / scheduler->chunkNo;
+    double basesPerSecond = elapsed > 0.0 ? finishedBases / elapsed : 0.0;
+    double secondsRemaining = fraction > 0.0 ? elapsed * (1.0 - fraction) / fraction : -1.0;
+
+    char *timeDescriptor = secondsRemaining < 0.0 ? stString_print("unknown") :
+                           getTimeDescriptorFromSeconds((int64_t) secondsRemaining);
+    st_logCritical("> %s %2"PRId64"%% complete (%"PRIu64"/%"PRId64" chunks, %.0f bases/s).  Estimated time "
+                   "remaining: %s\n", scheduler->progressStage, (int64_t) (100.0 * fraction), finishedChunkNo,
+                   scheduler->chunkNo, basesPerSecond, timeDescriptor);
+    free(timeDescriptor);
+    // the same, as key=value pairs for scraping
+    st_logCritical("PROGRESS stage=%s chunks=%"PRIu64"/%"PRId64" work=%.4f bases=%"PRIu64"/%"PRIu64" elapsed=%.1f "
+                   "basesPerSecond=%.1f etaSeconds=%.1f\n", scheduler->progressStage, finishedChunkNo,
+                   scheduler->chunkNo, fraction, finishedBases, scheduler->totalBases, elapsed, basesPerSecond,
+                   secondsRemaining);
+}
+
+void chunkScheduler_finish(ChunkScheduler *scheduler, int64_t i) {
+    if (scheduler->progressStage != NULL) {
+        __atomic_add_fetch(&scheduler->finishedWork, scheduler->works[i], __ATOMIC_RELAXED);
+        __atomic_add_fetch(&scheduler->finishedBases, scheduler->bases[i], __ATOMIC_RELAXED);
+        chunkScheduler_reportProgress(scheduler,
+                                      __atomic_add_fetch(&scheduler->finishedChunkNo, 1, __ATOMIC_RELAXED));
+    }
+    if (scheduler->maxMemory > 0) {
+        pthread_mutex_lock(&scheduler->memoryMutex);
+        scheduler->memoryInFlight -= scheduler->predictedMemories[i];
+        scheduler->chunksInFlight--;
+        pthread_cond_broadcast(&scheduler->memoryCond);
+        pthread_mutex_unlock(&scheduler->memoryMutex);
+    }
+    if (!scheduler->predictCost) return;
+    double seconds = chunkScheduler_getTime() - scheduler->startTimes[i];
+    double *features = &scheduler->features[i * CHUNK_COST_FEATURES];
+    pthread_mutex_lock(&scheduler->modelMutex);
+    for (int64_t r = 0; r < CHUNK_COST_FEATURES; r++) {
+        for (int64_t c = 0; c < CHUNK_COST_FEATURES; c++) scheduler->xtx[r][c] += features[r] * features[c];
+        scheduler->xty[r] += features[r] * seconds;
+    }
+    // refit each time the number of finished chunks doubles, each refit has the queues resorted
+    if (++scheduler->finishedNo == scheduler->nextRefit) {
+        chunkScheduler_refit(scheduler);
+        scheduler->nextRefit *= 2;
+    }
+    pthread_mutex_unlock(&scheduler->modelMutex);
+}
+
+int64_t chunkScheduler_getIdleThreadNo(void) {
+    # ifdef _OPENMP
+    return omp_in_parallel() ? __atomic_load_n(&chunkScheduler_idleThreadNo, __ATOMIC_RELAXED) : 0;
+    # else
+    return 0;
+    # endif
+}
+
+void chunkScheduler_destruct(ChunkScheduler *scheduler) {
+    __atomic_store_n(&chunkScheduler_idleThreadNo, 0, __ATOMIC_RELAXED);
+    for (int64_t q = 0; q < scheduler->queueNo; q++) {
+        pthread_mutex_destroy(&scheduler->queues[q].mutex);
+        stList_destruct(scheduler->queues[q].positions);
+    }
+    free(scheduler->queues);
+    pthread_mutex_destroy(&scheduler->modelMutex);
+    pthread_mutex_destroy(&scheduler->memoryMutex);
+    pthread_cond_destroy(&scheduler->memoryCond);
+    if (scheduler->features != NULL) free(scheduler->features);
+    if (scheduler->predictedMemories != NULL) free(scheduler->predictedMemories);
+    if (scheduler->memoryDepthLimits != NULL) free(scheduler->memoryDepthLimits);
+    free(scheduler->works);
+    free(scheduler->bases);
+    free(scheduler->startTimes);
+    free(scheduler);
+}
@@ -34,6 +34,99 @@ int phasedVariant_positionCmp(const void *a, const void *b) {
     return A->refPos < B->refPos ? -1 : 1;
 }
 
+static bool getPhaseSetIsInt(bcf_hdr_t *hdr, const char *vcfFile) {
+    // find type of phaseSet
+    int psId = bcf_hdr_id2int(hdr, BCF_DT_ID, "PS");
+    if (psId < 0) {
+        st_errAbort("error: PS tag not present in VCF header for %s", vcfFile);
+    }
+    int psType = bcf_hdr_id2type(hdr, BCF_HL_FMT, psId);
+    if (psType == BCF_HT_INT) {
+        return TRUE;
+    } else if (psType != BCF_HT_STR) {
+        st_errAbort("error: Unknown PS type in VCF header for %s", vcfFile);
+    }
+    return FALSE;
+}
+
+typedef struct _phasedVariantCounts {
+    int64_t totalEntries;
+    int64_t skippedForNotPass;
+    int64_t skippedForHomozygous;
+    int64_t skippedForNoPhaseset;
+    int64_t totalSaved;
+} PhasedVariantCounts;
+
+static PhasedVariant *getPhasedVariant(bcf_hdr_t *hdr, bcf1_t *rec, bool phaseSetIsInt, PhasedVariantCounts *counts) {
+    /*
+     * Gets the phased variant of the record, or NULL if it is not a PASS, heterozygous and phased variant.
+     */
+    //unpack for read REF,ALT,INFO,etc
+    bcf_unpack(rec, BCF_UN_ALL);
+    counts->totalEntries++;
+
+    // pass variant
+    if (!bcf_has_filter(hdr, rec, "PASS")) {
+        counts->skippedForNotPass++;
+        return NULL;
+    }
+
+    // genotype
+    int gt1 = -1;
+    int gt2 = -1;
+    int32_t *gt_arr = NULL, ngt_arr = 0;
+    int ngt = bcf_get_genotypes(hdr, rec, &gt_arr, &ngt_arr);
+    if (ngt>0 && !bcf_gt_is_missing(gt_arr[0])  && gt_arr[1] != bcf_int32_vector_end) {
+        gt1 = bcf_gt_allele(gt_arr[0]);
+        gt2 = bcf_gt_allele(gt_arr[1]);
+    }
+    free(gt_arr);
+    if (gt1 == gt2) {
+        counts->skippedForHomozygous++;
+        return NULL;
+    }
+
+    // phase set
+    char *phaseset = NULL;
+    if (phaseSetIsInt) {
+        int mPSs = 0, nPSs;
+        int32_t **PSs = NULL;
+        nPSs = bcf_get_format_int32(hdr, rec, "PS", &PSs, &mPSs);
+        if (nPSs <= 0 || PSs[0] == 0) {
+            counts->skippedForNoPhaseset++;
+            return NULL;
+        }
+        phaseset = stString_print("%"PRId32, PSs[0]);
+    } else {
+        int mPSs = 0, nPSs;
+        char **PSs = NULL;
+        nPSs = bcf_get_format_string(hdr, rec, "PS", &PSs, &mPSs);
+        if (nPSs <= 0 || stString_eq(PSs[0], ".")) {
+            counts->skippedForNoPhaseset++;
+            return NULL;
+        }
+        phaseset = stString_copy(PSs[0]);
+    }
+
+    // location data
+    const char *chrom = bcf_hdr_id2name(hdr, rec->rid);
+    int64_t pos = rec->pos;
+
+    // qual
+    double quality = rec->qual;
+
+    // get alleles
+    stList *alleles = stList_construct3(0, (void (*)(void*)) free);
+    for (int i=0; i<rec->n_allele; ++i) {
+        stList_append(alleles, stString_copy(rec->d.allele[i]));
+    }
+
+    counts->totalSaved++;
+    PhasedVariant *pv = phasedVariant_construct(chrom, pos, quality, alleles, gt1, gt2, phaseset);
+    free(phaseset);
+    return pv;
+}
+
 stHash *getPhasedVariants(const char *vcfFile) {
     // what we're saving into
     stHash *entries = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, free, (void(*)(void*))stList_destruct);
@@ -51,104 +144,27 @@ stHash *getPhasedVariants(const char *vcfFile) {
     if (nsmpl > 1) {
         st_logCritical("Got %d samples reading %s, will only take VCF records for the first\n", nsmpl, vcfFile);
     }
-    
-    // find type of phaseSet
-    bool phaseSetIsInt = FALSE;
-    int psId = bcf_hdr_id2int(hdr, BCF_DT_ID, "PS");
-    if (psId < 0) {
-        st_errAbort("error: PS tag not present in VCF header for %s", vcfFile);
-    }
-    int psType = bcf_hdr_id2type(hdr, BCF_HL_FMT, psId);
-    if (psType == BCF_HT_INT) {
-        phaseSetIsInt = TRUE;
-    } else if (psType == BCF_HT_STR) {
-        phaseSetIsInt = FALSE;
-    } else {
-        st_errAbort("error: Unknown PS type in VCF header for %s", vcfFile);
-    }
-    
+    bool phaseSetIsInt = getPhaseSetIsInt(hdr, vcfFile);
     
     // tracking
-    int64_t totalEntries = 0;
-    int64_t skippedForNotPass = 0;
-    int64_t skippedForHomozygous = 0;
-    int64_t skippedForNoPhaseset = 0;
-    int64_t totalSaved = 0;
+    PhasedVariantCounts counts = {0, 0, 0, 0, 0};
     
     // iterate over records
     bcf1_t *rec = bcf_init();
     while ( bcf_read(fp, hdr, rec) >= 0 )
     {
-        //unpack for read REF,ALT,INFO,etc
-        bcf_unpack(rec, BCF_UN_ALL);
-        totalEntries++;
-        
-        // pass variant
-        if (!bcf_has_filter(hdr, rec, "PASS")) {
-            skippedForNotPass++;
-            continue;
-        }
-        
-        // genotype
-        int gt1 = -1;
-        int gt2 = -1;
-        int32_t *gt_arr = NULL, ngt_arr = 0;
-        int ngt = bcf_get_genotypes(hdr, rec, &gt_arr, &ngt_arr);
-        if (ngt>0 && !bcf_gt_is_missing(gt_arr[0])  && gt_arr[1] != bcf_int32_vector_end) {
-            gt1 = bcf_gt_allele(gt_arr[0]);
-            gt2 = bcf_gt_allele(gt_arr[1]);
-        }
-        free(gt_arr);
-        if (gt1 == gt2) {
-            skippedForHomozygous++;
+        PhasedVariant *pv = getPhasedVariant(hdr, rec, phaseSetIsInt, &counts);
+        if (pv == NULL) {
             continue;
         }
         
-        // phase set
-        char *phaseset = NULL;
-        if (phaseSetIsInt) {
-            int mPSs = 0, nPSs;
-            int32_t **PSs = NULL;
-            nPSs = bcf_get_format_int32(hdr, rec, "PS", &PSs, &mPSs);
-            if (nPSs <= 0 || PSs[0] == 0) {
-                skippedForNoPhaseset++;
-                continue;
-            }
-            phaseset = stString_print("%"PRId32, PSs[0]);
-        } else {
-            int mPSs = 0, nPSs;
-            char **PSs = NULL;
-            nPSs = bcf_get_format_string(hdr, rec, "PS", &PSs, &mPSs);
-            if (nPSs <= 0 || stString_eq(PSs[0], ".")) {
-                skippedForNoPhaseset++;
-                continue;
-            }
-            phaseset = stString_copy(PSs[0]);
-        }
-        
-        
-        // location data
-        const char *chrom = bcf_hdr_id2name(hdr, rec->rid);
-        int64_t pos = rec->pos;
-        
-        // qual
-        double quality = rec->qual;
-        
-        // get alleles
-        stList *alleles = stList_construct3(0, (void (*)(void*)) free);
-        for (int i=0; i<rec->n_allele; ++i) {
-            stList_append(alleles, stString_copy(rec->d.allele[i]));
-        }
-        
         // save it
-        PhasedVariant *pv = phasedVariant_construct(chrom, pos, quality, alleles, gt1, gt2, phaseset);
         stList *contigList = stHash_search(entries, pv->refSeqName);
         if (contigList == NULL) {
             contigList = stList_construct3(0, (void(*)(void*))phasedVariant_destruct);
             stHash_insert(entries, stString_copy(pv->refSeqName), contigList);
         }
         stList_append(contigList, pv);
-        totalSaved++;
     }
     
     // cleanup
@@ -162,8 +178,8 @@ stHash *getPhasedVariants(const char *vcfFile) {
     // loggit
     st_logCritical("Read %"PRId64" variants from %s over %"PRId64" contigs in %"PRId64"s, keeping %"PRId64" phased variants"
                    " and discarding %"PRId64" for not PASS, %"PRId64" for HOM, %"PRId64" for not phased.\n",
-                   totalEntries, vcfFile, stHash_size(entries), time(NULL) - start, totalSaved, skippedForNotPass,
-                   skippedForHomozygous, skippedForNoPhaseset);
+                   counts.totalEntries, vcfFile, stHash_size(entries), time(NULL) - start, counts.totalSaved,
+                   counts.skippedForNotPass, counts.skippedForHomozygous, counts.skippedForNoPhaseset);
     
     // ensure sorted
     stHashIterator *itor = stHash_getIterator(entries);
@@ -178,6 +194,80 @@ stHash *getPhasedVariants(const char *vcfFile) {
     return entries;
 }
 
+PhasedVcfReader *phasedVcfReader_construct(const char *vcfFile) {
+    PhasedVcfReader *reader = st_calloc(1, sizeof(PhasedVcfReader));
+    reader->vcfFile = stString_copy(vcfFile);
+    reader->fp = hts_open(vcfFile, "r");
+    if (reader->fp == NULL) {
+        st_errAbort("error: Could not open VCF %s\n", vcfFile);
+    }
+    reader->hdr = bcf_hdr_read(reader->fp);
+    if (reader->hdr == NULL) {
+        st_errAbort("error: Could not read the header of VCF %s\n", vcfFile);
+    }
+    if (hts_get_format(reader->fp)->format == bcf) {
+        reader->idx = bcf_index_load(vcfFile);
+    } else if (hts_get_format(reader->fp)->compression == bgzf) {
+        reader->tbx = tbx_index_load(vcfFile);
+    }
+    if (reader->idx == NULL && reader->tbx == NULL) {
+        st_errAbort("error: VCF %s is not a bgzipped VCF with a tabix index or a BCF with a csi index\n", vcfFile);
+    }
+    reader->phaseSetIsInt = getPhaseSetIsInt(reader->hdr, vcfFile);
+    return reader;
+}
+
+void phasedVcfReader_destruct(PhasedVcfReader *reader) {
+    if (reader->idx != NULL) hts_idx_destroy(reader->idx);
+    if (reader->tbx != NULL) tbx_destroy(reader->tbx);
+    bcf_hdr_destroy(reader->hdr);
+    hts_close(reader->fp);
+    free(reader->vcfFile);
+    free(reader);
+}
+
+stList *phasedVcfReader_getContigs(PhasedVcfReader *reader) {
+    stList *contigs = stList_construct3(0, free);
+    int nseq = 0;
+    const char **seqnames = reader->tbx != NULL ? tbx_seqnames(reader->tbx, &nseq) :
+                            bcf_index_seqnames(reader->idx, reader->hdr, &nseq);
+    for (int i = 0; i < nseq; i++) {
+        stList_append(contigs, stString_copy(seqnames[i]));
+    }
+    free(seqnames);
+    return contigs;
+}
+
+stList *phasedVcfReader_getContigVariants(PhasedVcfReader *reader, const char *contig) {
+    stList *contigVariants = stList_construct3(0, (void(*)(void*))phasedVariant_destruct);
+    hts_itr_t *itr = reader->tbx != NULL ? tbx_itr_querys(reader->tbx, contig) :
+                     bcf_itr_querys(reader->idx, reader->hdr, contig);
+    if (itr == NULL) {
+        // no records for the contig
+        return contigVariants;
+    }
+    PhasedVariantCounts counts = {0, 0, 0, 0, 0};
+    bcf1_t *rec = bcf_init();
+    kstring_t line = {0, 0, NULL};
+    while (reader->tbx != NULL ? tbx_itr_next(reader->fp, reader->tbx, itr, &line) >= 0 &&
+                                 vcf_parse1(&line, reader->hdr, rec) >= 0 :
+           bcf_itr_next(reader->fp, itr, rec) >= 0) {
+        PhasedVariant *pv = getPhasedVariant(reader->hdr, rec, reader->phaseSetIsInt, &counts);
+        if (pv != NULL) {
+            stList_append(contigVariants, pv);
+        }
+    }
+    free(line.s);
+    bcf_destroy(rec);
+    hts_itr_destroy(itr);
+    st_logDebug("Read %"PRId64" variants of %s from %s, keeping %"PRId64" phased variants\n", counts.totalEntries,
+                contig, reader->vcfFile, counts.totalSaved);
+
+    // ensure sorted
+    stList_sort(contigVariants, phasedVariant_positionCmp);
+    return contigVariants;
+}
+
 stList *getSharedContigs(stHash *entry1, stHash *entry2) {
     
     // get contigs
@@ -227,79 +317,90 @@ void variantCorrectness_destruct(VariantCorrectness* vc) {
     free(vc);
 }
 
-double meanVariantDist(stHash *query, stHash *truth, stList *sharedContigs) {
+int64_t variantDistSum(stList *queryPhasedVariants, stList *truthPhasedVariants, int64_t *numPairsOut) {
     
     int64_t distSum = 0;
     int64_t numPairs = 0;
-    for (int64_t i = 0; i < stList_length(sharedContigs); ++i) {
-        char *contig = stList_get(sharedContigs, i);
-        stList *queryPhasedVariants = stHash_search(query, contig);
-        stList *truthPhasedVariants = stHash_search(truth, contig);
-        int64_t prevPos = -1;
-        for (int64_t j = 0, k = 0; j < stList_length(queryPhasedVariants) && k < stList_length(truthPhasedVariants); ) {
+    int64_t prevPos = -1;
+    for (int64_t j = 0, k = 0; j < stList_length(queryPhasedVariants) && k < stList_length(truthPhasedVariants); ) {
+        
+        PhasedVariant *qpv = stList_get(queryPhasedVariants, j);
+        PhasedVariant *tpv = stList_get(truthPhasedVariants, k);
+        
+        if (qpv->refPos < tpv->refPos) {
+            // variant only in query
+            ++j;
+        }
+        else if (tpv->refPos < qpv->refPos) {
+            // variant only in truth
+            ++k;
+        }
+        else {
             
-            PhasedVariant *qpv = stList_get(queryPhasedVariants, j);
-            PhasedVariant *tpv = stList_get(truthPhasedVariants, k);
+            // TODO: duplicative with localCorrectnessInternal
             
-            if (qpv->refPos < tpv->refPos) {
-                // variant only in query
-                ++j;
+            // match up the alleles
+            bool match11 = stString_eq(stList_get(qpv->alleles, qpv->gt1), stList_get(tpv->alleles, tpv->gt1));
+            bool match12 = stString_eq(stList_get(qpv->alleles, qpv->gt1), stList_get(tpv->alleles, tpv->gt2));
+            bool match21 = stString_eq(stList_get(qpv->alleles, qpv->gt2), stList_get(tpv->alleles, tpv->gt1));
+            bool match22 = stString_eq(stList_get(qpv->alleles, qpv->gt2), stList_get(tpv->alleles, tpv->gt2));
+            
+            ++j;
+            ++k;
+            
+            if (!(match11 || match12) || !(match21 || match22)) {
+                // the site is shared, but the alleles are not, just skip this variant
+                // TODO: is this the best way to handle this case?
+                continue;
             }
-            else if (tpv->refPos < qpv->refPos) {
-                // variant only in truth
-                ++k;
+            
+            if ((int) match11 + (int) match12 + (int) match21 + (int) match22 > 2) {
+                // at least one allele must be duplicated in the list of alts
+                st_logCritical("error: duplicate alleles detected at position %"PRId64" on sequence %s\n",
+                               qpv->refPos, qpv->refSeqName);
+                continue;
             }
-            else {
-                
-                // TODO: duplicative with localCorrectnessInternal
-                
-                // match up the alleles
-                bool match11 = stString_eq(stList_get(qpv->alleles, qpv->gt1), stList_get(tpv->alleles, tpv->gt1));
-                bool match12 = stString_eq(stList_get(qpv->alleles, qpv->gt1), stList_get(tpv->alleles, tpv->gt2));
-                bool match21 = stString_eq(stList_get(qpv->alleles, qpv->gt2), stList_get(tpv->alleles, tpv->gt1));
-                bool match22 = stString_eq(stList_get(qpv->alleles, qpv->gt2), stList_get(tpv->alleles, tpv->gt2));
-                
-                ++j;
-                ++k;
-                
-                if (!(match11 || match12) || !(match21 || match22)) {
-                    // the site is shared, but the alleles are not, just skip this variant
-                    // TODO: is this the best way to handle this case?
-                    continue;
-                }
-                
-                if ((int) match11 + (int) match12 + (int) match21 + (int) match22 > 2) {
-                    // at least one allele must be duplicated in the list of alts
-                    st_logCritical("error: duplicate alleles detected at position %"PRId64" on sequence %s\n",
-                                   qpv->refPos, qpv->refSeqName);
-                    continue;
-                }
-                
-                if (prevPos != -1) {
-                    distSum += (qpv->refPos - prevPos);
-                    ++numPairs;
-                }
-                
-                prevPos = qpv->refPos;
+            
+            if (prevPos != -1) {
+                distSum += (qpv->refPos - prevPos);
+                ++numPairs;
             }
+            
+            prevPos = qpv->refPos;
         }
     }
     
+    *numPairsOut = numPairs;
+    return distSum;
+}
+
+double meanVariantDist(stHash *query, stHash *truth, stList *sharedContigs) {
+    
+    int64_t distSum = 0;
+    int64_t numPairs = 0;
+    for (int64_t i = 0; i < stList_length(sharedContigs); ++i) {
+        char *contig = stList_get(sharedContigs, i);
+        int64_t contigNumPairs;
+        distSum += variantDistSum(stHash_search(query, contig), stHash_search(truth, contig), &contigNumPairs);
+        numPairs += contigNumPairs;
+    }
+    
     return ((double) distSum) / numPairs;
 }
 
-PartialPhaseSums* partialPhaseSums_construct(const char *queryPhaseSet, const char *truthPhaseSet) {
+PartialPhaseSums* partialPhaseSums_construct(const char *queryPhaseSet, const char *truthPhaseSet, int64_t numDecays) {
     PartialPhaseSums* pps = (PartialPhaseSums*) malloc(sizeof(PartialPhaseSums));
     pps->queryPhaseSet = stString_copy(queryPhaseSet);
     pps->truthPhaseSet = stString_copy(truthPhaseSet);
-    pps->phaseSum1 = 0.0;
-    pps->phaseSum2 = 0.0;
+    pps->phaseSum1 = (double*) calloc(2 * numDecays, sizeof(double));
+    pps->phaseSum2 = pps->phaseSum1 + numDecays;
     return pps;
 }
 
 void partialPhaseSums_destruct(PartialPhaseSums *pps) {
     free(pps->queryPhaseSet);
     free(pps->truthPhaseSet);
+    free(pps->phaseSum1);
     free(pps);
 }
 
@@ -326,24 +427,37 @@ stHash *phaseSetIntervals(stList *phasedVariants) {
 }
 
 double *phasingCorrectnessInternal(stList *queryPhasedVariants, stList *truthPhasedVariants,
-                                   double decay, bool bySeqDist, bool crossBlockCorrect,
+                                   double *decays, int64_t numDecays, bool bySeqDist, bool crossBlockCorrect,
                                    stHash *queryPhaseSetIntervals, stHash *truthPhaseSetIntervals, bool forward,
                                    stList *variantCorrectnessOut) {
     
     // TODO: what's the most sensible way to handle het variants that only occur in one VCF?
     // for now, just skipping them
     
+    // the per-variant values are only defined for a single decay
+    assert(variantCorrectnessOut == NULL || numDecays == 1);
+    
     // holds the partial sums for each active pair of phase sets
     stList *phaseSetPartialSums = stList_construct3(0, (void (*)(void *)) partialPhaseSums_destruct);
     
+    // all of the decays are accumulated in the same sweep, so every accumulator has one entry per decay and
+    // these are packaged up as the return value: [ sums | partition sums | out of scope sums | decay values ]
+    double *accumulators = (double*) calloc(4 * numDecays, sizeof(double));
+    
     // accumulator for the sum
-    double totalSum = 0.0;
+    double *totalSum = accumulators;
     
     // accumulator for the max value of the sum
-    double partitionTotalSum = 0.0;
+    double *partitionTotalSum = accumulators + numDecays;
     
     // accumulator for the unphased partial sums of phase set pairs that have fallen out of scope
-    double outOfScopeSum = 0.0;
+    double *outOfScopeSum = accumulators + 2 * numDecays;
+    
+    // the decay to apply at the current step
+    double *decayValues = accumulators + 3 * numDecays;
+    for (int64_t d = 0; d < numDecays; ++d) {
+        decayValues[d] = decays[d];
+    }
     
     // which direction are we iterating down the list of variants
     int64_t i, j, incr;
@@ -398,23 +512,26 @@ double *phasingCorrectnessInternal(stList *queryPhasedVariants, stList *truthPha
                 continue;
             }
             
-            double decayValue;
             if (bySeqDist) {
-                decayValue = pow(decay, fabs((double) (qpv->refPos - prevPosition)));
-            }
-            else {
-                decayValue = decay;
+                double dist = fabs((double) (qpv->refPos - prevPosition));
+                for (int64_t d = 0; d < numDecays; ++d) {
+                    decayValues[d] = pow(decays[d], dist);
+                }
             }
             
             // decay all of the previous partial sums
             for (int64_t k = 0; k < stList_length(phaseSetPartialSums); ++k) {
                 PartialPhaseSums *sums = stList_get(phaseSetPartialSums, k);
-                sums->phaseSum1 *= decayValue;
-                sums->phaseSum2 *= decayValue;
+                for (int64_t d = 0; d < numDecays; ++d) {
+                    sums->phaseSum1[d] *= decayValues[d];
+                    sums->phaseSum2[d] *= decayValues[d];
+                }
+            }
+            for (int64_t d = 0; d < numDecays; ++d) {
+                outOfScopeSum[d] *= decayValues[d];
             }
-            outOfScopeSum *= decayValue;
             
-            st_logDebug("going into iteration query %"PRId64", truth %"PRId64":\n\tref pos %"PRId64"\n\titer decay %f\n\ttotal %f\n\tpartition total %f\n\tout of scope sum %f\n", i - incr, j - incr, qpv->refPos, decayValue, totalSum, partitionTotalSum, outOfScopeSum);
+            st_logDebug("going into iteration query %"PRId64", truth %"PRId64":\n\tref pos %"PRId64"\n\titer decay %f\n\ttotal %f\n\tpartition total %f\n\tout of scope sum %f\n", i - incr, j - incr, qpv->refPos, decayValues[0], totalSum[0], partitionTotalSum[0], outOfScopeSum[0]);
             
             // do we find a phase set pair that matches this variant's phase set pair?
             bool foundCophasedSum = false;
@@ -432,57 +549,51 @@ double *phasingCorrectnessInternal(stList *queryPhasedVariants, stList *truthPha
                     
                     foundCophasedSum = true;
                     
-                    // partition functions acts as if correctly phased with everything
-                    partitionTotalSum += sums->phaseSum1 + sums->phaseSum2;
-                    
                     // because we've filtered down to 1) only het sites, and  2) sites
                     // where the alleles match, the only two combinations of matching
                     // that are allowed are 1-1/2-2 or 1-2/2-1
-                    if (match11) {
-                        totalSum += sums->phaseSum1;
-                        sums->phaseSum1 += 1.0;
-                        
-                        if (variantCorrectnessOut) {
-                            stList_append(variantCorrectnessOut, variantCorrectness_construct(qpv->refPos, sums->phaseSum1,
-                                                                                              sums->phaseSum1 + sums->phaseSum2));
-                        }
+                    double *phaseSum = match11 ? sums->phaseSum1 : sums->phaseSum2;
+                    
+                    if (variantCorrectnessOut) {
+                        stList_append(variantCorrectnessOut, variantCorrectness_construct(qpv->refPos, phaseSum[0] + 1.0,
+                                                                                          sums->phaseSum1[0] + sums->phaseSum2[0] + 1.0));
                     }
-                    else {
-                        totalSum += sums->phaseSum2;
-                        sums->phaseSum2 += 1.0;
-                        
-                        if (variantCorrectnessOut) {
-                            stList_append(variantCorrectnessOut, variantCorrectness_construct(qpv->refPos, sums->phaseSum2,
-                                                                                              sums->phaseSum1 + sums->phaseSum2));
-                        }
+                    
+                    for (int64_t d = 0; d < numDecays; ++d) {
+                        // partition functions acts as if correctly phased with everything
+                        partitionTotalSum[d] += sums->phaseSum1[d] + sums->phaseSum2[d];
+                        totalSum[d] += phaseSum[d];
+                        phaseSum[d] += 1.0;
                     }
                 }
                 else if (crossBlockCorrect) {
                     // this is a different phase set, but we're counting those summands
                     // as correct
-                    totalSum += sums->phaseSum1 + sums->phaseSum2;
-                    partitionTotalSum += sums->phaseSum1 + sums->phaseSum2;
+                    for (int64_t d = 0; d < numDecays; ++d) {
+                        totalSum[d] += sums->phaseSum1[d] + sums->phaseSum2[d];
+                        partitionTotalSum[d] += sums->phaseSum1[d] + sums->phaseSum2[d];
+                    }
                     
                     if (variantCorrectnessOut) {
-                        stList_append(variantCorrectnessOut, variantCorrectness_construct(qpv->refPos, sums->phaseSum1 + sums->phaseSum2,
-                                                                                          sums->phaseSum1 + sums->phaseSum2));
+                        stList_append(variantCorrectnessOut, variantCorrectness_construct(qpv->refPos, sums->phaseSum1[0] + sums->phaseSum2[0],
+                                                                                          sums->phaseSum1[0] + sums->phaseSum2[0]));
                     }
                 }
             }
             
             // add any summands from out of scope phase set pairs
-            totalSum += outOfScopeSum;
-            partitionTotalSum += outOfScopeSum;
+            for (int64_t d = 0; d < numDecays; ++d) {
+                totalSum[d] += outOfScopeSum[d];
+                partitionTotalSum[d] += outOfScopeSum[d];
+            }
             
             if (!foundCophasedSum) {
                 // this is the first time we've found this phase set pair, we need
                 // to initialize a new partial sum for it
-                PartialPhaseSums *sums = partialPhaseSums_construct(qpv->phaseSet, tpv->phaseSet);
-                if (match11) {
-                    sums->phaseSum1 = 1.0;
-                }
-                else {
-                    sums->phaseSum2 = 1.0;
+                PartialPhaseSums *sums = partialPhaseSums_construct(qpv->phaseSet, tpv->phaseSet, numDecays);
+                double *phaseSum = match11 ? sums->phaseSum1 : sums->phaseSum2;
+                for (int64_t d = 0; d < numDecays; ++d) {
+                    phaseSum[d] = 1.0;
                 }
                 stList_append(phaseSetPartialSums, sums);
                 
@@ -493,8 +604,8 @@ double *phasingCorrectnessInternal(stList *queryPhasedVariants, stList *truthPha
             
             if (variantCorrectnessOut) {
                 VariantCorrectness *vc = stList_get(variantCorrectnessOut, stList_length(variantCorrectnessOut) - 1);
-                vc->correctness += outOfScopeSum;
-                vc->maxCorrectness += outOfScopeSum;
+                vc->correctness += outOfScopeSum[0];
+                vc->maxCorrectness += outOfScopeSum[0];
             }
             
             prevPosition = qpv->refPos;
@@ -507,7 +618,7 @@ double *phasingCorrectnessInternal(stList *queryPhasedVariants, stList *truthPha
             int64_t *queryInterval = stHash_search(queryPhaseSetIntervals, sums->queryPhaseSet);
             int64_t *truthInterval = stHash_search(truthPhaseSetIntervals, sums->truthPhaseSet);
             
-            st_logDebug("end of iter partial sum %"PRId64":\n\tquery phase set: %s\n\ttruth phase set: %s\n\tphased sum 1: %f\n\tphased sum 2: %f\n", k, sums->queryPhaseSet, sums->truthPhaseSet, sums->phaseSum1, sums->phaseSum2);
+            st_logDebug("end of iter partial sum %"PRId64":\n\tquery phase set: %s\n\ttruth phase set: %s\n\tphased sum 1: %f\n\tphased sum 2: %f\n", k, sums->queryPhaseSet, sums->truthPhaseSet, sums->phaseSum1[0], sums->phaseSum2[0]);
             
             if (i < queryInterval[0] || i > queryInterval[1]
                 || j < truthInterval[0] || j > truthInterval[1]) {
@@ -517,7 +628,9 @@ double *phasingCorrectnessInternal(stList *queryPhasedVariants, stList *truthPha
                 st_logDebug("\t\tthis sum falls out of scope at this iteration\n");
                 
                 if (crossBlockCorrect) {
-                    outOfScopeSum += sums->phaseSum1 + sums->phaseSum2;
+                    for (int64_t d = 0; d < numDecays; ++d) {
+                        outOfScopeSum[d] += sums->phaseSum1[d] + sums->phaseSum2[d];
+                    }
                 }
                 
                 // remove this sum from the list of partial sums
@@ -533,11 +646,8 @@ double *phasingCorrectnessInternal(stList *queryPhasedVariants, stList *truthPha
     
     stList_destruct(phaseSetPartialSums);
     
-    // package the two values and return them
-    double *returnVal = malloc(2 * sizeof(double));
-    returnVal[0] = totalSum;
-    returnVal[1] = partitionTotalSum;
-    return returnVal;
+    // the sums and partition sums lead the accumulators, so they can be returned in place
+    return accumulators;
 }
 
 double switchCorrectness(stList *queryPhasedVariants, stList *truthPhasedVariants, bool bySeqDist,
@@ -712,11 +822,11 @@ double phasingCorrectness(stList *queryPhasedVariants, stList *truthPhasedVarian
         revVariantCorrectness = stList_construct3(0, (void (*)(void*)) variantCorrectness_destruct);
     }
     
-    double *forwardSums = phasingCorrectnessInternal(queryPhasedVariants, truthPhasedVariants, decay,
+    double *forwardSums = phasingCorrectnessInternal(queryPhasedVariants, truthPhasedVariants, &decay, 1,
                                                      bySeqDist, crossBlockCorrect,
                                                      queryPhaseSetIntervals, truthPhaseSetIntervals,
                                                      true, variantCorrectnessOut);
-    double *reverseSums = phasingCorrectnessInternal(queryPhasedVariants, truthPhasedVariants, decay,
+    double *reverseSums = phasingCorrectnessInternal(queryPhasedVariants, truthPhasedVariants, &decay, 1,
                                                      bySeqDist, crossBlockCorrect,
                                                      queryPhaseSetIntervals, truthPhaseSetIntervals,
                                                      false, revVariantCorrectness);
@@ -749,3 +859,64 @@ double phasingCorrectness(stList *queryPhasedVariants, stList *truthPhasedVarian
     
     return correctness;
 }
+
+void phasingCorrectnessForDecays(stList *queryPhasedVariants, stList *truthPhasedVariants, double *decays,
+                                 int64_t numDecays, bool bySeqDist, bool crossBlockCorrect, double *correctnessOut,
+                                 double *effectivePairCountsOut) {
+    
+    // the decays that are evaluated directly, in one sweep in each direction
+    double *sweepDecays = (double*) malloc(numDecays * sizeof(double));
+    int64_t *sweepIdxs = (int64_t*) malloc(numDecays * sizeof(int64_t));
+    int64_t numSweepDecays = 0;
+    
+    for (int64_t d = 0; d < numDecays; ++d) {
+        if (decays[d] < 0.0 || decays[d] > 1.0) {
+            st_errAbort("error: Decay factor is %f, must be between 0.0 and 1.0\n", decays[d]);
+        }
+        if (decays[d] == 0.0) {
+            // a limit rather than direct evaluation, as in phasingCorrectness
+            double effectivePairCount;
+            correctnessOut[d] = switchCorrectness(queryPhasedVariants, truthPhasedVariants, bySeqDist,
+                                                  crossBlockCorrect, &effectivePairCount, NULL);
+            if (effectivePairCountsOut != NULL) {
+                effectivePairCountsOut[d] = effectivePairCount;
+            }
+        }
+        else {
+            sweepDecays[numSweepDecays] = decays[d];
+            sweepIdxs[numSweepDecays] = d;
+            ++numSweepDecays;
+        }
+    }
+    
+    if (numSweepDecays > 0) {
+        stHash *queryPhaseSetIntervals = phaseSetIntervals(queryPhasedVariants);
+        stHash *truthPhaseSetIntervals = phaseSetIntervals(truthPhasedVariants);
+        
+        double *forwardSums = phasingCorrectnessInternal(queryPhasedVariants, truthPhasedVariants, sweepDecays,
+                                                         numSweepDecays, bySeqDist, crossBlockCorrect,
+                                                         queryPhaseSetIntervals, truthPhaseSetIntervals,
+                                                         true, NULL);
+        double *reverseSums = phasingCorrectnessInternal(queryPhasedVariants, truthPhasedVariants, sweepDecays,
+                                                         numSweepDecays, bySeqDist, crossBlockCorrect,
+                                                         queryPhaseSetIntervals, truthPhaseSetIntervals,
+                                                         false, NULL);
+        
+        for (int64_t k = 0; k < numSweepDecays; ++k) {
+            double numer = forwardSums[k] + reverseSums[k];
+            double denom = forwardSums[numSweepDecays + k] + reverseSums[numSweepDecays + k];
+            correctnessOut[sweepIdxs[k]] = numer / denom;
+            if (effectivePairCountsOut != NULL) {
+                effectivePairCountsOut[sweepIdxs[k]] = denom;
+            }
+        }
+        
+        free(forwardSums);
+        free(reverseSums);
+        stHash_destruct(queryPhaseSetIntervals);
+        stHash_destruct(truthPhaseSetIntervals);
+    }
+    
+    free(sweepDecays);
+    free(sweepIdxs);
+}
@@ -0,0 +1,21 @@
+/*
+ * Copyright (C) 2020 by Benedict Paten (benedictpaten@gmail.com)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include "logMath.h"
+
+LogAddKernel logAddKernel = LOG_ADD_DEFAULT;
+
+double logMathTable[LOG_MATH_TABLE_LENGTH];
+
+void setLogAddKernel(LogAddKernel kernel) {
+    if (kernel == LOG_ADD_TABLE) {
+        for (int64_t i = 0; i < LOG_MATH_TABLE_LENGTH; i++) {
+            double x = (double) i / LOG_MATH_TABLE_RESOLUTION;
+            logMathTable[i] = x + log1p(exp(-x));
+        }
+    }
+    logAddKernel = kernel;
+}
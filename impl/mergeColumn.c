@@ -10,30 +10,21 @@
  * Read partitioning hmm merge column (stRPMergeColumn) functions
  */
 
-static uint64_t intHashFn(const void *a) {
-    return *(uint64_t *) a;
-}
-
-static int intEqualsFn(const void *key1, const void *key2) {
-    return *(uint64_t *) key1 == *(uint64_t *) key2;
-}
-
-stRPMergeColumn *stRPMergeColumn_construct(uint64_t maskFrom, uint64_t maskTo) {
+stRPMergeColumn *stRPMergeColumn_construct(stRPPartition maskFrom, stRPPartition maskTo) {
     stRPMergeColumn *mColumn = st_calloc(1, sizeof(stRPMergeColumn));
     mColumn->maskFrom = maskFrom;
     mColumn->maskTo = maskTo;
 
     // Maps between partitions and cells
-    mColumn->mergeCellsFrom = stHash_construct3(intHashFn, intEqualsFn, NULL,
-                                                (void (*)(void *)) stRPMergeCell_destruct);
-    mColumn->mergeCellsTo = stHash_construct3(intHashFn, intEqualsFn, NULL, NULL);
+    mColumn->mergeCellsFrom = partitionMap_construct2(0, (void (*)(void *)) stRPMergeCell_destruct);
+    mColumn->mergeCellsTo = partitionMap_construct(0);
 
     return mColumn;
 }
 
 void stRPMergeColumn_destruct(stRPMergeColumn *mColumn) {
-    stHash_destruct(mColumn->mergeCellsFrom);
-    stHash_destruct(mColumn->mergeCellsTo);
+    partitionMap_destruct(mColumn->mergeCellsFrom);
+    partitionMap_destruct(mColumn->mergeCellsTo);
     free(mColumn);
 }
 
@@ -45,18 +36,17 @@ void stRPMergeColumn_print(stRPMergeColumn *mColumn, FILE *fileHandle, bool incl
     char *maskToString = intToBinaryString(mColumn->maskTo);
     fprintf(fileHandle, "\tMERGE_COLUMN MASK_FROM: %s MASK_TO: %s"
                         " DEPTH: %" PRIi64 "\n", maskFromString, maskToString,
-            stHash_size(mColumn->mergeCellsFrom));
-    assert(stHash_size(mColumn->mergeCellsFrom) == stHash_size(mColumn->mergeCellsTo));
+            partitionMap_size(mColumn->mergeCellsFrom));
+    assert(partitionMap_size(mColumn->mergeCellsFrom) == partitionMap_size(mColumn->mergeCellsTo));
     free(maskFromString);
     free(maskToString);
     if (includeCells) {
-        stHashIterator *it = stHash_getIterator(mColumn->mergeCellsFrom);
+        uint64_t slot = 0;
         stRPMergeCell *mCell;
-        while ((mCell = stHash_getNext(it)) != NULL) {
+        while ((mCell = partitionMap_getNext(mColumn->mergeCellsFrom, &slot)) != NULL) {
             fprintf(fileHandle, "\t\t");
             stRPMergeCell_print(mCell, fileHandle);
         }
-        stHash_destructIterator(it);
     }
 }
 
@@ -64,47 +54,43 @@ stRPMergeCell *stRPMergeColumn_getNextMergeCell(stRPCell *cell, stRPMergeColumn
     /*
      * Get the merge cell that this cell feeds into.
      */
-    uint64_t i = maskPartition(cell->partition, mergeColumn->maskFrom);
-    stRPMergeCell *mCell = stHash_search(mergeColumn->mergeCellsFrom, &i);
-    return mCell;
+    return partitionMap_search(mergeColumn->mergeCellsFrom, maskPartition(cell->partition, mergeColumn->maskFrom));
 }
 
 stRPMergeCell *stRPMergeColumn_getPreviousMergeCell(stRPCell *cell, stRPMergeColumn *mergeColumn) {
     /*
      * Get the merge cell that this cell feeds from.
      */
-    uint64_t i = maskPartition(cell->partition, mergeColumn->maskTo);
-    stRPMergeCell *mCell = stHash_search(mergeColumn->mergeCellsTo, &i);
-    return mCell;
+    return partitionMap_search(mergeColumn->mergeCellsTo, maskPartition(cell->partition, mergeColumn->maskTo));
 }
 
 int64_t stRPMergeColumn_numberOfPartitions(stRPMergeColumn *mColumn) {
     /*
      * Returns the number of cells in the column.
      */
-    return stHash_size(mColumn->mergeCellsFrom);
+    return partitionMap_size(mColumn->mergeCellsFrom);
 }
 
 /*
  * Read partitioning hmm merge cell (stRPMergeCell) functions
  */
 
-stRPMergeCell *stRPMergeCell_construct(uint64_t fromPartition, uint64_t toPartition,
+stRPMergeCell *stRPMergeCell_construct(stRPPartition fromPartition, stRPPartition toPartition,
                                        stRPMergeColumn *mColumn) {
     /*
      * Create a merge cell, adding it to the merge column mColumn.
      */
-    assert(popcount64(fromPartition) == popcount64(toPartition));
-    assert(popcount64(mColumn->maskFrom) == popcount64(mColumn->maskTo));
-    assert(popcount64(fromPartition) <= popcount64(mColumn->maskFrom));
+    assert(popcount128(fromPartition) == popcount128(toPartition));
+    assert(popcount128(mColumn->maskFrom) == popcount128(mColumn->maskTo));
+    assert(popcount128(fromPartition) <= popcount128(mColumn->maskFrom));
 
     stRPMergeCell *mCell = st_calloc(1, sizeof(stRPMergeCell));
     mCell->fromPartition = fromPartition;
     mCell->toPartition = toPartition;
-    assert(stHash_search(mColumn->mergeCellsFrom, &mCell->fromPartition) == NULL);
-    stHash_insert(mColumn->mergeCellsFrom, &mCell->fromPartition, mCell);
-    assert(stHash_search(mColumn->mergeCellsTo, &mCell->toPartition) == NULL);
-    stHash_insert(mColumn->mergeCellsTo, &mCell->toPartition, mCell);
+    assert(partitionMap_search(mColumn->mergeCellsFrom, fromPartition) == NULL);
+    partitionMap_insert(mColumn->mergeCellsFrom, fromPartition, mCell);
+    assert(partitionMap_search(mColumn->mergeCellsTo, toPartition) == NULL);
+    partitionMap_insert(mColumn->mergeCellsTo, toPartition, mCell);
     return mCell;
 }
 
@@ -5,10 +5,22 @@
  */
 
 #include "margin.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
 #include <sonLibListPrivate.h>
 #include <helenFeatures.h>
 #include <htsIntegration.h>
+#include <htslib/bgzf.h>
+#include <htslib/kstring.h>
+#include <htslib/tbx.h>
 
 char *getTimeDescriptorFromSeconds(int64_t seconds) {
     int64_t minutes = (int64_t) (seconds / 60);
@@ -27,6 +39,1039 @@ char *getTimeDescriptorFromSeconds(int64_t seconds) {
     return timeDescriptor;
 }
 
+uint64_t parseByteSize(char *string) {
+    char *end = NULL;
+    double size = strtod(string, &end);
+    if (end == string || size < 0) {
+        st_errAbort("Invalid size: %s\n", string);
+    }
+    double multiplier = 1.0;
+    switch (*end) {
+        case 'T': case 't': multiplier *= 1024.0; // fall through
+        case 'G': case 'g': multiplier *= 1024.0; // fall through
+        case 'M': case 'm': multiplier *= 1024.0; // fall through
+        case 'K': case 'k': multiplier *= 1024.0; end++; break;
+        default: break;
+    }
+    if (*end == 'B' || *end == 'b') end++;
+    if (*end != '\0') {
+        st_errAbort("Invalid size: %s\n", string);
+    }
+    return (uint64_t) (size * multiplier);
+}
+
+/*
+ * Buffered CSV writer
+ */
+
+// The buffer is flushed once it has fewer than CSV_WRITER_MAX_FIELD bytes free, so a number always fits
+#define CSV_WRITER_BUFFER_SIZE 65536
+#define CSV_WRITER_MAX_FIELD 64
+
+static const double csvWriter_powersOfTen[] = {1.0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9};
+
+CsvWriter *csvWriter_construct(FILE *fh) {
+    CsvWriter *writer = st_malloc(sizeof(CsvWriter));
+    writer->fh = fh;
+    writer->buffer = st_malloc(CSV_WRITER_BUFFER_SIZE);
+    writer->length = 0;
+    return writer;
+}
+
+void csvWriter_flush(CsvWriter *writer) {
+    if (writer->length > 0 && fwrite(writer->buffer, 1, writer->length, writer->fh) != (size_t) writer->length) {
+        st_errAbort("Could not write CSV output\n");
+    }
+    writer->length = 0;
+}
+
+void csvWriter_destruct(CsvWriter *writer) {
+    csvWriter_flush(writer);
+    free(writer->buffer);
+    free(writer);
+}
+
+static inline void csvWriter_reserve(CsvWriter *writer) {
+    if (writer->length > CSV_WRITER_BUFFER_SIZE - CSV_WRITER_MAX_FIELD) {
+        csvWriter_flush(writer);
+    }
+}
+
+void csvWriter_char(CsvWriter *writer, char c) {
+    csvWriter_reserve(writer);
+    writer->buffer[writer->length++] = c;
+}
+
+void csvWriter_string(CsvWriter *writer, const char *s) {
+    size_t length = strlen(s);
+    if (writer->length + (int64_t) length > CSV_WRITER_BUFFER_SIZE - CSV_WRITER_MAX_FIELD) {
+        csvWriter_flush(writer);
+        if (length > CSV_WRITER_BUFFER_SIZE - CSV_WRITER_MAX_FIELD) { // too long to buffer
+            if (fwrite(s, 1, length, writer->fh) != length) {
+                st_errAbort("Could not write CSV output\n");
+            }
+            return;
+        }
+    }
+    memcpy(writer->buffer + writer->length, s, length);
+    writer->length += length;
+}
+
+static inline void csvWriter_unsigned(CsvWriter *writer, uint64_t i, int64_t minDigits) {
+    // digits are written backwards into a scratch buffer, then copied
+    char digits[24];
+    int64_t n = 0;
+    do {
+        digits[n++] = (char) ('0' + i % 10);
+        i /= 10;
+    } while (i > 0 || n < minDigits);
+    while (n > 0) {
+        writer->buffer[writer->length++] = digits[--n];
+    }
+}
+
+void csvWriter_int(CsvWriter *writer, int64_t i) {
+    csvWriter_reserve(writer);
+    if (i < 0) {
+        writer->buffer[writer->length++] = '-';
+        csvWriter_unsigned(writer, -(uint64_t) i, 1);
+    } else {
+        csvWriter_unsigned(writer, (uint64_t) i, 1);
+    }
+}
+
+void csvWriter_float(CsvWriter *writer, double f, int64_t digits) {
+    assert(digits >= 0 && digits <= 9);
+    csvWriter_reserve(writer);
+    double absF = fabs(f);
+    if (!(absF < 1e15)) { // large, infinite or nan values are left to snprintf
+        int64_t i = snprintf(writer->buffer + writer->length, CSV_WRITER_MAX_FIELD, "%.*f", (int) digits, f);
+        if (i >= CSV_WRITER_MAX_FIELD) {
+            csvWriter_flush(writer);
+            char *s = stString_print("%.*f", (int) digits, f);
+            csvWriter_string(writer, s);
+            free(s);
+        } else {
+            writer->length += i;
+        }
+        return;
+    }
+    // fixed point: the integer part, exact below 2^53, and the fraction times 10^digits, rounded half to even as
+    // printf does
+    double integerPart = digits > 0 ? floor(absF) : rint(absF);
+    uint64_t scale = (uint64_t) csvWriter_powersOfTen[digits];
+    uint64_t fraction = (uint64_t) rint((absF - integerPart) * (double) scale);
+    if (fraction >= scale) { // the fraction rounded up to one
+        integerPart += 1.0;
+        fraction -= scale;
+    }
+    if (signbit(f)) {
+        writer->buffer[writer->length++] = '-';
+    }
+    csvWriter_unsigned(writer, (uint64_t) integerPart, 1);
+    if (digits > 0) {
+        writer->buffer[writer->length++] = '.';
+        csvWriter_unsigned(writer, fraction, digits);
+    }
+}
+
+/*
+ * Per-chunk telemetry
+ */
+
+static const char *chunkTelemetryStageNames[CTS_STAGES] = {"read", "realign", "poaIterations", "bubbleGraph",
+                                                            "phasing", "stitch"};
+static const char *chunkTelemetryCountNames[CTC_COUNTS] = {"reads", "nucleotides", "bubbles", "hmmCells",
+                                                            "hmmMergeCells", "dpCells", "alleleReadScores",
+                                                            "poaObservations", "consensusIterations",
+                                                            "polishIterations", "consensusCycles", "bamBytes"};
+
+typedef struct _chunkTelemetry {
+    BamChunk *bamChunk;
+    int64_t threadIdx;
+    double startWallTime;
+    double startCpuTime;
+    int64_t startMaxRss;
+    double stageStartWallTimes[CTS_STAGES];
+    double stageStartCpuTimes[CTS_STAGES];
+    double stageWallTimes[CTS_STAGES];
+    double stageCpuTimes[CTS_STAGES];
+    int64_t counts[CTC_COUNTS];
+    // the times of each round of POA realignment
+    int64_t poaIterationNo;
+    double poaIterationWallTimes[CHUNK_TELEMETRY_MAX_POA_ITERATIONS];
+    double poaIterationCpuTimes[CHUNK_TELEMETRY_MAX_POA_ITERATIONS];
+    // the hardware counters of each stage, if enabled
+    int64_t stageStartHardwareCounts[CTS_STAGES][CHC_COUNTERS];
+    int64_t stageHardwareCounts[CTS_STAGES][CHC_COUNTERS];
+} ChunkTelemetry;
+
+// the record of the chunk being processed by the thread, if any
+static __thread ChunkTelemetry *threadChunkTelemetry = NULL;
+// the counts the thread's counts are captured in, if any
+static __thread int64_t *threadCapturedCounts = NULL;
+
+// the totals of the run, between chunkTelemetry_startRun and chunkTelemetry_finishRun
+static bool runTelemetryStarted = FALSE;
+static double runStartWallTime;
+static int64_t runChunkNo;
+static int64_t runCounts[CTC_COUNTS];
+static double runStageWallTimes[CTS_STAGES];
+static double runStageCpuTimes[CTS_STAGES];
+static double runWallTime, runCpuTime;
+static int64_t runStageHardwareCounts[CTS_STAGES][CHC_COUNTERS];
+
+/*
+ * Hardware counters
+ */
+
+static const char *chunkHardwareCounterNames[CHC_COUNTERS] = {"cycles", "instructions", "llcMisses",
+                                                              "branchMisses", "dtlbMisses"};
+
+static bool hardwareCountersEnabled = FALSE;
+// set if a thread could not open the counter, so the run's total of it is incomplete
+static bool hardwareCounterUnavailable[CHC_COUNTERS];
+
+// the thread's counters, opened by the first chunk it records, -1 if they could not be
+static __thread bool threadHardwareCountersOpened = FALSE;
+static __thread int threadHardwareCounterFds[CHC_COUNTERS];
+
+void chunkTelemetry_setHardwareCounters(bool enabled) {
+    hardwareCountersEnabled = enabled;
+}
+
+static void hardwareCounters_open() {
+    for (int64_t i = 0; i < CHC_COUNTERS; i++) {
+        threadHardwareCounterFds[i] = -1;
+#if defined(__linux__)
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        // when the counters are multiplexed, the counts are scaled by the time each was counting
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        switch ((ChunkHardwareCounter) i) {
+        case CHC_CYCLES:
+            attr.config = PERF_COUNT_HW_CPU_CYCLES;
+            break;
+        case CHC_INSTRUCTIONS:
+            attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+            break;
+        case CHC_LLC_MISSES:
+            attr.config = PERF_COUNT_HW_CACHE_MISSES;
+            break;
+        case CHC_BRANCH_MISSES:
+            attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+            break;
+        default:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            break;
+        }
+        // counts the calling thread on any cpu
+        threadHardwareCounterFds[i] = (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+        if (threadHardwareCounterFds[i] < 0) {
+            if (!hardwareCounterUnavailable[i]) {
+                hardwareCounterUnavailable[i] = TRUE;
+                st_logInfo("> Could not open the %s hardware counter, it is reported as -1\n",
+                           chunkHardwareCounterNames[i]);
+            }
+        }
+    }
+    threadHardwareCountersOpened = TRUE;
+}
+
+static void hardwareCounters_read(int64_t *counts) {
+    for (int64_t i = 0; i < CHC_COUNTERS; i++) {
+        counts[i] = 0;
+        uint64_t values[3]; // the count, and the times enabled and running
+        if (threadHardwareCounterFds[i] >= 0 && read(threadHardwareCounterFds[i], values, sizeof(values)) ==
+                                                sizeof(values) && values[2] > 0) {
+            counts[i] = (int64_t) ((double) values[0] * ((double) values[1] / (double) values[2]));
+        }
+    }
+}
+
+static void printHardwareCounts(FILE *fh, char *name, int64_t counts[CTS_STAGES][CHC_COUNTERS], bool *unavailable) {
+    fprintf(fh, ", \"%s\": {", name);
+    for (int64_t i = 0; i < CTS_STAGES; i++) {
+        fprintf(fh, "%s\"%s\": {", i == 0 ? "" : ", ", chunkTelemetryStageNames[i]);
+        for (int64_t j = 0; j < CHC_COUNTERS; j++) {
+            fprintf(fh, "%s\"%s\": %" PRId64, j == 0 ? "" : ", ", chunkHardwareCounterNames[j],
+                    unavailable[j] ? -1 : counts[i][j]);
+        }
+        fprintf(fh, "}");
+    }
+    fprintf(fh, "}");
+}
+
+static double getTelemetryTime(clockid_t clock) {
+    struct timespec time;
+    clock_gettime(clock, &time);
+    return (double) time.tv_sec + (double) time.tv_nsec / 1.0e9;
+}
+
+static int64_t getMaxRss() {
+    // in kilobytes on linux, bytes on macos
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (int64_t) usage.ru_maxrss;
+}
+
+void chunkTelemetry_start(BamChunk *bamChunk) {
+    ChunkTelemetry *telemetry = threadChunkTelemetry;
+    if (telemetry == NULL) {
+        telemetry = threadChunkTelemetry = st_malloc(sizeof(ChunkTelemetry));
+    }
+    memset(telemetry, 0, sizeof(ChunkTelemetry));
+    telemetry->bamChunk = bamChunk;
+# ifdef _OPENMP
+    telemetry->threadIdx = omp_get_thread_num();
+# endif
+    telemetry->startWallTime = getTelemetryTime(CLOCK_MONOTONIC);
+    telemetry->startCpuTime = getTelemetryTime(CLOCK_THREAD_CPUTIME_ID);
+    telemetry->startMaxRss = getMaxRss();
+    allocProfile_startChunk();
+    if (hardwareCountersEnabled && !threadHardwareCountersOpened) {
+        hardwareCounters_open();
+    }
+}
+
+void chunkTelemetry_startStage(ChunkTelemetryStage stage) {
+    ChunkTelemetry *telemetry = threadChunkTelemetry;
+    if (telemetry == NULL || telemetry->bamChunk == NULL) {
+        return;
+    }
+    telemetry->stageStartWallTimes[stage] = getTelemetryTime(CLOCK_MONOTONIC);
+    telemetry->stageStartCpuTimes[stage] = getTelemetryTime(CLOCK_THREAD_CPUTIME_ID);
+    if (hardwareCountersEnabled) {
+        hardwareCounters_read(telemetry->stageStartHardwareCounts[stage]);
+    }
+}
+
+void chunkTelemetry_endStage(ChunkTelemetryStage stage) {
+    ChunkTelemetry *telemetry = threadChunkTelemetry;
+    if (telemetry == NULL || telemetry->bamChunk == NULL) {
+        return;
+    }
+    double wallTime = getTelemetryTime(CLOCK_MONOTONIC) - telemetry->stageStartWallTimes[stage];
+    double cpuTime = getTelemetryTime(CLOCK_THREAD_CPUTIME_ID) - telemetry->stageStartCpuTimes[stage];
+    telemetry->stageWallTimes[stage] += wallTime;
+    telemetry->stageCpuTimes[stage] += cpuTime;
+    if (hardwareCountersEnabled) {
+        int64_t hardwareCounts[CHC_COUNTERS];
+        hardwareCounters_read(hardwareCounts);
+        for (int64_t i = 0; i < CHC_COUNTERS; i++) {
+            telemetry->stageHardwareCounts[stage][i] += hardwareCounts[i] - telemetry->stageStartHardwareCounts[stage][i];
+        }
+    }
+    if (stage == CTS_POA_ITERATION && telemetry->poaIterationNo < CHUNK_TELEMETRY_MAX_POA_ITERATIONS) {
+        telemetry->poaIterationWallTimes[telemetry->poaIterationNo] = wallTime;
+        telemetry->poaIterationCpuTimes[telemetry->poaIterationNo++] = cpuTime;
+    }
+}
+
+void chunkTelemetry_addCount(ChunkTelemetryCount count, int64_t n) {
+    if (threadCapturedCounts != NULL) {
+        threadCapturedCounts[count] += n;
+        return;
+    }
+    ChunkTelemetry *telemetry = threadChunkTelemetry;
+    if (telemetry != NULL && telemetry->bamChunk != NULL) {
+        telemetry->counts[count] += n;
+    } else if (runTelemetryStarted) {
+        // work done outside any chunk's record, such as by a thread lent to the chunks still in flight
+        __atomic_fetch_add(&runCounts[count], n, __ATOMIC_RELAXED);
+    }
+}
+
+void chunkTelemetry_captureCounts(int64_t *counts) {
+    threadCapturedCounts = counts;
+}
+
+void chunkTelemetry_addCounts(int64_t *counts) {
+    for (int64_t i = 0; i < CTC_COUNTS; i++) {
+        if (counts[i] != 0) {
+            chunkTelemetry_addCount((ChunkTelemetryCount) i, counts[i]);
+        }
+    }
+}
+
+static void printTelemetryTimes(FILE *fh, char *name, double *stageTimes, double totalTime, double *poaIterationTimes,
+                                int64_t poaIterationNo) {
+    fprintf(fh, ", \"%s\": {\"total\": %.6f", name, totalTime);
+    for (int64_t i = 0; i < CTS_STAGES; i++) {
+        fprintf(fh, ", \"%s\": %.6f", chunkTelemetryStageNames[i], stageTimes[i]);
+    }
+    if (poaIterationTimes != NULL) {
+        fprintf(fh, ", \"poaIterationTimes\": [");
+        for (int64_t i = 0; i < poaIterationNo; i++) {
+            fprintf(fh, "%s%.6f", i == 0 ? "" : ", ", poaIterationTimes[i]);
+        }
+        fprintf(fh, "]");
+    }
+    fprintf(fh, "}");
+}
+
+void chunkTelemetry_finish(FILE *fh) {
+    ChunkTelemetry *telemetry = threadChunkTelemetry;
+    if (telemetry == NULL || telemetry->bamChunk == NULL) {
+        return;
+    }
+    if (fh == NULL) {
+        telemetry->bamChunk = NULL;
+        return;
+    }
+    double wallTime = getTelemetryTime(CLOCK_MONOTONIC) - telemetry->startWallTime;
+    double cpuTime = getTelemetryTime(CLOCK_THREAD_CPUTIME_ID) - telemetry->startCpuTime;
+    int64_t maxRssDelta = getMaxRss() - telemetry->startMaxRss;
+
+    // build the line, so the threads' lines are written whole
+    char *line = NULL;
+    size_t lineLength = 0;
+    FILE *lineFh = open_memstream(&line, &lineLength);
+    BamChunk *bamChunk = telemetry->bamChunk;
+    fprintf(lineFh, "{\"chunk\": %" PRId64 ", \"contig\": \"%s\", \"start\": %" PRId64 ", \"end\": %" PRId64
+                    ", \"thread\": %" PRId64, bamChunk->chunkIdx, bamChunk->refSeqName, bamChunk->chunkStart,
+            bamChunk->chunkEnd, telemetry->threadIdx);
+    for (int64_t i = 0; i < CTC_COUNTS; i++) {
+        fprintf(lineFh, ", \"%s\": %" PRId64, chunkTelemetryCountNames[i], telemetry->counts[i]);
+    }
+    fprintf(lineFh, ", \"maxRssDelta\": %" PRId64, maxRssDelta);
+    allocProfile_printChunk(lineFh);
+    printTelemetryTimes(lineFh, "wallTime", telemetry->stageWallTimes, wallTime, telemetry->poaIterationWallTimes,
+                        telemetry->poaIterationNo);
+    printTelemetryTimes(lineFh, "cpuTime", telemetry->stageCpuTimes, cpuTime, telemetry->poaIterationCpuTimes,
+                        telemetry->poaIterationNo);
+    if (hardwareCountersEnabled) {
+        bool unavailable[CHC_COUNTERS];
+        for (int64_t i = 0; i < CHC_COUNTERS; i++) {
+            unavailable[i] = threadHardwareCounterFds[i] < 0;
+        }
+        printHardwareCounts(lineFh, "hardwareCounters", telemetry->stageHardwareCounts, unavailable);
+    }
+    fprintf(lineFh, "}\n");
+    fclose(lineFh);
+
+    # ifdef _OPENMP
+    #pragma omp critical (chunkTelemetry)
+    # endif
+    {
+        fwrite(line, 1, lineLength, fh);
+        if (runTelemetryStarted) {
+            runChunkNo++;
+            for (int64_t i = 0; i < CTC_COUNTS; i++) {
+                __atomic_fetch_add(&runCounts[i], telemetry->counts[i], __ATOMIC_RELAXED);
+            }
+            for (int64_t i = 0; i < CTS_STAGES; i++) {
+                runStageWallTimes[i] += telemetry->stageWallTimes[i];
+                runStageCpuTimes[i] += telemetry->stageCpuTimes[i];
+                for (int64_t j = 0; j < CHC_COUNTERS; j++) {
+                    runStageHardwareCounts[i][j] += telemetry->stageHardwareCounts[i][j];
+                }
+            }
+            runWallTime += wallTime;
+            runCpuTime += cpuTime;
+        }
+    }
+    free(line);
+    telemetry->bamChunk = NULL;
+}
+
+bool chunkTelemetry_getProgress(double *wallTime, int64_t *counts) {
+    ChunkTelemetry *telemetry = threadChunkTelemetry;
+    if (telemetry == NULL || telemetry->bamChunk == NULL) {
+        return FALSE;
+    }
+    *wallTime = getTelemetryTime(CLOCK_MONOTONIC) - telemetry->startWallTime;
+    memcpy(counts, telemetry->counts, CTC_COUNTS * sizeof(int64_t));
+    return TRUE;
+}
+
+void chunkTelemetry_startRun() {
+    runChunkNo = 0;
+    memset(runCounts, 0, sizeof(runCounts));
+    memset(runStageWallTimes, 0, sizeof(runStageWallTimes));
+    memset(runStageCpuTimes, 0, sizeof(runStageCpuTimes));
+    memset(runStageHardwareCounts, 0, sizeof(runStageHardwareCounts));
+    runWallTime = 0.0;
+    runCpuTime = 0.0;
+    runStartWallTime = getTelemetryTime(CLOCK_MONOTONIC);
+    runTelemetryStarted = TRUE;
+    allocProfile_start();
+}
+
+void chunkTelemetry_finishRun(FILE *fh) {
+    if (!runTelemetryStarted) {
+        return;
+    }
+    runTelemetryStarted = FALSE;
+    fprintf(fh, "{\"run\": {\"chunks\": %" PRId64 ", \"wallTime\": %.6f", runChunkNo,
+            getTelemetryTime(CLOCK_MONOTONIC) - runStartWallTime);
+    for (int64_t i = 0; i < CTC_COUNTS; i++) {
+        fprintf(fh, ", \"%s\": %" PRId64, chunkTelemetryCountNames[i], runCounts[i]);
+    }
+    allocProfile_printRun(fh);
+    allocProfile_finish();
+    fprintf(fh, "}");
+    // the times of the stages, summed over the chunks
+    printTelemetryTimes(fh, "chunkWallTime", runStageWallTimes, runWallTime, NULL, 0);
+    printTelemetryTimes(fh, "chunkCpuTime", runStageCpuTimes, runCpuTime, NULL, 0);
+    if (hardwareCountersEnabled) {
+        printHardwareCounts(fh, "chunkHardwareCounters", runStageHardwareCounts, hardwareCounterUnavailable);
+    }
+    fprintf(fh, "}\n");
+}
+
+/*
+ * Timeline tracing
+ */
+
+typedef struct _traceEvent {
+    const char *name;
+    char phase;     // 'B' for begin, 'E' for end
+    int64_t chunkIdx;  // the chunk begun, or -1
+    int64_t time;   // in nanoseconds since the recorder was started
+} TraceEvent;
+
+typedef struct _traceBuffer {
+    int64_t threadIdx;
+    int64_t eventNo; // the number of events recorded, the buffer holding the last TRACE_BUFFER_SIZE of them
+    TraceEvent events[TRACE_BUFFER_SIZE];
+} TraceBuffer;
+
+static bool traceEnabled = FALSE;
+static char *traceFile = NULL;
+static int64_t traceStartTime;
+static stList *traceBuffers = NULL;
+// incremented when the recorder finishes, so threads do not reuse buffers it has freed
+static int64_t traceGeneration = 0;
+
+static __thread TraceBuffer *threadTraceBuffer = NULL;
+static __thread int64_t threadTraceGeneration = -1;
+
+static int64_t getTraceTime() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (int64_t) time.tv_sec * 1000000000 + (int64_t) time.tv_nsec;
+}
+
+void traceRecorder_start(char *file) {
+    if (traceEnabled) {
+        st_errAbort("The trace recorder was started twice\n");
+    }
+    traceFile = stString_copy(file);
+    traceBuffers = stList_construct3(0, free);
+    traceStartTime = getTraceTime();
+    traceEnabled = TRUE;
+}
+
+static void traceRecorder_record(const char *name, char phase, int64_t chunkIdx) {
+    TraceBuffer *buffer = threadTraceBuffer;
+    if (buffer == NULL || threadTraceGeneration != traceGeneration) {
+        // the only synchronization, once per thread
+        buffer = st_calloc(1, sizeof(TraceBuffer));
+        # ifdef _OPENMP
+        #pragma omp critical (traceRecorder)
+        # endif
+        {
+            buffer->threadIdx = stList_length(traceBuffers);
+            stList_append(traceBuffers, buffer);
+        }
+        threadTraceBuffer = buffer;
+        threadTraceGeneration = traceGeneration;
+    }
+    TraceEvent *event = &buffer->events[buffer->eventNo++ % TRACE_BUFFER_SIZE];
+    event->name = name;
+    event->phase = phase;
+    event->chunkIdx = chunkIdx;
+    event->time = getTraceTime() - traceStartTime;
+}
+
+void traceRecorder_begin(const char *name) {
+    if (traceEnabled) {
+        traceRecorder_record(name, 'B', -1);
+    }
+}
+
+void traceRecorder_beginChunk(int64_t chunkIdx) {
+    if (traceEnabled) {
+        traceRecorder_record("chunk", 'B', chunkIdx);
+    }
+}
+
+void traceRecorder_end(const char *name) {
+    if (traceEnabled) {
+        traceRecorder_record(name, 'E', -1);
+    }
+}
+
+void traceRecorder_finish() {
+    if (!traceEnabled) {
+        return;
+    }
+    traceEnabled = FALSE;
+
+    FILE *fh = safe_fopen(traceFile, "w");
+    fprintf(fh, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    fprintf(fh, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, \"args\": {\"name\": \"margin\"}}");
+    int64_t droppedEvents = 0;
+    for (int64_t i = 0; i < stList_length(traceBuffers); i++) {
+        TraceBuffer *buffer = stList_get(traceBuffers, i);
+        fprintf(fh, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %" PRId64
+                    ", \"args\": {\"name\": \"thread %" PRId64 "\"}}", buffer->threadIdx, buffer->threadIdx);
+        // oldest first, those overwritten being lost
+        int64_t firstEvent = buffer->eventNo > TRACE_BUFFER_SIZE ? buffer->eventNo - TRACE_BUFFER_SIZE : 0;
+        droppedEvents += firstEvent;
+        for (int64_t j = firstEvent; j < buffer->eventNo; j++) {
+            TraceEvent *event = &buffer->events[j % TRACE_BUFFER_SIZE];
+            fprintf(fh, ",\n{\"name\": \"%s\", \"ph\": \"%c\", \"pid\": 1, \"tid\": %" PRId64 ", \"ts\": %.3f",
+                    event->name, event->phase, buffer->threadIdx, (double) event->time / 1000.0);
+            if (event->chunkIdx >= 0) {
+                fprintf(fh, ", \"args\": {\"chunk\": %" PRId64 "}", event->chunkIdx);
+            }
+            fprintf(fh, "}");
+        }
+    }
+    fprintf(fh, "\n]}\n");
+    fclose(fh);
+
+    st_logCritical("> Wrote trace of %" PRId64 " threads to %s\n", stList_length(traceBuffers), traceFile);
+    if (droppedEvents > 0) {
+        st_logCritical("> The trace is missing the first %" PRId64 " events of threads whose buffers filled\n",
+                       droppedEvents);
+    }
+    stList_destruct(traceBuffers);
+    traceBuffers = NULL;
+    free(traceFile);
+    traceFile = NULL;
+    traceGeneration++;
+}
+
+/*
+ * Buffered logging
+ */
+
+// the longest line formatted on the stack, longer lines being formatted on the heap
+#define LOG_LINE_SIZE 1024
+// milliseconds the flusher waits for lines when the buffers are empty
+#define LOG_FLUSH_INTERVAL 50
+
+typedef struct _logBuffer {
+    uint64_t head; // bytes written to the buffer by its thread
+    uint64_t tail; // bytes of them written out by the flusher
+    char data[LOG_BUFFER_SIZE];
+} LogBuffer;
+
+static bool logBufferEnabled = FALSE;
+static FILE *logBufferFh = NULL;
+static stList *logBuffers = NULL;
+// held by the flusher as it writes out the buffers, and by a thread adding its buffer
+static pthread_mutex_t logBufferMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t logBufferCond = PTHREAD_COND_INITIALIZER;
+static pthread_t logBufferFlusher;
+static bool logBufferStopping = FALSE;
+// incremented when the logging finishes, so threads do not reuse buffers it has freed
+static int64_t logBufferGeneration = 0;
+
+static __thread LogBuffer *threadLogBuffer = NULL;
+static __thread int64_t threadLogGeneration = -1;
+
+static bool logBuffer_writeOut(LogBuffer *buffer) {
+    /*
+     * Writes the complete lines of the buffer to the file, returning whether there were any.
+     */
+    uint64_t head = __atomic_load_n(&buffer->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = buffer->tail;
+    if (head == tail) {
+        return FALSE;
+    }
+    uint64_t start = tail % LOG_BUFFER_SIZE;
+    uint64_t length = head - tail;
+    uint64_t firstLength = length < LOG_BUFFER_SIZE - start ? length : LOG_BUFFER_SIZE - start;
+    // locked so a line wrapping around the end of the buffer is not split by a line written directly
+    flockfile(logBufferFh);
+    fwrite(&buffer->data[start], 1, firstLength, logBufferFh);
+    if (length > firstLength) {
+        fwrite(buffer->data, 1, length - firstLength, logBufferFh);
+    }
+    funlockfile(logBufferFh);
+    __atomic_store_n(&buffer->tail, head, __ATOMIC_RELEASE);
+    return TRUE;
+}
+
+static void *logBuffer_flush(void *arg) {
+    /*
+     * The flusher, writing out the buffers until the logging finishes and they are empty.
+     */
+    pthread_mutex_lock(&logBufferMutex);
+    while (1) {
+        bool wrote = FALSE;
+        for (int64_t i = 0; i < stList_length(logBuffers); i++) {
+            wrote |= logBuffer_writeOut(stList_get(logBuffers, i));
+        }
+        if (wrote) {
+            fflush(logBufferFh);
+            continue;
+        }
+        if (logBufferStopping) {
+            break;
+        }
+        struct timespec wakeTime;
+        clock_gettime(CLOCK_REALTIME, &wakeTime);
+        wakeTime.tv_nsec += LOG_FLUSH_INTERVAL * 1000000L;
+        if (wakeTime.tv_nsec >= 1000000000L) {
+            wakeTime.tv_sec++;
+            wakeTime.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&logBufferCond, &logBufferMutex, &wakeTime);
+    }
+    pthread_mutex_unlock(&logBufferMutex);
+    return NULL;
+}
+
+void logBuffer_start(FILE *fh) {
+    if (logBufferEnabled) {
+        st_errAbort("Buffered logging was started twice\n");
+    }
+    logBufferFh = fh;
+    logBuffers = stList_construct3(0, free);
+    logBufferStopping = FALSE;
+    if (pthread_create(&logBufferFlusher, NULL, logBuffer_flush, NULL) != 0) {
+        st_errAbort("Could not start the thread writing out the log buffers\n");
+    }
+    logBufferEnabled = TRUE;
+}
+
+static void logBuffer_append(const char *line, uint64_t length) {
+    LogBuffer *buffer = threadLogBuffer;
+    if (buffer == NULL || threadLogGeneration != logBufferGeneration) {
+        // the only synchronization, once per thread
+        buffer = st_calloc(1, sizeof(LogBuffer));
+        pthread_mutex_lock(&logBufferMutex);
+        stList_append(logBuffers, buffer);
+        pthread_mutex_unlock(&logBufferMutex);
+        threadLogBuffer = buffer;
+        threadLogGeneration = logBufferGeneration;
+    }
+
+    // a line too long for the buffer is written directly, once the thread's earlier lines are written out
+    uint64_t head = buffer->head;
+    uint64_t neededTail = length > LOG_BUFFER_SIZE ? head : head + length - LOG_BUFFER_SIZE;
+    while (head + length > LOG_BUFFER_SIZE && __atomic_load_n(&buffer->tail, __ATOMIC_ACQUIRE) < neededTail) {
+        pthread_cond_signal(&logBufferCond);
+        sched_yield();
+    }
+    if (length > LOG_BUFFER_SIZE) {
+        fwrite(line, 1, length, logBufferFh);
+        return;
+    }
+
+    uint64_t start = head % LOG_BUFFER_SIZE;
+    uint64_t firstLength = length < LOG_BUFFER_SIZE - start ? length : LOG_BUFFER_SIZE - start;
+    memcpy(&buffer->data[start], line, firstLength);
+    memcpy(buffer->data, line + firstLength, length - firstLength);
+    __atomic_store_n(&buffer->head, head + length, __ATOMIC_RELEASE);
+}
+
+static void logBuffer_write(char *prefix, const char *format, va_list args) {
+    /*
+     * Formats the line, after the prefix, and appends it to the thread's buffer or, if the logging is not started,
+     * writes it to stderr.
+     */
+    char stackLine[LOG_LINE_SIZE];
+    size_t prefixLength = strlen(prefix);
+    char *line = stackLine;
+    va_list argsCopy;
+    va_copy(argsCopy, args);
+    int64_t length = prefixLength + vsnprintf(prefixLength < LOG_LINE_SIZE ? stackLine + prefixLength : stackLine,
+                                              prefixLength < LOG_LINE_SIZE ? LOG_LINE_SIZE - prefixLength : 0,
+                                              format, argsCopy);
+    va_end(argsCopy);
+    if (length >= LOG_LINE_SIZE) {
+        line = st_malloc(length + 1);
+        vsnprintf(line + prefixLength, length + 1 - prefixLength, format, args);
+    }
+    memcpy(line, prefix, prefixLength);
+
+    if (logBufferEnabled) {
+        logBuffer_append(line, length);
+    } else {
+        fwrite(line, 1, length, stderr);
+    }
+    if (line != stackLine) {
+        free(line);
+    }
+}
+
+void logBuffer_print(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    logBuffer_write("", format, args);
+    va_end(args);
+}
+
+void logBuffer_printFields(const char *event, const char *fieldsFormat, ...) {
+    struct timespec time;
+    clock_gettime(CLOCK_REALTIME, &time);
+    # ifdef _OPENMP
+    int64_t threadIdx = omp_get_thread_num();
+    # else
+    int64_t threadIdx = 0;
+    # endif
+    char *prefix = stString_print("EVENT event=%s time=%" PRId64 ".%03" PRId64 " thread=%" PRId64 " ", event,
+                                  (int64_t) time.tv_sec, (int64_t) time.tv_nsec / 1000000, threadIdx);
+    va_list args;
+    va_start(args, fieldsFormat);
+    logBuffer_write(prefix, fieldsFormat, args);
+    va_end(args);
+    free(prefix);
+}
+
+void logBuffer_finish() {
+    if (!logBufferEnabled) {
+        return;
+    }
+    logBufferEnabled = FALSE;
+    pthread_mutex_lock(&logBufferMutex);
+    logBufferStopping = TRUE;
+    pthread_cond_signal(&logBufferCond);
+    pthread_mutex_unlock(&logBufferMutex);
+    pthread_join(logBufferFlusher, NULL);
+    stList_destruct(logBuffers);
+    logBuffers = NULL;
+    logBufferFh = NULL;
+    logBufferGeneration++;
+}
+
+/*
+ * Chunk arenas
+ */
+
+typedef struct _chunkArenaBlock {
+    // the allocations from the block not yet freed, plus one while it is the current block of its thread's arena
+    int64_t liveNo;
+    int64_t capacity; // bytes of data, also so the data is aligned to 16 bytes
+    char data[];
+} ChunkArenaBlock;
+
+// each allocation is preceded by its block, or NULL if it is from the heap
+#define CHUNK_ARENA_HEADER_SIZE ((int64_t) sizeof(ChunkArenaBlock *))
+
+static int64_t chunkArenaLiveBlockNo = 0;
+
+static __thread bool chunkArenaOpen = FALSE;
+static __thread ChunkArenaBlock *chunkArenaBlock = NULL;
+static __thread int64_t chunkArenaBlockUsed = 0;
+static __thread ChunkArenaStats chunkArenaStats;
+
+static void chunkArenaBlock_release(ChunkArenaBlock *block) {
+    int64_t liveNo;
+    # ifdef _OPENMP
+    #pragma omp atomic capture
+    # endif
+    liveNo = --block->liveNo;
+    if (liveNo == 0) {
+        hugePages_free(block, sizeof(ChunkArenaBlock) + block->capacity);
+        # ifdef _OPENMP
+        #pragma omp atomic
+        # endif
+        chunkArenaLiveBlockNo--;
+    }
+}
+
+void chunkArena_open() {
+    if (chunkArenaOpen) {
+        st_errAbort("The chunk arena of this thread is already open\n");
+    }
+    chunkArenaOpen = TRUE;
+    memset(&chunkArenaStats, 0, sizeof(ChunkArenaStats));
+}
+
+void chunkArena_close() {
+    if (!chunkArenaOpen) {
+        st_errAbort("The chunk arena of this thread is not open\n");
+    }
+    if (chunkArenaBlock != NULL) {
+        chunkArenaBlock_release(chunkArenaBlock);
+        chunkArenaBlock = NULL;
+    }
+    chunkArenaOpen = FALSE;
+}
+
+void *chunkArena_malloc(size_t size) {
+    int64_t bytes = (CHUNK_ARENA_HEADER_SIZE + (int64_t) size + 7) & ~((int64_t) 7);
+    ChunkArenaBlock **header;
+    if (!chunkArenaOpen || bytes > CHUNK_ARENA_MAX_ALLOCATION) {
+        header = st_malloc(CHUNK_ARENA_HEADER_SIZE + size);
+        *header = NULL;
+        if (chunkArenaOpen) chunkArenaStats.heapAllocations++;
+        return header + 1;
+    }
+    if (chunkArenaBlock == NULL || chunkArenaBlockUsed + bytes > chunkArenaBlock->capacity) {
+        // the full block is freed by the last free of its allocations
+        if (chunkArenaBlock != NULL) chunkArenaBlock_release(chunkArenaBlock);
+        // a huge page backed block fills its huge page
+        int64_t capacity = hugePages_isEnabled() ? HUGE_PAGE_SIZE - (int64_t) sizeof(ChunkArenaBlock) :
+                           CHUNK_ARENA_BLOCK_SIZE;
+        chunkArenaBlock = hugePages_malloc(sizeof(ChunkArenaBlock) + capacity);
+        chunkArenaBlock->liveNo = 1;
+        chunkArenaBlock->capacity = capacity;
+        chunkArenaBlockUsed = 0;
+        chunkArenaStats.blocks++;
+        # ifdef _OPENMP
+        #pragma omp atomic
+        # endif
+        chunkArenaLiveBlockNo++;
+    }
+    header = (ChunkArenaBlock **) (chunkArenaBlock->data + chunkArenaBlockUsed);
+    *header = chunkArenaBlock;
+    chunkArenaBlockUsed += bytes;
+    # ifdef _OPENMP
+    #pragma omp atomic
+    # endif
+    chunkArenaBlock->liveNo++;
+    chunkArenaStats.allocations++;
+    chunkArenaStats.bytes += bytes;
+    return header + 1;
+}
+
+void *chunkArena_calloc(size_t n, size_t size) {
+    void *ptr = chunkArena_malloc(n * size);
+    memset(ptr, 0, n * size);
+    return ptr;
+}
+
+void chunkArena_free(void *ptr) {
+    if (ptr == NULL) return;
+    ChunkArenaBlock **header = ((ChunkArenaBlock **) ptr) - 1;
+    if (*header == NULL) {
+        free(header);
+    } else {
+        chunkArenaBlock_release(*header);
+    }
+}
+
+void chunkArena_getStats(ChunkArenaStats *stats) {
+    *stats = chunkArenaStats;
+}
+
+int64_t chunkArena_getLiveBlockNo() {
+    int64_t liveBlockNo;
+    # ifdef _OPENMP
+    #pragma omp atomic read
+    # endif
+    liveBlockNo = chunkArenaLiveBlockNo;
+    return liveBlockNo;
+}
+
+/*
+ * Huge pages
+ */
+
+static bool hugePagesEnabled = FALSE;
+static HugePageStats hugePageStats;
+
+void hugePages_setEnabled(bool enabled) {
+    hugePagesEnabled = enabled;
+}
+
+bool hugePages_isEnabled() {
+    return hugePagesEnabled;
+}
+
+void *hugePages_malloc(size_t size) {
+    if (!hugePagesEnabled) {
+        return st_malloc(size);
+    }
+    int64_t bytes = ((int64_t) size + HUGE_PAGE_SIZE - 1) & ~((int64_t) HUGE_PAGE_SIZE - 1);
+    void *ptr;
+    if (posix_memalign(&ptr, HUGE_PAGE_SIZE, bytes) != 0) {
+        st_errAbort("Could not allocate %" PRIi64 " bytes of huge pages\n", bytes);
+    }
+    # ifdef MADV_HUGEPAGE
+    // the kernel may back the range with huge pages whatever the system's THP setting, unless it is 'never'
+    madvise(ptr, bytes, MADV_HUGEPAGE);
+    # endif
+    # ifdef _OPENMP
+    #pragma omp critical (hugePages)
+    # endif
+    {
+        hugePageStats.allocations++;
+        hugePageStats.requestedBytes += (int64_t) size;
+        hugePageStats.bytes += bytes;
+        if (hugePageStats.bytes > hugePageStats.peakBytes) hugePageStats.peakBytes = hugePageStats.bytes;
+    }
+    return ptr;
+}
+
+void hugePages_free(void *ptr, size_t size) {
+    if (ptr == NULL) return;
+    if (hugePagesEnabled) {
+        int64_t bytes = ((int64_t) size + HUGE_PAGE_SIZE - 1) & ~((int64_t) HUGE_PAGE_SIZE - 1);
+        # ifdef _OPENMP
+        #pragma omp critical (hugePages)
+        # endif
+        {
+            hugePageStats.requestedBytes -= (int64_t) size;
+            hugePageStats.bytes -= bytes;
+        }
+    }
+    free(ptr);
+}
+
+static int64_t hugePages_getProcessHugePageBytes() {
+    /*
+     * Gets the bytes of the process's anonymous memory the kernel has backed with huge pages, or -1 if not known.
+     */
+    FILE *fh = fopen("/proc/self/smaps_rollup", "r");
+    if (fh == NULL) {
+        return -1;
+    }
+    int64_t kilobytes = -1;
+    char *line;
+    while ((line = stFile_getLineFromFile(fh)) != NULL) {
+        if (kilobytes < 0 && sscanf(line, "AnonHugePages: %" SCNi64 " kB", &kilobytes) != 1) {
+            kilobytes = -1;
+        }
+        free(line);
+    }
+    fclose(fh);
+    return kilobytes < 0 ? -1 : kilobytes * 1024;
+}
+
+void hugePages_getStats(HugePageStats *stats) {
+    # ifdef _OPENMP
+    #pragma omp critical (hugePages)
+    # endif
+    {
+        *stats = hugePageStats;
+    }
+    stats->processHugePageBytes = hugePages_getProcessHugePageBytes();
+}
+
+void hugePages_logSummary() {
+    if (!hugePagesEnabled) {
+        return;
+    }
+    HugePageStats stats;
+    hugePages_getStats(&stats);
+    st_logCritical("> Huge pages: %" PRIi64 " allocations, %" PRIi64 "K held (%" PRIi64 "K requested), peak %" PRIi64
+                   "K, peak RSS %" PRIi64 "K\n", stats.allocations, stats.bytes >> 10, stats.requestedBytes >> 10,
+                   stats.peakBytes >> 10, getMaxRss());
+    if (stats.processHugePageBytes < 0) {
+        st_logCritical("> Huge pages: could not read the process's huge page backed memory\n");
+    } else {
+        st_logCritical("> Huge pages: %" PRIi64 "K of the process backed by huge pages, %.1f%% of that held\n",
+                       stats.processHugePageBytes >> 10,
+                       stats.bytes > 0 ? 100.0 * (double) stats.processHugePageBytes / (double) stats.bytes : 0.0);
+    }
+}
+
 stHash *parseReferenceSequences(char *referenceFastaFile) {
     /*
      * Get hash of reference sequence names in fasta to their sequences, doing some munging on the sequence names.
@@ -193,6 +1238,36 @@ void removeReadsOnlyInChunkBoundary(BamChunk *bamChunk, stList *reads, stList *a
     stList_destruct(indicesToRemove);
 }
 
+double getAlignmentDivergence(stList *reads, stList *alignments, RleString *reference) {
+    /*
+     * Returns the fraction of the columns of the reads' anchor alignments to the reference that are mismatches
+     * (of base or repeat count) or inserted or deleted bases, the gaps between consecutive aligned pairs.
+     */
+    int64_t columns = 0, divergentColumns = 0;
+    for (int64_t i = 0; i < stList_length(reads); i++) {
+        RleString *read = ((BamChunkRead *) stList_get(reads, i))->rleRead;
+        stList *alignment = stList_get(alignments, i);
+        int64_t pRefPos = -1, pReadPos = -1;
+        for (int64_t j = 0; j < stList_length(alignment); j++) {
+            stIntTuple *alignedPair = stList_get(alignment, j);
+            int64_t refPos = stIntTuple_get(alignedPair, 0), readPos = stIntTuple_get(alignedPair, 1);
+            if (read->rleString[readPos] != reference->rleString[refPos] ||
+                rleString_getRepeatCount(read, readPos) != rleString_getRepeatCount(reference, refPos)) {
+                divergentColumns++;
+            }
+            if (j > 0) {
+                int64_t indels = (refPos - pRefPos - 1) + (readPos - pReadPos - 1);
+                divergentColumns += indels;
+                columns += indels;
+            }
+            columns++;
+            pRefPos = refPos;
+            pReadPos = readPos;
+        }
+    }
+    return columns == 0 ? 0.0 : (double) divergentColumns / columns;
+}
+
 void writePhasedReadInfoJSON(BamChunk *bamChunk, stList *primaryReads, stList *primaryAlignments, stList *filteredReads,
         stList *filteredAlignments, stSet *readsInHap1, stSet *readsInHap2, uint64_t *reference_rleToNonRleCoordMap,
         FILE *out) {
@@ -256,6 +1331,29 @@ void writePhasedReadInfoJSON(BamChunk *bamChunk, stList *primaryReads, stList *p
 }
 
 
+static double bubble_phasedReadSkew(Bubble *b, int64_t hap1AlleleNo, int64_t hap2AlleleNo, int64_t *totalReads,
+                                    int64_t *hap1Reads) {
+    /*
+     * Returns the binomial p-value of the split of the reads supporting one of the two alleles of a het bubble over
+     * the other, giving the number of such reads and of those supporting the first allele.
+     */
+    *totalReads = 0;
+    *hap1Reads = 0;
+    for (uint64_t j = 0; j < b->readNo; j++) {
+
+        double readHap1Support = b->alleleReadSupports[hap1AlleleNo * b->readNo + j];
+        double readHap2Support = b->alleleReadSupports[hap2AlleleNo * b->readNo + j];
+
+        if (readHap1Support != readHap2Support) {
+            (*totalReads)++;
+            if (readHap1Support > readHap2Support) {
+                (*hap1Reads)++;
+            }
+        }
+    }
+    return binomialPValue(*totalReads, *hap1Reads); // 1-bpv = prob of having a less extreme
+}
+
 stList *produceVcfEntriesFromBubbleGraph(BamChunk *bamChunk, BubbleGraph *bg, stHash *readsToPSeqs,
                                          stGenomeFragment *gF, double strandSkewThreshold,
                                          double readSkewThreshold) {
@@ -278,26 +1376,12 @@ stList *produceVcfEntriesFromBubbleGraph(BamChunk *bamChunk, BubbleGraph *bg, st
         if (hap1 == hap2) continue;
 
         // read info
-        int64_t hap1AlleleNo = gF->haplotypeString1[i];
-        int64_t hap2AlleleNo = gF->haplotypeString2[i];
-        int64_t totalReads = 0;
-        int64_t hap1Reads = 0;
-        for (uint64_t j = 0; j < b->readNo; j++) {
-
-            double readHap1Support = b->alleleReadSupports[hap1AlleleNo * b->readNo + j];
-            double readHap2Support = b->alleleReadSupports[hap2AlleleNo * b->readNo + j];
-
-            if (readHap1Support != readHap2Support) {
-                totalReads++;
-                if (readHap1Support > readHap2Support) {
-                    hap1Reads++;
-                }
-            }
-        }
+        int64_t totalReads, hap1Reads;
+        double readSupportSkew = bubble_phasedReadSkew(b, gF->haplotypeString1[i], gF->haplotypeString2[i],
+                                                       &totalReads, &hap1Reads);
 
         // bubble skew info
         double strandSkew = bubble_phasedStrandSkew(b, readsToPSeqs, gF);
-        double readSupportSkew = binomialPValue(totalReads, hap1Reads); // 1-bpv = prob of having a less extreme
 
         bool pass = TRUE;
         if (strandSkew < strandSkewThreshold) {
@@ -350,6 +1434,140 @@ stList *produceVcfEntriesFromBubbleGraph(BamChunk *bamChunk, BubbleGraph *bg, st
     return vcfEntries;
 }
 
+char *getChunkPhasedVariants(BamChunk *bamChunk, BubbleGraph *bg, RleString *reference, stHash *readsToPSeqs,
+                             stGenomeFragment *gF, double strandSkewThreshold, double readSkewThreshold,
+                             size_t *length) {
+    char *expandedReference = rleString_expand(reference);
+    uint64_t *rleToNonRleCoordMap = rleString_getRleToNonRleCoordinateMap(reference);
+    stList *records = stList_construct3(0, free);
+    for (uint64_t i = 0; i < gF->length; i++) {
+        Bubble *b = &bg->bubbles[gF->refStart + i];
+        int64_t hap1AlleleNo = gF->haplotypeString1[i];
+        int64_t hap2AlleleNo = gF->haplotypeString2[i];
+        if (hap1AlleleNo == hap2AlleleNo) continue;
+
+        // as for produceVcfEntriesFromBubbleGraph, only the hets supported evenly by strand and split by read
+        int64_t totalReads, hap1Reads;
+        if (bubble_phasedStrandSkew(b, readsToPSeqs, gF) < strandSkewThreshold ||
+            bubble_phasedReadSkew(b, hap1AlleleNo, hap2AlleleNo, &totalReads, &hap1Reads) < readSkewThreshold) {
+            continue;
+        }
+
+        // the alleles, expanded, with the reference allele first
+        RleString *hapAlleles[2] = { b->alleles[hap1AlleleNo], b->alleles[hap2AlleleNo] };
+        char *alleles[3] = { rleString_expand(b->refAllele), NULL, NULL };
+        int64_t alleleNo = 1;
+        int64_t gts[2];
+        bool hasEmptyAllele = alleles[0][0] == '\0';
+        for (int64_t h = 0; h < 2; h++) {
+            if (rleString_eq(hapAlleles[h], b->refAllele)) {
+                gts[h] = 0;
+            } else if (h == 1 && gts[0] != 0 && rleString_eq(hapAlleles[1], hapAlleles[0])) {
+                gts[h] = gts[0];
+            } else {
+                gts[h] = alleleNo;
+                alleles[alleleNo++] = rleString_expand(hapAlleles[h]);
+                hasEmptyAllele = hasEmptyAllele || alleles[gts[h]][0] == '\0';
+            }
+        }
+
+        // the position of the bubble in the contig, with the alleles padded by the preceding reference base if any
+        // is empty; only the bubbles starting in the chunk, not its overlap with its neighbours, are kept
+        int64_t pos = rleToNonRleCoordMap[b->refStart];
+        char *padding = "";
+        char paddingBase[2] = { '\0', '\0' };
+        if (hasEmptyAllele && pos > 0) {
+            pos--;
+            paddingBase[0] = expandedReference[pos];
+            padding = paddingBase;
+        }
+        int64_t contigPos = bamChunk->chunkOverlapStart + pos;
+        if ((!hasEmptyAllele || padding[0] != '\0') && contigPos >= bamChunk->chunkStart &&
+            contigPos < bamChunk->chunkEnd) {
+            char *alts = alleleNo == 2 ? stString_print("%s%s", padding, alleles[1]) :
+                         stString_print("%s%s,%s%s", padding, alleles[1], padding, alleles[2]);
+            stList_append(records, stString_print("%"PRId64"\t%"PRId64"\t%s\t%"PRId64"\t.\t%s%s\t%s\n", gts[0],
+                                                  gts[1], bamChunk->refSeqName, contigPos + 1, padding, alleles[0],
+                                                  alts));
+            free(alts);
+        }
+        for (int64_t a = 0; a < alleleNo; a++) {
+            free(alleles[a]);
+        }
+    }
+    char *chunkPhasedVariants = stString_join2("", records);
+    *length = strlen(chunkPhasedVariants);
+
+    // Cleanup
+    stList_destruct(records);
+    free(rleToNonRleCoordMap);
+    free(expandedReference);
+    return chunkPhasedVariants;
+}
+
+void writeChunkPhasedVariants(char *outputVcfFile, BamChunker *bamChunker, char **chunkPhasedVariants,
+                              bool *chunkWasSwitched, Params *params) {
+    // compressed, with the shared htslib thread pool, if the file is named so
+    bool compressOutput = strlen(outputVcfFile) > 3 && stString_eq(outputVcfFile + strlen(outputVcfFile) - 3, ".gz");
+    BGZF *fp = bgzf_open(outputVcfFile, compressOutput ? "w" : "wu");
+    if (fp == NULL) {
+        st_errAbort("Could not open output VCF for writing %s\n", outputVcfFile);
+    }
+    htsThreadPool *threadPool = compressOutput ? getHtsThreadPool(params->polishParams) : NULL;
+    if (threadPool != NULL) {
+        bgzf_thread_pool(fp, threadPool->pool, threadPool->qsize);
+    }
+    kstring_t line = {0, 0, NULL};
+    ksprintf(&line, "##fileformat=VCFv4.2\n");
+    ksprintf(&line, "##source=margin polish\n");
+    ksprintf(&line, "##FORMAT=<ID=GT,Number=1,Type=String,Description=\"Genotype\">\n");
+    ksprintf(&line, "##FORMAT=<ID=PS,Number=1,Type=Integer,Description=\"Phase set\">\n");
+    ksprintf(&line, "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\tFORMAT\tSAMPLE\n");
+
+    // the chunks of a contig are stitched into one pair of haplotypes, so their variants are in one phase set,
+    // numbered by its first variant
+    char *phaseSetContig = NULL;
+    int64_t phaseSet = 0;
+    for (int64_t chunkIdx = 0; chunkIdx < bamChunker->chunkCount; chunkIdx++) {
+        char *record = chunkPhasedVariants[chunkIdx];
+        if (record == NULL) continue;
+        BamChunk *bamChunk = bamChunker_getChunk(bamChunker, chunkIdx);
+        while (*record != '\0') {
+            char *end;
+            int64_t gt1 = strtoll(record, &end, 10);
+            int64_t gt2 = strtoll(end + 1, &end, 10);
+            record = end + 1;
+            end = strchr(record, '\n');
+            if (phaseSetContig == NULL || !stString_eq(phaseSetContig, bamChunk->refSeqName)) {
+                phaseSetContig = bamChunk->refSeqName;
+                phaseSet = strtoll(strchr(record, '\t') + 1, NULL, 10);
+            }
+            if (chunkWasSwitched != NULL && chunkWasSwitched[chunkIdx]) {
+                int64_t gt = gt1;
+                gt1 = gt2;
+                gt2 = gt;
+            }
+            ksprintf(&line, "%.*s\t.\tPASS\t.\tGT:PS\t%"PRId64"|%"PRId64":%"PRId64"\n", (int) (end - record), record,
+                     gt1, gt2, phaseSet);
+            if (bgzf_write(fp, line.s, line.l) != (ssize_t) line.l) {
+                st_errAbort("Error writing output VCF %s\n", outputVcfFile);
+            }
+            line.l = 0;
+            record = end + 1;
+        }
+    }
+    if (line.l > 0 && bgzf_write(fp, line.s, line.l) != (ssize_t) line.l) {
+        st_errAbort("Error writing output VCF %s\n", outputVcfFile);
+    }
+    free(line.s);
+    if (bgzf_close(fp) != 0) {
+        st_errAbort("Error closing output VCF %s\n", outputVcfFile);
+    }
+    if (compressOutput && tbx_index_build(outputVcfFile, 0, &tbx_conf_vcf) != 0) {
+        st_logCritical("  Failed to build tabix index for output VCF %s!\n", outputVcfFile);
+    }
+}
+
 ChunkTruthHaplotypes **chunkTruthHaplotypes_construct(int64_t length) {
     ChunkTruthHaplotypes **cths = st_calloc(length, sizeof(ChunkTruthHaplotypes *));
     for (int i = 0; i < length; i++) {
@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2020 by Benedict Paten (benedictpaten@gmail.com)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include "margin.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/*
+ * Placement of the threads processing chunks on the NUMA nodes of the host, each node with its own copy of the
+ * parameters. The nodes are read from sysfs, so the placement is only done on linux.
+ */
+
+// The most nodes looked for in sysfs
+#define NUMA_MAX_NODES 1024
+
+struct _numaPlacement {
+    Params *params; // The shared params, copied to each node
+    int64_t threadNo;
+    int64_t nodeNo;
+#if defined(__linux__)
+    cpu_set_t *nodeCpus; // The cpus of each node allowed to the process
+#endif
+    Params **nodeParams; // The copy of the params on each node, made by the first thread placed on it
+    bool *threadPlaced; // Whether each thread has been placed on its node
+    pthread_mutex_t mutex;
+};
+
+#if defined(__linux__)
+static bool numaPlacement_readNodeCpus(int64_t node, cpu_set_t *allowedCpus, cpu_set_t *cpus) {
+    /*
+     * Reads the cpus of the node from its cpulist, e.g. "0-63,128-191", keeping those in allowedCpus. Returns false if
+     * the node does not exist.
+     */
+    char *cpuListFile = stString_print("/sys/devices/system/node/node%" PRIi64 "/cpulist", node);
+    FILE *fh = fopen(cpuListFile, "r");
+    free(cpuListFile);
+    if (fh == NULL) {
+        return FALSE;
+    }
+    char *cpuList = stFile_getLineFromFile(fh);
+    fclose(fh);
+    CPU_ZERO(cpus);
+    if (cpuList == NULL) {
+        return TRUE;
+    }
+    char *savePtr = NULL;
+    for (char *range = strtok_r(cpuList, ",", &savePtr); range != NULL; range = strtok_r(NULL, ",", &savePtr)) {
+        int64_t first, last;
+        int64_t i = sscanf(range, "%" SCNi64 "-%" SCNi64, &first, &last);
+        if (i == 1) {
+            last = first;
+        } else if (i != 2) {
+            continue;
+        }
+        for (int64_t cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, allowedCpus)) {
+                CPU_SET(cpu, cpus);
+            }
+        }
+    }
+    free(cpuList);
+    return TRUE;
+}
+#endif
+
+NumaPlacement *numaPlacement_construct(Params *params, int64_t threadNo) {
+    NumaPlacement *placement = st_calloc(1, sizeof(NumaPlacement));
+    placement->params = params;
+    placement->threadNo = threadNo;
+    placement->nodeNo = 1;
+    pthread_mutex_init(&placement->mutex, NULL);
+
+#if defined(__linux__)
+    // the nodes with cpus the process may run on
+    cpu_set_t allowedCpus;
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &allowedCpus) != 0) {
+        CPU_ZERO(&allowedCpus);
+    }
+    placement->nodeCpus = st_calloc(NUMA_MAX_NODES, sizeof(cpu_set_t));
+    placement->nodeNo = 0;
+    for (int64_t node = 0; node < NUMA_MAX_NODES; node++) {
+        cpu_set_t *cpus = &placement->nodeCpus[placement->nodeNo];
+        if (numaPlacement_readNodeCpus(node, &allowedCpus, cpus) && CPU_COUNT(cpus) > 0) {
+            placement->nodeNo++;
+        }
+    }
+    // one node per thread at most, and without nodes the threads are not placed
+    if (placement->nodeNo > threadNo) {
+        placement->nodeNo = threadNo;
+    }
+    if (placement->nodeNo <= 1) {
+        st_logCritical("> Found a single NUMA node, not placing threads\n");
+        placement->nodeNo = 1;
+    } else {
+        st_logCritical("> Placing %" PRIi64 " threads on %" PRIi64 " NUMA nodes\n", threadNo, placement->nodeNo);
+    }
+#else
+    st_logCritical("> NUMA placement is only supported on linux, not placing threads\n");
+#endif
+
+    placement->nodeParams = st_calloc(placement->nodeNo, sizeof(Params *));
+    placement->threadPlaced = st_calloc(threadNo, sizeof(bool));
+    return placement;
+}
+
+static Params *numaPlacement_copyParams(Params *params) {
+    /*
+     * Copies the params, with their read only tables, as allocated and written by the calling thread. The state
+     * machines are shared.
+     */
+    Params *copy = st_calloc(1, sizeof(Params));
+    copy->polishParams = st_malloc(sizeof(PolishParams));
+    *copy->polishParams = *params->polishParams;
+    if (params->polishParams->repeatSubMatrix != NULL) {
+        copy->polishParams->repeatSubMatrix = repeatSubMatrix_copy(params->polishParams->repeatSubMatrix);
+    }
+    if (params->phaseParams != NULL) {
+        copy->phaseParams = stRPHmmParameters_copy(params->phaseParams);
+    }
+    copy->fingerprint = params->fingerprint;
+    return copy;
+}
+
+static void numaPlacement_destructParams(Params *copy) {
+    if (copy->polishParams->repeatSubMatrix != NULL) {
+        repeatSubMatrix_destruct(copy->polishParams->repeatSubMatrix);
+    }
+    free(copy->polishParams);
+    if (copy->phaseParams != NULL) {
+        stRPHmmParameters_destruct(copy->phaseParams);
+    }
+    free(copy);
+}
+
+Params *numaPlacement_getThreadParams(NumaPlacement *placement) {
+    if (placement->nodeNo <= 1) {
+        return placement->params;
+    }
+    // threads of nested regions, or outside any parallel region, are not placed
+    int64_t threadIdx = -1;
+#ifdef _OPENMP
+    threadIdx = omp_get_level() == 1 ? omp_get_thread_num() : -1;
+#endif
+    if (threadIdx < 0 || threadIdx >= placement->threadNo) {
+        return placement->params;
+    }
+
+    // the threads are placed in contiguous blocks, one per node
+    int64_t node = threadIdx * placement->nodeNo / placement->threadNo;
+#if defined(__linux__)
+    if (!placement->threadPlaced[threadIdx]) {
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &placement->nodeCpus[node]) != 0) {
+            st_logInfo("> Could not place thread %" PRIi64 " on NUMA node %" PRIi64 "\n", threadIdx, node);
+        }
+        placement->threadPlaced[threadIdx] = TRUE;
+    }
+#endif
+
+    // the first thread on the node copies the params, so that its pages are on the node
+    pthread_mutex_lock(&placement->mutex);
+    if (placement->nodeParams[node] == NULL) {
+        placement->nodeParams[node] = numaPlacement_copyParams(placement->params);
+    }
+    Params *params = placement->nodeParams[node];
+    pthread_mutex_unlock(&placement->mutex);
+    return params;
+}
+
+void numaPlacement_destruct(NumaPlacement *placement) {
+    for (int64_t node = 0; node < placement->nodeNo; node++) {
+        if (placement->nodeParams[node] != NULL) {
+            numaPlacement_destructParams(placement->nodeParams[node]);
+        }
+    }
+    free(placement->nodeParams);
+    free(placement->threadPlaced);
+#if defined(__linux__)
+    free(placement->nodeCpus);
+#endif
+    pthread_mutex_destroy(&placement->mutex);
+    free(placement);
+}
@@ -268,36 +268,8 @@ Diagonal bandIterator_getPrevious(BandIterator *bandIterator) {
     return bandIterator->band->diagonals[bandIterator->index];
 }
 
-///////////////////////////////////
-///////////////////////////////////
-//Log Add functions
-//
-//Interpolation function for doing log add
-///////////////////////////////////
-///////////////////////////////////
-
-#define logUnderflowThreshold 7.5
 #define posteriorMatchThreshold 0.01
 
-static inline double lookup(double x) {
-    //return log (exp (x) + 1);
-    assert(x >= 0.00f);
-    assert(x <= logUnderflowThreshold);
-    if (x <= 1.00f)
-        return ((-0.009350833524763f * x + 0.130659527668286f) * x + 0.498799810682272f) * x + 0.693203116424741f;
-    if (x <= 2.50f)
-        return ((-0.014532321752540f * x + 0.139942324101744f) * x + 0.495635523139337f) * x + 0.692140569840976f;
-    if (x <= 4.50f)
-        return ((-0.004605031767994f * x + 0.063427417320019f) * x + 0.695956496475118f) * x + 0.514272634594009f;
-    return ((-0.000458661602210f * x + 0.009695946122598f) * x + 0.930734667215156f) * x + 0.168037164329057f;
-}
-
-double logAdd(double x, double y) {
-    if (x < y)
-        return (x == LOG_ZERO || y - x >= logUnderflowThreshold) ? y : lookup(y - x) + x;
-    return (y == LOG_ZERO || x - y >= logUnderflowThreshold) ? x : lookup(x - y) + y;
-}
-
 ///////////////////////////////////
 ///////////////////////////////////
 //Cell calculations
@@ -357,11 +329,8 @@ static inline void updateExpectations(double *fromCells, double *toCells, int64_
     double p = exp(fromCells[from] + toCells[to] + (eP + tP) - totalProbability);
     //Add in the expectation of the transition
     hmm_addToTransitionExpectation(hmmExpectations, from, to, p);
-
-    // Training of emissions has been temporarily removed
-    //if(x < SYMBOL_NUMBER_NO_N && y < SYMBOL_NUMBER_NO_N) { //Ignore gaps involving Ns.
-    //    hmm_addToEmissionsExpectation(hmmExpectations, to, x, y, p);
-    //}
+    //And the expectation of the emission
+    hmm_addToEmissionsExpectationForSymbols(hmmExpectations, to, x, y, p);
 }
 
 static void
@@ -372,6 +341,199 @@ cell_calculateExpectation(StateMachine *sM, double *current, double *lower, doub
     sM->cellCalculate(sM, current, lower, middle, upper, cX, cY, updateExpectations, extraArgs2);
 }
 
+//Three state versions of the above, with the transitions inlined instead of going through the
+//cellCalculate and doTransition function pointers.
+
+static void
+stateMachine3_cellCalculateForward(StateMachine *sM, double *current, double *lower, double *middle, double *upper,
+                                   Symbol cX, Symbol cY, void *extraArgs) {
+    StateMachine3 *sM3 = (StateMachine3 *) sM;
+    STATE_MACHINE3_CELL_CALCULATE(sM3, current, lower, middle, upper, cX, cY, doTransitionForward, extraArgs)
+}
+
+static void
+stateMachine3_cellCalculateBackward(StateMachine *sM, double *current, double *lower, double *middle, double *upper,
+                                    Symbol cX, Symbol cY, void *extraArgs) {
+    StateMachine3 *sM3 = (StateMachine3 *) sM;
+    STATE_MACHINE3_CELL_CALCULATE(sM3, current, lower, middle, upper, cX, cY, doTransitionBackward, extraArgs)
+}
+
+static void
+stateMachine3_cellCalculateExpectation(StateMachine *sM, double *current, double *lower, double *middle,
+                                       double *upper, Symbol cX, Symbol cY, void *extraArgs) {
+    StateMachine3 *sM3 = (StateMachine3 *) sM;
+    void *extraArgs2[4] = {((void **) extraArgs)[0], ((void **) extraArgs)[1], &cX, &cY};
+    STATE_MACHINE3_CELL_CALCULATE(sM3, current, lower, middle, upper, cX, cY, updateExpectations, extraArgs2)
+}
+
+static bool stateMachine_isThreeState(StateMachine *sM) {
+    return (sM->type == threeState || sM->type == threeStateAsymmetric) && sM->stateNumber == SM3_STATES;
+}
+
+typedef void (*CellCalculation)(StateMachine *, double *, double *, double *, double *, Symbol, Symbol, void *);
+
+/*
+ * Cell calculations to use for a given state machine, chosen once per diagonal rather than per cell.
+ */
+static CellCalculation getForwardCellCalculation(StateMachine *sM) {
+    return stateMachine_isThreeState(sM) ? stateMachine3_cellCalculateForward : cell_calculateForward;
+}
+
+static CellCalculation getBackwardCellCalculation(StateMachine *sM) {
+    return stateMachine_isThreeState(sM) ? stateMachine3_cellCalculateBackward : cell_calculateBackward;
+}
+
+static CellCalculation getExpectationCellCalculation(StateMachine *sM) {
+    return stateMachine_isThreeState(sM) ? stateMachine3_cellCalculateExpectation : cell_calculateExpectation;
+}
+
+///////////////////////////////////
+///////////////////////////////////
+//DpArena
+//
+//Thread local free lists of the buffers used by the dp matrices, so the alignments computed by
+//a thread recycle memory rather than calling the allocator for every diagonal.
+///////////////////////////////////
+///////////////////////////////////
+
+#define DP_ARENA_MIN_BUFFER_BYTES 64
+#define DP_ARENA_BINS 256
+// With huge pages, buffers up to this size are cut from huge page slabs, larger ones have their own huge pages
+#define DP_ARENA_MAX_SLAB_BUFFER_BYTES (HUGE_PAGE_SIZE / 8)
+#define DP_ARENA_SLAB_HEADER_BYTES 64
+
+typedef struct _dpArenaBuffer {
+    struct _dpArenaBuffer *next;
+} DpArenaBuffer;
+
+typedef struct _dpArena {
+    DpArenaBuffer *freeBuffers[DP_ARENA_BINS];
+    DpArenaStats stats;
+    DpArenaBuffer *slabs; // The huge page slabs, each starting with a link to the previous one
+    int64_t slabUsed; // Bytes of the newest slab used
+} DpArena;
+
+static __thread DpArena dpArena;
+
+/*
+ * Gets the bin of buffers able to hold the given number of bytes. The bins split each power of two
+ * into quarters, so a buffer is at most 25% bigger than the request.
+ */
+static inline int64_t dpArena_getBin(int64_t bytes, int64_t *capacity) {
+    if (bytes <= DP_ARENA_MIN_BUFFER_BYTES) {
+        *capacity = DP_ARENA_MIN_BUFFER_BYTES;
+        return 0;
+    }
+    int64_t k = 63 - __builtin_clzll((uint64_t) bytes - 1); // 2^k < bytes <= 2^(k+1)
+    int64_t quarter = ((int64_t) 1) << (k - 2);
+    int64_t i = (bytes - 1 - (((int64_t) 1) << k)) / quarter;
+    *capacity = (((int64_t) 1) << k) + (i + 1) * quarter;
+    return 1 + (k - 6) * 4 + i;
+}
+
+/*
+ * Gets the capacity of the buffers of a bin, the inverse of dpArena_getBin.
+ */
+static int64_t dpArena_getBinCapacity(int64_t bin) {
+    if (bin == 0) {
+        return DP_ARENA_MIN_BUFFER_BYTES;
+    }
+    int64_t k = (bin - 1) / 4 + 6, i = (bin - 1) % 4;
+    return (((int64_t) 1) << k) + (i + 1) * (((int64_t) 1) << (k - 2));
+}
+
+/*
+ * Cuts a buffer from the arena's newest huge page slab, starting a new slab if it does not fit.
+ */
+static void *dpArena_getSlabBuffer(int64_t capacity) {
+    if (dpArena.slabs == NULL || dpArena.slabUsed + capacity > HUGE_PAGE_SIZE) {
+        DpArenaBuffer *slab = hugePages_malloc(HUGE_PAGE_SIZE);
+        slab->next = dpArena.slabs;
+        dpArena.slabs = slab;
+        dpArena.slabUsed = DP_ARENA_SLAB_HEADER_BYTES;
+    }
+    void *buffer = ((char *) dpArena.slabs) + dpArena.slabUsed;
+    dpArena.slabUsed += capacity;
+    return buffer;
+}
+
+static void *dpArena_getBuffer(int64_t bytes) {
+    int64_t capacity;
+    int64_t bin = dpArena_getBin(bytes, &capacity);
+    assert(bin < DP_ARENA_BINS);
+    DpArenaBuffer *buffer = dpArena.freeBuffers[bin];
+    if (buffer != NULL) {
+        dpArena.freeBuffers[bin] = buffer->next;
+        dpArena.stats.bytesCached -= capacity;
+        dpArena.stats.reuses++;
+    } else {
+        buffer = !hugePages_isEnabled() ? st_malloc(capacity) :
+                 capacity > DP_ARENA_MAX_SLAB_BUFFER_BYTES ? hugePages_malloc(capacity) :
+                 dpArena_getSlabBuffer(capacity);
+        dpArena.stats.allocations++;
+    }
+    dpArena.stats.bytesInUse += capacity;
+    if (dpArena.stats.bytesInUse + dpArena.stats.bytesCached > dpArena.stats.peakBytes) {
+        dpArena.stats.peakBytes = dpArena.stats.bytesInUse + dpArena.stats.bytesCached;
+    }
+    return buffer;
+}
+
+/*
+ * Returns a buffer obtained from dpArena_getBuffer, bytes must equal the size it was requested with.
+ */
+static void dpArena_releaseBuffer(void *buffer, int64_t bytes) {
+    if (buffer == NULL) {
+        return;
+    }
+    int64_t capacity;
+    int64_t bin = dpArena_getBin(bytes, &capacity);
+    DpArenaBuffer *b = buffer;
+    b->next = dpArena.freeBuffers[bin];
+    dpArena.freeBuffers[bin] = b;
+    dpArena.stats.bytesInUse -= capacity;
+    dpArena.stats.bytesCached += capacity;
+    assert(dpArena.stats.bytesInUse >= 0);
+}
+
+void dpArena_getStats(DpArenaStats *stats) {
+    *stats = dpArena.stats;
+}
+
+void dpArena_clear(void) {
+    // the buffers cut from slabs are only freed, with their slabs, once no buffers are in use
+    bool freeSlabs = dpArena.stats.bytesInUse == 0;
+    for (int64_t bin = 0; bin < DP_ARENA_BINS; bin++) {
+        DpArenaBuffer *keptBuffers = NULL;
+        while (dpArena.freeBuffers[bin] != NULL) {
+            DpArenaBuffer *b = dpArena.freeBuffers[bin];
+            dpArena.freeBuffers[bin] = b->next;
+            int64_t capacity = dpArena_getBinCapacity(bin);
+            if (!hugePages_isEnabled()) {
+                free(b);
+            } else if (capacity > DP_ARENA_MAX_SLAB_BUFFER_BYTES) {
+                hugePages_free(b, capacity);
+            } else if (!freeSlabs) {
+                b->next = keptBuffers;
+                keptBuffers = b;
+                continue;
+            }
+            dpArena.stats.bytesCached -= capacity;
+        }
+        dpArena.freeBuffers[bin] = keptBuffers;
+    }
+    if (freeSlabs) {
+        while (dpArena.slabs != NULL) {
+            DpArenaBuffer *slab = dpArena.slabs;
+            dpArena.slabs = slab->next;
+            hugePages_free(slab, HUGE_PAGE_SIZE);
+        }
+    }
+    dpArena.stats.peakBytes = dpArena.stats.bytesInUse + dpArena.stats.bytesCached;
+    dpArena.stats.allocations = 0;
+    dpArena.stats.reuses = 0;
+}
+
 ///////////////////////////////////
 ///////////////////////////////////
 //DpDiagonal
@@ -384,21 +546,53 @@ struct _dpDiagonal {
     Diagonal diagonal;
     int64_t stateNumber;
     double *cells;
+    // Scaled diagonals store linear probabilities, divided through by exp(logScale), in
+    // single precision in place of the log probabilities in cells.
+    float *scaledCells;
+    double logScale;
 };
 
+static inline int64_t dpDiagonal_getCellBytes(DpDiagonal *dpDiagonal) {
+    return (dpDiagonal->scaledCells != NULL ? sizeof(float) : sizeof(double)) * dpDiagonal->stateNumber *
+           (int64_t) diagonal_getWidth(dpDiagonal->diagonal);
+}
+
 DpDiagonal *dpDiagonal_construct(Diagonal diagonal, int64_t stateNumber) {
-    DpDiagonal *dpDiagonal = st_malloc(sizeof(DpDiagonal));
+    DpDiagonal *dpDiagonal = dpArena_getBuffer(sizeof(DpDiagonal));
+    dpDiagonal->diagonal = diagonal;
+    dpDiagonal->stateNumber = stateNumber;
+    assert(diagonal_getWidth(diagonal) >= 0);
+    dpDiagonal->cells = dpArena_getBuffer(sizeof(double) * stateNumber * (int64_t) diagonal_getWidth(diagonal));
+    dpDiagonal->scaledCells = NULL;
+    dpDiagonal->logScale = 0.0;
+    return dpDiagonal;
+}
+
+static DpDiagonal *dpDiagonal_constructScaled(Diagonal diagonal, int64_t stateNumber) {
+    DpDiagonal *dpDiagonal = dpArena_getBuffer(sizeof(DpDiagonal));
     dpDiagonal->diagonal = diagonal;
     dpDiagonal->stateNumber = stateNumber;
     assert(diagonal_getWidth(diagonal) >= 0);
-    dpDiagonal->cells = st_malloc(sizeof(double) * stateNumber * (int64_t) diagonal_getWidth(diagonal));
+    dpDiagonal->cells = NULL;
+    dpDiagonal->scaledCells = dpArena_getBuffer(sizeof(float) * stateNumber * (int64_t) diagonal_getWidth(diagonal));
+    dpDiagonal->logScale = LOG_ZERO;
     return dpDiagonal;
 }
 
+static inline bool dpDiagonal_isScaled(DpDiagonal *dpDiagonal) {
+    return dpDiagonal->scaledCells != NULL;
+}
+
 DpDiagonal *dpDiagonal_clone(DpDiagonal *diagonal) {
+    int64_t cellNumber = diagonal_getWidth(diagonal->diagonal) * diagonal->stateNumber;
+    if (dpDiagonal_isScaled(diagonal)) {
+        DpDiagonal *diagonal2 = dpDiagonal_constructScaled(diagonal->diagonal, diagonal->stateNumber);
+        memcpy(diagonal2->scaledCells, diagonal->scaledCells, sizeof(float) * cellNumber);
+        diagonal2->logScale = diagonal->logScale;
+        return diagonal2;
+    }
     DpDiagonal *diagonal2 = dpDiagonal_construct(diagonal->diagonal, diagonal->stateNumber);
-    memcpy(diagonal2->cells, diagonal->cells,
-           sizeof(double) * diagonal_getWidth(diagonal->diagonal) * diagonal->stateNumber);
+    memcpy(diagonal2->cells, diagonal->cells, sizeof(double) * cellNumber);
     return diagonal2;
 }
 
@@ -409,6 +603,20 @@ bool dpDiagonal_equals(DpDiagonal *diagonal1, DpDiagonal *diagonal2) {
     if (diagonal1->stateNumber != diagonal2->stateNumber) {
         return 0;
     }
+    if (dpDiagonal_isScaled(diagonal1) != dpDiagonal_isScaled(diagonal2)) {
+        return 0;
+    }
+    if (dpDiagonal_isScaled(diagonal1)) {
+        if (diagonal1->logScale != diagonal2->logScale) {
+            return 0;
+        }
+        for (int64_t i = 0; i < diagonal_getWidth(diagonal1->diagonal) * diagonal1->stateNumber; i++) {
+            if (diagonal1->scaledCells[i] != diagonal2->scaledCells[i]) {
+                return 0;
+            }
+        }
+        return 1;
+    }
     for (int64_t i = 0; i < diagonal_getWidth(diagonal1->diagonal) * diagonal1->stateNumber; i++) {
         if (diagonal1->cells[i] != diagonal2->cells[i]) {
             return 0;
@@ -418,11 +626,13 @@ bool dpDiagonal_equals(DpDiagonal *diagonal1, DpDiagonal *diagonal2) {
 }
 
 void dpDiagonal_destruct(DpDiagonal *dpDiagonal) {
-    free(dpDiagonal->cells);
-    free(dpDiagonal);
+    void *cells = dpDiagonal_isScaled(dpDiagonal) ? (void *) dpDiagonal->scaledCells : (void *) dpDiagonal->cells;
+    dpArena_releaseBuffer(cells, dpDiagonal_getCellBytes(dpDiagonal));
+    dpArena_releaseBuffer(dpDiagonal, sizeof(DpDiagonal));
 }
 
 double *dpDiagonal_getCell(DpDiagonal *dpDiagonal, int64_t xmy) {
+    assert(!dpDiagonal_isScaled(dpDiagonal));
     if (xmy < dpDiagonal->diagonal.xmyL || xmy > dpDiagonal->diagonal.xmyR) {
         return NULL;
     }
@@ -430,7 +640,23 @@ double *dpDiagonal_getCell(DpDiagonal *dpDiagonal, int64_t xmy) {
     return &dpDiagonal->cells[((xmy - dpDiagonal->diagonal.xmyL) / 2) * dpDiagonal->stateNumber];
 }
 
+static float *dpDiagonal_getScaledCell(DpDiagonal *dpDiagonal, int64_t xmy) {
+    assert(dpDiagonal_isScaled(dpDiagonal));
+    if (xmy < dpDiagonal->diagonal.xmyL || xmy > dpDiagonal->diagonal.xmyR) {
+        return NULL;
+    }
+    assert((diagonal_getXay(dpDiagonal->diagonal) + xmy) % 2 == 0);
+    return &dpDiagonal->scaledCells[((xmy - dpDiagonal->diagonal.xmyL) / 2) * dpDiagonal->stateNumber];
+}
+
 void dpDiagonal_zeroValues(DpDiagonal *diagonal) {
+    if (dpDiagonal_isScaled(diagonal)) {
+        for (int64_t i = 0; i < diagonal_getWidth(diagonal->diagonal) * diagonal->stateNumber; i++) {
+            diagonal->scaledCells[i] = 0.0f;
+        }
+        diagonal->logScale = LOG_ZERO;
+        return;
+    }
     for (int64_t i = 0; i < diagonal_getWidth(diagonal->diagonal) * diagonal->stateNumber; i++) {
         diagonal->cells[i] = LOG_ZERO;
     }
@@ -438,6 +664,22 @@ void dpDiagonal_zeroValues(DpDiagonal *diagonal) {
 
 void
 dpDiagonal_initialiseValues(DpDiagonal *diagonal, StateMachine *sM, double (*getStateValue)(StateMachine *, int64_t)) {
+    if (dpDiagonal_isScaled(diagonal)) {
+        //Scale by the largest of the state values
+        double maxValue = LOG_ZERO;
+        for (int64_t j = 0; j < diagonal->stateNumber; j++) {
+            maxValue = getStateValue(sM, j) > maxValue ? getStateValue(sM, j) : maxValue;
+        }
+        for (int64_t i = diagonal_getMinXmy(diagonal->diagonal); i <= diagonal_getMaxXmy(diagonal->diagonal); i += 2) {
+            float *cell = dpDiagonal_getScaledCell(diagonal, i);
+            assert(cell != NULL);
+            for (int64_t j = 0; j < diagonal->stateNumber; j++) {
+                cell[j] = maxValue == LOG_ZERO ? 0.0f : (float) exp(getStateValue(sM, j) - maxValue);
+            }
+        }
+        diagonal->logScale = maxValue;
+        return;
+    }
     for (int64_t i = diagonal_getMinXmy(diagonal->diagonal); i <= diagonal_getMaxXmy(diagonal->diagonal); i += 2) {
         double *cell = dpDiagonal_getCell(diagonal, i);
         assert(cell != NULL);
@@ -448,8 +690,16 @@ dpDiagonal_initialiseValues(DpDiagonal *diagonal, StateMachine *sM, double (*get
 }
 
 double dpDiagonal_dotProduct(DpDiagonal *diagonal1, DpDiagonal *diagonal2) {
-    double totalProbability = LOG_ZERO;
     Diagonal diagonal = diagonal1->diagonal;
+    if (dpDiagonal_isScaled(diagonal1)) {
+        assert(dpDiagonal_isScaled(diagonal2));
+        double total = 0.0;
+        for (int64_t i = 0; i < diagonal_getWidth(diagonal) * diagonal1->stateNumber; i++) {
+            total += (double) diagonal1->scaledCells[i] * diagonal2->scaledCells[i];
+        }
+        return total > 0.0 ? log(total) + diagonal1->logScale + diagonal2->logScale : LOG_ZERO;
+    }
+    double totalProbability = LOG_ZERO;
     int64_t xmy = diagonal_getMinXmy(diagonal);
     while (xmy <= diagonal_getMaxXmy(diagonal)) {
         totalProbability = logAdd(totalProbability,
@@ -460,6 +710,70 @@ double dpDiagonal_dotProduct(DpDiagonal *diagonal1, DpDiagonal *diagonal2) {
     return totalProbability;
 }
 
+/*
+ * Gets an upper bound on the log of the sum of the values in the diagonal, being the log of the
+ * maximum value times the number of values.
+ */
+static double dpDiagonal_getLogTotalUpperBound(DpDiagonal *diagonal) {
+    int64_t cellNumber = diagonal_getWidth(diagonal->diagonal) * diagonal->stateNumber;
+    if (dpDiagonal_isScaled(diagonal)) {
+        float maxValue = 0.0f;
+        for (int64_t i = 0; i < cellNumber; i++) {
+            maxValue = diagonal->scaledCells[i] > maxValue ? diagonal->scaledCells[i] : maxValue;
+        }
+        return maxValue > 0.0f ? diagonal->logScale + log(maxValue) + log(cellNumber) : LOG_ZERO;
+    }
+    double maxValue = LOG_ZERO;
+    for (int64_t i = 0; i < cellNumber; i++) {
+        maxValue = diagonal->cells[i] > maxValue ? diagonal->cells[i] : maxValue;
+    }
+    return maxValue != LOG_ZERO ? maxValue + log(cellNumber) : LOG_ZERO;
+}
+
+/*
+ * Divides the cells of a scaled diagonal through by their maximum, folding it into the scale, to
+ * keep the values in range of single precision.
+ */
+static void dpDiagonal_normaliseScaled(DpDiagonal *diagonal) {
+    int64_t cellNumber = diagonal_getWidth(diagonal->diagonal) * diagonal->stateNumber;
+    float maxValue = 0.0f;
+    for (int64_t i = 0; i < cellNumber; i++) {
+        maxValue = diagonal->scaledCells[i] > maxValue ? diagonal->scaledCells[i] : maxValue;
+    }
+    if (maxValue == 0.0f) {
+        diagonal->logScale = LOG_ZERO;
+        return;
+    }
+    float inverse = 1.0f / maxValue;
+    for (int64_t i = 0; i < cellNumber; i++) {
+        diagonal->scaledCells[i] *= inverse;
+    }
+    diagonal->logScale += log(maxValue);
+}
+
+/*
+ * Prepares a scaled diagonal to have values at the given scale added to it, returning the factor
+ * those values must be multiplied by. The diagonal is rescaled if needed so the factor is at most one.
+ */
+static double dpDiagonal_alignScale(DpDiagonal *diagonal, double logScale) {
+    if (logScale == LOG_ZERO) {
+        return 0.0;
+    }
+    if (diagonal->logScale == LOG_ZERO) {
+        diagonal->logScale = logScale;
+        return 1.0;
+    }
+    if (logScale > diagonal->logScale) {
+        float factor = (float) exp(diagonal->logScale - logScale);
+        for (int64_t i = 0; i < diagonal_getWidth(diagonal->diagonal) * diagonal->stateNumber; i++) {
+            diagonal->scaledCells[i] *= factor;
+        }
+        diagonal->logScale = logScale;
+        return 1.0;
+    }
+    return exp(logScale - diagonal->logScale);
+}
+
 ///////////////////////////////////
 ///////////////////////////////////
 //DpMatrix
@@ -473,22 +787,29 @@ struct _dpMatrix {
     int64_t diagonalNumber;
     int64_t activeDiagonals;
     int64_t stateNumber;
+    bool scaled; // If true, the diagonals store scaled single precision probabilities
 };
 
-DpMatrix *dpMatrix_construct(int64_t diagonalNumber, int64_t stateNumber) {
+DpMatrix *dpMatrix_construct2(int64_t diagonalNumber, int64_t stateNumber, bool scaled) {
     assert(diagonalNumber >= 0);
-    DpMatrix *dpMatrix = st_malloc(sizeof(DpMatrix));
+    DpMatrix *dpMatrix = dpArena_getBuffer(sizeof(DpMatrix));
     dpMatrix->diagonalNumber = diagonalNumber;
-    dpMatrix->diagonals = st_calloc(dpMatrix->diagonalNumber + 1, sizeof(DpDiagonal *));
+    dpMatrix->diagonals = dpArena_getBuffer((dpMatrix->diagonalNumber + 1) * sizeof(DpDiagonal *));
+    memset(dpMatrix->diagonals, 0, (dpMatrix->diagonalNumber + 1) * sizeof(DpDiagonal *));
     dpMatrix->activeDiagonals = 0;
     dpMatrix->stateNumber = stateNumber;
+    dpMatrix->scaled = scaled;
     return dpMatrix;
 }
 
+DpMatrix *dpMatrix_construct(int64_t diagonalNumber, int64_t stateNumber) {
+    return dpMatrix_construct2(diagonalNumber, stateNumber, 0);
+}
+
 void dpMatrix_destruct(DpMatrix *dpMatrix) {
     assert(dpMatrix->activeDiagonals == 0);
-    free(dpMatrix->diagonals);
-    free(dpMatrix);
+    dpArena_releaseBuffer(dpMatrix->diagonals, (dpMatrix->diagonalNumber + 1) * sizeof(DpDiagonal *));
+    dpArena_releaseBuffer(dpMatrix, sizeof(DpMatrix));
 }
 
 DpDiagonal *dpMatrix_getDiagonal(DpMatrix *dpMatrix, int64_t xay) {
@@ -506,7 +827,8 @@ DpDiagonal *dpMatrix_createDiagonal(DpMatrix *dpMatrix, Diagonal diagonal) {
     assert(diagonal.xay >= 0);
     assert(diagonal.xay <= dpMatrix->diagonalNumber);
     assert(dpMatrix_getDiagonal(dpMatrix, diagonal.xay) == NULL);
-    DpDiagonal *dpDiagonal = dpDiagonal_construct(diagonal, dpMatrix->stateNumber);
+    DpDiagonal *dpDiagonal = dpMatrix->scaled ? dpDiagonal_constructScaled(diagonal, dpMatrix->stateNumber)
+                                              : dpDiagonal_construct(diagonal, dpMatrix->stateNumber);
     dpMatrix->diagonals[diagonal_getXay(diagonal)] = dpDiagonal;
     dpMatrix->activeDiagonals++;
     return dpDiagonal;
@@ -523,6 +845,142 @@ void dpMatrix_deleteDiagonal(DpMatrix *dpMatrix, int64_t xay) {
     }
 }
 
+///////////////////////////////////
+///////////////////////////////////
+//AlignedPairs
+//
+//Growable struct-of-arrays buffer of weighted pairs
+///////////////////////////////////
+///////////////////////////////////
+
+AlignedPairs *alignedPairs_construct(void) {
+    return st_calloc(1, sizeof(AlignedPairs));
+}
+
+void alignedPairs_destruct(AlignedPairs *pairs) {
+    free(pairs->weight);
+    free(pairs->x);
+    free(pairs->y);
+    free(pairs);
+}
+
+static int64_t *alignedPairs_resizeArray(int64_t *array, int64_t length, int64_t maxLength) {
+    int64_t *array2 = st_malloc(maxLength * sizeof(int64_t));
+    if (array != NULL) {
+        memcpy(array2, array, length * sizeof(int64_t));
+        free(array);
+    }
+    return array2;
+}
+
+void alignedPairs_add(AlignedPairs *pairs, int64_t weight, int64_t x, int64_t y) {
+    if (pairs->length == pairs->maxLength) {
+        pairs->maxLength = pairs->maxLength < 64 ? 64 : pairs->maxLength * 2;
+        pairs->weight = alignedPairs_resizeArray(pairs->weight, pairs->length, pairs->maxLength);
+        pairs->x = alignedPairs_resizeArray(pairs->x, pairs->length, pairs->maxLength);
+        pairs->y = alignedPairs_resizeArray(pairs->y, pairs->length, pairs->maxLength);
+    }
+    pairs->weight[pairs->length] = weight;
+    pairs->x[pairs->length] = x;
+    pairs->y[pairs->length++] = y;
+}
+
+void alignedPairs_clear(AlignedPairs *pairs) {
+    pairs->length = 0;
+}
+
+typedef struct _packedPair {
+    int64_t x, y, weight;
+} PackedPair;
+
+static int cmpPackedPairsByCoordinates(const void *a, const void *b) {
+    const PackedPair *one = a, *two = b;
+    if (one->x != two->x) {
+        return one->x < two->x ? -1 : 1;
+    }
+    return one->y < two->y ? -1 : one->y > two->y ? 1 : 0;
+}
+
+static int cmpPackedPairsByInvertedCoordinates(const void *a, const void *b) {
+    const PackedPair *one = a, *two = b;
+    if (one->y != two->y) {
+        return one->y < two->y ? -1 : 1;
+    }
+    return one->x < two->x ? -1 : one->x > two->x ? 1 : 0;
+}
+
+static void alignedPairs_sort(AlignedPairs *pairs, int (*cmpFn)(const void *, const void *)) {
+    PackedPair *packedPairs = st_malloc((pairs->length + 1) * sizeof(PackedPair));
+    for (int64_t i = 0; i < pairs->length; i++) {
+        packedPairs[i].x = pairs->x[i];
+        packedPairs[i].y = pairs->y[i];
+        packedPairs[i].weight = pairs->weight[i];
+    }
+    qsort(packedPairs, pairs->length, sizeof(PackedPair), cmpFn);
+    for (int64_t i = 0; i < pairs->length; i++) {
+        pairs->x[i] = packedPairs[i].x;
+        pairs->y[i] = packedPairs[i].y;
+        pairs->weight[i] = packedPairs[i].weight;
+    }
+    free(packedPairs);
+}
+
+void alignedPairs_sortByCoordinates(AlignedPairs *pairs) {
+    alignedPairs_sort(pairs, cmpPackedPairsByCoordinates);
+}
+
+void alignedPairs_sortByInvertedCoordinates(AlignedPairs *pairs) {
+    alignedPairs_sort(pairs, cmpPackedPairsByInvertedCoordinates);
+}
+
+int64_t alignedPairs_find(AlignedPairs *pairs, int64_t x, int64_t y) {
+    int64_t i = 0, j = pairs->length;
+    while (i < j) {
+        int64_t k = i + (j - i) / 2;
+        if (pairs->x[k] < x || (pairs->x[k] == x && pairs->y[k] < y)) {
+            i = k + 1;
+        } else {
+            j = k;
+        }
+    }
+    return i < pairs->length && pairs->x[i] == x && pairs->y[i] == y ? i : -1;
+}
+
+stList *alignedPairs_toList(AlignedPairs *pairs) {
+    stList *alignedPairs = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
+    for (int64_t i = 0; i < pairs->length; i++) {
+        stList_append(alignedPairs, stIntTuple_construct3(pairs->weight[i], pairs->x[i], pairs->y[i]));
+    }
+    return alignedPairs;
+}
+
+AlignedPairs *alignedPairs_constructFromList(stList *alignedPairs) {
+    AlignedPairs *pairs = alignedPairs_construct();
+    for (int64_t i = 0; i < stList_length(alignedPairs); i++) {
+        stIntTuple *pair = stList_get(alignedPairs, i);
+        alignedPairs_add(pairs, stIntTuple_get(pair, 0), stIntTuple_get(pair, 1), stIntTuple_get(pair, 2));
+    }
+    return pairs;
+}
+
+/*
+ * Shifts the coordinates of the pairs from index start onwards and reverses their order, so that the
+ * pairs of each sub-alignment come out in the same order as from the stList based functions.
+ */
+static void alignedPairs_shiftAndReverse(AlignedPairs *pairs, int64_t start, int64_t offsetX, int64_t offsetY) {
+    for (int64_t i = start, j = pairs->length - 1; i <= j; i++, j--) {
+        int64_t weight = pairs->weight[i], x = pairs->x[i], y = pairs->y[i];
+        pairs->weight[i] = pairs->weight[j];
+        pairs->x[i] = pairs->x[j] + offsetX;
+        pairs->y[i] = pairs->y[j] + offsetY;
+        if (i != j) {
+            pairs->weight[j] = weight;
+            pairs->x[j] = x + offsetX;
+            pairs->y[j] = y + offsetY;
+        }
+    }
+}
+
 ///////////////////////////////////
 ///////////////////////////////////
 //Diagonal DP Calculations
@@ -545,13 +1003,13 @@ static Symbol getYCharacter(const SymbolString sY, int64_t xay, int64_t xmy) {
 }
 
 static void
-diagonalCalculation(StateMachine *sM, DpDiagonal *dpDiagonal, DpDiagonal *dpDiagonalM1, DpDiagonal *dpDiagonalM2,
-                    const SymbolString sX, const SymbolString sY,
-                    void (*cellCalculation)(StateMachine *, double *, double *, double *, double *, Symbol, Symbol,
-                                            void *), void *extraArgs) {
+diagonalCalculationCells(StateMachine *sM, DpDiagonal *dpDiagonal, DpDiagonal *dpDiagonalM1, DpDiagonal *dpDiagonalM2,
+                         const SymbolString sX, const SymbolString sY, int64_t xmyFrom, int64_t xmyTo,
+                         void (*cellCalculation)(StateMachine *, double *, double *, double *, double *, Symbol, Symbol,
+                                                 void *), void *extraArgs) {
     Diagonal diagonal = dpDiagonal->diagonal;
-    int64_t xmy = diagonal_getMinXmy(diagonal);
-    while (xmy <= diagonal_getMaxXmy(diagonal)) {
+    int64_t xmy = xmyFrom;
+    while (xmy <= xmyTo) {
         Symbol x = getXCharacter(sX, diagonal_getXay(diagonal), xmy);
         Symbol y = getYCharacter(sY, diagonal_getXay(diagonal), xmy);
         double *current = dpDiagonal_getCell(dpDiagonal, xmy);
@@ -563,16 +1021,336 @@ diagonalCalculation(StateMachine *sM, DpDiagonal *dpDiagonal, DpDiagonal *dpDiag
     }
 }
 
+static void
+diagonalCalculation(StateMachine *sM, DpDiagonal *dpDiagonal, DpDiagonal *dpDiagonalM1, DpDiagonal *dpDiagonalM2,
+                    const SymbolString sX, const SymbolString sY,
+                    void (*cellCalculation)(StateMachine *, double *, double *, double *, double *, Symbol, Symbol,
+                                            void *), void *extraArgs) {
+    diagonalCalculationCells(sM, dpDiagonal, dpDiagonalM1, dpDiagonalM2, sX, sY,
+                             diagonal_getMinXmy(dpDiagonal->diagonal), diagonal_getMaxXmy(dpDiagonal->diagonal),
+                             cellCalculation, extraArgs);
+}
+
+///////////////////////////////////
+///////////////////////////////////
+//Vectorised diagonal calculations
+//
+//Forward/backward recursions for the three state machine computed for all the cells
+//of a diagonal at once. The emissions for the diagonal are gathered first, then the
+//recurrences are computed in branch free loops over contiguous cells that the compiler
+//can vectorise. Cells at the edges of the band, which lack some of their neighbours,
+//are done with the scalar cell functions.
+///////////////////////////////////
+///////////////////////////////////
+
+//On x86-64 linux gcc builds a version of each lane loop for each instruction set and
+//picks the best one for the host when the program is loaded. Contraction to fused
+//multiply-adds is turned off so that every version gives the same results as the scalar code.
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && defined(__linux__)
+#define DIAGONAL_LANE_TARGETS __attribute__((target_clones("avx512f", "avx2", "sse4.1", "default"), optimize("fp-contract=off")))
+#else
+#define DIAGONAL_LANE_TARGETS
+#endif
+
+//Diagonals narrower than this have their emissions gathered on the stack
+#define DIAGONAL_LANE_STACK_WIDTH 512
+
+static bool useVectorisedDiagonals = 1;
+
+void setPairwiseAlignerUseVectorisedDiagonals(bool useVectorised) {
+    useVectorisedDiagonals = useVectorised;
+}
+
+static void DIAGONAL_LANE_TARGETS
+diagonalLanesForward(StateMachine3 *sM3, int64_t cellNumber, double *restrict current,
+                     const double *restrict lower, const double *restrict middle, const double *restrict upper,
+                     const double *restrict eGapX, const double *restrict eMatch, const double *restrict eGapY) {
+    const double tGapOpenX = sM3->TRANSITION_GAP_OPEN_X, tGapExtendX = sM3->TRANSITION_GAP_EXTEND_X;
+    const double tGapSwitchToX = sM3->TRANSITION_GAP_SWITCH_TO_X, tMatchContinue = sM3->TRANSITION_MATCH_CONTINUE;
+    const double tMatchFromGapX = sM3->TRANSITION_MATCH_FROM_GAP_X, tMatchFromGapY = sM3->TRANSITION_MATCH_FROM_GAP_Y;
+    const double tGapOpenY = sM3->TRANSITION_GAP_OPEN_Y, tGapExtendY = sM3->TRANSITION_GAP_EXTEND_Y;
+    const double tGapSwitchToY = sM3->TRANSITION_GAP_SWITCH_TO_Y;
+    for (int64_t i = 0; i < cellNumber; i++) {
+        double *c = &current[i * SM3_STATES];
+        const double *l = &lower[i * SM3_STATES], *m = &middle[i * SM3_STATES], *u = &upper[i * SM3_STATES];
+        //The order of the additions matches stateMachine3_cellCalculate
+        double gapX = c[SM3_GAP_X];
+        gapX = logMath_logAddApproximateBranchless(gapX, l[SM3_MATCH] + (eGapX[i] + tGapOpenX));
+        gapX = logMath_logAddApproximateBranchless(gapX, l[SM3_GAP_X] + (eGapX[i] + tGapExtendX));
+        gapX = logMath_logAddApproximateBranchless(gapX, l[SM3_GAP_Y] + (eGapX[i] + tGapSwitchToX));
+        double mat = c[SM3_MATCH];
+        mat = logMath_logAddApproximateBranchless(mat, m[SM3_MATCH] + (eMatch[i] + tMatchContinue));
+        mat = logMath_logAddApproximateBranchless(mat, m[SM3_GAP_X] + (eMatch[i] + tMatchFromGapX));
+        mat = logMath_logAddApproximateBranchless(mat, m[SM3_GAP_Y] + (eMatch[i] + tMatchFromGapY));
+        double gapY = c[SM3_GAP_Y];
+        gapY = logMath_logAddApproximateBranchless(gapY, u[SM3_MATCH] + (eGapY[i] + tGapOpenY));
+        gapY = logMath_logAddApproximateBranchless(gapY, u[SM3_GAP_Y] + (eGapY[i] + tGapExtendY));
+        gapY = logMath_logAddApproximateBranchless(gapY, u[SM3_GAP_X] + (eGapY[i] + tGapSwitchToY));
+        c[SM3_MATCH] = mat;
+        c[SM3_GAP_X] = gapX;
+        c[SM3_GAP_Y] = gapY;
+    }
+}
+
+/*
+ * Backward contributions of one block of transitions (all into toState) to the "from" cells.
+ */
+static void DIAGONAL_LANE_TARGETS
+diagonalLanesBackward(int64_t cellNumber, const double *restrict current, double *restrict from, int64_t toState,
+                      const double *restrict eP, double tFromMatch, double tFromGapX, double tFromGapY) {
+    for (int64_t i = 0; i < cellNumber; i++) {
+        double to = current[i * SM3_STATES + toState];
+        double *f = &from[i * SM3_STATES];
+        f[SM3_MATCH] = logMath_logAddApproximateBranchless(f[SM3_MATCH], to + (eP[i] + tFromMatch));
+        f[SM3_GAP_X] = logMath_logAddApproximateBranchless(f[SM3_GAP_X], to + (eP[i] + tFromGapX));
+        f[SM3_GAP_Y] = logMath_logAddApproximateBranchless(f[SM3_GAP_Y], to + (eP[i] + tFromGapY));
+    }
+}
+
+static bool diagonalCalculationIsVectorisable(StateMachine *sM, DpDiagonal *dpDiagonalM1, DpDiagonal *dpDiagonalM2) {
+    // the lanes add with the branchless form of the approximate kernel
+    return useVectorisedDiagonals && (logAddKernel == LOG_ADD_DEFAULT || logAddKernel == LOG_ADD_APPROXIMATE) &&
+           dpDiagonalM1 != NULL && dpDiagonalM2 != NULL && stateMachine_isThreeState(sM);
+}
+
+static void
+diagonalCalculationVectorised(StateMachine *sM, DpDiagonal *dpDiagonal, DpDiagonal *dpDiagonalM1,
+                              DpDiagonal *dpDiagonalM2, const SymbolString sX, const SymbolString sY, bool forward) {
+    CellCalculation cellCalculation = forward ? getForwardCellCalculation(sM) : getBackwardCellCalculation(sM);
+    Diagonal diagonal = dpDiagonal->diagonal;
+    int64_t xay = diagonal_getXay(diagonal);
+
+    //The range of cells which have all three of their neighbours
+    int64_t xmyL = diagonal_getMinXmy(diagonal), xmyR = diagonal_getMaxXmy(diagonal);
+    int64_t laneL = xmyL, laneR = xmyR;
+    laneL = laneL < diagonal_getMinXmy(dpDiagonalM1->diagonal) + 1 ? diagonal_getMinXmy(dpDiagonalM1->diagonal) + 1 : laneL;
+    laneL = laneL < diagonal_getMinXmy(dpDiagonalM2->diagonal) ? diagonal_getMinXmy(dpDiagonalM2->diagonal) : laneL;
+    laneR = laneR > diagonal_getMaxXmy(dpDiagonalM1->diagonal) - 1 ? diagonal_getMaxXmy(dpDiagonalM1->diagonal) - 1 : laneR;
+    laneR = laneR > diagonal_getMaxXmy(dpDiagonalM2->diagonal) ? diagonal_getMaxXmy(dpDiagonalM2->diagonal) : laneR;
+    if (laneL > laneR) {
+        diagonalCalculationCells(sM, dpDiagonal, dpDiagonalM1, dpDiagonalM2, sX, sY, xmyL, xmyR, cellCalculation, NULL);
+        return;
+    }
+    int64_t cellNumber = (laneR - laneL) / 2 + 1;
+
+    //Gather the emissions. The lanes never include the x = 0 or y = 0 cells, as these lack lower or upper
+    //neighbours, so the characters can be read straight from the sequences.
+    double eStack[3 * DIAGONAL_LANE_STACK_WIDTH];
+    double *eGapX = cellNumber <= DIAGONAL_LANE_STACK_WIDTH ? eStack
+                                                            : dpArena_getBuffer(3 * cellNumber * sizeof(double));
+    double *eMatch = &eGapX[cellNumber], *eGapY = &eGapX[2 * cellNumber];
+    Emissions *e = sM->emissions;
+    int64_t x = diagonal_getXCoordinate(xay, laneL), y = diagonal_getYCoordinate(xay, laneL);
+    assert(x > 0 && y - cellNumber + 1 > 0);
+    if (e->diagonalEmissions != NULL) {
+        e->diagonalEmissions(e, &sX.sequence[x - 1], &sY.sequence[y - 1], cellNumber, eGapX, eMatch, eGapY);
+    } else {
+        for (int64_t i = 0; i < cellNumber; i++) {
+            Symbol cX = sX.sequence[x - 1 + i], cY = sY.sequence[y - 1 - i];
+            eGapX[i] = e->gapEmissionX(e, cX);
+            eMatch[i] = e->emission(e, cX, cY);
+            eGapY[i] = e->gapEmissionY(e, cY);
+        }
+    }
+
+    double *current = dpDiagonal_getCell(dpDiagonal, laneL);
+    double *lower = dpDiagonal_getCell(dpDiagonalM1, laneL - 1);
+    double *middle = dpDiagonal_getCell(dpDiagonalM2, laneL);
+    double *upper = dpDiagonal_getCell(dpDiagonalM1, laneL + 1);
+    StateMachine3 *sM3 = (StateMachine3 *) sM;
+
+    //Cells left of the lanes
+    diagonalCalculationCells(sM, dpDiagonal, dpDiagonalM1, dpDiagonalM2, sX, sY, xmyL, laneL - 2, cellCalculation,
+                             NULL);
+    if (forward) {
+        diagonalLanesForward(sM3, cellNumber, current, lower, middle, upper, eGapX, eMatch, eGapY);
+    } else {
+        //A cell of M1 is the upper neighbour of one cell and the lower neighbour of the next, so
+        //the "upper" contributions of all the cells are added before the "lower" ones to keep
+        //the order of the scalar calculation.
+        diagonalLanesBackward(cellNumber, current, upper, SM3_GAP_Y, eGapY, sM3->TRANSITION_GAP_OPEN_Y,
+                              sM3->TRANSITION_GAP_SWITCH_TO_Y, sM3->TRANSITION_GAP_EXTEND_Y);
+        diagonalLanesBackward(cellNumber, current, lower, SM3_GAP_X, eGapX, sM3->TRANSITION_GAP_OPEN_X,
+                              sM3->TRANSITION_GAP_EXTEND_X, sM3->TRANSITION_GAP_SWITCH_TO_X);
+        diagonalLanesBackward(cellNumber, current, middle, SM3_MATCH, eMatch, sM3->TRANSITION_MATCH_CONTINUE,
+                              sM3->TRANSITION_MATCH_FROM_GAP_X, sM3->TRANSITION_MATCH_FROM_GAP_Y);
+    }
+    //Cells right of the lanes
+    diagonalCalculationCells(sM, dpDiagonal, dpDiagonalM1, dpDiagonalM2, sX, sY, laneR + 2, xmyR, cellCalculation,
+                             NULL);
+
+    if (eGapX != eStack) {
+        dpArena_releaseBuffer(eGapX, 3 * cellNumber * sizeof(double));
+    }
+}
+
+///////////////////////////////////
+///////////////////////////////////
+//Scaled diagonal calculations
+//
+//Forward/backward recursions for the three state machine in linear space. Each diagonal holds
+//single precision probabilities relative to its own scale, which is renormalised as the diagonal
+//is completed, so the log-space additions become multiply-adds.
+///////////////////////////////////
+///////////////////////////////////
+
+static float scaledZeroCell[SM3_STATES];
+
+/*
+ * Gets the linear emission probabilities of the cells of a diagonal, each multiplied by the given factor.
+ */
+static void getScaledDiagonalEmissions(StateMachine *sM, Diagonal diagonal, const SymbolString sX,
+                                       const SymbolString sY, double gapFactor, double matchFactor, float *eGapX,
+                                       float *eMatch, float *eGapY, double *buffer) {
+    int64_t xay = diagonal_getXay(diagonal), xmyL = diagonal_getMinXmy(diagonal);
+    int64_t cellNumber = diagonal_getWidth(diagonal);
+    double *eGapX2 = buffer, *eMatch2 = &buffer[cellNumber], *eGapY2 = &buffer[2 * cellNumber];
+    Emissions *e = sM->emissions;
+    //Only the first and last cells of the diagonal can have x = 0 or y = 0
+    int64_t i0 = diagonal_getXCoordinate(xay, xmyL) == 0 ? 1 : 0;
+    int64_t i1 = diagonal_getYCoordinate(xay, diagonal_getMaxXmy(diagonal)) == 0 ? cellNumber - 1 : cellNumber;
+    for (int64_t i = 0; i < cellNumber; i++) {
+        if (i == i0 && i0 < i1 && e->diagonalEmissions != NULL) {
+            int64_t x = diagonal_getXCoordinate(xay, xmyL + 2 * i), y = diagonal_getYCoordinate(xay, xmyL + 2 * i);
+            e->diagonalEmissions(e, &sX.sequence[x - 1], &sY.sequence[y - 1], i1 - i0, &eGapX2[i], &eMatch2[i],
+                                 &eGapY2[i]);
+            i = i1 - 1;
+            continue;
+        }
+        Symbol x = getXCharacter(sX, xay, xmyL + 2 * i);
+        Symbol y = getYCharacter(sY, xay, xmyL + 2 * i);
+        eGapX2[i] = e->gapEmissionX(e, x);
+        eMatch2[i] = e->emission(e, x, y);
+        eGapY2[i] = e->gapEmissionY(e, y);
+    }
+    for (int64_t i = 0; i < cellNumber; i++) {
+        eGapX[i] = (float) (exp(eGapX2[i]) * gapFactor);
+        eMatch[i] = (float) (exp(eMatch2[i]) * matchFactor);
+        eGapY[i] = (float) (exp(eGapY2[i]) * gapFactor);
+    }
+}
+
+static void
+diagonalCalculationScaled(StateMachine *sM, DpDiagonal *dpDiagonal, DpDiagonal *dpDiagonalM1, DpDiagonal *dpDiagonalM2,
+                          const SymbolString sX, const SymbolString sY, bool forward) {
+    assert(stateMachine_isThreeState(sM));
+    StateMachine3 *sM3 = (StateMachine3 *) sM;
+    Diagonal diagonal = dpDiagonal->diagonal;
+    int64_t xmyL = diagonal_getMinXmy(diagonal);
+    int64_t cellNumber = diagonal_getWidth(diagonal);
+
+    //Get the factors to bring the values from one diagonal to the scale of the other
+    double factorM1, factorM2;
+    if (forward) {
+        double logScaleM1 = dpDiagonalM1 == NULL ? LOG_ZERO : dpDiagonalM1->logScale;
+        double logScaleM2 = dpDiagonalM2 == NULL ? LOG_ZERO : dpDiagonalM2->logScale;
+        dpDiagonal_alignScale(dpDiagonal, logScaleM1 > logScaleM2 ? logScaleM1 : logScaleM2);
+        factorM1 = dpDiagonal_alignScale(dpDiagonal, logScaleM1);
+        factorM2 = dpDiagonal_alignScale(dpDiagonal, logScaleM2);
+    } else {
+        //The current diagonal is complete, all later diagonals having been added to it
+        dpDiagonal_normaliseScaled(dpDiagonal);
+        factorM1 = dpDiagonalM1 == NULL ? 0.0 : dpDiagonal_alignScale(dpDiagonalM1, dpDiagonal->logScale);
+        factorM2 = dpDiagonalM2 == NULL ? 0.0 : dpDiagonal_alignScale(dpDiagonalM2, dpDiagonal->logScale);
+    }
+    if (factorM1 == 0.0 && factorM2 == 0.0) {
+        return;
+    }
+
+    double eStack[3 * DIAGONAL_LANE_STACK_WIDTH];
+    float eStack2[3 * DIAGONAL_LANE_STACK_WIDTH];
+    bool onStack = cellNumber <= DIAGONAL_LANE_STACK_WIDTH;
+    double *buffer = onStack ? eStack : dpArena_getBuffer(3 * cellNumber * sizeof(double));
+    float *eGapX = onStack ? eStack2 : dpArena_getBuffer(3 * cellNumber * sizeof(float));
+    float *eMatch = &eGapX[cellNumber], *eGapY = &eGapX[2 * cellNumber];
+    getScaledDiagonalEmissions(sM, diagonal, sX, sY, factorM1, factorM2, eGapX, eMatch, eGapY, buffer);
+
+    const float tGapOpenX = exp(sM3->TRANSITION_GAP_OPEN_X), tGapExtendX = exp(sM3->TRANSITION_GAP_EXTEND_X);
+    const float tGapSwitchToX = exp(sM3->TRANSITION_GAP_SWITCH_TO_X);
+    const float tMatchContinue = exp(sM3->TRANSITION_MATCH_CONTINUE);
+    const float tMatchFromGapX = exp(sM3->TRANSITION_MATCH_FROM_GAP_X);
+    const float tMatchFromGapY = exp(sM3->TRANSITION_MATCH_FROM_GAP_Y);
+    const float tGapOpenY = exp(sM3->TRANSITION_GAP_OPEN_Y), tGapExtendY = exp(sM3->TRANSITION_GAP_EXTEND_Y);
+    const float tGapSwitchToY = exp(sM3->TRANSITION_GAP_SWITCH_TO_Y);
+
+    float scratchCell[SM3_STATES];
+    for (int64_t i = 0; i < cellNumber; i++) {
+        int64_t xmy = xmyL + 2 * i;
+        float *c = &dpDiagonal->scaledCells[i * SM3_STATES];
+        float *l = dpDiagonalM1 == NULL ? NULL : dpDiagonal_getScaledCell(dpDiagonalM1, xmy - 1);
+        float *m = dpDiagonalM2 == NULL ? NULL : dpDiagonal_getScaledCell(dpDiagonalM2, xmy);
+        float *u = dpDiagonalM1 == NULL ? NULL : dpDiagonal_getScaledCell(dpDiagonalM1, xmy + 1);
+        if (forward) {
+            //Missing neighbours contribute nothing
+            l = l == NULL ? scaledZeroCell : l;
+            m = m == NULL ? scaledZeroCell : m;
+            u = u == NULL ? scaledZeroCell : u;
+            c[SM3_GAP_X] += eGapX[i] * (l[SM3_MATCH] * tGapOpenX + l[SM3_GAP_X] * tGapExtendX +
+                                        l[SM3_GAP_Y] * tGapSwitchToX);
+            c[SM3_MATCH] += eMatch[i] * (m[SM3_MATCH] * tMatchContinue + m[SM3_GAP_X] * tMatchFromGapX +
+                                         m[SM3_GAP_Y] * tMatchFromGapY);
+            c[SM3_GAP_Y] += eGapY[i] * (u[SM3_MATCH] * tGapOpenY + u[SM3_GAP_Y] * tGapExtendY +
+                                        u[SM3_GAP_X] * tGapSwitchToY);
+        } else {
+            //Contributions to missing neighbours are discarded
+            l = l == NULL ? scratchCell : l;
+            m = m == NULL ? scratchCell : m;
+            u = u == NULL ? scratchCell : u;
+            float gapX = c[SM3_GAP_X] * eGapX[i];
+            l[SM3_MATCH] += gapX * tGapOpenX;
+            l[SM3_GAP_X] += gapX * tGapExtendX;
+            l[SM3_GAP_Y] += gapX * tGapSwitchToX;
+            float match = c[SM3_MATCH] * eMatch[i];
+            m[SM3_MATCH] += match * tMatchContinue;
+            m[SM3_GAP_X] += match * tMatchFromGapX;
+            m[SM3_GAP_Y] += match * tMatchFromGapY;
+            float gapY = c[SM3_GAP_Y] * eGapY[i];
+            u[SM3_MATCH] += gapY * tGapOpenY;
+            u[SM3_GAP_Y] += gapY * tGapExtendY;
+            u[SM3_GAP_X] += gapY * tGapSwitchToY;
+        }
+    }
+    if (forward) {
+        dpDiagonal_normaliseScaled(dpDiagonal);
+    }
+
+    if (!onStack) {
+        dpArena_releaseBuffer(buffer, 3 * cellNumber * sizeof(double));
+        dpArena_releaseBuffer(eGapX, 3 * cellNumber * sizeof(float));
+    }
+}
+
+static void diagonalCalculationForward2(StateMachine *sM, DpDiagonal *dpDiagonal, DpDiagonal *dpDiagonalM1,
+                                        DpDiagonal *dpDiagonalM2, const SymbolString sX, const SymbolString sY) {
+    chunkTelemetry_addCount(CTC_DP_CELLS, diagonal_getWidth(dpDiagonal->diagonal));
+    if (dpDiagonal_isScaled(dpDiagonal)) {
+        diagonalCalculationScaled(sM, dpDiagonal, dpDiagonalM1, dpDiagonalM2, sX, sY, 1);
+    } else if (diagonalCalculationIsVectorisable(sM, dpDiagonalM1, dpDiagonalM2)) {
+        diagonalCalculationVectorised(sM, dpDiagonal, dpDiagonalM1, dpDiagonalM2, sX, sY, 1);
+    } else {
+        diagonalCalculation(sM, dpDiagonal, dpDiagonalM1, dpDiagonalM2, sX, sY, getForwardCellCalculation(sM), NULL);
+    }
+}
+
 void diagonalCalculationForward(StateMachine *sM, int64_t xay, DpMatrix *dpMatrix, const SymbolString sX,
                                 const SymbolString sY) {
-    diagonalCalculation(sM, dpMatrix_getDiagonal(dpMatrix, xay), dpMatrix_getDiagonal(dpMatrix, xay - 1),
-                        dpMatrix_getDiagonal(dpMatrix, xay - 2), sX, sY, cell_calculateForward, NULL);
+    diagonalCalculationForward2(sM, dpMatrix_getDiagonal(dpMatrix, xay), dpMatrix_getDiagonal(dpMatrix, xay - 1),
+                                dpMatrix_getDiagonal(dpMatrix, xay - 2), sX, sY);
 }
 
 void diagonalCalculationBackward(StateMachine *sM, int64_t xay, DpMatrix *dpMatrix, const SymbolString sX,
                                  const SymbolString sY) {
-    diagonalCalculation(sM, dpMatrix_getDiagonal(dpMatrix, xay), dpMatrix_getDiagonal(dpMatrix, xay - 1),
-                        dpMatrix_getDiagonal(dpMatrix, xay - 2), sX, sY, cell_calculateBackward, NULL);
+    DpDiagonal *dpDiagonalM1 = dpMatrix_getDiagonal(dpMatrix, xay - 1);
+    DpDiagonal *dpDiagonalM2 = dpMatrix_getDiagonal(dpMatrix, xay - 2);
+    chunkTelemetry_addCount(CTC_DP_CELLS, diagonal_getWidth(dpMatrix_getDiagonal(dpMatrix, xay)->diagonal));
+    if (dpMatrix->scaled) {
+        diagonalCalculationScaled(sM, dpMatrix_getDiagonal(dpMatrix, xay), dpDiagonalM1, dpDiagonalM2, sX, sY, 0);
+    } else if (diagonalCalculationIsVectorisable(sM, dpDiagonalM1, dpDiagonalM2)) {
+        diagonalCalculationVectorised(sM, dpMatrix_getDiagonal(dpMatrix, xay), dpDiagonalM1, dpDiagonalM2, sX, sY, 0);
+    } else {
+        diagonalCalculation(sM, dpMatrix_getDiagonal(dpMatrix, xay), dpDiagonalM1, dpDiagonalM2, sX, sY,
+                            getBackwardCellCalculation(sM), NULL);
+    }
 }
 
 double diagonalCalculationTotalProbability(StateMachine *sM, int64_t xay, DpMatrix *forwardDpMatrix,
@@ -588,7 +1366,12 @@ double diagonalCalculationTotalProbability(StateMachine *sM, int64_t xay, DpMatr
     if (backDiagonal != NULL && forwardDiagonal != NULL) {
         DpDiagonal *matchDiagonal = dpDiagonal_clone(backDiagonal);
         dpDiagonal_zeroValues(matchDiagonal);
-        diagonalCalculation(sM, matchDiagonal, NULL, forwardDiagonal, sX, sY, cell_calculateForward, NULL);
+        if (dpDiagonal_isScaled(matchDiagonal)) {
+            diagonalCalculationScaled(sM, matchDiagonal, NULL, forwardDiagonal, sX, sY, 1);
+        } else {
+            diagonalCalculation(sM, matchDiagonal, NULL, forwardDiagonal, sX, sY, getForwardCellCalculation(sM),
+                                NULL);
+        }
         totalProbability = logAdd(totalProbability, dpDiagonal_dotProduct(matchDiagonal, backDiagonal));
         dpDiagonal_destruct(matchDiagonal);
     }
@@ -607,6 +1390,53 @@ void addPosteriorProb(int64_t x, int64_t y, double posteriorProbability, stList
     }
 }
 
+static inline void addPosteriorProbToPairs(int64_t x, int64_t y, double posteriorProbability, AlignedPairs *pairs,
+                                           PairwiseAlignmentParameters *p) {
+    if (posteriorProbability >= p->threshold) {
+        if (posteriorProbability > 1.0) {
+            posteriorProbability = 1.0;
+        }
+        alignedPairs_add(pairs, (int64_t) floor(posteriorProbability * PAIR_ALIGNMENT_PROB_1), x - 1, y - 1);
+    }
+}
+
+/*
+ * Functions to skip the diagonals on which no cell has a posterior at or above the threshold, in any of the given
+ * states, without computing the posteriors. The posterior of a cell is at most the product of the largest forward and
+ * largest backward values of the diagonal, over the cells and states, over the total probability.
+ */
+
+static double dpDiagonal_getMaxValue(DpDiagonal *dpDiagonal, int64_t *states, int64_t stateNo) {
+    double maxValue = dpDiagonal_isScaled(dpDiagonal) ? 0.0 : LOG_ZERO;
+    int64_t width = diagonal_getWidth(dpDiagonal->diagonal);
+    for (int64_t i = 0; i < width; i++) {
+        for (int64_t j = 0; j < stateNo; j++) {
+            int64_t k = i * dpDiagonal->stateNumber + states[j];
+            double value = dpDiagonal_isScaled(dpDiagonal) ? dpDiagonal->scaledCells[k] : dpDiagonal->cells[k];
+            if (value > maxValue) {
+                maxValue = value;
+            }
+        }
+    }
+    return maxValue;
+}
+
+static bool diagonalHasPosteriorsOverThreshold(DpDiagonal *forwardDiagonal, DpDiagonal *backDiagonal,
+                                               int64_t *states, int64_t stateNo, double totalProbability,
+                                               PairwiseAlignmentParameters *p) {
+    if (p->threshold <= 0.0) {
+        return 1;
+    }
+    double maxForward = dpDiagonal_getMaxValue(forwardDiagonal, states, stateNo);
+    double maxBackward = dpDiagonal_getMaxValue(backDiagonal, states, stateNo);
+    // The bound is relaxed very slightly, so that rounding can not drop a posterior at the threshold
+    if (dpDiagonal_isScaled(forwardDiagonal)) {
+        return maxForward * maxBackward * exp(forwardDiagonal->logScale + backDiagonal->logScale - totalProbability)
+               >= p->threshold * (1.0 - 1.0e-6);
+    }
+    return maxForward + maxBackward - totalProbability >= log(p->threshold) - 1.0e-6;
+}
+
 void diagonalCalculationPosteriorMatchProbs(StateMachine *sM, int64_t xay, DpMatrix *forwardDpMatrix,
                                             DpMatrix *backwardDpMatrix,
                                             const SymbolString sX, const SymbolString sY, double totalProbability,
@@ -617,8 +1447,27 @@ void diagonalCalculationPosteriorMatchProbs(StateMachine *sM, int64_t xay, DpMat
     stList *alignedPairs = ((void **) extraArgs)[0];
     DpDiagonal *forwardDiagonal = dpMatrix_getDiagonal(forwardDpMatrix, xay);
     DpDiagonal *backDiagonal = dpMatrix_getDiagonal(backwardDpMatrix, xay);
+    int64_t states[1] = { sM->matchState };
+    if (!diagonalHasPosteriorsOverThreshold(forwardDiagonal, backDiagonal, states, 1, totalProbability, p)) {
+        return;
+    }
     Diagonal diagonal = forwardDiagonal->diagonal;
     int64_t xmy = diagonal_getMinXmy(diagonal);
+    if (dpDiagonal_isScaled(forwardDiagonal)) {
+        double scale = exp(forwardDiagonal->logScale + backDiagonal->logScale - totalProbability);
+        while (xmy <= diagonal_getMaxXmy(diagonal)) {
+            int64_t x = diagonal_getXCoordinate(diagonal_getXay(diagonal), xmy);
+            int64_t y = diagonal_getYCoordinate(diagonal_getXay(diagonal), xmy);
+            if (x > 0 && y > 0) {
+                float *cellForward = dpDiagonal_getScaledCell(forwardDiagonal, xmy);
+                float *cellBackward = dpDiagonal_getScaledCell(backDiagonal, xmy);
+                addPosteriorProb(x, y, cellForward[sM->matchState] * cellBackward[sM->matchState] * scale,
+                                 alignedPairs, p);
+            }
+            xmy += 2;
+        }
+        return;
+    }
     //Walk over the cells computing the posteriors
     while (xmy <= diagonal_getMaxXmy(diagonal)) {
         int64_t x = diagonal_getXCoordinate(diagonal_getXay(diagonal), xmy);
@@ -642,38 +1491,64 @@ diagonalCalculationPosteriorProbs(StateMachine *sM, int64_t xay, DpMatrix *forwa
     assert(p->threshold >= 0.0);
     assert(p->threshold <= 1.0);
 
-    stList *alignedPairs = ((void **) extraArgs)[0];
-    stList *gapXPairs = ((void **) extraArgs)[2];
-    stList *gapYPairs = ((void **) extraArgs)[4];
+    AlignedPairs *alignedPairs = ((void **) extraArgs)[0];
+    AlignedPairs *gapXPairs = ((void **) extraArgs)[1];
+    AlignedPairs *gapYPairs = ((void **) extraArgs)[2];
 
     DpDiagonal *forwardDiagonal = dpMatrix_getDiagonal(forwardDpMatrix, xay);
     DpDiagonal *backDiagonal = dpMatrix_getDiagonal(backwardDpMatrix, xay);
+    int64_t states[3] = { sM->matchState, sM->gapXState, sM->gapYState };
+    if (!diagonalHasPosteriorsOverThreshold(forwardDiagonal, backDiagonal, states, 3, totalProbability, p)) {
+        return;
+    }
     Diagonal diagonal = forwardDiagonal->diagonal;
     int64_t xmy = diagonal_getMinXmy(diagonal);
+    if (dpDiagonal_isScaled(forwardDiagonal)) {
+        double scale = exp(forwardDiagonal->logScale + backDiagonal->logScale - totalProbability);
+        while (xmy <= diagonal_getMaxXmy(diagonal)) {
+            int64_t x = diagonal_getXCoordinate(diagonal_getXay(diagonal), xmy);
+            int64_t y = diagonal_getYCoordinate(diagonal_getXay(diagonal), xmy);
+            float *cellForward = dpDiagonal_getScaledCell(forwardDiagonal, xmy);
+            float *cellBackward = dpDiagonal_getScaledCell(backDiagonal, xmy);
+            if (x > 0 && y > 0) {
+                addPosteriorProbToPairs(x, y, cellForward[sM->matchState] * cellBackward[sM->matchState] * scale,
+                                        alignedPairs, p);
+            }
+            if (x > 0) {
+                addPosteriorProbToPairs(x, y, cellForward[sM->gapXState] * cellBackward[sM->gapXState] * scale,
+                                        gapXPairs, p);
+            }
+            if (y > 0) {
+                addPosteriorProbToPairs(x, y, cellForward[sM->gapYState] * cellBackward[sM->gapYState] * scale,
+                                        gapYPairs, p);
+            }
+            xmy += 2;
+        }
+        return;
+    }
     //Walk over the cells computing the posteriors
+    double logThreshold = p->threshold > 0.0 ? log(p->threshold) - 1.0e-6 : LOG_ZERO;
     while (xmy <= diagonal_getMaxXmy(diagonal)) {
         int64_t x = diagonal_getXCoordinate(diagonal_getXay(diagonal), xmy);
         int64_t y = diagonal_getYCoordinate(diagonal_getXay(diagonal), xmy);
 
         double *cellForward = dpDiagonal_getCell(forwardDiagonal, xmy);
         double *cellBackward = dpDiagonal_getCell(backDiagonal, xmy);
-        if (x > 0 && y > 0) {
+        // The exponentials are only taken of the log posteriors that can reach the threshold
+        double logPosteriorMatch = cellForward[sM->matchState] + cellBackward[sM->matchState] - totalProbability;
+        double logPosteriorGapX = cellForward[sM->gapXState] + cellBackward[sM->gapXState] - totalProbability;
+        double logPosteriorGapY = cellForward[sM->gapYState] + cellBackward[sM->gapYState] - totalProbability;
+        if (x > 0 && y > 0 && logPosteriorMatch >= logThreshold) {
             // Posterior match prob
-            double posteriorProbability = exp(
-                    (cellForward[sM->matchState] + cellBackward[sM->matchState]) - totalProbability);
-            addPosteriorProb(x, y, posteriorProbability, alignedPairs, p);
+            addPosteriorProbToPairs(x, y, exp(logPosteriorMatch), alignedPairs, p);
         }
 
-        if (x > 0) {
-            double posteriorProbability = exp(
-                    (cellForward[sM->gapXState] + cellBackward[sM->gapXState]) - totalProbability);
-            addPosteriorProb(x, y, posteriorProbability, gapXPairs, p);
+        if (x > 0 && logPosteriorGapX >= logThreshold) {
+            addPosteriorProbToPairs(x, y, exp(logPosteriorGapX), gapXPairs, p);
         }
 
-        if (y > 0) {
-            double posteriorProbability = exp(
-                    (cellForward[sM->gapYState] + cellBackward[sM->gapYState]) - totalProbability);
-            addPosteriorProb(x, y, posteriorProbability, gapYPairs, p);
+        if (y > 0 && logPosteriorGapY >= logThreshold) {
+            addPosteriorProbToPairs(x, y, exp(logPosteriorGapY), gapYPairs, p);
         }
 
         xmy += 2;
@@ -692,7 +1567,8 @@ diagonalCalculationExpectations(StateMachine *sM, int64_t xay, DpMatrix *forward
     void *extraArgs2[2] = {&totalProbability, hmmExpectations};
     hmmExpectations->likelihood += totalProbability; //We do this once per diagonal, which is a hack, rather than for the whole matrix. The correction factor is approximately 1/number of diagonals.
     diagonalCalculation(sM, dpMatrix_getDiagonal(backwardDpMatrix, xay), dpMatrix_getDiagonal(forwardDpMatrix, xay - 1),
-                        dpMatrix_getDiagonal(forwardDpMatrix, xay - 2), sX, sY, cell_calculateExpectation, extraArgs2);
+                        dpMatrix_getDiagonal(forwardDpMatrix, xay - 2), sX, sY, getExpectationCellCalculation(sM),
+                        extraArgs2);
 }
 
 ///////////////////////////////////
@@ -703,6 +1579,89 @@ diagonalCalculationExpectations(StateMachine *sM, int64_t xay, DpMatrix *forward
 ///////////////////////////////////
 ///////////////////////////////////
 
+/*
+ * Functions for the x-drop band, which adapts the band given by the anchors to the forward probabilities. Each
+ * diagonal is narrowed to the cells reachable from the kept cells of the previous two diagonals, and once its forward
+ * values are calculated the cells at its ends more than the x-drop (in log space) below its maximum are dropped.
+ * The band so stays wide where the probability mass is spread, as around indels, and narrow elsewhere.
+ */
+
+static Diagonal band_narrowToPredecessors(Diagonal diagonal, DpDiagonal *dpDiagonalM1, DpDiagonal *dpDiagonalM2) {
+    if (dpDiagonalM1 == NULL) {
+        return diagonal;
+    }
+    // Gaps reach from the adjacent cells of the previous diagonal, matches from the same cell two diagonals back
+    int64_t xmyL = diagonal_getMinXmy(dpDiagonalM1->diagonal) - 1;
+    int64_t xmyR = diagonal_getMaxXmy(dpDiagonalM1->diagonal) + 1;
+    if (dpDiagonalM2 != NULL) {
+        xmyL = diagonal_getMinXmy(dpDiagonalM2->diagonal) < xmyL ? diagonal_getMinXmy(dpDiagonalM2->diagonal) : xmyL;
+        xmyR = diagonal_getMaxXmy(dpDiagonalM2->diagonal) > xmyR ? diagonal_getMaxXmy(dpDiagonalM2->diagonal) : xmyR;
+    }
+    xmyL = xmyL > diagonal_getMinXmy(diagonal) ? xmyL : diagonal_getMinXmy(diagonal);
+    xmyR = xmyR < diagonal_getMaxXmy(diagonal) ? xmyR : diagonal_getMaxXmy(diagonal);
+    if (xmyL > xmyR) { // Nothing is reachable within the band, so leave it as it is
+        return diagonal;
+    }
+    return diagonal_construct(diagonal_getXay(diagonal), xmyL, xmyR);
+}
+
+static Diagonal dpDiagonal_getXDropRange(DpDiagonal *dpDiagonal, double xDrop) {
+    int64_t width = diagonal_getWidth(dpDiagonal->diagonal);
+    bool scaled = dpDiagonal_isScaled(dpDiagonal);
+    double zero = scaled ? 0.0 : LOG_ZERO;
+    int64_t cellNumber = width * dpDiagonal->stateNumber;
+    double maxValue = zero;
+    for (int64_t k = 0; k < cellNumber; k++) {
+        double value = scaled ? dpDiagonal->scaledCells[k] : dpDiagonal->cells[k];
+        maxValue = value > maxValue ? value : maxValue;
+    }
+    if (maxValue == zero) {
+        return dpDiagonal->diagonal;
+    }
+    double minValue = scaled ? maxValue * exp(-xDrop) : maxValue - xDrop;
+    int64_t first = width, last = -1;
+    for (int64_t i = 0; i < width; i++) {
+        for (int64_t j = 0; j < dpDiagonal->stateNumber; j++) {
+            int64_t k = i * dpDiagonal->stateNumber + j;
+            double value = scaled ? dpDiagonal->scaledCells[k] : dpDiagonal->cells[k];
+            if (value > zero && value >= minValue) {
+                first = i < first ? i : first;
+                last = i;
+                break;
+            }
+        }
+    }
+    assert(first <= last);
+    int64_t xmyL = diagonal_getMinXmy(dpDiagonal->diagonal);
+    return diagonal_construct(diagonal_getXay(dpDiagonal->diagonal), xmyL + 2 * first, xmyL + 2 * last);
+}
+
+/*
+ * Replaces the diagonal of the matrix with one covering the given sub-range of it, keeping the values.
+ */
+static void dpMatrix_trimDiagonal(DpMatrix *dpMatrix, Diagonal diagonal) {
+    DpDiagonal *dpDiagonal = dpMatrix_getDiagonal(dpMatrix, diagonal_getXay(diagonal));
+    assert(dpDiagonal != NULL);
+    assert(diagonal_getMinXmy(diagonal) >= diagonal_getMinXmy(dpDiagonal->diagonal));
+    assert(diagonal_getMaxXmy(diagonal) <= diagonal_getMaxXmy(dpDiagonal->diagonal));
+    if (diagonal_getWidth(diagonal) == diagonal_getWidth(dpDiagonal->diagonal)) {
+        return;
+    }
+    DpDiagonal *trimmedDiagonal = dpMatrix->scaled ? dpDiagonal_constructScaled(diagonal, dpMatrix->stateNumber)
+                                                   : dpDiagonal_construct(diagonal, dpMatrix->stateNumber);
+    int64_t offset = ((diagonal_getMinXmy(diagonal) - diagonal_getMinXmy(dpDiagonal->diagonal)) / 2) *
+                     dpMatrix->stateNumber;
+    int64_t cellNumber = diagonal_getWidth(diagonal) * dpMatrix->stateNumber;
+    if (dpMatrix->scaled) {
+        memcpy(trimmedDiagonal->scaledCells, &dpDiagonal->scaledCells[offset], sizeof(float) * cellNumber);
+    } else {
+        memcpy(trimmedDiagonal->cells, &dpDiagonal->cells[offset], sizeof(double) * cellNumber);
+    }
+    trimmedDiagonal->logScale = dpDiagonal->logScale;
+    dpDiagonal_destruct(dpDiagonal);
+    dpMatrix->diagonals[diagonal_getXay(diagonal)] = trimmedDiagonal;
+}
+
 void getPosteriorProbsWithBanding(StateMachine *sM, stList *anchorPairs, const SymbolString sX, const SymbolString sY,
                                   PairwiseAlignmentParameters *p, bool alignmentHasRaggedLeftEnd,
                                   bool alignmentHasRaggedRightEnd,
@@ -722,28 +1681,46 @@ void getPosteriorProbsWithBanding(StateMachine *sM, stList *anchorPairs, const S
         return;
     }
 
+    //The scaled calculations are not used for training, which needs the log-space cell calculations
+    bool scaled = p->scaledFloatProbabilities && stateMachine_isThreeState(sM) &&
+                  diagonalPosteriorProbFn != diagonalCalculationExpectations;
+
     //Primitives for the forward matrix recursion
     Band *band = p->dynamicAnchorExpansion ? band_constructDynamic(anchorPairs, sX.length, sY.length) : band_construct(
             anchorPairs, sX.length, sY.length, p->diagonalExpansion);
     BandIterator *forwardBandIterator = bandIterator_construct(band);
-    DpMatrix *forwardDpMatrix = dpMatrix_construct(diagonalNumber, sM->stateNumber);
+    DpMatrix *forwardDpMatrix = dpMatrix_construct2(diagonalNumber, sM->stateNumber, scaled);
     dpDiagonal_initialiseValues(dpMatrix_createDiagonal(forwardDpMatrix, bandIterator_getNext(forwardBandIterator)), sM,
                                 alignmentHasRaggedLeftEnd ? sM->raggedStartStateProb
                                                           : sM->startStateProb); //Initialise forward matrix.
 
     //Backward matrix.
-    DpMatrix *backwardDpMatrix = dpMatrix_construct(diagonalNumber, sM->stateNumber);
+    DpMatrix *backwardDpMatrix = dpMatrix_construct2(diagonalNumber, sM->stateNumber, scaled);
 
     int64_t tracedBackTo = 0;
     int64_t totalPosteriorCalculations = 0;
     while (1) { //Loop that moves through the matrix forward
         Diagonal diagonal = bandIterator_getNext(forwardBandIterator);
+        if (p->xDrop > 0) {
+            diagonal = band_narrowToPredecessors(diagonal,
+                                                 dpMatrix_getDiagonal(forwardDpMatrix, diagonal_getXay(diagonal) - 1),
+                                                 dpMatrix_getDiagonal(forwardDpMatrix, diagonal_getXay(diagonal) - 2));
+            band->diagonals[diagonal_getXay(diagonal)] = diagonal;
+        }
 
         //Forward calculation
         dpDiagonal_zeroValues(dpMatrix_createDiagonal(forwardDpMatrix, diagonal));
         diagonalCalculationForward(sM, diagonal_getXay(diagonal), forwardDpMatrix, sX, sY);
 
         bool atEnd = diagonal_getXay(diagonal) == diagonalNumber; //Condition true at the end of the matrix
+
+        //Drop the improbable ends of the diagonal from the band, so the backward calculation sees the same band
+        if (p->xDrop > 0 && !atEnd) {
+            diagonal = dpDiagonal_getXDropRange(dpMatrix_getDiagonal(forwardDpMatrix, diagonal_getXay(diagonal)),
+                                                p->xDrop);
+            dpMatrix_trimDiagonal(forwardDpMatrix, diagonal);
+            band->diagonals[diagonal_getXay(diagonal)] = diagonal;
+        }
         bool tracebackPoint = diagonal_getXay(diagonal) >= tracedBackTo + p->minDiagsBetweenTraceBack
                               && diagonal_getWidth(diagonal) <= p->diagonalExpansion * 2 +
                                                                 1; //Condition true when we want to do an intermediate traceback.
@@ -844,64 +1821,257 @@ void getPosteriorProbsWithBanding(StateMachine *sM, stList *anchorPairs, const S
 }
 
 /*
- * Computes for the forward log probability of aligning the two sequences
+ * Computes for the forward log probability of aligning the two sequences
+ */
+double computeForwardProbability(SymbolString sX, SymbolString sY, stList *anchorPairs, PairwiseAlignmentParameters *p,
+                                 StateMachine *sM,
+                                 bool alignmentHasRaggedLeftEnd, bool alignmentHasRaggedRightEnd) {
+    return computeForwardProbability2(sX, sY, anchorPairs, p, sM, alignmentHasRaggedLeftEnd,
+                                      alignmentHasRaggedRightEnd, LOG_ZERO);
+}
+
+/*
+ * The forward dp cells with x coordinate at most prefixLength, for the first diagonalNumber diagonals
+ * of an alignment without anchors. These are the same for any sequence X with the same prefix.
+ */
+typedef struct _forwardPrefix {
+    int64_t prefixLength;
+    int64_t diagonalNumber;
+    DpDiagonal **diagonals;
+} ForwardPrefix;
+
+static void forwardPrefix_clear(ForwardPrefix *prefix) {
+    for (int64_t i = 0; i < prefix->diagonalNumber; i++) {
+        if (prefix->diagonals[i] != NULL) {
+            dpDiagonal_destruct(prefix->diagonals[i]);
+            prefix->diagonals[i] = NULL;
+        }
+    }
+    prefix->diagonalNumber = 0;
+}
+
+/*
+ * Stores the cells of the diagonal within the prefix.
+ */
+static void forwardPrefix_add(ForwardPrefix *prefix, DpDiagonal *dpDiagonal) {
+    Diagonal diagonal = dpDiagonal->diagonal;
+    int64_t xay = diagonal_getXay(diagonal), xmyR = 2 * prefix->prefixLength - xay;
+    assert(prefix->diagonalNumber == xay);
+    if (xmyR >= diagonal_getMinXmy(diagonal)) {
+        xmyR = xmyR < diagonal_getMaxXmy(diagonal) ? xmyR : diagonal_getMaxXmy(diagonal);
+        DpDiagonal *prefixDiagonal = dpDiagonal_construct(diagonal_construct(xay, diagonal_getMinXmy(diagonal), xmyR),
+                                                          dpDiagonal->stateNumber);
+        memcpy(prefixDiagonal->cells, dpDiagonal->cells, dpDiagonal_getCellBytes(prefixDiagonal));
+        prefix->diagonals[xay] = prefixDiagonal;
+    }
+    prefix->diagonalNumber++;
+}
+
+/*
+ * Does the forward calculation for a diagonal, copying the cells it has in common with the shared prefix.
+ */
+static void diagonalCalculationForwardWithPrefix(StateMachine *sM, DpDiagonal *dpDiagonal, DpDiagonal *dpDiagonalM1,
+                                                 DpDiagonal *dpDiagonalM2, const SymbolString sX,
+                                                 const SymbolString sY, ForwardPrefix *sharedPrefix) {
+    int64_t xay = diagonal_getXay(dpDiagonal->diagonal);
+    DpDiagonal *prefixDiagonal = sharedPrefix != NULL && xay < sharedPrefix->diagonalNumber
+                                 ? sharedPrefix->diagonals[xay] : NULL;
+    if (prefixDiagonal == NULL) {
+        diagonalCalculationForward2(sM, dpDiagonal, dpDiagonalM1, dpDiagonalM2, sX, sY);
+        return;
+    }
+    assert(diagonal_getMinXmy(prefixDiagonal->diagonal) == diagonal_getMinXmy(dpDiagonal->diagonal));
+    memcpy(dpDiagonal->cells, prefixDiagonal->cells, dpDiagonal_getCellBytes(prefixDiagonal));
+    int64_t xmyL = diagonal_getMaxXmy(prefixDiagonal->diagonal) + 2;
+    if (xmyL <= diagonal_getMaxXmy(dpDiagonal->diagonal)) {
+        //The rest of the cells are calculated through a diagonal covering just them
+        DpDiagonal suffixDiagonal = *dpDiagonal;
+        suffixDiagonal.diagonal = diagonal_construct(xay, xmyL, diagonal_getMaxXmy(dpDiagonal->diagonal));
+        suffixDiagonal.cells = dpDiagonal_getCell(dpDiagonal, xmyL);
+        diagonalCalculationForward2(sM, &suffixDiagonal, dpDiagonalM1, dpDiagonalM2, sX, sY);
+    }
+}
+
+/*
+ * As computeForwardProbability2, additionally copying the cells in the shared prefix, if not NULL, and
+ * storing the cells in the prefix, if not NULL. Prefixes can only be used without anchors.
  */
-double computeForwardProbability(SymbolString sX, SymbolString sY, stList *anchorPairs, PairwiseAlignmentParameters *p,
-                                 StateMachine *sM,
-                                 bool alignmentHasRaggedLeftEnd, bool alignmentHasRaggedRightEnd) {
+static double computeForwardProbability3(SymbolString sX, SymbolString sY, stList *anchorPairs,
+                                         PairwiseAlignmentParameters *p, StateMachine *sM,
+                                         bool alignmentHasRaggedLeftEnd, bool alignmentHasRaggedRightEnd,
+                                         double logProbabilityFloor, ForwardPrefix *sharedPrefix,
+                                         ForwardPrefix *prefix) {
     //Prerequisites
     assert(p->traceBackDiagonals >= 1);
     assert(p->diagonalExpansion >= 0);
     assert(p->diagonalExpansion % 2 == 0);
     assert(p->minDiagsBetweenTraceBack >= 2);
     assert(p->traceBackDiagonals + 1 < p->minDiagsBetweenTraceBack);
+    assert((sharedPrefix == NULL && prefix == NULL) || stList_length(anchorPairs) == 0);
 
     int64_t diagonalNumber = sX.length + sY.length;
     if (diagonalNumber == 0) { //Deal with trivial case
         return LOG_ONE;
     }
 
-    //Primitives for the forward matrix recursion
+    //Primitives for the forward matrix recursion, which only needs the previous two diagonals to be kept
+    bool scaled = p->scaledFloatProbabilities && stateMachine_isThreeState(sM);
+    assert(!scaled || (sharedPrefix == NULL && prefix == NULL));
     Band *band = band_construct(anchorPairs, sX.length, sY.length, p->diagonalExpansion);
     BandIterator *forwardBandIterator = bandIterator_construct(band);
-    DpMatrix *forwardDpMatrix = dpMatrix_construct(diagonalNumber, sM->stateNumber);
-    dpDiagonal_initialiseValues(dpMatrix_createDiagonal(forwardDpMatrix, bandIterator_getNext(forwardBandIterator)), sM,
-                                alignmentHasRaggedLeftEnd ? sM->raggedStartStateProb
-                                                          : sM->startStateProb); //Initialise forward matrix.
+    Diagonal diagonal = bandIterator_getNext(forwardBandIterator);
+    DpDiagonal *dpDiagonalM2 = NULL;
+    DpDiagonal *dpDiagonalM1 = scaled ? dpDiagonal_constructScaled(diagonal, sM->stateNumber)
+                                      : dpDiagonal_construct(diagonal, sM->stateNumber);
+    dpDiagonal_initialiseValues(dpDiagonalM1, sM, alignmentHasRaggedLeftEnd ? sM->raggedStartStateProb
+                                                                            : sM->startStateProb); //Initialise forward matrix.
+    if (prefix != NULL) {
+        forwardPrefix_add(prefix, dpDiagonalM1);
+    }
 
     double totalLogProbability = LOG_ZERO;
 
     while (1) { //Loop that moves through the matrix forward
-        Diagonal diagonal = bandIterator_getNext(forwardBandIterator);
+        diagonal = bandIterator_getNext(forwardBandIterator);
 
         //Forward calculation
-        dpDiagonal_zeroValues(dpMatrix_createDiagonal(forwardDpMatrix, diagonal));
-        diagonalCalculationForward(sM, diagonal_getXay(diagonal), forwardDpMatrix, sX, sY);
+        DpDiagonal *dpDiagonal = scaled ? dpDiagonal_constructScaled(diagonal, sM->stateNumber)
+                                        : dpDiagonal_construct(diagonal, sM->stateNumber);
+        dpDiagonal_zeroValues(dpDiagonal);
+        diagonalCalculationForwardWithPrefix(sM, dpDiagonal, dpDiagonalM1, dpDiagonalM2, sX, sY, sharedPrefix);
+        if (prefix != NULL) {
+            forwardPrefix_add(prefix, dpDiagonal);
+        }
+        if (dpDiagonalM2 != NULL) {
+            dpDiagonal_destruct(dpDiagonalM2);
+        }
+        dpDiagonalM2 = dpDiagonalM1;
+        dpDiagonalM1 = dpDiagonal;
 
-        bool atEnd = diagonal_getXay(diagonal) == diagonalNumber; //Condition true at the end of the matrix
-        if (atEnd) {
-            //Backward matrix.
-            DpMatrix *backwardDpMatrix = dpMatrix_construct(diagonalNumber, sM->stateNumber);
-            dpDiagonal_initialiseValues(dpMatrix_createDiagonal(backwardDpMatrix, diagonal), sM,
+        if (diagonal_getXay(diagonal) == diagonalNumber) { //Condition true at the end of the matrix
+            DpDiagonal *backwardDiagonal = scaled ? dpDiagonal_constructScaled(diagonal, sM->stateNumber)
+                                                  : dpDiagonal_construct(diagonal, sM->stateNumber);
+            dpDiagonal_initialiseValues(backwardDiagonal, sM,
                                         alignmentHasRaggedRightEnd ? sM->raggedEndStateProb : sM->endStateProb);
-            totalLogProbability = diagonalCalculationTotalProbability(sM, diagonalNumber,
-                                                                      forwardDpMatrix, backwardDpMatrix, sX, sY);
-            dpMatrix_deleteDiagonal(backwardDpMatrix, diagonalNumber);
-            dpMatrix_destruct(backwardDpMatrix);
+            totalLogProbability = dpDiagonal_dotProduct(dpDiagonal, backwardDiagonal);
+            dpDiagonal_destruct(backwardDiagonal);
             break;
         }
+
+        //Every path to the end of the matrix passes through one of the last two diagonals, and the rest of the
+        //path has probability at most one, so if the upper bound from these is below the floor give up.
+        if (logProbabilityFloor != LOG_ZERO) {
+            double bound1 = dpDiagonal_getLogTotalUpperBound(dpDiagonalM1);
+            double bound2 = dpDiagonal_getLogTotalUpperBound(dpDiagonalM2);
+            double bound = (bound1 > bound2 ? bound1 : bound2) + log(2.0);
+            if (bound < logProbabilityFloor) {
+                totalLogProbability = bound;
+                break;
+            }
+        }
     }
     //Cleanup
-    for (int64_t i = 0; i <= diagonalNumber; i++) {
-        dpMatrix_deleteDiagonal(forwardDpMatrix, i);
-    }
-    dpMatrix_destruct(forwardDpMatrix);
+    dpDiagonal_destruct(dpDiagonalM1);
+    dpDiagonal_destruct(dpDiagonalM2);
     bandIterator_destruct(forwardBandIterator);
     band_destruct(band);
 
     return totalLogProbability;
 }
 
+double computeForwardProbability2(SymbolString sX, SymbolString sY, stList *anchorPairs,
+                                  PairwiseAlignmentParameters *p, StateMachine *sM,
+                                  bool alignmentHasRaggedLeftEnd, bool alignmentHasRaggedRightEnd,
+                                  double logProbabilityFloor) {
+    return computeForwardProbability3(sX, sY, anchorPairs, p, sM, alignmentHasRaggedLeftEnd,
+                                      alignmentHasRaggedRightEnd, logProbabilityFloor, NULL, NULL);
+}
+
+static int symbolString_cmp(SymbolString s1, SymbolString s2) {
+    for (int64_t i = 0; i < s1.length && i < s2.length; i++) {
+        if (s1.sequence[i] != s2.sequence[i]) {
+            return s1.sequence[i] < s2.sequence[i] ? -1 : 1;
+        }
+    }
+    return s1.length < s2.length ? -1 : (s1.length > s2.length ? 1 : 0);
+}
+
+static int64_t symbolString_getCommonPrefixLength(SymbolString s1, SymbolString s2) {
+    int64_t i = 0;
+    while (i < s1.length && i < s2.length && s1.sequence[i] == s2.sequence[i]) {
+        i++;
+    }
+    return i;
+}
+
+void computeForwardProbabilities(SymbolString *seqXs, int64_t seqXNumber, SymbolString seqY,
+                                 PairwiseAlignmentParameters *p, StateMachine *sM,
+                                 bool alignmentHasRaggedLeftEnd, bool alignmentHasRaggedRightEnd,
+                                 double logProbabilityMargin, double *logProbabilities) {
+    allocProfile_scope(APT_ALIGNER);
+    stList *anchorPairs = stList_construct();
+    double maxLogProbability = LOG_ZERO;
+
+    if (p->scaledFloatProbabilities && stateMachine_isThreeState(sM)) {
+        //The cells of scaled diagonals share a scale across the diagonal, so can not be copied in part
+        for (int64_t i = 0; i < seqXNumber; i++) {
+            logProbabilities[i] = computeForwardProbability2(seqXs[i], seqY, anchorPairs, p, sM,
+                                                             alignmentHasRaggedLeftEnd, alignmentHasRaggedRightEnd,
+                                                             logProbabilityMargin > 0 ? maxLogProbability -
+                                                                                        logProbabilityMargin
+                                                                                      : LOG_ZERO);
+            maxLogProbability = logProbabilities[i] > maxLogProbability ? logProbabilities[i] : maxLogProbability;
+        }
+        stList_destruct(anchorPairs);
+        return;
+    }
+
+    //Sort the sequences, so those with common prefixes are adjacent
+    int64_t order[seqXNumber];
+    int64_t maxDiagonalNumber = 0;
+    for (int64_t i = 0; i < seqXNumber; i++) {
+        int64_t j = i;
+        while (j > 0 && symbolString_cmp(seqXs[order[j - 1]], seqXs[i]) > 0) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+        maxDiagonalNumber = seqXs[i].length + seqY.length + 1 > maxDiagonalNumber ?
+                            seqXs[i].length + seqY.length + 1 : maxDiagonalNumber;
+    }
+
+    //Each sequence stores the cells of the prefix it shares with the next sequence, and uses those
+    //stored by the previous sequence
+    ForwardPrefix prefixes[2];
+    for (int64_t i = 0; i < 2; i++) {
+        prefixes[i].prefixLength = 0;
+        prefixes[i].diagonalNumber = 0;
+        prefixes[i].diagonals = st_calloc(maxDiagonalNumber, sizeof(DpDiagonal *));
+    }
+    for (int64_t i = 0; i < seqXNumber; i++) {
+        ForwardPrefix *sharedPrefix = i > 0 ? &prefixes[(i + 1) % 2] : NULL;
+        ForwardPrefix *prefix = NULL;
+        if (i + 1 < seqXNumber) {
+            prefix = &prefixes[i % 2];
+            forwardPrefix_clear(prefix);
+            prefix->prefixLength = symbolString_getCommonPrefixLength(seqXs[order[i]], seqXs[order[i + 1]]);
+        }
+        double logProbabilityFloor = logProbabilityMargin > 0 ? maxLogProbability - logProbabilityMargin : LOG_ZERO;
+        double logProbability = computeForwardProbability3(seqXs[order[i]], seqY, anchorPairs, p, sM,
+                                                           alignmentHasRaggedLeftEnd, alignmentHasRaggedRightEnd,
+                                                           logProbabilityFloor, sharedPrefix, prefix);
+        logProbabilities[order[i]] = logProbability;
+        maxLogProbability = logProbability > maxLogProbability ? logProbability : maxLogProbability;
+    }
+
+    //Cleanup
+    for (int64_t i = 0; i < 2; i++) {
+        forwardPrefix_clear(&prefixes[i]);
+        free(prefixes[i].diagonals);
+    }
+    stList_destruct(anchorPairs);
+}
+
 ///////////////////////////////////
 ///////////////////////////////////
 //Split large gap functions
@@ -978,6 +2148,29 @@ static void convertAlignedPairs(stList *alignedPairs2, int64_t offsetX, int64_t
     }
 }
 
+/*
+ * Gets the anchor pairs, from the j-th onwards, within the sub-region (x1, y1) to (x2, y2) of the split points,
+ * relative to its start, updating j to the first anchor pair after it.
+ */
+static stList *getSubRegionAnchorPairs(stList *anchorPairs, int64_t *j, int64_t x1, int64_t y1, int64_t x2,
+                                       int64_t y2) {
+    stList *subListOfAnchorPoints = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
+    while (*j < stList_length(anchorPairs)) {
+        stIntTuple *anchorPair = stList_get(anchorPairs, *j);
+        int64_t x = stIntTuple_get(anchorPair, 0);
+        int64_t y = stIntTuple_get(anchorPair, 1);
+        assert(x + y >= x1 + y1);
+        if (x + y >= x2 + y2) {
+            break;
+        }
+        assert(x >= x1 && x < x2);
+        assert(y >= y1 && y < y2);
+        stList_append(subListOfAnchorPoints, stIntTuple_construct3(x - x1, y - y1, stIntTuple_get(anchorPair, 2)));
+        (*j)++;
+    }
+    return subListOfAnchorPoints;
+}
+
 void getPosteriorProbsWithBandingSplittingAlignmentsByLargeGaps(StateMachine *sM, stList *anchorPairs, SymbolString sX,
                                                                 SymbolString sY,
                                                                 PairwiseAlignmentParameters *p,
@@ -991,6 +2184,7 @@ void getPosteriorProbsWithBandingSplittingAlignmentsByLargeGaps(StateMachine *sM
                                                                                                 PairwiseAlignmentParameters *,
                                                                                                 void *),
                                                                 void (*coordinateCorrectionFn)(), void *extraArgs) {
+    allocProfile_scope(APT_ALIGNER);
     stList *splitPoints = getSplitPoints(anchorPairs, sX.length, sY.length, p->splitMatrixBiggerThanThis,
                                          alignmentHasRaggedLeftEnd, alignmentHasRaggedRightEnd);
     int64_t j = 0;
@@ -1002,25 +2196,12 @@ void getPosteriorProbsWithBandingSplittingAlignmentsByLargeGaps(StateMachine *sM
         int64_t x2 = stIntTuple_get(subRegion, 2);
         int64_t y2 = stIntTuple_get(subRegion, 3);
 
-        //Sub sequences
-        SymbolString sX3 = symbolString_getSubString(sX, x1, x2 - x1);
-        SymbolString sY3 = symbolString_getSubString(sY, y1, y2 - y1);
+        //Sub sequences, as views of the sequences
+        SymbolString sX3 = symbolString_getView(sX, x1, x2 - x1);
+        SymbolString sY3 = symbolString_getView(sY, y1, y2 - y1);
 
         //List of anchor pairs
-        stList *subListOfAnchorPoints = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
-        while (j < stList_length(anchorPairs)) {
-            stIntTuple *anchorPair = stList_get(anchorPairs, j);
-            int64_t x = stIntTuple_get(anchorPair, 0);
-            int64_t y = stIntTuple_get(anchorPair, 1);
-            assert(x + y >= x1 + y1);
-            if (x + y >= x2 + y2) {
-                break;
-            }
-            assert(x >= x1 && x < x2);
-            assert(y >= y1 && y < y2);
-            stList_append(subListOfAnchorPoints, stIntTuple_construct3(x - x1, y - y1, stIntTuple_get(anchorPair, 2)));
-            j++;
-        }
+        stList *subListOfAnchorPoints = getSubRegionAnchorPairs(anchorPairs, &j, x1, y1, x2, y2);
 
         //Make the alignments
         getPosteriorProbsWithBanding(sM, subListOfAnchorPoints, sX3, sY3, p, (alignmentHasRaggedLeftEnd || i > 0),
@@ -1032,8 +2213,6 @@ void getPosteriorProbsWithBandingSplittingAlignmentsByLargeGaps(StateMachine *sM
 
         //Clean up
         stList_destruct(subListOfAnchorPoints);
-        symbolString_destruct(sX3);
-        symbolString_destruct(sY3);
     }
     assert(j == stList_length(anchorPairs));
     stList_destruct(splitPoints);
@@ -1056,6 +2235,9 @@ PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters_construct() {
     p->alignAmbiguityCharacters = 0;
     p->gapGamma = 0.5;
     p->dynamicAnchorExpansion = 0;
+    p->scaledFloatProbabilities = 0;
+    p->splitAlignmentParallelismThreshold = 0;
+    p->xDrop = 0.0;
     return p;
 }
 
@@ -1091,6 +2273,18 @@ void *pairwiseAlignmentParameters_jsonParse(PairwiseAlignmentParameters *params,
             params->gapGamma = stJson_parseFloat(js, tokens, ++tokenIndex);
         } else if (strcmp(keyString, "dynamicAnchorExpansion") == 0) {
             params->dynamicAnchorExpansion = stJson_parseBool(js, tokens, ++tokenIndex);
+        } else if (strcmp(keyString, "scaledFloatProbabilities") == 0) {
+            params->scaledFloatProbabilities = stJson_parseBool(js, tokens, ++tokenIndex);
+        } else if (strcmp(keyString, "splitAlignmentParallelismThreshold") == 0) {
+            params->splitAlignmentParallelismThreshold = stJson_parseInt(js, tokens, ++tokenIndex);
+            if (params->splitAlignmentParallelismThreshold < 0) {
+                st_errAbort("ERROR: splitAlignmentParallelismThreshold parameter must zero or greater\n");
+            }
+        } else if (strcmp(keyString, "xDrop") == 0) {
+            params->xDrop = stJson_parseFloat(js, tokens, ++tokenIndex);
+            if (params->xDrop < 0) {
+                st_errAbort("ERROR: xDrop parameter must zero or greater\n");
+            }
         } else {
             st_errAbort("ERROR: Unrecognised key in pairwise alignment parameters json: %s\n", keyString);
         }
@@ -1112,13 +2306,12 @@ static void alignedPairCoordinateCorrectionFn(int64_t offsetX, int64_t offsetY,
 }
 
 static void pairCoordinateCorrectionFn(int64_t offsetX, int64_t offsetY, void *extraArgs) {
-    for (int64_t i = 0; i < 6; i += 2) {
-        stList *subListOfPairs = ((void **) extraArgs)[i];
-        stList *pairs = ((void **) extraArgs)[i + 1];
-        convertAlignedPairs(subListOfPairs, offsetX, offsetY); //Shift back the  pairs to the appropriate coordinates
-        while (stList_length(subListOfPairs) > 0) {
-            stList_append(pairs, stList_pop(subListOfPairs));
-        }
+    int64_t *starts = ((void **) extraArgs)[3];
+    for (int64_t i = 0; i < 3; i++) {
+        AlignedPairs *pairs = ((void **) extraArgs)[i];
+        //Shift back the pairs of the sub-alignment to the appropriate coordinates
+        alignedPairs_shiftAndReverse(pairs, starts[i], offsetX, offsetY);
+        starts[i] = pairs->length;
     }
 }
 
@@ -1141,33 +2334,135 @@ stList *getAlignedPairsUsingAnchors(StateMachine *sM, SymbolString sX, SymbolStr
     return alignedPairs;
 }
 
-void getAlignedPairsWithIndelsUsingAnchors(StateMachine *sM, SymbolString sX, SymbolString sY, stList *anchorPairs,
-                                           PairwiseAlignmentParameters *p, stList **alignedPairs, stList **gapXPairs,
-                                           stList **gapYPairs,
-                                           bool alignmentHasRaggedLeftEnd, bool alignmentHasRaggedRightEnd) {
-    stList *subListOfAlignedPairs = stList_construct();
-    *alignedPairs = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
+/*
+ * As getPosteriorProbsWithBandingSplittingAlignmentsByLargeGaps for the pairs and indels, solving the sub-matrices
+ * as concurrent tasks, each into its own buffers, which are then appended to the given buffers in sub-matrix order,
+ * so the pairs are the same as if they had been solved one after another.
+ */
+static void getAlignedPairsWithIndelsSplittingAlignmentsInParallel(StateMachine *sM, stList *splitPoints,
+                                                                   stList *anchorPairs, SymbolString sX,
+                                                                   SymbolString sY, PairwiseAlignmentParameters *p,
+                                                                   AlignedPairs *alignedPairs,
+                                                                   AlignedPairs *gapXPairs, AlignedPairs *gapYPairs,
+                                                                   bool alignmentHasRaggedLeftEnd,
+                                                                   bool alignmentHasRaggedRightEnd) {
+    int64_t subRegionNo = stList_length(splitPoints);
+    stList *subListsOfAnchorPoints[subRegionNo];
+    AlignedPairs *subPairs[subRegionNo][3];
+    int64_t j = 0;
+    for (int64_t i = 0; i < subRegionNo; i++) {
+        stIntTuple *subRegion = stList_get(splitPoints, i);
+        subListsOfAnchorPoints[i] = getSubRegionAnchorPairs(anchorPairs, &j, stIntTuple_get(subRegion, 0),
+                                                            stIntTuple_get(subRegion, 1), stIntTuple_get(subRegion, 2),
+                                                            stIntTuple_get(subRegion, 3));
+        for (int64_t k = 0; k < 3; k++) {
+            subPairs[i][k] = alignedPairs_construct();
+        }
+    }
+    assert(j == stList_length(anchorPairs));
 
-    stList *subListOfGapXPairs = stList_construct();
-    *gapXPairs = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
+    for (int64_t i = 0; i < subRegionNo; i++) {
+        # ifdef _OPENMP
+        #pragma omp task firstprivate(i) shared(subListsOfAnchorPoints, subPairs)
+        # endif
+        {
+            stIntTuple *subRegion = stList_get(splitPoints, i);
+            int64_t x1 = stIntTuple_get(subRegion, 0);
+            int64_t y1 = stIntTuple_get(subRegion, 1);
+            int64_t x2 = stIntTuple_get(subRegion, 2);
+            int64_t y2 = stIntTuple_get(subRegion, 3);
+            SymbolString sX3 = symbolString_getView(sX, x1, x2 - x1);
+            SymbolString sY3 = symbolString_getView(sY, y1, y2 - y1);
+            int64_t starts[3] = {0, 0, 0};
+            void *extraArgs[4] = {subPairs[i][0], subPairs[i][1], subPairs[i][2], starts};
+            getPosteriorProbsWithBanding(sM, subListsOfAnchorPoints[i], sX3, sY3, p,
+                                         (alignmentHasRaggedLeftEnd || i > 0),
+                                         (alignmentHasRaggedRightEnd || i < subRegionNo - 1),
+                                         diagonalCalculationPosteriorProbs, extraArgs);
+            pairCoordinateCorrectionFn(x1, y1, extraArgs);
+        }
+    }
+    # ifdef _OPENMP
+    #pragma omp taskwait
+    # endif
+
+    // Concatenate the pairs in sub-matrix, and so coordinate, order
+    AlignedPairs *pairs[3] = {alignedPairs, gapXPairs, gapYPairs};
+    for (int64_t i = 0; i < subRegionNo; i++) {
+        for (int64_t k = 0; k < 3; k++) {
+            AlignedPairs *toAppend = subPairs[i][k];
+            for (int64_t l = 0; l < toAppend->length; l++) {
+                alignedPairs_add(pairs[k], toAppend->weight[l], toAppend->x[l], toAppend->y[l]);
+            }
+            alignedPairs_destruct(toAppend);
+        }
+        stList_destruct(subListsOfAnchorPoints[i]);
+    }
+}
 
-    stList *subListOfGapYPairs = stList_construct();
-    *gapYPairs = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
+void getAlignedPairsWithIndelsUsingAnchorsPacked(StateMachine *sM, SymbolString sX, SymbolString sY,
+                                                 stList *anchorPairs, PairwiseAlignmentParameters *p,
+                                                 AlignedPairs *alignedPairs, AlignedPairs *gapXPairs,
+                                                 AlignedPairs *gapYPairs,
+                                                 bool alignmentHasRaggedLeftEnd, bool alignmentHasRaggedRightEnd) {
+    // Optionally solve the sub-matrices of a big alignment concurrently
+    if (p->splitAlignmentParallelismThreshold > 0 && sX.length * sY.length > p->splitAlignmentParallelismThreshold) {
+        stList *splitPoints = getSplitPoints(anchorPairs, sX.length, sY.length, p->splitMatrixBiggerThanThis,
+                                             alignmentHasRaggedLeftEnd, alignmentHasRaggedRightEnd);
+        if (stList_length(splitPoints) > 1) {
+#if defined(_OPENMP)
+            if (!omp_in_parallel()) {
+                // Open a parallel region for the tasks to run in, otherwise they are shared with the threads of the
+                // enclosing region as they become free
+#pragma omp parallel
+#pragma omp single
+                getAlignedPairsWithIndelsSplittingAlignmentsInParallel(sM, splitPoints, anchorPairs, sX, sY, p,
+                                                                       alignedPairs, gapXPairs, gapYPairs,
+                                                                       alignmentHasRaggedLeftEnd,
+                                                                       alignmentHasRaggedRightEnd);
+            } else {
+                getAlignedPairsWithIndelsSplittingAlignmentsInParallel(sM, splitPoints, anchorPairs, sX, sY, p,
+                                                                       alignedPairs, gapXPairs, gapYPairs,
+                                                                       alignmentHasRaggedLeftEnd,
+                                                                       alignmentHasRaggedRightEnd);
+            }
+#else
+            getAlignedPairsWithIndelsSplittingAlignmentsInParallel(sM, splitPoints, anchorPairs, sX, sY, p,
+                                                                   alignedPairs, gapXPairs, gapYPairs,
+                                                                   alignmentHasRaggedLeftEnd,
+                                                                   alignmentHasRaggedRightEnd);
+#endif
+            stList_destruct(splitPoints);
+            return;
+        }
+        stList_destruct(splitPoints);
+    }
 
-    void *extraArgs[6] = {subListOfAlignedPairs, *alignedPairs,
-                          subListOfGapXPairs, *gapXPairs, subListOfGapYPairs, *gapYPairs};
+    int64_t starts[3] = {alignedPairs->length, gapXPairs->length, gapYPairs->length};
+    void *extraArgs[4] = {alignedPairs, gapXPairs, gapYPairs, starts};
 
     getPosteriorProbsWithBandingSplittingAlignmentsByLargeGaps(sM, anchorPairs, sX, sY, p,
                                                                alignmentHasRaggedLeftEnd, alignmentHasRaggedRightEnd,
                                                                diagonalCalculationPosteriorProbs,
                                                                pairCoordinateCorrectionFn, extraArgs);
+}
 
-    assert(stList_length(subListOfAlignedPairs) == 0);
-    stList_destruct(subListOfAlignedPairs);
-    assert(stList_length(subListOfGapXPairs) == 0);
-    stList_destruct(subListOfGapXPairs);
-    assert(stList_length(subListOfGapYPairs) == 0);
-    stList_destruct(subListOfGapYPairs);
+void getAlignedPairsWithIndelsUsingAnchors(StateMachine *sM, SymbolString sX, SymbolString sY, stList *anchorPairs,
+                                           PairwiseAlignmentParameters *p, stList **alignedPairs, stList **gapXPairs,
+                                           stList **gapYPairs,
+                                           bool alignmentHasRaggedLeftEnd, bool alignmentHasRaggedRightEnd) {
+    AlignedPairs *packedAlignedPairs = alignedPairs_construct();
+    AlignedPairs *packedGapXPairs = alignedPairs_construct();
+    AlignedPairs *packedGapYPairs = alignedPairs_construct();
+    getAlignedPairsWithIndelsUsingAnchorsPacked(sM, sX, sY, anchorPairs, p,
+                                                packedAlignedPairs, packedGapXPairs, packedGapYPairs,
+                                                alignmentHasRaggedLeftEnd, alignmentHasRaggedRightEnd);
+    *alignedPairs = alignedPairs_toList(packedAlignedPairs);
+    *gapXPairs = alignedPairs_toList(packedGapXPairs);
+    *gapYPairs = alignedPairs_toList(packedGapYPairs);
+    alignedPairs_destruct(packedAlignedPairs);
+    alignedPairs_destruct(packedGapXPairs);
+    alignedPairs_destruct(packedGapYPairs);
 }
 
 stList *getAlignedPairs(StateMachine *sM, SymbolString sX, SymbolString sY, PairwiseAlignmentParameters *p,
@@ -1230,6 +2525,23 @@ int64_t *getIndelProbabilities(stList *alignedPairs, int64_t seqLength, bool xIf
     return indelProbs;
 }
 
+int64_t *getIndelProbabilitiesPacked(AlignedPairs *alignedPairs, int64_t seqLength, bool xIfTrueElseY) {
+    int64_t *indelProbs = st_malloc(seqLength * sizeof(int64_t));
+    for (int64_t i = 0; i < seqLength; i++) {
+        indelProbs[i] = PAIR_ALIGNMENT_PROB_1;
+    }
+    int64_t *coordinates = xIfTrueElseY ? alignedPairs->x : alignedPairs->y;
+    for (int64_t i = 0; i < alignedPairs->length; i++) {
+        indelProbs[coordinates[i]] -= alignedPairs->weight[i];
+    }
+    for (int64_t i = 0; i < seqLength; i++) {
+        if (indelProbs[i] < 0) {
+            indelProbs[i] = 0;
+        }
+    }
+    return indelProbs;
+}
+
 stList *reweightAlignedPairs(stList *alignedPairs,
                              int64_t *indelProbsX, int64_t *indelProbsY, double gapGamma) {
     stList *reweightedAlignedPairs = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
@@ -1244,6 +2556,14 @@ stList *reweightAlignedPairs(stList *alignedPairs,
     return reweightedAlignedPairs;
 }
 
+void reweightAlignedPairsPacked(AlignedPairs *alignedPairs, int64_t *indelProbsX, int64_t *indelProbsY,
+                                double gapGamma) {
+    for (int64_t i = 0; i < alignedPairs->length; i++) {
+        alignedPairs->weight[i] = alignedPairs->weight[i] -
+                                  gapGamma * (indelProbsX[alignedPairs->x[i]] + indelProbsY[alignedPairs->y[i]]);
+    }
+}
+
 stList *reweightAlignedPairs2(stList *alignedPairs, int64_t seqLengthX, int64_t seqLengthY, double gapGamma) {
     if (gapGamma <= 0.0) {
         return alignedPairs;
@@ -1297,15 +2617,15 @@ double scoreByPosteriorProbabilityIgnoringGaps(stList *alignedPairs) {
  * Functions for pairwise alignment creation.
  */
 
-static int64_t *getCumulativeGapProbs(stList *gapPairs, int64_t seqLength, bool seqXNotSeqY) {
+static int64_t *getCumulativeGapProbs(AlignedPairs *gapPairs, int64_t seqLength, bool seqXNotSeqY) {
     int64_t *gapCumulativeProbs = st_calloc(seqLength, sizeof(int64_t));
 
     // Work out the per-position gap probability
-    for (int64_t i = 0; i < stList_length(gapPairs); i++) {
-        stIntTuple *gapPair = stList_get(gapPairs, i);
-        assert(stIntTuple_get(gapPair, seqXNotSeqY ? 1 : 2) >= 0);
-        assert(stIntTuple_get(gapPair, seqXNotSeqY ? 1 : 2) < seqLength);
-        gapCumulativeProbs[stIntTuple_get(gapPair, seqXNotSeqY ? 1 : 2)] += stIntTuple_get(gapPair, 0);
+    int64_t *coordinates = seqXNotSeqY ? gapPairs->x : gapPairs->y;
+    for (int64_t i = 0; i < gapPairs->length; i++) {
+        assert(coordinates[i] >= 0);
+        assert(coordinates[i] < seqLength);
+        gapCumulativeProbs[coordinates[i]] += gapPairs->weight[i];
     }
 
     // Make cumulative
@@ -1322,28 +2642,71 @@ static int64_t getIndelProb(int64_t *gapCumulativeProbs, int64_t start, int64_t
     return length == 0 ? 0 : (gapCumulativeProbs[start + length - 1] - (start > 0 ? gapCumulativeProbs[start - 1] : 0));
 }
 
-stList *getMaximalExpectedAccuracyPairwiseAlignment(stList *alignedPairs,
-                                                    stList *gapXPairs, stList *gapYPairs,
-                                                    int64_t seqXLength, int64_t seqYLength, double *alignmentScore,
-                                                    PairwiseAlignmentParameters *p) {
+/*
+ * Stable counting sort of the pairs by one coordinate, in [0, seqLength), the other arrays permuted to match.
+ */
+static void alignedPairs_countingSort(AlignedPairs *pairs, int64_t seqLength, bool byX, int64_t *buffer) {
+    int64_t *counts = st_calloc(seqLength + 1, sizeof(int64_t));
+    int64_t *key = byX ? pairs->x : pairs->y;
+    for (int64_t i = 0; i < pairs->length; i++) {
+        assert(key[i] >= 0 && key[i] < seqLength);
+        counts[key[i] + 1]++;
+    }
+    for (int64_t i = 1; i <= seqLength; i++) {
+        counts[i] += counts[i - 1];
+    }
+    int64_t *order = buffer, *permuted = &(buffer[pairs->length]);
+    for (int64_t i = 0; i < pairs->length; i++) {
+        order[counts[key[i]]++] = i;
+    }
+    int64_t *arrays[3] = { pairs->weight, pairs->x, pairs->y };
+    for (int64_t j = 0; j < 3; j++) {
+        for (int64_t i = 0; i < pairs->length; i++) {
+            permuted[i] = arrays[j][order[i]];
+        }
+        memcpy(arrays[j], permuted, sizeof(int64_t) * pairs->length);
+    }
+    free(counts);
+}
+
+stList *getMaximalExpectedAccuracyPairwiseAlignmentPacked(AlignedPairs *alignedPairs,
+                                                          AlignedPairs *gapXPairs, AlignedPairs *gapYPairs,
+                                                          int64_t seqXLength, int64_t seqYLength,
+                                                          double *alignmentScore, PairwiseAlignmentParameters *p) {
 
-    int64_t totalPairs = stList_length(alignedPairs); // Total number of aligned pairs
-    stList_sort(alignedPairs, cmpAlignedPairsByCoordinates);
+    int64_t totalPairs = alignedPairs->length; // Total number of aligned pairs
+
+    // Sort the pairs by x then y coordinate in linear time, by y and then stably by x
+    int64_t *sortBuffer = st_malloc(sizeof(int64_t) * (2 * totalPairs + 1));
+    alignedPairs_countingSort(alignedPairs, seqYLength, FALSE, sortBuffer);
+    alignedPairs_countingSort(alignedPairs, seqXLength, TRUE, sortBuffer);
+    free(sortBuffer);
 
     double *scores = st_calloc(totalPairs + 1, sizeof(double)); // MEA alignment score for each aligned pair
     int64_t *backPointers = st_calloc(totalPairs + 1, sizeof(int64_t)); // Trace back pointers
-    bool *isHighScore = st_calloc(totalPairs + 1,
-                                  sizeof(bool)); // Records if the score for a given aligned pair at index i is larger than any
-    // score for an aligned pair at any index less than i
 
     // Calculate gap array cumulative probs
     int64_t *gapYCumulativeProbs = getCumulativeGapProbs(gapYPairs, seqYLength, FALSE);
     int64_t *gapXCumulativeProbs = getCumulativeGapProbs(gapXPairs, seqXLength, TRUE);
 
-    // Iterate through the aligned pairs in order of increasing sequence coordinate
+    /*
+     * The best alignment ending at a pair (x, y) extends that ending at a pair (x2, y2), with x2 < x and y2 < y,
+     * maximising score(x2, y2) + gapGamma * (gapX(x2 + 1 .. x - 1) + gapY(y2 + 1 .. y - 1)). With cumulative gap
+     * probs this splits into a term of (x, y) and the key score(x2, y2) - gapGamma * (gapX(0 .. x2) + gapY(0 .. y2)),
+     * so the predecessor is the pair with the maximum key over the pairs strictly below and left of (x, y). The pairs
+     * are swept in x order, adding the keys of each column only once it is done, to a Fenwick tree over y that gives
+     * the maximum key and its pair for each prefix of y coordinates.
+     */
+    double *treeKeys = st_malloc(sizeof(double) * (seqYLength + 2));
+    int64_t *treePairs = st_malloc(sizeof(int64_t) * (seqYLength + 2));
+    for (int64_t k = 0; k <= seqYLength + 1; k++) {
+        treePairs[k] = -1; // -1 indicates no pair
+    }
 
     double maxScore = 0; // Max score seen so far
+    int64_t columnStart = 0; // The first pair in the current column, whose keys are yet to be added to the tree
 
+    // Iterate through the aligned pairs in order of increasing sequence coordinate
     for (int64_t i = 0; i < totalPairs + 1; i++) {
 
         int64_t matchProb, x, y;
@@ -1353,10 +2716,23 @@ stList *getMaximalExpectedAccuracyPairwiseAlignment(stList *alignedPairs,
             x = seqXLength;
             y = seqYLength;
         } else {
-            stIntTuple *aPair = stList_get(alignedPairs, i);
-            matchProb = stIntTuple_get(aPair, 0);
-            x = stIntTuple_get(aPair, 1);
-            y = stIntTuple_get(aPair, 2);
+            matchProb = alignedPairs->weight[i];
+            x = alignedPairs->x[i];
+            y = alignedPairs->y[i];
+        }
+
+        // Add the keys of the pairs in previous columns
+        for (; columnStart < i && alignedPairs->x[columnStart] < x; columnStart++) {
+            int64_t x2 = alignedPairs->x[columnStart], y2 = alignedPairs->y[columnStart];
+            double key = scores[columnStart] - (getIndelProb(gapXCumulativeProbs, 0, x2 + 1) +
+                                                getIndelProb(gapYCumulativeProbs, 0, y2 + 1)) * p->gapGamma;
+            for (int64_t k = y2 + 1; k <= seqYLength + 1; k += k & -k) {
+                // Of equal keys keep the latest pair, as the backward scan finds it first
+                if (treePairs[k] == -1 || key >= treeKeys[k]) {
+                    treeKeys[k] = key;
+                    treePairs[k] = columnStart;
+                }
+            }
         }
 
         // The MEA alignment score of the pair with no preceding alignment pair
@@ -1365,30 +2741,23 @@ stList *getMaximalExpectedAccuracyPairwiseAlignment(stList *alignedPairs,
                        p->gapGamma;
         int64_t backPointer = -1;
 
-        // Walk back through previous aligned pairs
-        for (int64_t j = i - 1; j >= 0; j--) {
-            stIntTuple *pPair = stList_get(alignedPairs, j);
-            int64_t x2 = stIntTuple_get(pPair, 1), y2 = stIntTuple_get(pPair, 2);
-
-            // If the previous pair, pPair, and aPair can form an alignment
-            if (x2 < x && y2 < y) {
-
-                // Calc score of MEA alignment including pPair
-                int64_t s = matchProb + scores[j] +
-                            (getIndelProb(gapXCumulativeProbs, x2 + 1, x - x2 - 1) +
-                             getIndelProb(gapYCumulativeProbs, y2 + 1, y - y2 - 1)) * p->gapGamma;
-
-                // If score s is highest keep it
-                if (s > score) {
-                    score = s;
-                    backPointer = j;
-                }
-
-                // If the score of pPair is a high score then can not increase score by exploring further back
-                // pointers
-                if (isHighScore[j]) {
-                    break;
-                }
+        // The best preceding pair, with a y coordinate less than y
+        int64_t bestPair = -1;
+        double bestKey = 0;
+        for (int64_t k = y; k > 0; k -= k & -k) {
+            if (treePairs[k] != -1 && (bestPair == -1 || treeKeys[k] > bestKey ||
+                                       (treeKeys[k] == bestKey && treePairs[k] > bestPair))) {
+                bestKey = treeKeys[k];
+                bestPair = treePairs[k];
+            }
+        }
+        if (bestPair != -1) {
+            double s = matchProb + bestKey +
+                       (getIndelProb(gapXCumulativeProbs, 0, x) + getIndelProb(gapYCumulativeProbs, 0, y)) *
+                       p->gapGamma;
+            if (s > score) { // If score s is highest keep it
+                score = s;
+                backPointer = bestPair;
             }
         }
 
@@ -1400,10 +2769,8 @@ stList *getMaximalExpectedAccuracyPairwiseAlignment(stList *alignedPairs,
         double s = score + ((x < seqXLength ? getIndelProb(gapXCumulativeProbs, x + 1, seqXLength - x - 1) : 0) +
                             (y < seqYLength ? getIndelProb(gapYCumulativeProbs, y + 1, seqYLength - y - 1) : 0)) *
                            p->gapGamma;
-        //fprintf(stderr, "scores %"PRId64"x, %"PRId64"y, %"PRId64"s, %"PRId64"S\n", x, y, score, maxScore);
         if (s >= maxScore) {
             maxScore = s; // Record the max score
-            isHighScore[i] = 1; // Record the fact that the score represents a max seen so far.
         }
     }
 
@@ -1411,17 +2778,17 @@ stList *getMaximalExpectedAccuracyPairwiseAlignment(stList *alignedPairs,
     stList *filteredAlignment = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
     int64_t i = backPointers[totalPairs];
     while (i >= 0) {
-        stIntTuple *aPair = stList_get(alignedPairs, i);
-        stList_append(filteredAlignment, stIntTuple_construct3(stIntTuple_get(aPair, 0),
-                                                               stIntTuple_get(aPair, 1), stIntTuple_get(aPair, 2)));
+        stList_append(filteredAlignment, stIntTuple_construct3(alignedPairs->weight[i], alignedPairs->x[i],
+                                                               alignedPairs->y[i]));
         i = backPointers[i];
-            }
+    }
     stList_reverse(filteredAlignment); // Flip the order
 
     // Cleanup
     free(scores);
     free(backPointers);
-    free(isHighScore);
+    free(treeKeys);
+    free(treePairs);
     free(gapXCumulativeProbs);
     free(gapYCumulativeProbs);
 
@@ -1429,6 +2796,23 @@ stList *getMaximalExpectedAccuracyPairwiseAlignment(stList *alignedPairs,
     return filteredAlignment;
 }
 
+stList *getMaximalExpectedAccuracyPairwiseAlignment(stList *alignedPairs,
+                                                    stList *gapXPairs, stList *gapYPairs,
+                                                    int64_t seqXLength, int64_t seqYLength, double *alignmentScore,
+                                                    PairwiseAlignmentParameters *p) {
+    AlignedPairs *packedAlignedPairs = alignedPairs_constructFromList(alignedPairs);
+    AlignedPairs *packedGapXPairs = alignedPairs_constructFromList(gapXPairs);
+    AlignedPairs *packedGapYPairs = alignedPairs_constructFromList(gapYPairs);
+    stList *filteredAlignment = getMaximalExpectedAccuracyPairwiseAlignmentPacked(packedAlignedPairs,
+                                                                                  packedGapXPairs, packedGapYPairs,
+                                                                                  seqXLength, seqYLength,
+                                                                                  alignmentScore, p);
+    alignedPairs_destruct(packedAlignedPairs);
+    alignedPairs_destruct(packedGapXPairs);
+    alignedPairs_destruct(packedGapYPairs);
+    return filteredAlignment;
+}
+
 stList *leftShiftAlignment(stList *alignedPairs, SymbolString seqX, SymbolString seqY) {
 
     stList *leftShiftedAlignedPairs = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
@@ -1521,92 +2905,201 @@ void setPairwiseAlignerKmerSize(int64_t kmerSize) {
     KMER_SIZE = kmerSize;
 }
 
-uint64_t kmerKey(const void *k) {
-    uint64_t hash = 0; //5381;
-    Symbol *cA = (Symbol *) k;
-    for (int64_t i = 0; i < KMER_SIZE; i++) {
-        hash = cA[i] + (hash << 6) + (hash << 16) - hash;
+static int64_t KMER_MINIMIZER_WINDOW = 5; // Seeds are the minimum hash k-mers of each window of this many k-mers
+static int64_t KMER_MAX_OCCURRENCES = 4; // Each seed of seqY is paired with at most the first this many seqX copies
+void setPairwiseAlignerKmerSeeding(int64_t minimizerWindow, int64_t maxKmerOccurrences) {
+    KMER_MINIMIZER_WINDOW = minimizerWindow;
+    KMER_MAX_OCCURRENCES = maxKmerOccurrences;
+}
+
+typedef struct _kmerSeed {
+    uint64_t hash, position;
+} KmerSeed;
+
+static int kmerSeed_cmp(const void *a, const void *b) {
+    KmerSeed *s1 = (KmerSeed *) a, *s2 = (KmerSeed *) b;
+    if (s1->hash != s2->hash) {
+        return s1->hash < s2->hash ? -1 : 1;
     }
-    return hash;
+    return s1->position < s2->position ? -1 : (s1->position > s2->position ? 1 : 0);
 }
 
-int kmerEqualKey(const void *key1, const void *key2) {
-    Symbol *cA = (Symbol *) key1, *cA2 = (Symbol *) key2;
-    for (int64_t i = 0; i < KMER_SIZE; i++) {
-        if (cA[i] != cA2[i]) {
-            return 0;
+static uint64_t mixKmerHash(uint64_t h) {
+    // An invertible mix, so the minimizers are pseudo-random rather than the lexicographically smallest k-mers
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+/*
+ * Gets the minimizers of seq, the lowest hash k-mer (the leftmost of equals) of each window of KMER_MINIMIZER_WINDOW
+ * consecutive k-mers, in ascending position order. The same k-mer always has the same hash, but distinct k-mers can
+ * too, so matches must be checked against the sequences.
+ */
+static KmerSeed *getMinimizers(SymbolString seq, int64_t *seedNo) {
+    int64_t kmerNo = seq.length - KMER_SIZE + 1;
+    uint64_t *hashes = st_malloc(sizeof(uint64_t) * kmerNo);
+    uint64_t base = 1000003, leadingPower = 1, h = 0;
+    for (int64_t i = 0; i < KMER_SIZE - 1; i++) {
+        leadingPower *= base;
+    }
+    for (int64_t i = 0; i < seq.length; i++) {
+        if (i >= KMER_SIZE) { // Remove the symbol leaving the k-mer
+            h -= (seq.sequence[i - KMER_SIZE] + 1) * leadingPower;
+        }
+        h = h * base + seq.sequence[i] + 1;
+        if (i >= KMER_SIZE - 1) {
+            hashes[i - KMER_SIZE + 1] = mixKmerHash(h);
         }
     }
-    return 1;
+
+    int64_t window = KMER_MINIMIZER_WINDOW < 1 ? 1 : (KMER_MINIMIZER_WINDOW > kmerNo ? kmerNo : KMER_MINIMIZER_WINDOW);
+    KmerSeed *seeds = st_malloc(sizeof(KmerSeed) * kmerNo);
+    *seedNo = 0;
+    int64_t minPosition = -1;
+    for (int64_t end = window - 1; end < kmerNo; end++) { // The window is of the k-mers end - window + 1 to end
+        int64_t start = end - window + 1;
+        if (minPosition < start) { // The last minimum has left the window, so rescan it
+            minPosition = start;
+            for (int64_t i = start + 1; i <= end; i++) {
+                if (hashes[i] < hashes[minPosition]) {
+                    minPosition = i;
+                }
+            }
+        } else if (hashes[end] < hashes[minPosition]) {
+            minPosition = end;
+        }
+        if (*seedNo == 0 || seeds[*seedNo - 1].position != minPosition) {
+            seeds[*seedNo].hash = hashes[minPosition];
+            seeds[(*seedNo)++].position = minPosition;
+        }
+    }
+    free(hashes);
+    return seeds;
 }
 
-stHash *getKmers(SymbolString seq, uint64_t *l) {
-    stHash *kmerOccurrences = stHash_construct3(kmerKey, kmerEqualKey, NULL, NULL);
-    for (uint64_t i = 0; i < seq.length - KMER_SIZE + 1; i++) {
-        l[i] = i;
-        // first hit counts
-        if (stHash_search(kmerOccurrences, &(seq.sequence[i])) == NULL) {
-            stHash_insert(kmerOccurrences, &(seq.sequence[i]),
-                          &(l[i])); // For speed and simplicity this only allows for one entry per k-mer
-            // for KMER_SIZE >= 20, this should not be a big deal as collisions should be rare
+static bool kmersEqual(Symbol *k1, Symbol *k2) {
+    for (int64_t i = 0; i < KMER_SIZE; i++) {
+        if (k1[i] != k2[i]) {
+            return 0;
         }
     }
-    return kmerOccurrences;
+    return 1;
 }
 
 typedef struct _chainPair {
     uint64_t x, y, score;
     int64_t backpointer;
-    bool highScore;
 } ChainPair;
 
+static int uint64_cmp(const void *a, const void *b) {
+    uint64_t i = *(uint64_t *) a, j = *(uint64_t *) b;
+    return i < j ? -1 : (i > j ? 1 : 0);
+}
+
+/*
+ * Is chain pair i a better chain to extend than chain pair j (either may be -1, for none).
+ */
+static bool chainPair_better(ChainPair *cPs, int64_t i, int64_t j) {
+    return i != -1 && (j == -1 || cPs[i].score > cPs[j].score || (cPs[i].score == cPs[j].score && i > j));
+}
+
 stList *getKmerAlignmentAnchors(SymbolString seqX, SymbolString seqY, uint64_t anchorExpansion) {
     if (KMER_SIZE > seqX.length || KMER_SIZE > seqY.length) { // Won't work if KMER_SIZE larger than sequences lengths
         return stList_construct();
     }
 
-    // Get the kmers in seqX
-    uint64_t l[seqX.length - KMER_SIZE + 1];
-    stHash *kmerOccurrences = getKmers(seqX, l);
-
-    // Get the kmers shared in both seqX and seqY
-    ChainPair cPs[seqY.length - KMER_SIZE + 1]; // Array of chain pairs, representing shared k-mers
-    uint64_t i = 0, maxScore = 0;
+    // Get the minimizers of seqX, sorted by hash to look up those of seqY
+    int64_t seedNoX, seedNoY;
+    KmerSeed *seedsX = getMinimizers(seqX, &seedNoX);
+    KmerSeed *seedsY = getMinimizers(seqY, &seedNoY);
+    qsort(seedsX, seedNoX, sizeof(KmerSeed), kmerSeed_cmp);
+
+    // Get the shared k-mers, in ascending y and then ascending x order
+    int64_t pairNo = 0, pairCapacity = seedNoY > 16 ? seedNoY : 16;
+    ChainPair *cPs = st_malloc(sizeof(ChainPair) * pairCapacity); // Array of chain pairs, representing shared k-mers
+    for (int64_t i = 0; i < seedNoY; i++) {
+        // Binary search for the first seed of seqX with the same hash
+        int64_t lo = 0, hi = seedNoX;
+        while (lo < hi) {
+            int64_t mid = lo + (hi - lo) / 2;
+            if (seedsX[mid].hash < seedsY[i].hash) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        int64_t occurrences = 0;
+        for (int64_t j = lo; j < seedNoX && seedsX[j].hash == seedsY[i].hash &&
+                             occurrences < KMER_MAX_OCCURRENCES; j++) {
+            if (kmersEqual(&(seqX.sequence[seedsX[j].position]), &(seqY.sequence[seedsY[i].position]))) {
+                if (pairNo == pairCapacity) {
+                    pairCapacity *= 2;
+                    cPs = st_realloc(cPs, sizeof(ChainPair) * pairCapacity);
+                }
+                cPs[pairNo].x = seedsX[j].position;
+                cPs[pairNo].y = seedsY[i].position;
+                cPs[pairNo].score = 1; // score of chain pair if no prior chain-pair in chain
+                cPs[pairNo++].backpointer = -1; // back-pointer to previous chain pair (-1 indicates no prior pair)
+                occurrences++;
+            }
+        }
+    }
+    free(seedsX);
+    free(seedsY);
+
+    // Chain the pairs, each extending the highest scoring chain ending with a pair of smaller x and y coordinates,
+    // found with a Fenwick tree over the ranks of the x coordinates holding the best chain ending at each
+    uint64_t *xs = st_malloc(sizeof(uint64_t) * (pairNo + 1));
+    for (int64_t i = 0; i < pairNo; i++) {
+        xs[i] = cPs[i].x;
+    }
+    qsort(xs, pairNo, sizeof(uint64_t), uint64_cmp);
+    int64_t rankNo = 0;
+    for (int64_t i = 0; i < pairNo; i++) {
+        if (rankNo == 0 || xs[rankNo - 1] != xs[i]) {
+            xs[rankNo++] = xs[i];
+        }
+    }
+    int64_t *tree = st_malloc(sizeof(int64_t) * (rankNo + 1));
+    for (int64_t i = 0; i <= rankNo; i++) {
+        tree[i] = -1;
+    }
     int64_t maxPair = -1;
-    for (uint64_t y = 0; y < seqY.length - KMER_SIZE + 1; y++) {
-        int64_t *x = stHash_search(kmerOccurrences, &(seqY.sequence[y]));
-        if (x != NULL) {
-            cPs[i].x = *x;
-            cPs[i].y = y;
-            cPs[i].score = 1; // score of chain pair if no prior chain-pair in chain
-            cPs[i].backpointer = -1; // back-pointer to previous chain pair (-1 indicates no prior pair)
-
-            // Find highest scoring subchain to extend
-            for (int64_t j = i - 1; j >= 0; j--) { // walk through the previous pairs in decreasing y coordinate
-                if (cPs[j].x <
-                    cPs[i].x) { // if previous aligned k-mer pair has smaller x coordinate then can be chained
-                    if (cPs[j].score + 1 > cPs[i].score) { // chain score is better than seen so far
-                        cPs[i].score = cPs[j].score + 1; // update chain score
-                        cPs[i].backpointer = j; // update backpointer
-                    }
-                    if (cPs[j].highScore) { // if this is a high score then can not do better by looking back further, so break
-                        break;
-                    }
+    for (int64_t i = 0; i < pairNo;) {
+        // Chain the pairs with this y coordinate, which can not be chained to one another, before adding them
+        int64_t j = i;
+        for (; j < pairNo && cPs[j].y == cPs[i].y; j++) {
+            uint64_t *rank = bsearch(&(cPs[j].x), xs, rankNo, sizeof(uint64_t), uint64_cmp);
+            int64_t best = -1;
+            for (int64_t k = rank - xs; k > 0; k -= k & -k) { // The ranks before that of the pair's x coordinate
+                if (chainPair_better(cPs, tree[k], best)) {
+                    best = tree[k];
                 }
             }
-
+            if (best != -1) {
+                cPs[j].score = cPs[best].score + 1;
+                cPs[j].backpointer = best;
+            }
             // Update if is equal to highest score seen so far
-            if (cPs[i].score >= maxScore) {
-                cPs[i].highScore = 1;
-                maxScore = cPs[i].score;
-                maxPair = i;
-            } else {
-                cPs[i].highScore = 0;
+            if (maxPair == -1 || cPs[j].score >= cPs[maxPair].score) {
+                maxPair = j;
+            }
+        }
+        for (; i < j; i++) {
+            uint64_t *rank = bsearch(&(cPs[i].x), xs, rankNo, sizeof(uint64_t), uint64_cmp);
+            for (int64_t k = rank - xs + 1; k <= rankNo; k += k & -k) {
+                if (chainPair_better(cPs, i, tree[k])) {
+                    tree[k] = i;
+                }
             }
-
-            i++;
         }
     }
+    free(xs);
+    free(tree);
 
     // Traceback
     stList *anchorPairs = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
@@ -1620,7 +3113,212 @@ stList *getKmerAlignmentAnchors(SymbolString seqX, SymbolString seqY, uint64_t a
     stList_reverse(anchorPairs); // Put in ascending coordinate order
 
     // Cleanup
-    stHash_destruct(kmerOccurrences);
+    free(cPs);
 
     return anchorPairs;
-}
\ No newline at end of file
+}
+/*
+ * Batches of independent alignments.
+ */
+
+typedef struct _pairwiseAlignmentProblem {
+    StateMachine *sM;
+    SymbolString sX, sY;
+    stList *anchorPairs;
+    bool alignmentHasRaggedLeftEnd, alignmentHasRaggedRightEnd;
+    AlignedPairs *alignedPairs, *gapXPairs, *gapYPairs; // Null until the pairs are computed
+    double forwardProbability;
+} PairwiseAlignmentProblem;
+
+struct _pairwiseAlignmentBatch {
+    PairwiseAlignmentParameters *p;
+    bool parallel; // Solve the alignments on the cpu in concurrent tasks
+    int64_t length, maxLength;
+    PairwiseAlignmentProblem *problems;
+};
+
+static PairwiseAlignmentBackend *pairwiseAlignmentBackend = NULL; // Null for the cpu
+
+void pairwiseAlignmentBatch_setBackend(PairwiseAlignmentBackend *backend) {
+    pairwiseAlignmentBackend = backend;
+}
+
+PairwiseAlignmentBackend *pairwiseAlignmentBatch_getBackend(void) {
+    return pairwiseAlignmentBackend;
+}
+
+PairwiseAlignmentBatch *pairwiseAlignmentBatch_construct(PairwiseAlignmentParameters *p) {
+    PairwiseAlignmentBatch *batch = st_malloc(sizeof(PairwiseAlignmentBatch));
+    batch->p = p;
+    batch->parallel = 1;
+    batch->length = 0;
+    batch->maxLength = 16;
+    batch->problems = st_malloc(sizeof(PairwiseAlignmentProblem) * batch->maxLength);
+    return batch;
+}
+
+void pairwiseAlignmentBatch_destruct(PairwiseAlignmentBatch *batch) {
+    for (int64_t i = 0; i < batch->length; i++) {
+        PairwiseAlignmentProblem *problem = &batch->problems[i];
+        if (problem->alignedPairs != NULL) {
+            alignedPairs_destruct(problem->alignedPairs);
+            alignedPairs_destruct(problem->gapXPairs);
+            alignedPairs_destruct(problem->gapYPairs);
+        }
+    }
+    free(batch->problems);
+    free(batch);
+}
+
+int64_t pairwiseAlignmentBatch_add(PairwiseAlignmentBatch *batch, StateMachine *sM, SymbolString sX, SymbolString sY,
+                                   stList *anchorPairs, bool alignmentHasRaggedLeftEnd,
+                                   bool alignmentHasRaggedRightEnd) {
+    if (batch->length == batch->maxLength) {
+        batch->maxLength *= 2;
+        batch->problems = st_realloc(batch->problems, sizeof(PairwiseAlignmentProblem) * batch->maxLength);
+    }
+    PairwiseAlignmentProblem *problem = &batch->problems[batch->length];
+    problem->sM = sM;
+    problem->sX = sX;
+    problem->sY = sY;
+    problem->anchorPairs = anchorPairs;
+    problem->alignmentHasRaggedLeftEnd = alignmentHasRaggedLeftEnd;
+    problem->alignmentHasRaggedRightEnd = alignmentHasRaggedRightEnd;
+    problem->alignedPairs = NULL;
+    problem->gapXPairs = NULL;
+    problem->gapYPairs = NULL;
+    problem->forwardProbability = LOG_ZERO;
+    return batch->length++;
+}
+
+void pairwiseAlignmentBatch_setParallel(PairwiseAlignmentBatch *batch, bool parallel) {
+    batch->parallel = parallel;
+}
+
+int64_t pairwiseAlignmentBatch_length(PairwiseAlignmentBatch *batch) {
+    return batch->length;
+}
+
+PairwiseAlignmentParameters *pairwiseAlignmentBatch_getParameters(PairwiseAlignmentBatch *batch) {
+    return batch->p;
+}
+
+void pairwiseAlignmentBatch_getProblem(PairwiseAlignmentBatch *batch, int64_t i, StateMachine **sM, SymbolString *sX,
+                                       SymbolString *sY, stList **anchorPairs, bool *alignmentHasRaggedLeftEnd,
+                                       bool *alignmentHasRaggedRightEnd) {
+    assert(i >= 0 && i < batch->length);
+    PairwiseAlignmentProblem *problem = &batch->problems[i];
+    *sM = problem->sM;
+    *sX = problem->sX;
+    *sY = problem->sY;
+    *anchorPairs = problem->anchorPairs;
+    *alignmentHasRaggedLeftEnd = problem->alignmentHasRaggedLeftEnd;
+    *alignmentHasRaggedRightEnd = problem->alignmentHasRaggedRightEnd;
+}
+
+static void pairwiseAlignmentProblem_initialisePairs(PairwiseAlignmentProblem *problem) {
+    if (problem->alignedPairs == NULL) {
+        problem->alignedPairs = alignedPairs_construct();
+        problem->gapXPairs = alignedPairs_construct();
+        problem->gapYPairs = alignedPairs_construct();
+    } else {
+        alignedPairs_clear(problem->alignedPairs);
+        alignedPairs_clear(problem->gapXPairs);
+        alignedPairs_clear(problem->gapYPairs);
+    }
+}
+
+/*
+ * Solves each problem of the batch with fn, in its own OpenMP task if the batch is parallel.
+ */
+static void pairwiseAlignmentBatch_computeTasks(PairwiseAlignmentBatch *batch,
+                                                void (*fn)(PairwiseAlignmentProblem *, PairwiseAlignmentParameters *)) {
+    for (int64_t i = 0; i < batch->length; i++) {
+        # ifdef _OPENMP
+        #pragma omp task if(batch->parallel) firstprivate(i) shared(batch)
+        # endif
+        fn(&batch->problems[i], batch->p);
+    }
+    # ifdef _OPENMP
+    #pragma omp taskwait
+    # endif
+}
+
+static void pairwiseAlignmentBatch_computeOnCpu(PairwiseAlignmentBatch *batch,
+                                                void (*fn)(PairwiseAlignmentProblem *, PairwiseAlignmentParameters *)) {
+#if defined(_OPENMP)
+    if (batch->parallel && !omp_in_parallel() && batch->length > 1) {
+        // Open a parallel region for the tasks to run in, otherwise they are shared with the threads of the
+        // enclosing region as they become free
+#pragma omp parallel
+#pragma omp single
+        pairwiseAlignmentBatch_computeTasks(batch, fn);
+        return;
+    }
+#endif
+    pairwiseAlignmentBatch_computeTasks(batch, fn);
+}
+
+static void pairwiseAlignmentProblem_computeAlignedPairs(PairwiseAlignmentProblem *problem,
+                                                         PairwiseAlignmentParameters *p) {
+    getAlignedPairsWithIndelsUsingAnchorsPacked(problem->sM, problem->sX, problem->sY, problem->anchorPairs, p,
+                                                problem->alignedPairs, problem->gapXPairs, problem->gapYPairs,
+                                                problem->alignmentHasRaggedLeftEnd,
+                                                problem->alignmentHasRaggedRightEnd);
+}
+
+static void pairwiseAlignmentProblem_computeForwardProbability(PairwiseAlignmentProblem *problem,
+                                                               PairwiseAlignmentParameters *p) {
+    problem->forwardProbability = computeForwardProbability(problem->sX, problem->sY, problem->anchorPairs, p,
+                                                            problem->sM, problem->alignmentHasRaggedLeftEnd,
+                                                            problem->alignmentHasRaggedRightEnd);
+}
+
+void pairwiseAlignmentBatch_computeAlignedPairs(PairwiseAlignmentBatch *batch) {
+    for (int64_t i = 0; i < batch->length; i++) {
+        pairwiseAlignmentProblem_initialisePairs(&batch->problems[i]);
+    }
+    if (pairwiseAlignmentBackend != NULL && pairwiseAlignmentBackend->computeAlignedPairs != NULL &&
+        pairwiseAlignmentBackend->computeAlignedPairs(batch, pairwiseAlignmentBackend->backendData)) {
+        return;
+    }
+    // Fall back to the cpu, discarding anything the backend left before declining the batch
+    for (int64_t i = 0; i < batch->length; i++) {
+        pairwiseAlignmentProblem_initialisePairs(&batch->problems[i]);
+    }
+    pairwiseAlignmentBatch_computeOnCpu(batch, pairwiseAlignmentProblem_computeAlignedPairs);
+}
+
+void pairwiseAlignmentBatch_computeForwardProbabilities(PairwiseAlignmentBatch *batch) {
+    if (pairwiseAlignmentBackend != NULL && pairwiseAlignmentBackend->computeForwardProbabilities != NULL &&
+        pairwiseAlignmentBackend->computeForwardProbabilities(batch, pairwiseAlignmentBackend->backendData)) {
+        return;
+    }
+    pairwiseAlignmentBatch_computeOnCpu(batch, pairwiseAlignmentProblem_computeForwardProbability);
+}
+
+AlignedPairs *pairwiseAlignmentBatch_getAlignedPairs(PairwiseAlignmentBatch *batch, int64_t i) {
+    assert(i >= 0 && i < batch->length && batch->problems[i].alignedPairs != NULL);
+    return batch->problems[i].alignedPairs;
+}
+
+AlignedPairs *pairwiseAlignmentBatch_getGapXPairs(PairwiseAlignmentBatch *batch, int64_t i) {
+    assert(i >= 0 && i < batch->length && batch->problems[i].gapXPairs != NULL);
+    return batch->problems[i].gapXPairs;
+}
+
+AlignedPairs *pairwiseAlignmentBatch_getGapYPairs(PairwiseAlignmentBatch *batch, int64_t i) {
+    assert(i >= 0 && i < batch->length && batch->problems[i].gapYPairs != NULL);
+    return batch->problems[i].gapYPairs;
+}
+
+double pairwiseAlignmentBatch_getForwardProbability(PairwiseAlignmentBatch *batch, int64_t i) {
+    assert(i >= 0 && i < batch->length);
+    return batch->problems[i].forwardProbability;
+}
+
+void pairwiseAlignmentBatch_setForwardProbability(PairwiseAlignmentBatch *batch, int64_t i,
+                                                  double forwardProbability) {
+    assert(i >= 0 && i < batch->length);
+    batch->problems[i].forwardProbability = forwardProbability;
+}
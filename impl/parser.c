@@ -17,11 +17,15 @@ stRPHmmParameters *stRPHmmParameters_construct() {
     stRPHmmParameters *params = st_calloc(1, sizeof(stRPHmmParameters));
 
     // More variables for hmm stuff
-    params->maxCoverageDepth = MAX_READ_PARTITIONING_DEPTH;
+    params->maxCoverageDepth = NARROW_PARTITIONING_DEPTH;
     params->maxNotSumTransitions = true;
+    params->viterbiPhasing = false;
     params->minPartitionsInAColumn = 50;
     params->maxPartitionsInAColumn = 200;
     params->minPosteriorProbabilityForPartition = 0.001;
+    params->forwardBeamLogProbMargin = 0;
+    params->forwardBeamMaxCells = 0;
+    params->sweepHmmConstruction = false;
     params->minReadCoverageToSupportPhasingBetweenHeterozygousSites = 0;
 
     // Other marginPhase program options
@@ -40,6 +44,7 @@ stRPHmmParameters *stRPHmmParameters_construct() {
     params->variantSelectionAdaptiveSamplingDesiredBasepairsPerVariant = 1000;
     params->minVariantQuality = 0.15;
     params->updateAllOutputVCFFormatFields = TRUE;
+    params->compressPhasedVcf = FALSE;
     params->phasesetMinBinomialReadSplitLikelihood = .0001;
     params->phasesetMaxDiscordantRatio = .1;
     params->bubbleFindingIterations = 1;
@@ -57,9 +62,13 @@ stRPHmmParameters *stRPHmmParameters_copy(stRPHmmParameters *toCopy) {
     // More variables for hmm stuff
     params->maxCoverageDepth = toCopy->maxCoverageDepth;
     params->maxNotSumTransitions = toCopy->maxNotSumTransitions;
+    params->viterbiPhasing = toCopy->viterbiPhasing;
     params->minPartitionsInAColumn = toCopy->minPartitionsInAColumn;
     params->maxPartitionsInAColumn = toCopy->maxPartitionsInAColumn;
     params->minPosteriorProbabilityForPartition = toCopy->minPosteriorProbabilityForPartition;
+    params->forwardBeamLogProbMargin = toCopy->forwardBeamLogProbMargin;
+    params->forwardBeamMaxCells = toCopy->forwardBeamMaxCells;
+    params->sweepHmmConstruction = toCopy->sweepHmmConstruction;
     params->minReadCoverageToSupportPhasingBetweenHeterozygousSites = toCopy->minReadCoverageToSupportPhasingBetweenHeterozygousSites;
 
     // Other marginPhase program options
@@ -78,6 +87,7 @@ stRPHmmParameters *stRPHmmParameters_copy(stRPHmmParameters *toCopy) {
     params->variantSelectionAdaptiveSamplingDesiredBasepairsPerVariant = toCopy->variantSelectionAdaptiveSamplingDesiredBasepairsPerVariant;
     params->minVariantQuality = toCopy->minVariantQuality;
     params->updateAllOutputVCFFormatFields = toCopy->updateAllOutputVCFFormatFields;
+    params->compressPhasedVcf = toCopy->compressPhasedVcf;
     params->phasesetMinBinomialReadSplitLikelihood = toCopy->phasesetMinBinomialReadSplitLikelihood;
     params->phasesetMaxDiscordantRatio = toCopy->phasesetMaxDiscordantRatio;
     params->bubbleFindingIterations = toCopy->bubbleFindingIterations;
@@ -101,14 +111,25 @@ void stRPHmmParameters_parseParametersFromJson(stRPHmmParameters *params, char *
 
         if (strcmp(keyString, "maxNotSumTransitions") == 0) {
             params->maxNotSumTransitions = stJson_parseBool(js, tokens, ++i);
+        } else if (strcmp(keyString, "viterbiPhasing") == 0) {
+            params->viterbiPhasing = stJson_parseBool(js, tokens, ++i);
         } else if (strcmp(keyString, "minPartitionsInAColumn") == 0) {
             params->minPartitionsInAColumn = stJson_parseInt(js, tokens, ++i);
         } else if (strcmp(keyString, "maxPartitionsInAColumn") == 0) {
             params->maxPartitionsInAColumn = stJson_parseInt(js, tokens, ++i);
         } else if (strcmp(keyString, "minPosteriorProbabilityForPartition") == 0) {
             params->minPosteriorProbabilityForPartition = stJson_parseFloat(js, tokens, ++i);
+        } else if (strcmp(keyString, "forwardBeamLogProbMargin") == 0) {
+            params->forwardBeamLogProbMargin = stJson_parseFloat(js, tokens, ++i);
+        } else if (strcmp(keyString, "forwardBeamMaxCells") == 0) {
+            params->forwardBeamMaxCells = stJson_parseInt(js, tokens, ++i);
+        } else if (strcmp(keyString, "sweepHmmConstruction") == 0) {
+            params->sweepHmmConstruction = stJson_parseBool(js, tokens, ++i);
         } else if (strcmp(keyString, "maxCoverageDepth") == 0) {
             params->maxCoverageDepth = stJson_parseInt(js, tokens, ++i);
+            if (params->maxCoverageDepth > MAX_READ_PARTITIONING_DEPTH) {
+                st_errAbort("ERROR: maxCoverageDepth can not exceed %d\n", MAX_READ_PARTITIONING_DEPTH);
+            }
         } else if (strcmp(keyString, "minReadCoverageToSupportPhasingBetweenHeterozygousSites") == 0) {
             params->minReadCoverageToSupportPhasingBetweenHeterozygousSites = stJson_parseInt(js, tokens, ++i);
         } else if (strcmp(keyString, "includeInvertedPartitions") == 0) {
@@ -135,6 +156,8 @@ void stRPHmmParameters_parseParametersFromJson(stRPHmmParameters *params, char *
             params->minVariantQuality = stJson_parseFloat(js, tokens, ++i);
         } else if (strcmp(keyString, "updateAllOutputVCFFormatFields") == 0) {
             params->updateAllOutputVCFFormatFields = stJson_parseBool(js, tokens, ++i);
+        } else if (strcmp(keyString, "compressPhasedVcf") == 0) {
+            params->compressPhasedVcf = stJson_parseBool(js, tokens, ++i);
         } else if (strcmp(keyString, "phasesetMinBinomialReadSplitLikelihood") == 0) {
             params->phasesetMinBinomialReadSplitLikelihood = stJson_parseFloat(js, tokens, ++i);
         } else if (strcmp(keyString, "phasesetMaxDiscordantRatio") == 0) {
@@ -231,24 +254,60 @@ PolishParams  *polishParams_constructEmpty() {
     params->minPosteriorProbForAlignmentAnchorsLength = 2;
     params->includeSoftClipping = FALSE;
     params->shuffleChunks = TRUE;
-    params->shuffleChunksMethod = SCM_SIZE_DESC;
+    params->shuffleChunksMethod = SCM_COST_DESC;
     params->useRepeatCountsInAlignment = FALSE;
     params->chunkSize = 10000;
     params->chunkBoundary = 1000;
+    params->adaptiveChunkSize = FALSE;
+    params->minChunkSize = 0;
+    params->maxChunkSize = 0;
+    params->targetChunkWork = 0;
+    params->chunkSiteWork = 100;
+    params->stitchExactMatchLength = 32;
+    params->estimateChunkDepthFromIndex = FALSE;
+    params->chunkDepthSummaryFile = NULL;
+    params->chunkPrefetchThreads = 1;
+    params->smallChunkGroupLength = 0;
+    params->useChunkArena = TRUE;
+    params->useHugePages = FALSE;
+    params->logAddKernel = LOG_ADD_DEFAULT;
+    params->maxMemory = 0;
+    params->chunkMemoryPerReadBase = 200;
+    params->progressInterval = 10;
+    params->bufferedLogging = FALSE;
+    params->htsThreads = 0;
+    params->streamBamInput = FALSE;
+    params->stitchOnline = FALSE;
+    params->useBinaryChunkRecords = FALSE;
+    params->compressChunkRecords = FALSE;
+    params->compressOutputFasta = FALSE;
+    params->maxInMemoryOutputBytes = 0;
     params->maxDepth = 64;
+    params->downsamplingSeed = 0;
     params->excessiveDepthThreshold = 512;
     params->includeSecondaryAlignments = FALSE;
     params->includeSupplementaryAlignments = FALSE;
     params->filterAlignmentsWithMapQBelowThisThreshold = 10;
     params->candidateVariantWeight = 0.2;
+    params->cleanChunkMaxDivergence = 0.0;
     params->columnAnchorTrim = 5;
     params->maxConsensusStrings = 100;
     params->repeatSubMatrix = NULL;
     params->stateMachineForGenomeComparison = stateMachine3_constructNucleotide(threeStateAsymmetric);
+    params->stateMachineForConsensusAlignment = stateMachine3_constructNucleotide(threeState);
     params->useReadAlleles = 1;
     params->useReadAllelesInPhasing = 0;
     params->hetSubstitutionProbability = 0.0001;
     params->hetRunLengthSubstitutionProbability = 0.0001;
+    params->alleleScoringBailOutMargin = 0.0;
+    params->alleleScoringPrescoreMargin = 0.0;
+    params->reuseOverlapAlleleSupports = 0;
+    params->truthProjectionExactMatchLength = 0;
+    params->useIncrementalRealignment = 1;
+    params->realignmentParallelismThreshold = 50000000;
+    params->useWindowedRealignment = 0;
+    params->windowedRealignmentFlank = 10;
+    params->partitionHaplotypePoaReads = 0;
     params->p = pairwiseAlignmentBandingParameters_construct();
 
     // At this point the repeat matrix, the hmms for read alignment, the alphabet and the pairwise alignment parameter will be null.
@@ -340,11 +399,88 @@ void polishParams_jsonParse(PolishParams *params, char *buf, size_t r) {
             if (stString_eqcase(tokStr, "random")) {
                 params->shuffleChunksMethod = SCM_RANDOM;
             } else if (stString_eqcase(tokStr, "size_desc")) {
-                params->shuffleChunksMethod = SCM_SIZE_DESC;
+                params->shuffleChunksMethod = SCM_COST_DESC;
+            } else if (stString_eqcase(tokStr, "cost_desc")) {
+                params->shuffleChunksMethod = SCM_COST_DESC;
+            } else {
+                st_errAbort("Invald 'shuffleChunksMethod' parameter '%s'.  Expected ('random', 'size_desc', "
+                            "'cost_desc').", tokStr);
+            }
+            tokenIndex += stJson_getNestedTokenCount(tokens, tokenIndex + 1);
+        } else if (strcmp(keyString, "estimateChunkDepthFromIndex") == 0) {
+            params->estimateChunkDepthFromIndex = stJson_parseBool(js, tokens, ++tokenIndex);
+        } else if (strcmp(keyString, "chunkDepthSummaryFile") == 0) {
+            jsmntok_t tok = tokens[tokenIndex + 1];
+            if (params->chunkDepthSummaryFile != NULL) free(params->chunkDepthSummaryFile);
+            params->chunkDepthSummaryFile = stString_copy(stJson_token_tostr(js, &tok));
+            tokenIndex += stJson_getNestedTokenCount(tokens, tokenIndex + 1);
+        } else if (strcmp(keyString, "chunkPrefetchThreads") == 0) {
+            if (stJson_parseInt(js, tokens, ++tokenIndex) < 0) {
+                st_errAbort("ERROR: chunkPrefetchThreads parameter must zero or greater\n");
+            }
+            params->chunkPrefetchThreads = (uint64_t) stJson_parseInt(js, tokens, tokenIndex);
+        } else if (strcmp(keyString, "smallChunkGroupLength") == 0) {
+            if (stJson_parseInt(js, tokens, ++tokenIndex) < 0) {
+                st_errAbort("ERROR: smallChunkGroupLength parameter must zero or greater\n");
+            }
+            params->smallChunkGroupLength = (uint64_t) stJson_parseInt(js, tokens, tokenIndex);
+        } else if (strcmp(keyString, "useChunkArena") == 0) {
+            params->useChunkArena = stJson_parseBool(js, tokens, ++tokenIndex);
+        } else if (strcmp(keyString, "useHugePages") == 0) {
+            params->useHugePages = stJson_parseBool(js, tokens, ++tokenIndex);
+        } else if (strcmp(keyString, "logAddKernel") == 0) {
+            jsmntok_t tok = tokens[tokenIndex + 1];
+            char *tokStr = stJson_token_tostr(js, &tok);
+            if (stString_eqcase(tokStr, "default")) {
+                params->logAddKernel = LOG_ADD_DEFAULT;
+            } else if (stString_eqcase(tokStr, "exact")) {
+                params->logAddKernel = LOG_ADD_EXACT;
+            } else if (stString_eqcase(tokStr, "approximate")) {
+                params->logAddKernel = LOG_ADD_APPROXIMATE;
+            } else if (stString_eqcase(tokStr, "table")) {
+                params->logAddKernel = LOG_ADD_TABLE;
             } else {
-                st_errAbort("Invald 'shuffleChunksMethod' parameter '%s'.  Expected ('random', 'size_desc').", tokStr);
+                st_errAbort("Invalid 'logAddKernel' parameter '%s'.  Expected ('default', 'exact', 'approximate', "
+                            "'table').", tokStr);
             }
             tokenIndex += stJson_getNestedTokenCount(tokens, tokenIndex + 1);
+        } else if (strcmp(keyString, "maxMemory") == 0) {
+            if (stJson_parseInt(js, tokens, ++tokenIndex) < 0) {
+                st_errAbort("ERROR: maxMemory parameter must zero or greater\n");
+            }
+            params->maxMemory = (uint64_t) stJson_parseInt(js, tokens, tokenIndex);
+        } else if (strcmp(keyString, "chunkMemoryPerReadBase") == 0) {
+            if (stJson_parseInt(js, tokens, ++tokenIndex) < 0) {
+                st_errAbort("ERROR: chunkMemoryPerReadBase parameter must zero or greater\n");
+            }
+            params->chunkMemoryPerReadBase = (uint64_t) stJson_parseInt(js, tokens, tokenIndex);
+        } else if (strcmp(keyString, "progressInterval") == 0) {
+            if (stJson_parseInt(js, tokens, ++tokenIndex) < 0) {
+                st_errAbort("ERROR: progressInterval parameter must zero or greater\n");
+            }
+            params->progressInterval = (uint64_t) stJson_parseInt(js, tokens, tokenIndex);
+        } else if (strcmp(keyString, "bufferedLogging") == 0) {
+            params->bufferedLogging = stJson_parseBool(js, tokens, ++tokenIndex);
+        } else if (strcmp(keyString, "htsThreads") == 0) {
+            if (stJson_parseInt(js, tokens, ++tokenIndex) < 0) {
+                st_errAbort("ERROR: htsThreads parameter must zero or greater\n");
+            }
+            params->htsThreads = (uint64_t) stJson_parseInt(js, tokens, tokenIndex);
+        } else if (strcmp(keyString, "streamBamInput") == 0) {
+            params->streamBamInput = stJson_parseBool(js, tokens, ++tokenIndex);
+        } else if (strcmp(keyString, "stitchOnline") == 0) {
+            params->stitchOnline = stJson_parseBool(js, tokens, ++tokenIndex);
+        } else if (strcmp(keyString, "useBinaryChunkRecords") == 0) {
+            params->useBinaryChunkRecords = stJson_parseBool(js, tokens, ++tokenIndex);
+        } else if (strcmp(keyString, "compressChunkRecords") == 0) {
+            params->compressChunkRecords = stJson_parseBool(js, tokens, ++tokenIndex);
+        } else if (strcmp(keyString, "compressOutputFasta") == 0) {
+            params->compressOutputFasta = stJson_parseBool(js, tokens, ++tokenIndex);
+        } else if (strcmp(keyString, "maxInMemoryOutputBytes") == 0) {
+            if (stJson_parseInt(js, tokens, ++tokenIndex) < 0) {
+                st_errAbort("ERROR: maxInMemoryOutputBytes parameter must zero or greater\n");
+            }
+            params->maxInMemoryOutputBytes = (uint64_t) stJson_parseInt(js, tokens, tokenIndex);
         } else if (strcmp(keyString, "includeSoftClipping") == 0) {
             params->includeSoftClipping = stJson_parseBool(js, tokens, ++tokenIndex);
         } else if (strcmp(keyString, "useRepeatCountsInAlignment") == 0) {
@@ -359,11 +495,43 @@ void polishParams_jsonParse(PolishParams *params, char *buf, size_t r) {
                 st_errAbort("ERROR: chunkBoundary parameter must zero or greater\n");
             }
             params->chunkBoundary = (uint64_t) stJson_parseInt(js, tokens, tokenIndex);
+        } else if (strcmp(keyString, "adaptiveChunkSize") == 0) {
+            params->adaptiveChunkSize = stJson_parseBool(js, tokens, ++tokenIndex);
+        } else if (strcmp(keyString, "minChunkSize") == 0) {
+            if (stJson_parseInt(js, tokens, ++tokenIndex) < 0) {
+                st_errAbort("ERROR: minChunkSize parameter must zero or greater\n");
+            }
+            params->minChunkSize = (uint64_t) stJson_parseInt(js, tokens, tokenIndex);
+        } else if (strcmp(keyString, "maxChunkSize") == 0) {
+            if (stJson_parseInt(js, tokens, ++tokenIndex) < 0) {
+                st_errAbort("ERROR: maxChunkSize parameter must zero or greater\n");
+            }
+            params->maxChunkSize = (uint64_t) stJson_parseInt(js, tokens, tokenIndex);
+        } else if (strcmp(keyString, "targetChunkWork") == 0) {
+            if (stJson_parseInt(js, tokens, ++tokenIndex) < 0) {
+                st_errAbort("ERROR: targetChunkWork parameter must zero or greater\n");
+            }
+            params->targetChunkWork = (uint64_t) stJson_parseInt(js, tokens, tokenIndex);
+        } else if (strcmp(keyString, "chunkSiteWork") == 0) {
+            if (stJson_parseInt(js, tokens, ++tokenIndex) < 0) {
+                st_errAbort("ERROR: chunkSiteWork parameter must zero or greater\n");
+            }
+            params->chunkSiteWork = (uint64_t) stJson_parseInt(js, tokens, tokenIndex);
+        } else if (strcmp(keyString, "stitchExactMatchLength") == 0) {
+            if (stJson_parseInt(js, tokens, ++tokenIndex) < 0) {
+                st_errAbort("ERROR: stitchExactMatchLength parameter must zero or greater\n");
+            }
+            params->stitchExactMatchLength = (uint64_t) stJson_parseInt(js, tokens, tokenIndex);
         } else if (strcmp(keyString, "maxDepth") == 0) {
             if (stJson_parseInt(js, tokens, ++tokenIndex) < 0) {
                 st_errAbort("ERROR: maxDepth parameter must zero or greater\n");
             }
             params->maxDepth = (uint64_t) stJson_parseInt(js, tokens, tokenIndex);
+        } else if (strcmp(keyString, "downsamplingSeed") == 0) {
+            if (stJson_parseInt(js, tokens, ++tokenIndex) < 0) {
+                st_errAbort("ERROR: downsamplingSeed parameter must zero or greater\n");
+            }
+            params->downsamplingSeed = (uint64_t) stJson_parseInt(js, tokens, tokenIndex);
         } else if (strcmp(keyString, "excessiveDepthThreshold") == 0) {
             if (stJson_parseInt(js, tokens, ++tokenIndex) < 0) {
                 st_errAbort("ERROR: excessiveDepthThreshold parameter must zero or greater\n");
@@ -383,6 +551,11 @@ void polishParams_jsonParse(PolishParams *params, char *buf, size_t r) {
                 st_errAbort("ERROR: candidateVariantWeight parameter must zero or greater\n");
             }
             params->candidateVariantWeight = stJson_parseFloat(js, tokens, tokenIndex);
+        } else if (strcmp(keyString, "cleanChunkMaxDivergence") == 0) {
+            if (stJson_parseFloat(js, tokens, ++tokenIndex) < 0) {
+                st_errAbort("ERROR: cleanChunkMaxDivergence parameter must zero or greater\n");
+            }
+            params->cleanChunkMaxDivergence = stJson_parseFloat(js, tokens, tokenIndex);
         } else if (strcmp(keyString, "columnAnchorTrim") == 0) {
             if (stJson_parseInt(js, tokens, ++tokenIndex) < 0) {
                 st_errAbort("ERROR: columnAnchorTrim parameter must zero or greater\n");
@@ -433,6 +606,39 @@ void polishParams_jsonParse(PolishParams *params, char *buf, size_t r) {
                 st_errAbort("ERROR: hetRunLengthSubstitutionProbability parameter must zero or greater\n");
             }
             params->hetRunLengthSubstitutionProbability = stJson_parseFloat(js, tokens, tokenIndex);
+        } else if (strcmp(keyString, "alleleScoringBailOutMargin") == 0) {
+            if (stJson_parseFloat(js, tokens, ++tokenIndex) < 0) {
+                st_errAbort("ERROR: alleleScoringBailOutMargin parameter must zero or greater\n");
+            }
+            params->alleleScoringBailOutMargin = stJson_parseFloat(js, tokens, tokenIndex);
+        } else if (strcmp(keyString, "alleleScoringPrescoreMargin") == 0) {
+            if (stJson_parseFloat(js, tokens, ++tokenIndex) < 0) {
+                st_errAbort("ERROR: alleleScoringPrescoreMargin parameter must zero or greater\n");
+            }
+            params->alleleScoringPrescoreMargin = stJson_parseFloat(js, tokens, tokenIndex);
+        } else if (strcmp(keyString, "reuseOverlapAlleleSupports") == 0) {
+            params->reuseOverlapAlleleSupports = stJson_parseBool(js, tokens, ++tokenIndex);
+        } else if (strcmp(keyString, "truthProjectionExactMatchLength") == 0) {
+            if (stJson_parseInt(js, tokens, ++tokenIndex) < 0) {
+                st_errAbort("ERROR: truthProjectionExactMatchLength parameter must zero or greater\n");
+            }
+            params->truthProjectionExactMatchLength = (uint64_t) stJson_parseInt(js, tokens, tokenIndex);
+        } else if (strcmp(keyString, "useIncrementalRealignment") == 0) {
+            params->useIncrementalRealignment = stJson_parseBool(js, tokens, ++tokenIndex);
+        } else if (strcmp(keyString, "realignmentParallelismThreshold") == 0) {
+            if (stJson_parseInt(js, tokens, ++tokenIndex) < 0) {
+                st_errAbort("ERROR: realignmentParallelismThreshold parameter must zero or greater\n");
+            }
+            params->realignmentParallelismThreshold = (uint64_t) stJson_parseInt(js, tokens, tokenIndex);
+        } else if (strcmp(keyString, "useWindowedRealignment") == 0) {
+            params->useWindowedRealignment = stJson_parseBool(js, tokens, ++tokenIndex);
+        } else if (strcmp(keyString, "windowedRealignmentFlank") == 0) {
+            if (stJson_parseInt(js, tokens, ++tokenIndex) < 0) {
+                st_errAbort("ERROR: windowedRealignmentFlank parameter must zero or greater\n");
+            }
+            params->windowedRealignmentFlank = (uint64_t) stJson_parseInt(js, tokens, tokenIndex);
+        } else if (strcmp(keyString, "partitionHaplotypePoaReads") == 0) {
+            params->partitionHaplotypePoaReads = stJson_parseBool(js, tokens, ++tokenIndex);
         } else if (strcmp(keyString, "useReadAlleles") == 0) {
             params->useReadAlleles = stJson_parseBool(js, tokens, ++tokenIndex);
         } else if (strcmp(keyString, "skipHaploidPolishingIfDiploid") == 0) {
@@ -457,6 +663,19 @@ void polishParams_jsonParse(PolishParams *params, char *buf, size_t r) {
     free(tokens);
 }
 
+/*
+ * Checks the reverse strand read state machine is the reverse complement of the forward strand one.
+ */
+static void polishParams_checkReadStateMachines(PolishParams *params) {
+    uint64_t maxRepeatCount = params->useRepeatCountsInAlignment ?
+                              (uint64_t) params->repeatSubMatrix->maximumRepeatLength : 1;
+    if (!stateMachine3_isReverseStrand(params->stateMachineForForwardStrandRead,
+                                       params->stateMachineForReverseStrandRead, maxRepeatCount)) {
+        st_errAbort("ERROR: The reverse strand read state machine is not the reverse complement of the forward "
+                    "strand one\n");
+    }
+}
+
 void polishParams_finishParsing(PolishParams *params) {
     if (params->repeatSubMatrix == NULL && params->useRunLengthEncoding) {
         st_logCritical(
@@ -487,6 +706,22 @@ void polishParams_finishParsing(PolishParams *params) {
         params->stateMachineForReverseStrandRead->emissions = rleNucleotideEmissions_construct(
                 params->stateMachineForReverseStrandRead->emissions, params->repeatSubMatrix, 0);
     }
+    polishParams_checkReadStateMachines(params);
+}
+
+void polishParams_setReadHmm(PolishParams *params, Hmm *hmm) {
+    stateMachine_destruct(params->stateMachineForForwardStrandRead);
+    stateMachine_destruct(params->stateMachineForReverseStrandRead);
+    params->stateMachineForForwardStrandRead = hmm_getStateMachine(hmm);
+    params->stateMachineForReverseStrandRead = hmm_getStateMachine(hmm);
+    nucleotideEmissions_reverseComplement((NucleotideEmissions *) params->stateMachineForReverseStrandRead->emissions);
+    if (params->useRepeatCountsInAlignment) {
+        params->stateMachineForForwardStrandRead->emissions = rleNucleotideEmissions_construct(
+                params->stateMachineForForwardStrandRead->emissions, params->repeatSubMatrix, 1);
+        params->stateMachineForReverseStrandRead->emissions = rleNucleotideEmissions_construct(
+                params->stateMachineForReverseStrandRead->emissions, params->repeatSubMatrix, 0);
+    }
+    polishParams_checkReadStateMachines(params);
 }
 
 void polishParams_printParameters(PolishParams *polishParams, FILE *fh) {
@@ -505,10 +740,12 @@ void polishParams_printParameters(PolishParams *polishParams, FILE *fh) {
 void polishParams_destruct(PolishParams *params) {
     if (params->repeatSubMatrix != NULL) repeatSubMatrix_destruct(params->repeatSubMatrix);
     stateMachine_destruct(params->stateMachineForGenomeComparison);
+    stateMachine_destruct(params->stateMachineForConsensusAlignment);
     stateMachine_destruct(params->stateMachineForForwardStrandRead);
     stateMachine_destruct(params->stateMachineForReverseStrandRead);
     pairwiseAlignmentBandingParameters_destruct(params->p);
     free(params->minPosteriorProbForAlignmentAnchors);
+    if (params->chunkDepthSummaryFile != NULL) free(params->chunkDepthSummaryFile);
     alphabet_destruct(params->alphabet);
     free(params);
 }
@@ -522,6 +759,7 @@ Params *params_constructEmpty() {
     Params *params = st_calloc(1, sizeof(Params));
     params->polishParams = polishParams_constructEmpty();
     params->phaseParams = stRPHmmParameters_construct();
+    params->fingerprint = CHUNK_JOURNAL_FINGERPRINT_SEED;
 
     return params;
 }
@@ -566,11 +804,15 @@ void params_jsonParse(Params *params, char *buf, size_t r, char *paramsFile) {
         } else if (strcmp(keyString, "polish") == 0) {
             jsmntok_t tok = tokens[tokenIndex + 1];
             char *tokStr = stJson_token_tostr(js, &tok);
+            params->fingerprint = chunkJournal_fingerprintString(params->fingerprint, keyString);
+            params->fingerprint = chunkJournal_fingerprintString(params->fingerprint, tokStr);
             polishParams_jsonParse(params->polishParams, tokStr, strlen(tokStr));
             tokenIndex += stJson_getNestedTokenCount(tokens, tokenIndex + 1);
         } else if (strcmp(keyString, "phase") == 0) {
             jsmntok_t tok = tokens[tokenIndex + 1];
             char *tokStr = stJson_token_tostr(js, &tok);
+            params->fingerprint = chunkJournal_fingerprintString(params->fingerprint, keyString);
+            params->fingerprint = chunkJournal_fingerprintString(params->fingerprint, tokStr);
             stRPHmmParameters_parseParametersFromJson(params->phaseParams, tokStr, strlen(tokStr));
             tokenIndex += stJson_getNestedTokenCount(tokens, tokenIndex + 1);
         } else {
@@ -605,11 +847,40 @@ void params_readParams2(Params *params, char *paramsFile) {
     fclose(fh);
 }
 
+// The params kept by params_keepParams, and the file they were parsed from
+static char *keptParamsFile = NULL;
+static Params *keptParams = NULL;
+
+void params_keepParams(char *paramsFile) {
+    if (keptParams != NULL) {
+        params_destruct(keptParams);
+        free(keptParamsFile);
+        keptParams = NULL;
+    }
+    keptParams = params_readParams(paramsFile);
+    keptParamsFile = stString_copy(paramsFile);
+}
+
+Params *params_getKeptParams(char *paramsFile) {
+    return keptParams != NULL && stString_eq(keptParamsFile, paramsFile) ? keptParams : NULL;
+}
+
 Params *params_readParams(char *paramsFile) {
+    // the kept params are handed to the first caller to ask for them
+    if (keptParams != NULL && stString_eq(keptParamsFile, paramsFile)) {
+        Params *params = keptParams;
+        keptParams = NULL;
+        free(keptParamsFile);
+        keptParamsFile = NULL;
+        return params;
+    }
+
     Params *params = params_constructEmpty();
     params_readParams2(params, paramsFile);
     stRPHmmParameters_finishParsing(params->phaseParams);
     polishParams_finishParsing(params->polishParams); // This initializes everything
+    // the kernel is global, so is set here, before any chunk is processed
+    setLogAddKernel(params->polishParams->logAddKernel);
 
     return params;
 }
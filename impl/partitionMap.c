@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2020 by Benedict Paten (benedictpaten@gmail.com)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include "margin.h"
+
+/*
+ * Open addressing hash map with partition keys, see partitionMap_construct. Slots are probed linearly, are empty when
+ * their value is NULL, and are kept at most half full. Removal shifts the following slots of the probe run back, so
+ * there are no tombstones.
+ */
+
+#define PARTITION_MAP_MIN_CAPACITY 16
+
+struct _partitionMap {
+    stRPPartition *keys;
+    void **values; // NULL for an empty slot
+    uint64_t mask; // capacity - 1, the capacity being a power of two
+    int64_t size;
+    void (*destructValue)(void *);
+};
+
+static uint64_t partitionMap_hash(stRPPartition key) {
+    // partitions have few varying bits, so they are mixed before masking. The high word is zero for the partitions of
+    // columns of at most NARROW_PARTITIONING_DEPTH reads.
+    uint64_t h = ((uint64_t) key ^ (uint64_t) (key >> 64) * 0xC2B2AE3D27D4EB4FULL) * 0x9E3779B97F4A7C15ULL;
+    return h ^ (h >> 32);
+}
+
+static uint64_t partitionMap_getCapacity(int64_t expectedSize) {
+    uint64_t capacity = PARTITION_MAP_MIN_CAPACITY;
+    while (capacity < 2 * (uint64_t) expectedSize) {
+        capacity *= 2;
+    }
+    return capacity;
+}
+
+PartitionMap *partitionMap_construct2(int64_t expectedSize, void (*destructValue)(void *)) {
+    PartitionMap *map = st_calloc(1, sizeof(PartitionMap));
+    uint64_t capacity = partitionMap_getCapacity(expectedSize);
+    map->keys = st_malloc(sizeof(stRPPartition) * capacity);
+    map->values = st_calloc(capacity, sizeof(void *));
+    map->mask = capacity - 1;
+    map->destructValue = destructValue;
+    return map;
+}
+
+PartitionMap *partitionMap_construct(int64_t expectedSize) {
+    return partitionMap_construct2(expectedSize, NULL);
+}
+
+void partitionMap_destruct(PartitionMap *map) {
+    if (map->destructValue != NULL) {
+        for (uint64_t i = 0; i <= map->mask; i++) {
+            if (map->values[i] != NULL) {
+                map->destructValue(map->values[i]);
+            }
+        }
+    }
+    free(map->keys);
+    free(map->values);
+    free(map);
+}
+
+int64_t partitionMap_size(PartitionMap *map) {
+    return map->size;
+}
+
+static uint64_t partitionMap_getSlot(PartitionMap *map, stRPPartition key) {
+    // returns the key's slot or the empty slot it would go in
+    uint64_t i = partitionMap_hash(key) & map->mask;
+    while (map->values[i] != NULL && map->keys[i] != key) {
+        i = (i + 1) & map->mask;
+    }
+    return i;
+}
+
+void *partitionMap_search(PartitionMap *map, stRPPartition key) {
+    return map->values[partitionMap_getSlot(map, key)];
+}
+
+static void partitionMap_resize(PartitionMap *map, uint64_t capacity) {
+    stRPPartition *keys = map->keys;
+    void **values = map->values;
+    uint64_t oldCapacity = map->mask + 1;
+    map->keys = st_malloc(sizeof(stRPPartition) * capacity);
+    map->values = st_calloc(capacity, sizeof(void *));
+    map->mask = capacity - 1;
+    for (uint64_t i = 0; i < oldCapacity; i++) {
+        if (values[i] != NULL) {
+            uint64_t j = partitionMap_getSlot(map, keys[i]);
+            map->keys[j] = keys[i];
+            map->values[j] = values[i];
+        }
+    }
+    free(keys);
+    free(values);
+}
+
+void partitionMap_insert(PartitionMap *map, stRPPartition key, void *value) {
+    assert(value != NULL);
+    uint64_t i = partitionMap_getSlot(map, key);
+    if (map->values[i] == NULL) {
+        if (2 * (uint64_t) (map->size + 1) > map->mask + 1) {
+            partitionMap_resize(map, 2 * (map->mask + 1));
+            i = partitionMap_getSlot(map, key);
+        }
+        map->keys[i] = key;
+        map->size++;
+    }
+    map->values[i] = value;
+}
+
+void *partitionMap_remove(PartitionMap *map, stRPPartition key) {
+    uint64_t i = partitionMap_getSlot(map, key);
+    void *value = map->values[i];
+    if (value == NULL) {
+        return NULL;
+    }
+    map->values[i] = NULL;
+    map->size--;
+
+    // shift back the following entries of the probe run that would no longer be found past the emptied slot
+    for (uint64_t j = (i + 1) & map->mask; map->values[j] != NULL; j = (j + 1) & map->mask) {
+        uint64_t k = partitionMap_hash(map->keys[j]) & map->mask;
+        // the entry can move to i if its home slot k is not cyclically in (i, j]
+        if (i <= j ? (k <= i || k > j) : (k <= i && k > j)) {
+            map->keys[i] = map->keys[j];
+            map->values[i] = map->values[j];
+            map->values[j] = NULL;
+            i = j;
+        }
+    }
+    return value;
+}
+
+void *partitionMap_getNext(PartitionMap *map, uint64_t *slot) {
+    while (*slot <= map->mask) {
+        void *value = map->values[(*slot)++];
+        if (value != NULL) {
+            return value;
+        }
+    }
+    return NULL;
+}
+
+stList *partitionMap_getValues(PartitionMap *map) {
+    stList *values = stList_construct();
+    uint64_t slot = 0;
+    void *value;
+    while ((value = partitionMap_getNext(map, &slot)) != NULL) {
+        stList_append(values, value);
+    }
+    return values;
+}
@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2020 by Benedict Paten (benedictpaten@gmail.com)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include "margin.h"
+
+/*
+ * Functions to phase a chunk of reads against the variants of a vcf, shared by the phase and cohort commands.
+ */
+
+PhaseChunkInput *phaseChunkInput_construct(BamChunk *bamChunk, char *referenceFastaFile, stHash *vcfEntries,
+                                           Params *params) {
+    PhaseChunkInput *input = st_malloc(sizeof(PhaseChunkInput));
+
+    // Get reference string for chunk of alignment
+    input->chunkReference = getSequenceFromReference(referenceFastaFile, bamChunk->refSeqName,
+                                                     bamChunk->chunkOverlapStart, bamChunk->chunkOverlapEnd);
+
+    // get VCF string
+    input->chunkVcfEntries = getVcfEntriesForRegion(vcfEntries, NULL, bamChunk->refSeqName,
+                                                    bamChunk->chunkOverlapStart, bamChunk->chunkOverlapEnd, params);
+    updateVcfEntriesWithSubstringsAndPositions(input->chunkVcfEntries, input->chunkReference,
+                                               strlen(input->chunkReference), FALSE, params);
+
+    // Convert bam lines into corresponding reads and alignments
+    input->reads = stList_construct3(0, (void (*)(void *)) bamChunkRead_destruct);
+    input->filteredReads = stList_construct3(0, (void (*)(void *)) bamChunkRead_destruct);
+    extractReadSubstringsAtVariantPositions(bamChunk, input->chunkVcfEntries, input->reads, input->filteredReads,
+                                            params->polishParams);
+    return input;
+}
+
+int64_t phaseChunk(BamChunker *bamChunker, int64_t chunkIdx, PhaseChunkInput *input, uint64_t maxDepth,
+                   OverlapSupportCache *overlapSupportCache, stHash *journaledVcfEntries,
+                   OutputChunkers *outputChunkers, int64_t threadIdx, Params *params, char *logIdentifier) {
+    BamChunk *bamChunk = bamChunker_getChunk(bamChunker, chunkIdx);
+    char *chunkReference = input->chunkReference;
+    stList *chunkVcfEntries = input->chunkVcfEntries;
+    stList *reads = input->reads;
+    stList *filteredReads = input->filteredReads;
+    free(input);
+
+    // do downsampling if appropriate
+    if (maxDepth > 0) {
+        // get downsampling structures
+        stList *maintainedReads = stList_construct3(0, (void (*)(void *)) bamChunkRead_destruct);
+
+        bool didDownsample = downsampleBamChunkReadWithVcfEntrySubstringsViaFullReadLengthLikelihood(
+                maxDepth, bamChunk, chunkVcfEntries, reads, maintainedReads, filteredReads);
+
+        // we need to destroy the discarded reads and structures
+        if (didDownsample) {
+            logBuffer_info(" %s Downsampled from %"PRId64" to %"PRId64" reads\n", logIdentifier,
+                           stList_length(reads), stList_length(maintainedReads));
+            // still has all the old reads, need to not free these
+            stList_setDestructor(reads, NULL);
+            stList_destruct(reads);
+            // and keep the filtered reads
+            reads = maintainedReads;
+        }
+            // no downsampling, we just need to free the (empty) objects
+        else {
+            assert(stList_length(maintainedReads) == 0);
+            stList_destruct(maintainedReads);
+        }
+    }
+
+    time_t primaryPhasingStart = time(NULL);
+
+    // Get the bubble graph representation
+    stList *vcfEntriesToBubbles = NULL;
+    stHash *readsToPSeqs = NULL;
+    stSet *readsBelongingToHap1 = NULL, *readsBelongingToHap2 = NULL;
+    chunkTelemetry_addCount(CTC_READS, stList_length(reads));
+    chunkTelemetry_startStage(CTS_BUBBLE_GRAPH);
+    BubbleGraph *bg = bubbleGraph_constructFromVCFAndBamChunkReadVcfEntrySubstrings2(reads, chunkVcfEntries, bamChunk,
+            overlapSupportCache, params, &vcfEntriesToBubbles);
+    chunkTelemetry_endStage(CTS_BUBBLE_GRAPH);
+    chunkTelemetry_addCount(CTC_BUBBLES, bg->bubbleNo);
+
+    // Now make a POA for each of the haplotypes
+    chunkTelemetry_startStage(CTS_PHASING);
+    stReference *ref = bubbleGraph_getReference(bg, bamChunk->refSeqName, params);
+    stGenomeFragment *gf = bubbleGraph_phaseBubbleGraph(bg, ref, reads, params, &readsToPSeqs);
+
+    stGenomeFragment_phaseBamChunkReads(gf, readsToPSeqs, reads, &readsBelongingToHap1, &readsBelongingToHap2,
+                                        params->phaseParams);
+    chunkTelemetry_endStage(CTS_PHASING);
+    logBuffer_info(" %s After phasing, of %i reads got %i reads partitioned into hap1 and %i reads partitioned "
+                   "into hap2 (%i unphased)\n", logIdentifier, (int) stList_length(reads),
+                   (int) stSet_size(readsBelongingToHap1), (int) stSet_size(readsBelongingToHap2),
+                   (int) (stList_length(reads) - stSet_size(readsBelongingToHap1) -
+                      stSet_size(readsBelongingToHap2)));
+
+    logBuffer_info(" %s Phased primary reads in %d sec\n", logIdentifier, time(NULL) - primaryPhasingStart);
+
+    // should included filtered reads in output
+    // get reads
+    for (int64_t bcrIdx = 0; bcrIdx < stList_length(reads); bcrIdx++) {
+        BamChunkRead *bcr = stList_get(reads, bcrIdx);
+        if (!stSet_search(readsBelongingToHap1, bcr) && !stSet_search(readsBelongingToHap2, bcr)) {
+            // was filtered in some form
+            stList_append(filteredReads, bamChunkRead_constructCopy(bcr));
+        }
+    }
+    logBuffer_info(" %s Assigning %"PRId64" filtered reads to haplotypes\n", logIdentifier,
+                   stList_length(filteredReads));
+
+    time_t filteredPhasingStart = time(NULL);
+
+    chunkTelemetry_startStage(CTS_PHASING);
+    bubbleGraph_partitionFilteredReadsFromVcfEntries(filteredReads, gf, bg, vcfEntriesToBubbles, readsBelongingToHap1,
+            readsBelongingToHap2, params, logIdentifier);
+    chunkTelemetry_endStage(CTS_PHASING);
+    logBuffer_info(" %s Partitioned filtered reads in %d sec.\n", logIdentifier, time(NULL) - filteredPhasingStart);
+
+    // once assigned, the filtered reads are only needed by name
+    for (int64_t bcrIdx = 0; bcrIdx < stList_length(filteredReads); bcrIdx++) {
+        bamChunkRead_destructSequence(stList_get(filteredReads, bcrIdx));
+    }
+
+    // save, before the output as with online stitching the chunk's vcf entries may be written on stitching
+    // only use primary reads (not filteredReads) to track read phasing
+    updateOriginalVcfEntriesWithBubbleData(bamChunk, bamChunker->readEnumerator, gf, bg,
+            vcfEntriesToBubbles, readsBelongingToHap1, readsBelongingToHap2, logIdentifier);
+    if (journaledVcfEntries != NULL) {
+        size_t chunkPhasingLength;
+        char *chunkPhasing = getChunkPhasingOfVcfEntries(bamChunk, journaledVcfEntries, &chunkPhasingLength);
+        outputChunkers_journalChunkData(outputChunkers, chunkIdx, chunkPhasing, chunkPhasingLength);
+        free(chunkPhasing);
+    }
+
+    // Output
+    chunkTelemetry_startStage(CTS_STITCH);
+    outputChunkers_processChunkSequencePhased(outputChunkers, threadIdx, chunkIdx, bamChunk->refSeqName,
+                                              NULL, NULL, reads, readsBelongingToHap1, readsBelongingToHap2, gf,
+                                              params);
+    chunkTelemetry_endStage(CTS_STITCH);
+    int64_t readNo = stList_length(reads) + stList_length(filteredReads);
+
+    // Cleanup
+    if (chunkVcfEntries != NULL) stList_destruct(chunkVcfEntries);
+    stSet_destruct(readsBelongingToHap1);
+    stSet_destruct(readsBelongingToHap2);
+    bubbleGraph_destruct(bg);
+    stGenomeFragment_destruct(gf);
+    stReference_destruct(ref);
+    stHash_destruct(readsToPSeqs);
+    stList_destruct(vcfEntriesToBubbles);
+    stList_destruct(reads);
+    stList_destruct(filteredReads);
+    free(chunkReference);
+
+    return readNo;
+}
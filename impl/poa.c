@@ -18,23 +18,9 @@ char *getLogIdentifier() {
     return logIdentifier;
 }
 
-PoaBaseObservation *poaBaseObservation_construct(int64_t readNo, int64_t offset, double weight) {
-    PoaBaseObservation *poaBaseObservation = st_calloc(1, sizeof(PoaBaseObservation));
-
-    poaBaseObservation->readNo = readNo;
-    poaBaseObservation->offset = offset;
-    poaBaseObservation->weight = weight;
-
-    return poaBaseObservation;
-}
-
-void poaBaseObservation_destruct(PoaBaseObservation *poaBaseObservation) {
-    free(poaBaseObservation);
-}
-
 PoaInsert *poaInsert_construct(RleString *insert, double weight, bool strand) {
-    PoaInsert *poaInsert = st_calloc(1, sizeof(PoaInsert));
-    poaInsert->observations = stList_construct3(0, (void (*)(void *)) poaBaseObservation_destruct);
+    PoaInsert *poaInsert = chunkArena_calloc(1, sizeof(PoaInsert));
+    poaInsert->observations = stList_construct(); // Observations are held by the poa's observation arena
 
     poaInsert->insert = insert;
     if (strand) {
@@ -49,7 +35,7 @@ PoaInsert *poaInsert_construct(RleString *insert, double weight, bool strand) {
 void poaInsert_destruct(PoaInsert *poaInsert) {
     stList_destruct(poaInsert->observations);
     rleString_destruct(poaInsert->insert);
-    free(poaInsert);
+    chunkArena_free(poaInsert);
 }
 
 double poaInsert_getWeight(PoaInsert *insert) {
@@ -58,8 +44,8 @@ double poaInsert_getWeight(PoaInsert *insert) {
 }
 
 PoaDelete *poaDelete_construct(int64_t length, double weight, bool strand) {
-    PoaDelete *poaDelete = st_calloc(1, sizeof(PoaDelete));
-    poaDelete->observations = stList_construct3(0, (void (*)(void *)) poaBaseObservation_destruct);
+    PoaDelete *poaDelete = chunkArena_calloc(1, sizeof(PoaDelete));
+    poaDelete->observations = stList_construct(); // Observations are held by the poa's observation arena
 
     poaDelete->length = length;
     if (strand) {
@@ -73,7 +59,7 @@ PoaDelete *poaDelete_construct(int64_t length, double weight, bool strand) {
 
 void poaDelete_destruct(PoaDelete *poaDelete) {
     stList_destruct(poaDelete->observations);
-    free(poaDelete);
+    chunkArena_free(poaDelete);
 }
 
 double poaDelete_getWeight(PoaDelete *delete) {
@@ -82,7 +68,7 @@ double poaDelete_getWeight(PoaDelete *delete) {
 }
 
 PoaNode *poaNode_construct(Poa *poa, char base, uint64_t repeatCount) {
-    PoaNode *poaNode = st_calloc(1, sizeof(PoaNode));
+    PoaNode *poaNode = chunkArena_calloc(1, sizeof(PoaNode));
 
     // for when people put crazy characters in their reference
     if (poa->alphabet->convertSymbolToChar(poa->alphabet->convertCharToSymbol(base)) == 'N') {
@@ -93,9 +79,9 @@ PoaNode *poaNode_construct(Poa *poa, char base, uint64_t repeatCount) {
     poaNode->deletes = stList_construct3(0, (void (*)(void *)) poaDelete_destruct);
     poaNode->base = base;
     poaNode->repeatCount = repeatCount;
-    poaNode->baseWeights = st_calloc(poa->alphabet->alphabetSize, sizeof(double)); // Encoded using Symbol enum
-    poaNode->repeatCountWeights = st_calloc(poa->maxRepeatCount, sizeof(double));
-    poaNode->observations = stList_construct3(0, (void (*)(void *)) poaBaseObservation_destruct);
+    poaNode->baseWeights = chunkArena_calloc(poa->alphabet->alphabetSize, sizeof(double)); // Encoded using Symbol enum
+    poaNode->repeatCountWeights = chunkArena_calloc(poa->maxRepeatCount, sizeof(double));
+    poaNode->observations = stList_construct(); // Observations are held by the poa's observation arena
 
     return poaNode;
 }
@@ -104,9 +90,15 @@ void poaNode_destruct(PoaNode *poaNode) {
     stList_destruct(poaNode->inserts);
     stList_destruct(poaNode->deletes);
     stList_destruct(poaNode->observations);
-    free(poaNode->baseWeights);
-    free(poaNode->repeatCountWeights);
-    free(poaNode);
+    if (poaNode->insertIndex != NULL) {
+        stSet_destruct(poaNode->insertIndex);
+    }
+    if (poaNode->deleteIndex != NULL) {
+        stSet_destruct(poaNode->deleteIndex);
+    }
+    chunkArena_free(poaNode->baseWeights);
+    chunkArena_free(poaNode->repeatCountWeights);
+    chunkArena_free(poaNode);
 }
 
 Poa *poa_getReferenceGraph(RleString *reference, Alphabet *alphabet, uint64_t maxRepeatCount) {
@@ -120,18 +112,107 @@ Poa *poa_getReferenceGraph(RleString *reference, Alphabet *alphabet, uint64_t ma
     stList_append(poa->nodes, poaNode_construct(poa, 'N', 1)); // Add empty prefix node
     for (int64_t i = 0; i < reference->length; i++) {
         stList_append(poa->nodes,
-                poaNode_construct(poa, (char) toupper(reference->rleString[i]), reference->repeatCounts[i]));
+                poaNode_construct(poa, (char) toupper(reference->rleString[i]), rleString_getRepeatCount(reference, i)));
     }
 
     return poa;
 }
 
 void poa_destruct(Poa *poa) {
+    chunkTelemetry_addCount(CTC_POA_OBSERVATIONS, poa->stagedObservationNo);
     rleString_destruct(poa->refString);
     stList_destruct(poa->nodes);
+    free(poa->observations);
+    free(poa->nodeObservationOffsets);
+    free(poa->stagedObservations);
     free(poa);
 }
 
+/*
+ * Adds an observation to the given list of observations of a node, insert or delete of the poa. Until
+ * poa_buildObservationArena is called the observation is held in the poa's staged observations and the list holds its
+ * index, tagged by setting the low bit, which no pointer to an observation has.
+ */
+static void poa_addObservation(Poa *poa, stList *observations, int64_t readNo, int64_t offset, double weight) {
+    if (poa->stagedObservationNo == poa->maxStagedObservationNo) {
+        poa->maxStagedObservationNo = poa->maxStagedObservationNo < 64 ? 64 : poa->maxStagedObservationNo * 2;
+        poa->stagedObservations = st_realloc(poa->stagedObservations,
+                                             sizeof(PoaBaseObservation) * poa->maxStagedObservationNo);
+    }
+    PoaBaseObservation *obs = &poa->stagedObservations[poa->stagedObservationNo];
+    obs->readNo = readNo;
+    obs->offset = offset;
+    obs->weight = weight;
+    stList_append(observations, (void *) ((uintptr_t) poa->stagedObservationNo++ << 1 | 1));
+}
+
+/*
+ * Copies the observations of the list into the arena, starting from index j, and points the list at them. Returns
+ * the index following the last observation copied.
+ */
+static int64_t poa_moveObservationsToArena(Poa *poa, stList *observations, PoaBaseObservation *arena, int64_t j) {
+    for (int64_t k = 0; k < stList_length(observations); k++) {
+        uintptr_t o = (uintptr_t) stList_get(observations, k);
+        arena[j] = o & 1 ? poa->stagedObservations[o >> 1] : *(PoaBaseObservation *) o;
+        stList_set(observations, k, &arena[j++]);
+    }
+    return j;
+}
+
+void poa_buildObservationArena(Poa *poa) {
+    if (poa->nodeObservationOffsets != NULL && poa->stagedObservationNo == 0) {
+        return; // Nothing has been added since the arena was last built
+    }
+
+    // Count the observations
+    int64_t observationNo = 0;
+    for (int64_t i = 0; i < stList_length(poa->nodes); i++) {
+        PoaNode *node = stList_get(poa->nodes, i);
+        observationNo += stList_length(node->observations);
+        for (int64_t j = 0; j < stList_length(node->inserts); j++) {
+            observationNo += stList_length(((PoaInsert *) stList_get(node->inserts, j))->observations);
+        }
+        for (int64_t j = 0; j < stList_length(node->deletes); j++) {
+            observationNo += stList_length(((PoaDelete *) stList_get(node->deletes, j))->observations);
+        }
+    }
+
+    // Lay out each node's observations, followed by those of its inserts and deletes
+    PoaBaseObservation *arena = st_malloc(sizeof(PoaBaseObservation) * (observationNo > 0 ? observationNo : 1));
+    int64_t *nodeObservationOffsets = st_malloc(sizeof(int64_t) * (stList_length(poa->nodes) + 1));
+    int64_t j = 0;
+    for (int64_t i = 0; i < stList_length(poa->nodes); i++) {
+        PoaNode *node = stList_get(poa->nodes, i);
+        nodeObservationOffsets[i] = j;
+        j = poa_moveObservationsToArena(poa, node->observations, arena, j);
+        for (int64_t k = 0; k < stList_length(node->inserts); k++) {
+            j = poa_moveObservationsToArena(poa, ((PoaInsert *) stList_get(node->inserts, k))->observations, arena, j);
+        }
+        for (int64_t k = 0; k < stList_length(node->deletes); k++) {
+            j = poa_moveObservationsToArena(poa, ((PoaDelete *) stList_get(node->deletes, k))->observations, arena, j);
+        }
+    }
+    assert(j == observationNo);
+    nodeObservationOffsets[stList_length(poa->nodes)] = j;
+
+    // Replace any existing arena and clear the staged observations, which are counted as they are
+    chunkTelemetry_addCount(CTC_POA_OBSERVATIONS, poa->stagedObservationNo);
+    free(poa->observations);
+    free(poa->nodeObservationOffsets);
+    free(poa->stagedObservations);
+    poa->observations = arena;
+    poa->nodeObservationOffsets = nodeObservationOffsets;
+    poa->stagedObservations = NULL;
+    poa->stagedObservationNo = 0;
+    poa->maxStagedObservationNo = 0;
+}
+
+PoaBaseObservation *poa_getNodeObservations(Poa *poa, int64_t nodeIndex, int64_t *observationNo) {
+    poa_buildObservationArena(poa);
+    *observationNo = stList_length(((PoaNode *) stList_get(poa->nodes, nodeIndex))->observations);
+    return &poa->observations[poa->nodeObservationOffsets[nodeIndex]];
+}
+
 int cmpAlignedPairsByCoordinates(const void *a, const void *b) {
     /*
      * Compares aligned pairs, represented as stIntTuples of the form (weight, x, y) first by
@@ -165,63 +246,144 @@ int cmpAlignedPairsByInvertedCoordinates(const void *a, const void *b) {
     return i;
 }
 
-bool isMatch(stSortedSet *matchesSet, int64_t x, int64_t y) {
-    stIntTuple pair[4];
-    pair[0] = 3;
-    pair[2] = x;
-    pair[3] = y;
-    return stSortedSet_search(matchesSet, &pair) != NULL;
+/*
+ * Number of distinct inserts or deletes a node must have before they are looked up using a hash rather than a scan
+ * of the node's list.
+ */
+#define POA_GAP_INDEX_MIN_LENGTH 8
+
+static uint64_t poaInsert_hashKey(const void *k) {
+    return rleString_hash(((PoaInsert *) k)->insert);
+}
+
+static int poaInsert_equalKey(const void *k1, const void *k2) {
+    return rleString_eq(((PoaInsert *) k1)->insert, ((PoaInsert *) k2)->insert);
+}
+
+static uint64_t poaDelete_hashKey(const void *k) {
+    return (uint64_t) ((PoaDelete *) k)->length;
 }
 
-static void
-addToInserts(PoaNode *node, RleString *insert, double weight, bool strand, PoaBaseObservation *observation) {
+static int poaDelete_equalKey(const void *k1, const void *k2) {
+    return ((PoaDelete *) k1)->length == ((PoaDelete *) k2)->length;
+}
+
+static stSet *getGapIndex(stList *gaps, uint64_t (*hashKey)(const void *), int (*equalKey)(const void *, const void *)) {
     /*
-     * Add given insert to node.
+     * Makes a set of the given inserts or deletes, used to find them without scanning the list.
      */
+    stSet *index = stSet_construct3(hashKey, equalKey, NULL);
+    for (int64_t m = 0; m < stList_length(gaps); m++) {
+        stSet_insert(index, stList_get(gaps, m));
+    }
+    return index;
+}
 
+static void poa_destructGapIndices(Poa *poa) {
+    /*
+     * Frees the indices of inserts and deletes made while adding reads to the poa.
+     */
+    for (int64_t i = 0; i < stList_length(poa->nodes); i++) {
+        PoaNode *node = stList_get(poa->nodes, i);
+        if (node->insertIndex != NULL) {
+            stSet_destruct(node->insertIndex);
+            node->insertIndex = NULL;
+        }
+        if (node->deleteIndex != NULL) {
+            stSet_destruct(node->deleteIndex);
+            node->deleteIndex = NULL;
+        }
+    }
+}
+
+static PoaInsert *poaNode_getInsert(PoaNode *node, RleString *insert) {
+    /*
+     * Gets the insert of the node with the given string, adding it with zero weight if it has none.
+     */
     PoaInsert *poaInsert = NULL;
-    // Check if the complete insert is already in the poa graph:
-    for (int64_t m = 0; m < stList_length(node->inserts); m++) {
-        PoaInsert *tmp = stList_get(node->inserts, m);
-        if (rleString_eq(tmp->insert, insert)) {
-            poaInsert = tmp;
-            break;
+    // Check if the complete insert is already in the poa graph, using the node's index if it has many inserts:
+    if (node->insertIndex == NULL && stList_length(node->inserts) >= POA_GAP_INDEX_MIN_LENGTH) {
+        node->insertIndex = getGapIndex(node->inserts, poaInsert_hashKey, poaInsert_equalKey);
+    }
+    if (node->insertIndex != NULL) {
+        PoaInsert query;
+        query.insert = insert;
+        poaInsert = stSet_search(node->insertIndex, &query);
+    } else {
+        for (int64_t m = 0; m < stList_length(node->inserts); m++) {
+            PoaInsert *tmp = stList_get(node->inserts, m);
+            if (rleString_eq(tmp->insert, insert)) {
+                poaInsert = tmp;
+                break;
+            }
         }
     }
     // otherwise create and save it
     if (poaInsert == NULL) {
         poaInsert = poaInsert_construct(rleString_copy(insert), 0, FALSE);
         stList_append(node->inserts, poaInsert);
+        if (node->insertIndex != NULL) {
+            stSet_insert(node->insertIndex, poaInsert);
+        }
     }
-
-    // update with (stranded) weight and observation
-    if (strand) {
-        poaInsert->weightForwardStrand += weight;
-    } else {
-        poaInsert->weightReverseStrand += weight;
-    }
-    stList_append(poaInsert->observations, observation);
+    return poaInsert;
 }
 
-static void addToDeletes(PoaNode *node, int64_t length, double weight, bool strand, PoaBaseObservation *observation) {
+static PoaDelete *poaNode_getDelete(PoaNode *node, int64_t length) {
     /*
-     * Add given deletion to node.
+     * Gets the delete of the node of the given length, adding it with zero weight if it has none.
      */
-
     PoaDelete *poaDelete = NULL;
-    // Check if the delete is already in the poa graph:
-    for (int64_t m = 0; m < stList_length(node->deletes); m++) {
-        PoaDelete *tmp = stList_get(node->deletes, m);
-        if (tmp->length == length) {
-            poaDelete = tmp;
-            break;
+    // Check if the delete is already in the poa graph, using the node's index if it has many deletes:
+    if (node->deleteIndex == NULL && stList_length(node->deletes) >= POA_GAP_INDEX_MIN_LENGTH) {
+        node->deleteIndex = getGapIndex(node->deletes, poaDelete_hashKey, poaDelete_equalKey);
+    }
+    if (node->deleteIndex != NULL) {
+        PoaDelete query;
+        query.length = length;
+        poaDelete = stSet_search(node->deleteIndex, &query);
+    } else {
+        for (int64_t m = 0; m < stList_length(node->deletes); m++) {
+            PoaDelete *tmp = stList_get(node->deletes, m);
+            if (tmp->length == length) {
+                poaDelete = tmp;
+                break;
+            }
         }
     }
     // otherwise create and save it
     if (poaDelete == NULL) {
         poaDelete = poaDelete_construct(length, 0, FALSE);
         stList_append(node->deletes, poaDelete);
+        if (node->deleteIndex != NULL) {
+            stSet_insert(node->deleteIndex, poaDelete);
+        }
     }
+    return poaDelete;
+}
+
+static void addToInserts(Poa *poa, PoaNode *node, RleString *insert, double weight, bool strand, int64_t readNo,
+                         int64_t offset) {
+    /*
+     * Add given insert to node.
+     */
+    PoaInsert *poaInsert = poaNode_getInsert(node, insert);
+
+    // update with (stranded) weight and observation
+    if (strand) {
+        poaInsert->weightForwardStrand += weight;
+    } else {
+        poaInsert->weightReverseStrand += weight;
+    }
+    poa_addObservation(poa, poaInsert->observations, readNo, offset, weight);
+}
+
+static void addToDeletes(Poa *poa, PoaNode *node, int64_t length, double weight, bool strand, int64_t readNo,
+                         int64_t offset) {
+    /*
+     * Add given deletion to node.
+     */
+    PoaDelete *poaDelete = poaNode_getDelete(node, length);
 
     // update with (stranded) weight and observation
     if (strand) {
@@ -229,41 +391,88 @@ static void addToDeletes(PoaNode *node, int64_t length, double weight, bool stra
     } else {
         poaDelete->weightReverseStrand += weight;
     }
-    stList_append(poaDelete->observations, observation);
+    poa_addObservation(poa, poaDelete->observations, readNo, offset, weight);
 }
 
-static bool matchesReferenceSubstring(RleString *refString, int64_t refStart, RleString *str, int64_t length,
-                                      bool compareRepeatCounts) {
+static inline PoaNode *poa_getAugmentedNode(Poa *poa, int64_t i) {
     /*
-     * Returns true if the given string str matches the given reference substring starting
-     * from the given reference position, refStart. Optionally also compares the repeat lengths for equality also.
+     * Gets the i-th node of the poa, to add a read's weights to. The nodes of a partial poa are made as they are first
+     * needed.
      */
+    PoaNode *node = stList_get(poa->nodes, i);
+    if (node == NULL) {
+        node = i == 0 ? poaNode_construct(poa, 'N', 1) :
+               poaNode_construct(poa, (char) toupper(poa->refString->rleString[i - 1]),
+                                 rleString_getRepeatCount(poa->refString, i - 1));
+        stList_set(poa->nodes, i, node);
+    }
+    return node;
+}
+
+static bool repeatCountsMatch(RleString *str1, int64_t start1, RleString *str2, int64_t start2, int64_t length) {
+    /*
+     * Returns true if the repeat counts of the length positions of str1 from start1 equal those of str2 from start2.
+     */
+    if (str1->repeatCounts != NULL && str2->repeatCounts != NULL &&
+        memcmp(str1->repeatCounts + start1, str2->repeatCounts + start2, length) == 0 &&
+        str1->overflowLength == 0 && str2->overflowLength == 0) {
+        return 1;
+    }
+    if (str1->repeatCounts == NULL && str2->repeatCounts == NULL) {
+        return 1;
+    }
     for (int64_t l = 0; l < length; l++) {
-        if (refString->rleString[refStart + l] != str->rleString[l] ||
-            (compareRepeatCounts && refString->repeatCounts[refStart + l] != str->repeatCounts[l])) {
+        if (rleString_getRepeatCount(str1, start1 + l) != rleString_getRepeatCount(str2, start2 + l)) {
             return 0;
         }
     }
     return 1;
 }
 
-static bool hasInternalRepeat(RleString *str, int64_t repeatLength, bool compareRepeatCounts) {
+static bool matchesReferenceSubstring(RleString *refString, int64_t refStart, RleString *str, int64_t length,
+                                      bool compareRepeatCounts) {
     /*
-     * Establishes if str has an internal repeat of length repeatLength.
-     * e.g. if ATATAT, internal repeat AT (length 2) is an internal repeat, but ATA is not.
+     * Returns true if the given string str matches the given reference substring starting
+     * from the given reference position, refStart. Optionally also compares the repeat lengths for equality also.
      */
-    if (str->length % repeatLength != 0) { // If not divisible by repeatLength then can not be repeat
-        return 0;
-    }
-    for (int64_t i = repeatLength; i < str->length; i += repeatLength) {
-        for (int64_t j = 0; j < repeatLength; j++) {
-            if (str->rleString[j] != str->rleString[j + i] ||
-                (compareRepeatCounts && str->repeatCounts[j] != str->repeatCounts[j + i])) {
-                return 0;
-            }
+    return memcmp(refString->rleString + refStart, str->rleString, length) == 0 &&
+           (!compareRepeatCounts || repeatCountsMatch(refString, refStart, str, 0, length));
+}
+
+static inline bool rleString_positionsMatch(RleString *str, int64_t i, int64_t j, bool compareRepeatCounts) {
+    return str->rleString[i] == str->rleString[j] &&
+           (!compareRepeatCounts || rleString_getRepeatCount(str, i) == rleString_getRepeatCount(str, j));
+}
+
+// Strings up to this length have the prefix function of getMinimalRepeatLength on the stack
+#define MINIMAL_REPEAT_STACK_LENGTH 128
+
+static int64_t getMinimalRepeatLength(RleString *str, bool compareRepeatCounts) {
+    /*
+     * Returns the length of the shortest string of which str is a whole number of repeats.
+     * e.g. if ATATAT, the minimal internal repeat is AT (length 2), if AAAAAAA it is A, and if ATA it is ATA.
+     * The longest proper prefix that is also a suffix of str, from the prefix function, leaves the shortest period,
+     * which is a repeat of str if it divides its length, in time linear in the length of str.
+     */
+    int64_t n = str->length;
+    if (n <= 1) {
+        return 1;
+    }
+    int64_t stackPrefixLengths[MINIMAL_REPEAT_STACK_LENGTH];
+    int64_t *prefixLengths = n <= MINIMAL_REPEAT_STACK_LENGTH ? stackPrefixLengths : st_malloc(n * sizeof(int64_t));
+    prefixLengths[0] = 0;
+    for (int64_t i = 1; i < n; i++) {
+        int64_t k = prefixLengths[i - 1];
+        while (k > 0 && !rleString_positionsMatch(str, i, k, compareRepeatCounts)) {
+            k = prefixLengths[k - 1];
         }
+        prefixLengths[i] = rleString_positionsMatch(str, i, k, compareRepeatCounts) ? k + 1 : k;
     }
-    return 1;
+    int64_t period = n - prefixLengths[n - 1];
+    if (prefixLengths != stackPrefixLengths) {
+        free(prefixLengths);
+    }
+    return n % period == 0 ? period : n;
 }
 
 int64_t getShift(RleString *refString, int64_t refStart, RleString *str, bool compareRepeatCounts) {
@@ -272,12 +481,7 @@ int64_t getShift(RleString *refString, int64_t refStart, RleString *str, bool co
     // Establish minimal internal repeat length
     // if ATATAT, minimal internal repeat is AT,
     // similarly if AAAAAAA then minimal internal repeat is A
-    int64_t minRepeatLength = 0;
-    while (minRepeatLength++ < str->length) {
-        if (hasInternalRepeat(str, minRepeatLength, compareRepeatCounts)) {
-            break;
-        }
-    }
+    int64_t minRepeatLength = getMinimalRepeatLength(str, compareRepeatCounts);
 
     // Now walk back by multiples of minimal internal repeat length
     for (int64_t k = refStart - minRepeatLength; k >= 0; k -= minRepeatLength) {
@@ -305,7 +509,7 @@ int64_t getMaxCommonSuffixLength(RleString *str1, int64_t length1, RleString *st
     int64_t i = 0;
     while (length1 - i - 1 >= 0 && (int64_t) str2->length - i - 1 >= 0) {
         if (str1->rleString[length1 - 1 - i] != str2->rleString[str2->length - 1 - i] ||
-            (compareRepeatCounts && str1->repeatCounts[length1 - 1 - i] != str2->repeatCounts[str2->length - 1 - i])) {
+            (compareRepeatCounts && rleString_getRepeatCount(str1, length1 - 1 - i) != rleString_getRepeatCount(str2, str2->length - 1 - i))) {
             break;
         }
         i++;
@@ -314,66 +518,56 @@ int64_t getMaxCommonSuffixLength(RleString *str1, int64_t length1, RleString *st
     return i;
 }
 
-void poa_augment(Poa *poa, RleString *read, bool readStrand, int64_t readNo, stList *matches, stList *inserts,
-                 stList *deletes,
-                 PolishParams *polishParams) {
+void poa_augmentPacked(Poa *poa, RleString *read, bool readStrand, int64_t readNo, AlignedPairs *matches,
+                       AlignedPairs *inserts, AlignedPairs *deletes, PolishParams *polishParams) {
     // Add weights of matches to the POA graph
 
     // For each match in alignment subgraph identify its corresponding node in the POA graph
     // add the weight of the match to the POA node
-    for (int64_t i = 0; i < stList_length(matches); i++) {
-        stIntTuple *match = stList_get(matches, i);
-
-        PoaNode *node = stList_get(poa->nodes, stIntTuple_get(match, 1) + 1); // Get corresponding POA node
+    for (int64_t i = 0; i < matches->length; i++) {
+        PoaNode *node = poa_getAugmentedNode(poa, matches->x[i] + 1); // Get corresponding POA node
 
         // Add base weight to POA node
-        int64_t j = stIntTuple_get(match, 2), weight = stIntTuple_get(match, 0);
+        int64_t j = matches->y[i], weight = matches->weight[i];
         assert(poa->alphabet->convertCharToSymbol(read->rleString[j]) < poa->alphabet->alphabetSize);
         node->baseWeights[poa->alphabet->convertCharToSymbol(read->rleString[j])] += weight;
-        assert(read->repeatCounts[j] >= 0);
-        int64_t rc = read->repeatCounts[j] < poa->maxRepeatCount ? read->repeatCounts[j] : poa->maxRepeatCount - 1;
+        assert(rleString_getRepeatCount(read, j) >= 0);
+        int64_t rc = rleString_getRepeatCount(read, j) < poa->maxRepeatCount ? rleString_getRepeatCount(read, j) : poa->maxRepeatCount - 1;
         node->repeatCountWeights[rc] += weight;
 
         // PoaObservation
-        stList_append(node->observations,
-                      poaBaseObservation_construct(readNo, stIntTuple_get(match, 2), stIntTuple_get(match, 0)));
+        poa_addObservation(poa, node->observations, readNo, j, weight);
     }
 
-    // Create a set of match coordinates
+    // Sort the matches, so the match coordinates can be searched
 
-    stSortedSet *matchesSet = stSortedSet_construct3(cmpAlignedPairsByCoordinates, NULL);
-    for (int64_t i = 0; i < stList_length(matches); i++) {
-        stIntTuple *match = stList_get(matches, i);
-
-        assert(stSortedSet_search(matchesSet, match) == NULL);
-        stSortedSet_insert(matchesSet, match); // Add to matches
-    }
+    alignedPairs_sortByCoordinates(matches);
 
     // Add inserts to the POA graph
 
     // Sort the inserts first by the reference coordinate and then by read coordinate
-    stList_sort(inserts, cmpAlignedPairsByCoordinates);
+    alignedPairs_sortByCoordinates(inserts);
 
     // Let a complete-insert be a sequence of inserts with the same reference coordinate i
     // and consecutive read coordinates j, j+1, ..., j+n, such that the i,j-1 is a match or equal to (-1,-1) (the beginning)
     // in the alignment subgraph and i+1,j+n+1 is similarly a match or equal to (N, M) (the end of the alignment).
 
     // Enumerate set of complete inserts
-    for (int64_t i = 0; i < stList_length(inserts);) {
+    for (int64_t i = 0; i < inserts->length;) {
 
-        stIntTuple *insertStart = stList_get(inserts, i); // Start of putative complete-insert
+        // i is the start of putative complete-insert
+        int64_t insertStartX = inserts->x[i], insertStartY = inserts->y[i];
 
         int64_t j = i + 1;
-        for (; j < stList_length(inserts); j++) {
-            stIntTuple *insertEnd = stList_get(inserts, j); // End of putative complete-insert
+        for (; j < inserts->length; j++) { // j is the end of putative complete-insert
 
             // If they don't have the same reference coordinate then not part of same complete-insert
-            if (stIntTuple_get(insertStart, 1) != stIntTuple_get(insertEnd, 1)) {
+            if (insertStartX != inserts->x[j]) {
                 break;
             }
 
             // If they don't form a contiguous sequence of read coordinates then not part of same complete-insert
-            if (stIntTuple_get(insertStart, 2) + j - i != stIntTuple_get(insertEnd, 2)) {
+            if (insertStartY + j - i != inserts->y[j]) {
                 break;
             }
         }
@@ -386,39 +580,36 @@ void poa_augment(Poa *poa, RleString *read, bool readStrand, int64_t readNo, stL
         for (int64_t k = i; k < j; k++) {
 
             // If k position is not flanked by a preceding match or the beginning then can not be a complete insert
-            if (!isMatch(matchesSet, stIntTuple_get(insertStart, 1), stIntTuple_get(insertStart, 2) + k - i - 1) &&
-                stIntTuple_get(insertStart, 2) + k - i - 1 > -1) {
+            if (alignedPairs_find(matches, insertStartX, insertStartY + k - i - 1) == -1 &&
+                insertStartY + k - i - 1 > -1) {
                 continue;
             }
 
             for (int64_t l = k; l < j; l++) {
 
                 // If l position is not flanked by a proceeding match or the end then can not be a complete insert
-                if (!isMatch(matchesSet, stIntTuple_get(insertStart, 1) + 1,
-                             stIntTuple_get(insertStart, 2) + l - i + 1) &&
-                    stIntTuple_get(insertStart, 2) + l - i + 1 < read->length) {
+                if (alignedPairs_find(matches, insertStartX + 1, insertStartY + l - i + 1) == -1 &&
+                    insertStartY + l - i + 1 < read->length) {
                     continue;
                 }
 
                 // At this point k (inclusive) and l (inclusive) represent a complete-insert
 
                 // Calculate weight and label, including repeat counts
-                assert(stIntTuple_get(insertStart, 2) + k - i == stIntTuple_get(stList_get(inserts, k), 2));
-                assert(stIntTuple_get(stList_get(inserts, k), 2) >= 0);
+                assert(insertStartY + k - i == inserts->y[k]);
+                assert(inserts->y[k] >= 0);
 
-                RleString *insert = rleString_copySubstring(read, stIntTuple_get(stList_get(inserts, k), 2), l + 1 - k);
+                RleString *insert = rleString_copySubstring(read, inserts->y[k], l + 1 - k);
                 double insertWeight = UINT_MAX;
                 for (int64_t m = k; m < l + 1; m++) {
-                    stIntTuple *insertBase = stList_get(inserts, m);
-                    insertWeight =
-                            insertWeight < stIntTuple_get(insertBase, 0) ? insertWeight : stIntTuple_get(insertBase, 0);
+                    insertWeight = insertWeight < inserts->weight[m] ? insertWeight : inserts->weight[m];
                 }
 
                 // Get the leftmost node in the poa graph to which the insert will connect
 
                 // First find the left point to which the insert will be connected
-                assert(stIntTuple_get(insertStart, 1) >= -1);
-                int64_t insertPosition = stIntTuple_get(insertStart, 1) + 1;
+                assert(insertStartX >= -1);
+                int64_t insertPosition = insertStartX + 1;
 
                 // Now walk back over reference sequence and see if insert can be left-shifted
                 insertPosition = getShift(poa->refString, insertPosition, insert,
@@ -435,9 +626,8 @@ void poa_augment(Poa *poa, RleString *read, bool readStrand, int64_t readNo, stL
                 assert(insertPosition >= 0);
 
                 // Add insert to graph at leftmost position
-                addToInserts(stList_get(poa->nodes, insertPosition), insert, insertWeight, readStrand,
-                             poaBaseObservation_construct(readNo, stIntTuple_get(stList_get(inserts, k), 2),
-                                                          insertWeight));
+                addToInserts(poa, poa_getAugmentedNode(poa, insertPosition), insert, insertWeight, readStrand,
+                             readNo, inserts->y[k]);
 
                 // Cleanup
                 rleString_destruct(insert);
@@ -451,27 +641,27 @@ void poa_augment(Poa *poa, RleString *read, bool readStrand, int64_t readNo, stL
     // Add deletes to the POA graph
 
     // Sort the deletes first by the read coordinate and then by reference coordinate
-    stList_sort(deletes, cmpAlignedPairsByInvertedCoordinates);
+    alignedPairs_sortByInvertedCoordinates(deletes);
 
     // Analogous to a complete-insert, let a complete-delete be a sequence of deletes with the same read coordinate j
     // and consecutive reference coordinates i, i+1, ..., i+m, such that the i-1,j is a match or equal to (-1,-1) (the beginning)
     // in the alignment subgraph and i+m+1,j+1 is similarly a match or (N, M) (the alignment end).
 
     // Enumerate set of complete-deletes, adding them to the graph
-    for (int64_t i = 0; i < stList_length(deletes);) {
-        stIntTuple *deleteStart = stList_get(deletes, i); // Start of putative complete-delete
+    for (int64_t i = 0; i < deletes->length;) {
+        // i is the start of putative complete-delete
+        int64_t deleteStartX = deletes->x[i], deleteStartY = deletes->y[i];
 
         int64_t j = i + 1;
-        for (; j < stList_length(deletes); j++) {
-            stIntTuple *deleteEnd = stList_get(deletes, j); // End of putative complete-delete
+        for (; j < deletes->length; j++) { // j is the end of putative complete-delete
 
             // If they don't have the same read coordinate then not part of same complete-insert
-            if (stIntTuple_get(deleteStart, 2) != stIntTuple_get(deleteEnd, 2)) {
+            if (deleteStartY != deletes->y[j]) {
                 break;
             }
 
             // If they don't form a contiguous sequence of read coordinates then not part of same complete-insert
-            if (stIntTuple_get(deleteStart, 1) + j - i != stIntTuple_get(deleteEnd, 1)) {
+            if (deleteStartX + j - i != deletes->x[j]) {
                 break;
             }
         }
@@ -484,17 +674,16 @@ void poa_augment(Poa *poa, RleString *read, bool readStrand, int64_t readNo, stL
         for (int64_t k = i; k < j; k++) {
 
             // If k position is not flanked by a preceding match or the alignment beginning then can not be a complete-delete
-            if (!isMatch(matchesSet, stIntTuple_get(deleteStart, 1) + k - i - 1, stIntTuple_get(deleteStart, 2)) &&
-                stIntTuple_get(deleteStart, 1) + k - i - 1 > -1) {
+            if (alignedPairs_find(matches, deleteStartX + k - i - 1, deleteStartY) == -1 &&
+                deleteStartX + k - i - 1 > -1) {
                 continue;
             }
 
             for (int64_t l = k; l < j; l++) {
 
                 // If l position is not flanked by a proceeding match or the alignment end then can not be a complete-delete
-                if (!isMatch(matchesSet, stIntTuple_get(deleteStart, 1) + l - i + 1,
-                             stIntTuple_get(deleteStart, 2) + 1) &&
-                    stIntTuple_get(deleteStart, 1) + l - i + 1 < poa->refString->length) {
+                if (alignedPairs_find(matches, deleteStartX + l - i + 1, deleteStartY + 1) == -1 &&
+                    deleteStartX + l - i + 1 < poa->refString->length) {
                     continue;
                 }
 
@@ -506,15 +695,14 @@ void poa_augment(Poa *poa, RleString *read, bool readStrand, int64_t readNo, stL
                 // Calculate weight
                 double deleteWeight = UINT_MAX;
                 for (int64_t m = k; m < l + 1; m++) {
-                    stIntTuple *delete = stList_get(deletes, m);
-                    deleteWeight = deleteWeight < stIntTuple_get(delete, 0) ? deleteWeight : stIntTuple_get(delete, 0);
+                    deleteWeight = deleteWeight < deletes->weight[m] ? deleteWeight : deletes->weight[m];
                 }
 
                 // Get the leftmost node in the poa graph to which the delete will connect
 
                 // First find the left point to which the delete would be connected
-                assert(stIntTuple_get(deleteStart, 1) + k - i >= 0);
-                int64_t deletePosition = stIntTuple_get(deleteStart, 1) + k - i;
+                assert(deleteStartX + k - i >= 0);
+                int64_t deletePosition = deleteStartX + k - i;
 
                 // Get string being deleted
                 RleString *delete = rleString_copySubstring(poa->refString, deletePosition, deleteLength);
@@ -529,17 +717,26 @@ void poa_augment(Poa *poa, RleString *read, bool readStrand, int64_t readNo, stL
                 rleString_destruct(delete);
 
                 // Add delete to graph at leftmost position
-                addToDeletes(stList_get(poa->nodes, deletePosition), deleteLength, deleteWeight, readStrand,
-                             poaBaseObservation_construct(readNo, stIntTuple_get(deleteStart, 2), deleteWeight));
+                addToDeletes(poa, poa_getAugmentedNode(poa, deletePosition), deleteLength, deleteWeight, readStrand,
+                             readNo, deleteStartY);
             }
         }
 
         // Increase i to start of next maximal complete-delete
         i = j;
     }
+}
 
-    // Cleanup
-    stSortedSet_destruct(matchesSet);
+void poa_augment(Poa *poa, RleString *read, bool readStrand, int64_t readNo, stList *matches, stList *inserts,
+                 stList *deletes,
+                 PolishParams *polishParams) {
+    AlignedPairs *packedMatches = alignedPairs_constructFromList(matches);
+    AlignedPairs *packedInserts = alignedPairs_constructFromList(inserts);
+    AlignedPairs *packedDeletes = alignedPairs_constructFromList(deletes);
+    poa_augmentPacked(poa, read, readStrand, readNo, packedMatches, packedInserts, packedDeletes, polishParams);
+    alignedPairs_destruct(packedMatches);
+    alignedPairs_destruct(packedInserts);
+    alignedPairs_destruct(packedDeletes);
 }
 
 stList *poa_getAnchorAlignments(Poa *poa, const int64_t *poaToConsensusMap, int64_t noOfReads, PolishParams *pp) {
@@ -605,68 +802,717 @@ static void adjustAnchors(stList *anchorPairs, int64_t index, int64_t adjustment
     }
 }
 
+static void adjustPairs(AlignedPairs *pairs, int64_t start, int64_t adjustment) {
+    for (int64_t i = start; i < pairs->length; i++) {
+        pairs->x[i] += adjustment;
+    }
+}
+
+/*
+ * Gets the interval of the reference, from firstRefPosition (inclusive) to endRefPosition (exclusive), to which a read
+ * with the given anchor pairs is aligned by getAlignedPairsWithIndelsCroppingReference.
+ */
+static void getCroppedReferenceInterval(RleString *reference, RleString *read, stList *anchorPairs,
+                                        int64_t *firstRefPosition, int64_t *endRefPosition) {
+    // TODO I think we may want to extend refStart and refEnd by the length of the read before and after the first and last aligned positions
+    if (stList_length(anchorPairs) > 0) {
+        stIntTuple *fPair = stList_get(anchorPairs, 0);
+        *firstRefPosition = stIntTuple_get(fPair, 0) - stIntTuple_get(fPair, 1);
+        *firstRefPosition = *firstRefPosition < 0 ? 0 : *firstRefPosition;
+
+        stIntTuple *lPair = stList_peek(anchorPairs);
+        *endRefPosition = 1 + stIntTuple_get(lPair, 0) + (read->length - stIntTuple_get(lPair, 1));
+        *endRefPosition = *endRefPosition > reference->length ? reference->length : *endRefPosition;
+    } else {
+        *firstRefPosition = 0;
+        *endRefPosition = reference->length;
+    }
+    assert(*firstRefPosition <= reference->length && *firstRefPosition >= 0);
+    assert(*endRefPosition <= reference->length && *endRefPosition >= 0);
+}
+
+static SymbolString getReadSymbolString(RleString *read, PolishParams *polishParams) {
+    uint64_t maxRL = polishParams->useRunLengthEncoding ? (uint64_t) polishParams->repeatSubMatrix->maximumRepeatLength
+                                                        : 2;
+    return rleString_constructSymbolString(read, 0, read->length, polishParams->alphabet,
+                                           polishParams->useRepeatCountsInAlignment, maxRL);
+}
+
 /*
  * Generates aligned pairs and indel probs, but first crops reference to only include sequence from first
  * to last anchor position.
  */
+void getAlignedPairsWithIndelsCroppingReferencePacked(RleString *reference,
+                                                      RleString *read, bool readStrand, stList *anchorPairs,
+                                                      AlignedPairs *matches, AlignedPairs *inserts,
+                                                      AlignedPairs *deletes, PolishParams *polishParams) {
+    // Crop reference, to avoid long unaligned prefix and suffix
+    // that generates a lot of delete pairs
+
+    // Get cropping coordinates
+    int64_t firstRefPosition, endRefPosition;
+    getCroppedReferenceInterval(reference, read, anchorPairs, &firstRefPosition, &endRefPosition);
+
+    // Adjust anchor positions
+    adjustAnchors(anchorPairs, 0, -firstRefPosition);
+
+    // Get symbol strings
+    uint64_t maxRL = polishParams->useRunLengthEncoding ? (uint64_t) polishParams->repeatSubMatrix->maximumRepeatLength
+                                                        : 2;
+    SymbolString sX = rleString_constructSymbolString(reference, firstRefPosition, endRefPosition - firstRefPosition,
+                                                      polishParams->alphabet, polishParams->useRepeatCountsInAlignment,
+                                                      maxRL);
+    SymbolString sY = getReadSymbolString(read, polishParams);
+
+    // Get alignment
+    int64_t matchesStart = matches->length, insertsStart = inserts->length, deletesStart = deletes->length;
+    getAlignedPairsWithIndelsUsingAnchorsPacked(readStrand ? polishParams->stateMachineForForwardStrandRead :
+                                                polishParams->stateMachineForReverseStrandRead, sX, sY,
+                                                anchorPairs, polishParams->p, matches, deletes, inserts, 0, 0);
+
+    // Cleanup symbol strings
+    symbolString_destruct(sX);
+    symbolString_destruct(sY);
+
+    // Adjust back anchors
+    adjustAnchors(anchorPairs, 0, firstRefPosition);
+
+    // Shift matches/inserts/deletes
+    adjustPairs(matches, matchesStart, firstRefPosition);
+    adjustPairs(inserts, insertsStart, firstRefPosition);
+    adjustPairs(deletes, deletesStart, firstRefPosition);
+}
+
+void getExpectationsCroppingReference(RleString *reference, RleString *read, bool readStrand, stList *anchorPairs,
+                                      Hmm *hmmExpectations, PolishParams *polishParams) {
+    // Crop the reference as for the alignment
+    int64_t firstRefPosition, endRefPosition;
+    getCroppedReferenceInterval(reference, read, anchorPairs, &firstRefPosition, &endRefPosition);
+    adjustAnchors(anchorPairs, 0, -firstRefPosition);
+
+    uint64_t maxRL = polishParams->useRunLengthEncoding ? (uint64_t) polishParams->repeatSubMatrix->maximumRepeatLength
+                                                        : 2;
+    SymbolString sX = rleString_constructSymbolString(reference, firstRefPosition, endRefPosition - firstRefPosition,
+                                                      polishParams->alphabet, polishParams->useRepeatCountsInAlignment,
+                                                      maxRL);
+    SymbolString sY = getReadSymbolString(read, polishParams);
+
+    if (readStrand) {
+        getExpectationsUsingAnchors(polishParams->stateMachineForForwardStrandRead, hmmExpectations, sX, sY,
+                                    anchorPairs, polishParams->p, 0, 0);
+    } else {
+        // The reverse strand state machine has the complemented emissions
+        Hmm *reverseExpectations = hmm_constructEmpty(0.0, hmmExpectations->type, hmmExpectations->emissionsType);
+        getExpectationsUsingAnchors(polishParams->stateMachineForReverseStrandRead, reverseExpectations, sX, sY,
+                                    anchorPairs, polishParams->p, 0, 0);
+        hmm_reverseComplementEmissions(reverseExpectations);
+        hmm_addExpectations(hmmExpectations, reverseExpectations);
+        hmm_destruct(reverseExpectations);
+    }
+
+    // Cleanup
+    symbolString_destruct(sX);
+    symbolString_destruct(sY);
+    adjustAnchors(anchorPairs, 0, firstRefPosition);
+}
+
 void getAlignedPairsWithIndelsCroppingReference(RleString *reference,
                                                 RleString *read, bool readStrand, stList *anchorPairs,
                                                 stList **matches, stList **inserts, stList **deletes,
                                                 PolishParams *polishParams) {
-    // Crop reference, to avoid long unaligned prefix and suffix
-    // that generates a lot of delete pairs
+    AlignedPairs *packedMatches = alignedPairs_construct();
+    AlignedPairs *packedInserts = alignedPairs_construct();
+    AlignedPairs *packedDeletes = alignedPairs_construct();
+    getAlignedPairsWithIndelsCroppingReferencePacked(reference, read, readStrand, anchorPairs,
+                                                     packedMatches, packedInserts, packedDeletes, polishParams);
+    *matches = alignedPairs_toList(packedMatches);
+    *inserts = alignedPairs_toList(packedInserts);
+    *deletes = alignedPairs_toList(packedDeletes);
+    alignedPairs_destruct(packedMatches);
+    alignedPairs_destruct(packedInserts);
+    alignedPairs_destruct(packedDeletes);
+}
 
-    // Get cropping coordinates
-    // TODO I think we may want to extend refStart and refEnd by the length of the read before and after the first and last aligned positions
+/*
+ * Alignments of reads made by poa_realign2, kept so that a read can reuse its alignment in a later round of
+ * realignment if neither the part of the reference it is aligned to nor its anchors have changed.
+ */
+typedef struct _poaRealignmentCacheEntry {
+    RleString *refSubstring; // The cropped reference the read was aligned to, or NULL if the read has not been aligned
+    int64_t anchorsLength; // Length of anchors
+    int64_t *anchors; // The anchor pairs, with reference coordinates relative to the start of refSubstring
+    AlignedPairs *matches, *inserts, *deletes; // The pairs, with reference coordinates relative to refSubstring
+    SymbolString readSymbols; // The read's symbol string, made when it is first aligned, sequence NULL until then
+} PoaRealignmentCacheEntry;
+
+struct _poaRealignmentCache {
+    int64_t readNo;
+    PoaRealignmentCacheEntry *entries;
+    bool readOnly;
+};
+
+PoaRealignmentCache *poaRealignmentCache_construct(int64_t readNo) {
+    PoaRealignmentCache *cache = st_malloc(sizeof(PoaRealignmentCache));
+    cache->readNo = readNo;
+    cache->entries = st_calloc(readNo, sizeof(PoaRealignmentCacheEntry));
+    cache->readOnly = 0;
+    return cache;
+}
+
+void poaRealignmentCache_destruct(PoaRealignmentCache *cache) {
+    for (int64_t i = 0; i < cache->readNo; i++) {
+        PoaRealignmentCacheEntry *entry = &cache->entries[i];
+        if (entry->refSubstring != NULL) {
+            rleString_destruct(entry->refSubstring);
+            free(entry->anchors);
+            alignedPairs_destruct(entry->matches);
+            alignedPairs_destruct(entry->inserts);
+            alignedPairs_destruct(entry->deletes);
+        }
+        if (entry->readSymbols.sequence != NULL) {
+            symbolString_destruct(entry->readSymbols);
+        }
+    }
+    free(cache->entries);
+    free(cache);
+}
+
+void poaRealignmentCache_setReadOnly(PoaRealignmentCache *cache, bool readOnly) {
+    cache->readOnly = readOnly;
+}
+
+/*
+ * Flattens the anchor pairs into an array of each tuple's length followed by its values, with the reference
+ * coordinates made relative to firstRefPosition.
+ */
+static int64_t *encodeAnchors(stList *anchorPairs, int64_t firstRefPosition, int64_t *anchorsLength) {
+    *anchorsLength = 0;
+    for (int64_t i = 0; i < stList_length(anchorPairs); i++) {
+        *anchorsLength += 1 + stIntTuple_length(stList_get(anchorPairs, i));
+    }
+    int64_t *anchors = st_malloc(sizeof(int64_t) * (*anchorsLength == 0 ? 1 : *anchorsLength));
+    int64_t j = 0;
+    for (int64_t i = 0; i < stList_length(anchorPairs); i++) {
+        stIntTuple *pair = stList_get(anchorPairs, i);
+        anchors[j++] = stIntTuple_length(pair);
+        for (int64_t k = 0; k < stIntTuple_length(pair); k++) {
+            anchors[j++] = stIntTuple_get(pair, k) - (k == 0 ? firstRefPosition : 0);
+        }
+    }
+    return anchors;
+}
+
+static bool rleString_substringEq(RleString *r1, int64_t start, RleString *r2) {
+    for (int64_t i = 0; i < r2->length; i++) {
+        if (r1->rleString[start + i] != r2->rleString[i] || rleString_getRepeatCount(r1, start + i) != rleString_getRepeatCount(r2, i)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void alignedPairs_appendShifted(AlignedPairs *pairs, AlignedPairs *toAppend, int64_t adjustment) {
+    for (int64_t i = 0; i < toAppend->length; i++) {
+        alignedPairs_add(pairs, toAppend->weight[i], toAppend->x[i] + adjustment, toAppend->y[i]);
+    }
+}
+
+static void alignedPairs_appendShifted2(AlignedPairs *pairs, AlignedPairs *toAppend, int64_t xAdjustment,
+                                        int64_t yAdjustment) {
+    for (int64_t i = 0; i < toAppend->length; i++) {
+        alignedPairs_add(pairs, toAppend->weight[i], toAppend->x[i] + xAdjustment, toAppend->y[i] + yAdjustment);
+    }
+}
+
+/*
+ * If the cropped reference and anchors of the readNo-th read are the same as when the read was last aligned, up to a
+ * shift in reference coordinates, appends the (shifted) pairs from the cache and returns non-zero.
+ */
+static bool poaRealignmentCache_getPairs(PoaRealignmentCache *cache, int64_t readNo, RleString *reference,
+                                         RleString *read, stList *anchorPairs, AlignedPairs *matches,
+                                         AlignedPairs *inserts, AlignedPairs *deletes) {
+    assert(readNo < cache->readNo);
+    PoaRealignmentCacheEntry *entry = &cache->entries[readNo];
+    if (entry->refSubstring == NULL) {
+        return 0;
+    }
+
+    int64_t firstRefPosition, endRefPosition, anchorsLength;
+    getCroppedReferenceInterval(reference, read, anchorPairs, &firstRefPosition, &endRefPosition);
+    int64_t *anchors = encodeAnchors(anchorPairs, firstRefPosition, &anchorsLength);
+
+    // If nothing the alignment depends on has changed reuse the old pairs
+    bool hit = entry->refSubstring->length == endRefPosition - firstRefPosition &&
+               entry->anchorsLength == anchorsLength &&
+               memcmp(entry->anchors, anchors, sizeof(int64_t) * anchorsLength) == 0 &&
+               rleString_substringEq(reference, firstRefPosition, entry->refSubstring);
+    if (hit) {
+        alignedPairs_appendShifted(matches, entry->matches, firstRefPosition);
+        alignedPairs_appendShifted(inserts, entry->inserts, firstRefPosition);
+        alignedPairs_appendShifted(deletes, entry->deletes, firstRefPosition);
+    }
+    free(anchors);
+    return hit;
+}
+
+/*
+ * Stores the pairs of the readNo-th read, aligned to the reference cropped to firstRefPosition to endRefPosition
+ * with the given anchors, unless the cache is read only.
+ */
+static void poaRealignmentCache_setPairs(PoaRealignmentCache *cache, int64_t readNo, RleString *reference,
+                                         stList *anchorPairs, int64_t firstRefPosition, int64_t endRefPosition,
+                                         AlignedPairs *matches, AlignedPairs *inserts, AlignedPairs *deletes) {
+    if (cache->readOnly) {
+        return;
+    }
+    assert(readNo < cache->readNo);
+    PoaRealignmentCacheEntry *entry = &cache->entries[readNo];
+    if (entry->refSubstring == NULL) {
+        entry->matches = alignedPairs_construct();
+        entry->inserts = alignedPairs_construct();
+        entry->deletes = alignedPairs_construct();
+    } else {
+        rleString_destruct(entry->refSubstring);
+        free(entry->anchors);
+        alignedPairs_clear(entry->matches);
+        alignedPairs_clear(entry->inserts);
+        alignedPairs_clear(entry->deletes);
+    }
+    entry->refSubstring = rleString_copySubstring(reference, firstRefPosition, endRefPosition - firstRefPosition);
+    entry->anchors = encodeAnchors(anchorPairs, firstRefPosition, &entry->anchorsLength);
+    alignedPairs_appendShifted(entry->matches, matches, -firstRefPosition);
+    alignedPairs_appendShifted(entry->inserts, inserts, -firstRefPosition);
+    alignedPairs_appendShifted(entry->deletes, deletes, -firstRefPosition);
+}
+
+/*
+ * The alignment of a read to the reference, cropped around its anchors, as done by
+ * getAlignedPairsWithIndelsCroppingReferencePacked, split so that the alignments of many reads can be solved
+ * together as a PairwiseAlignmentBatch.
+ */
+typedef struct _poaReadAlignmentJob {
+    int64_t readNo;
+    int64_t batchIndex; // Index of the alignment in the batch
+    stList *anchorPairs; // Shifted to the cropped reference while the job is in the batch
+    bool ownsAnchorPairs;
     int64_t firstRefPosition, endRefPosition;
-    if (stList_length(anchorPairs) > 0) {
-        stIntTuple *fPair = stList_get(anchorPairs, 0);
-        firstRefPosition = stIntTuple_get(fPair, 0) - stIntTuple_get(fPair, 1);
-        firstRefPosition = firstRefPosition < 0 ? 0 : firstRefPosition;
+    SymbolString sX, sY; // sX is a view of the reference's symbol string
+    bool ownsReadSymbols; // If false sY is the read's symbol string in the cache
+} PoaReadAlignmentJob;
 
-        stIntTuple *lPair = stList_peek(anchorPairs);
-        endRefPosition = 1 + stIntTuple_get(lPair, 0) + (read->length - stIntTuple_get(lPair, 1));
-        endRefPosition = endRefPosition > reference->length ? reference->length : endRefPosition;
+/*
+ * Crops the reference, gets the symbol strings and shifts the anchors of the readNo-th read's alignment.
+ */
+static void poaReadAlignmentJob_prepare(PoaReadAlignmentJob *job, Poa *poa, BamChunkRead *chunkRead, int64_t readNo,
+                                        stList *anchorAlignments, RleString *reference,
+                                        SymbolString referenceSymbols, PolishParams *polishParams,
+                                        PoaRealignmentCache *cache) {
+    job->readNo = readNo;
+    if (anchorAlignments == NULL) {
+        // Align to the whole reference without anchors
+        job->anchorPairs = stList_construct();
+        job->ownsAnchorPairs = 1;
+        job->firstRefPosition = 0;
+        job->endRefPosition = reference->length;
+        job->sX = referenceSymbols;
+        job->sY = rleString_constructSymbolString(chunkRead->rleRead, 0, chunkRead->rleRead->length,
+                                                  polishParams->alphabet, polishParams->useRepeatCountsInAlignment,
+                                                  poa->maxRepeatCount - 1);
+        job->ownsReadSymbols = 1;
+        return;
+    }
+
+    // Crop reference, to avoid long unaligned prefix and suffix that generates a lot of delete pairs
+    job->anchorPairs = stList_get(anchorAlignments, readNo);
+    job->ownsAnchorPairs = 0;
+    getCroppedReferenceInterval(reference, chunkRead->rleRead, job->anchorPairs, &job->firstRefPosition,
+                                &job->endRefPosition);
+    adjustAnchors(job->anchorPairs, 0, -job->firstRefPosition);
+    job->sX = symbolString_getView(referenceSymbols, job->firstRefPosition,
+                                   job->endRefPosition - job->firstRefPosition);
+
+    // The read's symbol string is made once and kept in the cache, if there is one
+    PoaRealignmentCacheEntry *entry = cache != NULL ? &cache->entries[readNo] : NULL;
+    if (entry != NULL && entry->readSymbols.sequence == NULL && !cache->readOnly) {
+        entry->readSymbols = getReadSymbolString(chunkRead->rleRead, polishParams);
+    }
+    if (entry != NULL && entry->readSymbols.sequence != NULL) {
+        job->sY = entry->readSymbols;
+        job->ownsReadSymbols = 0;
     } else {
-        firstRefPosition = 0;
-        endRefPosition = reference->length;
+        job->sY = getReadSymbolString(chunkRead->rleRead, polishParams);
+        job->ownsReadSymbols = 1;
+    }
+}
+
+/*
+ * Appends the pairs of the solved job to the buffers, in reference coordinates, shifts back its anchors and stores its
+ * pairs in the cache, if there is one.
+ */
+static void poaReadAlignmentJob_finish(PoaReadAlignmentJob *job, PairwiseAlignmentBatch *batch, RleString *reference,
+                                       PoaRealignmentCache *cache, AlignedPairs *matches, AlignedPairs *inserts,
+                                       AlignedPairs *deletes) {
+    // The batch's x indels are deletes relative to the reference and its y indels inserts
+    alignedPairs_appendShifted(matches, pairwiseAlignmentBatch_getAlignedPairs(batch, job->batchIndex),
+                               job->firstRefPosition);
+    alignedPairs_appendShifted(deletes, pairwiseAlignmentBatch_getGapXPairs(batch, job->batchIndex),
+                               job->firstRefPosition);
+    alignedPairs_appendShifted(inserts, pairwiseAlignmentBatch_getGapYPairs(batch, job->batchIndex),
+                               job->firstRefPosition);
+
+    if (job->ownsReadSymbols) {
+        symbolString_destruct(job->sY);
+    }
+    if (job->ownsAnchorPairs) {
+        stList_destruct(job->anchorPairs);
+        return;
+    }
+    adjustAnchors(job->anchorPairs, 0, job->firstRefPosition);
+    if (cache != NULL) {
+        poaRealignmentCache_setPairs(cache, job->readNo, reference, job->anchorPairs, job->firstRefPosition,
+                                     job->endRefPosition, matches, inserts, deletes);
+    }
+}
+
+static int poaReadAlignmentJob_cmpByDecreasingArea(const void *a, const void *b) {
+    PoaReadAlignmentJob *j1 = (PoaReadAlignmentJob *) a, *j2 = (PoaReadAlignmentJob *) b;
+    int64_t area1 = j1->sX.length * j1->sY.length, area2 = j2->sX.length * j2->sY.length;
+    return area1 > area2 ? -1 : (area1 < area2 ? 1 : (j1->readNo < j2->readNo ? -1 : 1));
+}
+
+/*
+ * Converts the pairs from start (inclusive) to end (exclusive) of an anchor alignment into matches, inserts and
+ * deletes each with weight PAIR_ALIGNMENT_PROB_1, as used by poa_realignOnlyAnchorAlignments.
+ */
+static void getAnchorAlignmentPairs2(stList *anchorAlignment, int64_t start, int64_t end, AlignedPairs *matches,
+                                     AlignedPairs *inserts, AlignedPairs *deletes) {
+    if (start >= end) {
+        return;
+    }
+    int64_t k = start;
+    stIntTuple *currAlign = stList_get(anchorAlignment, k);
+    int64_t posRef = stIntTuple_get(currAlign, 0);
+    int64_t posRead = stIntTuple_get(currAlign, 1);
+
+    while (TRUE) {
+        if (currAlign == NULL) break;
+        int64_t currAlignPosRef = stIntTuple_get(currAlign, 0);
+        int64_t currAlignPosRead = stIntTuple_get(currAlign, 1);
+        // Read delete
+        if (posRef < currAlignPosRef) {
+            alignedPairs_add(deletes, PAIR_ALIGNMENT_PROB_1, posRef, currAlignPosRead-1);
+            posRef++;
+        }
+
+        // Read insert
+        else if (posRead < currAlignPosRead) {
+            alignedPairs_add(inserts, PAIR_ALIGNMENT_PROB_1, currAlignPosRef-1, posRead);
+            posRead++;
+        }
+
+        // match
+        else if (posRef == currAlignPosRef && posRead == currAlignPosRead) {
+            alignedPairs_add(matches, PAIR_ALIGNMENT_PROB_1, posRef, posRead);
+            posRef++;
+            posRead++;
+            currAlign = ++k < end ? stList_get(anchorAlignment, k) : NULL;
+        }
+
+        // should never happen
+        else {
+            assert(FALSE);
+        }
+    }
+}
+
+static void getAnchorAlignmentPairs(stList *anchorAlignment, AlignedPairs *matches, AlignedPairs *inserts,
+                                    AlignedPairs *deletes) {
+    getAnchorAlignmentPairs2(anchorAlignment, 0, stList_length(anchorAlignment), matches, inserts, deletes);
+}
+
+/*
+ * Partial poas, to add the reads of a batch to the poa in parallel. A partial poa shares the reference of its poa and
+ * has only the nodes its reads add weight to, made as they are first needed. Each run of the batch's reads is added to
+ * its own partial, then the partials are merged into the poa by a tree reduction.
+ */
+
+static Poa *poa_constructPartial(Poa *poa) {
+    Poa *partial = st_calloc(1, sizeof(Poa));
+    partial->alphabet = poa->alphabet;
+    partial->maxRepeatCount = poa->maxRepeatCount;
+    partial->refString = poa->refString;
+    partial->nodes = stList_construct3(stList_length(poa->nodes), NULL);
+    return partial;
+}
+
+static void poa_destructPartial(Poa *partial) {
+    for (int64_t i = 0; i < stList_length(partial->nodes); i++) {
+        PoaNode *node = stList_get(partial->nodes, i);
+        if (node != NULL) {
+            poaNode_destruct(node);
+        }
+    }
+    stList_destruct(partial->nodes);
+    free(partial->stagedObservations);
+    free(partial);
+}
+
+static void poa_mergeObservations(Poa *poa, stList *observations, Poa *partial, stList *partialObservations) {
+    for (int64_t k = 0; k < stList_length(partialObservations); k++) {
+        uintptr_t o = (uintptr_t) stList_get(partialObservations, k);
+        assert(o & 1); // A partial's observations are only staged
+        PoaBaseObservation *obs = &partial->stagedObservations[o >> 1];
+        poa_addObservation(poa, observations, obs->readNo, obs->offset, obs->weight);
+    }
+}
+
+static void poa_mergePartial(Poa *poa, Poa *partial) {
+    /*
+     * Adds the weights, inserts, deletes and observations of the partial, whose reads follow those of poa, to poa,
+     * each after those already there.
+     */
+    for (int64_t i = 0; i < stList_length(partial->nodes); i++) {
+        PoaNode *partialNode = stList_get(partial->nodes, i);
+        if (partialNode == NULL) {
+            continue;
+        }
+        PoaNode *node = poa_getAugmentedNode(poa, i);
+        for (int64_t k = 0; k < poa->alphabet->alphabetSize; k++) {
+            node->baseWeights[k] += partialNode->baseWeights[k];
+        }
+        for (int64_t k = 0; k < poa->maxRepeatCount; k++) {
+            node->repeatCountWeights[k] += partialNode->repeatCountWeights[k];
+        }
+        poa_mergeObservations(poa, node->observations, partial, partialNode->observations);
+        for (int64_t j = 0; j < stList_length(partialNode->inserts); j++) {
+            PoaInsert *partialInsert = stList_get(partialNode->inserts, j);
+            PoaInsert *poaInsert = poaNode_getInsert(node, partialInsert->insert);
+            poaInsert->weightForwardStrand += partialInsert->weightForwardStrand;
+            poaInsert->weightReverseStrand += partialInsert->weightReverseStrand;
+            poa_mergeObservations(poa, poaInsert->observations, partial, partialInsert->observations);
+        }
+        for (int64_t j = 0; j < stList_length(partialNode->deletes); j++) {
+            PoaDelete *partialDelete = stList_get(partialNode->deletes, j);
+            PoaDelete *poaDelete = poaNode_getDelete(node, partialDelete->length);
+            poaDelete->weightForwardStrand += partialDelete->weightForwardStrand;
+            poaDelete->weightReverseStrand += partialDelete->weightReverseStrand;
+            poa_mergeObservations(poa, poaDelete->observations, partial, partialDelete->observations);
+        }
+    }
+}
+
+static void poa_augmentRun(Poa *poa, stList *bamChunkReads, stList *anchorAlignments, int64_t batchStart,
+                           int64_t runStart, int64_t runEnd, AlignedPairs **matches, AlignedPairs **inserts,
+                           AlignedPairs **deletes, PolishParams *polishParams) {
+    for (int64_t k = runStart; k < runEnd; k++) {
+        if (anchorAlignments != NULL && stList_get(anchorAlignments, k) == NULL) {
+            continue; // The read is left out of the poa
+        }
+        BamChunkRead *chunkRead = stList_get(bamChunkReads, k);
+        int64_t j = k - batchStart;
+        poa_augmentPacked(poa, chunkRead->rleRead, chunkRead->forwardStrand, k, matches[j], inserts[j], deletes[j],
+                          polishParams);
+    }
+}
+
+static void poa_augmentRunsInParallel(Poa *poa, stList *bamChunkReads, stList *anchorAlignments, int64_t batchStart,
+                                      int64_t batchEnd, int64_t runNo, AlignedPairs **matches, AlignedPairs **inserts,
+                                      AlignedPairs **deletes, PolishParams *polishParams) {
+    /*
+     * The first run is added to the poa itself, each of the others to a partial, in their own tasks. Then, at each
+     * level of the reduction, each partial is merged into that of the run preceding it at the level, so the order
+     * of the merges does not depend on which thread does which.
+     */
+    Poa *partials[runNo];
+    partials[0] = poa;
+    for (int64_t r = 1; r < runNo; r++) {
+        partials[r] = poa_constructPartial(poa);
+    }
+    int64_t batchLength = batchEnd - batchStart;
+    for (int64_t r = 0; r < runNo; r++) {
+        # ifdef _OPENMP
+        #pragma omp task firstprivate(r) shared(partials, bamChunkReads, anchorAlignments, matches, inserts, deletes)
+        # endif
+        poa_augmentRun(partials[r], bamChunkReads, anchorAlignments, batchStart,
+                       batchStart + r * batchLength / runNo, batchStart + (r + 1) * batchLength / runNo,
+                       matches, inserts, deletes, polishParams);
+    }
+    # ifdef _OPENMP
+    #pragma omp taskwait
+    # endif
+    for (int64_t step = 1; step < runNo; step *= 2) {
+        for (int64_t r = 0; r + step < runNo; r += 2 * step) {
+            # ifdef _OPENMP
+            #pragma omp task firstprivate(r, step) shared(partials)
+            # endif
+            {
+                poa_mergePartial(partials[r], partials[r + step]);
+                poa_destructPartial(partials[r + step]);
+            }
+        }
+        # ifdef _OPENMP
+        #pragma omp taskwait
+        # endif
     }
-    assert(firstRefPosition <= reference->length && firstRefPosition >= 0);
-    assert(endRefPosition <= reference->length && endRefPosition >= 0);
+}
 
-    // Adjust anchor positions
-    adjustAnchors(anchorPairs, 0, -firstRefPosition);
+/*
+ * Adds the aligned pairs of the reads of the batch from batchStart to batchEnd to the poa. If in parallel the batch is
+ * split into contiguous runs of reads, one per thread, which are added to partial poas in parallel and merged. The pair
+ * weights are integers, so their sums are exact in any order, and each list of inserts, deletes and observations is
+ * extended run by run in read order, so the poa is the same as if the reads were added one by one.
+ */
+static void poa_augmentBatch(Poa *poa, stList *bamChunkReads, stList *anchorAlignments, int64_t batchStart,
+                             int64_t batchEnd, AlignedPairs **matches, AlignedPairs **inserts, AlignedPairs **deletes,
+                             PolishParams *polishParams, bool inParallel) {
+    int64_t runNo = 1;
+    # ifdef _OPENMP
+    if (inParallel) {
+        runNo = omp_get_max_threads() < batchEnd - batchStart ? omp_get_max_threads() : batchEnd - batchStart;
+    }
+    if (runNo > 1) {
+        if (!omp_in_parallel()) {
+            // Open a parallel region for the tasks to run in, as for the alignments of a batch
+            #pragma omp parallel
+            #pragma omp single
+            poa_augmentRunsInParallel(poa, bamChunkReads, anchorAlignments, batchStart, batchEnd, runNo, matches,
+                                      inserts, deletes, polishParams);
+        } else {
+            poa_augmentRunsInParallel(poa, bamChunkReads, anchorAlignments, batchStart, batchEnd, runNo, matches,
+                                      inserts, deletes, polishParams);
+        }
+        return;
+    }
+    # endif
+    poa_augmentRun(poa, bamChunkReads, anchorAlignments, batchStart, batchStart, batchEnd, matches, inserts, deletes,
+                   polishParams);
+}
 
-    // Get symbol strings
-    uint64_t maxRL = polishParams->useRunLengthEncoding ? (uint64_t) polishParams->repeatSubMatrix->maximumRepeatLength
-                                                        : 2;
-    SymbolString sX = rleString_constructSymbolString(reference, firstRefPosition, endRefPosition - firstRefPosition,
-                                                      polishParams->alphabet, polishParams->useRepeatCountsInAlignment,
-                                                      maxRL);
-    SymbolString sY = rleString_constructSymbolString(read, 0, read->length, polishParams->alphabet,
-                                                      polishParams->useRepeatCountsInAlignment,
-                                                      maxRL);
+/*
+ * Aligns each of the reads to the reference of the poa and adds the resulting weights, edges and nodes to the poa.
+ * Returns the number of reads whose pairs came from the cache.
+ *
+ * The reads are aligned in batches: the symbol strings and anchors of a batch's reads are made first, then their
+ * alignments are solved together as a PairwiseAlignmentBatch, so whichever alignment backend is set does all of them.
+ * If the number of reads times the reference length is greater than the polishParams->realignmentParallelismThreshold
+ * each alignment of a batch is solved in its own OpenMP task, largest first, so that threads that are otherwise idle
+ * can help with a deep chunk, as for bubbles in bubbleGraph.c; otherwise batches are of one read. A batch's reads are
+ * then added to the poa by poa_augmentBatch, in parallel when its alignments were, as contiguous runs of reads, each
+ * into a partial poa that are merged back in read order. As the weights are integer valued their sums are exact, so
+ * the poa is the same as if the reads were aligned and added one by one.
+ */
+static int64_t poa_alignAndAugment(Poa *poa, stList *bamChunkReads, stList *anchorAlignments, RleString *reference,
+                                   PolishParams *polishParams, PoaRealignmentCache *cache, bool onlyAnchorAlignments) {
+    int64_t readNo = stList_length(bamChunkReads);
+    bool inParallel = polishParams->realignmentParallelismThreshold > 0 &&
+                      readNo * reference->length > polishParams->realignmentParallelismThreshold;
+    int64_t batchSize = 1;
+    # ifdef _OPENMP
+    // Within the chunk loops the batches are also made for the threads that may run out of chunks, which are lent
+    // the alignments of a batch however small the chunk
+    if (inParallel || omp_in_parallel()) {
+        batchSize = 4 * omp_get_max_threads();
+    }
+    # endif
+
+    // Buffers for the posterior probabilities, one per read of a batch, reused for each batch
+    AlignedPairs *matches[batchSize], *inserts[batchSize], *deletes[batchSize];
+    bool cached[batchSize];
+    PoaReadAlignmentJob jobs[batchSize];
+    for (int64_t j = 0; j < batchSize; j++) {
+        matches[j] = alignedPairs_construct();
+        inserts[j] = alignedPairs_construct();
+        deletes[j] = alignedPairs_construct();
+    }
+
+    // The reference's symbol string is made once, the alignments taking views of it
+    SymbolString referenceSymbols = {polishParams->alphabet, NULL, 0};
+    if (!onlyAnchorAlignments) {
+        uint64_t maxRL = anchorAlignments == NULL ? poa->maxRepeatCount - 1 :
+                         (polishParams->useRunLengthEncoding ?
+                          (uint64_t) polishParams->repeatSubMatrix->maximumRepeatLength : 2);
+        referenceSymbols = rleString_constructSymbolString(reference, 0, reference->length, polishParams->alphabet,
+                                                           polishParams->useRepeatCountsInAlignment, maxRL);
+    }
+
+    int64_t cachedReads = 0;
+    for (int64_t i = 0; i < readNo; i += batchSize) {
+        int64_t batchEnd = i + batchSize < readNo ? i + batchSize : readNo;
+
+        // Get the pairs of the reads that need no alignment, and prepare the alignments of the rest
+        int64_t jobNo = 0;
+        for (int64_t k = i; k < batchEnd; k++) {
+            int64_t j = k - i;
+            BamChunkRead *chunkRead = stList_get(bamChunkReads, k);
+            alignedPairs_clear(matches[j]);
+            alignedPairs_clear(inserts[j]);
+            alignedPairs_clear(deletes[j]);
+            cached[j] = 0;
+            if (anchorAlignments != NULL && stList_get(anchorAlignments, k) == NULL) {
+                continue; // The read is left out of the poa
+            } else if (onlyAnchorAlignments) {
+                getAnchorAlignmentPairs(stList_get(anchorAlignments, k), matches[j], inserts[j], deletes[j]);
+            } else if (cache != NULL && anchorAlignments != NULL &&
+                       poaRealignmentCache_getPairs(cache, k, reference, chunkRead->rleRead,
+                                                    stList_get(anchorAlignments, k), matches[j], inserts[j],
+                                                    deletes[j])) {
+                cached[j] = 1;
+            } else {
+                poaReadAlignmentJob_prepare(&jobs[jobNo++], poa, chunkRead, k, anchorAlignments, reference,
+                                            referenceSymbols, polishParams, cache);
+            }
+        }
 
-    // Get alignment
-    getAlignedPairsWithIndelsUsingAnchors(readStrand ? polishParams->stateMachineForForwardStrandRead :
-                                          polishParams->stateMachineForReverseStrandRead, sX, sY,
-                                          anchorPairs, polishParams->p, matches, deletes, inserts, 0, 0);
+        // Generate set of posterior probabilities for matches, deletes and inserts with respect to reference,
+        // solving the biggest alignments first so the batch's tasks finish close together
+        if (jobNo > 0) {
+            qsort(jobs, jobNo, sizeof(PoaReadAlignmentJob), poaReadAlignmentJob_cmpByDecreasingArea);
+            PairwiseAlignmentBatch *batch = pairwiseAlignmentBatch_construct(polishParams->p);
+            pairwiseAlignmentBatch_setParallel(batch, inParallel || chunkScheduler_getIdleThreadNo() > 0);
+            for (int64_t l = 0; l < jobNo; l++) {
+                BamChunkRead *chunkRead = stList_get(bamChunkReads, jobs[l].readNo);
+                jobs[l].batchIndex = pairwiseAlignmentBatch_add(batch, chunkRead->forwardStrand ?
+                                                                       polishParams->stateMachineForForwardStrandRead :
+                                                                       polishParams->stateMachineForReverseStrandRead,
+                                                                jobs[l].sX, jobs[l].sY, jobs[l].anchorPairs, 0, 0);
+            }
+            pairwiseAlignmentBatch_computeAlignedPairs(batch);
+            for (int64_t l = 0; l < jobNo; l++) {
+                int64_t j = jobs[l].readNo - i;
+                poaReadAlignmentJob_finish(&jobs[l], batch, reference, cache, matches[j], inserts[j], deletes[j]);
+            }
+            pairwiseAlignmentBatch_destruct(batch);
+        }
 
-    // Cleanup symbol strings
-    symbolString_destruct(sX);
-    symbolString_destruct(sY);
+        // Add weights, edges and nodes to the poa, as if in read order
+        poa_augmentBatch(poa, bamChunkReads, anchorAlignments, i, batchEnd, matches, inserts, deletes, polishParams,
+                         inParallel || chunkScheduler_getIdleThreadNo() > 0);
+        for (int64_t k = i; k < batchEnd; k++) {
+            cachedReads += cached[k - i];
+        }
+    }
 
-    // Adjust back anchors
-    adjustAnchors(anchorPairs, 0, firstRefPosition);
+    // Cleanup
+    for (int64_t j = 0; j < batchSize; j++) {
+        alignedPairs_destruct(matches[j]);
+        alignedPairs_destruct(inserts[j]);
+        alignedPairs_destruct(deletes[j]);
+    }
+    if (referenceSymbols.sequence != NULL) {
+        symbolString_destruct(referenceSymbols);
+    }
 
-    // Shift matches/inserts/deletes
-    adjustAnchors(*matches, 1, firstRefPosition);
-    adjustAnchors(*inserts, 1, firstRefPosition);
-    adjustAnchors(*deletes, 1, firstRefPosition);
+    return cachedReads;
 }
 
 Poa *poa_realign(stList *bamChunkReads, stList *anchorAlignments, RleString *reference,
                  PolishParams *polishParams) {
+    return poa_realign2(bamChunkReads, anchorAlignments, reference, polishParams, NULL);
+}
+
+Poa *poa_realign2(stList *bamChunkReads, stList *anchorAlignments, RleString *reference,
+                  PolishParams *polishParams, PoaRealignmentCache *cache) {
+    allocProfile_scope(APT_POA);
     // Build a reference graph with zero weights
     uint64_t maximumRepeatLength = 2; // MRL is exclusive
     if (polishParams->useRunLengthEncoding) {
@@ -678,38 +1524,17 @@ Poa *poa_realign(stList *bamChunkReads, stList *anchorAlignments, RleString *ref
     }
     Poa *poa = poa_getReferenceGraph(reference, polishParams->alphabet, maximumRepeatLength);
 
-    // For each read
-    for (int64_t i = 0; i < stList_length(bamChunkReads); i++) {
-        BamChunkRead *chunkRead = stList_get(bamChunkReads, i);
-
-        // Generate set of posterior probabilities for matches, deletes and inserts with respect to reference.
-        stList *matches = NULL, *inserts = NULL, *deletes = NULL;
-
-        if(anchorAlignments == NULL) {
-            SymbolString sX = rleString_constructSymbolString(reference, 0, reference->length, polishParams->alphabet,
-                                                              polishParams->useRepeatCountsInAlignment, poa->maxRepeatCount - 1);
-            SymbolString sY = rleString_constructSymbolString(chunkRead->rleRead, 0, chunkRead->rleRead->length,
-                                                              polishParams->alphabet, polishParams->useRepeatCountsInAlignment, poa->maxRepeatCount - 1);
-
-            getAlignedPairsWithIndels(chunkRead->forwardStrand ? polishParams->stateMachineForForwardStrandRead :
-                                      polishParams->stateMachineForReverseStrandRead,
-                                      sX, sY, polishParams->p, &matches, &deletes, &inserts, 0, 0);
-
-            symbolString_destruct(sX);
-            symbolString_destruct(sY);
-        }
-        else {
-            getAlignedPairsWithIndelsCroppingReference(reference, chunkRead->rleRead, chunkRead->forwardStrand, stList_get(anchorAlignments, i),
-                                                       &matches, &inserts, &deletes, polishParams);
-        }
-
-        // Add weights, edges and nodes to the poa
-        poa_augment(poa, chunkRead->rleRead, chunkRead->forwardStrand, i, matches, inserts, deletes, polishParams);
+    // For each read, align it and add it to the poa
+    int64_t cachedReads = poa_alignAndAugment(poa, bamChunkReads, anchorAlignments, reference, polishParams, cache,
+                                              FALSE);
+    poa_destructGapIndices(poa); // Only needed while adding reads
+    poa_buildObservationArena(poa);
 
-        // Cleanup
-        stList_destruct(matches);
-        stList_destruct(inserts);
-        stList_destruct(deletes);
+    if (cache != NULL && anchorAlignments != NULL) {
+        char *logIdentifier = getLogIdentifier();
+        st_logInfo(" %s Realigned %"PRId64" of %"PRId64" reads, reusing the alignments of the others\n", logIdentifier,
+                   stList_length(bamChunkReads) - cachedReads, stList_length(bamChunkReads));
+        free(logIdentifier);
     }
 
     return poa;
@@ -728,62 +1553,225 @@ Poa *poa_realignOnlyAnchorAlignments(stList *bamChunkReads, stList *anchorAlignm
     }
     Poa *poa = poa_getReferenceGraph(reference, polishParams->alphabet, maximumRepeatLength);
 
-    // For each read
-    for (int64_t i = 0; i < stList_length(bamChunkReads); i++) {
-        BamChunkRead *chunkRead = stList_get(bamChunkReads, i);
-        stList *anchorAlignment = stList_get(anchorAlignments, i);
-
-        // Generate set of posterior probabilities for matches, deletes and inserts with respect to reference.
-        stList *matches = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
-        stList *inserts = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
-        stList *deletes = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
-
-
-        stListIterator *alignmentItor = stList_getIterator(anchorAlignment);
-        stIntTuple *currAlign = stList_getNext(alignmentItor);
-        int64_t posRef = stIntTuple_get(currAlign, 0);
-        int64_t posRead = stIntTuple_get(currAlign, 1);
-
-        while (TRUE) {
-            if (currAlign == NULL) break;
-            int64_t currAlignPosRef = stIntTuple_get(currAlign, 0);
-            int64_t currAlignPosRead = stIntTuple_get(currAlign, 1);
-            // Read delete
-            if (posRef < currAlignPosRef) {
-                stList_append(deletes, stIntTuple_construct3(PAIR_ALIGNMENT_PROB_1, posRef, currAlignPosRead-1));
-                posRef++;
-            }
+    // For each read, convert its anchor alignment to pairs and add it to the poa
+    poa_alignAndAugment(poa, bamChunkReads, anchorAlignments, reference, polishParams, NULL, TRUE);
+    poa_destructGapIndices(poa);
+    poa_buildObservationArena(poa);
 
-            // Read insert
-            else if (posRead < currAlignPosRead) {
-                stList_append(inserts, stIntTuple_construct3(PAIR_ALIGNMENT_PROB_1, currAlignPosRef-1, posRead));
-                posRead++;
-            }
+    return poa;
+}
 
-            // match
-            else if (posRef == currAlignPosRef && posRead == currAlignPosRead) {
-                stList_append(matches, stIntTuple_construct3(PAIR_ALIGNMENT_PROB_1, posRef, posRead));
-                posRef++;
-                posRead++;
-                currAlign = stList_getNext(alignmentItor);
-            }
+/*
+ * A window of a read's anchor alignment that is realigned by poa_realignDisagreementWindows: the pairs from start
+ * (inclusive) to end (exclusive), between the reference and read positions of the pairs flanking them.
+ */
+typedef struct _realignmentWindow {
+    int64_t start, end;
+    int64_t refStart, refEnd; // The reference positions realigned, end exclusive
+    int64_t readStart, readEnd; // The read positions realigned, end exclusive
+    int64_t batchIndex;
+    stList *anchorPairs; // The window's pairs, shifted to its reference and read positions
+} RealignmentWindow;
+
+static int64_t getFirstPairAtOrAfter(stList *anchorAlignment, int64_t refPosition) {
+    int64_t i = 0, j = stList_length(anchorAlignment);
+    while (i < j) {
+        int64_t k = (i + j) / 2;
+        if (stIntTuple_get(stList_get(anchorAlignment, k), 0) < refPosition) {
+            i = k + 1;
+        } else {
+            j = k;
+        }
+    }
+    return i;
+}
+
+static stList *getRealignmentWindows(stList *anchorAlignment, bool *disagreement, int64_t refLength) {
+    /*
+     * Gets the windows of the read's anchor alignment overlapping the runs of reference positions marked in
+     * disagreement, merging those that share their flanking pairs. A window at an end of the alignment is flanked by
+     * the position before its first pair or after its last pair.
+     */
+    stList *windows = stList_construct3(0, free);
+    int64_t n = stList_length(anchorAlignment);
+    if (n == 0) {
+        return windows;
+    }
+    int64_t firstRef = stIntTuple_get(stList_get(anchorAlignment, 0), 0);
+    int64_t lastRef = stIntTuple_get(stList_get(anchorAlignment, n - 1), 0);
+    for (int64_t i = firstRef; i <= lastRef;) {
+        if (!disagreement[i]) {
+            i++;
+            continue;
+        }
+        int64_t j = i + 1;
+        while (j < refLength && disagreement[j]) {
+            j++;
+        }
+        int64_t start = getFirstPairAtOrAfter(anchorAlignment, i), end = getFirstPairAtOrAfter(anchorAlignment, j);
+        RealignmentWindow *pWindow = stList_length(windows) > 0 ? stList_peek(windows) : NULL;
+        if (pWindow != NULL && start <= pWindow->end) {
+            pWindow->end = end;
+        } else {
+            RealignmentWindow *window = st_calloc(1, sizeof(RealignmentWindow));
+            window->start = start;
+            window->end = end;
+            stList_append(windows, window);
+        }
+        i = j;
+    }
+
+    // The positions between the flanking pairs
+    for (int64_t i = 0; i < stList_length(windows); i++) {
+        RealignmentWindow *window = stList_get(windows, i);
+        stIntTuple *first = stList_get(anchorAlignment, window->start > 0 ? window->start - 1 : 0);
+        window->refStart = stIntTuple_get(first, 0) + (window->start > 0 ? 1 : 0);
+        window->readStart = stIntTuple_get(first, 1) + (window->start > 0 ? 1 : 0);
+        stIntTuple *last = stList_get(anchorAlignment, window->end < n ? window->end : n - 1);
+        window->refEnd = stIntTuple_get(last, 0) + (window->end < n ? 0 : 1);
+        window->readEnd = stIntTuple_get(last, 1) + (window->end < n ? 0 : 1);
+    }
+    return windows;
+}
 
-            // should never happen
-            else {
-                assert(FALSE);
+Poa *poa_realignDisagreementWindows(stList *bamChunkReads, stList *anchorAlignments, RleString *reference,
+                                    PolishParams *polishParams) {
+    // Find the windows of the reference where the anchor alignments disagree, flanked
+    Poa *anchorPoa = poa_realignOnlyAnchorAlignments(bamChunkReads, anchorAlignments, reference, polishParams);
+    bool *candidateVariantPositions = poa_getCandidateVariantPositions(anchorPoa, polishParams);
+    bool *disagreement = st_calloc(reference->length + 1, sizeof(bool));
+    int64_t flank = polishParams->windowedRealignmentFlank;
+    for (int64_t i = 1; i < stList_length(anchorPoa->nodes); i++) {
+        if (candidateVariantPositions[i]) {
+            int64_t refPosition = i - 1; // The first node of the poa is the prefix "N"
+            for (int64_t j = refPosition - flank; j <= refPosition + flank; j++) {
+                if (j >= 0 && j < reference->length) {
+                    disagreement[j] = 1;
+                }
             }
         }
+    }
+    free(candidateVariantPositions);
+    poa_destruct(anchorPoa);
 
-        // Add weights, edges and nodes to the poa
-        poa_augment(poa, chunkRead->rleRead, chunkRead->forwardStrand, i, matches, inserts, deletes, polishParams);
+    // Build a reference graph with zero weights
+    uint64_t maximumRepeatLength = 2; // MRL is exclusive
+    if (polishParams->useRunLengthEncoding) {
+        if (polishParams->repeatSubMatrix != NULL) {
+            maximumRepeatLength = polishParams->repeatSubMatrix->maximumRepeatLength;
+        } else {
+            maximumRepeatLength = MAXIMUM_REPEAT_LENGTH;
+        }
+    }
+    Poa *poa = poa_getReferenceGraph(reference, polishParams->alphabet, maximumRepeatLength);
+    uint64_t maxRL = polishParams->useRunLengthEncoding ?
+                     (uint64_t) polishParams->repeatSubMatrix->maximumRepeatLength : 2;
+    SymbolString referenceSymbols = rleString_constructSymbolString(reference, 0, reference->length,
+                                                                    polishParams->alphabet,
+                                                                    polishParams->useRepeatCountsInAlignment, maxRL);
+    int64_t readNo = stList_length(bamChunkReads);
+    bool inParallel = polishParams->realignmentParallelismThreshold > 0 &&
+                      readNo * reference->length > polishParams->realignmentParallelismThreshold;
+
+    // For each read, take the pairs of its anchor alignment outside the windows and realign it within them
+    AlignedPairs *matches = alignedPairs_construct(), *inserts = alignedPairs_construct(),
+            *deletes = alignedPairs_construct();
+    int64_t readLength = 0, realignedReadLength = 0;
+    for (int64_t k = 0; k < readNo; k++) {
+        BamChunkRead *chunkRead = stList_get(bamChunkReads, k);
+        stList *anchorAlignment = stList_get(anchorAlignments, k);
+        stList *windows = getRealignmentWindows(anchorAlignment, disagreement, reference->length);
+        alignedPairs_clear(matches);
+        alignedPairs_clear(inserts);
+        alignedPairs_clear(deletes);
+
+        // The pairs outside the windows
+        int64_t pEnd = 0;
+        for (int64_t i = 0; i < stList_length(windows); i++) {
+            RealignmentWindow *window = stList_get(windows, i);
+            getAnchorAlignmentPairs2(anchorAlignment, pEnd, window->start, matches, inserts, deletes);
+            pEnd = window->end;
+        }
+        getAnchorAlignmentPairs2(anchorAlignment, pEnd, stList_length(anchorAlignment), matches, inserts, deletes);
+
+        // The windows, those with nothing to align to being indels
+        SymbolString readSymbols = {polishParams->alphabet, NULL, 0};
+        PairwiseAlignmentBatch *batch = pairwiseAlignmentBatch_construct(polishParams->p);
+        pairwiseAlignmentBatch_setParallel(batch, inParallel);
+        for (int64_t i = 0; i < stList_length(windows); i++) {
+            RealignmentWindow *window = stList_get(windows, i);
+            if (window->readStart == window->readEnd) {
+                for (int64_t j = window->refStart; j < window->refEnd; j++) {
+                    alignedPairs_add(deletes, PAIR_ALIGNMENT_PROB_1, j, window->readStart - 1);
+                }
+                continue;
+            }
+            if (window->refStart == window->refEnd) {
+                for (int64_t j = window->readStart; j < window->readEnd; j++) {
+                    alignedPairs_add(inserts, PAIR_ALIGNMENT_PROB_1, window->refStart - 1, j);
+                }
+                continue;
+            }
+            if (readSymbols.sequence == NULL) {
+                readSymbols = getReadSymbolString(chunkRead->rleRead, polishParams);
+            }
+            window->anchorPairs = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
+            for (int64_t j = window->start; j < window->end; j++) {
+                stIntTuple *pair = stList_get(anchorAlignment, j);
+                stList_append(window->anchorPairs, stIntTuple_construct3(stIntTuple_get(pair, 0) - window->refStart,
+                                                                         stIntTuple_get(pair, 1) - window->readStart,
+                                                                         stIntTuple_get(pair, 2)));
+            }
+            window->batchIndex = pairwiseAlignmentBatch_add(batch, chunkRead->forwardStrand ?
+                                                                   polishParams->stateMachineForForwardStrandRead :
+                                                                   polishParams->stateMachineForReverseStrandRead,
+                                                            symbolString_getView(referenceSymbols, window->refStart,
+                                                                                 window->refEnd - window->refStart),
+                                                            symbolString_getView(readSymbols, window->readStart,
+                                                                                 window->readEnd - window->readStart),
+                                                            window->anchorPairs, 0, 0);
+            realignedReadLength += window->readEnd - window->readStart;
+        }
+        pairwiseAlignmentBatch_computeAlignedPairs(batch);
+        for (int64_t i = 0; i < stList_length(windows); i++) {
+            RealignmentWindow *window = stList_get(windows, i);
+            if (window->anchorPairs == NULL) {
+                continue;
+            }
+            // The batch's x indels are deletes relative to the reference and its y indels inserts
+            alignedPairs_appendShifted2(matches, pairwiseAlignmentBatch_getAlignedPairs(batch, window->batchIndex),
+                                        window->refStart, window->readStart);
+            alignedPairs_appendShifted2(deletes, pairwiseAlignmentBatch_getGapXPairs(batch, window->batchIndex),
+                                        window->refStart, window->readStart);
+            alignedPairs_appendShifted2(inserts, pairwiseAlignmentBatch_getGapYPairs(batch, window->batchIndex),
+                                        window->refStart, window->readStart);
+            stList_destruct(window->anchorPairs);
+        }
+        pairwiseAlignmentBatch_destruct(batch);
+        if (readSymbols.sequence != NULL) {
+            symbolString_destruct(readSymbols);
+        }
+        stList_destruct(windows);
+        readLength += chunkRead->rleRead->length;
 
-        // Cleanup
-        stList_destruct(matches);
-        stList_destruct(inserts);
-        stList_destruct(deletes);
-        stList_destructIterator(alignmentItor);
+        poa_augmentPacked(poa, chunkRead->rleRead, chunkRead->forwardStrand, k, matches, inserts, deletes,
+                          polishParams);
     }
 
+    // Cleanup
+    alignedPairs_destruct(matches);
+    alignedPairs_destruct(inserts);
+    alignedPairs_destruct(deletes);
+    symbolString_destruct(referenceSymbols);
+    free(disagreement);
+    poa_destructGapIndices(poa);
+    poa_buildObservationArena(poa);
+
+    char *logIdentifier = getLogIdentifier();
+    st_logInfo(" %s Realigned %" PRIi64 " of %" PRIi64 " read positions, in windows of disagreement with the "
+               "reference\n", logIdentifier, realignedReadLength, readLength);
+    free(logIdentifier);
+
     return poa;
 }
 
@@ -879,24 +1867,32 @@ double *poaNode_getStrandSpecificBaseWeights(PoaNode *node, stList *bamChunkRead
 void poa_printRepeatCountsCSV(Poa *poa, FILE *fH, stList *bamChunkReads) {
     fprintf(fH, "REF_INDEX,REF_BASE");
     fprintf(fH, ",REPEAT_COUNT_OBSxN(READ_BASE,READ_STRAND,REPEAT_COUNT,WEIGHT)\n");
+    CsvWriter *writer = csvWriter_construct(fH);
 
     // Print info for each base in reference in turn
     for (int64_t i = 0; i < stList_length(poa->nodes); i++) {
         PoaNode *node = stList_get(poa->nodes, i);
 
-        fprintf(fH, "%" PRIi64 ",%c", i, node->base);
+        csvWriter_int(writer, i);
+        csvWriter_char(writer, ',');
+        csvWriter_char(writer, node->base);
 
         for (int64_t j = 0; j < stList_length(node->observations); j++) {
             PoaBaseObservation *obs = stList_get(node->observations, j);
             BamChunkRead *bamChunkRead = stList_get(bamChunkReads, obs->readNo);
-            int64_t repeatCount = bamChunkRead->rleRead->repeatCounts[obs->offset];
+            int64_t repeatCount = rleString_getRepeatCount(bamChunkRead->rleRead, obs->offset);
             char base = bamChunkRead->rleRead->rleString[obs->offset];
-            fprintf(fH, ",%c%c%" PRIi64 ",%.3f", base, bamChunkRead->forwardStrand ? '+' : '-', repeatCount,
-                    obs->weight / PAIR_ALIGNMENT_PROB_1);
+            csvWriter_char(writer, ',');
+            csvWriter_char(writer, base);
+            csvWriter_char(writer, bamChunkRead->forwardStrand ? '+' : '-');
+            csvWriter_int(writer, repeatCount);
+            csvWriter_char(writer, ',');
+            csvWriter_float(writer, obs->weight / PAIR_ALIGNMENT_PROB_1, 3);
         }
 
-        fprintf(fH, "\n");
+        csvWriter_char(writer, '\n');
     }
+    csvWriter_destruct(writer);
 }
 
 void poa_printDOT(Poa *poa, FILE *fH, stList *bamChunkReads) {
@@ -921,7 +1917,7 @@ void poa_printDOT(Poa *poa, FILE *fH, stList *bamChunkReads) {
             // skip non-match rates
             if (rleString->rleString[obvs->offset] != node->base) continue;
             // save run length
-            int64_t rl = rleString->repeatCounts[obvs->offset];
+            int64_t rl = rleString_getRepeatCount(rleString, obvs->offset);
             if (rl > 50) rl = 50;
             runLengths[rl - 1] += obvs->weight;
         }
@@ -979,17 +1975,17 @@ void poa_printDOT(Poa *poa, FILE *fH, stList *bamChunkReads) {
 
 }
 
-void printMLRepeatCounts(RepeatSubMatrix *repeatSubMatrix, FILE *fh, Symbol base, stList *observations,
-                         stList *bamChunkReads) {
+void printMLRepeatCounts(RepeatSubMatrix *repeatSubMatrix, CsvWriter *writer, Symbol base, PoaBaseObservation *observations,
+                         int64_t observationNo, stList *bamChunkReads) {
     int64_t minRepeatLength, maxRepeatLength;
 
     // Calculate range of repeat counts observed
-    repeatSubMatrix_getMinAndMaxRepeatCountObservations(repeatSubMatrix, observations,
+    repeatSubMatrix_getMinAndMaxRepeatCountObservations(repeatSubMatrix, observations, observationNo,
                                                         bamChunkReads, &minRepeatLength, &maxRepeatLength);
 
     if (minRepeatLength == repeatSubMatrix->maximumRepeatLength) { // Case we have no valid observations
         for (int64_t i = 1; i < repeatSubMatrix->maximumRepeatLength; i++) {
-            fprintf(fh, ",0");
+            csvWriter_string(writer, ",0");
         }
         return;
     }
@@ -998,25 +1994,26 @@ void printMLRepeatCounts(RepeatSubMatrix *repeatSubMatrix, FILE *fh, Symbol base
     double logProbabilities[maxRepeatLength - minRepeatLength + 1];
 
     // Get weights for each repeat count
-    repeatSubMatrix_getRepeatCountProbs(repeatSubMatrix, base, observations,
+    repeatSubMatrix_getRepeatCountProbs(repeatSubMatrix, base, observations, observationNo,
                                         bamChunkReads, logProbabilities, minRepeatLength, maxRepeatLength);
 
     // Calculate the normalizing constant for the probabilities
     double totalProb = LOG_ZERO;
     for (int64_t i = minRepeatLength; i <= maxRepeatLength; i++) {
-        totalProb = stMath_logAddExact(logProbabilities[i - minRepeatLength] * 2.302585093,
-                                       totalProb); // Use constant to move from base 10 to base e
+        totalProb = logAddPrecise(logProbabilities[i - minRepeatLength] * 2.302585093,
+                                  totalProb); // Use constant to move from base 10 to base e
     }
 
     // Print the repeat counts
     for (int64_t i = 1; i < minRepeatLength; i++) {
-        fprintf(fh, ",0");
+        csvWriter_string(writer, ",0");
     }
     for (int64_t i = minRepeatLength; i <= maxRepeatLength; i++) {
-        fprintf(fh, ",%f", (float) exp(logProbabilities[i - minRepeatLength] * 2.302585093 - totalProb));
+        csvWriter_char(writer, ',');
+        csvWriter_float(writer, (float) exp(logProbabilities[i - minRepeatLength] * 2.302585093 - totalProb), 6);
     }
     for (int64_t i = maxRepeatLength + 1; i < repeatSubMatrix->maximumRepeatLength; i++) {
-        fprintf(fh, ",0");
+        csvWriter_string(writer, ",0");
     }
 }
 
@@ -1041,6 +2038,7 @@ void poa_printCSV(Poa *poa, FILE *fH,
 
     fprintf(fH,
             ",DELETES\n"); //xN(DELETE_LENGTH,TOTAL_WEIGHT,FRACTION_POS_STRAND)
+    CsvWriter *writer = csvWriter_construct(fH);
 
     // Print info for each base in reference in turn
     for (int64_t i = 0; i < stList_length(poa->nodes); i++) {
@@ -1054,53 +2052,70 @@ void poa_printCSV(Poa *poa, FILE *fH,
                                                                    &totalWeight, &totalPositiveWeight,
                                                                    &totalNegativeWeight, poa->alphabet, NULL);
 
-        fprintf(fH, "%" PRIi64 ",%c,%" PRIi64 ",%f,%f", i, node->base, node->repeatCount,
-                nFloat(totalWeight, PAIR_ALIGNMENT_PROB_1),
-                nFloat(totalPositiveWeight, totalPositiveWeight + totalNegativeWeight));
+        csvWriter_int(writer, i);
+        csvWriter_char(writer, ',');
+        csvWriter_char(writer, node->base);
+        csvWriter_char(writer, ',');
+        csvWriter_int(writer, node->repeatCount);
+        csvWriter_char(writer, ',');
+        csvWriter_float(writer, nFloat(totalWeight, PAIR_ALIGNMENT_PROB_1), 6);
+        csvWriter_char(writer, ',');
+        csvWriter_float(writer, nFloat(totalPositiveWeight, totalPositiveWeight + totalNegativeWeight), 6);
 
         for (int64_t j = 0; j < poa->alphabet->alphabetSize; j++) {
             double positiveStrandBaseWeight = baseWeights[j * 2 + 1];
             double negativeStrandBaseWeight = baseWeights[j * 2 + 0];
             double totalBaseWeight = positiveStrandBaseWeight + negativeStrandBaseWeight;
 
-            fprintf(fH, ",%f,%f", nFloat(node->baseWeights[j], totalWeight),
-                    nFloat(positiveStrandBaseWeight, totalBaseWeight));
+            csvWriter_char(writer, ',');
+            csvWriter_float(writer, nFloat(node->baseWeights[j], totalWeight), 6);
+            csvWriter_char(writer, ',');
+            csvWriter_float(writer, nFloat(positiveStrandBaseWeight, totalBaseWeight), 6);
         }
 
         free(baseWeights);
 
         // Print repeat counts
-        printMLRepeatCounts(repeatSubMatrix, fH, poa->alphabet->convertCharToSymbol(node->base),
-                            node->observations, bamChunkReads);
+        int64_t observationNo;
+        PoaBaseObservation *observations = poa_getNodeObservations(poa, i, &observationNo);
+        printMLRepeatCounts(repeatSubMatrix, writer, poa->alphabet->convertCharToSymbol(node->base),
+                            observations, observationNo, bamChunkReads);
 
         // Inserts
-        fprintf(fH, ",");
+        csvWriter_char(writer, ',');
         for (int64_t j = 0; j < stList_length(node->inserts); j++) {
             PoaInsert *insert = stList_get(node->inserts, j);
             if (poaInsert_getWeight(insert) / PAIR_ALIGNMENT_PROB_1 >= indelSignificanceThreshold) {
                 char *s = rleString_expand(insert->insert);
-                fprintf(fH, "|%s|%f|%f",
-                        s, nFloat(poaInsert_getWeight(insert), PAIR_ALIGNMENT_PROB_1),
-                        nFloat(insert->weightForwardStrand, poaInsert_getWeight(insert)));
+                csvWriter_char(writer, '|');
+                csvWriter_string(writer, s);
+                csvWriter_char(writer, '|');
+                csvWriter_float(writer, nFloat(poaInsert_getWeight(insert), PAIR_ALIGNMENT_PROB_1), 6);
+                csvWriter_char(writer, '|');
+                csvWriter_float(writer, nFloat(insert->weightForwardStrand, poaInsert_getWeight(insert)), 6);
                 free(s);
             }
         }
 
         // Deletes
-        fprintf(fH, ",");
+        csvWriter_char(writer, ',');
         for (int64_t j = 0; j < stList_length(node->deletes); j++) {
             PoaDelete *delete = stList_get(node->deletes, j);
             if (poaDelete_getWeight(delete) / PAIR_ALIGNMENT_PROB_1 >= indelSignificanceThreshold) {
-                fprintf(fH, "|%" PRIi64 "|%f|%f",
-                        delete->length, nFloat(poaDelete_getWeight(delete), PAIR_ALIGNMENT_PROB_1),
-                        nFloat(delete->weightForwardStrand, poaDelete_getWeight(delete)));
+                csvWriter_char(writer, '|');
+                csvWriter_int(writer, delete->length);
+                csvWriter_char(writer, '|');
+                csvWriter_float(writer, nFloat(poaDelete_getWeight(delete), PAIR_ALIGNMENT_PROB_1), 6);
+                csvWriter_char(writer, '|');
+                csvWriter_float(writer, nFloat(delete->weightForwardStrand, poaDelete_getWeight(delete)), 6);
             }
         }
-        fprintf(fH, "\n");
+        csvWriter_char(writer, '\n');
     }
+    csvWriter_destruct(writer);
 }
 
-void poa_printPhasedCSV_indelPrint(stList *observations, FILE *fH,
+void poa_printPhasedCSV_indelPrint(stList *observations, CsvWriter *writer,
                                    stList *bamChunkReads, stSet *readsInHap1, stSet *readsInHap2) {
     double totalPositiveWeightHap1 = 0.0, totalNegativeWeightHap1 = 0.0;
     double totalPositiveWeightHap2 = 0.0, totalNegativeWeightHap2 = 0.0;
@@ -1126,12 +2141,15 @@ void poa_printPhasedCSV_indelPrint(stList *observations, FILE *fH,
     double totalWeight =
             totalPositiveWeightHap1 + totalNegativeWeightHap1 + totalPositiveWeightHap2 + totalNegativeWeightHap2;
 
-    fprintf(fH, "|%f|%f|%f|%f|%f",
-            nFloat(totalWeight, PAIR_ALIGNMENT_PROB_1),
-            nFloat(totalPositiveWeightHap1 + totalNegativeWeightHap1, totalWeight),
-            nFloat(totalPositiveWeightHap2 + totalNegativeWeightHap2, totalWeight),
-            nFloat(totalPositiveWeightHap1, totalPositiveWeightHap1 + totalNegativeWeightHap1),
-            nFloat(totalPositiveWeightHap2, totalPositiveWeightHap2 + totalNegativeWeightHap2));
+    double fields[5] = {nFloat(totalWeight, PAIR_ALIGNMENT_PROB_1),
+                        nFloat(totalPositiveWeightHap1 + totalNegativeWeightHap1, totalWeight),
+                        nFloat(totalPositiveWeightHap2 + totalNegativeWeightHap2, totalWeight),
+                        nFloat(totalPositiveWeightHap1, totalPositiveWeightHap1 + totalNegativeWeightHap1),
+                        nFloat(totalPositiveWeightHap2, totalPositiveWeightHap2 + totalNegativeWeightHap2)};
+    for (int64_t i = 0; i < 5; i++) {
+        csvWriter_char(writer, '|');
+        csvWriter_float(writer, fields[i], 6);
+    }
 }
 
 void poa_printPhasedCSV(Poa *poa, FILE *fH,
@@ -1155,6 +2173,7 @@ void poa_printPhasedCSV(Poa *poa, FILE *fH,
     fprintf(fH,
             ",INSERTS" //xN(INSERT_SEQ,TOTAL_WEIGHT,FRACTION_HAP1_WEIGHT,FRACTION_HAP2_WEIGHT,FRACTION_POS_STRAND_HAP1,FRACTION_POS_STRAND_HAP2)'
             ",DELETES\n"); //xN(DELETE_LENGTH,TOTAL_WEIGHT,FRACTION_HAP1_WEIGHT,FRACTION_HAP2_WEIGHT,FRACTION_POS_STRAND_HAP1,FRACTION_POS_STRAND_HAP2)'
+    CsvWriter *writer = csvWriter_construct(fH);
 
     // Print info for each base in reference in turn
     for (int64_t i = 0; i < stList_length(poa->nodes); i++) {
@@ -1178,10 +2197,19 @@ void poa_printPhasedCSV(Poa *poa, FILE *fH,
                 &totalWeightHap2, &totalPositiveWeightHap2, &totalNegativeWeightHap2, poa->alphabet, readsInHap2);
 
         //fprintf(fH, "REF_INDEX,REF_BASE,TOTAL_WEIGHT,FRACTION_HAP1_WEIGHT,FRACTION_HAP2_WEIGHT,FRACTION_POS_STRAND_HAP1,FRACTION_POS_STRAND_HAP2");
-        fprintf(fH, "%" PRIi64 ",%c,%" PRIi64 ",%f,%f,%f,%f,%f", i, node->base, node->repeatCount,
-                nFloat(totalWeight, PAIR_ALIGNMENT_PROB_1),
-                nFloat(totalWeightHap1, totalWeight), nFloat(totalWeightHap2, totalWeight),
-                nFloat(totalPositiveWeightHap1, totalWeightHap1), nFloat(totalPositiveWeightHap2, totalWeightHap2));
+        csvWriter_int(writer, i);
+        csvWriter_char(writer, ',');
+        csvWriter_char(writer, node->base);
+        csvWriter_char(writer, ',');
+        csvWriter_int(writer, node->repeatCount);
+        double nodeFields[5] = {nFloat(totalWeight, PAIR_ALIGNMENT_PROB_1),
+                                nFloat(totalWeightHap1, totalWeight), nFloat(totalWeightHap2, totalWeight),
+                                nFloat(totalPositiveWeightHap1, totalWeightHap1),
+                                nFloat(totalPositiveWeightHap2, totalWeightHap2)};
+        for (int64_t k = 0; k < 5; k++) {
+            csvWriter_char(writer, ',');
+            csvWriter_float(writer, nodeFields[k], 6);
+        }
 
         for (int64_t j = 0; j < poa->alphabet->alphabetSize; j++) {
             double positiveStrandBaseWeight = baseWeights[j * 2 + 1];
@@ -1195,11 +2223,16 @@ void poa_printPhasedCSV(Poa *poa, FILE *fH,
             double negativeStrandBaseWeightHap2 = baseWeightsHap2[j * 2 + 0];
 
             //fprintf(fH, ",NORM_BASE_%c_WEIGHT,FRACTION_BASE_%c_HAP1,FRACTION_BASE_%c_HAP2,FRACTION_BASE_%c_POS_STRAND_HAP1,FRACTION_BASE_%c_POS_STRAND_HAP2", c, c, c, c);
-            fprintf(fH, ",%f,%f,%f,%f,%f", nFloat(totalBaseWeight, totalWeight),
+            double baseFields[5] = {
+                    nFloat(totalBaseWeight, totalWeight),
                     nFloat(positiveStrandBaseWeightHap1 + negativeStrandBaseWeightHap1, totalBaseWeight),
                     nFloat(positiveStrandBaseWeightHap2 + negativeStrandBaseWeightHap2, totalBaseWeight),
                     nFloat(positiveStrandBaseWeightHap1, positiveStrandBaseWeightHap1 + negativeStrandBaseWeightHap1),
-                    nFloat(positiveStrandBaseWeightHap2, positiveStrandBaseWeightHap2 + negativeStrandBaseWeightHap2));
+                    nFloat(positiveStrandBaseWeightHap2, positiveStrandBaseWeightHap2 + negativeStrandBaseWeightHap2)};
+            for (int64_t k = 0; k < 5; k++) {
+                csvWriter_char(writer, ',');
+                csvWriter_float(writer, baseFields[k], 6);
+            }
         }
 
         free(baseWeights);
@@ -1207,55 +2240,63 @@ void poa_printPhasedCSV(Poa *poa, FILE *fH,
         free(baseWeightsHap2);
 
         // Split observations between haplotypes (assume reads not in hap1 are in hap2)
-        stList *observationsHap1 = stList_construct();
-        stList *observationsHap2 = stList_construct();
-        for (int64_t j = 0; j < stList_length(node->observations); j++) {
-            PoaBaseObservation *observation = stList_get(node->observations, j);
-            BamChunkRead *read = stList_get(bamChunkReads, observation->readNo);
-            stList_append(stSet_search(readsInHap1, read) != NULL ? observationsHap1 : observationsHap2, observation);
+        int64_t observationNo, observationNoHap1 = 0, observationNoHap2 = 0;
+        PoaBaseObservation *observations = poa_getNodeObservations(poa, i, &observationNo);
+        PoaBaseObservation *observationsHap1 = st_malloc(sizeof(PoaBaseObservation) * (observationNo + 1));
+        PoaBaseObservation *observationsHap2 = st_malloc(sizeof(PoaBaseObservation) * (observationNo + 1));
+        for (int64_t j = 0; j < observationNo; j++) {
+            BamChunkRead *read = stList_get(bamChunkReads, observations[j].readNo);
+            if (stSet_search(readsInHap1, read) != NULL) {
+                observationsHap1[observationNoHap1++] = observations[j];
+            } else {
+                observationsHap2[observationNoHap2++] = observations[j];
+            }
         }
 
         // Print repeat counts for hap1
-        printMLRepeatCounts(repeatSubMatrix, fH, poa->alphabet->convertCharToSymbol(node->base),
-                            observationsHap1, bamChunkReads);
+        printMLRepeatCounts(repeatSubMatrix, writer, poa->alphabet->convertCharToSymbol(node->base),
+                            observationsHap1, observationNoHap1, bamChunkReads);
 
         // Print repeat counts for hap2
-        printMLRepeatCounts(repeatSubMatrix, fH, poa->alphabet->convertCharToSymbol(node->base),
-                            observationsHap2, bamChunkReads);
+        printMLRepeatCounts(repeatSubMatrix, writer, poa->alphabet->convertCharToSymbol(node->base),
+                            observationsHap2, observationNoHap2, bamChunkReads);
 
         // Cleanup
-        stList_destruct(observationsHap1);
-        stList_destruct(observationsHap2);
+        free(observationsHap1);
+        free(observationsHap2);
 
         // Inserts
-        fprintf(fH, ",");
+        csvWriter_char(writer, ',');
         for (int64_t j = 0; j < stList_length(node->inserts); j++) {
             PoaInsert *insert = stList_get(node->inserts, j);
             if (poaInsert_getWeight(insert) / PAIR_ALIGNMENT_PROB_1 >= indelSignificanceThreshold) {
 
                 //fprintf(fH, "\tINSERTSxN(INSERT_SEQ, TOTAL_WEIGHT, FRACTION_HAP1_WEIGHT, FRACTION_HAP2_WEIGHT, FRACTION_POS_STRAND_HAP1, FRACTION_POS_STRAND_HAP2)\n");
                 char *s = rleString_expand(insert->insert);
-                fprintf(fH, "|%s", s);
-                poa_printPhasedCSV_indelPrint(insert->observations, fH,
+                csvWriter_char(writer, '|');
+                csvWriter_string(writer, s);
+                poa_printPhasedCSV_indelPrint(insert->observations, writer,
                                               bamChunkReads, readsInHap1, readsInHap2);
                 free(s);
             }
         }
 
         // Deletes
-        fprintf(fH, ",");
+        csvWriter_char(writer, ',');
         for (int64_t j = 0; j < stList_length(node->deletes); j++) {
             PoaDelete *delete = stList_get(node->deletes, j);
             if (poaDelete_getWeight(delete) / PAIR_ALIGNMENT_PROB_1 >= indelSignificanceThreshold) {
 
                 //fprintf(fH, "\tDELETESxN(DELETE_LENGTH, TOTAL_WEIGHT, FRACTION_HAP1_WEIGHT, FRACTION_HAP2_WEIGHT, FRACTION_POS_STRAND_HAP1, FRACTION_POS_STRAND_HAP2)\n");
-                fprintf(fH, "|%" PRIi64 "", delete->length);
-                poa_printPhasedCSV_indelPrint(delete->observations, fH,
+                csvWriter_char(writer, '|');
+                csvWriter_int(writer, delete->length);
+                poa_printPhasedCSV_indelPrint(delete->observations, writer,
                                               bamChunkReads, readsInHap1, readsInHap2);
             }
         }
-        fprintf(fH, "\n");
+        csvWriter_char(writer, '\n');
     }
+    csvWriter_destruct(writer);
 }
 
 void poa_print(Poa *poa, FILE *fH,
@@ -1347,45 +2388,106 @@ getMaxWeight(const double *weights, uint64_t weightNo, uint64_t referenceIndex,
     return weights[referenceIndex] * referenceWeightPenalty >= maxWeight ? referenceIndex : maxIndex;
 }
 
-RleString *poa_getConsensus(Poa *poa, int64_t **poaToConsensusMap, PolishParams *pp) {
-    // Cheesy profile HMM like algorithm
-    // Calculates forward probabilities through model, then
-    // traces back through max prob local path, greedily
+/*
+ * The consensus of a window of the poa, computed by poa_getWindowConsensus. Within the chunk's poa the windows are
+ * separated by anchor nodes, which have no inserts or deletes and are not deleted over, so the only transition into
+ * the node following an anchor is the match from it and the forward probabilities and traceback of each window are
+ * independent of those of the others.
+ */
+typedef struct _poaConsensusWindow {
+    int64_t start; // The anchor the window follows, or 0 for the first window
+    int64_t end; // The anchor ending the window, or the number of nodes for the last window
+    char *consensus; // The expanded consensus of the window
+    int64_t length; // The length of the window's consensus, in runs if run length encoded
+} PoaConsensusWindow;
+
+// The least number of nodes in a window of poa_getConsensus, so the windows are worth a task each
+#define POA_CONSENSUS_MIN_WINDOW_LENGTH 4096
+
+static PoaConsensusWindow *poa_getConsensusWindows(Poa *poa, int64_t *windowNo) {
+    /*
+     * Splits the nodes into windows at anchors at least POA_CONSENSUS_MIN_WINDOW_LENGTH nodes apart.
+     */
+    int64_t nodeNo = stList_length(poa->nodes);
+    stList *anchors = stList_construct();
+    int64_t deleteEnd = 0; // The furthest node the deletes of the nodes so far lead to
+    for (int64_t i = 0; i < nodeNo - 1; i++) {
+        PoaNode *node = stList_get(poa->nodes, i);
+        int64_t windowStart = stList_length(anchors) == 0 ? 0 : (int64_t) stList_peek(anchors);
+        if (i - windowStart >= POA_CONSENSUS_MIN_WINDOW_LENGTH && deleteEnd <= i &&
+            stList_length(node->inserts) == 0 && stList_length(node->deletes) == 0) {
+            stList_append(anchors, (void *) i);
+        }
+        for (int64_t j = 0; j < stList_length(node->deletes); j++) {
+            PoaDelete *delete = stList_get(node->deletes, j);
+            deleteEnd = i + delete->length + 1 > deleteEnd ? i + delete->length + 1 : deleteEnd;
+        }
+    }
+
+    *windowNo = stList_length(anchors) + 1;
+    PoaConsensusWindow *windows = st_calloc(*windowNo, sizeof(PoaConsensusWindow));
+    for (int64_t i = 0; i < *windowNo; i++) {
+        windows[i].start = i == 0 ? 0 : (int64_t) stList_get(anchors, i - 1);
+        windows[i].end = i + 1 < *windowNo ? (int64_t) stList_get(anchors, i) : nodeNo;
+    }
+    stList_destruct(anchors);
+    return windows;
+}
+
+static char poa_getConsensusBase(Poa *poa, PoaNode *node, PolishParams *pp) {
+    // Picks a base, giving a discount to the reference base, because the alignment is biased towards it
+    int64_t maxBaseIndex = getMaxWeight(node->baseWeights, poa->alphabet->alphabetSize,
+                                        poa->alphabet->convertCharToSymbol(node->base), pp->referenceBasePenalty);
+    return poa->alphabet->convertSymbolToChar(maxBaseIndex);
+}
+
+static void poa_getWindowConsensus(Poa *poa, PoaConsensusWindow *window, int64_t *poaToConsensusMap,
+                                   PolishParams *pp) {
+    /*
+     * Computes the consensus of the window, setting the positions of its nodes in poaToConsensusMap, counted from the
+     * end of the window's consensus. The probabilities are indexed from the start of the window, where the forward
+     * probability is log(1), it being the same up to a constant as if computed from the start of the poa.
+     */
+    int64_t nodeNo = stList_length(poa->nodes);
+    int64_t start = window->start;
+    int64_t windowLength = window->end - start;
 
     // Probabilities/weights we keep track of.
 
     // Total weight of outgoing transitions
-    double *totalOutgoingWeights = st_calloc(stList_length(poa->nodes), sizeof(double));
+    double *totalOutgoingWeights = st_calloc(windowLength, sizeof(double));
 
     // Forward probabilities
-    double *nodeForwardLogProbs = st_calloc(stList_length(poa->nodes) + 1, sizeof(double));
+    double *nodeForwardLogProbs = st_calloc(windowLength + 1, sizeof(double));
     // Initialize, only start state has log(1) = 0 prob
-    for (int64_t i = 1; i < stList_length(poa->nodes) + 1; i++) {
+    for (int64_t i = 1; i < windowLength + 1; i++) {
         nodeForwardLogProbs[i] = LOG_ZERO;
     }
 
     // Forward probabilities of transitioning from a node to the its successor without
     // an indel
-    double *matchTransitionForwardLogProbs = st_calloc(stList_length(poa->nodes), sizeof(double));
+    double *matchTransitionForwardLogProbs = st_calloc(windowLength, sizeof(double));
 
     // Calculate incoming deletions for each node
 
     stList *incomingDeletions = stList_construct3(0, (void (*)(void *)) stList_destruct);
-    for (int64_t i = 0; i < stList_length(poa->nodes) + 1; i++) {
+    for (int64_t i = 0; i < windowLength + 1; i++) {
         stList_append(incomingDeletions, stList_construct());
     }
-    for (int64_t i = 0; i < stList_length(poa->nodes); i++) {
+    for (int64_t i = start; i < window->end; i++) {
         PoaNode *node = stList_get(poa->nodes, i);
         for (int64_t j = 0; j < stList_length(node->deletes); j++) {
             PoaDelete *delete = stList_get(node->deletes, j);
-            stList_append(stList_get(incomingDeletions, i + delete->length + 1), delete);
+            assert(i + delete->length + 1 <= window->end);
+            stList_append(stList_get(incomingDeletions, i - start + delete->length + 1), delete);
         }
     }
 
-    // Walk through the graph left-to-right calculating forward probabilities
+    // Walk through the window left-to-right calculating forward probabilities
 
-    for (int64_t i = 0; i < stList_length(poa->nodes); i++) {
+    for (int64_t i = start; i < window->end; i++) {
         PoaNode *node = stList_get(poa->nodes, i);
+        int64_t w = i - start;
 
         // Calculate total weight of indels connecting from this node
 
@@ -1406,17 +2508,17 @@ RleString *poa_getConsensus(Poa *poa, int64_t **poaToConsensusMap, PolishParams
 
         double matchTransitionWeight = 0.0;
         if (i == 0) {
-            if (stList_length(poa->nodes) == 1) { // In case is zero length reference
+            if (nodeNo == 1) { // In case is zero length reference
                 matchTransitionWeight = 1.0;
             } else {
                 // Set the initiation probability according to the average base weight
-                for (int64_t j = 1; j < stList_length(poa->nodes); j++) {
+                for (int64_t j = 1; j < nodeNo; j++) {
                     PoaNode *nNode = stList_get(poa->nodes, j);
                     for (int64_t k = 0; k < poa->alphabet->alphabetSize; k++) {
                         matchTransitionWeight += nNode->baseWeights[k];
                     }
                 }
-                matchTransitionWeight /= (double) stList_length(poa->nodes) - 1;
+                matchTransitionWeight /= (double) nodeNo - 1;
                 matchTransitionWeight -= totalIndelWeight;
             }
         } else {
@@ -1430,58 +2532,47 @@ RleString *poa_getConsensus(Poa *poa, int64_t **poaToConsensusMap, PolishParams
         matchTransitionWeight = matchTransitionWeight <= 0.0 ? 0.0001 : matchTransitionWeight; // Make a small value
 
         // Calculate the total weight of outgoing transitions
-        totalOutgoingWeights[i] = matchTransitionWeight + totalIndelWeight;
+        totalOutgoingWeights[w] = matchTransitionWeight + totalIndelWeight;
 
         // Update the probabilities of nodes that connect by to this node
 
         // Inserts
         for (int64_t j = 0; j < stList_length(node->inserts); j++) {
             PoaInsert *insert = stList_get(node->inserts, j);
-            nodeForwardLogProbs[i + 1] = logAdd(nodeForwardLogProbs[i + 1],
-                                                nodeForwardLogProbs[i] +
-                                                log(poaInsert_getWeight(insert) / totalOutgoingWeights[i]));
+            nodeForwardLogProbs[w + 1] = logAdd(nodeForwardLogProbs[w + 1],
+                                                nodeForwardLogProbs[w] +
+                                                log(poaInsert_getWeight(insert) / totalOutgoingWeights[w]));
         }
 
         // Deletes
         for (int64_t j = 0; j < stList_length(node->deletes); j++) {
             PoaDelete *delete = stList_get(node->deletes, j);
-            nodeForwardLogProbs[i + delete->length + 1] = logAdd(nodeForwardLogProbs[i + delete->length + 1],
-                                                                 nodeForwardLogProbs[i] +
+            nodeForwardLogProbs[w + delete->length + 1] = logAdd(nodeForwardLogProbs[w + delete->length + 1],
+                                                                 nodeForwardLogProbs[w] +
                                                                  log(poaDelete_getWeight(delete) /
-                                                                     totalOutgoingWeights[i]));
+                                                                     totalOutgoingWeights[w]));
         }
 
         // Match
-        matchTransitionForwardLogProbs[i] =
-                nodeForwardLogProbs[i] + log(matchTransitionWeight / totalOutgoingWeights[i]);
-        nodeForwardLogProbs[i + 1] = logAdd(nodeForwardLogProbs[i + 1], matchTransitionForwardLogProbs[i]);
+        matchTransitionForwardLogProbs[w] =
+                nodeForwardLogProbs[w] + log(matchTransitionWeight / totalOutgoingWeights[w]);
+        nodeForwardLogProbs[w + 1] = logAdd(nodeForwardLogProbs[w + 1], matchTransitionForwardLogProbs[w]);
     }
 
-    // Now traceback picking consensus greedily
-
-    // Allocate consensus map, setting the alignment of reference
-    // string positions initially all to gaps.
-    *poaToConsensusMap = st_malloc((stList_length(poa->nodes) - 1) * sizeof(int64_t));
-    for (int64_t i = 0; i < stList_length(poa->nodes) - 1; i++) {
-        (*poaToConsensusMap)[i] = -1;
-    }
+    // Now traceback picking consensus greedily, from the base following the window, which the traceback of the
+    // following window always ends with
 
     stList *consensusStrings = stList_construct3(0, free);
     int64_t runningConsensusLength = 0;
-    char previousBase = '-';
+    char previousBase = window->end < nodeNo ? poa_getConsensusBase(poa, stList_get(poa->nodes, window->end + 1), pp)
+                                             : '-';
 
-    for (int64_t i = stList_length(poa->nodes); i > 0;) {
+    for (int64_t i = window->end; i > start;) {
 
         //  Add base if not at end
-        if (i < stList_length(poa->nodes)) {
+        if (i < nodeNo) {
             PoaNode *node = stList_get(poa->nodes, i);
-
-            // Picks a base, giving a discount to the reference base,
-            // because the alignment is biased towards it
-            int64_t maxBaseIndex = getMaxWeight(node->baseWeights, poa->alphabet->alphabetSize,
-                                                poa->alphabet->convertCharToSymbol(node->base),
-                                                pp->referenceBasePenalty);
-            char base = poa->alphabet->convertSymbolToChar(maxBaseIndex);
+            char base = poa_getConsensusBase(poa, node, pp);
 
             if (pp->useRunLengthEncoding) {
 
@@ -1497,12 +2588,12 @@ RleString *poa_getConsensus(Poa *poa, int64_t **poaToConsensusMap, PolishParams
 
                 // Update poa to consensus map and increase RLE consensus length
                 if (previousBase != base) {
-                    (*poaToConsensusMap)[i - 1] = runningConsensusLength++;
+                    poaToConsensusMap[i - 1] = runningConsensusLength++;
                 }
                 previousBase = base;
             } else { // Otherwise repeat counts always one
                 stList_append(consensusStrings, expandChar(base, 1));
-                (*poaToConsensusMap)[i - 1] = runningConsensusLength++;
+                poaToConsensusMap[i - 1] = runningConsensusLength++;
             }
         }
 
@@ -1513,7 +2604,8 @@ RleString *poa_getConsensus(Poa *poa, int64_t **poaToConsensusMap, PolishParams
         PoaNode *pNode = stList_get(poa->nodes, i - 1);
         for (int64_t j = 0; j < stList_length(pNode->inserts); j++) {
             PoaInsert *insert = stList_get(pNode->inserts, j);
-            double p = log(poaInsert_getWeight(insert) / totalOutgoingWeights[i - 1]) + nodeForwardLogProbs[i - 1];
+            double p = log(poaInsert_getWeight(insert) / totalOutgoingWeights[i - 1 - start]) +
+                       nodeForwardLogProbs[i - 1 - start];
             if (p > maxInsertProb) {
                 maxInsertProb = p;
                 maxInsert = insert;
@@ -1525,11 +2617,11 @@ RleString *poa_getConsensus(Poa *poa, int64_t **poaToConsensusMap, PolishParams
         double maxDeleteProb = LOG_ZERO;
         double totalDeleteProb = LOG_ZERO;
         PoaDelete *maxDelete = NULL;
-        stList *incidentDeletes = stList_get(incomingDeletions, i);
+        stList *incidentDeletes = stList_get(incomingDeletions, i - start);
         for (int64_t j = 0; j < stList_length(incidentDeletes); j++) {
             PoaDelete *delete = stList_get(incidentDeletes, j);
-            double p = log(poaDelete_getWeight(delete) / totalOutgoingWeights[i - delete->length - 1]) +
-                       nodeForwardLogProbs[i - delete->length - 1];
+            double p = log(poaDelete_getWeight(delete) / totalOutgoingWeights[i - start - delete->length - 1]) +
+                       nodeForwardLogProbs[i - start - delete->length - 1];
             if (p > maxDeleteProb) {
                 maxDeleteProb = p;
                 maxDelete = delete;
@@ -1537,10 +2629,8 @@ RleString *poa_getConsensus(Poa *poa, int64_t **poaToConsensusMap, PolishParams
             totalDeleteProb = logAdd(totalDeleteProb, p);
         }
 
-        //fprintf(stderr, "%i Maxinsert: %f Maxdelete %f Match %f\n", (int)i, (float)maxInsertProb, (float)maxDeleteProb, (float)matchTransitionForwardLogProbs[i-1]);
-
-        if (matchTransitionForwardLogProbs[i - 1] >= totalDeleteProb &&
-            matchTransitionForwardLogProbs[i - 1] >= totalInsertProb) {
+        if (matchTransitionForwardLogProbs[i - 1 - start] >= totalDeleteProb &&
+            matchTransitionForwardLogProbs[i - 1 - start] >= totalInsertProb) {
             // Is likely a match, move back to previous reference base
             i--;
         } else if (totalInsertProb >= totalDeleteProb) {
@@ -1562,27 +2652,93 @@ RleString *poa_getConsensus(Poa *poa, int64_t **poaToConsensusMap, PolishParams
         }
     }
 
-    // Concatenate backwards to make consensus string
+    // Concatenate backwards to make the window's consensus string
     stList_reverse(consensusStrings);
+    window->consensus = stString_join2("", consensusStrings);
+    window->length = runningConsensusLength;
+
+    // Cleanup
+    stList_destruct(consensusStrings);
+    stList_destruct(incomingDeletions);
+    free(nodeForwardLogProbs);
+    free(matchTransitionForwardLogProbs);
+    free(totalOutgoingWeights);
+}
+
+static void poa_getWindowConsensuses(Poa *poa, PoaConsensusWindow *windows, int64_t windowNo,
+                                     int64_t *poaToConsensusMap, PolishParams *pp, bool inTasks) {
+    #pragma omp taskloop grainsize(1) if(inTasks)
+    for (int64_t i = 0; i < windowNo; i++) {
+        poa_getWindowConsensus(poa, &windows[i], poaToConsensusMap, pp);
+    }
+}
+
+RleString *poa_getConsensus(Poa *poa, int64_t **poaToConsensusMap, PolishParams *pp) {
+    /*
+     * Cheesy profile HMM like algorithm, calculates forward probabilities through model, then traces back through max
+     * prob local path, greedily. Long poas are split into windows at anchors, whose consensuses are computed in tasks,
+     * in a parallel region opened for them or, within the chunk loops, only while threads that have run out of chunks
+     * are free to take the tasks. The windows depend only on the poa, so the consensus does not depend on the threads.
+     */
+    int64_t nodeNo = stList_length(poa->nodes);
+
+    // Allocate consensus map, setting the alignment of reference
+    // string positions initially all to gaps.
+    *poaToConsensusMap = st_malloc((nodeNo - 1) * sizeof(int64_t));
+    for (int64_t i = 0; i < nodeNo - 1; i++) {
+        (*poaToConsensusMap)[i] = -1;
+    }
+
+    // The consensus of each window
+    int64_t windowNo;
+    PoaConsensusWindow *windows = poa_getConsensusWindows(poa, &windowNo);
+#if defined(_OPENMP)
+    if (windowNo == 1) {
+        poa_getWindowConsensus(poa, &windows[0], *poaToConsensusMap, pp);
+    } else if (!omp_in_parallel()) {
+#pragma omp parallel
+#pragma omp single
+        poa_getWindowConsensuses(poa, windows, windowNo, *poaToConsensusMap, pp, TRUE);
+    } else {
+        poa_getWindowConsensuses(poa, windows, windowNo, *poaToConsensusMap, pp, chunkScheduler_getIdleThreadNo() > 0);
+    }
+#else
+    poa_getWindowConsensuses(poa, windows, windowNo, *poaToConsensusMap, pp, FALSE);
+#endif
+
+    // Concatenate the windows' consensuses, counting the consensus length following each window
+    stList *consensusStrings = stList_construct();
+    int64_t *followingConsensusLengths = st_malloc(windowNo * sizeof(int64_t));
+    int64_t consensusLength = 0;
+    for (int64_t i = windowNo - 1; i >= 0; i--) {
+        followingConsensusLengths[i] = consensusLength;
+        consensusLength += windows[i].length;
+    }
+    for (int64_t i = 0; i < windowNo; i++) {
+        stList_append(consensusStrings, windows[i].consensus);
+    }
     char *expandedConsensusString = stString_join2("", consensusStrings);
     RleString *consensusString = pp->useRunLengthEncoding ? rleString_construct(expandedConsensusString)
                                                           : rleString_construct_no_rle(expandedConsensusString);
     free(expandedConsensusString);
-    assert(runningConsensusLength == consensusString->length);
-
-    // Now reverse the poaToConsensusMap, because offsets are from  end of string but need them to be from beginning
-    for (int64_t i = 0; i < stList_length(poa->nodes) - 1; i++) {
-        if ((*poaToConsensusMap)[i] != -1) {
-            (*poaToConsensusMap)[i] = consensusString->length - 1 - (*poaToConsensusMap)[i];
+    assert(consensusLength == consensusString->length);
+
+    // Now reverse the poaToConsensusMap, because offsets are from the end of each window's consensus but need them to
+    // be from beginning
+    for (int64_t i = 0; i < windowNo; i++) {
+        for (int64_t j = windows[i].start; j < windows[i].end && j < nodeNo - 1; j++) {
+            if ((*poaToConsensusMap)[j] != -1) {
+                (*poaToConsensusMap)[j] = consensusString->length - 1 - followingConsensusLengths[i] -
+                                          (*poaToConsensusMap)[j];
+            }
         }
+        free(windows[i].consensus);
     }
 
     // Cleanup
     stList_destruct(consensusStrings);
-    stList_destruct(incomingDeletions);
-    free(nodeForwardLogProbs);
-    free(matchTransitionForwardLogProbs);
-    free(totalOutgoingWeights);
+    free(followingConsensusLengths);
+    free(windows);
 
     return consensusString;
 }
@@ -1625,6 +2781,11 @@ stList *poa_getReadAlignmentsToConsensus(Poa *poa, stList *bamChunkReads, Polish
     // Alignments
     stList *alignments = stList_construct3(0, (void (*)(void *)) stList_destruct);
 
+    // Buffers for the posterior probabilities, reused for each read
+    AlignedPairs *matches = alignedPairs_construct();
+    AlignedPairs *inserts = alignedPairs_construct();
+    AlignedPairs *deletes = alignedPairs_construct();
+
     // Make the MEA alignments
     SymbolString refSymbolString = rleString_constructSymbolString(poa->refString, 0, poa->refString->length,
                                                                    polishParams->alphabet,
@@ -1634,16 +2795,19 @@ stList *poa_getReadAlignmentsToConsensus(Poa *poa, stList *bamChunkReads, Polish
         BamChunkRead *read = stList_get(bamChunkReads, i);
 
         // Generate the posterior alignment probabilities
-        stList *matches, *inserts, *deletes;
-        getAlignedPairsWithIndelsCroppingReference(poa->refString, read->rleRead, read->forwardStrand,
-                                                   stList_get(anchorAlignments, i), &matches, &inserts, &deletes,
-                                                   polishParams);
+        alignedPairs_clear(matches);
+        alignedPairs_clear(inserts);
+        alignedPairs_clear(deletes);
+        getAlignedPairsWithIndelsCroppingReferencePacked(poa->refString, read->rleRead, read->forwardStrand,
+                                                         stList_get(anchorAlignments, i), matches, inserts, deletes,
+                                                         polishParams);
 
         // Get the MEA alignment
         double alignmentScore;
-        stList *alignment = getMaximalExpectedAccuracyPairwiseAlignment(matches, deletes, inserts,
-                                                                        poa->refString->length, read->rleRead->length,
-                                                                        &alignmentScore, polishParams->p);
+        stList *alignment = getMaximalExpectedAccuracyPairwiseAlignmentPacked(matches, deletes, inserts,
+                                                                              poa->refString->length,
+                                                                              read->rleRead->length,
+                                                                              &alignmentScore, polishParams->p);
 
         // Symbol strings
         SymbolString readSymbolString = rleString_constructSymbolString(read->rleRead, 0, read->rleRead->length,
@@ -1655,9 +2819,6 @@ stList *poa_getReadAlignmentsToConsensus(Poa *poa, stList *bamChunkReads, Polish
         stList *leftShiftedAlignment = leftShiftAlignment(alignment, refSymbolString, readSymbolString);
 
         // Cleanup
-        stList_destruct(inserts);
-        stList_destruct(deletes);
-        stList_destruct(matches);
         stList_destruct(alignment);
         symbolString_destruct(readSymbolString);
 
@@ -1665,6 +2826,9 @@ stList *poa_getReadAlignmentsToConsensus(Poa *poa, stList *bamChunkReads, Polish
     }
 
     // Cleanup
+    alignedPairs_destruct(matches);
+    alignedPairs_destruct(inserts);
+    alignedPairs_destruct(deletes);
     stList_destruct(anchorAlignments);
     symbolString_destruct(refSymbolString);
 
@@ -1675,16 +2839,17 @@ stList *poa_getReadAlignmentsToConsensus(Poa *poa, stList *bamChunkReads, Polish
  * Functions for run-length decoding with POAs
  */
 
-int64_t getRunLengthMode(Alphabet *alphabet, Symbol base, stList *observations, stList *bamChunkReads) {
+int64_t getRunLengthMode(Alphabet *alphabet, Symbol base, PoaBaseObservation *observations, int64_t observationNo,
+                         stList *bamChunkReads) {
     stHash *runLengths = stHash_construct();
     int64_t maxCount = 0;
     int64_t maxRL = 0;
-    for (int64_t i = 0; i < stList_length(observations); i++) {
-        PoaBaseObservation *obs = stList_get(observations, i);
+    for (int64_t i = 0; i < observationNo; i++) {
+        PoaBaseObservation *obs = &observations[i];
         BamChunkRead *bcr = stList_get(bamChunkReads, obs->readNo);
         RleString *rleString = bcr->rleRead;
         if (alphabet->convertCharToSymbol(rleString->rleString[obs->offset]) != base) continue;
-        int64_t obvsRL = rleString->repeatCounts[obs->offset];
+        int64_t obvsRL = rleString_getRepeatCount(rleString, obs->offset);
         int64_t currRlCount = (int64_t) stHash_remove(runLengths, (void *) obvsRL) + 1;
         if (currRlCount > maxCount) {
             maxCount = currRlCount;
@@ -1697,18 +2862,23 @@ int64_t getRunLengthMode(Alphabet *alphabet, Symbol base, stList *observations,
     return maxRL;
 }
 
-static int64_t expandRLEConsensus2(Poa *poa, PoaNode *node, stList *bamChunkReads, RepeatSubMatrix *repeatSubMatrix) {
+static int64_t expandRLEConsensus2(Poa *poa, int64_t nodeIndex, stList *bamChunkReads,
+                                   RepeatSubMatrix *repeatSubMatrix) {
+    PoaNode *node = stList_get(poa->nodes, nodeIndex);
+    int64_t observationNo;
+    PoaBaseObservation *observations = poa_getNodeObservations(poa, nodeIndex, &observationNo);
+
 //	assert(repeatSubMatrix != NULL);
     // for an experiment, or case with no repeat matrix
     if (repeatSubMatrix == NULL) {
-        return getRunLengthMode(poa->alphabet, poa->alphabet->convertCharToSymbol(node->base), node->observations,
-                                bamChunkReads);
+        return getRunLengthMode(poa->alphabet, poa->alphabet->convertCharToSymbol(node->base), observations,
+                                observationNo, bamChunkReads);
     }
 
     // Repeat count
     double logProbability;
     return repeatSubMatrix_getMLRepeatCount(repeatSubMatrix, poa->alphabet->convertCharToSymbol(node->base),
-                                            node->observations,
+                                            observations, observationNo,
                                             bamChunkReads, &logProbability);
 }
 
@@ -1716,63 +2886,119 @@ void poa_estimateRepeatCountsUsingBayesianModel(Poa *poa, stList *bamChunkReads,
     poa->refString->nonRleLength = 0;
     for (uint64_t i = 1; i < stList_length(poa->nodes); i++) {
         PoaNode *node = stList_get(poa->nodes, i);
-        poa->refString->repeatCounts[i - 1] = expandRLEConsensus2(poa, node, bamChunkReads,
-                                                                  repeatSubMatrix);
-        if (poa->refString->repeatCounts[i - 1] == 0) { // Prevent zero length estimates
-            poa->refString->repeatCounts[i - 1] = 1;
+        uint64_t repeatCount = expandRLEConsensus2(poa, i, bamChunkReads, repeatSubMatrix);
+        if (repeatCount == 0) { // Prevent zero length estimates
+            repeatCount = 1;
         }
-        node->repeatCount = poa->refString->repeatCounts[i - 1];
-        poa->refString->nonRleLength += poa->refString->repeatCounts[i - 1];
+        rleString_setRepeatCount(poa->refString, i - 1, repeatCount);
+        node->repeatCount = repeatCount;
+        poa->refString->nonRleLength += repeatCount;
     }
 }
 
-void poa_estimatePhasedRepeatCountsUsingBayesianModel(Poa *poa, stList *bamChunkReads,
-                                                      RepeatSubMatrix *repeatSubMatrix, stSet *readsBelongingToHap1,
-                                                      stSet *readsBelongingToHap2, PolishParams *params) {
-    poa->refString->nonRleLength = 0;
-    for (uint64_t i = 1; i < stList_length(poa->nodes); i++) {
+bool *getReadsInHap1(stList *bamChunkReads, stSet *readsBelongingToHap1) {
+    bool *readInHap1 = st_malloc(sizeof(bool) * (stList_length(bamChunkReads) > 0 ? stList_length(bamChunkReads) : 1));
+    for (int64_t i = 0; i < stList_length(bamChunkReads); i++) {
+        readInHap1[i] = stSet_search(readsBelongingToHap1, stList_get(bamChunkReads, i)) != NULL;
+    }
+    return readInHap1;
+}
+
+static void poa_estimatePhasedRepeatCountsOfNodes(Poa *poa, stList *bamChunkReads, RepeatSubMatrix *repeatSubMatrix,
+                                                  bool *readInHap1, PolishParams *params, uint64_t *repeatCounts,
+                                                  bool inTasks) {
+    int64_t nodeNo = stList_length(poa->nodes);
+    #pragma omp taskloop grainsize(256) if(inTasks)
+    for (int64_t i = 1; i < nodeNo; i++) {
         PoaNode *node = stList_get(poa->nodes, i);
 
         // Repeat count
         double logProbability;
-        poa->refString->repeatCounts[i - 1] = repeatSubMatrix_getPhasedMLRepeatCount(repeatSubMatrix,
-                                                                                     poa->refString->repeatCounts[i -
-                                                                                                                  1],
-                                                                                     poa->alphabet->convertCharToSymbol(
-                                                                                             node->base),
-                                                                                     node->observations,
-                                                                                     bamChunkReads, &logProbability,
-                                                                                     readsBelongingToHap1,
-                                                                                     readsBelongingToHap2, params);
-
-        if (poa->refString->repeatCounts[i - 1] == 0) { // Prevent zero length estimates
-            poa->refString->repeatCounts[i - 1] = 1;
+        int64_t observationNo;
+        PoaBaseObservation *observations = poa_getNodeObservations(poa, i, &observationNo);
+        uint64_t repeatCount = repeatSubMatrix_getPhasedMLRepeatCount(repeatSubMatrix,
+                                                                      rleString_getRepeatCount(poa->refString, i - 1),
+                                                                      poa->alphabet->convertCharToSymbol(node->base),
+                                                                      observations, observationNo,
+                                                                      bamChunkReads, &logProbability,
+                                                                      readInHap1, params);
+
+        if (repeatCount == 0) { // Prevent zero length estimates
+            repeatCount = 1;
         }
+        repeatCounts[i] = repeatCount;
+    }
+}
+
+void poa_estimatePhasedRepeatCountsUsingBayesianModel(Poa *poa, stList *bamChunkReads,
+                                                      RepeatSubMatrix *repeatSubMatrix, stSet *readsBelongingToHap1,
+                                                      stSet *readsBelongingToHap2, PolishParams *params) {
+    /*
+     * The nodes' repeat counts are estimated independently, then set in the reference string in order. They are
+     * estimated in tasks, in a parallel region opened for them or, within the chunk loops, only while threads that
+     * have run out of chunks are free to take the tasks. Only the reads in readsBelongingToHap1 are needed to split
+     * the observations, the others being those of hap 2.
+     */
+    bool *readInHap1 = getReadsInHap1(bamChunkReads, readsBelongingToHap1);
+    poa_buildObservationArena(poa);
+    int64_t nodeNo = stList_length(poa->nodes);
+    uint64_t *repeatCounts = st_malloc(sizeof(uint64_t) * nodeNo);
+
+#if defined(_OPENMP)
+    if (!omp_in_parallel()) {
+#pragma omp parallel
+#pragma omp single
+        poa_estimatePhasedRepeatCountsOfNodes(poa, bamChunkReads, repeatSubMatrix, readInHap1, params, repeatCounts,
+                                              TRUE);
+    } else {
+        poa_estimatePhasedRepeatCountsOfNodes(poa, bamChunkReads, repeatSubMatrix, readInHap1, params, repeatCounts,
+                                              chunkScheduler_getIdleThreadNo() > 0);
+    }
+#else
+    poa_estimatePhasedRepeatCountsOfNodes(poa, bamChunkReads, repeatSubMatrix, readInHap1, params, repeatCounts,
+                                          FALSE);
+#endif
+
+    poa->refString->nonRleLength = 0;
+    for (int64_t i = 1; i < nodeNo; i++) {
+        rleString_setRepeatCount(poa->refString, i - 1, repeatCounts[i]);
 
-        node->repeatCount = poa->refString->repeatCounts[i - 1]; // Update the repeat count of the node
+        ((PoaNode *) stList_get(poa->nodes, i))->repeatCount = repeatCounts[i]; // Update the repeat count of the node
 
-        poa->refString->nonRleLength += poa->refString->repeatCounts[i - 1]; // Update the length of non-rle refString
+        poa->refString->nonRleLength += repeatCounts[i]; // Update the length of non-rle refString
     }
+
+    free(repeatCounts);
+    free(readInHap1);
 }
 
 /*
  * Code to restimate bases using the phasing
  */
 
-void getPhasedBaseWeights(double *logProbabilitiesHap, stList *observations, Poa *poa, stList *bamChunkReads) {
-    for (int64_t i = 0; i < poa->alphabet->alphabetSize; i++) { // Initialize memory
-        logProbabilitiesHap[i] = 0.0;
+void getPhasedBaseWeights(double *logProbabilitiesHap1, double *logProbabilitiesHap2,
+                          PoaBaseObservation *observations, int64_t observationNo, Poa *poa, stList *bamChunkReads,
+                          bool *readInHap1) {
+    /*
+     * Sums the weights of the observations of each base for each haplotype, in one pass, the haplotype of each
+     * observation looked up by its read number.
+     */
+    int64_t alphabetSize = poa->alphabet->alphabetSize;
+    double weights[2 * alphabetSize]; // Those of hap 2, then hap 1
+    for (int64_t i = 0; i < 2 * alphabetSize; i++) { // Initialize memory
+        weights[i] = 0.0;
     }
-    for (int64_t i = 0; i < stList_length(observations); i++) {
-        PoaBaseObservation *observation = stList_get(observations, i);
+    for (int64_t i = 0; i < observationNo; i++) {
+        PoaBaseObservation *observation = &observations[i];
         BamChunkRead *read = stList_get(bamChunkReads, observation->readNo);
         int64_t base = poa->alphabet->convertCharToSymbol(read->rleRead->rleString[observation->offset]);
         assert(base >= 0);
-        assert(base < poa->alphabet->alphabetSize);
-        logProbabilitiesHap[base] += observation->weight;
+        assert(base < alphabetSize);
+        weights[readInHap1[observation->readNo] * alphabetSize + base] += observation->weight;
     }
-    for (int64_t i = 0; i < poa->alphabet->alphabetSize; i++) { // Normalize
-        logProbabilitiesHap[i] /= PAIR_ALIGNMENT_PROB_1;
+    for (int64_t i = 0; i < alphabetSize; i++) { // Normalize
+        logProbabilitiesHap1[i] = weights[alphabetSize + i] / PAIR_ALIGNMENT_PROB_1;
+        logProbabilitiesHap2[i] = weights[i] / PAIR_ALIGNMENT_PROB_1;
     }
 }
 
@@ -1784,25 +3010,16 @@ double getBaseProbForHaplotype(int64_t base, double *logProbabilitiesHap1, const
                                                                                         logProbSubstitution);
 }
 
-uint64_t poaNode_getPhasedMLBase(PoaNode *node, stList *bamChunkReads, Poa *poa, stSet *readsBelongingToHap1) {
-
-    // Split observations between haplotypes
-    stList *observationsHap1 = stList_construct();
-    stList *observationsHap2 = stList_construct();
-    for (int64_t i = 0; i < stList_length(node->observations); i++) {
-        PoaBaseObservation *observation = stList_get(node->observations, i);
-        BamChunkRead *read = stList_get(bamChunkReads, observation->readNo);
-        stList_append(stSet_search(readsBelongingToHap1, read) != NULL ? observationsHap1 : observationsHap2,
-                      observation);
-    }
+uint64_t poaNode_getPhasedMLBase(Poa *poa, int64_t nodeIndex, stList *bamChunkReads, bool *readInHap1) {
+    PoaNode *node = stList_get(poa->nodes, nodeIndex);
+    int64_t observationNo;
+    PoaBaseObservation *observations = poa_getNodeObservations(poa, nodeIndex, &observationNo);
 
-    // Get probs for hap 1
+    // Get probs for hap 1 and hap 2
     double logProbabilitiesHap1[poa->alphabet->alphabetSize];
-    getPhasedBaseWeights(logProbabilitiesHap1, observationsHap1, poa, bamChunkReads);
-
-    // Get probs for hap 2
     double logProbabilitiesHap2[poa->alphabet->alphabetSize];
-    getPhasedBaseWeights(logProbabilitiesHap2, observationsHap2, poa, bamChunkReads);
+    getPhasedBaseWeights(logProbabilitiesHap1, logProbabilitiesHap2, observations, observationNo, poa, bamChunkReads,
+                         readInHap1);
 
     // Get ML prob for haplotype 2
     double logProbMLHap2;
@@ -1822,28 +3039,47 @@ uint64_t poaNode_getPhasedMLBase(PoaNode *node, stList *bamChunkReads, Poa *poa,
     }
 
     if (mlBase != poa->alphabet->convertCharToSymbol(node->base)) {
-        st_logDebug(
-                "Got %c base, previous base: %c, other hap ML base: %c (observation # hap1: %i, observqtion # hap2: %i\n",
-                poa->alphabet->convertSymbolToChar(mlBase), node->base, poa->alphabet->convertSymbolToChar(mLBaseHap2),
-                (int) stList_length(observationsHap1), (int) stList_length(observationsHap2));
+        st_logDebug("Got %c base, previous base: %c, other hap ML base: %c (observation #: %i)\n",
+                    poa->alphabet->convertSymbolToChar(mlBase), node->base,
+                    poa->alphabet->convertSymbolToChar(mLBaseHap2), (int) observationNo);
     }
 
-    // Cleanup
-    stList_destruct(observationsHap1);
-    stList_destruct(observationsHap2);
-
     return mlBase;
 }
 
+static void poa_estimatePhasedBasesOfNodes(Poa *poa, stList *bamChunkReads, bool *readInHap1, bool inTasks) {
+    int64_t nodeNo = stList_length(poa->nodes);
+    #pragma omp taskloop grainsize(256) if(inTasks)
+    for (int64_t i = 1; i < nodeNo; i++) {
+        PoaNode *node = stList_get(poa->nodes, i);
+        node->base = poa->alphabet->convertSymbolToChar(poaNode_getPhasedMLBase(poa, i, bamChunkReads, readInHap1));
+        poa->refString->rleString[i - 1] = node->base;
+    }
+}
+
 void poa_estimatePhasedBasesUsingBayesianModel(Poa *poa, stList *bamChunkReads, stSet *readsBelongingToHap1,
                                                PolishParams *params) {
+    /*
+     * As poa_estimatePhasedRepeatCountsUsingBayesianModel, the nodes' bases are estimated in tasks, each node only
+     * changing its own base.
+     */
+    bool *readInHap1 = getReadsInHap1(bamChunkReads, readsBelongingToHap1);
+    poa_buildObservationArena(poa);
     poa->refString->nonRleLength = 0;
-    for (uint64_t i = 1; i < stList_length(poa->nodes); i++) {
-        PoaNode *node = stList_get(poa->nodes, i);
-        node->base = poa->alphabet->convertSymbolToChar(poaNode_getPhasedMLBase(node, bamChunkReads,
-                                                                                poa, readsBelongingToHap1));
-        poa->refString->rleString[i - 1] = node->base;
+
+#if defined(_OPENMP)
+    if (!omp_in_parallel()) {
+#pragma omp parallel
+#pragma omp single
+        poa_estimatePhasedBasesOfNodes(poa, bamChunkReads, readInHap1, TRUE);
+    } else {
+        poa_estimatePhasedBasesOfNodes(poa, bamChunkReads, readInHap1, chunkScheduler_getIdleThreadNo() > 0);
     }
+#else
+    poa_estimatePhasedBasesOfNodes(poa, bamChunkReads, readInHap1, FALSE);
+#endif
+
+    free(readInHap1);
 }
 
 
@@ -1875,6 +3111,50 @@ RleString *poa_polish(Poa *poa, stList *bamChunkReads, PolishParams *params,
 // Functions to iteratively polish a sequence
 Poa *poa_realignIterative(Poa *poa, stList *bamChunkReads, PolishParams *polishParams, bool hmmNotRealign,
                           int64_t minIterations, int64_t maxIterations) {
+    PoaRealignmentCache *cache = polishParams->useIncrementalRealignment ?
+                                 poaRealignmentCache_construct(stList_length(bamChunkReads)) : NULL;
+    poa = poa_realignIterative2(poa, bamChunkReads, polishParams, hmmNotRealign, minIterations, maxIterations, cache);
+    if (cache != NULL) {
+        poaRealignmentCache_destruct(cache);
+    }
+    return poa;
+}
+
+/*
+ * A consensus string a poa of poa_realignIterative2 was realigned to, with its hash, used to detect the iterations
+ * cycling through the same consensus strings.
+ */
+typedef struct _consensusVisit {
+    RleString *consensus;
+    uint64_t hash;
+} ConsensusVisit;
+
+static ConsensusVisit *consensusVisit_construct(RleString *consensus) {
+    ConsensusVisit *visit = st_malloc(sizeof(ConsensusVisit));
+    visit->consensus = consensus;
+    visit->hash = rleString_hash(consensus);
+    return visit;
+}
+
+static void consensusVisit_destruct(ConsensusVisit *visit) {
+    rleString_destruct(visit->consensus);
+    free(visit);
+}
+
+static bool consensusVisits_contains(stList *visits, RleString *consensus) {
+    uint64_t hash = rleString_hash(consensus);
+    for (int64_t i = 0; i < stList_length(visits); i++) {
+        ConsensusVisit *visit = stList_get(visits, i);
+        if (visit->hash == hash && rleString_eq(visit->consensus, consensus)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+Poa *poa_realignIterative2(Poa *poa, stList *bamChunkReads, PolishParams *polishParams, bool hmmNotRealign,
+                           int64_t minIterations, int64_t maxIterations, PoaRealignmentCache *cache) {
+    allocProfile_scope(APT_POA);
     assert(maxIterations >= 0);
     assert(minIterations <= maxIterations);
 
@@ -1885,9 +3165,18 @@ Poa *poa_realignIterative(Poa *poa, stList *bamChunkReads, PolishParams *polishP
 
     st_logInfo(" %s Starting realignment with score: %6.4f\n", logIdentifier, score / PAIR_ALIGNMENT_PROB_1);
 
+    // The consensus strings realigned to so far. Realignment is deterministic, so a consensus equal to one of them
+    // means the iterations would cycle through the same poas until maxIterations. The best scoring poa so far is kept
+    // to stop with in that case; it is only other than the current poa while the score may fall, before minIterations
+    stList *visits = stList_construct3(0, (void (*)(void *)) consensusVisit_destruct);
+    stList_append(visits, consensusVisit_construct(rleString_copy(poa->refString)));
+    Poa *bestPoa = poa;
+    double bestScore = score;
+
     int64_t i = 0;
     while (i < maxIterations) {
         i++;
+        chunkTelemetry_startStage(CTS_POA_ITERATION);
 
         time_t consensusFindingStartTime = time(NULL);
 
@@ -1903,6 +3192,23 @@ Poa *poa_realignIterative(Poa *poa, stList *bamChunkReads, PolishParams *polishP
         if (rleString_eq(reference, poa->refString)) {
             rleString_destruct(reference);
             free(poaToConsensusMap);
+            chunkTelemetry_endStage(CTS_POA_ITERATION);
+            break;
+        }
+
+        // Stop with the best scoring poa in case the consensus string was realigned to before (i.e. oscillation)
+        if (consensusVisits_contains(visits, reference)) {
+            st_logInfo(" %s Consensus of round %" PRIi64 " repeats an earlier one, stopping with score: %6.4f\n",
+                       logIdentifier, i, bestScore / PAIR_ALIGNMENT_PROB_1);
+            chunkTelemetry_addCount(CTC_CONSENSUS_CYCLES, 1);
+            if (bestPoa != poa) {
+                poa_destruct(poa);
+                poa = bestPoa;
+                score = bestScore;
+            }
+            rleString_destruct(reference);
+            free(poaToConsensusMap);
+            chunkTelemetry_endStage(CTS_POA_ITERATION);
             break;
         }
 
@@ -1913,7 +3219,7 @@ Poa *poa_realignIterative(Poa *poa, stList *bamChunkReads, PolishParams *polishP
         time_t realignStartTime = time(NULL);
 
         // Generated updated poa
-        Poa *poa2 = poa_realign(bamChunkReads, anchorAlignments, reference, polishParams);
+        Poa *poa2 = poa_realign2(bamChunkReads, anchorAlignments, reference, polishParams, cache);
 
         // Get updated repeat counts
         if (polishParams->useRunLengthEncoding) {
@@ -1921,7 +3227,7 @@ Poa *poa_realignIterative(Poa *poa, stList *bamChunkReads, PolishParams *polishP
         }
 
         // Cleanup
-        rleString_destruct(reference);
+        stList_append(visits, consensusVisit_construct(reference));
         free(poaToConsensusMap);
         stList_destruct(anchorAlignments);
 
@@ -1934,13 +3240,29 @@ Poa *poa_realignIterative(Poa *poa, stList *bamChunkReads, PolishParams *polishP
         // Stop if score decreases (greedy stopping)
         if (score2 <= score && i > minIterations) {
             poa_destruct(poa2);
+            chunkTelemetry_endStage(CTS_POA_ITERATION);
             break;
         }
 
-        poa_destruct(poa);
+        if (score2 > bestScore) {
+            if (bestPoa != poa) {
+                poa_destruct(bestPoa);
+            }
+            bestPoa = poa2;
+            bestScore = score2;
+        }
+        if (poa != bestPoa) {
+            poa_destruct(poa);
+        }
         poa = poa2;
         score = score2;
+        chunkTelemetry_endStage(CTS_POA_ITERATION);
+    }
+    if (bestPoa != poa) {
+        poa_destruct(bestPoa);
     }
+    stList_destruct(visits);
+    chunkTelemetry_addCount(hmmNotRealign ? CTC_CONSENSUS_ITERATIONS : CTC_POLISH_ITERATIONS, i);
 
     st_logInfo(
             " %s Took %3d seconds to realign iterative using algorithm: %s through %" PRIi64 " iterations, got final score : %6.4f\n",
@@ -1954,22 +3276,41 @@ Poa *poa_realignIterative(Poa *poa, stList *bamChunkReads, PolishParams *polishP
 
 Poa *poa_realignAll(stList *bamChunkReads, stList *anchorAlignments, RleString *reference,
                     PolishParams *polishParams) {
+    // Alignments kept between rounds of realignment, so that reads in unchanged regions need not be realigned
+    PoaRealignmentCache *cache = polishParams->useIncrementalRealignment ?
+                                 poaRealignmentCache_construct(stList_length(bamChunkReads)) : NULL;
+    Poa *poa = poa_realignAll2(bamChunkReads, anchorAlignments, reference, polishParams, cache);
+    if (cache != NULL) {
+        poaRealignmentCache_destruct(cache);
+    }
+    return poa;
+}
+
+Poa *poa_realignAll2(stList *bamChunkReads, stList *anchorAlignments, RleString *reference,
+                     PolishParams *polishParams, PoaRealignmentCache *cache) {
+    allocProfile_scope(APT_POA);
+    traceRecorder_begin("poa_realignAll");
     time_t startTime = time(NULL);
-    Poa *poa = poa_realign(bamChunkReads, anchorAlignments, reference, polishParams);
+    chunkTelemetry_startStage(CTS_REALIGN);
+    Poa *poa = polishParams->useWindowedRealignment ?
+               poa_realignDisagreementWindows(bamChunkReads, anchorAlignments, reference, polishParams) :
+               poa_realign2(bamChunkReads, anchorAlignments, reference, polishParams, cache);
+    chunkTelemetry_endStage(CTS_REALIGN);
     char *logIdentifier = getLogIdentifier();
 
     st_logInfo(" %s Took %3d seconds to generate initial POA\n", logIdentifier, (int) (time(NULL) - startTime));
     free(logIdentifier);
 
     if (polishParams->maxPoaConsensusIterations > 0) {
-        poa = poa_realignIterative(poa, bamChunkReads, polishParams, 1,
-                polishParams->minPoaConsensusIterations, polishParams->maxPoaConsensusIterations);
+        poa = poa_realignIterative2(poa, bamChunkReads, polishParams, 1,
+                polishParams->minPoaConsensusIterations, polishParams->maxPoaConsensusIterations, cache);
     }
 
     if (polishParams->maxRealignmentPolishIterations > 0) {
-        poa = poa_realignIterative(poa, bamChunkReads, polishParams, 0,
-                polishParams->minRealignmentPolishIterations, polishParams->maxRealignmentPolishIterations);
+        poa = poa_realignIterative2(poa, bamChunkReads, polishParams, 0,
+                polishParams->minRealignmentPolishIterations, polishParams->maxRealignmentPolishIterations, cache);
     }
 
+    traceRecorder_end("poa_realignAll");
     return poa;
 }
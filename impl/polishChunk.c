@@ -0,0 +1,492 @@
+/*
+ * Copyright (C) 2020 by Benedict Paten (benedictpaten@gmail.com)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include "margin.h"
+#include "htsIntegration.h"
+#include "helenFeatures.h"
+
+/*
+ * The body of polish's chunk loop, shared by the polish and replay commands.
+ */
+
+int64_t polishChunk(BamChunk *bamChunk, int64_t chunkIdx, BamChunkReads *chunkInput, uint64_t maxDepth,
+                    PolishChunkSettings *settings, OutputChunkers *outputChunkers, int64_t threadIdx, Params *params,
+                    char *logIdentifier, int64_t *totalNucleotides) {
+    RleString *rleReference = chunkInput->rleReference;
+    uint64_t *rleReferenceCoordinateMap = chunkInput->rleReferenceCoordinateMap;
+    stList *reads = chunkInput->reads;
+    stList *alignments = chunkInput->alignments;
+    stList *filteredReads = chunkInput->filteredReads;
+    stList *filteredAlignments = chunkInput->filteredAlignments;
+    free(chunkInput);
+
+    // the settings of the run
+    bool diploid = settings->diploid;
+    bool skipRealignment = settings->skipRealignment;
+    bool onlyUseVCFAlleles = settings->onlyUseVCFAlleles;
+    bool partitionFilteredReads = settings->partitionFilteredReads;
+    BamChunker *truthHaplotypesBamChunker = settings->truthHaplotypesBamChunker;
+    bool partitionTruthSequences = truthHaplotypesBamChunker != NULL;
+    stHash *vcfEntries = settings->vcfEntries;
+    bool outputFasta = settings->outputFasta;
+    bool outputPhasingState = settings->outputPhasingState;
+    char **chunkPhasedVariants = settings->chunkPhasedVariants;
+    bool outputPhasedVcf = chunkPhasedVariants != NULL;
+    bool useChunkJournal = settings->journalChunkData;
+    char *outputBase = settings->outputBase;
+    bool writeChunkSupplementaryOutput = settings->writeChunkSupplementaryOutput;
+    bool outputPoaDOT = settings->outputPoaDOT;
+    bool outputPoaCSV = settings->outputPoaCSV;
+    bool outputRepeatCounts = settings->outputRepeatCounts;
+    bool outputHaplotypeReads = settings->outputHaplotypeReads;
+    bool outputHaplotypeBAM = settings->outputHaplotypeBAM;
+    #ifdef _HDF5
+    HelenFeatureType helenFeatureType = settings->helenFeatureType;
+    int64_t splitWeightMaxRunLength = settings->splitWeightMaxRunLength;
+    void **helenHDF5Files = settings->helenHDF5Files;
+    bool fullFeatureOutput = settings->fullFeatureOutput;
+    char *trueReferenceBam = settings->trueReferenceBam;
+    #endif
+
+    removeReadsOnlyInChunkBoundary(bamChunk, reads, alignments, logIdentifier);
+
+    // do downsampling if appropriate
+    if (maxDepth > 0) {
+        // get downsampling structures
+        stList *maintainedReads = stList_construct3(0, (void (*)(void *)) bamChunkRead_destruct);
+        stList *maintainedAlignments = stList_construct3(0, (void (*)(void *)) stList_destruct);
+
+        bool didDownsample = diploid ?
+                             // prioritizes longer reads (better for phasing)
+                             downsampleViaFullReadLengthLikelihood(maxDepth, bamChunk, reads,
+                                                                   alignments, maintainedReads, maintainedAlignments,
+                                                                   filteredReads, filteredAlignments):
+                             // just randomly samples reads
+                             downsampleViaReadLikelihood(maxDepth, bamChunk, reads,
+                                                         alignments, maintainedReads, maintainedAlignments,
+                                                         filteredReads, filteredAlignments);
+
+        // we need to destroy the discarded reads and structures
+        if (didDownsample) {
+            logBuffer_info(" %s Downsampled from %"PRId64" to %"PRId64" reads\n", logIdentifier,
+                           stList_length(reads), stList_length(maintainedReads));
+            // still has all the old reads, need to not free these
+            stList_setDestructor(reads, NULL);
+            stList_setDestructor(alignments, NULL);
+            stList_destruct(reads);
+            stList_destruct(alignments);
+            // and keep the filtered reads
+            reads = maintainedReads;
+            alignments = maintainedAlignments;
+        }
+            // no downsampling, we just need to free the (empty) objects
+        else {
+            assert(stList_length(maintainedReads) == 0);
+            assert(stList_length(maintainedAlignments) == 0);
+            stList_destruct(maintainedReads);
+            stList_destruct(maintainedAlignments);
+        }
+    }
+
+    // prep for polishing
+    Poa *poa = NULL; // The poa alignment
+    char *polishedConsensusString = NULL; // The polished reference string
+    PoaRealignmentCache *realignmentCache = NULL; // Haploid alignments kept to build the haplotype POAs
+
+    // Run the polishing method
+    *totalNucleotides = 0;
+    for (int64_t u = 0; u < stList_length(reads); u++) {
+        *totalNucleotides += strlen(((BamChunkRead *) stList_get(reads, u))->rleRead->rleString);
+    }
+    logBuffer_info(" %s Running polishing algorithm with %"PRId64" reads and %"PRIu64"K nucleotides\n",
+                   logIdentifier, stList_length(reads), *totalNucleotides >> 10);
+    chunkTelemetry_addCount(CTC_READS, stList_length(reads));
+    chunkTelemetry_addCount(CTC_NUCLEOTIDES, *totalNucleotides);
+
+    // Generate partial order alignment (POA) (destroys rleAlignments in the process)
+    if (diploid && skipRealignment) {
+        // This option fills the poa with only cigar-string likelihoods
+        logBuffer_info(" %s Getting alignment likelihoods from CIGAR string, and not mutating POA\n", logIdentifier);
+        chunkTelemetry_startStage(CTS_REALIGN);
+        poa = poa_realignOnlyAnchorAlignments(reads, alignments, rleReference, params->polishParams);
+        chunkTelemetry_endStage(CTS_REALIGN);
+    } else if (diploid && params->polishParams->skipHaploidPolishingIfDiploid) {
+        // This option generates a POA against the input reference background
+        logBuffer_info(" %s Generating alignment likelihoods, but not mutating POA\n", logIdentifier);
+        chunkTelemetry_startStage(CTS_REALIGN);
+        if (params->polishParams->useWindowedRealignment) {
+            poa = poa_realignDisagreementWindows(reads, alignments, rleReference, params->polishParams);
+        } else {
+            if (params->polishParams->useIncrementalRealignment) {
+                realignmentCache = poaRealignmentCache_construct(stList_length(reads));
+            }
+            poa = poa_realign2(reads, alignments, rleReference, params->polishParams, realignmentCache);
+        }
+        chunkTelemetry_endStage(CTS_REALIGN);
+    } else if (!diploid && params->polishParams->cleanChunkMaxDivergence > 0 &&
+               getAlignmentDivergence(reads, alignments, rleReference) <=
+               params->polishParams->cleanChunkMaxDivergence) {
+        // The reads agree with the reference, so check with only their anchor alignments that there is nothing
+        // for the realignment to change
+        chunkTelemetry_startStage(CTS_REALIGN);
+        poa = poa_realignOnlyAnchorAlignments(reads, alignments, rleReference, params->polishParams);
+        chunkTelemetry_endStage(CTS_REALIGN);
+        if (poa_hasCandidateVariants(poa, params->polishParams)) {
+            poa_destruct(poa);
+            poa = NULL;
+        } else {
+            logBuffer_info(" %s Chunk has no candidate variants, not realigning\n", logIdentifier);
+        }
+    }
+    if (poa == NULL) {
+        // This option refines the POA
+        logBuffer_info(" %s Generating alignment likelihoods and mutating POA\n", logIdentifier);
+        if (params->polishParams->useIncrementalRealignment) {
+            realignmentCache = poaRealignmentCache_construct(stList_length(reads));
+        }
+        poa = poa_realignAll2(reads, alignments, rleReference, params->polishParams, realignmentCache);
+        if (!diploid && realignmentCache != NULL) {
+            poaRealignmentCache_destruct(realignmentCache);
+            realignmentCache = NULL;
+        }
+    }
+
+    // Log info about the POA
+    if (st_getLogLevel() >= info) {
+        st_logInfo(" %s Summary stats for POA:\t", logIdentifier);
+        poa_printSummaryStats(poa, stderr);
+    }
+    if (st_getLogLevel() >= debug) {
+        poa_print(poa, stderr, reads, 5);
+    }
+
+    // Write any optional outputs about repeat count and POA, etc.
+    if (writeChunkSupplementaryOutput) {
+        poa_writeSupplementalChunkInformation(outputBase, chunkIdx, bamChunk, poa, reads, params,
+                                              outputPoaDOT, outputPoaCSV, outputRepeatCounts);
+    }
+
+    // handle diploid case
+    if(diploid) {
+
+        time_t primaryPhasingStart = time(NULL);
+
+        // iteratively find bubbles
+        int64_t bubbleFindingIteration = 0;
+        BubbleGraph *bg = NULL;
+        stHash *readsToPSeqs = NULL;
+        stSet *readsBelongingToHap1 = NULL, *readsBelongingToHap2 = NULL;
+        stGenomeFragment *gf = NULL;
+        stReference *ref = NULL;
+        stList *chunkVcfEntries = NULL;
+        if (vcfEntries != NULL) {
+            chunkVcfEntries = getVcfEntriesForRegion(vcfEntries, params->polishParams->useRunLengthEncoding ?
+                                                     rleReferenceCoordinateMap : NULL, bamChunk->refSeqName,
+                    bamChunk->chunkOverlapStart,  bamChunk->chunkOverlapEnd, params);
+            logBuffer_info(" %s Got %"PRId64" VCF entries for region\n", logIdentifier, stList_length(chunkVcfEntries));
+        }
+        do {
+            // cleanup and iterate (if not first run through)
+            if (bubbleFindingIteration != 0) {
+                // get new hets
+                stList *filteredChunkHetAlleles = produceVcfEntriesFromBubbleGraph(bamChunk, bg, readsToPSeqs, gf,
+                        params->phaseParams->bubbleMinBinomialStrandLikelihood,
+                        params->phaseParams->bubbleMinBinomialReadSplitLikelihood);
+                int64_t filteredAlleleCount = stList_length(filteredChunkHetAlleles);
+                logBuffer_info(" %s At bubble finding iteration %"PRId64", kept %"PRId64" alleles of %"PRId64"\n",
+                        logIdentifier, bubbleFindingIteration, filteredAlleleCount, bg->bubbleNo);
+                // terminate or iterate
+                if (filteredAlleleCount == 0 || filteredAlleleCount == bg->bubbleNo) {
+                    stList_destruct(filteredChunkHetAlleles);
+                    break;
+                } else {
+                    if (chunkVcfEntries != NULL) stList_destruct(chunkVcfEntries);
+                    chunkVcfEntries = filteredChunkHetAlleles;
+                }
+                // cleanup
+                bubbleGraph_destruct(bg);
+                stHash_destruct(readsToPSeqs);
+                stSet_destruct(readsBelongingToHap1);
+                stSet_destruct(readsBelongingToHap2);
+                stGenomeFragment_destruct(gf);
+                stReference_destruct(ref);
+            }
+
+
+            // Get the bubble graph representation
+            chunkTelemetry_startStage(CTS_BUBBLE_GRAPH);
+            if (onlyUseVCFAlleles) {
+                bg = bubbleGraph_constructFromPoaAndVCFOnlyVCFAllele(poa, reads, rleReference, chunkVcfEntries, params);
+            } else {
+                bg = bubbleGraph_constructFromPoaAndVCF(poa, reads, chunkVcfEntries, params->polishParams, TRUE);
+            }
+            chunkTelemetry_endStage(CTS_BUBBLE_GRAPH);
+            chunkTelemetry_addCount(CTC_BUBBLES, bg->bubbleNo);
+
+            // Now make a POA for each of the haplotypes
+            chunkTelemetry_startStage(CTS_PHASING);
+            ref = bubbleGraph_getReference(bg, bamChunk->refSeqName, params);
+            gf = bubbleGraph_phaseBubbleGraph(bg, ref, reads, params, &readsToPSeqs);
+            chunkTelemetry_endStage(CTS_PHASING);
+
+            stGenomeFragment_phaseBamChunkReads(gf, readsToPSeqs, reads, &readsBelongingToHap1, &readsBelongingToHap2,
+                                                params->phaseParams);
+            logBuffer_info(" %s After phasing, of %i reads got %i reads partitioned into hap1 and %i reads partitioned "
+                           "into hap2 (%i unphased)\n", logIdentifier, (int) stList_length(reads),
+                           (int) stSet_size(readsBelongingToHap1), (int) stSet_size(readsBelongingToHap2),
+                           (int) (stList_length(reads) - stSet_size(readsBelongingToHap1) -
+                              stSet_size(readsBelongingToHap2)));
+
+            // Debug report of hets
+            if (st_getLogLevel() <= info) {
+                uint64_t totalHets = 0;
+                for (uint64_t h = 0; h < gf->length; h++) {
+                    Bubble *b = &bg->bubbles[h + gf->refStart];
+                    if (gf->haplotypeString1[h] != gf->haplotypeString2[h]) {
+                        st_logDebug(" %s Got predicted het at bubble %i %s %s\n", logIdentifier, (int) h + gf->refStart,
+                                    b->alleles[gf->haplotypeString1[h]]->rleString,
+                                    b->alleles[gf->haplotypeString2[h]]->rleString);
+                        totalHets++;
+                    } else if (!rleString_eq(b->alleles[gf->haplotypeString1[h]], b->refAllele)) {
+                        st_logDebug(" %s Got predicted hom alt at bubble %i %i\n", logIdentifier,
+                                    (int) h + gf->refStart,
+                                    (int) gf->haplotypeString1[h]);
+                    }
+                }
+                logBuffer_info(" %s In phasing chunk, got: %i hets from: %i total sites (fraction: %f)\n", logIdentifier,
+                               (int) totalHets, (int) gf->length, (float) totalHets / gf->length);
+            }
+
+            bubbleFindingIteration++;
+        } while (vcfEntries == NULL && bubbleFindingIteration <= params->phaseParams->bubbleFindingIterations);
+
+
+        // debugging output
+        char *chunkBubbleOutFilename = NULL;
+        FILE *chunkBubbleOut = NULL;
+        uint64_t *reference_rleToNonRleCoordMap = rleString_getRleToNonRleCoordinateMap(rleReference);
+
+        // haplotype-specific info (skipped if not writing FASTA)
+        uint64_t *hap1 = NULL;
+        uint64_t *hap2 = NULL;
+        Poa *poa_hap1 = NULL;
+        Poa *poa_hap2 = NULL;
+
+        if (outputFasta) {
+            logBuffer_info(" %s Building POA for each haplotype\n", logIdentifier);
+            hap1 = getPaddedHaplotypeString(gf->haplotypeString1, gf, bg, params);
+            hap2 = getPaddedHaplotypeString(gf->haplotypeString2, gf, bg, params);
+
+            // Reads whose anchors and reference are unchanged between the haploid consensus and a haplotype
+            // reuse their haploid alignments, which are kept unchanged to be shared by both haplotypes
+            if (realignmentCache != NULL) {
+                poaRealignmentCache_setReadOnly(realignmentCache, TRUE);
+            }
+            if(params->polishParams->useRunLengthEncoding) {
+                logBuffer_info(" %s Using read phasing to reestimate repeat counts in phased manner\n", logIdentifier);
+            }
+            bubbleGraph_getHaplotypePoas(bg, hap1, hap2, poa, reads, readsBelongingToHap1, readsBelongingToHap2,
+                                         params, realignmentCache, &poa_hap1, &poa_hap2);
+            logBuffer_info(" %s Phased primary reads in %d sec\n", logIdentifier, time(NULL) - primaryPhasingStart);
+
+
+            if (outputPhasingState) {
+                // save info
+                chunkBubbleOutFilename = stString_print("%s.C%05"PRId64".%s-%"PRId64"-%"PRId64".phasingInfo.json",
+                                                        outputBase, chunkIdx,  bamChunk->refSeqName, bamChunk->chunkOverlapStart, bamChunk->chunkOverlapEnd);
+                logBuffer_info(" %s Saving chunk phasing info to: %s\n", logIdentifier, chunkBubbleOutFilename);
+                chunkBubbleOut = safe_fopen(chunkBubbleOutFilename, "w");
+                fprintf(chunkBubbleOut, "{\n");
+                bubbleGraph_saveBubblePhasingInfo(bamChunk, bg, readsToPSeqs, gf, reference_rleToNonRleCoordMap,
+                                                  chunkBubbleOut);
+            }
+        } else {
+            logBuffer_info(" %s Skipping haplotype-specific POA construction\n", logIdentifier);
+        }
+
+
+        // should included filtered reads in output
+        if (partitionFilteredReads || partitionTruthSequences) {
+            // get reads
+            if (partitionFilteredReads) {
+                for (int64_t bcrIdx = 0; bcrIdx < stList_length(reads); bcrIdx++) {
+                    BamChunkRead *bcr = stList_get(reads, bcrIdx);
+                    if (!stSet_search(readsBelongingToHap1, bcr) && !stSet_search(readsBelongingToHap2, bcr)) {
+                        // was filtered in some form
+                        stList_append(filteredReads, bamChunkRead_constructCopy(bcr));
+                        stList_append(filteredAlignments, copyListOfIntTuples(stList_get(alignments, bcrIdx)));
+                    }
+                }
+            }
+            if (partitionTruthSequences) {
+                chunkTruthHaplotypes_addTruthReadsToFilteredReadSet(bamChunk, truthHaplotypesBamChunker,
+                        filteredReads, filteredAlignments, rleReference, params, logIdentifier);
+            }
+            logBuffer_info(" %s Assigning %"PRId64" filtered reads to haplotypes\n", logIdentifier, stList_length(filteredReads));
+            removeReadsOnlyInChunkBoundary(bamChunk, filteredReads, filteredAlignments, logIdentifier);
+
+            // we want to only keep up to excessiveDepthThreshold filtered reads
+            // get downsampling structures
+            stList *filteredMaintainedReads = stList_construct3(0, (void (*)(void *)) bamChunkRead_destruct);
+            stList *filteredMaintainedAlignments = stList_construct3(0, (void (*)(void *)) stList_destruct);
+            stList *filteredFilteredReads = stList_construct3(0, (void (*)(void *)) bamChunkRead_destruct);
+            stList *filteredFilteredAlignments = stList_construct3(0, (void (*)(void *)) stList_destruct);
+            bool didDownsample = downsampleViaFullReadLengthLikelihood(params->polishParams->excessiveDepthThreshold,
+                    bamChunk,  filteredReads, filteredAlignments, filteredMaintainedReads,
+                    filteredMaintainedAlignments, filteredFilteredReads,  filteredFilteredAlignments);
+
+            // we need to destroy data structures
+            if (didDownsample) {
+                logBuffer_info(" %s Downsampled filtered reads from %"PRId64" to %"PRId64" reads\n", logIdentifier,
+                               stList_length(filteredReads), stList_length(filteredMaintainedReads));
+                // still has all the old reads, need to not free these
+                stList_setDestructor(filteredReads, NULL);
+                stList_setDestructor(filteredAlignments, NULL);
+                stList_destruct(filteredReads);
+                stList_destruct(filteredAlignments);
+                // and keep the filtered reads
+                filteredReads = filteredMaintainedReads;
+                filteredAlignments = filteredMaintainedAlignments;
+            }
+            // no downsampling, we just need to free the (empty) maintained read objects
+            else {
+                assert(stList_length(filteredMaintainedReads) == 0);
+                assert(stList_length(filteredMaintainedAlignments) == 0);
+                stList_destruct(filteredMaintainedReads);
+                stList_destruct(filteredMaintainedAlignments);
+            }
+            // always destroy these (they're either empty or we don't need the reads anymore)
+            stList_destruct(filteredFilteredReads);
+            stList_destruct(filteredFilteredAlignments);
+
+            time_t filteredPhasingStart = time(NULL);
+            Poa *filteredPoa = NULL;
+            chunkTelemetry_startStage(CTS_REALIGN);
+            if (skipRealignment) {
+                filteredPoa = poa_realignOnlyAnchorAlignments(filteredReads, filteredAlignments, rleReference, params->polishParams);
+            } else {
+                filteredPoa = poa_realign(filteredReads, filteredAlignments, rleReference, params->polishParams);
+            }
+            chunkTelemetry_endStage(CTS_REALIGN);
+
+            chunkTelemetry_startStage(CTS_PHASING);
+            bubbleGraph_partitionFilteredReads(filteredPoa, filteredReads, gf, bg, bamChunk,
+                                               reference_rleToNonRleCoordMap, readsBelongingToHap1,
+                                               readsBelongingToHap2, params->polishParams,
+                                               chunkBubbleOut, logIdentifier);
+            chunkTelemetry_endStage(CTS_PHASING);
+            poa_destruct(filteredPoa);
+            logBuffer_info(" %s Partitioned filtered reads in %d sec.\n", logIdentifier, time(NULL) - filteredPhasingStart);
+
+            // once assigned, the filtered reads are only needed by name, unless their phasing state is written
+            if (!(outputPhasingState && outputFasta)) {
+                for (int64_t bcrIdx = 0; bcrIdx < stList_length(filteredReads); bcrIdx++) {
+                    bamChunkRead_destructSequence(stList_get(filteredReads, bcrIdx));
+                }
+                stList_destruct(filteredAlignments);
+                filteredAlignments = stList_construct3(0, (void (*)(void *)) stList_destruct);
+            }
+        }
+
+        // debugging output for state
+        if (outputPhasingState && outputFasta) {
+            writePhasedReadInfoJSON(bamChunk, reads, alignments, filteredReads, filteredAlignments,
+                                    readsBelongingToHap1, readsBelongingToHap2, reference_rleToNonRleCoordMap,
+                                    chunkBubbleOut);
+            fprintf(chunkBubbleOut, "\n}\n");
+            fclose(chunkBubbleOut);
+            free(chunkBubbleOutFilename);
+        }
+
+        // the phased variants, from the same phasing as the haplotypes and the phased reads, kept (and journaled)
+        // before the output as the chunk may be stitched as it is output
+        if (outputPhasedVcf) {
+            size_t chunkPhasedVariantsLength;
+            chunkPhasedVariants[chunkIdx] = getChunkPhasedVariants(bamChunk, bg, rleReference, readsToPSeqs, gf,
+                    params->phaseParams->bubbleMinBinomialStrandLikelihood,
+                    params->phaseParams->bubbleMinBinomialReadSplitLikelihood, &chunkPhasedVariantsLength);
+            if (useChunkJournal) {
+                outputChunkers_journalChunkData(outputChunkers, chunkIdx, chunkPhasedVariants[chunkIdx],
+                                                chunkPhasedVariantsLength);
+            }
+        }
+
+        // Output
+        chunkTelemetry_startStage(CTS_STITCH);
+        outputChunkers_processChunkSequencePhased(outputChunkers, threadIdx, chunkIdx, bamChunk->refSeqName,
+                                                  poa_hap1, poa_hap2, reads,
+                                                  readsBelongingToHap1, readsBelongingToHap2, gf, params);
+        chunkTelemetry_endStage(CTS_STITCH);
+
+        //ancillary files
+        if (writeChunkSupplementaryOutput) {
+            poa_writeSupplementalChunkInformationDiploid(outputBase, chunkIdx, bamChunk, gf, poa_hap1, poa_hap2,
+                    reads, readsBelongingToHap1, readsBelongingToHap2, params, outputPoaDOT, outputPoaCSV,
+                    outputRepeatCounts, outputHaplotypeReads, outputHaplotypeBAM, logIdentifier);
+        }
+
+        // Cleanup
+        if (hap1 != NULL) free(hap1);
+        if (hap2 != NULL) free(hap2);
+        if (chunkVcfEntries != NULL) stList_destruct(chunkVcfEntries);
+        stSet_destruct(readsBelongingToHap1);
+        stSet_destruct(readsBelongingToHap2);
+        bubbleGraph_destruct(bg);
+        stGenomeFragment_destruct(gf);
+        stReference_destruct(ref);
+        if (poa_hap1 != NULL) poa_destruct(poa_hap1);
+        if (poa_hap2 != NULL) poa_destruct(poa_hap2);
+        stHash_destruct(readsToPSeqs);
+        free(reference_rleToNonRleCoordMap);
+
+    } else {
+
+        // get polished reference string and expand RLE (regardless of whether RLE was applied)
+        if (params->polishParams->useRunLengthEncoding) {
+            poa_estimateRepeatCountsUsingBayesianModel(poa, reads, params->polishParams->repeatSubMatrix);
+        }
+
+        // output
+        chunkTelemetry_startStage(CTS_STITCH);
+        outputChunkers_processChunkSequence(outputChunkers, threadIdx, chunkIdx, bamChunk->refSeqName, poa, reads);
+        chunkTelemetry_endStage(CTS_STITCH);
+
+        //ancillary files
+        if (writeChunkSupplementaryOutput) {
+            poa_writeSupplementalChunkInformation(outputBase, chunkIdx, bamChunk, poa, reads, params,
+                    outputPoaDOT, outputPoaCSV, outputRepeatCounts);
+        }
+
+        // HELEN feature outputs
+        #ifdef _HDF5
+        RleString *polishedRleConsensus = rleString_copy(poa->refString);
+        polishedConsensusString = rleString_expand(polishedRleConsensus);
+        if (helenFeatureType != HFEAT_NONE) {
+            PoaFeature_handleHelenFeatures(helenFeatureType, splitWeightMaxRunLength,
+                                           helenHDF5Files, fullFeatureOutput, trueReferenceBam, rleReference, params,
+                                           logIdentifier, chunkIdx,
+                                           bamChunk, poa, reads, polishedConsensusString, polishedRleConsensus);
+
+        }
+        free(polishedConsensusString);
+        rleString_destruct(polishedRleConsensus);
+        #endif
+    }
+
+    // Cleanup
+    int64_t readNo = stList_length(reads);
+    rleString_destruct(rleReference);
+    if (rleReferenceCoordinateMap != NULL) free(rleReferenceCoordinateMap);
+    poa_destruct(poa);
+    if (realignmentCache != NULL) {
+        poaRealignmentCache_destruct(realignmentCache);
+    }
+    stList_destruct(reads);
+    stList_destruct(alignments);
+    stList_destruct(filteredReads);
+    stList_destruct(filteredAlignments);
+    return readNo;
+}
@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2020 by Benedict Paten (benedictpaten@gmail.com)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include <ctype.h>
+#include "margin.h"
+
+/*
+ * Functions to polish (and phase) a window of a reference from reads given in memory, for embedding margin in
+ * another program.
+ */
+
+static stSet *region_getReadNames(stSet *reads) {
+    stSet *readNames = stSet_construct3(stHash_stringKey, stHash_stringEqualKey, free);
+    stSetIterator *it = stSet_getIterator(reads);
+    BamChunkRead *read;
+    while ((read = stSet_getNext(it)) != NULL) {
+        stSet_insert(readNames, stString_copy(read->readName));
+    }
+    stSet_destructIterator(it);
+    return readNames;
+}
+
+static void region_phase(RegionPolishResult *result, BamChunk *bamChunk, Poa *poa, stList *reads, Params *params) {
+    /*
+     * Phases the reads on the bubble graph of the poa, making the consensus of each haplotype.
+     */
+    BubbleGraph *bg = bubbleGraph_constructFromPoaAndVCF(poa, reads, NULL, params->polishParams, TRUE);
+    stReference *ref = bubbleGraph_getReference(bg, bamChunk->refSeqName, params);
+    stHash *readsToPSeqs = NULL;
+    stGenomeFragment *gf = bubbleGraph_phaseBubbleGraph(bg, ref, reads, params, &readsToPSeqs);
+    stSet *readsBelongingToHap1, *readsBelongingToHap2;
+    stGenomeFragment_phaseBamChunkReads(gf, readsToPSeqs, reads, &readsBelongingToHap1, &readsBelongingToHap2,
+                                        params->phaseParams);
+
+    // the heterozygous variants
+    result->vcfEntries = produceVcfEntriesFromBubbleGraph(bamChunk, bg, readsToPSeqs, gf,
+                                                          params->phaseParams->bubbleMinBinomialStrandLikelihood,
+                                                          params->phaseParams->bubbleMinBinomialReadSplitLikelihood);
+
+    // the haplotypes
+    uint64_t *hap1 = getPaddedHaplotypeString(gf->haplotypeString1, gf, bg, params);
+    uint64_t *hap2 = getPaddedHaplotypeString(gf->haplotypeString2, gf, bg, params);
+    Poa *poa_hap1, *poa_hap2;
+    bubbleGraph_getHaplotypePoas(bg, hap1, hap2, poa, reads, readsBelongingToHap1, readsBelongingToHap2, params, NULL,
+                                 &poa_hap1, &poa_hap2);
+    result->hap1Consensus = rleString_copy(poa_hap1->refString);
+    result->hap2Consensus = rleString_copy(poa_hap2->refString);
+    result->readsInHap1 = region_getReadNames(readsBelongingToHap1);
+    result->readsInHap2 = region_getReadNames(readsBelongingToHap2);
+
+    // Cleanup
+    free(hap1);
+    free(hap2);
+    poa_destruct(poa_hap1);
+    poa_destruct(poa_hap2);
+    stSet_destruct(readsBelongingToHap1);
+    stSet_destruct(readsBelongingToHap2);
+    stGenomeFragment_destruct(gf);
+    stHash_destruct(readsToPSeqs);
+    stReference_destruct(ref);
+    bubbleGraph_destruct(bg);
+}
+
+RegionPolishResult *polishRegion(char *refSeqName, char *reference, int64_t refStart, AlignedRead *alignedReads,
+                                 int64_t alignedReadNo, Params *params, bool diploid) {
+    PolishParams *polishParams = params->polishParams;
+    int64_t refEnd = refStart + strlen(reference);
+
+    // the window is the only chunk of a chunker without a bam file
+    BamChunker *bamChunker = st_calloc(1, sizeof(BamChunker));
+    bamChunker->includeSoftClip = polishParams->includeSoftClipping;
+    bamChunker->params = polishParams;
+    bamChunker->chunks = stList_construct3(0, (void (*)(void *)) bamChunk_destruct);
+    BamChunk *bamChunk = bamChunk_construct2(refSeqName, 0, refStart, refStart, refEnd, refEnd, 0, bamChunker);
+    stList_append(bamChunker->chunks, bamChunk);
+    bamChunker->chunkCount = 1;
+
+    // the reference, in upper case as if read from a fasta file
+    char *upperReference = stString_copy(reference);
+    for (int64_t i = 0; upperReference[i] != '\0'; i++) {
+        upperReference[i] = (char) toupper(upperReference[i]);
+    }
+    RleString *rleReference = polishParams->useRunLengthEncoding ? rleString_construct(upperReference) :
+                              rleString_construct_no_rle(upperReference);
+    free(upperReference);
+
+    // the reads and their alignments to the window
+    BamChunkReads *chunkReads = bamChunkReads_constructFromAlignedReads(bamChunk, rleReference, alignedReads,
+                                                                        alignedReadNo, FALSE, polishParams);
+    if (chunkReads == NULL) {
+        rleString_destruct(rleReference);
+        bamChunker_destruct(bamChunker);
+        return NULL;
+    }
+    RegionPolishResult *result = polishChunkReads(bamChunk, chunkReads, polishParams->maxDepth, params, diploid);
+    bamChunker_destruct(bamChunker);
+
+    return result;
+}
+
+RegionPolishResult *polishChunkReads(BamChunk *bamChunk, BamChunkReads *chunkReads, uint64_t maxDepth,
+                                     Params *params, bool diploid) {
+    PolishParams *polishParams = params->polishParams;
+    RleString *rleReference = chunkReads->rleReference;
+    stList *reads = chunkReads->reads;
+    stList *alignments = chunkReads->alignments;
+    removeReadsOnlyInChunkBoundary(bamChunk, reads, alignments, "");
+
+    // downsample as a chunk of a polish run would be
+    if (maxDepth > 0) {
+        stList *maintainedReads = stList_construct3(0, (void (*)(void *)) bamChunkRead_destruct);
+        stList *maintainedAlignments = stList_construct3(0, (void (*)(void *)) stList_destruct);
+        bool didDownsample = diploid ?
+                             downsampleViaFullReadLengthLikelihood(maxDepth, bamChunk, reads,
+                                                                   alignments, maintainedReads, maintainedAlignments,
+                                                                   chunkReads->filteredReads,
+                                                                   chunkReads->filteredAlignments) :
+                             downsampleViaReadLikelihood(maxDepth, bamChunk, reads,
+                                                         alignments, maintainedReads, maintainedAlignments,
+                                                         chunkReads->filteredReads, chunkReads->filteredAlignments);
+        if (didDownsample) {
+            stList_setDestructor(reads, NULL);
+            stList_setDestructor(alignments, NULL);
+            stList_destruct(reads);
+            stList_destruct(alignments);
+            reads = maintainedReads;
+            alignments = maintainedAlignments;
+        } else {
+            stList_destruct(maintainedReads);
+            stList_destruct(maintainedAlignments);
+        }
+    }
+
+    // polish
+    RegionPolishResult *result = st_calloc(1, sizeof(RegionPolishResult));
+    Poa *poa = diploid && polishParams->skipHaploidPolishingIfDiploid ?
+               poa_realign2(reads, alignments, rleReference, polishParams, NULL) :
+               poa_realignAll2(reads, alignments, rleReference, polishParams, NULL);
+    if (diploid) {
+        region_phase(result, bamChunk, poa, reads, params);
+    } else if (polishParams->useRunLengthEncoding) {
+        poa_estimateRepeatCountsUsingBayesianModel(poa, reads, polishParams->repeatSubMatrix);
+    }
+    result->consensus = rleString_copy(poa->refString);
+
+    // Cleanup
+    poa_destruct(poa);
+    stList_destruct(reads);
+    stList_destruct(alignments);
+    stList_destruct(chunkReads->filteredReads);
+    stList_destruct(chunkReads->filteredAlignments);
+    if (chunkReads->rleReferenceCoordinateMap != NULL) free(chunkReads->rleReferenceCoordinateMap);
+    rleString_destruct(rleReference);
+    free(chunkReads);
+
+    return result;
+}
+
+void regionPolishResult_destruct(RegionPolishResult *result) {
+    rleString_destruct(result->consensus);
+    if (result->hap1Consensus != NULL) rleString_destruct(result->hap1Consensus);
+    if (result->hap2Consensus != NULL) rleString_destruct(result->hap2Consensus);
+    if (result->vcfEntries != NULL) stList_destruct(result->vcfEntries);
+    if (result->readsInHap1 != NULL) stSet_destruct(result->readsInHap1);
+    if (result->readsInHap2 != NULL) stSet_destruct(result->readsInHap2);
+    free(result);
+}
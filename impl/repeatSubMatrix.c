@@ -62,15 +62,27 @@ RepeatSubMatrix *repeatSubMatrix_constructEmpty(Alphabet *alphabet) {
     return repeatSubMatrix;
 }
 
+RepeatSubMatrix *repeatSubMatrix_copy(RepeatSubMatrix *repeatSubMatrix) {
+    Alphabet *alphabet = st_malloc(sizeof(Alphabet));
+    *alphabet = *repeatSubMatrix->alphabet;
+    RepeatSubMatrix *copy = repeatSubMatrix_constructEmpty(alphabet);
+    assert(copy->maxEntry == repeatSubMatrix->maxEntry);
+    memcpy(copy->baseLogProbs_AT, repeatSubMatrix->baseLogProbs_AT, copy->maximumRepeatLength * sizeof(double));
+    memcpy(copy->baseLogProbs_GC, repeatSubMatrix->baseLogProbs_GC, copy->maximumRepeatLength * sizeof(double));
+    memcpy(copy->logProbabilities, repeatSubMatrix->logProbabilities, copy->maxEntry * sizeof(double));
+    return copy;
+}
+
 double
-repeatSubMatrix_getLogProbForGivenRepeatCount(RepeatSubMatrix *repeatSubMatrix, Symbol base, stList *observations,
+repeatSubMatrix_getLogProbForGivenRepeatCount(RepeatSubMatrix *repeatSubMatrix, Symbol base,
+                                              PoaBaseObservation *observations, int64_t observationNo,
                                               stList *bamChunkReads, int64_t underlyingRepeatCount) {
     assert(underlyingRepeatCount < repeatSubMatrix->maximumRepeatLength);
     double logProb = LOG_ONE;
-    for (int64_t i = 0; i < stList_length(observations); i++) {
-        PoaBaseObservation *observation = stList_get(observations, i);
+    for (int64_t i = 0; i < observationNo; i++) {
+        PoaBaseObservation *observation = &observations[i];
         BamChunkRead *read = stList_get(bamChunkReads, observation->readNo);
-        int64_t observedRepeatCount = read->rleRead->repeatCounts[observation->offset];
+        int64_t observedRepeatCount = rleString_getRepeatCount(read->rleRead, observation->offset);
 
         // Be robust to over-long repeat count observations
         observedRepeatCount = observedRepeatCount >= repeatSubMatrix->maximumRepeatLength ?
@@ -83,17 +95,18 @@ repeatSubMatrix_getLogProbForGivenRepeatCount(RepeatSubMatrix *repeatSubMatrix,
     return logProb / PAIR_ALIGNMENT_PROB_1;
 }
 
-void repeatSubMatrix_getMinAndMaxRepeatCountObservations(RepeatSubMatrix *repeatSubMatrix, stList *observations,
+void repeatSubMatrix_getMinAndMaxRepeatCountObservations(RepeatSubMatrix *repeatSubMatrix,
+                                                         PoaBaseObservation *observations, int64_t observationNo,
                                                          stList *bamChunkReads, int64_t *minRepeatLength,
                                                          int64_t *maxRepeatLength) {
     // Get the range or repeat observations, used to avoid calculating all repeat lengths, heuristically
     *minRepeatLength = repeatSubMatrix->maximumRepeatLength;
     *maxRepeatLength = 0;
     char *maxRLReadId = NULL;
-    for (int64_t i = 0; i < stList_length(observations); i++) {
-        PoaBaseObservation *observation = stList_get(observations, i);
+    for (int64_t i = 0; i < observationNo; i++) {
+        PoaBaseObservation *observation = &observations[i];
         BamChunkRead *read = stList_get(bamChunkReads, observation->readNo);
-        int64_t observedRepeatCount = read->rleRead->repeatCounts[observation->offset];
+        int64_t observedRepeatCount = rleString_getRepeatCount(read->rleRead, observation->offset);
         if (observedRepeatCount < *minRepeatLength) {
             *minRepeatLength = observedRepeatCount;
         }
@@ -112,22 +125,69 @@ void repeatSubMatrix_getMinAndMaxRepeatCountObservations(RepeatSubMatrix *repeat
     }
 }
 
-void repeatSubMatrix_getRepeatCountProbs(RepeatSubMatrix *repeatSubMatrix, Symbol base, stList *observations,
+static void repeatSubMatrix_getRepeatCountProbsOfBuckets(RepeatSubMatrix *repeatSubMatrix, Symbol base,
+                                                         double *weights, int64_t minObserved, int64_t maxObserved,
+                                                         double *logProbabilities, int64_t minRepeatLength,
+                                                         int64_t maxRepeatLength) {
+    /*
+     * Each candidate repeat count is a dot product of the bucketed weights, weights[strand * maximumRepeatLength +
+     * observed repeat count], with a row of the substitution matrix.
+     */
+    int64_t m = repeatSubMatrix->maximumRepeatLength;
+    for (int64_t i = minRepeatLength; i <= maxRepeatLength; i++) {
+        assert(i < m);
+        double logProb = LOG_ONE;
+        for (int64_t strand = 0; strand < 2; strand++) {
+            double *row = repeatSubMatrix_setLogProb(repeatSubMatrix, base, strand, 0, i);
+            for (int64_t j = minObserved; j <= maxObserved; j++) {
+                if (weights[strand * m + j] != 0.0) {
+                    logProb += row[j] * weights[strand * m + j];
+                }
+            }
+        }
+        logProbabilities[i - minRepeatLength] = logProb / PAIR_ALIGNMENT_PROB_1;
+    }
+}
+
+void repeatSubMatrix_getRepeatCountProbs(RepeatSubMatrix *repeatSubMatrix, Symbol base,
+                                         PoaBaseObservation *observations, int64_t observationNo,
                                          stList *bamChunkReads, double *logProbabilities, int64_t minRepeatLength,
                                          int64_t maxRepeatLength) {
-    for (int64_t i = minRepeatLength; i <= maxRepeatLength; i++) {
-        logProbabilities[i - minRepeatLength] =
-                repeatSubMatrix_getLogProbForGivenRepeatCount(repeatSubMatrix, base, observations, bamChunkReads, i);
+    /*
+     * The observations are first bucketed by strand and observed repeat count, summing their weights, so each
+     * candidate repeat count is then a dot product of the buckets with a row of the substitution matrix.
+     */
+    int64_t m = repeatSubMatrix->maximumRepeatLength;
+    double weights[2 * m];
+    int64_t minObserved = m, maxObserved = -1;
+    for (int64_t j = 0; j < 2 * m; j++) {
+        weights[j] = 0.0;
     }
+    for (int64_t j = 0; j < observationNo; j++) {
+        PoaBaseObservation *observation = &observations[j];
+        BamChunkRead *read = stList_get(bamChunkReads, observation->readNo);
+        int64_t observedRepeatCount = rleString_getRepeatCount(read->rleRead, observation->offset);
+
+        // Be robust to over-long repeat count observations
+        observedRepeatCount = observedRepeatCount >= m ? m - 1 : observedRepeatCount;
+
+        weights[(read->forwardStrand ? 1 : 0) * m + observedRepeatCount] += observation->weight;
+        minObserved = observedRepeatCount < minObserved ? observedRepeatCount : minObserved;
+        maxObserved = observedRepeatCount > maxObserved ? observedRepeatCount : maxObserved;
+    }
+
+    repeatSubMatrix_getRepeatCountProbsOfBuckets(repeatSubMatrix, base, weights, minObserved, maxObserved,
+                                                 logProbabilities, minRepeatLength, maxRepeatLength);
 }
 
-int64_t repeatSubMatrix_getMLRepeatCount(RepeatSubMatrix *repeatSubMatrix, Symbol base, stList *observations,
+int64_t repeatSubMatrix_getMLRepeatCount(RepeatSubMatrix *repeatSubMatrix, Symbol base,
+                                         PoaBaseObservation *observations, int64_t observationNo,
                                          stList *bamChunkReads, double *logProbability) {
     int64_t minRepeatLength, maxRepeatLength;
     double logProbabilities[repeatSubMatrix->maximumRepeatLength];
 
     // Calculate range of repeat counts observed
-    repeatSubMatrix_getMinAndMaxRepeatCountObservations(repeatSubMatrix, observations,
+    repeatSubMatrix_getMinAndMaxRepeatCountObservations(repeatSubMatrix, observations, observationNo,
                                                         bamChunkReads, &minRepeatLength, &maxRepeatLength);
 
     if (minRepeatLength == repeatSubMatrix->maximumRepeatLength) {
@@ -136,7 +196,7 @@ int64_t repeatSubMatrix_getMLRepeatCount(RepeatSubMatrix *repeatSubMatrix, Symbo
     }
 
     // Get the prob for each repeat count
-    repeatSubMatrix_getRepeatCountProbs(repeatSubMatrix, base, observations,
+    repeatSubMatrix_getRepeatCountProbs(repeatSubMatrix, base, observations, observationNo,
                                         bamChunkReads, logProbabilities, minRepeatLength, maxRepeatLength);
 
     return getMax(logProbabilities, maxRepeatLength - minRepeatLength + 1, logProbability) + minRepeatLength;
@@ -167,11 +227,11 @@ int64_t getMax(double *values, int64_t length,
 }
 
 int64_t repeatSubMatrix_getPhasedMLRepeatCount(RepeatSubMatrix *repeatSubMatrix, int64_t existingRepeatCount,
-        Symbol base, stList *observations, stList *bamChunkReads, double *logProbability, stSet *readsBelongingToHap1,
-        stSet *readsBelongingToHap2, PolishParams *params) {
+        Symbol base, PoaBaseObservation *observations, int64_t observationNo, stList *bamChunkReads,
+        double *logProbability, bool *readInHap1, PolishParams *params) {
     // Calculate range of repeat counts observed
     int64_t minRepeatLength, maxRepeatLength;
-    repeatSubMatrix_getMinAndMaxRepeatCountObservations(repeatSubMatrix, observations,
+    repeatSubMatrix_getMinAndMaxRepeatCountObservations(repeatSubMatrix, observations, observationNo,
                                                         bamChunkReads, &minRepeatLength, &maxRepeatLength);
 
     if (minRepeatLength == repeatSubMatrix->maximumRepeatLength) {
@@ -179,25 +239,36 @@ int64_t repeatSubMatrix_getPhasedMLRepeatCount(RepeatSubMatrix *repeatSubMatrix,
         return 0; // Case we have no valid observations, so assume repeat length of 0
     }
 
-    // Split observations between haplotypes
-    stList *observationsHap1 = stList_construct();
-    stList *observationsHap2 = stList_construct();
-    for (int64_t i = 0; i < stList_length(observations); i++) {
-        PoaBaseObservation *observation = stList_get(observations, i);
+    // Bucket the observations by haplotype, strand and observed repeat count in one pass, the haplotype of each
+    // looked up by its read number
+    int64_t m = repeatSubMatrix->maximumRepeatLength;
+    double weights[4 * m]; // Those of hap 2, then hap 1
+    int64_t minObserved = m, maxObserved = -1, observationNoHap1 = 0;
+    for (int64_t j = 0; j < 4 * m; j++) {
+        weights[j] = 0.0;
+    }
+    for (int64_t j = 0; j < observationNo; j++) {
+        PoaBaseObservation *observation = &observations[j];
         BamChunkRead *read = stList_get(bamChunkReads, observation->readNo);
-        stList_append(stSet_search(readsBelongingToHap1, read) != NULL ? observationsHap1 : observationsHap2,
-                      observation);
+        int64_t observedRepeatCount = rleString_getRepeatCount(read->rleRead, observation->offset);
+        observedRepeatCount = observedRepeatCount >= m ? m - 1 : observedRepeatCount;
+        int64_t hap = readInHap1[observation->readNo];
+        weights[(hap * 2 + read->forwardStrand) * m + observedRepeatCount] += observation->weight;
+        minObserved = observedRepeatCount < minObserved ? observedRepeatCount : minObserved;
+        maxObserved = observedRepeatCount > maxObserved ? observedRepeatCount : maxObserved;
+        observationNoHap1 += hap;
     }
+    int64_t observationNoHap2 = observationNo - observationNoHap1;
 
     // Get probs for hap 1
-    double logProbabilitiesHap1[repeatSubMatrix->maximumRepeatLength];
-    repeatSubMatrix_getRepeatCountProbs(repeatSubMatrix, base, observationsHap1,
-                                        bamChunkReads, logProbabilitiesHap1, minRepeatLength, maxRepeatLength);
+    double logProbabilitiesHap1[m];
+    repeatSubMatrix_getRepeatCountProbsOfBuckets(repeatSubMatrix, base, &weights[2 * m], minObserved, maxObserved,
+                                                 logProbabilitiesHap1, minRepeatLength, maxRepeatLength);
 
     // Get probs for hap 2
-    double logProbabilitiesHap2[repeatSubMatrix->maximumRepeatLength];
-    repeatSubMatrix_getRepeatCountProbs(repeatSubMatrix, base, observationsHap2,
-                                        bamChunkReads, logProbabilitiesHap2, minRepeatLength, maxRepeatLength);
+    double logProbabilitiesHap2[m];
+    repeatSubMatrix_getRepeatCountProbsOfBuckets(repeatSubMatrix, base, weights, minObserved, maxObserved,
+                                                 logProbabilitiesHap2, minRepeatLength, maxRepeatLength);
 
     // Get ML prob for haplotype 2
     double logProbMLHap2;
@@ -226,13 +297,182 @@ int64_t repeatSubMatrix_getPhasedMLRepeatCount(RepeatSubMatrix *repeatSubMatrix,
                 (int) mlRepeatLength, (int) mLRepeatLengthHap2, (float) *logProbability,
                 (float) logProbabilitiesHap1[mlRepeatLength - minRepeatLength],
                 (float) logProbMLHap2, (int) minRepeatLength, (int) maxRepeatLength,
-                (int) stList_length(observations), (int) stList_length(observationsHap1),
-                (int) stList_length(observationsHap2));
+                (int) observationNo, (int) observationNoHap1, (int) observationNoHap2);
     }
 
-    // Cleanup
-    stList_destruct(observationsHap1);
-    stList_destruct(observationsHap2);
-
     return mlRepeatLength;
-}
\ No newline at end of file
+}
+
+/*
+ * Run length observation counts, from which a repeat count substitution matrix is trained
+ */
+
+#define RUN_LENGTH_COUNTS_MAGIC 0x434d4c52
+
+RunLengthCounts *runLengthCounts_construct(int64_t maximumRepeatLength) {
+    RunLengthCounts *runLengthCounts = st_calloc(1, sizeof(RunLengthCounts));
+    runLengthCounts->maximumRepeatLength = maximumRepeatLength;
+    runLengthCounts->counts = st_calloc(4 * maximumRepeatLength * maximumRepeatLength, sizeof(uint64_t));
+    return runLengthCounts;
+}
+
+void runLengthCounts_destruct(RunLengthCounts *runLengthCounts) {
+    free(runLengthCounts->counts);
+    free(runLengthCounts);
+}
+
+uint64_t *runLengthCounts_getCount(RunLengthCounts *runLengthCounts, Symbol base, uint64_t underlyingRepeatCount,
+                                   uint64_t observedRepeatCount) {
+    assert(base < 4);
+    int64_t maxRL = runLengthCounts->maximumRepeatLength;
+    underlyingRepeatCount = underlyingRepeatCount < maxRL ? underlyingRepeatCount : maxRL - 1;
+    observedRepeatCount = observedRepeatCount < maxRL ? observedRepeatCount : maxRL - 1;
+    return &(runLengthCounts->counts[(base * maxRL + underlyingRepeatCount) * maxRL + observedRepeatCount]);
+}
+
+void runLengthCounts_merge(RunLengthCounts *runLengthCounts, RunLengthCounts *otherRunLengthCounts) {
+    if (runLengthCounts->maximumRepeatLength != otherRunLengthCounts->maximumRepeatLength) {
+        st_errAbort("Cannot merge run length counts with maximum repeat lengths %"PRId64" and %"PRId64"\n",
+                    runLengthCounts->maximumRepeatLength, otherRunLengthCounts->maximumRepeatLength);
+    }
+    int64_t size = 4 * runLengthCounts->maximumRepeatLength * runLengthCounts->maximumRepeatLength;
+    for (int64_t i = 0; i < size; i++) {
+        runLengthCounts->counts[i] += otherRunLengthCounts->counts[i];
+    }
+}
+
+void runLengthCounts_write(RunLengthCounts *runLengthCounts, FILE *fh) {
+    uint32_t magic = RUN_LENGTH_COUNTS_MAGIC;
+    int64_t size = 4 * runLengthCounts->maximumRepeatLength * runLengthCounts->maximumRepeatLength;
+    if (fwrite(&magic, sizeof(uint32_t), 1, fh) != 1 ||
+        fwrite(&runLengthCounts->maximumRepeatLength, sizeof(int64_t), 1, fh) != 1 ||
+        fwrite(runLengthCounts->counts, sizeof(uint64_t), size, fh) != size) {
+        st_errAbort("Failed to write run length counts\n");
+    }
+}
+
+RunLengthCounts *runLengthCounts_read(FILE *fh) {
+    uint32_t magic;
+    if (fread(&magic, sizeof(uint32_t), 1, fh) != 1) {
+        return NULL;
+    }
+    int64_t maximumRepeatLength;
+    if (magic != RUN_LENGTH_COUNTS_MAGIC || fread(&maximumRepeatLength, sizeof(int64_t), 1, fh) != 1 ||
+        maximumRepeatLength <= 0) {
+        st_errAbort("Got a malformed run length counts header\n");
+    }
+    RunLengthCounts *runLengthCounts = runLengthCounts_construct(maximumRepeatLength);
+    int64_t size = 4 * maximumRepeatLength * maximumRepeatLength;
+    if (fread(runLengthCounts->counts, sizeof(uint64_t), size, fh) != size) {
+        st_errAbort("Got truncated run length counts\n");
+    }
+    return runLengthCounts;
+}
+
+static void runLengthCounts_printLogProbs(FILE *fh, double *counts, int64_t length, double pseudocount) {
+    double total = 0.0;
+    for (int64_t i = 0; i < length; i++) {
+        total += counts[i] + pseudocount;
+    }
+    for (int64_t i = 0; i < length; i++) {
+        fprintf(fh, "%s%.9f", i == 0 ? "" : ", ", log10((counts[i] + pseudocount) / total));
+    }
+}
+
+void runLengthCounts_writeRepeatSubMatrixJson(RunLengthCounts *runLengthCounts, FILE *fh, double pseudocount) {
+    int64_t maxRL = runLengthCounts->maximumRepeatLength;
+    if (maxRL != MAXIMUM_REPEAT_LENGTH) {
+        st_errAbort("Run length counts must have a maximum repeat length of %d to be used as a repeat sub matrix, "
+                    "not %"PRId64"\n", MAXIMUM_REPEAT_LENGTH, maxRL);
+    }
+    double *counts = st_calloc(maxRL, sizeof(double));
+    char *bases = "ACGT";
+
+    fprintf(fh, "{\n");
+
+    // priors over the underlying repeat counts, for A/T and G/C
+    for (int64_t gc = 0; gc < 2; gc++) {
+        for (int64_t underlying = 0; underlying < maxRL; underlying++) {
+            counts[underlying] = 0.0;
+            for (int64_t observed = 0; observed < maxRL; observed++) {
+                counts[underlying] += *runLengthCounts_getCount(runLengthCounts, gc ? 1 : 0, underlying, observed);
+                counts[underlying] += *runLengthCounts_getCount(runLengthCounts, gc ? 2 : 3, underlying, observed);
+            }
+        }
+        fprintf(fh, "  \"baseLogRepeatCounts_%s\": [", gc ? "GC" : "AT");
+        runLengthCounts_printLogProbs(fh, counts, maxRL, pseudocount);
+        fprintf(fh, "],\n");
+    }
+
+    // observed repeat count given underlying repeat count, per base
+    for (Symbol base = 0; base < 4; base++) {
+        fprintf(fh, "  \"repeatCountLogProbabilities_%c_F\": [", bases[base]);
+        for (int64_t underlying = 0; underlying < maxRL; underlying++) {
+            for (int64_t observed = 0; observed < maxRL; observed++) {
+                counts[observed] = *runLengthCounts_getCount(runLengthCounts, base, underlying, observed);
+            }
+            fprintf(fh, "%s", underlying == 0 ? "" : ", ");
+            runLengthCounts_printLogProbs(fh, counts, maxRL, pseudocount);
+        }
+        fprintf(fh, "]%s\n", base == 3 ? "" : ",");
+    }
+
+    fprintf(fh, "}\n");
+    free(counts);
+}
+
+void runLengthCounts_writeTsv(RunLengthCounts *runLengthCounts, Symbol base, FILE *fh) {
+    int64_t maxRL = runLengthCounts->maximumRepeatLength;
+    fprintf(fh, "#ref_rl");
+    for (int64_t observed = 1; observed < maxRL; observed++) {
+        fprintf(fh, "\tread_%"PRId64"%s", observed, observed == maxRL - 1 ? "+" : "");
+    }
+    fprintf(fh, "\n");
+    for (int64_t underlying = 1; underlying < maxRL; underlying++) {
+        fprintf(fh, "%"PRId64, underlying);
+        for (int64_t observed = 1; observed < maxRL; observed++) {
+            fprintf(fh, "\t%"PRIu64, *runLengthCounts_getCount(runLengthCounts, base, underlying, observed));
+        }
+        fprintf(fh, "\n");
+    }
+}
+
+void runLengthCounts_writeOutputFiles(RunLengthCounts *runLengthCounts, char *outputBase, double pseudocount) {
+    char *bases = "ACGT";
+    for (Symbol base = 0; base < 4; base++) {
+        char *countFilename = stString_print("%s.run_lengths.%c.tsv", outputBase, bases[base]);
+        FILE *countFile = fopen(countFilename, "w");
+        if (countFile == NULL) {
+            st_errAbort("Could not open output file for writing: %s\n", countFilename);
+        }
+        st_logCritical("> Writing %c counts to %s\n", bases[base], countFilename);
+        runLengthCounts_writeTsv(runLengthCounts, base, countFile);
+        fclose(countFile);
+        free(countFilename);
+    }
+
+    char *binaryFilename = stString_print("%s.run_lengths.bin", outputBase);
+    FILE *binaryFile = fopen(binaryFilename, "wb");
+    if (binaryFile == NULL) {
+        st_errAbort("Could not open output file for writing: %s\n", binaryFilename);
+    }
+    st_logCritical("> Writing mergeable counts to %s\n", binaryFilename);
+    runLengthCounts_write(runLengthCounts, binaryFile);
+    fclose(binaryFile);
+    free(binaryFilename);
+
+    if (runLengthCounts->maximumRepeatLength != MAXIMUM_REPEAT_LENGTH) {
+        st_logCritical("> Not writing repeat sub matrix, as the maximum run length is not %d\n",
+                       MAXIMUM_REPEAT_LENGTH - 1);
+        return;
+    }
+    char *jsonFilename = stString_print("%s.repeatSubMatrix.json", outputBase);
+    FILE *jsonFile = fopen(jsonFilename, "w");
+    if (jsonFile == NULL) {
+        st_errAbort("Could not open output file for writing: %s\n", jsonFilename);
+    }
+    st_logCritical("> Writing repeat sub matrix to %s\n", jsonFilename);
+    runLengthCounts_writeRepeatSubMatrixJson(runLengthCounts, jsonFile, pseudocount);
+    fclose(jsonFile);
+    free(jsonFilename);
+}
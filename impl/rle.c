@@ -3,32 +3,133 @@
 //
 
 #include "margin.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static int64_t rleString_findOverflowIndex(RleString *rleString, uint64_t i) {
+    /*
+     * Binary searches the overflow table for position i, returning its index in the table, or -(insertion point) - 1
+     * if it is not there.
+     */
+    int64_t low = 0, high = (int64_t) rleString->overflowLength - 1;
+    while (low <= high) {
+        int64_t mid = (low + high) / 2;
+        if (rleString->overflowIndices[mid] < i) {
+            low = mid + 1;
+        } else if (rleString->overflowIndices[mid] > i) {
+            high = mid - 1;
+        } else {
+            return mid;
+        }
+    }
+    return -low - 1;
+}
+
+uint64_t rleString_getOverflowRepeatCount(RleString *rleString, uint64_t i) {
+    int64_t j = rleString_findOverflowIndex(rleString, i);
+    assert(j >= 0);
+    return rleString->overflowCounts[j];
+}
+
+void rleString_setRepeatCount(RleString *rleString, uint64_t i, uint64_t repeatCount) {
+    assert(i < rleString->length);
+    if (rleString->repeatCounts == NULL) {
+        if (repeatCount == 1) {
+            return;
+        }
+        // the counts are stored once one is not one
+        rleString->repeatCounts = st_malloc(rleString->length * sizeof(uint8_t));
+        memset(rleString->repeatCounts, 1, rleString->length * sizeof(uint8_t));
+    }
+    if (repeatCount < RLE_STRING_OVERFLOW_COUNT) {
+        // remove any previous overflow entry
+        if (rleString->repeatCounts[i] == RLE_STRING_OVERFLOW_COUNT) {
+            int64_t j = rleString_findOverflowIndex(rleString, i);
+            assert(j >= 0);
+            for (uint64_t k = j + 1; k < rleString->overflowLength; k++) {
+                rleString->overflowIndices[k - 1] = rleString->overflowIndices[k];
+                rleString->overflowCounts[k - 1] = rleString->overflowCounts[k];
+            }
+            rleString->overflowLength--;
+        }
+        rleString->repeatCounts[i] = (uint8_t) repeatCount;
+        return;
+    }
+
+    // too large, so store it in the overflow table, which is kept sorted by position
+    int64_t j = rleString_findOverflowIndex(rleString, i);
+    if (j < 0) {
+        j = -j - 1;
+        rleString->overflowIndices = st_realloc(rleString->overflowIndices,
+                                                sizeof(uint64_t) * (rleString->overflowLength + 1));
+        rleString->overflowCounts = st_realloc(rleString->overflowCounts,
+                                               sizeof(uint64_t) * (rleString->overflowLength + 1));
+        for (int64_t k = (int64_t) rleString->overflowLength; k > j; k--) {
+            rleString->overflowIndices[k] = rleString->overflowIndices[k - 1];
+            rleString->overflowCounts[k] = rleString->overflowCounts[k - 1];
+        }
+        rleString->overflowIndices[j] = i;
+        rleString->overflowLength++;
+    }
+    rleString->overflowCounts[j] = repeatCount;
+    rleString->repeatCounts[i] = RLE_STRING_OVERFLOW_COUNT;
+}
+
+#if defined(__SSE2__)
+static inline uint64_t runEndMask(const char *str, uint64_t i) {
+    /*
+     * Returns a mask whose bit k is set if str[i + k] is the last character of a run, for k in [0, 16), by comparing
+     * the sixteen characters with the sixteen after them. Reads str[i + 16], so requires i + 16 <= strlen(str).
+     */
+    __m128i x = _mm_loadu_si128((const __m128i *) &str[i]);
+    __m128i y = _mm_loadu_si128((const __m128i *) &str[i + 1]);
+    return (uint16_t) ~_mm_movemask_epi8(_mm_cmpeq_epi8(x, y));
+}
+#endif
 
 RleString * rleString_construct(char *str) {
     RleString *rleString = st_calloc(1, sizeof(RleString));
 
-    rleString->nonRleLength = strlen(str);
+    uint64_t n = strlen(str);
+    rleString->nonRleLength = n;
 
-    // Calc length of rle'd str
-    for (uint64_t i = 0; i < rleString->nonRleLength; i++) {
-        if (i + 1 == rleString->nonRleLength || str[i] != str[i + 1]) {
+    // Calc length of rle'd str. With SSE2 the run ends are found sixteen characters at a time, the string's
+    // terminating NUL ending the last run.
+    uint64_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 16 <= n; i += 16) {
+        rleString->length += popcount64(runEndMask(str, i));
+    }
+#endif
+    for (; i < n; i++) {
+        if (i + 1 == n || str[i] != str[i + 1]) {
             rleString->length++;
         }
     }
 
     // Allocate
     rleString->rleString = st_calloc(rleString->length + 1, sizeof(char));
-    rleString->repeatCounts = st_calloc(rleString->length, sizeof(uint64_t));
+    rleString->repeatCounts = st_calloc(rleString->length, sizeof(uint8_t));
 
     // Fill out
-    uint64_t j = 0, k = 1;
-    for (uint64_t i = 0; i < rleString->nonRleLength; i++) {
-        if (i + 1 == rleString->nonRleLength || str[i] != str[i + 1]) {
+    uint64_t j = 0, runStart = 0;
+    i = 0;
+#if defined(__SSE2__)
+    for (; i + 16 <= n; i += 16) {
+        for (uint64_t mask = runEndMask(str, i); mask != 0; mask &= mask - 1) {
+            uint64_t runEnd = i + __builtin_ctzll(mask);
+            rleString->rleString[j] = str[runEnd];
+            rleString_setRepeatCount(rleString, j++, runEnd + 1 - runStart);
+            runStart = runEnd + 1;
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        if (i + 1 == n || str[i] != str[i + 1]) {
             rleString->rleString[j] = str[i];
-            rleString->repeatCounts[j++] = k;
-            k = 1;
-        } else {
-            k++;
+            rleString_setRepeatCount(rleString, j++, i + 1 - runStart);
+            runStart = i + 1;
         }
     }
     rleString->rleString[j] = '\0';
@@ -50,12 +151,12 @@ RleString *rleString_constructPreComputed(char *rleChars, const uint8_t *rleCoun
 
     // Allocate
     rleString->rleString = stString_copy(rleChars);
-    rleString->repeatCounts = st_calloc(rleString->length, sizeof(int64_t));
+    rleString->repeatCounts = st_calloc(rleString->length, sizeof(uint8_t));
 
     // Fill out
     for (int64_t r = 0; r < rleString->length; r++) {
         // counts
-        rleString->repeatCounts[r] = rleCounts[r];
+        rleString_setRepeatCount(rleString, r, rleCounts[r]);
     }
 
     return rleString;
@@ -67,14 +168,9 @@ RleString *rleString_construct_no_rle(char *string) {
     rleString->nonRleLength = strlen(string);
     rleString->length = rleString->nonRleLength;
 
-    // Allocate
+    // Allocate, the repeat counts are all one so are not stored
     rleString->rleString = stString_copy(string);
-    rleString->repeatCounts = st_calloc(rleString->length, sizeof(uint64_t));
-
-    // Fill out repeat counts
-    for (uint64_t i = 0; i < rleString->length; i++) {
-        rleString->repeatCounts[i] = 1;
-    }
+    rleString->repeatCounts = NULL;
 
     return rleString;
 }
@@ -90,12 +186,19 @@ RleString *rleString_copySubstring(RleString *rleString, uint64_t start, uint64_
     // Copy character substring
     rleSubstring->rleString = stString_getSubString(rleString->rleString, start, length);
 
+    // A substring of a string with unit repeat counts has unit repeat counts
+    if (rleString->repeatCounts == NULL) {
+        rleSubstring->nonRleLength = length;
+        return rleSubstring;
+    }
+
     // Copy repeat count substring and calculate non-rle length
     rleSubstring->nonRleLength = 0;
-    rleSubstring->repeatCounts = st_calloc(length, sizeof(uint64_t));
+    rleSubstring->repeatCounts = st_calloc(length, sizeof(uint8_t));
     for (uint64_t i = 0; i < rleSubstring->length; i++) {
-        rleSubstring->repeatCounts[i] = rleString->repeatCounts[i + start];
-        rleSubstring->nonRleLength += rleSubstring->repeatCounts[i];
+        uint64_t repeatCount = rleString_getRepeatCount(rleString, i + start);
+        rleString_setRepeatCount(rleSubstring, i, repeatCount);
+        rleSubstring->nonRleLength += repeatCount;
     }
 
     return rleSubstring;
@@ -104,7 +207,7 @@ RleString *rleString_copySubstring(RleString *rleString, uint64_t start, uint64_
 void rleString_print(RleString *rleString, FILE *f) {
     fprintf(f, "%s -- ", rleString->rleString);
     for (int64_t i = 0; i < rleString->length; i++) {
-        fprintf(f, "%" PRIi64 " ", rleString->repeatCounts[i]);
+        fprintf(f, "%" PRIi64 " ", rleString_getRepeatCount(rleString, i));
     }
 }
 
@@ -120,16 +223,26 @@ bool rleString_eq(RleString *r1, RleString *r2) {
     // Check bases and repeat counts for equality
     for (int64_t i = 0; i < r1->length; i++) {
         if (r1->rleString[i] != r2->rleString[i] ||
-            r1->repeatCounts[i] != r2->repeatCounts[i]) {
+            rleString_getRepeatCount(r1, i) != rleString_getRepeatCount(r2, i)) {
             return 0;
         }
     }
     return 1;
 }
 
+uint64_t rleString_hash(RleString *rleString) {
+    uint64_t h = stHash_stringKey(rleString->rleString);
+    for (int64_t i = 0; i < rleString->length; i++) {
+        h = h * 31 + rleString_getRepeatCount(rleString, i);
+    }
+    return h;
+}
+
 void rleString_destruct(RleString *rleString) {
     free(rleString->rleString);
     free(rleString->repeatCounts);
+    free(rleString->overflowIndices);
+    free(rleString->overflowCounts);
     free(rleString);
 }
 
@@ -143,10 +256,14 @@ char *expandChar(char c, uint64_t repeatCount) {
 }
 
 char *rleString_expand(RleString *rleString) {
+    if (rleString->repeatCounts == NULL) {
+        return stString_getSubString(rleString->rleString, 0, rleString->length);
+    }
     char *s = st_calloc(rleString->nonRleLength + 1, sizeof(char));
     int64_t j = 0;
     for (int64_t i = 0; i < rleString->length; i++) {
-        for (int64_t k = 0; k < rleString->repeatCounts[i]; k++) {
+        uint64_t repeatCount = rleString_getRepeatCount(rleString, i);
+        for (int64_t k = 0; k < repeatCount; k++) {
             s[j++] = rleString->rleString[i];
         }
     }
@@ -155,19 +272,37 @@ char *rleString_expand(RleString *rleString) {
 }
 
 void rleString_rotateString(RleString *str, int64_t rotationLength, bool mergeEnds) {
+    if (str->repeatCounts == NULL && !mergeEnds) {
+        // only the characters move
+        char rotatedString[str->length];
+        for (int64_t i = 0; i < str->length; i++) {
+            rotatedString[(i + rotationLength) % str->length] = str->rleString[i];
+        }
+        memcpy(str->rleString, rotatedString, str->length);
+        return;
+    }
+    if (str->repeatCounts == NULL) {
+        str->repeatCounts = st_malloc(str->length * sizeof(uint8_t));
+        memset(str->repeatCounts, 1, str->length * sizeof(uint8_t));
+    }
     char rotatedString[str->length];
     uint64_t rotatedRepeatCounts[str->length];
     for (int64_t i = 0; i < str->length; i++) {
         rotatedString[(i + rotationLength) % str->length] = str->rleString[i];
-        rotatedRepeatCounts[(i + rotationLength) % str->length] = str->repeatCounts[i];
+        rotatedRepeatCounts[(i + rotationLength) % str->length] = rleString_getRepeatCount(str, i);
+    }
+    // the overflow table is rebuilt for the new positions
+    for (int64_t i = 0; i < str->length; i++) {
+        str->repeatCounts[i] = 0;
     }
+    str->overflowLength = 0;
     int64_t j = 0;
     for (int64_t i = 0; i < str->length; i++) {
         if (!mergeEnds || i == 0 || rotatedString[i] != rotatedString[i - 1]) {
             str->rleString[j] = rotatedString[i];
-            str->repeatCounts[j++] = rotatedRepeatCounts[i];
+            rleString_setRepeatCount(str, j++, rotatedRepeatCounts[i]);
         } else {
-            str->repeatCounts[j - 1] += rotatedRepeatCounts[i];
+            rleString_setRepeatCount(str, j - 1, rleString_getRepeatCount(str, j - 1) + rotatedRepeatCounts[i]);
         }
         //str->rleString[i] = rotatedString[i];
         //str->repeatCounts[i] = rotatedRepeatCounts[i];
@@ -179,18 +314,23 @@ uint8_t *rleString_rleQualities(RleString *rleString, const uint8_t *qualities)
     // calculate read qualities (if set)
     //TODO unit test this
     uint8_t *rleQualities = st_calloc(rleString->length, sizeof(uint8_t));
+    if (rleString->repeatCounts == NULL) {
+        memcpy(rleQualities, qualities, rleString->length * sizeof(uint8_t));
+        return rleQualities;
+    }
     uint64_t rawPos = 0;
     for (uint64_t rlePos = 0; rlePos < rleString->length; rlePos++) {
         uint8_t min = UINT8_MAX;
         uint8_t max = 0;
         int64_t mean = 0;
-        for (uint64_t repeatIdx = 0; repeatIdx < rleString->repeatCounts[rlePos]; repeatIdx++) {
+        uint64_t repeatCount = rleString_getRepeatCount(rleString, rlePos);
+        for (uint64_t repeatIdx = 0; repeatIdx < repeatCount; repeatIdx++) {
             uint8_t q = qualities[rawPos++];
             min = (q < min ? q : min);
             max = (q > max ? q : max);
             mean += q;
         }
-        mean = mean / rleString->repeatCounts[rlePos];
+        mean = mean / repeatCount;
         assert(mean <= UINT8_MAX);
         // pick your favorite metric
         //r->qualities[rlePos] = min;
@@ -203,12 +343,29 @@ uint8_t *rleString_rleQualities(RleString *rleString, const uint8_t *qualities)
 
 uint64_t *rleString_getNonRleToRleCoordinateMap(RleString *rleString) {
     uint64_t *nonRleToRleCoordinateMap = st_malloc(sizeof(uint64_t) * rleString->nonRleLength);
+    if (rleString->repeatCounts == NULL) {
+        // the identity
+        for (uint64_t i = 0; i < rleString->length; i++) {
+            nonRleToRleCoordinateMap[i] = i;
+        }
+        return nonRleToRleCoordinateMap;
+    }
 
     uint64_t j = 0;
     for (uint64_t i = 0; i < rleString->length; i++) {
-        for (uint64_t k = 0; k < rleString->repeatCounts[i]; k++) {
-            nonRleToRleCoordinateMap[j++] = i;
+        uint64_t repeatCount = rleString_getRepeatCount(rleString, i);
+        uint64_t k = 0;
+#if defined(__SSE2__)
+        // runs are filled two coordinates per store
+        __m128i v = _mm_set1_epi64x((int64_t) i);
+        for (; k + 2 <= repeatCount; k += 2) {
+            _mm_storeu_si128((__m128i *) &nonRleToRleCoordinateMap[j + k], v);
         }
+#endif
+        for (; k < repeatCount; k++) {
+            nonRleToRleCoordinateMap[j + k] = i;
+        }
+        j += repeatCount;
     }
     assert(j == rleString->nonRleLength);
 
@@ -217,11 +374,18 @@ uint64_t *rleString_getNonRleToRleCoordinateMap(RleString *rleString) {
 
 uint64_t *rleString_getRleToNonRleCoordinateMap(RleString *rleString) {
     uint64_t *rleToNonRleCoordinateMap = st_malloc(sizeof(uint64_t) * rleString->length);
+    if (rleString->repeatCounts == NULL) {
+        // the identity
+        for (uint64_t i = 0; i < rleString->length; i++) {
+            rleToNonRleCoordinateMap[i] = i;
+        }
+        return rleToNonRleCoordinateMap;
+    }
 
     uint64_t j = 0;
     for (uint64_t i = 0; i < rleString->length; i++) {
         rleToNonRleCoordinateMap[i] = j;
-        j += rleString->repeatCounts[i];
+        j += rleString_getRepeatCount(rleString, i);
     }
     assert(j == rleString->nonRleLength);
 
@@ -248,4 +412,72 @@ stList *runLengthEncodeAlignment(stList *alignment,
     }
 
     return rleAlignment;
+}
+
+PackedAlignment *packedAlignment_construct(void) {
+    PackedAlignment *alignment = st_calloc(1, sizeof(PackedAlignment));
+    alignment->maxRunNo = 16;
+    alignment->runs = st_malloc(sizeof(AlignmentRun) * alignment->maxRunNo);
+    return alignment;
+}
+
+void packedAlignment_destruct(PackedAlignment *alignment) {
+    free(alignment->runs);
+    free(alignment);
+}
+
+void packedAlignment_addPair(PackedAlignment *alignment, int64_t x, int64_t y) {
+    alignment->length++;
+    if (alignment->runNo > 0) {
+        AlignmentRun *run = &alignment->runs[alignment->runNo - 1];
+        assert(x >= run->x + run->length && y >= run->y + run->length);
+        if (x == run->x + run->length && y == run->y + run->length) {
+            run->length++;
+            return;
+        }
+    }
+    if (alignment->runNo == alignment->maxRunNo) {
+        alignment->maxRunNo *= 2;
+        alignment->runs = st_realloc(alignment->runs, sizeof(AlignmentRun) * alignment->maxRunNo);
+    }
+    AlignmentRun *run = &alignment->runs[alignment->runNo++];
+    run->x = x;
+    run->y = y;
+    run->length = 1;
+}
+
+PackedAlignment *packedAlignment_runLengthEncode(PackedAlignment *alignment,
+                                                 const uint64_t *seqXNonRleToRleCoordinateMap,
+                                                 const uint64_t *seqYNonRleToRleCoordinateMap) {
+    PackedAlignment *rleAlignment = packedAlignment_construct();
+
+    // keep the pairs that advance in both run length encoded sequences, as runLengthEncodeAlignment does
+    int64_t x = -1, y = -1;
+    for (int64_t i = 0; i < alignment->runNo; i++) {
+        AlignmentRun *run = &alignment->runs[i];
+        for (int64_t j = 0; j < run->length; j++) {
+            int64_t x2 = seqXNonRleToRleCoordinateMap[run->x + j];
+            int64_t y2 = seqYNonRleToRleCoordinateMap[run->y + j];
+            if (x2 > x && y2 > y) {
+                packedAlignment_addPair(rleAlignment, x2, y2);
+                x = x2;
+                y = y2;
+            }
+        }
+    }
+
+    return rleAlignment;
+}
+
+stList *packedAlignment_getAlignedPairs(PackedAlignment *alignment, int64_t weight) {
+    stList *alignedPairs = stList_construct3(alignment->length, (void (*)(void *)) stIntTuple_destruct);
+    int64_t k = 0;
+    for (int64_t i = 0; i < alignment->runNo; i++) {
+        AlignmentRun *run = &alignment->runs[i];
+        for (int64_t j = 0; j < run->length; j++) {
+            stList_set(alignedPairs, k++, stIntTuple_construct3(run->x + j, run->y + j, weight));
+        }
+    }
+    assert(k == alignment->length);
+    return alignedPairs;
 }
\ No newline at end of file
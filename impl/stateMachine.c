@@ -109,6 +109,14 @@ SymbolString symbolString_getSubString(SymbolString s, uint64_t start, uint64_t
     return s2;
 }
 
+SymbolString symbolString_getView(SymbolString s, uint64_t start, uint64_t length) {
+    assert(start + length <= s.length); // Check bounds
+    SymbolString s2 = s;
+    s2.sequence = &(s.sequence[start]);
+    s2.length = length;
+    return s2;
+}
+
 void symbolString_destruct(SymbolString s) {
     free(s.sequence);
 }
@@ -138,7 +146,7 @@ SymbolString rleString_constructSymbolString(RleString *s,
 	symbolString.sequence = symbol_convertStringToSymbols(s->rleString, start, length, a);
 	if(includeRepeatCounts) {
 		for (int64_t i = 0; i < length; i++) {
-			symbolString.sequence[i] = symbol_addRepeatCount(symbolString.sequence[i], s->repeatCounts[i+start], maxRepeatCountExclusive);
+			symbolString.sequence[i] = symbol_addRepeatCount(symbolString.sequence[i], rleString_getRepeatCount(s, i+start), maxRepeatCountExclusive);
 		}
 	}
 	symbolString.length = length;
@@ -306,6 +314,34 @@ void hmm_setEmissionsExpectation(Hmm *hmm, int64_t state, int64_t emissionNo, do
     *hmm_getEmissionsExpectation2(hmm, state, emissionNo) = p;
 }
 
+void hmm_addToEmissionsExpectationForSymbols(Hmm *hmm, int64_t state, Symbol x, Symbol y, double p) {
+    if (hmm->emissionsType != nucleotideEmissions) {
+        return;
+    }
+    // Repeat counts are not part of the nucleotide emissions, and emissions of ambiguous characters are not trained
+    x = symbol_stripRepeatCount(x);
+    y = symbol_stripRepeatCount(y);
+    switch (state) {
+        case match:
+            if (x < 4 && y < 4) {
+                hmm_addToEmissionsExpectation(hmm, state, x * 4 + y, p);
+            }
+            break;
+        case shortGapX:
+            if (x < 4) {
+                hmm_addToEmissionsExpectation(hmm, state, x, p);
+            }
+            break;
+        case shortGapY:
+            if (y < 4) {
+                hmm_addToEmissionsExpectation(hmm, state, y, p);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
 static void
 hmm_emissions_loadProbs(Hmm *hmm, double *emissionProbs, int64_t state, int64_t start, int64_t emissionNumber) {
     for (int64_t x = 0; x < emissionNumber; x++) {
@@ -337,6 +373,64 @@ void hmm_normalise(Hmm *hmm) {
     }
 }
 
+void hmm_addExpectations(Hmm *hmmExpectations, Hmm *hmmExpectations2) {
+    assert(hmmExpectations->stateNumber == hmmExpectations2->stateNumber);
+    assert(hmmExpectations->totalEmissions == hmmExpectations2->totalEmissions);
+    for (int64_t i = 0; i < hmmExpectations->stateNumber * hmmExpectations->stateNumber; i++) {
+        hmmExpectations->transitions[i] += hmmExpectations2->transitions[i];
+    }
+    for (int64_t i = 0; i < hmmExpectations->totalEmissions; i++) {
+        hmmExpectations->emissions[i] += hmmExpectations2->emissions[i];
+    }
+    hmmExpectations->likelihood += hmmExpectations2->likelihood;
+}
+
+void hmm_reverseComplementEmissions(Hmm *hmm) {
+    if (hmm->emissionsType != nucleotideEmissions) {
+        st_errAbort("Reverse complement of hmm: unrecognized emission type");
+    }
+    // Matches, swapping each pair of bases for the pair of their complements
+    for (int64_t i = 0; i < 16; i++) {
+        int64_t j = (3 - i / 4) * 4 + (3 - i % 4);
+        if (i < j) {
+            double p = hmm_getEmissionsExpectation(hmm, match, i);
+            hmm_setEmissionsExpectation(hmm, match, i, hmm_getEmissionsExpectation(hmm, match, j));
+            hmm_setEmissionsExpectation(hmm, match, j, p);
+        }
+    }
+    // Gaps
+    for (int64_t state = shortGapX; state <= shortGapY; state++) {
+        for (int64_t i = 0; i < 2; i++) {
+            double p = hmm_getEmissionsExpectation(hmm, state, i);
+            hmm_setEmissionsExpectation(hmm, state, i, hmm_getEmissionsExpectation(hmm, state, 3 - i));
+            hmm_setEmissionsExpectation(hmm, state, 3 - i, p);
+        }
+    }
+}
+
+void hmm_printJson(Hmm *hmm, FILE *fh, const char *indent) {
+    fprintf(fh, "{\n%s\t\"type\" : %i,\n%s\t\"emissionsType\" : %i,\n%s\t\"transitions\" : [",
+            indent, (int) hmm->type, indent, (int) hmm->emissionsType, indent);
+    for (int64_t from = 0; from < hmm->stateNumber; from++) {
+        fprintf(fh, "\n%s\t\t", indent);
+        for (int64_t to = 0; to < hmm->stateNumber; to++) {
+            fprintf(fh, "%.8f%s", hmm_getTransition(hmm, from, to),
+                    from + 1 == hmm->stateNumber && to + 1 == hmm->stateNumber ? "" : ", ");
+        }
+    }
+    fprintf(fh, "\n%s\t],\n%s\t\"emissions\" : [", indent, indent);
+    for (int64_t state = 0; state < hmm->stateNumber; state++) {
+        for (int64_t x = 0; x < hmm->emissionNoPerState[state]; x++) {
+            if (x % 4 == 0) {
+                fprintf(fh, "\n%s\t\t", indent);
+            }
+            fprintf(fh, "%.8f%s", hmm_getEmissionsExpectation(hmm, state, x),
+                    state + 1 == hmm->stateNumber && x + 1 == hmm->emissionNoPerState[state] ? "" : ", ");
+        }
+    }
+    fprintf(fh, "\n%s\t],\n%s\t\"likelihood\" : %f\n%s}", indent, indent, hmm->likelihood, indent);
+}
+
 void hmm_randomise(Hmm *hmm) {
     //Transitions
     for (int64_t from = 0; from < hmm->stateNumber; from++) {
@@ -382,6 +476,25 @@ static inline double getNucleotideMatchProb(NucleotideEmissions *e, Symbol x, Sy
     return e->EMISSION_MATCH_PROBS[x * 4 + y];
 }
 
+/*
+ * Defines a function computing the emissions along a run of cells of a diagonal (see
+ * Emissions.diagonalEmissions) with the given, inlined, emission functions.
+ */
+#define EMISSIONS_DIAGONAL_FN(NAME, EMISSIONS_TYPE, GAP_X_FN, MATCH_FN, GAP_Y_FN) \
+static void NAME(Emissions *e, const Symbol *sX, const Symbol *sY, int64_t n, double *eGapX, double *eMatch, \
+                 double *eGapY) { \
+    EMISSIONS_TYPE *e2 = (EMISSIONS_TYPE *) e; \
+    for (int64_t i = 0; i < n; i++) { \
+        Symbol x = sX[i], y = sY[-i]; \
+        eGapX[i] = GAP_X_FN(e2, x); \
+        eMatch[i] = MATCH_FN(e2, x, y); \
+        eGapY[i] = GAP_Y_FN(e2, y); \
+    } \
+}
+
+EMISSIONS_DIAGONAL_FN(nucleotideEmissions_diagonal, NucleotideEmissions, getNucleotideGapProbX, getNucleotideMatchProb,
+                      getNucleotideGapProbY)
+
 void nucleotideEmissions_print(NucleotideEmissions *ne, FILE *f) {
     // Matches
     fprintf(f, "\tSubstitution matrix: \n");
@@ -438,6 +551,7 @@ Emissions *nucleotideEmissions_construct() {
     ne->e.emission = (double (*)(Emissions *, Symbol, Symbol)) getNucleotideMatchProb;
     ne->e.gapEmissionX = (double (*)(Emissions *, Symbol)) getNucleotideGapProbX;
     ne->e.gapEmissionY = (double (*)(Emissions *, Symbol)) getNucleotideGapProbY;
+    ne->e.diagonalEmissions = nucleotideEmissions_diagonal;
     ne->e.printFn = (void (*)(Emissions *, FILE *)) nucleotideEmissions_print;
 
 
@@ -501,23 +615,6 @@ void emissions_destruct(Emissions *e) {
 ///////////////////////////////////
 ///////////////////////////////////
 
-//Transitions
-typedef struct _StateMachine3 StateMachine3;
-
-struct _StateMachine3 {
-    //3 state state machine, allowing for symmetry in x and y.
-    StateMachine model;
-    double TRANSITION_MATCH_CONTINUE;
-    double TRANSITION_MATCH_FROM_GAP_X;
-    double TRANSITION_MATCH_FROM_GAP_Y;
-    double TRANSITION_GAP_OPEN_X;
-    double TRANSITION_GAP_OPEN_Y;
-    double TRANSITION_GAP_EXTEND_X;
-    double TRANSITION_GAP_EXTEND_Y;
-    double TRANSITION_GAP_SWITCH_TO_X;
-    double TRANSITION_GAP_SWITCH_TO_Y;
-};
-
 static double stateMachine3_startStateProb(StateMachine *sM, int64_t state) {
     //Match state is like going to a match.
     state_check(sM, state);
@@ -565,24 +662,7 @@ static void stateMachine3_cellCalculate(StateMachine *sM, double *current, doubl
                                                              void *),
                                         void *extraArgs) {
     StateMachine3 *sM3 = (StateMachine3 *) sM;
-    if (lower != NULL) {
-        double eP = sM->emissions->gapEmissionX(sM->emissions, cX);
-        doTransition(lower, current, match, shortGapX, eP, sM3->TRANSITION_GAP_OPEN_X, extraArgs);
-        doTransition(lower, current, shortGapX, shortGapX, eP, sM3->TRANSITION_GAP_EXTEND_X, extraArgs);
-        doTransition(lower, current, shortGapY, shortGapX, eP, sM3->TRANSITION_GAP_SWITCH_TO_X, extraArgs);
-    }
-    if (middle != NULL) {
-        double eP = sM->emissions->emission(sM->emissions, cX, cY);
-        doTransition(middle, current, match, match, eP, sM3->TRANSITION_MATCH_CONTINUE, extraArgs);
-        doTransition(middle, current, shortGapX, match, eP, sM3->TRANSITION_MATCH_FROM_GAP_X, extraArgs);
-        doTransition(middle, current, shortGapY, match, eP, sM3->TRANSITION_MATCH_FROM_GAP_Y, extraArgs);
-    }
-    if (upper != NULL) {
-        double eP = sM->emissions->gapEmissionY(sM->emissions, cY);
-        doTransition(upper, current, match, shortGapY, eP, sM3->TRANSITION_GAP_OPEN_Y, extraArgs);
-        doTransition(upper, current, shortGapY, shortGapY, eP, sM3->TRANSITION_GAP_EXTEND_Y, extraArgs);
-        doTransition(upper, current, shortGapX, shortGapY, eP, sM3->TRANSITION_GAP_SWITCH_TO_Y, extraArgs);
-    }
+    STATE_MACHINE3_CELL_CALCULATE(sM3, current, lower, middle, upper, cX, cY, doTransition, extraArgs)
 }
 
 void stateMachine3_print(StateMachine3 *sM3, FILE *f) {
@@ -702,6 +782,48 @@ StateMachine *hmm_getStateMachine(Hmm *hmm) {
     return NULL;
 }
 
+bool stateMachine3_isReverseStrand(StateMachine *sM, StateMachine *reverseSM, uint64_t maxRepeatCountExclusive) {
+    if (sM->type != reverseSM->type || sM->stateNumber != SM3_STATES || reverseSM->stateNumber != SM3_STATES) {
+        return 0;
+    }
+    // The transitions are shared
+    StateMachine3 *sM3 = (StateMachine3 *) sM, *reverseSM3 = (StateMachine3 *) reverseSM;
+    double transitions[] = { sM3->TRANSITION_MATCH_CONTINUE, sM3->TRANSITION_MATCH_FROM_GAP_X,
+                             sM3->TRANSITION_MATCH_FROM_GAP_Y, sM3->TRANSITION_GAP_OPEN_X, sM3->TRANSITION_GAP_OPEN_Y,
+                             sM3->TRANSITION_GAP_EXTEND_X, sM3->TRANSITION_GAP_EXTEND_Y,
+                             sM3->TRANSITION_GAP_SWITCH_TO_X, sM3->TRANSITION_GAP_SWITCH_TO_Y };
+    double reverseTransitions[] = { reverseSM3->TRANSITION_MATCH_CONTINUE, reverseSM3->TRANSITION_MATCH_FROM_GAP_X,
+                                    reverseSM3->TRANSITION_MATCH_FROM_GAP_Y, reverseSM3->TRANSITION_GAP_OPEN_X,
+                                    reverseSM3->TRANSITION_GAP_OPEN_Y, reverseSM3->TRANSITION_GAP_EXTEND_X,
+                                    reverseSM3->TRANSITION_GAP_EXTEND_Y, reverseSM3->TRANSITION_GAP_SWITCH_TO_X,
+                                    reverseSM3->TRANSITION_GAP_SWITCH_TO_Y };
+    for (int64_t i = 0; i < 9; i++) {
+        if (transitions[i] != reverseTransitions[i]) {
+            return 0;
+        }
+    }
+    // The emissions of each pair of bases are those of their complements
+    Emissions *e = sM->emissions, *reverseE = reverseSM->emissions;
+    for (uint64_t xRepeatCount = 0; xRepeatCount < maxRepeatCountExclusive; xRepeatCount++) {
+        for (uint64_t yRepeatCount = 0; yRepeatCount < maxRepeatCountExclusive; yRepeatCount++) {
+            for (Symbol xBase = 0; xBase < 4; xBase++) {
+                for (Symbol yBase = 0; yBase < 4; yBase++) {
+                    Symbol x = symbol_addRepeatCount(xBase, xRepeatCount, maxRepeatCountExclusive);
+                    Symbol y = symbol_addRepeatCount(yBase, yRepeatCount, maxRepeatCountExclusive);
+                    Symbol cX = symbol_addRepeatCount(3 - xBase, xRepeatCount, maxRepeatCountExclusive);
+                    Symbol cY = symbol_addRepeatCount(3 - yBase, yRepeatCount, maxRepeatCountExclusive);
+                    if (fabs(e->emission(e, x, y) - reverseE->emission(reverseE, cX, cY)) > 1.0e-9 ||
+                        e->gapEmissionX(e, x) != reverseE->gapEmissionX(reverseE, cX) ||
+                        e->gapEmissionY(e, y) != reverseE->gapEmissionY(reverseE, cY)) {
+                        return 0;
+                    }
+                }
+            }
+        }
+    }
+    return 1;
+}
+
 void stateMachine_destruct(StateMachine *stateMachine) {
     emissions_destruct(stateMachine->emissions);
     free(stateMachine);
@@ -713,32 +835,55 @@ void stateMachine_destruct(StateMachine *stateMachine) {
 ///////////////////////////////////
 ///////////////////////////////////
 
+// The bases of the tables of the rle emissions, the four nucleotides and N
+#define RLE_EMISSION_BASES 5
+
 typedef struct _rleNucleotideEmissions {
     NucleotideEmissions ne;
     RepeatSubMatrix *repeatSubMatrix;
     bool strand;
+    // The emissions of the strand, precomputed when the emissions are constructed so each is a table lookup
+    double gapXLogProbs[RLE_EMISSION_BASES];
+    double gapYLogProbs[RLE_EMISSION_BASES];
+    double matchLogProbs[RLE_EMISSION_BASES * RLE_EMISSION_BASES]; // [xBase][yBase]
+    int64_t maximumRepeatLength;
+    int64_t repeatRowLength; // maximumRepeatLength rounded up to a multiple of four doubles, for vector gathers
+    double repeatLogProbs[]; // [xBase][xRepeatCount][yRepeatCount], the weighted repeat count log probabilities
 } RleNucleotideEmissions;
 
+static inline Symbol rleNucleotideEmissions_getBase(Symbol s) {
+    Symbol base = symbol_stripRepeatCount(s);
+    return base < RLE_EMISSION_BASES ? base : RLE_EMISSION_BASES - 1; // Other ambiguous characters are treated as Ns
+}
+
 static inline double getRleNucleotideGapProbX(RleNucleotideEmissions *rlene, Symbol x) {
-    return getNucleotideGapProb(rlene->ne.EMISSION_GAP_X_PROBS, symbol_stripRepeatCount(x));
+    return rlene->gapXLogProbs[rleNucleotideEmissions_getBase(x)];
 }
 
 static inline double getRleNucleotideGapProbY(RleNucleotideEmissions *rlene, Symbol y) {
-    Symbol base = symbol_stripRepeatCount(y);
     //double *repeatProbs = (base == 0 || base == 3) ? rlene->repeatSubMatrix->baseLogProbs_AT : rlene->repeatSubMatrix->baseLogProbs_GC;
-    return getNucleotideGapProb(rlene->ne.EMISSION_GAP_Y_PROBS,
-                                base); // + 2.3025 * repeatProbs[symbol_getRepeatLength(y)];
+    return rlene->gapYLogProbs[rleNucleotideEmissions_getBase(y)]; // + 2.3025 * repeatProbs[symbol_getRepeatLength(y)];
 }
 
 static inline double getRleNucleotideMatchProb(RleNucleotideEmissions *rlene, Symbol x, Symbol y) {
-    Symbol xBase = symbol_stripRepeatCount(x);
-    return getNucleotideMatchProb(&(rlene->ne), xBase, symbol_stripRepeatCount(y)) +
-           2.3025 * repeatSubMatrix_getLogProb(rlene->repeatSubMatrix, xBase, rlene->strand, symbol_getRepeatLength(y),
-                                               symbol_getRepeatLength(x));
+    Symbol xBase = rleNucleotideEmissions_getBase(x);
+    int64_t xRepeatCount = symbol_getRepeatLength(x), yRepeatCount = symbol_getRepeatLength(y);
+    assert(xRepeatCount < rlene->maximumRepeatLength);
+    assert(yRepeatCount < rlene->maximumRepeatLength);
+    return rlene->matchLogProbs[xBase * RLE_EMISSION_BASES + rleNucleotideEmissions_getBase(y)] +
+           rlene->repeatLogProbs[(xBase * rlene->maximumRepeatLength + xRepeatCount) * rlene->repeatRowLength +
+                                 yRepeatCount];
 }
 
+EMISSIONS_DIAGONAL_FN(rleNucleotideEmissions_diagonal, RleNucleotideEmissions, getRleNucleotideGapProbX,
+                      getRleNucleotideMatchProb, getRleNucleotideGapProbY)
+
 Emissions *rleNucleotideEmissions_construct(Emissions *emissions, RepeatSubMatrix *repeatSubMatrix, bool strand) {
-    RleNucleotideEmissions *rlene = st_calloc(1, sizeof(RleNucleotideEmissions));
+    int64_t maximumRepeatLength = repeatSubMatrix->maximumRepeatLength;
+    int64_t repeatRowLength = (maximumRepeatLength + 3) / 4 * 4;
+    RleNucleotideEmissions *rlene = st_calloc(1, sizeof(RleNucleotideEmissions) +
+                                                 sizeof(double) * RLE_EMISSION_BASES * maximumRepeatLength *
+                                                 repeatRowLength);
     rlene->repeatSubMatrix = repeatSubMatrix;
     rlene->strand = strand;
     NucleotideEmissions *ne = (NucleotideEmissions *) emissions;
@@ -747,6 +892,29 @@ Emissions *rleNucleotideEmissions_construct(Emissions *emissions, RepeatSubMatri
     rlene->ne.e.emission = (double (*)(Emissions *, Symbol, Symbol)) getRleNucleotideMatchProb;
     rlene->ne.e.gapEmissionX = (double (*)(Emissions *, Symbol)) getRleNucleotideGapProbX;
     rlene->ne.e.gapEmissionY = (double (*)(Emissions *, Symbol)) getRleNucleotideGapProbY;
+    rlene->ne.e.diagonalEmissions = rleNucleotideEmissions_diagonal;
+
+    // Precompute the emissions
+    for (Symbol x = 0; x < RLE_EMISSION_BASES; x++) {
+        rlene->gapXLogProbs[x] = getNucleotideGapProbX(&(rlene->ne), x);
+        rlene->gapYLogProbs[x] = getNucleotideGapProbY(&(rlene->ne), x);
+        for (Symbol y = 0; y < RLE_EMISSION_BASES; y++) {
+            rlene->matchLogProbs[x * RLE_EMISSION_BASES + y] = getNucleotideMatchProb(&(rlene->ne), x, y);
+        }
+    }
+    rlene->maximumRepeatLength = maximumRepeatLength;
+    rlene->repeatRowLength = repeatRowLength;
+    for (Symbol x = 0; x < RLE_EMISSION_BASES; x++) {
+        // Repeat counts of Ns are modelled as those of As
+        Symbol repeatBase = x < RLE_EMISSION_BASES - 1 ? x : 0;
+        for (int64_t xRepeatCount = 0; xRepeatCount < maximumRepeatLength; xRepeatCount++) {
+            for (int64_t yRepeatCount = 0; yRepeatCount < maximumRepeatLength; yRepeatCount++) {
+                rlene->repeatLogProbs[(x * maximumRepeatLength + xRepeatCount) * repeatRowLength + yRepeatCount] =
+                        2.3025 * repeatSubMatrix_getLogProb(repeatSubMatrix, repeatBase, strand, yRepeatCount,
+                                                            xRepeatCount);
+            }
+        }
+    }
 
     return (Emissions *) rlene;
 }
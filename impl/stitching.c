@@ -4,6 +4,11 @@
 // Code for stitching together "chunks" of inferred sequence
 //
 
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <htslib/faidx.h>
+#include <htslib/bgzf.h>
 #include "margin.h"
 #include "htsIntegration.h"
 
@@ -240,14 +245,116 @@ static void swap(void **a, void **b) {
     *b = c;
 }
 
-static void addToHapReadsSeen(stHash *hapReads, stHash *otherHapReads, stHash *readsToAdd) {
+typedef struct _phasedReads {
     /*
-     * Adds read names / probs from readsToAdd to hapReads that are not in otherHapReads. Cleans up readsToAdd.
+     * The reads assigned to each haplotype while stitching. Read names are interned as dense integer ids, so that
+     * each haplotype is an array of probs indexed by id and intersections with a chunk's reads are array lookups.
      */
-    stHashIterator *it = stHash_getIterator(readsToAdd);
-    char *readName;
-    while ((readName = stHash_getNext(it)) != NULL) {
-        double *prob = stHash_search(readsToAdd, readName);
+    stHash *readNameToId; // Read name to one plus the read's id, names are owned by readNames
+    stList *readNames; // Read names, indexed by id
+    int64_t capacity; // Allocated length of hapProbs
+    double *hapProbs[2]; // Prob of each read being in each haplotype, NAN if the read is not in the haplotype
+} PhasedReads;
+
+typedef struct _chunkReads {
+    /*
+     * The reads of one haplotype of a chunk, as ids interned by a PhasedReads.
+     */
+    int64_t length;
+    int64_t *ids;
+    double *probs;
+} ChunkReads;
+
+static PhasedReads *phasedReads_construct(void) {
+    PhasedReads *phasedReads = st_calloc(1, sizeof(PhasedReads));
+    phasedReads->readNameToId = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, NULL, NULL);
+    phasedReads->readNames = stList_construct3(0, free);
+    return phasedReads;
+}
+
+static void phasedReads_destruct(PhasedReads *phasedReads) {
+    stHash_destruct(phasedReads->readNameToId);
+    stList_destruct(phasedReads->readNames);
+    free(phasedReads->hapProbs[0]);
+    free(phasedReads->hapProbs[1]);
+    free(phasedReads);
+}
+
+static int64_t phasedReads_getId(PhasedReads *phasedReads, char *readName) {
+    /*
+     * Returns the id of the read, interning the name if it has not been seen before.
+     */
+    int64_t id = (int64_t) stHash_search(phasedReads->readNameToId, readName) - 1;
+    if (id >= 0) {
+        return id;
+    }
+    id = stList_length(phasedReads->readNames);
+    char *name = stString_copy(readName);
+    stList_append(phasedReads->readNames, name);
+    stHash_insert(phasedReads->readNameToId, name, (void *) (id + 1));
+    if (id >= phasedReads->capacity) {
+        int64_t capacity = phasedReads->capacity == 0 ? 1024 : 2 * phasedReads->capacity;
+        for (int64_t h = 0; h < 2; h++) {
+            phasedReads->hapProbs[h] = st_realloc(phasedReads->hapProbs[h], capacity * sizeof(double));
+            for (int64_t i = phasedReads->capacity; i < capacity; i++) {
+                phasedReads->hapProbs[h][i] = NAN;
+            }
+        }
+        phasedReads->capacity = capacity;
+    }
+    return id;
+}
+
+static ChunkReads *phasedReads_getChunkReads(PhasedReads *phasedReads, stList *readPartitionLines) {
+    /*
+     * Parse the names of the reads from the lines of output representing the relative read phasing (the first line
+     * is a header) and return them as ids with their probs.
+     */
+    ChunkReads *chunkReads = st_calloc(1, sizeof(ChunkReads));
+    int64_t maxLength = stList_length(readPartitionLines) - 1;
+    chunkReads->ids = st_malloc((maxLength > 0 ? maxLength : 1) * sizeof(int64_t));
+    chunkReads->probs = st_malloc((maxLength > 0 ? maxLength : 1) * sizeof(double));
+    for (int64_t i = 1; i < stList_length(readPartitionLines); i++) {
+        char *line = stList_get(readPartitionLines, i);
+        char *comma = strchr(line, ',');
+        if (comma == NULL) {
+            st_errAbort("Could not parse read partition line: %s", line);
+        }
+        *comma = '\0'; // Temporarily terminate the read name, to avoid copying it
+        int64_t id = phasedReads_getId(phasedReads, line);
+        *comma = ',';
+        chunkReads->ids[chunkReads->length] = id;
+        chunkReads->probs[chunkReads->length++] = strtof(comma + 1, NULL); // Log prob of the read being in the partition
+    }
+    return chunkReads;
+}
+
+static void chunkReads_destruct(ChunkReads *chunkReads) {
+    free(chunkReads->ids);
+    free(chunkReads->probs);
+    free(chunkReads);
+}
+
+static void phasedReads_setHaplotype(PhasedReads *phasedReads, int64_t hap, stList *readPartitionLines) {
+    /*
+     * Initialises the reads of a haplotype from the first chunk of a contig.
+     */
+    ChunkReads *chunkReads = phasedReads_getChunkReads(phasedReads, readPartitionLines);
+    for (int64_t i = 0; i < chunkReads->length; i++) {
+        assert(isnan(phasedReads->hapProbs[hap][chunkReads->ids[i]])); // Sanity check that read is not present twice
+        phasedReads->hapProbs[hap][chunkReads->ids[i]] = chunkReads->probs[i];
+    }
+    chunkReads_destruct(chunkReads);
+}
+
+static void phasedReads_addToHapReadsSeen(PhasedReads *phasedReads, int64_t hap, ChunkReads *readsToAdd) {
+    /*
+     * Adds read ids / probs from readsToAdd to the haplotype that are not in the other haplotype.
+     */
+    double *hapProbs = phasedReads->hapProbs[hap], *otherHapProbs = phasedReads->hapProbs[1 - hap];
+    for (int64_t i = 0; i < readsToAdd->length; i++) {
+        int64_t id = readsToAdd->ids[i];
+        double prob = readsToAdd->probs[i];
 
         /*
          * Check if in reads for other haplotype.
@@ -255,12 +362,10 @@ static void addToHapReadsSeen(stHash *hapReads, stHash *otherHapReads, stHash *r
          * remove it from the other haplotype so it can be added to this haplotype,
          * otherwise do not add it to this haplotype.
          */
-        double *pProb;
-        if ((pProb = stHash_search(otherHapReads, readName)) != NULL) {
-            if (*prob > *pProb) {
-                free(stHash_removeAndFreeKey(otherHapReads, readName)); // Remove from otherHapReads
+        if (!isnan(otherHapProbs[id])) {
+            if (prob > otherHapProbs[id]) {
+                otherHapProbs[id] = NAN;
             } else {
-                free(prob);
                 continue;
             }
         }
@@ -268,95 +373,82 @@ static void addToHapReadsSeen(stHash *hapReads, stHash *otherHapReads, stHash *r
         /*
          * Now add the read to this haplotype
          */
-        if ((pProb = stHash_search(hapReads, readName)) == NULL) {
-            stHash_insert(hapReads, stString_copy(readName), prob);
-        } else if (*prob > *pProb) {
-            free(stHash_removeAndFreeKey(hapReads, readName)); // Cleanup the prior entries
-            stHash_insert(hapReads, stString_copy(readName), prob);
-        } else {
-            free(prob);
+        if (isnan(hapProbs[id]) || prob > hapProbs[id]) {
+            hapProbs[id] = prob;
         }
     }
-    stHash_destructIterator(it);
-    stHash_setDestructValues(readsToAdd, NULL);
-    stHash_destruct(readsToAdd);
 }
 
-stHash *getReadNames(stList *readPartitionLines) {
+static int64_t phasedReads_sizeOfIntersection(PhasedReads *phasedReads, int64_t hap, ChunkReads *chunkReads,
+                                              bool nonNegativeValuesOnly) {
     /*
-     * Parse the names of the reads from the lines of output representing the relative read phasing and return as a set
-     * of strings.
+     * Returns the number of reads in chunkReads also in the haplotype, optionally counting only reads with
+     * non-negative values in both.
      */
-    stHash *readNames = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, free, free);
-    for (int64_t i = 1; i < stList_length(readPartitionLines); i++) {
-        char *line = stList_get(readPartitionLines, i);
-        stList *tokens = stString_splitByString(line, ",");
-        assert(stHash_search(readNames, stList_get(tokens, 0)) ==
-               NULL); // Sanity check that read name is not present twice
-        double *prob = st_calloc(1, sizeof(double));
-        *prob = strtof(stList_peek(tokens), NULL); // Get the log prob of the read being in the partition
-        stHash_insert(readNames, stList_removeFirst(tokens), prob); // First field is the read name
-        stList_destruct(tokens);
+    double *hapProbs = phasedReads->hapProbs[hap];
+    int64_t j = 0;
+    for (int64_t i = 0; i < chunkReads->length; i++) {
+        double pLikelihood = hapProbs[chunkReads->ids[i]];
+        if (isnan(pLikelihood) || (nonNegativeValuesOnly && (chunkReads->probs[i] < 0 || pLikelihood < 0))) {
+            continue;
+        }
+        j++;
     }
-    return readNames;
+    return j;
 }
 
-int64_t sizeOfIntersection(stHash *pSet, stHash *nSet) {
+static void phasedReads_convertToLines(PhasedReads *phasedReads, int64_t hap, stList *readPartitionLines) {
     /*
-     * Returns the number of keys in nSet also in pSet.
+     * Format the output of the reads for a haplotype
      */
-    stHashIterator *it = stHash_getIterator(nSet);
-    int64_t i = 0;
-    char *readName;
-    while ((readName = stHash_getNext(it)) != NULL) {
-        if ((stHash_search(pSet, readName)) != NULL) {
-            i++;
+    stList_append(readPartitionLines, stString_print("READ_NAME,LOG_PROB_OF_BEING_IN_PARTITION\n"));
+    for (int64_t id = 0; id < stList_length(phasedReads->readNames); id++) {
+        if (!isnan(phasedReads->hapProbs[hap][id])) {
+            stList_append(readPartitionLines, stString_print("%s,%f\n", stList_get(phasedReads->readNames, id),
+                                                             phasedReads->hapProbs[hap][id]));
         }
     }
-    stHash_destructIterator(it);
-    return i;
 }
 
-int64_t sizeOfIntersectionWithNonNegativeValues(stHash *pSet, stHash *nSet) {
+static void phasedReads_write(PhasedReads *phasedReads, int64_t hap, FILE *fh) {
     /*
-     * Returns the number of keys in nSet also in pSet.
+     * Write out the reads for a haplotype in the given file
      */
-    stHashIterator *it = stHash_getIterator(nSet);
-    int64_t i = 0;
-    char *readName;
-    while ((readName = stHash_getNext(it)) != NULL) {
-        double nLikelihood = *((double*) stHash_search(nSet, readName));
-        if (nLikelihood < 0)
-            continue;
-        if ((stHash_search(pSet, readName)) != NULL) {
-            double pLikelihood = *((double*) stHash_search(pSet, readName));
-            if (pLikelihood < 0)
-                continue;
-            i++;
+    fprintf(fh, "READ_NAME,PHRED_SCORE_OF_BEING_IN_PARTITION\n");
+    for (int64_t id = 0; id < stList_length(phasedReads->readNames); id++) {
+        if (!isnan(phasedReads->hapProbs[hap][id])) {
+            fprintf(fh, "%s,%f\n", (char *) stList_get(phasedReads->readNames, id), phasedReads->hapProbs[hap][id]);
         }
     }
-    stHash_destructIterator(it);
-    return i;
 }
 
-void chunkToStitch_phaseAdjacentChunks(ChunkToStitch *chunk, stHash *readsInHap1, stHash *readsInHap2, Params *params ) {
+static void appendReadNames(stList *readPartitionLines, stList *readNames) {
+    /*
+     * Parse the names of the reads from the lines of output representing the relative read phasing and append them
+     * to readNames.
+     */
+    for (int64_t i = 1; i < stList_length(readPartitionLines); i++) {
+        char *line = stList_get(readPartitionLines, i);
+        char *comma = strchr(line, ',');
+        stList_append(readNames, comma == NULL ? stString_copy(line) : stString_getSubString(line, 0, comma - line));
+    }
+}
+
+static void chunkToStitch_phaseAdjacentChunks(ChunkToStitch *chunk, PhasedReads *phasedReads, Params *params) {
     /*
      * Phases chunk so that hap1 in chunk corresponds to hap1 in the prior chunks (as best as we can tell).
      */
 
-    // Get the names of the reads in the different read sets
-    stHash *chunkHap1Reads = getReadNames(chunk->readsHap1Lines);
-    stHash *chunkHap2Reads = getReadNames(chunk->readsHap2Lines);
+    // Get the ids of the reads in the different read sets
+    ChunkReads *chunkHap1Reads = phasedReads_getChunkReads(phasedReads, chunk->readsHap1Lines);
+    ChunkReads *chunkHap2Reads = phasedReads_getChunkReads(phasedReads, chunk->readsHap2Lines);
 
     // Calculate the intersection between reads shared between the chunks
-    int64_t cisH1 = params->phaseParams->stitchWithPrimaryReadsOnly ?
-            sizeOfIntersectionWithNonNegativeValues(readsInHap1, chunkHap1Reads) : sizeOfIntersection(readsInHap1, chunkHap1Reads);
-    int64_t cisH2 = params->phaseParams->stitchWithPrimaryReadsOnly ?
-            sizeOfIntersectionWithNonNegativeValues(readsInHap2, chunkHap2Reads) : sizeOfIntersection(readsInHap2, chunkHap2Reads);
-    int64_t transH1 = params->phaseParams->stitchWithPrimaryReadsOnly ?
-            sizeOfIntersectionWithNonNegativeValues(readsInHap2, chunkHap1Reads) : sizeOfIntersection(readsInHap2, chunkHap1Reads);
-    int64_t transH2 = params->phaseParams->stitchWithPrimaryReadsOnly ?
-            sizeOfIntersectionWithNonNegativeValues(readsInHap1, chunkHap2Reads) : sizeOfIntersection(readsInHap1, chunkHap2Reads);
+    bool primaryOnly = params->phaseParams->stitchWithPrimaryReadsOnly;
+    int64_t cisH1 = phasedReads_sizeOfIntersection(phasedReads, 0, chunkHap1Reads, primaryOnly);
+    int64_t cisH2 = phasedReads_sizeOfIntersection(phasedReads, 1, chunkHap2Reads, primaryOnly);
+    int64_t transH1 = phasedReads_sizeOfIntersection(phasedReads, 1, chunkHap1Reads, primaryOnly);
+    int64_t transH2 = phasedReads_sizeOfIntersection(phasedReads, 0, chunkHap2Reads, primaryOnly);
 
     // Calculate support for the cis (keeping the current relative phasing) and the trans (switching the phasing) configurations
     int64_t cisPhase = cisH1 + cisH2; // Number of reads consistently phased in cis configuration
@@ -367,7 +459,7 @@ void chunkToStitch_phaseAdjacentChunks(ChunkToStitch *chunk, stHash *readsInHap1
     char *logIdentifier = getLogIdentifier();
     st_logInfo(" %s In stitching chunk %"PRId64" got %"
                PRIi64 " hap1 and %" PRIi64 " hap2 reads\n",
-               logIdentifier, chunk->chunkOrdinal, stHash_size(chunkHap1Reads), stHash_size(chunkHap2Reads));
+               logIdentifier, chunk->chunkOrdinal, chunkHap1Reads->length, chunkHap2Reads->length);
     st_logInfo(
             " %s Support for phasing cis-configuration,   Total: %" PRIi64 " (%f), %" PRIi64 " (%f) in h1 intersection, %" PRIi64 " (%f) in h2 intersection\n",
             logIdentifier, cisPhase, 1.0 * cisPhase / total, cisH1, 1.0 * cisH1 / (cisH1 + transH2), cisH2, 1.0 * cisH2 / (cisH2 + transH2));
@@ -387,10 +479,12 @@ void chunkToStitch_phaseAdjacentChunks(ChunkToStitch *chunk, stHash *readsInHap1
     }
 
     //Remove duplicated reads from output
-    addToHapReadsSeen(readsInHap1, readsInHap2, chunkHap1Reads);
-    addToHapReadsSeen(readsInHap2, readsInHap1, chunkHap2Reads);
+    phasedReads_addToHapReadsSeen(phasedReads, 0, chunkHap1Reads);
+    phasedReads_addToHapReadsSeen(phasedReads, 1, chunkHap2Reads);
 
     // Cleanup
+    chunkReads_destruct(chunkHap1Reads);
+    chunkReads_destruct(chunkHap2Reads);
     free(logIdentifier);
 }
 
@@ -414,6 +508,50 @@ char *getLargeNucleotideSequenceSummary(char *sequence) {
     return tmpSeq;
 }
 
+static bool overlapBasesMatch(char x, char y) {
+    return toupper(x) == toupper(y) && toupper(x) != 'N';
+}
+
+static bool getOverlapCropPointFromExactMatch(char *x, int64_t xLength, char *y, int64_t yLength,
+                                              stList *anchorPairs, int64_t minMatchLength,
+                                              int64_t *xCrop, int64_t *yCrop) {
+    /*
+     * Extends each anchor pair into the maximal exact match along its diagonal and, if the longest such match is at
+     * least minMatchLength long, sets the crop point to its middle. Anchors within an already extended match are
+     * skipped, so this is linear in the overlap length.
+     */
+    int64_t bestLength = 0, bestX = -1, bestY = -1;
+    int64_t lastMatchDiagonal = INT64_MAX, lastMatchEnd = -1;
+    for (int64_t k = 0; k < stList_length(anchorPairs); k++) {
+        stIntTuple *anchorPair = stList_get(anchorPairs, k);
+        int64_t ax = stIntTuple_get(anchorPair, 0), ay = stIntTuple_get(anchorPair, 1);
+        if ((ax - ay == lastMatchDiagonal && ax < lastMatchEnd) || ax >= xLength || ay >= yLength ||
+            !overlapBasesMatch(x[ax], y[ay])) {
+            continue;
+        }
+        int64_t start = 0, end = 1;
+        while (ax - start > 0 && ay - start > 0 && overlapBasesMatch(x[ax - start - 1], y[ay - start - 1])) {
+            start++;
+        }
+        while (ax + end < xLength && ay + end < yLength && overlapBasesMatch(x[ax + end], y[ay + end])) {
+            end++;
+        }
+        lastMatchDiagonal = ax - ay;
+        lastMatchEnd = ax + end;
+        if (start + end > bestLength) {
+            bestLength = start + end;
+            bestX = ax - start;
+            bestY = ay - start;
+        }
+    }
+    if (bestLength < minMatchLength) {
+        return 0;
+    }
+    *xCrop = bestX + bestLength / 2;
+    *yCrop = bestY + bestLength / 2;
+    return 1;
+}
+
 int64_t removeOverlap(char *prefixString, int64_t prefixStringLength, char *suffixString, int64_t suffixStringLength,
                       int64_t approxOverlap, PolishParams *polishParams,
                       int64_t *prefixStringCropEnd, int64_t *suffixStringCropStart) {
@@ -446,15 +584,24 @@ int64_t removeOverlap(char *prefixString, int64_t prefixStringLength, char *suff
     SymbolString sX = symbolString_construct(&(prefixString[i]), 0, strlen(&(prefixString[i])), polishParams->alphabet);
     SymbolString sY = symbolString_construct(suffixString, 0, strlen(suffixString), polishParams->alphabet);
 
-    // Use default state machine for alignment
-    StateMachine *sM = stateMachine3_constructNucleotide(threeState);
-
     // Get quick and dirty anchor pairs
     stList *anchorPairs = getKmerAlignmentAnchors(sX, sY, (uint64_t) polishParams->p->diagonalExpansion);
     stList *alignedPairs = NULL;
-
+    int64_t exactMatchCropX, exactMatchCropY;
+
+    // fast case, the overlap shares a long exact match so crop in its middle without aligning
+    if (polishParams->stitchExactMatchLength > 0 &&
+        getOverlapCropPointFromExactMatch(&(prefixString[i]), prefixStringLength - i, suffixString, j, anchorPairs,
+                                          (int64_t) polishParams->stitchExactMatchLength,
+                                          &exactMatchCropX, &exactMatchCropY)) {
+        st_logInfo(" %s Found an exact match of at least %"PRIu64" while removing overlap for sequences of "
+                   "length p:%"PRId64", s:%"PRId64", not aligning\n", logIdentifier,
+                   polishParams->stitchExactMatchLength, sX.length, sY.length);
+        alignedPairs = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
+        stList_append(alignedPairs, stIntTuple_construct3(PAIR_ALIGNMENT_PROB_1, exactMatchCropX, exactMatchCropY));
+    }
     // failure case for anchoring, 0 or 1 anchors
-    if (stList_length(anchorPairs) < MIN_OVERLAP_ANCHOR_PAIRS) {
+    else if (stList_length(anchorPairs) < MIN_OVERLAP_ANCHOR_PAIRS) {
         st_logInfo(" %s Anchoring for overlap alignment (lengths p:%"PRId64", s:%"PRId64") failed for having %"PRId64" "
                    "(< %"PRId64") entries\n", logIdentifier, sX.length, sY.length, stList_length(anchorPairs),
                    MIN_OVERLAP_ANCHOR_PAIRS);
@@ -464,8 +611,9 @@ int64_t removeOverlap(char *prefixString, int64_t prefixStringLength, char *suff
         // TODO here we could save an align point in the middle of the overlap?
         //  would need to be careful about .5 overlap boundary being unaligned given run length changes
     } else {
-        // Anchoring worked: run the alignment
-        alignedPairs = getAlignedPairsUsingAnchors(sM, sX, sY, anchorPairs, polishParams->p, 1, 1);
+        // Anchoring worked: run the alignment, using default state machine
+        alignedPairs = getAlignedPairsUsingAnchors(polishParams->stateMachineForConsensusAlignment, sX, sY,
+                                                   anchorPairs, polishParams->p, 1, 1);
         st_logInfo(" %s Got %"PRId64" anchor pairs and %"PRId64" aligned pairs while removing overlap for sequences of "
                                                                                  "length p:%"PRId64", s:%"PRId64"\n",
                    logIdentifier, stList_length(anchorPairs), stList_length(alignedPairs), sX.length, sY.length);
@@ -474,7 +622,6 @@ int64_t removeOverlap(char *prefixString, int64_t prefixStringLength, char *suff
     // Cleanup
     symbolString_destruct(sX);
     symbolString_destruct(sY);
-    stateMachine_destruct(sM);
     stList_destruct(anchorPairs);
 
     // Remove the suffix crop
@@ -691,6 +838,121 @@ void chunkToStitch_trimAdjacentChunks(ChunkToStitch *pChunk, ChunkToStitch *chun
  * OutputChunker
  */
 
+typedef struct _chunkJournal ChunkJournal;
+
+/*
+ * BGZF compressed fasta output
+ *
+ * Writes a fasta file BGZF compressed, in lines of BGZF_FASTA_LINE_LENGTH bases, and indexes it as it is written,
+ * with the .gzi index of its BGZF blocks and the .fai index of its sequences, so it is ready to be queried (as by
+ * samtools faidx) once closed. The blocks are compressed by the shared htslib thread pool (see getHtsThreadPool),
+ * or else by threads of the writer's own, while the sequences continue to be written.
+ */
+
+#define BGZF_FASTA_LINE_LENGTH 60
+
+typedef struct _bgzfFastaWriter {
+    char *file;
+    BGZF *fp;
+    FILE *faiFh;
+    int64_t bytesWritten; // Uncompressed bytes written, the offsets of the .fai index
+    // The sequence being written
+    char *seqName;
+    int64_t seqLength;
+    int64_t seqOffset;
+    int64_t lineBases; // Bases written to the current line
+} BgzfFastaWriter;
+
+static void bgzfFastaWriter_write(BgzfFastaWriter *writer, const char *bytes, int64_t length) {
+    if (bgzf_write(writer->fp, bytes, length) != length) {
+        st_errAbort("Error writing compressed fasta %s\n", writer->file);
+    }
+    writer->bytesWritten += length;
+}
+
+static BgzfFastaWriter *bgzfFastaWriter_construct(char *file, Params *params) {
+    BgzfFastaWriter *writer = st_calloc(1, sizeof(BgzfFastaWriter));
+    writer->file = stString_copy(file);
+    if ((writer->fp = bgzf_open(file, "w")) == NULL) {
+        st_errAbort("Could not open compressed fasta %s for writing\n", file);
+    }
+    htsThreadPool *threadPool = getHtsThreadPool(params->polishParams);
+    if (threadPool != NULL) {
+        bgzf_thread_pool(writer->fp, threadPool->pool, threadPool->qsize);
+    }
+#ifdef _OPENMP
+    else if (omp_get_max_threads() > 1) {
+        bgzf_mt(writer->fp, omp_get_max_threads(), 256);
+    }
+#endif
+    if (bgzf_index_build_init(writer->fp) != 0) {
+        st_errAbort("Could not start the .gzi index of compressed fasta %s\n", file);
+    }
+    char *faiFile = stString_print("%s.fai", file);
+    writer->faiFh = safe_fopen(faiFile, "w");
+    free(faiFile);
+    return writer;
+}
+
+static void bgzfFastaWriter_finishSequence(BgzfFastaWriter *writer) {
+    if (writer->seqName == NULL) {
+        return;
+    }
+    if (writer->lineBases > 0) {
+        bgzfFastaWriter_write(writer, "\n", 1);
+        writer->lineBases = 0;
+    }
+    fprintf(writer->faiFh, "%s\t%"PRId64"\t%"PRId64"\t%d\t%d\n", writer->seqName, writer->seqLength,
+            writer->seqOffset, BGZF_FASTA_LINE_LENGTH, BGZF_FASTA_LINE_LENGTH + 1);
+    free(writer->seqName);
+    writer->seqName = NULL;
+}
+
+static void bgzfFastaWriter_startSequence(BgzfFastaWriter *writer, char *seqName) {
+    bgzfFastaWriter_finishSequence(writer);
+    bgzfFastaWriter_write(writer, ">", 1);
+    bgzfFastaWriter_write(writer, seqName, strlen(seqName));
+    bgzfFastaWriter_write(writer, "\n", 1);
+    writer->seqName = stString_copy(seqName);
+    writer->seqLength = 0;
+    writer->seqOffset = writer->bytesWritten;
+}
+
+static void bgzfFastaWriter_appendSequence(BgzfFastaWriter *writer, char *seq) {
+    /*
+     * Appends the bases to the sequence being written, continuing its current line.
+     */
+    int64_t length = strlen(seq);
+    for (int64_t i = 0; i < length;) {
+        int64_t lineBases = BGZF_FASTA_LINE_LENGTH - writer->lineBases;
+        lineBases = lineBases < length - i ? lineBases : length - i;
+        bgzfFastaWriter_write(writer, &(seq[i]), lineBases);
+        writer->lineBases += lineBases;
+        i += lineBases;
+        if (writer->lineBases == BGZF_FASTA_LINE_LENGTH) {
+            bgzfFastaWriter_write(writer, "\n", 1);
+            writer->lineBases = 0;
+        }
+    }
+    writer->seqLength += length;
+}
+
+static void bgzfFastaWriter_destruct(BgzfFastaWriter *writer) {
+    /*
+     * Finishes the last sequence, then writes the indexes and closes the file.
+     */
+    bgzfFastaWriter_finishSequence(writer);
+    if (bgzf_flush(writer->fp) != 0 || bgzf_index_dump(writer->fp, writer->file, ".gzi") != 0) {
+        st_errAbort("Could not write the .gzi index of compressed fasta %s\n", writer->file);
+    }
+    if (bgzf_close(writer->fp) != 0) {
+        st_errAbort("Error closing compressed fasta %s\n", writer->file);
+    }
+    fclose(writer->faiFh);
+    free(writer->file);
+    free(writer);
+}
+
 typedef struct _outputChunker {
     /*
      * Object for managing the output of a polished sequence.
@@ -701,6 +963,7 @@ typedef struct _outputChunker {
     char *outputSequenceFile; // This is either the name of the file or the location in memory of the file buffer
     FILE *outputSequenceFileHandle;
     size_t outputSequenceFileBufferSize; // Used if in memory
+    BgzfFastaWriter *outputSequenceBgzfWriter; // If set, the sequence is written through it rather than the handle
     // Poa file
     bool outputPoa;
     char *outputPoaFile;
@@ -717,10 +980,739 @@ typedef struct _outputChunker {
     char *outputReadPartitionFile;
     FILE *outputReadPartitionFileHandle;
     size_t outputRepeatPartitionFileBufferSize;
+    // Binary chunk record file - if used, the four outputs above are held in a single length-prefixed
+    // record per chunk rather than written to their own text streams (only used for temporary output)
+    bool useChunkRecords;
+    bool compressChunkRecords;
+    char *outputChunkRecordFile;
+    FILE *outputChunkRecordFileHandle;
+    size_t outputChunkRecordFileBufferSize;
+    // Spilling - if using memory buffers and maxMemoryBufferBytes > 0, the buffers are moved to temporary files
+    // named after spillFileBase once they exceed maxMemoryBufferBytes, and output continues on disk
+    uint64_t maxMemoryBufferBytes;
+    char *spillFileBase;
+    // Chunk journal - if set, each chunk record is also appended to this durable journal, shared between chunkers
+    ChunkJournal *chunkJournal;
 
     Params *params;
 } OutputChunker;
 
+/*
+ * Chunk journal
+ *
+ * An append-only file holding each finished chunk's record, so a run that is interrupted can be resumed
+ * without recomputing these chunks. It starts with a header:
+ * MAGIC (uint32), FINGERPRINT (uint64), CHUNK_COUNT (int64)
+ * followed by entries:
+ * TYPE (uint8), CHUNK_ORDINAL (int64), LENGTH (uint64), BYTES
+ * where the bytes of a CHUNK_JOURNAL_RECORD entry are a whole chunk record, as written to the temporary output,
+ * and those of a CHUNK_JOURNAL_DATA entry are any other per chunk data the caller needs to restore. A chunk is
+ * journaled once its record entry is complete, so the data entry of a chunk must be appended before its record.
+ * The bytes of a CHUNK_JOURNAL_INPUT entry are the chunk's input key (see chunkJournal_getInputKey), identifying
+ * the parameters and inputs the chunk was made from, so that a later run can reuse the chunk if they are unchanged.
+ * Each entry is synced to disk as it is appended, and an entry cut short by the interruption is discarded.
+ * Journals, like the chunk cache and chunk records, are written in the native byte order, so may be moved between
+ * hosts of the same byte order. One written on a host of the other byte order is recognised by its byte swapped
+ * magic, and rejected.
+ */
+
+#define CHUNK_JOURNAL_MAGIC 0x4c4e4a4d
+#define CHUNK_JOURNAL_RECORD 0
+#define CHUNK_JOURNAL_DATA 1
+#define CHUNK_JOURNAL_INPUT 2
+
+struct _chunkJournal {
+    char *journalFile;
+    FILE *fh;
+    int64_t chunkCount;
+    int64_t journaledChunkNo;
+    // the offset and length of the bytes of each chunk's entries, an offset of -1 if there is none
+    off_t *recordOffsets;
+    uint64_t *recordLengths;
+    off_t *dataOffsets;
+    uint64_t *dataLengths;
+    off_t *inputOffsets;
+    uint64_t *inputLengths;
+    char *cacheDirectory; // of the chunk cache the chunks are also added to, or NULL
+};
+
+uint64_t chunkJournal_fingerprintString(uint64_t fingerprint, const char *string) {
+    // FNV-1a, including the terminating NUL so that consecutive strings are delimited
+    if (string == NULL) {
+        string = "";
+    }
+    do {
+        fingerprint = (fingerprint ^ (uint8_t) *string) * 1099511628211ULL;
+    } while (*string++ != '\0');
+    return fingerprint;
+}
+
+uint64_t chunkJournal_fingerprintFile(uint64_t fingerprint, const char *file) {
+    // by contents alone, so that a copy (or a move) of a file has the same fingerprint, and an absent file another
+    fingerprint = chunkJournal_fingerprintString(fingerprint, file == NULL ? "absent" : "present");
+    if (file == NULL) {
+        return fingerprint;
+    }
+    FILE *fh = safe_fopen((char *) file, "rb");
+    char buffer[4096];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), fh)) > 0) {
+        for (size_t i = 0; i < length; i++) {
+            fingerprint = (fingerprint ^ (uint8_t) buffer[i]) * 1099511628211ULL;
+        }
+    }
+    fclose(fh);
+    return fingerprint;
+}
+
+static void chunkJournal_sync(ChunkJournal *chunkJournal) {
+    if (fflush(chunkJournal->fh) != 0 || fsync(fileno(chunkJournal->fh)) != 0) {
+        st_errAbort("Failed to sync the chunk journal %s\n", chunkJournal->journalFile);
+    }
+}
+
+static ChunkJournal *chunkJournal_constructEmpty(char *journalFile, int64_t chunkCount) {
+    ChunkJournal *chunkJournal = st_calloc(1, sizeof(ChunkJournal));
+    chunkJournal->journalFile = stString_copy(journalFile);
+    chunkJournal->chunkCount = chunkCount;
+    chunkJournal->recordOffsets = st_calloc(chunkCount, sizeof(off_t));
+    chunkJournal->recordLengths = st_calloc(chunkCount, sizeof(uint64_t));
+    chunkJournal->dataOffsets = st_calloc(chunkCount, sizeof(off_t));
+    chunkJournal->dataLengths = st_calloc(chunkCount, sizeof(uint64_t));
+    chunkJournal->inputOffsets = st_calloc(chunkCount, sizeof(off_t));
+    chunkJournal->inputLengths = st_calloc(chunkCount, sizeof(uint64_t));
+    for (int64_t i = 0; i < chunkCount; i++) {
+        chunkJournal->recordOffsets[i] = -1;
+        chunkJournal->dataOffsets[i] = -1;
+        chunkJournal->inputOffsets[i] = -1;
+    }
+    return chunkJournal;
+}
+
+static bool isByteSwappedMagic(uint32_t magic, uint32_t expectedMagic) {
+    /*
+     * Returns true if the magic is the expected one as written on a host of the other byte order.
+     */
+    return magic != expectedMagic && magic == __builtin_bswap32(expectedMagic);
+}
+
+static void chunkJournal_checkByteOrder(uint32_t magic, char *journalFile) {
+    if (isByteSwappedMagic(magic, CHUNK_JOURNAL_MAGIC)) {
+        st_errAbort("The chunk journal %s was written on a host of the other byte order, and can not be read here\n",
+                    journalFile);
+    }
+}
+
+static bool chunkJournal_readHeader(FILE *fh, char *journalFile, uint64_t fingerprint, int64_t chunkCount) {
+    /*
+     * Returns true if the journal starts with a header for the given fingerprint and chunk count, aborting if it is of
+     * the other byte order.
+     */
+    uint32_t magic;
+    uint64_t journalFingerprint;
+    int64_t journalChunkCount;
+    if (fread(&magic, sizeof(uint32_t), 1, fh) != 1) {
+        return FALSE;
+    }
+    chunkJournal_checkByteOrder(magic, journalFile);
+    return fread(&journalFingerprint, sizeof(uint64_t), 1, fh) == 1 &&
+           fread(&journalChunkCount, sizeof(int64_t), 1, fh) == 1 && magic == CHUNK_JOURNAL_MAGIC &&
+           journalFingerprint == fingerprint && journalChunkCount == chunkCount;
+}
+
+static void chunkJournal_indexEntry(ChunkJournal *chunkJournal, uint8_t type, int64_t chunkOrdinal, off_t offset,
+                                    uint64_t length) {
+    if (type == CHUNK_JOURNAL_RECORD) {
+        if (chunkJournal->recordOffsets[chunkOrdinal] == -1) {
+            chunkJournal->journaledChunkNo++;
+        }
+        chunkJournal->recordOffsets[chunkOrdinal] = offset;
+        chunkJournal->recordLengths[chunkOrdinal] = length;
+    } else if (type == CHUNK_JOURNAL_INPUT) {
+        // a chunk's input key is journaled before its data and record, so one journaled after them supersedes the
+        // chunk, as when its inputs have changed since
+        if (chunkJournal->recordOffsets[chunkOrdinal] != -1) {
+            chunkJournal->journaledChunkNo--;
+        }
+        chunkJournal->recordOffsets[chunkOrdinal] = -1;
+        chunkJournal->dataOffsets[chunkOrdinal] = -1;
+        chunkJournal->inputOffsets[chunkOrdinal] = offset;
+        chunkJournal->inputLengths[chunkOrdinal] = length;
+    } else {
+        chunkJournal->dataOffsets[chunkOrdinal] = offset;
+        chunkJournal->dataLengths[chunkOrdinal] = length;
+    }
+}
+
+static off_t chunkJournal_readEntries(ChunkJournal *chunkJournal, off_t fileSize) {
+    /*
+     * Indexes the entries following the header, returning the offset at which the last complete entry ends.
+     */
+    FILE *fh = chunkJournal->fh;
+    off_t entriesEnd = ftello(fh);
+    while (1) {
+        uint8_t type;
+        int64_t chunkOrdinal;
+        uint64_t length;
+        if (fread(&type, sizeof(uint8_t), 1, fh) != 1 || fread(&chunkOrdinal, sizeof(int64_t), 1, fh) != 1 ||
+            fread(&length, sizeof(uint64_t), 1, fh) != 1) {
+            break;
+        }
+        off_t offset = ftello(fh);
+        if (length > (uint64_t) (fileSize - offset) || chunkOrdinal < 0 || chunkOrdinal >= chunkJournal->chunkCount ||
+            (type != CHUNK_JOURNAL_RECORD && type != CHUNK_JOURNAL_DATA && type != CHUNK_JOURNAL_INPUT) ||
+            fseeko(fh, (off_t) length, SEEK_CUR) != 0) {
+            break;
+        }
+        chunkJournal_indexEntry(chunkJournal, type, chunkOrdinal, offset, length);
+        entriesEnd = offset + (off_t) length;
+    }
+    return entriesEnd;
+}
+
+static off_t chunkJournal_fileSize(ChunkJournal *chunkJournal) {
+    struct stat fileStat;
+    if (fstat(fileno(chunkJournal->fh), &fileStat) != 0) {
+        st_errAbort("Could not stat the chunk journal %s\n", chunkJournal->journalFile);
+    }
+    return fileStat.st_size;
+}
+
+static ChunkJournal *chunkJournal_construct(char *journalFile, uint64_t fingerprint, int64_t chunkCount) {
+    /*
+     * Opens the journal, loading the chunks already in it if it was made for the same fingerprint and chunk count,
+     * and otherwise starting a new one.
+     */
+    ChunkJournal *chunkJournal = chunkJournal_constructEmpty(journalFile, chunkCount);
+
+    FILE *fh = fopen(journalFile, "r+b");
+    if (fh != NULL && !chunkJournal_readHeader(fh, journalFile, fingerprint, chunkCount)) {
+        st_logCritical("> Chunk journal %s is for different inputs or parameters, starting a new one\n",
+                       journalFile);
+        fclose(fh);
+        fh = NULL;
+    }
+    if (fh != NULL) {
+        chunkJournal->fh = fh;
+        off_t fileSize = chunkJournal_fileSize(chunkJournal);
+        off_t entriesEnd = chunkJournal_readEntries(chunkJournal, fileSize);
+        if (entriesEnd < fileSize) {
+            st_logCritical("> Discarding %" PRIi64 " bytes of an incomplete entry at the end of chunk journal %s\n",
+                           (int64_t) (fileSize - entriesEnd), journalFile);
+            if (fflush(fh) != 0 || ftruncate(fileno(fh), entriesEnd) != 0) {
+                st_errAbort("Failed to truncate the chunk journal %s\n", journalFile);
+            }
+        }
+        st_logCritical("> Resuming from chunk journal %s with %" PRIi64 " of %" PRIi64 " chunks done\n",
+                       journalFile, chunkJournal->journaledChunkNo, chunkCount);
+    } else {
+        chunkJournal->fh = safe_fopen(journalFile, "w+b");
+        uint32_t magic = CHUNK_JOURNAL_MAGIC;
+        if (fwrite(&magic, sizeof(uint32_t), 1, chunkJournal->fh) != 1 ||
+            fwrite(&fingerprint, sizeof(uint64_t), 1, chunkJournal->fh) != 1 ||
+            fwrite(&chunkCount, sizeof(int64_t), 1, chunkJournal->fh) != 1) {
+            st_errAbort("Failed to write the chunk journal %s\n", journalFile);
+        }
+        chunkJournal_sync(chunkJournal);
+        st_logCritical("> Journaling finished chunks to %s\n", journalFile);
+    }
+    return chunkJournal;
+}
+
+static void chunkJournal_destruct(ChunkJournal *chunkJournal) {
+    fclose(chunkJournal->fh);
+    free(chunkJournal->journalFile);
+    free(chunkJournal->recordOffsets);
+    free(chunkJournal->recordLengths);
+    free(chunkJournal->dataOffsets);
+    free(chunkJournal->dataLengths);
+    free(chunkJournal->inputOffsets);
+    free(chunkJournal->inputLengths);
+    free(chunkJournal->cacheDirectory);
+    free(chunkJournal);
+}
+
+static void chunkJournal_append(ChunkJournal *chunkJournal, uint8_t type, int64_t chunkOrdinal, const char *bytes1,
+                                uint64_t length1, const char *bytes2, uint64_t length2) {
+    /*
+     * Appends an entry whose bytes are bytes1 followed by bytes2, and syncs it to disk.
+     */
+    uint64_t length = length1 + length2;
+    # ifdef _OPENMP
+    #pragma omp critical (chunkJournal)
+    # endif
+    {
+        if (fseeko(chunkJournal->fh, 0, SEEK_END) != 0 || fwrite(&type, sizeof(uint8_t), 1, chunkJournal->fh) != 1 ||
+            fwrite(&chunkOrdinal, sizeof(int64_t), 1, chunkJournal->fh) != 1 ||
+            fwrite(&length, sizeof(uint64_t), 1, chunkJournal->fh) != 1) {
+            st_errAbort("Failed to write chunk %" PRIi64 " to the chunk journal %s\n", chunkOrdinal,
+                        chunkJournal->journalFile);
+        }
+        off_t offset = ftello(chunkJournal->fh);
+        if (fwrite(bytes1, 1, length1, chunkJournal->fh) != length1 ||
+            fwrite(bytes2, 1, length2, chunkJournal->fh) != length2) {
+            st_errAbort("Failed to write chunk %" PRIi64 " to the chunk journal %s\n", chunkOrdinal,
+                        chunkJournal->journalFile);
+        }
+        chunkJournal_sync(chunkJournal);
+        chunkJournal_indexEntry(chunkJournal, type, chunkOrdinal, offset, length);
+    }
+}
+
+static char *chunkJournal_readBytes(ChunkJournal *chunkJournal, off_t offset, uint64_t length) {
+    char *bytes = st_malloc(length + 1);
+    if (fseeko(chunkJournal->fh, offset, SEEK_SET) != 0 || fread(bytes, 1, length, chunkJournal->fh) != length) {
+        st_errAbort("Failed to read from the chunk journal %s\n", chunkJournal->journalFile);
+    }
+    bytes[length] = '\0';
+    return bytes;
+}
+
+static ChunkJournal *chunkJournal_constructFromPrevious(char *journalFile) {
+    /*
+     * Opens the journal of another run to read the chunks in it, whatever the fingerprint and chunk count it was
+     * made for.
+     */
+    FILE *fh = fopen(journalFile, "rb");
+    if (fh == NULL) {
+        st_errAbort("Could not open the previous chunk journal %s\n", journalFile);
+    }
+    uint32_t magic;
+    uint64_t fingerprint;
+    int64_t chunkCount;
+    bool hasMagic = fread(&magic, sizeof(uint32_t), 1, fh) == 1;
+    if (hasMagic) {
+        chunkJournal_checkByteOrder(magic, journalFile);
+    }
+    if (!hasMagic || fread(&fingerprint, sizeof(uint64_t), 1, fh) != 1 ||
+        fread(&chunkCount, sizeof(int64_t), 1, fh) != 1 || magic != CHUNK_JOURNAL_MAGIC || chunkCount < 0) {
+        st_errAbort("%s is not a chunk journal\n", journalFile);
+    }
+    ChunkJournal *chunkJournal = chunkJournal_constructEmpty(journalFile, chunkCount);
+    chunkJournal->fh = fh;
+    off_t fileSize = chunkJournal_fileSize(chunkJournal);
+    if (chunkJournal_readEntries(chunkJournal, fileSize) < fileSize) {
+        st_logCritical("> Ignoring an incomplete entry at the end of previous chunk journal %s\n", journalFile);
+    }
+    return chunkJournal;
+}
+
+int64_t chunkJournal_merge(char *journalFile, stList *shardJournalFiles, uint64_t fingerprint, int64_t chunkCount) {
+    /*
+     * Copies the chunks of the shard journals that are not yet in the journal into it.
+     */
+    ChunkJournal *chunkJournal = chunkJournal_construct(journalFile, fingerprint, chunkCount);
+    for (int64_t i = 0; i < stList_length(shardJournalFiles); i++) {
+        char *shardJournalFile = stList_get(shardJournalFiles, i);
+        ChunkJournal *shardJournal = chunkJournal_constructEmpty(shardJournalFile, chunkCount);
+        shardJournal->fh = fopen(shardJournalFile, "rb");
+        if (shardJournal->fh == NULL) {
+            st_errAbort("Could not open the shard chunk journal %s\n", shardJournalFile);
+        }
+        if (!chunkJournal_readHeader(shardJournal->fh, shardJournalFile, fingerprint, chunkCount)) {
+            st_errAbort("Shard chunk journal %s is for different inputs or parameters\n", shardJournalFile);
+        }
+        off_t fileSize = chunkJournal_fileSize(shardJournal);
+        if (chunkJournal_readEntries(shardJournal, fileSize) < fileSize) {
+            st_logCritical("> Ignoring an incomplete entry at the end of shard chunk journal %s\n", shardJournalFile);
+        }
+        int64_t mergedChunkNo = 0;
+        for (int64_t j = 0; j < chunkCount; j++) {
+            if (shardJournal->recordOffsets[j] == -1 || chunkJournal->recordOffsets[j] != -1) {
+                continue;
+            }
+            // the input and data go first, as a chunk is only taken to be journaled once its record is
+            if (shardJournal->inputOffsets[j] != -1) {
+                char *input = chunkJournal_readBytes(shardJournal, shardJournal->inputOffsets[j],
+                                                     shardJournal->inputLengths[j]);
+                chunkJournal_append(chunkJournal, CHUNK_JOURNAL_INPUT, j, input, shardJournal->inputLengths[j], NULL,
+                                    0);
+                free(input);
+            }
+            if (shardJournal->dataOffsets[j] != -1) {
+                char *data = chunkJournal_readBytes(shardJournal, shardJournal->dataOffsets[j],
+                                                    shardJournal->dataLengths[j]);
+                chunkJournal_append(chunkJournal, CHUNK_JOURNAL_DATA, j, data, shardJournal->dataLengths[j], NULL, 0);
+                free(data);
+            }
+            char *record = chunkJournal_readBytes(shardJournal, shardJournal->recordOffsets[j],
+                                                  shardJournal->recordLengths[j]);
+            chunkJournal_append(chunkJournal, CHUNK_JOURNAL_RECORD, j, record, shardJournal->recordLengths[j], NULL, 0);
+            free(record);
+            mergedChunkNo++;
+        }
+        st_logCritical("> Merged %" PRIi64 " chunks from shard chunk journal %s\n", mergedChunkNo, shardJournalFile);
+        chunkJournal_destruct(shardJournal);
+    }
+    int64_t journaledChunkNo = chunkJournal->journaledChunkNo;
+    chunkJournal_destruct(chunkJournal);
+    return journaledChunkNo;
+}
+
+/*
+ * Chunk cache
+ *
+ * A directory of chunks shared by runs, each in a file named by the hash of the chunk's input key, laid out as:
+ * MAGIC (uint32), then the length-prefixed (uint64) input key, data and record of the chunk
+ * where the data and record are those of its journal entries, a length of CHUNK_CACHE_ABSENT marking a chunk without
+ * data. The input key is stored in full, so that a hash collision is a miss. Files are written under a temporary name
+ * then renamed, so runs sharing the cache only see whole files, and a file that can not be read, or that was written
+ * on a host of the other byte order, is a miss.
+ */
+
+#define CHUNK_CACHE_MAGIC 0x4843434d
+#define CHUNK_CACHE_ABSENT UINT64_MAX
+
+static bool chunkCache_checkByteOrder(uint32_t magic, char *inputKey) {
+    /*
+     * Returns true if the magic is that of a cache file, a file written on a host of the other byte order being a miss.
+     */
+    if (isByteSwappedMagic(magic, CHUNK_CACHE_MAGIC)) {
+        st_logInfo("> Not using the cached chunk of input key %016" PRIx64 ", written on a host of the other byte "
+                   "order\n", chunkJournal_fingerprintString(CHUNK_JOURNAL_FINGERPRINT_SEED, inputKey));
+        return FALSE;
+    }
+    return magic == CHUNK_CACHE_MAGIC;
+}
+
+static char *chunkCache_getFile(char *cacheDirectory, char *inputKey) {
+    return stString_print("%s/%016" PRIx64 ".chunk", cacheDirectory,
+                          chunkJournal_fingerprintString(CHUNK_JOURNAL_FINGERPRINT_SEED, inputKey));
+}
+
+static bool chunkCache_writeBytes(FILE *fh, const char *bytes1, uint64_t length1, const char *bytes2,
+                                  uint64_t length2) {
+    // the bytes of a field are bytes1 followed by bytes2, or absent if bytes1 is NULL
+    uint64_t length = bytes1 == NULL ? CHUNK_CACHE_ABSENT : length1 + length2;
+    if (fwrite(&length, sizeof(uint64_t), 1, fh) != 1) {
+        return FALSE;
+    }
+    return bytes1 == NULL || (fwrite(bytes1, 1, length1, fh) == length1 && fwrite(bytes2, 1, length2, fh) == length2);
+}
+
+static bool chunkCache_readBytes(FILE *fh, off_t fileSize, char **bytes, uint64_t *length) {
+    /*
+     * Reads a field into bytes (NUL terminated, to be freed by the caller), or NULL if it is absent. Returns FALSE if
+     * the file ends first.
+     */
+    *bytes = NULL;
+    if (fread(length, sizeof(uint64_t), 1, fh) != 1) {
+        return FALSE;
+    }
+    if (*length == CHUNK_CACHE_ABSENT) {
+        return TRUE;
+    }
+    if (*length > (uint64_t) (fileSize - ftello(fh))) {
+        return FALSE;
+    }
+    *bytes = st_malloc(*length + 1);
+    if (fread(*bytes, 1, *length, fh) != *length) {
+        free(*bytes);
+        *bytes = NULL;
+        return FALSE;
+    }
+    (*bytes)[*length] = '\0';
+    return TRUE;
+}
+
+static void chunkJournal_cacheChunk(ChunkJournal *chunkJournal, int64_t chunkOrdinal, const char *record1,
+                                    uint64_t recordLength1, const char *record2, uint64_t recordLength2) {
+    /*
+     * Adds the journaled chunk, whose record is record1 followed by record2, to the chunk cache, if there is one and
+     * the chunk's input key is journaled. A chunk that can not be cached is only logged, as it is still journaled.
+     */
+    if (chunkJournal->cacheDirectory == NULL) {
+        return;
+    }
+    char *inputKey = NULL, *data = NULL;
+    uint64_t dataLength = 0;
+    # ifdef _OPENMP
+    #pragma omp critical (chunkJournal)
+    # endif
+    {
+        if (chunkJournal->inputOffsets[chunkOrdinal] != -1) {
+            inputKey = chunkJournal_readBytes(chunkJournal, chunkJournal->inputOffsets[chunkOrdinal],
+                                              chunkJournal->inputLengths[chunkOrdinal]);
+            if (chunkJournal->dataOffsets[chunkOrdinal] != -1) {
+                dataLength = chunkJournal->dataLengths[chunkOrdinal];
+                data = chunkJournal_readBytes(chunkJournal, chunkJournal->dataOffsets[chunkOrdinal], dataLength);
+            }
+        }
+    }
+    if (inputKey == NULL) {
+        return;
+    }
+
+    char *cacheFile = chunkCache_getFile(chunkJournal->cacheDirectory, inputKey);
+    char *tempFile = stString_print("%s.%" PRIi64 ".%" PRIi64 ".tmp", cacheFile, (int64_t) getpid(), chunkOrdinal);
+    FILE *fh = fopen(tempFile, "wb");
+    uint32_t magic = CHUNK_CACHE_MAGIC;
+    bool written = fh != NULL && fwrite(&magic, sizeof(uint32_t), 1, fh) == 1 &&
+                   chunkCache_writeBytes(fh, inputKey, strlen(inputKey), NULL, 0) &&
+                   chunkCache_writeBytes(fh, data, dataLength, NULL, 0) &&
+                   chunkCache_writeBytes(fh, record1, recordLength1, record2, recordLength2);
+    if (fh != NULL && fclose(fh) != 0) {
+        written = FALSE;
+    }
+    if (!written || rename(tempFile, cacheFile) != 0) {
+        st_logCritical("> Failed to add chunk %" PRIi64 " to the chunk cache %s\n", chunkOrdinal,
+                       chunkJournal->cacheDirectory);
+        remove(tempFile);
+    }
+    free(tempFile);
+    free(cacheFile);
+    free(inputKey);
+    free(data);
+}
+
+static bool chunkJournal_readCachedChunk(ChunkJournal *chunkJournal, char *inputKey, char **data,
+                                         uint64_t *dataLength, char **record, uint64_t *recordLength) {
+    /*
+     * Reads the data (NULL if there is none) and record of the cached chunk with the given input key, returning FALSE
+     * if it is not in the cache.
+     */
+    *data = NULL;
+    *record = NULL;
+    char *cacheFile = chunkCache_getFile(chunkJournal->cacheDirectory, inputKey);
+    FILE *fh = fopen(cacheFile, "rb");
+    free(cacheFile);
+    if (fh == NULL) {
+        return FALSE;
+    }
+    struct stat fileStat;
+    uint32_t magic;
+    char *cachedInputKey = NULL;
+    uint64_t cachedInputKeyLength;
+    bool found = fstat(fileno(fh), &fileStat) == 0 && fread(&magic, sizeof(uint32_t), 1, fh) == 1 &&
+                 chunkCache_checkByteOrder(magic, inputKey) &&
+                 chunkCache_readBytes(fh, fileStat.st_size, &cachedInputKey, &cachedInputKeyLength) &&
+                 cachedInputKey != NULL && stString_eq(cachedInputKey, inputKey) &&
+                 chunkCache_readBytes(fh, fileStat.st_size, data, dataLength) &&
+                 chunkCache_readBytes(fh, fileStat.st_size, record, recordLength) && *record != NULL;
+    fclose(fh);
+    free(cachedInputKey);
+    if (!found) {
+        free(*data);
+        free(*record);
+        *data = NULL;
+        *record = NULL;
+    }
+    return found;
+}
+
+/*
+ * Binary chunk records
+ *
+ * Each record is laid out as:
+ * MAGIC (uint32), CHUNK_ORDINAL (int64), COMPRESSED (uint8), PAYLOAD_LENGTH (uint64), PAYLOAD
+ * where the payload, optionally compressed, is the length-prefixed sequence name followed by each
+ * length-prefixed field, a length of CHUNK_RECORD_ABSENT_FIELD marking a field that was not output. Records are
+ * in the native byte order, and are read back from the temporary output by the process that wrote them, or from
+ * journals and the chunk cache, which reject those of the other byte order.
+ */
+
+#define CHUNK_RECORD_MAGIC 0x4b48434d
+#define CHUNK_RECORD_ABSENT_FIELD UINT64_MAX
+#define CHUNK_RECORD_HEADER_LENGTH (sizeof(uint32_t) + sizeof(int64_t) + sizeof(uint8_t) + sizeof(uint64_t))
+
+enum ChunkRecordField {
+    CHUNK_RECORD_SEQ_HAP1,
+    CHUNK_RECORD_SEQ_HAP2,
+    CHUNK_RECORD_POA_HAP1,
+    CHUNK_RECORD_POA_HAP2,
+    CHUNK_RECORD_REPEAT_COUNTS_HAP1,
+    CHUNK_RECORD_REPEAT_COUNTS_HAP2,
+    CHUNK_RECORD_READS_HAP1,
+    CHUNK_RECORD_READS_HAP2,
+    CHUNK_RECORD_FIELDS
+};
+
+typedef struct _chunkRecord {
+    char *fields[CHUNK_RECORD_FIELDS]; // NULL if the field is absent
+    size_t fieldLengths[CHUNK_RECORD_FIELDS];
+} ChunkRecord;
+
+static FILE *chunkRecord_openField(ChunkRecord *record, enum ChunkRecordField field) {
+    /*
+     * Returns a stream writing to the given field, which is filled in when the stream is closed.
+     */
+    return open_memstream(&record->fields[field], &record->fieldLengths[field]);
+}
+
+static void chunkRecord_setField(ChunkRecord *record, enum ChunkRecordField field, char *string) {
+    /*
+     * Sets the field to the given string, taking ownership of it.
+     */
+    record->fields[field] = string;
+    record->fieldLengths[field] = strlen(string);
+}
+
+static void appendToPayload(char **payload, const void *data, size_t length) {
+    memcpy(*payload, data, length);
+    *payload += length;
+}
+
+static void outputChunker_writeChunkRecord(OutputChunker *outputChunker, char *sequenceName, int64_t chunkOrdinal,
+                                           ChunkRecord *record) {
+    /*
+     * Writes the record to the chunk record stream, then frees its fields.
+     */
+
+    // Build the payload
+    uint64_t nameLength = strlen(sequenceName);
+    size_t payloadLength = sizeof(uint64_t) * (CHUNK_RECORD_FIELDS + 1) + nameLength;
+    for (int64_t i = 0; i < CHUNK_RECORD_FIELDS; i++) {
+        if (record->fields[i] != NULL) {
+            payloadLength += record->fieldLengths[i];
+        }
+    }
+    char *payload = st_malloc(payloadLength), *p = payload;
+    appendToPayload(&p, &nameLength, sizeof(uint64_t));
+    appendToPayload(&p, sequenceName, nameLength);
+    for (int64_t i = 0; i < CHUNK_RECORD_FIELDS; i++) {
+        uint64_t fieldLength = record->fields[i] == NULL ? CHUNK_RECORD_ABSENT_FIELD : record->fieldLengths[i];
+        appendToPayload(&p, &fieldLength, sizeof(uint64_t));
+        if (record->fields[i] != NULL) {
+            appendToPayload(&p, record->fields[i], record->fieldLengths[i]);
+            free(record->fields[i]);
+            record->fields[i] = NULL;
+        }
+    }
+    assert(p == payload + payloadLength);
+
+    // Compress it, if requested
+    uint8_t compressed = outputChunker->compressChunkRecords;
+    if (compressed) {
+        int64_t compressedLength;
+        char *compressedPayload = stCompression_compress(payload, payloadLength, &compressedLength, -1);
+        free(payload);
+        payload = compressedPayload;
+        payloadLength = compressedLength;
+    }
+
+    // Write the record
+    FILE *fh = outputChunker->outputChunkRecordFileHandle;
+    uint32_t magic = CHUNK_RECORD_MAGIC;
+    uint64_t storedPayloadLength = payloadLength;
+    char header[CHUNK_RECORD_HEADER_LENGTH], *h = header;
+    appendToPayload(&h, &magic, sizeof(uint32_t));
+    appendToPayload(&h, &chunkOrdinal, sizeof(int64_t));
+    appendToPayload(&h, &compressed, sizeof(uint8_t));
+    appendToPayload(&h, &storedPayloadLength, sizeof(uint64_t));
+    if (fwrite(header, 1, CHUNK_RECORD_HEADER_LENGTH, fh) != CHUNK_RECORD_HEADER_LENGTH ||
+        fwrite(payload, 1, payloadLength, fh) != payloadLength) {
+        st_errAbort("Failed to write chunk %" PRIi64 " to the temporary output\n", chunkOrdinal);
+    }
+
+    // And make it durable, and reusable by later runs if there is a chunk cache
+    if (outputChunker->chunkJournal != NULL) {
+        chunkJournal_append(outputChunker->chunkJournal, CHUNK_JOURNAL_RECORD, chunkOrdinal, header,
+                            CHUNK_RECORD_HEADER_LENGTH, payload, payloadLength);
+        chunkJournal_cacheChunk(outputChunker->chunkJournal, chunkOrdinal, header, CHUNK_RECORD_HEADER_LENGTH,
+                                payload, payloadLength);
+    }
+    free(payload);
+}
+
+static stList *chunkRecord_getLines(char *field, uint64_t length) {
+    /*
+     * Splits a field into its newline terminated lines, newlines are omitted from the lines.
+     */
+    stList *lines = stList_construct3(0, free);
+    uint64_t lineStart = 0;
+    for (uint64_t i = 0; i < length; i++) {
+        if (field[i] == '\n') {
+            stList_append(lines, stString_getSubString(field, lineStart, i - lineStart));
+            lineStart = i + 1;
+        }
+    }
+    if (lineStart < length) {
+        stList_append(lines, stString_getSubString(field, lineStart, length - lineStart));
+    }
+    return lines;
+}
+
+static ChunkToStitch *outputChunker_readChunkRecord(OutputChunker *outputChunker, bool phased) {
+    /*
+     * Reads the next record from the chunk record stream, returns NULL if none remain.
+     */
+    FILE *fh = outputChunker->outputChunkRecordFileHandle;
+    uint32_t magic;
+    if (fread(&magic, sizeof(uint32_t), 1, fh) != 1) {
+        return NULL;
+    }
+    int64_t chunkOrdinal;
+    uint8_t compressed;
+    uint64_t payloadLength;
+    if (magic != CHUNK_RECORD_MAGIC || fread(&chunkOrdinal, sizeof(int64_t), 1, fh) != 1 ||
+        fread(&compressed, sizeof(uint8_t), 1, fh) != 1 || fread(&payloadLength, sizeof(uint64_t), 1, fh) != 1) {
+        st_errAbort("Got a malformed chunk record header in the temporary output\n");
+    }
+    char *payload = st_malloc(payloadLength);
+    if (fread(payload, 1, payloadLength, fh) != payloadLength) {
+        st_errAbort("Got a truncated record for chunk %" PRIi64 " in the temporary output\n", chunkOrdinal);
+    }
+    if (compressed) {
+        int64_t uncompressedLength;
+        char *uncompressedPayload = stCompression_decompress(payload, payloadLength, &uncompressedLength);
+        free(payload);
+        payload = uncompressedPayload;
+        payloadLength = uncompressedLength;
+    }
+
+    // Parse the payload
+    ChunkToStitch *chunk = st_calloc(1, sizeof(ChunkToStitch));
+    chunk->chunkOrdinal = chunkOrdinal;
+    char *p = payload, *end = payload + payloadLength;
+    uint64_t nameLength;
+    memcpy(&nameLength, p, sizeof(uint64_t));
+    p += sizeof(uint64_t);
+    chunk->seqName = stString_getSubString(p, 0, nameLength);
+    p += nameLength;
+    char *fields[CHUNK_RECORD_FIELDS];
+    uint64_t fieldLengths[CHUNK_RECORD_FIELDS];
+    for (int64_t i = 0; i < CHUNK_RECORD_FIELDS; i++) {
+        if (p + sizeof(uint64_t) > end) {
+            st_errAbort("Got a malformed record for chunk %" PRIi64 " in the temporary output\n", chunkOrdinal);
+        }
+        memcpy(&fieldLengths[i], p, sizeof(uint64_t));
+        p += sizeof(uint64_t);
+        if (fieldLengths[i] == CHUNK_RECORD_ABSENT_FIELD) {
+            fields[i] = NULL;
+            continue;
+        }
+        if (p + fieldLengths[i] > end) {
+            st_errAbort("Got a malformed record for chunk %" PRIi64 " in the temporary output\n", chunkOrdinal);
+        }
+        fields[i] = p;
+        p += fieldLengths[i];
+    }
+
+    // Sequences
+    if (fields[CHUNK_RECORD_SEQ_HAP1] != NULL) {
+        chunk->seqHap1 = stString_getSubString(fields[CHUNK_RECORD_SEQ_HAP1], 0, fieldLengths[CHUNK_RECORD_SEQ_HAP1]);
+    }
+    if (fields[CHUNK_RECORD_SEQ_HAP2] != NULL) {
+        chunk->seqHap2 = stString_getSubString(fields[CHUNK_RECORD_SEQ_HAP2], 0, fieldLengths[CHUNK_RECORD_SEQ_HAP2]);
+    }
+
+    // Lines
+    stList **lines[CHUNK_RECORD_FIELDS] = { NULL, NULL, &chunk->poaHap1StringsLines, &chunk->poaHap2StringsLines,
+                                            &chunk->repeatCountLinesHap1, &chunk->repeatCountLinesHap2,
+                                            &chunk->readsHap1Lines, &chunk->readsHap2Lines };
+    for (int64_t i = CHUNK_RECORD_POA_HAP1; i < CHUNK_RECORD_FIELDS; i++) {
+        if (fields[i] != NULL) {
+            *lines[i] = chunkRecord_getLines(fields[i], fieldLengths[i]);
+        }
+    }
+    if (phased && (chunk->readsHap1Lines == NULL || chunk->readsHap2Lines == NULL)) {
+        st_errAbort("Expected chunk phasing info but found none! Expected chunk %"PRId64, chunkOrdinal);
+    }
+
+    free(payload);
+    return chunk;
+}
+
 static FILE *open(bool output, char **file, size_t *outputBufferSize, bool inMemory, char *openStr) {
     if (!output) {
         return NULL;
@@ -739,22 +1731,105 @@ void outputChunker_open(OutputChunker *outputChunker, char *openStr) {
     /*
      * Open the files.
      */
-    outputChunker->outputSequenceFileHandle = open(outputChunker->outputSequence, &(outputChunker->outputSequenceFile),
+    bool textOutput = !outputChunker->useChunkRecords;
+    outputChunker->outputChunkRecordFileHandle = open(outputChunker->useChunkRecords,
+                                                      &(outputChunker->outputChunkRecordFile),
+                                                      &(outputChunker->outputChunkRecordFileBufferSize),
+                                                      outputChunker->useMemoryBuffers, openStr);
+    outputChunker->outputSequenceFileHandle = open(textOutput && outputChunker->outputSequence,
+                                                   &(outputChunker->outputSequenceFile),
                                                    &(outputChunker->outputSequenceFileBufferSize),
                                                    outputChunker->useMemoryBuffers, openStr);
-    outputChunker->outputPoaFileHandle = open(outputChunker->outputPoa, &(outputChunker->outputPoaFile),
+    outputChunker->outputPoaFileHandle = open(textOutput && outputChunker->outputPoa, &(outputChunker->outputPoaFile),
                                               &(outputChunker->outputPoaFileBufferSize),
                                               outputChunker->useMemoryBuffers, openStr);
-    outputChunker->outputRepeatCountFileHandle = open(outputChunker->outputRepeatCounts,
+    outputChunker->outputRepeatCountFileHandle = open(textOutput && outputChunker->outputRepeatCounts,
                                                       &(outputChunker->outputRepeatCountFile),
                                                       &(outputChunker->outputRepeatCountFileBufferSize),
                                                       outputChunker->useMemoryBuffers, openStr);
-    outputChunker->outputReadPartitionFileHandle = open(outputChunker->outputReadPartition,
+    outputChunker->outputReadPartitionFileHandle = open(textOutput && outputChunker->outputReadPartition,
                                                         &(outputChunker->outputReadPartitionFile),
                                                         &(outputChunker->outputRepeatPartitionFileBufferSize),
                                                         outputChunker->useMemoryBuffers, openStr);
 }
 
+static void outputChunker_setMemoryBudget(OutputChunker *outputChunker, uint64_t maxMemoryBufferBytes,
+                                          char *spillFileBase) {
+    /*
+     * Sets the number of bytes an in-memory chunker may buffer before moving its output to files named after
+     * spillFileBase, taking ownership of spillFileBase.
+     */
+    assert(outputChunker->useMemoryBuffers);
+    outputChunker->maxMemoryBufferBytes = maxMemoryBufferBytes;
+    outputChunker->spillFileBase = spillFileBase;
+}
+
+static void spillBuffer(bool output, char **file, size_t *outputBufferSize, char *fileName) {
+    /*
+     * Writes the in-memory buffer to the named file and replaces the buffer with the file's name.
+     */
+    if (!output) {
+        free(fileName);
+        return;
+    }
+    FILE *fh = safe_fopen(fileName, "w");
+    if (*outputBufferSize > 0 && fwrite(*file, 1, *outputBufferSize, fh) != *outputBufferSize) {
+        st_errAbort("Failed to write the in-memory output buffer to %s\n", fileName);
+    }
+    fclose(fh);
+    free(*file);
+    *file = fileName;
+    *outputBufferSize = 0;
+}
+
+void outputChunker_close(OutputChunker *outputChunker);
+
+static void outputChunker_spillIfOverMemoryBudget(OutputChunker *outputChunker) {
+    /*
+     * If the chunker's in-memory buffers exceed its budget, moves them to temporary files and continues the output
+     * there. The output is then read back from the files during stitching as for any on-disk chunker.
+     */
+    if (!outputChunker->useMemoryBuffers || outputChunker->maxMemoryBufferBytes == 0) {
+        return;
+    }
+
+    // The buffer sizes are only updated when the streams are flushed
+    FILE *fhs[5] = { outputChunker->outputSequenceFileHandle, outputChunker->outputPoaFileHandle,
+                     outputChunker->outputRepeatCountFileHandle, outputChunker->outputReadPartitionFileHandle,
+                     outputChunker->outputChunkRecordFileHandle };
+    for (int64_t i = 0; i < 5; i++) {
+        if (fhs[i] != NULL) {
+            fflush(fhs[i]);
+        }
+    }
+    uint64_t bufferBytes = outputChunker->outputSequenceFileBufferSize + outputChunker->outputPoaFileBufferSize +
+                           outputChunker->outputRepeatCountFileBufferSize +
+                           outputChunker->outputRepeatPartitionFileBufferSize +
+                           outputChunker->outputChunkRecordFileBufferSize;
+    if (bufferBytes <= outputChunker->maxMemoryBufferBytes) {
+        return;
+    }
+
+    st_logInfo("> Output buffers of %" PRIu64 " bytes exceed the in-memory budget of %" PRIu64
+               " bytes, continuing on disk at %s.*\n", bufferBytes, outputChunker->maxMemoryBufferBytes,
+               outputChunker->spillFileBase);
+    outputChunker_close(outputChunker);
+    bool textOutput = !outputChunker->useChunkRecords;
+    char *base = outputChunker->spillFileBase;
+    spillBuffer(textOutput && outputChunker->outputSequence, &outputChunker->outputSequenceFile,
+                &outputChunker->outputSequenceFileBufferSize, stString_print("%s.fa.temp", base));
+    spillBuffer(textOutput && outputChunker->outputPoa, &outputChunker->outputPoaFile,
+                &outputChunker->outputPoaFileBufferSize, stString_print("%s.poa.temp", base));
+    spillBuffer(textOutput && outputChunker->outputRepeatCounts, &outputChunker->outputRepeatCountFile,
+                &outputChunker->outputRepeatCountFileBufferSize, stString_print("%s.repeatCount.temp", base));
+    spillBuffer(textOutput && outputChunker->outputReadPartition, &outputChunker->outputReadPartitionFile,
+                &outputChunker->outputRepeatPartitionFileBufferSize, stString_print("%s.reads.temp", base));
+    spillBuffer(outputChunker->useChunkRecords, &outputChunker->outputChunkRecordFile,
+                &outputChunker->outputChunkRecordFileBufferSize, stString_print("%s.chunks.temp", base));
+    outputChunker->useMemoryBuffers = 0;
+    outputChunker_open(outputChunker, "a");
+}
+
 OutputChunker *
 outputChunker_construct(Params *params, char *outputSequenceFile, char *outputPoaFile, char *outputReadPartitionFile,
                         char *outputRepeatCountFile) {
@@ -781,6 +1856,24 @@ outputChunker_construct(Params *params, char *outputSequenceFile, char *outputPo
     return outputChunker;
 }
 
+static OutputChunker *outputChunker_constructFinal(Params *params, char *outputSequenceFile, char *outputPoaFile,
+                                                   char *outputReadPartitionFile, char *outputRepeatCountFile) {
+    /*
+     * Create an OutputChunker object for the final output files, whose sequence file is BGZF compressed and indexed
+     * as it is written if params->polishParams->compressOutputFasta is set.
+     */
+    bool compressSequence = outputSequenceFile != NULL && params->polishParams->compressOutputFasta;
+    OutputChunker *outputChunker = outputChunker_construct(params, compressSequence ? NULL : outputSequenceFile,
+                                                           outputPoaFile, outputReadPartitionFile,
+                                                           outputRepeatCountFile);
+    if (compressSequence) {
+        outputChunker->outputSequence = TRUE;
+        outputChunker->outputSequenceFile = outputSequenceFile;
+        outputChunker->outputSequenceBgzfWriter = bgzfFastaWriter_construct(outputSequenceFile, params);
+    }
+    return outputChunker;
+}
+
 OutputChunker *
 outputChunker_constructInMemory(Params *params, bool outputSequence,  bool outputPoaFile, bool outputReadPartitionFile,
                                 bool outputRepeatCountFile) {
@@ -803,9 +1896,63 @@ outputChunker_constructInMemory(Params *params, bool outputSequence,  bool outpu
     return outputChunker;
 }
 
+static OutputChunker *
+outputChunker_constructChunkRecords(Params *params, char *outputChunkRecordFile, bool inMemory, bool outputSequence,
+                                    bool outputPoaFile, bool outputReadPartitionFile, bool outputRepeatCountFile,
+                                    bool compress) {
+    /*
+     * Create an OutputChunker object that writes each chunk as a single binary record, either to the given file or,
+     * if inMemory, to an in-memory buffer.
+     */
+    OutputChunker *outputChunker = st_calloc(1, sizeof(OutputChunker));
+
+    // Initialize variables
+    outputChunker->useMemoryBuffers = inMemory;
+    outputChunker->outputSequence = outputSequence;
+    outputChunker->outputPoa = outputPoaFile;
+    outputChunker->outputReadPartition = outputReadPartitionFile;
+    outputChunker->outputRepeatCounts = outputRepeatCountFile;
+    outputChunker->useChunkRecords = 1;
+    outputChunker->compressChunkRecords = compress;
+    outputChunker->outputChunkRecordFile = inMemory ? NULL : outputChunkRecordFile;
+    outputChunker->params = params;
+
+    // Open files for writing
+    outputChunker_open(outputChunker, "w");
+
+    return outputChunker;
+}
+
+static void outputChunker_processChunkRecord(OutputChunker *outputChunker, int64_t chunkOrdinal, char *sequenceName,
+                                             Poa *poa, stList *reads) {
+    /*
+     * As outputChunker_processChunkSequence, but writing a binary chunk record.
+     */
+    ChunkRecord record = { { NULL }, { 0 } };
+    if (outputChunker->outputSequence) {
+        chunkRecord_setField(&record, CHUNK_RECORD_SEQ_HAP1, rleString_expand(poa->refString));
+    }
+    if (outputChunker->outputPoa) {
+        FILE *fh = chunkRecord_openField(&record, CHUNK_RECORD_POA_HAP1);
+        poa_printCSV(poa, fh, reads, outputChunker->params->polishParams->repeatSubMatrix, 5);
+        fclose(fh);
+    }
+    if (outputChunker->outputRepeatCounts) {
+        FILE *fh = chunkRecord_openField(&record, CHUNK_RECORD_REPEAT_COUNTS_HAP1);
+        poa_printRepeatCountsCSV(poa, fh, reads);
+        fclose(fh);
+    }
+    outputChunker_writeChunkRecord(outputChunker, sequenceName, chunkOrdinal, &record);
+}
+
 void
 outputChunker_processChunkSequence(OutputChunker *outputChunker, int64_t chunkOrdinal, char *sequenceName, Poa *poa,
                                    stList *reads) {
+    if (outputChunker->useChunkRecords) {
+        outputChunker_processChunkRecord(outputChunker, chunkOrdinal, sequenceName, poa, reads);
+        return;
+    }
+
     // Create chunk name
     char *headerLinePrefix = stString_print("%s,%" PRIi64 ",", sequenceName, chunkOrdinal);
 
@@ -864,9 +2011,77 @@ outputChunker_processChunkSequencePhased2(OutputChunker *outputChunker, char *he
     }
 }
 
+static void printReadPartition(FILE *fh, stGenomeFragment *gF, Params *params, bool hap1,
+                               stSet *readsBelongingToHap) {
+    /*
+     * Prints the reads in the haplotype's partition, followed by any reads assigned to the haplotype that were
+     * not in the genome fragment.
+     */
+    // becasue we (may) have filtered reads now: readsBelongingToHapX has more reads than GF
+    stSet *readIdsInGf = stSet_construct3(stHash_stringKey, stHash_stringEqualKey, free);
+    stGenomeFragment_printPartitionAsCSV(gF, fh, params->phaseParams, hap1, readIdsInGf);
+    BamChunkRead *read = NULL;
+    stSetIterator *itor = stSet_getIterator(readsBelongingToHap);
+    while ((read = stSet_getNext(itor)) != NULL) {
+        if (stSet_search(readIdsInGf, read->readName) == NULL) {
+            fprintf(fh, "%s,%f\n", read->readName, -1.0);
+        }
+    }
+    stSet_destructIterator(itor);
+    stSet_destruct(readIdsInGf);
+}
+
+static void outputChunker_processChunkRecordPhased2(OutputChunker *outputChunker, ChunkRecord *record, bool hap1,
+                                                    Poa *poa, stList *reads, stSet *readsBelongingToHap1,
+                                                    stSet *readsBelongingToHap2) {
+    if (outputChunker->outputSequence) {
+        chunkRecord_setField(record, hap1 ? CHUNK_RECORD_SEQ_HAP1 : CHUNK_RECORD_SEQ_HAP2,
+                             rleString_expand(poa->refString));
+    }
+    if (outputChunker->outputPoa) {
+        FILE *fh = chunkRecord_openField(record, hap1 ? CHUNK_RECORD_POA_HAP1 : CHUNK_RECORD_POA_HAP2);
+        poa_printPhasedCSV(poa, fh, reads, readsBelongingToHap1, readsBelongingToHap2,
+                           outputChunker->params->polishParams->repeatSubMatrix, 5);
+        fclose(fh);
+    }
+    if (outputChunker->outputRepeatCounts) {
+        FILE *fh = chunkRecord_openField(record, hap1 ? CHUNK_RECORD_REPEAT_COUNTS_HAP1 :
+                                                        CHUNK_RECORD_REPEAT_COUNTS_HAP2);
+        poa_printRepeatCountsCSV(poa, fh, reads);
+        fclose(fh);
+    }
+}
+
+static void outputChunker_processChunkRecordPhased(OutputChunker *outputChunker, int64_t chunkOrdinal,
+                                                   char *sequenceName, Poa *poaHap1, Poa *poaHap2, stList *reads,
+                                                   stSet *readsBelongingToHap1, stSet *readsBelongingToHap2,
+                                                   stGenomeFragment *gF, Params *params) {
+    /*
+     * As outputChunker_processChunkSequencePhased, but writing a binary chunk record.
+     */
+    ChunkRecord record = { { NULL }, { 0 } };
+    outputChunker_processChunkRecordPhased2(outputChunker, &record, 1, poaHap1, reads, readsBelongingToHap1,
+                                            readsBelongingToHap2);
+    outputChunker_processChunkRecordPhased2(outputChunker, &record, 0, poaHap2, reads, readsBelongingToHap2,
+                                            readsBelongingToHap1);
+    FILE *fh = chunkRecord_openField(&record, CHUNK_RECORD_READS_HAP1);
+    printReadPartition(fh, gF, params, 1, readsBelongingToHap1);
+    fclose(fh);
+    fh = chunkRecord_openField(&record, CHUNK_RECORD_READS_HAP2);
+    printReadPartition(fh, gF, params, 0, readsBelongingToHap2);
+    fclose(fh);
+    outputChunker_writeChunkRecord(outputChunker, sequenceName, chunkOrdinal, &record);
+}
+
 void outputChunker_processChunkSequencePhased(OutputChunker *outputChunker, int64_t chunkOrdinal, char *sequenceName,
                                          Poa *poaHap1, Poa *poaHap2, stList *reads, stSet *readsBelongingToHap1,
                                          stSet *readsBelongingToHap2, stGenomeFragment *gF, Params *params) {
+    if (outputChunker->useChunkRecords) {
+        outputChunker_processChunkRecordPhased(outputChunker, chunkOrdinal, sequenceName, poaHap1, poaHap2, reads,
+                                               readsBelongingToHap1, readsBelongingToHap2, gF, params);
+        return;
+    }
+
     // Create chunk name
     char *headerLinePrefix = stString_print("%s,%" PRIi64 ",", sequenceName, chunkOrdinal);
 
@@ -876,49 +2091,28 @@ void outputChunker_processChunkSequencePhased(OutputChunker *outputChunker, int6
     outputChunker_processChunkSequencePhased2(outputChunker, headerLinePrefix,
                                               poaHap2, reads, readsBelongingToHap2, readsBelongingToHap1);
 
-    // becasue we (may) have filtered reads now: readsBelongingToHapX has more reads than GF
-    stSet *readIdsInGfHap1 = stSet_construct3(stHash_stringKey, stHash_stringEqualKey, free);
-    stSet *readIdsInGfHap2 = stSet_construct3(stHash_stringKey, stHash_stringEqualKey, free);
-    BamChunkRead *read = NULL;
-    stSetIterator *itor = NULL;
-
     // Output the read partition hap1
     fprintf(outputChunker->outputReadPartitionFileHandle, "%s%" PRIi64 "\n", headerLinePrefix,
             stSet_size(readsBelongingToHap1) + 1);
-    stGenomeFragment_printPartitionAsCSV(gF, outputChunker->outputReadPartitionFileHandle, params->phaseParams, 1,
-                                         readIdsInGfHap1);
-    itor = stSet_getIterator(readsBelongingToHap1);
-    while ((read = stSet_getNext(itor)) != NULL) {
-        if (stSet_search(readIdsInGfHap1, read->readName) == NULL) {
-            fprintf(outputChunker->outputReadPartitionFileHandle, "%s,%f\n", read->readName, -1.0);
-        }
-    }
-    stSet_destructIterator(itor);
+    printReadPartition(outputChunker->outputReadPartitionFileHandle, gF, params, 1, readsBelongingToHap1);
 
     // Output the read partition hap2
     fprintf(outputChunker->outputReadPartitionFileHandle, "%s%" PRIi64 "\n", headerLinePrefix,
             stSet_size(readsBelongingToHap2) + 1);
-    stGenomeFragment_printPartitionAsCSV(gF, outputChunker->outputReadPartitionFileHandle, params->phaseParams, 0,
-                                         readIdsInGfHap2);
-    itor = stSet_getIterator(readsBelongingToHap2);
-    while ((read = stSet_getNext(itor)) != NULL) {
-        if (stSet_search(readIdsInGfHap2, read->readName) == NULL) {
-            fprintf(outputChunker->outputReadPartitionFileHandle, "%s,%f\n", read->readName, -1.0);
-        }
-    }
-    stSet_destructIterator(itor);
+    printReadPartition(outputChunker->outputReadPartitionFileHandle, gF, params, 0, readsBelongingToHap2);
     fflush(outputChunker->outputReadPartitionFileHandle);
 
     // Cleanup
     free(headerLinePrefix);
-    stSet_destruct(readIdsInGfHap1);
-    stSet_destruct(readIdsInGfHap2);
 }
 
 ChunkToStitch *outputChunker_readChunk(OutputChunker *outputChunker, bool phased) {
     /*
      * Read a chunk of output from the outputChunker.
      */
+    if (outputChunker->useChunkRecords) {
+        return outputChunker_readChunkRecord(outputChunker, phased);
+    }
     ChunkToStitch *chunk = st_calloc(1, sizeof(ChunkToStitch));
 
     if (outputChunker->outputSequenceFile != NULL) {
@@ -949,6 +2143,18 @@ ChunkToStitch *outputChunker_readChunk(OutputChunker *outputChunker, bool phased
 }
 
 void outputChunker_close(OutputChunker *outputChunker) {
+    // Finish the compressed sequence output file
+    if (outputChunker->outputSequenceBgzfWriter != NULL) {
+        bgzfFastaWriter_destruct(outputChunker->outputSequenceBgzfWriter);
+        outputChunker->outputSequenceBgzfWriter = NULL;
+    }
+
+    // Cleanup the chunk record file
+    if (outputChunker->outputChunkRecordFileHandle != NULL) {
+        fclose(outputChunker->outputChunkRecordFileHandle);
+        outputChunker->outputChunkRecordFileHandle = NULL;
+    }
+
     // Cleanup the sequence output file
     if (outputChunker->outputSequenceFileHandle != NULL) {
         fclose(outputChunker->outputSequenceFileHandle);
@@ -979,14 +2185,23 @@ void outputChunker_closeAndDeleteFiles(OutputChunker *outputChunker) {
      * Closes the file streams and removes the output files (used for
      * chunker output to temporary files)
      */
+    bool compressedSequence = outputChunker->outputSequenceBgzfWriter != NULL;
     outputChunker_close(outputChunker); // Closes file streams
 
     if (!outputChunker->useMemoryBuffers) { // If not in memory need to delete underlying files
         // if in memory, buffers will be freed in destructor
 
-        // Delete the sequence output file
+        // Delete the sequence output file, and its indexes if compressed
         if (outputChunker->outputSequenceFile != NULL) {
             stFile_rmrf(outputChunker->outputSequenceFile);
+            if (compressedSequence) {
+                char *indexFile = stString_print("%s.fai", outputChunker->outputSequenceFile);
+                stFile_rmrf(indexFile);
+                free(indexFile);
+                indexFile = stString_print("%s.gzi", outputChunker->outputSequenceFile);
+                stFile_rmrf(indexFile);
+                free(indexFile);
+            }
         }
 
         // Delete repeat count file
@@ -1003,6 +2218,11 @@ void outputChunker_closeAndDeleteFiles(OutputChunker *outputChunker) {
         if (outputChunker->outputReadPartitionFile != NULL) {
             stFile_rmrf(outputChunker->outputReadPartitionFile);
         }
+
+        // Delete chunk record file
+        if (outputChunker->outputChunkRecordFile != NULL) {
+            stFile_rmrf(outputChunker->outputChunkRecordFile);
+        }
     }
 }
 
@@ -1020,7 +2240,12 @@ void outputChunker_writeChunkToFinalOutput(OutputChunker *outputChunker,
      */
 
     // Write the sequence
-    if (outputChunker->outputSequenceFile != NULL) {
+    if (outputChunker->outputSequenceBgzfWriter != NULL) {
+        if (startOfSequence) {
+            bgzfFastaWriter_startSequence(outputChunker->outputSequenceBgzfWriter, seqName);
+        }
+        bgzfFastaWriter_appendSequence(outputChunker->outputSequenceBgzfWriter, seq);
+    } else if (outputChunker->outputSequenceFile != NULL) {
         if (startOfSequence) {
             fastaWrite(seq, seqName, outputChunker->outputSequenceFileHandle);
         } else {
@@ -1063,6 +2288,12 @@ void outputChunker_destruct(OutputChunker *outputChunker) {
         free(outputChunker->outputReadPartitionFile);
     }
 
+    // Cleanup chunk record file
+    if (outputChunker->outputChunkRecordFile != NULL) {
+        free(outputChunker->outputChunkRecordFile);
+    }
+    free(outputChunker->spillFileBase);
+
     // Cleanup residual
     free(outputChunker);
 }
@@ -1071,6 +2302,35 @@ void outputChunker_destruct(OutputChunker *outputChunker) {
  * OutputChunkers
  */
 
+typedef struct _onlineStitcher {
+    /*
+     * State for stitching chunks in ordinal order as they are completed, rather than after all are done.
+     */
+    bool phased;
+    int64_t chunkCount;
+    int64_t nextChunkOrdinal; // The ordinal of the next chunk to stitch
+    ChunkToStitch **pendingChunks; // Completed chunks waiting on a chunk with a lower ordinal, indexed by ordinal
+
+    // The contig currently being stitched, as in mergeContigChunkz
+    ChunkToStitch *pChunk; // The last chunk added to the contig, NULL if no contig is being stitched
+    ChunkToStitch *stitched;
+    bool trackSequence;
+    bool trackPoa;
+    bool trackRepeatCounts;
+    stList *hap1Seqs;
+    stList *hap2Seqs;
+    PhasedReads *phasedReads;
+    int64_t lengthOfSequenceOutputSoFarHap1;
+    int64_t lengthOfSequenceOutputSoFarHap2;
+
+    // Extra data tracked for the caller, any may be NULL
+    stList *readIdsHap1;
+    stList *readIdsHap2;
+    bool *switchedState;
+    void (*chunkStitched)(int64_t chunkOrdinal, bool wasSwitched, void *extraArg);
+    void *chunkStitchedArg;
+} OnlineStitcher;
+
 struct _outputChunkers {
     int64_t noOfOutputChunkers;
     stList *tempFileChunkers;
@@ -1079,6 +2339,10 @@ struct _outputChunkers {
     OutputChunker *outputChunkerHap1;
     OutputChunker *outputChunkerHap2;
     Params *params;
+    OnlineStitcher *onlineStitcher; // If non-null, chunks are stitched as they are processed
+    ChunkJournal *chunkJournal; // If non-null, finished chunks are journaled
+    char *spliceReferenceFile; // If non-null, the stitched runs of chunks are spliced into this reference
+    BamChunker *spliceChunker; // The chunks, giving the interval of the reference each run covers
 };
 
 static char *printTempFileName(char *fileName, int64_t index) {
@@ -1095,6 +2359,14 @@ static char *printFinalFileName(char *fileName, char *suffix) {
     return stString_print("%s%s", fileName, suffix == NULL ? "" : suffix);
 }
 
+static char *printFinalSequenceFileName(char *fileName, char *suffix, Params *params) {
+    if (fileName == NULL) {
+        return NULL;
+    }
+    return stString_print("%s%s%s", fileName, suffix == NULL ? "" : suffix,
+                          params->polishParams->compressOutputFasta ? ".gz" : "");
+}
+
 OutputChunkers *
 outputChunkers_construct(int64_t noOfOutputChunkers, Params *params, char *outputSequenceFile, char *outputPoaFile,
                          char *outputReadPartitionFile, char *outputRepeatCountFile, char *hap1Suffix, char *hap2Suffix,
@@ -1125,52 +2397,90 @@ outputChunkers_construct(int64_t noOfOutputChunkers, Params *params, char *outpu
     OutputChunkers *outputChunkers = st_calloc(1, sizeof(OutputChunkers));
     outputChunkers->noOfOutputChunkers = noOfOutputChunkers;
     outputChunkers->params = params;
+    // Name any temporary files not made per output after the first output being made
+    char *outputFileBase = outputSequenceFile != NULL ? outputSequenceFile :
+                           (outputPoaFile != NULL ? outputPoaFile :
+                            (outputReadPartitionFileForStitching != NULL ? outputReadPartitionFileForStitching :
+                             (outputRepeatCountFile != NULL ? outputRepeatCountFile : "temp_chunk_output")));
+    char *outputChunkRecordFile = stString_print("%s.chunks", outputFileBase);
+
     // Make the temporary, parallel chunkers
     outputChunkers->tempFileChunkers = stList_construct3(0, (void (*)(void *)) outputChunker_destruct);
     for (int64_t i = 0; i < noOfOutputChunkers; i++) {
-        stList_append(outputChunkers->tempFileChunkers, inMemoryBuffers ?
-            outputChunker_constructInMemory(params, outputSequenceFile != NULL, outputPoaFile != NULL,
-                    outputReadPartitionFileForStitching != NULL, outputRepeatCountFile != NULL) :
-            outputChunker_construct(params, printTempFileName(outputSequenceFile, i), printTempFileName(outputPoaFile, i),
-                printTempFileName(outputReadPartitionFileForStitching, i), printTempFileName(outputRepeatCountFile, i)));
+        OutputChunker *outputChunker;
+        if (params->polishParams->useBinaryChunkRecords) {
+            outputChunker = outputChunker_constructChunkRecords(params, printTempFileName(outputChunkRecordFile, i),
+                                                                inMemoryBuffers, outputSequenceFile != NULL,
+                                                                outputPoaFile != NULL,
+                                                                outputReadPartitionFileForStitching != NULL,
+                                                                outputRepeatCountFile != NULL,
+                                                                params->polishParams->compressChunkRecords);
+        } else {
+            outputChunker = inMemoryBuffers ?
+                outputChunker_constructInMemory(params, outputSequenceFile != NULL, outputPoaFile != NULL,
+                        outputReadPartitionFileForStitching != NULL, outputRepeatCountFile != NULL) :
+                outputChunker_construct(params, printTempFileName(outputSequenceFile, i), printTempFileName(outputPoaFile, i),
+                    printTempFileName(outputReadPartitionFileForStitching, i), printTempFileName(outputRepeatCountFile, i));
+        }
+        // The in-memory budget is shared evenly between the chunkers
+        if (inMemoryBuffers && params->polishParams->maxInMemoryOutputBytes > 0) {
+            outputChunker_setMemoryBudget(outputChunker,
+                                          1 + params->polishParams->maxInMemoryOutputBytes / noOfOutputChunkers,
+                                          stString_print("%s.spill.%" PRIi64, outputFileBase, i));
+        }
+        stList_append(outputChunkers->tempFileChunkers, outputChunker);
     }
+    free(outputChunkRecordFile);
+
     // Make the final output chunkers
-    outputChunkers->outputChunkerHap1 = outputChunker_construct(params,
-                                                                printFinalFileName(outputSequenceFile, hap1Suffix),
-                                                                printFinalFileName(outputPoaFile, hap1Suffix),
-                                                                printFinalFileName(outputReadPartitionFile, hap1Suffix),
-                                                                printFinalFileName(outputRepeatCountFile, hap1Suffix));
+    outputChunkers->outputChunkerHap1 =
+            outputChunker_constructFinal(params, printFinalSequenceFileName(outputSequenceFile, hap1Suffix, params),
+                                         printFinalFileName(outputPoaFile, hap1Suffix),
+                                         printFinalFileName(outputReadPartitionFile, hap1Suffix),
+                                         printFinalFileName(outputRepeatCountFile, hap1Suffix));
 
     if (hap2Suffix != NULL) {
-        outputChunkers->outputChunkerHap2 = outputChunker_construct(params,
-                                                                    printFinalFileName(outputSequenceFile, hap2Suffix),
-                                                                    printFinalFileName(outputPoaFile, hap2Suffix),
-                                                                    printFinalFileName(outputReadPartitionFile,
-                                                                                       hap2Suffix),
-                                                                    printFinalFileName(outputRepeatCountFile,
-                                                                                       hap2Suffix));
+        outputChunkers->outputChunkerHap2 =
+                outputChunker_constructFinal(params, printFinalSequenceFileName(outputSequenceFile, hap2Suffix, params),
+                                             printFinalFileName(outputPoaFile, hap2Suffix),
+                                             printFinalFileName(outputReadPartitionFile, hap2Suffix),
+                                             printFinalFileName(outputRepeatCountFile, hap2Suffix));
     }
 
     return outputChunkers;
 }
 
+static void outputChunkers_stitchChunkOnline(OutputChunkers *outputChunkers, int64_t chunker);
+
 void outputChunkers_processChunkSequence(OutputChunkers *outputChunkers, int64_t chunker, int64_t chunkOrdinal,
                                     char *sequenceName, Poa *poa,
                                     stList *reads) {
+    allocProfile_scope(APT_STITCHING);
     outputChunker_processChunkSequence(stList_get(outputChunkers->tempFileChunkers, chunker), chunkOrdinal,
                                        sequenceName, poa,
                                        reads);
+    if (outputChunkers->onlineStitcher != NULL) {
+        outputChunkers_stitchChunkOnline(outputChunkers, chunker);
+    } else {
+        outputChunker_spillIfOverMemoryBudget(stList_get(outputChunkers->tempFileChunkers, chunker));
+    }
 }
 
 void outputChunkers_processChunkSequencePhased(OutputChunkers *outputChunkers, int64_t chunker, int64_t chunkOrdinal,
                                                char *sequenceName, Poa *poaHap1, Poa *poaHap2, stList *reads,
                                                stSet *readsBelongingToHap1, stSet *readsBelongingToHap2,
                                                stGenomeFragment *gF, Params *params) {
+    allocProfile_scope(APT_STITCHING);
     outputChunker_processChunkSequencePhased(stList_get(outputChunkers->tempFileChunkers, chunker), chunkOrdinal,
                                              sequenceName,
                                              poaHap1,
                                              poaHap2, reads, readsBelongingToHap1,
                                              readsBelongingToHap2, gF, params);
+    if (outputChunkers->onlineStitcher != NULL) {
+        outputChunkers_stitchChunkOnline(outputChunkers, chunker);
+    } else {
+        outputChunker_spillIfOverMemoryBudget(stList_get(outputChunkers->tempFileChunkers, chunker));
+    }
 }
 
 void outputChunkers_close(OutputChunkers *outputChunkers) {
@@ -1255,20 +2565,6 @@ void outputChunkers_writeChunk(OutputChunkers *outputChunkers, ChunkToStitch *ch
 }
 
 
-void writeReadPartition(stHash *readsInHap, FILE *fh) {
-    /*
-     * Write out the reads for a haplotype in the given file
-     */
-    fprintf(fh, "READ_NAME,PHRED_SCORE_OF_BEING_IN_PARTITION\n");
-    stHashIterator *it = stHash_getIterator(readsInHap);
-    char *readName;
-    while ((readName = stHash_getNext(it)) != NULL) {
-        double *prob = stHash_search(readsInHap, readName);
-        fprintf(fh, "%s,%f\n", readName, *prob);
-    }
-    stHash_destructIterator(it);
-}
-
 void outputChunkers_stitchLinear(OutputChunkers *outputChunkers, bool phased, Params *params) {
     /*
      * Stitch together the outputs using a single thread, but very minimal memory.
@@ -1294,10 +2590,11 @@ void outputChunkers_stitchLinear(OutputChunkers *outputChunkers, bool phased, Pa
     int64_t lengthOfSequenceOutputSoFarHap2 = 0;
 
     // Track the names of the reads in the two haplotypes, if phased
-    stHash *hap1Reads = NULL, *hap2Reads = NULL;
+    PhasedReads *phasedReads = NULL;
     if (phased) {
-        hap1Reads = getReadNames(pChunk->readsHap1Lines);
-        hap2Reads = getReadNames(pChunk->readsHap2Lines);
+        phasedReads = phasedReads_construct();
+        phasedReads_setHaplotype(phasedReads, 0, pChunk->readsHap1Lines);
+        phasedReads_setHaplotype(phasedReads, 1, pChunk->readsHap2Lines);
     }
 
     // Indicate we're at the of beginning a sequences
@@ -1309,7 +2606,7 @@ void outputChunkers_stitchLinear(OutputChunkers *outputChunkers, bool phased, Pa
 
         // If phased, ensure the chunks phasing is consistent
         if (phased) {
-            chunkToStitch_phaseAdjacentChunks(chunk, hap1Reads, hap2Reads, params);
+            chunkToStitch_phaseAdjacentChunks(chunk, phasedReads, params);
         }
 
         // Set the flag determining if this is the start of a new sequence
@@ -1341,8 +2638,8 @@ void outputChunkers_stitchLinear(OutputChunkers *outputChunkers, bool phased, Pa
 
     // Write out the read name phasing, if needed
     if (phased) {
-        writeReadPartition(hap1Reads, outputChunkers->outputChunkerHap1->outputReadPartitionFileHandle);
-        writeReadPartition(hap2Reads, outputChunkers->outputChunkerHap2->outputReadPartitionFileHandle);
+        phasedReads_write(phasedReads, 0, outputChunkers->outputChunkerHap1->outputReadPartitionFileHandle);
+        phasedReads_write(phasedReads, 1, outputChunkers->outputChunkerHap2->outputReadPartitionFileHandle);
     }
 
     // Cleanup
@@ -1351,8 +2648,7 @@ void outputChunkers_stitchLinear(OutputChunkers *outputChunkers, bool phased, Pa
     }
     stSortedSet_destruct(orderedChunks);
     if (phased) {
-        stHash_destruct(hap1Reads);
-        stHash_destruct(hap2Reads);
+        phasedReads_destruct(phasedReads);
     }
 }
 
@@ -1386,22 +2682,9 @@ void updateStitchingChunk(ChunkToStitch *stitched, ChunkToStitch *pChunk, stList
     }
 }
 
-void convertReadPartitionToLines(stHash *readsInHap, stList *readPartitionLines) {
-    /*
-     * Format the output of the reads for a haplotype
-     */
-    stList_append(readPartitionLines, stString_print("READ_NAME,LOG_PROB_OF_BEING_IN_PARTITION\n"));
-    stHashIterator *it = stHash_getIterator(readsInHap);
-    char *readName;
-    while ((readName = stHash_getNext(it)) != NULL) {
-        double *prob = stHash_search(readsInHap, readName);
-        stList_append(readPartitionLines, stString_print("%s,%f\n", readName, *prob));
-    }
-    stHash_destructIterator(it);
-}
-
 ChunkToStitch *mergeContigChunkz(ChunkToStitch **chunks, int64_t startIdx, int64_t endIdxExclusive, bool phased,
         Params *params) {
+    traceRecorder_begin("mergeContigChunkz");
     // for logging
     char *logIdentifier = getLogIdentifier();
     time_t stitchStart = time(NULL);
@@ -1426,10 +2709,11 @@ ChunkToStitch *mergeContigChunkz(ChunkToStitch **chunks, int64_t startIdx, int64
     stList *hap2Seqs = (phased && trackSequence ? stList_construct3(0, free) : NULL);
 
     // Track the names of the reads in the two haplotypes, if phased
-    stHash *hap1Reads, *hap2Reads;
+    PhasedReads *phasedReads = NULL;
     if (phased) {
-        hap1Reads = getReadNames(pChunk->readsHap1Lines);
-        hap2Reads = getReadNames(pChunk->readsHap2Lines);
+        phasedReads = phasedReads_construct();
+        phasedReads_setHaplotype(phasedReads, 0, pChunk->readsHap1Lines);
+        phasedReads_setHaplotype(phasedReads, 1, pChunk->readsHap2Lines);
     }
 
     // Get each successive chunk and stitch and phase progressively
@@ -1441,7 +2725,7 @@ ChunkToStitch *mergeContigChunkz(ChunkToStitch **chunks, int64_t startIdx, int64
 
         // If phased, ensure the chunks phasing is consistent
         if (phased) {
-            chunkToStitch_phaseAdjacentChunks(chunk, hap1Reads, hap2Reads, params);
+            chunkToStitch_phaseAdjacentChunks(chunk, phasedReads, params);
         }
 
         // handles the case where we're not tracking sequences (for very fast)
@@ -1467,16 +2751,15 @@ ChunkToStitch *mergeContigChunkz(ChunkToStitch **chunks, int64_t startIdx, int64
     if (phased) {
         stitched->seqHap2 = trackSequence ? stString_join2("", hap2Seqs) : NULL;
         // Save back the reads in each haplotype to the stitched chunk
-        convertReadPartitionToLines(hap1Reads, stitched->readsHap1Lines);
-        convertReadPartitionToLines(hap2Reads, stitched->readsHap2Lines);
+        phasedReads_convertToLines(phasedReads, 0, stitched->readsHap1Lines);
+        phasedReads_convertToLines(phasedReads, 1, stitched->readsHap2Lines);
     }
 
     // cleanup
     if (trackSequence) stList_destruct(hap1Seqs);
     if (phased) {
         stList_destruct(hap2Seqs);
-        stHash_destruct(hap1Reads);
-        stHash_destruct(hap2Reads);
+        phasedReads_destruct(phasedReads);
     }
 
     // loggit
@@ -1485,12 +2768,55 @@ ChunkToStitch *mergeContigChunkz(ChunkToStitch **chunks, int64_t startIdx, int64
     free(logIdentifier);
 
     // fin
+    traceRecorder_end("mergeContigChunkz");
+    return stitched;
+}
+
+static void flipWasSwitched(ChunkToStitch **chunks, int64_t startIdx, int64_t endIdxExclusive) {
+    for (int64_t i = startIdx; i < endIdxExclusive; i++) {
+        chunks[i]->wasSwitched = !chunks[i]->wasSwitched;
+    }
+}
+
+ChunkToStitch *mergeContigChunkzTree(ChunkToStitch **chunks, int64_t startIdx, int64_t endIdxExclusive,
+                                     int64_t chunksPerLeaf, bool phased, Params *params) {
+    /*
+     * As mergeContigChunkz, but splits the chunks into halves, stitches each half recursively (the first as an OpenMP
+     * task) and then stitches the two halves together, so ranges of at most chunksPerLeaf chunks are stitched
+     * linearly in parallel. If the second half is flipped when phasing it against the first, the wasSwitched
+     * flag of each of its chunks is flipped, so at each level the flags are relative to the first chunk of the range.
+     * Must be called from within a parallel region for the tasks to run concurrently.
+     */
+    if (endIdxExclusive - startIdx <= chunksPerLeaf) {
+        return mergeContigChunkz(chunks, startIdx, endIdxExclusive, phased, params);
+    }
+
+    // Stitch each half
+    int64_t midIdx = startIdx + (endIdxExclusive - startIdx) / 2;
+    ChunkToStitch *halves[2];
+    # ifdef _OPENMP
+    #pragma omp task shared(halves)
+    # endif
+    halves[0] = mergeContigChunkzTree(chunks, startIdx, midIdx, chunksPerLeaf, phased, params);
+    halves[1] = mergeContigChunkzTree(chunks, midIdx, endIdxExclusive, chunksPerLeaf, phased, params);
+    # ifdef _OPENMP
+    #pragma omp taskwait
+    # endif
+
+    // Stitch the halves together
+    halves[0]->seqName = stString_copy(chunks[startIdx]->seqName);
+    halves[1]->seqName = stString_copy(chunks[midIdx]->seqName);
+    ChunkToStitch *stitched = mergeContigChunkz(halves, 0, 2, phased, params);
+    if (halves[1]->wasSwitched) {
+        flipWasSwitched(chunks, midIdx, endIdxExclusive);
+    }
+
+    // cleanup
+    chunkToStitch_destruct(halves[0]);
+    chunkToStitch_destruct(halves[1]);
     return stitched;
 }
 
-//TODO this is currently unused
-// refactored to not use this function.  we now multithread per contig and stitch all chunks linearly within contigs
-// this function is kept here in case we revert back, but can eventually be removed.
 ChunkToStitch *mergeContigChunkzThreaded(ChunkToStitch **chunks, int64_t startIdx, int64_t endIdxExclusive, int64_t numThreads,
                                 bool phased, Params *params, char *referenceSequenceName) {
 
@@ -1500,46 +2826,122 @@ ChunkToStitch *mergeContigChunkzThreaded(ChunkToStitch **chunks, int64_t startId
     // divide into chunks
     int64_t totalChunks = endIdxExclusive - startIdx;
     int64_t chunksPerThread = (int64_t) ceil(1.0 * totalChunks / numThreads);
-    while (startIdx + chunksPerThread * (numThreads - 1) >= endIdxExclusive) {numThreads--;}
-    ChunkToStitch **outputChunks = st_calloc(numThreads, sizeof(ChunkToStitch*));
 
-    // multithread loop
-    st_logInfo("  Merging chunks for %s from (%"PRId64", %"PRId64"] with %"PRId64" chunks per thread on %"PRId64" threads \n",
+    // reduce in parallel
+    st_logInfo("  Merging chunks for %s from (%"PRId64", %"PRId64"] with at most %"PRId64" chunks per task on %"PRId64" threads \n",
                referenceSequenceName, startIdx, endIdxExclusive, chunksPerThread, numThreads);
-    #pragma omp parallel for schedule(static,1)
-    for (int64_t thread = 0; thread < numThreads; thread++) {
-        int64_t threadedStartIdx = startIdx + chunksPerThread * thread;
-        int64_t threadedEndIdxExclusive = threadedStartIdx + chunksPerThread;
-        if (endIdxExclusive < threadedEndIdxExclusive) threadedEndIdxExclusive = endIdxExclusive;
-
-        // merge for this thread
-        outputChunks[thread] = mergeContigChunkz(chunks, threadedStartIdx, threadedEndIdxExclusive, phased, params);
-    }
-
-    // finish
-    ChunkToStitch *stitched = mergeContigChunkz(outputChunks, 0, numThreads, phased, params);
-
-    // update stitching in original chunks
-    #pragma omp parallel for schedule(static,1)
-    for (int64_t thread = 0; thread < numThreads; thread++) {
-        int64_t threadedStartIdx = startIdx + chunksPerThread * thread;
-        int64_t threadedEndIdxExclusive = threadedStartIdx + chunksPerThread;
-        if (endIdxExclusive < threadedEndIdxExclusive) threadedEndIdxExclusive = endIdxExclusive;
-
-        // potentially update all switching
-        if (outputChunks[thread]->wasSwitched) {
-            for (int64_t i = threadedStartIdx; i < threadedEndIdxExclusive; i++) {
-                chunks[i]->wasSwitched = !chunks[i]->wasSwitched;
+    ChunkToStitch *stitched = NULL;
+    traceRecorder_begin("mergeContigChunkzThreaded");
+    # ifdef _OPENMP
+    #pragma omp parallel num_threads(numThreads) if(!omp_in_parallel())
+    #pragma omp single
+    # endif
+    stitched = mergeContigChunkzTree(chunks, startIdx, endIdxExclusive, chunksPerThread, phased, params);
+    traceRecorder_end("mergeContigChunkzThreaded");
+
+    return stitched;
+}
+
+static void outputChunkers_writeStitchedContig(OutputChunkers *outputChunkers, ChunkToStitch *stitched,
+                                               stList *readIdsHap1, stList *readIdsHap2) {
+    /*
+     * Writes a stitched contig to the final output files, tracks its read ids if requested and destroys it.
+     */
+
+    // write contents
+    outputChunkers_writeChunk(outputChunkers, stitched);
+
+    // to write to bam, we need to add all these
+    if (readIdsHap1 != NULL && readIdsHap2 != NULL) {
+        appendReadNames(stitched->readsHap1Lines, readIdsHap1);
+        appendReadNames(stitched->readsHap2Lines, readIdsHap2);
+    }
+
+    // Clean up
+    chunkToStitch_destruct(stitched);
+}
+
+void outputChunkers_setReferenceSplicing(OutputChunkers *outputChunkers, char *referenceFastaFile,
+                                         BamChunker *bamChunker) {
+    if (outputChunkers->onlineStitcher != NULL) {
+        st_errAbort("Stitched sequences can not be spliced into the reference when stitching online\n");
+    }
+    outputChunkers->spliceReferenceFile = stString_copy(referenceFastaFile);
+    outputChunkers->spliceChunker = bamChunker;
+}
+
+static void outputChunkers_writeSplicedContigs(OutputChunkers *outputChunkers, ChunkToStitch **stitchedRuns,
+                                               stList *runChunkPositions, stList *readIdsHap1, stList *readIdsHap2) {
+    /*
+     * Writes every sequence of the reference, with the stitched runs of chunks spliced in place of the intervals of
+     * the reference they cover, tracks the runs' read ids if requested and destroys the runs.
+     */
+    faidx_t *fai = fai_load_format(outputChunkers->spliceReferenceFile, FAI_FASTA);
+    if (fai == NULL) {
+        st_errAbort("[faidx] Could not load fai index of %s\n", outputChunkers->spliceReferenceFile);
+    }
+    bool hap2 = outputChunkers->outputChunkerHap2 != NULL;
+    int64_t runIdx = 0, splicedRunNo = 0;
+    for (int64_t i = 0; i < faidx_nseq(fai); i++) {
+        char *seqName = (char *) faidx_iseq(fai, i);
+        int seqLength = faidx_seq_len(fai, seqName), fetchedLength;
+        char *refSeq = faidx_fetch_seq(fai, seqName, 0, seqLength - 1, &fetchedLength);
+        if (refSeq == NULL) {
+            st_errAbort("ERROR: Could not fetch %s from %s\n", seqName, outputChunkers->spliceReferenceFile);
+        }
+
+        // the unmodified reference between the runs on the sequence, which are in order
+        stList *hap1Pieces = stList_construct3(0, free);
+        stList *hap2Pieces = stList_construct3(0, free);
+        int64_t refPos = 0;
+        while (runIdx < stList_length(runChunkPositions) && stString_eq(stitchedRuns[runIdx]->seqName, seqName)) {
+            stIntTuple *runChunkPos = stList_get(runChunkPositions, runIdx);
+            BamChunk *firstChunk = stList_get(outputChunkers->spliceChunker->chunks, stIntTuple_get(runChunkPos, 0));
+            BamChunk *lastChunk = stList_get(outputChunkers->spliceChunker->chunks, stIntTuple_get(runChunkPos, 1) - 1);
+            assert(firstChunk->chunkOverlapStart >= refPos);
+            ChunkToStitch *run = stitchedRuns[runIdx];
+            char *refPiece = stString_getSubString(refSeq, refPos, firstChunk->chunkOverlapStart - refPos);
+            stList_append(hap1Pieces, stString_copy(refPiece));
+            stList_append(hap1Pieces, stString_copy(run->seqHap1));
+            if (hap2) {
+                stList_append(hap2Pieces, stString_copy(refPiece));
+                stList_append(hap2Pieces, stString_copy(run->seqHap2 == NULL ? run->seqHap1 : run->seqHap2));
+            }
+            free(refPiece);
+            refPos = lastChunk->chunkOverlapEnd;
+            if (readIdsHap1 != NULL && readIdsHap2 != NULL) {
+                appendReadNames(run->readsHap1Lines, readIdsHap1);
+                appendReadNames(run->readsHap2Lines, readIdsHap2);
             }
+            chunkToStitch_destruct(run);
+            runIdx++;
+            splicedRunNo++;
+        }
+        stList_append(hap1Pieces, stString_copy(&(refSeq[refPos])));
+        if (hap2) {
+            stList_append(hap2Pieces, stString_copy(&(refSeq[refPos])));
         }
 
-        // cleanup
-        chunkToStitch_destruct(outputChunks[thread]);
-    }
+        // write the spliced sequence
+        ChunkToStitch *spliced = chunkToStitch_construct(stString_copy(seqName), 0, FALSE, FALSE, FALSE);
+        spliced->startOfSequence = TRUE;
+        spliced->seqHap1 = stString_join2("", hap1Pieces);
+        spliced->seqHap2 = hap2 ? stString_join2("", hap2Pieces) : NULL;
+        outputChunkers_writeChunk(outputChunkers, spliced);
 
-    // cleanup
-    free(outputChunks); //these chunks were freed after switching
-    return stitched;
+        // cleanup
+        chunkToStitch_destruct(spliced);
+        stList_destruct(hap1Pieces);
+        stList_destruct(hap2Pieces);
+        free(refSeq);
+    }
+    if (runIdx != stList_length(runChunkPositions)) {
+        st_errAbort("The stitched sequence of %s is not in the order of the sequences of %s\n",
+                    stitchedRuns[runIdx]->seqName, outputChunkers->spliceReferenceFile);
+    }
+    st_logCritical("> Spliced %"PRId64" polished intervals into the %"PRId64" sequences of %s\n", splicedRunNo,
+                   (int64_t) faidx_nseq(fai), outputChunkers->spliceReferenceFile);
+    fai_destroy(fai);
 }
 
 void outputChunkers_stitch(OutputChunkers *outputChunkers, bool phased, int64_t chunkCount) {
@@ -1547,6 +2949,7 @@ void outputChunkers_stitch(OutputChunkers *outputChunkers, bool phased, int64_t
 }
 void outputChunkers_stitchAndTrackExtraData(OutputChunkers *outputChunkers, bool phased, int64_t chunkCount,
                                             stList *readIdsHap1, stList *readIdsHap2, bool* switchedState) {
+    allocProfile_scope(APT_STITCHING);
 
     // prep for merge
     assert(chunkCount > 0);
@@ -1600,8 +3003,12 @@ void outputChunkers_stitchAndTrackExtraData(OutputChunkers *outputChunkers, bool
     // find which chunks belong to each contig
     for (int64_t chunkIdx = 1; chunkIdx <= chunkCount; chunkIdx++) {
 
-        // we encountered the last chunk in the contig (end of list or new refSeqName)
-        if (chunkIdx == chunkCount || !stString_eq(referenceSequenceName, chunks[chunkIdx]->seqName)) {
+        // we encountered the last chunk in the contig (end of list or new refSeqName), or when splicing in the run
+        // of overlapping chunks
+        if (chunkIdx == chunkCount || !stString_eq(referenceSequenceName, chunks[chunkIdx]->seqName) ||
+            (outputChunkers->spliceChunker != NULL &&
+             ((BamChunk *) stList_get(outputChunkers->spliceChunker->chunks, chunkIdx))->chunkOverlapStart >
+             ((BamChunk *) stList_get(outputChunkers->spliceChunker->chunks, chunkIdx - 1))->chunkOverlapEnd)) {
 
             stList_append(contigChunkPositions, stIntTuple_construct2(contigStartIdx, chunkIdx));
             stList_append(contigNames, referenceSequenceName);
@@ -1618,56 +3025,58 @@ void outputChunkers_stitchAndTrackExtraData(OutputChunkers *outputChunkers, bool
 
     ChunkToStitch **stitchedContigs = st_calloc(stList_length(contigChunkPositions), sizeof(ChunkToStitch*));
 
-    // in parallel, stitch each contig linearly
-    #pragma omp parallel for schedule(static,1)
+    // split long contigs so that there are a few ranges of chunks stitched linearly for every thread, with one
+    // thread every contig is stitched linearly
+    int64_t chunksPerLeaf = chunkCount;
+    # ifdef _OPENMP
+    if (omp_get_max_threads() > 1) {
+        chunksPerLeaf = chunkCount / (4 * omp_get_max_threads());
+        if (chunksPerLeaf < 2) chunksPerLeaf = 2;
+    }
+    # endif
+
+    // in parallel, stitch each contig as a task, reducing long contigs as a tree of tasks
+    # ifdef _OPENMP
+    #pragma omp parallel
+    #pragma omp single
+    # endif
     for (int64_t contigIdx = 0; contigIdx < stList_length(contigChunkPositions); contigIdx++) {
-        // get indices
-        stIntTuple *contigChunkPos = stList_get(contigChunkPositions, contigIdx);
-        int64_t startIdx = stIntTuple_get(contigChunkPos, 0);
-        int64_t endIdxExcl = stIntTuple_get(contigChunkPos, 1);
-
-        // merge and write out
-        ChunkToStitch *stitched = mergeContigChunkz(chunks, startIdx, endIdxExcl, phased, outputChunkers->params);
-        stitched->seqName = stString_copy(stList_get(contigNames, contigIdx));
-        stitched->startOfSequence = true;
-
-        // update stitched state
-        for (int64_t i = startIdx; i < endIdxExcl; i++) {
-            if (switchedState != NULL) {
-                switchedState[i] = chunks[i]->wasSwitched;
+        # ifdef _OPENMP
+        #pragma omp task firstprivate(contigIdx)
+        # endif
+        {
+            // get indices
+            stIntTuple *contigChunkPos = stList_get(contigChunkPositions, contigIdx);
+            int64_t startIdx = stIntTuple_get(contigChunkPos, 0);
+            int64_t endIdxExcl = stIntTuple_get(contigChunkPos, 1);
+
+            // merge and write out
+            ChunkToStitch *stitched = mergeContigChunkzTree(chunks, startIdx, endIdxExcl, chunksPerLeaf, phased,
+                                                            outputChunkers->params);
+            stitched->seqName = stString_copy(stList_get(contigNames, contigIdx));
+            stitched->startOfSequence = true;
+
+            // update stitched state
+            for (int64_t i = startIdx; i < endIdxExcl; i++) {
+                if (switchedState != NULL) {
+                    switchedState[i] = chunks[i]->wasSwitched;
+                }
+                chunkToStitch_destruct(chunks[i]);
             }
-            chunkToStitch_destruct(chunks[i]);
+            stitchedContigs[contigIdx] = stitched;
         }
-        stitchedContigs[contigIdx] = stitched;
     }
 
     // write everything single-threaded
-    for (int64_t contigIdx = 0; contigIdx < stList_length(contigChunkPositions); contigIdx++) {
-        ChunkToStitch *stitched = stitchedContigs[contigIdx];
-
-        // write contents
-        outputChunkers_writeChunk(outputChunkers, stitched);
+    if (outputChunkers->spliceReferenceFile != NULL && outputChunkers->outputChunkerHap1->outputSequenceFile != NULL) {
+        outputChunkers_writeSplicedContigs(outputChunkers, stitchedContigs, contigChunkPositions, readIdsHap1,
+                                           readIdsHap2);
+    } else {
+        for (int64_t contigIdx = 0; contigIdx < stList_length(contigChunkPositions); contigIdx++) {
+            ChunkToStitch *stitched = stitchedContigs[contigIdx];
 
-        // to write to bam, we need to add all these
-        if (readIdsHap1 != NULL && readIdsHap2 != NULL) {
-            stHash *chunkReadToProbHap1 = getReadNames(stitched->readsHap1Lines);
-            stHash *chunkReadToProbHap2 = getReadNames(stitched->readsHap2Lines);
-            stList *chunkReadsHap1 = stHash_getKeys(chunkReadToProbHap1);
-            stList *chunkReadsHap2 = stHash_getKeys(chunkReadToProbHap2);
-            stList_appendAll(readIdsHap1, chunkReadsHap1);
-            stList_appendAll(readIdsHap2, chunkReadsHap2);
-            stHash_setDestructKeys(chunkReadToProbHap1, NULL);
-            stHash_setDestructKeys(chunkReadToProbHap2, NULL);
-            stList_setDestructor(chunkReadsHap1, NULL);
-            stList_setDestructor(chunkReadsHap2, NULL);
-            stHash_destruct(chunkReadToProbHap1);
-            stHash_destruct(chunkReadToProbHap2);
-            stList_destruct(chunkReadsHap1);
-            stList_destruct(chunkReadsHap2);
+            outputChunkers_writeStitchedContig(outputChunkers, stitched, readIdsHap1, readIdsHap2);
         }
-
-        // Clean up
-        chunkToStitch_destruct(stitched);
     }
 
 
@@ -1680,6 +3089,259 @@ void outputChunkers_stitchAndTrackExtraData(OutputChunkers *outputChunkers, bool
 }
 
 
+/*
+ * Online stitching
+ */
+
+void outputChunkers_startOnlineStitching(OutputChunkers *outputChunkers, bool phased, int64_t chunkCount,
+                                         stList *readIdsHap1, stList *readIdsHap2, bool *switchedState) {
+    /*
+     * Switches the output chunkers to stitching each chunk as soon as it and all the chunks before it in
+     * the ordinal order have been processed. Each contig is written to the final output once its last
+     * chunk is stitched and the chunks' buffers are freed straight away, so the temporary output for the
+     * whole genome is never held at once. Must be called before any chunks are processed, and
+     * outputChunkers_finishOnlineStitching must then be called instead of outputChunkers_stitch*.
+     */
+    assert(outputChunkers->onlineStitcher == NULL);
+
+    // Chunks are read back as soon as they are written, so use in-memory temporary chunkers
+    for (int64_t i = 0; i < stList_length(outputChunkers->tempFileChunkers); i++) {
+        OutputChunker *outputChunker = stList_get(outputChunkers->tempFileChunkers, i);
+        if (!outputChunker->useMemoryBuffers) {
+            OutputChunker *inMemoryChunker = outputChunker->useChunkRecords ?
+                    outputChunker_constructChunkRecords(outputChunkers->params, NULL, 1,
+                                                        outputChunker->outputSequence,
+                                                        outputChunker->outputPoa,
+                                                        outputChunker->outputReadPartition,
+                                                        outputChunker->outputRepeatCounts,
+                                                        outputChunker->compressChunkRecords) :
+                    outputChunker_constructInMemory(outputChunkers->params,
+                                                    outputChunker->outputSequence,
+                                                    outputChunker->outputPoa,
+                                                    outputChunker->outputReadPartition,
+                                                    outputChunker->outputRepeatCounts);
+            inMemoryChunker->chunkJournal = outputChunker->chunkJournal;
+            outputChunker_closeAndDeleteFiles(outputChunker);
+            outputChunker_destruct(outputChunker);
+            stList_set(outputChunkers->tempFileChunkers, i, inMemoryChunker);
+        }
+    }
+
+    OnlineStitcher *onlineStitcher = st_calloc(1, sizeof(OnlineStitcher));
+    onlineStitcher->phased = phased;
+    onlineStitcher->chunkCount = chunkCount;
+    onlineStitcher->pendingChunks = st_calloc(chunkCount, sizeof(ChunkToStitch *));
+    onlineStitcher->readIdsHap1 = readIdsHap1;
+    onlineStitcher->readIdsHap2 = readIdsHap2;
+    onlineStitcher->switchedState = switchedState;
+    outputChunkers->onlineStitcher = onlineStitcher;
+}
+
+void outputChunkers_setOnlineStitchingCallback(OutputChunkers *outputChunkers,
+                                               void (*chunkStitched)(int64_t chunkOrdinal, bool wasSwitched,
+                                                                     void *extraArg),
+                                               void *extraArg) {
+    assert(outputChunkers->onlineStitcher != NULL);
+    outputChunkers->onlineStitcher->chunkStitched = chunkStitched;
+    outputChunkers->onlineStitcher->chunkStitchedArg = extraArg;
+}
+
+static ChunkToStitch *outputChunker_takeChunk(OutputChunker *outputChunker, bool phased) {
+    /*
+     * Reads back the single chunk just written to an in-memory chunker and resets its buffers.
+     */
+    assert(outputChunker->useMemoryBuffers);
+    outputChunker_close(outputChunker);
+    outputChunker_open(outputChunker, "r");
+    ChunkToStitch *chunk = outputChunker_readChunk(outputChunker, phased);
+    if (chunk == NULL) {
+        st_errAbort("Expected a chunk in the temporary output but found none");
+    }
+    outputChunker_close(outputChunker);
+
+    // Free the buffers and start again with empty ones
+    free(outputChunker->outputSequenceFile);
+    free(outputChunker->outputPoaFile);
+    free(outputChunker->outputRepeatCountFile);
+    free(outputChunker->outputReadPartitionFile);
+    free(outputChunker->outputChunkRecordFile);
+    outputChunker->outputSequenceFile = NULL;
+    outputChunker->outputChunkRecordFile = NULL;
+    outputChunker->outputPoaFile = NULL;
+    outputChunker->outputRepeatCountFile = NULL;
+    outputChunker->outputReadPartitionFile = NULL;
+    outputChunker_open(outputChunker, "w");
+
+    return chunk;
+}
+
+static void onlineStitcher_finishChunk(OnlineStitcher *onlineStitcher, ChunkToStitch *chunk) {
+    if (onlineStitcher->switchedState != NULL) {
+        onlineStitcher->switchedState[chunk->chunkOrdinal] = chunk->wasSwitched;
+    }
+    if (onlineStitcher->chunkStitched != NULL) {
+        onlineStitcher->chunkStitched(chunk->chunkOrdinal, chunk->wasSwitched, onlineStitcher->chunkStitchedArg);
+    }
+    chunkToStitch_destruct(chunk);
+}
+
+static void onlineStitcher_startContig(OnlineStitcher *onlineStitcher, ChunkToStitch *chunk) {
+    /*
+     * Starts stitching a new contig with its first chunk.
+     */
+    onlineStitcher->trackSequence = chunk->seqHap1 != NULL;
+    onlineStitcher->trackRepeatCounts = chunk->repeatCountLinesHap1 != NULL;
+    onlineStitcher->trackPoa = chunk->poaHap1StringsLines != NULL;
+    onlineStitcher->stitched = chunkToStitch_construct(NULL, -1 * chunk->chunkOrdinal, onlineStitcher->phased,
+                                                       onlineStitcher->trackRepeatCounts, onlineStitcher->trackPoa);
+    onlineStitcher->hap1Seqs = onlineStitcher->trackSequence ? stList_construct3(0, free) : NULL;
+    onlineStitcher->hap2Seqs = onlineStitcher->phased && onlineStitcher->trackSequence ?
+            stList_construct3(0, free) : NULL;
+    if (onlineStitcher->phased) {
+        onlineStitcher->phasedReads = phasedReads_construct();
+        phasedReads_setHaplotype(onlineStitcher->phasedReads, 0, chunk->readsHap1Lines);
+        phasedReads_setHaplotype(onlineStitcher->phasedReads, 1, chunk->readsHap2Lines);
+    }
+    onlineStitcher->lengthOfSequenceOutputSoFarHap1 = 0;
+    onlineStitcher->lengthOfSequenceOutputSoFarHap2 = 0;
+    onlineStitcher->pChunk = chunk;
+}
+
+static void outputChunkers_finishContigOnline(OutputChunkers *outputChunkers) {
+    /*
+     * Adds the last chunk of the current contig, then writes out the contig.
+     */
+    OnlineStitcher *onlineStitcher = outputChunkers->onlineStitcher;
+    ChunkToStitch *stitched = onlineStitcher->stitched;
+    ChunkToStitch *pChunk = onlineStitcher->pChunk;
+
+    if (onlineStitcher->trackSequence) {
+        updateStitchingChunk(stitched, pChunk, onlineStitcher->hap1Seqs, onlineStitcher->hap2Seqs,
+                             onlineStitcher->phased, onlineStitcher->trackPoa, onlineStitcher->trackRepeatCounts);
+    }
+    stitched->seqHap1 = onlineStitcher->trackSequence ? stString_join2("", onlineStitcher->hap1Seqs) : NULL;
+    if (onlineStitcher->phased) {
+        stitched->seqHap2 = onlineStitcher->trackSequence ? stString_join2("", onlineStitcher->hap2Seqs) : NULL;
+        phasedReads_convertToLines(onlineStitcher->phasedReads, 0, stitched->readsHap1Lines);
+        phasedReads_convertToLines(onlineStitcher->phasedReads, 1, stitched->readsHap2Lines);
+    }
+    stitched->seqName = stString_copy(pChunk->seqName);
+    stitched->startOfSequence = true;
+    onlineStitcher_finishChunk(onlineStitcher, pChunk);
+
+    // Write out the contig
+    st_logInfo("> Stitched and wrote out contig %s\n", stitched->seqName);
+    outputChunkers_writeStitchedContig(outputChunkers, stitched, onlineStitcher->readIdsHap1,
+                                       onlineStitcher->readIdsHap2);
+
+    // Cleanup
+    if (onlineStitcher->hap1Seqs != NULL) stList_destruct(onlineStitcher->hap1Seqs);
+    if (onlineStitcher->hap2Seqs != NULL) stList_destruct(onlineStitcher->hap2Seqs);
+    if (onlineStitcher->phased) {
+        phasedReads_destruct(onlineStitcher->phasedReads);
+    }
+    onlineStitcher->hap1Seqs = NULL;
+    onlineStitcher->hap2Seqs = NULL;
+    onlineStitcher->phasedReads = NULL;
+    onlineStitcher->stitched = NULL;
+    onlineStitcher->pChunk = NULL;
+}
+
+static void outputChunkers_addChunkOnline(OutputChunkers *outputChunkers, ChunkToStitch *chunk) {
+    /*
+     * Stitches the next chunk in the ordinal order onto the current contig, does the same steps as
+     * mergeContigChunkz for each successive chunk.
+     */
+    OnlineStitcher *onlineStitcher = outputChunkers->onlineStitcher;
+    ChunkToStitch *pChunk = onlineStitcher->pChunk;
+
+    // Start of a new contig
+    if (pChunk != NULL && !stString_eq(pChunk->seqName, chunk->seqName)) {
+        outputChunkers_finishContigOnline(outputChunkers);
+        pChunk = NULL;
+    }
+    if (pChunk == NULL) {
+        onlineStitcher_startContig(onlineStitcher, chunk);
+        return;
+    }
+
+    // If phased, ensure the chunks phasing is consistent
+    if (onlineStitcher->phased) {
+        chunkToStitch_phaseAdjacentChunks(chunk, onlineStitcher->phasedReads, outputChunkers->params);
+    }
+
+    // handles the case where we're not tracking sequences (for very fast)
+    if (onlineStitcher->trackSequence) {
+        // Trim the overlap between chunks
+        chunkToStitch_trimAdjacentChunks(pChunk, chunk, outputChunkers->params,
+                                         &onlineStitcher->lengthOfSequenceOutputSoFarHap1,
+                                         &onlineStitcher->lengthOfSequenceOutputSoFarHap2);
+
+        // Save to stitched
+        updateStitchingChunk(onlineStitcher->stitched, pChunk, onlineStitcher->hap1Seqs, onlineStitcher->hap2Seqs,
+                             onlineStitcher->phased, onlineStitcher->trackPoa, onlineStitcher->trackRepeatCounts);
+    }
+
+    // The previous chunk is no longer needed
+    onlineStitcher_finishChunk(onlineStitcher, pChunk);
+    onlineStitcher->pChunk = chunk;
+}
+
+static void outputChunkers_stitchChunkOnline(OutputChunkers *outputChunkers, int64_t chunker) {
+    /*
+     * Takes the chunk just written by the given chunker and stitches it, along with any chunks that were
+     * waiting on it, if all the chunks before it are done.
+     */
+    allocProfile_scope(APT_STITCHING);
+    traceRecorder_begin("outputChunkers_stitchChunkOnline");
+    OnlineStitcher *onlineStitcher = outputChunkers->onlineStitcher;
+    ChunkToStitch *chunk = outputChunker_takeChunk(stList_get(outputChunkers->tempFileChunkers, chunker),
+                                                   onlineStitcher->phased);
+
+    # ifdef _OPENMP
+    #pragma omp critical (onlineStitching)
+    # endif
+    {
+        if (chunk->chunkOrdinal < onlineStitcher->nextChunkOrdinal || chunk->chunkOrdinal >= onlineStitcher->chunkCount ||
+            onlineStitcher->pendingChunks[chunk->chunkOrdinal] != NULL) {
+            st_errAbort("Encountered chunk %"PRId64" twice or out of range while stitching\n", chunk->chunkOrdinal);
+        }
+        onlineStitcher->pendingChunks[chunk->chunkOrdinal] = chunk;
+        while (onlineStitcher->nextChunkOrdinal < onlineStitcher->chunkCount &&
+               onlineStitcher->pendingChunks[onlineStitcher->nextChunkOrdinal] != NULL) {
+            ChunkToStitch *nextChunk = onlineStitcher->pendingChunks[onlineStitcher->nextChunkOrdinal];
+            onlineStitcher->pendingChunks[onlineStitcher->nextChunkOrdinal++] = NULL;
+            outputChunkers_addChunkOnline(outputChunkers, nextChunk);
+        }
+    }
+    traceRecorder_end("outputChunkers_stitchChunkOnline");
+}
+
+void outputChunkers_finishOnlineStitching(OutputChunkers *outputChunkers) {
+    /*
+     * Writes out the last contig, checking that every chunk was stitched.
+     */
+    OnlineStitcher *onlineStitcher = outputChunkers->onlineStitcher;
+    assert(onlineStitcher != NULL);
+    if (onlineStitcher->nextChunkOrdinal != onlineStitcher->chunkCount) {
+        st_errAbort("Missing chunk %"PRId64" of %"PRId64" when finishing stitching\n",
+                    onlineStitcher->nextChunkOrdinal, onlineStitcher->chunkCount);
+    }
+    if (onlineStitcher->pChunk != NULL) {
+        outputChunkers_finishContigOnline(outputChunkers);
+    }
+    free(onlineStitcher->pendingChunks);
+    free(onlineStitcher);
+    outputChunkers->onlineStitcher = NULL;
+}
+
+void outputChunkers_discardOutput(OutputChunkers *outputChunkers) {
+    outputChunker_closeAndDeleteFiles(outputChunkers->outputChunkerHap1);
+    if (outputChunkers->outputChunkerHap2 != NULL) {
+        outputChunker_closeAndDeleteFiles(outputChunkers->outputChunkerHap2);
+    }
+}
+
 void outputChunkers_destruct(OutputChunkers *outputChunkers) {
     // Close the file streams and delete the temporary files of the temp file chunkers
     for (int64_t i = 0; i < stList_length(outputChunkers->tempFileChunkers); i++) {
@@ -1688,14 +3350,236 @@ void outputChunkers_destruct(OutputChunkers *outputChunkers) {
     time_t start = time(NULL);
     // Now cleanup the temp file chunkers
     stList_destruct(outputChunkers->tempFileChunkers);
+    // Cleanup any unfinished online stitching
+    if (outputChunkers->onlineStitcher != NULL) {
+        free(outputChunkers->onlineStitcher->pendingChunks);
+        free(outputChunkers->onlineStitcher);
+    }
+    // Close the chunk journal, leaving it on disk
+    if (outputChunkers->chunkJournal != NULL) {
+        chunkJournal_destruct(outputChunkers->chunkJournal);
+    }
     // Cleanup the final output chunkers
     outputChunker_destruct(outputChunkers->outputChunkerHap1);
     if (outputChunkers->outputChunkerHap2 != NULL) {
         outputChunker_destruct(outputChunkers->outputChunkerHap2);
     }
+    if (outputChunkers->spliceReferenceFile != NULL) {
+        free(outputChunkers->spliceReferenceFile);
+    }
     free(outputChunkers);
     char *timeDes = getTimeDescriptorFromSeconds(time(NULL) - start);
     st_logInfo("    Closed remaining output chunking infrastructure in %s\n", timeDes);
     free(timeDes);
 
-}
\ No newline at end of file
+}
+
+int64_t outputChunkers_openChunkJournal(OutputChunkers *outputChunkers, char *journalFile, uint64_t fingerprint,
+                                        int64_t chunkCount) {
+    /*
+     * Makes the chunkers journal each chunk record they write, returning the number of chunks already journaled.
+     */
+    assert(outputChunkers->chunkJournal == NULL);
+    for (int64_t i = 0; i < stList_length(outputChunkers->tempFileChunkers); i++) {
+        if (!((OutputChunker *) stList_get(outputChunkers->tempFileChunkers, i))->useChunkRecords) {
+            st_errAbort("The chunk journal can only be used with the useBinaryChunkRecords parameter\n");
+        }
+    }
+    outputChunkers->chunkJournal = chunkJournal_construct(journalFile, fingerprint, chunkCount);
+    for (int64_t i = 0; i < stList_length(outputChunkers->tempFileChunkers); i++) {
+        ((OutputChunker *) stList_get(outputChunkers->tempFileChunkers, i))->chunkJournal =
+                outputChunkers->chunkJournal;
+    }
+    return outputChunkers->chunkJournal->journaledChunkNo;
+}
+
+bool outputChunkers_isChunkJournaled(OutputChunkers *outputChunkers, int64_t chunkOrdinal) {
+    return outputChunkers->chunkJournal != NULL && outputChunkers->chunkJournal->recordOffsets[chunkOrdinal] != -1;
+}
+
+void outputChunkers_journalChunkData(OutputChunkers *outputChunkers, int64_t chunkOrdinal, char *data,
+                                     size_t length) {
+    assert(outputChunkers->chunkJournal != NULL);
+    chunkJournal_append(outputChunkers->chunkJournal, CHUNK_JOURNAL_DATA, chunkOrdinal, data, length, NULL, 0);
+}
+
+char *outputChunkers_getJournaledChunkData(OutputChunkers *outputChunkers, int64_t chunkOrdinal, size_t *length) {
+    ChunkJournal *chunkJournal = outputChunkers->chunkJournal;
+    if (!outputChunkers_isChunkJournaled(outputChunkers, chunkOrdinal) ||
+        chunkJournal->dataOffsets[chunkOrdinal] == -1) {
+        return NULL;
+    }
+    *length = chunkJournal->dataLengths[chunkOrdinal];
+    return chunkJournal_readBytes(chunkJournal, chunkJournal->dataOffsets[chunkOrdinal], *length);
+}
+
+void outputChunkers_setChunkCache(OutputChunkers *outputChunkers, char *cacheDirectory) {
+    ChunkJournal *chunkJournal = outputChunkers->chunkJournal;
+    assert(chunkJournal != NULL && chunkJournal->cacheDirectory == NULL);
+    if (mkdir(cacheDirectory, 0777) != 0 && errno != EEXIST) {
+        st_errAbort("Could not make the chunk cache directory %s\n", cacheDirectory);
+    }
+    chunkJournal->cacheDirectory = stString_copy(cacheDirectory);
+}
+
+static void chunkJournal_appendReusedChunk(ChunkJournal *chunkJournal, int64_t chunkOrdinal, char *data,
+                                           uint64_t dataLength, char *record, uint64_t recordLength) {
+    /*
+     * Journals a chunk of another run, with its data (if not NULL) and record, which is renumbered in place.
+     */
+    // the data goes first, as a chunk is only taken to be journaled once its record is
+    if (data != NULL) {
+        chunkJournal_append(chunkJournal, CHUNK_JOURNAL_DATA, chunkOrdinal, data, dataLength, NULL, 0);
+    }
+    // the record is of the other run's chunk, so is renumbered
+    memcpy(record + sizeof(uint32_t), &chunkOrdinal, sizeof(int64_t));
+    chunkJournal_append(chunkJournal, CHUNK_JOURNAL_RECORD, chunkOrdinal, record, recordLength, NULL, 0);
+}
+
+static char *chunkJournal_getInputKey(BamChunk *bamChunk, uint64_t settingsFingerprint, uint64_t inputFingerprint) {
+    return stString_print("%" PRIu64 "\t%s\t%" PRIi64 "\t%" PRIi64 "\t%" PRIu64, settingsFingerprint,
+                          bamChunk->refSeqName, bamChunk->chunkOverlapStart, bamChunk->chunkOverlapEnd,
+                          inputFingerprint);
+}
+
+int64_t outputChunkers_journalChunkInputKeys(OutputChunkers *outputChunkers, char **inputKeys, int64_t fromChunk,
+                                             int64_t toChunk, char *previousJournalFile) {
+    ChunkJournal *chunkJournal = outputChunkers->chunkJournal;
+    assert(chunkJournal != NULL && toChunk <= chunkJournal->chunkCount);
+
+    // the chunks of the previous run, by their input keys
+    ChunkJournal *previousJournal = NULL;
+    stHash *previousChunks = NULL;
+    if (previousJournalFile != NULL) {
+        previousJournal = chunkJournal_constructFromPrevious(previousJournalFile);
+        previousChunks = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, free, NULL);
+        for (int64_t j = 0; j < previousJournal->chunkCount; j++) {
+            if (previousJournal->recordOffsets[j] == -1 || previousJournal->inputOffsets[j] == -1) continue;
+            char *inputKey = chunkJournal_readBytes(previousJournal, previousJournal->inputOffsets[j],
+                                                    previousJournal->inputLengths[j]);
+            if (stHash_search(previousChunks, inputKey) == NULL) {
+                stHash_insert(previousChunks, inputKey, (void *) (j + 1));
+            } else {
+                free(inputKey);
+            }
+        }
+    }
+
+    // journal the inputs, superseding a journaled chunk whose inputs have changed since, then copy the previous run's
+    // chunk if its inputs were the same, or else the cached chunk
+    int64_t reusedChunkNo = 0, cachedChunkNo = 0, supersededChunkNo = 0;
+    for (int64_t i = fromChunk; i < toChunk; i++) {
+        if (inputKeys[i] == NULL) continue;
+        if (chunkJournal->recordOffsets[i] != -1) {
+            char *journaledInputKey = chunkJournal->inputOffsets[i] == -1 ? NULL :
+                                      chunkJournal_readBytes(chunkJournal, chunkJournal->inputOffsets[i],
+                                                             chunkJournal->inputLengths[i]);
+            bool unchanged = journaledInputKey != NULL && stString_eq(journaledInputKey, inputKeys[i]);
+            free(journaledInputKey);
+            if (unchanged) continue;
+            supersededChunkNo++;
+        }
+        chunkJournal_append(chunkJournal, CHUNK_JOURNAL_INPUT, i, inputKeys[i], strlen(inputKeys[i]), NULL, 0);
+        int64_t j = previousChunks == NULL ? -1 : (int64_t) stHash_search(previousChunks, inputKeys[i]) - 1;
+        if (chunkJournal->recordOffsets[i] == -1 && j >= 0) {
+            char *data = previousJournal->dataOffsets[j] == -1 ? NULL :
+                         chunkJournal_readBytes(previousJournal, previousJournal->dataOffsets[j],
+                                                previousJournal->dataLengths[j]);
+            char *record = chunkJournal_readBytes(previousJournal, previousJournal->recordOffsets[j],
+                                                  previousJournal->recordLengths[j]);
+            if (previousJournal->recordLengths[j] < CHUNK_RECORD_HEADER_LENGTH) {
+                st_errAbort("Chunk %" PRIi64 " of the previous chunk journal %s is not a chunk record\n", j,
+                            previousJournalFile);
+            }
+            chunkJournal_appendReusedChunk(chunkJournal, i, data, previousJournal->dataLengths[j], record,
+                                           previousJournal->recordLengths[j]);
+            // and it is added to the cache, as a computed chunk would be
+            chunkJournal_cacheChunk(chunkJournal, i, record, previousJournal->recordLengths[j], NULL, 0);
+            free(data);
+            free(record);
+            reusedChunkNo++;
+        }
+        char *data, *record;
+        uint64_t dataLength, recordLength;
+        if (chunkJournal->recordOffsets[i] == -1 && chunkJournal->cacheDirectory != NULL &&
+            chunkJournal_readCachedChunk(chunkJournal, inputKeys[i], &data, &dataLength, &record, &recordLength)) {
+            if (recordLength >= CHUNK_RECORD_HEADER_LENGTH) {
+                chunkJournal_appendReusedChunk(chunkJournal, i, data, dataLength, record, recordLength);
+                cachedChunkNo++;
+            }
+            free(data);
+            free(record);
+        }
+    }
+    if (previousJournal != NULL) {
+        st_logCritical("> Reused %" PRIi64 " of %" PRIi64 " chunks with unchanged inputs from previous chunk journal "
+                       "%s\n", reusedChunkNo, toChunk - fromChunk, previousJournalFile);
+        stHash_destruct(previousChunks);
+        chunkJournal_destruct(previousJournal);
+    }
+    if (chunkJournal->cacheDirectory != NULL) {
+        st_logCritical("> Reused %" PRIi64 " of %" PRIi64 " chunks with unchanged inputs from chunk cache %s\n",
+                       cachedChunkNo, toChunk - fromChunk, chunkJournal->cacheDirectory);
+    }
+    if (supersededChunkNo > 0) {
+        st_logCritical("> Dropped %" PRIi64 " journaled chunks whose inputs have changed\n", supersededChunkNo);
+    }
+    return reusedChunkNo + cachedChunkNo - supersededChunkNo;
+}
+
+int64_t outputChunkers_journalChunkInputs(OutputChunkers *outputChunkers, BamChunker *bamChunker,
+                                          char *referenceFile, int64_t fromChunk, int64_t toChunk,
+                                          uint64_t settingsFingerprint, char *previousJournalFile) {
+    ChunkJournal *chunkJournal = outputChunkers->chunkJournal;
+    assert(chunkJournal != NULL && chunkJournal->chunkCount == bamChunker->chunkCount);
+
+    // the input keys of the chunks, journaled or not, made in parallel as each reads the chunk's alignments
+    char **inputKeys = st_calloc(bamChunker->chunkCount, sizeof(char *));
+    time_t start = time(NULL);
+    # ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic,1)
+    # endif
+    for (int64_t i = fromChunk; i < toChunk; i++) {
+        BamChunk *bamChunk = stList_get(bamChunker->chunks, i);
+        inputKeys[i] = chunkJournal_getInputKey(bamChunk, settingsFingerprint,
+                                                bamChunk_getInputFingerprint(bamChunk, referenceFile,
+                                                                             CHUNK_JOURNAL_FINGERPRINT_SEED));
+    }
+    st_logInfo("> Fingerprinted the inputs of chunks %" PRIi64 " to %" PRIi64 " in %" PRIi64 "s\n", fromChunk,
+               toChunk - 1, (int64_t) (time(NULL) - start));
+
+    int64_t journaledChunkChange = outputChunkers_journalChunkInputKeys(outputChunkers, inputKeys, fromChunk,
+                                                                        toChunk, previousJournalFile);
+    for (int64_t i = fromChunk; i < toChunk; i++) {
+        free(inputKeys[i]);
+    }
+    free(inputKeys);
+    return journaledChunkChange;
+}
+
+void outputChunkers_replayChunkJournal(OutputChunkers *outputChunkers) {
+    /*
+     * Passes the journaled chunks to the first chunker, as if they had just been processed, so they are stitched
+     * along with the rest.
+     */
+    ChunkJournal *chunkJournal = outputChunkers->chunkJournal;
+    assert(chunkJournal != NULL);
+    OutputChunker *outputChunker = stList_get(outputChunkers->tempFileChunkers, 0);
+    for (int64_t i = 0; i < chunkJournal->chunkCount; i++) {
+        if (chunkJournal->recordOffsets[i] == -1) {
+            continue;
+        }
+        char *record = chunkJournal_readBytes(chunkJournal, chunkJournal->recordOffsets[i],
+                                              chunkJournal->recordLengths[i]);
+        if (fwrite(record, 1, chunkJournal->recordLengths[i], outputChunker->outputChunkRecordFileHandle) !=
+            chunkJournal->recordLengths[i]) {
+            st_errAbort("Failed to write journaled chunk %" PRIi64 " to the temporary output\n", i);
+        }
+        free(record);
+        if (outputChunkers->onlineStitcher != NULL) {
+            outputChunkers_stitchChunkOnline(outputChunkers, 0);
+        } else {
+            outputChunker_spillIfOverMemoryBudget(outputChunker);
+        }
+    }
+}
@@ -5,6 +5,7 @@
 #include "margin.h"
 #include <htslib/hts.h>
 #include <htslib/vcf.h>
+#include <htslib/tbx.h>
 #include <htslib/kstring.h>
 #include <htslib/kseq.h>
 
@@ -33,11 +34,38 @@ VcfEntry *vcfEntry_construct(const char *refSeqName, int64_t refPos, int64_t raw
     return vcfEntry;
 }
 
+VcfEntry *vcfEntry_constructView(VcfEntry *rootVcfEntry, int64_t refPos) {
+    /*
+     * Makes a chunk's entry for the root entry, at the chunk's refPos. The view shares the immutable name and
+     * alleles of the root, so only the chunk's own state is allocated. The reads supporting each allele are only
+     * recorded in the root entry.
+     */
+    VcfEntry *vcfEntry = st_calloc(1, sizeof(VcfEntry));
+    vcfEntry->refSeqName = rootVcfEntry->refSeqName;
+    vcfEntry->refPos = refPos;
+    vcfEntry->rawRefPosInformativeOnly = rootVcfEntry->rawRefPosInformativeOnly;
+    vcfEntry->quality = rootVcfEntry->quality;
+    vcfEntry->alleles = rootVcfEntry->alleles;
+    vcfEntry->gt1 = rootVcfEntry->gt1;
+    vcfEntry->gt2 = rootVcfEntry->gt2;
+    vcfEntry->alleleSubstrings = NULL;
+    vcfEntry->refAlnStart = -1;
+    vcfEntry->refAlnStopIncl = -1;
+    vcfEntry->alleleIdxToReads = NULL;
+    vcfEntry->rootVcfEntry = rootVcfEntry;
+    vcfEntry->genotypeProb = -1.0;
+    vcfEntry->haplotype1Prob = -1.0;
+    vcfEntry->haplotype2Prob = -1.0;
+    return vcfEntry;
+}
+
 void vcfEntry_destruct(VcfEntry *vcfEntry) {
-    stList_destruct(vcfEntry->alleles);
     if (vcfEntry->alleleSubstrings != NULL) stList_destruct(vcfEntry->alleleSubstrings);
     if (vcfEntry->alleleIdxToReads != NULL) stList_destruct(vcfEntry->alleleIdxToReads);
-    free(vcfEntry->refSeqName);
+    if (vcfEntry->rootVcfEntry == NULL) {
+        stList_destruct(vcfEntry->alleles);
+        free(vcfEntry->refSeqName);
+    }
     free(vcfEntry);
 }
 
@@ -83,14 +111,235 @@ int vcfEntry_qualityCmp(const void *a, const void *b) {
     return A->quality < B->quality ? -1 : 1; //ascending order, and we pop off end
 }
 
-stHash *parseVcf2(char *vcfFile, char *regionStr, Params *params) {
-    stHash *entries = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, free, (void(*)(void*))stList_destruct);
+typedef struct _vcfParseCounts {
+    int64_t totalEntries;
+    int64_t keptEntries;
+    int64_t skippedForRegion;
+    int64_t skippedForIndel;
+    int64_t skippedForNotPass;
+    int64_t skippedForHomozygous;
+} VcfParseCounts;
+
+static VcfEntry *parseVcfRecord(bcf_hdr_t *hdr, bcf1_t *rec, char *regionStr, char *regionContig, int regionStart,
+                                int regionEnd, Params *params, VcfParseCounts *counts) {
+    /*
+     * Makes the vcf entry for the record, or returns NULL if it is filtered out.
+     */
+    //unpack for read REF,ALT,INFO,etc
+    bcf_unpack(rec, BCF_UN_ALL);
+    counts->totalEntries++;
+
+    // location data
+    const char *chrom = bcf_hdr_id2name(hdr, rec->rid);
+    int64_t pos = rec->pos;
+
+    // quick fail
+    if (regionStr != NULL && (!stString_eq(regionContig, chrom) || (regionStart >= 0 && !(regionStart <= pos && pos < regionEnd)))) {
+        counts->skippedForRegion++;
+        return NULL;
+    }
+    if (params->phaseParams->onlyUsePassVCFEntries && !bcf_has_filter(hdr, rec, "PASS")) {
+        counts->skippedForNotPass++;
+        return NULL;
+    }
+    if (params->phaseParams->onlyUseSNPVCFEntries && !bcf_is_snp(rec)) {
+        counts->skippedForIndel++;
+        return NULL;
+    }
+
+
+    // genotype
+    int gt1 = -1;
+    int gt2 = -1;
+    int32_t *gt_arr = NULL, ngt_arr = 0;
+    int ngt = bcf_get_genotypes(hdr, rec, &gt_arr, &ngt_arr);
+    if (ngt>0 && !bcf_gt_is_missing(gt_arr[0])  && gt_arr[1] != bcf_int32_vector_end) {
+        gt1 = bcf_gt_allele(gt_arr[0]);
+        gt2 = bcf_gt_allele(gt_arr[1]);
+    }
+    free(gt_arr);
+    if (!params->phaseParams->includeHomozygousVCFEntries && gt1 == gt2) {
+        counts->skippedForHomozygous++;
+        return NULL;
+    }
+
+    double quality = rec->qual;
 
-    //open vcf file
-    htsFile *fp = hts_open(vcfFile,"rb");
+    // get alleles
+    stList *alleles = stList_construct3(0, (void (*)(void*)) rleString_destruct);
+    for (int i=0; i<rec->n_allele; ++i) {
+        stList_append(alleles,
+                params->polishParams->useRunLengthEncoding ?
+                rleString_construct(rec->d.allele[i]) :
+                rleString_construct_no_rle(rec->d.allele[i]));
+    }
+
+    counts->keptEntries++;
+    return vcfEntry_construct(chrom, pos, pos, quality, alleles, gt1, gt2);
+}
+
+static stList *parseVcfContigIndexed(htsFile *fp, bcf_hdr_t *hdr, hts_idx_t *idx, tbx_t *tbx, const char *query,
+                                     char *regionStr, char *regionContig, int regionStart, int regionEnd,
+                                     Params *params, VcfParseCounts *counts) {
+    /*
+     * Gets the vcf entries of the records overlapping the query region, using the bcf (idx) or tabix (tbx) index.
+     */
+    stList *contigEntries = stList_construct3(0, (void(*)(void*))vcfEntry_destruct);
+    hts_itr_t *itr = tbx != NULL ? tbx_itr_querys(tbx, query) : bcf_itr_querys(idx, hdr, query);
+    if (itr == NULL) {
+        // no records for the contig
+        return contigEntries;
+    }
+    bcf1_t *rec = bcf_init();
+    kstring_t line = {0, 0, NULL};
+    while (tbx != NULL ? tbx_itr_next(fp, tbx, itr, &line) >= 0 && vcf_parse1(&line, hdr, rec) >= 0 :
+           bcf_itr_next(fp, itr, rec) >= 0) {
+        VcfEntry *entry = parseVcfRecord(hdr, rec, regionStr, regionContig, regionStart, regionEnd, params, counts);
+        if (entry != NULL) {
+            stList_append(contigEntries, entry);
+        }
+    }
+    free(line.s);
+    bcf_destroy(rec);
+    hts_itr_destroy(itr);
+    return contigEntries;
+}
+
+static bool parseVcfIndexed(char *vcfFile, char *regionStr, char *regionContig, int regionStart, int regionEnd,
+                            Params *params, stHash *entries, VcfParseCounts *counts) {
+    /*
+     * If the vcf is a bgzipped vcf with a tabix index or a bcf with a csi index, parses the vcf entries of the region,
+     * or of every contig in parallel, through the index and returns true. Otherwise returns false.
+     */
+    htsFile *fp = hts_open(vcfFile, "r");
     if (fp == NULL) {
         st_errAbort("Could not open VCF %s\n", vcfFile);
     }
+    bool isBcf = hts_get_format(fp)->format == bcf;
+    bool isBgzf = hts_get_format(fp)->compression == bgzf;
+    hts_idx_t *idx = isBcf ? bcf_index_load(vcfFile) : NULL;
+    tbx_t *tbx = !isBcf && isBgzf ? tbx_index_load(vcfFile) : NULL;
+    if (idx == NULL && tbx == NULL) {
+        hts_close(fp);
+        return FALSE;
+    }
+
+    // the regions to query, the contigs of the index unless a region is given
+    stList *queries = stList_construct3(0, free);
+    if (regionStr != NULL) {
+        stList_append(queries, regionStart >= 0 ? stString_print("%s:%d-%d", regionContig, regionStart, regionEnd) :
+                               stString_copy(regionContig));
+    } else {
+        bcf_hdr_t *hdr = bcf_hdr_read(fp);
+        int nseq = 0;
+        const char **seqnames = tbx != NULL ? tbx_seqnames(tbx, &nseq) : bcf_index_seqnames(idx, hdr, &nseq);
+        for (int i = 0; i < nseq; i++) {
+            stList_append(queries, stString_copy(seqnames[i]));
+        }
+        free(seqnames);
+        bcf_hdr_destroy(hdr);
+    }
+    if (idx != NULL) hts_idx_destroy(idx);
+    if (tbx != NULL) tbx_destroy(tbx);
+    hts_close(fp);
+    st_logInfo("> Parsing %s through its index, with %"PRId64" queries\n", vcfFile, stList_length(queries));
+
+    // parse the queries in parallel, each thread with its own handle on the vcf
+    VcfParseCounts *queryCounts = st_calloc(stList_length(queries), sizeof(VcfParseCounts));
+    # ifdef _OPENMP
+    #pragma omp parallel
+    # endif
+    {
+        htsFile *threadFp = hts_open(vcfFile, "r");
+        bcf_hdr_t *hdr = threadFp == NULL ? NULL : bcf_hdr_read(threadFp);
+        hts_idx_t *threadIdx = isBcf ? bcf_index_load(vcfFile) : NULL;
+        tbx_t *threadTbx = isBcf ? NULL : tbx_index_load(vcfFile);
+        if (hdr == NULL || (threadIdx == NULL && threadTbx == NULL)) {
+            st_errAbort("Could not open VCF %s and its index\n", vcfFile);
+        }
+
+        # ifdef _OPENMP
+        #pragma omp for schedule(dynamic, 1)
+        # endif
+        for (int64_t i = 0; i < stList_length(queries); i++) {
+            stList *contigEntries = parseVcfContigIndexed(threadFp, hdr, threadIdx, threadTbx, stList_get(queries, i),
+                                                          regionStr, regionContig, regionStart, regionEnd, params,
+                                                          &queryCounts[i]);
+            if (stList_length(contigEntries) == 0) {
+                stList_destruct(contigEntries);
+                continue;
+            }
+            # ifdef _OPENMP
+            #pragma omp critical(parseVcfIndexed)
+            # endif
+            {
+                VcfEntry *entry = stList_get(contigEntries, 0);
+                stList *contigList = stHash_search(entries, entry->refSeqName);
+                if (contigList == NULL) {
+                    stHash_insert(entries, stString_copy(entry->refSeqName), contigEntries);
+                } else {
+                    // the same contig can only be queried twice if the index lists it twice
+                    stList_appendAll(contigList, contigEntries);
+                    stList_setDestructor(contigEntries, NULL);
+                    stList_destruct(contigEntries);
+                }
+            }
+        }
+
+        if (threadIdx != NULL) hts_idx_destroy(threadIdx);
+        if (threadTbx != NULL) tbx_destroy(threadTbx);
+        bcf_hdr_destroy(hdr);
+        hts_close(threadFp);
+    }
+
+    // total the counts
+    for (int64_t i = 0; i < stList_length(queries); i++) {
+        counts->totalEntries += queryCounts[i].totalEntries;
+        counts->keptEntries += queryCounts[i].keptEntries;
+        counts->skippedForRegion += queryCounts[i].skippedForRegion;
+        counts->skippedForIndel += queryCounts[i].skippedForIndel;
+        counts->skippedForNotPass += queryCounts[i].skippedForNotPass;
+        counts->skippedForHomozygous += queryCounts[i].skippedForHomozygous;
+    }
+    free(queryCounts);
+    stList_destruct(queries);
+    return TRUE;
+}
+
+// The entries kept by vcf_keepParsedVcf, and the file, region and params they were parsed with
+static char *keptVcfFile = NULL;
+static char *keptVcfRegion = NULL;
+static Params *keptVcfParams = NULL;
+static stHash *keptVcfEntries = NULL;
+
+void vcf_keepParsedVcf(char *vcfFile, char *regionStr, Params *params) {
+    if (keptVcfEntries != NULL) {
+        stHash_destruct(keptVcfEntries);
+        free(keptVcfFile);
+        free(keptVcfRegion);
+        keptVcfEntries = NULL;
+    }
+    keptVcfEntries = parseVcf2(vcfFile, regionStr, params);
+    keptVcfFile = stString_copy(vcfFile);
+    keptVcfRegion = regionStr == NULL ? NULL : stString_copy(regionStr);
+    keptVcfParams = params;
+}
+
+stHash *parseVcf2(char *vcfFile, char *regionStr, Params *params) {
+    // the kept entries are handed to the first caller to ask for them
+    if (keptVcfEntries != NULL && params == keptVcfParams && stString_eq(keptVcfFile, vcfFile) &&
+            (regionStr == NULL ? keptVcfRegion == NULL : keptVcfRegion != NULL && stString_eq(keptVcfRegion, regionStr))) {
+        stHash *entries = keptVcfEntries;
+        keptVcfEntries = NULL;
+        free(keptVcfFile);
+        free(keptVcfRegion);
+        keptVcfFile = NULL;
+        keptVcfRegion = NULL;
+        keptVcfParams = NULL;
+        return entries;
+    }
+
+    stHash *entries = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, free, (void(*)(void*))stList_destruct);
 
     // region manage
     char regionContig[128] = "";
@@ -108,100 +357,58 @@ stHash *parseVcf2(char *vcfFile, char *regionStr, Params *params) {
             regionEnd = -1;
         }
     }
-    int64_t totalEntries = 0;
-    int64_t keptEntries = 0;
-    int64_t skippedForRegion = 0;
-    int64_t skippedForIndel = 0;
-    int64_t skippedForNotPass = 0;
-    int64_t skippedForHomozygous = 0;
-
-    //read header
-    bcf_hdr_t *hdr = bcf_hdr_read(fp);
-    int nsmpl = bcf_hdr_nsamples(hdr);
-    if (nsmpl > 1) {
-        st_logCritical("> Got %d samples reading %s, will only take VCF records for the first\n", nsmpl, vcfFile);
-    }
-
-
-    bcf1_t *rec    = bcf_init();
-
-    //save for each vcf record
-    while ( bcf_read(fp, hdr, rec) >= 0 )
-    {
-        //unpack for read REF,ALT,INFO,etc
-        bcf_unpack(rec, BCF_UN_ALL);
-        totalEntries++;
-
-        // location data
-        const char *chrom = bcf_hdr_id2name(hdr, rec->rid);
-        int64_t pos = rec->pos;
-
-        // quick fail
-        if (regionStr != NULL && (!stString_eq(regionContig, chrom) || (regionStart >= 0 && !(regionStart <= pos && pos < regionEnd)))) {
-            skippedForRegion++;
-            continue;
-        }
-        if (params->phaseParams->onlyUsePassVCFEntries && !bcf_has_filter(hdr, rec, "PASS")) {
-            skippedForNotPass++;
-            continue;
-        }
-        if (params->phaseParams->onlyUseSNPVCFEntries && !bcf_is_snp(rec)) {
-            skippedForIndel++;
-            continue;
+    VcfParseCounts counts = {0, 0, 0, 0, 0, 0};
+
+    // use the index if there is one, otherwise read the whole file
+    if (!parseVcfIndexed(vcfFile, regionStr, regionContig, regionStart, regionEnd, params, entries, &counts)) {
+        //open vcf file
+        htsFile *fp = hts_open(vcfFile,"rb");
+        if (fp == NULL) {
+            st_errAbort("Could not open VCF %s\n", vcfFile);
         }
 
-
-        // genotype
-        int gt1 = -1;
-        int gt2 = -1;
-        int32_t *gt_arr = NULL, ngt_arr = 0;
-        int ngt = bcf_get_genotypes(hdr, rec, &gt_arr, &ngt_arr);
-        if (ngt>0 && !bcf_gt_is_missing(gt_arr[0])  && gt_arr[1] != bcf_int32_vector_end) {
-            gt1 = bcf_gt_allele(gt_arr[0]);
-            gt2 = bcf_gt_allele(gt_arr[1]);
-        }
-        free(gt_arr);
-        if (!params->phaseParams->includeHomozygousVCFEntries && gt1 == gt2) {
-            skippedForHomozygous++;
-            continue;
+        //read header
+        bcf_hdr_t *hdr = bcf_hdr_read(fp);
+        int nsmpl = bcf_hdr_nsamples(hdr);
+        if (nsmpl > 1) {
+            st_logCritical("> Got %d samples reading %s, will only take VCF records for the first\n", nsmpl, vcfFile);
         }
 
-        double quality = rec->qual;
+        bcf1_t *rec    = bcf_init();
 
-        // get alleles
-        stList *alleles = stList_construct3(0, (void (*)(void*)) rleString_destruct);
-        for (int i=0; i<rec->n_allele; ++i) {
-            stList_append(alleles,
-                    params->polishParams->useRunLengthEncoding ?
-                    rleString_construct(rec->d.allele[i]) :
-                    rleString_construct_no_rle(rec->d.allele[i]));
-        }
+        //save for each vcf record
+        while ( bcf_read(fp, hdr, rec) >= 0 )
+        {
+            VcfEntry *entry = parseVcfRecord(hdr, rec, regionStr, regionContig, regionStart, regionEnd, params,
+                                             &counts);
+            if (entry == NULL) continue;
 
-        // save it
-        VcfEntry *entry = vcfEntry_construct(chrom, pos, pos, quality, alleles, gt1, gt2);
-        stList *contigList = stHash_search(entries, entry->refSeqName);
-        if (contigList == NULL) {
-            contigList = stList_construct3(0, (void(*)(void*))vcfEntry_destruct);
-            stHash_insert(entries, stString_copy(entry->refSeqName), contigList);
+            // save it
+            stList *contigList = stHash_search(entries, entry->refSeqName);
+            if (contigList == NULL) {
+                contigList = stList_construct3(0, (void(*)(void*))vcfEntry_destruct);
+                stHash_insert(entries, stString_copy(entry->refSeqName), contigList);
+            }
+            stList_append(contigList, entry);
         }
-        stList_append(contigList, entry);
-        keptEntries++;
-    }
 
-    // cleanup
-    bcf_destroy(rec);
-    bcf_hdr_destroy(hdr);
-    int ret;
-    if ( (ret=hts_close(fp)) ) {
-        st_logCritical("> Failed to close VCF %s with code %d\n", vcfFile, ret);
+        // cleanup
+        bcf_destroy(rec);
+        bcf_hdr_destroy(hdr);
+        int ret;
+        if ( (ret=hts_close(fp)) ) {
+            st_logCritical("> Failed to close VCF %s with code %d\n", vcfFile, ret);
+        }
     }
 
     // logging
     st_logCritical("> Parsed %"PRId64" total VCF entries from %s; kept %"PRId64"%s, skipped %"PRId64" for region, %"PRId64" for not being "
                    "PASS, %"PRId64" for being homozygous, %"PRId64" for being INDEL\n",
-                   totalEntries, vcfFile, keptEntries, params->phaseParams->includeHomozygousVCFEntries ? "" : "HETs",
-                   skippedForRegion, skippedForNotPass, skippedForHomozygous, skippedForIndel);
-    if (keptEntries == 0) {
+                   counts.totalEntries, vcfFile, counts.keptEntries,
+                   params->phaseParams->includeHomozygousVCFEntries ? "" : "HETs",
+                   counts.skippedForRegion, counts.skippedForNotPass, counts.skippedForHomozygous,
+                   counts.skippedForIndel);
+    if (counts.keptEntries == 0) {
         st_errAbort("No valid VCF entries found!");
     }
 
@@ -220,14 +427,6 @@ stHash *parseVcf2(char *vcfFile, char *regionStr, Params *params) {
     return entries;
 }
 
-stList *copyListOfRleStrings(stList *toCopy) {
-    stList *copy = stList_construct3(0, (void (*)(void*)) rleString_destruct);
-    for (int i = 0; i < stList_length(toCopy); i++) {
-        stList_append(copy, rleString_copy(stList_get(toCopy, i)));
-    }
-    return copy;
-}
-
 int64_t binarySearchVcfListForFirstIndexAtOrAfterRefPos2(stList *vcfEntries, int64_t desiredEntryPos, int64_t startPos,
                                                          int64_t endPosIncl) {
     if (endPosIncl - startPos == 1) {
@@ -287,10 +486,8 @@ stList *getVcfEntriesForRegion(stHash *vcfEntryMap, uint64_t *rleMap, char *refS
             refPos = rleMap[refPos];
         }
 
-        // make variant
-        VcfEntry *copy = vcfEntry_construct(e->refSeqName, refPos, e->rawRefPosInformativeOnly, e->quality,
-                copyListOfRleStrings(e->alleles), e->gt1, e->gt2);
-        copy->rootVcfEntry = e;
+        // make variant, a view of the entry sharing its alleles
+        VcfEntry *copy = vcfEntry_constructView(e, refPos);
 
         // where to save it?
         if (params->phaseParams->useVariantSelectionAdaptiveSampling &&
@@ -377,24 +574,35 @@ stList *getAlleleSubstrings2(VcfEntry *entry, char *referenceSeq, int64_t refSeq
     *refStartPos = pStart < 0 ? 0 : pStart;
     *refEndPosIncl = sStart + expansion >= refSeqLen ? refSeqLen - 1 : sStart + expansion;
 
-    char *prefix = stString_getSubString(referenceSeq, *refStartPos, pStart < 0 ? pos : expansion);
-    char *suffix = stString_getSubString(referenceSeq, sStart, sLen);
+    // the prefix and suffix are read in place from the reference, and each allele substring is assembled in one
+    // buffer, reused for the alleles
+    char *prefix = &referenceSeq[*refStartPos];
+    int64_t prefixLen = pStart < 0 ? pos : expansion;
+    char *suffix = &referenceSeq[sStart];
+    int64_t maxAlleleLen = 0;
+    for (int64_t i = 0; i < stList_length(entry->alleles); i++) {
+        RleString *allele = stList_get(entry->alleles, i);
+        maxAlleleLen = allele->nonRleLength > maxAlleleLen ? allele->nonRleLength : maxAlleleLen;
+    }
+    char *fullAlleleSubstring = st_malloc(sizeof(char) * (prefixLen + maxAlleleLen + sLen + 1));
+    memcpy(fullAlleleSubstring, prefix, prefixLen);
 
     // get alleles
     for (int64_t i = 0; i < stList_length(entry->alleles); i++) {
-        char *expandedAllele = rleString_expand(stList_get(entry->alleles, i));
-        char *fullAlleleSubstring = stString_print("%s%s%s", prefix, expandedAllele, suffix);
+        RleString *allele = stList_get(entry->alleles, i);
+        char *expandedAllele = rleString_expand(allele);
+        memcpy(&fullAlleleSubstring[prefixLen], expandedAllele, allele->nonRleLength);
+        memcpy(&fullAlleleSubstring[prefixLen + allele->nonRleLength], suffix, sLen);
+        fullAlleleSubstring[prefixLen + allele->nonRleLength + sLen] = '\0';
         stList_append(substrings,
                 useRunLengthEncoding ?
                 rleString_construct(fullAlleleSubstring) :
                 rleString_construct_no_rle(fullAlleleSubstring));
         free(expandedAllele);
-        free(fullAlleleSubstring);
     }
 
     // cleanup
-    free(prefix);
-    free(suffix);
+    free(fullAlleleSubstring);
 
     // put refStartPos and endPos back in poa-space
     if (putRefPosInPOASpace) {
@@ -428,36 +636,11 @@ void updateVcfEntriesWithSubstringsAndPositions(stList *vcfEntries, char *refere
 }
 
 
-stHash *buildVcfEntryToBamChunkReadMap(stList *bamChunkReads) {
-    // get hash of allele to list of substrings
-    stHash *vcfEntriesToReads = stHash_construct2(NULL, (void(*)(void*))stList_destruct);
-    for (int64_t i = 0; i < stList_length(bamChunkReads); i++) {
-        BamChunkRead *bcr = stList_get(bamChunkReads, i);
-        BamChunkReadVcfEntrySubstrings *bcrves = bcr->bamChunkReadVcfEntrySubstrings;
-        for (uint64_t j = 0; j < stList_length(bcrves->vcfEntries); j++) {
-            VcfEntry *vcfEntry = stList_get(bcrves->vcfEntries, j);
-
-            // save
-            stList *bcrList = stHash_search(vcfEntriesToReads, vcfEntry);
-            if (bcrList == NULL) {
-                bcrList = stList_construct();
-                stHash_insert(vcfEntriesToReads, vcfEntry, bcrList);
-            }
-            stList_append(bcrList, bcr);
-        }
-    }
-
-    return vcfEntriesToReads;
-}
-
-
-void updateOriginalVcfEntriesWithBubbleData(BamChunk *bamChunk, stList *bamChunkReads, stHash *readIdToIdx,
-        stGenomeFragment *gF, BubbleGraph *bg, stList *chunkVcfEntriesToBubbles, stSet *hap1Reads, stSet *hap2Reads,
-        char *logIdentifier) {
-
-    // prep
-    stHash *vcfEntryToReads = buildVcfEntryToBamChunkReadMap(bamChunkReads);
-
+void updateOriginalVcfEntriesWithBubbleData(BamChunk *bamChunk, stHash *readIdToIdx, stGenomeFragment *gF,
+        BubbleGraph *bg, stList *chunkVcfEntriesToBubbles, stSet *hap1Reads, stSet *hap2Reads, char *logIdentifier) {
+    /*
+     * The reads of each entry are those of its bubble, which was made from the reads' substrings for the entry.
+     */
     // loop over all primary bubbles in the actual chunk boundaries
     for (uint64_t primaryBubbleIdx = 0; primaryBubbleIdx < gF->length; primaryBubbleIdx++) {
         // bubble and hap info
@@ -482,11 +665,8 @@ void updateOriginalVcfEntriesWithBubbleData(BamChunk *bamChunk, stList *bamChunk
             continue;
         }
 
-        // get read substrings
-        stList *entryBCRs = stHash_search(vcfEntryToReads, chunkVcfEntry);
-
         // nothing to phase with, make no updates
-        if (stList_length(entryBCRs) == 0) {
+        if (primaryBubble->readNo == 0) {
             rootVcfEntry->gt1 = -1;
             rootVcfEntry->gt2 = -1;
             rootVcfEntry->genotypeProb = 0;
@@ -506,8 +686,8 @@ void updateOriginalVcfEntriesWithBubbleData(BamChunk *bamChunk, stList *bamChunk
         int64_t unMatchedReads = 0;
         stSet *hap1RootVcfEntryReadIndices = stList_get(rootVcfEntry->alleleIdxToReads, hap1AlleleNo);
         stSet *hap2RootVcfEntryReadIndices = stList_get(rootVcfEntry->alleleIdxToReads, hap2AlleleNo);
-        for (int64_t i = 0; i < stList_length(entryBCRs); i++) {
-            BamChunkRead *bcr = stList_get(entryBCRs, i);
+        for (int64_t i = 0; i < primaryBubble->readNo; i++) {
+            BamChunkRead *bcr = primaryBubble->reads[i]->read;
             int64_t readIdx = (int64_t) stHash_search(readIdToIdx, bcr->readName);
             assert(readIdx != 0);
             if (stSet_search(hap1Reads, bcr) != NULL) {
@@ -518,69 +698,131 @@ void updateOriginalVcfEntriesWithBubbleData(BamChunk *bamChunk, stList *bamChunk
                 unMatchedReads++;
             }
         }
-        if (unMatchedReads == stList_length(entryBCRs)) {
+        if (unMatchedReads == primaryBubble->readNo) {
             st_logInfo(" %s No reads (out of %"PRId64") were aligned to VCF entry at pos %s:%"PRId64"\n",
                     logIdentifier, unMatchedReads, rootVcfEntry->refSeqName, rootVcfEntry->rawRefPosInformativeOnly);
         }
 
     }
-
-    stHash_destruct(vcfEntryToReads);
 }
 
 
-void updateHaplotypeSwitchingInVcfEntries(BamChunker *chunker, bool *chunkWasSwitched, stHash *vcfEntryMap) {
-    // trakcing
-    int64_t totalSwitchedVcfEntries = 0;
-    int64_t totalVcfEntries = 0;
-
-    // for iteration
-    char *currContig = NULL;
-    stList *currVcfEntries = NULL;
-    int64_t currVcfEntryIdx = 0;
-    for (int64_t i = 0; i < chunker->chunkCount; i++) {
-        BamChunk *chunk = stList_get(chunker->chunks, i);
-        if (currContig == NULL || !stString_eq(currContig, chunk->refSeqName)) {
-            currContig = chunk->refSeqName;
-            currVcfEntries = stHash_search(vcfEntryMap, currContig);
-            if (currVcfEntries == NULL) {
-                // no entries in vcf entry map, we can continue
-                continue;
+char *getChunkPhasingOfVcfEntries(BamChunk *bamChunk, stHash *vcfEntries, size_t *length) {
+    /*
+     * Serializes the genotypes, probabilities and read indices that updateOriginalVcfEntriesWithBubbleData set for
+     * the vcf entries within the chunk's boundaries, one line per entry.
+     */
+    char *chunkPhasing = NULL;
+    FILE *fh = open_memstream(&chunkPhasing, length);
+    stList *contigVcfEntries = stHash_search(vcfEntries, bamChunk->refSeqName);
+    int64_t vcfEntryIdx = contigVcfEntries == NULL ? -1 :
+                          binarySearchVcfListForFirstIndexAtOrAfterRefPos(contigVcfEntries, bamChunk->chunkStart);
+    VcfEntry *vcfEntry;
+    while (vcfEntryIdx >= 0 && vcfEntryIdx < stList_length(contigVcfEntries) &&
+           (vcfEntry = stList_get(contigVcfEntries, vcfEntryIdx))->refPos < bamChunk->chunkEnd) {
+        fprintf(fh, "%"PRId64"\t%"PRId64"\t%"PRId64"\t%a\t%a\t%a", vcfEntry->refPos, vcfEntry->gt1, vcfEntry->gt2,
+                vcfEntry->genotypeProb, vcfEntry->haplotype1Prob, vcfEntry->haplotype2Prob);
+        for (int64_t a = 0; vcfEntry->alleleIdxToReads != NULL && a < stList_length(vcfEntry->alleleIdxToReads); a++) {
+            stSetIterator *itor = stSet_getIterator(stList_get(vcfEntry->alleleIdxToReads, a));
+            void *readIdx;
+            char *separator = "\t";
+            while ((readIdx = stSet_getNext(itor)) != NULL) {
+                fprintf(fh, "%s%"PRId64, separator, (int64_t) readIdx);
+                separator = ",";
             }
-            currContig = chunk->refSeqName;
-            currVcfEntryIdx = binarySearchVcfListForFirstIndexAtOrAfterRefPos(currVcfEntries, chunk->chunkStart);
-            if (currVcfEntryIdx < 0) {
-                // no entries for this contig
-                currContig = NULL;
-                continue;
+            if (separator[0] == '\t') {
+                fprintf(fh, "\t.");
             }
+            stSet_destructIterator(itor);
         }
+        fprintf(fh, "\n");
+        vcfEntryIdx++;
+    }
+    fclose(fh);
+    return chunkPhasing;
+}
 
-        VcfEntry *vcfEntry;
-        while (currVcfEntryIdx < stList_length(currVcfEntries) &&
-                (vcfEntry = stList_get(currVcfEntries, currVcfEntryIdx))->refPos < chunk->chunkEnd) {
-            if (vcfEntry->refPos < chunk->chunkStart) {
-                // should not happen
-                st_logInfo("  While switching haplotypes on VCF entries got entry starting before chunk (%s %"PRId64" < %"PRId64")\n",
-                           vcfEntry->refSeqName, vcfEntry->refPos, chunk->chunkStart);
-                currVcfEntryIdx++;
+void setChunkPhasingOfVcfEntries(BamChunk *bamChunk, stHash *vcfEntries, char *chunkPhasing) {
+    /*
+     * Restores the phasing of the vcf entries within the chunk's boundaries from getChunkPhasingOfVcfEntries.
+     */
+    stList *contigVcfEntries = stHash_search(vcfEntries, bamChunk->refSeqName);
+    int64_t vcfEntryIdx = contigVcfEntries == NULL ? -1 :
+                          binarySearchVcfListForFirstIndexAtOrAfterRefPos(contigVcfEntries, bamChunk->chunkStart);
+    char *p = chunkPhasing;
+    VcfEntry *vcfEntry;
+    while (vcfEntryIdx >= 0 && vcfEntryIdx < stList_length(contigVcfEntries) &&
+           (vcfEntry = stList_get(contigVcfEntries, vcfEntryIdx))->refPos < bamChunk->chunkEnd) {
+        if (*p == '\0' || strtoll(p, &p, 10) != vcfEntry->refPos) {
+            st_errAbort("Chunk phasing does not match the vcf entries of %s:%"PRId64"-%"PRId64"\n",
+                        bamChunk->refSeqName, bamChunk->chunkStart, bamChunk->chunkEnd);
+        }
+        vcfEntry->gt1 = strtoll(p, &p, 10);
+        vcfEntry->gt2 = strtoll(p, &p, 10);
+        vcfEntry->genotypeProb = strtod(p, &p);
+        vcfEntry->haplotype1Prob = strtod(p, &p);
+        vcfEntry->haplotype2Prob = strtod(p, &p);
+        for (int64_t a = 0; vcfEntry->alleleIdxToReads != NULL && a < stList_length(vcfEntry->alleleIdxToReads); a++) {
+            stSet *readIndices = stList_get(vcfEntry->alleleIdxToReads, a);
+            if (*p == '\t') p++;
+            if (*p == '.') {
+                p++;
                 continue;
             }
+            while (1) {
+                stSet_insert(readIndices, (void *) strtoll(p, &p, 10));
+                if (*p != ',') break;
+                p++;
+            }
+        }
+        while (*p != '\0' && *p++ != '\n');
+        vcfEntryIdx++;
+    }
+}
 
-            // update
-            if (chunkWasSwitched[i]) {
-                int64_t tmpi = vcfEntry->gt1;
-                vcfEntry->gt1 = vcfEntry->gt2;
-                vcfEntry->gt2 = tmpi;
-                float tmpf = vcfEntry->haplotype1Prob;
-                vcfEntry->haplotype1Prob = vcfEntry->haplotype2Prob;
-                vcfEntry->haplotype2Prob = tmpf;
+static void switchHaplotypesInVcfEntriesOfChunk(BamChunk *chunk, stList *contigVcfEntries, bool wasSwitched,
+                                                int64_t *totalSwitchedVcfEntries, int64_t *totalVcfEntries) {
+    /*
+     * Applies the chunk's switch state from stitching to the vcf entries within its boundaries.
+     */
+    if (contigVcfEntries == NULL) {
+        // no entries in vcf entry map for this contig
+        return;
+    }
+    int64_t vcfEntryIdx = binarySearchVcfListForFirstIndexAtOrAfterRefPos(contigVcfEntries, chunk->chunkStart);
+    if (vcfEntryIdx < 0) {
+        // no entries in this chunk
+        return;
+    }
 
-                totalSwitchedVcfEntries++;
-            }
-            totalVcfEntries++;
-            currVcfEntryIdx++;
+    VcfEntry *vcfEntry;
+    while (vcfEntryIdx < stList_length(contigVcfEntries) &&
+            (vcfEntry = stList_get(contigVcfEntries, vcfEntryIdx))->refPos < chunk->chunkEnd) {
+        // update
+        if (wasSwitched) {
+            int64_t tmpi = vcfEntry->gt1;
+            vcfEntry->gt1 = vcfEntry->gt2;
+            vcfEntry->gt2 = tmpi;
+            float tmpf = vcfEntry->haplotype1Prob;
+            vcfEntry->haplotype1Prob = vcfEntry->haplotype2Prob;
+            vcfEntry->haplotype2Prob = tmpf;
+
+            (*totalSwitchedVcfEntries)++;
         }
+        (*totalVcfEntries)++;
+        vcfEntryIdx++;
+    }
+}
+
+void updateHaplotypeSwitchingInVcfEntries(BamChunker *chunker, bool *chunkWasSwitched, stHash *vcfEntryMap) {
+    // trakcing
+    int64_t totalSwitchedVcfEntries = 0;
+    int64_t totalVcfEntries = 0;
+
+    for (int64_t i = 0; i < chunker->chunkCount; i++) {
+        BamChunk *chunk = stList_get(chunker->chunks, i);
+        switchHaplotypesInVcfEntriesOfChunk(chunk, stHash_search(vcfEntryMap, chunk->refSeqName), chunkWasSwitched[i],
+                                            &totalSwitchedVcfEntries, &totalVcfEntries);
     }
     st_logInfo("  Switched %"PRId64"/%"PRId64" (%.2f) VCF entry haplotypes after stitching\n",
             totalSwitchedVcfEntries, totalVcfEntries, 1.0 * totalSwitchedVcfEntries / totalVcfEntries);
@@ -613,39 +855,112 @@ int cmpint64(const void *I, const void *J) {
     return i > j ? 1 : i < j ? -1 : 0;
 }
 
-void writePhasedVcf(char *inputVcfFile, char *regionStr, char *outputVcfFile, char *phaseSetBedFile,
-        stHash *vcfEntryMap, Params *params) {
+struct _phasedVcfWriter {
+    // files
+    char *inputVcfFile;
+    char *outputVcfFile;
+    bool compressOutput; // BGZF compress and tabix index the output
+    bool indexingOutput; // The tabix index of the compressed output is built as the records are written
+    htsFile *fpIn;
+    htsFile *fpOut;
+    FILE *phaseSetBedOut;
+    bcf_hdr_t *hdr;
+    bcf1_t *rec;
+    bool hasPendingRecord; // rec has been read but not written, as the phasing at its position is not final
+    bool inputFinished;
+
+    // region management
+    char *regionStr;
+    char regionContig[128];
+    int regionStart;
+    int regionEnd;
+
+    // vcf entries and how far their phasing is final
+    stHash *vcfEntryMap;
+    Params *params;
+    BamChunker *chunker; // If NULL all the vcf entries are final
+    int64_t nextChunkIdx; // The next chunk expected in phasedVcfWriter_finishChunk
+    stSet *contigsWithChunks;
+    stSet *finishedContigs; // Contigs all of whose chunks are final
+    char *finishingContig; // The contig of the last chunk made final, if not finished
+    int64_t finalUpToPos; // Positions on finishingContig before this are final
 
+    // tracking total entries
+    int64_t totalEntries;
+    int64_t totalPhasedWritten;
+    int64_t skippedBecasueNotConsidered;
+    int64_t notPhasedBecauseMarginCalledHomozygous;
+    int64_t notPhasedBecauseMarginCalledHetDifferentFromInputVCF;
+    int64_t totalSwitchedVcfEntries;
+    int64_t totalSwitchableVcfEntries;
+
+    // tracking vcf entries
+    VcfEntry *prevHetVcfEntry;
+    VcfEntry *currVcfEntry;
+    int32_t phaseSet;
+    int64_t nextVcfEntryIdx;
+    char *currChrom;
+    stList *currChromVcfEntries;
+
+    // phase set data
+    stList *phaseSetLengths;
+};
+
+PhasedVcfWriter *phasedVcfWriter_construct(char *inputVcfFile, char *regionStr, char *outputVcfFile,
+                                           char *phaseSetBedFile, stHash *vcfEntryMap, BamChunker *chunker,
+                                           Params *params) {
     //open files
     htsFile *fpIn = hts_open(inputVcfFile,"rb");
     if (fpIn == NULL) {
         st_logCritical("Could not open input VCF for reading %s\n", inputVcfFile);
-        return;
+        return NULL;
     }
-    htsFile *fpOut = hts_open(outputVcfFile, "w");
+    bool compressOutput = strlen(outputVcfFile) > 3 && stString_eq(outputVcfFile + strlen(outputVcfFile) - 3, ".gz");
+    htsFile *fpOut = hts_open(outputVcfFile, compressOutput ? "wz" : "w");
     if (fpOut == NULL) {
         st_logCritical("Could not open output VCF for writing %s\n", outputVcfFile);
-        return;
+        hts_close(fpIn);
+        return NULL;
     }
     FILE *phaseSetBedOut = phaseSetBedFile == NULL ? NULL : fopen(phaseSetBedFile, "w");
     if (phaseSetBedOut == NULL && phaseSetBedFile != NULL) {
         st_logCritical("Could not open phase set BED file for writing %s\n", phaseSetBedFile);
     }
 
+    PhasedVcfWriter *writer = st_calloc(1, sizeof(PhasedVcfWriter));
+    writer->inputVcfFile = stString_copy(inputVcfFile);
+    writer->outputVcfFile = stString_copy(outputVcfFile);
+    writer->compressOutput = compressOutput;
+    writer->fpIn = fpIn;
+    writer->fpOut = fpOut;
+    writer->phaseSetBedOut = phaseSetBedOut;
+    writer->vcfEntryMap = vcfEntryMap;
+    writer->params = params;
+    writer->phaseSet = -1;
+    writer->phaseSetLengths = stList_construct();
+
     // region manage
-    char regionContig[128] = "";
-    int regionStart = 0;
-    int regionEnd = 0;
+    writer->regionStr = regionStr == NULL ? NULL : stString_copy(regionStr);
     if (regionStr != NULL) {
-        int scanRet = sscanf(regionStr, "%[^:]:%d-%d", regionContig, &regionStart, &regionEnd);
+        int scanRet = sscanf(regionStr, "%[^:]:%d-%d", writer->regionContig, &writer->regionStart, &writer->regionEnd);
         if (scanRet != 3 && scanRet != 1) {
             st_errAbort("Region in unexpected format (expected %%s:%%d-%%d or %%s)): %s", regionStr);
-        } else if (regionStart < 0 || regionEnd < 0 || regionEnd < regionStart) {
+        } else if (writer->regionStart < 0 || writer->regionEnd < 0 || writer->regionEnd < writer->regionStart) {
             st_errAbort("Start and end locations in region must be positive, start must be less than end: %s", regionStr);
         }
         if (scanRet == 1) {
-            regionStart = -1;
-            regionEnd = -1;
+            writer->regionStart = -1;
+            writer->regionEnd = -1;
+        }
+    }
+
+    // the contigs whose vcf entries wait on their chunks being stitched
+    writer->chunker = chunker;
+    if (chunker != NULL) {
+        writer->contigsWithChunks = stSet_construct3(stHash_stringKey, stHash_stringEqualKey, NULL);
+        writer->finishedContigs = stSet_construct3(stHash_stringKey, stHash_stringEqualKey, NULL);
+        for (int64_t i = 0; i < chunker->chunkCount; i++) {
+            stSet_insert(writer->contigsWithChunks, ((BamChunk *) stList_get(chunker->chunks, i))->refSeqName);
         }
     }
 
@@ -668,303 +983,411 @@ void writePhasedVcf(char *inputVcfFile, char *regionStr, char *outputVcfFile, ch
         bcf_hdr_append(hdr, "##FORMAT=<ID=HDPV,Number=2,Type=Integer,Description=\"Haplotype Discordance with Previous Variant\">");
     }
 
-
-    // write header
+    // write header, then if compressed start indexing the records as they are written, compressing them with the
+    // shared htslib thread pool, or else threads of the file's own
     bcf_hdr_write(fpOut, hdr);
-    bcf1_t *rec    = bcf_init();
-
-    // tracking total entries
-    int64_t totalEntries = 0;
-    int64_t totalPhasedWritten = 0;
-    int64_t skippedBecasueNotConsidered = 0;
-    int64_t notPhasedBecauseMarginCalledHomozygous = 0;
-    int64_t notPhasedBecauseMarginCalledHetDifferentFromInputVCF = 0;
+    if (compressOutput) {
+        htsThreadPool *threadPool = getHtsThreadPool(params->polishParams);
+        if (threadPool != NULL) {
+            hts_set_opt(fpOut, HTS_OPT_THREAD_POOL, threadPool);
+        }
+#ifdef _OPENMP
+        else if (omp_get_max_threads() > 1) {
+            hts_set_threads(fpOut, omp_get_max_threads());
+        }
+#endif
+#if defined(HTS_VERSION) && HTS_VERSION >= 101100
+        char *indexFile = stString_print("%s.tbi", outputVcfFile);
+        writer->indexingOutput = bcf_idx_init(fpOut, hdr, 0, indexFile) == 0;
+        free(indexFile);
+#endif
+    }
+    writer->hdr = hdr;
+    writer->rec = bcf_init();
 
-    // tracking vcf entries
-    VcfEntry *prevHetVcfEntry = NULL;
-    VcfEntry *currVcfEntry = NULL;
-    int32_t phaseSet = -1;
-    int64_t nextVcfEntryIdx = 0;
-    char *currChrom = NULL;
-    stList *currChromVcfEntries = NULL;
+    return writer;
+}
 
-    // phase set data
-    stList *phaseSetLengths = stList_construct();
+static bool phasedVcfWriter_isFinal(PhasedVcfWriter *writer, const char *chrom, int64_t pos) {
+    /*
+     * Returns true if the phasing of any vcf entry at the position is final, so the record there can be written.
+     */
+    if (writer->chunker == NULL || stSet_search(writer->contigsWithChunks, (void *) chrom) == NULL ||
+        stSet_search(writer->finishedContigs, (void *) chrom) != NULL) {
+        return TRUE;
+    }
+    return writer->finishingContig != NULL && stString_eq(writer->finishingContig, chrom) && pos < writer->finalUpToPos;
+}
 
-    // iterate
-    while ( bcf_read(fpIn, hdr, rec) >= 0 )
-    {
-        //unpack for read REF,ALT,INFO,etc
-        bcf_unpack(rec, BCF_UN_ALL);
-        totalEntries++;
+static void releaseVcfEntryReads(VcfEntry *vcfEntry) {
+    /*
+     * Frees the reads supporting each allele of an entry that has been written out, which are the bulk of its memory.
+     */
+    if (vcfEntry != NULL && vcfEntry->alleleIdxToReads != NULL) {
+        stList_destruct(vcfEntry->alleleIdxToReads);
+        vcfEntry->alleleIdxToReads = NULL;
+    }
+}
 
-        // location data
-        const char *chrom = bcf_hdr_id2name(hdr, rec->rid);
-        int64_t pos = rec->pos;
+static void phasedVcfWriter_writeRecord(PhasedVcfWriter *writer) {
+    /*
+     * Writes the pending record, phased using the vcf entry at its position.
+     */
+    htsFile *fpOut = writer->fpOut;
+    bcf_hdr_t *hdr = writer->hdr;
+    bcf1_t *rec = writer->rec;
+    Params *params = writer->params;
+    writer->totalEntries++;
+
+    // location data
+    const char *chrom = bcf_hdr_id2name(hdr, rec->rid);
+    int64_t pos = rec->pos;
+
+    // skipped cases
+    bool skipVariantAnalysis = FALSE;
+    if (writer->regionStr != NULL && (!stString_eq(writer->regionContig, chrom) ||
+            (writer->regionStart >= 0 && !(writer->regionStart <= pos && pos < writer->regionEnd)))) {
+        skipVariantAnalysis = TRUE;
+    }
+    if (params->phaseParams->onlyUsePassVCFEntries && !bcf_has_filter(hdr, rec, "PASS")) {
+        skipVariantAnalysis = TRUE;
+    }
+    if (params->phaseParams->onlyUseSNPVCFEntries && !bcf_is_snp(rec)) {
+        skipVariantAnalysis = TRUE;
+    }
 
-        // skipped cases
-        bool skipVariantAnalysis = FALSE;
-        if (regionStr != NULL && (!stString_eq(regionContig, chrom) || (regionStart >= 0 && !(regionStart <= pos && pos < regionEnd)))) {
-            skipVariantAnalysis = TRUE;
-        }
-        if (params->phaseParams->onlyUsePassVCFEntries && !bcf_has_filter(hdr, rec, "PASS")) {
-            skipVariantAnalysis = TRUE;
-        }
-        if (params->phaseParams->onlyUseSNPVCFEntries && !bcf_is_snp(rec)) {
-            skipVariantAnalysis = TRUE;
-        }
+    // genotype
+    int32_t origGt1 = -1;
+    int32_t origGt2 = -1;
+    int32_t *gt_arr = NULL, ngt_arr = 0;
+    int ngt = bcf_get_genotypes(hdr, rec, &gt_arr, &ngt_arr);
+    if (ngt>0 && !bcf_gt_is_missing(gt_arr[0])  && gt_arr[1] != bcf_int32_vector_end) {
+        origGt1 = bcf_gt_allele(gt_arr[0]);
+        origGt2 = bcf_gt_allele(gt_arr[1]);
+    }
+    free(gt_arr);
+    if (!params->phaseParams->includeHomozygousVCFEntries && origGt1 == origGt2) {
+        skipVariantAnalysis = TRUE;
+    }
 
-        // genotype
-        int32_t origGt1 = -1;
-        int32_t origGt2 = -1;
-        int32_t *gt_arr = NULL, ngt_arr = 0;
-        int ngt = bcf_get_genotypes(hdr, rec, &gt_arr, &ngt_arr);
-        if (ngt>0 && !bcf_gt_is_missing(gt_arr[0])  && gt_arr[1] != bcf_int32_vector_end) {
-            origGt1 = bcf_gt_allele(gt_arr[0]);
-            origGt2 = bcf_gt_allele(gt_arr[1]);
-        }
-        free(gt_arr);
-        if (!params->phaseParams->includeHomozygousVCFEntries && origGt1 == origGt2) {
-            skipVariantAnalysis = TRUE;
-        }
+    // all skipped variants are written this way
+    if (skipVariantAnalysis) {
+        writer->skippedBecasueNotConsidered++;
+        writeUnphasedVariant(fpOut, hdr, rec, origGt1, origGt2);
+        return;
+    }
 
-        // all skipped variants are written this way
-        if (skipVariantAnalysis) {
-            skippedBecasueNotConsidered++;
-            writeUnphasedVariant(fpOut, hdr, rec, origGt1, origGt2);
-            continue;
+    // setup our vcf entries for new chrom
+    if (writer->currChrom == NULL || !stString_eq(writer->currChrom, chrom)) {
+        // handle phase set
+        recordPhaseSet(writer->phaseSet, writer->prevHetVcfEntry, writer->phaseSetLengths, "ContigEnd\t",
+                       writer->phaseSetBedOut);
+        releaseVcfEntryReads(writer->prevHetVcfEntry);
+        releaseVcfEntryReads(writer->currVcfEntry);
+        // free old value
+        if (writer->currChrom != NULL) free(writer->currChrom);
+        // init chrom and entries
+        writer->currChrom = stString_copy(chrom);
+        writer->currChromVcfEntries = stHash_search(writer->vcfEntryMap, writer->currChrom);
+        assert(writer->currChromVcfEntries != NULL);
+        // prep
+        writer->prevHetVcfEntry = NULL;
+        writer->currVcfEntry = NULL;
+        writer->nextVcfEntryIdx = 0;
+        writer->phaseSet = -1;
+    }
+    stList *currChromVcfEntries = writer->currChromVcfEntries;
+
+    // find new current vcf entry
+    VcfEntry *nextVcfEntry = NULL;
+    int64_t skippedVcfEntries = 0;
+    while (writer->nextVcfEntryIdx < stList_length(currChromVcfEntries)) {
+        nextVcfEntry = stList_get(currChromVcfEntries, writer->nextVcfEntryIdx);
+        if (nextVcfEntry->refPos == pos) {
+            // found it
+            writer->nextVcfEntryIdx++;
+            break;
+        } else if (nextVcfEntry->refPos > pos) {
+            //we have missed our variant, should not happen
+            nextVcfEntry = NULL;
+            break;
+        } else if (nextVcfEntry->refPos < pos) {
+            // we aren't at our variant yet, this should not happen
+            skippedVcfEntries++;
+        } else {
+            assert(FALSE);
         }
+        writer->nextVcfEntryIdx++;
+    }
+    // this is only error case where something unexpected has happened
+    if (skippedVcfEntries > 0) {
+        st_logCritical("  Skipped %"PRId64" considered VCF entries searching %ssuccessfully for entry at %s:%"PRId64"\n",
+                skippedVcfEntries, nextVcfEntry == NULL ? "un":"", chrom, pos);
+    }
 
-        // setup our vcf entries for new chrom
-        if (currChrom == NULL || !stString_eq(currChrom, chrom)) {
-            // handle phase set
-            recordPhaseSet(phaseSet, prevHetVcfEntry, phaseSetLengths, "ContigEnd\t", phaseSetBedOut);
-            // free old value
-            if (currChrom != NULL) free(currChrom);
-            // init chrom and entries
-            currChrom = stString_copy(chrom);
-            currChromVcfEntries = stHash_search(vcfEntryMap, currChrom);
-            assert(currChromVcfEntries != NULL);
-            // prep
-            prevHetVcfEntry = NULL;
-            currVcfEntry = NULL;
-            nextVcfEntryIdx = 0;
-            phaseSet = -1;
-        }
-
-        // find new current vcf entry
-        VcfEntry *nextVcfEntry = NULL;
-        int64_t skippedVcfEntries = 0;
-        while (nextVcfEntryIdx < stList_length(currChromVcfEntries)) {
-            nextVcfEntry = stList_get(currChromVcfEntries, nextVcfEntryIdx);
-            if (nextVcfEntry->refPos == pos) {
-                // found it
-                nextVcfEntryIdx++;
-                break;
-            } else if (nextVcfEntry->refPos > pos) {
-                //we have missed our variant, should not happen
-                nextVcfEntry = NULL;
-                break;
-            } else if (nextVcfEntry->refPos < pos) {
-                // we aren't at our variant yet, this should not happen
-                skippedVcfEntries++;
-            } else {
-                assert(FALSE);
-            }
-            nextVcfEntryIdx++;
-        }
-        // this is only error case where something unexpected has happened
-        if (skippedVcfEntries > 0) {
-            st_logCritical("  Skipped %"PRId64" considered VCF entries searching %ssuccessfully for entry at %s:%"PRId64"\n",
-                    skippedVcfEntries, nextVcfEntry == NULL ? "un":"", chrom, pos);
+    // handle case where we did not find this variant (bad)
+    VcfEntry *prevHetVcfEntry = writer->prevHetVcfEntry;
+    if (nextVcfEntry == NULL) {
+        //loggit
+        if (writer->nextVcfEntryIdx < stList_length(currChromVcfEntries)) {
+            nextVcfEntry = stList_get(currChromVcfEntries, writer->nextVcfEntryIdx);
         }
+        st_logCritical("  When writing VCF entries at %s:%"PRId64", did not find existing entry (prev %s:%"PRId64", next %s:%"PRId64")\n",
+                   chrom, pos, prevHetVcfEntry != NULL ? prevHetVcfEntry->refSeqName : "NULL",
+                   prevHetVcfEntry != NULL ? prevHetVcfEntry->refPos : -1, nextVcfEntry->refSeqName,
+                   nextVcfEntry->refPos);
+        // write variant
+        writeUnphasedVariant(fpOut, hdr, rec, origGt1, origGt2);
+        return;
+    }
 
-        // handle case where we did not find this variant (bad)
-        if (nextVcfEntry == NULL) {
-            //loggit
-            if (nextVcfEntryIdx < stList_length(currChromVcfEntries)) {
-                nextVcfEntry = stList_get(currChromVcfEntries, nextVcfEntryIdx);
-            }
-            st_logCritical("  When writing VCF entries at %s:%"PRId64", did not find existing entry (prev %s:%"PRId64", next %s:%"PRId64")\n",
-                       chrom, pos, prevHetVcfEntry != NULL ? prevHetVcfEntry->refSeqName : "NULL",
-                       prevHetVcfEntry != NULL ? prevHetVcfEntry->refPos : -1, nextVcfEntry->refSeqName,
-                       nextVcfEntry->refPos);
-            // write variant
-            writeUnphasedVariant(fpOut, hdr, rec, origGt1, origGt2);
-            continue;
-        }
+    // handle case where we found this variant, but it was for some reason filtered out (ok)
+    if (nextVcfEntry->genotypeProb == -1.0) {
+        writer->skippedBecasueNotConsidered++;
+        writeUnphasedVariant(fpOut, hdr, rec, origGt1, origGt2);
+        return;
+    }
 
-        // handle case where we found this variant, but it was for some reason filtered out (ok)
-        if (nextVcfEntry->genotypeProb == -1.0) {
-            skippedBecasueNotConsidered++;
-            writeUnphasedVariant(fpOut, hdr, rec, origGt1, origGt2);
-            continue;
-        }
+    // iterate, only the entries for the previous het and the current variant are needed from here on
+    VcfEntry *currVcfEntry = writer->currVcfEntry;
+    if (currVcfEntry != NULL && currVcfEntry->gt1 != currVcfEntry->gt2) {
+        // prev must be het
+        releaseVcfEntryReads(prevHetVcfEntry);
+        prevHetVcfEntry = currVcfEntry;
+    } else {
+        releaseVcfEntryReads(currVcfEntry);
+    }
+    currVcfEntry = nextVcfEntry;
+    writer->prevHetVcfEntry = prevHetVcfEntry;
+    writer->currVcfEntry = currVcfEntry;
+
+    // get variant data from margin analysis
+    // genotype
+    int gt1 = (int) currVcfEntry->gt1;
+    int gt2 = (int) currVcfEntry->gt2;
+    // probs
+    int32_t gtProb = (int32_t) toPhred(currVcfEntry->genotypeProb);
+    int32_t hp1Prob = (int32_t) toPhred(currVcfEntry->haplotype1Prob);
+    int32_t hp2Prob = (int32_t) toPhred(currVcfEntry->haplotype2Prob);
+    // depths
+    int32_t depth = 0;
+    int32_t hap1Depth = -1;
+    int32_t hap2Depth = -1;
+    for (int i = 0; i < stList_length(currVcfEntry->alleleIdxToReads); i++) {
+        int32_t hpDepth = (int32_t) stSet_size(stList_get(currVcfEntry->alleleIdxToReads, i));
+        depth += hpDepth;
+        if (i == gt1) hap1Depth = hpDepth;
+        if (i == gt2) hap2Depth = hpDepth;
+    }
+    // read concordancy with with previous het variant
+    int32_t hcpv1 = -1;
+    int32_t hcpv2 = -1;
+    int32_t hdpv1 = -1;
+    int32_t hdpv2 = -1;
+    bool determinedHetConcordancy = FALSE;
+    if (prevHetVcfEntry != NULL && gt1 != gt2 && prevHetVcfEntry->gt1 >= 0 && currVcfEntry->gt1 >= 0) {
+        stSet *prevH1 = stList_get(prevHetVcfEntry->alleleIdxToReads, prevHetVcfEntry->gt1);
+        stSet *prevH2 = stList_get(prevHetVcfEntry->alleleIdxToReads, prevHetVcfEntry->gt2);
+        stSet *currH1 = stList_get(currVcfEntry->alleleIdxToReads, currVcfEntry->gt1);
+        stSet *currH2 = stList_get(currVcfEntry->alleleIdxToReads, currVcfEntry->gt2);
+        hcpv1 = (int32_t) stSet_sizeOfIntersection(prevH1, currH1);
+        hcpv2 = (int32_t) stSet_sizeOfIntersection(prevH2, currH2);
+        hdpv1 = (int32_t) stSet_sizeOfIntersection(prevH2, currH1);
+        hdpv2 = (int32_t) stSet_sizeOfIntersection(prevH1, currH2);
+        determinedHetConcordancy = TRUE;
+    }
 
-        // iterate
-        if (currVcfEntry != NULL && currVcfEntry->gt1 != currVcfEntry->gt2) {
-            // prev must be het
-            prevHetVcfEntry = currVcfEntry;
-        }
-        currVcfEntry = nextVcfEntry;
-
-        // get variant data from margin analysis
-        // genotype
-        int gt1 = (int) currVcfEntry->gt1;
-        int gt2 = (int) currVcfEntry->gt2;
-        // probs
-        int32_t gtProb = (int32_t) toPhred(currVcfEntry->genotypeProb);
-        int32_t hp1Prob = (int32_t) toPhred(currVcfEntry->haplotype1Prob);
-        int32_t hp2Prob = (int32_t) toPhred(currVcfEntry->haplotype2Prob);
-        // depths
-        int32_t depth = 0;
-        int32_t hap1Depth = -1;
-        int32_t hap2Depth = -1;
-        for (int i = 0; i < stList_length(currVcfEntry->alleleIdxToReads); i++) {
-            int32_t hpDepth = (int32_t) stSet_size(stList_get(currVcfEntry->alleleIdxToReads, i));
-            depth += hpDepth;
-            if (i == gt1) hap1Depth = hpDepth;
-            if (i == gt2) hap2Depth = hpDepth;
-        }
-        // read concordancy with with previous het variant
-        int32_t hcpv1 = -1;
-        int32_t hcpv2 = -1;
-        int32_t hdpv1 = -1;
-        int32_t hdpv2 = -1;
-        bool determinedHetConcordancy = FALSE;
-        if (prevHetVcfEntry != NULL && gt1 != gt2 && prevHetVcfEntry->gt1 >= 0 && currVcfEntry->gt1 >= 0) {
-            stSet *prevH1 = stList_get(prevHetVcfEntry->alleleIdxToReads, prevHetVcfEntry->gt1);
-            stSet *prevH2 = stList_get(prevHetVcfEntry->alleleIdxToReads, prevHetVcfEntry->gt2);
-            stSet *currH1 = stList_get(currVcfEntry->alleleIdxToReads, currVcfEntry->gt1);
-            stSet *currH2 = stList_get(currVcfEntry->alleleIdxToReads, currVcfEntry->gt2);
-            hcpv1 = (int32_t) stSet_sizeOfIntersection(prevH1, currH1);
-            hcpv2 = (int32_t) stSet_sizeOfIntersection(prevH2, currH2);
-            hdpv1 = (int32_t) stSet_sizeOfIntersection(prevH2, currH1);
-            hdpv2 = (int32_t) stSet_sizeOfIntersection(prevH1, currH2);
-            determinedHetConcordancy = TRUE;
-        }
-
-        // new phase set consideration
-        bool newPhaseSet = FALSE;
-        char *newPhaseSetReason = NULL;
-        if (gt1 != gt2 && prevHetVcfEntry == NULL) {
+    // new phase set consideration
+    bool newPhaseSet = FALSE;
+    char *newPhaseSetReason = NULL;
+    if (gt1 != gt2 && prevHetVcfEntry == NULL) {
+        newPhaseSet = TRUE;
+        st_logInfo("  Calling new phase set at %s:%"PRId64" because no previous HET\n", chrom, pos);
+        newPhaseSetReason = stString_print("NoHet\t");
+    } else if (determinedHetConcordancy) {
+        //TODO switched to AND not OR for primary phasing detection
+        if (hcpv1 == 0 && hcpv2 == 0) {
             newPhaseSet = TRUE;
-            st_logInfo("  Calling new phase set at %s:%"PRId64" because no previous HET\n", chrom, pos);
-            newPhaseSetReason = stString_print("NoHet\t");
-        } else if (determinedHetConcordancy) {
-            //TODO switched to AND not OR for primary phasing detection
-            if (hcpv1 == 0 && hcpv2 == 0) {
-                newPhaseSet = TRUE;
-                st_logInfo("  Calling new phase set at %s:%"PRId64" because missing concordancy (H1:%"PRId32", H2:%"PRId32")\n",
-                        chrom, pos, hcpv1, hcpv2);
-                newPhaseSetReason = stString_print("MissingConcordancy\tH1-%"PRId32"_H2-%"PRId32, hcpv1, hcpv2);
-            } else if (binomialPValue(hcpv1 + hcpv2, hcpv1) < params->phaseParams->phasesetMinBinomialReadSplitLikelihood) {
-                newPhaseSet = TRUE;
-                st_logInfo("  Calling new phase set at %s:%"PRId64" because unlikely concordancy (H1:%"PRId32", H2:%"PRId32", prob:%.8f)\n",
-                        chrom, pos, hcpv1, hcpv2, binomialPValue(hcpv1 + hcpv2, hcpv1));
-                newPhaseSetReason = stString_print("UnlikelyConcordancy\tH1-%"PRId32"_H2-%"PRId32"_Prob-%.8f", hcpv1, hcpv2, binomialPValue(hcpv1 + hcpv2, hcpv1));
-            } else if (1.0 * (hdpv1 + hdpv2) / (hcpv1 + hcpv2 + hdpv1 + hdpv2) > params->phaseParams->phasesetMaxDiscordantRatio) {
-                newPhaseSet = TRUE;
-                st_logInfo("  Calling new phase set at %s:%"PRId64" because of discordancy (H1D:%"PRId32"+H2D:%"PRId32" / H1C:%"PRId32"+H2C:%"PRId32"+H1D:%"PRId32"+H2D:%"PRId32" = %.4f)\n",
-                        chrom, pos, hdpv1, hdpv2, hcpv1, hcpv2, hdpv1, hdpv2, 1.0 * (hdpv1 + hdpv2) / (hcpv1 + hcpv2 + hdpv1 + hdpv2));
-                newPhaseSetReason = stString_print("Discordancy\tH1D-%"PRId32"_H2D-%"PRId32"_H1C-%"PRId32"_H2C-%"PRId32"_ratio-%.4f",
-                        hcpv1, hcpv2, hdpv1, hdpv2, 1.0 * (hdpv1 + hdpv2) / (hcpv1 + hcpv2 + hdpv1 + hdpv2));
-            }
+            st_logInfo("  Calling new phase set at %s:%"PRId64" because missing concordancy (H1:%"PRId32", H2:%"PRId32")\n",
+                    chrom, pos, hcpv1, hcpv2);
+            newPhaseSetReason = stString_print("MissingConcordancy\tH1-%"PRId32"_H2-%"PRId32, hcpv1, hcpv2);
+        } else if (binomialPValue(hcpv1 + hcpv2, hcpv1) < params->phaseParams->phasesetMinBinomialReadSplitLikelihood) {
+            newPhaseSet = TRUE;
+            st_logInfo("  Calling new phase set at %s:%"PRId64" because unlikely concordancy (H1:%"PRId32", H2:%"PRId32", prob:%.8f)\n",
+                    chrom, pos, hcpv1, hcpv2, binomialPValue(hcpv1 + hcpv2, hcpv1));
+            newPhaseSetReason = stString_print("UnlikelyConcordancy\tH1-%"PRId32"_H2-%"PRId32"_Prob-%.8f", hcpv1, hcpv2, binomialPValue(hcpv1 + hcpv2, hcpv1));
+        } else if (1.0 * (hdpv1 + hdpv2) / (hcpv1 + hcpv2 + hdpv1 + hdpv2) > params->phaseParams->phasesetMaxDiscordantRatio) {
+            newPhaseSet = TRUE;
+            st_logInfo("  Calling new phase set at %s:%"PRId64" because of discordancy (H1D:%"PRId32"+H2D:%"PRId32" / H1C:%"PRId32"+H2C:%"PRId32"+H1D:%"PRId32"+H2D:%"PRId32" = %.4f)\n",
+                    chrom, pos, hdpv1, hdpv2, hcpv1, hcpv2, hdpv1, hdpv2, 1.0 * (hdpv1 + hdpv2) / (hcpv1 + hcpv2 + hdpv1 + hdpv2));
+            newPhaseSetReason = stString_print("Discordancy\tH1D-%"PRId32"_H2D-%"PRId32"_H1C-%"PRId32"_H2C-%"PRId32"_ratio-%.4f",
+                    hcpv1, hcpv2, hdpv1, hdpv2, 1.0 * (hdpv1 + hdpv2) / (hcpv1 + hcpv2 + hdpv1 + hdpv2));
         }
+    }
 
-        if (newPhaseSet) {
-            recordPhaseSet(phaseSet, prevHetVcfEntry, phaseSetLengths, newPhaseSetReason, phaseSetBedOut);
-            free(newPhaseSetReason);
-            phaseSet = (int32_t) pos;
+    if (newPhaseSet) {
+        recordPhaseSet(writer->phaseSet, prevHetVcfEntry, writer->phaseSetLengths, newPhaseSetReason,
+                       writer->phaseSetBedOut);
+        free(newPhaseSetReason);
+        writer->phaseSet = (int32_t) pos;
+    }
+    bool writePhaseSet;
+    if (gt1 != gt2) {
+        writePhaseSet = TRUE;
+    } else {
+        writePhaseSet = FALSE;
+        writer->notPhasedBecauseMarginCalledHomozygous++;
+    }
+
+    // write values
+    int32_t *tmpia = (int*)malloc(bcf_hdr_nsamples(hdr)*2*sizeof(int));
+    if (params->phaseParams->updateAllOutputVCFFormatFields) {
+        // write everything, it is ok to clobber existing data
+        // write genotype
+        if (writePhaseSet) {
+            tmpia[0] = gt1 < 0 ? bcf_gt_missing : bcf_gt_phased(gt1);
+            tmpia[1] = gt1 < 0 ? bcf_gt_missing : bcf_gt_phased(gt2);
+        } else {
+            tmpia[0] = gt1 < 0 ? bcf_gt_missing : bcf_gt_unphased(gt1);
+            tmpia[1] = gt1 < 0 ? bcf_gt_missing : bcf_gt_unphased(gt2);
         }
-        bool writePhaseSet;
+        bcf_update_genotypes(hdr, rec, tmpia, 2);
+        // write quality info
+        tmpia[0] = gtProb;
+        bcf_update_format_int32(hdr, rec, "GQ", tmpia, 1);
+        tmpia[0] = hp1Prob;
+        tmpia[1] = hp2Prob;
+        bcf_update_format_int32(hdr, rec, "HQ", tmpia, 2);
+        // write depth info
+        tmpia[0] = depth;
+        bcf_update_format_int32(hdr, rec, "DP", tmpia, 1);
+        tmpia[0] = hap1Depth;
+        tmpia[1] = hap2Depth;
+        bcf_update_format_int32(hdr, rec, "HD", tmpia, 2);
+        // write read concordancy (only makes sense with het variants)
         if (gt1 != gt2) {
-            writePhaseSet = TRUE;
-        } else {
-            writePhaseSet = FALSE;
-            notPhasedBecauseMarginCalledHomozygous++;
+            tmpia[0] = hcpv1;
+            tmpia[1] = hcpv2;
+            bcf_update_format_int32(hdr, rec, "HCPV", tmpia, 2);
+            tmpia[0] = hdpv1;
+            tmpia[1] = hdpv2;
+            bcf_update_format_int32(hdr, rec, "HDPV", tmpia, 2);
         }
-
-        // write values
-        int32_t *tmpia = (int*)malloc(bcf_hdr_nsamples(hdr)*2*sizeof(int));
-        if (params->phaseParams->updateAllOutputVCFFormatFields) {
-            // write everything, it is ok to clobber existing data
-            // write genotype
-            if (writePhaseSet) {
-                tmpia[0] = gt1 < 0 ? bcf_gt_missing : bcf_gt_phased(gt1);
-                tmpia[1] = gt1 < 0 ? bcf_gt_missing : bcf_gt_phased(gt2);
-            } else {
-                tmpia[0] = gt1 < 0 ? bcf_gt_missing : bcf_gt_unphased(gt1);
-                tmpia[1] = gt1 < 0 ? bcf_gt_missing : bcf_gt_unphased(gt2);
-            }
-            bcf_update_genotypes(hdr, rec, tmpia, 2);
-            // write quality info
-            tmpia[0] = gtProb;
-            bcf_update_format_int32(hdr, rec, "GQ", tmpia, 1);
-            tmpia[0] = hp1Prob;
-            tmpia[1] = hp2Prob;
-            bcf_update_format_int32(hdr, rec, "HQ", tmpia, 2);
-            // write depth info
-            tmpia[0] = depth;
-            bcf_update_format_int32(hdr, rec, "DP", tmpia, 1);
-            tmpia[0] = hap1Depth;
-            tmpia[1] = hap2Depth;
-            bcf_update_format_int32(hdr, rec, "HD", tmpia, 2);
-            // write read concordancy (only makes sense with het variants)
+    } else {
+        // only write gt and phase set, not ok to clobber existing data
+        // only update genotype (and phase set) if we match the called genotype
+        if ( !( (gt1 == origGt1 && gt2 == origGt2) || (gt1 == origGt2 && gt2 == origGt1) ) ) {
+            // we have not found the same genotypes as we originally got, phasing cannot be trusted
+            writePhaseSet = FALSE;
             if (gt1 != gt2) {
-                tmpia[0] = hcpv1;
-                tmpia[1] = hcpv2;
-                bcf_update_format_int32(hdr, rec, "HCPV", tmpia, 2);
-                tmpia[0] = hdpv1;
-                tmpia[1] = hdpv2;
-                bcf_update_format_int32(hdr, rec, "HDPV", tmpia, 2);
+                writer->notPhasedBecauseMarginCalledHetDifferentFromInputVCF++;
             }
+        }
+
+        // write GT, either phased with MP or unphased
+        if (writePhaseSet) {
+            tmpia[0] = bcf_gt_phased(gt1);
+            tmpia[1] = bcf_gt_phased(gt2);
         } else {
-            // only write gt and phase set, not ok to clobber existing data
-            // only update genotype (and phase set) if we match the called genotype
-            if ( !( (gt1 == origGt1 && gt2 == origGt2) || (gt1 == origGt2 && gt2 == origGt1) ) ) {
-                // we have not found the same genotypes as we originally got, phasing cannot be trusted
-                writePhaseSet = FALSE;
-                if (gt1 != gt2) {
-                    notPhasedBecauseMarginCalledHetDifferentFromInputVCF++;
-                }
-            }
+            tmpia[0] = bcf_gt_unphased(origGt1);
+            tmpia[1] = bcf_gt_unphased(origGt2);
+        }
+        bcf_update_genotypes(hdr, rec, tmpia, 2);
+    }
 
-            // write GT, either phased with MP or unphased
-            if (writePhaseSet) {
-                tmpia[0] = bcf_gt_phased(gt1);
-                tmpia[1] = bcf_gt_phased(gt2);
-            } else {
-                tmpia[0] = bcf_gt_unphased(origGt1);
-                tmpia[1] = bcf_gt_unphased(origGt2);
+    // only update phase set on hets called by margin
+    if (writePhaseSet) {
+        tmpia[0] = writer->phaseSet;
+        bcf_update_format_int32(hdr, rec, "PS", tmpia, 1);
+        writer->totalPhasedWritten++;
+    }
+
+    // save it
+    bcf_write(fpOut, hdr, rec);
+    free(tmpia);
+}
+
+static void phasedVcfWriter_writeFinalRecords(PhasedVcfWriter *writer, bool all) {
+    /*
+     * Writes the records of the input vcf, in order, until reaching one whose phasing is not final (or the end of
+     * the input). If all is true then all the phasing is taken to be final.
+     */
+    while (!writer->inputFinished) {
+        if (!writer->hasPendingRecord) {
+            if (bcf_read(writer->fpIn, writer->hdr, writer->rec) < 0) {
+                writer->inputFinished = TRUE;
+                break;
             }
-            bcf_update_genotypes(hdr, rec, tmpia, 2);
+            //unpack for read REF,ALT,INFO,etc
+            bcf_unpack(writer->rec, BCF_UN_ALL);
+            writer->hasPendingRecord = TRUE;
         }
-
-        // only update phase set on hets called by margin
-        if (writePhaseSet) {
-            tmpia[0] = phaseSet;
-            bcf_update_format_int32(hdr, rec, "PS", tmpia, 1);
-            totalPhasedWritten++;
+        if (!all && !phasedVcfWriter_isFinal(writer, bcf_hdr_id2name(writer->hdr, writer->rec->rid),
+                                             writer->rec->pos)) {
+            break;
         }
+        phasedVcfWriter_writeRecord(writer);
+        writer->hasPendingRecord = FALSE;
+    }
+}
 
-        // save it
-        bcf_write(fpOut, hdr, rec);
-        free(tmpia);
+void phasedVcfWriter_finishChunk(PhasedVcfWriter *writer, int64_t chunkIdx, bool wasSwitched) {
+    /*
+     * Applies the chunk's switch state to its vcf entries, making their phasing final, and writes out any records
+     * that were waiting on them.
+     */
+    assert(writer->chunker != NULL);
+    if (chunkIdx != writer->nextChunkIdx) {
+        st_errAbort("Got chunk %"PRId64" but expected chunk %"PRId64" when writing phased VCF\n", chunkIdx,
+                    writer->nextChunkIdx);
+    }
+    writer->nextChunkIdx++;
+
+    // apply the switch state
+    BamChunk *chunk = stList_get(writer->chunker->chunks, chunkIdx);
+    switchHaplotypesInVcfEntriesOfChunk(chunk, stHash_search(writer->vcfEntryMap, chunk->refSeqName), wasSwitched,
+                                        &writer->totalSwitchedVcfEntries, &writer->totalSwitchableVcfEntries);
+
+    // mark the chunk's positions as final
+    if (chunkIdx + 1 == writer->chunker->chunkCount ||
+        !stString_eq(chunk->refSeqName, ((BamChunk *) stList_get(writer->chunker->chunks, chunkIdx + 1))->refSeqName)) {
+        stSet_insert(writer->finishedContigs, chunk->refSeqName);
+        writer->finishingContig = NULL;
+    } else {
+        writer->finishingContig = chunk->refSeqName;
+        writer->finalUpToPos = chunk->chunkEnd;
     }
 
+    phasedVcfWriter_writeFinalRecords(writer, FALSE);
+}
+
+void phasedVcfWriter_destruct(PhasedVcfWriter *writer) {
+    /*
+     * Writes any remaining records, taking all phasing as final, then closes (and if compressed, indexes) the output.
+     */
+    Params *params = writer->params;
+    phasedVcfWriter_writeFinalRecords(writer, TRUE);
+
     // loggit
+    if (writer->chunker != NULL) {
+        st_logInfo("  Switched %"PRId64"/%"PRId64" (%.2f) VCF entry haplotypes after stitching\n",
+                   writer->totalSwitchedVcfEntries, writer->totalSwitchableVcfEntries,
+                   1.0 * writer->totalSwitchedVcfEntries / writer->totalSwitchableVcfEntries);
+    }
     if (params->phaseParams->updateAllOutputVCFFormatFields) {
         st_logCritical("  Wrote %"PRId64" variants: %"PRId64" were phased; skipped %"PRId64" for not being analyzed, %"PRId64" for being homozygous\n",
-                totalEntries, totalPhasedWritten, skippedBecasueNotConsidered, notPhasedBecauseMarginCalledHomozygous);
+                writer->totalEntries, writer->totalPhasedWritten, writer->skippedBecasueNotConsidered,
+                writer->notPhasedBecauseMarginCalledHomozygous);
     } else {
         st_logCritical("  Wrote %"PRId64" variants: %"PRId64" were phased; skipped %"PRId64" for not being analyzed, %"PRId64" for being homozygous, %"PRId64" for disagreement with margin\n",
-                       totalEntries, totalPhasedWritten, skippedBecasueNotConsidered,
-                       notPhasedBecauseMarginCalledHomozygous, notPhasedBecauseMarginCalledHetDifferentFromInputVCF);
+                       writer->totalEntries, writer->totalPhasedWritten, writer->skippedBecasueNotConsidered,
+                       writer->notPhasedBecauseMarginCalledHomozygous,
+                       writer->notPhasedBecauseMarginCalledHetDifferentFromInputVCF);
     }
 
     // finish phase sets
-    recordPhaseSet(phaseSet, prevHetVcfEntry, phaseSetLengths, "ContigEnd\t", phaseSetBedOut);
+    stList *phaseSetLengths = writer->phaseSetLengths;
+    recordPhaseSet(writer->phaseSet, writer->prevHetVcfEntry, phaseSetLengths, "ContigEnd\t", writer->phaseSetBedOut);
     stList_sort(phaseSetLengths, cmpint64);
     int64_t minPhaseSetLen = INT64_MAX;
     int64_t maxPhaseSetLen = 0;
@@ -992,18 +1415,45 @@ void writePhasedVcf(char *inputVcfFile, char *regionStr, char *outputVcfFile, ch
 
 
     // cleanup
-    if (currChrom != NULL) free(currChrom);
+    if (writer->currChrom != NULL) free(writer->currChrom);
     stList_destruct(phaseSetLengths);
-    bcf_destroy(rec);
-    bcf_hdr_destroy(hdr);
+    bcf_destroy(writer->rec);
+    bcf_hdr_destroy(writer->hdr);
     int ret;
-    if ( (ret=hts_close(fpIn)) ) {
-        st_logCritical("  Failed to close input VCF %s with code %d!\n", inputVcfFile, ret);
+    if ( (ret=hts_close(writer->fpIn)) ) {
+        st_logCritical("  Failed to close input VCF %s with code %d!\n", writer->inputVcfFile, ret);
+    }
+#if defined(HTS_VERSION) && HTS_VERSION >= 101100
+    if (writer->indexingOutput && bcf_idx_save(writer->fpOut) != 0) {
+        st_logCritical("  Failed to write tabix index for output VCF %s, indexing it after closing\n",
+                       writer->outputVcfFile);
+        writer->indexingOutput = FALSE;
+    }
+#endif
+    if ( (ret=hts_close(writer->fpOut)) ) {
+        st_logCritical("  Failed to close output VCF %s with code %d!\n", writer->outputVcfFile, ret);
+    } else if (writer->compressOutput && !writer->indexingOutput &&
+               tbx_index_build(writer->outputVcfFile, 0, &tbx_conf_vcf) != 0) {
+        st_logCritical("  Failed to build tabix index for output VCF %s!\n", writer->outputVcfFile);
+    }
+    if (writer->phaseSetBedOut != NULL) {
+        fclose(writer->phaseSetBedOut);
     }
-    if ( (ret=hts_close(fpOut)) ) {
-        st_logCritical("  Failed to close output VCF %s with code %d!\n", outputVcfFile, ret);
+    if (writer->chunker != NULL) {
+        stSet_destruct(writer->contigsWithChunks);
+        stSet_destruct(writer->finishedContigs);
     }
-    if (phaseSetBedOut != NULL) {
-        fclose(phaseSetBedOut);
+    if (writer->regionStr != NULL) free(writer->regionStr);
+    free(writer->inputVcfFile);
+    free(writer->outputVcfFile);
+    free(writer);
+}
+
+void writePhasedVcf(char *inputVcfFile, char *regionStr, char *outputVcfFile, char *phaseSetBedFile,
+        stHash *vcfEntryMap, Params *params) {
+    PhasedVcfWriter *writer = phasedVcfWriter_construct(inputVcfFile, regionStr, outputVcfFile, phaseSetBedFile,
+                                                        vcfEntryMap, NULL, params);
+    if (writer != NULL) {
+        phasedVcfWriter_destruct(writer);
     }
 }
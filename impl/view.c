@@ -6,29 +6,52 @@
 
 #include <margin.h>
 
-static int64_t *msaView_set(MsaView *view, int64_t refCoordinate, int64_t seqIndex) {
-    return &(view->seqCoordinates[(view->refLength + 1) * seqIndex + refCoordinate]);
+static int64_t msaView_get(MsaView *view, int64_t refCoordinate, int64_t seqIndex) {
+    // Returns the coordinate of the position + 2 in the non-ref sequence aligned to the reference position, or, if
+    // the non-ref sequence is not aligned there, -1 times the coordinate + 2 of the rightmost position aligned to the
+    // prefix of the reference up to the position, or -1 if there is none
+    MsaViewSegment *segments = &(view->seqSegments[view->firstSeqSegments[seqIndex]]);
+    int64_t segmentNo = view->firstSeqSegments[seqIndex + 1] - view->firstSeqSegments[seqIndex];
+
+    // Binary search for the last segment starting at or before the reference position
+    int64_t min = 0, max = segmentNo;
+    while (min < max) {
+        int64_t mid = min + (max - min) / 2;
+        if (segments[mid].refStart <= refCoordinate) {
+            min = mid + 1;
+        } else {
+            max = mid;
+        }
+    }
+    if (min == 0) {
+        return -1;
+    }
+    MsaViewSegment *segment = &(segments[min - 1]);
+    if (refCoordinate < segment->refStart + segment->length) {
+        return segment->seqStart + refCoordinate - segment->refStart + 2;
+    }
+    return -(segment->seqStart + segment->length + 1);
 }
 
 int64_t msaView_getSeqCoordinate(MsaView *view, int64_t refCoordinate, int64_t seqIndex) {
-    int64_t i = msaView_set(view, refCoordinate, seqIndex)[0];
+    int64_t i = msaView_get(view, refCoordinate, seqIndex);
     return i < 0 ? -1 : i - 2;
 }
 
 int64_t msaView_getUpToSeqCoordinate(MsaView *view, int64_t refCoordinate, int64_t seqIndex) {
-    int64_t i = msaView_set(view, refCoordinate, seqIndex)[0];
+    int64_t i = msaView_get(view, refCoordinate, seqIndex);
     return i < 0 ? -i - 2 : i - 2;
 }
 
 int64_t msaView_getPrecedingInsertLength(MsaView *view, int64_t rightRefCoordinate, int64_t seqIndex) {
-    int64_t i = msaView_set(view, rightRefCoordinate, seqIndex)[0];
+    int64_t i = msaView_get(view, rightRefCoordinate, seqIndex);
     if (i < 0) {
         return 0;
     }
     if (rightRefCoordinate == 0) {
         return i - 2;
     }
-    int64_t j = msaView_set(view, rightRefCoordinate - 1, seqIndex)[0];
+    int64_t j = msaView_get(view, rightRefCoordinate - 1, seqIndex);
     if (j < 0) {
         return i + j - 1;
     }
@@ -71,48 +94,79 @@ MsaView *msaView_construct(char *refSeq, char *refName,
     view->seqNo = stList_length(refToSeqAlignments);
     view->seqs = seqs; // This is not copied
     view->seqNames = seqNames; // Ditto
-    view->seqCoordinates = st_calloc(view->seqNo * (view->refLength + 1), sizeof(int64_t)); // At each
-    // reference position for each non-ref sequence stores the coordinate of the position + 1 in the non-ref sequence aligned
-    // to the reference position, if non-ref sequence is aligned at that position stores then stores -1 times the index
-    // of the rightmost position aligned to the prefix of the reference up to that position + 1. The plus ones are to avoid
-    // dealing with difference between 0 and -0. This storage format is sufficient to represent the alignment in an easy
-    // to access format
 
+    // The alignment of each non-ref sequence is stored as the runs of reference positions aligned to consecutive
+    // positions of the non-ref sequence, the end of the reference being aligned to the end of the non-ref sequence.
+    // Reads are mostly aligned in long gapless runs, so this takes memory in proportion to the number of indels rather
+    // than the reference length times the number of sequences
+    int64_t *column = st_malloc((view->refLength + 1) * sizeof(int64_t)); // Scratch, reused for each sequence
+    int64_t maxSegmentNo = view->seqNo + 1;
+    view->seqSegments = st_malloc(maxSegmentNo * sizeof(MsaViewSegment));
+    view->firstSeqSegments = st_malloc((view->seqNo + 1) * sizeof(int64_t));
+    int64_t segmentNo = 0;
     for (int64_t i = 0; i < view->seqNo; i++) {
+        for (int64_t j = 0; j < view->refLength; j++) {
+            column[j] = -1;
+        }
         stList *alignment = stList_get(refToSeqAlignments, i);
         for (int64_t j = 0; j < stList_length(alignment); j++) {
             stIntTuple *alignedPair = stList_get(alignment, j);
-            msaView_set(view, stIntTuple_get(alignedPair, 1), i)[0] = stIntTuple_get(alignedPair, 2) + 2;
+            column[stIntTuple_get(alignedPair, 1)] = stIntTuple_get(alignedPair, 2);
         }
-        msaView_set(view, view->refLength, i)[0] = strlen(stList_get(view->seqs, i)) + 2;
-        int64_t k = 1;
-        for (int64_t j = 0; j < view->refLength; j++) {
-            int64_t *l = msaView_set(view, j, i);
-            if (l[0] == 0) {
-                l[0] = -k;
-            } else {
-                k = l[0];
+        column[view->refLength] = strlen(stList_get(view->seqs, i));
+
+        view->firstSeqSegments[i] = segmentNo;
+        for (int64_t j = 0; j < view->refLength + 1; j++) {
+            if (column[j] == -1) {
+                continue;
             }
+            if (segmentNo > view->firstSeqSegments[i]) {
+                MsaViewSegment *segment = &(view->seqSegments[segmentNo - 1]);
+                if (segment->refStart + segment->length == j && segment->seqStart + segment->length == column[j]) {
+                    segment->length++; // Extends the current run
+                    continue;
+                }
+            }
+            if (segmentNo == maxSegmentNo) {
+                maxSegmentNo *= 2;
+                view->seqSegments = st_realloc(view->seqSegments, maxSegmentNo * sizeof(MsaViewSegment));
+            }
+            MsaViewSegment *segment = &(view->seqSegments[segmentNo++]);
+            segment->refStart = j;
+            segment->length = 1;
+            segment->seqStart = column[j];
         }
     }
+    view->firstSeqSegments[view->seqNo] = segmentNo;
+    free(column);
 
+    // An insert can only precede the first position of a run, its length being the gap in the non-ref sequence since
+    // the previous run
     view->maxPrecedingInsertLengths = st_calloc(view->refLength + 1, sizeof(int64_t));
-    view->precedingInsertCoverages = st_calloc(view->refLength + 1, sizeof(int64_t *));
-    for (int64_t j = 0; j < view->refLength + 1; j++) {
-        int64_t maxIndelLength = 0;
-        for (int64_t i = 0; i < view->seqNo; i++) {
-            int64_t k = msaView_getPrecedingInsertLength(view, j, i);
-            if (k > maxIndelLength) {
-                maxIndelLength = k;
+    for (int64_t i = 0; i < view->seqNo; i++) {
+        int64_t lastSeqCoordinate = -1;
+        for (int64_t k = view->firstSeqSegments[i]; k < view->firstSeqSegments[i + 1]; k++) {
+            MsaViewSegment *segment = &(view->seqSegments[k]);
+            int64_t indelLength = segment->seqStart - lastSeqCoordinate - 1;
+            if (indelLength > view->maxPrecedingInsertLengths[segment->refStart]) {
+                view->maxPrecedingInsertLengths[segment->refStart] = indelLength;
             }
+            lastSeqCoordinate = segment->seqStart + segment->length - 1;
         }
-        view->maxPrecedingInsertLengths[j] = maxIndelLength;
-        view->precedingInsertCoverages[j] = st_calloc(maxIndelLength, sizeof(int64_t));
-        for (int64_t i = 0; i < view->seqNo; i++) {
-            int64_t k = msaView_getPrecedingInsertLength(view, j, i);
-            for (int64_t l = 0; l < k; l++) {
-                view->precedingInsertCoverages[j][l]++;
+    }
+    view->precedingInsertCoverages = st_calloc(view->refLength + 1, sizeof(int64_t *));
+    for (int64_t j = 0; j < view->refLength + 1; j++) {
+        view->precedingInsertCoverages[j] = st_calloc(view->maxPrecedingInsertLengths[j], sizeof(int64_t));
+    }
+    for (int64_t i = 0; i < view->seqNo; i++) {
+        int64_t lastSeqCoordinate = -1;
+        for (int64_t k = view->firstSeqSegments[i]; k < view->firstSeqSegments[i + 1]; k++) {
+            MsaViewSegment *segment = &(view->seqSegments[k]);
+            int64_t indelLength = segment->seqStart - lastSeqCoordinate - 1;
+            for (int64_t l = 0; l < indelLength; l++) {
+                view->precedingInsertCoverages[segment->refStart][l]++;
             }
+            lastSeqCoordinate = segment->seqStart + segment->length - 1;
         }
     }
 
@@ -125,7 +179,8 @@ void msaView_destruct(MsaView *view) {
     }
     free(view->precedingInsertCoverages);
     free(view->maxPrecedingInsertLengths);
-    free(view->seqCoordinates);
+    free(view->seqSegments);
+    free(view->firstSeqSegments);
     free(view);
 }
 
@@ -231,7 +286,7 @@ char repeatCountToChar(int64_t repeatCount) {
 
 char refCharRepeatCountFn(int64_t refCoordinate, void *extraArg) {
     RleString *refString = ((void **) extraArg)[0];
-    return repeatCountToChar(refString->repeatCounts[refCoordinate]);
+    return repeatCountToChar(rleString_getRepeatCount(refString, refCoordinate));
 }
 
 char seqCharRepeatCountFn(int64_t seq, int64_t seqCoordinate, int64_t refCoordinate, void *extraArg) {
@@ -239,8 +294,8 @@ char seqCharRepeatCountFn(int64_t seq, int64_t seqCoordinate, int64_t refCoordin
     stList *rleStrings = ((void **) extraArg)[1];
     RleString *rleString = stList_get(rleStrings, seq);
 
-    int64_t refRepeatCount = refCoordinate >= 0 ? refString->repeatCounts[refCoordinate] : -1;
-    int64_t seqRepeatCount = rleString->repeatCounts[seqCoordinate];
+    int64_t refRepeatCount = refCoordinate >= 0 ? rleString_getRepeatCount(refString, refCoordinate) : -1;
+    int64_t seqRepeatCount = rleString_getRepeatCount(rleString, seqCoordinate);
 
     return refRepeatCount == seqRepeatCount ? '*' : repeatCountToChar(seqRepeatCount);
 }
@@ -33,8 +33,8 @@ struct _poaFeatureSplitRleWeight {
     int64_t labelRunLength;
     PoaFeatureSplitRleWeight *nextRunLength; //so we can model all inserts after a position
     PoaFeatureSplitRleWeight *nextInsert; //so we can model all inserts after a position
-    double *weights;
     int64_t maxRunLength;
+    double weights[]; // allocated with the feature
 };
 
 typedef struct _poaFeatureChannelRleWeight PoaFeatureChannelRleWeight;
@@ -46,9 +46,10 @@ struct _poaFeatureChannelRleWeight {
     int64_t labelRunLength;
     PoaFeatureChannelRleWeight *nextRunLength; //so we can model all inserts after a position
     PoaFeatureChannelRleWeight *nextInsert; //so we can model all inserts after a position
-    double *nucleotideWeights;
-    double *runLengthWeights;
+    double *nucleotideWeights; // points into weights
+    double *runLengthWeights; // points into weights, after the nucleotide weights
     int64_t maxRunLength;
+    double weights[]; // allocated with the feature
 };
 
 typedef struct _HelenFeatureHDF5FileInfo HelenFeatureHDF5FileInfo;
@@ -135,6 +136,8 @@ stList *alignConsensusAndTruthCPECAN(char *consensusStr, char *truthStr, double
 stList *alignConsensusAndTruthRLE(RleString *consensusStr, RleString *truthStr, double *score, PolishParams *polishParams);
 stList *alignConsensusAndTruthRLEWithKmerAnchors(RleString *consensusStr, RleString *truthStr, double *score,
                                                  PolishParams *polishParams);
+stList *alignConsensusAndTruthRLEWithExactMatchProjection(RleString *consensusStr, RleString *truthStr, double *score,
+                                                          PolishParams *polishParams);
 stList *alignConsensusAndTruthRLEWithSSWAnchors(RleString *consensusStr, RleString *truthStr, double *score,
                                                 PolishParams *polishParams);
 void annotateHelenFeaturesWithTruth(stList *features, HelenFeatureType featureType, stList *trueRefAlignment,
@@ -10,6 +10,7 @@
 
 #include <htslib/hts.h>
 #include <htslib/vcf.h>
+#include <htslib/tbx.h>
 #include <htslib/kstring.h>
 #include <htslib/kseq.h>
 
@@ -24,12 +25,23 @@ struct _phasedVariant {
     char *phaseSet;
 };
 
+// a VCF read a contig at a time through its index, a tabix index of a bgzipped VCF or a csi index of a BCF
+typedef struct _phasedVcfReader PhasedVcfReader;
+struct _phasedVcfReader {
+    char *vcfFile;
+    htsFile *fp;
+    bcf_hdr_t *hdr;
+    hts_idx_t *idx; // of a BCF, else NULL
+    tbx_t *tbx; // of a bgzipped VCF, else NULL
+    bool phaseSetIsInt;
+};
+
 typedef struct _partialPhaseSums PartialPhaseSums;
 struct _partialPhaseSums {
     char *queryPhaseSet;
     char *truthPhaseSet;
-    double phaseSum1;
-    double phaseSum2;
+    double *phaseSum1; // one entry per decay being evaluated
+    double *phaseSum2;
 };
 
 typedef struct _variantCorrectness VariantCorrectness;
@@ -48,15 +60,30 @@ int phasedVariant_positionCmp(const void *a, const void *b);
 
 stHash *getPhasedVariants(const char *vcfFile);
 
+// aborts if the VCF is not indexed
+PhasedVcfReader *phasedVcfReader_construct(const char *vcfFile);
+
+void phasedVcfReader_destruct(PhasedVcfReader *reader);
+
+// the contigs of the VCF's index
+stList *phasedVcfReader_getContigs(PhasedVcfReader *reader);
+
+// the phased variants of the contig, as getPhasedVariants gets them, sorted by position
+stList *phasedVcfReader_getContigVariants(PhasedVcfReader *reader, const char *contig);
+
 stList *getSharedContigs(stHash *entry1, stHash *entry2);
 
 VariantCorrectness *variantCorrectness_construct(int64_t refPos, double correctness, double maxCorrectness);
 
 void variantCorrectness_destruct(VariantCorrectness* vc);
 
+// the sum of the distances between consecutive variants shared by the query and truth of a contig, and the number of
+// those distances
+int64_t variantDistSum(stList *queryPhasedVariants, stList *truthPhasedVariants, int64_t *numPairsOut);
+
 double meanVariantDist(stHash *query, stHash *truth, stList *sharedContigs);
 
-PartialPhaseSums *partialPhaseSums_construct(const char *queryPhaseSet, const char *truthPhaseSet);
+PartialPhaseSums *partialPhaseSums_construct(const char *queryPhaseSet, const char *truthPhaseSet, int64_t numDecays);
 
 void partialPhaseSums_destruct(PartialPhaseSums *pps);
 
@@ -66,3 +93,9 @@ double phasingCorrectness(stList *queryPhasedVariants, stList *truthPhasedVarian
                           bool bySeqDist, bool crossBlockCorrect, double *effectivePairCountOut,
                           stList* variantCorrectnessOut);
 
+// evaluates phasingCorrectness for each of the decays, in a single pass over the variants in each
+// direction, writing the results to the numDecays long output arrays (effectivePairCountsOut may be NULL)
+void phasingCorrectnessForDecays(stList *queryPhasedVariants, stList *truthPhasedVariants, double *decays,
+                                 int64_t numDecays, bool bySeqDist, bool crossBlockCorrect, double *correctnessOut,
+                                 double *effectivePairCountsOut);
+
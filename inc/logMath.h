@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2020 by Benedict Paten (benedictpaten@gmail.com)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+/*
+ * Log space math shared by the pair-HMM, the POA and the phasing HMM. log(exp(x) + exp(y)) is computed by one of
+ * three kernels: exactly with log1p, by a piecewise cubic approximation or by interpolating a table. The kernels are
+ * inline so that the lane loops of the diagonal calculations vectorise them.
+ */
+
+#ifndef LOGMATH_H_
+#define LOGMATH_H_
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define LOG_ZERO -INFINITY
+
+// The approximate and table kernels take log(exp(x) + exp(y)) to be max(x, y) once |x - y| reaches this
+#define LOG_MATH_UNDERFLOW_THRESHOLD 7.5
+
+// Entries of the table per unit of difference, the interpolation error is below 1e-5
+#define LOG_MATH_TABLE_RESOLUTION 64
+#define LOG_MATH_TABLE_LENGTH 482 // LOG_MATH_UNDERFLOW_THRESHOLD * LOG_MATH_TABLE_RESOLUTION + 2
+
+typedef enum _logAddKernel {
+    LOG_ADD_DEFAULT = 0, // logAdd is approximate, logAddPrecise is exact
+    LOG_ADD_EXACT = 1,
+    LOG_ADD_APPROXIMATE = 2,
+    LOG_ADD_TABLE = 3
+} LogAddKernel;
+
+// The kernel used by logAdd and logAddPrecise, set with setLogAddKernel
+extern LogAddKernel logAddKernel;
+
+// log(exp(x) + 1) at x = i / LOG_MATH_TABLE_RESOLUTION, filled when the table kernel is set
+extern double logMathTable[LOG_MATH_TABLE_LENGTH];
+
+/*
+ * log(exp(x) + 1) for 0 <= x <= LOG_MATH_UNDERFLOW_THRESHOLD.
+ */
+static inline double logMath_log1pExpApproximate(double x) {
+    if (x <= 1.00f)
+        return ((-0.009350833524763f * x + 0.130659527668286f) * x + 0.498799810682272f) * x + 0.693203116424741f;
+    if (x <= 2.50f)
+        return ((-0.014532321752540f * x + 0.139942324101744f) * x + 0.495635523139337f) * x + 0.692140569840976f;
+    if (x <= 4.50f)
+        return ((-0.004605031767994f * x + 0.063427417320019f) * x + 0.695956496475118f) * x + 0.514272634594009f;
+    return ((-0.000458661602210f * x + 0.009695946122598f) * x + 0.930734667215156f) * x + 0.168037164329057f;
+}
+
+/*
+ * Same as logMath_log1pExpApproximate, but selects the polynomial without branching.
+ */
+static inline double logMath_log1pExpApproximateBranchless(double x) {
+    double a = x <= 1.00f ? -0.009350833524763f : (x <= 2.50f ? -0.014532321752540f :
+                                                  (x <= 4.50f ? -0.004605031767994f : -0.000458661602210f));
+    double b = x <= 1.00f ? 0.130659527668286f : (x <= 2.50f ? 0.139942324101744f :
+                                                 (x <= 4.50f ? 0.063427417320019f : 0.009695946122598f));
+    double c = x <= 1.00f ? 0.498799810682272f : (x <= 2.50f ? 0.495635523139337f :
+                                                 (x <= 4.50f ? 0.695956496475118f : 0.930734667215156f));
+    double d = x <= 1.00f ? 0.693203116424741f : (x <= 2.50f ? 0.692140569840976f :
+                                                 (x <= 4.50f ? 0.514272634594009f : 0.168037164329057f));
+    return ((a * x + b) * x + c) * x + d;
+}
+
+/*
+ * log(exp(x) + 1) for 0 <= x < LOG_MATH_UNDERFLOW_THRESHOLD, from the table.
+ */
+static inline double logMath_log1pExpTable(double x) {
+    double s = x * LOG_MATH_TABLE_RESOLUTION;
+    int64_t i = (int64_t) s;
+    return logMathTable[i] + (s - i) * (logMathTable[i + 1] - logMathTable[i]);
+}
+
+static inline double logMath_logAddExact(double x, double y) {
+    double hi = x < y ? y : x;
+    double lo = x < y ? x : y;
+    return lo == LOG_ZERO ? hi : hi + log1p(exp(lo - hi));
+}
+
+static inline double logMath_logAddApproximate(double x, double y) {
+    if (x < y)
+        return (x == LOG_ZERO || y - x >= LOG_MATH_UNDERFLOW_THRESHOLD) ? y : logMath_log1pExpApproximate(y - x) + x;
+    return (y == LOG_ZERO || x - y >= LOG_MATH_UNDERFLOW_THRESHOLD) ? x : logMath_log1pExpApproximate(x - y) + y;
+}
+
+/*
+ * Same as logMath_logAddApproximate, but without branching, for the lane loops. If both arguments are LOG_ZERO the
+ * difference is NaN, which fails the threshold comparison and so LOG_ZERO is returned.
+ */
+static inline double logMath_logAddApproximateBranchless(double x, double y) {
+    double hi = x < y ? y : x;
+    double lo = x < y ? x : y;
+    double d = hi - lo;
+    return d < LOG_MATH_UNDERFLOW_THRESHOLD ? logMath_log1pExpApproximateBranchless(d) + lo : hi;
+}
+
+static inline double logMath_logAddTable(double x, double y) {
+    double hi = x < y ? y : x;
+    double lo = x < y ? x : y;
+    double d = hi - lo;
+    return d < LOG_MATH_UNDERFLOW_THRESHOLD ? logMath_log1pExpTable(d) + lo : hi;
+}
+
+static inline double logMath_logAdd(LogAddKernel kernel, double x, double y) {
+    switch (kernel) {
+        case LOG_ADD_EXACT:
+            return logMath_logAddExact(x, y);
+        case LOG_ADD_TABLE:
+            return logMath_logAddTable(x, y);
+        default:
+            return logMath_logAddApproximate(x, y);
+    }
+}
+
+/*
+ * The log add of the pair-HMM and the POA, approximate unless another kernel is set.
+ */
+static inline double logAdd(double x, double y) {
+    return logMath_logAdd(logAddKernel, x, y);
+}
+
+/*
+ * The log add of the phasing, exact unless another kernel is set.
+ */
+static inline double logAddPrecise(double x, double y) {
+    return logMath_logAdd(logAddKernel == LOG_ADD_DEFAULT ? LOG_ADD_EXACT : logAddKernel, x, y);
+}
+
+/*
+ * Sets the kernel of logAdd and logAddPrecise, not to be called while they are in use. params_readParams sets the
+ * kernel of the polish params' logAddKernel.
+ */
+void setLogAddKernel(LogAddKernel kernel);
+
+#endif /* LOGMATH_H_ */
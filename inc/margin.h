@@ -52,6 +52,7 @@ typedef struct _stRPColumn stRPColumn;
 typedef struct _stRPCell stRPCell;
 typedef struct _stRPMergeColumn stRPMergeColumn;
 typedef struct _stRPMergeCell stRPMergeCell;
+typedef struct _stRPColumnEmissions stRPColumnEmissions;
 typedef struct _stGenomeFragment stGenomeFragment;
 
 /*
@@ -87,10 +88,24 @@ typedef struct _params Params;
 struct _params {
 	PolishParams *polishParams;
 	stRPHmmParameters *phaseParams;
+	uint64_t fingerprint; // A chunk journal fingerprint of the resolved parameters: each setting parsed, in the order
+	// applied, with those of included files in place of their "include" (see chunkJournal_fingerprintString)
 };
 
 Params *params_readParams(char *paramsFile);
 
+/*
+ * Parses the params of the file and keeps them, so that the next call of params_readParams for the same file in this
+ * process returns them rather than parsing the file again, handing them to the caller. Used by 'margin serve', which
+ * runs each request in a child process forked after the params are kept.
+ */
+void params_keepParams(char *paramsFile);
+
+/*
+ * Gets the params kept for the file by params_keepParams, which stay kept, or NULL if none are.
+ */
+Params *params_getKeptParams(char *paramsFile);
+
 void params_destruct(Params *params);
 
 void params_printParameters(Params *params, FILE *fh);
@@ -108,6 +123,18 @@ stList *getTilingPaths(stSortedSet *hmms);
 
 stSet *getOverlappingComponents(stList *tilingPath1, stList *tilingPath2);
 
+/*
+ * A connected component of overlapping hmms from two tiling paths, given by the half open ranges of the
+ * indices of its hmms in each path, see getOverlappingComponents2.
+ */
+typedef struct _tilingPathComponent {
+	int64_t start1, end1; // The hmms of the component in tilingPath1
+	int64_t start2, end2; // The hmms of the component in tilingPath2
+	int64_t refLength; // The total reference length of the hmms, a proxy for the cost of merging them
+} TilingPathComponent;
+
+TilingPathComponent *getOverlappingComponents2(stList *tilingPath1, stList *tilingPath2, int64_t *componentNumber);
+
 stList *mergeTwoTilingPaths(stList *tilingPath1, stList *tilingPath2);
 
 stRPHmm *fuseTilingPath(stList *tilingPath);
@@ -139,22 +166,59 @@ double logAddP(double a, double b, bool maxNotSum);
  */
 
 // The maximum read depth the model can support
-#define MAX_READ_PARTITIONING_DEPTH 64
+#define MAX_READ_PARTITIONING_DEPTH 128
+
+// The maximum read depth of a column whose partitions fit in one 64 bit word. The bit count vectors and emissions of
+// columns no deeper than this use one word per bit plane, and of deeper columns two, see calculateCountBitVectors.
+#define NARROW_PARTITIONING_DEPTH 64
+
+// A read partition or mask, bit i for the i-th read of a column. Only eight byte aligned, as the cells holding them are
+// allocated from the chunk arena, whose allocations are eight byte aligned.
+typedef uint128_t stRPPartition __attribute__((aligned(8)));
+
+char *intToBinaryString(stRPPartition i);
+
+stRPPartition makeAcceptMask(uint64_t depth);
+
+stRPPartition mergePartitionsOrMasks(stRPPartition partition1, stRPPartition partition2,
+									 uint64_t depthOfPartition1, uint64_t depthOfPartition2);
+
+stRPPartition maskPartition(stRPPartition partition, stRPPartition mask);
 
-char *intToBinaryString(uint64_t i);
+bool seqInHap1(stRPPartition partition, int64_t seqIndex);
 
-uint64_t makeAcceptMask(uint64_t depth);
+stRPPartition invertPartition(stRPPartition partition, uint64_t depth);
 
-uint64_t mergePartitionsOrMasks(uint64_t partition1, uint64_t partition2,
-								uint64_t depthOfPartition1, uint64_t depthOfPartition2);
+stRPPartition flipAReadsPartition(stRPPartition partition, uint64_t readIndex);
 
-uint64_t maskPartition(uint64_t partition, uint64_t mask);
+/*
+ * Open addressing hash map from partitions to values held in its slots, for the hot paths where stHash's chained,
+ * boxed entries cost too much. NULL values can not be stored, as NULL is returned for absent keys.
+ */
+typedef struct _partitionMap PartitionMap;
+
+PartitionMap *partitionMap_construct(int64_t expectedSize);
+
+// As partitionMap_construct, destructing the values with destructValue when the map is destructed
+PartitionMap *partitionMap_construct2(int64_t expectedSize, void (*destructValue)(void *));
+
+void partitionMap_destruct(PartitionMap *map);
+
+int64_t partitionMap_size(PartitionMap *map);
+
+void *partitionMap_search(PartitionMap *map, stRPPartition key);
+
+// Inserts the key with the value, replacing the value of the key if it is present
+void partitionMap_insert(PartitionMap *map, stRPPartition key, void *value);
 
-bool seqInHap1(uint64_t partition, int64_t seqIndex);
+// Removes the key, returning its value, or NULL if it is absent. The value is not destructed.
+void *partitionMap_remove(PartitionMap *map, stRPPartition key);
 
-uint64_t invertPartition(uint64_t partition, uint64_t depth);
+// Iterates the values: starting with *slot as 0, returns the next value, or NULL after the last. The map must not be
+// changed while iterating.
+void *partitionMap_getNext(PartitionMap *map, uint64_t *slot);
 
-uint64_t flipAReadsPartition(uint64_t partition, uint64_t readIndex);
+stList *partitionMap_getValues(PartitionMap *map);
 
 
 /*
@@ -218,7 +282,7 @@ double emissionLogProbability(stRPColumn *column, stRPCell *cell, uint64_t *bitC
 							  stReference *reference,
 							  stRPHmmParameters *params);
 
-void fillInPredictedGenome(stGenomeFragment *gF, uint64_t partition,
+void fillInPredictedGenome(stGenomeFragment *gF, stRPPartition partition,
 						   stRPColumn *column, stRPHmmParameters *params);
 
 /*
@@ -226,9 +290,14 @@ void fillInPredictedGenome(stGenomeFragment *gF, uint64_t partition,
 */
 int popcount64(uint64_t x);
 
-uint64_t getLogProbOfAllele(uint64_t *bitCountVectors, uint64_t depth, uint64_t partition,
+int popcount128(uint128_t x);
+
+uint64_t getLogProbOfAllele(uint64_t *bitCountVectors, uint64_t depth, stRPPartition partition,
 							uint64_t siteOffset, uint64_t allele);
 
+// Toggles the AVX-512 / AVX2 allele probabilities, where the host supports them
+void setEmissionsUseVectorisedPopcount(bool useVectorised);
+
 uint64_t *calculateCountBitVectors(uint8_t **seqs, stReference *ref,
 								   uint64_t firstSite, uint64_t length, uint64_t depth);
 
@@ -242,12 +311,26 @@ struct _stRPHmmParameters {
 	 */
 	bool maxNotSumTransitions;
 
+	// If true, or if maxNotSumTransitions is, the phasing hmms are run with stRPHmm_viterbi, finding the most
+	// probable path without a backward pass
+	bool viterbiPhasing;
+
 	// Filters on the number of states in a column
 	// Used to prune the hmm
 	int64_t minPartitionsInAColumn;
 	int64_t maxPartitionsInAColumn;
 	double minPosteriorProbabilityForPartition;
 
+	// Beam used during the forward pass, discarding cells as each column is computed, before the full pruning.
+	// Cells whose forward log prob is more than forwardBeamLogProbMargin below the column's max, or that are not
+	// among the forwardBeamMaxCells most probable in the column, are discarded. Either is off if not positive.
+	double forwardBeamLogProbMargin;
+	int64_t forwardBeamMaxCells;
+
+	// If true, and a forward beam is set, getRPHmms makes the hmm of each set of overlapping reads directly, in one
+	// sweep over the reads (see stRPHmm_constructBySweep), rather than by merging the hmms of the reads
+	bool sweepHmmConstruction;
+
 	// MaxCoverageDepth is the maximum depth of profileSeqs to allow at any base.
 	// If the coverage depth is higher than this then some profile seqs are randomly discarded.
 	int64_t maxCoverageDepth;
@@ -291,6 +374,7 @@ struct _stRPHmmParameters {
 
     // for output vcf
     bool updateAllOutputVCFFormatFields;
+    bool compressPhasedVcf; // BGZF compress and tabix index the phased vcf
 
     // likelihood at which we start a new phase set based on read concordance between haplotypes
     double phasesetMinBinomialReadSplitLikelihood;
@@ -330,10 +414,13 @@ struct _stRPHmm {
 	//Forward/backward probability calculation things
 	double forwardLogProb;
 	double backwardLogProb;
+	bool hasViterbiPointers; // If true the merge cells' maxForwardCell are set, see stRPHmm_viterbi
 };
 
 stRPHmm *stRPHmm_construct(stProfileSeq *profileSeq, stRPHmmParameters *params);
 
+stRPHmm *stRPHmm_constructBySweep(stList *profileSeqs, stRPHmmParameters *params);
+
 void stRPHmm_destruct(stRPHmm *hmm, bool destructColumns);
 
 void stRPHmm_destruct2(stRPHmm *hmm);
@@ -348,6 +435,13 @@ stRPHmm *stRPHmm_fuse(stRPHmm *leftHmm, stRPHmm *rightHmm);
 
 void stRPHmm_forwardBackward(stRPHmm *hmm);
 
+/*
+ * Runs the forward algorithm taking the max rather than the sum over transitions, recording for each merge cell the
+ * cell its max came from, which stRPHmm_forwardTraceBack then follows. The backward pass is skipped, so the cells'
+ * posterior probabilities are not set and the hmm can not be pruned until stRPHmm_forwardBackward is run.
+ */
+void stRPHmm_viterbi(stRPHmm *hmm);
+
 void stRPHmm_prune(stRPHmm *hmm);
 
 void stRPHmm_print(stRPHmm *hmm, FILE *fileHandle, bool includeColumns, bool includeCells);
@@ -379,6 +473,8 @@ struct _stRPColumn {
 	stRPCell *head;
 	stRPMergeColumn *nColumn, *pColumn;
 	double totalLogProb;
+	uint64_t *bitCountVectors; // Cached by stRPColumn_getBitCountVectors, NULL until first used
+	stRPColumnEmissions *emissions; // Cached by stRPColumn_getEmissions, NULL until first used
 };
 
 stRPColumn *stRPColumn_construct(int64_t refStart, int64_t length, int64_t depth,
@@ -386,6 +482,25 @@ stRPColumn *stRPColumn_construct(int64_t refStart, int64_t length, int64_t depth
 
 void stRPColumn_destruct(stRPColumn *column);
 
+uint64_t *stRPColumn_getBitCountVectors(stRPColumn *column, stReference *ref);
+
+/*
+ * Per-site emission tables of a column. At a site only the reads with non-zero allele probabilities affect the
+ * emission probability, so where there are few of them the site's -log probability is tabulated for every
+ * partition of those reads and shared by all the cells of the column.
+ */
+struct _stRPColumnEmissions {
+	int64_t length; // Number of sites
+	bool includeAncestorSubProb; // The setting the tables were made for
+	stRPPartition *siteReadMasks; // For each site, the reads with non-zero allele probabilities
+	uint64_t **siteLogProbs; // For each site, NULL or the -log prob of each partition of the reads in the site's mask,
+							 // indexed by the partition's bits within the mask packed together
+};
+
+stRPColumnEmissions *stRPColumn_getEmissions(stRPColumn *column, stReference *ref, stRPHmmParameters *params);
+
+void stRPColumnEmissions_destruct(stRPColumnEmissions *emissions);
+
 void stRPColumn_print(stRPColumn *column, FILE *fileHandle, bool includeCells);
 
 void stRPColumn_split(stRPColumn *column, int64_t firstHalfLength, stRPHmm *hmm);
@@ -399,12 +514,15 @@ stSet *stRPColumn_getColumnSequencesAsSet(stRPColumn *column);
  * State of read partitioning hmm
  */
 struct _stRPCell {
-	uint64_t partition;
+	stRPPartition partition;
 	double forwardLogProb, backwardLogProb;
 	stRPCell *nCell;
+	// Merge cells this cell feeds from and into, set by stRPHmm_forwardBackward and only valid until the hmm's
+	// merge cells next change
+	stRPMergeCell *pMergeCell, *nMergeCell;
 };
 
-stRPCell *stRPCell_construct(int64_t partition);
+stRPCell *stRPCell_construct(stRPPartition partition);
 
 void stRPCell_destruct(stRPCell *cell);
 
@@ -417,14 +535,14 @@ double stRPCell_posteriorProb(stRPCell *cell, stRPColumn *column);
  * Merge column of read partitioning hmm
  */
 struct _stRPMergeColumn {
-	uint64_t maskFrom;
-	uint64_t maskTo;
-	stHash *mergeCellsFrom;
-	stHash *mergeCellsTo;
+	stRPPartition maskFrom;
+	stRPPartition maskTo;
+	PartitionMap *mergeCellsFrom; // keyed by the merge cells' fromPartition
+	PartitionMap *mergeCellsTo; // keyed by the merge cells' toPartition
 	stRPColumn *nColumn, *pColumn;
 };
 
-stRPMergeColumn *stRPMergeColumn_construct(uint64_t maskFrom, uint64_t maskTo);
+stRPMergeColumn *stRPMergeColumn_construct(stRPPartition maskFrom, stRPPartition maskTo);
 
 void stRPMergeColumn_destruct(stRPMergeColumn *mColumn);
 
@@ -441,13 +559,14 @@ int64_t stRPMergeColumn_numberOfPartitions(stRPMergeColumn *mColumn);
  * Merge cell of read partitioning hmm
  */
 struct _stRPMergeCell {
-	uint64_t fromPartition;
-	uint64_t toPartition;
+	stRPPartition fromPartition;
+	stRPPartition toPartition;
 	double forwardLogProb, backwardLogProb;
+	stRPCell *maxForwardCell; // The cell of the previous column its max forward probability came from, see stRPHmm_viterbi
 };
 
-stRPMergeCell *stRPMergeCell_construct(uint64_t fromPartition,
-									   uint64_t toPartition, stRPMergeColumn *mColumn);
+stRPMergeCell *stRPMergeCell_construct(stRPPartition fromPartition,
+									   stRPPartition toPartition, stRPMergeColumn *mColumn);
 
 void stRPMergeCell_destruct(stRPMergeCell *mCell);
 
@@ -500,6 +619,10 @@ stGenomeFragment_constructEmpty(stReference *ref, uint64_t refStart, uint64_t le
 
 stGenomeFragment *stGenomeFragment_construct(stRPHmm *hmm, stList *path);
 
+// A genome fragment of the reads made without the hmm, NULL if more than one site has reads preferring an allele
+// other than the consensus allele
+stGenomeFragment *stGenomeFragment_constructTrivial(stReference *ref, stList *profileSeqs);
+
 void stGenomeFragment_destruct(stGenomeFragment *genomeFragment);
 
 void stGenomeFragment_refineGenomeFragment(stGenomeFragment *gF,
@@ -515,6 +638,9 @@ void stGenomeFragment_phaseBamChunkReads(stGenomeFragment *gf, stHash *readsToPS
 double getLogProbOfReadGivenHaplotype(const uint64_t *haplotypeString, int64_t start, int64_t length,
 									  stProfileSeq *profileSeq, stReference *ref);
 
+// The log probabilities of each of the profile seqs given each of the haplotypes of the genome fragment, scored together
+void stGenomeFragment_getReadLogProbs(stGenomeFragment *gF, stList *pSeqs, double *logProbs1, double *logProbs2);
+
 
 
 
@@ -529,6 +655,7 @@ double getLogProbOfReadGivenHaplotype(const uint64_t *haplotypeString, int64_t s
 typedef enum {
     SCM_RANDOM=0,
     SCM_SIZE_DESC=1,
+    SCM_COST_DESC=2,
 } ShuffleChunksMethod;
 
 struct _polishParams {
@@ -536,7 +663,9 @@ struct _polishParams {
 
 	// Models for comparing sequences
 	Alphabet *alphabet; // The alphabet object
+	// The state machines are built once, when the params are read, and are shared read-only by all threads
 	StateMachine *stateMachineForGenomeComparison; // Statemachine for comparing two haplotypes
+	StateMachine *stateMachineForConsensusAlignment; // Default statemachine for aligning consensus sequences, as when stitching
 	StateMachine *stateMachineForForwardStrandRead; // Statemachine for a forward strand read aligned to a reference assembly.
 	StateMachine *stateMachineForReverseStrandRead; // Statemachine for a reverse strand read aligned to a reference assembly.
 	PairwiseAlignmentParameters *p; // Parameters object used for aligning
@@ -551,14 +680,49 @@ struct _polishParams {
 	bool includeSoftClipping;
 	uint64_t chunkSize;
 	uint64_t chunkBoundary;
+	bool adaptiveChunkSize; // Vary the length of the chunks, within minChunkSize and maxChunkSize, so that each has about
+	// targetChunkWork of estimated work (depth times length, plus chunkSiteWork per read per VCF site when phasing)
+	uint64_t minChunkSize; // Zero for chunkSize / 4
+	uint64_t maxChunkSize; // Zero for chunkSize * 4
+	uint64_t targetChunkWork; // Zero for the work of a chunk of chunkSize at the mean depth (and site density)
+	uint64_t chunkSiteWork;
+	uint64_t stitchExactMatchLength; // If non-zero, the overlap of adjacent chunks is cropped in the middle of an exact
+	// match of at least this length (in RLE space) found by extending the alignment anchors, rather than by aligning it
+	bool estimateChunkDepthFromIndex; // Plan chunks from the bam index rather than decoding every alignment
+	char *chunkDepthSummaryFile; // If set, plan chunks from this (mosdepth regions style) bed of depths instead
+	uint64_t chunkPrefetchThreads; // Number of I/O threads loading the reads of upcoming chunks, zero to load each chunk's
+	// reads in the thread that processes it
+	uint64_t smallChunkGroupLength; // If non-zero, the chunks at most a quarter this long (such as those of the small
+	// contigs of a fragmented assembly) are loaded in groups of up to this many reference bases, see BamChunkGroups
+	bool useChunkArena; // Allocate the small objects of each chunk from a per-thread arena, see chunkArena_open
+	bool useHugePages; // Back the chunk arena blocks and the dp matrix buffers with transparent huge pages, see hugePages_malloc
+	LogAddKernel logAddKernel; // The kernel of the log adds of the pair-HMM, the POA and the phasing, see logMath.h
+	uint64_t maxMemory; // If non-zero, the budget in bytes for the predicted memory of the chunks processed at once
+	uint64_t chunkMemoryPerReadBase; // Bytes of memory predicted per read base of a chunk, for maxMemory
+	uint64_t progressInterval; // Seconds between the progress reports of the chunk loop, zero to report every chunk
+	bool bufferedLogging; // Log the lines of the chunk loop through per-thread buffers, see logBuffer_start
+	uint64_t htsThreads; // Size of the htslib thread pool shared by the bam files for BGZF (de)compression, zero for none
+	bool streamBamInput; // Read the (coordinate sorted, not necessarily indexed) bam in one pass rather than querying
+	// its index per chunk, chunks are then processed in file order
+	bool stitchOnline; // Stitch and write out each contig as soon as its chunks are done, rather than after all
+	// chunks are processed, chunks are then processed in contig order
+	bool useBinaryChunkRecords; // Hold each chunk's temporary output as one binary record rather than as CSV text
+	bool compressChunkRecords; // Compress the binary chunk records
+	bool compressOutputFasta; // Write the polished fasta BGZF compressed, with its .fai and .gzi indexes, as it is stitched
+	uint64_t maxInMemoryOutputBytes; // If non-zero, in-memory temporary output is moved to disk once the chunkers
+	// together buffer more than this many bytes
 	// input reads configuration
 	uint64_t maxDepth;
-	uint64_t excessiveDepthThreshold; // depth threshold where we randomly discard reads on initial reading
+	uint64_t downsamplingSeed; // Seeds the per read hashes deciding which reads are kept when downsampling
+	uint64_t excessiveDepthThreshold; // depth of the reads (and of the filtered reads) kept on initial reading, 0 for all
 	bool includeSecondaryAlignments;
 	bool includeSupplementaryAlignments;
     uint64_t filterAlignmentsWithMapQBelowThisThreshold;
     // other configuration
     double candidateVariantWeight; // The fraction (from 0 to 1) of the average position coverage needed to define a candidate variant
+    double cleanChunkMaxDivergence; // If positive, a haploid chunk whose reads' alignments diverge from the reference
+    // by at most this fraction of columns is first checked for candidate variants with only its anchor alignments,
+    // and is not realigned if it has none
     uint64_t columnAnchorTrim; // The min distance between a column anchor and a candidate variant
     uint64_t maxConsensusStrings; // The maximum number of different consensus strings to consider for a substring.
     uint64_t maxPoaConsensusIterations; // Maximum number of poa_consensus / realignment iterations
@@ -571,8 +735,26 @@ struct _polishParams {
     double minAvgBaseQuality; // Minimum average base quality to include a substring for consensus finding
     double hetSubstitutionProbability; // The probability of a heterozygous variant
     double hetRunLengthSubstitutionProbability; // The probability of a heterozygous run length
+    double alleleScoringBailOutMargin; // If positive, stop computing a read's likelihood of an allele once it
+    // can not come within this log-likelihood margin of the best allele for the read, storing an upper bound
+    double alleleScoringPrescoreMargin; // If positive, first score a read against a bubble's alleles by edit distance,
+    // only computing its likelihoods if no allele is closer than the others by more than this many edits, and
+    // otherwise calibrating them from the edit distances (see bubble_setAlleleReadSupports)
+    bool reuseOverlapAlleleSupports; // In phasing from a VCF, reuse the allele supports of the reads in the overlap of
+    // adjacent chunks scored by the chunk processed first, rather than scoring them in both
+    uint64_t truthProjectionExactMatchLength; // If non-zero, HELEN truth labels are found by projecting the
+    // consensus onto the truth through exact matches of at least this length (in RLE space), aligning only between them
 
     // Poa parameters
+    bool useIncrementalRealignment; // In rounds of POA realignment, only realign reads whose anchors or aligned
+    // reference sequence have changed since the previous round, reusing the alignments of the others
+    uint64_t realignmentParallelismThreshold; // If the number of reads times the reference length of a POA realignment
+    // is greater than this, and it is not zero, reads are aligned in parallel using any otherwise idle threads
+    bool useWindowedRealignment; // Make the initial POA from the reads' CIGAR alignments, realigning them only in the
+    // windows where they disagree with the reference, see poa_realignDisagreementWindows
+    uint64_t windowedRealignmentFlank; // The reference positions flanking each disagreement in its realigned window
+    bool partitionHaplotypePoaReads; // In diploid polishing, make the POA of each haplotype from only the reads
+    // partitioned to it and the unphased reads, rather than from all the reads
     bool poaConstructCompareRepeatCounts; // use the repeat counts in deciding if an indel can be shifted
     double referenceBasePenalty; // used by poa_getConsensus to weight against picking the reference base
     double *minPosteriorProbForAlignmentAnchors; // used by by poa_getAnchorAlignments to determine which alignment pairs
@@ -587,6 +769,12 @@ PolishParams *polishParams_constructEmpty();
 
 void polishParams_printParameters(PolishParams *polishParams, FILE *fh);
 
+/*
+ * Replaces the state machines for aligning reads to the reference with ones made from the given hmm, for the forward
+ * strand, as if it had been given as hmmForwardStrandReadGivenReference.
+ */
+void polishParams_setReadHmm(PolishParams *params, Hmm *hmm);
+
 void polishParams_destruct(PolishParams *polishParams);
 
 /*
@@ -598,6 +786,12 @@ struct _Poa {
 	uint64_t maxRepeatCount; // The maximum repeat count, exclusive
 	RleString *refString; // The reference string, encoded using RLE
 	stList *nodes;
+	PoaBaseObservation *observations; // Arena holding the observations of the nodes, inserts and deletes, see
+	// poa_buildObservationArena, or NULL if not built
+	int64_t *nodeObservationOffsets; // Index in observations of the first observation of each node
+	PoaBaseObservation *stagedObservations; // Observations added since the arena was last built
+	int64_t stagedObservationNo; // Number of staged observations
+	int64_t maxStagedObservationNo; // Allocated length of stagedObservations
 };
 
 struct _poaNode {
@@ -607,21 +801,23 @@ struct _poaNode {
 	uint64_t repeatCount; // Repeat count of base
 	double *baseWeights; // Weight given to each possible base
 	double *repeatCountWeights; // Weight given to each possible repeat count
-	stList *observations; // Individual events representing event, a list of PoaObservations
+	stList *observations; // Individual events representing event, a list of PoaObservations in the poa's arena
+	stSet *insertIndex; // Set of the inserts, used to find them while reads are added to a node with many, or NULL
+	stSet *deleteIndex; // As insertIndex, for the deletes
 };
 
 struct _poaInsert {
 	RleString *insert; // RLE string representing characters of insert e.g. "GAT" with repeat counts "121", etc.
 	double weightForwardStrand;
 	double weightReverseStrand;
-	stList *observations; // Individual events representing event, a list of PoaObservations
+	stList *observations; // Individual events representing event, a list of PoaObservations in the poa's arena
 };
 
 struct _poaDelete {
 	int64_t length; // Length of delete
 	double weightForwardStrand;
 	double weightReverseStrand;
-	stList *observations; // Individual events representing event, a list of PoaObservations
+	stList *observations; // Individual events representing event, a list of PoaObservations in the poa's arena
 };
 
 struct _poaBaseObservation {
@@ -647,12 +843,33 @@ Poa *poa_getReferenceGraph(RleString *reference, Alphabet *alphabet, uint64_t ma
 
 /*
  * Adds to given POA the matches, inserts and deletes from the alignment of the given read to the reference.
- * Adds the inserts and deletes so that they are left aligned.
+ * Adds the inserts and deletes so that they are left aligned. The observations of the read are only put in the
+ * lists of observations of the POA by poa_buildObservationArena.
  */
 void poa_augment(Poa *poa, RleString *read, bool readStrand, int64_t readNo, stList *matches, stList *inserts,
 				 stList *deletes,
 				 PolishParams *polishParams);
 
+/*
+ * As poa_augment, taking packed pairs. Sorts the matches, inserts and deletes in place.
+ */
+void poa_augmentPacked(Poa *poa, RleString *read, bool readStrand, int64_t readNo, AlignedPairs *matches,
+					   AlignedPairs *inserts, AlignedPairs *deletes, PolishParams *polishParams);
+
+/*
+ * Moves the observations added by poa_augment into one contiguous array, laid out in node order with each node's
+ * observations followed by those of its inserts and deletes, and points the observation lists of the nodes, inserts
+ * and deletes into it. Must be called after the last read is added and before the observations are used. The
+ * functions that realign reads to make a POA, such as poa_realign, call it.
+ */
+void poa_buildObservationArena(Poa *poa);
+
+/*
+ * Gets the observations of the nodeIndex-th node of the POA, which are contiguous, setting observationNo to their number.
+ * Builds the observation arena if needed.
+ */
+PoaBaseObservation *poa_getNodeObservations(Poa *poa, int64_t nodeIndex, int64_t *observationNo);
+
 /*
  * Creates a POA representing the reference and the expected inserts / deletes and substitutions from the
  * alignment of the given set of reads aligned to the reference. Anchor alignments is a set of pairwise
@@ -661,6 +878,31 @@ void poa_augment(Poa *poa, RleString *read, bool readStrand, int64_t readNo, stL
  */
 Poa *poa_realign(stList *bamChunkReads, stList *alignments, RleString *reference, PolishParams *polishParams);
 
+/*
+ * Alignments of a set of reads kept between successive calls to poa_realign2, see below.
+ */
+typedef struct _poaRealignmentCache PoaRealignmentCache;
+
+PoaRealignmentCache *poaRealignmentCache_construct(int64_t readNo);
+
+void poaRealignmentCache_destruct(PoaRealignmentCache *cache);
+
+/*
+ * If readOnly is true, reads realigned using the cache are not stored in it, so that the alignments to one reference,
+ * e.g. the haploid consensus, can be shared by alignments to several others, e.g. the two haplotypes. The read symbol
+ * strings made when the reads were first aligned are still reused.
+ */
+void poaRealignmentCache_setReadOnly(PoaRealignmentCache *cache, bool readOnly);
+
+/*
+ * As poa_realign, but if cache is non-null, reads whose anchors and cropped reference sequence are unchanged since they
+ * were last aligned using the cache reuse the resulting alignments, shifted to the new reference coordinates, rather
+ * than being realigned. The resulting POA is the same as that from poa_realign. Other reads are realigned and their
+ * alignments stored in the cache. The cache must be constructed with the number of reads in bamChunkReads.
+ */
+Poa *poa_realign2(stList *bamChunkReads, stList *alignments, RleString *reference, PolishParams *polishParams,
+				  PoaRealignmentCache *cache);
+
 /*
  * Creates a POA representing the reference and the inserts / deletes and substitutions only in the anchor
  * aligments.
@@ -668,6 +910,15 @@ Poa *poa_realign(stList *bamChunkReads, stList *alignments, RleString *reference
 Poa *poa_realignOnlyAnchorAlignments(stList *bamChunkReads, stList *anchorAlignments, RleString *reference,
 									 PolishParams *polishParams);
 
+/*
+ * Creates a POA from the anchor alignments, as poa_realignOnlyAnchorAlignments, except that the windows of the
+ * reference with candidate variants in that POA, flanked by polishParams->windowedRealignmentFlank positions, are
+ * realigned, each read only within the windows it overlaps. The anchor alignments must be the complete alignments of
+ * the reads, as from their CIGAR strings.
+ */
+Poa *poa_realignDisagreementWindows(stList *bamChunkReads, stList *anchorAlignments, RleString *reference,
+									PolishParams *polishParams);
+
 /*
  * Generates a set of anchor alignments for the reads aligned to a consensus sequence derived from the poa.
  * These anchors can be used to restrict subsequent alignments to the consensus to generate a new poa.
@@ -803,12 +1054,21 @@ RleString *poa_polish(Poa *poa, stList *bamChunkReads, PolishParams *params,
  * Iteratively uses poa_getConsensus and poa_polish to refine the median reference sequence
  * for the given reads and the starting reference.
  *
- * Allows the specification of the min and max number of realignment cycles.
+ * Allows the specification of the min and max number of realignment cycles. Stops early if the consensus is unchanged,
+ * if the score falls after minIterations, or if the consensus is one realigned to before, so that the iterations
+ * would cycle, in which case the best scoring poa of the iterations is returned.
  */
 Poa *poa_realignIterative(Poa *poa, stList *bamChunkReads,
 						  PolishParams *polishParams, bool hmmNotRealign,
 						  int64_t minIterations, int64_t maxIterations);
 
+/*
+ * As poa_realignIterative, realigning using poa_realign2 with the given cache, which may be null.
+ */
+Poa *poa_realignIterative2(Poa *poa, stList *bamChunkReads,
+						   PolishParams *polishParams, bool hmmNotRealign,
+						   int64_t minIterations, int64_t maxIterations, PoaRealignmentCache *cache);
+
 /*
  * Convenience function that iteratively polishes sequence using poa_getConsensus and then poa_polish for
  * a specified number of iterations.
@@ -816,6 +1076,13 @@ Poa *poa_realignIterative(Poa *poa, stList *bamChunkReads,
 Poa *poa_realignAll(stList *bamChunkReads, stList *anchorAlignments, RleString *reference,
 					PolishParams *polishParams);
 
+/*
+ * As poa_realignAll, realigning using the given cache, which may be null, and which is kept after the polish so the
+ * alignments can be reused, e.g. by bubbleGraph_getNewPoa2.
+ */
+Poa *poa_realignAll2(stList *bamChunkReads, stList *anchorAlignments, RleString *reference,
+					 PolishParams *polishParams, PoaRealignmentCache *cache);
+
 /*
  * Greedily evaluate the top scoring indels.
  */
@@ -885,14 +1152,49 @@ void poa_estimatePhasedRepeatCountsUsingBayesianModel(Poa *poa, stList *bamChunk
 void poa_estimatePhasedBasesUsingBayesianModel(Poa *poa, stList *bamChunkReads, stSet *readsBelongingToHap1,
 											   PolishParams *params);
 
+/*
+ * Gets an array, indexed by read number, of whether each of the reads is in readsBelongingToHap1, so the phased
+ * estimates look the haplotype of an observation up by its readNo rather than in the set.
+ */
+bool *getReadsInHap1(stList *bamChunkReads, stSet *readsBelongingToHap1);
+
 // Data structure for representing RLE strings
 struct _rleString {
 	char *rleString; //Run-length-encoded (RLE) string
-	uint64_t *repeatCounts; // Count of repeat for each position in rleString
+	uint8_t *repeatCounts; // Count of repeat for each position in rleString, or RLE_STRING_OVERFLOW_COUNT if it is
+	                       // too large and is stored in overflowCounts. Use rleString_getRepeatCount to read it and
+	                       // rleString_setRepeatCount to set it. NULL if every count is one, as for strings that are
+	                       // not run length encoded, which then need no repeat count storage.
 	uint64_t length; // Length of the rleString
 	uint64_t nonRleLength; // Length of the expanded, non-rle string
+	uint64_t overflowLength; // Number of repeat counts stored in overflowCounts
+	uint64_t *overflowIndices; // Sorted positions in rleString of the repeat counts stored in overflowCounts
+	uint64_t *overflowCounts; // Repeat counts too large for repeatCounts, one per overflowIndices
 };
 
+#define RLE_STRING_OVERFLOW_COUNT UINT8_MAX
+
+/*
+ * Gets the repeat count of a repeat count too large for rleString->repeatCounts.
+ */
+uint64_t rleString_getOverflowRepeatCount(RleString *rleString, uint64_t i);
+
+/*
+ * Gets the repeat count of position i in the rleString.
+ */
+static inline uint64_t rleString_getRepeatCount(RleString *rleString, uint64_t i) {
+	if (rleString->repeatCounts == NULL) {
+		return 1;
+	}
+	uint8_t repeatCount = rleString->repeatCounts[i];
+	return repeatCount != RLE_STRING_OVERFLOW_COUNT ? repeatCount : rleString_getOverflowRepeatCount(rleString, i);
+}
+
+/*
+ * Sets the repeat count of position i in the rleString. Does not update nonRleLength.
+ */
+void rleString_setRepeatCount(RleString *rleString, uint64_t i, uint64_t repeatCount);
+
 /*
  * Returns a string "cXrepeatCount", e.g. c='a', repeatCount=4 returns "aaaa".
  */
@@ -912,6 +1214,11 @@ RleString *rleString_copySubstring(RleString *rleString, uint64_t start, uint64_
 
 bool rleString_eq(RleString *r1, RleString *r2);
 
+/*
+ * Hash of the bases and repeat counts of the string, so strings that are rleString_eq have the same hash.
+ */
+uint64_t rleString_hash(RleString *rleString);
+
 /*
  * Debug output friendly version of rleString on one line.
  * Does not print any new lines.
@@ -960,6 +1267,16 @@ int64_t getMax(double *values, int64_t length,
 
 RepeatSubMatrix *repeatSubMatrix_constructEmpty(Alphabet *alphabet);
 
+/*
+ * Copies the repeat sub matrix, its tables allocated and written by the calling thread.
+ */
+RepeatSubMatrix *repeatSubMatrix_copy(RepeatSubMatrix *repeatSubMatrix);
+
+/*
+ * Parses the log probabilities of a json repeat sub matrix into repeatSubMatrix.
+ */
+void repeatSubMatrix_jsonParse(RepeatSubMatrix *repeatSubMatrix, char *buf, size_t r);
+
 void repeatSubMatrix_destruct(RepeatSubMatrix *repeatSubMatrix);
 
 /*
@@ -979,20 +1296,22 @@ repeatSubMatrix_setLogProb(RepeatSubMatrix *repeatSubMatrix, Symbol base, bool s
  * Gets the log probability of observing a given set of repeat observations conditioned on an underlying repeat count and base.
  */
 double repeatSubMatrix_getLogProbForGivenRepeatCount(RepeatSubMatrix *repeatSubMatrix, Symbol base,
-													 stList *observations, stList *bamChunkReads,
-													 int64_t underlyingRepeatCount);
+													 PoaBaseObservation *observations, int64_t observationNo,
+													 stList *bamChunkReads, int64_t underlyingRepeatCount);
 
 /*
  * Gets the maximum likelihood underlying repeat count for a given set of observed read repeat counts.
  * Puts the ml log probility in *logProbabilty.
  */
-int64_t repeatSubMatrix_getMLRepeatCount(RepeatSubMatrix *repeatSubMatrix, Symbol base, stList *observations,
+int64_t repeatSubMatrix_getMLRepeatCount(RepeatSubMatrix *repeatSubMatrix, Symbol base,
+										 PoaBaseObservation *observations, int64_t observationNo,
 										 stList *bamChunkReads, double *logProbability);
 
 /*
  * Get the log probabilities of repeat counts from minRepeatLength (inclusive) to maxRepeatLength (inclusive)
  */
-void repeatSubMatrix_getRepeatCountProbs(RepeatSubMatrix *repeatSubMatrix, Symbol base, stList *observations,
+void repeatSubMatrix_getRepeatCountProbs(RepeatSubMatrix *repeatSubMatrix, Symbol base,
+										 PoaBaseObservation *observations, int64_t observationNo,
 										 stList *bamChunkReads, double *logProbabilities, int64_t minRepeatLength,
 										 int64_t maxRepeatLength);
 
@@ -1001,17 +1320,66 @@ void repeatSubMatrix_getRepeatCountProbs(RepeatSubMatrix *repeatSubMatrix, Symbo
  */
 int64_t
 repeatSubMatrix_getPhasedMLRepeatCount(RepeatSubMatrix *repeatSubMatrix, int64_t existingRepeatCount, Symbol base,
-									   stList *observations,
-									   stList *bamChunkReads, double *logProbability, stSet *readsBelongingToHap1,
-									   stSet *readsBelongingToHap2, PolishParams *params);
+									   PoaBaseObservation *observations, int64_t observationNo,
+									   stList *bamChunkReads, double *logProbability, bool *readInHap1,
+									   PolishParams *params);
 
 /*
  * Get the minimum and maximum repeat count observations.
  */
-void repeatSubMatrix_getMinAndMaxRepeatCountObservations(RepeatSubMatrix *repeatSubMatrix, stList *observations,
+void repeatSubMatrix_getMinAndMaxRepeatCountObservations(RepeatSubMatrix *repeatSubMatrix,
+														 PoaBaseObservation *observations, int64_t observationNo,
 														 stList *bamChunkReads, int64_t *minRepeatLength,
 														 int64_t *maxRepeatLength);
 
+/*
+ * Counts of observed (read) repeat counts given underlying (reference) repeat counts, per base on the forward strand.
+ * Counts are additive, so those from different bams or regions can be merged and then turned into a repeat sub matrix.
+ */
+typedef struct _runLengthCounts {
+	int64_t maximumRepeatLength; // exclusive, longer repeat counts are put in the last bin
+	uint64_t *counts;
+} RunLengthCounts;
+
+RunLengthCounts *runLengthCounts_construct(int64_t maximumRepeatLength);
+
+void runLengthCounts_destruct(RunLengthCounts *runLengthCounts);
+
+/*
+ * Gets the address of the count for the given base and repeat counts.
+ */
+uint64_t *runLengthCounts_getCount(RunLengthCounts *runLengthCounts, Symbol base, uint64_t underlyingRepeatCount,
+								   uint64_t observedRepeatCount);
+
+/*
+ * Adds the counts in otherRunLengthCounts to runLengthCounts.
+ */
+void runLengthCounts_merge(RunLengthCounts *runLengthCounts, RunLengthCounts *otherRunLengthCounts);
+
+/*
+ * Binary serialization. Records can be concatenated, runLengthCounts_read returns NULL once the file is exhausted.
+ */
+void runLengthCounts_write(RunLengthCounts *runLengthCounts, FILE *fh);
+
+RunLengthCounts *runLengthCounts_read(FILE *fh);
+
+/*
+ * Writes the counts as a json repeat sub matrix (the "repeatCountSubstitutionMatrix" params object), adding
+ * pseudocount to every count.
+ */
+void runLengthCounts_writeRepeatSubMatrixJson(RunLengthCounts *runLengthCounts, FILE *fh, double pseudocount);
+
+/*
+ * Writes the counts for a base as a table, with a row per underlying repeat count and a column per observed one.
+ */
+void runLengthCounts_writeTsv(RunLengthCounts *runLengthCounts, Symbol base, FILE *fh);
+
+/*
+ * Writes outputBase.run_lengths.[ACGT].tsv tables, the mergeable outputBase.run_lengths.bin and, if the maximum
+ * repeat length is MAXIMUM_REPEAT_LENGTH, the repeat sub matrix outputBase.repeatSubMatrix.json.
+ */
+void runLengthCounts_writeOutputFiles(RunLengthCounts *runLengthCounts, char *outputBase, double pseudocount);
+
 /*
  * Translate a sequence of aligned pairs (as stIntTuples) whose coordinates are monotonically increasing
  * in both underlying sequences (seqX and seqY) into an equivalent run-length encoded space alignment.
@@ -1020,6 +1388,46 @@ stList *runLengthEncodeAlignment(stList *alignment,
 								 const uint64_t *seqXNonRleToRleCoordinateMap,
 								 const uint64_t *seqYNonRleToRleCoordinateMap);
 
+/*
+ * An alignment stored as runs of aligned pairs (x + i, y + i), 0 <= i < length, each run starting after the end of the
+ * previous one in both sequences. The alignments of long reads are mostly long runs of matches, so this is a small
+ * fraction of the size of a list of stIntTuple aligned pairs, which are only made where needed.
+ */
+typedef struct _alignmentRun {
+	int64_t x;
+	int64_t y;
+	int64_t length;
+} AlignmentRun;
+
+typedef struct _packedAlignment {
+	AlignmentRun *runs;
+	int64_t runNo;
+	int64_t maxRunNo; // allocated length of runs
+	int64_t length; // the number of aligned pairs, the sum of the lengths of the runs
+} PackedAlignment;
+
+PackedAlignment *packedAlignment_construct(void);
+
+void packedAlignment_destruct(PackedAlignment *alignment);
+
+/*
+ * Appends the aligned pair (x, y), which must come after the last pair in both sequences, extending the last run if
+ * it continues its diagonal.
+ */
+void packedAlignment_addPair(PackedAlignment *alignment, int64_t x, int64_t y);
+
+/*
+ * As runLengthEncodeAlignment, for a packed alignment, without expanding it.
+ */
+PackedAlignment *packedAlignment_runLengthEncode(PackedAlignment *alignment,
+												 const uint64_t *seqXNonRleToRleCoordinateMap,
+												 const uint64_t *seqYNonRleToRleCoordinateMap);
+
+/*
+ * Expands the alignment to a list of aligned pairs, as stIntTuples (x, y, weight).
+ */
+stList *packedAlignment_getAlignedPairs(PackedAlignment *alignment, int64_t weight);
+
 /*
  * Make edited string with given insert. Edit start is the index of the position to insert the string.
  */
@@ -1039,12 +1447,37 @@ void getAlignedPairsWithIndelsCroppingReference(RleString *reference,
 												stList **matches, stList **inserts, stList **deletes,
 												PolishParams *polishParams);
 
+/*
+ * As getAlignedPairsWithIndelsCroppingReference, but appends the pairs to the given buffers.
+ */
+void getAlignedPairsWithIndelsCroppingReferencePacked(RleString *reference,
+													  RleString *read, bool readStrand, stList *anchorPairs,
+													  AlignedPairs *matches, AlignedPairs *inserts,
+													  AlignedPairs *deletes, PolishParams *polishParams);
+
+/*
+ * As getAlignedPairsWithIndelsCroppingReference, but adds the expectations of the transitions and emissions of the
+ * alignment to hmmExpectations instead. The expectations of reverse strand reads are reverse complemented, so they
+ * are all expectations of the forward strand hmm.
+ */
+void getExpectationsCroppingReference(RleString *reference, RleString *read, bool readStrand, stList *anchorPairs,
+									  Hmm *hmmExpectations, PolishParams *polishParams);
+
 /*
  * Functions for processing BAMs
  */
 
 // TODO: MOVE BAMCHUNKER TO PARSER .c
 
+typedef struct _bamFileHandle {
+	samFile *in; // The open bam file
+	hts_idx_t *idx; // Its index
+	bam_hdr_t *bamHdr; // Its header
+	bool pooled; // If true, owned by a chunker's pool and left open when released
+	int64_t source; // Index of the file in the chunker's bam files, 0 for bamFile
+	struct _bamFileHandle *next; // Handle on the chunker's next bam file, if any, opened and released with this one
+} BamFileHandle;
+
 typedef struct _bamChunker {
 	// file locations
 	char *bamFile;
@@ -1057,6 +1490,10 @@ typedef struct _bamChunker {
 	stList *chunks;
 	uint64_t chunkCount;
 	stHash *readEnumerator;
+	char *cramReferenceFile; // If not NULL, the fasta used to decode cram input, see bamChunker_setCramReference
+	BamFileHandle **fileHandles; // Open handles on bamFile, one per thread, opened on first use, see bamChunker_getFileHandle
+	int64_t fileHandleNo; // Length of fileHandles
+	stList *secondaryBamFiles; // Further bam files whose reads are merged with those of bamFile, see bamChunker_addBamFile
 } BamChunker;
 
 typedef struct _bamChunk {
@@ -1084,6 +1521,7 @@ typedef struct _bamChunkRead {
 	bool forwardStrand;            // whether the alignment is matched to the forward strand
 	int64_t fullReadLength;   // total length for whole read (not just chunk portion)
 	BamChunkReadVcfEntrySubstrings *bamChunkReadVcfEntrySubstrings; // for ultra-fast phasing work
+	int64_t source;            // index of the bam file the read came from, 0 for the chunker's bamFile
 } BamChunkRead;
 
 BamChunkRead *bamChunkRead_construct2(char *readName, char *nucleotides, uint8_t *qualities, bool forwardStrand,
@@ -1097,6 +1535,12 @@ BamChunkRead *bamChunkRead_constructCopy(BamChunkRead *copy);
 
 void bamChunkRead_destruct(BamChunkRead *bamChunkRead);
 
+/*
+ * Frees the sequence, qualities and variant substrings of the read, keeping its name, strand and length, for reads
+ * that are only needed by name once they are assigned to haplotypes.
+ */
+void bamChunkRead_destructSequence(BamChunkRead *bamChunkRead);
+
 BamChunkReadVcfEntrySubstrings *bamChunkReadVcfEntrySubstrings_construct();
 BamChunkReadVcfEntrySubstrings *bamChunkReadVcfEntrySubstrings_construct2( stList *readSubstrings,
                                                                            stList *readSubstringQualities,
@@ -1138,6 +1582,13 @@ int64_t removeOverlap(char *prefixString, int64_t prefixStringLength, char *suff
  * View functions
  */
 
+typedef struct _msaViewSegment {
+	int64_t refStart; // The first reference position of a run of reference positions
+	int64_t length; // The length of the run
+	int64_t seqStart; // The position in the non-ref sequence aligned to refStart, the run being aligned to
+	// consecutive positions from it
+} MsaViewSegment;
+
 struct _refMsaView {
 	int64_t refLength; // The length of the reference sequence
 	char *refSeq; // The reference sequence - this is not copied by the constructor
@@ -1145,8 +1596,10 @@ struct _refMsaView {
 	int64_t seqNo; // The number of non-ref sequences aligned to the reference
 	stList *seqs; // The non-ref sequences - - this is not copied by the constructor
 	stList *seqNames; // The non-ref sequence names - this is not copied by the constructor, and can be NULL
-	int64_t *seqCoordinates; // A matrix giving the coordinates of the non-reference sequence
-	// as aligned to the reference sequence
+	MsaViewSegment *seqSegments; // The alignment of each non-reference sequence to the reference sequence, as the
+	// runs of reference positions aligned to consecutive sequence positions, in reference order
+	int64_t *firstSeqSegments; // The index in seqSegments of the first segment of each sequence, followed by the
+	// number of segments, so memory scales with the number of indels rather than the reference length
 	int64_t *maxPrecedingInsertLengths; // The maximum length of an insert in
 	// any of the sequences preceding the reference positions
 	int64_t **precedingInsertCoverages; // The number of sequences with each given indel position
@@ -1233,8 +1686,32 @@ typedef struct _bubbleGraph {
 	uint64_t bubbleNo; // The number of bubbles
 	Bubble *bubbles; // An array of bubbles
 	uint64_t totalAlleles; // Sum of alleles across bubbles
+	// The data the bubbles' reads are scanned for, packed into arrays for the whole graph, so they are read
+	// contiguously rather than through the pointers of each bubble
+	float *alleleReadSupports; // The allele read supports of every bubble, in bubble order, the
+	// alleleReadSupports of each bubble pointing to its block
+	uint64_t readNo; // The number of distinct reads of the bubbles
+	BamChunkRead **reads; // The distinct reads, indexed in the order they are first seen in the bubbles
+	uint64_t *readIndexOffsets; // The reads of bubble i are at readIndices[readIndexOffsets[i]] up to
+	// readIndices[readIndexOffsets[i + 1]]
+	uint64_t *readIndices; // The index in reads of each read of each bubble
+	uint64_t *forwardStrandBits; // Bit i is set if read i is on the forward strand
 } BubbleGraph;
 
+/*
+ * Gets the index, in bg->reads, of the jth read of the ith bubble.
+ */
+static inline uint64_t bubbleGraph_getReadIndex(BubbleGraph *bg, uint64_t i, uint64_t j) {
+	return bg->readIndices[bg->readIndexOffsets[i] + j];
+}
+
+/*
+ * Returns non-zero if the read with the given index in bg->reads is on the forward strand.
+ */
+static inline bool bubbleGraph_isForwardStrand(BubbleGraph *bg, uint64_t readIndex) {
+	return (bg->forwardStrandBits[readIndex / 64] >> (readIndex % 64)) & 1;
+}
+
 /*
  * Get a consensus path through bubble graph by picking the highest
  * likelihood allele at each bubble. Returned as a string of bg->refLength integers,
@@ -1255,6 +1732,14 @@ RleString *bubbleGraph_getConsensusString(BubbleGraph *bg, uint64_t *consensusPa
 BubbleGraph *bubbleGraph_constructFromPoa(Poa *poa, stList *bamChunkReads, PolishParams *params);
 BubbleGraph *bubbleGraph_constructFromPoa2(Poa *poa, stList *bamChunkReads, PolishParams *params, bool phasing);
 
+/*
+ * Returns an array with an element for each node of the POA that is non-zero if the node is, or is in, a candidate
+ * variant. poa_hasCandidateVariants returns non-zero if any is, so that a bubble graph built from it would have
+ * bubbles.
+ */
+bool *poa_getCandidateVariantPositions(Poa *poa, PolishParams *params);
+bool poa_hasCandidateVariants(Poa *poa, PolishParams *params);
+
 void bubbleGraph_destruct(BubbleGraph *bg);
 
 /*
@@ -1291,9 +1776,31 @@ bubbleGraph_phaseBubbleGraph(BubbleGraph *bg, stReference *ref, stList *reads, P
 Poa *bubbleGraph_getNewPoa(BubbleGraph *bg, uint64_t *consensusPath, Poa *poa, stList *reads, Params *params);
 
 /*
- * Gets the strand support skew for each allele.
+ * As bubbleGraph_getNewPoa, realigning the reads using poa_realign2 with the given cache, which may be null.
+ */
+Poa *bubbleGraph_getNewPoa2(BubbleGraph *bg, uint64_t *consensusPath, Poa *poa, stList *reads, Params *params,
+                            PoaRealignmentCache *cache);
+
+/*
+ * As bubbleGraph_getNewPoa2, leaving the reads in excludedReads, which may be null, out of the new poa.
+ */
+Poa *bubbleGraph_getNewPoa3(BubbleGraph *bg, uint64_t *consensusPath, Poa *poa, stList *reads,
+                            stSet *excludedReads, Params *params, PoaRealignmentCache *cache);
+
+/*
+ * Makes the poas of the two haplotypes, given by their padded haplotype strings, hap1 and hap2, estimating their
+ * repeat counts from the reads of each haplotype if using run length encoding. The haplotypes are made as tasks that
+ * idle threads of an enclosing parallel region can run. If params->polishParams->partitionHaplotypePoaReads is set
+ * the poa of each haplotype is made without the reads of the other. The cache, which may be null, must be read only.
+ */
+void bubbleGraph_getHaplotypePoas(BubbleGraph *bg, uint64_t *hap1, uint64_t *hap2, Poa *poa, stList *reads,
+                                  stSet *readsInHap1, stSet *readsInHap2, Params *params, PoaRealignmentCache *cache,
+                                  Poa **poaHap1, Poa **poaHap2);
+
+/*
+ * Gets the strand support skew for each allele of the given bubble of the graph.
  */
-void bubble_calculateStrandSkews(Bubble *b, double *skews);
+void bubble_calculateStrandSkews(BubbleGraph *bg, uint64_t bubbleIndex, double *skews);
 
 /*
  * Gets the p-value for the bubble having a phased strand-skew
@@ -1327,11 +1834,19 @@ BubbleGraph *bubbleGraph_partitionFilteredReadsFromVcfEntries(stList *bamChunkRe
                                                               BubbleGraph *bg, stList *vcfEntriesToBubbles, stSet *hap1Reads,
                                                               stSet *hap2Reads, Params *params, char *logIdentifier);
 
+/*
+ * Scores each read against the two phased alleles of the het vcfEntries (with substrings from
+ * extractReadSubstringsAtVariantPositions) whose original position is in [scoredRefStart, scoredRefEnd).
+ * Returns a map of read to double[2], the summed log probabilities of the read being from hap1 and hap2.
+ */
+stHash *bubbleGraph_scoreReadsAgainstPhasedVcfEntries(stList *bamChunkReads, stList *vcfEntries,
+		int64_t scoredRefStart, int64_t scoredRefEnd, Params *params);
+
 /*
  * Phases reads from phased vcfEntries
  */
-BubbleGraph *bubbleGraph_partitionFilteredReadsFromPhasedVcfEntries(stList *bamChunkReads, BubbleGraph *bg,
-		stList *vcfEntriesToBubbles, stSet *hap1Reads, stSet *hap2Reads, Params *params, char *logIdentifier);
+void bubbleGraph_partitionFilteredReadsFromPhasedVcfEntries(stList *bamChunkReads, stList *vcfEntries,
+		stSet *hap1Reads, stSet *hap2Reads, Params *params, char *logIdentifier);
 
 /*
  * For tracking Bubble Graph stuff
@@ -1413,10 +1928,123 @@ void outputChunkers_stitchAndTrackExtraData(OutputChunkers *outputChunkers, bool
 
 void outputChunkers_stitchLinear(OutputChunkers *outputChunkers, bool phased, Params *params);
 
+/*
+ * Makes outputChunkers_stitch* write every sequence of the reference, with the stitched sequence of each run of
+ * overlapping chunks of the chunker spliced in place of the interval of the reference the run covers, and the rest of
+ * the reference unmodified. Consecutive chunks that do not overlap are stitched apart. The chunks must be in the order
+ * of the sequences of the reference, as made by bamChunker_constructFromBed. Only the sequences are spliced, so the
+ * POA and repeat count outputs are not supported. Not supported by online stitching.
+ */
+void outputChunkers_setReferenceSplicing(OutputChunkers *outputChunkers, char *referenceFastaFile,
+                                         BamChunker *bamChunker);
+
+/*
+ * Stitch each contig while the chunks are still being processed: chunks are stitched in ordinal order as
+ * soon as they and their predecessors are done, and each contig is written out once complete.
+ * Call outputChunkers_startOnlineStitching before processing any chunk and
+ * outputChunkers_finishOnlineStitching, instead of outputChunkers_stitch*, once all are processed.
+ */
+void outputChunkers_startOnlineStitching(OutputChunkers *outputChunkers, bool phased, int64_t chunkCount,
+                                         stList *readIdsHap1, stList *readIdsHap2, bool *switchedState);
+
+/*
+ * Sets a function called, under the stitching lock and in ordinal order, once each chunk's phasing relative to the
+ * prior chunks of its contig is final.
+ */
+void outputChunkers_setOnlineStitchingCallback(OutputChunkers *outputChunkers,
+                                               void (*chunkStitched)(int64_t chunkOrdinal, bool wasSwitched,
+                                                                     void *extraArg),
+                                               void *extraArg);
+
+void outputChunkers_finishOnlineStitching(OutputChunkers *outputChunkers);
+
+/*
+ * Chunk journal, so that an interrupted run can be resumed. Once opened, each finished chunk's record is appended to
+ * the journal and synced to disk. If the journal already exists for the same fingerprint (of the inputs and
+ * parameters) and chunk count, the chunks in it are kept and the count of them is returned: these chunks should then
+ * be skipped, and outputChunkers_replayChunkJournal called (after outputChunkers_startOnlineStitching, if stitching
+ * online) to add them to the output. The chunkers must use binary chunk records.
+ */
+int64_t outputChunkers_openChunkJournal(OutputChunkers *outputChunkers, char *journalFile, uint64_t fingerprint,
+                                        int64_t chunkCount);
+
+bool outputChunkers_isChunkJournaled(OutputChunkers *outputChunkers, int64_t chunkOrdinal);
+
+void outputChunkers_replayChunkJournal(OutputChunkers *outputChunkers);
+
+/*
+ * Journals other data needed to restore a chunk, which must be done before the chunk is processed by the chunkers.
+ * The data of a journaled chunk is returned (NUL terminated, to be freed by the caller) by
+ * outputChunkers_getJournaledChunkData, or NULL if there is none.
+ */
+void outputChunkers_journalChunkData(OutputChunkers *outputChunkers, int64_t chunkOrdinal, char *data,
+                                     size_t length);
+
+char *outputChunkers_getJournaledChunkData(OutputChunkers *outputChunkers, int64_t chunkOrdinal, size_t *length);
+
+/*
+ * Hashes strings and files (by their contents, not their names, a NULL file being absent) into a chunk journal
+ * fingerprint, starting from CHUNK_JOURNAL_FINGERPRINT_SEED.
+ */
+#define CHUNK_JOURNAL_FINGERPRINT_SEED 14695981039346656037ULL
+
+uint64_t chunkJournal_fingerprintString(uint64_t fingerprint, const char *string);
+
+uint64_t chunkJournal_fingerprintFile(uint64_t fingerprint, const char *file);
+
+/*
+ * Hashes the inputs of a chunk, its reference substring and the alignments overlapping it (in any order), into a
+ * fingerprint identifying them across runs, for reusing a chunk whose inputs are unchanged.
+ */
+uint64_t bamChunk_getInputFingerprint(BamChunk *bamChunk, char *referenceFile, uint64_t fingerprint);
+
+/*
+ * Journals the input key of each chunk in [fromChunk, toChunk) of the opened journal: its settingsFingerprint (of the
+ * parameters and options, but not of the bam or reference), its coordinates and its input fingerprint (see
+ * bamChunk_getInputFingerprint). A journaled chunk whose journaled input key differs, as when the bam or reference
+ * has changed since it was journaled, is superseded, so it is recomputed. If previousJournalFile is set, the chunks of
+ * that journal (of a run on an earlier version of the bam or reference) with the same input key as a chunk not
+ * journaled are copied into the journal, so they are replayed rather than recomputed, as are those in the chunk
+ * cache, if set. Returns the change in the number of journaled chunks: those copied less those superseded.
+ */
+int64_t outputChunkers_journalChunkInputs(OutputChunkers *outputChunkers, BamChunker *bamChunker,
+                                          char *referenceFile, int64_t fromChunk, int64_t toChunk,
+                                          uint64_t settingsFingerprint, char *previousJournalFile);
+
+/*
+ * As outputChunkers_journalChunkInputs, but given the input key of each chunk in [fromChunk, toChunk) to journal
+ * (indexed by chunk ordinal, NULL for a chunk to skip), which are left to the caller to free.
+ */
+int64_t outputChunkers_journalChunkInputKeys(OutputChunkers *outputChunkers, char **inputKeys, int64_t fromChunk,
+                                             int64_t toChunk, char *previousJournalFile);
+
+/*
+ * Sets a chunk cache on the opened journal: a directory, made if it does not exist, of chunks shared by any number of
+ * runs. outputChunkers_journalChunkInputs then copies the cached chunk with the same input key as each chunk not yet
+ * journaled into the journal, so it is replayed rather than recomputed, and each chunk journaled once its input key is
+ * (computed, or reused from a previous journal) is added to the cache.
+ */
+void outputChunkers_setChunkCache(OutputChunkers *outputChunkers, char *cacheDirectory);
+
+/*
+ * Copies the chunks of the journals written by the shards of a run (each made for the same fingerprint and chunk
+ * count) into the given journal, which may then be opened by outputChunkers_openChunkJournal to stitch them. Returns
+ * the number of chunks in the journal.
+ */
+int64_t chunkJournal_merge(char *journalFile, stList *shardJournalFiles, uint64_t fingerprint, int64_t chunkCount);
+
+/*
+ * Closes and removes the final output files, for a run that only journals its chunks, for them to be stitched by
+ * a later run.
+ */
+void outputChunkers_discardOutput(OutputChunkers *outputChunkers);
+
 void outputChunkers_destruct(OutputChunkers *outputChunkers);
 
 ChunkToStitch *mergeContigChunkz(ChunkToStitch **chunks, int64_t startIdx, int64_t endIdxExclusive, bool phased,
                                  Params *params);
+ChunkToStitch *mergeContigChunkzTree(ChunkToStitch **chunks, int64_t startIdx, int64_t endIdxExclusive,
+                                     int64_t chunksPerLeaf, bool phased, Params *params);
 ChunkToStitch *mergeContigChunkzThreaded(ChunkToStitch **chunks, int64_t startIdx, int64_t endIdxExclusive, int64_t numThreads,
                                          bool phased, Params *params, char *referenceSequenceName);
 
@@ -1435,7 +2063,7 @@ struct _vcfEntry {
     stList *alleleSubstrings;
     int64_t refAlnStart;
     int64_t refAlnStopIncl;
-    VcfEntry *rootVcfEntry;
+    VcfEntry *rootVcfEntry; // if not NULL, this is a chunk's view of the root entry, sharing its refSeqName and alleles
     // reports initial genotypes, updated after margin runs
     int64_t gt1;
     int64_t gt2;
@@ -1449,11 +2077,21 @@ struct _vcfEntry {
 // vcf functions
 VcfEntry *vcfEntry_construct(const char *refSeqName, int64_t refPos, int64_t rawRefPos, double phredQuality,
         stList *alleles, int64_t gt1, int64_t gt2);
+VcfEntry *vcfEntry_constructView(VcfEntry *rootVcfEntry, int64_t refPos);
 void vcfEntry_destruct(VcfEntry *vcfEntry);
 RleString *getVcfEntryAlleleH1(VcfEntry *vcfEntry);
 RleString *getVcfEntryAlleleH2(VcfEntry *vcfEntry);
 stHash *parseVcf(char *vcfFile, Params *params);
 stHash *parseVcf2(char *vcfFile, char *regionStr, Params *params);
+
+/*
+ * Parses the entries of the vcf in the region (or all of it if regionStr is NULL) with the params and keeps them, so
+ * that the next call of parseVcf2 for the same file and region with the same params object in this process returns
+ * them rather than parsing the file again, handing them to the caller. Replaces any entries kept before. Used by
+ * 'margin serve' with the params of params_getKeptParams, which its requests are handed by params_readParams.
+ */
+void vcf_keepParsedVcf(char *vcfFile, char *regionStr, Params *params);
+
 int64_t binarySearchVcfListForFirstIndexAtOrAfterRefPos(stList *vcfEntries, int64_t refPos); // just exposed for testing
 stList *getVcfEntriesForRegion(stHash *vcfEntries, uint64_t *rleMap, char *refSeqName, int64_t startPos,
         int64_t endPos, Params *params);
@@ -1463,13 +2101,33 @@ stList *getAlleleSubstrings(VcfEntry *entry, RleString *referenceSeq, Params *pa
                             int64_t *refStartPos, int64_t *refEndPosIncl, bool refPosInPOASpace);
 void updateVcfEntriesWithSubstringsAndPositions(stList *vcfEntries, char *referenceSeq, int64_t refSeqLen,
         bool refPosInPOASpace, Params *params);
-void updateOriginalVcfEntriesWithBubbleData(BamChunk *bamChunk, stList *bamChunkReads, stHash *readIdToIdx,
-		stGenomeFragment *gF, BubbleGraph *bg, stList *chunkVcfEntriesToBubbles, stSet *hap1Reads, stSet *hap2Reads,
-		char *logIdentifier);
+void updateOriginalVcfEntriesWithBubbleData(BamChunk *bamChunk, stHash *readIdToIdx, stGenomeFragment *gF,
+		BubbleGraph *bg, stList *chunkVcfEntriesToBubbles, stSet *hap1Reads, stSet *hap2Reads, char *logIdentifier);
+/*
+ * Serialize and restore the phasing set by updateOriginalVcfEntriesWithBubbleData for the entries within a chunk,
+ * used to resume phasing from a chunk journal.
+ */
+char *getChunkPhasingOfVcfEntries(BamChunk *bamChunk, stHash *vcfEntries, size_t *length);
+void setChunkPhasingOfVcfEntries(BamChunk *bamChunk, stHash *vcfEntries, char *chunkPhasing);
 void updateHaplotypeSwitchingInVcfEntries(BamChunker *chunker, bool *chunkWasSwitched, stHash *vcfEntryMap);
 void writePhasedVcf(char *inputVcfFile, char *regionStr, char *outputVcfFile, char *phaseSetBedFile,
         stHash *vcfEntryMap, Params *params);
 
+/*
+ * Writes the phased VCF while the chunks are still being stitched. Records are written in input order as soon as
+ * the phasing at their position is final, and the reads supporting each written entry are freed.
+ * If chunker is NULL all entries are taken to be final, otherwise phasedVcfWriter_finishChunk must be called for
+ * each chunk, in ordinal order, with its switch state once stitched. If outputVcfFile ends with ".gz" the output is
+ * BGZF compressed, in parallel, and tabix indexed as its records are written (after it is closed, if the htslib
+ * version can not index a vcf as it is written). Returns NULL if the files could not be opened.
+ */
+typedef struct _phasedVcfWriter PhasedVcfWriter;
+PhasedVcfWriter *phasedVcfWriter_construct(char *inputVcfFile, char *regionStr, char *outputVcfFile,
+                                           char *phaseSetBedFile, stHash *vcfEntryMap, BamChunker *chunker,
+                                           Params *params);
+void phasedVcfWriter_finishChunk(PhasedVcfWriter *writer, int64_t chunkIdx, bool wasSwitched);
+void phasedVcfWriter_destruct(PhasedVcfWriter *writer);
+
 // bubble functions using vcfs
 BubbleGraph *bubbleGraph_constructFromPoaAndVCF(Poa *poa, stList *bamChunkReads, stList *vcfEntries,
                                                 PolishParams *params, bool phasing);
@@ -1478,33 +2136,430 @@ BubbleGraph *bubbleGraph_constructFromPoaAndVCFOnlyVCFAllele(Poa *poa, stList *b
 BubbleGraph *bubbleGraph_constructFromVCFAndBamChunkReadVcfEntrySubstrings(stList *bamChunkReads, stList *vcfEntries,
                                                                            Params *params, stList **vcfEntriesToBubbleIdx);
 
+/*
+ * Keeps the allele supports of the reads of the bubbles in the overlaps of VCF-guided chunks, keyed by the VCF entry and
+ * the read, for the neighbouring chunk to reuse rather than score again. Only the supports saved by the latest
+ * maxChunks chunks are kept. Safe to share between threads.
+ */
+typedef struct _overlapSupportCache OverlapSupportCache;
+
+OverlapSupportCache *overlapSupportCache_construct(int64_t maxChunks);
+
+void overlapSupportCache_destruct(OverlapSupportCache *cache);
+
+/*
+ * As bubbleGraph_constructFromVCFAndBamChunkReadVcfEntrySubstrings, but if overlapSupportCache is not NULL the reads of
+ * the bubbles in the overlaps of the bamChunk with its neighbours reuse the supports saved by them, for the same read
+ * substring and alleles, and the supports of the others are saved for them.
+ */
+BubbleGraph *bubbleGraph_constructFromVCFAndBamChunkReadVcfEntrySubstrings2(stList *bamChunkReads, stList *vcfEntries,
+        BamChunk *bamChunk, OverlapSupportCache *overlapSupportCache, Params *params, stList **vcfEntriesToBubbleIdx);
+
+/*
+ * The reference, vcf entries and read substrings of a chunk to be phased, which may be loaded ahead of its phasing by a
+ * ChunkPrefetcher.
+ */
+typedef struct _phaseChunkInput {
+    char *chunkReference;
+    stList *chunkVcfEntries;
+    stList *reads;
+    stList *filteredReads;
+} PhaseChunkInput;
+
+/*
+ * Loads the input of a chunk to be phased against the given vcf entries (a map of contig name to its list of entries).
+ */
+PhaseChunkInput *phaseChunkInput_construct(BamChunk *bamChunk, char *referenceFastaFile, stHash *vcfEntries,
+                                           Params *params);
+
+/*
+ * Phases the chunk of the chunker from its input, which is taken and destructed, as the phase and cohort commands do:
+ * downsamples its reads to maxDepth (if not zero), phases them on the bubble graph of its vcf entries (reusing the
+ * overlap supports of its neighbours if overlapSupportCache is not NULL), partitions the filtered reads, records the
+ * phasing in the vcf entries and passes the chunk to the output chunkers. If journaledVcfEntries is not NULL the
+ * phasing of the chunk's entries of it is journaled with the chunk. Returns the number of reads of the chunk.
+ */
+int64_t phaseChunk(BamChunker *bamChunker, int64_t chunkIdx, PhaseChunkInput *input, uint64_t maxDepth,
+                   OverlapSupportCache *overlapSupportCache, stHash *journaledVcfEntries,
+                   OutputChunkers *outputChunkers, int64_t threadIdx, Params *params, char *logIdentifier);
+
 /*
  * Misc
  */
 char *getTimeDescriptorFromSeconds(int64_t seconds);
 
-stHash *parseReferenceSequences(char *referenceFastaFile);
+/*
+ * Parses a number of bytes, optionally with a K, M, G or T suffix for powers of 1024, aborting if it is invalid.
+ */
+uint64_t parseByteSize(char *string);
 
-char *getFileBase(char *base, char *defawlt);
+/*
+ * Buffered writer of the supplemental CSV outputs. Fields are formatted into a buffer owned by the writer, without
+ * the locale lookups and stream locking of fprintf, and the buffer is written to the file as it fills and when the
+ * writer is destructed. Each printer constructs its own writer, so threads printing chunks do not share a buffer.
+ */
+typedef struct _csvWriter {
+    FILE *fh;
+    char *buffer;
+    int64_t length;
+} CsvWriter;
 
-FILE *safe_fopen(char *file, char *openStr);
+CsvWriter *csvWriter_construct(FILE *fh);
 
-RleString *bamChunk_getReferenceSubstring(BamChunk *bamChunk, char *referenceFile, Params *params);
-uint64_t *getPaddedHaplotypeString(uint64_t *hap, stGenomeFragment *gf, BubbleGraph *bg, Params *params);
-stSet *bamChunkRead_to_readName(stSet *bamChunkReads);
-stList *copyListOfIntTuples(stList *toCopy);
-double fromLog(double theLog);
-double toPhred(double prob);
-double fromPhred(double phred);
-void writePhasedReadInfoJSON(BamChunk *bamChunk, stList *primaryReads, stList *primaryAlignments, stList *filteredReads,
-                             stList *filteredAlignments, stSet *readsInHap1, stSet *readsInHap2,
-                             uint64_t *reference_rleToNonRleCoordMap, FILE *out);
-void removeReadsStartingAfterChunkEnd(BamChunk *bamChunk, stList *reads, stList *alignments, char *logIdentifier);
-void removeReadsOnlyInChunkBoundary(BamChunk *bamChunk, stList *reads, stList *alignments, char *logIdentifier);
-stList *produceVcfEntriesFromBubbleGraph(BamChunk *bamChunk, BubbleGraph *bg, stHash *readsToPSeqs,
+/*
+ * Flushes the buffer to the file, which is not closed.
+ */
+void csvWriter_destruct(CsvWriter *writer);
+
+void csvWriter_flush(CsvWriter *writer);
+
+void csvWriter_char(CsvWriter *writer, char c);
+
+void csvWriter_string(CsvWriter *writer, const char *s);
+
+void csvWriter_int(CsvWriter *writer, int64_t i);
+
+/*
+ * Writes f with the given number of digits after the decimal point, at most 9, as printf's "%.<digits>f" does, except
+ * that the last digit may differ for values within a rounding error of halfway between two outputs.
+ */
+void csvWriter_float(CsvWriter *writer, double f, int64_t digits);
+
+/*
+ * Per-chunk telemetry. Between chunkTelemetry_start and chunkTelemetry_finish, a thread records the wall and CPU time
+ * of the stages of the chunk it is processing, with counts of the chunk's work, and the growth of the process's peak
+ * resident set size. Stages and counts may be recorded from anywhere on the thread, such as each round of POA
+ * realignment, and recording does nothing on a thread without a started chunk, so costs nothing when telemetry is
+ * off. A stage may be entered more than once, its times accumulating, but stages are not nested.
+ */
+typedef enum _chunkTelemetryStage {
+    CTS_READ,           // getting the chunk's reference and reads
+    CTS_REALIGN,        // aligning the reads to make the POA
+    CTS_POA_ITERATION,  // each round of POA consensus finding and realignment, also recorded per round
+    CTS_BUBBLE_GRAPH,   // building the bubble graph
+    CTS_PHASING,        // phasing the bubble graph with the HMM, and partitioning the filtered reads
+    CTS_STITCH,         // outputting the chunk to the chunkers, which stitch it if stitching online
+    CTS_STAGES
+} ChunkTelemetryStage;
+
+typedef enum _chunkTelemetryCount {
+    CTC_READS,          // reads used for the chunk
+    CTC_NUCLEOTIDES,    // nucleotides of those reads within the chunk (polish only, phase uses substrings at sites)
+    CTC_BUBBLES,        // bubbles in the bubble graphs built
+    CTC_HMM_CELLS,      // cells computed by the forward passes of the phasing HMMs
+    CTC_HMM_MERGE_CELLS, // merge cells the forward passes of the phasing HMMs propagate to
+    CTC_DP_CELLS,       // cells of the pairwise alignment matrices computed by the forward and backward passes
+    CTC_ALLELE_READ_SCORES, // alleles scored against read substrings, as bubble alleles times reads not cached
+    CTC_POA_OBSERVATIONS, // base, insert and delete observations added to POAs
+    CTC_CONSENSUS_ITERATIONS, // iterations of poa_getConsensus and realignment by poa_realignIterative
+    CTC_POLISH_ITERATIONS, // iterations of poa_polish and realignment by poa_realignIterative
+    CTC_CONSENSUS_CYCLES, // times poa_realignIterative stopped because the consensus repeated an earlier one
+    CTC_BAM_BYTES,      // bytes of the bam records decoded
+    CTC_COUNTS
+} ChunkTelemetryCount;
+
+// the rounds of POA realignment of a chunk beyond this many are only recorded in the stage total
+#define CHUNK_TELEMETRY_MAX_POA_ITERATIONS 64
+
+void chunkTelemetry_start(BamChunk *bamChunk);
+
+void chunkTelemetry_startStage(ChunkTelemetryStage stage);
+
+void chunkTelemetry_endStage(ChunkTelemetryStage stage);
+
+void chunkTelemetry_addCount(ChunkTelemetryCount count, int64_t n);
+
+/*
+ * Writes the thread's record of its chunk to fh as a line of JSON, and ends it. If fh is NULL the record is just ended.
+ */
+void chunkTelemetry_finish(FILE *fh);
+
+/*
+ * Gets the wall time so far of the thread's chunk, copying its counts to counts (of length CTC_COUNTS). Returns false,
+ * leaving them unset, if the thread has no started chunk.
+ */
+bool chunkTelemetry_getProgress(double *wallTime, int64_t *counts);
+
+/*
+ * Until called again with NULL, adds the thread's counts to counts rather than to its chunk's record, as when loading
+ * a chunk ahead of the thread that will process it. The captured counts are added to the processing thread's record
+ * with chunkTelemetry_addCounts.
+ */
+void chunkTelemetry_captureCounts(int64_t *counts);
+
+void chunkTelemetry_addCounts(int64_t *counts);
+
+/*
+ * Totals of the counts, and of the stage times, of a run's chunks. Between chunkTelemetry_startRun and
+ * chunkTelemetry_finishRun the records finished are added to the totals, as are counts made on a thread without a
+ * started chunk, such as by a thread lent to the chunks still in flight, which are not in any chunk's record.
+ * chunkTelemetry_finishRun writes the totals to fh as a last line of JSON, with the run's wall time.
+ */
+void chunkTelemetry_startRun();
+
+void chunkTelemetry_finishRun(FILE *fh);
+
+/*
+ * Hardware performance counters. When enabled, before chunkTelemetry_startRun, each thread recording a chunk opens
+ * perf_event_open counters of its own execution, which are read at the start and end of each stage, and the counts of
+ * each stage are written with its times, so a stage can be seen to be compute or memory bound. Work done for the
+ * stage by other threads, such as the tasks of a split alignment, is not counted. A counter that can not be opened,
+ * as off linux, or on a host without it or whose perf_event_paranoid setting forbids it, is written as -1.
+ */
+typedef enum _chunkHardwareCounter {
+    CHC_CYCLES,
+    CHC_INSTRUCTIONS,
+    CHC_LLC_MISSES,     // last level cache misses
+    CHC_BRANCH_MISSES,
+    CHC_DTLB_MISSES,    // data TLB read misses
+    CHC_COUNTERS
+} ChunkHardwareCounter;
+
+void chunkTelemetry_setHardwareCounters(bool enabled);
+
+/*
+ * Timeline tracing. Between traceRecorder_start and traceRecorder_finish, begin and end events from any thread are
+ * recorded to a ring buffer owned by the thread, without locking, and traceRecorder_finish writes them to the file as
+ * Chrome trace JSON, which can be viewed in chrome://tracing or Perfetto. Events must be given static names, and
+ * recording checks a flag and returns when the recorder is not started. The recorder must be started and finished
+ * outside parallel regions.
+ */
+
+// events of a thread beyond this many overwrite its oldest
+#define TRACE_BUFFER_SIZE 65536
+
+// the getopt_long value of the commands' long-only --chromeTrace option, beyond the short options' characters
+#define OPTION_CHROME_TRACE 256
+
+void traceRecorder_start(char *traceFile);
+
+void traceRecorder_begin(const char *name);
+
+/*
+ * Begins an event for the processing of a chunk, ended by traceRecorder_end("chunk").
+ */
+void traceRecorder_beginChunk(int64_t chunkIdx);
+
+void traceRecorder_end(const char *name);
+
+void traceRecorder_finish();
+
+/*
+ * Buffered logging. Between logBuffer_start and logBuffer_finish, the lines logged by logBuffer_print and
+ * logBuffer_printFields are appended to a ring buffer owned by the thread, without locking, and a single flusher thread
+ * writes the complete lines of the buffers to the file, so the threads do not contend for it. Each thread's lines are
+ * written in order, but not in order with those of other threads or with lines written to the file directly (such as
+ * by st_logInfo). When the logging is not started, the lines are written to stderr. The logging must be started and
+ * finished outside parallel regions.
+ */
+
+// bytes of lines a thread may have waiting to be written out, beyond which it waits for the flusher
+#define LOG_BUFFER_SIZE 65536
+
+void logBuffer_start(FILE *fh);
+
+void logBuffer_print(const char *format, ...);
+
+/*
+ * Logs a line of structured fields, as "EVENT event=<event> time=<seconds since the epoch> thread=<thread> " followed
+ * by the formatted fields, which should be space separated key=value pairs and end the line.
+ */
+void logBuffer_printFields(const char *event, const char *fieldsFormat, ...);
+
+void logBuffer_finish();
+
+/*
+ * Log at the info level, checking the level before the arguments are evaluated, so that a filtered line costs no
+ * formatting.
+ */
+#define logBuffer_info(...) do { if (st_getLogLevel() >= info) logBuffer_print(__VA_ARGS__); } while (0)
+#define logBuffer_infoFields(event, ...) do { \
+        if (st_getLogLevel() >= info) logBuffer_printFields(event, __VA_ARGS__); } while (0)
+
+/*
+ * Chunk arenas. Between chunkArena_open and chunkArena_close, the small objects of the chunk a thread is processing
+ * are bump allocated from large blocks rather than each with malloc. Each allocation is preceded by a pointer to its
+ * block, and chunkArena_free counts it off the block, which is freed whole when all its allocations are, so objects
+ * may be freed from any thread and at any time, but long lived ones keep their block alive. Outside an open arena, or
+ * for allocations over CHUNK_ARENA_MAX_ALLOCATION, memory comes from the heap. Allocations are aligned to 8 bytes.
+ * Memory from chunkArena_malloc or chunkArena_calloc must be freed with chunkArena_free, never free.
+ */
+
+#define CHUNK_ARENA_BLOCK_SIZE (1024 * 1024)
+#define CHUNK_ARENA_MAX_ALLOCATION (CHUNK_ARENA_BLOCK_SIZE / 64)
+
+typedef struct _chunkArenaStats {
+    int64_t allocations; // from the arena since it was opened
+    int64_t bytes; // of those allocations, with their headers
+    int64_t heapAllocations; // made while the arena was open but too large for it
+    int64_t blocks;
+} ChunkArenaStats;
+
+void chunkArena_open();
+
+/*
+ * Releases the thread's current block, which is freed once its allocations are.
+ */
+void chunkArena_close();
+
+void *chunkArena_malloc(size_t size);
+
+void *chunkArena_calloc(size_t n, size_t size);
+
+void chunkArena_free(void *ptr);
+
+/*
+ * Gets the counts of the calling thread's arena since it was last opened.
+ */
+void chunkArena_getStats(ChunkArenaStats *stats);
+
+/*
+ * Gets the number of blocks, over all threads, not yet freed.
+ */
+int64_t chunkArena_getLiveBlockNo();
+
+/*
+ * Huge pages. Once enabled, which must be done before any allocations from them, hugePages_malloc rounds allocations
+ * up to whole huge pages, aligned to them, and advises the kernel to back them with transparent huge pages. Used for
+ * the large, short lived and randomly accessed buffers of the chunk arenas and the dp matrices, so their TLB misses
+ * are fewer. When not enabled, allocations are from the heap. Memory from hugePages_malloc must be freed with
+ * hugePages_free, giving the size it was allocated with.
+ */
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+typedef struct _hugePageStats {
+    int64_t allocations;
+    int64_t requestedBytes; // of the allocations not yet freed
+    int64_t bytes; // of those allocations rounded up to huge pages
+    int64_t peakBytes;
+    int64_t processHugePageBytes; // of the process's memory backed by huge pages (AnonHugePages), -1 if not known
+} HugePageStats;
+
+void hugePages_setEnabled(bool enabled);
+
+bool hugePages_isEnabled();
+
+void *hugePages_malloc(size_t size);
+
+void hugePages_free(void *ptr, size_t size);
+
+void hugePages_getStats(HugePageStats *stats);
+
+/*
+ * Logs the huge page stats, with the process's peak RSS, if huge pages are enabled.
+ */
+void hugePages_logSummary();
+
+/*
+ * Allocation profiling. In a build with ALLOC_PROFILE (cmake -DALLOC_PROFILE=ON), the st_malloc, st_calloc, st_realloc
+ * and free calls of margin's own code go through the profiler, which, between allocProfile_start and
+ * allocProfile_finish, counts the allocations, bytes, peak live bytes and lifetimes of each subsystem, the subsystem
+ * being the tag of the innermost allocProfile_scope the allocating thread is in. The counts of the chunk a thread is
+ * processing are written in the chunk's telemetry record, and the run's in the run's. Allocations made inside sonLib and
+ * htslib are not seen, nor are frees made through function pointers, such as by the destructors of sonLib containers,
+ * so such an allocation is counted live until its address is allocated again. In other builds the scopes compile to
+ * nothing.
+ */
+typedef enum _allocProfileTag {
+    APT_OTHER,          // allocations outside any scope
+    APT_ALIGNER,        // pairwise alignment and allele scoring
+    APT_POA,            // building and realigning POAs
+    APT_BUBBLE_GRAPH,   // building bubble graphs
+    APT_PHASING,        // the phasing HMMs and read partitioning
+    APT_IO,             // parsing the reads of chunks
+    APT_STITCHING,      // outputting and stitching chunks
+    APT_TAGS
+} AllocProfileTag;
+
+// lifetimes are counted in buckets of powers of ten, from under a microsecond to ten seconds or more
+#define ALLOC_PROFILE_LIFETIME_BUCKETS 8
+
+void allocProfile_start();
+
+void allocProfile_finish();
+
+/*
+ * Starts the calling thread's counts for a chunk.
+ */
+void allocProfile_startChunk();
+
+/*
+ * Writes the counts of each subsystem, of the thread's chunk or of the run, to fh as a JSON field, preceded by ", ".
+ */
+void allocProfile_printChunk(FILE *fh);
+
+void allocProfile_printRun(FILE *fh);
+
+#ifdef MARGIN_ALLOC_PROFILE
+
+AllocProfileTag allocProfile_push(AllocProfileTag tag);
+
+void allocProfile_pop(AllocProfileTag *previousTag);
+
+#define allocProfile_scope(tag) \
+        AllocProfileTag allocProfilePreviousTag __attribute__((cleanup(allocProfile_pop))) = allocProfile_push(tag)
+
+void *allocProfile_malloc(size_t size);
+
+void *allocProfile_calloc(size_t n, size_t size);
+
+void *allocProfile_realloc(void *ptr, size_t size);
+
+void allocProfile_free(void *ptr);
+
+#define st_malloc(size) allocProfile_malloc(size)
+#define st_calloc(n, size) allocProfile_calloc(n, size)
+#define st_realloc(ptr, size) allocProfile_realloc(ptr, size)
+#define free(ptr) allocProfile_free(ptr)
+
+#else
+
+#define allocProfile_scope(tag) ((void) 0)
+
+#endif
+
+stHash *parseReferenceSequences(char *referenceFastaFile);
+
+char *getFileBase(char *base, char *defawlt);
+
+FILE *safe_fopen(char *file, char *openStr);
+
+RleString *bamChunk_getReferenceSubstring(BamChunk *bamChunk, char *referenceFile, Params *params);
+uint64_t *getPaddedHaplotypeString(uint64_t *hap, stGenomeFragment *gf, BubbleGraph *bg, Params *params);
+stSet *bamChunkRead_to_readName(stSet *bamChunkReads);
+stList *copyListOfIntTuples(stList *toCopy);
+double fromLog(double theLog);
+double toPhred(double prob);
+double fromPhred(double phred);
+void writePhasedReadInfoJSON(BamChunk *bamChunk, stList *primaryReads, stList *primaryAlignments, stList *filteredReads,
+                             stList *filteredAlignments, stSet *readsInHap1, stSet *readsInHap2,
+                             uint64_t *reference_rleToNonRleCoordMap, FILE *out);
+void removeReadsStartingAfterChunkEnd(BamChunk *bamChunk, stList *reads, stList *alignments, char *logIdentifier);
+void removeReadsOnlyInChunkBoundary(BamChunk *bamChunk, stList *reads, stList *alignments, char *logIdentifier);
+double getAlignmentDivergence(stList *reads, stList *alignments, RleString *reference);
+stList *produceVcfEntriesFromBubbleGraph(BamChunk *bamChunk, BubbleGraph *bg, stHash *readsToPSeqs,
 										 stGenomeFragment *gF, double strandSkewThreshold,
 										 double readSkewThreshold);
 
+/*
+ * Returns the het variants of the bubble graph phased by the genome fragment of a chunk, filtered as by
+ * produceVcfEntriesFromBubbleGraph, as records in the contig's coordinates, one per line, each preceded by the
+ * genotypes of the chunk's two haplotypes. Only the variants starting in the chunk, not in its overlap with its
+ * neighbours, are included. The records are journaled with the chunk, and written by writeChunkPhasedVariants.
+ */
+char *getChunkPhasedVariants(BamChunk *bamChunk, BubbleGraph *bg, RleString *reference, stHash *readsToPSeqs,
+                             stGenomeFragment *gF, double strandSkewThreshold, double readSkewThreshold,
+                             size_t *length);
+
+/*
+ * Writes the phased variants of the chunks, in chunk order, as a VCF, with the haplotypes of each chunk swapped if
+ * they were switched in stitching. Chunks without variants may be NULL. If outputVcfFile ends with ".gz" the output
+ * is BGZF compressed and tabix indexed.
+ */
+void writeChunkPhasedVariants(char *outputVcfFile, BamChunker *bamChunker, char **chunkPhasedVariants,
+                              bool *chunkWasSwitched, Params *params);
+
 #define CHUNK_TRUTH_READ_ID "CTRID"
 #define CHUNK_TRUTH_READ_ID_LEN 5
 #define CHUNK_TRUTH_READ_ID_SEP "."
@@ -1544,14 +2599,73 @@ BamChunker *bamChunker_construct(char *bamFile, PolishParams *params);
 BamChunker *bamChunker_construct2(char *bamFile, char *region, stSet *validContigs, PolishParams *params,
         bool recordFilteredReads);
 
+/*
+ * As bamChunker_construct2, with the vcf entries (a map of contig name to its list of entries, or NULL) whose sites add
+ * to the estimated work of the chunks when their lengths are varied (see PolishParams adaptiveChunkSize).
+ */
+BamChunker *bamChunker_construct3(char *bamFile, char *region, stSet *validContigs, stHash *vcfEntries,
+        PolishParams *params, bool recordFilteredReads);
+
 BamChunker *bamChunker_constructFromFasta(char *fastaFile, char *bamFile, char *regionStr, PolishParams *params);
 
+/*
+ * Makes chunks covering only the intervals of a bed file (of 0-based, end exclusive intervals), each extended by the
+ * chunk boundary on both sides as a flank. Intervals whose flanks overlap are merged into one run of chunks, and the
+ * runs are in the order of the sequences of the fasta, so they can be spliced into it when stitching (see
+ * outputChunkers_setReferenceSplicing).
+ */
+BamChunker *bamChunker_constructFromBed(char *bedFile, char *fastaFile, char *bamFile, PolishParams *params);
+
 BamChunker *bamChunker_copyConstruct(BamChunker *toCopy);
 
 void bamChunker_destruct(BamChunker *bamChunker);
 
 BamChunk *bamChunker_getChunk(BamChunker *bamChunker, int64_t chunkIdx);
 
+/*
+ * Sets the fasta the chunker's bam file is decoded against if it is a cram, so that the reference of its slices is
+ * read from the local fasta (once per open handle) rather than resolved from the header's M5 tags.
+ */
+void bamChunker_setCramReference(BamChunker *bamChunker, char *referenceFile);
+
+/*
+ * Adds a further indexed bam (or cram) file to the chunker, aligned to the same reference as its bam file. The reads
+ * of each chunk are then taken from all of its files, each read recording the index of its file as its source (1 for
+ * the first added file). The chunks themselves are planned from the chunker's bam file alone. Must be called before
+ * any handle is got on the chunker's files.
+ */
+void bamChunker_addBamFile(BamChunker *bamChunker, char *bamFile);
+
+/*
+ * Gets the number of bam files the chunker reads, its bam file and those added with bamChunker_addBamFile.
+ */
+int64_t bamChunker_getBamFileNo(BamChunker *bamChunker);
+
+/*
+ * Gets the process-wide htslib thread pool of params->htsThreads threads, creating it on first use, or NULL if
+ * htsThreads is zero. It is attached to the bam files opened by the chunkers and writeHaplotaggedBam.
+ */
+htsThreadPool *getHtsThreadPool(PolishParams *params);
+
+/*
+ * Destroys the pool made by getHtsThreadPool, once no files using it are open.
+ */
+void htsThreadPool_destruct();
+
+/*
+ * Gets an open handle on the chunker's bam file, with its index and header loaded, for the calling thread. Each
+ * thread of the outermost parallel region keeps its handle open until the chunker is destructed, so the index is
+ * loaded once per thread rather than once per chunk. Other callers, such as threads of nested parallel regions, get
+ * a handle of their own. Must be paired with bamChunker_releaseFileHandle. If the chunker has several bam files the
+ * handle is on the first, with the handles on the others chained by their next field.
+ */
+BamFileHandle *bamChunker_getFileHandle(BamChunker *bamChunker);
+
+/*
+ * Releases a handle got from bamChunker_getFileHandle, closing it if it is not kept by the chunker.
+ */
+void bamChunker_releaseFileHandle(BamChunker *bamChunker, BamFileHandle *fileHandle);
+
 BamChunk *bamChunk_construct();
 BamChunk *bamChunk_construct2(char *refSeqName, int64_t chunkIndex, int64_t chunkOverlapStart, int64_t chunkStart, int64_t chunkEnd,
                               int64_t chunkOverlapEnd, int64_t depth, BamChunker *parent);
@@ -1564,16 +2678,267 @@ void bamChunk_destruct(BamChunk *bamChunk);
 
 
 /*
- * Converts chunk of aligned reads into list of reads and alignments.
+ * Loads the chunks of a run ahead of the threads processing them, using a pool of I/O threads, so that reading
+ * them overlaps with the compute. Chunk i is the i-th chunk processed, and the depth chunks after the one most
+ * recently taken are loaded in the background.
+ */
+typedef struct _chunkPrefetcher ChunkPrefetcher;
+
+/*
+ * Creates a prefetcher for chunks 0 to chunkNo - 1, loaded by loadChunk using threadNo I/O threads. loadChunk must be
+ * safe to call concurrently, and is called by the thread taking a chunk if it has not been prefetched. If threadNo is
+ * zero, chunks are only loaded when they are taken.
+ */
+ChunkPrefetcher *chunkPrefetcher_construct(int64_t chunkNo, int64_t threadNo, int64_t depth,
+                                           void *(*loadChunk)(int64_t i, void *extraArg), void *extraArg);
+
+/*
+ * Gets the i-th chunk, as returned by loadChunk, waiting for it if it is being loaded. Each chunk must be taken
+ * exactly once, and is then owned by the caller.
+ */
+void *chunkPrefetcher_getChunk(ChunkPrefetcher *prefetcher, int64_t i);
+
+/*
+ * Destructs the prefetcher, which must be called after all the chunks have been taken.
+ */
+void chunkPrefetcher_destruct(ChunkPrefetcher *prefetcher);
+
+/*
+ * Schedules the chunks of a run over the threads processing them. With a cost model, the chunks are ordered longest
+ * predicted first (LPT), where a chunk's cost is predicted from its estimated depth and length, and dealt out to a
+ * queue per thread. A thread whose queue is empty steals the longest predicted chunk from the queue with the most
+ * predicted work left. The model is refit on the times taken by the finished chunks, as their number doubles, and
+ * the queues are then resorted. Without a cost model, the chunks are taken in order from a single queue.
+ */
+typedef struct _chunkScheduler ChunkScheduler;
+
+/*
+ * Creates a scheduler over the chunks whose indices are given by the stIntTuples of chunkOrder. If predictCost is set,
+ * chunkOrder is sorted longest predicted first, so that a ChunkPrefetcher over it reads ahead the chunks taken next.
+ */
+ChunkScheduler *chunkScheduler_construct(BamChunker *bamChunker, stList *chunkOrder, int64_t threadNo,
+                                         bool predictCost);
+
+/*
+ * Gets the position in the chunk order of the next chunk for the calling thread to process, returning FALSE once all
+ * of the chunks have been taken.
+ */
+bool chunkScheduler_next(ChunkScheduler *scheduler, int64_t *i);
+
+/*
+ * Records that the chunk at position i, got from chunkScheduler_next, has been processed.
+ */
+void chunkScheduler_finish(ChunkScheduler *scheduler, int64_t i);
+
+/*
+ * Gets the number of threads of the running chunk loop that have run out of chunks, or zero outside a parallel
+ * region. Such threads wait at the end of the loop's parallel region, where they run the OpenMP tasks made by the
+ * chunks still in flight, so work within a chunk that would otherwise run on the chunk's own thread (the nodes of a
+ * poa, the columns of a phasing hmm and the read realignment batches) is split into tasks while this is non-zero,
+ * lending the free threads to the last chunks of a run.
+ */
+int64_t chunkScheduler_getIdleThreadNo(void);
+
+/*
+ * Reports the progress of the chunks as they are finished, at most every interval seconds and once all are finished,
+ * as the fraction of their estimated work done (by the initial cost model), the reference bases per second and an
+ * estimate of the time remaining. Each report is logged both for people and, on a line starting "PROGRESS", as
+ * key=value pairs. Stage names the run in the reports, is not copied and must outlive the scheduler.
+ */
+void chunkScheduler_startProgress(ChunkScheduler *scheduler, char *stage, uint64_t interval);
+
+void chunkScheduler_destruct(ChunkScheduler *scheduler);
+
+/*
+ * Places the threads processing chunks on the NUMA nodes of the host, in contiguous blocks of threads per node, each
+ * thread pinned to the cpus of its node. Each node has its own copy of the params, with the repeat sub matrix, made by
+ * the first thread placed on it, so that the tables it reads are in the node's memory, as are the chunk's buffers it
+ * allocates. On a host with a single node, or other than linux, the threads are not placed.
+ */
+typedef struct _numaPlacement NumaPlacement;
+
+NumaPlacement *numaPlacement_construct(Params *params, int64_t threadNo);
+
+/*
+ * Places the calling thread of the outermost parallel region on its node, if not already placed, and returns the
+ * params of the node. Returns the shared params to other threads.
+ */
+Params *numaPlacement_getThreadParams(NumaPlacement *placement);
+
+void numaPlacement_destruct(NumaPlacement *placement);
+
+// Memory predicted for a chunk besides that proportional to its read bases, for its reference, matrices and output
+#define CHUNK_MEMORY_OVERHEAD (16 * 1024 * 1024)
+
+/*
+ * Limits the chunks in flight to those whose predicted memory sums to at most maxMemory, chunkScheduler_next waiting
+ * for chunks to finish before returning one that would not fit. A chunk's memory is predicted as bytesPerReadBase
+ * times its estimated depth times its length, plus CHUNK_MEMORY_OVERHEAD. A chunk predicted to need more than
+ * maxMemory on its own should be downsampled to chunkScheduler_getMemoryDepthLimit, and is run alone if even that does
+ * not fit. Must be called before any chunks are taken, with the chunkOrder given to chunkScheduler_construct.
+ */
+void chunkScheduler_setMemoryBudget(ChunkScheduler *scheduler, BamChunker *bamChunker, stList *chunkOrder,
+                                    uint64_t maxMemory, uint64_t bytesPerReadBase);
+
+/*
+ * Gets the predicted memory of the chunk at position i, zero if there is no memory budget.
+ */
+uint64_t chunkScheduler_getPredictedMemory(ChunkScheduler *scheduler, int64_t i);
+
+/*
+ * Gets the depth the chunk at position i must be downsampled to for its predicted memory to fit the budget, or zero
+ * if it fits as it is.
+ */
+uint64_t chunkScheduler_getMemoryDepthLimit(ChunkScheduler *scheduler, int64_t i);
+
+/*
+ * The reference substring of a chunk, with the reads and alignments converted from the bam lines overlapping it.
+ */
+typedef struct _bamChunkReads {
+    RleString *rleReference;
+    // The map from the chunk's reference coordinates to those of rleReference, built once for the chunk and shared
+    // by the conversion of its reads and the rest of its polishing, or NULL if rleReference is not run length encoded
+    uint64_t *rleReferenceCoordinateMap;
+    stList *reads;
+    stList *alignments;
+    stList *filteredReads;
+    stList *filteredAlignments;
+    bool downsampled; // the reads were downsampled as they were read
+} BamChunkReads;
+
+/*
+ * Constructs the reads of a chunk with empty read and alignment lists, building the coordinate map of the reference
+ * if it is run length encoded.
+ */
+BamChunkReads *bamChunkReads_construct(RleString *rleReference);
+
+/*
+ * Destructs the reads of a chunk, with its reference, lists and coordinate map.
+ */
+void bamChunkReads_destruct(BamChunkReads *chunkReads);
+
+/*
+ * A read aligned to a reference sequence, given in memory with the fields of its SAM record.
+ */
+typedef struct _alignedRead {
+    char *readName;
+    char *nucleotides; // The read sequence, reverse complemented if aligned to the reverse strand, as in SAM
+    uint8_t *qualities; // The phred quality of each nucleotide, or NULL if not known
+    char *cigar; // The CIGAR string of the alignment
+    int64_t refStart; // The 0-based position of the first aligned base in the reference sequence
+    bool forwardStrand;
+    uint8_t mapQ;
+    bool secondary; // The alignment is secondary
+    bool supplementary; // The alignment is supplementary
+} AlignedRead;
+
+/*
+ * Converts the aligned reads overlapping the chunk to its reads and alignments, as convertToReadsAndAlignmentsWithFiltered
+ * converts the alignments read from the chunk's bam file, without reading a file. The reads are aligned to the chunk's
+ * contig, of which rleReference is the substring covered by the chunk. If withFilteredReads is set, reads with a
+ * mapping quality below the threshold are kept as the filtered reads. Returns NULL, leaving rleReference with the
+ * caller, if the record of a read can not be parsed, such as for a malformed CIGAR.
+ */
+BamChunkReads *bamChunkReads_constructFromAlignedReads(BamChunk *bamChunk, RleString *rleReference,
+                                                       AlignedRead *alignedReads, int64_t alignedReadNo,
+                                                       bool withFilteredReads, PolishParams *polishParams);
+
+/*
+ * Reads the chunks of a chunker in a single pass over its coordinate sorted bam file, which does not need an index,
+ * so may be piped in as "-". Each alignment is converted for every open chunk it overlaps. A chunk is opened when the
+ * stream reaches its start, and holds the same reads, in the same order, as convertToReadsAndAlignmentsWithFiltered
+ * would give once the stream has passed its end.
+ */
+typedef struct _bamChunkStream BamChunkStream;
+
+/*
+ * Creates a stream over the chunks of the chunker, whose indices are given by the stIntTuples of chunkOrder. The
+ * chunk order is sorted into the order of the bam file, in which the chunks should be taken. If withFilteredReads is
+ * set, alignments with a mapping quality below the threshold are kept as the filtered reads of their chunks.
+ */
+BamChunkStream *bamChunkStream_construct(BamChunker *bamChunker, stList *chunkOrder, char *referenceFile,
+                                         Params *params, bool withFilteredReads);
+
+/*
+ * Gets the reads of the i-th chunk of the sorted chunk order, reading the bam until the chunk is complete. Safe to
+ * call concurrently (such as from a ChunkPrefetcher), and each chunk must be taken exactly once.
+ */
+BamChunkReads *bamChunkStream_getChunk(BamChunkStream *stream, int64_t i);
+
+void bamChunkStream_destruct(BamChunkStream *stream);
+
+/*
+ * Groups of small chunks, each loaded at once: the reads of a group's chunks are read with a single multi-region
+ * iterator of one open bam file and index, and their references fetched together, so that the chunks of the many
+ * small contigs of a fragmented assembly share the fixed costs of a load. Each chunk keeps its identity, holding the
+ * same reads, in the same order, as convertToReadsAndAlignmentsWithFiltered would give.
+ */
+typedef struct _bamChunkGroups BamChunkGroups;
+
+/*
+ * Groups the runs of consecutive chunks of the chunk order, whose indices are given by its stIntTuples, that are at
+ * most a quarter of maxGroupLength long, into groups of up to maxGroupLength reference bases. If withFilteredReads is
+ * set, alignments with a mapping quality below the threshold are kept as the filtered reads of their chunks.
+ */
+BamChunkGroups *bamChunkGroups_construct(BamChunker *bamChunker, stList *chunkOrder, uint64_t maxGroupLength,
+                                         char *referenceFile, Params *params, bool withFilteredReads);
+
+/*
+ * Gets the reads of the i-th chunk of the chunk order, loading its group if it is the first of the group to be taken,
+ * or NULL if the chunk is not in a group. Safe to call concurrently (such as from a ChunkPrefetcher), and each chunk
+ * must be taken exactly once.
+ */
+BamChunkReads *bamChunkGroups_getChunk(BamChunkGroups *groups, int64_t i);
+
+void bamChunkGroups_destruct(BamChunkGroups *groups);
+
+/*
+ * Converts chunk of aligned reads into list of reads and alignments. Of an excessively deep chunk, the reads are kept up
+ * to excessiveDepthThreshold depth, and the filtered reads likewise, choosing the reads as downsampling would prefer
+ * them while reading, so the reads discarded are neither decoded nor held.
  */
 uint32_t convertToReadsAndAlignments(BamChunk *bamChunk, RleString *reference, stList *reads, stList *alignments,
                                      PolishParams *polishParams);
 uint32_t convertToReadsAndAlignmentsWithFiltered(BamChunk *bamChunk, RleString *reference, stList *reads,
                                                  stList *alignments, stList *filteredReads, stList *filteredAlignments,
                                                  PolishParams *polishParams);
+/*
+ * As convertToReadsAndAlignmentsWithFiltered, given the coordinate map of the chunk's reference rather than the
+ * reference, so that a map built once for the chunk is not built again.
+ */
+uint32_t convertToReadsAndAlignmentsWithFiltered2(BamChunk *bamChunk, uint64_t *ref_nonRleToRleCoordinateMap,
+                                                  stList *reads, stList *alignments, stList *filteredReads,
+                                                  stList *filteredAlignments, PolishParams *polishParams);
+/*
+ * Converts the chunk's aligned reads as convertToReadsAndAlignmentsWithFiltered does, but first downsamples them to the
+ * intended depth (if greater than zero) from their bam records alone, choosing the reads as
+ * downsampleViaFullReadLengthLikelihood (if byFullReadLength) or downsampleViaReadLikelihood would, after dropping the
+ * reads only in the chunk boundary. Only the maintained reads (and the filtered reads, if filteredReads is not NULL)
+ * have their sequences and alignments decoded, the discarded reads are not kept. Sets downsampled if the chunk was
+ * deep enough to downsample.
+ */
+uint32_t convertToReadsAndAlignmentsWithDownsampling(BamChunk *bamChunk, RleString *reference, int64_t intendedDepth,
+                                                     bool byFullReadLength, stList *reads, stList *alignments,
+                                                     stList *filteredReads, stList *filteredAlignments,
+                                                     bool *downsampled, PolishParams *polishParams);
+/*
+ * As convertToReadsAndAlignmentsWithDownsampling, given the coordinate map of the chunk's reference rather than the
+ * reference.
+ */
+uint32_t convertToReadsAndAlignmentsWithDownsampling2(BamChunk *bamChunk, uint64_t *ref_nonRleToRleCoordinateMap,
+                                                      int64_t intendedDepth, bool byFullReadLength, stList *reads,
+                                                      stList *alignments, stList *filteredReads,
+                                                      stList *filteredAlignments, bool *downsampled,
+                                                      PolishParams *polishParams);
 uint32_t extractReadSubstringsAtVariantPositions(BamChunk *bamChunk, stList *vcfEntries, stList *reads,
                                                  stList *filteredReads, PolishParams *polishParams);
 
+/*
+ * Gets the uniform draw in [0, 1) deciding whether the read is kept when downsampling the chunk, a hash of the read's
+ * name, the chunk and the downsamplingSeed. The downsampling is so the same at any thread count and in any read order.
+ */
+double downsampling_getReadDraw(BamChunk *bamChunk, char *readName);
+
 bool downsampleViaReadLikelihood(int64_t intendedDepth, BamChunk *bamChunk, stList *inputReads, stList *inputAlignments,
                                  stList *maintainedReads, stList *maintainedAlignments, stList *discardedReads,
                                  stList *discardedAlignments);
@@ -1584,16 +2949,46 @@ bool downsampleViaFullReadLengthLikelihood(int64_t intendedDepth, BamChunk *bamC
                                            stList *inputAlignments, stList *maintainedReads, stList *maintainedAlignments,
                                            stList *discardedReads, stList *discardedAlignments);
 bool downsampleBamChunkReadWithVcfEntrySubstringsViaFullReadLengthLikelihood(int64_t intendedDepth,
+                                                                             BamChunk *bamChunk,
                                                                              stList *chunkVcfEntries,
                                                                              stList *inputReads,
                                                                              stList *maintainedReads,
                                                                              stList *discardedReads);
 
+/*
+ * Writes <outputBamFileBase>[chunk identifier].haplotagged.bam with the HP tag of each read set from the haplotype
+ * read sets, and its bai index. If bamChunk is NULL and there are multiple threads, windows of the genome are
+ * tagged in parallel and written in order.
+ */
 void writeHaplotaggedBam(char *inputBamLocation, char *outputBamFileBase, char *regionStr, stSet *readsInH1, stSet *readsInH2,
         BamChunk *bamChunk, Params *params, char *logIdentifier);
 
+/*
+ * Gets the upper-cased substring [startPos, endPosExcl) of the given contig of the fasta file. The fasta index is
+ * loaded once per thread and kept in a process-wide cache, see referenceCache_destruct.
+ */
 char *getSequenceFromReference(char *fastaFile, char *contig, int64_t startPos, int64_t endPosExcl);
 
+/*
+ * Frees the fasta indices cached by getSequenceFromReference. Must not be called while other threads may be
+ * fetching reference sequence.
+ */
+void referenceCache_destruct();
+
+/*
+ * Reads the sequence of the contig of the fasta file and keeps it, so that getSequenceFromReference serves the
+ * contig from memory in this process rather than from the fasta. Replaces any contig kept before. Used by
+ * 'margin serve', which runs each request in a child process forked after the contig is kept.
+ */
+void referenceCache_keepContig(char *fastaFile, char *contig);
+
+/*
+ * Loads the index of the bam file and keeps it, so that every later load of the file's index in this process uses it
+ * rather than loading it again. Replaces any index kept before. A cram index is bound to its file handle, so for a
+ * cram file nothing is kept. Used by 'margin serve', as for referenceCache_keepContig.
+ */
+void bamIndex_keepIndex(char *bamFile);
+
 int64_t getAlignedReadLength(bam1_t *aln);
 
 int64_t getAlignedReadLength2(bam1_t *aln, int64_t *start_softclip, int64_t *end_softclip);
@@ -1619,4 +3014,119 @@ void poa_writeSupplementalChunkInformationDiploid(char *outputBase, int64_t chun
 
 
 
+/*
+ * Region API
+ */
+
+/*
+ * The result of polishing a window of a reference. consensus is the polished window. If phased, hap1Consensus and
+ * hap2Consensus are the consensus of each haplotype, vcfEntries the heterozygous variants found, with positions in
+ * the coordinates of the window's (run length encoded) reference, and readsInHap1 and readsInHap2 the names of the
+ * reads assigned to each haplotype; otherwise they are NULL.
+ */
+typedef struct _regionPolishResult {
+    RleString *consensus;
+    RleString *hap1Consensus;
+    RleString *hap2Consensus;
+    stList *vcfEntries;
+    stSet *readsInHap1;
+    stSet *readsInHap2;
+} RegionPolishResult;
+
+/*
+ * Polishes, and if diploid phases, the window of contig refSeqName starting at refStart whose sequence is reference,
+ * from the given aligned reads, as a chunk of the polish or phase commands would be, without reading or writing files.
+ * Returns NULL if the record of a read can not be parsed, such as for a malformed CIGAR.
+ */
+RegionPolishResult *polishRegion(char *refSeqName, char *reference, int64_t refStart, AlignedRead *alignedReads,
+                                 int64_t alignedReadNo, Params *params, bool diploid);
+
+/*
+ * Polishes, and if diploid phases, the chunk from its reads as polishRegion does, first downsampling them to maxDepth
+ * if it is not zero. Takes ownership of chunkReads, which is destructed.
+ */
+RegionPolishResult *polishChunkReads(BamChunk *bamChunk, BamChunkReads *chunkReads, uint64_t maxDepth,
+                                     Params *params, bool diploid);
+
+void regionPolishResult_destruct(RegionPolishResult *result);
+
+/*
+ * The settings of a polish run that its chunks are processed with by polishChunk.
+ */
+typedef struct _polishChunkSettings {
+    bool diploid;
+    bool skipRealignment; // Make the POA from the reads' CIGAR alignments alone, when diploid
+    bool onlyUseVCFAlleles;
+    bool partitionFilteredReads; // Partition the reads filtered from phasing (and the truth sequences) to haplotypes
+    BamChunker *truthHaplotypesBamChunker; // Of the truth sequences to partition with the filtered reads, or NULL
+    stHash *vcfEntries; // The variants to phase, by contig, or NULL to find them from the bubbles
+    bool outputFasta; // Make the POA of each haplotype, when diploid
+    bool outputPhasingState;
+    char **chunkPhasedVariants; // If not NULL, each chunk's phased variants are set in it, indexed by chunk
+    bool journalChunkData; // Journal each chunk's phased variants with it
+    char *outputBase; // Of the chunks' supplementary outputs and phasing state
+    bool writeChunkSupplementaryOutput;
+    bool outputPoaDOT;
+    bool outputPoaCSV;
+    bool outputRepeatCounts;
+    bool outputHaplotypeReads;
+    bool outputHaplotypeBAM;
+    HelenFeatureType helenFeatureType; // The HELEN features written, with _HDF5
+    int64_t splitWeightMaxRunLength;
+    void **helenHDF5Files;
+    bool fullFeatureOutput;
+    char *trueReferenceBam;
+} PolishChunkSettings;
+
+/*
+ * Polishes the chunk from its input, which is taken and destructed, as the polish command does: downsamples its reads
+ * to maxDepth (if not zero), makes its POA and, if diploid, phases the reads on its bubble graph and makes the POA of
+ * each haplotype, then passes the chunk to the output chunkers as chunkIdx. Returns the number of reads of the chunk,
+ * and sets totalNucleotides to their length.
+ */
+int64_t polishChunk(BamChunk *bamChunk, int64_t chunkIdx, BamChunkReads *chunkInput, uint64_t maxDepth,
+                    PolishChunkSettings *settings, OutputChunkers *outputChunkers, int64_t threadIdx, Params *params,
+                    char *logIdentifier, int64_t *totalNucleotides);
+
+/*
+ * Chunk replay bundles, for profiling a slow chunk on its own. A bundle holds a chunk's inputs as they were loaded:
+ * its coordinates, its reference substring, its reads, with their qualities and strands, and their alignments, and its
+ * filtered reads, with the depth the reads were to be downsampled to, whether the chunk was phased, and the fingerprint
+ * of the resolved PARAMS it was run with (see Params). Polish writes the bundles of its chunks that exceed the
+ * thresholds of its --replayBundleSeconds or --replayBundleCells options, to be rerun by 'margin replay'.
+ */
+typedef struct _chunkReplayBundle ChunkReplayBundle;
+
+/*
+ * Serializes the inputs of the chunk in memory, before they are processed; chunkReads is not modified. maxDepth is
+ * the depth the reads are to be downsampled to, zero if they are not.
+ */
+ChunkReplayBundle *chunkReplayBundle_construct(BamChunk *bamChunk, BamChunkReads *chunkReads, uint64_t maxDepth,
+                                               bool diploid, bool partitionFilteredReads,
+                                               uint64_t paramsFingerprint);
+
+/*
+ * Writes the bundle, compressed, to file.
+ */
+void chunkReplayBundle_write(ChunkReplayBundle *bundle, char *file);
+
+void chunkReplayBundle_destruct(ChunkReplayBundle *bundle);
+
+/*
+ * A chunk read back from a replay bundle, the only chunk of a chunker without a bam file.
+ */
+typedef struct _chunkReplay {
+    BamChunker *bamChunker;
+    BamChunk *bamChunk;
+    BamChunkReads *chunkReads; // set to NULL if taken, such as by polishChunk
+    uint64_t maxDepth;
+    bool diploid;
+    bool partitionFilteredReads;
+    uint64_t paramsFingerprint;
+} ChunkReplay;
+
+ChunkReplay *chunkReplay_read(char *file, PolishParams *polishParams);
+
+void chunkReplay_destruct(ChunkReplay *replay);
+
 #endif /* ST_RP_HMM_H_ */
@@ -0,0 +1,9 @@
+//
+// Created by tpesout on 6/26/18.
+//
+
+#ifndef MARGIN_VERSION_H
+
+#define MARGIN_POLISH_VERSION_H "2.2.dev-5177eec"
+
+#endif //MARGIN_VERSION_H
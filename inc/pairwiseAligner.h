@@ -18,6 +18,7 @@
 #include "sonLib.h"
 #include "pairwiseAlignment.h"
 #include "stateMachine.h"
+#include "logMath.h"
 
 //The exception string
 extern const char *PAIRWISE_ALIGNMENT_EXCEPTION_ID;
@@ -36,6 +37,13 @@ typedef struct _pairwiseAlignmentBandingParameters {
     float gapGamma; //The AMAP gap-gamma parameter which controls the degree to which indel probabilities are factored into the alignment.
     bool dynamicAnchorExpansion; // For each alignment anchor specify the expansion of the band individually, instead of using a
     // single expansion
+    bool scaledFloatProbabilities; // Do the forward/backward calculations in single precision, using scaled linear
+    // probabilities rather than log probabilities. Halves the memory of the dp matrices, at the cost of accuracy.
+    int64_t splitAlignmentParallelismThreshold; // If non-zero, the sub-matrices of alignments with pairs and indels
+    // bigger than this, split by splitMatrixBiggerThanThis, are solved as concurrent tasks, at the cost of their
+    // matrices being held at once
+    double xDrop; // If non-zero, the band is adapted to the forward probabilities: the cells at the ends of each
+    // diagonal whose forward values are more than this below the diagonal's maximum, in log space, are dropped from it
 } PairwiseAlignmentParameters;
 
 PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters_construct();
@@ -56,6 +64,27 @@ computeForwardProbability(SymbolString seqX, SymbolString seqY, stList *anchorPa
                           StateMachine *sM,
                           bool alignmentHasRaggedLeftEnd, bool alignmentHasRaggedRightEnd);
 
+/*
+ * As computeForwardProbability, but gives up once the forward probability is known to be less than
+ * logProbabilityFloor, returning an upper bound on it that is less than the floor. A floor of LOG_ZERO
+ * always computes the full probability.
+ */
+double computeForwardProbability2(SymbolString seqX, SymbolString seqY, stList *anchorPairs,
+                                  PairwiseAlignmentParameters *p, StateMachine *sM,
+                                  bool alignmentHasRaggedLeftEnd, bool alignmentHasRaggedRightEnd,
+                                  double logProbabilityFloor);
+
+/*
+ * Computes the forward log probabilities of aligning each of the seqXs to seqY, without anchors, into
+ * logProbabilities. The dp cells of the prefixes that the seqXs have in common are computed only once.
+ * If logProbabilityMargin is positive, each alignment gives up, as computeForwardProbability2, once its
+ * probability is more than the margin below the best of those already computed.
+ */
+void computeForwardProbabilities(SymbolString *seqXs, int64_t seqXNumber, SymbolString seqY,
+                                 PairwiseAlignmentParameters *p, StateMachine *sM,
+                                 bool alignmentHasRaggedLeftEnd, bool alignmentHasRaggedRightEnd,
+                                 double logProbabilityMargin, double *logProbabilities);
+
 /*
  * Gets the set of posterior match probabilities under a simple HMM model of alignment for two DNA sequences.
  */
@@ -83,6 +112,61 @@ void getAlignedPairsWithIndelsUsingAnchors(StateMachine *sM, SymbolString sX, Sy
                                            stList **gapYPairs,
                                            bool alignmentHasRaggedLeftEnd, bool alignmentHasRaggedRightEnd);
 
+/*
+ * A growable struct-of-arrays buffer of aligned pairs. The ith pair is (weight[i], x[i], y[i]), with the same
+ * meaning as the (weight, x, y) stIntTuples used by the stList based functions, but without an allocation per pair.
+ */
+typedef struct _alignedPairs {
+    int64_t length;
+    int64_t maxLength;
+    int64_t *weight;
+    int64_t *x;
+    int64_t *y;
+} AlignedPairs;
+
+AlignedPairs *alignedPairs_construct(void);
+
+void alignedPairs_destruct(AlignedPairs *pairs);
+
+void alignedPairs_add(AlignedPairs *pairs, int64_t weight, int64_t x, int64_t y);
+
+/*
+ * Removes all the pairs, keeping the memory for reuse.
+ */
+void alignedPairs_clear(AlignedPairs *pairs);
+
+/*
+ * Sorts the pairs in place by x and then y coordinate, as cmpAlignedPairsByCoordinates.
+ */
+void alignedPairs_sortByCoordinates(AlignedPairs *pairs);
+
+/*
+ * Sorts the pairs in place by y and then x coordinate, as cmpAlignedPairsByInvertedCoordinates.
+ */
+void alignedPairs_sortByInvertedCoordinates(AlignedPairs *pairs);
+
+/*
+ * Gets the index of the pair with the given coordinates in pairs sorted by alignedPairs_sortByCoordinates,
+ * or -1 if there is no such pair.
+ */
+int64_t alignedPairs_find(AlignedPairs *pairs, int64_t x, int64_t y);
+
+/*
+ * Converts to and from lists of (weight, x, y) stIntTuples.
+ */
+stList *alignedPairs_toList(AlignedPairs *pairs);
+
+AlignedPairs *alignedPairs_constructFromList(stList *alignedPairs);
+
+/*
+ * As getAlignedPairsWithIndelsUsingAnchors, but appends the pairs to the given buffers.
+ */
+void getAlignedPairsWithIndelsUsingAnchorsPacked(StateMachine *sM, SymbolString sX, SymbolString sY,
+                                                 stList *anchorPairs, PairwiseAlignmentParameters *p,
+                                                 AlignedPairs *alignedPairs, AlignedPairs *gapXPairs,
+                                                 AlignedPairs *gapYPairs,
+                                                 bool alignmentHasRaggedLeftEnd, bool alignmentHasRaggedRightEnd);
+
 /*
  * As filterPairwiseAlignmentToMakePairsOrdered, but does not use the multiple alignment code. Returns
  * a subset of alignedPairs that form a maximal expected accuracy (MEA) alignment, as described in Schwartz and Pachter.
@@ -92,6 +176,14 @@ stList *getMaximalExpectedAccuracyPairwiseAlignment(stList *alignedPairs, stList
                                                     int64_t seqXLength, int64_t seqYLength, double *alignmentScore,
                                                     PairwiseAlignmentParameters *p);
 
+/*
+ * As getMaximalExpectedAccuracyPairwiseAlignment, taking packed pairs. Sorts alignedPairs in place.
+ */
+stList *getMaximalExpectedAccuracyPairwiseAlignmentPacked(AlignedPairs *alignedPairs,
+                                                          AlignedPairs *gapXPairs, AlignedPairs *gapYPairs,
+                                                          int64_t seqXLength, int64_t seqYLength,
+                                                          double *alignmentScore, PairwiseAlignmentParameters *p);
+
 /*
  * Shifts pairs in an alignment so that inserts are maximally left shifted.
  */
@@ -170,12 +262,6 @@ Diagonal bandIterator_getNext(BandIterator *bandIterator);
 
 Diagonal bandIterator_getPrevious(BandIterator *bandIterator);
 
-//Log add
-
-#define LOG_ZERO -INFINITY
-
-double logAdd(double x, double y);
-
 //Cell calculations
 
 void cell_calculateForward(StateMachine *sM, double *current, double *lower, double *middle, double *upper, Symbol cX,
@@ -188,6 +274,31 @@ double cell_dotProduct(double *cell1, double *cell2, int64_t stateNumber);
 
 double cell_dotProduct2(double *cell1, StateMachine *sM, double (*getStateValue)(StateMachine *, int64_t));
 
+//DpArena
+
+/*
+ * The dp matrices and their diagonals are allocated from a thread local arena, which keeps
+ * released buffers for reuse by later alignments computed by the same thread.
+ */
+typedef struct _dpArenaStats {
+    int64_t bytesInUse; // Bytes of buffers currently held by dp matrices
+    int64_t bytesCached; // Bytes of released buffers kept for reuse
+    int64_t peakBytes; // Largest total of bytesInUse and bytesCached since the last dpArena_clear
+    int64_t allocations; // Number of buffers obtained from the allocator since the last dpArena_clear
+    int64_t reuses; // Number of buffers obtained from the arena since the last dpArena_clear
+} DpArenaStats;
+
+/*
+ * Gets the arena stats of the calling thread.
+ */
+void dpArena_getStats(DpArenaStats *stats);
+
+/*
+ * Frees the buffers cached by the arena of the calling thread, and restarts its peak and counts. Polish and phase call
+ * it at the end of each chunk, so the stats are those of the chunk.
+ */
+void dpArena_clear(void);
+
 //DpDiagonal
 
 typedef struct _dpDiagonal DpDiagonal;
@@ -215,6 +326,12 @@ typedef struct _dpMatrix DpMatrix;
 
 DpMatrix *dpMatrix_construct(int64_t diagonalNumber, int64_t stateNumber);
 
+/*
+ * As dpMatrix_construct, but if scaled is true the diagonals store scaled, single precision, linear
+ * probabilities, which are only supported for the three state machines.
+ */
+DpMatrix *dpMatrix_construct2(int64_t diagonalNumber, int64_t stateNumber, bool scaled);
+
 void dpMatrix_destruct(DpMatrix *dpMatrix);
 
 DpDiagonal *dpMatrix_getDiagonal(DpMatrix *dpMatrix, int64_t xay);
@@ -279,6 +396,12 @@ stList *reweightAlignedPairs(stList *alignedPairs,
 
 stList *reweightAlignedPairs2(stList *alignedPairs, int64_t seqLengthX, int64_t seqLengthY, double gapGamma);
 
+//As getIndelProbabilities and reweightAlignedPairs, for packed pairs, reweighting in place.
+int64_t *getIndelProbabilitiesPacked(AlignedPairs *alignedPairs, int64_t seqLength, bool xIfTrueElseY);
+
+void reweightAlignedPairsPacked(AlignedPairs *alignedPairs, int64_t *indelProbsX, int64_t *indelProbsY,
+                                double gapGamma);
+
 /*
  * Functions to score an alignment by identity / or some proxy to it.
  */
@@ -316,14 +439,93 @@ stList *filterPairwiseAlignmentToMakePairsOrdered(stList *alignedPairs, SymbolSt
 
 /*
  * Get quick and dirty alignment anchors by finding long chain of shared k-mers, mid-point of each k-mer is then an anchor
- * with given diagonal expansion around it.
+ * with given diagonal expansion around it. Only the minimizers of the sequences are used, and the chain is found in
+ * O(n log n) time for n shared minimizers, so this is usable on long sequences.
  */
 stList *getKmerAlignmentAnchors(SymbolString seqX, SymbolString seqY, uint64_t anchorExpansion);
 
+/*
+ * Batches of independent alignments, e.g. of many reads to a reference, for a backend able to solve many alignments
+ * at once, such as on a GPU. Without a backend, or if the backend declines a batch, the alignments are solved on the
+ * cpu, each in its own OpenMP task. The sequences and anchor pairs added to a batch are not copied, and must be kept
+ * until the batch is computed.
+ */
+typedef struct _pairwiseAlignmentBatch PairwiseAlignmentBatch;
+
+PairwiseAlignmentBatch *pairwiseAlignmentBatch_construct(PairwiseAlignmentParameters *p);
+
+void pairwiseAlignmentBatch_destruct(PairwiseAlignmentBatch *batch);
+
+/*
+ * Adds an alignment of sX and sY, with the given anchors and ends, as for getAlignedPairsWithIndelsUsingAnchors and
+ * computeForwardProbability, returning its index in the batch.
+ */
+int64_t pairwiseAlignmentBatch_add(PairwiseAlignmentBatch *batch, StateMachine *sM, SymbolString sX, SymbolString sY,
+                                   stList *anchorPairs, bool alignmentHasRaggedLeftEnd,
+                                   bool alignmentHasRaggedRightEnd);
+
+/*
+ * If parallel is false, alignments solved on the cpu are solved one after another by the calling thread, e.g. for
+ * batches too small to be worth the tasks. Batches are parallel by default.
+ */
+void pairwiseAlignmentBatch_setParallel(PairwiseAlignmentBatch *batch, bool parallel);
+
+int64_t pairwiseAlignmentBatch_length(PairwiseAlignmentBatch *batch);
+
+PairwiseAlignmentParameters *pairwiseAlignmentBatch_getParameters(PairwiseAlignmentBatch *batch);
+
+void pairwiseAlignmentBatch_getProblem(PairwiseAlignmentBatch *batch, int64_t i, StateMachine **sM, SymbolString *sX,
+                                       SymbolString *sY, stList **anchorPairs, bool *alignmentHasRaggedLeftEnd,
+                                       bool *alignmentHasRaggedRightEnd);
+
+/*
+ * Computes the aligned pairs and indel pairs of each alignment of the batch, as getAlignedPairsWithIndelsUsingAnchors,
+ * got with the functions below, which are owned by the batch.
+ */
+void pairwiseAlignmentBatch_computeAlignedPairs(PairwiseAlignmentBatch *batch);
+
+AlignedPairs *pairwiseAlignmentBatch_getAlignedPairs(PairwiseAlignmentBatch *batch, int64_t i);
+
+AlignedPairs *pairwiseAlignmentBatch_getGapXPairs(PairwiseAlignmentBatch *batch, int64_t i);
+
+AlignedPairs *pairwiseAlignmentBatch_getGapYPairs(PairwiseAlignmentBatch *batch, int64_t i);
+
+/*
+ * Computes the forward log probability of each alignment of the batch, as computeForwardProbability.
+ */
+void pairwiseAlignmentBatch_computeForwardProbabilities(PairwiseAlignmentBatch *batch);
+
+double pairwiseAlignmentBatch_getForwardProbability(PairwiseAlignmentBatch *batch, int64_t i);
+
+void pairwiseAlignmentBatch_setForwardProbability(PairwiseAlignmentBatch *batch, int64_t i, double forwardProbability);
+
+/*
+ * A backend solving batches. Each function, if non-null, returns non-zero if it solved the whole batch, setting the
+ * results with pairwiseAlignmentBatch_setForwardProbability or appending to the (empty) buffers of
+ * pairwiseAlignmentBatch_getAlignedPairs etc., or zero to have the batch solved on the cpu, e.g. for state machines
+ * or sequence lengths it does not support.
+ */
+typedef struct _pairwiseAlignmentBackend {
+    const char *name;
+    bool (*computeAlignedPairs)(PairwiseAlignmentBatch *batch, void *backendData);
+    bool (*computeForwardProbabilities)(PairwiseAlignmentBatch *batch, void *backendData);
+    void *backendData;
+} PairwiseAlignmentBackend;
+
+/*
+ * Sets the backend used by all batches, or null for the cpu. Not thread safe, set it before aligning.
+ */
+void pairwiseAlignmentBatch_setBackend(PairwiseAlignmentBackend *backend);
+
+PairwiseAlignmentBackend *pairwiseAlignmentBatch_getBackend(void);
+
 /*
  * Parameters for testing
  */
 void setPairwiseAlignerKmerSize(int64_t kmerSize);
+void setPairwiseAlignerKmerSeeding(int64_t minimizerWindow, int64_t maxKmerOccurrences); // Minimizer window and cap on
+// the copies in seqX of each seed of seqY used by getKmerAlignmentAnchors
+void setPairwiseAlignerUseVectorisedDiagonals(bool useVectorised); // Toggles the lane-wise diagonal calculations
 void setMinOverlapAnchorPairs(int64_t minOverlapAnchorPairs);
 
 #endif /* PAIRWISEALIGNER_H_ */
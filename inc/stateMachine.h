@@ -31,6 +31,12 @@ SymbolString symbolString_construct(const char *sequence, int64_t start, int64_t
 
 SymbolString symbolString_getSubString(SymbolString s, uint64_t start, uint64_t length);
 
+/*
+ * Gets the substring of s as a view of its symbols, without copying them. The view must not be destructed and must not
+ * be used after s is.
+ */
+SymbolString symbolString_getView(SymbolString s, uint64_t start, uint64_t length);
+
 void symbolString_destruct(SymbolString s);
 
 /*
@@ -70,6 +76,10 @@ struct _emissions {
     double (*gapEmissionX)(Emissions *e, Symbol cX);
 
     double (*gapEmissionY)(Emissions *e, Symbol cY);
+    //Computes the gap x, match and gap y emissions for n consecutive cells of an x+y diagonal, where x moves
+    //forward from sX[0] and y moves backward from sY[0]. Specialised per emissions type to avoid per cell calls.
+    void (*diagonalEmissions)(Emissions *e, const Symbol *sX, const Symbol *sY, int64_t n, double *eGapX,
+                              double *eMatch, double *eGapY);
 
     void (*printFn)(Emissions *e, FILE *f);
 };
@@ -125,6 +135,59 @@ struct _stateMachine {
     void (*printFn)(StateMachine *e, FILE *f);
 };
 
+/*
+ * The three state machine. The transitions are exposed so that the pairwise aligner
+ * can compute whole diagonals of the dp matrix without going through cellCalculate.
+ */
+typedef struct _StateMachine3 StateMachine3;
+
+struct _StateMachine3 {
+    //3 state state machine, allowing for symmetry in x and y.
+    StateMachine model;
+    double TRANSITION_MATCH_CONTINUE;
+    double TRANSITION_MATCH_FROM_GAP_X;
+    double TRANSITION_MATCH_FROM_GAP_Y;
+    double TRANSITION_GAP_OPEN_X;
+    double TRANSITION_GAP_OPEN_Y;
+    double TRANSITION_GAP_EXTEND_X;
+    double TRANSITION_GAP_EXTEND_Y;
+    double TRANSITION_GAP_SWITCH_TO_X;
+    double TRANSITION_GAP_SWITCH_TO_Y;
+};
+
+//Cell layout of the three state machine
+#define SM3_MATCH 0
+#define SM3_GAP_X 1
+#define SM3_GAP_Y 2
+#define SM3_STATES 3
+
+/*
+ * Body of the three state cell calculation. DO_TRANSITION is called as
+ * DO_TRANSITION(fromCells, toCells, from, to, emissionProb, transitionProb, extraArgs), so when it is a
+ * static inline function or macro rather than a function pointer the compiler can inline the recurrences.
+ */
+#define STATE_MACHINE3_CELL_CALCULATE(sM3, current, lower, middle, upper, cX, cY, DO_TRANSITION, extraArgs) { \
+    Emissions *stateMachine3_e = (sM3)->model.emissions; \
+    if ((lower) != NULL) { \
+        double eP = stateMachine3_e->gapEmissionX(stateMachine3_e, (cX)); \
+        DO_TRANSITION((lower), (current), SM3_MATCH, SM3_GAP_X, eP, (sM3)->TRANSITION_GAP_OPEN_X, (extraArgs)); \
+        DO_TRANSITION((lower), (current), SM3_GAP_X, SM3_GAP_X, eP, (sM3)->TRANSITION_GAP_EXTEND_X, (extraArgs)); \
+        DO_TRANSITION((lower), (current), SM3_GAP_Y, SM3_GAP_X, eP, (sM3)->TRANSITION_GAP_SWITCH_TO_X, (extraArgs)); \
+    } \
+    if ((middle) != NULL) { \
+        double eP = stateMachine3_e->emission(stateMachine3_e, (cX), (cY)); \
+        DO_TRANSITION((middle), (current), SM3_MATCH, SM3_MATCH, eP, (sM3)->TRANSITION_MATCH_CONTINUE, (extraArgs)); \
+        DO_TRANSITION((middle), (current), SM3_GAP_X, SM3_MATCH, eP, (sM3)->TRANSITION_MATCH_FROM_GAP_X, (extraArgs)); \
+        DO_TRANSITION((middle), (current), SM3_GAP_Y, SM3_MATCH, eP, (sM3)->TRANSITION_MATCH_FROM_GAP_Y, (extraArgs)); \
+    } \
+    if ((upper) != NULL) { \
+        double eP = stateMachine3_e->gapEmissionY(stateMachine3_e, (cY)); \
+        DO_TRANSITION((upper), (current), SM3_MATCH, SM3_GAP_Y, eP, (sM3)->TRANSITION_GAP_OPEN_Y, (extraArgs)); \
+        DO_TRANSITION((upper), (current), SM3_GAP_Y, SM3_GAP_Y, eP, (sM3)->TRANSITION_GAP_EXTEND_Y, (extraArgs)); \
+        DO_TRANSITION((upper), (current), SM3_GAP_X, SM3_GAP_Y, eP, (sM3)->TRANSITION_GAP_SWITCH_TO_Y, (extraArgs)); \
+    } \
+}
+
 StateMachine *hmm_getStateMachine(Hmm *hmm);
 
 StateMachine *
@@ -135,6 +198,13 @@ stateMachine3_constructNucleotide(StateMachineType type); // Construct with defa
 
 void stateMachine_destruct(StateMachine *stateMachine);
 
+/*
+ * Returns non-zero if the three state machine reverseSM is that of the reverse strand of sM: the transitions are the
+ * same and the emissions of each pair of bases, with each repeat count less than maxRepeatCountExclusive, are those
+ * of the complementary bases.
+ */
+bool stateMachine3_isReverseStrand(StateMachine *sM, StateMachine *reverseSM, uint64_t maxRepeatCountExclusive);
+
 /*
  * Hmm for loading/unloading HMMs and storing expectations.
  */
@@ -175,4 +245,26 @@ double hmm_getEmissionsExpectation(Hmm *hmm, int64_t state, int64_t emissionNo);
 
 void hmm_setEmissionsExpectation(Hmm *hmm, int64_t state, int64_t emissionNo, double p);
 
+/*
+ * Adds the expectation of the emission of symbols x and y (x only from the gap x state, y only from the gap y state)
+ * from the given state. Repeat counts are ignored, as are ambiguous symbols.
+ */
+void hmm_addToEmissionsExpectationForSymbols(Hmm *hmmExpectations, int64_t state, Symbol x, Symbol y, double p);
+
+/*
+ * Adds the expectations, and likelihood, of hmmExpectations2 to those of hmmExpectations.
+ */
+void hmm_addExpectations(Hmm *hmmExpectations, Hmm *hmmExpectations2);
+
+/*
+ * Swaps the emissions of each base for those of its complement, so expectations gathered with the reverse strand state
+ * machine become expectations of the forward strand one.
+ */
+void hmm_reverseComplementEmissions(Hmm *hmm);
+
+/*
+ * Prints the hmm as json, in the form read by hmm_jsonParse, with the given indent on each line after the first.
+ */
+void hmm_printJson(Hmm *hmm, FILE *fh, const char *indent);
+
 #endif /* STATEMACHINE_H_ */
@@ -10,6 +10,10 @@
 
 int polish_main(int argc, char *argv[]);
 int phase_main(int argc, char *argv[]);
+int cohort_main(int argc, char *argv[]);
+int stitch_main(int argc, char *argv[]);
+int serve_main(int argc, char *argv[]);
+int replay_main(int argc, char *argv[]);
 
 void usage() {
     fprintf(stderr, "Program: margin (tools for analysis of long read data)\n");
@@ -20,6 +24,10 @@ void usage() {
     fprintf(stderr, "Commands:\n");
     fprintf(stderr, "    polish             Polishes a reference sequence using read data\n");
     fprintf(stderr, "    phase              Haplotags reads and phases variants using read data and VCF\n");
+    fprintf(stderr, "    cohort             Haplotags reads and phases variants of each sample of a cohort in one run\n");
+    fprintf(stderr, "    stitch             Stitches the shards of a polish or phase run into its output\n");
+    fprintf(stderr, "    serve              Serves polish, phase and haplotag requests from stdin, keeping inputs loaded\n");
+    fprintf(stderr, "    replay             Reruns a chunk from the replay bundle of its inputs, for profiling\n");
     fprintf(stderr, "\n");
 }
 
@@ -35,6 +43,14 @@ int main(int argc, char *argv[]) {
         return polish_main(argc-1, argv+1);
     } else if (strcmp(argv[1], "phase") == 0) {
         return phase_main(argc-1, argv+1);
+    } else if (strcmp(argv[1], "cohort") == 0) {
+        return cohort_main(argc-1, argv+1);
+    } else if (strcmp(argv[1], "stitch") == 0) {
+        return stitch_main(argc-1, argv+1);
+    } else if (strcmp(argv[1], "serve") == 0) {
+        return serve_main(argc-1, argv+1);
+    } else if (strcmp(argv[1], "replay") == 0) {
+        return replay_main(argc-1, argv+1);
     } else if (strcmp(argv[1], "version") == 0) {
         fprintf(stderr, "%s\n", MARGIN_POLISH_VERSION_H);
         return 0;
@@ -18,6 +18,25 @@
 #include "helenFeatures.h"
 
 
+typedef struct _phaseChunkLoader {
+    BamChunker *bamChunker;
+    stList *chunkOrder;
+    char *referenceFastaFile;
+    stHash *vcfEntries;
+    Params *params;
+} PhaseChunkLoader;
+
+static void phasedVcfWriter_chunkStitched(int64_t chunkOrdinal, bool wasSwitched, void *extraArg) {
+    phasedVcfWriter_finishChunk(extraArg, chunkOrdinal, wasSwitched);
+}
+
+static void *phaseChunkInput_load(int64_t i, void *extraArg) {
+    PhaseChunkLoader *loader = extraArg;
+    BamChunk *bamChunk = bamChunker_getChunk(loader->bamChunker,
+                                             stIntTuple_get(stList_get(loader->chunkOrder, i), 0));
+    return phaseChunkInput_construct(bamChunk, loader->referenceFastaFile, loader->vcfEntries, loader->params);
+}
+
 /*
  * Main functions
  */
@@ -43,7 +62,31 @@ void phase_usage() {
     fprintf(stderr, "    -r --region              : If set, will only compute for given chromosomal region\n");
     fprintf(stderr, "                                 Format: chr:start_pos-end_pos (chr3:2000-3000)\n");
     fprintf(stderr, "    -p --depth               : Will override the downsampling depth set in PARAMS\n");
+    fprintf(stderr, "    -m --maxMemory           : Only start a chunk while the predicted memory of the chunks in flight\n");
+    fprintf(stderr, "                                 fits in this many bytes (suffixes K, M, G, T), downsampling chunks\n");
+    fprintf(stderr, "                                 that would not fit on their own. Overrides maxMemory in PARAMS\n");
+    fprintf(stderr, "    -e --seed                : Seed of the per read hashes choosing the reads kept by downsampling,\n");
+    fprintf(stderr, "                                 which are the same at any thread count. Overrides downsamplingSeed\n");
+    fprintf(stderr, "                                 in PARAMS\n");
     fprintf(stderr, "    -k --tempFilesToDisk     : Write temporary files to disk (for --diploid or supplementary output)\n");
+    fprintf(stderr, "    -J --chunkJournal        : Journal finished chunks to OUTPUT_BASE.chunkJournal, so that if the run\n");
+    fprintf(stderr, "                                 is interrupted, rerunning it skips the journaled chunks\n");
+    fprintf(stderr, "    -x --shard               : Only process shard i of N (format: i/N, 0 <= i < N), a contiguous part of\n");
+    fprintf(stderr, "                                 the chunks, journaling them to OUTPUT_BASE.shard<i>of<N>.chunkJournal.\n");
+    fprintf(stderr, "                                 Run all N shards, then 'margin stitch' to write the output\n");
+    fprintf(stderr, "    -E --chunkTelemetry      : Write the wall and CPU time of each stage of each chunk, with counts of\n");
+    fprintf(stderr, "                                 its work (reads, bubbles, HMM and alignment cells, bam bytes...),\n");
+    fprintf(stderr, "                                 to OUTPUT_BASE.chunkTelemetry.jsonl, ending with the run's totals\n");
+    fprintf(stderr, "    -H --hardwareCounters    : Also count the cycles, instructions, last level cache, branch and data\n");
+    fprintf(stderr, "                                 TLB misses of each stage in the chunk telemetry, with the hardware\n");
+    fprintf(stderr, "                                 counters of linux's perf_event_open. Implies --chunkTelemetry\n");
+    fprintf(stderr, "       --chromeTrace         : Write a timeline of the work of each thread, as Chrome trace JSON for\n");
+    fprintf(stderr, "                                 chrome://tracing or Perfetto, to OUTPUT_BASE.trace.json\n");
+# ifdef _OPENMP
+    fprintf(stderr, "    -N --numa                : Place the threads on the NUMA nodes of the host, in contiguous blocks\n");
+    fprintf(stderr, "                                 pinned to the cpus of each node, each node with its own copy of the\n");
+    fprintf(stderr, "                                 model tables of PARAMS\n");
+#endif
 
     fprintf(stderr, "\nOutput options:\n");
     fprintf(stderr, "    -M --skipHaplotypeBAM    : Do not write out phased BAM\n");
@@ -65,7 +108,16 @@ int phase_main(int argc, char *argv[]) {
     char *vcfFile = NULL;
     int numThreads = 1;
     int64_t maxDepth = -1;
+    uint64_t maxMemory = 0;
+    int64_t downsamplingSeed = -1;
     bool inMemory = TRUE;
+    bool useChunkJournal = FALSE;
+    int64_t shardIdx = -1;
+    int64_t shardCount = 0;
+    int64_t stitchShardCount = 0;
+    bool writeChunkTelemetry = FALSE;
+    bool writeChromeTrace = FALSE;
+    bool useNuma = FALSE;
     bool shouldOutputHaplotaggedBam = TRUE;
     bool shouldOutputPhasedVcf = TRUE;
 
@@ -92,13 +144,24 @@ int phase_main(int argc, char *argv[]) {
                 { "outputBase", required_argument, 0, 'o'},
                 { "region", required_argument, 0, 'r'},
                 { "depth", required_argument, 0, 'p'},
+                { "maxMemory", required_argument, 0, 'm'},
+                { "seed", required_argument, 0, 'e'},
                 { "tempFilesToDisk", no_argument, 0, 'k'},
+                { "chunkJournal", no_argument, 0, 'J'},
+                { "shard", required_argument, 0, 'x'},
+                { "stitchShards", required_argument, 0, 'y'},
+                { "chunkTelemetry", no_argument, 0, 'E'},
+                { "hardwareCounters", no_argument, 0, 'H'},
+                { "chromeTrace", no_argument, 0, OPTION_CHROME_TRACE},
+# ifdef _OPENMP
+                { "numa", no_argument, 0, 'N'},
+#endif
                 { "skipHaplotypeBAM", no_argument, 0, 'M'},
                 { "skipPhasedVCF", no_argument, 0, 'V'},
                 { 0, 0, 0, 0 } };
 
         int option_index = 0;
-        int key = getopt_long(argc-2, &argv[2], "ha:o:p:t:r:kMV", long_options, &option_index);
+        int key = getopt_long(argc-2, &argv[2], "ha:o:p:m:e:t:r:kJx:y:EHNMV", long_options, &option_index);
 
         if (key == -1) {
             break;
@@ -125,6 +188,15 @@ int phase_main(int argc, char *argv[]) {
                 st_errAbort("Invalid maxDepth: %s", optarg);
             }
             break;
+        case 'm':
+            maxMemory = parseByteSize(optarg);
+            break;
+        case 'e':
+            downsamplingSeed = atoll(optarg);
+            if (downsamplingSeed < 0) {
+                st_errAbort("Invalid seed: %s", optarg);
+            }
+            break;
         case 't':
             numThreads = atoi(optarg);
             if (numThreads <= 0) {
@@ -134,6 +206,34 @@ int phase_main(int argc, char *argv[]) {
         case 'k':
             inMemory = FALSE;
             break;
+        case 'J':
+            useChunkJournal = TRUE;
+            break;
+        case 'x':
+            if (sscanf(optarg, "%"SCNd64"/%"SCNd64, &shardIdx, &shardCount) != 2 || shardCount <= 0 ||
+                shardIdx < 0 || shardIdx >= shardCount) {
+                st_errAbort("Invalid shard, expected i/N with 0 <= i < N: %s", optarg);
+            }
+            break;
+        case 'y':
+            stitchShardCount = atoi(optarg);
+            if (stitchShardCount <= 0) {
+                st_errAbort("Invalid shard count: %s", optarg);
+            }
+            break;
+        case 'E':
+            writeChunkTelemetry = TRUE;
+            break;
+        case 'H':
+            writeChunkTelemetry = TRUE;
+            chunkTelemetry_setHardwareCounters(TRUE);
+            break;
+        case OPTION_CHROME_TRACE:
+            writeChromeTrace = TRUE;
+            break;
+        case 'N':
+            useNuma = TRUE;
+            break;
         case 'M':
             shouldOutputHaplotaggedBam = FALSE;
             break;
@@ -193,6 +293,7 @@ int phase_main(int argc, char *argv[]) {
     // Parse parameters
     st_logCritical("> Parsing model parameters from file: %s\n", paramsFile);
     Params *params = params_readParams(paramsFile);
+    hugePages_setEnabled(params->polishParams->useHugePages);
 
     // update depth (if set)
     if (maxDepth >= 0) {
@@ -201,6 +302,41 @@ int phase_main(int argc, char *argv[]) {
         params->polishParams->maxDepth = (uint64_t) maxDepth;
     }
 
+    // update memory budget (if set)
+    if (maxMemory > 0) {
+        st_logCritical("> Changing maxMemory parameter from %"PRIu64" to %"PRIu64"\n", params->polishParams->maxMemory,
+                       maxMemory);
+        params->polishParams->maxMemory = maxMemory;
+    }
+
+    // update downsampling seed (if set)
+    if (downsamplingSeed >= 0) {
+        st_logCritical("> Changing downsamplingSeed parameter from %"PRIu64" to %"PRId64"\n",
+                       params->polishParams->downsamplingSeed, downsamplingSeed);
+        params->polishParams->downsamplingSeed = (uint64_t) downsamplingSeed;
+    }
+
+    // shards journal their chunks, to be stitched from the journals
+    if (shardCount > 0 && stitchShardCount > 0) {
+        st_errAbort("A shard can not be run while stitching shards");
+    }
+    if (shardCount > 0) {
+        // the shard's (temporary) files are named apart from the other shards'
+        char *shardOutputBase = stString_print("%s.shard%"PRId64"of%"PRId64, outputBase, shardIdx, shardCount);
+        free(outputBase);
+        outputBase = shardOutputBase;
+        params->polishParams->stitchOnline = FALSE;
+        useChunkJournal = TRUE;
+    }
+    if (stitchShardCount > 0) {
+        useChunkJournal = TRUE;
+    }
+
+    // the journal holds each chunk's record
+    if (useChunkJournal) {
+        params->polishParams->useBinaryChunkRecords = TRUE;
+    }
+
     // Print a report of the parsed parameters
     if (st_getLogLevel() == debug) {
         params_printParameters(params, stderr);
@@ -219,9 +355,21 @@ int phase_main(int argc, char *argv[]) {
         stSet_insert(vcfContigs, stList_get(vcfContigsTmp, i));
     }
 
+    // phasing enumerates the reads as they are chunked, so the alignments have to be read
+    if (params->polishParams->estimateChunkDepthFromIndex || params->polishParams->chunkDepthSummaryFile != NULL) {
+        st_logCritical("> Estimating chunk depth from the alignments, as phasing enumerates the reads\n");
+        params->polishParams->estimateChunkDepthFromIndex = FALSE;
+        if (params->polishParams->chunkDepthSummaryFile != NULL) {
+            free(params->polishParams->chunkDepthSummaryFile);
+            params->polishParams->chunkDepthSummaryFile = NULL;
+        }
+    }
+
     // get chunker for bam.  if regionStr is NULL, it will be ignored
     time_t chunkingStart = time(NULL);
-    BamChunker *bamChunker = bamChunker_construct2(bamInFile, regionStr, vcfContigs, params->polishParams, TRUE);
+    BamChunker *bamChunker = bamChunker_construct3(bamInFile, regionStr, vcfContigs, vcfEntries, params->polishParams,
+                                                   TRUE);
+    bamChunker_setCramReference(bamChunker, referenceFastaFile);
     char *regionStrInformative = regionStr != NULL ? stString_copy(regionStr) : stString_join2(",", vcfContigsTmp);
     st_logCritical(
             "> Set up bam chunker in %"PRId64"s with chunk size %i and overlap %i (for region=%s), resulting in %i total chunks\n",
@@ -254,7 +402,9 @@ int phase_main(int argc, char *argv[]) {
     for (int64_t i = 0; i < bamChunker->chunkCount; i++) {
         stList_append(chunkOrder, stIntTuple_construct1(i));
     }
-    if (params->polishParams->shuffleChunks) {
+    if (params->polishParams->stitchOnline) {
+        st_logCritical("> Stitching online, processing chunks in contig order\n");
+    } else if (params->polishParams->shuffleChunks) {
         switch (params->polishParams->shuffleChunksMethod) {
             case SCM_SIZE_DESC:
                 st_logCritical("> Ordering chunks by estimated depth\n");
@@ -265,206 +415,282 @@ int phase_main(int argc, char *argv[]) {
                 st_logCritical("> Randomly shuffling chunks\n");
                 stList_shuffle(chunkOrder);
                 break;
+            case SCM_COST_DESC:
+                st_logCritical("> Ordering chunks by predicted cost\n");
+                break;
+        }
+    }
+
+    // (may) resume from the chunks journaled by an earlier run of the same inputs and options
+    char *chunkJournalFile = NULL;
+    stList *shardJournalFiles = stList_construct3(0, free);
+    stList *journaledChunks = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
+    if (useChunkJournal) {
+        chunkJournalFile = stString_print("%s.chunkJournal", outputBase);
+        // the settings, which a journaled chunk must share to be reused: the resolved parameters, the contents of the
+        // vcf and the options. The bam and reference are in each chunk's input key instead
+        uint64_t fingerprint = chunkJournal_fingerprintString(CHUNK_JOURNAL_FINGERPRINT_SEED, MARGIN_POLISH_VERSION_H);
+        fingerprint = chunkJournal_fingerprintFile(fingerprint, vcfFile);
+        char *options = stString_print("phase %"PRIu64" %s %"PRId64" %"PRIu64" %"PRIu64, params->fingerprint,
+                                       regionStr == NULL ? "" : regionStr, maxDepth, maxMemory,
+                                       params->polishParams->downsamplingSeed);
+        fingerprint = chunkJournal_fingerprintString(fingerprint, options);
+        free(options);
+        if (stitchShardCount > 0) {
+            for (int64_t i = 0; i < stitchShardCount; i++) {
+                stList_append(shardJournalFiles, stString_print("%s.shard%"PRId64"of%"PRId64".chunkJournal",
+                                                                outputBase, i, stitchShardCount));
+            }
+            chunkJournal_merge(chunkJournalFile, shardJournalFiles, fingerprint, bamChunker->chunkCount);
+        }
+        int64_t journaledChunkNo = outputChunkers_openChunkJournal(outputChunkers, chunkJournalFile, fingerprint,
+                                                                   bamChunker->chunkCount);
+        if (stitchShardCount > 0 && journaledChunkNo != bamChunker->chunkCount) {
+            st_errAbort("Found %"PRId64" of %"PRId64" chunks in the shard journals, all %"PRId64" shards must be "
+                        "completed before stitching", journaledChunkNo, bamChunker->chunkCount, stitchShardCount);
+        }
+        int64_t shardStart = shardCount > 0 ? bamChunker->chunkCount * shardIdx / shardCount : 0;
+        int64_t shardEnd = shardCount > 0 ? bamChunker->chunkCount * (shardIdx + 1) / shardCount :
+                           bamChunker->chunkCount;
+        // journal the inputs of the chunks, dropping the journaled chunks whose inputs have changed since
+        if (stitchShardCount == 0) {
+            journaledChunkNo += outputChunkers_journalChunkInputs(outputChunkers, bamChunker, referenceFastaFile,
+                                                                  shardStart, shardEnd, fingerprint, NULL);
+        }
+        if (journaledChunkNo > 0 || shardCount > 0) {
+            if (shardCount > 0) {
+                st_logCritical("> Processing shard %"PRId64" of %"PRId64", chunks %"PRId64" to %"PRId64"\n",
+                               shardIdx, shardCount, shardStart, shardEnd - 1);
+            }
+            stList *unjournaledChunkOrder = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
+            for (int64_t i = 0; i < stList_length(chunkOrder); i++) {
+                stIntTuple *chunkIdx = stList_get(chunkOrder, i);
+                if (outputChunkers_isChunkJournaled(outputChunkers, stIntTuple_get(chunkIdx, 0))) {
+                    stList_append(journaledChunks, chunkIdx);
+                } else if (stIntTuple_get(chunkIdx, 0) < shardStart || stIntTuple_get(chunkIdx, 0) >= shardEnd) {
+                    stIntTuple_destruct(chunkIdx);
+                } else {
+                    stList_append(unjournaledChunkOrder, chunkIdx);
+                }
+            }
+            stList_setDestructor(chunkOrder, NULL);
+            stList_destruct(chunkOrder);
+            chunkOrder = unjournaledChunkOrder;
+        }
+    }
+
+    // each thread takes chunks from the scheduler until there are none left
+    bool predictChunkCost = !params->polishParams->stitchOnline && params->polishParams->shuffleChunks &&
+            params->polishParams->shuffleChunksMethod == SCM_COST_DESC;
+    ChunkScheduler *chunkScheduler = chunkScheduler_construct(bamChunker, chunkOrder, numThreads, predictChunkCost);
+    if (params->polishParams->maxMemory > 0) {
+        chunkScheduler_setMemoryBudget(chunkScheduler, bamChunker, chunkOrder, params->polishParams->maxMemory,
+                                       params->polishParams->chunkMemoryPerReadBase);
+    }
+
+    // read chunks ahead of the threads processing them
+    PhaseChunkLoader chunkLoader = {bamChunker, chunkOrder, referenceFastaFile, vcfEntries, params};
+    ChunkPrefetcher *chunkPrefetcher = chunkPrefetcher_construct(stList_length(chunkOrder),
+                                                                 params->polishParams->chunkPrefetchThreads,
+                                                                 numThreads, phaseChunkInput_load, &chunkLoader);
+
+    // the supports of the reads in the chunk overlaps, kept for as many chunks as may be in flight at once
+    OverlapSupportCache *overlapSupportCache = params->polishParams->reuseOverlapAlleleSupports ?
+            overlapSupportCache_construct(2 * numThreads) : NULL;
+
+    // for writing haplotyped chunks
+    stList *allReadIdsHap1 = stList_construct3(0, free);
+    stList *allReadIdsHap2 = stList_construct3(0, free);
+
+    // for writing vcf
+    bool *chunkWasSwitched = st_calloc(bamChunker->chunkCount, sizeof(bool));
+    char *outputVcfFile = stString_print("%s.phased.vcf%s", outputBase,
+                                         params->phaseParams->compressPhasedVcf ? ".gz" : "");
+    char *outputPhaseSetFile = stString_print("%s.phaseset.bed", outputBase);
+
+    // (may) stitch the chunks and write the phased vcf as the chunks are completed
+    PhasedVcfWriter *phasedVcfWriter = NULL;
+    if (params->polishParams->stitchOnline) {
+        outputChunkers_startOnlineStitching(outputChunkers, TRUE, bamChunker->chunkCount, allReadIdsHap1,
+                                            allReadIdsHap2, chunkWasSwitched);
+        if (shouldOutputPhasedVcf) {
+            st_logCritical("> Writing phased VCF to %s, phaseset info to %s, as chunks are stitched\n",
+                           outputVcfFile, outputPhaseSetFile);
+            phasedVcfWriter = phasedVcfWriter_construct(vcfFile, regionStr, outputVcfFile, outputPhaseSetFile,
+                                                        vcfEntries, bamChunker, params);
+            if (phasedVcfWriter != NULL) {
+                outputChunkers_setOnlineStitchingCallback(outputChunkers, phasedVcfWriter_chunkStitched,
+                                                          phasedVcfWriter);
+            }
+        }
+    }
+
+    // the journaled chunks are output as if they had just been processed, after restoring their vcf entries'
+    // phasing, which the phased vcf writer may use as they are stitched, unless just journaling a shard
+    if (useChunkJournal && shardCount == 0) {
+        for (int64_t i = 0; i < stList_length(journaledChunks); i++) {
+            int64_t chunkIdx = stIntTuple_get(stList_get(journaledChunks, i), 0);
+            size_t chunkPhasingLength;
+            char *chunkPhasing = outputChunkers_getJournaledChunkData(outputChunkers, chunkIdx, &chunkPhasingLength);
+            if (chunkPhasing != NULL) {
+                setChunkPhasingOfVcfEntries(bamChunker_getChunk(bamChunker, chunkIdx), vcfEntries, chunkPhasing);
+                free(chunkPhasing);
+            }
         }
+        outputChunkers_replayChunkJournal(outputChunkers);
+    }
+
+    // (may) record the stages of each chunk
+    char *chunkTelemetryFile = NULL;
+    FILE *chunkTelemetryFh = NULL;
+    if (writeChunkTelemetry) {
+        chunkTelemetryFile = stString_print("%s.chunkTelemetry.jsonl", outputBase);
+        st_logCritical("> Writing chunk telemetry to %s\n", chunkTelemetryFile);
+        chunkTelemetryFh = safe_fopen(chunkTelemetryFile, "w");
+        chunkTelemetry_startRun();
+    }
+
+    // (may) record a timeline of the threads' work
+    if (writeChromeTrace) {
+        char *traceFile = stString_print("%s.trace.json", outputBase);
+        traceRecorder_start(traceFile);
+        free(traceFile);
     }
 
     // multiproccess the chunks, save to results
     st_logCritical("> Setup complete, beginning run\n");
-    int64_t lastReportedPercentage = 0;
-    time_t polishStartTime = time(NULL);
+    chunkScheduler_startProgress(chunkScheduler, "Phasing", params->polishParams->progressInterval);
+
+    // (may) log the lines of the chunk loop through per-thread buffers, written out by a single flusher thread
+    if (params->polishParams->bufferedLogging) {
+        logBuffer_start(stderr);
+    }
+
+    // (may) place the threads on the NUMA nodes, each thread using the params of its node in the loop
+    NumaPlacement *numaPlacement = useNuma ? numaPlacement_construct(params, numThreads) : NULL;
+    Params *sharedParams = params;
 
     # ifdef _OPENMP
-    #pragma omp parallel for schedule(dynamic,1)
+    #pragma omp parallel
     # endif
-    for (int64_t i = 0; i < bamChunker->chunkCount; i++) {
+    for (int64_t i = 0; chunkScheduler_next(chunkScheduler, &i);) {
+        Params *params = numaPlacement == NULL ? sharedParams : numaPlacement_getThreadParams(numaPlacement);
         int64_t chunkIdx = stIntTuple_get(stList_get(chunkOrder, i), 0);
         // Time all chunks
         time_t chunkStartTime = time(NULL);
 
         // Get chunk
         BamChunk *bamChunk = bamChunker_getChunk(bamChunker, chunkIdx);
+        traceRecorder_beginChunk(chunkIdx);
+        if (params->polishParams->useChunkArena) {
+            chunkArena_open();
+        }
 
-        // logging
+        // logging, the progress is reported by the scheduler as chunks are finished
         char *logIdentifier;
-        bool logProgress = FALSE;
-        int64_t currentPercentage = (int64_t) (100 * i / bamChunker->chunkCount);
         # ifdef _OPENMP
         int64_t threadIdx = omp_get_thread_num();
         logIdentifier = stString_print(" T%02d_C%05"PRId64, threadIdx, chunkIdx);
-        if (threadIdx == 0) {
-            if (currentPercentage != lastReportedPercentage) {
-                logProgress = TRUE;
-                lastReportedPercentage = currentPercentage;
-            }
-        }
         # else
         int64_t threadIdx = 0;
         logIdentifier = stString_copy("");
-        if (currentPercentage != lastReportedPercentage) {
-            logProgress = TRUE;
-            lastReportedPercentage = currentPercentage;
-        }
         # endif
 
-        // prints percentage complete and estimated time remaining
-        if (logProgress) {
-            // log progress
-            int64_t timeTaken = (int64_t) (time(NULL) - polishStartTime);
-            int64_t secondsRemaining = (int64_t) floor(1.0 * timeTaken / currentPercentage * (100 - currentPercentage));
-            char *timeDescriptor = (secondsRemaining == 0 && currentPercentage <= 50 ?
-                                    stString_print("unknown") : getTimeDescriptorFromSeconds(secondsRemaining));
-            st_logCritical("> Polishing %2"PRId64"%% complete (%"PRId64"/%"PRId64").  Estimated time remaining: %s\n",
-                           currentPercentage, i, bamChunker->chunkCount, timeDescriptor);
-            free(timeDescriptor);
-        }
+        logBuffer_info(">%s Going to process a chunk for reference sequence: %s, starting at: %i and ending at: %i\n",
+                       logIdentifier, bamChunk->refSeqName, (int) bamChunk->chunkOverlapStart, bamChunk->chunkOverlapEnd);
 
-        // Get reference string for chunk of alignment
-        char *chunkReference = getSequenceFromReference(referenceFastaFile, bamChunk->refSeqName,
-                bamChunk->chunkOverlapStart, bamChunk->chunkOverlapEnd);
-        st_logInfo(">%s Going to process a chunk for reference sequence: %s, starting at: %i and ending at: %i\n",
-                   logIdentifier, bamChunk->refSeqName, (int) bamChunk->chunkOverlapStart, bamChunk->chunkOverlapEnd);
-
-        // get VCF string
-        stList *chunkVcfEntries = getVcfEntriesForRegion(vcfEntries, NULL, bamChunk->refSeqName,
-                                                 bamChunk->chunkOverlapStart,  bamChunk->chunkOverlapEnd, params);
-        updateVcfEntriesWithSubstringsAndPositions(chunkVcfEntries, chunkReference, strlen(chunkReference),
-                FALSE, params);
-
-        // Convert bam lines into corresponding reads and alignments
-        st_logInfo(" %s Parsing input reads from file: %s\n", logIdentifier, bamInFile);
-        stList *reads = stList_construct3(0, (void (*)(void *)) bamChunkRead_destruct);
-        stList *filteredReads = stList_construct3(0, (void (*)(void *)) bamChunkRead_destruct);
-        extractReadSubstringsAtVariantPositions(bamChunk, chunkVcfEntries, reads, filteredReads, params->polishParams);
-
-        // do downsampling if appropriate
-        if (params->polishParams->maxDepth > 0) {
-            // get downsampling structures
-            stList *maintainedReads = stList_construct3(0, (void (*)(void *)) bamChunkRead_destruct);
-
-            bool didDownsample = downsampleBamChunkReadWithVcfEntrySubstringsViaFullReadLengthLikelihood(
-                    params->polishParams->maxDepth, chunkVcfEntries, reads, maintainedReads, filteredReads);
-
-            // we need to destroy the discarded reads and structures
-            if (didDownsample) {
-                st_logInfo(" %s Downsampled from %"PRId64" to %"PRId64" reads\n", logIdentifier,
-                           stList_length(reads), stList_length(maintainedReads));
-                // still has all the old reads, need to not free these
-                stList_setDestructor(reads, NULL);
-                stList_destruct(reads);
-                // and keep the filtered reads
-                reads = maintainedReads;
-            }
-                // no downsampling, we just need to free the (empty) objects
-            else {
-                assert(stList_length(maintainedReads) == 0);
-                stList_destruct(maintainedReads);
-            }
+        // Get the reference, VCF entries and read substrings of the chunk, which may have been prefetched
+        if (chunkTelemetryFh != NULL) {
+            chunkTelemetry_start(bamChunk);
         }
-
-        time_t primaryPhasingStart = time(NULL);
-
-        // iteratively find bubbles
-        int64_t bubbleFindingIteration = 0;
-        BubbleGraph *bg = NULL;
-        stHash *readsToPSeqs = NULL;
-        stSet *readsBelongingToHap1 = NULL, *readsBelongingToHap2 = NULL;
-        stGenomeFragment *gf = NULL;
-        stReference *ref = NULL;
-        stList *vcfEntriesToBubbles = NULL;
-
-        // Get the bubble graph representation
-        bg =  bubbleGraph_constructFromVCFAndBamChunkReadVcfEntrySubstrings(reads, chunkVcfEntries, params,
-                &vcfEntriesToBubbles);
-
-        // Now make a POA for each of the haplotypes
-        ref = bubbleGraph_getReference(bg, bamChunk->refSeqName, params);
-        gf = bubbleGraph_phaseBubbleGraph(bg, ref, reads, params, &readsToPSeqs);
-
-        stGenomeFragment_phaseBamChunkReads(gf, readsToPSeqs, reads, &readsBelongingToHap1, &readsBelongingToHap2,
-                                            params->phaseParams);
-        st_logInfo(" %s After phasing, of %i reads got %i reads partitioned into hap1 and %i reads partitioned "
-                   "into hap2 (%i unphased)\n", logIdentifier, (int) stList_length(reads),
-                   (int) stSet_size(readsBelongingToHap1), (int) stSet_size(readsBelongingToHap2),
-                   (int) (stList_length(reads) - stSet_size(readsBelongingToHap1) -
-                          stSet_size(readsBelongingToHap2)));
-
-
-        st_logInfo(" %s Phased primary reads in %d sec\n", logIdentifier, time(NULL) - primaryPhasingStart);
-
-        // should included filtered reads in output
-        // get reads
-        for (int64_t bcrIdx = 0; bcrIdx < stList_length(reads); bcrIdx++) {
-            BamChunkRead *bcr = stList_get(reads, bcrIdx);
-            if (!stSet_search(readsBelongingToHap1, bcr) && !stSet_search(readsBelongingToHap2, bcr)) {
-                // was filtered in some form
-                stList_append(filteredReads, bamChunkRead_constructCopy(bcr));
-            }
+        logBuffer_info(" %s Parsing input reads from file: %s\n", logIdentifier, bamInFile);
+        chunkTelemetry_startStage(CTS_READ);
+        traceRecorder_begin("chunkPrefetcher_getChunk");
+        PhaseChunkInput *chunkInput = chunkPrefetcher_getChunk(chunkPrefetcher, i);
+        traceRecorder_end("chunkPrefetcher_getChunk");
+        chunkTelemetry_endStage(CTS_READ);
+
+        // phase, downsampling to a lower depth if the chunk would not fit in the memory budget
+        uint64_t chunkMaxDepth = params->polishParams->maxDepth;
+        uint64_t memoryDepthLimit = chunkScheduler_getMemoryDepthLimit(chunkScheduler, i);
+        if (memoryDepthLimit > 0 && (chunkMaxDepth == 0 || memoryDepthLimit < chunkMaxDepth)) {
+            chunkMaxDepth = memoryDepthLimit;
         }
-        st_logInfo(" %s Assigning %"PRId64" filtered reads to haplotypes\n", logIdentifier, stList_length(filteredReads));
-
-        time_t filteredPhasingStart = time(NULL);
-
-        bubbleGraph_partitionFilteredReadsFromVcfEntries(filteredReads, gf, bg, vcfEntriesToBubbles, readsBelongingToHap1,
-                readsBelongingToHap2, params, logIdentifier);
-        st_logInfo(" %s Partitioned filtered reads in %d sec.\n", logIdentifier, time(NULL) - filteredPhasingStart);
-
-
-        // Output
-        outputChunkers_processChunkSequencePhased(outputChunkers, threadIdx, chunkIdx, bamChunk->refSeqName,
-                                                  NULL, NULL, reads, readsBelongingToHap1, readsBelongingToHap2, gf,
-                                                  params);
-
-        // save
-        // only use primary reads (not filteredReads) to track read phasing
-        updateOriginalVcfEntriesWithBubbleData(bamChunk, reads, bamChunker->readEnumerator, gf, bg,
-                vcfEntriesToBubbles, readsBelongingToHap1, readsBelongingToHap2, logIdentifier);
-
-        // Cleanup
-        if (chunkVcfEntries != NULL) stList_destruct(chunkVcfEntries);
-        stSet_destruct(readsBelongingToHap1);
-        stSet_destruct(readsBelongingToHap2);
-        bubbleGraph_destruct(bg);
-        stGenomeFragment_destruct(gf);
-        stReference_destruct(ref);
-        stHash_destruct(readsToPSeqs);
-        stList_destruct(vcfEntriesToBubbles);
-        free(chunkReference);
+        int64_t readNo = phaseChunk(bamChunker, chunkIdx, chunkInput, chunkMaxDepth, overlapSupportCache,
+                                    useChunkJournal ? vcfEntries : NULL, outputChunkers, threadIdx, params,
+                                    logIdentifier);
 
         // report timing
         if (st_getLogLevel() >= info) {
-            st_logInfo(">%s Chunk with ~%"PRId64" reads processed in %d sec\n",
-                       logIdentifier, stList_length(reads) + stList_length(filteredReads), (int) (time(NULL) - chunkStartTime));
+            logBuffer_info(">%s Chunk with ~%"PRId64" reads processed in %d sec\n",
+                           logIdentifier, readNo, (int) (time(NULL) - chunkStartTime));
+            logBuffer_infoFields("chunk", "chunk=%"PRId64" contig=%s start=%"PRId64" end=%"PRId64" reads=%"PRId64
+                                 " seconds=%d\n", chunkIdx, bamChunk->refSeqName, bamChunk->chunkStart,
+                                 bamChunk->chunkEnd, readNo, (int) (time(NULL) - chunkStartTime));
+            if (params->polishParams->useChunkArena) {
+                ChunkArenaStats chunkArenaStats;
+                chunkArena_getStats(&chunkArenaStats);
+                logBuffer_info(" %s Chunk arena held %"PRId64" objects in %"PRId64"K over %"PRId64" blocks, %"PRId64
+                               " too large for it\n", logIdentifier, chunkArenaStats.allocations,
+                               chunkArenaStats.bytes >> 10, chunkArenaStats.blocks, chunkArenaStats.heapAllocations);
+            }
         }
 
         // final post-completion logging cleanup
-        stList_destruct(reads);
-        stList_destruct(filteredReads);
         free(logIdentifier);
+        if (chunkTelemetryFh != NULL) {
+            chunkTelemetry_finish(chunkTelemetryFh);
+        }
+        if (params->polishParams->useChunkArena) {
+            chunkArena_close();
+        }
+        // the dp matrix buffers cached by the chunk are freed, rather than held by the thread for the rest of the run
+        dpArena_clear();
+        traceRecorder_end("chunk");
+        chunkScheduler_finish(chunkScheduler, i);
+    }
+    logBuffer_finish();
+    if (chunkTelemetryFh != NULL) {
+        chunkTelemetry_finishRun(chunkTelemetryFh);
+        fclose(chunkTelemetryFh);
+        free(chunkTelemetryFile);
+    }
+    hugePages_logSummary();
+    chunkScheduler_destruct(chunkScheduler);
+    if (numaPlacement != NULL) numaPlacement_destruct(numaPlacement);
+    chunkPrefetcher_destruct(chunkPrefetcher);
+    if (overlapSupportCache != NULL) {
+        overlapSupportCache_destruct(overlapSupportCache);
     }
 
-    // for writing haplotyped chunks
-    stList *allReadIdsHap1 = stList_construct3(0, free);
-    stList *allReadIdsHap2 = stList_construct3(0, free);
-
-    // for writing vcf
-    bool *chunkWasSwitched = st_calloc(bamChunker->chunkCount, sizeof(bool));
-
-    // merge chunks
-    time_t mergeStartTime = time(NULL);
-    st_logCritical("> Starting merge\n");
-    outputChunkers_stitchAndTrackExtraData(outputChunkers, TRUE, bamChunker->chunkCount, allReadIdsHap1, allReadIdsHap2,
-            chunkWasSwitched);
-    time_t mergeEndTime = time(NULL);
-    char *tds = getTimeDescriptorFromSeconds((int) mergeEndTime - mergeStartTime);
-    st_logCritical("> Merging took %s\n", tds);
-    outputChunkers_destruct(outputChunkers);
-    free(tds);
-    tds = getTimeDescriptorFromSeconds((int) time(NULL) - mergeEndTime);
-    st_logCritical("> Merge cleanup took %s\n", tds);
-    free(tds);
+    // a shard's chunks are only journaled, and are stitched with the other shards' by margin stitch
+    if (shardCount > 0) {
+        outputChunkers_discardOutput(outputChunkers);
+        outputChunkers_destruct(outputChunkers);
+        st_logCritical("> Journaled shard %"PRId64" of %"PRId64" to %s, stitch all %"PRId64" shards with "
+                       "'margin stitch'\n", shardIdx, shardCount, chunkJournalFile, shardCount);
+    } else {
+        // merge chunks
+        time_t mergeStartTime = time(NULL);
+        st_logCritical("> Starting merge\n");
+        if (params->polishParams->stitchOnline) {
+            outputChunkers_finishOnlineStitching(outputChunkers);
+        } else {
+            outputChunkers_stitchAndTrackExtraData(outputChunkers, TRUE, bamChunker->chunkCount, allReadIdsHap1,
+                                                   allReadIdsHap2, chunkWasSwitched);
+        }
+        time_t mergeEndTime = time(NULL);
+        char *tds = getTimeDescriptorFromSeconds((int) mergeEndTime - mergeStartTime);
+        st_logCritical("> Merging took %s\n", tds);
+        outputChunkers_destruct(outputChunkers);
+        free(tds);
+        tds = getTimeDescriptorFromSeconds((int) time(NULL) - mergeEndTime);
+        st_logCritical("> Merge cleanup took %s\n", tds);
+        free(tds);
+    }
 
     // maybe write final haplotyped bams
-    if (shouldOutputHaplotaggedBam) {
+    if (shouldOutputHaplotaggedBam && shardCount == 0) {
         // logging
         time_t hapBamStart = time(NULL);
         st_logInfo("> Writing final haplotyped BAMs\n");
@@ -494,16 +720,18 @@ int phase_main(int argc, char *argv[]) {
     }
 
     // maybe write VCF
-    if (shouldOutputPhasedVcf) {
+    if (shouldOutputPhasedVcf && shardCount == 0) {
         // loggit
         time_t vcfWriteStart = time(NULL);
-        char *outputVcfFile = stString_print("%s.phased.vcf", outputBase);
-        char *outputPhaseSetFile = stString_print("%s.phaseset.bed", outputBase);
-        st_logCritical("> Writing phased VCF to %s, phaseset info to %s\n", outputVcfFile, outputPhaseSetFile);
 
-        // write it
-        updateHaplotypeSwitchingInVcfEntries(bamChunker, chunkWasSwitched, vcfEntries);
-        writePhasedVcf(vcfFile, regionStr, outputVcfFile, outputPhaseSetFile, vcfEntries, params);
+        // write it, or the records that were waiting on the last chunks
+        if (phasedVcfWriter != NULL) {
+            phasedVcfWriter_destruct(phasedVcfWriter);
+        } else if (!params->polishParams->stitchOnline) {
+            st_logCritical("> Writing phased VCF to %s, phaseset info to %s\n", outputVcfFile, outputPhaseSetFile);
+            updateHaplotypeSwitchingInVcfEntries(bamChunker, chunkWasSwitched, vcfEntries);
+            writePhasedVcf(vcfFile, regionStr, outputVcfFile, outputPhaseSetFile, vcfEntries, params);
+        }
 
         // loggit
         char *phasedVcfTDS = getTimeDescriptorFromSeconds(time(NULL) - vcfWriteStart);
@@ -511,16 +739,33 @@ int phase_main(int argc, char *argv[]) {
 
         // cleanup
         free(phasedVcfTDS);
-        free(outputVcfFile);
-        free(outputPhaseSetFile);
     }
 
+    // the run is complete, so the journals are no longer needed, unless this is a shard yet to be stitched
+    if (chunkJournalFile != NULL) {
+        if (shardCount == 0) {
+            st_logInfo("> Removing chunk journal %s\n", chunkJournalFile);
+            remove(chunkJournalFile);
+        }
+        free(chunkJournalFile);
+    }
+    for (int64_t i = 0; i < stList_length(shardJournalFiles); i++) {
+        st_logInfo("> Removing shard chunk journal %s\n", (char *) stList_get(shardJournalFiles, i));
+        remove(stList_get(shardJournalFiles, i));
+    }
+    stList_destruct(shardJournalFiles);
+
     // cleanup
     free(chunkWasSwitched);
+    free(outputVcfFile);
+    free(outputPhaseSetFile);
     bamChunker_destruct(bamChunker);
+    referenceCache_destruct();
+    htsThreadPool_destruct();
     params_destruct(params);
     if (regionStr != NULL) free(regionStr);
     stList_destruct(chunkOrder);
+    stList_destruct(journaledChunks);
     free(vcfFile);
     stHash_destruct(vcfEntries);
     if (allReadIdsHap1 != NULL) stList_destruct(allReadIdsHap1);
@@ -529,6 +774,7 @@ int phase_main(int argc, char *argv[]) {
     free(bamInFile);
     free(referenceFastaFile);
     free(paramsFile);
+    traceRecorder_finish();
 
     // log completion
     char *timeDescriptor = getTimeDescriptorFromSeconds(time(NULL) - startTime);
@@ -18,6 +18,67 @@
 #include "helenFeatures.h"
 
 
+/*
+ * Loads the reference and reads of a chunk ahead of its processing by a ChunkPrefetcher, either by querying the bam
+ * index or, if the bam is streamed, from the single pass over it.
+ */
+typedef struct _polishChunkLoader {
+    BamChunker *bamChunker;
+    stList *chunkOrder;
+    char *referenceFastaFile;
+    Params *params;
+    bool withFilteredReads;
+    BamChunkStream *bamChunkStream;
+    BamChunkGroups *bamChunkGroups; // the groups of small chunks, loaded at once
+    ChunkScheduler *chunkScheduler;
+    bool diploid;
+    bool downsampleBeforeDecoding; // the reads discarded by downsampling are not needed, so need not be decoded
+} PolishChunkLoader;
+
+static uint64_t polish_getChunkMaxDepth(Params *params, ChunkScheduler *chunkScheduler, int64_t i) {
+    // the downsampling depth, lower if the chunk would not fit in the memory budget
+    uint64_t chunkMaxDepth = params->polishParams->maxDepth;
+    uint64_t memoryDepthLimit = chunkScheduler_getMemoryDepthLimit(chunkScheduler, i);
+    if (memoryDepthLimit > 0 && (chunkMaxDepth == 0 || memoryDepthLimit < chunkMaxDepth)) {
+        chunkMaxDepth = memoryDepthLimit;
+    }
+    return chunkMaxDepth;
+}
+
+static void *polishChunkInput_load(int64_t i, void *extraArg) {
+    PolishChunkLoader *loader = extraArg;
+    if (loader->bamChunkStream != NULL) {
+        return bamChunkStream_getChunk(loader->bamChunkStream, i);
+    }
+    if (loader->bamChunkGroups != NULL) {
+        BamChunkReads *input = bamChunkGroups_getChunk(loader->bamChunkGroups, i);
+        if (input != NULL) {
+            return input;
+        }
+    }
+    BamChunk *bamChunk = bamChunker_getChunk(loader->bamChunker,
+                                             stIntTuple_get(stList_get(loader->chunkOrder, i), 0));
+    BamChunkReads *input = bamChunkReads_construct(
+            bamChunk_getReferenceSubstring(bamChunk, loader->referenceFastaFile, loader->params));
+
+    // Convert bam lines into corresponding reads and alignments
+    uint64_t chunkMaxDepth = polish_getChunkMaxDepth(loader->params, loader->chunkScheduler, i);
+    if (loader->downsampleBeforeDecoding && chunkMaxDepth > 0) {
+        convertToReadsAndAlignmentsWithDownsampling2(bamChunk, input->rleReferenceCoordinateMap, chunkMaxDepth,
+                                                     loader->diploid, input->reads, input->alignments,
+                                                     loader->withFilteredReads ? input->filteredReads : NULL,
+                                                     loader->withFilteredReads ? input->filteredAlignments : NULL,
+                                                     &input->downsampled, loader->params->polishParams);
+    } else {
+        convertToReadsAndAlignmentsWithFiltered2(bamChunk, input->rleReferenceCoordinateMap, input->reads,
+                                                 input->alignments,
+                                                 loader->withFilteredReads ? input->filteredReads : NULL,
+                                                 loader->withFilteredReads ? input->filteredAlignments : NULL,
+                                                 loader->params->polishParams);
+    }
+    return input;
+}
+
 /*
  * Main functions
  */
@@ -29,6 +90,9 @@ void polish_usage() {
 
     fprintf(stderr, "\nRequired arguments:\n");
     fprintf(stderr, "    BAM_FILE is the alignment of reads to the assembly (or reference).\n");
+    fprintf(stderr, "      A coordinate sorted BAM_FILE of '-' is read from stdin, in a single pass.\n");
+    fprintf(stderr, "      Of a comma separated list of BAM_FILEs, aligned to the same reference, the reads of all\n");
+    fprintf(stderr, "      are polished together, with the chunks planned from the first.\n");
     fprintf(stderr, "    ASSEMBLY_FASTA is the reference sequence BAM file in fasta format.\n");
     fprintf(stderr, "    PARAMS is the file with marginPolish parameters.\n");
 
@@ -41,8 +105,46 @@ void polish_usage() {
     fprintf(stderr, "    -o --outputBase          : Name to use for output files [default = 'output']\n");
     fprintf(stderr, "    -r --region              : If set, will only compute for given chromosomal region\n");
     fprintf(stderr, "                                 Format: chr:start_pos-end_pos (chr3:2000-3000)\n");
+    fprintf(stderr, "    -b --bed                 : If set, will only polish the intervals of this BED file, flanked by the\n");
+    fprintf(stderr, "                                 chunk boundary, writing the whole assembly with the polished intervals\n");
+    fprintf(stderr, "                                 spliced into the rest of it unmodified\n");
     fprintf(stderr, "    -p --depth               : Will override the downsampling depth set in PARAMS\n");
+    fprintf(stderr, "    -m --maxMemory           : Only start a chunk while the predicted memory of the chunks in flight\n");
+    fprintf(stderr, "                                 fits in this many bytes (suffixes K, M, G, T), downsampling chunks\n");
+    fprintf(stderr, "                                 that would not fit on their own. Overrides maxMemory in PARAMS\n");
+    fprintf(stderr, "    -e --seed                : Seed of the per read hashes choosing the reads kept by downsampling,\n");
+    fprintf(stderr, "                                 which are the same at any thread count. Overrides downsamplingSeed\n");
+    fprintf(stderr, "                                 in PARAMS\n");
     fprintf(stderr, "    -k --tempFilesToDisk     : Write temporary files to disk (for --diploid or supplementary output)\n");
+    fprintf(stderr, "    -J --chunkJournal        : Journal finished chunks to OUTPUT_BASE.chunkJournal, so that if the run\n");
+    fprintf(stderr, "                                 is interrupted, rerunning it skips the journaled chunks\n");
+    fprintf(stderr, "    -I --incremental         : Reuse the chunks of this chunk journal of a previous run (with the same\n");
+    fprintf(stderr, "                                 PARAMS and options) whose reference substring and alignments are\n");
+    fprintf(stderr, "                                 unchanged, only recomputing the rest. Implies --chunkJournal\n");
+    fprintf(stderr, "    -K --chunkCache          : Reuse the chunks in this directory, shared by any number of runs, whose\n");
+    fprintf(stderr, "                                 PARAMS, options, reference substring and alignments are unchanged,\n");
+    fprintf(stderr, "                                 adding the chunks computed to it. Implies --chunkJournal\n");
+    fprintf(stderr, "    -x --shard               : Only process shard i of N (format: i/N, 0 <= i < N), a contiguous part of\n");
+    fprintf(stderr, "                                 the chunks, journaling them to OUTPUT_BASE.shard<i>of<N>.chunkJournal.\n");
+    fprintf(stderr, "                                 Run all N shards, then 'margin stitch' to write the output\n");
+    fprintf(stderr, "    -E --chunkTelemetry      : Write the wall and CPU time of each stage of each chunk, with counts of\n");
+    fprintf(stderr, "                                 its work (reads, bubbles, HMM and alignment cells, bam bytes...),\n");
+    fprintf(stderr, "                                 to OUTPUT_BASE.chunkTelemetry.jsonl, ending with the run's totals\n");
+    fprintf(stderr, "    -H --hardwareCounters    : Also count the cycles, instructions, last level cache, branch and data\n");
+    fprintf(stderr, "                                 TLB misses of each stage in the chunk telemetry, with the hardware\n");
+    fprintf(stderr, "                                 counters of linux's perf_event_open. Implies --chunkTelemetry\n");
+    fprintf(stderr, "       --chromeTrace         : Write a timeline of the work of each thread, as Chrome trace JSON for\n");
+    fprintf(stderr, "                                 chrome://tracing or Perfetto, to OUTPUT_BASE.trace.json\n");
+    fprintf(stderr, "    -B --replayBundleSeconds : Write the inputs of each chunk taking at least this many seconds to a\n");
+    fprintf(stderr, "                                 replay bundle, OUTPUT_BASE.chunk<i>.replay, to be rerun on its own\n");
+    fprintf(stderr, "                                 (such as under a profiler) by 'margin replay'\n");
+    fprintf(stderr, "    -W --replayBundleCells   : Write a replay bundle of each chunk computing at least this many\n");
+    fprintf(stderr, "                                 pairwise alignment and phasing HMM cells\n");
+# ifdef _OPENMP
+    fprintf(stderr, "    -N --numa                : Place the threads on the NUMA nodes of the host, in contiguous blocks\n");
+    fprintf(stderr, "                                 pinned to the cpus of each node, each node with its own copy of the\n");
+    fprintf(stderr, "                                 model tables of PARAMS\n");
+#endif
 
 
     fprintf(stderr, "\nDiploid options:\n");
@@ -80,6 +182,9 @@ void polish_usage() {
     fprintf(stderr, "    -s --outputPhasingState  : Write out phasing likelihoods as JSON file (--diploid only)\n");
     fprintf(stderr, "    -M --skipHaplotypeBAM    : Do not write out phased BAMs (--diploid only, default is to write)\n");
     fprintf(stderr, "    -T --skipOutputFasta     : Do not write out phased fasta (--diploid only, default is to write)\n");
+    fprintf(stderr, "    -V --outputPhasedVcf     : Write out the phased het variants of the reference to\n");
+    fprintf(stderr, "                               OUTPUT_BASE.phased.vcf, from the same phasing of the reads as\n");
+    fprintf(stderr, "                               the phased fasta and BAMs (--diploid only)\n");
     fprintf(stderr, "\n");
 }
 
@@ -93,12 +198,26 @@ int polish_main(int argc, char *argv[]) {
     char *referenceFastaFile = NULL;
     char *outputBase = stString_copy("output");
     char *regionStr = NULL;
+    char *bedFile = NULL;
     char *vcfFile = NULL;
     int numThreads = 1;
     int64_t maxDepth = -1;
+    uint64_t maxMemory = 0;
+    int64_t downsamplingSeed = -1;
     bool diploid = FALSE;
     bool inMemory = TRUE;
     bool skipRealignment = FALSE;
+    bool useChunkJournal = FALSE;
+    char *previousChunkJournalFile = NULL;
+    char *chunkCacheDirectory = NULL;
+    int64_t shardIdx = -1;
+    int64_t shardCount = 0;
+    int64_t stitchShardCount = 0;
+    bool writeChunkTelemetry = FALSE;
+    bool writeChromeTrace = FALSE;
+    double replayBundleSeconds = 0.0;
+    int64_t replayBundleCells = 0;
+    bool useNuma = FALSE;
 
     // for feature generation
     HelenFeatureType helenFeatureType = HFEAT_NONE;
@@ -120,6 +239,7 @@ int polish_main(int argc, char *argv[]) {
     bool outputPhasingState = FALSE;
     bool partitionTruthSequences = FALSE;
     bool onlyUseVCFAlleles = FALSE;
+    bool outputPhasedVcf = FALSE;
 
     if (argc < 4) {
         free(outputBase);
@@ -128,7 +248,9 @@ int polish_main(int argc, char *argv[]) {
         return 0;
     }
 
-    bamInFile = stString_copy(argv[1]);
+    // further bam files, given as a comma separated list, have their reads merged with those of the first
+    stList *secondaryBamInFiles = stString_splitByString(argv[1], ",");
+    bamInFile = stList_removeFirst(secondaryBamInFiles);
     referenceFastaFile = stString_copy(argv[2]);
     paramsFile = stString_copy(argv[3]);
 
@@ -142,7 +264,10 @@ int polish_main(int argc, char *argv[]) {
 #endif
                 { "outputBase", required_argument, 0, 'o'},
                 { "region", required_argument, 0, 'r'},
+                { "bed", required_argument, 0, 'b'},
                 { "depth", required_argument, 0, 'p'},
+                { "maxMemory", required_argument, 0, 'm'},
+                { "seed", required_argument, 0, 'e'},
                 { "diploid", no_argument, 0, '2'},
                 { "vcf", required_argument, 0, 'v'},
                 { "produceFeatures", no_argument, 0, 'f'},
@@ -157,15 +282,29 @@ int polish_main(int argc, char *argv[]) {
                 { "skipHaplotypeBAM", no_argument, 0, 'M'},
                 { "outputHaplotypeReads", no_argument, 0, 'n'},
                 { "tempFilesToDisk", no_argument, 0, 'k'},
+                { "chunkJournal", no_argument, 0, 'J'},
+                { "incremental", required_argument, 0, 'I'},
+                { "chunkCache", required_argument, 0, 'K'},
+                { "shard", required_argument, 0, 'x'},
+                { "stitchShards", required_argument, 0, 'y'},
+                { "chunkTelemetry", no_argument, 0, 'E'},
+                { "hardwareCounters", no_argument, 0, 'H'},
+                { "chromeTrace", no_argument, 0, OPTION_CHROME_TRACE},
+                { "replayBundleSeconds", required_argument, 0, 'B'},
+                { "replayBundleCells", required_argument, 0, 'W'},
+# ifdef _OPENMP
+                { "numa", no_argument, 0, 'N'},
+#endif
                 { "skipFilteredReads", no_argument, 0, 'S'},
                 { "outputPhasingState", no_argument, 0, 't'},
                 { "skipRealignment", no_argument, 0, 'R'},
                 { "skipOutputFasta", no_argument, 0, 'T'},
                 { "onlyVcfAlleles", no_argument, 0, 'A'},
+                { "outputPhasedVcf", no_argument, 0, 'V'},
                 { 0, 0, 0, 0 } };
 
         int option_index = 0;
-        int key = getopt_long(argc-2, &argv[2], "ha:o:v:p:2v:t:r:fF:u:L:cijdMnkSsRTA", long_options, &option_index);
+        int key = getopt_long(argc-2, &argv[2], "ha:o:v:p:m:e:2v:t:r:b:fF:u:L:cijdMnkJI:K:x:y:EHCB:W:NSsRTAV", long_options, &option_index);
 
         if (key == -1) {
             break;
@@ -186,12 +325,24 @@ int polish_main(int argc, char *argv[]) {
         case 'r':
             regionStr = stString_copy(optarg);
             break;
+        case 'b':
+            bedFile = stString_copy(optarg);
+            break;
         case 'p':
             maxDepth = atoi(optarg);
             if (maxDepth < 0) {
                 st_errAbort("Invalid maxDepth: %s", optarg);
             }
             break;
+        case 'm':
+            maxMemory = parseByteSize(optarg);
+            break;
+        case 'e':
+            downsamplingSeed = atoll(optarg);
+            if (downsamplingSeed < 0) {
+                st_errAbort("Invalid seed: %s", optarg);
+            }
+            break;
         case 'F':
             if (stString_eqcase(optarg, "simpleWeight") || stString_eqcase(optarg, "simple")) {
                 helenFeatureType = HFEAT_SIMPLE_WEIGHT;
@@ -235,6 +386,48 @@ int polish_main(int argc, char *argv[]) {
         case 'k':
             inMemory = FALSE;
             break;
+        case 'J':
+            useChunkJournal = TRUE;
+            break;
+        case 'I':
+            previousChunkJournalFile = stString_copy(optarg);
+            useChunkJournal = TRUE;
+            break;
+        case 'K':
+            chunkCacheDirectory = stString_copy(optarg);
+            useChunkJournal = TRUE;
+            break;
+        case 'x':
+            if (sscanf(optarg, "%"SCNd64"/%"SCNd64, &shardIdx, &shardCount) != 2 || shardCount <= 0 ||
+                shardIdx < 0 || shardIdx >= shardCount) {
+                st_errAbort("Invalid shard, expected i/N with 0 <= i < N: %s", optarg);
+            }
+            break;
+        case 'y':
+            stitchShardCount = atoi(optarg);
+            if (stitchShardCount <= 0) {
+                st_errAbort("Invalid shard count: %s", optarg);
+            }
+            break;
+        case 'E':
+            writeChunkTelemetry = TRUE;
+            break;
+        case 'H':
+            writeChunkTelemetry = TRUE;
+            chunkTelemetry_setHardwareCounters(TRUE);
+            break;
+        case OPTION_CHROME_TRACE:
+            writeChromeTrace = TRUE;
+            break;
+        case 'B':
+            replayBundleSeconds = atof(optarg);
+            break;
+        case 'W':
+            replayBundleCells = atoll(optarg);
+            break;
+        case 'N':
+            useNuma = TRUE;
+            break;
         case 'c':
             writeChunkSupplementaryOutput = TRUE;
             break;
@@ -268,11 +461,15 @@ int polish_main(int argc, char *argv[]) {
         case 'A':
             onlyUseVCFAlleles = TRUE;
             break;
+        case 'V':
+            outputPhasedVcf = TRUE;
+            break;
         default:
             polish_usage();
             free(outputBase);
             free(logLevelString);
             free(bamInFile);
+            stList_destruct(secondaryBamInFiles);
             free(referenceFastaFile);
             free(paramsFile);
             if (trueReferenceBam != NULL) free(trueReferenceBam);
@@ -281,7 +478,7 @@ int polish_main(int argc, char *argv[]) {
     }
 
     // sanity check (verify files exist)
-    if (access(bamInFile, R_OK) != 0) {
+    if (!stString_eq(bamInFile, "-") && access(bamInFile, R_OK) != 0) {
         st_errAbort("Could not read from input bam file: %s\n", bamInFile);
         char *idx = stString_print("%s.bai", bamInFile);
         if (access(idx, R_OK) != 0) {
@@ -289,6 +486,11 @@ int polish_main(int argc, char *argv[]) {
         }
         free(idx);
     }
+    for (int64_t i = 0; i < stList_length(secondaryBamInFiles); i++) {
+        if (access(stList_get(secondaryBamInFiles, i), R_OK) != 0) {
+            st_errAbort("Could not read from input bam file: %s\n", (char *) stList_get(secondaryBamInFiles, i));
+        }
+    }
     if (access(referenceFastaFile, R_OK) != 0) {
         st_errAbort("Could not read from reference fastafile: %s\n", referenceFastaFile);
     }
@@ -298,6 +500,9 @@ int polish_main(int argc, char *argv[]) {
     if (vcfFile != NULL && access(paramsFile, R_OK) != 0) {
         st_errAbort("Could not read from vcf file: %s\n", vcfFile);
     }
+    if (bedFile != NULL && access(bedFile, R_OK) != 0) {
+        st_errAbort("Could not read from bed file: %s\n", bedFile);
+    }
     if (trueReferenceBam != NULL) {
         if (access(trueReferenceBam, R_OK) != 0) {
             st_errAbort("Could not read from truth file: %s\n", trueReferenceBam);
@@ -313,6 +518,9 @@ int polish_main(int argc, char *argv[]) {
     if (!outputFasta && (outputPoaCSV || outputRepeatCounts || outputPoaDOT )) {
         st_errAbort("Cannot --outputPoaCSV, --outputRepeatCounts, or --outputPoaDOT if --skipOutputFasta");
     }
+    if (bedFile != NULL && (regionStr != NULL || outputPoaCSV || outputRepeatCounts)) {
+        st_errAbort("Cannot --region, --outputPoaCSV, or --outputRepeatCounts if --bed");
+    }
 
     // Initialization from arguments
     time_t startTime = time(NULL);
@@ -349,6 +557,7 @@ int polish_main(int argc, char *argv[]) {
     // Parse parameters
     st_logCritical("> Parsing model parameters from file: %s\n", paramsFile);
     Params *params = params_readParams(paramsFile);
+    hugePages_setEnabled(params->polishParams->useHugePages);
 
     // update depth (if set)
     if (maxDepth >= 0) {
@@ -357,6 +566,73 @@ int polish_main(int argc, char *argv[]) {
         params->polishParams->maxDepth = (uint64_t) maxDepth;
     }
 
+    // update memory budget (if set)
+    if (maxMemory > 0) {
+        st_logCritical("> Changing maxMemory parameter from %"PRIu64" to %"PRIu64"\n", params->polishParams->maxMemory,
+                       maxMemory);
+        params->polishParams->maxMemory = maxMemory;
+    }
+
+    // update downsampling seed (if set)
+    if (downsamplingSeed >= 0) {
+        st_logCritical("> Changing downsamplingSeed parameter from %"PRIu64" to %"PRId64"\n",
+                       params->polishParams->downsamplingSeed, downsamplingSeed);
+        params->polishParams->downsamplingSeed = (uint64_t) downsamplingSeed;
+    }
+
+    // a piped bam can only be read once, in a single pass
+    if (stString_eq(bamInFile, "-")) {
+        params->polishParams->streamBamInput = TRUE;
+        if (outputHaplotypeBAM) {
+            st_logCritical("> Not writing haplotyped BAMs, as the input BAM is piped\n");
+            outputHaplotypeBAM = FALSE;
+        }
+    }
+    if (stList_length(secondaryBamInFiles) > 0) {
+        if (params->polishParams->streamBamInput) {
+            st_errAbort("Several input bam files can not be streamed, as they are read with their indexes\n");
+        }
+        if (outputHaplotypeBAM) {
+            st_logCritical("> Not writing haplotyped BAMs, as there are several input BAMs\n");
+            outputHaplotypeBAM = FALSE;
+        }
+    }
+
+    // shards journal their chunks, to be stitched from the journals
+    if (shardCount > 0 && stitchShardCount > 0) {
+        st_errAbort("A shard can not be run while stitching shards");
+    }
+    if (shardCount > 0) {
+        // the shard's (temporary) files are named apart from the other shards'
+        char *shardOutputBase = stString_print("%s.shard%"PRId64"of%"PRId64, outputBase, shardIdx, shardCount);
+        free(outputBase);
+        outputBase = shardOutputBase;
+        params->polishParams->stitchOnline = FALSE;
+        useChunkJournal = TRUE;
+    }
+    if (stitchShardCount > 0) {
+        useChunkJournal = TRUE;
+    }
+
+    // the polished intervals are spliced into the reference once all the chunks are stitched
+    if (bedFile != NULL) {
+        if (params->polishParams->streamBamInput) {
+            st_errAbort("The --bed option can not be used with a piped BAM");
+        }
+        params->polishParams->stitchOnline = FALSE;
+    }
+
+    // the journal holds each chunk's record, so it must be made and can not resume a run reading a pipe
+    if (useChunkJournal) {
+        if (params->polishParams->streamBamInput) {
+            st_errAbort("The --chunkJournal and --shard options can not be used with a piped BAM");
+        }
+        if (helenFeatureType != HFEAT_NONE) {
+            st_errAbort("The --chunkJournal and --shard options can not be used when producing HELEN features");
+        }
+        params->polishParams->useBinaryChunkRecords = TRUE;
+    }
+
     // a failure case
     if (diploid && partitionFilteredReads && !params->polishParams->skipHaploidPolishingIfDiploid) {
         st_errAbort("Parameter polish->skipHaploidPolishingIfDiploid must be TRUE unless skipFilteredReads is set");
@@ -370,6 +646,9 @@ int polish_main(int argc, char *argv[]) {
         }
         st_logCritical("> Only considering alleles found in VCF\n");
     }
+    if (outputPhasedVcf && !diploid) {
+        st_errAbort("The --outputPhasedVcf option can only be used with --diploid");
+    }
 
     // Set no RLE if appropriate feature type is set
     if (helenFeatureType == HFEAT_SIMPLE_WEIGHT) {
@@ -397,11 +676,21 @@ int polish_main(int argc, char *argv[]) {
 
     // get chunker for bam.  if regionStr is NULL, it will be ignored
     time_t chunkingStart = time(NULL);
-    BamChunker *bamChunker = bamChunker_construct2(bamInFile, regionStr, NULL, params->polishParams, partitionFilteredReads);
+    // when streaming, the bam is only read once, so the chunks are planned over the reference
+    // with a bed, only its intervals are chunked
+    BamChunker *bamChunker = bedFile != NULL ?
+            bamChunker_constructFromBed(bedFile, referenceFastaFile, bamInFile, params->polishParams) :
+            params->polishParams->streamBamInput ?
+            bamChunker_constructFromFasta(referenceFastaFile, bamInFile, regionStr, params->polishParams) :
+            bamChunker_construct2(bamInFile, regionStr, NULL, params->polishParams, partitionFilteredReads);
+    bamChunker_setCramReference(bamChunker, referenceFastaFile);
+    for (int64_t i = 0; i < stList_length(secondaryBamInFiles); i++) {
+        bamChunker_addBamFile(bamChunker, stList_get(secondaryBamInFiles, i));
+    }
     st_logCritical(
             "> Set up bam chunker in %"PRId64"s with chunk size %i and overlap %i (for region=%s), resulting in %i total chunks\n",
             time(NULL) - chunkingStart, (int) bamChunker->chunkSize, (int) bamChunker->chunkBoundary,
-            regionStr == NULL ? "all" : regionStr, bamChunker->chunkCount);
+            bedFile != NULL ? bedFile : (regionStr == NULL ? "all" : regionStr), bamChunker->chunkCount);
     if (bamChunker->chunkCount == 0) {
         st_errAbort("> Found no valid reads!\n");
     }
@@ -447,13 +736,23 @@ int polish_main(int argc, char *argv[]) {
             outputHaplotypeReads ? outputReadCsvFile : NULL,
             outputRepeatCounts ? outputRepeatCountFile : NULL,
             diploid ? ".hap1" : "", diploid ? ".hap2" : NULL, inMemory);
+    if (bedFile != NULL) {
+        outputChunkers_setReferenceSplicing(outputChunkers, referenceFastaFile, bamChunker);
+    }
 
     // (may) need to shuffle chunks
     stList *chunkOrder = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
     for (int64_t i = 0; i < bamChunker->chunkCount; i++) {
         stList_append(chunkOrder, stIntTuple_construct1(i));
     }
-    if (params->polishParams->shuffleChunks) {
+    BamChunkStream *bamChunkStream = NULL;
+    if (params->polishParams->streamBamInput) {
+        st_logCritical("> Streaming the BAM in a single pass, processing chunks in file order\n");
+        bamChunkStream = bamChunkStream_construct(bamChunker, chunkOrder, referenceFastaFile, params,
+                                                  diploid && partitionFilteredReads);
+    } else if (params->polishParams->stitchOnline) {
+        st_logCritical("> Stitching online, processing chunks in contig order\n");
+    } else if (params->polishParams->shuffleChunks) {
         switch (params->polishParams->shuffleChunksMethod) {
             case SCM_SIZE_DESC:
                 st_logCritical("> Ordering chunks by estimated depth\n");
@@ -464,475 +763,328 @@ int polish_main(int argc, char *argv[]) {
                 st_logCritical("> Randomly shuffling chunks\n");
                 stList_shuffle(chunkOrder);
                 break;
+            case SCM_COST_DESC:
+                st_logCritical("> Ordering chunks by predicted cost\n");
+                break;
         }
     }
 
-    // multiproccess the chunks, save to results
-    st_logCritical("> Setup complete, beginning run\n");
-    int64_t lastReportedPercentage = 0;
-    time_t polishStartTime = time(NULL);
-
-    # ifdef _OPENMP
-    #pragma omp parallel for schedule(dynamic,1)
-    # endif
-    for (int64_t i = 0; i < bamChunker->chunkCount; i++) {
-        int64_t chunkIdx = stIntTuple_get(stList_get(chunkOrder, i), 0);
-        // Time all chunks
-        time_t chunkStartTime = time(NULL);
-
-        // Get chunk
-        BamChunk *bamChunk = bamChunker_getChunk(bamChunker, chunkIdx);
-
-        // logging
-        char *logIdentifier;
-        bool logProgress = FALSE;
-        int64_t currentPercentage = (int64_t) (100 * i / bamChunker->chunkCount);
-        # ifdef _OPENMP
-        int64_t threadIdx = omp_get_thread_num();
-        logIdentifier = stString_print(" T%02d_C%05"PRId64, threadIdx, chunkIdx);
-        if (threadIdx == 0) {
-            if (currentPercentage != lastReportedPercentage) {
-                logProgress = TRUE;
-                lastReportedPercentage = currentPercentage;
-            }
-        }
-        # else
-        int64_t threadIdx = 0;
-        logIdentifier = stString_copy("");
-        if (currentPercentage != lastReportedPercentage) {
-            logProgress = TRUE;
-            lastReportedPercentage = currentPercentage;
+    // (may) resume from the chunks journaled by an earlier run of the same inputs and options
+    char *chunkJournalFile = NULL;
+    stList *shardJournalFiles = stList_construct3(0, free);
+    if (useChunkJournal) {
+        chunkJournalFile = stString_print("%s.chunkJournal", outputBase);
+        if (previousChunkJournalFile != NULL && stString_eq(previousChunkJournalFile, chunkJournalFile)) {
+            st_errAbort("The previous chunk journal %s would be overwritten, use another --outputBase",
+                        previousChunkJournalFile);
         }
-        # endif
-
-        // prints percentage complete and estimated time remaining
-        if (logProgress) {
-            // log progress
-            int64_t timeTaken = (int64_t) (time(NULL) - polishStartTime);
-            int64_t secondsRemaining = (int64_t) floor(1.0 * timeTaken / currentPercentage * (100 - currentPercentage));
-            char *timeDescriptor = (secondsRemaining == 0 && currentPercentage <= 50 ?
-                                    stString_print("unknown") : getTimeDescriptorFromSeconds(secondsRemaining));
-            st_logCritical("> Polishing %2"PRId64"%% complete (%"PRId64"/%"PRId64").  Estimated time remaining: %s\n",
-                           currentPercentage, i, bamChunker->chunkCount, timeDescriptor);
-            free(timeDescriptor);
-        }
-
-        RleString *rleReference = bamChunk_getReferenceSubstring(bamChunk, referenceFastaFile, params);
-        st_logInfo(">%s Going to process a chunk for reference sequence: %s, starting at: %i and ending at: %i\n",
-                   logIdentifier, bamChunk->refSeqName, (int) bamChunk->chunkOverlapStart, bamChunk->chunkOverlapEnd);
-
-        // Convert bam lines into corresponding reads and alignments
-        st_logInfo(" %s Parsing input reads from file: %s\n", logIdentifier, bamInFile);
-        stList *reads = stList_construct3(0, (void (*)(void *)) bamChunkRead_destruct);
-        stList *alignments = stList_construct3(0, (void (*)(void *)) stList_destruct);
-        stList *filteredReads = stList_construct3(0, (void (*)(void *)) bamChunkRead_destruct);
-        stList *filteredAlignments = stList_construct3(0, (void (*)(void *)) stList_destruct);
-        if (diploid && partitionFilteredReads) {
-            convertToReadsAndAlignmentsWithFiltered(bamChunk, rleReference, reads, alignments,
-                    filteredReads, filteredAlignments, params->polishParams);
-        } else {
-            convertToReadsAndAlignments(bamChunk, rleReference, reads, alignments, params->polishParams);
-        }
-        removeReadsOnlyInChunkBoundary(bamChunk, reads, alignments, logIdentifier);
-
-        // do downsampling if appropriate
-        if (params->polishParams->maxDepth > 0) {
-            // get downsampling structures
-            stList *maintainedReads = stList_construct3(0, (void (*)(void *)) bamChunkRead_destruct);
-            stList *maintainedAlignments = stList_construct3(0, (void (*)(void *)) stList_destruct);
-
-            bool didDownsample = diploid ?
-                                 // prioritizes longer reads (better for phasing)
-                                 downsampleViaFullReadLengthLikelihood(params->polishParams->maxDepth, bamChunk, reads,
-                                                                       alignments, maintainedReads, maintainedAlignments,
-                                                                       filteredReads, filteredAlignments):
-                                 // just randomly samples reads
-                                 downsampleViaReadLikelihood(params->polishParams->maxDepth, bamChunk, reads,
-                                                             alignments, maintainedReads, maintainedAlignments,
-                                                             filteredReads, filteredAlignments);
-
-            // we need to destroy the discarded reads and structures
-            if (didDownsample) {
-                st_logInfo(" %s Downsampled from %"PRId64" to %"PRId64" reads\n", logIdentifier,
-                           stList_length(reads), stList_length(maintainedReads));
-                // still has all the old reads, need to not free these
-                stList_setDestructor(reads, NULL);
-                stList_setDestructor(alignments, NULL);
-                stList_destruct(reads);
-                stList_destruct(alignments);
-                // and keep the filtered reads
-                reads = maintainedReads;
-                alignments = maintainedAlignments;
-            }
-                // no downsampling, we just need to free the (empty) objects
-            else {
-                assert(stList_length(maintainedReads) == 0);
-                assert(stList_length(maintainedAlignments) == 0);
-                stList_destruct(maintainedReads);
-                stList_destruct(maintainedAlignments);
+        // the settings, which a chunk of a previous run must share to be reused: the resolved parameters, the
+        // contents of the other inputs and the options. The bam and reference are in each chunk's input key instead
+        uint64_t fingerprint = chunkJournal_fingerprintString(CHUNK_JOURNAL_FINGERPRINT_SEED, MARGIN_POLISH_VERSION_H);
+        fingerprint = chunkJournal_fingerprintFile(fingerprint, vcfFile);
+        fingerprint = chunkJournal_fingerprintFile(fingerprint, trueReferenceBam);
+        fingerprint = chunkJournal_fingerprintFile(fingerprint, bedFile);
+        char *options = stString_print("polish %"PRIu64" %s %"PRId64" %"PRIu64" %"PRIu64" %d%d%d%d%d%d%d%d%d%d",
+                                       params->fingerprint, regionStr == NULL ? "" : regionStr, maxDepth, maxMemory,
+                                       params->polishParams->downsamplingSeed, diploid, skipRealignment,
+                                       partitionFilteredReads, onlyUseVCFAlleles, outputFasta, outputPoaCSV,
+                                       outputRepeatCounts, outputHaplotypeReads, outputHaplotypeBAM, outputPhasedVcf);
+        fingerprint = chunkJournal_fingerprintString(fingerprint, options);
+        free(options);
+        if (stitchShardCount > 0) {
+            for (int64_t i = 0; i < stitchShardCount; i++) {
+                stList_append(shardJournalFiles, stString_print("%s.shard%"PRId64"of%"PRId64".chunkJournal",
+                                                                outputBase, i, stitchShardCount));
             }
+            chunkJournal_merge(chunkJournalFile, shardJournalFiles, fingerprint, bamChunker->chunkCount);
         }
-
-        // prep for polishing
-        Poa *poa = NULL; // The poa alignment
-        char *polishedConsensusString = NULL; // The polished reference string
-
-        // Run the polishing method
-        int64_t totalNucleotides = 0;
-        if (st_getLogLevel() >= info) {
-            for (int64_t u = 0; u < stList_length(reads); u++) {
-                totalNucleotides += strlen(((BamChunkRead *) stList_get(reads, u))->rleRead->rleString);
+        int64_t journaledChunkNo = outputChunkers_openChunkJournal(outputChunkers, chunkJournalFile, fingerprint,
+                                                                   bamChunker->chunkCount);
+        if (stitchShardCount > 0 && journaledChunkNo != bamChunker->chunkCount) {
+            st_errAbort("Found %"PRId64" of %"PRId64" chunks in the shard journals, all %"PRId64" shards must be "
+                        "completed before stitching", journaledChunkNo, bamChunker->chunkCount, stitchShardCount);
+        }
+        int64_t shardStart = shardCount > 0 ? bamChunker->chunkCount * shardIdx / shardCount : 0;
+        int64_t shardEnd = shardCount > 0 ? bamChunker->chunkCount * (shardIdx + 1) / shardCount :
+                           bamChunker->chunkCount;
+        // journal the inputs of the chunks, so a later run can reuse those whose inputs are unchanged, and (may) reuse
+        // the chunks of a previous run or of the chunk cache
+        if (stitchShardCount == 0) {
+            if (chunkCacheDirectory != NULL) {
+                outputChunkers_setChunkCache(outputChunkers, chunkCacheDirectory);
             }
-            st_logInfo(" %s Running polishing algorithm with %"PRId64" reads and %"PRIu64"K nucleotides\n",
-                       logIdentifier, stList_length(reads), totalNucleotides >> 10);
-        }
-
-        // Generate partial order alignment (POA) (destroys rleAlignments in the process)
-        if (diploid && skipRealignment) {
-            // This option fills the poa with only cigar-string likelihoods
-            st_logInfo(" %s Getting alignment likelihoods from CIGAR string, and not mutating POA\n", logIdentifier);
-            poa = poa_realignOnlyAnchorAlignments(reads, alignments, rleReference, params->polishParams);
-        } else if (diploid && params->polishParams->skipHaploidPolishingIfDiploid) {
-            // This option generates a POA against the input reference background
-            st_logInfo(" %s Generating alignment likelihoods, but not mutating POA\n", logIdentifier);
-            poa = poa_realign(reads, alignments, rleReference, params->polishParams);
-        } else {
-            // This option refines the POA
-            st_logInfo(" %s Generating alignment likelihoods and mutating POA\n", logIdentifier);
-            poa = poa_realignAll(reads, alignments, rleReference, params->polishParams);
+            journaledChunkNo += outputChunkers_journalChunkInputs(outputChunkers, bamChunker, referenceFastaFile,
+                                                                  shardStart, shardEnd, fingerprint,
+                                                                  previousChunkJournalFile);
         }
-
-        // Log info about the POA
-        if (st_getLogLevel() >= info) {
-            st_logInfo(" %s Summary stats for POA:\t", logIdentifier);
-            poa_printSummaryStats(poa, stderr);
-        }
-        if (st_getLogLevel() >= debug) {
-            poa_print(poa, stderr, reads, 5);
-        }
-
-        // Write any optional outputs about repeat count and POA, etc.
-        if (writeChunkSupplementaryOutput) {
-            poa_writeSupplementalChunkInformation(outputBase, chunkIdx, bamChunk, poa, reads, params,
-                                                  outputPoaDOT, outputPoaCSV, outputRepeatCounts);
-        }
-
-        // handle diploid case
-        if(diploid) {
-
-            time_t primaryPhasingStart = time(NULL);
-
-            // iteratively find bubbles
-            int64_t bubbleFindingIteration = 0;
-            BubbleGraph *bg = NULL;
-            stHash *readsToPSeqs = NULL;
-            stSet *readsBelongingToHap1 = NULL, *readsBelongingToHap2 = NULL;
-            stGenomeFragment *gf = NULL;
-            stReference *ref = NULL;
-            stList *chunkVcfEntries = NULL;
-            if (vcfEntries != NULL) {
-                uint64_t *rleMap = params->polishParams->useRunLengthEncoding ?
-                                   rleString_getNonRleToRleCoordinateMap(rleReference) : NULL;
-                chunkVcfEntries = getVcfEntriesForRegion(vcfEntries, rleMap, bamChunk->refSeqName,
-                        bamChunk->chunkOverlapStart,  bamChunk->chunkOverlapEnd, params);
-                st_logInfo(" %s Got %"PRId64" VCF entries for region\n", logIdentifier, stList_length(chunkVcfEntries));
-                if (rleMap != NULL) free(rleMap);
+        if (journaledChunkNo > 0 || shardCount > 0) {
+            if (shardCount > 0) {
+                st_logCritical("> Processing shard %"PRId64" of %"PRId64", chunks %"PRId64" to %"PRId64"\n",
+                               shardIdx, shardCount, shardStart, shardEnd - 1);
             }
-            do {
-                // cleanup and iterate (if not first run through)
-                if (bubbleFindingIteration != 0) {
-                    // get new hets
-                    stList *filteredChunkHetAlleles = produceVcfEntriesFromBubbleGraph(bamChunk, bg, readsToPSeqs, gf,
-                            params->phaseParams->bubbleMinBinomialStrandLikelihood,
-                            params->phaseParams->bubbleMinBinomialReadSplitLikelihood);
-                    int64_t filteredAlleleCount = stList_length(filteredChunkHetAlleles);
-                    st_logInfo(" %s At bubble finding iteration %"PRId64", kept %"PRId64" alleles of %"PRId64"\n",
-                            logIdentifier, bubbleFindingIteration, filteredAlleleCount, bg->bubbleNo);
-                    // terminate or iterate
-                    if (filteredAlleleCount == 0 || filteredAlleleCount == bg->bubbleNo) {
-                        stList_destruct(filteredChunkHetAlleles);
-                        break;
-                    } else {
-                        if (chunkVcfEntries != NULL) stList_destruct(chunkVcfEntries);
-                        chunkVcfEntries = filteredChunkHetAlleles;
-                    }
-                    // cleanup
-                    bubbleGraph_destruct(bg);
-                    stHash_destruct(readsToPSeqs);
-                    stSet_destruct(readsBelongingToHap1);
-                    stSet_destruct(readsBelongingToHap2);
-                    stGenomeFragment_destruct(gf);
-                    stReference_destruct(ref);
-                }
-
-
-                // Get the bubble graph representation
-                if (onlyUseVCFAlleles) {
-                    bg = bubbleGraph_constructFromPoaAndVCFOnlyVCFAllele(poa, reads, rleReference, chunkVcfEntries, params);
+            stList *unjournaledChunkOrder = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
+            for (int64_t i = 0; i < stList_length(chunkOrder); i++) {
+                stIntTuple *chunkIdx = stList_get(chunkOrder, i);
+                if (outputChunkers_isChunkJournaled(outputChunkers, stIntTuple_get(chunkIdx, 0)) ||
+                    stIntTuple_get(chunkIdx, 0) < shardStart || stIntTuple_get(chunkIdx, 0) >= shardEnd) {
+                    stIntTuple_destruct(chunkIdx);
                 } else {
-                    bg = bubbleGraph_constructFromPoaAndVCF(poa, reads, chunkVcfEntries, params->polishParams, TRUE);
+                    stList_append(unjournaledChunkOrder, chunkIdx);
                 }
+            }
+            stList_setDestructor(chunkOrder, NULL);
+            stList_destruct(chunkOrder);
+            chunkOrder = unjournaledChunkOrder;
+        }
+    }
 
-                // Now make a POA for each of the haplotypes
-                ref = bubbleGraph_getReference(bg, bamChunk->refSeqName, params);
-                gf = bubbleGraph_phaseBubbleGraph(bg, ref, reads, params, &readsToPSeqs);
-
-                stGenomeFragment_phaseBamChunkReads(gf, readsToPSeqs, reads, &readsBelongingToHap1, &readsBelongingToHap2,
-                                                    params->phaseParams);
-                st_logInfo(" %s After phasing, of %i reads got %i reads partitioned into hap1 and %i reads partitioned "
-                           "into hap2 (%i unphased)\n", logIdentifier, (int) stList_length(reads),
-                           (int) stSet_size(readsBelongingToHap1), (int) stSet_size(readsBelongingToHap2),
-                           (int) (stList_length(reads) - stSet_size(readsBelongingToHap1) -
-                                  stSet_size(readsBelongingToHap2)));
-
-                // Debug report of hets
-                if (st_getLogLevel() <= info) {
-                    uint64_t totalHets = 0;
-                    for (uint64_t h = 0; h < gf->length; h++) {
-                        Bubble *b = &bg->bubbles[h + gf->refStart];
-                        if (gf->haplotypeString1[h] != gf->haplotypeString2[h]) {
-                            st_logDebug(" %s Got predicted het at bubble %i %s %s\n", logIdentifier, (int) h + gf->refStart,
-                                        b->alleles[gf->haplotypeString1[h]]->rleString,
-                                        b->alleles[gf->haplotypeString2[h]]->rleString);
-                            totalHets++;
-                        } else if (!rleString_eq(b->alleles[gf->haplotypeString1[h]], b->refAllele)) {
-                            st_logDebug(" %s Got predicted hom alt at bubble %i %i\n", logIdentifier,
-                                        (int) h + gf->refStart,
-                                        (int) gf->haplotypeString1[h]);
-                        }
-                    }
-                    st_logInfo(" %s In phasing chunk, got: %i hets from: %i total sites (fraction: %f)\n", logIdentifier,
-                               (int) totalHets, (int) gf->length, (float) totalHets / gf->length);
-                }
-
-                bubbleFindingIteration++;
-            } while (vcfFile == NULL && bubbleFindingIteration <= params->phaseParams->bubbleFindingIterations);
-
+    // each thread takes chunks from the scheduler until there are none left
+    bool predictChunkCost = bamChunkStream == NULL && !params->polishParams->stitchOnline &&
+            params->polishParams->shuffleChunks &&
+            params->polishParams->shuffleChunksMethod == SCM_COST_DESC;
+    ChunkScheduler *chunkScheduler = chunkScheduler_construct(bamChunker, chunkOrder, numThreads, predictChunkCost);
+    if (params->polishParams->maxMemory > 0) {
+        chunkScheduler_setMemoryBudget(chunkScheduler, bamChunker, chunkOrder, params->polishParams->maxMemory,
+                                       params->polishParams->chunkMemoryPerReadBase);
+    }
 
-            // debugging output
-            char *chunkBubbleOutFilename = NULL;
-            FILE *chunkBubbleOut = NULL;
-            uint64_t *reference_rleToNonRleCoordMap = rleString_getRleToNonRleCoordinateMap(rleReference);
+    // read chunks ahead of the threads processing them
+    // the reads discarded by downsampling are only used when phasing the filtered reads (or the truth sequences)
+    // small chunks (may) be loaded in groups, from a single bam file
+    BamChunkGroups *bamChunkGroups = NULL;
+    if (bamChunkStream == NULL && params->polishParams->smallChunkGroupLength > 0 &&
+        bamChunker_getBamFileNo(bamChunker) == 1) {
+        bamChunkGroups = bamChunkGroups_construct(bamChunker, chunkOrder, params->polishParams->smallChunkGroupLength,
+                                                  referenceFastaFile, params, diploid && partitionFilteredReads);
+    }
+    PolishChunkLoader chunkLoader = {bamChunker, chunkOrder, referenceFastaFile, params,
+                                     diploid && partitionFilteredReads, bamChunkStream, bamChunkGroups,
+                                     chunkScheduler, diploid,
+                                     !(diploid && (partitionFilteredReads || partitionTruthSequences))};
+    ChunkPrefetcher *chunkPrefetcher = chunkPrefetcher_construct(stList_length(chunkOrder),
+                                                                 params->polishParams->chunkPrefetchThreads,
+                                                                 numThreads, polishChunkInput_load, &chunkLoader);
 
-            // haplotype-specific info (skipped if not writing FASTA)
-            uint64_t *hap1 = NULL;
-            uint64_t *hap2 = NULL;
-            Poa *poa_hap1 = NULL;
-            Poa *poa_hap2 = NULL;
+    // for writing haplotyped chunks
+    stList *allReadIdsHap1 = NULL;
+    stList *allReadIdsHap2 = NULL;
+    if (partitionTruthSequences || outputHaplotypeBAM) {
+        // setup
+        allReadIdsHap1 = stList_construct3(0, free);
+        allReadIdsHap2 = stList_construct3(0, free);
+    }
 
-            if (outputFasta) {
-                st_logInfo(" %s Building POA for each haplotype\n", logIdentifier);
-                hap1 = getPaddedHaplotypeString(gf->haplotypeString1, gf, bg, params);
-                hap2 = getPaddedHaplotypeString(gf->haplotypeString2, gf, bg, params);
+    // for writing the phased vcf, the variants of each chunk and whether its haplotypes were switched in stitching
+    char **chunkPhasedVariants = NULL;
+    bool *chunkWasSwitched = NULL;
+    if (outputPhasedVcf) {
+        chunkPhasedVariants = st_calloc(bamChunker->chunkCount, sizeof(char *));
+        chunkWasSwitched = st_calloc(bamChunker->chunkCount, sizeof(bool));
+    }
 
-                poa_hap1 = bubbleGraph_getNewPoa(bg, hap1, poa, reads, params);
-                poa_hap2 = bubbleGraph_getNewPoa(bg, hap2, poa, reads, params);
+    // (may) stitch the chunks as they are completed
+    if (params->polishParams->stitchOnline) {
+        outputChunkers_startOnlineStitching(outputChunkers, diploid, bamChunker->chunkCount,
+                                            allReadIdsHap1, allReadIdsHap2, chunkWasSwitched);
+    }
 
-                if(params->polishParams->useRunLengthEncoding) {
-                    st_logInfo(" %s Using read phasing to reestimate repeat counts in phased manner\n", logIdentifier);
-                    poa_estimatePhasedRepeatCountsUsingBayesianModel(poa_hap1, reads, params->polishParams->repeatSubMatrix,
-                                                                     readsBelongingToHap1, readsBelongingToHap2, params->polishParams);
-                    poa_estimatePhasedRepeatCountsUsingBayesianModel(poa_hap2, reads, params->polishParams->repeatSubMatrix,
-                                                                     readsBelongingToHap2, readsBelongingToHap1, params->polishParams);
-                }
-                st_logInfo(" %s Phased primary reads in %d sec\n", logIdentifier, time(NULL) - primaryPhasingStart);
-
-
-                if (outputPhasingState) {
-                    // save info
-                    chunkBubbleOutFilename = stString_print("%s.C%05"PRId64".%s-%"PRId64"-%"PRId64".phasingInfo.json",
-                                                            outputBase, chunkIdx,  bamChunk->refSeqName, bamChunk->chunkOverlapStart, bamChunk->chunkOverlapEnd);
-                    st_logInfo(" %s Saving chunk phasing info to: %s\n", logIdentifier, chunkBubbleOutFilename);
-                    chunkBubbleOut = safe_fopen(chunkBubbleOutFilename, "w");
-                    fprintf(chunkBubbleOut, "{\n");
-                    bubbleGraph_saveBubblePhasingInfo(bamChunk, bg, readsToPSeqs, gf, reference_rleToNonRleCoordMap,
-                                                      chunkBubbleOut);
+    // the journaled chunks are output as if they had just been processed, after restoring their phased variants,
+    // unless just journaling a shard
+    if (useChunkJournal && shardCount == 0) {
+        if (outputPhasedVcf) {
+            for (int64_t chunkIdx = 0; chunkIdx < bamChunker->chunkCount; chunkIdx++) {
+                if (outputChunkers_isChunkJournaled(outputChunkers, chunkIdx)) {
+                    size_t chunkPhasedVariantsLength;
+                    chunkPhasedVariants[chunkIdx] = outputChunkers_getJournaledChunkData(outputChunkers, chunkIdx,
+                                                                                         &chunkPhasedVariantsLength);
                 }
-            } else {
-                st_logInfo(" %s Skipping haplotype-specific POA construction\n", logIdentifier);
             }
+        }
+        outputChunkers_replayChunkJournal(outputChunkers);
+    }
 
+    // (may) record the stages of each chunk
+    char *chunkTelemetryFile = NULL;
+    FILE *chunkTelemetryFh = NULL;
+    if (writeChunkTelemetry) {
+        chunkTelemetryFile = stString_print("%s.chunkTelemetry.jsonl", outputBase);
+        st_logCritical("> Writing chunk telemetry to %s\n", chunkTelemetryFile);
+        chunkTelemetryFh = safe_fopen(chunkTelemetryFile, "w");
+        chunkTelemetry_startRun();
+    }
 
-            // should included filtered reads in output
-            if (partitionFilteredReads || partitionTruthSequences) {
-                // get reads
-                if (partitionFilteredReads) {
-                    for (int64_t bcrIdx = 0; bcrIdx < stList_length(reads); bcrIdx++) {
-                        BamChunkRead *bcr = stList_get(reads, bcrIdx);
-                        if (!stSet_search(readsBelongingToHap1, bcr) && !stSet_search(readsBelongingToHap2, bcr)) {
-                            // was filtered in some form
-                            stList_append(filteredReads, bamChunkRead_constructCopy(bcr));
-                            stList_append(filteredAlignments, copyListOfIntTuples(stList_get(alignments, bcrIdx)));
-                        }
-                    }
-                }
-                if (partitionTruthSequences) {
-                    chunkTruthHaplotypes_addTruthReadsToFilteredReadSet(bamChunk, truthHaplotypesBamChunker,
-                            filteredReads, filteredAlignments, rleReference, params, logIdentifier);
-                }
-                st_logInfo(" %s Assigning %"PRId64" filtered reads to haplotypes\n", logIdentifier, stList_length(filteredReads));
-                removeReadsOnlyInChunkBoundary(bamChunk, filteredReads, filteredAlignments, logIdentifier);
-
-                // we want to only keep up to excessiveDepthThreshold filtered reads
-                // get downsampling structures
-                stList *filteredMaintainedReads = stList_construct3(0, (void (*)(void *)) bamChunkRead_destruct);
-                stList *filteredMaintainedAlignments = stList_construct3(0, (void (*)(void *)) stList_destruct);
-                stList *filteredFilteredReads = stList_construct3(0, (void (*)(void *)) bamChunkRead_destruct);
-                stList *filteredFilteredAlignments = stList_construct3(0, (void (*)(void *)) stList_destruct);
-                bool didDownsample = downsampleViaFullReadLengthLikelihood(params->polishParams->excessiveDepthThreshold,
-                        bamChunk,  filteredReads, filteredAlignments, filteredMaintainedReads,
-                        filteredMaintainedAlignments, filteredFilteredReads,  filteredFilteredAlignments);
-
-                // we need to destroy data structures
-                if (didDownsample) {
-                    st_logInfo(" %s Downsampled filtered reads from %"PRId64" to %"PRId64" reads\n", logIdentifier,
-                               stList_length(filteredReads), stList_length(filteredMaintainedReads));
-                    // still has all the old reads, need to not free these
-                    stList_setDestructor(filteredReads, NULL);
-                    stList_setDestructor(filteredAlignments, NULL);
-                    stList_destruct(filteredReads);
-                    stList_destruct(filteredAlignments);
-                    // and keep the filtered reads
-                    filteredReads = filteredMaintainedReads;
-                    filteredAlignments = filteredMaintainedAlignments;
-                }
-                // no downsampling, we just need to free the (empty) maintained read objects
-                else {
-                    assert(stList_length(filteredMaintainedReads) == 0);
-                    assert(stList_length(filteredMaintainedAlignments) == 0);
-                    stList_destruct(filteredMaintainedReads);
-                    stList_destruct(filteredMaintainedAlignments);
-                }
-                // always destroy these (they're either empty or we don't need the reads anymore)
-                stList_destruct(filteredFilteredReads);
-                stList_destruct(filteredFilteredAlignments);
-
-                time_t filteredPhasingStart = time(NULL);
-                Poa *filteredPoa = NULL;
-                if (skipRealignment) {
-                    filteredPoa = poa_realignOnlyAnchorAlignments(filteredReads, filteredAlignments, rleReference, params->polishParams);
-                } else {
-                    filteredPoa = poa_realign(filteredReads, filteredAlignments, rleReference, params->polishParams);
-                }
-
-                bubbleGraph_partitionFilteredReads(filteredPoa, filteredReads, gf, bg, bamChunk,
-                                                   reference_rleToNonRleCoordMap, readsBelongingToHap1,
-                                                   readsBelongingToHap2, params->polishParams,
-                                                   chunkBubbleOut, logIdentifier);
-                poa_destruct(filteredPoa);
-                st_logInfo(" %s Partitioned filtered reads in %d sec.\n", logIdentifier, time(NULL) - filteredPhasingStart);
-            }
+    // (may) record a timeline of the threads' work
+    if (writeChromeTrace) {
+        char *traceFile = stString_print("%s.trace.json", outputBase);
+        traceRecorder_start(traceFile);
+        free(traceFile);
+    }
 
-            // debugging output for state
-            if (outputPhasingState && outputFasta) {
-                writePhasedReadInfoJSON(bamChunk, reads, alignments, filteredReads, filteredAlignments,
-                                        readsBelongingToHap1, readsBelongingToHap2, reference_rleToNonRleCoordMap,
-                                        chunkBubbleOut);
-                fprintf(chunkBubbleOut, "\n}\n");
-                fclose(chunkBubbleOut);
-                free(chunkBubbleOutFilename);
-            }
+    // (may) bundle the inputs of the chunks exceeding the thresholds, to profile them on their own
+    bool writeReplayBundles = replayBundleSeconds > 0 || replayBundleCells > 0;
 
-            // Output
-            outputChunkers_processChunkSequencePhased(outputChunkers, threadIdx, chunkIdx, bamChunk->refSeqName,
-                                                      poa_hap1, poa_hap2, reads,
-                                                      readsBelongingToHap1, readsBelongingToHap2, gf, params);
+    // multiproccess the chunks, save to results
+    st_logCritical("> Setup complete, beginning run\n");
+    chunkScheduler_startProgress(chunkScheduler, "Polishing", params->polishParams->progressInterval);
 
-            //ancillary files
-            if (writeChunkSupplementaryOutput) {
-                poa_writeSupplementalChunkInformationDiploid(outputBase, chunkIdx, bamChunk, gf, poa_hap1, poa_hap2,
-                        reads, readsBelongingToHap1, readsBelongingToHap2, params, outputPoaDOT, outputPoaCSV,
-                        outputRepeatCounts, outputHaplotypeReads, outputHaplotypeBAM, logIdentifier);
-            }
+    // (may) log the lines of the chunk loop through per-thread buffers, written out by a single flusher thread
+    if (params->polishParams->bufferedLogging) {
+        logBuffer_start(stderr);
+    }
 
-            // Cleanup
-            if (hap1 != NULL) free(hap1);
-            if (hap2 != NULL) free(hap2);
-            if (chunkVcfEntries != NULL) stList_destruct(chunkVcfEntries);
-            stSet_destruct(readsBelongingToHap1);
-            stSet_destruct(readsBelongingToHap2);
-            bubbleGraph_destruct(bg);
-            stGenomeFragment_destruct(gf);
-            stReference_destruct(ref);
-            if (poa_hap1 != NULL) poa_destruct(poa_hap1);
-            if (poa_hap2 != NULL) poa_destruct(poa_hap2);
-            stHash_destruct(readsToPSeqs);
-            free(reference_rleToNonRleCoordMap);
+    // the settings the chunks are polished with
+    PolishChunkSettings chunkSettings = {diploid, skipRealignment, onlyUseVCFAlleles, partitionFilteredReads,
+                                         truthHaplotypesBamChunker, vcfEntries, outputFasta, outputPhasingState,
+                                         chunkPhasedVariants, useChunkJournal, outputBase,
+                                         writeChunkSupplementaryOutput, outputPoaDOT, outputPoaCSV,
+                                         outputRepeatCounts, outputHaplotypeReads, outputHaplotypeBAM,
+                                         helenFeatureType, splitWeightMaxRunLength, helenHDF5Files, fullFeatureOutput,
+                                         trueReferenceBam};
 
-        } else {
+    // (may) place the threads on the NUMA nodes, each thread using the params of its node in the loop
+    NumaPlacement *numaPlacement = useNuma ? numaPlacement_construct(params, numThreads) : NULL;
+    Params *sharedParams = params;
 
-            // get polished reference string and expand RLE (regardless of whether RLE was applied)
-            if (params->polishParams->useRunLengthEncoding) {
-                poa_estimateRepeatCountsUsingBayesianModel(poa, reads, params->polishParams->repeatSubMatrix);
-            }
+    # ifdef _OPENMP
+    #pragma omp parallel
+    # endif
+    for (int64_t i = 0; chunkScheduler_next(chunkScheduler, &i);) {
+        Params *params = numaPlacement == NULL ? sharedParams : numaPlacement_getThreadParams(numaPlacement);
+        int64_t chunkIdx = stIntTuple_get(stList_get(chunkOrder, i), 0);
+        // Time all chunks
+        time_t chunkStartTime = time(NULL);
 
-            // output
-            outputChunkers_processChunkSequence(outputChunkers, threadIdx, chunkIdx, bamChunk->refSeqName, poa, reads);
+        // Get chunk
+        BamChunk *bamChunk = bamChunker_getChunk(bamChunker, chunkIdx);
+        traceRecorder_beginChunk(chunkIdx);
+        if (params->polishParams->useChunkArena) {
+            chunkArena_open();
+        }
 
-            //ancillary files
-            if (writeChunkSupplementaryOutput) {
-                poa_writeSupplementalChunkInformation(outputBase, chunkIdx, bamChunk, poa, reads, params,
-                        outputPoaDOT, outputPoaCSV, outputRepeatCounts);
-            }
+        // logging, the progress is reported by the scheduler as chunks are finished
+        char *logIdentifier;
+        # ifdef _OPENMP
+        int64_t threadIdx = omp_get_thread_num();
+        logIdentifier = stString_print(" T%02d_C%05"PRId64, threadIdx, chunkIdx);
+        # else
+        int64_t threadIdx = 0;
+        logIdentifier = stString_copy("");
+        # endif
 
-            // HELEN feature outputs
-            #ifdef _HDF5
-            RleString *polishedRleConsensus = rleString_copy(poa->refString);
-            polishedConsensusString = rleString_expand(polishedRleConsensus);
-            if (helenFeatureType != HFEAT_NONE) {
-                PoaFeature_handleHelenFeatures(helenFeatureType, splitWeightMaxRunLength,
-                                               helenHDF5Files, fullFeatureOutput, trueReferenceBam, rleReference, params,
-                                               logIdentifier, chunkIdx,
-                                               bamChunk, poa, reads, polishedConsensusString, polishedRleConsensus);
+        logBuffer_info(">%s Going to process a chunk for reference sequence: %s, starting at: %i and ending at: %i\n",
+                       logIdentifier, bamChunk->refSeqName, (int) bamChunk->chunkOverlapStart, bamChunk->chunkOverlapEnd);
 
-            }
-            free(polishedConsensusString);
-            rleString_destruct(polishedRleConsensus);
-            #endif
+        // Get the reference and the reads and alignments converted from the bam lines, which may have been prefetched
+        if (chunkTelemetryFh != NULL || writeReplayBundles) {
+            chunkTelemetry_start(bamChunk);
         }
+        logBuffer_info(" %s Parsing input reads from file: %s\n", logIdentifier, bamInFile);
+        chunkTelemetry_startStage(CTS_READ);
+        traceRecorder_begin("chunkPrefetcher_getChunk");
+        BamChunkReads *chunkInput = chunkPrefetcher_getChunk(chunkPrefetcher, i);
+        traceRecorder_end("chunkPrefetcher_getChunk");
+        chunkTelemetry_endStage(CTS_READ);
+        ChunkReplayBundle *replayBundle = !writeReplayBundles ? NULL :
+                chunkReplayBundle_construct(bamChunk, chunkInput, chunkInput->downsampled ? 0 :
+                                            polish_getChunkMaxDepth(params, chunkScheduler, i),
+                                            diploid, partitionFilteredReads, params->fingerprint);
+        int64_t totalNucleotides;
+        int64_t readNo = polishChunk(bamChunk, chunkIdx, chunkInput, chunkInput->downsampled ? 0 :
+                                     polish_getChunkMaxDepth(params, chunkScheduler, i), &chunkSettings,
+                                     outputChunkers, threadIdx, params, logIdentifier, &totalNucleotides);
 
         // report timing
         if (st_getLogLevel() >= info) {
-            st_logInfo(">%s Chunk with %"PRId64" reads and %"PRIu64"K nucleotides processed in %d sec\n",
-                       logIdentifier, stList_length(reads), totalNucleotides >> 10,
-                       (int) (time(NULL) - chunkStartTime));
+            logBuffer_info(">%s Chunk with %"PRId64" reads and %"PRIu64"K nucleotides processed in %d sec\n",
+                           logIdentifier, readNo, totalNucleotides >> 10,
+                           (int) (time(NULL) - chunkStartTime));
+            logBuffer_infoFields("chunk", "chunk=%"PRId64" contig=%s start=%"PRId64" end=%"PRId64" reads=%"PRId64
+                                 " nucleotides=%"PRId64" seconds=%d\n", chunkIdx, bamChunk->refSeqName,
+                                 bamChunk->chunkStart, bamChunk->chunkEnd, readNo, totalNucleotides,
+                                 (int) (time(NULL) - chunkStartTime));
+            DpArenaStats dpArenaStats;
+            dpArena_getStats(&dpArenaStats);
+            logBuffer_info(" %s Pairwise alignment arena peak %"PRId64"K, %"PRId64" buffers allocated, %"PRId64" reused\n",
+                           logIdentifier, dpArenaStats.peakBytes >> 10, dpArenaStats.allocations, dpArenaStats.reuses);
+            if (params->polishParams->useChunkArena) {
+                ChunkArenaStats chunkArenaStats;
+                chunkArena_getStats(&chunkArenaStats);
+                logBuffer_info(" %s Chunk arena held %"PRId64" objects in %"PRId64"K over %"PRId64" blocks, %"PRId64
+                               " too large for it\n", logIdentifier, chunkArenaStats.allocations,
+                               chunkArenaStats.bytes >> 10, chunkArenaStats.blocks, chunkArenaStats.heapAllocations);
+            }
+        }
+
+        // (may) write the chunk's inputs to be replayed, if it exceeded a threshold
+        if (replayBundle != NULL) {
+            double chunkWallTime;
+            int64_t chunkCounts[CTC_COUNTS];
+            if (chunkTelemetry_getProgress(&chunkWallTime, chunkCounts) &&
+                ((replayBundleSeconds > 0 && chunkWallTime >= replayBundleSeconds) ||
+                 (replayBundleCells > 0 && chunkCounts[CTC_DP_CELLS] + chunkCounts[CTC_HMM_CELLS] >= replayBundleCells))) {
+                char *replayBundleFile = stString_print("%s.chunk%"PRId64".replay", outputBase, chunkIdx);
+                logBuffer_info(" %s Writing replay bundle of chunk, processed in %.1f sec, to %s\n", logIdentifier,
+                               chunkWallTime, replayBundleFile);
+                chunkReplayBundle_write(replayBundle, replayBundleFile);
+                free(replayBundleFile);
+            }
+            chunkReplayBundle_destruct(replayBundle);
         }
 
         // Cleanup
-        rleString_destruct(rleReference);
-        poa_destruct(poa);
-        stList_destruct(reads);
-        stList_destruct(alignments);
-        stList_destruct(filteredReads);
-        stList_destruct(filteredAlignments);
         free(logIdentifier);
+        if (chunkTelemetryFh != NULL || writeReplayBundles) {
+            chunkTelemetry_finish(chunkTelemetryFh);
+        }
+        if (params->polishParams->useChunkArena) {
+            chunkArena_close();
+        }
+        // the dp matrix buffers cached by the chunk are freed, rather than held by the thread for the rest of the run
+        dpArena_clear();
+        traceRecorder_end("chunk");
+        chunkScheduler_finish(chunkScheduler, i);
     }
-
-    // for writing haplotyped chunks
-    stList *allReadIdsHap1 = NULL;
-    stList *allReadIdsHap2 = NULL;
-    if (partitionTruthSequences || outputHaplotypeBAM) {
-        // setup
-        allReadIdsHap1 = stList_construct3(0, free);
-        allReadIdsHap2 = stList_construct3(0, free);
+    logBuffer_finish();
+    if (chunkTelemetryFh != NULL) {
+        chunkTelemetry_finishRun(chunkTelemetryFh);
+        fclose(chunkTelemetryFh);
+        free(chunkTelemetryFile);
+    }
+    hugePages_logSummary();
+    chunkScheduler_destruct(chunkScheduler);
+    if (numaPlacement != NULL) numaPlacement_destruct(numaPlacement);
+    chunkPrefetcher_destruct(chunkPrefetcher);
+    if (bamChunkStream != NULL) bamChunkStream_destruct(bamChunkStream);
+    if (bamChunkGroups != NULL) bamChunkGroups_destruct(bamChunkGroups);
+
+    // a shard's chunks are only journaled, and are stitched with the other shards' by margin stitch
+    if (shardCount > 0) {
+        outputChunkers_discardOutput(outputChunkers);
+        outputChunkers_destruct(outputChunkers);
+        st_logCritical("> Journaled shard %"PRId64" of %"PRId64" to %s, stitch all %"PRId64" shards with "
+                       "'margin stitch'\n", shardIdx, shardCount, chunkJournalFile, shardCount);
+    } else {
+        // merge chunks
+        time_t mergeStartTime = time(NULL);
+        st_logCritical("> Starting merge\n");
+        if (params->polishParams->stitchOnline) {
+            outputChunkers_finishOnlineStitching(outputChunkers);
+        } else {
+            outputChunkers_stitchAndTrackExtraData(outputChunkers, diploid, bamChunker->chunkCount,
+                                                   allReadIdsHap1, allReadIdsHap2, chunkWasSwitched);
+        }
+        time_t mergeEndTime = time(NULL);
+        char *tds = getTimeDescriptorFromSeconds((int) mergeEndTime - mergeStartTime);
+        st_logCritical("> Merging took %s\n", tds);
+        outputChunkers_destruct(outputChunkers);
+        free(tds);
+        tds = getTimeDescriptorFromSeconds((int) time(NULL) - mergeEndTime);
+        st_logCritical("> Merge cleanup took %s\n", tds);
+        free(tds);
     }
-
-    // merge chunks
-    time_t mergeStartTime = time(NULL);
-    st_logCritical("> Starting merge\n");
-    outputChunkers_stitchAndTrackExtraData(outputChunkers, diploid, bamChunker->chunkCount,
-                                           allReadIdsHap1, allReadIdsHap2, NULL);
-    time_t mergeEndTime = time(NULL);
-    char *tds = getTimeDescriptorFromSeconds((int) mergeEndTime - mergeStartTime);
-    st_logCritical("> Merging took %s\n", tds);
-    outputChunkers_destruct(outputChunkers);
-    free(tds);
-    tds = getTimeDescriptorFromSeconds((int) time(NULL) - mergeEndTime);
-    st_logCritical("> Merge cleanup took %s\n", tds);
-    free(tds);
 
     // maybe write final haplotyped bams
-    if (outputHaplotypeBAM) {
+    if (outputHaplotypeBAM && shardCount == 0) {
         time_t hapBamStart = time(NULL);
         st_logInfo("> Writing final haplotyped BAMs\n");
 
@@ -959,7 +1111,23 @@ int polish_main(int argc, char *argv[]) {
         free(hapBamTDS);
     }
 
-    if (diploid && partitionTruthSequences) {
+    // maybe write the phased vcf
+    if (outputPhasedVcf) {
+        if (shardCount == 0) {
+            char *outputVcfFile = stString_print("%s.phased.vcf%s", outputBase,
+                                                 params->phaseParams->compressPhasedVcf ? ".gz" : "");
+            st_logCritical("> Writing phased VCF to %s\n", outputVcfFile);
+            writeChunkPhasedVariants(outputVcfFile, bamChunker, chunkPhasedVariants, chunkWasSwitched, params);
+            free(outputVcfFile);
+        }
+        for (int64_t i = 0; i < bamChunker->chunkCount; i++) {
+            if (chunkPhasedVariants[i] != NULL) free(chunkPhasedVariants[i]);
+        }
+        free(chunkPhasedVariants);
+        free(chunkWasSwitched);
+    }
+
+    if (diploid && partitionTruthSequences && shardCount == 0) {
         char *chunkTruthHaplotypesPartitionFile = stString_print("%s.truthHaplotypesPartition.tsv", outputBase);
         st_logCritical("> Writing truth haplotype partitioning to %s\n", chunkTruthHaplotypesPartitionFile);
         chunkTruthHaplotypes_print(allReadIdsHap1, allReadIdsHap2, bamChunker->chunks, bamChunker->chunkCount,
@@ -967,15 +1135,34 @@ int polish_main(int argc, char *argv[]) {
         free(chunkTruthHaplotypesPartitionFile);
     }
 
+    // the run is complete, so the journals are no longer needed, unless this is a shard yet to be stitched
+    if (chunkJournalFile != NULL) {
+        if (shardCount == 0) {
+            st_logInfo("> Removing chunk journal %s\n", chunkJournalFile);
+            remove(chunkJournalFile);
+        }
+        free(chunkJournalFile);
+    }
+    for (int64_t i = 0; i < stList_length(shardJournalFiles); i++) {
+        st_logInfo("> Removing shard chunk journal %s\n", (char *) stList_get(shardJournalFiles, i));
+        remove(stList_get(shardJournalFiles, i));
+    }
+    stList_destruct(shardJournalFiles);
+
     // Cleanup
     if (partitionTruthSequences) {
         chunkTruthHaplotypes_destruct(chunkTruthHaplotypesArray, bamChunker->chunkCount);
         bamChunker_destruct(truthHaplotypesBamChunker);
     }
     bamChunker_destruct(bamChunker);
+    referenceCache_destruct();
+    htsThreadPool_destruct();
     params_destruct(params);
     if (trueReferenceBam != NULL) free(trueReferenceBam);
     if (regionStr != NULL) free(regionStr);
+    if (bedFile != NULL) free(bedFile);
+    if (previousChunkJournalFile != NULL) free(previousChunkJournalFile);
+    if (chunkCacheDirectory != NULL) free(chunkCacheDirectory);
 #ifdef _HDF5
     if (helenHDF5Files != NULL) {
         for (int64_t i = 0; i < numThreads; i++) {
@@ -997,8 +1184,10 @@ int polish_main(int argc, char *argv[]) {
     if (allReadIdsHap2 != NULL) stList_destruct(allReadIdsHap2);
     free(outputBase);
     free(bamInFile);
+    stList_destruct(secondaryBamInFiles);
     free(referenceFastaFile);
     free(paramsFile);
+    traceRecorder_finish();
 
     // log completion
     char *timeDescriptor = getTimeDescriptorFromSeconds(time(NULL) - startTime);
@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2020 by Benedict Paten (benedictpaten@gmail.com)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "margin.h"
+
+void replay_usage() {
+    fprintf(stderr, "usage: margin replay <BUNDLE> <PARAMS> [options]\n");
+    fprintf(stderr, "Reruns the chunk whose inputs were written to BUNDLE by polish --replayBundleSeconds or\n");
+    fprintf(stderr, "--replayBundleCells, on its own, such as under a profiler.\n");
+    fprintf(stderr, "    The chunk is downsampled, polished and, if it was phased, phased as polish does, with the\n");
+    fprintf(stderr, "    parameters in PARAMS, which should be those the chunk was run with.\n");
+    fprintf(stderr, "    The chunk's telemetry, the time and counts of its work, is written to stdout as a line of JSON\n");
+    fprintf(stderr, "    for each time it is run.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "    -h --help                : Print this help screen\n");
+    fprintf(stderr, "    -a --logLevel            : Set the log level [default = info]\n");
+    fprintf(stderr, "    -n --repeats             : Run the chunk this many times [default = 1]\n");
+    fprintf(stderr, "    -o --outputBase          : Write the chunk's polished sequence, as polish outputs it, to\n");
+    fprintf(stderr, "                                 OUTPUT_BASE.fa (OUTPUT_BASE.fa.hap1 and .hap2 if phased)\n");
+    fprintf(stderr, "\n");
+}
+
+int replay_main(int argc, char *argv[]) {
+    char *logLevelString = stString_copy("info");
+    char *outputBase = NULL;
+    int64_t repeats = 1;
+
+    if (argc < 3) {
+        free(logLevelString);
+        replay_usage();
+        return 1;
+    }
+    char *bundleFile = argv[1];
+    char *paramsFile = argv[2];
+
+    // Parse the options
+    while (1) {
+        static struct option long_options[] = {
+                { "help", no_argument, 0, 'h' },
+                { "logLevel", required_argument, 0, 'a' },
+                { "repeats", required_argument, 0, 'n' },
+                { "outputBase", required_argument, 0, 'o' },
+                { 0, 0, 0, 0 } };
+
+        int option_index = 0;
+        int key = getopt_long(argc - 2, &argv[2], "ha:n:o:", long_options, &option_index);
+
+        if (key == -1) {
+            break;
+        }
+
+        switch (key) {
+        case 'a':
+            free(logLevelString);
+            logLevelString = stString_copy(optarg);
+            break;
+        case 'n':
+            repeats = atoll(optarg);
+            if (repeats < 1) {
+                st_errAbort("Invalid repeats: %s", optarg);
+            }
+            break;
+        case 'o':
+            if (outputBase != NULL) free(outputBase);
+            outputBase = stString_copy(optarg);
+            break;
+        case 'h':
+            replay_usage();
+            free(logLevelString);
+            if (outputBase != NULL) free(outputBase);
+            return 0;
+        default:
+            replay_usage();
+            free(logLevelString);
+            if (outputBase != NULL) free(outputBase);
+            return 1;
+        }
+    }
+    st_setLogLevelFromString(logLevelString);
+    free(logLevelString);
+
+    // the parameters, which the bundle records the fingerprint of
+    st_logCritical("> Parsing model parameters from file: %s\n", paramsFile);
+    Params *params = params_readParams(paramsFile);
+
+    for (int64_t run = 0; run < repeats; run++) {
+        // the bundle is read again for each run, as the chunk's reads are consumed by it
+        ChunkReplay *replay = chunkReplay_read(bundleFile, params->polishParams);
+        BamChunk *bamChunk = replay->bamChunk;
+        if (run == 0) {
+            st_logCritical("> Replaying chunk %" PRId64 " of %s:%" PRId64 "-%" PRId64 " with %" PRId64 " reads (%"
+                           PRId64 " filtered)%s\n", bamChunk->chunkIdx, bamChunk->refSeqName,
+                           bamChunk->chunkStart, bamChunk->chunkEnd, stList_length(replay->chunkReads->reads),
+                           stList_length(replay->chunkReads->filteredReads), replay->diploid ? ", phased" : "");
+            if (replay->paramsFingerprint != params->fingerprint) {
+                st_logCritical("> WARNING: %s differs from the parameters the chunk was run with\n", paramsFile);
+            }
+        }
+
+        // run the chunk as polish does, recording its telemetry, its sequence only being kept by the last run
+        if (params->polishParams->useChunkArena) {
+            chunkArena_open();
+        }
+        char *outputSequenceFile = outputBase != NULL && run + 1 == repeats ?
+                                   stString_print("%s.fa", outputBase) : NULL;
+        OutputChunkers *outputChunkers = outputChunkers_construct(1, params, outputSequenceFile, NULL, NULL, NULL,
+                                                                  replay->diploid ? ".hap1" : "",
+                                                                  replay->diploid ? ".hap2" : NULL, TRUE);
+        PolishChunkSettings settings = { 0 };
+        settings.diploid = replay->diploid;
+        settings.partitionFilteredReads = replay->partitionFilteredReads;
+        settings.outputFasta = TRUE;
+        char *logIdentifier = stString_copy("");
+        chunkTelemetry_start(bamChunk);
+        BamChunkReads *chunkReads = replay->chunkReads;
+        replay->chunkReads = NULL;
+        // the chunk is the only chunk of the replay's chunker
+        int64_t totalNucleotides;
+        polishChunk(bamChunk, 0, chunkReads, replay->maxDepth, &settings, outputChunkers, 0, params, logIdentifier,
+                    &totalNucleotides);
+        double wallTime;
+        int64_t counts[CTC_COUNTS];
+        chunkTelemetry_getProgress(&wallTime, counts);
+        chunkTelemetry_finish(stdout);
+        st_logCritical("> Run %" PRId64 " of the chunk took %.3f sec\n", run + 1, wallTime);
+
+        if (outputSequenceFile != NULL) {
+            st_logCritical("> Writing the chunk's polished sequence to %s\n", outputSequenceFile);
+            outputChunkers_stitch(outputChunkers, replay->diploid, 1);
+            free(outputSequenceFile);
+        } else {
+            outputChunkers_discardOutput(outputChunkers);
+        }
+        outputChunkers_destruct(outputChunkers);
+        free(logIdentifier);
+        if (params->polishParams->useChunkArena) {
+            chunkArena_close();
+        }
+        dpArena_clear();
+        chunkReplay_destruct(replay);
+    }
+
+    // Cleanup
+    params_destruct(params);
+    if (outputBase != NULL) free(outputBase);
+    return 0;
+}
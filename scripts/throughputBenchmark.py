@@ -0,0 +1,204 @@
+#!/usr/bin/env python3
+"""
+Runs margin polish and margin phase on pinned regions at 1, 2, 4, ... threads, reporting chunks/s, bases/s, parallel
+efficiency and peak RSS, and optionally compares the throughput against a baseline report.
+
+Run from the build directory:
+    ../scripts/throughputBenchmark.py --output throughput.json
+    ../scripts/throughputBenchmark.py --baseline throughput.json --tolerance 0.1
+
+Exits with status 1 if any run is slower than the baseline by more than the tolerance.
+"""
+
+import argparse
+import json
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+SCRIPT_DIR = os.path.dirname(os.path.abspath(__file__))
+REPO_DIR = os.path.dirname(SCRIPT_DIR)
+
+REAL_DATA = os.path.join(REPO_DIR, "tests", "data", "realData")
+ONT_PARAMS = os.path.join(REPO_DIR, "params", "ont", "r9.4", "allParams.np.human.r94-g360.json")
+HIFI_PARAMS = os.path.join(REPO_DIR, "params", "pacbio", "hifi", "allParams.hifi.json")
+
+# The canned datasets. The repo only ships ONT reads, so the HiFi parameter set is timed on them too: the throughput
+# reflects its models and settings, not HiFi reads. Pass --datasets to time other data.
+DATASETS = [
+    {"name": "ont_r9.4_polish", "tool": "polish",
+     "bam": os.path.join(REAL_DATA, "HG002.r94g360.chr20_59M_100k.bam"),
+     "reference": os.path.join(REAL_DATA, "hg38.chr20_59M_100k.fa"),
+     "params": ONT_PARAMS, "region": "chr20:1-60000"},
+    {"name": "ont_r9.4_phase", "tool": "phase",
+     "bam": os.path.join(REAL_DATA, "HG002.r94g360.chr20_59M_100k.bam"),
+     "reference": os.path.join(REAL_DATA, "hg38.chr20_59M_100k.fa"),
+     "vcf": os.path.join(REAL_DATA, "HG002.r94g360.chr20_59M_100k.vcf"),
+     "params": ONT_PARAMS, "region": "chr20:1-100000"},
+    {"name": "hifi_polish", "tool": "polish",
+     "bam": os.path.join(REAL_DATA, "HG002.r94g360.chr20_59M_100k.bam"),
+     "reference": os.path.join(REAL_DATA, "hg38.chr20_59M_100k.fa"),
+     "params": HIFI_PARAMS, "region": "chr20:1-60000"},
+    {"name": "hifi_phase", "tool": "phase",
+     "bam": os.path.join(REAL_DATA, "HG002.r94g360.chr20_59M_100k.bam"),
+     "reference": os.path.join(REAL_DATA, "hg38.chr20_59M_100k.fa"),
+     "vcf": os.path.join(REAL_DATA, "HG002.r94g360.chr20_59M_100k.vcf"),
+     "params": HIFI_PARAMS, "region": "chr20:1-100000"},
+]
+
+# The regions are small, so the chunks are made small too, to give the threads enough chunks to share
+CHUNK_SIZE = 5000
+CHUNK_BOUNDARY = 500
+
+
+def region_length(region):
+    start, end = region.split(":")[1].split("-")
+    return int(end) - int(start) + 1
+
+
+def thread_counts(max_threads):
+    counts = []
+    t = 1
+    while t < max_threads:
+        counts.append(t)
+        t *= 2
+    counts.append(max_threads)
+    return counts
+
+
+def write_chunked_params(params, work_dir):
+    """ Writes params that include the given params, overriding the chunking. """
+    chunked_params = os.path.join(work_dir, "params.json")
+    with open(chunked_params, "w") as fh:
+        json.dump({"include": os.path.abspath(params),
+                   "polish": {"chunkSize": CHUNK_SIZE, "chunkBoundary": CHUNK_BOUNDARY}}, fh)
+    return chunked_params
+
+
+def run_margin(margin, dataset, params, threads, work_dir):
+    """ Runs margin once, returning the wall time in seconds, the peak RSS in bytes and the number of chunks. """
+    output_base = os.path.join(work_dir, "out")
+    inputs = [dataset["bam"], dataset["reference"]]
+    if dataset["tool"] == "phase":
+        inputs.append(dataset["vcf"])
+    command = [margin, dataset["tool"]] + inputs + [params, "--threads", str(threads), "--region", dataset["region"],
+                                                    "--outputBase", output_base, "--logLevel", "critical",
+                                                    "--chunkTelemetry"]
+    with open(os.path.join(work_dir, "log.txt"), "w") as log:
+        start = time.time()
+        process = subprocess.Popen(command, stdout=log, stderr=subprocess.STDOUT)
+        _, status, rusage = os.wait4(process.pid, 0)
+        wall_time = time.time() - start
+    if status != 0:
+        raise RuntimeError("Command failed with status %d, see %s: %s" %
+                           (status, os.path.join(work_dir, "log.txt"), " ".join(command)))
+
+    # ru_maxrss is in kilobytes on linux, bytes on macos
+    peak_rss = rusage.ru_maxrss if sys.platform == "darwin" else rusage.ru_maxrss * 1024
+    with open(output_base + ".chunkTelemetry.jsonl") as fh:
+        chunks = sum(1 for line in fh if line.strip())
+    return wall_time, peak_rss, chunks
+
+
+def benchmark_dataset(margin, dataset, threads_list, repeats, keep):
+    work_dir = tempfile.mkdtemp(prefix="margin_throughput_")
+    try:
+        params = write_chunked_params(dataset["params"], work_dir)
+        bases = region_length(dataset["region"])
+        runs = []
+        for threads in threads_list:
+            # the fastest of the repeats, which is the least disturbed by the rest of the machine
+            best = None
+            for _ in range(repeats):
+                result = run_margin(margin, dataset, params, threads, work_dir)
+                if best is None or result[0] < best[0]:
+                    best = result
+            wall_time, peak_rss, chunks = best
+            runs.append({"threads": threads, "wallTime": wall_time, "chunks": chunks,
+                         "chunksPerSecond": chunks / wall_time, "basesPerSecond": bases / wall_time,
+                         "peakRss": peak_rss})
+            sys.stderr.write("%-20s %3d threads: %8.2fs %8.2f chunks/s %10.0f bases/s %8.1f MB\n" %
+                             (dataset["name"], threads, wall_time, chunks / wall_time, bases / wall_time,
+                              peak_rss / 1.0e6))
+        for run in runs:
+            run["parallelEfficiency"] = runs[0]["wallTime"] / (run["wallTime"] * run["threads"] / runs[0]["threads"])
+        return {"name": dataset["name"], "tool": dataset["tool"], "region": dataset["region"], "bases": bases,
+                "params": os.path.relpath(dataset["params"], REPO_DIR), "runs": runs}
+    finally:
+        if keep:
+            sys.stderr.write("Kept outputs of %s in %s\n" % (dataset["name"], work_dir))
+        else:
+            shutil.rmtree(work_dir)
+
+
+def compare_to_baseline(report, baseline, tolerance):
+    """ Prints the change in chunks/s of each run also in the baseline, returning the runs slower than tolerated. """
+    baseline_runs = {(d["name"], r["threads"]): r for d in baseline["datasets"] for r in d["runs"]}
+    regressions = []
+    for dataset in report["datasets"]:
+        for run in dataset["runs"]:
+            baseline_run = baseline_runs.get((dataset["name"], run["threads"]))
+            if baseline_run is None:
+                continue
+            change = run["chunksPerSecond"] / baseline_run["chunksPerSecond"] - 1.0
+            sys.stderr.write("%-20s %3d threads: %+6.1f%% chunks/s against the baseline\n" %
+                             (dataset["name"], run["threads"], 100.0 * change))
+            if change < -tolerance:
+                regressions.append((dataset["name"], run["threads"], change))
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--margin", default="./margin", help="The margin executable [default: ./margin]")
+    parser.add_argument("--maxThreads", type=int, default=os.cpu_count(),
+                        help="Time 1, 2, 4, ... up to this many threads [default: the cpu count]")
+    parser.add_argument("--repeats", type=int, default=1, help="Runs of each thread count, the fastest kept")
+    parser.add_argument("--datasets", help="JSON list of datasets to use instead of the canned ones, with the keys "
+                                           "name, tool (polish or phase), bam, reference, vcf (for phase), params "
+                                           "and region")
+    parser.add_argument("--only", help="Only time the datasets whose names contain this")
+    parser.add_argument("--output", help="Write the report to this JSON file [default: stdout]")
+    parser.add_argument("--baseline", help="A report to compare chunks/s against")
+    parser.add_argument("--tolerance", type=float, default=0.1,
+                        help="Fraction by which chunks/s may drop below the baseline [default: 0.1]")
+    parser.add_argument("--keep", action="store_true", help="Keep the outputs of the runs")
+    args = parser.parse_args()
+
+    datasets = DATASETS
+    if args.datasets is not None:
+        with open(args.datasets) as fh:
+            datasets = json.load(fh)
+    if args.only is not None:
+        datasets = [d for d in datasets if args.only in d["name"]]
+
+    threads_list = thread_counts(max(1, args.maxThreads))
+    margin = os.path.abspath(args.margin)
+    report = {"margin": subprocess.run([margin, "version"], stdout=subprocess.PIPE,
+                                       stderr=subprocess.STDOUT).stdout.decode().strip(),
+              "chunkSize": CHUNK_SIZE, "chunkBoundary": CHUNK_BOUNDARY,
+              "datasets": [benchmark_dataset(margin, d, threads_list, args.repeats, args.keep) for d in datasets]}
+
+    if args.output is None:
+        json.dump(report, sys.stdout, indent=2)
+        sys.stdout.write("\n")
+    else:
+        with open(args.output, "w") as fh:
+            json.dump(report, fh, indent=2)
+
+    if args.baseline is not None:
+        with open(args.baseline) as fh:
+            baseline = json.load(fh)
+        regressions = compare_to_baseline(report, baseline, args.tolerance)
+        for name, threads, change in regressions:
+            sys.stderr.write("Regression: %s at %d threads is %.1f%% slower than the baseline\n" %
+                             (name, threads, -100.0 * change))
+        if len(regressions) > 0:
+            sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,362 @@
+/*
+ * Copyright (C) 2020 by Benedict Paten (benedictpaten@gmail.com)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "margin.h"
+
+int polish_main(int argc, char *argv[]);
+int phase_main(int argc, char *argv[]);
+
+#define SERVE_MAX_REQUEST_ARGS 256
+
+void serve_usage() {
+    fprintf(stderr, "usage: margin serve <PARAMS>\n");
+    fprintf(stderr, "Serves polish, phase and haplotag requests read from stdin, one per line, keeping the parameters\n");
+    fprintf(stderr, "in PARAMS, and the bam index, reference contig and parsed variants of the last request, loaded\n");
+    fprintf(stderr, "between requests.\n");
+    fprintf(stderr, "    Each request is a margin command line without 'margin', its arguments separated by whitespace\n");
+    fprintf(stderr, "    and its positional arguments first, e.g.\n");
+    fprintf(stderr, "        polish ALIGN_BAM REFERENCE_FASTA PARAMS -r chr3:2000-3000 -o out\n");
+    fprintf(stderr, "        phase ALIGN_BAM REFERENCE_FASTA VARIANT_VCF PARAMS -r chr3:2000-3000 -o out\n");
+    fprintf(stderr, "    A haplotag request takes the arguments of phase, and writes only the haplotagged bam.\n");
+    fprintf(stderr, "    Kept are:\n");
+    fprintf(stderr, "        the index of ALIGN_BAM, if it is a bam file,\n");
+    fprintf(stderr, "        the sequence of the contig of the request's region in REFERENCE_FASTA,\n");
+    fprintf(stderr, "        the variants of VARIANT_VCF in the request's region, if the request names PARAMS.\n");
+    fprintf(stderr, "    Each is loaded again when a request names another file or region, or its file is modified.\n");
+    fprintf(stderr, "    Each request is run in its own process, so a failed request does not stop the server. When it\n");
+    fprintf(stderr, "    completes a line of its exit status, the length in bytes of its result and the request, tab\n");
+    fprintf(stderr, "    separated, is written to stdout, followed by the result: the polished fasta (haplotype 1 then\n");
+    fprintf(stderr, "    haplotype 2 if diploid) of a polish request, the phased vcf of a phase request and the\n");
+    fprintf(stderr, "    haplotagged bam of a haplotag request, as written to the request's OUTPUT_BASE, whose earlier\n");
+    fprintf(stderr, "    result files are removed before it is run. A failed request has no result. The request's log\n");
+    fprintf(stderr, "    is written to stderr.\n");
+    fprintf(stderr, "\n");
+}
+
+/*
+ * A file loaded by the server, with the region or contig it was loaded for and when it was modified, so it is loaded
+ * again if it changes.
+ */
+typedef struct _servedFile {
+    char *file;
+    char *key;
+    struct timespec modified;
+} ServedFile;
+
+static bool serve_stringsEqual(char *string1, char *string2) {
+    return string1 == NULL ? string2 == NULL : string2 != NULL && strcmp(string1, string2) == 0;
+}
+
+static bool servedFile_update(ServedFile *servedFile, char *file, char *key) {
+    /*
+     * Returns TRUE if the file (for the key) is not the one loaded or has been modified since it was, recording it as
+     * loaded. A file that cannot be read is not loaded, so the request reports it.
+     */
+    struct stat st;
+    if (access(file, R_OK) != 0 || stat(file, &st) != 0) {
+        return FALSE;
+    }
+    if (serve_stringsEqual(servedFile->file, file) && serve_stringsEqual(servedFile->key, key) &&
+            servedFile->modified.tv_sec == st.st_mtim.tv_sec && servedFile->modified.tv_nsec == st.st_mtim.tv_nsec) {
+        return FALSE;
+    }
+    free(servedFile->file);
+    free(servedFile->key);
+    servedFile->file = stString_copy(file);
+    servedFile->key = key == NULL ? NULL : stString_copy(key);
+    servedFile->modified = st.st_mtim;
+    return TRUE;
+}
+
+static void servedFile_forget(ServedFile *servedFile) {
+    free(servedFile->file);
+    free(servedFile->key);
+    servedFile->file = NULL;
+    servedFile->key = NULL;
+}
+
+static char *serve_getOption(int argc, char **argv, char *shortOption, char *longOption) {
+    /*
+     * Gets the value of the last of the option's occurrences in the request, as getopt_long would, or NULL.
+     */
+    char *value = NULL;
+    int64_t longOptionLength = strlen(longOption);
+    for (int i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], shortOption) == 0 || strcmp(argv[i], longOption) == 0) && i + 1 < argc) {
+            value = argv[++i];
+        } else if (strncmp(argv[i], longOption, longOptionLength) == 0 && argv[i][longOptionLength] == '=') {
+            value = argv[i] + longOptionLength + 1;
+        } else if (strncmp(argv[i], shortOption, 2) == 0 && argv[i][2] != '\0') {
+            value = argv[i] + 2;
+        }
+    }
+    return value;
+}
+
+static bool serve_isValidRegion(char *regionStr) {
+    // as checked by parseVcf2, which would stop the server on a malformed region
+    char regionContig[128] = "";
+    int regionStart = 0;
+    int regionEnd = 0;
+    int scanRet = sscanf(regionStr, "%127[^:]:%d-%d", regionContig, &regionStart, &regionEnd);
+    return scanRet == 1 || (scanRet == 3 && regionStart >= 0 && regionEnd >= regionStart);
+}
+
+static void serve_keepRequestFiles(int argc, char **argv, bool hasVcf, char *paramsFile, ServedFile *servedFiles) {
+    /*
+     * Loads the bam index, reference contig and variants the request uses, unless they are already loaded, for the
+     * request's process to find. servedFiles are those of the bam, reference and vcf.
+     */
+    int positionalArgs = 1;
+    while (positionalArgs < argc && argv[positionalArgs][0] != '-') {
+        positionalArgs++;
+    }
+    if (positionalArgs < (hasVcf ? 5 : 4)) {
+        return;
+    }
+    char *bamFile = argv[1];
+    char *referenceFastaFile = argv[2];
+    char *vcfFile = hasVcf ? argv[3] : NULL;
+    char *requestParamsFile = argv[hasVcf ? 4 : 3];
+    char *regionStr = serve_getOption(argc, argv, "-r", "--region");
+    if (regionStr != NULL && !serve_isValidRegion(regionStr)) {
+        return;
+    }
+
+    if (servedFile_update(&servedFiles[0], bamFile, NULL)) {
+        st_logCritical("> Loading the index of bam file: %s\n", bamFile);
+        bamIndex_keepIndex(bamFile);
+    }
+
+    // without a region the reference is read as for any other command
+    if (regionStr != NULL) {
+        char *contig = stString_copy(regionStr);
+        char *colon = strchr(contig, ':');
+        if (colon != NULL) *colon = '\0';
+        if (servedFile_update(&servedFiles[1], referenceFastaFile, contig)) {
+            st_logCritical("> Loading contig %s of reference: %s\n", contig, referenceFastaFile);
+            referenceCache_keepContig(referenceFastaFile, contig);
+        }
+        free(contig);
+    }
+
+    // the variants are parsed with the kept params, which only a request naming the same params file is handed
+    Params *params = params_getKeptParams(paramsFile);
+    if (vcfFile != NULL && params != NULL && stString_eq(requestParamsFile, paramsFile) &&
+            servedFile_update(&servedFiles[2], vcfFile, regionStr)) {
+        st_logCritical("> Parsing variants from VCF: %s\n", vcfFile);
+        vcf_keepParsedVcf(vcfFile, regionStr, params);
+    }
+}
+
+static void serve_removeResultFiles(char *outputBase, char **resultSuffixes) {
+    /*
+     * Removes the result files left at the output base by an earlier run, so those that exist after the request
+     * completes are the ones it wrote, however coarse the file system's modification times.
+     */
+    for (int64_t i = 0; resultSuffixes[i] != NULL; i++) {
+        char *resultFile = stString_print("%s%s", outputBase, resultSuffixes[i]);
+        if (unlink(resultFile) != 0 && errno != ENOENT) {
+            st_logCritical("> Could not remove the earlier result file: %s\n", resultFile);
+        }
+        free(resultFile);
+    }
+}
+
+static bool serve_isResultFile(char *resultFile, int64_t *length) {
+    /*
+     * Returns if the file was written by the request, as it exists, getting its length.
+     */
+    struct stat st;
+    if (stat(resultFile, &st) != 0) {
+        return FALSE;
+    }
+    *length = st.st_size;
+    return TRUE;
+}
+
+static int64_t serve_getResultLength(char *outputBase, char **resultSuffixes) {
+    /*
+     * Gets the total length of the result files of the request.
+     */
+    int64_t length = 0;
+    for (int64_t i = 0; resultSuffixes[i] != NULL; i++) {
+        char *resultFile = stString_print("%s%s", outputBase, resultSuffixes[i]);
+        int64_t fileLength;
+        if (serve_isResultFile(resultFile, &fileLength)) {
+            length += fileLength;
+        }
+        free(resultFile);
+    }
+    return length;
+}
+
+static void serve_writeResult(char *outputBase, char **resultSuffixes, FILE *out) {
+    char buffer[65536];
+    for (int64_t i = 0; resultSuffixes[i] != NULL; i++) {
+        char *resultFile = stString_print("%s%s", outputBase, resultSuffixes[i]);
+        int64_t fileLength;
+        if (serve_isResultFile(resultFile, &fileLength)) {
+            FILE *fh = fopen(resultFile, "rb");
+            if (fh == NULL) {
+                st_errAbort("Could not read result file: %s\n", resultFile);
+            }
+            size_t readLength;
+            while ((readLength = fread(buffer, 1, sizeof(buffer), fh)) > 0) {
+                fwrite(buffer, 1, readLength, out);
+            }
+            fclose(fh);
+        }
+        free(resultFile);
+    }
+}
+
+static int serve_runRequest(char *request, char *paramsFile, ServedFile *servedFiles) {
+    /*
+     * Runs the request in a child process, writing its response to stdout, and returns its exit status.
+     */
+    static char *polishResultSuffixes[] = {".fa", ".fa.gz", ".fa.hap1", ".fa.hap1.gz", ".fa.hap2", ".fa.hap2.gz",
+                                           NULL};
+    static char *phaseResultSuffixes[] = {".phased.vcf", ".phased.vcf.gz", NULL};
+    static char *haplotagResultSuffixes[] = {".haplotagged.bam", NULL};
+    static char *noResultSuffixes[] = {NULL};
+
+    char *requestCopy = stString_copy(request);
+    char *argv[SERVE_MAX_REQUEST_ARGS + 2];
+    int argc = 0;
+    char *savePtr = NULL;
+    int status = 0;
+    for (char *arg = strtok_r(requestCopy, " \t\r", &savePtr); arg != NULL; arg = strtok_r(NULL, " \t\r", &savePtr)) {
+        if (argc == SERVE_MAX_REQUEST_ARGS) {
+            st_logCritical("> Request has more than %d arguments: %s\n", SERVE_MAX_REQUEST_ARGS, request);
+            status = 1;
+            break;
+        }
+        argv[argc++] = arg;
+    }
+    argv[argc] = NULL;
+
+    int (*command_main)(int, char **) = NULL;
+    char **resultSuffixes = noResultSuffixes;
+    if (status != 0) {
+        // the request was not read
+    } else if (argc > 0 && strcmp(argv[0], "polish") == 0) {
+        command_main = polish_main;
+        resultSuffixes = polishResultSuffixes;
+        serve_keepRequestFiles(argc, argv, FALSE, paramsFile, servedFiles);
+    } else if (argc > 0 && strcmp(argv[0], "phase") == 0) {
+        command_main = phase_main;
+        resultSuffixes = phaseResultSuffixes;
+        serve_keepRequestFiles(argc, argv, TRUE, paramsFile, servedFiles);
+    } else if (argc > 0 && strcmp(argv[0], "haplotag") == 0) {
+        // a phase that only writes the haplotagged bam
+        command_main = phase_main;
+        resultSuffixes = haplotagResultSuffixes;
+        argv[argc++] = "--skipPhasedVCF";
+        argv[argc] = NULL;
+        serve_keepRequestFiles(argc, argv, TRUE, paramsFile, servedFiles);
+    } else {
+        st_logCritical("> Unrecognized request, expected a polish, phase or haplotag command: %s\n", request);
+        status = 1;
+    }
+
+    // the request's result files are written to its output base
+    char *outputBase = serve_getOption(argc, argv, "-o", "--outputBase");
+    outputBase = outputBase == NULL ? stString_copy("output") : stString_copy(outputBase);
+    struct stat st;
+    if (stat(outputBase, &st) == 0 && S_ISDIR(st.st_mode)) {
+        // as by getFileBase
+        if (outputBase[strlen(outputBase) - 1] == '/') outputBase[strlen(outputBase) - 1] = '\0';
+        char *directoryOutputBase = stString_print("%s/output", outputBase);
+        free(outputBase);
+        outputBase = directoryOutputBase;
+    }
+    if (command_main != NULL) {
+        serve_removeResultFiles(outputBase, resultSuffixes);
+
+        // the child has all the server has loaded, and anything it leaves behind is cleaned up as it exits
+        fflush(stdout);
+        fflush(stderr);
+        pid_t pid = fork();
+        if (pid < 0) {
+            st_logCritical("> Could not fork to run request: %s\n", request);
+            status = 1;
+        } else if (pid == 0) {
+            // stdout is for the server's responses
+            dup2(STDERR_FILENO, STDOUT_FILENO);
+            int childStatus = command_main(argc, argv);
+            fflush(NULL);
+            _exit(childStatus);
+        } else {
+            while (waitpid(pid, &status, 0) < 0) {
+                if (errno != EINTR) {
+                    st_errAbort("Could not wait for the request to complete: %s\n", request);
+                }
+            }
+            status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+        }
+    }
+
+    // respond, with the result files if the request succeeded
+    if (status != 0) {
+        resultSuffixes = noResultSuffixes;
+    }
+    fprintf(stdout, "%d\t%"PRId64"\t%s\n", status, serve_getResultLength(outputBase, resultSuffixes), request);
+    serve_writeResult(outputBase, resultSuffixes, stdout);
+    fflush(stdout);
+
+    free(outputBase);
+    free(requestCopy);
+    return status;
+}
+
+int serve_main(int argc, char *argv[]) {
+    if (argc != 2 || strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0) {
+        serve_usage();
+        return argc != 2 ? 1 : 0;
+    }
+    char *paramsFile = argv[1];
+    if (access(paramsFile, R_OK) != 0) {
+        st_errAbort("Could not read from params file: %s\n", paramsFile);
+    }
+
+    // the loaded params, and the bam, reference and vcf of the last requests
+    ServedFile servedParams = {NULL, NULL, {0, 0}};
+    ServedFile servedFiles[3] = {{NULL, NULL, {0, 0}}, {NULL, NULL, {0, 0}}, {NULL, NULL, {0, 0}}};
+
+    char *request;
+    while ((request = stFile_getLineFromFile(stdin)) != NULL) {
+        if (request[strspn(request, " \t\r")] == '\0') {
+            free(request);
+            continue;
+        }
+
+        if (servedFile_update(&servedParams, paramsFile, NULL)) {
+            st_logCritical("> Parsing model parameters from file: %s\n", paramsFile);
+            params_keepParams(paramsFile);
+            // the variants were parsed with the replaced params
+            servedFile_forget(&servedFiles[2]);
+        }
+
+        serve_runRequest(request, paramsFile, servedFiles);
+        free(request);
+    }
+
+    servedFile_forget(&servedParams);
+    for (int64_t i = 0; i < 3; i++) {
+        servedFile_forget(&servedFiles[i]);
+    }
+    return 0;
+}
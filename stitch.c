@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2020 by Benedict Paten (benedictpaten@gmail.com)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int polish_main(int argc, char *argv[]);
+int phase_main(int argc, char *argv[]);
+
+void stitch_usage() {
+    fprintf(stderr, "usage: margin stitch <polish|phase> <SHARD_COUNT> <ARGUMENTS> [options]\n");
+    fprintf(stderr, "Stitches the chunks journaled by the SHARD_COUNT shards of a polish or phase run (each run with\n");
+    fprintf(stderr, "--shard i/SHARD_COUNT) into the run's final output.\n");
+    fprintf(stderr, "    ARGUMENTS and options are those the shards were run with, without --shard.\n");
+    fprintf(stderr, "    The shards' journals, OUTPUT_BASE.shard<i>of<SHARD_COUNT>.chunkJournal, are removed once stitched.\n");
+    fprintf(stderr, "\n");
+}
+
+int stitch_main(int argc, char *argv[]) {
+    if (argc < 3 || strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0) {
+        stitch_usage();
+        return argc < 3 ? 1 : 0;
+    }
+    int (*command_main)(int, char **);
+    if (strcmp(argv[1], "polish") == 0) {
+        command_main = polish_main;
+    } else if (strcmp(argv[1], "phase") == 0) {
+        command_main = phase_main;
+    } else {
+        stitch_usage();
+        fprintf(stderr, "unrecognized command '%s'\n", argv[1]);
+        return 1;
+    }
+    if (atoi(argv[2]) <= 0) {
+        stitch_usage();
+        fprintf(stderr, "invalid shard count '%s'\n", argv[2]);
+        return 1;
+    }
+
+    // run the command with the shards' arguments, stitching the shards rather than processing chunks
+    int commandArgc = argc;
+    char **commandArgv = malloc((commandArgc + 1) * sizeof(char *));
+    commandArgv[0] = argv[1];
+    for (int i = 3; i < argc; i++) {
+        commandArgv[i - 2] = argv[i];
+    }
+    commandArgv[argc - 2] = "--stitchShards";
+    commandArgv[argc - 1] = argv[2];
+    commandArgv[argc] = NULL;
+    int status = command_main(commandArgc, commandArgv);
+    free(commandArgv);
+    return status;
+}
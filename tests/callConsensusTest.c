@@ -23,7 +23,7 @@ void getCallConsensusDataFromReads(char *rawReads[], int readCount, char **rleRe
         (*rleReads)[i] = stString_copy(rleString->rleString);
         (*rleCounts)[i] = st_calloc(rleString->length, sizeof(uint8_t));
         for (int j = 0; j < rleString->length; j++) {
-            ((*rleCounts)[i])[j] = (uint8_t) rleString->repeatCounts[j];
+            ((*rleCounts)[i])[j] = (uint8_t) rleString_getRepeatCount(rleString, j);
         }
         (*strands)[i] = 0; //todo
 
@@ -56,6 +56,72 @@ static void test_getRegionChunker(CuTest *testCase) {
     bamChunker_destruct(chunker);
 }
 
+static int64_t countChunksStartingIn(BamChunker *chunker, int64_t start, int64_t end) {
+    int64_t count = 0;
+    for (int64_t i = 0; i < chunker->chunkCount; i++) {
+        BamChunk *chunk = bamChunker_getChunk(chunker, i);
+        if (chunk->chunkStart >= start && chunk->chunkStart < end) count++;
+    }
+    return count;
+}
+
+static void test_getAdaptiveChunks(CuTest *testCase) {
+    /*
+     * Test that variable length chunks tile the region within the bounds on their length, and that a region dense with
+     * vcf sites is given more (so shorter) chunks than without the sites.
+     */
+    stHash *vcfEntries = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, free,
+                                           (void (*)(void *)) stList_destruct);
+    stList *contigVcfEntries = stList_construct3(0, (void (*)(void *)) vcfEntry_destruct);
+    for (int64_t pos = 150000; pos < 160000; pos += 10) {
+        stList_append(contigVcfEntries, vcfEntry_construct("contig_1", pos, pos, 60.0, NULL, 0, 1));
+    }
+    stHash_insert(vcfEntries, stString_copy("contig_1"), contigVcfEntries);
+
+    BamChunker *chunkers[2];
+    for (int64_t withSites = 0; withSites < 2; withSites++) {
+        PolishParams *params = getParameters(10000, 1000, FALSE);
+        params->adaptiveChunkSize = TRUE;
+        params->minChunkSize = 2000;
+        params->maxChunkSize = 40000;
+        params->chunkSiteWork = 1000;
+        BamChunker *chunker = bamChunker_construct3(INPUT_BAM, "contig_1:100000-300000", NULL,
+                                                    withSites ? vcfEntries : NULL, params, false);
+        CuAssertTrue(testCase, chunker->chunkCount > 0);
+        for (int64_t i = 0; i < chunker->chunkCount; i++) {
+            BamChunk *chunk = bamChunker_getChunk(chunker, i);
+            int64_t length = chunk->chunkEnd - chunk->chunkStart;
+            CuAssertTrue(testCase, length > 0 && length <= 40000);
+            if (i + 1 < chunker->chunkCount) {
+                CuAssertTrue(testCase, length >= 2000);
+                CuAssertIntEquals(testCase, chunk->chunkEnd, bamChunker_getChunk(chunker, i + 1)->chunkStart);
+            }
+            CuAssertTrue(testCase, chunk->chunkOverlapStart == (chunk->chunkStart - 1000 < 100000 ? 100000 :
+                                                                chunk->chunkStart - 1000));
+        }
+        CuAssertIntEquals(testCase, 100000, bamChunker_getChunk(chunker, 0)->chunkStart);
+        chunkers[withSites] = chunker;
+    }
+
+    // the sites only add work where there are reads
+    int64_t chunksWithoutSites = countChunksStartingIn(chunkers[0], 150000, 160000);
+    int64_t chunksWithSites = countChunksStartingIn(chunkers[1], 150000, 160000);
+    CuAssertTrue(testCase, chunksWithSites >= chunksWithoutSites);
+    for (int64_t i = 0; i < chunkers[1]->chunkCount; i++) {
+        BamChunk *chunk = bamChunker_getChunk(chunkers[1], i);
+        if (chunk->chunkStart >= 150000 && chunk->chunkEnd <= 160000 && chunk->estimatedDepth > 0) {
+            CuAssertTrue(testCase, chunksWithSites > chunksWithoutSites);
+            break;
+        }
+    }
+
+    for (int64_t withSites = 0; withSites < 2; withSites++) {
+        free(chunkers[withSites]->params);
+        bamChunker_destruct(chunkers[withSites]);
+    }
+    stHash_destruct(vcfEntries);
+}
+
 static void test_getChunksByChrom(CuTest *testCase) {
     BamChunker *chunker = bamChunker_construct(INPUT_BAM, getParameters(0, 0, FALSE));
     CuAssertTrue(testCase, chunker->chunkCount == 2);
@@ -73,6 +139,103 @@ static void test_getChunksBy100kb(CuTest *testCase) {
     bamChunker_destruct(chunker);
 }
 
+static void test_getChunksFromIndex(CuTest *testCase) {
+    // planned from the index in windows of the chunk size, without decoding the alignments, so the extents are
+    // only as fine as the index's bins
+    PolishParams *params = getParameters(100000, 0, FALSE);
+    params->estimateChunkDepthFromIndex = TRUE;
+    BamChunker *chunker = bamChunker_construct(INPUT_BAM, params);
+    CuAssertTrue(testCase, chunker->chunkCount > 0);
+    CuAssertTrue(testCase, chunker->readEnumerator == NULL);
+    BamChunk *chunk = bamChunker_getChunk(chunker, 0);
+    CuAssertStrEquals(testCase, "contig_1", chunk->refSeqName);
+    CuAssertTrue(testCase, chunk->chunkStart <= 100000);
+    CuAssertTrue(testCase, chunk->chunkEnd > 100000);
+    chunk = bamChunker_getChunk(chunker, chunker->chunkCount - 1);
+    CuAssertStrEquals(testCase, "contig_2", chunk->refSeqName);
+    free(chunker->params);
+    bamChunker_destruct(chunker);
+}
+
+static void test_getChunksFromDepthSummary(CuTest *testCase) {
+    // planned from the regions of non-zero depth in the summary, which match the alignments' extents
+    char *summaryFile = "chunkingTestDepthSummary.bed";
+    FILE *fh = safe_fopen(summaryFile, "w");
+    fprintf(fh, "contig_1\t0\t100000\t0\n");
+    fprintf(fh, "contig_1\t100000\t2100008\t30.5\n");
+    fprintf(fh, "contig_2\t100000\t100032\t4\n");
+    fprintf(fh, "contig_3\t0\t1000\t10\n");
+    fclose(fh);
+
+    PolishParams *params = getParameters(100000, 0, FALSE);
+    params->chunkDepthSummaryFile = stString_copy(summaryFile);
+    BamChunker *chunker = bamChunker_construct(INPUT_BAM, params);
+    CuAssertIntEquals(testCase, 22, chunker->chunkCount);
+    CuAssertTrue(testCase, chunker->readEnumerator == NULL);
+    BamChunk *chunk = bamChunker_getChunk(chunker, 0);
+    CuAssertStrEquals(testCase, "contig_1", chunk->refSeqName);
+    CuAssertIntEquals(testCase, 100000, chunk->chunkStart);
+    CuAssertIntEquals(testCase, 30, chunk->estimatedDepth);
+    chunk = bamChunker_getChunk(chunker, 21);
+    CuAssertStrEquals(testCase, "contig_2", chunk->refSeqName);
+    CuAssertIntEquals(testCase, 100032, chunk->chunkEnd);
+
+    free(params->chunkDepthSummaryFile);
+    free(chunker->params);
+    bamChunker_destruct(chunker);
+    remove(summaryFile);
+}
+
+static void test_getChunksFromBed(CuTest *testCase) {
+    // the intervals are flanked by the boundary, those whose flanks overlap merged, and clamped to the contig
+    char *bedFile = "chunkingTestIntervals.bed";
+    FILE *fh = safe_fopen(bedFile, "w");
+    fprintf(fh, "# intervals to polish\n");
+    fprintf(fh, "contig_1\t100\t110\n");
+    fprintf(fh, "contig_1\t26\t30\n");
+    fprintf(fh, "contig_1\t10\t20\n");
+    fprintf(fh, "contig_1\t138\t144\n");
+    fclose(fh);
+
+    PolishParams *params = getParameters(16, 4, FALSE);
+    BamChunker *chunker = bamChunker_constructFromBed(bedFile, INPUT_MVVP_REF, INPUT_MVVP_BAM, params);
+    CuAssertIntEquals(testCase, 5, chunker->chunkCount);
+    int64_t expected[5][4] = {{6, 6, 22, 26}, {18, 22, 34, 34}, {96, 96, 112, 114}, {108, 112, 114, 114},
+                              {134, 134, 144, 144}};
+    for (int64_t i = 0; i < chunker->chunkCount; i++) {
+        BamChunk *chunk = bamChunker_getChunk(chunker, i);
+        CuAssertStrEquals(testCase, "contig_1", chunk->refSeqName);
+        CuAssertIntEquals(testCase, expected[i][0], chunk->chunkOverlapStart);
+        CuAssertIntEquals(testCase, expected[i][1], chunk->chunkStart);
+        CuAssertIntEquals(testCase, expected[i][2], chunk->chunkEnd);
+        CuAssertIntEquals(testCase, expected[i][3], chunk->chunkOverlapEnd);
+    }
+
+    free(chunker->params);
+    bamChunker_destruct(chunker);
+    remove(bedFile);
+}
+
+static void test_chunkInputFingerprint(CuTest *testCase) {
+    // the fingerprint of a chunk's inputs is the same each time, and differs between chunks
+    PolishParams *params = getParameters(16, 4, FALSE);
+    BamChunker *chunker = bamChunker_constructFromFasta(INPUT_MVVP_REF, INPUT_MVVP_BAM, NULL, params);
+    CuAssertTrue(testCase, chunker->chunkCount > 1);
+    stSet *fingerprints = stSet_construct();
+    for (int64_t i = 0; i < chunker->chunkCount; i++) {
+        BamChunk *chunk = bamChunker_getChunk(chunker, i);
+        uint64_t fingerprint = bamChunk_getInputFingerprint(chunk, INPUT_MVVP_REF, CHUNK_JOURNAL_FINGERPRINT_SEED);
+        CuAssertTrue(testCase, fingerprint == bamChunk_getInputFingerprint(chunk, INPUT_MVVP_REF,
+                                                                           CHUNK_JOURNAL_FINGERPRINT_SEED));
+        CuAssertTrue(testCase, stSet_search(fingerprints, (void *) fingerprint) == NULL);
+        stSet_insert(fingerprints, (void *) fingerprint);
+    }
+
+    stSet_destruct(fingerprints);
+    free(chunker->params);
+    bamChunker_destruct(chunker);
+}
+
 static void test_getQualityScores(CuTest *testCase) {
     BamChunker *chunker = bamChunker_construct(INPUT_BAM, getParameters(10000, 0, FALSE));
 
@@ -240,6 +403,976 @@ static void test_getChunksWithoutBoundary(CuTest *testCase) {
     bamChunker_destruct(chunker);
 }
 
+static void test_getReadsWithPooledFileHandles(CuTest *testCase) {
+    /*
+     * Test that reading the chunks in parallel, reusing each thread's open bam file between chunks, gets the same
+     * reads as reading them serially.
+     */
+    BamChunker *chunker = bamChunker_construct(INPUT_BAM, getParameters(8, 4, FALSE));
+    int64_t *serialReadCounts = st_calloc(chunker->chunkCount, sizeof(int64_t));
+    int64_t *parallelReadCounts = st_calloc(chunker->chunkCount, sizeof(int64_t));
+
+    for (int64_t chunkIdx = 0; chunkIdx < chunker->chunkCount; chunkIdx++) {
+        stList *reads = stList_construct3(0, (void (*)(void *)) bamChunkRead_destruct);
+        stList *alignments = stList_construct3(0, (void (*)(void *)) stList_destruct);
+        serialReadCounts[chunkIdx] = convertToReadsAndAlignments(bamChunker_getChunk(chunker, chunkIdx), NULL, reads,
+                                                                 alignments, chunker->params);
+        stList_destruct(reads);
+        stList_destruct(alignments);
+    }
+
+    // Twice, so the second time every thread's handle has already been used
+    for (int64_t i = 0; i < 2; i++) {
+        #pragma omp parallel for schedule(dynamic,1)
+        for (int64_t chunkIdx = 0; chunkIdx < chunker->chunkCount; chunkIdx++) {
+            stList *reads = stList_construct3(0, (void (*)(void *)) bamChunkRead_destruct);
+            stList *alignments = stList_construct3(0, (void (*)(void *)) stList_destruct);
+            parallelReadCounts[chunkIdx] = convertToReadsAndAlignments(bamChunker_getChunk(chunker, chunkIdx), NULL,
+                                                                       reads, alignments, chunker->params);
+            stList_destruct(reads);
+            stList_destruct(alignments);
+        }
+        for (int64_t chunkIdx = 0; chunkIdx < chunker->chunkCount; chunkIdx++) {
+            CuAssertIntEquals(testCase, serialReadCounts[chunkIdx], parallelReadCounts[chunkIdx]);
+        }
+    }
+
+    free(serialReadCounts);
+    free(parallelReadCounts);
+    free(chunker->params);
+    bamChunker_destruct(chunker);
+}
+
+static void test_getReadsFromSeveralBams(CuTest *testCase) {
+    /*
+     * Test that a chunker reading the same bam twice gets each read of the chunk twice, once from each file, tagged
+     * with the file it came from.
+     */
+    BamChunker *chunker = bamChunker_construct(INPUT_BAM, getParameters(10000, 0, FALSE));
+    BamChunker *mergedChunker = bamChunker_construct(INPUT_BAM, chunker->params);
+    bamChunker_addBamFile(mergedChunker, INPUT_BAM);
+    CuAssertIntEquals(testCase, 2, bamChunker_getBamFileNo(mergedChunker));
+    CuAssertIntEquals(testCase, chunker->chunkCount, mergedChunker->chunkCount);
+
+    for (int64_t chunkIdx = 0; chunkIdx < chunker->chunkCount; chunkIdx++) {
+        stList *reads = stList_construct3(0, (void (*)(void *)) bamChunkRead_destruct);
+        stList *alignments = stList_construct3(0, (void (*)(void *)) stList_destruct);
+        int64_t readCount = convertToReadsAndAlignments(bamChunker_getChunk(chunker, chunkIdx), NULL, reads,
+                                                        alignments, chunker->params);
+        stList *mergedReads = stList_construct3(0, (void (*)(void *)) bamChunkRead_destruct);
+        stList *mergedAlignments = stList_construct3(0, (void (*)(void *)) stList_destruct);
+        int64_t mergedReadCount = convertToReadsAndAlignments(bamChunker_getChunk(mergedChunker, chunkIdx), NULL,
+                                                              mergedReads, mergedAlignments, chunker->params);
+        CuAssertIntEquals(testCase, 2 * readCount, mergedReadCount);
+        for (int64_t i = 0; i < readCount; i++) {
+            BamChunkRead *read = stList_get(reads, i);
+            BamChunkRead *firstRead = stList_get(mergedReads, i);
+            BamChunkRead *secondRead = stList_get(mergedReads, readCount + i);
+            CuAssertIntEquals(testCase, 0, read->source);
+            CuAssertIntEquals(testCase, 0, firstRead->source);
+            CuAssertIntEquals(testCase, 1, secondRead->source);
+            CuAssertStrEquals(testCase, read->readName, firstRead->readName);
+            CuAssertStrEquals(testCase, read->readName, secondRead->readName);
+            CuAssertIntEquals(testCase, stList_length(stList_get(alignments, i)),
+                              stList_length(stList_get(mergedAlignments, readCount + i)));
+        }
+        stList_destruct(reads);
+        stList_destruct(alignments);
+        stList_destruct(mergedReads);
+        stList_destruct(mergedAlignments);
+    }
+
+    free(chunker->params);
+    bamChunker_destruct(chunker);
+    bamChunker_destruct(mergedChunker);
+}
+
+static void *loadChunkReadCount(int64_t i, void *extraArg) {
+    BamChunker *chunker = extraArg;
+    stList *reads = stList_construct3(0, (void (*)(void *)) bamChunkRead_destruct);
+    stList *alignments = stList_construct3(0, (void (*)(void *)) stList_destruct);
+    int64_t *readCount = st_malloc(sizeof(int64_t));
+    *readCount = convertToReadsAndAlignments(bamChunker_getChunk(chunker, i), NULL, reads, alignments,
+                                             chunker->params);
+    stList_destruct(reads);
+    stList_destruct(alignments);
+    return readCount;
+}
+
+static void test_chunkPrefetcher(CuTest *testCase) {
+    /*
+     * Test that chunks got from a chunk prefetcher, with and without I/O threads, are those loaded directly.
+     */
+    BamChunker *chunker = bamChunker_construct(INPUT_BAM, getParameters(8, 4, FALSE));
+    for (int64_t threadNo = 0; threadNo < 3; threadNo++) {
+        ChunkPrefetcher *prefetcher = chunkPrefetcher_construct(chunker->chunkCount, threadNo, 2, loadChunkReadCount,
+                                                                chunker);
+        int64_t *readCounts = st_calloc(chunker->chunkCount, sizeof(int64_t));
+        #pragma omp parallel for schedule(dynamic,1)
+        for (int64_t i = 0; i < chunker->chunkCount; i++) {
+            int64_t *readCount = chunkPrefetcher_getChunk(prefetcher, i);
+            readCounts[i] = *readCount;
+            free(readCount);
+        }
+        chunkPrefetcher_destruct(prefetcher);
+
+        for (int64_t i = 0; i < chunker->chunkCount; i++) {
+            int64_t *readCount = loadChunkReadCount(i, chunker);
+            CuAssertIntEquals(testCase, *readCount, readCounts[i]);
+            free(readCount);
+        }
+        free(readCounts);
+    }
+    free(chunker->params);
+    bamChunker_destruct(chunker);
+}
+
+static void test_bamChunkStream(CuTest *testCase) {
+    /*
+     * Test that streaming the bam in one pass, from chunks planned from the reference, gets the same reads and
+     * alignments for each chunk as querying the index.
+     */
+    Params *params = params_readParams(INPUT_PARAMS);
+    params->polishParams->chunkSize = 16;
+    params->polishParams->chunkBoundary = 4;
+    params->polishParams->includeSoftClipping = TRUE;
+    BamChunker *chunker = bamChunker_constructFromFasta(INPUT_MVVP_REF, INPUT_MVVP_BAM, NULL, params->polishParams);
+    CuAssertTrue(testCase, chunker->chunkCount > 1);
+
+    // in reverse, so the stream has to sort the chunks into file order
+    stList *chunkOrder = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
+    for (int64_t i = chunker->chunkCount - 1; i >= 0; i--) {
+        stList_append(chunkOrder, stIntTuple_construct1(i));
+    }
+    BamChunkStream *stream = bamChunkStream_construct(chunker, chunkOrder, INPUT_MVVP_REF, params, TRUE);
+
+    for (int64_t i = 0; i < chunker->chunkCount; i++) {
+        BamChunk *bamChunk = bamChunker_getChunk(chunker, stIntTuple_get(stList_get(chunkOrder, i), 0));
+        if (i > 0) {
+            BamChunk *prevBamChunk = bamChunker_getChunk(chunker, stIntTuple_get(stList_get(chunkOrder, i - 1), 0));
+            CuAssertTrue(testCase, prevBamChunk->chunkOverlapStart < bamChunk->chunkOverlapStart);
+        }
+        BamChunkReads *streamed = bamChunkStream_getChunk(stream, i);
+
+        RleString *rleReference = bamChunk_getReferenceSubstring(bamChunk, INPUT_MVVP_REF, params);
+        BamChunkReads *queried = bamChunkReads_construct(rleReference);
+        convertToReadsAndAlignmentsWithFiltered(bamChunk, rleReference, queried->reads, queried->alignments,
+                                                queried->filteredReads, queried->filteredAlignments,
+                                                params->polishParams);
+
+        CuAssertTrue(testCase, rleString_eq(streamed->rleReference, queried->rleReference));
+        CuAssertIntEquals(testCase, stList_length(queried->reads), stList_length(streamed->reads));
+        CuAssertIntEquals(testCase, stList_length(queried->filteredReads), stList_length(streamed->filteredReads));
+        for (int64_t j = 0; j < stList_length(queried->reads); j++) {
+            BamChunkRead *queriedRead = stList_get(queried->reads, j);
+            BamChunkRead *streamedRead = stList_get(streamed->reads, j);
+            CuAssertStrEquals(testCase, queriedRead->readName, streamedRead->readName);
+            CuAssertTrue(testCase, rleString_eq(queriedRead->rleRead, streamedRead->rleRead));
+            stList *queriedAlignment = stList_get(queried->alignments, j);
+            stList *streamedAlignment = stList_get(streamed->alignments, j);
+            CuAssertIntEquals(testCase, stList_length(queriedAlignment), stList_length(streamedAlignment));
+            for (int64_t k = 0; k < stList_length(queriedAlignment); k++) {
+                CuAssertTrue(testCase, stIntTuple_cmpFn(stList_get(queriedAlignment, k),
+                                                        stList_get(streamedAlignment, k)) == 0);
+            }
+        }
+
+        // the chunk's coordinate map, built once with its reference
+        if (params->polishParams->useRunLengthEncoding) {
+            uint64_t *coordinateMap = rleString_getNonRleToRleCoordinateMap(rleReference);
+            CuAssertTrue(testCase, streamed->rleReferenceCoordinateMap != NULL);
+            for (int64_t j = 0; j < rleReference->nonRleLength; j++) {
+                CuAssertIntEquals(testCase, coordinateMap[j], streamed->rleReferenceCoordinateMap[j]);
+            }
+            free(coordinateMap);
+        }
+
+        bamChunkReads_destruct(streamed);
+        bamChunkReads_destruct(queried);
+    }
+
+    bamChunkStream_destruct(stream);
+    stList_destruct(chunkOrder);
+    bamChunker_destruct(chunker);
+    params_destruct(params);
+}
+
+static void test_downsampleBeforeDecoding(CuTest *testCase) {
+    /*
+     * Test that downsampling the chunks from their bam records, before decoding the reads, keeps the same reads as
+     * decoding them all, removing those only in the chunk boundary and then downsampling.
+     */
+    Params *params = params_readParams(INPUT_PARAMS);
+    params->polishParams->chunkSize = 16;
+    params->polishParams->chunkBoundary = 4;
+    BamChunker *chunker = bamChunker_constructFromFasta(INPUT_MVVP_REF, INPUT_MVVP_BAM, NULL, params->polishParams);
+
+    for (int64_t byFullReadLength = 0; byFullReadLength < 2; byFullReadLength++) {
+        for (int64_t i = 0; i < chunker->chunkCount; i++) {
+            BamChunk *bamChunk = bamChunker_getChunk(chunker, i);
+            RleString *rleReference = bamChunk_getReferenceSubstring(bamChunk, INPUT_MVVP_REF, params);
+
+            // decoded, then downsampled
+            stList *reads = stList_construct3(0, (void (*)(void *)) bamChunkRead_destruct);
+            stList *alignments = stList_construct3(0, (void (*)(void *)) stList_destruct);
+            convertToReadsAndAlignments(bamChunk, rleReference, reads, alignments, params->polishParams);
+            removeReadsOnlyInChunkBoundary(bamChunk, reads, alignments, "");
+            stList *maintainedReads = stList_construct3(0, (void (*)(void *)) bamChunkRead_destruct);
+            stList *maintainedAlignments = stList_construct3(0, (void (*)(void *)) stList_destruct);
+            stList *discardedReads = stList_construct();
+            stList *discardedAlignments = stList_construct();
+            bool downsampled = byFullReadLength ?
+                    downsampleViaFullReadLengthLikelihood(2, bamChunk, reads, alignments, maintainedReads,
+                                                          maintainedAlignments, discardedReads, discardedAlignments) :
+                    downsampleViaReadLikelihood(2, bamChunk, reads, alignments, maintainedReads,
+                                                maintainedAlignments, discardedReads, discardedAlignments);
+            if (downsampled) {
+                // the maintained and discarded lists now own the reads
+                stList_setDestructor(discardedReads, (void (*)(void *)) bamChunkRead_destruct);
+                stList_setDestructor(discardedAlignments, (void (*)(void *)) stList_destruct);
+                stList_setDestructor(reads, NULL);
+                stList_setDestructor(alignments, NULL);
+                stList_destruct(reads);
+                stList_destruct(alignments);
+                reads = maintainedReads;
+                alignments = maintainedAlignments;
+            } else {
+                stList_destruct(maintainedReads);
+                stList_destruct(maintainedAlignments);
+            }
+
+            // downsampled, then decoded
+            stList *earlyReads = stList_construct3(0, (void (*)(void *)) bamChunkRead_destruct);
+            stList *earlyAlignments = stList_construct3(0, (void (*)(void *)) stList_destruct);
+            bool earlyDownsampled = FALSE;
+            convertToReadsAndAlignmentsWithDownsampling(bamChunk, rleReference, 2, byFullReadLength, earlyReads,
+                                                        earlyAlignments, NULL, NULL, &earlyDownsampled,
+                                                        params->polishParams);
+
+            CuAssertTrue(testCase, downsampled == earlyDownsampled);
+            CuAssertIntEquals(testCase, stList_length(reads), stList_length(earlyReads));
+            for (int64_t j = 0; j < stList_length(reads); j++) {
+                BamChunkRead *read = stList_get(reads, j);
+                BamChunkRead *earlyRead = stList_get(earlyReads, j);
+                CuAssertStrEquals(testCase, read->readName, earlyRead->readName);
+                CuAssertTrue(testCase, rleString_eq(read->rleRead, earlyRead->rleRead));
+                stList *alignment = stList_get(alignments, j);
+                stList *earlyAlignment = stList_get(earlyAlignments, j);
+                CuAssertIntEquals(testCase, stList_length(alignment), stList_length(earlyAlignment));
+                for (int64_t k = 0; k < stList_length(alignment); k++) {
+                    CuAssertTrue(testCase, stIntTuple_cmpFn(stList_get(alignment, k),
+                                                            stList_get(earlyAlignment, k)) == 0);
+                }
+            }
+
+            stList_destruct(reads);
+            stList_destruct(alignments);
+            stList_destruct(discardedReads);
+            stList_destruct(discardedAlignments);
+            stList_destruct(earlyReads);
+            stList_destruct(earlyAlignments);
+            rleString_destruct(rleReference);
+        }
+    }
+
+    bamChunker_destruct(chunker);
+    params_destruct(params);
+}
+
+static int64_t getReadIndex(stList *reads, char *readName) {
+    for (int64_t i = 0; i < stList_length(reads); i++) {
+        if (stString_eq(((BamChunkRead *) stList_get(reads, i))->readName, readName)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void test_readsOfExcessivelyDeepChunks(CuTest *testCase) {
+    /*
+     * Test that of a chunk deeper than the excessive depth threshold, the reads kept while reading are those of the
+     * lowest draws, as uniform downsampling would keep, until their length reaches the threshold's depth, in the order
+     * of the bam, and that streaming the bam keeps the same reads.
+     */
+    Params *params = params_readParams(INPUT_PARAMS);
+    params->polishParams->chunkSize = 16;
+    params->polishParams->chunkBoundary = 4;
+    BamChunker *chunker = bamChunker_constructFromFasta(INPUT_MVVP_REF, INPUT_MVVP_BAM, NULL, params->polishParams);
+    stList *chunkOrder = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
+    for (int64_t i = 0; i < chunker->chunkCount; i++) {
+        stList_append(chunkOrder, stIntTuple_construct1(i));
+    }
+    params->polishParams->excessiveDepthThreshold = 1;
+    BamChunkStream *stream = bamChunkStream_construct(chunker, chunkOrder, INPUT_MVVP_REF, params, FALSE);
+
+    bool someDiscarded = FALSE;
+    for (int64_t i = 0; i < chunker->chunkCount; i++) {
+        BamChunk *bamChunk = bamChunker_getChunk(chunker, stIntTuple_get(stList_get(chunkOrder, i), 0));
+        RleString *rleReference = bamChunk_getReferenceSubstring(bamChunk, INPUT_MVVP_REF, params);
+
+        // all the reads, then those kept
+        params->polishParams->excessiveDepthThreshold = 0;
+        BamChunkReads *all = bamChunkReads_construct(rleString_copy(rleReference));
+        convertToReadsAndAlignments(bamChunk, rleReference, all->reads, all->alignments, params->polishParams);
+        params->polishParams->excessiveDepthThreshold = 1;
+        BamChunkReads *kept = bamChunkReads_construct(rleString_copy(rleReference));
+        convertToReadsAndAlignments(bamChunk, rleReference, kept->reads, kept->alignments, params->polishParams);
+        someDiscarded = someDiscarded || stList_length(kept->reads) < stList_length(all->reads);
+
+        // the reads of the lowest draws, up to the first to reach the budget
+        int64_t budget = bamChunk->chunkOverlapEnd - bamChunk->chunkOverlapStart;
+        int64_t keptLength = 0, lastIndex = -1;
+        for (int64_t j = 0; j < stList_length(all->reads); j++) {
+            BamChunkRead *read = stList_get(all->reads, j);
+            double draw = downsampling_getReadDraw(bamChunk, read->readName);
+            int64_t lowerLength = 0;
+            for (int64_t k = 0; k < stList_length(all->reads); k++) {
+                BamChunkRead *otherRead = stList_get(all->reads, k);
+                if (downsampling_getReadDraw(bamChunk, otherRead->readName) < draw) {
+                    lowerLength += otherRead->rleRead->length;
+                }
+            }
+            int64_t index = getReadIndex(kept->reads, read->readName);
+            CuAssertTrue(testCase, (index >= 0) == (lowerLength < budget));
+            if (index >= 0) {
+                // in the order of the bam
+                CuAssertTrue(testCase, index > lastIndex);
+                lastIndex = index;
+                keptLength += read->rleRead->length;
+            }
+        }
+        CuAssertTrue(testCase, lastIndex == stList_length(kept->reads) - 1);
+        CuAssertTrue(testCase, keptLength >= budget || stList_length(kept->reads) == stList_length(all->reads));
+
+        BamChunkReads *streamed = bamChunkStream_getChunk(stream, i);
+        CuAssertIntEquals(testCase, stList_length(kept->reads), stList_length(streamed->reads));
+        for (int64_t j = 0; j < stList_length(kept->reads); j++) {
+            CuAssertStrEquals(testCase, ((BamChunkRead *) stList_get(kept->reads, j))->readName,
+                              ((BamChunkRead *) stList_get(streamed->reads, j))->readName);
+        }
+
+        bamChunkReads_destruct(all);
+        bamChunkReads_destruct(kept);
+        bamChunkReads_destruct(streamed);
+        rleString_destruct(rleReference);
+    }
+    CuAssertTrue(testCase, someDiscarded);
+
+    bamChunkStream_destruct(stream);
+    stList_destruct(chunkOrder);
+    bamChunker_destruct(chunker);
+    params_destruct(params);
+}
+
+static void test_downsamplingIsOrderIndependent(CuTest *testCase) {
+    /*
+     * Test that downsampling keeps the same reads whatever their order, and that the reads kept are chosen by the seed.
+     */
+    Params *params = params_readParams(INPUT_PARAMS);
+    params->polishParams->chunkSize = 16;
+    params->polishParams->chunkBoundary = 4;
+    BamChunker *chunker = bamChunker_constructFromFasta(INPUT_MVVP_REF, INPUT_MVVP_BAM, NULL, params->polishParams);
+    BamChunk *bamChunk = bamChunker_getChunk(chunker, 0);
+    RleString *rleReference = bamChunk_getReferenceSubstring(bamChunk, INPUT_MVVP_REF, params);
+    stList *reads = stList_construct3(0, (void (*)(void *)) bamChunkRead_destruct);
+    stList *alignments = stList_construct3(0, (void (*)(void *)) stList_destruct);
+    convertToReadsAndAlignments(bamChunk, rleReference, reads, alignments, params->polishParams);
+    CuAssertTrue(testCase, stList_length(reads) > 1);
+
+    stList *reversedReads = stList_copy(reads, NULL);
+    stList *reversedAlignments = stList_copy(alignments, NULL);
+    stList_reverse(reversedReads);
+    stList_reverse(reversedAlignments);
+    stSet *keptReadNames[2];
+    stList *orders[2][2] = {{reads, alignments}, {reversedReads, reversedAlignments}};
+    for (int64_t i = 0; i < 2; i++) {
+        keptReadNames[i] = stSet_construct3(stHash_stringKey, stHash_stringEqualKey, NULL);
+        stList *maintainedReads = stList_construct();
+        stList *maintainedAlignments = stList_construct();
+        stList *discardedReads = stList_construct();
+        stList *discardedAlignments = stList_construct();
+        if (!downsampleViaReadLikelihood(1, bamChunk, orders[i][0], orders[i][1], maintainedReads,
+                                         maintainedAlignments, discardedReads, discardedAlignments)) {
+            stList_appendAll(maintainedReads, orders[i][0]);
+        }
+        for (int64_t j = 0; j < stList_length(maintainedReads); j++) {
+            stSet_insert(keptReadNames[i], ((BamChunkRead *) stList_get(maintainedReads, j))->readName);
+        }
+        stList_destruct(maintainedReads);
+        stList_destruct(maintainedAlignments);
+        stList_destruct(discardedReads);
+        stList_destruct(discardedAlignments);
+    }
+    CuAssertIntEquals(testCase, stSet_size(keptReadNames[0]), stSet_size(keptReadNames[1]));
+    for (int64_t j = 0; j < stList_length(reads); j++) {
+        char *readName = ((BamChunkRead *) stList_get(reads, j))->readName;
+        CuAssertTrue(testCase, (stSet_search(keptReadNames[0], readName) == NULL) ==
+                               (stSet_search(keptReadNames[1], readName) == NULL));
+    }
+
+    // the draws are fixed by the read, the chunk and the seed
+    char *readName = ((BamChunkRead *) stList_get(reads, 0))->readName;
+    double draw = downsampling_getReadDraw(bamChunk, readName);
+    CuAssertTrue(testCase, draw >= 0.0 && draw < 1.0);
+    CuAssertDblEquals(testCase, draw, downsampling_getReadDraw(bamChunk, readName), 0.0);
+    params->polishParams->downsamplingSeed = 1;
+    CuAssertTrue(testCase, draw != downsampling_getReadDraw(bamChunk, readName));
+
+    stSet_destruct(keptReadNames[0]);
+    stSet_destruct(keptReadNames[1]);
+    stList_destruct(reversedReads);
+    stList_destruct(reversedAlignments);
+    stList_destruct(reads);
+    stList_destruct(alignments);
+    rleString_destruct(rleReference);
+    bamChunker_destruct(chunker);
+    params_destruct(params);
+}
+
+static void test_chunkScheduler(CuTest *testCase) {
+    /*
+     * Test that every chunk is taken from the scheduler exactly once, and that with a cost model the chunk order is
+     * longest predicted first (so deepest first, for chunks of the same length).
+     */
+    BamChunker *chunker = bamChunker_construct(INPUT_BAM, getParameters(10000, 0, FALSE));
+    for (int64_t predictCost = 0; predictCost < 2; predictCost++) {
+        stList *chunkOrder = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
+        for (int64_t i = 0; i < chunker->chunkCount; i++) {
+            stList_append(chunkOrder, stIntTuple_construct1(i));
+        }
+        ChunkScheduler *scheduler = chunkScheduler_construct(chunker, chunkOrder, 4, predictCost);
+        int64_t *takenCounts = st_calloc(chunker->chunkCount, sizeof(int64_t));
+        #pragma omp parallel
+        for (int64_t i = 0; chunkScheduler_next(scheduler, &i);) {
+            #pragma omp atomic
+            takenCounts[i]++;
+            chunkScheduler_finish(scheduler, i);
+        }
+        chunkScheduler_destruct(scheduler);
+
+        for (int64_t i = 0; i < chunker->chunkCount; i++) {
+            CuAssertIntEquals(testCase, 1, takenCounts[i]);
+            int64_t chunkIdx = stIntTuple_get(stList_get(chunkOrder, i), 0);
+            if (!predictCost) {
+                CuAssertIntEquals(testCase, i, chunkIdx);
+            } else if (i > 0) {
+                BamChunk *chunk = bamChunker_getChunk(chunker, chunkIdx);
+                BamChunk *prevChunk = bamChunker_getChunk(chunker, stIntTuple_get(stList_get(chunkOrder, i - 1), 0));
+                if (prevChunk->chunkOverlapEnd - prevChunk->chunkOverlapStart ==
+                    chunk->chunkOverlapEnd - chunk->chunkOverlapStart) {
+                    CuAssertTrue(testCase, prevChunk->estimatedDepth >= chunk->estimatedDepth);
+                }
+            }
+        }
+        free(takenCounts);
+        stList_destruct(chunkOrder);
+    }
+    free(chunker->params);
+    bamChunker_destruct(chunker);
+}
+
+static void test_chunkSchedulerIdleThreads(CuTest *testCase) {
+    /*
+     * Test that the threads of the chunk loop are counted as idle once they have run out of chunks, so that the
+     * chunks still in flight can be lent them, and that none are outside the loop.
+     */
+    BamChunker *chunker = bamChunker_construct(INPUT_BAM, getParameters(10000, 0, FALSE));
+    stList *chunkOrder = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
+    for (int64_t i = 0; i < chunker->chunkCount; i++) {
+        stList_append(chunkOrder, stIntTuple_construct1(i));
+    }
+    ChunkScheduler *scheduler = chunkScheduler_construct(chunker, chunkOrder, 2, TRUE);
+    int64_t idleInFlight = 0, idleAfterLoop = 0, threadNo = 1;
+    # ifdef _OPENMP
+    #pragma omp parallel num_threads(2)
+    # endif
+    {
+        for (int64_t i = 0; chunkScheduler_next(scheduler, &i);) {
+            # ifdef _OPENMP
+            #pragma omp atomic
+            # endif
+            idleInFlight += chunkScheduler_getIdleThreadNo();
+            chunkScheduler_finish(scheduler, i);
+        }
+        # ifdef _OPENMP
+        #pragma omp barrier
+        #pragma omp single
+        {
+            threadNo = omp_get_num_threads();
+            idleAfterLoop = chunkScheduler_getIdleThreadNo();
+        }
+        # endif
+    }
+    CuAssertTrue(testCase, idleInFlight <= chunker->chunkCount * (threadNo - 1));
+    CuAssertIntEquals(testCase, threadNo > 1 ? threadNo : 0, idleAfterLoop);
+    CuAssertIntEquals(testCase, 0, chunkScheduler_getIdleThreadNo());
+    chunkScheduler_destruct(scheduler);
+
+    stList_destruct(chunkOrder);
+    free(chunker->params);
+    bamChunker_destruct(chunker);
+}
+
+static void test_chunkSchedulerMemoryBudget(CuTest *testCase) {
+    /*
+     * Test that with a memory budget every chunk is still taken exactly once, that the chunks predicted to need more
+     * than the budget are given a depth limit at which they fit, and that the chunks in flight only exceed the budget
+     * when there is just one of them.
+     */
+    BamChunker *chunker = bamChunker_construct(INPUT_BAM, getParameters(10000, 0, FALSE));
+    stList *chunkOrder = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
+    for (int64_t i = 0; i < chunker->chunkCount; i++) {
+        stList_append(chunkOrder, stIntTuple_construct1(i));
+    }
+    uint64_t bytesPerReadBase = 200;
+    uint64_t maxMemory = 2 * (CHUNK_MEMORY_OVERHEAD + bytesPerReadBase * 10000 * 3);
+    ChunkScheduler *scheduler = chunkScheduler_construct(chunker, chunkOrder, 4, FALSE);
+    chunkScheduler_setMemoryBudget(scheduler, chunker, chunkOrder, maxMemory, bytesPerReadBase);
+
+    for (int64_t i = 0; i < chunker->chunkCount; i++) {
+        BamChunk *chunk = bamChunker_getChunk(chunker, i);
+        uint64_t depthLimit = chunkScheduler_getMemoryDepthLimit(scheduler, i);
+        CuAssertTrue(testCase, chunkScheduler_getPredictedMemory(scheduler, i) <= maxMemory);
+        if (depthLimit > 0) {
+            CuAssertTrue(testCase, chunk->estimatedDepth > 0 && depthLimit < (uint64_t) chunk->estimatedDepth);
+        }
+    }
+
+    int64_t *takenCounts = st_calloc(chunker->chunkCount, sizeof(int64_t));
+    uint64_t memoryInFlight = 0;
+    int64_t chunksInFlight = 0;
+    bool exceeded = FALSE;
+    #pragma omp parallel
+    for (int64_t i = 0; chunkScheduler_next(scheduler, &i);) {
+        #pragma omp critical (memoryBudgetTest)
+        {
+            takenCounts[i]++;
+            memoryInFlight += chunkScheduler_getPredictedMemory(scheduler, i);
+            chunksInFlight++;
+            if (chunksInFlight > 1 && memoryInFlight > maxMemory) {
+                exceeded = TRUE;
+            }
+        }
+        #pragma omp critical (memoryBudgetTest)
+        {
+            memoryInFlight -= chunkScheduler_getPredictedMemory(scheduler, i);
+            chunksInFlight--;
+        }
+        chunkScheduler_finish(scheduler, i);
+    }
+    CuAssertTrue(testCase, !exceeded);
+    for (int64_t i = 0; i < chunker->chunkCount; i++) {
+        CuAssertIntEquals(testCase, 1, takenCounts[i]);
+    }
+
+    free(takenCounts);
+    chunkScheduler_destruct(scheduler);
+    stList_destruct(chunkOrder);
+    free(chunker->params);
+    bamChunker_destruct(chunker);
+}
+
+static void test_chunkTelemetry(CuTest *testCase) {
+    /*
+     * Test that the telemetry of each chunk, recorded by the thread processing it, is written as a line with its
+     * counts, and that nothing is recorded by a thread without a started chunk.
+     */
+    BamChunker *chunker = bamChunker_construct(INPUT_BAM, getParameters(10000, 0, FALSE));
+    char *telemetry = NULL;
+    size_t telemetryLength = 0;
+    FILE *fh = open_memstream(&telemetry, &telemetryLength);
+    chunkTelemetry_addCount(CTC_READS, 1000);
+    chunkTelemetry_finish(fh);
+    #pragma omp parallel for
+    for (int64_t i = 0; i < chunker->chunkCount; i++) {
+        chunkTelemetry_start(bamChunker_getChunk(chunker, i));
+        chunkTelemetry_startStage(CTS_READ);
+        chunkTelemetry_addCount(CTC_READS, i);
+        chunkTelemetry_endStage(CTS_READ);
+        for (int64_t j = 0; j < 3; j++) {
+            chunkTelemetry_startStage(CTS_POA_ITERATION);
+            chunkTelemetry_addCount(CTC_HMM_CELLS, 2);
+            chunkTelemetry_endStage(CTS_POA_ITERATION);
+        }
+        chunkTelemetry_finish(fh);
+    }
+    fclose(fh);
+
+    stList *lines = stString_splitByString(telemetry, "\n");
+    CuAssertIntEquals(testCase, chunker->chunkCount + 1, stList_length(lines)); // the last line is empty
+    int64_t *lineCounts = st_calloc(chunker->chunkCount, sizeof(int64_t));
+    for (int64_t i = 0; i < chunker->chunkCount; i++) {
+        char *line = stList_get(lines, i);
+        int64_t chunkIdx = -1;
+        CuAssertTrue(testCase, sscanf(line, "{\"chunk\": %" SCNd64, &chunkIdx) == 1);
+        CuAssertTrue(testCase, chunkIdx >= 0 && chunkIdx < chunker->chunkCount);
+        lineCounts[chunkIdx]++;
+        char *reads = stString_print("\"reads\": %" PRId64 ",", chunkIdx);
+        CuAssertTrue(testCase, strstr(line, reads) != NULL);
+        CuAssertTrue(testCase, strstr(line, "\"hmmCells\": 6,") != NULL);
+        CuAssertTrue(testCase, strstr(line, "\"poaIterationTimes\": [") != NULL);
+        CuAssertTrue(testCase, strstr(line, "\"stitch\": ") != NULL);
+        free(reads);
+    }
+    for (int64_t i = 0; i < chunker->chunkCount; i++) {
+        CuAssertIntEquals(testCase, 1, lineCounts[i]);
+    }
+    free(lineCounts);
+    stList_destruct(lines);
+    free(telemetry);
+    free(chunker->params);
+    bamChunker_destruct(chunker);
+}
+
+static void test_chunkTelemetryRunTotals(CuTest *testCase) {
+    /*
+     * Test that the run's totals line sums the counts of its chunks, with the counts made outside any chunk, and that
+     * counts captured while loading a chunk are added to the chunk of the thread that takes them.
+     */
+    BamChunker *chunker = bamChunker_construct(INPUT_BAM, getParameters(10000, 0, FALSE));
+    char *telemetry = NULL;
+    size_t telemetryLength = 0;
+    FILE *fh = open_memstream(&telemetry, &telemetryLength);
+    chunkTelemetry_addCount(CTC_DP_CELLS, 1000); // before the run, so not counted
+    chunkTelemetry_startRun();
+    chunkTelemetry_addCount(CTC_DP_CELLS, 7);
+    #pragma omp parallel for
+    for (int64_t i = 0; i < chunker->chunkCount; i++) {
+        int64_t loadCounts[CTC_COUNTS] = { 0 };
+        chunkTelemetry_captureCounts(loadCounts);
+        chunkTelemetry_addCount(CTC_BAM_BYTES, 100);
+        chunkTelemetry_captureCounts(NULL);
+        chunkTelemetry_start(bamChunker_getChunk(chunker, i));
+        chunkTelemetry_addCounts(loadCounts);
+        chunkTelemetry_addCount(CTC_DP_CELLS, 10);
+        chunkTelemetry_finish(fh);
+    }
+    chunkTelemetry_finishRun(fh);
+    fclose(fh);
+
+    stList *lines = stString_splitByString(telemetry, "\n");
+    CuAssertIntEquals(testCase, chunker->chunkCount + 2, stList_length(lines)); // the last line is empty
+    for (int64_t i = 0; i < chunker->chunkCount; i++) {
+        char *line = stList_get(lines, i);
+        CuAssertTrue(testCase, strstr(line, "\"dpCells\": 10,") != NULL);
+        CuAssertTrue(testCase, strstr(line, "\"bamBytes\": 100,") != NULL);
+    }
+    char *runLine = stList_get(lines, chunker->chunkCount);
+    char *runChunks = stString_print("{\"run\": {\"chunks\": %" PRId64 ",", chunker->chunkCount);
+    char *runDpCells = stString_print("\"dpCells\": %" PRId64 ",", 10 * chunker->chunkCount + 7);
+    char *runBamBytes = stString_print("\"bamBytes\": %" PRId64 "}", 100 * chunker->chunkCount);
+    CuAssertTrue(testCase, strstr(runLine, runChunks) == runLine);
+    CuAssertTrue(testCase, strstr(runLine, runDpCells) != NULL);
+    CuAssertTrue(testCase, strstr(runLine, runBamBytes) != NULL);
+    CuAssertTrue(testCase, strstr(runLine, "\"chunkCpuTime\": {\"total\": ") != NULL);
+
+    // counts after the run are not added to it
+    chunkTelemetry_addCount(CTC_DP_CELLS, 1000);
+    chunkTelemetry_finishRun(fh = open_memstream(&runLine, &telemetryLength));
+    fclose(fh);
+    CuAssertIntEquals(testCase, 0, telemetryLength);
+    free(runLine);
+
+    free(runChunks);
+    free(runDpCells);
+    free(runBamBytes);
+    stList_destruct(lines);
+    free(telemetry);
+    free(chunker->params);
+    bamChunker_destruct(chunker);
+}
+
+static int64_t countSubstrings(char *string, char *substring) {
+    int64_t count = 0;
+    for (char *match = strstr(string, substring); match != NULL; match = strstr(match + 1, substring)) {
+        count++;
+    }
+    return count;
+}
+
+static void test_chunkArena(CuTest *testCase) {
+    /*
+     * Test that memory from an open chunk arena is bump allocated from blocks, that large allocations and those outside
+     * an open arena come from the heap, and that a block is freed once it is closed and all its allocations are freed,
+     * whichever thread frees them.
+     */
+    int64_t liveBlockNo = chunkArena_getLiveBlockNo();
+    int64_t *heapObject = chunkArena_malloc(sizeof(int64_t));
+    *heapObject = 1;
+    CuAssertIntEquals(testCase, liveBlockNo, chunkArena_getLiveBlockNo());
+
+    int64_t objectNo = 100000;
+    int64_t **objects = st_malloc(objectNo * sizeof(int64_t *));
+    chunkArena_open();
+    for (int64_t i = 0; i < objectNo; i++) {
+        objects[i] = chunkArena_calloc(3, sizeof(int64_t));
+        CuAssertIntEquals(testCase, 0, objects[i][2]);
+        CuAssertTrue(testCase, ((uintptr_t) objects[i]) % 8 == 0);
+        objects[i][0] = i;
+        objects[i][2] = -i;
+    }
+    char *largeObject = chunkArena_malloc(CHUNK_ARENA_MAX_ALLOCATION);
+    memset(largeObject, 'a', CHUNK_ARENA_MAX_ALLOCATION);
+    ChunkArenaStats stats;
+    chunkArena_getStats(&stats);
+    CuAssertIntEquals(testCase, objectNo, stats.allocations);
+    CuAssertIntEquals(testCase, 1, stats.heapAllocations);
+    CuAssertTrue(testCase, stats.blocks * CHUNK_ARENA_BLOCK_SIZE >= stats.bytes);
+    CuAssertTrue(testCase, stats.bytes >= objectNo * 3 * (int64_t) sizeof(int64_t));
+    CuAssertIntEquals(testCase, liveBlockNo + stats.blocks, chunkArena_getLiveBlockNo());
+    chunkArena_close();
+
+    // the blocks outlive the arena until their objects are freed, here other than the last from other threads
+    for (int64_t i = 0; i < objectNo; i++) {
+        CuAssertIntEquals(testCase, i, objects[i][0]);
+        CuAssertIntEquals(testCase, -i, objects[i][2]);
+    }
+    CuAssertIntEquals(testCase, liveBlockNo + stats.blocks, chunkArena_getLiveBlockNo());
+    #pragma omp parallel for
+    for (int64_t i = 0; i < objectNo - 1; i++) {
+        chunkArena_free(objects[i]);
+    }
+    CuAssertIntEquals(testCase, liveBlockNo + 1, chunkArena_getLiveBlockNo());
+    chunkArena_free(objects[objectNo - 1]);
+    CuAssertIntEquals(testCase, liveBlockNo, chunkArena_getLiveBlockNo());
+
+    chunkArena_free(largeObject);
+    chunkArena_free(heapObject);
+    chunkArena_free(NULL);
+    free(objects);
+}
+
+static BamChunkRead *getReplayRead(char *readName, char *nucleotides, bool withQualities, bool forwardStrand,
+                                   int64_t source, bool useRunLengthEncoding) {
+    uint8_t *qualities = NULL;
+    if (withQualities) {
+        qualities = st_malloc(strlen(nucleotides));
+        for (int64_t i = 0; nucleotides[i] != '\0'; i++) {
+            qualities[i] = (uint8_t) (i % 40);
+        }
+    }
+    BamChunkRead *read = bamChunkRead_construct3(readName, nucleotides, qualities, forwardStrand, 2 * strlen(nucleotides),
+                                                 useRunLengthEncoding);
+    read->source = source;
+    if (qualities != NULL) free(qualities);
+    return read;
+}
+
+static stList *getReplayAlignment(int64_t pairNo) {
+    stList *alignment = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
+    for (int64_t i = 0; i < pairNo; i++) {
+        stList_append(alignment, stIntTuple_construct3(i + 2, i, PAIR_ALIGNMENT_PROB_1 - i));
+    }
+    return alignment;
+}
+
+static void assertReplayReadsEqual(CuTest *testCase, stList *reads, stList *alignments, stList *replayedReads,
+                                   stList *replayedAlignments) {
+    CuAssertIntEquals(testCase, stList_length(reads), stList_length(replayedReads));
+    CuAssertIntEquals(testCase, stList_length(alignments), stList_length(replayedAlignments));
+    for (int64_t i = 0; i < stList_length(reads); i++) {
+        BamChunkRead *read = stList_get(reads, i), *replayedRead = stList_get(replayedReads, i);
+        CuAssertStrEquals(testCase, read->readName, replayedRead->readName);
+        CuAssertTrue(testCase, rleString_eq(read->rleRead, replayedRead->rleRead));
+        CuAssertTrue(testCase, (read->rleRead->repeatCounts == NULL) == (replayedRead->rleRead->repeatCounts == NULL));
+        CuAssertTrue(testCase, (read->qualities == NULL) == (replayedRead->qualities == NULL));
+        if (read->qualities != NULL) {
+            CuAssertTrue(testCase, memcmp(read->qualities, replayedRead->qualities, read->rleRead->length) == 0);
+        }
+        CuAssertIntEquals(testCase, read->forwardStrand, replayedRead->forwardStrand);
+        CuAssertIntEquals(testCase, read->fullReadLength, replayedRead->fullReadLength);
+        CuAssertIntEquals(testCase, read->source, replayedRead->source);
+        stList *alignment = stList_get(alignments, i), *replayedAlignment = stList_get(replayedAlignments, i);
+        CuAssertIntEquals(testCase, stList_length(alignment), stList_length(replayedAlignment));
+        for (int64_t j = 0; j < stList_length(alignment); j++) {
+            CuAssertTrue(testCase, stIntTuple_cmpFn(stList_get(alignment, j), stList_get(replayedAlignment, j)) == 0);
+        }
+    }
+}
+
+static void test_chunkReplayBundle(CuTest *testCase) {
+    /*
+     * Test that the inputs of a chunk are read back from its replay bundle as they were written, including repeat
+     * counts too long to be stored in a byte, reads without qualities and filtered reads.
+     */
+    PolishParams *params = getParameters(0, 0, FALSE);
+    BamChunk *bamChunk = bamChunk_construct2("contig1", 7, 900, 1000, 2000, 2100, 0, NULL);
+    char *longRun = st_calloc(305, sizeof(char));
+    memset(longRun, 'A', 304);
+    longRun[1] = 'C';
+    longRun[302] = 'G';
+    longRun[303] = 'T';
+    BamChunkReads *chunkReads = bamChunkReads_construct(rleString_construct("ACCGGGTTTTAC"));
+    stList_append(chunkReads->reads, getReplayRead("read1", longRun, TRUE, FALSE, 1, TRUE));
+    stList_append(chunkReads->alignments, getReplayAlignment(4));
+    stList_append(chunkReads->reads, getReplayRead("read2", "ACGTACGT", FALSE, TRUE, 0, FALSE));
+    stList_append(chunkReads->alignments, getReplayAlignment(0));
+    stList_append(chunkReads->filteredReads, getReplayRead("filteredRead", "AACCGT", TRUE, TRUE, 0, TRUE));
+    stList_append(chunkReads->filteredAlignments, getReplayAlignment(3));
+
+    ChunkReplayBundle *bundle = chunkReplayBundle_construct(bamChunk, chunkReads, 64, TRUE, FALSE, 12345);
+    char *bundleFile = "./chunkReplayTest.replay";
+    chunkReplayBundle_write(bundle, bundleFile);
+    chunkReplayBundle_destruct(bundle);
+    ChunkReplay *replay = chunkReplay_read(bundleFile, params);
+    remove(bundleFile);
+
+    CuAssertStrEquals(testCase, "contig1", replay->bamChunk->refSeqName);
+    CuAssertIntEquals(testCase, 7, replay->bamChunk->chunkIdx);
+    CuAssertIntEquals(testCase, 900, replay->bamChunk->chunkOverlapStart);
+    CuAssertIntEquals(testCase, 1000, replay->bamChunk->chunkStart);
+    CuAssertIntEquals(testCase, 2000, replay->bamChunk->chunkEnd);
+    CuAssertIntEquals(testCase, 2100, replay->bamChunk->chunkOverlapEnd);
+    CuAssertIntEquals(testCase, 1, replay->bamChunker->chunkCount);
+    CuAssertIntEquals(testCase, 64, replay->maxDepth);
+    CuAssertTrue(testCase, replay->diploid);
+    CuAssertTrue(testCase, !replay->partitionFilteredReads);
+    CuAssertTrue(testCase, replay->paramsFingerprint == 12345);
+    CuAssertTrue(testCase, rleString_eq(chunkReads->rleReference, replay->chunkReads->rleReference));
+    CuAssertTrue(testCase, replay->chunkReads->rleReferenceCoordinateMap != NULL);
+    assertReplayReadsEqual(testCase, chunkReads->reads, chunkReads->alignments, replay->chunkReads->reads,
+                           replay->chunkReads->alignments);
+    assertReplayReadsEqual(testCase, chunkReads->filteredReads, chunkReads->filteredAlignments,
+                           replay->chunkReads->filteredReads, replay->chunkReads->filteredAlignments);
+    CuAssertIntEquals(testCase, 304, ((BamChunkRead *) stList_get(replay->chunkReads->reads, 0))->rleRead->nonRleLength);
+
+    chunkReplay_destruct(replay);
+    bamChunkReads_destruct(chunkReads);
+    bamChunk_destruct(bamChunk);
+    free(longRun);
+    free(params);
+}
+
+static void test_traceRecorder(CuTest *testCase) {
+    /*
+     * Test that the events of each thread are written, in order, as a Chrome trace, and that events recorded while
+     * the recorder is not started are dropped.
+     */
+    char *traceFile = "./tmp.trace.json";
+    traceRecorder_begin("dropped");
+    traceRecorder_start(traceFile);
+    int64_t chunkCount = 100;
+    #pragma omp parallel for
+    for (int64_t i = 0; i < chunkCount; i++) {
+        traceRecorder_beginChunk(i);
+        traceRecorder_begin("work");
+        traceRecorder_end("work");
+        traceRecorder_end("chunk");
+    }
+    traceRecorder_finish();
+    traceRecorder_end("dropped");
+
+    FILE *fh = safe_fopen(traceFile, "r");
+    char *trace = stFile_getLineFromFile(fh);
+    stList *lines = stList_construct3(0, free);
+    while (trace != NULL) {
+        stList_append(lines, trace);
+        trace = stFile_getLineFromFile(fh);
+    }
+    fclose(fh);
+    trace = stString_join2("\n", lines);
+
+    CuAssertTrue(testCase, strstr(trace, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [") == trace);
+    CuAssertIntEquals(testCase, 0, countSubstrings(trace, "dropped"));
+    CuAssertIntEquals(testCase, chunkCount, countSubstrings(trace, "{\"name\": \"chunk\", \"ph\": \"B\""));
+    CuAssertIntEquals(testCase, chunkCount, countSubstrings(trace, "{\"name\": \"chunk\", \"ph\": \"E\""));
+    CuAssertIntEquals(testCase, chunkCount, countSubstrings(trace, "{\"name\": \"work\", \"ph\": \"B\""));
+    for (int64_t i = 0; i < chunkCount; i++) {
+        char *args = stString_print("\"args\": {\"chunk\": %" PRId64 "}", i);
+        CuAssertIntEquals(testCase, 1, countSubstrings(trace, args));
+        free(args);
+    }
+
+    // each thread's events are nested in the order recorded
+    for (int64_t i = 1; i < stList_length(lines); i++) {
+        char *line = stList_get(lines, i);
+        if (strstr(line, "\"name\": \"work\", \"ph\": \"B\"") != NULL) {
+            CuAssertTrue(testCase, strstr(stList_get(lines, i - 1), "\"name\": \"chunk\", \"ph\": \"B\"") != NULL);
+            CuAssertTrue(testCase, strstr(stList_get(lines, i + 1), "\"name\": \"work\", \"ph\": \"E\"") != NULL);
+            CuAssertTrue(testCase, strstr(stList_get(lines, i + 2), "\"name\": \"chunk\", \"ph\": \"E\"") != NULL);
+        }
+    }
+
+    free(trace);
+    stList_destruct(lines);
+    stFile_rmrf(traceFile);
+}
+
+static int64_t logBufferTestEvaluations = 0;
+
+static int64_t logBufferTest_evaluate() {
+    logBufferTestEvaluations++;
+    return 0;
+}
+
+static void test_logBuffer(CuTest *testCase) {
+    /*
+     * Test that the lines logged by many threads through their buffers are each written out whole, including lines
+     * longer than a buffer and lines of fields, and that a line filtered by the log level is not formatted.
+     */
+    char *logFile = "./tmp.log";
+    enum stLogLevel logLevel = st_getLogLevel();
+    st_setLogLevel(off);
+    logBuffer_info("%" PRId64 "\n", logBufferTest_evaluate());
+    CuAssertIntEquals(testCase, 0, logBufferTestEvaluations);
+    st_setLogLevel(info);
+
+    FILE *fh = safe_fopen(logFile, "w");
+    logBuffer_start(fh);
+    int64_t lineNo = 2000;
+    char *longLine = st_malloc(LOG_BUFFER_SIZE + 2);
+    memset(longLine, 'x', LOG_BUFFER_SIZE);
+    longLine[LOG_BUFFER_SIZE] = '\n';
+    longLine[LOG_BUFFER_SIZE + 1] = '\0';
+    #pragma omp parallel for
+    for (int64_t i = 0; i < lineNo; i++) {
+        if (i % 500 == 0) {
+            logBuffer_info("%s", longLine);
+        } else if (i % 2 == 0) {
+            logBuffer_info("line %" PRId64 " %0*d\n", i, (int) (i % 300), 0);
+        } else {
+            logBuffer_infoFields("test", "line=%" PRId64 " odd=true\n", i);
+        }
+    }
+    logBuffer_finish();
+    fclose(fh);
+    st_setLogLevel(logLevel);
+
+    fh = safe_fopen(logFile, "r");
+    bool *seen = st_calloc(lineNo, sizeof(bool));
+    int64_t longLineNo = 0;
+    char *line;
+    while ((line = stFile_getLineFromFile(fh)) != NULL) {
+        int64_t i;
+        if (strlen(line) == LOG_BUFFER_SIZE && strspn(line, "x") == LOG_BUFFER_SIZE) {
+            longLineNo++;
+        } else if (sscanf(line, "line %" SCNd64, &i) == 1) {
+            CuAssertTrue(testCase, i >= 0 && i < lineNo && i % 2 == 0 && !seen[i]);
+            char *padding = strrchr(line, ' ') + 1;
+            CuAssertIntEquals(testCase, i % 300 > 0 ? i % 300 : 1, strlen(padding));
+            CuAssertIntEquals(testCase, strlen(padding), strspn(padding, "0"));
+            seen[i] = TRUE;
+        } else {
+            CuAssertTrue(testCase, strstr(line, "EVENT event=test time=") == line);
+            char *fields = strstr(line, " line=");
+            CuAssertTrue(testCase, fields != NULL && sscanf(fields, " line=%" SCNd64, &i) == 1);
+            CuAssertTrue(testCase, i >= 0 && i < lineNo && i % 2 == 1 && !seen[i]);
+            CuAssertTrue(testCase, strstr(fields, " odd=true") != NULL);
+            seen[i] = TRUE;
+        }
+        free(line);
+    }
+    fclose(fh);
+    CuAssertIntEquals(testCase, lineNo / 500, longLineNo);
+    for (int64_t i = 0; i < lineNo; i++) {
+        CuAssertTrue(testCase, seen[i] || i % 500 == 0);
+    }
+
+    free(seen);
+    free(longLine);
+    stFile_rmrf(logFile);
+}
+
 void assertClippingAlignmentMatchCount(CuTest *testCase, int64_t idx, stList *alignment) {
     switch (idx) {
         case 0: //8S8M
@@ -1141,10 +2274,31 @@ CuSuite *chunkingTestSuite(void) {
 
     SUITE_ADD_TEST(suite, test_getRegionChunker);
     SUITE_ADD_TEST(suite, test_getChunksByChrom);
+    SUITE_ADD_TEST(suite, test_getAdaptiveChunks);
     SUITE_ADD_TEST(suite, test_getChunksBy100kb);
+    SUITE_ADD_TEST(suite, test_getChunksFromIndex);
+    SUITE_ADD_TEST(suite, test_getChunksFromDepthSummary);
+    SUITE_ADD_TEST(suite, test_getChunksFromBed);
+    SUITE_ADD_TEST(suite, test_chunkInputFingerprint);
     SUITE_ADD_TEST(suite, test_getQualityScores);
     SUITE_ADD_TEST(suite, test_getChunksWithBoundary);
     SUITE_ADD_TEST(suite, test_getChunksWithoutBoundary);
+    SUITE_ADD_TEST(suite, test_getReadsWithPooledFileHandles);
+    SUITE_ADD_TEST(suite, test_getReadsFromSeveralBams);
+    SUITE_ADD_TEST(suite, test_chunkPrefetcher);
+    SUITE_ADD_TEST(suite, test_bamChunkStream);
+    SUITE_ADD_TEST(suite, test_downsampleBeforeDecoding);
+    SUITE_ADD_TEST(suite, test_readsOfExcessivelyDeepChunks);
+    SUITE_ADD_TEST(suite, test_downsamplingIsOrderIndependent);
+    SUITE_ADD_TEST(suite, test_chunkScheduler);
+    SUITE_ADD_TEST(suite, test_chunkSchedulerIdleThreads);
+    SUITE_ADD_TEST(suite, test_chunkSchedulerMemoryBudget);
+    SUITE_ADD_TEST(suite, test_chunkTelemetry);
+    SUITE_ADD_TEST(suite, test_chunkTelemetryRunTotals);
+    SUITE_ADD_TEST(suite, test_chunkReplayBundle);
+    SUITE_ADD_TEST(suite, test_traceRecorder);
+    SUITE_ADD_TEST(suite, test_logBuffer);
+    SUITE_ADD_TEST(suite, test_chunkArena);
     SUITE_ADD_TEST(suite, test_getReadsWithSoftClipping);
     SUITE_ADD_TEST(suite, test_getReadsWithoutSoftClipping);
     SUITE_ADD_TEST(suite, test_readAlignmentsWithoutSoftclippingChunkStart);
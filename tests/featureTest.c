@@ -300,6 +300,52 @@ void test_truthAlignments(CuTest *testCase) {
     truthAlignmentTest(testCase, TRUTH_ALIGN_REG9_SEQ1, TRUTH_ALIGN_REG9_SEQ2);
 }
 
+void truthProjectionTest(CuTest *testCase, Params *params, char *consensusRaw, char* truthRaw) {
+    RleString *consensusRle = rleString_construct(consensusRaw);
+    RleString *truthRle = rleString_construct(truthRaw);
+    double score = 0;
+
+    stList *alignedPairs = alignConsensusAndTruthRLEWithExactMatchProjection(consensusRle, truthRle, &score,
+                                                                             params->polishParams);
+
+    // aligned pairs are in bounds and strictly increasing in both sequences
+    int64_t prevX = -1, prevY = -1;
+    for (int64_t i = 0; i < stList_length(alignedPairs); i++) {
+        stIntTuple *ap = stList_get(alignedPairs, i);
+        int64_t x = stIntTuple_get(ap, 0), y = stIntTuple_get(ap, 1);
+        CuAssertTrue(testCase, x > prevX && x < consensusRle->length);
+        CuAssertTrue(testCase, y > prevY && y < truthRle->length);
+        prevX = x;
+        prevY = y;
+    }
+
+    // identical sequences project straight through
+    if (strcmp(consensusRaw, truthRaw) == 0) {
+        CuAssertIntEquals(testCase, consensusRle->length, stList_length(alignedPairs));
+        for (int64_t i = 0; i < stList_length(alignedPairs); i++) {
+            stIntTuple *ap = stList_get(alignedPairs, i);
+            CuAssertIntEquals(testCase, i, stIntTuple_get(ap, 0));
+            CuAssertIntEquals(testCase, i, stIntTuple_get(ap, 1));
+        }
+    }
+
+    stList_destruct(alignedPairs);
+    rleString_destruct(consensusRle);
+    rleString_destruct(truthRle);
+}
+
+void test_truthAlignmentByExactMatchProjection(CuTest *testCase) {
+    Params *params = params_readParams(FEATURE_TEST_PARAMS);
+    params->polishParams->truthProjectionExactMatchLength = 64;
+    truthProjectionTest(testCase, params, TRUTH_ALIGN_REG6_SEQ1, TRUTH_ALIGN_REG6_SEQ1);
+    truthProjectionTest(testCase, params, TRUTH_ALIGN_REG6_SEQ1, TRUTH_ALIGN_REG6_SEQ2);
+    truthProjectionTest(testCase, params, TRUTH_ALIGN_REG6_SEQ1, TRUTH_ALIGN_REG6_SEQ3);
+    truthProjectionTest(testCase, params, TRUTH_ALIGN_REG7_SEQ1, TRUTH_ALIGN_REG7_SEQ2);
+    truthProjectionTest(testCase, params, TRUTH_ALIGN_REG8_SEQ1, TRUTH_ALIGN_REG8_SEQ2);
+    truthProjectionTest(testCase, params, TRUTH_ALIGN_REG9_SEQ1, TRUTH_ALIGN_REG9_SEQ2);
+    params_destruct(params);
+}
+
 CuSuite* featureTestSuite(void) {
     CuSuite* suite = CuSuiteNew();
 //
@@ -310,6 +356,7 @@ CuSuite* featureTestSuite(void) {
     SUITE_ADD_TEST(suite, test_simpleWeightFeatureGeneration);
     SUITE_ADD_TEST(suite, test_splitRleWeightFeatureGeneration);
     SUITE_ADD_TEST(suite, test_truthAlignments);
+    SUITE_ADD_TEST(suite, test_truthAlignmentByExactMatchProjection);
 
     return suite;
 }
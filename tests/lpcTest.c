@@ -11,6 +11,7 @@
 #include "localPhasingCorrectness.h"
 
 static char *TEST_VCF = "../tests/data/localPhasingCorrectness/smallPhased.vcf";
+static char *TEST_VCF_BGZ = "temp_smallPhased.vcf.gz";
 
 // in lieu of a separate algorithm for switch correctness, i'll just have an independent
 // implementation
@@ -370,6 +371,60 @@ void test_correctValueWithPhaseSets(CuTest *testCase) {
     }
 }
 
+void test_correctValueForDecays(CuTest *testCase) {
+    
+    int64_t numDecayValues = 11;
+    double decayValues[11] = {0.0, 0.1, 0.2, 0.3, 0.4, 0.5, 0.6, 0.7, 0.8, 0.9, 1.0};
+    
+    int64_t numSites = 40;
+    stList *alleles[2];
+    for (int64_t i = 0; i < 2; ++i) {
+        alleles[i] = stList_construct();
+        for (int64_t j = 0; j < numSites; ++j) {
+            stList *a = stList_construct3(0, free);
+            stList_append(a, stString_copy("A"));
+            stList_append(a, stString_copy("C"));
+            stList_append(alleles[i], a);
+        }
+    }
+    
+    // random phasing errors and phase set breaks in the query
+    stList *variants[2];
+    for (int64_t i = 0; i < 2; ++i) {
+        variants[i] = stList_construct3(0, (void (*)(void *)) phasedVariant_destruct);
+        for (int64_t j = 0; j < numSites; ++j) {
+            bool flip = i == 1 && st_random() < 0.2;
+            char *phaseSet = stString_print("ps%"PRId64, i == 0 ? 0 : j / 7 + (j % 7 == 3 ? 1 : 0));
+            stList_append(variants[i],
+                          phasedVariant_construct("ref", j * j + 1, 60.0,
+                                                  stList_get(alleles[i], j),
+                                                  flip ? 1 : 0, flip ? 0 : 1, phaseSet));
+            free(phaseSet);
+        }
+    }
+    
+    for (int64_t byDist = 0; byDist < 2; ++byDist) {
+        for (int64_t crossBlockCorrect = 0; crossBlockCorrect < 2; ++crossBlockCorrect) {
+            double correctness[11], effectiveSizes[11];
+            phasingCorrectnessForDecays(variants[0], variants[1], decayValues, numDecayValues, byDist,
+                                        crossBlockCorrect, correctness, effectiveSizes);
+            for (int64_t i = 0; i < numDecayValues; ++i) {
+                double effectiveSize;
+                double expected = phasingCorrectness(variants[0], variants[1], decayValues[i],
+                                                     byDist, crossBlockCorrect, &effectiveSize, NULL);
+                CuAssertDblEquals(testCase, expected, correctness[i], 0.000001);
+                CuAssertDblEquals(testCase, effectiveSize, effectiveSizes[i], 0.000001);
+            }
+        }
+    }
+    
+    // clean up
+    for (int64_t i = 0; i < 2; ++i) {
+        stList_destruct(variants[i]);
+        stList_destruct(alleles[i]);
+    }
+}
+
 int64_t lpcIntegrationTest(char *truthVcfFile, char *queryVcfFile) {
     // Run localPhasingCorrectness
     char *command = stString_print("./calcLocalPhasingCorrectness %s %s > /dev/null", truthVcfFile, queryVcfFile);
@@ -385,6 +440,60 @@ void test_executableExecutes(CuTest *testCase) {
     CuAssertTrue(testCase, ret == 0);
 }
 
+void test_phasedVcfReaderMatchesWholeFile(CuTest *testCase) {
+    // rewrite the vcf bgzipped, then tabix it
+    htsFile *in = hts_open(TEST_VCF, "r");
+    htsFile *out = hts_open(TEST_VCF_BGZ, "wz");
+    CuAssertTrue(testCase, in != NULL && out != NULL);
+    bcf_hdr_t *hdr = bcf_hdr_read(in);
+    CuAssertTrue(testCase, bcf_hdr_write(out, hdr) == 0);
+    bcf1_t *rec = bcf_init();
+    while (bcf_read(in, hdr, rec) >= 0) {
+        CuAssertTrue(testCase, bcf_write(out, hdr, rec) == 0);
+    }
+    bcf_destroy(rec);
+    bcf_hdr_destroy(hdr);
+    hts_close(in);
+    hts_close(out);
+    CuAssertTrue(testCase, tbx_index_build(TEST_VCF_BGZ, 0, &tbx_conf_vcf) == 0);
+
+    // each contig read through the index has the variants of the whole file
+    stHash *variants = getPhasedVariants(TEST_VCF);
+    PhasedVcfReader *reader = phasedVcfReader_construct(TEST_VCF_BGZ);
+    stList *contigs = phasedVcfReader_getContigs(reader);
+    CuAssertIntEquals(testCase, stHash_size(variants), stList_length(contigs));
+    for (int64_t i = 0; i < stList_length(contigs); i++) {
+        stList *contigVariants = stHash_search(variants, stList_get(contigs, i));
+        stList *readerContigVariants = phasedVcfReader_getContigVariants(reader, stList_get(contigs, i));
+        CuAssertPtrNotNull(testCase, contigVariants);
+        CuAssertIntEquals(testCase, stList_length(contigVariants), stList_length(readerContigVariants));
+        for (int64_t j = 0; j < stList_length(contigVariants); j++) {
+            PhasedVariant *pv = stList_get(contigVariants, j);
+            PhasedVariant *readerPv = stList_get(readerContigVariants, j);
+            CuAssertIntEquals(testCase, pv->refPos, readerPv->refPos);
+            CuAssertIntEquals(testCase, pv->gt1, readerPv->gt1);
+            CuAssertIntEquals(testCase, pv->gt2, readerPv->gt2);
+            CuAssertStrEquals(testCase, pv->phaseSet, readerPv->phaseSet);
+        }
+        stList_destruct(readerContigVariants);
+    }
+
+    // as is the streamed evaluation
+    char *command = stString_print("./calcLocalPhasingCorrectness --streaming %s %s > /dev/null", TEST_VCF_BGZ,
+                                   TEST_VCF_BGZ);
+    CuAssertTrue(testCase, st_system(command) == 0);
+    free(command);
+
+    // clean up
+    stList_destruct(contigs);
+    phasedVcfReader_destruct(reader);
+    stHash_destruct(variants);
+    remove(TEST_VCF_BGZ);
+    char *indexFile = stString_print("%s.tbi", TEST_VCF_BGZ);
+    remove(indexFile);
+    free(indexFile);
+}
+
 CuSuite *lpcTestSuite(void) {
     
     //st_setLogLevel(debug);
@@ -394,6 +503,8 @@ CuSuite *lpcTestSuite(void) {
     SUITE_ADD_TEST(suite, test_executableExecutes);
     SUITE_ADD_TEST(suite, test_correctValueSimple);
     SUITE_ADD_TEST(suite, test_correctValueWithPhaseSets);
+    SUITE_ADD_TEST(suite, test_correctValueForDecays);
+    SUITE_ADD_TEST(suite, test_phasedVcfReaderMatchesWholeFile);
 
     return suite;
 }
@@ -250,14 +250,131 @@ void verifyVcfGenotypes(CuTest *testCase, char *vcfFile1, char *vcfFile2) {
     hts_close(fp2);
 }
 
-void test_marginPhaseIntegration(CuTest *testCase) {
+static int64_t marginPolishPhasedVcfTest(char *command, char *paramsFile, char *options, char *base) {
+    // Run margin polish (or margin stitch) in diploid mode writing the phased vcf
+    char *commandString = stString_print("./margin %s %s %s %s --diploid --outputPhasedVcf %s %s --outputBase %s",
+                                         command, BAM_FILE, REF_FILE, paramsFile, options,
+                                         verbose ? "--logLevel DEBUG" : "--logLevel INFO", base);
+    st_logInfo("> Running command: %s\n", commandString);
+
+    int64_t i = st_system(commandString);
+    free(commandString);
+    return i;
+}
+
+static void verifyPhasedVcfGenotypes(CuTest *testCase, char *vcfFile, char *truthVcfFile) {
+    /*
+     * Checks every record of the vcf is a phased het, and that most are at (or next to, as the alleles of a bubble
+     * may be padded) a het of the truth vcf
+     */
+    stList *truthHetPositions = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
+    htsFile *fp = hts_open(truthVcfFile, "r");
+    bcf_hdr_t *hdr = bcf_hdr_read(fp);
+    bcf1_t *rec = bcf_init();
+    int32_t *gt_arr = NULL, ngt_arr = 0;
+    while (bcf_read(fp, hdr, rec) == 0) {
+        int ngt = bcf_get_genotypes(hdr, rec, &gt_arr, &ngt_arr);
+        if (ngt == 2 && !bcf_gt_is_missing(gt_arr[0]) && !bcf_gt_is_missing(gt_arr[1]) &&
+            bcf_gt_allele(gt_arr[0]) != bcf_gt_allele(gt_arr[1])) {
+            stList_append(truthHetPositions, stIntTuple_construct1(rec->pos));
+        }
+    }
+    bcf_destroy(rec);
+    bcf_hdr_destroy(hdr);
+    hts_close(fp);
+
+    fp = hts_open(vcfFile, "r");
+    CuAssertTrue(testCase, fp != NULL);
+    hdr = bcf_hdr_read(fp);
+    rec = bcf_init();
+    int64_t recordNo = 0, truthHetNo = 0, previousPos = -1;
+    while (bcf_read(fp, hdr, rec) == 0) {
+        recordNo++;
+        CuAssertTrue(testCase, rec->pos >= previousPos);
+        previousPos = rec->pos;
+        CuAssertIntEquals(testCase, 2, bcf_get_genotypes(hdr, rec, &gt_arr, &ngt_arr));
+        CuAssertTrue(testCase, !bcf_gt_is_missing(gt_arr[0]) && !bcf_gt_is_missing(gt_arr[1]));
+        CuAssertTrue(testCase, bcf_gt_is_phased(gt_arr[1]));
+        CuAssertTrue(testCase, bcf_gt_allele(gt_arr[0]) != bcf_gt_allele(gt_arr[1]));
+        for (int64_t j = 0; j < stList_length(truthHetPositions); j++) {
+            if (llabs(stIntTuple_get(stList_get(truthHetPositions, j), 0) - rec->pos) <= 10) {
+                truthHetNo++;
+                break;
+            }
+        }
+    }
+    CuAssertTrue(testCase, recordNo > 0);
+    CuAssertTrue(testCase, truthHetNo * 2 > recordNo);
+
+    // cleanup
+    free(gt_arr);
+    bcf_destroy(rec);
+    bcf_hdr_destroy(hdr);
+    hts_close(fp);
+    stList_destruct(truthHetPositions);
+}
+
+void test_marginPolishPhasedVcf(CuTest *testCase) {
+    /*
+     * Checks diploid polishing writes the phased vcf, with the genotypes of the hets of the truth vcf, and that
+     * stitching the chunks journaled by shards of the run writes the same genotypes
+     */
+    char *base = "temp_output_polish_phased";
+    char *stitchedBase = "temp_output_polish_phased_stitched";
+
+    // Make a temporary params file with smaller default chunk sizes
+    char *tempParamsFile = "params_polish_phased.temp";
+    FILE *fh = fopen(tempParamsFile, "w");
+    fprintf(fh, "{ \"include\" : \"%s\", \"polish\": { \"filterAlignmentsWithMapQBelowThisThreshold\": 0,\"chunkSize\": 20000,\"chunkBoundary\": 500 } }", POLISH_PARAMS_FILE);
+    fclose(fh);
+
+    // A single run
+    CuAssertTrue(testCase, marginPolishPhasedVcfTest("polish", tempParamsFile, "", base) == 0);
+    char *outputVcfFile = stString_print("%s.phased.vcf", base);
+    CuAssertTrue(testCase, access(outputVcfFile, F_OK) == 0);
+    verifyPhasedVcfGenotypes(testCase, outputVcfFile, VCF_FILE);
+
+    // The shards of a run, whose journaled chunks, with their phased variants, are then stitched
+    for (int64_t shard = 0; shard < 2; shard++) {
+        char *shardOption = stString_print("--shard %" PRId64 "/2", shard);
+        CuAssertTrue(testCase, marginPolishPhasedVcfTest("polish", tempParamsFile, shardOption, stitchedBase) == 0);
+        free(shardOption);
+    }
+    CuAssertTrue(testCase, marginPolishPhasedVcfTest("stitch polish 2", tempParamsFile, "", stitchedBase) == 0);
+    char *stitchedVcfFile = stString_print("%s.phased.vcf", stitchedBase);
+    CuAssertTrue(testCase, access(stitchedVcfFile, F_OK) == 0);
+    verifyPhasedVcfGenotypes(testCase, stitchedVcfFile, VCF_FILE);
+    verifyVcfGenotypes(testCase, stitchedVcfFile, outputVcfFile);
+
+    // Cleanup
+    char *outputFiles[] = { "fa.hap1", "fa.hap2", "phased.vcf" };
+    for (int64_t i = 0; i < 3; i++) {
+        char *outputFile = stString_print("%s.%s", base, outputFiles[i]);
+        stFile_rmrf(outputFile);
+        free(outputFile);
+        outputFile = stString_print("%s.%s", stitchedBase, outputFiles[i]);
+        stFile_rmrf(outputFile);
+        free(outputFile);
+    }
+    free(outputVcfFile);
+    free(stitchedVcfFile);
+    stFile_rmrf(tempParamsFile);
+}
+
+static void test_marginPhaseIntegration2(CuTest *testCase, bool stitchOnline) {
     struct stat st;
     char *base = "temp_output_phase";
 
     // Make a temporary params file with smaller default chunk sizes
     char *tempParamsFile = "params_phase.temp";
     FILE *fh = fopen(tempParamsFile, "w");
-    fprintf(fh, "{ \"include\" : \"%s\", \"polish\": { \"chunkSize\": 20000,\"chunkBoundary\": 500 } }", PHASE_PARAMS_FILE);
+    if (stitchOnline) {
+        // Stitch and write the vcf as the chunks are done, compressed and indexed
+        fprintf(fh, "{ \"include\" : \"%s\", \"polish\": { \"chunkSize\": 20000,\"chunkBoundary\": 500, "
+                    "\"stitchOnline\": true }, \"phase\": { \"compressPhasedVcf\": true } }", PHASE_PARAMS_FILE);
+    } else {
+        fprintf(fh, "{ \"include\" : \"%s\", \"polish\": { \"chunkSize\": 20000,\"chunkBoundary\": 500 } }", PHASE_PARAMS_FILE);
+    }
     fclose(fh);
 
     // Run in diploid mode and get all the file outputs
@@ -266,7 +383,8 @@ void test_marginPhaseIntegration(CuTest *testCase) {
 
     // outputs
     char *outputBamFile = "temp_output_phase.haplotagged.bam";
-    char *outputVcfFile = "temp_output_phase.phased.vcf";
+    char *outputVcfFile = stitchOnline ? "temp_output_phase.phased.vcf.gz" : "temp_output_phase.phased.vcf";
+    char *outputVcfIndexFile = "temp_output_phase.phased.vcf.gz.tbi";
     char *outputPhasesetFile = "temp_output_phase.phaseset.bed";
 
     // test bam
@@ -279,6 +397,7 @@ void test_marginPhaseIntegration(CuTest *testCase) {
     stat(outputVcfFile, &st);
     CuAssertTrue(testCase, st.st_size > 0);
     verifyVcfGenotypes(testCase, outputVcfFile, VCF_FILE);
+    CuAssertTrue(testCase, !stitchOnline || access(outputVcfIndexFile, F_OK) == 0);
 
     CuAssertTrue(testCase, access(outputPhasesetFile, F_OK) == 0);
     stat(outputPhasesetFile, &st);
@@ -289,13 +408,217 @@ void test_marginPhaseIntegration(CuTest *testCase) {
     stFile_rmrf(outputVcfFile);
     stFile_rmrf(outputBamFile);
     stFile_rmrf(outputPhasesetFile);
+    if (stitchOnline) {
+        stFile_rmrf(outputVcfIndexFile);
+    }
+}
+
+void test_marginPhaseIntegration(CuTest *testCase) {
+    test_marginPhaseIntegration2(testCase, 0);
+}
+
+void test_marginPhaseIntegrationStitchOnline(CuTest *testCase) {
+    test_marginPhaseIntegration2(testCase, 1);
+}
+
+void test_marginCohortIntegration(CuTest *testCase) {
+    /*
+     * Phases a cohort of two samples, each of the reads of the real data, with margin cohort, and checks each sample's
+     * haplotagged bam and phased vcf are as margin phase writes them
+     */
+    char *base = "temp_output_cohort";
+
+    // Make a temporary params file with smaller default chunk sizes, and the sample sheet
+    char *tempParamsFile = "params_cohort.temp";
+    FILE *fh = fopen(tempParamsFile, "w");
+    fprintf(fh, "{ \"include\" : \"%s\", \"polish\": { \"chunkSize\": 20000,\"chunkBoundary\": 500 } }", PHASE_PARAMS_FILE);
+    fclose(fh);
+    char *sampleSheetFile = "samples_cohort.temp";
+    char *sampleNames[] = { "sample1", "sample2" };
+    fh = fopen(sampleSheetFile, "w");
+    fprintf(fh, "# SAMPLE_NAME\tALIGN_BAM\tVARIANT_VCF\n");
+    for (int64_t i = 0; i < 2; i++) {
+        fprintf(fh, "%s\t%s\t%s\n", sampleNames[i], BAM_FILE, VCF_FILE);
+    }
+    fclose(fh);
+
+    // Run on two threads, so the chunks of the samples are phased together
+    char *command = stString_print("./margin cohort %s %s %s --threads 2 %s --outputBase %s", sampleSheetFile,
+                                   REF_FILE, tempParamsFile, verbose ? "--logLevel DEBUG" : "--logLevel INFO", base);
+    st_logInfo("> Running command: %s\n", command);
+    CuAssertTrue(testCase, st_system(command) == 0);
+    free(command);
+
+    // outputs of each sample
+    char *outputVcfFiles[2];
+    for (int64_t i = 0; i < 2; i++) {
+        char *outputBamFile = stString_print("%s.%s.haplotagged.bam", base, sampleNames[i]);
+        char *outputBamIndexFile = stString_print("%s.bai", outputBamFile);
+        outputVcfFiles[i] = stString_print("%s.%s.phased.vcf", base, sampleNames[i]);
+        char *outputPhasesetFile = stString_print("%s.%s.phaseset.bed", base, sampleNames[i]);
+        CuAssertTrue(testCase, access(outputBamFile, F_OK) == 0);
+        verifyHaplotaggedReads(testCase, outputBamFile);
+        CuAssertTrue(testCase, access(outputVcfFiles[i], F_OK) == 0);
+        verifyVcfGenotypes(testCase, outputVcfFiles[i], VCF_FILE);
+        CuAssertTrue(testCase, access(outputPhasesetFile, F_OK) == 0);
+        stFile_rmrf(outputBamFile);
+        stFile_rmrf(outputBamIndexFile);
+        stFile_rmrf(outputPhasesetFile);
+        free(outputBamFile);
+        free(outputBamIndexFile);
+        free(outputPhasesetFile);
+    }
+
+    // the samples have the same reads, so are phased the same
+    verifyVcfGenotypes(testCase, outputVcfFiles[0], outputVcfFiles[1]);
+
+    // Cleanup
+    for (int64_t i = 0; i < 2; i++) {
+        stFile_rmrf(outputVcfFiles[i]);
+        free(outputVcfFiles[i]);
+    }
+    stFile_rmrf(sampleSheetFile);
+    stFile_rmrf(tempParamsFile);
+}
+
+static char *readServeResponse(CuTest *testCase, FILE *fh, int64_t *status, char *request) {
+    /*
+     * Reads a response of margin serve, checking it is for the request, and returns its result.
+     */
+    char *line = stFile_getLineFromFile(fh);
+    CuAssertTrue(testCase, line != NULL);
+    int64_t resultLength;
+    int offset;
+    CuAssertIntEquals(testCase, 2, sscanf(line, "%"SCNd64"\t%"SCNd64"\t%n", status, &resultLength, &offset));
+    CuAssertStrEquals(testCase, request, line + offset);
+    char *result = st_calloc(resultLength + 1, sizeof(char));
+    CuAssertIntEquals(testCase, resultLength, fread(result, sizeof(char), resultLength, fh));
+    free(line);
+    return result;
+}
+
+static char *readWholeFile(CuTest *testCase, char *file) {
+    struct stat st;
+    CuAssertTrue(testCase, stat(file, &st) == 0);
+    char *contents = st_calloc(st.st_size + 1, sizeof(char));
+    FILE *fh = fopen(file, "rb");
+    CuAssertIntEquals(testCase, st.st_size, fread(contents, sizeof(char), st.st_size, fh));
+    fclose(fh);
+    return contents;
+}
+
+void test_marginServeIntegration(CuTest *testCase) {
+    /*
+     * Drives phase and haplotag requests of the real data through margin serve's stdin, twice for the same files so
+     * the second is run against what the server kept of the first, and checks the results it streams back
+     */
+    char *base = "temp_output_serve";
+
+    // Make a temporary params file with smaller default chunk sizes
+    char *tempParamsFile = "params_serve.temp";
+    FILE *fh = fopen(tempParamsFile, "w");
+    fprintf(fh, "{ \"include\" : \"%s\", \"polish\": { \"chunkSize\": 20000,\"chunkBoundary\": 500 } }", PHASE_PARAMS_FILE);
+    fclose(fh);
+
+    // the requests
+    char *logString = verbose ? "--logLevel DEBUG" : "--logLevel INFO";
+    char *requests[4];
+    requests[0] = stString_print("phase %s %s %s %s --region chr20 %s --outputBase %s.1", BAM_FILE, REF_FILE,
+                                 VCF_FILE, tempParamsFile, logString, base);
+    requests[1] = stString_print("phase %s %s %s %s --region chr20 %s --outputBase %s.2", BAM_FILE, REF_FILE,
+                                 VCF_FILE, tempParamsFile, logString, base);
+    requests[2] = stString_print("haplotag %s %s %s %s --region chr20 %s --outputBase %s.3", BAM_FILE, REF_FILE,
+                                 VCF_FILE, tempParamsFile, logString, base);
+    requests[3] = stString_print("unknown %s", BAM_FILE);
+    char *requestsFile = "requests_serve.temp";
+    char *responsesFile = "responses_serve.temp";
+    fh = fopen(requestsFile, "w");
+    for (int64_t i = 0; i < 4; i++) {
+        fprintf(fh, "%s\n", requests[i]);
+    }
+    fclose(fh);
+
+    // a result file of an earlier run, which is not the first request's and so must not be streamed with its result
+    char *staleVcfFile = "temp_output_serve.1.phased.vcf.gz";
+    fh = fopen(staleVcfFile, "w");
+    fprintf(fh, "stale\n");
+    fclose(fh);
+
+    char *command = stString_print("./margin serve %s < %s > %s", tempParamsFile, requestsFile, responsesFile);
+    st_logInfo("> Running command: %s\n", command);
+    CuAssertTrue(testCase, st_system(command) == 0);
+    free(command);
+
+    // the phase requests stream their phased vcfs, the same both times
+    fh = fopen(responsesFile, "rb");
+    char *vcfResults[2];
+    for (int64_t i = 0; i < 2; i++) {
+        int64_t status;
+        vcfResults[i] = readServeResponse(testCase, fh, &status, requests[i]);
+        CuAssertIntEquals(testCase, 0, status);
+        char *outputVcfFile = stString_print("%s.%"PRId64".phased.vcf", base, i + 1);
+        char *outputVcf = readWholeFile(testCase, outputVcfFile);
+        CuAssertStrEquals(testCase, outputVcf, vcfResults[i]);
+        verifyVcfGenotypes(testCase, outputVcfFile, VCF_FILE);
+        free(outputVcf);
+        free(outputVcfFile);
+    }
+    verifyVcfGenotypes(testCase, "temp_output_serve.1.phased.vcf", "temp_output_serve.2.phased.vcf");
+    CuAssertTrue(testCase, access(staleVcfFile, F_OK) != 0);
+
+    // the haplotag request streams its haplotagged bam, and writes no vcf
+    int64_t status;
+    char *bamResult = readServeResponse(testCase, fh, &status, requests[2]);
+    CuAssertIntEquals(testCase, 0, status);
+    char *outputBamFile = "temp_output_serve.3.haplotagged.bam";
+    struct stat st;
+    CuAssertTrue(testCase, stat(outputBamFile, &st) == 0);
+    CuAssertTrue(testCase, st.st_size > 0);
+    char *outputBam = readWholeFile(testCase, outputBamFile);
+    CuAssertTrue(testCase, memcmp(outputBam, bamResult, st.st_size) == 0);
+    verifyHaplotaggedReads(testCase, outputBamFile);
+    CuAssertTrue(testCase, access("temp_output_serve.3.phased.vcf", F_OK) != 0);
+
+    // the unknown request fails, without stopping the server
+    char *unknownResult = readServeResponse(testCase, fh, &status, requests[3]);
+    CuAssertIntEquals(testCase, 1, status);
+    CuAssertStrEquals(testCase, "", unknownResult);
+    CuAssertTrue(testCase, stFile_getLineFromFile(fh) == NULL);
+    fclose(fh);
+
+    // Cleanup
+    char *outputSuffixes[] = { "phased.vcf", "phaseset.bed", "haplotagged.bam", "haplotagged.bam.bai" };
+    for (int64_t i = 0; i < 3; i++) {
+        for (int64_t j = 0; j < 4; j++) {
+            char *outputFile = stString_print("%s.%"PRId64".%s", base, i + 1, outputSuffixes[j]);
+            if (access(outputFile, F_OK) == 0) {
+                stFile_rmrf(outputFile);
+            }
+            free(outputFile);
+        }
+    }
+    for (int64_t i = 0; i < 4; i++) {
+        free(requests[i]);
+    }
+    free(vcfResults[0]);
+    free(vcfResults[1]);
+    free(bamResult);
+    free(outputBam);
+    free(unknownResult);
+    stFile_rmrf(requestsFile);
+    stFile_rmrf(responsesFile);
+    stFile_rmrf(tempParamsFile);
 }
 
 CuSuite *marginIntegrationTestSuite(void) {
     CuSuite *suite = CuSuiteNew();
     SUITE_ADD_TEST(suite, test_marginPolishIntegration);
     SUITE_ADD_TEST(suite, test_marginIntegrationInMemory);
+    SUITE_ADD_TEST(suite, test_marginPolishPhasedVcf);
     SUITE_ADD_TEST(suite, test_marginPhaseIntegration);
+    SUITE_ADD_TEST(suite, test_marginPhaseIntegrationStitchOnline);
+    SUITE_ADD_TEST(suite, test_marginCohortIntegration);
+    SUITE_ADD_TEST(suite, test_marginServeIntegration);
 
     return suite;
 }
@@ -138,6 +138,25 @@ void test_logAdd(CuTest *testCase) {
     }
 }
 
+void test_logAddKernels(CuTest *testCase) {
+    LogAddKernel kernels[] = {LOG_ADD_EXACT, LOG_ADD_APPROXIMATE, LOG_ADD_TABLE};
+    for (int64_t k = 0; k < 3; k++) {
+        setLogAddKernel(kernels[k]);
+        for (int64_t test = 0; test < 100000; test++) {
+            double x = log(st_random()) * 10, y = log(st_random()) * 10;
+            double z = logMath_logAddExact(x, y);
+            CuAssertDblEquals(testCase, z, logAdd(x, y), 0.001);
+            CuAssertDblEquals(testCase, z, logAddPrecise(x, y), 0.001);
+            CuAssertDblEquals(testCase, logMath_logAddApproximate(x, y), logMath_logAddApproximateBranchless(x, y),
+                              0.0);
+        }
+        CuAssertDblEquals(testCase, LOG_ZERO, logAdd(LOG_ZERO, LOG_ZERO), 0.0);
+        CuAssertDblEquals(testCase, -1.0, logAdd(LOG_ZERO, -1.0), 0.0);
+        CuAssertDblEquals(testCase, -1.0, logAddPrecise(-1.0, LOG_ZERO), 0.0);
+    }
+    setLogAddKernel(LOG_ADD_DEFAULT);
+}
+
 void test_symbol(CuTest *testCase) {
     Alphabet *a = alphabet_constructNucleotide();
     Symbol cA[9] = {0, 1, 2, 3, 4, 3, 4, 1, 2};
@@ -145,6 +164,13 @@ void test_symbol(CuTest *testCase) {
     for (int64_t i = 0; i < 9; i++) {
         CuAssertTrue(testCase, cA[i] == cA2.sequence[i]);
     }
+    // A view shares the symbols of the string
+    SymbolString cA3 = symbolString_getView(cA2, 2, 5);
+    CuAssertIntEquals(testCase, 5, cA3.length);
+    CuAssertTrue(testCase, cA3.sequence == &(cA2.sequence[2]));
+    for (int64_t i = 0; i < 5; i++) {
+        CuAssertTrue(testCase, cA[i + 2] == cA3.sequence[i]);
+    }
     symbolString_destruct(cA2);
     alphabet_destruct(a);
 }
@@ -1150,6 +1176,86 @@ void test_em_3State(CuTest *testCase) {
     test_em(testCase, threeState, nucleotideEmissions);
 }
 
+void test_hmm_shardedExpectations(CuTest *testCase) {
+    /*
+     * The expectations of a set of sequence pairs accumulated into separate shards and added together are those
+     * accumulated into one hmm.
+     */
+    for (int64_t test = 0; test < 20; test++) {
+        PairwiseAlignmentParameters *p = pairwiseAlignmentBandingParameters_construct();
+        Hmm *model = hmm_constructEmpty(0.0, threeState, nucleotideEmissions);
+        hmm_randomise(model);
+        StateMachine *sM = hmm_getStateMachine(model);
+        Alphabet *a = alphabet_constructNucleotide();
+
+        Hmm *hmm = hmm_constructEmpty(0.0, threeState, nucleotideEmissions);
+        Hmm *shards[2] = { hmm_constructEmpty(0.0, threeState, nucleotideEmissions),
+                           hmm_constructEmpty(0.0, threeState, nucleotideEmissions) };
+        for (int64_t i = 0; i < 4; i++) {
+            char *sX = getRandomSequence(st_randomInt(10, 100));
+            char *sY = evolveSequence(sX);
+            SymbolString sX2 = symbolString_construct(sX, 0, strlen(sX), a);
+            SymbolString sY2 = symbolString_construct(sY, 0, strlen(sY), a);
+            getExpectations(sM, hmm, sX2, sY2, p, 0, 0);
+            getExpectations(sM, shards[i % 2], sX2, sY2, p, 0, 0);
+            symbolString_destruct(sX2);
+            symbolString_destruct(sY2);
+            free(sX);
+            free(sY);
+        }
+        hmm_addExpectations(shards[0], shards[1]);
+
+        for (int64_t i = 0; i < hmm->stateNumber * hmm->stateNumber; i++) {
+            CuAssertDblEquals(testCase, hmm->transitions[i], shards[0]->transitions[i],
+                              1.0e-9 * (1.0 + hmm->transitions[i]));
+        }
+        double totalEmissions = 0.0;
+        for (int64_t i = 0; i < hmm->totalEmissions; i++) {
+            CuAssertDblEquals(testCase, hmm->emissions[i], shards[0]->emissions[i], 1.0e-9 * (1.0 + hmm->emissions[i]));
+            totalEmissions += hmm->emissions[i];
+        }
+        CuAssertDblEquals(testCase, hmm->likelihood, shards[0]->likelihood, 1.0e-9 * (1.0 + fabs(hmm->likelihood)));
+        CuAssertTrue(testCase, totalEmissions > 0.0);
+
+        // Cleanup
+        hmm_destruct(hmm);
+        hmm_destruct(shards[0]);
+        hmm_destruct(shards[1]);
+        hmm_destruct(model);
+        stateMachine_destruct(sM);
+        alphabet_destruct(a);
+        pairwiseAlignmentBandingParameters_destruct(p);
+    }
+}
+
+void test_hmm_reverseComplementEmissions(CuTest *testCase) {
+    /*
+     * Reverse complementing the emissions swaps each emission for that of the complemented bases, as for the reverse
+     * strand state machine, and doing it twice gives back the emissions.
+     */
+    Hmm *hmm = hmm_constructEmpty(0.0, threeState, nucleotideEmissions);
+    hmm_randomise(hmm);
+    Hmm *reverseHmm = hmm_constructEmpty(0.0, threeState, nucleotideEmissions);
+    hmm_addExpectations(reverseHmm, hmm);
+    hmm_reverseComplementEmissions(reverseHmm);
+    for (int64_t x = 0; x < 4; x++) {
+        for (int64_t y = 0; y < 4; y++) {
+            CuAssertDblEquals(testCase, hmm_getEmissionsExpectation(hmm, 0, x * 4 + y),
+                              hmm_getEmissionsExpectation(reverseHmm, 0, (3 - x) * 4 + (3 - y)), 0.0);
+        }
+        for (int64_t state = 1; state < 3; state++) {
+            CuAssertDblEquals(testCase, hmm_getEmissionsExpectation(hmm, state, x),
+                              hmm_getEmissionsExpectation(reverseHmm, state, 3 - x), 0.0);
+        }
+    }
+    hmm_reverseComplementEmissions(reverseHmm);
+    for (int64_t i = 0; i < hmm->totalEmissions; i++) {
+        CuAssertDblEquals(testCase, hmm->emissions[i], reverseHmm->emissions[i], 0.0);
+    }
+    hmm_destruct(hmm);
+    hmm_destruct(reverseHmm);
+}
+
 void test_computeForwardProbability(CuTest *testCase) {
     for (int64_t test = 0; test < 1000; test++) {
         // Make a pair of sequences
@@ -1188,6 +1294,736 @@ void test_computeForwardProbability(CuTest *testCase) {
     }
 }
 
+void test_computeForwardProbabilityWithFloor(CuTest *testCase) {
+    // Checks a floor below the forward probability does not change it, and that with a floor above it
+    // an upper bound below the floor is returned
+    for (int64_t test = 0; test < 100; test++) {
+        char *sX = getRandomSequence(st_randomInt(10, 300));
+        char *sY = st_random() > 0.5 ? evolveSequence(sX) : getRandomSequence(st_randomInt(10, 300));
+
+        PairwiseAlignmentParameters *p = pairwiseAlignmentBandingParameters_construct();
+        p->scaledFloatProbabilities = st_random() > 0.5;
+        StateMachine *sM = stateMachine3_constructNucleotide(st_random() > 0.5 ? threeState : threeStateAsymmetric);
+        SymbolString ssX = symbolString_construct(sX, 0, strlen(sX), sM->emissions->alphabet);
+        SymbolString ssY = symbolString_construct(sY, 0, strlen(sY), sM->emissions->alphabet);
+        stList *anchorPairs = stList_construct();
+        bool raggedLeftEnd = st_random() > 0.5;
+        bool raggedRightEnd = st_random() > 0.5;
+
+        double forwardProb = computeForwardProbability(ssX, ssY, anchorPairs, p, sM, raggedLeftEnd, raggedRightEnd);
+        double forwardProb2 = computeForwardProbability2(ssX, ssY, anchorPairs, p, sM, raggedLeftEnd,
+                                                         raggedRightEnd, forwardProb - 1.0);
+        CuAssertDblEquals(testCase, forwardProb, forwardProb2, 0.0);
+
+        double logProbabilityFloor = forwardProb + st_random() * 50;
+        double boundProb = computeForwardProbability2(ssX, ssY, anchorPairs, p, sM, raggedLeftEnd,
+                                                      raggedRightEnd, logProbabilityFloor);
+        CuAssertTrue(testCase, boundProb < logProbabilityFloor);
+        CuAssertTrue(testCase, boundProb >= forwardProb);
+
+        // Cleanup
+        stList_destruct(anchorPairs);
+        symbolString_destruct(ssX);
+        symbolString_destruct(ssY);
+        stateMachine_destruct(sM);
+        pairwiseAlignmentBandingParameters_destruct(p);
+        free(sX);
+        free(sY);
+    }
+}
+
+void test_computeForwardProbabilities(CuTest *testCase) {
+    // Checks scoring a read against a set of alleles with common prefixes at once gives the same
+    // probabilities as scoring it against each allele
+    for (int64_t test = 0; test < 100; test++) {
+        char *prefix = getRandomSequence(st_randomInt(0, 100));
+        char *suffix = getRandomSequence(st_randomInt(0, 100));
+        int64_t alleleNo = st_randomInt(1, 8);
+        char *alleles[alleleNo];
+        for (int64_t i = 0; i < alleleNo; i++) {
+            char *middle = getRandomSequence(st_randomInt(0, 20));
+            // Some alleles share a longer prefix
+            alleles[i] = i > 0 && st_random() > 0.5 ? stString_print("%s%s%s", alleles[i - 1], middle, suffix)
+                                                    : stString_print("%s%s%s", prefix, middle, suffix);
+            free(middle);
+        }
+        char *read = evolveSequence(alleles[0]);
+
+        PairwiseAlignmentParameters *p = pairwiseAlignmentBandingParameters_construct();
+        p->scaledFloatProbabilities = st_random() > 0.8;
+        StateMachine *sM = stateMachine3_constructNucleotide(st_random() > 0.5 ? threeState : threeStateAsymmetric);
+        SymbolString ssAlleles[alleleNo];
+        for (int64_t i = 0; i < alleleNo; i++) {
+            ssAlleles[i] = symbolString_construct(alleles[i], 0, strlen(alleles[i]), sM->emissions->alphabet);
+        }
+        SymbolString ssRead = symbolString_construct(read, 0, strlen(read), sM->emissions->alphabet);
+        stList *anchorPairs = stList_construct();
+        bool raggedLeftEnd = st_random() > 0.5;
+        bool raggedRightEnd = st_random() > 0.5;
+
+        double logProbs[alleleNo], logProbs2[alleleNo];
+        computeForwardProbabilities(ssAlleles, alleleNo, ssRead, p, sM, raggedLeftEnd, raggedRightEnd, 0.0, logProbs);
+        double maxLogProb = LOG_ZERO;
+        for (int64_t i = 0; i < alleleNo; i++) {
+            double logProb = computeForwardProbability(ssAlleles[i], ssRead, anchorPairs, p, sM, raggedLeftEnd,
+                                                       raggedRightEnd);
+            CuAssertDblEquals(testCase, logProb, logProbs[i], 0.0);
+            maxLogProb = logProb > maxLogProb ? logProb : maxLogProb;
+        }
+
+        // With a margin, the best allele is still computed exactly and the others are at least their
+        // probabilities
+        computeForwardProbabilities(ssAlleles, alleleNo, ssRead, p, sM, raggedLeftEnd, raggedRightEnd, 5.0,
+                                    logProbs2);
+        for (int64_t i = 0; i < alleleNo; i++) {
+            CuAssertTrue(testCase, logProbs2[i] >= logProbs[i]);
+            if (logProbs[i] == maxLogProb) {
+                CuAssertDblEquals(testCase, logProbs[i], logProbs2[i], 0.0);
+            }
+        }
+
+        // Cleanup
+        for (int64_t i = 0; i < alleleNo; i++) {
+            symbolString_destruct(ssAlleles[i]);
+            free(alleles[i]);
+        }
+        stList_destruct(anchorPairs);
+        symbolString_destruct(ssRead);
+        stateMachine_destruct(sM);
+        pairwiseAlignmentBandingParameters_destruct(p);
+        free(prefix);
+        free(suffix);
+        free(read);
+    }
+}
+
+void test_vectorisedDiagonalCalculations(CuTest *testCase) {
+    // Checks the lane-wise diagonal calculations give the same results as the scalar cell calculations
+    for (int64_t test = 0; test < 100; test++) {
+        char *sX = getRandomSequence(st_randomInt(10, 300));
+        char *sY = evolveSequence(sX);
+
+        PairwiseAlignmentParameters *p = pairwiseAlignmentBandingParameters_construct();
+        StateMachine *sM = stateMachine3_constructNucleotide(st_random() > 0.5 ? threeState : threeStateAsymmetric);
+        SymbolString ssX = symbolString_construct(sX, 0, strlen(sX), sM->emissions->alphabet);
+        SymbolString ssY = symbolString_construct(sY, 0, strlen(sY), sM->emissions->alphabet);
+        bool raggedLeftEnd = st_random() > 0.5;
+        bool raggedRightEnd = st_random() > 0.5;
+        stList *anchorPairs = stList_construct();
+
+        setPairwiseAlignerUseVectorisedDiagonals(0);
+        double scalarForwardProb = computeForwardProbability(ssX, ssY, anchorPairs, p, sM, raggedLeftEnd,
+                                                             raggedRightEnd);
+        stList *scalarAlignedPairs = getAlignedPairs(sM, ssX, ssY, p, raggedLeftEnd, raggedRightEnd);
+
+        setPairwiseAlignerUseVectorisedDiagonals(1);
+        double forwardProb = computeForwardProbability(ssX, ssY, anchorPairs, p, sM, raggedLeftEnd, raggedRightEnd);
+        stList *alignedPairs = getAlignedPairs(sM, ssX, ssY, p, raggedLeftEnd, raggedRightEnd);
+
+        CuAssertDblEquals(testCase, scalarForwardProb, forwardProb, 0.0001);
+        CuAssertIntEquals(testCase, stList_length(scalarAlignedPairs), stList_length(alignedPairs));
+        for (int64_t i = 0; i < stList_length(alignedPairs); i++) {
+            stIntTuple *scalarPair = stList_get(scalarAlignedPairs, i);
+            stIntTuple *pair = stList_get(alignedPairs, i);
+            CuAssertIntEquals(testCase, stIntTuple_get(scalarPair, 1), stIntTuple_get(pair, 1));
+            CuAssertIntEquals(testCase, stIntTuple_get(scalarPair, 2), stIntTuple_get(pair, 2));
+            CuAssertTrue(testCase, llabs(stIntTuple_get(scalarPair, 0) - stIntTuple_get(pair, 0)) <= 1);
+        }
+
+        // Cleanup
+        stList_destruct(anchorPairs);
+        stList_destruct(scalarAlignedPairs);
+        stList_destruct(alignedPairs);
+        symbolString_destruct(ssX);
+        symbolString_destruct(ssY);
+        stateMachine_destruct(sM);
+        pairwiseAlignmentBandingParameters_destruct(p);
+        free(sX);
+        free(sY);
+    }
+}
+
+void test_scaledFloatProbabilities(CuTest *testCase) {
+    // Checks the scaled, single precision calculations are close to the log-space double precision calculations
+    for (int64_t test = 0; test < 100; test++) {
+        char *sX = getRandomSequence(st_randomInt(10, 300));
+        char *sY = evolveSequence(sX);
+
+        PairwiseAlignmentParameters *p = pairwiseAlignmentBandingParameters_construct();
+        StateMachine *sM = stateMachine3_constructNucleotide(st_random() > 0.5 ? threeState : threeStateAsymmetric);
+        SymbolString ssX = symbolString_construct(sX, 0, strlen(sX), sM->emissions->alphabet);
+        SymbolString ssY = symbolString_construct(sY, 0, strlen(sY), sM->emissions->alphabet);
+        bool raggedLeftEnd = st_random() > 0.5;
+        bool raggedRightEnd = st_random() > 0.5;
+        stList *anchorPairs = stList_construct();
+
+        double forwardProb = computeForwardProbability(ssX, ssY, anchorPairs, p, sM, raggedLeftEnd, raggedRightEnd);
+        stList *alignedPairs = getAlignedPairs(sM, ssX, ssY, p, raggedLeftEnd, raggedRightEnd);
+
+        p->scaledFloatProbabilities = 1;
+        double scaledForwardProb = computeForwardProbability(ssX, ssY, anchorPairs, p, sM, raggedLeftEnd,
+                                                             raggedRightEnd);
+        stList *scaledAlignedPairs = getAlignedPairs(sM, ssX, ssY, p, raggedLeftEnd, raggedRightEnd);
+
+        CuAssertDblEquals(testCase, forwardProb, scaledForwardProb, 0.001 * fabs(forwardProb) + 0.001);
+
+        // Walk the two sets of pairs in coordinate order, pairs missing from one set must be close to the threshold
+        stList_sort(alignedPairs, cmpAlignedPairsByCoordinates);
+        stList_sort(scaledAlignedPairs, cmpAlignedPairsByCoordinates);
+        int64_t tolerance = PAIR_ALIGNMENT_PROB_1 / 100;
+        int64_t threshold = p->threshold * PAIR_ALIGNMENT_PROB_1 + tolerance;
+        int64_t i = 0, j = 0;
+        while (i < stList_length(alignedPairs) || j < stList_length(scaledAlignedPairs)) {
+            stIntTuple *pair = i < stList_length(alignedPairs) ? stList_get(alignedPairs, i) : NULL;
+            stIntTuple *scaledPair = j < stList_length(scaledAlignedPairs) ? stList_get(scaledAlignedPairs, j) : NULL;
+            int cmp = pair == NULL ? 1 : (scaledPair == NULL ? -1 : cmpAlignedPairsByCoordinates(pair, scaledPair));
+            if (cmp == 0) {
+                CuAssertTrue(testCase, llabs(stIntTuple_get(pair, 0) - stIntTuple_get(scaledPair, 0)) <= tolerance);
+                i++;
+                j++;
+            } else if (cmp < 0) {
+                CuAssertTrue(testCase, stIntTuple_get(pair, 0) <= threshold);
+                i++;
+            } else {
+                CuAssertTrue(testCase, stIntTuple_get(scaledPair, 0) <= threshold);
+                j++;
+            }
+        }
+
+        // Cleanup
+        stList_destruct(anchorPairs);
+        stList_destruct(alignedPairs);
+        stList_destruct(scaledAlignedPairs);
+        symbolString_destruct(ssX);
+        symbolString_destruct(ssY);
+        stateMachine_destruct(sM);
+        pairwiseAlignmentBandingParameters_destruct(p);
+        free(sX);
+        free(sY);
+    }
+}
+
+void test_dpArena(CuTest *testCase) {
+    // Checks that once warmed up by an alignment, repeating it is done without calling the allocator
+    char *sX = getRandomSequence(st_randomInt(500, 1000));
+    char *sY = evolveSequence(sX);
+    PairwiseAlignmentParameters *p = pairwiseAlignmentBandingParameters_construct();
+    StateMachine *sM = stateMachine3_constructNucleotide(threeState);
+    SymbolString ssX = symbolString_construct(sX, 0, strlen(sX), sM->emissions->alphabet);
+    SymbolString ssY = symbolString_construct(sY, 0, strlen(sY), sM->emissions->alphabet);
+
+    DpArenaStats stats, stats2;
+    for (int64_t test = 0; test < 3; test++) {
+        dpArena_getStats(&stats);
+        stList *alignedPairs = getAlignedPairs(sM, ssX, ssY, p, 0, 0);
+        dpArena_getStats(&stats2);
+        CuAssertIntEquals(testCase, 0, stats2.bytesInUse);
+        CuAssertTrue(testCase, stats2.peakBytes > 0);
+        CuAssertTrue(testCase, stats2.reuses > stats.reuses);
+        if (test > 0) {
+            CuAssertIntEquals(testCase, stats.allocations, stats2.allocations);
+            CuAssertIntEquals(testCase, stats.peakBytes, stats2.peakBytes);
+        }
+        stList_destruct(alignedPairs);
+    }
+
+    dpArena_clear();
+    dpArena_getStats(&stats);
+    CuAssertIntEquals(testCase, 0, stats.bytesCached);
+    CuAssertIntEquals(testCase, 0, stats.peakBytes);
+    CuAssertIntEquals(testCase, 0, stats.allocations);
+    CuAssertIntEquals(testCase, 0, stats.reuses);
+
+    // The peak and counts after a clear are those of the alignments since, as for each chunk of a run
+    stList *alignedPairs = getAlignedPairs(sM, ssX, ssY, p, 0, 0);
+    dpArena_getStats(&stats);
+    CuAssertTrue(testCase, stats.peakBytes > 0 && stats.peakBytes <= stats2.peakBytes);
+    CuAssertTrue(testCase, stats.allocations > 0);
+    stList_destruct(alignedPairs);
+    dpArena_clear();
+
+    symbolString_destruct(ssX);
+    symbolString_destruct(ssY);
+    stateMachine_destruct(sM);
+    pairwiseAlignmentBandingParameters_destruct(p);
+    free(sX);
+    free(sY);
+}
+
+void test_dpArenaHugePages(CuTest *testCase) {
+    // Checks that alignments with the dp buffers in huge pages are the same, and that clearing the arena frees them
+    char *sX = getRandomSequence(st_randomInt(500, 1000));
+    char *sY = evolveSequence(sX);
+    PairwiseAlignmentParameters *p = pairwiseAlignmentBandingParameters_construct();
+    StateMachine *sM = stateMachine3_constructNucleotide(threeState);
+    SymbolString ssX = symbolString_construct(sX, 0, strlen(sX), sM->emissions->alphabet);
+    SymbolString ssY = symbolString_construct(sY, 0, strlen(sY), sM->emissions->alphabet);
+
+    // the arena must hold no heap buffers when huge pages are enabled
+    stList *alignedPairs = getAlignedPairs(sM, ssX, ssY, p, 0, 0);
+    dpArena_clear();
+    hugePages_setEnabled(TRUE);
+    stList *hugePageAlignedPairs = getAlignedPairs(sM, ssX, ssY, p, 0, 0);
+    HugePageStats stats;
+    hugePages_getStats(&stats);
+    CuAssertTrue(testCase, stats.bytes > 0);
+    CuAssertIntEquals(testCase, 0, stats.bytes % HUGE_PAGE_SIZE);
+    CuAssertIntEquals(testCase, stList_length(alignedPairs), stList_length(hugePageAlignedPairs));
+    for (int64_t i = 0; i < stList_length(alignedPairs); i++) {
+        stIntTuple *pair = stList_get(alignedPairs, i), *hugePagePair = stList_get(hugePageAlignedPairs, i);
+        for (int64_t j = 0; j < 3; j++) {
+            CuAssertIntEquals(testCase, stIntTuple_get(pair, j), stIntTuple_get(hugePagePair, j));
+        }
+    }
+
+    dpArena_clear();
+    hugePages_getStats(&stats);
+    CuAssertIntEquals(testCase, 0, stats.bytes);
+    CuAssertIntEquals(testCase, 0, stats.requestedBytes);
+    hugePages_setEnabled(FALSE);
+
+    stList_destruct(alignedPairs);
+    stList_destruct(hugePageAlignedPairs);
+    symbolString_destruct(ssX);
+    symbolString_destruct(ssY);
+    stateMachine_destruct(sM);
+    pairwiseAlignmentBandingParameters_destruct(p);
+    free(sX);
+    free(sY);
+}
+
+void test_packedAlignedPairs(CuTest *testCase) {
+    // Checks the packed aligned pairs agree with the list based functions
+    for (int64_t test = 0; test < 100; test++) {
+        char *sX = getRandomSequence(st_randomInt(0, 300));
+        char *sY = evolveSequence(sX);
+        int64_t lX = strlen(sX), lY = strlen(sY);
+        PairwiseAlignmentParameters *p = pairwiseAlignmentBandingParameters_construct();
+        StateMachine *sM = stateMachine3_constructNucleotide(threeState);
+        SymbolString ssX = symbolString_construct(sX, 0, lX, sM->emissions->alphabet);
+        SymbolString ssY = symbolString_construct(sY, 0, lY, sM->emissions->alphabet);
+        bool raggedLeftEnd = st_random() > 0.5, raggedRightEnd = st_random() > 0.5;
+
+        stList *alignedPairs, *gapXPairs, *gapYPairs;
+        getAlignedPairsWithIndels(sM, ssX, ssY, p, &alignedPairs, &gapXPairs, &gapYPairs, raggedLeftEnd,
+                                  raggedRightEnd);
+
+        AlignedPairs *packedPairs[3] = { alignedPairs_construct(), alignedPairs_construct(), alignedPairs_construct() };
+        stList *anchorPairs = stList_construct();
+        getAlignedPairsWithIndelsUsingAnchorsPacked(sM, ssX, ssY, anchorPairs, p, packedPairs[0], packedPairs[1],
+                                                    packedPairs[2], raggedLeftEnd, raggedRightEnd);
+        stList *pairs[3] = { alignedPairs, gapXPairs, gapYPairs };
+        for (int64_t i = 0; i < 3; i++) {
+            CuAssertIntEquals(testCase, stList_length(pairs[i]), packedPairs[i]->length);
+            for (int64_t j = 0; j < packedPairs[i]->length; j++) {
+                stIntTuple *pair = stList_get(pairs[i], j);
+                CuAssertIntEquals(testCase, stIntTuple_get(pair, 0), packedPairs[i]->weight[j]);
+                CuAssertIntEquals(testCase, stIntTuple_get(pair, 1), packedPairs[i]->x[j]);
+                CuAssertIntEquals(testCase, stIntTuple_get(pair, 2), packedPairs[i]->y[j]);
+            }
+        }
+
+        // Check the MEA alignments are the same
+        double alignmentScore, alignmentScore2;
+        stList *filteredAlignment = getMaximalExpectedAccuracyPairwiseAlignment(alignedPairs, gapXPairs, gapYPairs,
+                                                                                lX, lY, &alignmentScore, p);
+        stList *filteredAlignment2 = getMaximalExpectedAccuracyPairwiseAlignmentPacked(packedPairs[0], packedPairs[1],
+                                                                                       packedPairs[2], lX, lY,
+                                                                                       &alignmentScore2, p);
+        CuAssertDblEquals(testCase, alignmentScore, alignmentScore2, 0.0);
+        CuAssertIntEquals(testCase, stList_length(filteredAlignment), stList_length(filteredAlignment2));
+        for (int64_t j = 0; j < stList_length(filteredAlignment); j++) {
+            CuAssertTrue(testCase, stIntTuple_cmpFn(stList_get(filteredAlignment, j),
+                                                    stList_get(filteredAlignment2, j)) == 0);
+        }
+
+        // Check sorting and search
+        alignedPairs_sortByCoordinates(packedPairs[0]);
+        for (int64_t j = 0; j < packedPairs[0]->length; j++) {
+            if (j > 0) {
+                CuAssertTrue(testCase, packedPairs[0]->x[j - 1] < packedPairs[0]->x[j] ||
+                                       (packedPairs[0]->x[j - 1] == packedPairs[0]->x[j] &&
+                                        packedPairs[0]->y[j - 1] < packedPairs[0]->y[j]));
+            }
+            CuAssertIntEquals(testCase, j, alignedPairs_find(packedPairs[0], packedPairs[0]->x[j],
+                                                               packedPairs[0]->y[j]));
+        }
+        CuAssertIntEquals(testCase, -1, alignedPairs_find(packedPairs[0], lX, lY));
+        alignedPairs_sortByInvertedCoordinates(packedPairs[1]);
+        for (int64_t j = 1; j < packedPairs[1]->length; j++) {
+            CuAssertTrue(testCase, packedPairs[1]->y[j - 1] < packedPairs[1]->y[j] ||
+                                   (packedPairs[1]->y[j - 1] == packedPairs[1]->y[j] &&
+                                    packedPairs[1]->x[j - 1] < packedPairs[1]->x[j]));
+        }
+
+        // Cleanup
+        for (int64_t i = 0; i < 3; i++) {
+            alignedPairs_destruct(packedPairs[i]);
+            stList_destruct(pairs[i]);
+        }
+        stList_destruct(anchorPairs);
+        stList_destruct(filteredAlignment);
+        stList_destruct(filteredAlignment2);
+        symbolString_destruct(ssX);
+        symbolString_destruct(ssY);
+        stateMachine_destruct(sM);
+        pairwiseAlignmentBandingParameters_destruct(p);
+        free(sX);
+        free(sY);
+    }
+}
+
+void test_diagonalEmissions(CuTest *testCase) {
+    // Checks the specialised diagonal emission functions agree with the per cell emission functions
+    StateMachine *sM = stateMachine3_constructNucleotide(threeState);
+    Emissions *e = sM->emissions;
+    CuAssertTrue(testCase, e->diagonalEmissions != NULL);
+    char *sX = getRandomSequence(100);
+    char *sY = getRandomSequence(100);
+    SymbolString ssX = symbolString_construct(sX, 0, strlen(sX), e->alphabet);
+    SymbolString ssY = symbolString_construct(sY, 0, strlen(sY), e->alphabet);
+    double eGapX[50], eMatch[50], eGapY[50];
+    e->diagonalEmissions(e, &ssX.sequence[10], &ssY.sequence[60], 50, eGapX, eMatch, eGapY);
+    for (int64_t i = 0; i < 50; i++) {
+        CuAssertDblEquals(testCase, e->gapEmissionX(e, ssX.sequence[10 + i]), eGapX[i], 0.0);
+        CuAssertDblEquals(testCase, e->emission(e, ssX.sequence[10 + i], ssY.sequence[60 - i]), eMatch[i], 0.0);
+        CuAssertDblEquals(testCase, e->gapEmissionY(e, ssY.sequence[60 - i]), eGapY[i], 0.0);
+    }
+    symbolString_destruct(ssX);
+    symbolString_destruct(ssY);
+    stateMachine_destruct(sM);
+    free(sX);
+    free(sY);
+}
+
+static void test_posteriorThresholdPruning(CuTest *testCase) {
+    /*
+     * Skipping the diagonals and cells that can not reach the posterior threshold keeps exactly the pairs over
+     * the threshold: those of an alignment with no threshold whose weights are over it.
+     */
+    for (int64_t test = 0; test < 100; test++) {
+        char *sX = getRandomSequence(st_randomInt(1, 300));
+        char *sY = evolveSequence(sX);
+        PairwiseAlignmentParameters *p = pairwiseAlignmentBandingParameters_construct();
+        p->scaledFloatProbabilities = st_random() > 0.5;
+        StateMachine *sM = stateMachine3_constructNucleotide(threeState);
+        SymbolString ssX = symbolString_construct(sX, 0, strlen(sX), sM->emissions->alphabet);
+        SymbolString ssY = symbolString_construct(sY, 0, strlen(sY), sM->emissions->alphabet);
+        stList *anchorPairs = stList_construct();
+
+        double threshold = st_random() * 0.5;
+        AlignedPairs *allPairs[3] = { alignedPairs_construct(), alignedPairs_construct(), alignedPairs_construct() };
+        p->threshold = 0.0;
+        getAlignedPairsWithIndelsUsingAnchorsPacked(sM, ssX, ssY, anchorPairs, p, allPairs[0], allPairs[1],
+                                                    allPairs[2], 0, 0);
+        AlignedPairs *pairs[3] = { alignedPairs_construct(), alignedPairs_construct(), alignedPairs_construct() };
+        p->threshold = threshold;
+        getAlignedPairsWithIndelsUsingAnchorsPacked(sM, ssX, ssY, anchorPairs, p, pairs[0], pairs[1], pairs[2], 0, 0);
+
+        for (int64_t i = 0; i < 3; i++) {
+            alignedPairs_sortByCoordinates(allPairs[i]);
+            alignedPairs_sortByCoordinates(pairs[i]);
+            // Each pair kept is in the unthresholded pairs with the same weight
+            for (int64_t j = 0; j < pairs[i]->length; j++) {
+                int64_t k = alignedPairs_find(allPairs[i], pairs[i]->x[j], pairs[i]->y[j]);
+                CuAssertTrue(testCase, k != -1);
+                CuAssertIntEquals(testCase, allPairs[i]->weight[k], pairs[i]->weight[j]);
+            }
+            // Each unthresholded pair clearly over the threshold is kept
+            for (int64_t j = 0; j < allPairs[i]->length; j++) {
+                if (allPairs[i]->weight[j] > threshold * PAIR_ALIGNMENT_PROB_1 + 1) {
+                    CuAssertTrue(testCase, alignedPairs_find(pairs[i], allPairs[i]->x[j], allPairs[i]->y[j]) != -1);
+                }
+            }
+            alignedPairs_destruct(allPairs[i]);
+            alignedPairs_destruct(pairs[i]);
+        }
+
+        // Cleanup
+        stList_destruct(anchorPairs);
+        symbolString_destruct(ssX);
+        symbolString_destruct(ssY);
+        stateMachine_destruct(sM);
+        pairwiseAlignmentBandingParameters_destruct(p);
+        free(sX);
+        free(sY);
+    }
+}
+
+static void test_xDropBanding(CuTest *testCase) {
+    /*
+     * A generous x-drop only drops cells with negligible probability from the band, so gives the pairs of the fixed
+     * band, and a tight one still finds the alignment of closely related sequences.
+     */
+    for (int64_t test = 0; test < 100; test++) {
+        char *sX = getRandomSequence(st_randomInt(1, 300));
+        char *sY = evolveSequence(sX);
+        PairwiseAlignmentParameters *p = pairwiseAlignmentBandingParameters_construct();
+        p->scaledFloatProbabilities = st_random() > 0.5;
+        p->threshold = 0.1;
+        StateMachine *sM = stateMachine3_constructNucleotide(threeState);
+        SymbolString ssX = symbolString_construct(sX, 0, strlen(sX), sM->emissions->alphabet);
+        SymbolString ssY = symbolString_construct(sY, 0, strlen(sY), sM->emissions->alphabet);
+        stList *anchorPairs = stList_construct();
+
+        AlignedPairs *bandPairs[3] = { alignedPairs_construct(), alignedPairs_construct(), alignedPairs_construct() };
+        getAlignedPairsWithIndelsUsingAnchorsPacked(sM, ssX, ssY, anchorPairs, p, bandPairs[0], bandPairs[1],
+                                                    bandPairs[2], 0, 0);
+        AlignedPairs *xDropPairs[3] = { alignedPairs_construct(), alignedPairs_construct(), alignedPairs_construct() };
+        p->xDrop = 50.0;
+        getAlignedPairsWithIndelsUsingAnchorsPacked(sM, ssX, ssY, anchorPairs, p, xDropPairs[0], xDropPairs[1],
+                                                    xDropPairs[2], 0, 0);
+
+        for (int64_t i = 0; i < 3; i++) {
+            alignedPairs_sortByCoordinates(bandPairs[i]);
+            alignedPairs_sortByCoordinates(xDropPairs[i]);
+            // Each pair clearly over the threshold in one is in the other, with nearly the same weight
+            for (int64_t j = 0; j < bandPairs[i]->length; j++) {
+                int64_t k = alignedPairs_find(xDropPairs[i], bandPairs[i]->x[j], bandPairs[i]->y[j]);
+                if (bandPairs[i]->weight[j] > 0.11 * PAIR_ALIGNMENT_PROB_1) {
+                    CuAssertTrue(testCase, k != -1);
+                }
+                if (k != -1) {
+                    CuAssertTrue(testCase, llabs(xDropPairs[i]->weight[k] - bandPairs[i]->weight[j]) <
+                                           0.01 * PAIR_ALIGNMENT_PROB_1);
+                }
+            }
+            for (int64_t j = 0; j < xDropPairs[i]->length; j++) {
+                if (xDropPairs[i]->weight[j] > 0.11 * PAIR_ALIGNMENT_PROB_1) {
+                    CuAssertTrue(testCase,
+                                 alignedPairs_find(bandPairs[i], xDropPairs[i]->x[j], xDropPairs[i]->y[j]) != -1);
+                }
+            }
+            alignedPairs_destruct(xDropPairs[i]);
+            xDropPairs[i] = alignedPairs_construct();
+        }
+
+        // A tight x-drop keeps the confident matches of the fixed band
+        p->xDrop = 15.0;
+        getAlignedPairsWithIndelsUsingAnchorsPacked(sM, ssX, ssY, anchorPairs, p, xDropPairs[0], xDropPairs[1],
+                                                    xDropPairs[2], 0, 0);
+        alignedPairs_sortByCoordinates(xDropPairs[0]);
+        for (int64_t j = 0; j < bandPairs[0]->length; j++) {
+            if (bandPairs[0]->weight[j] > 0.9 * PAIR_ALIGNMENT_PROB_1) {
+                CuAssertTrue(testCase,
+                             alignedPairs_find(xDropPairs[0], bandPairs[0]->x[j], bandPairs[0]->y[j]) != -1);
+            }
+        }
+
+        // Cleanup
+        for (int64_t i = 0; i < 3; i++) {
+            alignedPairs_destruct(bandPairs[i]);
+            alignedPairs_destruct(xDropPairs[i]);
+        }
+        stList_destruct(anchorPairs);
+        symbolString_destruct(ssX);
+        symbolString_destruct(ssY);
+        stateMachine_destruct(sM);
+        pairwiseAlignmentBandingParameters_destruct(p);
+        free(sX);
+        free(sY);
+    }
+}
+
+static void test_parallelSplitAlignments(CuTest *testCase) {
+    /*
+     * Solving the sub-matrices of an alignment split at large gaps between its anchors concurrently gives the same
+     * pairs, in the same order, as solving them one after another.
+     */
+    for (int64_t test = 0; test < 20; test++) {
+        // Two related sequences separated by unrelated sequence, which is left without anchors
+        char *sX1 = getRandomSequence(st_randomInt(100, 300)), *sX2 = getRandomSequence(st_randomInt(100, 300));
+        char *sXGap = getRandomSequence(st_randomInt(150, 250)), *sYGap = getRandomSequence(st_randomInt(150, 250));
+        char *sX = stString_print("%s%s%s", sX1, sXGap, sX2);
+        char *sY = stString_print("%s%s%s", sX1, sYGap, sX2);
+        int64_t lX = strlen(sX), lY = strlen(sY), gapEndX = strlen(sX1) + strlen(sXGap),
+                gapEndY = strlen(sX1) + strlen(sYGap);
+        stList *anchorPairs = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
+        for (int64_t i = 5; i < strlen(sX1); i += 10) {
+            stList_append(anchorPairs, stIntTuple_construct3(i, i, 10));
+        }
+        for (int64_t i = 5; i < strlen(sX2); i += 10) {
+            stList_append(anchorPairs, stIntTuple_construct3(gapEndX + i, gapEndY + i, 10));
+        }
+
+        PairwiseAlignmentParameters *p = pairwiseAlignmentBandingParameters_construct();
+        p->splitMatrixBiggerThanThis = 100 * 100;
+        StateMachine *sM = stateMachine3_constructNucleotide(threeState);
+        SymbolString ssX = symbolString_construct(sX, 0, lX, sM->emissions->alphabet);
+        SymbolString ssY = symbolString_construct(sY, 0, lY, sM->emissions->alphabet);
+        bool raggedLeftEnd = st_random() > 0.5, raggedRightEnd = st_random() > 0.5;
+        stList *splitPoints = getSplitPoints(anchorPairs, lX, lY, p->splitMatrixBiggerThanThis, raggedLeftEnd,
+                                             raggedRightEnd);
+        CuAssertTrue(testCase, stList_length(splitPoints) > 1);
+
+        AlignedPairs *serialPairs[3] = { alignedPairs_construct(), alignedPairs_construct(), alignedPairs_construct() };
+        getAlignedPairsWithIndelsUsingAnchorsPacked(sM, ssX, ssY, anchorPairs, p, serialPairs[0], serialPairs[1],
+                                                    serialPairs[2], raggedLeftEnd, raggedRightEnd);
+        p->splitAlignmentParallelismThreshold = 1;
+        AlignedPairs *parallelPairs[3] = { alignedPairs_construct(), alignedPairs_construct(),
+                                           alignedPairs_construct() };
+        getAlignedPairsWithIndelsUsingAnchorsPacked(sM, ssX, ssY, anchorPairs, p, parallelPairs[0], parallelPairs[1],
+                                                    parallelPairs[2], raggedLeftEnd, raggedRightEnd);
+        for (int64_t i = 0; i < 3; i++) {
+            CuAssertIntEquals(testCase, serialPairs[i]->length, parallelPairs[i]->length);
+            for (int64_t j = 0; j < serialPairs[i]->length; j++) {
+                CuAssertIntEquals(testCase, serialPairs[i]->weight[j], parallelPairs[i]->weight[j]);
+                CuAssertIntEquals(testCase, serialPairs[i]->x[j], parallelPairs[i]->x[j]);
+                CuAssertIntEquals(testCase, serialPairs[i]->y[j], parallelPairs[i]->y[j]);
+            }
+            alignedPairs_destruct(serialPairs[i]);
+            alignedPairs_destruct(parallelPairs[i]);
+        }
+
+        // Cleanup
+        stList_destruct(splitPoints);
+        stList_destruct(anchorPairs);
+        symbolString_destruct(ssX);
+        symbolString_destruct(ssY);
+        stateMachine_destruct(sM);
+        pairwiseAlignmentBandingParameters_destruct(p);
+        free(sX1);
+        free(sX2);
+        free(sXGap);
+        free(sYGap);
+        free(sX);
+        free(sY);
+    }
+}
+
+static bool decliningBackend_computeAlignedPairs(PairwiseAlignmentBatch *batch, void *backendData) {
+    // Leave junk in the buffers before declining, which the cpu fallback must discard
+    alignedPairs_add(pairwiseAlignmentBatch_getAlignedPairs(batch, 0), 1, 0, 0);
+    (*(int64_t *) backendData)++;
+    return 0;
+}
+
+static bool constantBackend_computeForwardProbabilities(PairwiseAlignmentBatch *batch, void *backendData) {
+    for (int64_t i = 0; i < pairwiseAlignmentBatch_length(batch); i++) {
+        pairwiseAlignmentBatch_setForwardProbability(batch, i, -1.0);
+    }
+    (*(int64_t *) backendData)++;
+    return 1;
+}
+
+static void test_pairwiseAlignmentBatch(CuTest *testCase) {
+    /*
+     * The alignments of a batch are the same as computing them one at a time, with no backend, with a backend that
+     * declines the batch, and the results of a backend that accepts it are used.
+     */
+    PairwiseAlignmentParameters *p = pairwiseAlignmentBandingParameters_construct();
+    StateMachine *sM = stateMachine3_constructNucleotide(threeState);
+    int64_t alignmentNo = 10, backendCalls = 0;
+    char *sequences[2 * alignmentNo];
+    SymbolString symbolStrings[2 * alignmentNo];
+    stList *anchorPairs = stList_construct();
+    PairwiseAlignmentBackend backend = { "test", decliningBackend_computeAlignedPairs,
+                                         constantBackend_computeForwardProbabilities, &backendCalls };
+    for (int64_t useBackend = 0; useBackend < 2; useBackend++) {
+        pairwiseAlignmentBatch_setBackend(useBackend ? &backend : NULL);
+        PairwiseAlignmentBatch *batch = pairwiseAlignmentBatch_construct(p);
+        for (int64_t i = 0; i < alignmentNo; i++) {
+            sequences[2 * i] = getRandomSequence(st_randomInt(1, 200));
+            sequences[2 * i + 1] = evolveSequence(sequences[2 * i]);
+            for (int64_t j = 2 * i; j < 2 * i + 2; j++) {
+                symbolStrings[j] = symbolString_construct(sequences[j], 0, strlen(sequences[j]),
+                                                          sM->emissions->alphabet);
+            }
+            CuAssertIntEquals(testCase, i, pairwiseAlignmentBatch_add(batch, sM, symbolStrings[2 * i],
+                                                                      symbolStrings[2 * i + 1], anchorPairs, 0, 0));
+        }
+        CuAssertIntEquals(testCase, alignmentNo, pairwiseAlignmentBatch_length(batch));
+        pairwiseAlignmentBatch_computeAlignedPairs(batch);
+        pairwiseAlignmentBatch_computeForwardProbabilities(batch);
+
+        for (int64_t i = 0; i < alignmentNo; i++) {
+            AlignedPairs *pairs[3] = { alignedPairs_construct(), alignedPairs_construct(), alignedPairs_construct() };
+            getAlignedPairsWithIndelsUsingAnchorsPacked(sM, symbolStrings[2 * i], symbolStrings[2 * i + 1],
+                                                        anchorPairs, p, pairs[0], pairs[1], pairs[2], 0, 0);
+            AlignedPairs *batchPairs[3] = { pairwiseAlignmentBatch_getAlignedPairs(batch, i),
+                                            pairwiseAlignmentBatch_getGapXPairs(batch, i),
+                                            pairwiseAlignmentBatch_getGapYPairs(batch, i) };
+            for (int64_t k = 0; k < 3; k++) {
+                CuAssertIntEquals(testCase, pairs[k]->length, batchPairs[k]->length);
+                for (int64_t j = 0; j < pairs[k]->length; j++) {
+                    CuAssertIntEquals(testCase, pairs[k]->weight[j], batchPairs[k]->weight[j]);
+                    CuAssertIntEquals(testCase, pairs[k]->x[j], batchPairs[k]->x[j]);
+                    CuAssertIntEquals(testCase, pairs[k]->y[j], batchPairs[k]->y[j]);
+                }
+                alignedPairs_destruct(pairs[k]);
+            }
+            double forwardProbability = useBackend ? -1.0 :
+                                        computeForwardProbability(symbolStrings[2 * i], symbolStrings[2 * i + 1],
+                                                                  anchorPairs, p, sM, 0, 0);
+            CuAssertDblEquals(testCase, forwardProbability, pairwiseAlignmentBatch_getForwardProbability(batch, i),
+                              0.0);
+        }
+
+        // Cleanup
+        pairwiseAlignmentBatch_destruct(batch);
+        for (int64_t j = 0; j < 2 * alignmentNo; j++) {
+            symbolString_destruct(symbolStrings[j]);
+            free(sequences[j]);
+        }
+    }
+    CuAssertIntEquals(testCase, 2, backendCalls);
+    pairwiseAlignmentBatch_setBackend(NULL);
+    stList_destruct(anchorPairs);
+    stateMachine_destruct(sM);
+    pairwiseAlignmentBandingParameters_destruct(p);
+}
+
+static void test_getKmerAlignmentAnchorsLongSequence(CuTest *testCase) {
+    /*
+     * Anchors of a long sequence with itself, and with a copy containing a tandem repeat, are on the main diagonal
+     * outside of the repeat.
+     */
+    setPairwiseAlignerKmerSize(20);
+    char *sX = getRandomSequence(1000000);
+    Alphabet *a = alphabet_constructNucleotide();
+    SymbolString ssX = symbolString_construct(sX, 0, strlen(sX), a);
+    stList *alignmentAnchors = getKmerAlignmentAnchors(ssX, ssX, 10);
+    CuAssertTrue(testCase, stList_length(alignmentAnchors) > 0);
+    for (int64_t i = 0; i < stList_length(alignmentAnchors); i++) {
+        stIntTuple *pair = stList_get(alignmentAnchors, i);
+        CuAssertIntEquals(testCase, stIntTuple_get(pair, 0), stIntTuple_get(pair, 1));
+    }
+    stList_destruct(alignmentAnchors);
+
+    // Repeat a 100bp unit in the middle of the sequence ten times, by inserting nine more copies before it
+    char *unit = stString_getSubString(sX, 500000, 100);
+    char *prefix = stString_getSubString(sX, 0, 500000);
+    char *repeat = stString_print("%s%s%s%s%s%s%s%s%s", unit, unit, unit, unit, unit, unit, unit, unit, unit);
+    char *sY = stString_print("%s%s%s", prefix, repeat, &(sX[500000]));
+    SymbolString ssY = symbolString_construct(sY, 0, strlen(sY), a);
+    alignmentAnchors = getKmerAlignmentAnchors(ssX, ssY, 10);
+    int64_t pX = -1, pY = -1;
+    for (int64_t i = 0; i < stList_length(alignmentAnchors); i++) {
+        stIntTuple *pair = stList_get(alignmentAnchors, i);
+        int64_t x = stIntTuple_get(pair, 0), y = stIntTuple_get(pair, 1);
+        CuAssertTrue(testCase, pX < x && pY < y);
+        if (x < 500000) {
+            CuAssertIntEquals(testCase, x, y);
+        } else if (x >= 500100) {
+            CuAssertIntEquals(testCase, x + 900, y);
+        }
+        pX = x;
+        pY = y;
+    }
+    CuAssertTrue(testCase, stList_length(alignmentAnchors) > 0);
+
+    // Cleanup
+    stList_destruct(alignmentAnchors);
+    symbolString_destruct(ssX);
+    symbolString_destruct(ssY);
+    alphabet_destruct(a);
+    free(sX);
+    free(sY);
+    free(unit);
+    free(prefix);
+    free(repeat);
+}
+
 static void test_getKmerAlignmentAnchors(CuTest *testCase) {
     for (int64_t test = 0; test < 1000; test++) {
         // Make a pair of sequences
@@ -1237,6 +2073,7 @@ CuSuite *pairwiseAlignmentTestSuite(void) {
     SUITE_ADD_TEST(suite, test_diagonal);
     SUITE_ADD_TEST(suite, test_bands);
     SUITE_ADD_TEST(suite, test_logAdd);
+    SUITE_ADD_TEST(suite, test_logAddKernels);
     SUITE_ADD_TEST(suite, test_symbol);
     SUITE_ADD_TEST(suite, test_symbolRLE);
     SUITE_ADD_TEST(suite, test_cell);
@@ -1254,9 +2091,24 @@ CuSuite *pairwiseAlignmentTestSuite(void) {
     SUITE_ADD_TEST(suite, test_hmm_3StateAsymmetric);
     SUITE_ADD_TEST(suite, test_em_3State);
     SUITE_ADD_TEST(suite, test_em_3StateAsymmetric);
+    SUITE_ADD_TEST(suite, test_hmm_shardedExpectations);
+    SUITE_ADD_TEST(suite, test_hmm_reverseComplementEmissions);
     SUITE_ADD_TEST(suite, test_leftShiftAlignment);
     SUITE_ADD_TEST(suite, test_computeForwardProbability);
+    SUITE_ADD_TEST(suite, test_computeForwardProbabilityWithFloor);
+    SUITE_ADD_TEST(suite, test_computeForwardProbabilities);
+    SUITE_ADD_TEST(suite, test_vectorisedDiagonalCalculations);
+    SUITE_ADD_TEST(suite, test_diagonalEmissions);
+    SUITE_ADD_TEST(suite, test_scaledFloatProbabilities);
+    SUITE_ADD_TEST(suite, test_dpArena);
+    SUITE_ADD_TEST(suite, test_dpArenaHugePages);
+    SUITE_ADD_TEST(suite, test_packedAlignedPairs);
+    SUITE_ADD_TEST(suite, test_posteriorThresholdPruning);
+    SUITE_ADD_TEST(suite, test_xDropBanding);
+    SUITE_ADD_TEST(suite, test_parallelSplitAlignments);
+    SUITE_ADD_TEST(suite, test_pairwiseAlignmentBatch);
     SUITE_ADD_TEST(suite, test_getKmerAlignmentAnchors);
+    SUITE_ADD_TEST(suite, test_getKmerAlignmentAnchorsLongSequence);
 
     return suite;
 }
@@ -28,11 +28,70 @@ void test_jsmnParsing(CuTest *testCase) {
     stRPHmmParameters_destruct(params);
 }
 
+static void writeParamsFile(CuTest *testCase, char *file, char *json) {
+    FILE *fh = fopen(file, "w");
+    CuAssertTrue(testCase, fh != NULL);
+    fprintf(fh, "%s", json);
+    fclose(fh);
+}
+
+void test_paramsFingerprint(CuTest *testCase) {
+    /*
+     * Checks the fingerprint of the parsed params is of the settings they resolve to, including those of the files
+     * they include, and not of the names of the files
+     */
+    char *includingJson = "{ \"include\" : \"../params/ont/r9.4/allParams.np.human.r94-g344.json\", "
+                          "\"include\" : \"testParamsFingerprintIncluded.json\" }";
+    writeParamsFile(testCase, "./testParamsFingerprint.json", includingJson);
+    writeParamsFile(testCase, "./testParamsFingerprintIncluded.json", "{ \"polish\" : { \"maxDepth\" : 40 } }");
+    Params *params = params_readParams("./testParamsFingerprint.json");
+    CuAssertIntEquals(testCase, 40, params->polishParams->maxDepth);
+
+    // The same settings, from a file of another name, have the same fingerprint
+    writeParamsFile(testCase, "./testParamsFingerprintCopy.json", includingJson);
+    Params *copiedParams = params_readParams("./testParamsFingerprintCopy.json");
+    CuAssertTrue(testCase, params->fingerprint == copiedParams->fingerprint);
+
+    // An edit to an included file changes it, though the including file is unchanged
+    writeParamsFile(testCase, "./testParamsFingerprintIncluded.json", "{ \"polish\" : { \"maxDepth\" : 41 } }");
+    Params *editedParams = params_readParams("./testParamsFingerprint.json");
+    CuAssertIntEquals(testCase, 41, editedParams->polishParams->maxDepth);
+    CuAssertTrue(testCase, params->fingerprint != editedParams->fingerprint);
+
+    // cleanup
+    params_destruct(params);
+    params_destruct(copiedParams);
+    params_destruct(editedParams);
+    stFile_rmrf("./testParamsFingerprint.json");
+    stFile_rmrf("./testParamsFingerprintCopy.json");
+    stFile_rmrf("./testParamsFingerprintIncluded.json");
+}
+
+void test_paramsLogAddKernel(CuTest *testCase) {
+    /*
+     * Checks the log add kernel of the params is parsed and set when they are read
+     */
+    writeParamsFile(testCase, "./testParamsLogAddKernel.json",
+                    "{ \"include\" : \"../params/ont/r9.4/allParams.np.human.r94-g344.json\", "
+                    "\"polish\" : { \"logAddKernel\" : \"table\" } }");
+    Params *params = params_readParams("./testParamsLogAddKernel.json");
+    CuAssertIntEquals(testCase, LOG_ADD_TABLE, params->polishParams->logAddKernel);
+    CuAssertIntEquals(testCase, LOG_ADD_TABLE, logAddKernel);
+    CuAssertDblEquals(testCase, logMath_logAddExact(-1.0, -2.5), logAdd(-1.0, -2.5), 1e-5);
+
+    // cleanup, the default kernel being restored for the other tests
+    params_destruct(params);
+    setLogAddKernel(LOG_ADD_DEFAULT);
+    stFile_rmrf("./testParamsLogAddKernel.json");
+}
+
 CuSuite *parserTestSuite(void) {
     st_setLogLevelFromString("debug");
     CuSuite *suite = CuSuiteNew();
 
     SUITE_ADD_TEST(suite, test_jsmnParsing);
+    SUITE_ADD_TEST(suite, test_paramsFingerprint);
+    SUITE_ADD_TEST(suite, test_paramsLogAddKernel);
 
     return suite;
 }
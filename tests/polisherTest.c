@@ -75,7 +75,7 @@ static void test_getShift(CuTest *testCase) {
 
         int64_t k = 0; // Calculate shift in non-rle space
         for (int64_t j = 0; j < i; j++) {
-            k += str_rle->repeatCounts[j];
+            k += rleString_getRepeatCount(str_rle, j);
         }
 
         //if(k < length) {
@@ -112,6 +112,44 @@ static void test_getShift(CuTest *testCase) {
     }
 }
 
+static void test_getShiftOfLongRepeats(CuTest *testCase) {
+    /*
+     * Test that inserts of many copies of a repeat unit, longer than those of test_getShift, are shifted left over all
+     * the copies of the unit at the end of the reference.
+     */
+    for (int64_t test = 0; test < 1000; test++) {
+        char *unit = getRandomACGTSequence(st_randomInt(1, 7));
+        char *flank = getRandomACGTSequence(st_randomInt(0, 10));
+        int64_t unitLength = strlen(unit), copyNo = st_randomInt(1, 20), insertCopyNo = st_randomInt(1, 60);
+        char *str = st_calloc(strlen(flank) + unitLength * copyNo + 1, sizeof(char));
+        char *insert = st_calloc(unitLength * insertCopyNo + 1, sizeof(char));
+        strcpy(str, flank);
+        for (int64_t i = 0; i < copyNo; i++) {
+            strcat(str, unit);
+        }
+        for (int64_t i = 0; i < insertCopyNo; i++) {
+            strcat(insert, unit);
+        }
+        RleString *str_rle = rleString_construct_no_rle(str);
+        RleString *insert_rle = rleString_construct_no_rle(insert);
+
+        int64_t i = getShift(str_rle, str_rle->length, insert_rle, 0);
+        CuAssertTrue(testCase, i <= (int64_t) strlen(flank));
+        char *shiftedStr = makeShiftedString(str, insert, i);
+        char *concatenatedStr = stString_print("%s%s", str, insert);
+        CuAssertStrEquals(testCase, concatenatedStr, shiftedStr);
+
+        free(shiftedStr);
+        free(concatenatedStr);
+        free(unit);
+        free(flank);
+        free(str);
+        free(insert);
+        rleString_destruct(str_rle);
+        rleString_destruct(insert_rle);
+    }
+}
+
 static void checkInserts(CuTest *testCase, Poa *poa, int64_t nodeIndex,
                          int64_t insertNumber, const char **inserts, const double *insertWeights, bool divideWeights) {
     PoaNode *node = stList_get(poa->nodes, nodeIndex);
@@ -389,7 +427,7 @@ static void test_poa_realign(CuTest *testCase) {
                 baseWeights[stIntTuple_get(match, 1) * poa->alphabet->alphabetSize + poa->alphabet->convertCharToSymbol(
                         read->rleString[stIntTuple_get(match, 2)])] += stIntTuple_get(match, 0);
                 repeatCountWeights[stIntTuple_get(match, 1) * poa->maxRepeatCount +
-                                   read->repeatCounts[stIntTuple_get(match, 2)]] += stIntTuple_get(match, 0);
+                                   rleString_getRepeatCount(read, stIntTuple_get(match, 2))] += stIntTuple_get(match, 0);
             }
 
             // Cleanup
@@ -473,6 +511,364 @@ static void test_poa_realignIterative(CuTest *testCase) {
     }
 }
 
+static void checkPoasEqual(CuTest *testCase, Poa *poa1, Poa *poa2) {
+    CuAssertTrue(testCase, rleString_eq(poa1->refString, poa2->refString));
+    CuAssertIntEquals(testCase, stList_length(poa1->nodes), stList_length(poa2->nodes));
+    for (int64_t i = 0; i < stList_length(poa1->nodes); i++) {
+        PoaNode *node1 = stList_get(poa1->nodes, i), *node2 = stList_get(poa2->nodes, i);
+        for (int64_t j = 0; j < poa1->alphabet->alphabetSize; j++) {
+            CuAssertDblEquals(testCase, node1->baseWeights[j], node2->baseWeights[j], 0.0);
+        }
+        for (int64_t j = 0; j < poa1->maxRepeatCount; j++) {
+            CuAssertDblEquals(testCase, node1->repeatCountWeights[j], node2->repeatCountWeights[j], 0.0);
+        }
+        int64_t observationNo1, observationNo2;
+        PoaBaseObservation *observations1 = poa_getNodeObservations(poa1, i, &observationNo1);
+        PoaBaseObservation *observations2 = poa_getNodeObservations(poa2, i, &observationNo2);
+        CuAssertIntEquals(testCase, observationNo1, observationNo2);
+        for (int64_t j = 0; j < observationNo1; j++) {
+            CuAssertIntEquals(testCase, observations1[j].readNo, observations2[j].readNo);
+            CuAssertIntEquals(testCase, observations1[j].offset, observations2[j].offset);
+            CuAssertDblEquals(testCase, observations1[j].weight, observations2[j].weight, 0.0);
+        }
+        CuAssertIntEquals(testCase, stList_length(node1->inserts), stList_length(node2->inserts));
+        for (int64_t j = 0; j < stList_length(node1->inserts); j++) {
+            PoaInsert *insert1 = stList_get(node1->inserts, j), *insert2 = stList_get(node2->inserts, j);
+            CuAssertTrue(testCase, rleString_eq(insert1->insert, insert2->insert));
+            CuAssertDblEquals(testCase, poaInsert_getWeight(insert1), poaInsert_getWeight(insert2), 0.0);
+        }
+        CuAssertIntEquals(testCase, stList_length(node1->deletes), stList_length(node2->deletes));
+        for (int64_t j = 0; j < stList_length(node1->deletes); j++) {
+            PoaDelete *delete1 = stList_get(node1->deletes, j), *delete2 = stList_get(node2->deletes, j);
+            CuAssertIntEquals(testCase, delete1->length, delete2->length);
+            CuAssertDblEquals(testCase, poaDelete_getWeight(delete1), poaDelete_getWeight(delete2), 0.0);
+        }
+    }
+}
+
+static bool countingBackend_computeAlignedPairs(PairwiseAlignmentBatch *batch, void *backendData) {
+    *(int64_t *) backendData += pairwiseAlignmentBatch_length(batch);
+    return 0; // Have the cpu solve the batch
+}
+
+static void test_poa_realignWithBackend(CuTest *testCase) {
+    /*
+     * Every read alignment of poa_realign goes through the pairwise alignment backend, and the poa is the same
+     * whether the realignment is parallel or not.
+     */
+    for (int64_t test = 0; test < 20; test++) {
+        Params *params = params_readParams(polishParamsFile);
+        PolishParams *polishParams = params->polishParams;
+        char *trueReference = getRandomSequence(st_randomInt(1, 300));
+        char *reference = evolveSequence(trueReference);
+        RleString *reference_rle = polishParams->useRunLengthEncoding ?
+                                   rleString_construct(reference) : rleString_construct_no_rle(reference);
+        int64_t readNumber = st_randomInt(0, 20);
+        stList *reads = stList_construct3(0, (void (*)(void *)) bamChunkRead_destruct);
+        for (int64_t i = 0; i < readNumber; i++) {
+            stList_append(reads, bamChunkRead_construct2(stString_print("Read_%d", i), evolveSequence(trueReference),
+                                                         NULL, st_random() > 0.5,
+                                                         polishParams->useRunLengthEncoding));
+        }
+
+        int64_t alignments = 0;
+        PairwiseAlignmentBackend backend = { "counting", countingBackend_computeAlignedPairs, NULL, &alignments };
+        polishParams->realignmentParallelismThreshold = 0;
+        Poa *poa1 = poa_realign(reads, NULL, reference_rle, polishParams);
+        pairwiseAlignmentBatch_setBackend(&backend);
+        polishParams->realignmentParallelismThreshold = 1;
+        Poa *poa2 = poa_realign(reads, NULL, reference_rle, polishParams);
+        pairwiseAlignmentBatch_setBackend(NULL);
+        CuAssertIntEquals(testCase, readNumber, alignments);
+        checkPoasEqual(testCase, poa1, poa2);
+
+        // Cleanup
+        poa_destruct(poa1);
+        poa_destruct(poa2);
+        stList_destruct(reads);
+        rleString_destruct(reference_rle);
+        free(trueReference);
+        free(reference);
+        params_destruct(params);
+    }
+}
+
+static void test_poa_realign2(CuTest *testCase) {
+    /*
+     * Test that using a realignment cache gives the same POAs as realigning all the reads, both when the
+     * reference is unchanged and when it has a substitution, and when the cache is read only.
+     */
+
+    for (int64_t test = 0; test < 100; test++) {
+        Params *params = params_readParams(polishParamsFile);
+        PolishParams *polishParams = params->polishParams;
+
+        //Make true reference
+        char *trueReference = getRandomSequence(st_randomInt(1, 300));
+
+        // Make starting reference
+        char *reference = evolveSequence(trueReference);
+        RleString *reference_rle = params->polishParams->useRunLengthEncoding ?
+                                   rleString_construct(reference) : rleString_construct_no_rle(reference);
+
+        // Reads, each a fragment of the true reference
+        int64_t readNumber = st_randomInt(0, 20);
+        stList *reads = stList_construct3(0, (void (*)(void *)) bamChunkRead_destruct);
+        for (int64_t i = 0; i < readNumber; i++) {
+            int64_t start = st_randomInt(0, strlen(trueReference));
+            char *fragment = stString_getSubString(trueReference, start, st_randomInt(1, strlen(trueReference) - start + 1));
+            stList_append(reads, bamChunkRead_construct2(stString_print("Read_%d", i), evolveSequence(fragment),
+                                                         NULL, st_random() > 0.5,
+                                                         params->polishParams->useRunLengthEncoding));
+            free(fragment);
+        }
+
+        // Get anchors to a consensus
+        Poa *poa = poa_realign(reads, NULL, reference_rle, polishParams);
+        int64_t *poaToConsensusMap;
+        RleString *consensus = poa_getConsensus(poa, &poaToConsensusMap, polishParams);
+        stList *anchorAlignments = poa_getAnchorAlignments(poa, poaToConsensusMap, readNumber, polishParams);
+
+        // Realign to the consensus twice, the second time using only cached alignments
+        PoaRealignmentCache *cache = poaRealignmentCache_construct(readNumber);
+        Poa *poa1 = poa_realign(reads, anchorAlignments, consensus, polishParams);
+        for (int64_t i = 0; i < 2; i++) {
+            Poa *poa2 = poa_realign2(reads, anchorAlignments, consensus, polishParams, cache);
+            checkPoasEqual(testCase, poa1, poa2);
+            poa_destruct(poa2);
+        }
+
+        // Make a substitution in the consensus, so that the reads overlapping it are realigned, first without
+        // storing the new alignments, as for the haplotypes, so the cache still holds those to the old consensus
+        int64_t substitution = consensus->length > 0 ? st_randomInt(0, consensus->length) : -1;
+        char oldBase = substitution >= 0 ? consensus->rleString[substitution] : 'N';
+        if (substitution >= 0) {
+            consensus->rleString[substitution] = oldBase == 'A' ? 'C' : 'A';
+        }
+        Poa *poa3 = poa_realign(reads, anchorAlignments, consensus, polishParams);
+        poaRealignmentCache_setReadOnly(cache, 1);
+        Poa *poa4 = poa_realign2(reads, anchorAlignments, consensus, polishParams, cache);
+        checkPoasEqual(testCase, poa3, poa4);
+        poa_destruct(poa4);
+        if (substitution >= 0) {
+            consensus->rleString[substitution] = oldBase;
+        }
+        poa4 = poa_realign2(reads, anchorAlignments, consensus, polishParams, cache);
+        checkPoasEqual(testCase, poa1, poa4);
+        poa_destruct(poa4);
+        if (substitution >= 0) {
+            consensus->rleString[substitution] = oldBase == 'A' ? 'C' : 'A';
+        }
+        poaRealignmentCache_setReadOnly(cache, 0);
+        poa4 = poa_realign2(reads, anchorAlignments, consensus, polishParams, cache);
+        checkPoasEqual(testCase, poa3, poa4);
+
+        //Cleanup
+        poaRealignmentCache_destruct(cache);
+        free(trueReference);
+        free(reference);
+        free(poaToConsensusMap);
+        stList_destruct(anchorAlignments);
+        stList_destruct(reads);
+        rleString_destruct(consensus);
+        poa_destruct(poa);
+        poa_destruct(poa1);
+        poa_destruct(poa3);
+        poa_destruct(poa4);
+        params_destruct(params);
+        rleString_destruct(reference_rle);
+    }
+}
+
+static void test_poa_realignInParallel(CuTest *testCase) {
+    /*
+     * Test that aligning the reads of a realignment in parallel, and adding them to the POA through partial POAs,
+     * gives the same POAs, down to the order of the observations, as aligning and adding them serially.
+     */
+
+    for (int64_t test = 0; test < 20; test++) {
+        Params *params = params_readParams(polishParamsFile);
+        PolishParams *polishParams = params->polishParams;
+
+        //Make true reference
+        char *trueReference = getRandomSequence(st_randomInt(1, 300));
+
+        // Make starting reference
+        char *reference = evolveSequence(trueReference);
+        RleString *reference_rle = params->polishParams->useRunLengthEncoding ?
+                                   rleString_construct(reference) : rleString_construct_no_rle(reference);
+
+        // Reads
+        int64_t readNumber = st_randomInt(0, 100);
+        stList *reads = stList_construct3(0, (void (*)(void *)) bamChunkRead_destruct);
+        for (int64_t i = 0; i < readNumber; i++) {
+            stList_append(reads, bamChunkRead_construct2(stString_print("Read_%d", i), evolveSequence(trueReference),
+                                                         NULL, st_random() > 0.5,
+                                                         params->polishParams->useRunLengthEncoding));
+        }
+
+        // Realign serially
+        polishParams->realignmentParallelismThreshold = 0;
+        Poa *poa = poa_realign(reads, NULL, reference_rle, polishParams);
+        int64_t *poaToConsensusMap;
+        RleString *consensus = poa_getConsensus(poa, &poaToConsensusMap, polishParams);
+        stList *anchorAlignments = poa_getAnchorAlignments(poa, poaToConsensusMap, readNumber, polishParams);
+        Poa *poa1 = poa_realign(reads, anchorAlignments, consensus, polishParams);
+        Poa *poa2 = poa_realignOnlyAnchorAlignments(reads, anchorAlignments, consensus, polishParams);
+
+        // Realign in parallel
+        polishParams->realignmentParallelismThreshold = 1;
+        Poa *poa3, *poa4, *poa5;
+        # ifdef _OPENMP
+        #pragma omp parallel
+        #pragma omp single
+        # endif
+        {
+            poa3 = poa_realign(reads, NULL, reference_rle, polishParams);
+            poa4 = poa_realign(reads, anchorAlignments, consensus, polishParams);
+            poa5 = poa_realignOnlyAnchorAlignments(reads, anchorAlignments, consensus, polishParams);
+        }
+        checkPoasEqual(testCase, poa, poa3);
+        checkPoasEqual(testCase, poa1, poa4);
+        checkPoasEqual(testCase, poa2, poa5);
+
+        //Cleanup
+        free(trueReference);
+        free(reference);
+        free(poaToConsensusMap);
+        stList_destruct(anchorAlignments);
+        stList_destruct(reads);
+        rleString_destruct(consensus);
+        poa_destruct(poa);
+        poa_destruct(poa1);
+        poa_destruct(poa2);
+        poa_destruct(poa3);
+        poa_destruct(poa4);
+        poa_destruct(poa5);
+        params_destruct(params);
+        rleString_destruct(reference_rle);
+    }
+}
+
+static void checkObservationsInArena(CuTest *testCase, Poa *poa, stList *observations, int64_t *j) {
+    for (int64_t k = 0; k < stList_length(observations); k++) {
+        CuAssertPtrEquals(testCase, &poa->observations[(*j)++], stList_get(observations, k));
+    }
+}
+
+static void test_poa_realignDisagreementWindows(CuTest *testCase) {
+    /*
+     * Test that reads agreeing with the reference are not realigned, and that a substitution in the reference is
+     * polished by realigning the window around it.
+     */
+    Params *params = params_readParams(polishParamsFile);
+    PolishParams *polishParams = params->polishParams;
+    polishParams->useRunLengthEncoding = 0;
+
+    for (int64_t test = 0; test < 10; test++) {
+        char *trueReference = getRandomSequence(st_randomInt(50, 300));
+        int64_t length = strlen(trueReference);
+
+        // Reads matching the true reference, aligned to it without gaps
+        int64_t readNumber = st_randomInt(10, 30);
+        stList *reads = stList_construct3(0, (void (*)(void *)) bamChunkRead_destruct);
+        stList *anchorAlignments = stList_construct3(0, (void (*)(void *)) stList_destruct);
+        for (int64_t i = 0; i < readNumber; i++) {
+            stList_append(reads, bamChunkRead_construct2(stString_print("Read_%d", i), trueReference, NULL,
+                                                         st_random() > 0.5, 0));
+            stList *anchorAlignment = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
+            for (int64_t j = 0; j < length; j++) {
+                stList_append(anchorAlignment, stIntTuple_construct3(j, j, polishParams->p->diagonalExpansion));
+            }
+            stList_append(anchorAlignments, anchorAlignment);
+        }
+
+        // With nothing to realign the poa is that of the anchor alignments
+        RleString *reference = rleString_construct_no_rle(trueReference);
+        Poa *poa = poa_realignDisagreementWindows(reads, anchorAlignments, reference, polishParams);
+        Poa *anchorPoa = poa_realignOnlyAnchorAlignments(reads, anchorAlignments, reference, polishParams);
+        checkPoasEqual(testCase, poa, anchorPoa);
+        poa_destruct(poa);
+        poa_destruct(anchorPoa);
+        rleString_destruct(reference);
+
+        // A substitution in the middle of the reference is fixed
+        char *mutatedReference = stString_copy(trueReference);
+        int64_t i = length / 2;
+        mutatedReference[i] = mutatedReference[i] == 'A' ? 'C' : 'A';
+        reference = rleString_construct_no_rle(mutatedReference);
+        poa = poa_realignDisagreementWindows(reads, anchorAlignments, reference, polishParams);
+        int64_t *poaToConsensusMap;
+        RleString *consensus = poa_getConsensus(poa, &poaToConsensusMap, polishParams);
+        CuAssertStrEquals(testCase, trueReference, consensus->rleString);
+
+        // Cleanup
+        free(poaToConsensusMap);
+        rleString_destruct(consensus);
+        poa_destruct(poa);
+        rleString_destruct(reference);
+        free(mutatedReference);
+        stList_destruct(anchorAlignments);
+        stList_destruct(reads);
+        free(trueReference);
+    }
+
+    params_destruct(params);
+}
+
+static void test_poa_buildObservationArena(CuTest *testCase) {
+    /*
+     * Test that after realignment the observations of the nodes, inserts and deletes are laid out contiguously in
+     * node order in the poa's observation arena.
+     */
+
+    for (int64_t test = 0; test < 20; test++) {
+        Params *params = params_readParams(polishParamsFile);
+        PolishParams *polishParams = params->polishParams;
+
+        char *trueReference = getRandomSequence(st_randomInt(1, 300));
+        char *reference = evolveSequence(trueReference);
+        RleString *reference_rle = polishParams->useRunLengthEncoding ?
+                                   rleString_construct(reference) : rleString_construct_no_rle(reference);
+
+        int64_t readNumber = st_randomInt(0, 20);
+        stList *reads = stList_construct3(0, (void (*)(void *)) bamChunkRead_destruct);
+        for (int64_t i = 0; i < readNumber; i++) {
+            stList_append(reads, bamChunkRead_construct2(stString_print("Read_%d", i), evolveSequence(trueReference),
+                                                         NULL, st_random() > 0.5,
+                                                         polishParams->useRunLengthEncoding));
+        }
+
+        Poa *poa = poa_realign(reads, NULL, reference_rle, polishParams);
+        CuAssertIntEquals(testCase, 0, poa->stagedObservationNo);
+
+        int64_t j = 0;
+        for (int64_t i = 0; i < stList_length(poa->nodes); i++) {
+            PoaNode *node = stList_get(poa->nodes, i);
+            int64_t observationNo;
+            PoaBaseObservation *observations = poa_getNodeObservations(poa, i, &observationNo);
+            CuAssertIntEquals(testCase, stList_length(node->observations), observationNo);
+            CuAssertPtrEquals(testCase, &poa->observations[j], observations);
+            checkObservationsInArena(testCase, poa, node->observations, &j);
+            for (int64_t k = 0; k < stList_length(node->inserts); k++) {
+                checkObservationsInArena(testCase, poa, ((PoaInsert *) stList_get(node->inserts, k))->observations, &j);
+            }
+            for (int64_t k = 0; k < stList_length(node->deletes); k++) {
+                checkObservationsInArena(testCase, poa, ((PoaDelete *) stList_get(node->deletes, k))->observations, &j);
+            }
+        }
+        CuAssertIntEquals(testCase, j, poa->nodeObservationOffsets[stList_length(poa->nodes)]);
+
+        // Cleanup
+        poa_destruct(poa);
+        stList_destruct(reads);
+        rleString_destruct(reference_rle);
+        free(reference);
+        free(trueReference);
+        params_destruct(params);
+    }
+}
+
 int64_t calcSequenceMatches(char *seq1, char *seq2) {
     Params *params = params_readParams(polishParamsFile);
     PolishParams *polishParams = params->polishParams;
@@ -737,7 +1133,7 @@ static void test_rleString_example(CuTest *testCase, const char *testStr,
     CuAssertIntEquals(testCase, rleLength, rleString->length);
     CuAssertStrEquals(testCase, testStrRLE, rleString->rleString);
     for (int64_t i = 0; i < rleLength; i++) {
-        CuAssertIntEquals(testCase, repeatCounts[i], rleString->repeatCounts[i]);
+        CuAssertIntEquals(testCase, repeatCounts[i], rleString_getRepeatCount(rleString, i));
     }
 
     CuAssertIntEquals(testCase, nonRleLength, rleString->nonRleLength);
@@ -767,6 +1163,63 @@ static void test_rleString_examples(CuTest *testCase) {
                            (const int64_t[]) {0, 0, 0, 0, 0, 1, 1});
 }
 
+static void test_rleString_hash(CuTest *testCase) {
+    // Strings that are equal have the same hash, and strings differing only in a repeat count are not equal
+    for (int64_t test = 0; test < 100; test++) {
+        char *string = getRandomSequence(st_randomInt(0, 100));
+        RleString *rleString = rleString_construct(string);
+        RleString *rleString2 = rleString_copy(rleString);
+        CuAssertTrue(testCase, rleString_eq(rleString, rleString2));
+        CuAssertTrue(testCase, rleString_hash(rleString) == rleString_hash(rleString2));
+        if (rleString->length > 0) {
+            int64_t i = st_randomInt(0, rleString->length);
+            rleString_setRepeatCount(rleString2, i, rleString_getRepeatCount(rleString, i) + 1);
+            CuAssertTrue(testCase, !rleString_eq(rleString, rleString2));
+        }
+        rleString_destruct(rleString);
+        rleString_destruct(rleString2);
+        free(string);
+    }
+}
+
+static void test_rleString_noRle(CuTest *testCase) {
+    // A string that is not run length encoded stores no repeat counts until one is set to other than one
+    RleString *rleString = rleString_construct_no_rle("GATTACAGGGGTT");
+    CuAssertTrue(testCase, rleString->repeatCounts == NULL);
+    CuAssertIntEquals(testCase, 13, rleString->length);
+    CuAssertIntEquals(testCase, 13, rleString->nonRleLength);
+    uint64_t *nonRleToRleCoordinateMap = rleString_getNonRleToRleCoordinateMap(rleString);
+    uint64_t *rleToNonRleCoordinateMap = rleString_getRleToNonRleCoordinateMap(rleString);
+    for (int64_t i = 0; i < rleString->length; i++) {
+        CuAssertIntEquals(testCase, 1, rleString_getRepeatCount(rleString, i));
+        CuAssertIntEquals(testCase, i, nonRleToRleCoordinateMap[i]);
+        CuAssertIntEquals(testCase, i, rleToNonRleCoordinateMap[i]);
+    }
+    char *expandedRleString = rleString_expand(rleString);
+    CuAssertStrEquals(testCase, "GATTACAGGGGTT", expandedRleString);
+
+    RleString *substring = rleString_copySubstring(rleString, 2, 5);
+    CuAssertTrue(testCase, substring->repeatCounts == NULL);
+    CuAssertStrEquals(testCase, "TTACA", substring->rleString);
+    CuAssertIntEquals(testCase, 5, substring->nonRleLength);
+
+    rleString_rotateString(substring, 2, 0);
+    CuAssertTrue(testCase, substring->repeatCounts == NULL);
+    CuAssertStrEquals(testCase, "CATTA", substring->rleString);
+
+    rleString_setRepeatCount(rleString, 1, 1);
+    CuAssertTrue(testCase, rleString->repeatCounts == NULL);
+    rleString_setRepeatCount(rleString, 1, 300);
+    CuAssertIntEquals(testCase, 300, rleString_getRepeatCount(rleString, 1));
+    CuAssertIntEquals(testCase, 1, rleString_getRepeatCount(rleString, 2));
+
+    free(nonRleToRleCoordinateMap);
+    free(rleToNonRleCoordinateMap);
+    free(expandedRleString);
+    rleString_destruct(substring);
+    rleString_destruct(rleString);
+}
+
 void test_rle_rotateString(CuTest *testCase) {
     // Specific example
     RleString *e = rleString_construct("GATAACA");
@@ -797,7 +1250,7 @@ void test_rle_rotateString(CuTest *testCase) {
         // Check the result
         for (int64_t j = 0; j < t->length; j++) {
             CuAssertIntEquals(testCase, t->rleString[j], t_rotated->rleString[(j + i) % t->length]);
-            CuAssertIntEquals(testCase, t->repeatCounts[j], t_rotated->repeatCounts[(j + i) % t->length]);
+            CuAssertIntEquals(testCase, rleString_getRepeatCount(t, j), rleString_getRepeatCount(t_rotated, (j + i) % t->length));
         }
 
         // Cleanup
@@ -807,6 +1260,393 @@ void test_rle_rotateString(CuTest *testCase) {
     }
 }
 
+static char *getRandomRunSequence(int64_t length) {
+    // random sequence with runs of all lengths, so run ends fall everywhere in the sixteen character SIMD blocks
+    char *s = st_malloc(length + 1);
+    int64_t i = 0;
+    while (i < length) {
+        char c = "ACGT"[st_randomInt(0, 4)];
+        int64_t runLength = st_random() > 0.1 ? st_randomInt(1, 4) : st_randomInt(1, 300);
+        for (int64_t j = 0; j < runLength && i < length; j++) {
+            s[i++] = c;
+        }
+    }
+    s[length] = '\0';
+    return s;
+}
+
+void test_rleString_randomExamples(CuTest *testCase) {
+    for (int64_t test = 0; test < 1000; test++) {
+        char *s = getRandomRunSequence(st_randomInt(0, 1000));
+        RleString *r = rleString_construct(s);
+
+        // against the byte at a time encoding
+        int64_t nonRleLength = strlen(s);
+        CuAssertIntEquals(testCase, nonRleLength, r->nonRleLength);
+        uint64_t *nonRleToRle = rleString_getNonRleToRleCoordinateMap(r);
+        uint64_t *rleToNonRle = rleString_getRleToNonRleCoordinateMap(r);
+        int64_t j = 0, k = 1;
+        for (int64_t i = 0; i < nonRleLength; i++) {
+            CuAssertIntEquals(testCase, j, nonRleToRle[i]);
+            if (i + 1 == nonRleLength || s[i] != s[i + 1]) {
+                CuAssertTrue(testCase, j < r->length);
+                CuAssertIntEquals(testCase, s[i], r->rleString[j]);
+                CuAssertIntEquals(testCase, k, rleString_getRepeatCount(r, j));
+                CuAssertIntEquals(testCase, i + 1 - k, rleToNonRle[j]);
+                j++;
+                k = 1;
+            } else {
+                k++;
+            }
+        }
+        CuAssertIntEquals(testCase, j, r->length);
+        CuAssertIntEquals(testCase, '\0', r->rleString[r->length]);
+
+        free(nonRleToRle);
+        free(rleToNonRle);
+        rleString_destruct(r);
+        free(s);
+    }
+}
+
+void test_packedAlignment_runLengthEncode(CuTest *testCase) {
+    for (int64_t test = 0; test < 100; test++) {
+        char *x = getRandomRunSequence(st_randomInt(1, 1000));
+        char *y = getRandomRunSequence(st_randomInt(1, 1000));
+        RleString *rleX = rleString_construct(x);
+        RleString *rleY = rleString_construct(y);
+        uint64_t *xMap = rleString_getNonRleToRleCoordinateMap(rleX);
+        uint64_t *yMap = rleString_getNonRleToRleCoordinateMap(rleY);
+
+        // a random alignment of matches and indels, as from a cigar
+        PackedAlignment *packedAlignment = packedAlignment_construct();
+        stList *alignment = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
+        int64_t i = 0, j = 0;
+        while (i < rleX->nonRleLength && j < rleY->nonRleLength) {
+            double r = st_random();
+            if (r < 0.8) {
+                packedAlignment_addPair(packedAlignment, i, j);
+                stList_append(alignment, stIntTuple_construct3(i++, j++, 5));
+            } else if (r < 0.9) {
+                i++;
+            } else {
+                j++;
+            }
+        }
+
+        // the expansion is the alignment
+        CuAssertIntEquals(testCase, stList_length(alignment), packedAlignment->length);
+        CuAssertTrue(testCase, packedAlignment->runNo <= stList_length(alignment));
+        stList *alignedPairs = packedAlignment_getAlignedPairs(packedAlignment, 5);
+        CuAssertIntEquals(testCase, stList_length(alignment), stList_length(alignedPairs));
+        for (int64_t k = 0; k < stList_length(alignment); k++) {
+            CuAssertTrue(testCase, stIntTuple_cmpFn(stList_get(alignment, k), stList_get(alignedPairs, k)) == 0);
+        }
+
+        // and run length encoding it is the same as run length encoding the aligned pairs
+        stList *rleAlignment = runLengthEncodeAlignment(alignment, xMap, yMap);
+        PackedAlignment *packedRleAlignment = packedAlignment_runLengthEncode(packedAlignment, xMap, yMap);
+        stList *rleAlignedPairs = packedAlignment_getAlignedPairs(packedRleAlignment, 5);
+        CuAssertIntEquals(testCase, stList_length(rleAlignment), stList_length(rleAlignedPairs));
+        for (int64_t k = 0; k < stList_length(rleAlignment); k++) {
+            CuAssertTrue(testCase,
+                         stIntTuple_cmpFn(stList_get(rleAlignment, k), stList_get(rleAlignedPairs, k)) == 0);
+        }
+
+        stList_destruct(rleAlignedPairs);
+        packedAlignment_destruct(packedRleAlignment);
+        stList_destruct(rleAlignment);
+        stList_destruct(alignedPairs);
+        stList_destruct(alignment);
+        packedAlignment_destruct(packedAlignment);
+        free(xMap);
+        free(yMap);
+        rleString_destruct(rleX);
+        rleString_destruct(rleY);
+        free(x);
+        free(y);
+    }
+}
+
+void test_rleString_constructSpeed(CuTest *testCase) {
+    // microbenchmark of the encoding and coordinate maps for a 1Mb read
+    char *s = getRandomRunSequence(1000000);
+    time_t startTime = time(NULL);
+    for (int64_t test = 0; test < 100; test++) {
+        RleString *r = rleString_construct(s);
+        uint64_t *nonRleToRle = rleString_getNonRleToRleCoordinateMap(r);
+        uint64_t *rleToNonRle = rleString_getRleToNonRleCoordinateMap(r);
+        CuAssertIntEquals(testCase, r->length - 1, nonRleToRle[r->nonRleLength - 1]);
+        free(nonRleToRle);
+        free(rleToNonRle);
+        rleString_destruct(r);
+    }
+    fprintf(stderr, " Run length encoded a 1Mb sequence 100 times in %" PRIi64 " seconds\n",
+            (int64_t) (time(NULL) - startTime));
+    free(s);
+}
+
+void test_rleString_overflowRepeatCounts(CuTest *testCase) {
+    // runs too long for the uint8_t repeat counts
+    char *a = expandChar('A', 300), *g = expandChar('G', 1000);
+    char *s = stString_print("%sC%sT", a, g);
+    RleString *r = rleString_construct(s);
+    CuAssertIntEquals(testCase, 4, r->length);
+    CuAssertIntEquals(testCase, 1302, r->nonRleLength);
+    CuAssertIntEquals(testCase, 300, rleString_getRepeatCount(r, 0));
+    CuAssertIntEquals(testCase, 1, rleString_getRepeatCount(r, 1));
+    CuAssertIntEquals(testCase, 1000, rleString_getRepeatCount(r, 2));
+    CuAssertIntEquals(testCase, 1, rleString_getRepeatCount(r, 3));
+    CuAssertIntEquals(testCase, 2, r->overflowLength);
+
+    // expansion, copies and rotation keep them
+    char *expanded = rleString_expand(r);
+    CuAssertStrEquals(testCase, s, expanded);
+    RleString *sub = rleString_copySubstring(r, 1, 3);
+    CuAssertIntEquals(testCase, 1002, sub->nonRleLength);
+    CuAssertIntEquals(testCase, 1000, rleString_getRepeatCount(sub, 1));
+    CuAssertIntEquals(testCase, 1, sub->overflowLength);
+    RleString *rotated = rleString_copy(r);
+    rleString_rotateString(rotated, 1, 0);
+    CuAssertIntEquals(testCase, 300, rleString_getRepeatCount(rotated, 1));
+    CuAssertIntEquals(testCase, 1000, rleString_getRepeatCount(rotated, 3));
+
+    // setting them small again clears the overflow
+    rleString_setRepeatCount(r, 2, 7);
+    CuAssertIntEquals(testCase, 7, rleString_getRepeatCount(r, 2));
+    CuAssertIntEquals(testCase, 300, rleString_getRepeatCount(r, 0));
+    rleString_setRepeatCount(r, 0, 3);
+    CuAssertIntEquals(testCase, 0, r->overflowLength);
+    CuAssertIntEquals(testCase, 3, rleString_getRepeatCount(r, 0));
+
+    rleString_destruct(rotated);
+    rleString_destruct(sub);
+    rleString_destruct(r);
+    free(expanded);
+    free(s);
+    free(a);
+    free(g);
+}
+
+void test_runLengthCounts(CuTest *testCase) {
+    // counts survive serialization and merging, and become a normalized repeat sub matrix
+    RunLengthCounts *counts1 = runLengthCounts_construct(MAXIMUM_REPEAT_LENGTH);
+    RunLengthCounts *counts2 = runLengthCounts_construct(MAXIMUM_REPEAT_LENGTH);
+    for (int64_t i = 0; i < 10000; i++) {
+        (*runLengthCounts_getCount(st_random() > 0.5 ? counts1 : counts2, st_randomInt(0, 4), st_randomInt(1, 60),
+                                   st_randomInt(1, 60)))++;
+    }
+    FILE *fh = tmpfile();
+    runLengthCounts_write(counts1, fh);
+    runLengthCounts_write(counts2, fh);
+    rewind(fh);
+    RunLengthCounts *merged = runLengthCounts_read(fh);
+    RunLengthCounts *readCounts2 = runLengthCounts_read(fh);
+    CuAssertTrue(testCase, runLengthCounts_read(fh) == NULL);
+    fclose(fh);
+    runLengthCounts_merge(merged, readCounts2);
+    uint64_t total = 0;
+    for (Symbol base = 0; base < 4; base++) {
+        for (int64_t underlying = 0; underlying < MAXIMUM_REPEAT_LENGTH; underlying++) {
+            for (int64_t observed = 0; observed < MAXIMUM_REPEAT_LENGTH; observed++) {
+                uint64_t count = *runLengthCounts_getCount(merged, base, underlying, observed);
+                CuAssertIntEquals(testCase, *runLengthCounts_getCount(counts1, base, underlying, observed) +
+                                            *runLengthCounts_getCount(counts2, base, underlying, observed), count);
+                total += count;
+            }
+        }
+    }
+    CuAssertIntEquals(testCase, 10000, total);
+
+    // as a repeat sub matrix
+    char *json;
+    size_t jsonLength;
+    fh = open_memstream(&json, &jsonLength);
+    runLengthCounts_writeRepeatSubMatrixJson(merged, fh, 1.0);
+    fclose(fh);
+    RepeatSubMatrix *repeatSubMatrix = repeatSubMatrix_constructEmpty(alphabet_constructNucleotide());
+    repeatSubMatrix_jsonParse(repeatSubMatrix, json, jsonLength);
+    for (Symbol base = 0; base < 4; base++) {
+        for (int64_t underlying = 0; underlying < MAXIMUM_REPEAT_LENGTH; underlying++) {
+            double rowTotal = MAXIMUM_REPEAT_LENGTH;
+            for (int64_t observed = 0; observed < MAXIMUM_REPEAT_LENGTH; observed++) {
+                rowTotal += *runLengthCounts_getCount(merged, base, underlying, observed);
+            }
+            double p = 0.0;
+            for (int64_t observed = 0; observed < MAXIMUM_REPEAT_LENGTH; observed++) {
+                double logProb = repeatSubMatrix_getLogProb(repeatSubMatrix, base, 1, observed, underlying);
+                CuAssertDblEquals(testCase,
+                                  log10((*runLengthCounts_getCount(merged, base, underlying, observed) + 1) / rowTotal),
+                                  logProb, 0.00001);
+                // the reverse strand is the complement
+                CuAssertDblEquals(testCase, logProb,
+                                  repeatSubMatrix_getLogProb(repeatSubMatrix, 3 - base, 0, observed, underlying), 0.0);
+                p += pow(10, logProb);
+            }
+            CuAssertDblEquals(testCase, 1.0, p, 0.00001);
+        }
+    }
+    double p = 0.0;
+    for (int64_t underlying = 0; underlying < MAXIMUM_REPEAT_LENGTH; underlying++) {
+        p += pow(10, repeatSubMatrix->baseLogProbs_AT[underlying]);
+    }
+    CuAssertDblEquals(testCase, 1.0, p, 0.00001);
+
+    repeatSubMatrix_destruct(repeatSubMatrix);
+    free(json);
+    runLengthCounts_destruct(counts1);
+    runLengthCounts_destruct(counts2);
+    runLengthCounts_destruct(merged);
+    runLengthCounts_destruct(readCounts2);
+}
+
+void test_rleNucleotideEmissions(CuTest *testCase) {
+    // the precomputed rle emissions against the nucleotide emissions plus the weighted repeat count probabilities
+    Params *params = params_readParams(polishParamsFile);
+    CuAssertTrue(testCase, params->polishParams->useRepeatCountsInAlignment);
+    RepeatSubMatrix *repeatSubMatrix = params->polishParams->repeatSubMatrix;
+    for (int64_t strand = 0; strand < 2; strand++) {
+        StateMachine *sM = strand ? params->polishParams->stateMachineForForwardStrandRead :
+                           params->polishParams->stateMachineForReverseStrandRead;
+        Emissions *e = sM->emissions;
+        for (Symbol xBase = 0; xBase < 5; xBase++) {
+            for (Symbol yBase = 0; yBase < 5; yBase++) {
+                double baseLogProb = e->emission(e, xBase, yBase) -
+                                     2.3025 * repeatSubMatrix_getLogProb(repeatSubMatrix, xBase < 4 ? xBase : 0,
+                                                                         strand, 0, 0);
+                for (int64_t xRepeatCount = 0; xRepeatCount < MAXIMUM_REPEAT_LENGTH; xRepeatCount++) {
+                    for (int64_t yRepeatCount = 0; yRepeatCount < MAXIMUM_REPEAT_LENGTH; yRepeatCount++) {
+                        Symbol x = symbol_addRepeatCount(xBase, xRepeatCount, MAXIMUM_REPEAT_LENGTH);
+                        Symbol y = symbol_addRepeatCount(yBase, yRepeatCount, MAXIMUM_REPEAT_LENGTH);
+                        double logProb = baseLogProb +
+                                         2.3025 * repeatSubMatrix_getLogProb(repeatSubMatrix, xBase < 4 ? xBase : 0,
+                                                                             strand, yRepeatCount, xRepeatCount);
+                        CuAssertDblEquals(testCase, logProb, e->emission(e, x, y), 0.000001);
+                        // the gap emissions do not depend on the repeat counts
+                        CuAssertDblEquals(testCase, e->gapEmissionX(e, xBase), e->gapEmissionX(e, x), 0.0);
+                        CuAssertDblEquals(testCase, e->gapEmissionY(e, yBase), e->gapEmissionY(e, y), 0.0);
+                    }
+                }
+                // the diagonal emissions are the cell emissions
+                Symbol sX[1] = { symbol_addRepeatCount(xBase, 3, MAXIMUM_REPEAT_LENGTH) };
+                Symbol sY[1] = { symbol_addRepeatCount(yBase, 5, MAXIMUM_REPEAT_LENGTH) };
+                double eGapX, eMatch, eGapY;
+                e->diagonalEmissions(e, sX, sY, 1, &eGapX, &eMatch, &eGapY);
+                CuAssertDblEquals(testCase, e->emission(e, sX[0], sY[0]), eMatch, 0.0);
+                CuAssertDblEquals(testCase, e->gapEmissionX(e, sX[0]), eGapX, 0.0);
+                CuAssertDblEquals(testCase, e->gapEmissionY(e, sY[0]), eGapY, 0.0);
+            }
+        }
+    }
+    params_destruct(params);
+}
+
+void test_readStateMachinesAreReverseStrands(CuTest *testCase) {
+    // the read state machines built when reading the params are those of the two strands
+    Params *params = params_readParams(polishParamsFile);
+    PolishParams *polishParams = params->polishParams;
+    CuAssertTrue(testCase, stateMachine3_isReverseStrand(polishParams->stateMachineForForwardStrandRead,
+                                                         polishParams->stateMachineForReverseStrandRead,
+                                                         polishParams->repeatSubMatrix->maximumRepeatLength));
+    CuAssertTrue(testCase, stateMachine3_isReverseStrand(polishParams->stateMachineForReverseStrandRead,
+                                                         polishParams->stateMachineForForwardStrandRead,
+                                                         polishParams->repeatSubMatrix->maximumRepeatLength));
+    CuAssertTrue(testCase, !stateMachine3_isReverseStrand(polishParams->stateMachineForForwardStrandRead,
+                                                          polishParams->stateMachineForForwardStrandRead,
+                                                          polishParams->repeatSubMatrix->maximumRepeatLength));
+    params_destruct(params);
+}
+
+void test_repeatSubMatrix_getRepeatCountProbs(CuTest *testCase) {
+    // the bucketed evaluation of the repeat count probabilities against the observation by observation one
+    Params *params = params_readParams(polishParamsFile);
+    RepeatSubMatrix *repeatSubMatrix = params->polishParams->repeatSubMatrix;
+    for (int64_t test = 0; test < 100; test++) {
+        stList *reads = stList_construct3(0, (void (*)(void *)) bamChunkRead_destruct);
+        int64_t observationNo = st_randomInt(1, 50);
+        PoaBaseObservation observations[observationNo];
+        for (int64_t i = 0; i < observationNo; i++) {
+            char *readName = stString_print("read_%" PRIi64, i);
+            char *s = getRandomRunSequence(st_randomInt(1, 100));
+            stList_append(reads, bamChunkRead_construct2(readName, s, NULL, st_random() > 0.5, TRUE));
+            free(readName);
+            free(s);
+            BamChunkRead *read = stList_peek(reads);
+            observations[i].readNo = i;
+            observations[i].offset = st_randomInt(0, read->rleRead->length);
+            observations[i].weight = st_random() * PAIR_ALIGNMENT_PROB_1;
+        }
+        Symbol base = st_randomInt(0, 4);
+        int64_t minRepeatLength, maxRepeatLength;
+        repeatSubMatrix_getMinAndMaxRepeatCountObservations(repeatSubMatrix, observations, observationNo, reads,
+                                                            &minRepeatLength, &maxRepeatLength);
+        double logProbabilities[repeatSubMatrix->maximumRepeatLength];
+        repeatSubMatrix_getRepeatCountProbs(repeatSubMatrix, base, observations, observationNo, reads,
+                                            logProbabilities, minRepeatLength, maxRepeatLength);
+        for (int64_t i = minRepeatLength; i <= maxRepeatLength; i++) {
+            double logProb = repeatSubMatrix_getLogProbForGivenRepeatCount(repeatSubMatrix, base, observations,
+                                                                           observationNo, reads, i);
+            CuAssertDblEquals(testCase, logProb, logProbabilities[i - minRepeatLength], 0.0001);
+        }
+        stList_destruct(reads);
+    }
+    params_destruct(params);
+}
+
+void test_repeatSubMatrix_getPhasedMLRepeatCount(CuTest *testCase) {
+    // the reads' labels are those of the hap 1 set, and with every read in hap 1 the phased repeat count is the
+    // unphased one
+    Params *params = params_readParams(polishParamsFile);
+    RepeatSubMatrix *repeatSubMatrix = params->polishParams->repeatSubMatrix;
+    for (int64_t test = 0; test < 100; test++) {
+        stList *reads = stList_construct3(0, (void (*)(void *)) bamChunkRead_destruct);
+        stSet *readsInHap1 = stSet_construct();
+        stSet *someReads = stSet_construct();
+        int64_t observationNo = st_randomInt(1, 50);
+        PoaBaseObservation observations[observationNo];
+        for (int64_t i = 0; i < observationNo; i++) {
+            char *readName = stString_print("read_%" PRIi64, i);
+            char *s = getRandomRunSequence(st_randomInt(1, 100));
+            stList_append(reads, bamChunkRead_construct2(readName, s, NULL, st_random() > 0.5, TRUE));
+            free(readName);
+            free(s);
+            BamChunkRead *read = stList_peek(reads);
+            stSet_insert(readsInHap1, read);
+            if (st_random() > 0.5) {
+                stSet_insert(someReads, read);
+            }
+            observations[i].readNo = i;
+            observations[i].offset = st_randomInt(0, read->rleRead->length);
+            observations[i].weight = st_random() * PAIR_ALIGNMENT_PROB_1;
+        }
+
+        // the labels are those of the set
+        bool *readInHap1 = getReadsInHap1(reads, someReads);
+        for (int64_t i = 0; i < observationNo; i++) {
+            CuAssertIntEquals(testCase, stSet_search(someReads, stList_get(reads, i)) != NULL, readInHap1[i]);
+        }
+        free(readInHap1);
+
+        Symbol base = st_randomInt(0, 4);
+        double logProbability, phasedLogProbability;
+        int64_t repeatCount = repeatSubMatrix_getMLRepeatCount(repeatSubMatrix, base, observations, observationNo,
+                                                               reads, &logProbability);
+        readInHap1 = getReadsInHap1(reads, readsInHap1);
+        int64_t phasedRepeatCount = repeatSubMatrix_getPhasedMLRepeatCount(repeatSubMatrix, repeatCount, base,
+                                                                           observations, observationNo, reads,
+                                                                           &phasedLogProbability, readInHap1,
+                                                                           params->polishParams);
+        CuAssertIntEquals(testCase, repeatCount, phasedRepeatCount);
+        CuAssertDblEquals(testCase, logProbability, phasedLogProbability, 0.0001);
+
+        free(readInHap1);
+        stSet_destruct(readsInHap1);
+        stSet_destruct(someReads);
+        stList_destruct(reads);
+    }
+    params_destruct(params);
+}
+
 void checkStringsAndFree(CuTest *testCase, const char *expected, char *temp) {
     CuAssertStrEquals(testCase, expected, temp);
     free(temp);
@@ -895,6 +1735,9 @@ void test_removeOverlap_RandomExamples(CuTest *testCase) {
     params->polishParams->useRunLengthEncoding = FALSE;
 
     for (int64_t test = 0; test < 100; test++) {
+        // Alternate between cropping at exact matches and always aligning the overlap
+        polishParams->stitchExactMatchLength = test % 2 == 0 ? 32 : 0;
+
         // Truth
         char *truth = getRandomSequence(st_randomInt(200, 300));
         int64_t halfway = strlen(truth) / 2;
@@ -937,6 +1780,33 @@ void test_removeOverlap_RandomExamples(CuTest *testCase) {
     params_destruct(params);
 }
 
+void test_removeOverlap_exactMatch(CuTest *testCase) {
+    /*
+     * Checks an overlap sharing a long exact match is cropped in the middle of the match without aligning.
+     */
+    Params *params = params_readParams(polishParamsFile);
+    PolishParams *polishParams = params->polishParams;
+    polishParams->stitchExactMatchLength = 32;
+
+    for (int64_t test = 0; test < 10; test++) {
+        char *truth = getRandomSequence(400);
+        char *prefixString = stString_getSubString(truth, 0, 250);
+        char *suffixString = stString_getSubString(truth, 150, 250);
+
+        int64_t prefixStringCropEnd, suffixStringCropStart;
+        int64_t overlapWeight = removeOverlap(prefixString, strlen(prefixString), suffixString, strlen(suffixString),
+                                              100, polishParams, &prefixStringCropEnd, &suffixStringCropStart);
+        CuAssertIntEquals(testCase, PAIR_ALIGNMENT_PROB_1, overlapWeight);
+        CuAssertIntEquals(testCase, 200, prefixStringCropEnd);
+        CuAssertIntEquals(testCase, 50, suffixStringCropStart);
+
+        free(prefixString);
+        free(suffixString);
+        free(truth);
+    }
+
+    params_destruct(params);
+}
 
 int64_t polishingTest(char *bamFile, char *referenceFile, char *paramsFile, char *region, bool verbose, bool diploid) {
 
@@ -961,6 +1831,244 @@ void test_binomialPValue(CuTest *testCase) {
     CuAssertDblEquals(testCase, 80347448443237920.0, bionomialCoefficient(64, 22), 0.001);
     CuAssertDblEquals(testCase, 151473214816.0, bionomialCoefficient(64, 10), 0.001);
     CuAssertDblEquals(testCase, 1832624140942590534.0, bionomialCoefficient(64, 32), 0.001);
+
+    CuAssertDblEquals(testCase, 0.623046875, binomialPValue(10, 5), 1e-12);
+    CuAssertDblEquals(testCase, 0.0546875, binomialPValue(10, 2), 1e-12);
+    CuAssertDblEquals(testCase, 0.0546875, binomialPValue(10, 8), 1e-12);
+    CuAssertDblEquals(testCase, 0.029970594783499616, binomialPValue(64, 40), 1e-12);
+    // Beyond the depths at which the binomial coefficients overflow
+    CuAssertDblEquals(testCase, 1.3264377797634238e-05, binomialPValue(200, 130), 1e-12);
+    CuAssertDblEquals(testCase, 0.5126125090891804, binomialPValue(1000, 500), 1e-10);
+}
+
+static void test_getAlignmentDivergence(CuTest *testCase) {
+    RleString *reference = rleString_construct_no_rle("GATTACA");
+    stList *reads = stList_construct3(0, (void (*)(void *)) bamChunkRead_destruct);
+    stList *alignments = stList_construct3(0, (void (*)(void *)) stList_destruct);
+
+    // A read matching the reference
+    stList_append(reads, bamChunkRead_construct2("match", "GATTACA", NULL, TRUE, FALSE));
+    stList *alignment = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
+    for (int64_t i = 0; i < 7; i++) {
+        stList_append(alignment, stIntTuple_construct3(i, i, 10));
+    }
+    stList_append(alignments, alignment);
+    CuAssertDblEquals(testCase, 0.0, getAlignmentDivergence(reads, alignments, reference), 1e-12);
+
+    // A read with a mismatch and a deleted base
+    stList_append(reads, bamChunkRead_construct2("mismatch", "GCTACA", NULL, TRUE, FALSE));
+    alignment = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
+    stList_append(alignment, stIntTuple_construct3(0, 0, 10));
+    stList_append(alignment, stIntTuple_construct3(1, 1, 10));
+    for (int64_t i = 3; i < 7; i++) {
+        stList_append(alignment, stIntTuple_construct3(i, i - 1, 10));
+    }
+    stList_append(alignments, alignment);
+    CuAssertDblEquals(testCase, 2.0 / 14.0, getAlignmentDivergence(reads, alignments, reference), 1e-12);
+
+    stList_destruct(reads);
+    stList_destruct(alignments);
+    rleString_destruct(reference);
+}
+
+void test_csvWriter(CuTest *testCase) {
+    // fields are written as fprintf would write them
+    char *written, *expected;
+    size_t writtenLength, expectedLength;
+    FILE *fh = open_memstream(&written, &writtenLength);
+    FILE *expectedFh = open_memstream(&expected, &expectedLength);
+    CsvWriter *writer = csvWriter_construct(fh);
+    double examples[] = {0.0, -0.0, 1.0, 0.5, 0.0000005, 0.9999999, -2.25, 1e20, -1e-9, INFINITY, NAN};
+    for (int64_t i = 0; i < 100000; i++) {
+        double f = i < 11 ? examples[i] : (st_random() - 0.5) * pow(10.0, st_randomInt(-8, 12));
+        int64_t digits = st_randomInt(0, 7);
+        int64_t j = st_randomInt(-1000000, 1000000);
+        csvWriter_float(writer, f, digits);
+        csvWriter_char(writer, ',');
+        csvWriter_int(writer, j);
+        csvWriter_string(writer, ",read\n");
+        fprintf(expectedFh, "%.*f,%" PRIi64 ",read\n", (int) digits, f, j);
+    }
+    csvWriter_destruct(writer);
+    fclose(fh);
+    fclose(expectedFh);
+    CuAssertIntEquals(testCase, expectedLength, writtenLength);
+    CuAssertStrEquals(testCase, expected, written);
+    free(written);
+    free(expected);
+}
+
+static char *REGION_PARAMS_FILE = "../params/ont/r9.4/allParams.np.human.r94-g360.json";
+static char *REGION_REF_FILE = "../tests/data/realData/hg38.chr20_59M_100k.fa";
+static char *REGION_BAM_FILE = "../tests/data/realData/HG002.r94g360.chr20_59M_100k.bam";
+
+static AlignedRead *getAlignedReads(CuTest *testCase, char *bamFile, char *contig, int64_t start, int64_t end,
+                                    int64_t *alignedReadNo) {
+    /*
+     * Reads the alignments overlapping the window of the bam file as AlignedReads, as a program embedding margin
+     * would give them
+     */
+    samFile *in = hts_open(bamFile, "r");
+    CuAssertTrue(testCase, in != NULL);
+    bam_hdr_t *bamHdr = sam_hdr_read(in);
+    hts_idx_t *idx = sam_index_load(in, bamFile);
+    CuAssertTrue(testCase, idx != NULL);
+    char *region = stString_print("%s:%" PRIi64 "-%" PRIi64, contig, start + 1, end);
+    hts_itr_t *iter = sam_itr_querys(idx, bamHdr, region);
+    bam1_t *aln = bam_init1();
+    stList *alignedReads = stList_construct();
+    while (sam_itr_next(in, iter, aln) >= 0) {
+        if (aln->core.flag & BAM_FUNMAP) continue;
+        AlignedRead *r = st_calloc(1, sizeof(AlignedRead));
+        r->readName = stString_copy(bam_get_qname(aln));
+        r->nucleotides = st_malloc(aln->core.l_qseq + 1);
+        uint8_t *seq = bam_get_seq(aln), *qual = bam_get_qual(aln);
+        for (int64_t i = 0; i < aln->core.l_qseq; i++) {
+            r->nucleotides[i] = seq_nt16_str[bam_seqi(seq, i)];
+        }
+        r->nucleotides[aln->core.l_qseq] = '\0';
+        if (aln->core.l_qseq > 0 && qual[0] != 0xff) {
+            r->qualities = st_malloc(aln->core.l_qseq);
+            memcpy(r->qualities, qual, aln->core.l_qseq);
+        }
+        char *cigar = stString_print("");
+        uint32_t *ops = bam_get_cigar(aln);
+        for (uint32_t i = 0; i < aln->core.n_cigar; i++) {
+            char *extendedCigar = stString_print("%s%d%c", cigar, bam_cigar_oplen(ops[i]), bam_cigar_opchr(ops[i]));
+            free(cigar);
+            cigar = extendedCigar;
+        }
+        r->cigar = cigar;
+        r->refStart = aln->core.pos;
+        r->forwardStrand = !bam_is_rev(aln);
+        r->mapQ = aln->core.qual;
+        r->secondary = (aln->core.flag & BAM_FSECONDARY) != 0;
+        r->supplementary = (aln->core.flag & BAM_FSUPPLEMENTARY) != 0;
+        stList_append(alignedReads, r);
+    }
+
+    // as an array
+    *alignedReadNo = stList_length(alignedReads);
+    AlignedRead *alignedReadArray = st_calloc(*alignedReadNo, sizeof(AlignedRead));
+    for (int64_t i = 0; i < *alignedReadNo; i++) {
+        alignedReadArray[i] = *(AlignedRead *) stList_get(alignedReads, i);
+        free(stList_get(alignedReads, i));
+    }
+
+    // Cleanup
+    stList_destruct(alignedReads);
+    bam_destroy1(aln);
+    hts_itr_destroy(iter);
+    hts_idx_destroy(idx);
+    bam_hdr_destroy(bamHdr);
+    hts_close(in);
+    free(region);
+    return alignedReadArray;
+}
+
+static void alignedReads_destruct(AlignedRead *alignedReads, int64_t alignedReadNo) {
+    for (int64_t i = 0; i < alignedReadNo; i++) {
+        free(alignedReads[i].readName);
+        free(alignedReads[i].nucleotides);
+        free(alignedReads[i].qualities);
+        free(alignedReads[i].cigar);
+    }
+    free(alignedReads);
+}
+
+static void checkRleStringsEqual(CuTest *testCase, RleString *rleString1, RleString *rleString2) {
+    char *string1 = rleString_expand(rleString1);
+    char *string2 = rleString_expand(rleString2);
+    CuAssertStrEquals(testCase, string1, string2);
+    free(string1);
+    free(string2);
+}
+
+static void checkReadNamesEqual(CuTest *testCase, stSet *readNames1, stSet *readNames2) {
+    CuAssertIntEquals(testCase, stSet_size(readNames1), stSet_size(readNames2));
+    stSetIterator *it = stSet_getIterator(readNames1);
+    char *readName;
+    while ((readName = stSet_getNext(it)) != NULL) {
+        CuAssertTrue(testCase, stSet_search(readNames2, readName) != NULL);
+    }
+    stSet_destructIterator(it);
+}
+
+static void test_polishRegion(CuTest *testCase, bool diploid) {
+    /*
+     * Polishes a window of the real data from its reads given in memory, and checks the result is that of polishing
+     * the same window from the reads read from the bam file
+     */
+    Params *params = params_readParams(REGION_PARAMS_FILE);
+    params->polishParams->maxDepth = 0; // so that neither path is downsampled
+    char *contig = "chr20";
+    int64_t start = 400, end = 2400;
+    char *reference = getSequenceFromReference(REGION_REF_FILE, contig, start, end);
+    for (int64_t i = 0; reference[i] != '\0'; i++) {
+        reference[i] = (char) toupper(reference[i]); // as polishRegion does
+    }
+
+    // the in memory path
+    int64_t alignedReadNo;
+    AlignedRead *alignedReads = getAlignedReads(testCase, REGION_BAM_FILE, contig, start, end, &alignedReadNo);
+    CuAssertTrue(testCase, alignedReadNo > 0);
+    RegionPolishResult *result = polishRegion(contig, reference, start, alignedReads, alignedReadNo, params, diploid);
+    CuAssertTrue(testCase, result != NULL);
+
+    // the bam path, for the same window as a chunk of a chunker of the bam file
+    BamChunker *bamChunker = bamChunker_construct(REGION_BAM_FILE, params->polishParams);
+    BamChunk *bamChunk = bamChunk_construct2(contig, 0, start, start, end, end, 0, bamChunker);
+    RleString *rleReference = params->polishParams->useRunLengthEncoding ? rleString_construct(reference) :
+                              rleString_construct_no_rle(reference);
+    BamChunkReads *chunkReads = bamChunkReads_construct(rleReference);
+    convertToReadsAndAlignmentsWithFiltered2(bamChunk, chunkReads->rleReferenceCoordinateMap, chunkReads->reads,
+                                             chunkReads->alignments, NULL, NULL, params->polishParams);
+    CuAssertIntEquals(testCase, alignedReadNo, stList_length(chunkReads->reads));
+    RegionPolishResult *bamResult = polishChunkReads(bamChunk, chunkReads, 0, params, diploid);
+
+    // the results agree
+    checkRleStringsEqual(testCase, bamResult->consensus, result->consensus);
+    CuAssertTrue(testCase, (result->hap1Consensus != NULL) == diploid);
+    if (diploid) {
+        checkRleStringsEqual(testCase, bamResult->hap1Consensus, result->hap1Consensus);
+        checkRleStringsEqual(testCase, bamResult->hap2Consensus, result->hap2Consensus);
+        checkReadNamesEqual(testCase, bamResult->readsInHap1, result->readsInHap1);
+        checkReadNamesEqual(testCase, bamResult->readsInHap2, result->readsInHap2);
+        CuAssertIntEquals(testCase, stList_length(bamResult->vcfEntries), stList_length(result->vcfEntries));
+        for (int64_t i = 0; i < stList_length(result->vcfEntries); i++) {
+            VcfEntry *e = stList_get(result->vcfEntries, i), *bamE = stList_get(bamResult->vcfEntries, i);
+            CuAssertIntEquals(testCase, bamE->refPos, e->refPos);
+        }
+    }
+
+    // Cleanup
+    regionPolishResult_destruct(result);
+    regionPolishResult_destruct(bamResult);
+    bamChunk_destruct(bamChunk);
+    bamChunker_destruct(bamChunker);
+    alignedReads_destruct(alignedReads, alignedReadNo);
+    free(reference);
+    params_destruct(params);
+}
+
+void test_polishRegionHaploid(CuTest *testCase) {
+    test_polishRegion(testCase, FALSE);
+}
+
+void test_polishRegionDiploid(CuTest *testCase) {
+    test_polishRegion(testCase, TRUE);
+}
+
+void test_polishRegionMalformedCigar(CuTest *testCase) {
+    /*
+     * A read whose CIGAR does not match its sequence is an error returned to the caller, not an abort
+     */
+    Params *params = params_readParams(REGION_PARAMS_FILE);
+    AlignedRead alignedRead = { "read1", "ACGTACGTAC", NULL, "5M", 0, TRUE, 60, FALSE, FALSE };
+    CuAssertTrue(testCase, polishRegion("chr20", "ACGTACGTACGTACGTACGT", 0, &alignedRead, 1, params, FALSE) == NULL);
+    alignedRead.cigar = "10Q";
+    CuAssertTrue(testCase, polishRegion("chr20", "ACGTACGTACGTACGTACGT", 0, &alignedRead, 1, params, FALSE) == NULL);
+    params_destruct(params);
 }
 
 CuSuite *polisherTestSuite(void) {
@@ -968,8 +2076,20 @@ CuSuite *polisherTestSuite(void) {
 
     SUITE_ADD_TEST(suite, test_poa_getReferenceGraph);
     SUITE_ADD_TEST(suite, test_getShift);
+    SUITE_ADD_TEST(suite, test_getShiftOfLongRepeats);
     SUITE_ADD_TEST(suite, test_rleString_examples);
+    SUITE_ADD_TEST(suite, test_rleString_noRle);
+    SUITE_ADD_TEST(suite, test_rleString_hash);
     SUITE_ADD_TEST(suite, test_rle_rotateString);
+    SUITE_ADD_TEST(suite, test_rleString_overflowRepeatCounts);
+    SUITE_ADD_TEST(suite, test_rleString_randomExamples);
+    SUITE_ADD_TEST(suite, test_packedAlignment_runLengthEncode);
+    SUITE_ADD_TEST(suite, test_rleString_constructSpeed);
+    SUITE_ADD_TEST(suite, test_repeatSubMatrix_getRepeatCountProbs);
+    SUITE_ADD_TEST(suite, test_repeatSubMatrix_getPhasedMLRepeatCount);
+    SUITE_ADD_TEST(suite, test_rleNucleotideEmissions);
+    SUITE_ADD_TEST(suite, test_readStateMachinesAreReverseStrands);
+    SUITE_ADD_TEST(suite, test_runLengthCounts);
     SUITE_ADD_TEST(suite, test_poa_augment_example);
     SUITE_ADD_TEST(suite, test_poa_realign_tiny_example1);
     SUITE_ADD_TEST(suite, test_poa_realign);
@@ -980,8 +2100,19 @@ CuSuite *polisherTestSuite(void) {
     SUITE_ADD_TEST(suite, test_polishParams);
     SUITE_ADD_TEST(suite, test_removeOverlapExample);
     SUITE_ADD_TEST(suite, test_removeOverlap_RandomExamples);
+    SUITE_ADD_TEST(suite, test_removeOverlap_exactMatch);
     SUITE_ADD_TEST(suite, test_binomialPValue);
+    SUITE_ADD_TEST(suite, test_getAlignmentDivergence);
     SUITE_ADD_TEST(suite, test_poa_realignIterative);
+    SUITE_ADD_TEST(suite, test_poa_realign2);
+    SUITE_ADD_TEST(suite, test_poa_realignWithBackend);
+    SUITE_ADD_TEST(suite, test_poa_realignInParallel);
+    SUITE_ADD_TEST(suite, test_poa_realignDisagreementWindows);
+    SUITE_ADD_TEST(suite, test_poa_buildObservationArena);
+    SUITE_ADD_TEST(suite, test_csvWriter);
+    SUITE_ADD_TEST(suite, test_polishRegionHaploid);
+    SUITE_ADD_TEST(suite, test_polishRegionDiploid);
+    SUITE_ADD_TEST(suite, test_polishRegionMalformedCigar);
     SUITE_ADD_TEST(suite, test_poa_realign_ecoli_examples_rle);
     SUITE_ADD_TEST(suite, test_poa_realign_ecoli_examples_no_rle);
     SUITE_ADD_TEST(suite, test_poa_realign_ecoli_many_examples_rle);
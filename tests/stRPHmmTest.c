@@ -90,7 +90,8 @@ stProfileSeq *getRandomProfileSeq(stReference *ref, uint64_t *hapSeq,
 
 static stRPHmmParameters *getHmmParams(int64_t maxPartitionsInAColumn,
                                        double readErrorRate, bool maxNotSumTransitions,
-                                       int64_t minReadCoverageToSupportPhasingBetweenHeterozygousSites) {
+                                       int64_t minReadCoverageToSupportPhasingBetweenHeterozygousSites,
+                                       int64_t forwardBeamMaxCells) {
     stRPHmmParameters *params = st_calloc(1, sizeof(stRPHmmParameters));
 
     params->maxNotSumTransitions = maxNotSumTransitions;
@@ -99,6 +100,7 @@ static stRPHmmParameters *getHmmParams(int64_t maxPartitionsInAColumn,
     params->minReadCoverageToSupportPhasingBetweenHeterozygousSites =
             minReadCoverageToSupportPhasingBetweenHeterozygousSites;
     params->includeInvertedPartitions = 1;
+    params->forwardBeamMaxCells = forwardBeamMaxCells;
 
     return params;
 }
@@ -166,7 +168,7 @@ static void test_systemTest(CuTest *testCase, int64_t minReferenceSeqNumber, int
                             int64_t maxPartitionsInAColumn, double readErrorRate,
                             bool maxNotSumTransitions, bool splitHmmsWherePhasingUncertain,
                             int64_t minReadCoverageToSupportPhasingBetweenHeterozygousSites,
-                            bool printHmm) {
+                            bool printHmm, int64_t forwardBeamMaxCells, bool sweepHmmConstruction) {
     /*
      * System level test
      *
@@ -213,7 +215,9 @@ static void test_systemTest(CuTest *testCase, int64_t minReferenceSeqNumber, int
 
         stRPHmmParameters *params = getHmmParams(maxPartitionsInAColumn,
                                                  readErrorRate, maxNotSumTransitions,
-                                                 minReadCoverageToSupportPhasingBetweenHeterozygousSites);
+                                                 minReadCoverageToSupportPhasingBetweenHeterozygousSites,
+                                                 forwardBeamMaxCells);
+        params->sweepHmmConstruction = sweepHmmConstruction;
 
         stList *referenceSeqs = stList_construct3(0, (void (*)(void *)) stReference_destruct);
         stList *hapSeqs1 = stList_construct3(0, free);
@@ -369,7 +373,7 @@ static void test_systemTest(CuTest *testCase, int64_t minReferenceSeqNumber, int
                 stRPCell *cell = column->head;
                 while (cell != NULL) {
                     // Check that partition is properly specified
-                    CuAssertIntEquals(testCase, cell->partition >> column->depth, 0);
+                    CuAssertTrue(testCase, (cell->partition & ~makeAcceptMask(column->depth)) == 0);
 
                     cell = cell->nCell;
                 }
@@ -415,8 +419,8 @@ static void test_systemTest(CuTest *testCase, int64_t minReferenceSeqNumber, int
                 }
 
                 // Check merge cells are same in both the from and to sets
-                stList *mCellsFrom = stHash_getValues(mColumn->mergeCellsFrom);
-                stList *mCellsTo = stHash_getValues(mColumn->mergeCellsTo);
+                stList *mCellsFrom = partitionMap_getValues(mColumn->mergeCellsFrom);
+                stList *mCellsTo = partitionMap_getValues(mColumn->mergeCellsTo);
                 stSet *mCellsFromSet = stList_getSet(mCellsFrom);
                 stSet *mCellsToSet = stList_getSet(mCellsTo);
                 CuAssertTrue(testCase, stSet_equals(mCellsFromSet, mCellsToSet));
@@ -428,13 +432,12 @@ static void test_systemTest(CuTest *testCase, int64_t minReferenceSeqNumber, int
 
                 // Check merge cells
                 stRPMergeCell *mCell;
-                stHashIterator *it = stHash_getIterator(mColumn->mergeCellsFrom);
-                while ((mCell = stHash_getNext(it)) != NULL) {
+                uint64_t slot = 0;
+                while ((mCell = partitionMap_getNext(mColumn->mergeCellsFrom, &slot)) != NULL) {
                     // Check partitions
                     CuAssertTrue(testCase, (mCell->fromPartition & mColumn->maskFrom) == mCell->fromPartition);
                     CuAssertTrue(testCase, (mCell->toPartition & mColumn->maskTo) == mCell->toPartition);
                 }
-                stHash_destructIterator(it);
 
             }
 
@@ -469,17 +472,32 @@ static void test_systemTest(CuTest *testCase, int64_t minReferenceSeqNumber, int
                 // Check posterior probabilities
                 stRPCell *cell = column->head;
                 double totalProb = 0.0;
+                int64_t cellNumber = 0;
                 while (cell != NULL) {
+                    cellNumber++;
                     double posteriorProb = stRPCell_posteriorProb(cell, column);
                     CuAssertTrue(testCase, posteriorProb >= 0.0);
                     CuAssertTrue(testCase, posteriorProb <= 1.0);
                     totalProb += posteriorProb;
+
+                    // The merge cells linked by forward-backward must be those in the merge columns
+                    CuAssertPtrEquals(testCase, column->pColumn == NULL ? NULL :
+                                                stRPMergeColumn_getPreviousMergeCell(cell, column->pColumn),
+                                      cell->pMergeCell);
+                    CuAssertPtrEquals(testCase, column->nColumn == NULL ? NULL :
+                                                stRPMergeColumn_getNextMergeCell(cell, column->nColumn),
+                                      cell->nMergeCell);
                     cell = cell->nCell;
                 }
 
                 if (!maxNotSumTransitions) {
                     CuAssertDblEquals(testCase, 1.0, totalProb, 0.1);
                 }
+
+                // The forward pass beam bounds the cells in each column
+                if (forwardBeamMaxCells > 0) {
+                    CuAssertTrue(testCase, cellNumber <= forwardBeamMaxCells);
+                }
                 if (column->nColumn == NULL) {
                     break;
                 }
@@ -489,15 +507,14 @@ static void test_systemTest(CuTest *testCase, int64_t minReferenceSeqNumber, int
 
                 // Check posterior probabilities of merge cells
                 stRPMergeCell *mCell;
-                stHashIterator *it = stHash_getIterator(mColumn->mergeCellsFrom);
+                uint64_t slot = 0;
                 totalProb = 0.0;
-                while ((mCell = stHash_getNext(it)) != NULL) {
+                while ((mCell = partitionMap_getNext(mColumn->mergeCellsFrom, &slot)) != NULL) {
                     double posteriorProb = stRPMergeCell_posteriorProb(mCell, mColumn);
                     CuAssertTrue(testCase, posteriorProb >= 0.0);
                     CuAssertTrue(testCase, posteriorProb <= 1.0);
                     totalProb += posteriorProb;
                 }
-                stHash_destructIterator(it);
                 if (!maxNotSumTransitions) {
                     CuAssertDblEquals(testCase, 1.0, totalProb, 0.1);
                 }
@@ -549,6 +566,18 @@ static void test_systemTest(CuTest *testCase, int64_t minReferenceSeqNumber, int
                 }
             }
 
+            // Taking the max over transitions, the viterbi pass's traceback, following the merge cells' pointers
+            // to the cells their maxes came from, is the same path
+            if (maxNotSumTransitions) {
+                stRPHmm_viterbi(hmm);
+                stList *viterbiPath = stRPHmm_forwardTraceBack(hmm);
+                CuAssertIntEquals(testCase, stList_length(traceBackPath), stList_length(viterbiPath));
+                for (int64_t j = 0; j < stList_length(traceBackPath); j++) {
+                    CuAssertPtrEquals(testCase, stList_get(traceBackPath, j), stList_get(viterbiPath, j));
+                }
+                stList_destruct(viterbiPath);
+            }
+
             stSet *profileSeqsPartition1 = stRPHmm_partitionSequencesByStatePath(hmm, traceBackPath, 1);
             stSet *profileSeqsPartition2 = stRPHmm_partitionSequencesByStatePath(hmm, traceBackPath, 0);
 
@@ -778,7 +807,7 @@ void test_systemSingleReferenceFullLengthReads(CuTest *testCase) {
                     minReferenceLength, maxReferenceLength, minCoverage, maxCoverage,
                     minReadLength, maxReadLength, maxPartitionsInAColumn, readErrorRate,
                     maxNotSumTransitions, splitHmmsWherePhasingUncertain,
-                    minReadCoverageToSupportPhasingBetweenHeterozygousSites, printHmm);
+                    minReadCoverageToSupportPhasingBetweenHeterozygousSites, printHmm, 0, 0);
 }
 
 void test_systemSingleReferenceFixedLengthReads(CuTest *testCase) {
@@ -801,7 +830,7 @@ void test_systemSingleReferenceFixedLengthReads(CuTest *testCase) {
                     minReferenceLength, maxReferenceLength, minCoverage, maxCoverage,
                     minReadLength, maxReadLength, maxPartitionsInAColumn, readErrorRate,
                     maxNotSumTransitions, splitHmmsWherePhasingUncertain,
-                    minReadCoverageToSupportPhasingBetweenHeterozygousSites, printHmm);
+                    minReadCoverageToSupportPhasingBetweenHeterozygousSites, printHmm, 0, 0);
 }
 
 void test_systemSingleReference(CuTest *testCase) {
@@ -824,7 +853,7 @@ void test_systemSingleReference(CuTest *testCase) {
                     minReferenceLength, maxReferenceLength, minCoverage, maxCoverage,
                     minReadLength, maxReadLength, maxPartitionsInAColumn,
                     readErrorRate, maxNotSumTransitions, splitHmmsWherePhasingUncertain,
-                    minReadCoverageToSupportPhasingBetweenHeterozygousSites, printHmm);
+                    minReadCoverageToSupportPhasingBetweenHeterozygousSites, printHmm, 0, 0);
 }
 
 void test_systemMultipleReferences(CuTest *testCase) {
@@ -847,7 +876,134 @@ void test_systemMultipleReferences(CuTest *testCase) {
                     minReferenceLength, maxReferenceLength, minCoverage, maxCoverage,
                     minReadLength, maxReadLength, maxPartitionsInAColumn, readErrorRate,
                     maxNotSumTransitions, splitHmmsWherePhasingUncertain,
-                    minReadCoverageToSupportPhasingBetweenHeterozygousSites, printHmm);
+                    minReadCoverageToSupportPhasingBetweenHeterozygousSites, printHmm, 0, 0);
+}
+
+void test_systemSingleReferenceForwardBeam(CuTest *testCase) {
+    int64_t minReferenceSeqNumber = 1;
+    int64_t maxReferenceSeqNumber = 1;
+    int64_t minReferenceLength = 1000;
+    int64_t maxReferenceLength = 1000;
+    int64_t minCoverage = 30;
+    int64_t maxCoverage = 30;
+    int64_t minReadLength = 10;
+    int64_t maxReadLength = 300;
+    int64_t maxPartitionsInAColumn = 50;
+    double readErrorRate = 0.05;
+    bool maxNotSumTransitions = 0;
+    bool splitHmmsWherePhasingUncertain = 1;
+    int64_t minReadCoverageToSupportPhasingBetweenHeterozygousSites = 15;
+    bool printHmm = 0;
+    int64_t forwardBeamMaxCells = 20;
+
+    test_systemTest(testCase, minReferenceSeqNumber, maxReferenceSeqNumber,
+                    minReferenceLength, maxReferenceLength, minCoverage, maxCoverage,
+                    minReadLength, maxReadLength, maxPartitionsInAColumn, readErrorRate,
+                    maxNotSumTransitions, splitHmmsWherePhasingUncertain,
+                    minReadCoverageToSupportPhasingBetweenHeterozygousSites, printHmm, forwardBeamMaxCells, 0);
+}
+
+void test_systemSingleReferenceSweep(CuTest *testCase) {
+    int64_t minReferenceSeqNumber = 1;
+    int64_t maxReferenceSeqNumber = 1;
+    int64_t minReferenceLength = 1000;
+    int64_t maxReferenceLength = 1000;
+    int64_t minCoverage = 30;
+    int64_t maxCoverage = 30;
+    int64_t minReadLength = 10;
+    int64_t maxReadLength = 300;
+    int64_t maxPartitionsInAColumn = 50;
+    double readErrorRate = 0.05;
+    bool maxNotSumTransitions = 0;
+    bool splitHmmsWherePhasingUncertain = 1;
+    int64_t minReadCoverageToSupportPhasingBetweenHeterozygousSites = 15;
+    bool printHmm = 0;
+    int64_t forwardBeamMaxCells = 20;
+
+    test_systemTest(testCase, minReferenceSeqNumber, maxReferenceSeqNumber,
+                    minReferenceLength, maxReferenceLength, minCoverage, maxCoverage,
+                    minReadLength, maxReadLength, maxPartitionsInAColumn, readErrorRate,
+                    maxNotSumTransitions, splitHmmsWherePhasingUncertain,
+                    minReadCoverageToSupportPhasingBetweenHeterozygousSites, printHmm, forwardBeamMaxCells, 1);
+}
+
+void test_systemDeepColumn(CuTest *testCase) {
+    /*
+     * Phases full length reads from two haplotypes, more of them than NARROW_PARTITIONING_DEPTH, so every column of
+     * the hmm has two word partitions, checking the reads are partitioned by the haplotype they came from and the
+     * haplotypes are recovered.
+     */
+    for (int64_t test = 0; test < 10; test++) {
+        stRPHmmParameters *params = getHmmParams(50, 0.0, 0, 0, 0);
+        stReference *ref = getRandomReference("Reference_0", 50);
+        uint64_t *hap1 = getRandomHaplotype(ref);
+        uint64_t *hap2 = getRandomHaplotype(ref);
+        while (memcmp(hap1, hap2, ref->length * sizeof(uint64_t)) == 0) {
+            free(hap2);
+            hap2 = getRandomHaplotype(ref);
+        }
+
+        // Make the reads, alternating between the haplotypes
+        int64_t readNo = st_randomInt(NARROW_PARTITIONING_DEPTH + 1, MAX_READ_PARTITIONING_DEPTH + 1);
+        stList *profileSeqs = stList_construct3(0, (void (*)(void *)) stProfileSeq_destruct);
+        stSet *hap1Seqs = stSet_construct();
+        for (int64_t i = 0; i < readNo; i++) {
+            stProfileSeq *pSeq = getRandomProfileSeq(ref, i % 2 == 0 ? hap1 : hap2, ref->length, 0.0);
+            stList_append(profileSeqs, pSeq);
+            if (i % 2 == 0) {
+                stSet_insert(hap1Seqs, pSeq);
+            }
+        }
+        stList_shuffle(profileSeqs);
+
+        // All the reads are kept, in one hmm as deep as there are reads
+        stList *filteredProfileSeqs = stList_construct();
+        stList *discardedProfileSeqs = stList_construct();
+        filterReadsByCoverageDepth(profileSeqs, params, filteredProfileSeqs, discardedProfileSeqs);
+        CuAssertIntEquals(testCase, 0, stList_length(discardedProfileSeqs));
+        stList *hmms = getRPHmms(filteredProfileSeqs, params);
+        CuAssertIntEquals(testCase, 1, stList_length(hmms));
+        stRPHmm *hmm = stList_get(hmms, 0);
+        CuAssertIntEquals(testCase, readNo, hmm->maxDepth);
+        stRPHmm_forwardBackward(hmm);
+        stList *traceBackPath = stRPHmm_forwardTraceBack(hmm);
+
+        // The first partition is the reads of one of the haplotypes
+        stSet *profileSeqsPartition1 = stRPHmm_partitionSequencesByStatePath(hmm, traceBackPath, 1);
+        int64_t hap1SeqsInPartition1 = 0;
+        for (int64_t i = 0; i < readNo; i++) {
+            stProfileSeq *pSeq = stList_get(profileSeqs, i);
+            if ((stSet_search(profileSeqsPartition1, pSeq) != NULL) == (stSet_search(hap1Seqs, pSeq) != NULL)) {
+                hap1SeqsInPartition1++;
+            }
+        }
+        CuAssertTrue(testCase, hap1SeqsInPartition1 == readNo || hap1SeqsInPartition1 == 0);
+
+        // And the genome fragment has its haplotype
+        stGenomeFragment *gF = stGenomeFragment_construct(hmm, traceBackPath);
+        uint64_t *partition1Hap = hap1SeqsInPartition1 == readNo ? hap1 : hap2;
+        uint64_t *partition2Hap = hap1SeqsInPartition1 == readNo ? hap2 : hap1;
+        for (int64_t i = 0; i < ref->length; i++) {
+            CuAssertIntEquals(testCase, partition1Hap[i], gF->haplotypeString1[i]);
+            CuAssertIntEquals(testCase, partition2Hap[i], gF->haplotypeString2[i]);
+            CuAssertIntEquals(testCase, stSet_size(profileSeqsPartition1), gF->readsSupportingHaplotype1[i]);
+            CuAssertIntEquals(testCase, readNo - stSet_size(profileSeqsPartition1), gF->readsSupportingHaplotype2[i]);
+        }
+
+        // Cleanup
+        stGenomeFragment_destruct(gF);
+        stSet_destruct(profileSeqsPartition1);
+        stList_destruct(traceBackPath);
+        stList_destruct(hmms);
+        stList_destruct(filteredProfileSeqs);
+        stList_destruct(discardedProfileSeqs);
+        stSet_destruct(hap1Seqs);
+        stList_destruct(profileSeqs);
+        free(hap1);
+        free(hap2);
+        stReference_destruct(ref);
+        stRPHmmParameters_destruct(params);
+    }
 }
 
 void test_popCount64(CuTest *testCase) {
@@ -862,25 +1018,25 @@ void test_popCount64(CuTest *testCase) {
 }
 
 static uint64_t getLogProbOfAlleleSimple(stReference *ref,
-                                         uint8_t **seqs, uint64_t partition,
+                                         uint8_t **seqs, stRPPartition partition,
                                          int64_t depth, int64_t length,
                                          int64_t site, int64_t allele) {
     uint64_t expectation = 0;
     for (int64_t i = 0; i < depth; i++) {
-        if ((partition & ((uint64_t) 1 << i)) != 0) {
+        if ((partition & ((stRPPartition) 1 << i)) != 0) {
             expectation += seqs[i][ref->sites[site].alleleOffset + allele];
         }
     }
     return expectation;
 }
 
-static uint64_t getRandomPartition(int64_t depth) {
+static stRPPartition getRandomPartition(int64_t depth) {
     //return 0xFFFFFFFFFFFFFFFF;
-    return st_randomInt(0, 0xFFFFFFFFFFFFFFFF / 2);
+    return (stRPPartition) st_randomInt(0, 0xFFFFFFFFFFFFFFFF / 2) << 64 | st_randomInt(0, 0xFFFFFFFFFFFFFFFF / 2);
 }
 
 void test_bitCountVectors(CuTest *testCase) {
-    for (uint64_t depth = 0; depth < 64; depth++) {
+    for (uint64_t depth = 0; depth <= MAX_READ_PARTITIONING_DEPTH; depth++) {
         for (int64_t test = 0; test < 100; test++) {
             // Make reference
             stReference *ref = getRandomReference("ref", (uint64_t) st_randomInt(0, 10));
@@ -902,7 +1058,7 @@ void test_bitCountVectors(CuTest *testCase) {
             uint64_t *countBitVectors = calculateCountBitVectors(seqs, ref, 0, ref->length, depth);
 
             // Partition
-            uint64_t partition = getRandomPartition(depth);
+            stRPPartition partition = getRandomPartition(depth);
 
             // Test we get the expected output
             for (int64_t i = 0; i < ref->length; i++) {
@@ -927,6 +1083,207 @@ void test_bitCountVectors(CuTest *testCase) {
     }
 }
 
+void test_emissionTables(CuTest *testCase) {
+    stRPHmmParameters *params = stRPHmmParameters_construct();
+    for (int64_t test = 0; test < 100; test++) {
+        params->includeAncestorSubProb = test % 2;
+
+        // Make a column in which most reads have zero allele probs at most sites, so many sites get a table
+        stReference *ref = getRandomReference("ref", (uint64_t) st_randomInt(1, 10));
+        int64_t depth = st_randomInt(0, MAX_READ_PARTITIONING_DEPTH);
+        uint8_t **seqs = st_malloc(sizeof(uint8_t *) * depth);
+        for (int64_t i = 0; i < depth; i++) {
+            seqs[i] = st_calloc(ref->totalAlleles, sizeof(uint8_t));
+            for (int64_t j = 0; j < ref->length; j++) {
+                if (st_random() < 0.1) {
+                    for (int64_t k = 0; k < ref->sites[j].alleleNumber; k++) {
+                        seqs[i][ref->sites[j].alleleOffset + k] = (uint8_t) st_randomInt(0, 255);
+                    }
+                }
+            }
+        }
+        stRPColumn *column = stRPColumn_construct(0, ref->length, depth, st_calloc(depth + 1, sizeof(stProfileSeq *)),
+                                                  seqs);
+        stRPCell **pCell = &column->head;
+        for (int64_t i = 0; i < 300; i++) {
+            *pCell = stRPCell_construct(getRandomPartition(depth) & makeAcceptMask(depth));
+            pCell = &(*pCell)->nCell;
+        }
+        uint64_t *bitCountVectors = stRPColumn_getBitCountVectors(column, ref);
+
+        // Emission probs without the tables
+        double emissionProbs[300];
+        int64_t i = 0;
+        for (stRPCell *cell = column->head; cell != NULL; cell = cell->nCell) {
+            emissionProbs[i++] = emissionLogProbability(column, cell, bitCountVectors, ref, params);
+        }
+
+        // Must be the same with them, and for the inverse of each partition, whose table entries are copied
+        stRPColumnEmissions *emissions = stRPColumn_getEmissions(column, ref, params);
+        CuAssertPtrEquals(testCase, column->emissions, emissions);
+        i = 0;
+        for (stRPCell *cell = column->head; cell != NULL; cell = cell->nCell) {
+            CuAssertDblEquals(testCase, emissionProbs[i],
+                              emissionLogProbability(column, cell, bitCountVectors, ref, params), 0.0);
+            stRPCell *invertedCell = stRPCell_construct(invertPartition(cell->partition, depth));
+            CuAssertDblEquals(testCase, emissionProbs[i++],
+                              emissionLogProbability(column, invertedCell, bitCountVectors, ref, params), 0.0);
+            stRPCell_destruct(invertedCell);
+        }
+
+        // Cleanup
+        for (int64_t j = 0; j < depth; j++) {
+            free(seqs[j]);
+        }
+        stRPColumn_destruct(column);
+        stReference_destruct(ref);
+    }
+    stRPHmmParameters_destruct(params);
+}
+
+void test_vectorisedPopcountEmissions(CuTest *testCase) {
+    stRPHmmParameters *params = stRPHmmParameters_construct();
+    for (int64_t test = 0; test < 100; test++) {
+        params->includeAncestorSubProb = test % 2;
+
+        // Make a column of random reads
+        stReference *ref = getRandomReference("ref", (uint64_t) st_randomInt(1, 10));
+        int64_t depth = st_randomInt(0, MAX_READ_PARTITIONING_DEPTH + 1);
+        uint8_t **seqs = st_malloc(sizeof(uint8_t *) * depth);
+        for (int64_t i = 0; i < depth; i++) {
+            seqs[i] = st_malloc(ref->totalAlleles * sizeof(uint8_t));
+            for (int64_t j = 0; j < ref->totalAlleles; j++) {
+                seqs[i][j] = (uint8_t) st_randomInt(0, 255);
+            }
+        }
+        stRPColumn *column = stRPColumn_construct(0, ref->length, depth, st_calloc(depth + 1, sizeof(stProfileSeq *)),
+                                                  seqs);
+        uint64_t *bitCountVectors = stRPColumn_getBitCountVectors(column, ref);
+
+        // The emission probs must be the same with the scalar and the vectorised popcounts
+        for (int64_t i = 0; i < 100; i++) {
+            stRPCell *cell = stRPCell_construct(getRandomPartition(depth) & makeAcceptMask(depth));
+            setEmissionsUseVectorisedPopcount(0);
+            double emissionProb = emissionLogProbability(column, cell, bitCountVectors, ref, params);
+            setEmissionsUseVectorisedPopcount(1);
+            CuAssertDblEquals(testCase, emissionProb,
+                              emissionLogProbability(column, cell, bitCountVectors, ref, params), 0.0);
+            stRPCell_destruct(cell);
+        }
+
+        // Cleanup
+        for (int64_t j = 0; j < depth; j++) {
+            free(seqs[j]);
+        }
+        stRPColumn_destruct(column);
+        stReference_destruct(ref);
+    }
+    stRPHmmParameters_destruct(params);
+}
+
+void test_trivialGenomeFragment(CuTest *testCase) {
+    for (int64_t test = 0; test < 100; test++) {
+        stReference *ref = getRandomReference("ref", (uint64_t) st_randomInt(1, 10));
+        uint64_t *hap1 = getRandomHaplotype(ref);
+        uint64_t *hap2 = st_calloc(ref->length, sizeof(uint64_t));
+        memcpy(hap2, hap1, ref->length * sizeof(uint64_t));
+
+        // Make the second haplotype differ from the first at zero, one or two sites
+        int64_t changedSites = st_randomInt(0, 3), contestedSite = -1;
+        for (int64_t i = 0; i < changedSites; i++) {
+            int64_t j = st_randomInt(0, ref->length);
+            if (ref->sites[j].alleleNumber > 1 && hap2[j] == hap1[j]) {
+                hap2[j] = (hap1[j] + 1) % ref->sites[j].alleleNumber;
+                contestedSite = contestedSite == -1 ? j : -2;
+            }
+        }
+
+        // Full length reads without errors, from both haplotypes
+        stList *profileSeqs = stList_construct3(0, (void (*)(void *)) stProfileSeq_destruct);
+        int64_t readNo = st_randomInt(2, 20);
+        for (int64_t i = 0; i < readNo; i++) {
+            stList_append(profileSeqs, getRandomProfileSeq(ref, i % 2 == 0 ? hap1 : hap2, ref->length, 0.0));
+        }
+
+        stGenomeFragment *gF = stGenomeFragment_constructTrivial(ref, profileSeqs);
+        if (contestedSite == -2) {
+            // More than one contested site needs the hmm
+            CuAssertPtrEquals(testCase, NULL, gF);
+        } else {
+            CuAssertPtrNotNull(testCase, gF);
+            CuAssertIntEquals(testCase, 0, gF->refStart);
+            CuAssertIntEquals(testCase, ref->length, gF->length);
+            CuAssertIntEquals(testCase, readNo, stSet_size(gF->reads1) + stSet_size(gF->reads2));
+            for (uint64_t i = 0; i < ref->length; i++) {
+                if ((int64_t) i == contestedSite) {
+                    // Each haplotype's allele is picked, and its reads are with it
+                    CuAssertTrue(testCase, gF->haplotypeString1[i] != gF->haplotypeString2[i]);
+                    CuAssertTrue(testCase, gF->haplotypeString1[i] == hap1[i] || gF->haplotypeString1[i] == hap2[i]);
+                    CuAssertTrue(testCase, gF->haplotypeString2[i] == hap1[i] || gF->haplotypeString2[i] == hap2[i]);
+                    for (int64_t j = 0; j < readNo; j++) {
+                        stProfileSeq *pSeq = stList_get(profileSeqs, j);
+                        uint64_t allele = j % 2 == 0 ? hap1[i] : hap2[i];
+                        CuAssertTrue(testCase, stSet_search(allele == gF->haplotypeString1[i] ? gF->reads1 : gF->reads2,
+                                                            pSeq) != NULL);
+                    }
+                } else {
+                    CuAssertIntEquals(testCase, hap1[i], gF->haplotypeString1[i]);
+                    CuAssertIntEquals(testCase, hap1[i], gF->haplotypeString2[i]);
+                }
+            }
+            stGenomeFragment_destruct(gF);
+        }
+
+        // Cleanup
+        stList_destruct(profileSeqs);
+        free(hap1);
+        free(hap2);
+        stReference_destruct(ref);
+    }
+}
+
+void test_genomeFragmentReadLogProbs(CuTest *testCase) {
+    for (int64_t test = 0; test < 100; test++) {
+        stReference *ref = getRandomReference("ref", (uint64_t) st_randomInt(1, 20));
+        uint64_t *hap1 = getRandomHaplotype(ref);
+        uint64_t *hap2 = getRandomHaplotype(ref);
+
+        // A genome fragment over a random interval of the reference
+        int64_t start = st_randomInt(0, ref->length);
+        int64_t length = st_randomInt(1, ref->length - start + 1);
+        stGenomeFragment *gF = stGenomeFragment_constructEmpty(ref, start, length, stSet_construct(),
+                                                               stSet_construct());
+        memcpy(gF->haplotypeString1, hap1 + start, length * sizeof(uint64_t));
+        memcpy(gF->haplotypeString2, hap2 + start, length * sizeof(uint64_t));
+
+        // Reads with errors, some overlapping the fragment only in part or not at all
+        stList *profileSeqs = stList_construct3(0, (void (*)(void *)) stProfileSeq_destruct);
+        int64_t readNo = st_randomInt(0, 20);
+        for (int64_t i = 0; i < readNo; i++) {
+            stList_append(profileSeqs, getRandomProfileSeq(ref, hap1, st_randomInt(1, ref->length + 1), 0.2));
+        }
+
+        // The reads scored together must have the same log probs as scored one at a time
+        double *logProbs = st_malloc(sizeof(double) * (2 * readNo + 1));
+        stGenomeFragment_getReadLogProbs(gF, profileSeqs, logProbs, logProbs + readNo);
+        for (int64_t i = 0; i < readNo; i++) {
+            stProfileSeq *pSeq = stList_get(profileSeqs, i);
+            CuAssertDblEquals(testCase, getLogProbOfReadGivenHaplotype(gF->haplotypeString1, start, length, pSeq, ref),
+                              logProbs[i], 0.0);
+            CuAssertDblEquals(testCase, getLogProbOfReadGivenHaplotype(gF->haplotypeString2, start, length, pSeq, ref),
+                              logProbs[readNo + i], 0.0);
+        }
+
+        // Cleanup
+        free(logProbs);
+        stList_destruct(profileSeqs);
+        stGenomeFragment_destruct(gF);
+        free(hap1);
+        free(hap2);
+        stReference_destruct(ref);
+    }
+}
+
 void buildComponent(stRPHmm *hmm1, stSortedSet *component, stSet *seen) {
     stSet_insert(seen, hmm1);
     stSortedSetIterator *it = stSortedSet_getIterator(component);
@@ -956,7 +1313,7 @@ void test_getOverlappingComponents(CuTest *testCase) {
         fprintf(stderr, "Starting test iteration: #%" PRIi64 "\n", test);
 
         stRPHmmParameters *params = getHmmParams(maxPartitionsInAColumn,
-                                                 readErrorRate, maxNotSumTransitions, 0);
+                                                 readErrorRate, maxNotSumTransitions, 0, 0);
 
         stList *referenceSeqs = stList_construct3(0, free);
         stList *hapSeqs1 = stList_construct3(0, free);
@@ -1087,6 +1444,28 @@ void test_getOverlappingComponents(CuTest *testCase) {
                 }
             }
 
+            // Check that the components given as ranges of the tiling paths are the same
+            int64_t componentNumber;
+            TilingPathComponent *components2 = getOverlappingComponents2(tilingPath1, tilingPath2, &componentNumber);
+            CuAssertIntEquals(testCase, stSet_size(components), componentNumber);
+            for (int64_t i = 0; i < componentNumber; i++) {
+                TilingPathComponent *component2 = &components2[i];
+                CuAssertTrue(testCase, component2->end1 - component2->start1 + component2->end2 - component2->start2 > 0);
+                stRPHmm *firstHmm = component2->end1 > component2->start1 ?
+                                    stList_get(tilingPath1, component2->start1) :
+                                    stList_get(tilingPath2, component2->start2);
+                component = stHash_search(hmmToComponent, firstHmm);
+                CuAssertIntEquals(testCase, stSortedSet_size(component),
+                                  component2->end1 - component2->start1 + component2->end2 - component2->start2);
+                for (int64_t j = component2->start1; j < component2->end1; j++) {
+                    CuAssertTrue(testCase, stHash_search(hmmToComponent, stList_get(tilingPath1, j)) == component);
+                }
+                for (int64_t j = component2->start2; j < component2->end2; j++) {
+                    CuAssertTrue(testCase, stHash_search(hmmToComponent, stList_get(tilingPath2, j)) == component);
+                }
+            }
+            free(components2);
+
             // Cleanup
             stList_destruct(tilingPath1);
             stList_destruct(tilingPath2);
@@ -1114,14 +1493,14 @@ void test_getOverlappingComponents(CuTest *testCase) {
 }
 
 void test_flipAReadsPartition(CuTest *testCase) {
-    for (uint64_t i = 0; i < 64; i++) {
-        CuAssertTrue(testCase, flipAReadsPartition(0, i) == ((uint64_t) 1 << i));
-        CuAssertTrue(testCase, popcount64(flipAReadsPartition(0, i)) == 1);
+    for (uint64_t i = 0; i < MAX_READ_PARTITIONING_DEPTH; i++) {
+        CuAssertTrue(testCase, flipAReadsPartition(0, i) == ((stRPPartition) 1 << i));
+        CuAssertTrue(testCase, popcount128(flipAReadsPartition(0, i)) == 1);
     }
-    for (uint64_t i = 0; i < 64; i++) {
-        CuAssertTrue(testCase,
-                     flipAReadsPartition(0xFFFFFFFFFFFFFFFF, i) == (0xFFFFFFFFFFFFFFFF ^ ((uint64_t) 1 << i)));
-        CuAssertTrue(testCase, popcount64(flipAReadsPartition(0xFFFFFFFFFFFFFFFF, i)) == 63);
+    for (uint64_t i = 0; i < MAX_READ_PARTITIONING_DEPTH; i++) {
+        stRPPartition allReads = makeAcceptMask(MAX_READ_PARTITIONING_DEPTH);
+        CuAssertTrue(testCase, flipAReadsPartition(allReads, i) == (allReads ^ ((stRPPartition) 1 << i)));
+        CuAssertTrue(testCase, popcount128(flipAReadsPartition(allReads, i)) == MAX_READ_PARTITIONING_DEPTH - 1);
     }
     CuAssertTrue(testCase, flipAReadsPartition(0x1111111111111111, 16) == 0x1111111111101111);
     CuAssertTrue(testCase, flipAReadsPartition(0x1111111111101111, 16) == 0x1111111111111111);
@@ -1214,11 +1593,18 @@ CuSuite *stRPHmmTestSuite(void) {
     SUITE_ADD_TEST(suite, test_systemSingleReferenceFixedLengthReads);
     SUITE_ADD_TEST(suite, test_systemSingleReference);
     SUITE_ADD_TEST(suite, test_systemMultipleReferences);
+    SUITE_ADD_TEST(suite, test_systemSingleReferenceForwardBeam);
+    SUITE_ADD_TEST(suite, test_systemSingleReferenceSweep);
+    SUITE_ADD_TEST(suite, test_systemDeepColumn);
 
     // Constituent function tests
     SUITE_ADD_TEST(suite, test_flipAReadsPartition);
     SUITE_ADD_TEST(suite, test_popCount64);
     SUITE_ADD_TEST(suite, test_bitCountVectors);
+    SUITE_ADD_TEST(suite, test_emissionTables);
+    SUITE_ADD_TEST(suite, test_vectorisedPopcountEmissions);
+    SUITE_ADD_TEST(suite, test_trivialGenomeFragment);
+    SUITE_ADD_TEST(suite, test_genomeFragmentReadLogProbs);
     SUITE_ADD_TEST(suite, test_getOverlappingComponents);
 
     return suite;
@@ -4,6 +4,10 @@
 
 #include "CuTest.h"
 #include "margin.h"
+#include <htslib/faidx.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 static char *paramsFile = "../params/ont/r9.4/allParams.np.human.r94-g344.json";
 static char *outputSequenceFile = "./testStitchingSequenceFile.fa";
@@ -50,9 +54,56 @@ char *getSequence(CuTest *testCase, char *outputSequenceFile, char *sequenceName
     return sequence;
 }
 
-void test_stitching(CuTest *testCase) {
+char *getIndexedSequence(CuTest *testCase, char *outputSequenceFile, char *sequenceName) {
+    /*
+     * Gets the sequence from a BGZF compressed fasta through the .fai and .gzi indexes written with it
+     */
+    faidx_t *fai = fai_load(outputSequenceFile);
+    CuAssertTrue(testCase, fai != NULL);
+    CuAssertIntEquals(testCase, 1, faidx_nseq(fai));
+    CuAssertStrEquals(testCase, sequenceName, faidx_iseq(fai, 0));
+    int length = faidx_seq_len(fai, sequenceName), fetchedLength;
+    char *sequence = faidx_fetch_seq(fai, sequenceName, 0, length - 1, &fetchedLength);
+    CuAssertIntEquals(testCase, length, fetchedLength);
+    fai_destroy(fai);
+
+    return sequence;
+}
+
+static char *chunkJournalFile = "./testStitchingChunkJournal";
+
+static void processChunks(OutputChunkers *outputChunkers, int64_t noOfOutputChunkers, stList *chunks,
+                          stList *randomizedChunks, int64_t firstChunk, int64_t lastChunk, char *sequenceName,
+                          Params *params) {
     /*
-     * Runs the stitcher with a set of chunks and checks we get back the original sequence
+     * Outputs the given range of the randomized chunks
+     */
+    for (int64_t i = firstChunk; i < lastChunk; i++) {
+        char *chunk = stList_get(randomizedChunks, i);
+        int64_t chunkOrdinal = stList_find(chunks, chunk);
+        // Build the inputs for the chunker
+        RleString *rle_chunk = rleString_construct_no_rle(chunk);
+        Poa *poa = poa_getReferenceGraph(rle_chunk, params->polishParams->alphabet,
+                                         (uint64_t ) params->polishParams->repeatSubMatrix->maximumRepeatLength);
+        stList *reads = stList_construct(); // No reads, currently
+        // Output the chunk
+        outputChunkers_processChunkSequence(outputChunkers, st_randomInt(0, noOfOutputChunkers), chunkOrdinal,
+                                            sequenceName, poa, reads);
+        // Cleanup
+        poa_destruct(poa);
+        stList_destruct(reads);
+        rleString_destruct(rle_chunk);
+    }
+}
+
+static void stitchingTest(CuTest *testCase, bool online, bool journal, int64_t shards, bool compressed,
+                          bool binaryRecords, bool compressedRecords, bool inMemory,
+                          uint64_t maxInMemoryOutputBytes) {
+    /*
+     * Runs the stitcher with a set of chunks and checks we get back the original sequence. The temporary output is
+     * written as binary chunk records if binaryRecords is set (as it is for a journal), compressed if compressedRecords
+     * is also set. It is held in memory if inMemory is set, spilling to disk once it exceeds maxInMemoryOutputBytes
+     * (if non-zero).
      */
     setPairwiseAlignerKmerSize(2);
     setMinOverlapAnchorPairs(1);
@@ -62,6 +113,14 @@ void test_stitching(CuTest *testCase) {
         Params *params = params_readParams(paramsFile);
         params->polishParams->useRunLengthEncoding = FALSE; // Turn off RLE for this test to work
         params->polishParams->chunkBoundary = 3;
+        params->polishParams->useBinaryChunkRecords = binaryRecords;
+        params->polishParams->compressChunkRecords = compressedRecords;
+        params->polishParams->compressOutputFasta = compressed;
+        // The journal holds the binary chunk records
+        if (journal || shards > 0) {
+            params->polishParams->useBinaryChunkRecords = TRUE;
+        }
+        params->polishParams->maxInMemoryOutputBytes = maxInMemoryOutputBytes;
 
         // Sequences
         char *sequence = "AAAAAAAAAATTTTTTTTTTCCCCCCCCCCGGGGGGGGGG";
@@ -85,39 +144,90 @@ void test_stitching(CuTest *testCase) {
         stList_shuffle(randomizedChunks); // This randomizes the order of the chunks
         int64_t noOfOutputChunkers = st_randomInt(1, 5);
 
+        // With shards, process each shard's chunks in a separate run, then merge the shards' journals
+        int64_t journaledChunks = 0;
+        if (shards > 0) {
+            stFile_rmrf(chunkJournalFile);
+            stList *shardJournalFiles = stList_construct3(0, free);
+            for (int64_t shard = 0; shard < shards; shard++) {
+                stList_append(shardJournalFiles, stString_print("%s.shard%" PRIi64, chunkJournalFile, shard));
+                stFile_rmrf(stList_get(shardJournalFiles, shard));
+                OutputChunkers *outputChunkers = outputChunkers_construct(noOfOutputChunkers, params,
+                                                                          outputSequenceFile, outputPoaFile, NULL,
+                                                                          outputRepeatCountFile,
+                                                                          NULL, NULL, inMemory);
+                outputChunkers_openChunkJournal(outputChunkers, stList_get(shardJournalFiles, shard), 1,
+                                                stList_length(chunks));
+                processChunks(outputChunkers, noOfOutputChunkers, chunks, randomizedChunks,
+                              stList_length(chunks) * shard / shards, stList_length(chunks) * (shard + 1) / shards,
+                              sequenceName, params);
+                outputChunkers_discardOutput(outputChunkers);
+                outputChunkers_destruct(outputChunkers);
+            }
+            journaledChunks = stList_length(chunks);
+            CuAssertIntEquals(testCase, journaledChunks, chunkJournal_merge(chunkJournalFile, shardJournalFiles, 1,
+                                                                            stList_length(chunks)));
+            for (int64_t shard = 0; shard < shards; shard++) {
+                stFile_rmrf(stList_get(shardJournalFiles, shard));
+            }
+            stList_destruct(shardJournalFiles);
+        } else if (journal) {
+            // With a journal, process some of the chunks then abandon the run, as if it were interrupted
+            stFile_rmrf(chunkJournalFile);
+            journaledChunks = st_randomInt(0, stList_length(chunks) + 1);
+            OutputChunkers *outputChunkers = outputChunkers_construct(noOfOutputChunkers, params,
+                                                                      outputSequenceFile, outputPoaFile, NULL,
+                                                                      outputRepeatCountFile,
+                                                                      NULL, NULL, inMemory);
+            CuAssertIntEquals(testCase, 0, outputChunkers_openChunkJournal(outputChunkers, chunkJournalFile, 1,
+                                                                           stList_length(chunks)));
+            processChunks(outputChunkers, noOfOutputChunkers, chunks, randomizedChunks, 0, journaledChunks,
+                          sequenceName, params);
+            outputChunkers_destruct(outputChunkers);
+        }
+
         // Get chunker
         OutputChunkers *outputChunkers = outputChunkers_construct(noOfOutputChunkers, params,
                                                                   outputSequenceFile, outputPoaFile, NULL,
                                                                   outputRepeatCountFile,
-                                                                  NULL, NULL, 0);
+                                                                  NULL, NULL, inMemory);
+        if (journal || shards > 0) {
+            // The resumed run finds the chunks of the abandoned one, or of the shards
+            CuAssertIntEquals(testCase, journaledChunks,
+                              outputChunkers_openChunkJournal(outputChunkers, chunkJournalFile, 1,
+                                                              stList_length(chunks)));
+            for (int64_t i = 0; i < stList_length(randomizedChunks); i++) {
+                CuAssertIntEquals(testCase, i < journaledChunks, outputChunkers_isChunkJournaled(outputChunkers,
+                        stList_find(chunks, stList_get(randomizedChunks, i))));
+            }
+        }
+        if (online) {
+            outputChunkers_startOnlineStitching(outputChunkers, 0, stList_length(chunks), NULL, NULL, NULL);
+        }
+        if (journal || shards > 0) {
+            outputChunkers_replayChunkJournal(outputChunkers);
+        }
 
         // Now process the chunks
-        for (int64_t i = 0; i < stList_length(randomizedChunks); i++) {
-            char *chunk = stList_get(randomizedChunks, i);
-            int64_t chunkOrdinal = stList_find(chunks, chunk);
-            // Build the inputs for the chunker
-            RleString *rle_chunk = rleString_construct_no_rle(chunk);
-            Poa *poa = poa_getReferenceGraph(rle_chunk, params->polishParams->alphabet,
-                                             (uint64_t ) params->polishParams->repeatSubMatrix->maximumRepeatLength);
-            stList *reads = stList_construct(); // No reads, currently
-            // Output the chunk
-            outputChunkers_processChunkSequence(outputChunkers, st_randomInt(0, noOfOutputChunkers), chunkOrdinal,
-                                                sequenceName, poa, reads);
-            // Cleanup
-            poa_destruct(poa);
-            stList_destruct(reads);
-            rleString_destruct(rle_chunk);
-        }
+        processChunks(outputChunkers, noOfOutputChunkers, chunks, randomizedChunks, journaledChunks,
+                      stList_length(randomizedChunks), sequenceName, params);
 
         // Do stitching
-        outputChunkers_stitch(outputChunkers, 0, stList_length(randomizedChunks));
+        if (online) {
+            outputChunkers_finishOnlineStitching(outputChunkers);
+        } else {
+            outputChunkers_stitch(outputChunkers, 0, stList_length(randomizedChunks));
+        }
 
         // Destroy chunkers
         outputChunkers_destruct(outputChunkers);
 
         // Read output sequence and check it agrees with what we expect
-        char *seqFromFile = getSequence(testCase, outputSequenceFile, sequenceName);
+        char *compressedSequenceFile = stString_print("%s.gz", outputSequenceFile);
+        char *seqFromFile = compressed ? getIndexedSequence(testCase, compressedSequenceFile, sequenceName) :
+                            getSequence(testCase, outputSequenceFile, sequenceName);
         CuAssertStrEquals(testCase, sequence, seqFromFile);
+        free(seqFromFile);
 
         // Check poa
         checkCSV(testCase, outputPoaFile, sequence);
@@ -127,14 +237,336 @@ void test_stitching(CuTest *testCase) {
 
         // Cleanup
         stList_destruct(randomizedChunks);
-        stFile_rmrf(outputSequenceFile);
+        if (compressed) {
+            char *indexFile = stString_print("%s.fai", compressedSequenceFile);
+            stFile_rmrf(indexFile);
+            free(indexFile);
+            indexFile = stString_print("%s.gzi", compressedSequenceFile);
+            stFile_rmrf(indexFile);
+            free(indexFile);
+            stFile_rmrf(compressedSequenceFile);
+        } else {
+            stFile_rmrf(outputSequenceFile);
+        }
+        free(compressedSequenceFile);
         stFile_rmrf(outputPoaFile);
         stFile_rmrf(outputRepeatCountFile);
+        if (journal || shards > 0) {
+            stFile_rmrf(chunkJournalFile);
+        }
         params_destruct(params);
         stList_destruct(chunks);
     }
 }
 
+void test_stitching(CuTest *testCase) {
+    stitchingTest(testCase, 0, 0, 0, 0, 0, 0, 0, 0);
+}
+
+void test_stitchingBinaryChunkRecords(CuTest *testCase) {
+    /*
+     * As test_stitching, but with the temporary output written as binary chunk records, uncompressed then compressed
+     */
+    stitchingTest(testCase, 0, 0, 0, 0, 1, 0, 0, 0);
+    stitchingTest(testCase, 0, 0, 0, 0, 1, 1, 0, 0);
+}
+
+void test_stitchingCompressedTextChunkRecords(CuTest *testCase) {
+    /*
+     * As test_stitching, but with compressChunkRecords set for text temporary output, which only applies to binary
+     * chunk records and so must leave the text output as it is
+     */
+    stitchingTest(testCase, 0, 0, 0, 0, 0, 1, 0, 0);
+}
+
+void test_stitchingInMemory(CuTest *testCase) {
+    /*
+     * As test_stitching, but with the temporary output held in memory: without a budget, with a budget that is spilled
+     * to disk part way through, and with a budget so small it is spilled by the first chunk
+     */
+    stitchingTest(testCase, 0, 0, 0, 0, 0, 0, 1, 0);
+    stitchingTest(testCase, 0, 0, 0, 0, 0, 0, 1, 100);
+    stitchingTest(testCase, 0, 0, 0, 0, 0, 0, 1, 1);
+    stitchingTest(testCase, 0, 0, 0, 0, 1, 1, 1, 0);
+    stitchingTest(testCase, 0, 0, 0, 0, 1, 1, 1, 100);
+    stitchingTest(testCase, 0, 0, 0, 0, 1, 1, 1, 1);
+}
+
+void test_stitchingOnline(CuTest *testCase) {
+    /*
+     * As test_stitching, but stitching the chunks as they are processed
+     */
+    stitchingTest(testCase, 1, 0, 0, 0, 0, 0, 0, 0);
+}
+
+void test_stitchingResumedFromChunkJournal(CuTest *testCase) {
+    /*
+     * As test_stitching, but resuming from the chunks journaled by an abandoned run, stitching offline or online
+     */
+    stitchingTest(testCase, 0, 1, 0, 0, 0, 0, 0, 0);
+    stitchingTest(testCase, 1, 1, 0, 0, 0, 0, 0, 0);
+}
+
+void test_stitchingShardedChunkJournals(CuTest *testCase) {
+    /*
+     * As test_stitching, but processing the chunks in shards whose journals are merged and then stitched
+     */
+    stitchingTest(testCase, 0, 0, st_randomInt(1, 5), 0, 0, 0, 0, 0);
+    stitchingTest(testCase, 1, 0, st_randomInt(1, 5), 0, 0, 0, 0, 0);
+}
+
+void test_stitchingCompressedFasta(CuTest *testCase) {
+    /*
+     * As test_stitching, but writing the stitched sequence BGZF compressed and indexed, stitching offline or online
+     */
+    stitchingTest(testCase, 0, 0, 0, 1, 0, 0, 0, 0);
+    stitchingTest(testCase, 1, 0, 0, 1, 0, 0, 0, 0);
+}
+
+
+static char *chunkCacheDirectory = "./testStitchingChunkCache";
+
+static stList *getChunkCacheFiles(void) {
+    /*
+     * Gets the paths of the entries of the chunk cache
+     */
+    stList *cacheFiles = stList_construct3(0, free);
+    DIR *dir = opendir(chunkCacheDirectory);
+    struct dirent *entry;
+    while (dir != NULL && (entry = readdir(dir)) != NULL) {
+        size_t length = strlen(entry->d_name);
+        if (length > 6 && strcmp(entry->d_name + length - 6, ".chunk") == 0) {
+            stList_append(cacheFiles, stString_print("%s/%s", chunkCacheDirectory, entry->d_name));
+        }
+    }
+    if (dir != NULL) {
+        closedir(dir);
+    }
+    return cacheFiles;
+}
+
+static char *cachedStitchingRun(CuTest *testCase, Params *params, stList *chunks, char **inputKeys,
+                                char *sequenceName, int64_t expectedCachedChunks) {
+    /*
+     * Runs the stitcher with a fresh journal and the chunk cache, only processing the chunks not found in the cache,
+     * and returns the stitched sequence
+     */
+    stFile_rmrf(chunkJournalFile);
+    stList *randomizedChunks = stList_copy(chunks, NULL);
+    stList_shuffle(randomizedChunks);
+    int64_t noOfOutputChunkers = st_randomInt(1, 5);
+    OutputChunkers *outputChunkers = outputChunkers_construct(noOfOutputChunkers, params, outputSequenceFile,
+                                                              outputPoaFile, NULL, outputRepeatCountFile,
+                                                              NULL, NULL, 0);
+    CuAssertIntEquals(testCase, 0, outputChunkers_openChunkJournal(outputChunkers, chunkJournalFile, 1,
+                                                                   stList_length(chunks)));
+    outputChunkers_setChunkCache(outputChunkers, chunkCacheDirectory);
+    CuAssertIntEquals(testCase, expectedCachedChunks,
+                      outputChunkers_journalChunkInputKeys(outputChunkers, inputKeys, 0, stList_length(chunks),
+                                                           NULL));
+    outputChunkers_replayChunkJournal(outputChunkers);
+
+    // Put the chunks copied from the cache last, so the rest are processed
+    for (int64_t i = stList_length(randomizedChunks) - 1; i >= 0; i--) {
+        char *chunk = stList_get(randomizedChunks, i);
+        if (outputChunkers_isChunkJournaled(outputChunkers, stList_find(chunks, chunk))) {
+            stList_remove(randomizedChunks, i);
+            stList_append(randomizedChunks, chunk);
+        }
+    }
+    processChunks(outputChunkers, noOfOutputChunkers, chunks, randomizedChunks, 0,
+                  stList_length(chunks) - expectedCachedChunks, sequenceName, params);
+    outputChunkers_stitch(outputChunkers, 0, stList_length(chunks));
+    outputChunkers_destruct(outputChunkers);
+
+    char *sequence = getSequence(testCase, outputSequenceFile, sequenceName);
+    stFile_rmrf(outputSequenceFile);
+    stFile_rmrf(outputPoaFile);
+    stFile_rmrf(outputRepeatCountFile);
+    stFile_rmrf(chunkJournalFile);
+    stList_destruct(randomizedChunks);
+    return sequence;
+}
+
+void test_stitchingFromChunkCache(CuTest *testCase) {
+    /*
+     * Populates the chunk cache with a run, then checks a second run replays every chunk from it and stitches the
+     * same sequence, and that a truncated entry, one whose stored input key differs from the chunk's (as for a
+     * hash collision), or one of the other byte order, is a miss that is recomputed
+     */
+    setPairwiseAlignerKmerSize(2);
+    setMinOverlapAnchorPairs(1);
+    Params *params = params_readParams(paramsFile);
+    params->polishParams->useRunLengthEncoding = FALSE;
+    params->polishParams->chunkBoundary = 3;
+    params->polishParams->useBinaryChunkRecords = TRUE;
+
+    char *sequence = "AAAAAAAAAATTTTTTTTTTCCCCCCCCCCGGGGGGGGGG";
+    char *sequenceName = "seq1";
+    char *chunkStrings[] = { "AAAA", "AAAAAAAAAAT", "AAATTT", "AAATTTTTTTTTTCCCCC", "TTTCCCCCCCCCCG",
+                             "CGGGGGGGGGG", "" };
+    stList *chunks = stList_construct();
+    for (int64_t i = 0; i < 7; i++) {
+        stList_append(chunks, chunkStrings[i]);
+    }
+    char **inputKeys = st_calloc(stList_length(chunks), sizeof(char *));
+    for (int64_t i = 0; i < stList_length(chunks); i++) {
+        inputKeys[i] = stString_print("testKey\t%s\t%" PRIi64, sequenceName, i);
+    }
+    stFile_rmrf(chunkCacheDirectory);
+
+    // The first run finds nothing in the cache, and adds every chunk to it
+    char *firstSequence = cachedStitchingRun(testCase, params, chunks, inputKeys, sequenceName, 0);
+    CuAssertStrEquals(testCase, sequence, firstSequence);
+    stList *cacheFiles = getChunkCacheFiles();
+    CuAssertIntEquals(testCase, stList_length(chunks), stList_length(cacheFiles));
+
+    // The second run copies every chunk from the cache
+    char *cachedSequence = cachedStitchingRun(testCase, params, chunks, inputKeys, sequenceName,
+                                              stList_length(chunks));
+    CuAssertStrEquals(testCase, firstSequence, cachedSequence);
+    free(cachedSequence);
+
+    // A truncated entry is a miss
+    char *cacheFile = stList_get(cacheFiles, st_randomInt(0, stList_length(cacheFiles)));
+    struct stat fileStat;
+    CuAssertIntEquals(testCase, 0, stat(cacheFile, &fileStat));
+    CuAssertIntEquals(testCase, 0, truncate(cacheFile, fileStat.st_size / 2));
+    cachedSequence = cachedStitchingRun(testCase, params, chunks, inputKeys, sequenceName,
+                                        stList_length(chunks) - 1);
+    CuAssertStrEquals(testCase, firstSequence, cachedSequence);
+    free(cachedSequence);
+
+    // The recomputed chunk was cached again, replacing the truncated entry
+    cachedSequence = cachedStitchingRun(testCase, params, chunks, inputKeys, sequenceName, stList_length(chunks));
+    CuAssertStrEquals(testCase, firstSequence, cachedSequence);
+    free(cachedSequence);
+
+    // An entry whose stored input key is not the chunk's is a miss, by changing the first byte of the key, which
+    // follows the magic number and key length
+    cacheFile = stList_get(cacheFiles, st_randomInt(0, stList_length(cacheFiles)));
+    FILE *fh = fopen(cacheFile, "r+b");
+    CuAssertTrue(testCase, fh != NULL);
+    CuAssertIntEquals(testCase, 0, fseek(fh, sizeof(uint32_t) + sizeof(uint64_t), SEEK_SET));
+    CuAssertIntEquals(testCase, 't', fgetc(fh));
+    CuAssertIntEquals(testCase, 0, fseek(fh, sizeof(uint32_t) + sizeof(uint64_t), SEEK_SET));
+    CuAssertIntEquals(testCase, 'T', fputc('T', fh));
+    fclose(fh);
+    cachedSequence = cachedStitchingRun(testCase, params, chunks, inputKeys, sequenceName,
+                                        stList_length(chunks) - 1);
+    CuAssertStrEquals(testCase, firstSequence, cachedSequence);
+    free(cachedSequence);
+
+    // An entry written on a host of the other byte order, so with a byte swapped magic number, is a miss
+    cacheFile = stList_get(cacheFiles, st_randomInt(0, stList_length(cacheFiles)));
+    fh = fopen(cacheFile, "r+b");
+    CuAssertTrue(testCase, fh != NULL);
+    uint32_t magic;
+    CuAssertIntEquals(testCase, 1, fread(&magic, sizeof(uint32_t), 1, fh));
+    magic = __builtin_bswap32(magic);
+    CuAssertIntEquals(testCase, 0, fseek(fh, 0, SEEK_SET));
+    CuAssertIntEquals(testCase, 1, fwrite(&magic, sizeof(uint32_t), 1, fh));
+    fclose(fh);
+    cachedSequence = cachedStitchingRun(testCase, params, chunks, inputKeys, sequenceName,
+                                        stList_length(chunks) - 1);
+    CuAssertStrEquals(testCase, firstSequence, cachedSequence);
+    free(cachedSequence);
+
+    // Cleanup
+    stFile_rmrf(chunkCacheDirectory);
+    stList_destruct(cacheFiles);
+    for (int64_t i = 0; i < stList_length(chunks); i++) {
+        free(inputKeys[i]);
+    }
+    free(inputKeys);
+    free(firstSequence);
+    stList_destruct(chunks);
+    params_destruct(params);
+}
+
+
+void test_stitchingSupersedesChunksWithChangedInputs(CuTest *testCase) {
+    /*
+     * Journals every chunk with its input key, then checks a resumed run given a different input key for one chunk
+     * (as when the reads or reference under it have changed) drops that chunk from the journal and recomputes it,
+     * replaying the rest, and that a further run then finds every chunk journaled again
+     */
+    setPairwiseAlignerKmerSize(2);
+    setMinOverlapAnchorPairs(1);
+    Params *params = params_readParams(paramsFile);
+    params->polishParams->useRunLengthEncoding = FALSE;
+    params->polishParams->chunkBoundary = 3;
+    params->polishParams->useBinaryChunkRecords = TRUE;
+
+    char *sequence = "AAAAAAAAAATTTTTTTTTTCCCCCCCCCCGGGGGGGGGG";
+    char *sequenceName = "seq1";
+    char *chunkStrings[] = { "AAAA", "AAAAAAAAAAT", "AAATTT", "AAATTTTTTTTTTCCCCC", "TTTCCCCCCCCCCG",
+                             "CGGGGGGGGGG", "" };
+    stList *chunks = stList_construct();
+    for (int64_t i = 0; i < 7; i++) {
+        stList_append(chunks, chunkStrings[i]);
+    }
+    char **inputKeys = st_calloc(stList_length(chunks), sizeof(char *));
+    for (int64_t i = 0; i < stList_length(chunks); i++) {
+        inputKeys[i] = stString_print("testKey\t%s\t%" PRIi64, sequenceName, i);
+    }
+
+    // The first run journals the input keys, then every chunk
+    stFile_rmrf(chunkJournalFile);
+    OutputChunkers *outputChunkers = outputChunkers_construct(1, params, outputSequenceFile, outputPoaFile, NULL,
+                                                              outputRepeatCountFile, NULL, NULL, 0);
+    CuAssertIntEquals(testCase, 0, outputChunkers_openChunkJournal(outputChunkers, chunkJournalFile, 1,
+                                                                   stList_length(chunks)));
+    CuAssertIntEquals(testCase, 0, outputChunkers_journalChunkInputKeys(outputChunkers, inputKeys, 0,
+                                                                        stList_length(chunks), NULL));
+    processChunks(outputChunkers, 1, chunks, chunks, 0, stList_length(chunks), sequenceName, params);
+    outputChunkers_discardOutput(outputChunkers);
+    outputChunkers_destruct(outputChunkers);
+
+    // The resumed run, with the input key of one chunk changed, drops it and recomputes it
+    int64_t changedChunk = st_randomInt(0, stList_length(chunks));
+    free(inputKeys[changedChunk]);
+    inputKeys[changedChunk] = stString_print("changedTestKey\t%s\t%" PRIi64, sequenceName, changedChunk);
+    outputChunkers = outputChunkers_construct(1, params, outputSequenceFile, outputPoaFile, NULL,
+                                              outputRepeatCountFile, NULL, NULL, 0);
+    CuAssertIntEquals(testCase, stList_length(chunks),
+                      outputChunkers_openChunkJournal(outputChunkers, chunkJournalFile, 1, stList_length(chunks)));
+    CuAssertIntEquals(testCase, -1, outputChunkers_journalChunkInputKeys(outputChunkers, inputKeys, 0,
+                                                                         stList_length(chunks), NULL));
+    for (int64_t i = 0; i < stList_length(chunks); i++) {
+        CuAssertIntEquals(testCase, i != changedChunk, outputChunkers_isChunkJournaled(outputChunkers, i));
+    }
+    outputChunkers_replayChunkJournal(outputChunkers);
+    processChunks(outputChunkers, 1, chunks, chunks, changedChunk, changedChunk + 1, sequenceName, params);
+    outputChunkers_stitch(outputChunkers, 0, stList_length(chunks));
+    outputChunkers_destruct(outputChunkers);
+    char *stitchedSequence = getSequence(testCase, outputSequenceFile, sequenceName);
+    CuAssertStrEquals(testCase, sequence, stitchedSequence);
+    free(stitchedSequence);
+
+    // The recomputed chunk is journaled with its new input key, so a further run finds every chunk unchanged
+    outputChunkers = outputChunkers_construct(1, params, outputSequenceFile, outputPoaFile, NULL,
+                                              outputRepeatCountFile, NULL, NULL, 0);
+    CuAssertIntEquals(testCase, stList_length(chunks),
+                      outputChunkers_openChunkJournal(outputChunkers, chunkJournalFile, 1, stList_length(chunks)));
+    CuAssertIntEquals(testCase, 0, outputChunkers_journalChunkInputKeys(outputChunkers, inputKeys, 0,
+                                                                        stList_length(chunks), NULL));
+    outputChunkers_discardOutput(outputChunkers);
+    outputChunkers_destruct(outputChunkers);
+
+    // Cleanup
+    stFile_rmrf(outputSequenceFile);
+    stFile_rmrf(outputPoaFile);
+    stFile_rmrf(outputRepeatCountFile);
+    stFile_rmrf(chunkJournalFile);
+    for (int64_t i = 0; i < stList_length(chunks); i++) {
+        free(inputKeys[i]);
+    }
+    free(inputKeys);
+    stList_destruct(chunks);
+    params_destruct(params);
+}
+
 
 ChunkToStitch **getChunksToStitchFromStrings(char **strings, int len) {
     ChunkToStitch **chunks = st_calloc(len, sizeof(ChunkToStitch*));
@@ -208,6 +640,11 @@ void test_mergeContigChunksThreaded(CuTest *testCase) {
     chunksToStitch = getChunksToStitchFromStrings(chunks, 16);
     contig = mergeContigChunkzThreaded(chunksToStitch, 0, 16, 8, FALSE, params, "testContig")->seqHap1;
     CuAssertTrue(testCase, strcmp(contig, truth) == 0 );
+
+    // Reducing all the way down to single chunks
+    chunksToStitch = getChunksToStitchFromStrings(chunks, 16);
+    contig = mergeContigChunkzTree(chunksToStitch, 0, 16, 1, FALSE, params)->seqHap1;
+    CuAssertTrue(testCase, strcmp(contig, truth) == 0 );
 }
 
 
@@ -216,5 +653,14 @@ CuSuite *stitchingTestSuite(void) {
     SUITE_ADD_TEST(suite, test_mergeContigChunks);
     SUITE_ADD_TEST(suite, test_mergeContigChunksThreaded);
     SUITE_ADD_TEST(suite, test_stitching);
+    SUITE_ADD_TEST(suite, test_stitchingBinaryChunkRecords);
+    SUITE_ADD_TEST(suite, test_stitchingCompressedTextChunkRecords);
+    SUITE_ADD_TEST(suite, test_stitchingInMemory);
+    SUITE_ADD_TEST(suite, test_stitchingOnline);
+    SUITE_ADD_TEST(suite, test_stitchingResumedFromChunkJournal);
+    SUITE_ADD_TEST(suite, test_stitchingShardedChunkJournals);
+    SUITE_ADD_TEST(suite, test_stitchingCompressedFasta);
+    SUITE_ADD_TEST(suite, test_stitchingFromChunkCache);
+    SUITE_ADD_TEST(suite, test_stitchingSupersedesChunksWithChangedInputs);
     return suite;
 }
@@ -6,11 +6,14 @@
 
 #include "CuTest.h"
 #include "margin.h"
+#include <htslib/vcf.h>
+#include <htslib/tbx.h>
 
 
 static char* PARAMS = "../params/ont/r9.4/allParams.np.human.r94-g344.json";
 static char* VCF1 = "../tests/data/vcfTest/vcfTest1.vcf";
 static char* VCF1_GZ = "../tests/data/vcfTest/vcfTest1.vcf.gz";
+static char* VCF1_BGZ = "temp_vcfTest1.vcf.gz";
 static char* VCF2 = "../tests/data/vcfTest/vcfTest2.vcf";
 static char* VCF2_REF = "../tests/data/vcfTest/vcfTest2.ref.fa";
 static char* VCF3 = "../tests/data/vcfTest/vcfTest3.vcf";
@@ -88,6 +91,62 @@ void test_vcfParseRLEGZ(CuTest *testCase) {
     params_destruct(params);
 }
 
+static void writeIndexedVcf(CuTest *testCase, char *inputVcf, char *outputVcf) {
+    // rewrite the vcf bgzipped, then tabix it
+    htsFile *in = hts_open(inputVcf, "r");
+    htsFile *out = hts_open(outputVcf, "wz");
+    CuAssertTrue(testCase, in != NULL && out != NULL);
+    bcf_hdr_t *hdr = bcf_hdr_read(in);
+    CuAssertTrue(testCase, bcf_hdr_write(out, hdr) == 0);
+    bcf1_t *rec = bcf_init();
+    while (bcf_read(in, hdr, rec) >= 0) {
+        CuAssertTrue(testCase, bcf_write(out, hdr, rec) == 0);
+    }
+    bcf_destroy(rec);
+    bcf_hdr_destroy(hdr);
+    hts_close(in);
+    hts_close(out);
+    CuAssertTrue(testCase, tbx_index_build(outputVcf, 0, &tbx_conf_vcf) == 0);
+}
+
+void test_vcfParseRLEIndexed(CuTest *testCase) {
+    bool RLE = TRUE;
+    Params *params = params_readParams(PARAMS);
+    params->polishParams->useRunLengthEncoding = RLE;
+    params->phaseParams->includeHomozygousVCFEntries = FALSE;
+    writeIndexedVcf(testCase, VCF1, VCF1_BGZ);
+
+    // whole file, through the index
+    stHash *vcfEntryMap = parseVcf(VCF1_BGZ, params);
+    stList *vcfEntries = stHash_search(vcfEntryMap, "chr20");
+
+    CuAssertTrue(testCase, stHash_size(vcfEntryMap) == 1);
+    CuAssertTrue(testCase, stList_length(vcfEntries) == 7);
+    assertVcfEntryCorrect(testCase, stList_get(vcfEntries, 0), "chr20", 1000, "G", "A", RLE);
+    assertVcfEntryCorrect(testCase, stList_get(vcfEntries, 1), "chr20", 2000, "T", "CCC", RLE);
+    assertVcfEntryCorrect(testCase, stList_get(vcfEntries, 2), "chr20", 3000, "C", "A", RLE);
+    assertVcfEntryCorrect(testCase, stList_get(vcfEntries, 3), "chr20", 4000, "T", "C", RLE);
+    assertVcfEntryCorrect(testCase, stList_get(vcfEntries, 4), "chr20", 5000, "GATTACA", "A", RLE);
+    assertVcfEntryCorrect(testCase, stList_get(vcfEntries, 5), "chr20", 6000, "T", "TC", RLE);
+    assertVcfEntryCorrect(testCase, stList_get(vcfEntries, 6), "chr20", 250000000, "A", "G", RLE);
+    stHash_destruct(vcfEntryMap);
+
+    // a region, through the index
+    vcfEntryMap = parseVcf2(VCF1_BGZ, "chr20:1500-5500", params);
+    vcfEntries = stHash_search(vcfEntryMap, "chr20");
+
+    CuAssertTrue(testCase, stList_length(vcfEntries) == 4);
+    assertVcfEntryCorrect(testCase, stList_get(vcfEntries, 0), "chr20", 2000, "T", "CCC", RLE);
+    assertVcfEntryCorrect(testCase, stList_get(vcfEntries, 3), "chr20", 5000, "GATTACA", "A", RLE);
+    stHash_destruct(vcfEntryMap);
+
+    params_destruct(params);
+    remove(VCF1_BGZ);
+    char *indexFile = stString_print("%s.tbi", VCF1_BGZ);
+    remove(indexFile);
+    free(indexFile);
+}
+
 void test_vcfParseRLESNP(CuTest *testCase) {
     bool RLE = TRUE;
     Params *params = params_readParams(PARAMS);
@@ -272,6 +331,14 @@ void test_vcfAlleleSubstrings(CuTest *testCase) {
         stList_append(allRegionRefPositions, stIntTuple_construct2(start, end));
     }
 
+    // the region's entries are views of the contig's entries, sharing their alleles
+    for (int64_t i = 0; i < stList_length(regionVcfEntries); i++) {
+        VcfEntry *e = stList_get(regionVcfEntries, i);
+        CuAssertTrue(testCase, e->rootVcfEntry != NULL);
+        CuAssertTrue(testCase, e->alleles == e->rootVcfEntry->alleles);
+        CuAssertIntEquals(testCase, e->rootVcfEntry->refPos - 64 + 1, e->refPos);
+    }
+
     CuAssertTrue(testCase, stList_length(allRegionAlleleSubstrings) == 7);
     char *regionAlleles4[] = {"GAC", "GCCAC"};
     assertAlleleSubstringsCorrect2(testCase, stList_get(allRegionAlleleSubstrings, 0), regionAlleles4, 2,
@@ -406,6 +473,7 @@ CuSuite *vcfTestSuite(void) {
 
     SUITE_ADD_TEST(suite, test_vcfParseRLE);
     SUITE_ADD_TEST(suite, test_vcfParseRLEGZ);
+    SUITE_ADD_TEST(suite, test_vcfParseRLEIndexed);
     SUITE_ADD_TEST(suite, test_vcfParseRAW);
     SUITE_ADD_TEST(suite, test_vcfParseRLEHOM);
     SUITE_ADD_TEST(suite, test_vcfParseRLESNP);
@@ -30,6 +30,10 @@ void usage() {
     fprintf(stderr, " -c, --cross-block-correct  count variants in different blocks as correctly phased together\n");
     fprintf(stderr, " -s, --report-eff-size      add a column for the effective pair count of each contig\n");
     fprintf(stderr, " -p, --per-variant          report values for variants instead of contigs (for troubleshooting)\n");
+    fprintf(stderr, " -S, --streaming            read the VCFs a contig at a time through their indexes (tabix indexed\n");
+    fprintf(stderr, "                            bgzipped VCFs or csi indexed BCFs), holding only the variants of the\n");
+    fprintf(stderr, "                            contigs being evaluated\n");
+    fprintf(stderr, " -t, --threads INT          number of concurrent threads [1]\n");
     fprintf(stderr, " -q, --quiet                do not log progress to stderr\n");
     fprintf(stderr, " -h, --help                 print this message and exit\n");
     fprintf(stderr, "\n");
@@ -47,6 +51,8 @@ int main(int argc, char *argv[]) {
     bool crossBlockCorrect = false;
     bool reportEffectiveSize = false;
     bool perVariant = false;
+    bool streaming = false;
+    int64_t numThreads = 1;
     
     char* parseEnd = NULL;
     
@@ -61,13 +67,15 @@ int main(int argc, char *argv[]) {
             {"cross-block-correct", no_argument, 0, 'c'},
             {"report-eff-size", no_argument, 0, 's'},
             {"per-variant", no_argument, 0, 'p'},
+            {"streaming", no_argument, 0, 'S'},
+            {"threads", required_argument, 0, 't'},
             {"quiet", no_argument, 0, 'q'},
             {"help", no_argument, 0, 'h'},
             {0,0,0,0}
         };
         
         int option_index = 0;
-        c = getopt_long (argc, argv, "n:m:M:dcspqh?",
+        c = getopt_long (argc, argv, "n:m:M:dcspSt:qh?",
                          long_options, &option_index);
         if (c == -1){
             break;
@@ -110,6 +118,17 @@ int main(int argc, char *argv[]) {
             case 'p':
                 perVariant = true;
                 break;
+            case 'S':
+                streaming = true;
+                break;
+            case 't':
+                numThreads = strtol(optarg, &parseEnd, 10);
+                if ((parseEnd - optarg) != strlen(optarg)) {
+                    fprintf(stderr, "error: Failed to parse argument %s as an integer\n\n", optarg);
+                    usage();
+                    exit(1);
+                }
+                break;
             case 'q':
                 st_setLogLevel(critical);
                 break;
@@ -151,6 +170,15 @@ int main(int argc, char *argv[]) {
     if (perVariant && reportEffectiveSize) {
         st_errAbort("error: Cannot report effective size for variants, only for contigs\n");
     }
+    if (perVariant && streaming) {
+        st_errAbort("error: Cannot report values for variants when streaming, only for contigs\n");
+    }
+    if (numThreads <= 0) {
+        st_errAbort("error: Must use at least 1 thread\n");
+    }
+# ifdef _OPENMP
+    omp_set_num_threads(numThreads);
+# endif
     
 
     // sanity check (verify files are accessible)
@@ -195,83 +223,188 @@ int main(int argc, char *argv[]) {
         st_logDebug("\t%f\n", decayValues[i]);
     }
 
-    // read and parse the VCFs
-    st_logInfo("Reading VCF %s...\n", truthVcfFile);
-    stHash *truthVariants = getPhasedVariants(truthVcfFile);
-    st_logInfo("Reading VCF %s...\n", queryVcfFile);
-    stHash *queryVariants = getPhasedVariants(queryVcfFile);
-    
-    free(truthVcfFile);
-    free(queryVcfFile);
-
-    stList *sharedContigs = getSharedContigs(truthVariants, queryVariants);
-    st_logInfo("Found %"PRId64" shared contigs (truth %"PRId64", query %"PRId64")\n", stList_length(sharedContigs),
-            stHash_size(truthVariants), stHash_size(queryVariants));
-    
-    
-    int64_t reportIterations[5];
-    for (int64_t i = 0; i < 5; ++i) {
-        reportIterations[i] = ((i + 1) * numLengthScales) / 5;
-    }
-    int64_t nextReportIdx = 0;
-    while (reportIterations[nextReportIdx] == 0 && nextReportIdx < 5) {
-        ++nextReportIdx;
-    }
-    
+    stList *sharedContigs = NULL;
+    stHash *truthVariants = NULL;
+    stHash *queryVariants = NULL;
     double *correctnessValues = NULL;
     double *effectivePairCounts = NULL;
     stList *perVarCorrectness = NULL;
+    double variantDist;
     
-    double variantDist = meanVariantDist(truthVariants, queryVariants, sharedContigs);
-    
-    if (perVariant) {
-        perVarCorrectness = stList_construct3(0, (void (*)(void*)) stList_destruct);
-    }
-    else {
-        correctnessValues = (double*) malloc(sizeof(double) * numLengthScales * stList_length(sharedContigs));
-        effectivePairCounts = (double*) malloc(sizeof(double) * numLengthScales * stList_length(sharedContigs));
-    }
-        
-    
-    // Compute the correctness values
-    for (int64_t i = 0; i < numLengthScales; ++i) {
-        
-        // to hold a list of per-variant correctness for each contig in this length scales
-        stList *lengthScalePerVarContigs = NULL;
-        if (perVariant) {
-            lengthScalePerVarContigs = stList_construct3(0, (void (*)(void*)) stList_destruct);
-            stList_append(perVarCorrectness, lengthScalePerVarContigs);
+    if (streaming) {
+        // the contigs of both indexes
+        PhasedVcfReader *truthReader = phasedVcfReader_construct(truthVcfFile);
+        PhasedVcfReader *queryReader = phasedVcfReader_construct(queryVcfFile);
+        stList *truthContigs = phasedVcfReader_getContigs(truthReader);
+        stList *queryContigs = phasedVcfReader_getContigs(queryReader);
+        stSet *queryContigSet = stSet_construct3(stHash_stringKey, stHash_stringEqualKey, NULL);
+        for (int64_t i = 0; i < stList_length(queryContigs); ++i) {
+            stSet_insert(queryContigSet, stList_get(queryContigs, i));
         }
+        sharedContigs = stList_construct3(0, free);
+        for (int64_t i = 0; i < stList_length(truthContigs); ++i) {
+            if (stSet_search(queryContigSet, stList_get(truthContigs, i)) != NULL) {
+                stList_append(sharedContigs, stString_copy(stList_get(truthContigs, i)));
+            }
+        }
+        stList_sort(sharedContigs, (int (*)(const void *, const void *)) strcmp);
+        st_logInfo("Found %"PRId64" shared contigs (truth %"PRId64", query %"PRId64")\n", stList_length(sharedContigs),
+                   stList_length(truthContigs), stList_length(queryContigs));
+        stSet_destruct(queryContigSet);
+        stList_destruct(truthContigs);
+        stList_destruct(queryContigs);
+        phasedVcfReader_destruct(truthReader);
+        phasedVcfReader_destruct(queryReader);
         
-        for (int64_t j = 0; j < stList_length(sharedContigs); ++j) {
-            stList *contigTruthVariants = stHash_search(truthVariants, stList_get(sharedContigs, j));
-            stList *contigQueryVariants = stHash_search(queryVariants, stList_get(sharedContigs, j));
+        // each contig is read and evaluated for all the length scales at once, so only the variants of the
+        // contigs in flight are held
+        int64_t numContigs = stList_length(sharedContigs);
+        correctnessValues = (double*) malloc(sizeof(double) * numLengthScales * numContigs);
+        effectivePairCounts = (double*) malloc(sizeof(double) * numLengthScales * numContigs);
+        int64_t distSum = 0;
+        int64_t numPairs = 0;
+        int64_t numContigsDone = 0;
+        
+        #pragma omp parallel
+        {
+            PhasedVcfReader *threadTruthReader = phasedVcfReader_construct(truthVcfFile);
+            PhasedVcfReader *threadQueryReader = phasedVcfReader_construct(queryVcfFile);
+            double *contigCorrectness = (double*) malloc(sizeof(double) * numLengthScales);
+            double *contigEffectivePairCounts = (double*) malloc(sizeof(double) * numLengthScales);
             
-            stList *perVarContig = NULL;
-            if (perVariant) {
-                perVarContig = stList_construct3(0, (void (*)(void*)) variantCorrectness_destruct);
-                stList_append(lengthScalePerVarContigs, perVarContig);
+            #pragma omp for schedule(dynamic,1)
+            for (int64_t j = 0; j < numContigs; ++j) {
+                char *contig = stList_get(sharedContigs, j);
+                stList *contigTruthVariants = phasedVcfReader_getContigVariants(threadTruthReader, contig);
+                stList *contigQueryVariants = phasedVcfReader_getContigVariants(threadQueryReader, contig);
+                
+                st_logDebug("\tComputing correctness for contig %s\n", contig);
+                
+                int64_t contigNumPairs;
+                int64_t contigDistSum = variantDistSum(contigTruthVariants, contigQueryVariants, &contigNumPairs);
+                phasingCorrectnessForDecays(contigTruthVariants, contigQueryVariants, decayValues, numLengthScales,
+                                            bySeqDist, crossBlockCorrect, contigCorrectness,
+                                            contigEffectivePairCounts);
+                for (int64_t i = 0; i < numLengthScales; ++i) {
+                    correctnessValues[i * numContigs + j] = contigCorrectness[i];
+                    effectivePairCounts[i * numContigs + j] = contigEffectivePairCounts[i];
+                }
+                stList_destruct(contigTruthVariants);
+                stList_destruct(contigQueryVariants);
+                
+                #pragma omp critical
+                {
+                    distSum += contigDistSum;
+                    numPairs += contigNumPairs;
+                    ++numContigsDone;
+                    st_logInfo("Finished computing correctness for %"PRId64" of %"PRId64" contigs\n",
+                               numContigsDone, numContigs);
+                }
             }
             
-            st_logDebug("\tComputing correctness for contig %s\n", stList_get(sharedContigs, j));
+            free(contigCorrectness);
+            free(contigEffectivePairCounts);
+            phasedVcfReader_destruct(threadTruthReader);
+            phasedVcfReader_destruct(threadQueryReader);
+        }
+        variantDist = ((double) distSum) / numPairs;
+    }
+    else {
+        // read and parse the VCFs
+        st_logInfo("Reading VCF %s...\n", truthVcfFile);
+        truthVariants = getPhasedVariants(truthVcfFile);
+        st_logInfo("Reading VCF %s...\n", queryVcfFile);
+        queryVariants = getPhasedVariants(queryVcfFile);
+
+        sharedContigs = getSharedContigs(truthVariants, queryVariants);
+        st_logInfo("Found %"PRId64" shared contigs (truth %"PRId64", query %"PRId64")\n", stList_length(sharedContigs),
+                stHash_size(truthVariants), stHash_size(queryVariants));
+    
+        variantDist = meanVariantDist(truthVariants, queryVariants, sharedContigs);
+    
+        int64_t numContigs = stList_length(sharedContigs);
+    
+        if (perVariant) {
+            // the per-variant values need a separate evaluation for each length scale
+            perVarCorrectness = stList_construct3(0, (void (*)(void*)) stList_destruct);
+            for (int64_t i = 0; i < numLengthScales; ++i) {
             
-            double effectivePairCount;
-            double correctness = phasingCorrectness(contigTruthVariants, contigQueryVariants, decayValues[i],
-                                                    bySeqDist, crossBlockCorrect, &effectivePairCount, perVarContig);
+                // to hold a list of per-variant correctness for each contig in this length scales
+                stList *lengthScalePerVarContigs = stList_construct3(0, (void (*)(void*)) stList_destruct);
+                stList_append(perVarCorrectness, lengthScalePerVarContigs);
+                for (int64_t j = 0; j < numContigs; ++j) {
+                    stList_append(lengthScalePerVarContigs,
+                                  stList_construct3(0, (void (*)(void*)) variantCorrectness_destruct));
+                }
+            }
+        
+            #pragma omp parallel for schedule(dynamic,1)
+            for (int64_t k = 0; k < numLengthScales * numContigs; ++k) {
+                int64_t i = k / numContigs;
+                int64_t j = k % numContigs;
+                stList *contigTruthVariants = stHash_search(truthVariants, stList_get(sharedContigs, j));
+                stList *contigQueryVariants = stHash_search(queryVariants, stList_get(sharedContigs, j));
+                stList *perVarContig = stList_get(stList_get(perVarCorrectness, i), j);
             
-            if (!perVariant) {
-                correctnessValues[i * stList_length(sharedContigs) + j] = correctness;
-                effectivePairCounts[i * stList_length(sharedContigs) + j] = effectivePairCount;
+                double effectivePairCount;
+                phasingCorrectness(contigTruthVariants, contigQueryVariants, decayValues[i], bySeqDist,
+                                   crossBlockCorrect, &effectivePairCount, perVarContig);
             }
         }
+        else {
+            correctnessValues = (double*) malloc(sizeof(double) * numLengthScales * numContigs);
+            effectivePairCounts = (double*) malloc(sizeof(double) * numLengthScales * numContigs);
         
-        if (i + 1 == reportIterations[nextReportIdx]) {
-            st_logInfo("Finished computing correctness for %"PRId64" of %"PRId64" length scales\n", i + 1, numLengthScales);
-            while (i + 1 == reportIterations[nextReportIdx] && nextReportIdx < 5) {
-                ++nextReportIdx;
+            // all of a contig's length scales are evaluated in one sweep, but if there are fewer contigs
+            // than threads we also split the length scales into blocks so that every thread has work
+            int64_t numScaleBlocks = 1;
+    # ifdef _OPENMP
+            if (numContigs > 0 && numContigs < numThreads) {
+                numScaleBlocks = (numThreads + numContigs - 1) / numContigs;
+                if (numScaleBlocks > numLengthScales) {
+                    numScaleBlocks = numLengthScales;
+                }
+            }
+    # endif
+            int64_t scaleBlockSize = (numLengthScales + numScaleBlocks - 1) / numScaleBlocks;
+            int64_t numTasksDone = 0;
+        
+            #pragma omp parallel for schedule(dynamic,1)
+            for (int64_t k = 0; k < numContigs * numScaleBlocks; ++k) {
+                int64_t j = k / numScaleBlocks;
+                int64_t blockStart = (k % numScaleBlocks) * scaleBlockSize;
+                int64_t blockLength = numLengthScales - blockStart < scaleBlockSize ? numLengthScales - blockStart
+                                                                                     : scaleBlockSize;
+                if (blockLength > 0) {
+                    stList *contigTruthVariants = stHash_search(truthVariants, stList_get(sharedContigs, j));
+                    stList *contigQueryVariants = stHash_search(queryVariants, stList_get(sharedContigs, j));
+                
+                    st_logDebug("\tComputing correctness for contig %s\n", stList_get(sharedContigs, j));
+                
+                    double *blockCorrectness = (double*) malloc(sizeof(double) * blockLength);
+                    double *blockEffectivePairCounts = (double*) malloc(sizeof(double) * blockLength);
+                    phasingCorrectnessForDecays(contigTruthVariants, contigQueryVariants, &(decayValues[blockStart]),
+                                                blockLength, bySeqDist, crossBlockCorrect, blockCorrectness,
+                                                blockEffectivePairCounts);
+                    for (int64_t i = 0; i < blockLength; ++i) {
+                        correctnessValues[(blockStart + i) * numContigs + j] = blockCorrectness[i];
+                        effectivePairCounts[(blockStart + i) * numContigs + j] = blockEffectivePairCounts[i];
+                    }
+                    free(blockCorrectness);
+                    free(blockEffectivePairCounts);
+                }
+            
+                #pragma omp critical
+                {
+                    ++numTasksDone;
+                    st_logInfo("Finished computing correctness for %"PRId64" of %"PRId64" contig length scale blocks\n",
+                               numTasksDone, numContigs * numScaleBlocks);
+                }
             }
         }
     }
+    free(truthVcfFile);
+    free(queryVcfFile);
     
     // print out the results in a table
     
@@ -362,8 +495,8 @@ int main(int argc, char *argv[]) {
     free(decayValues);
     free(lengthScales);
     stList_destruct(sharedContigs);
-    stHash_destruct(truthVariants);
-    stHash_destruct(queryVariants);
+    if (truthVariants != NULL) stHash_destruct(truthVariants);
+    if (queryVariants != NULL) stHash_destruct(queryVariants);
     stList_destruct(perVarCorrectness);
     
     return 0;
@@ -0,0 +1,519 @@
+/*
+ * Copyright (C) 2018 by Benedict Paten (benedictpaten@gmail.com)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <time.h>
+#include "marginVersion.h"
+
+#include "margin.h"
+#include "htsIntegration.h"
+
+/*
+ * Microbenchmarks of the core kernels, run over a small fixed region of the test data so that their timings can be
+ * compared across commits.
+ */
+
+#define BENCH_DEFAULT_BAM "../tests/data/realData/HG002.r94g360.chr20_59M_100k.bam"
+#define BENCH_DEFAULT_REFERENCE "../tests/data/realData/hg38.chr20_59M_100k.fa"
+#define BENCH_DEFAULT_PARAMS "../params/ont/r9.4/allParams.np.human.r94-g360.json"
+#define BENCH_DEFAULT_REGION "chr20:40000-45000"
+
+// The pairwise kernels align the reads to a window of the reference of this many run length encoded bases
+#define BENCH_PAIRWISE_WINDOW 300
+#define BENCH_PAIRWISE_READS 8
+// The cheap kernels are repeated this many times in a run, so a run is long enough to time
+#define BENCH_REPEATS 20
+
+/*
+ * Allocation counting. The linker is asked to wrap the allocator when building marginBench (see CMakeLists.txt), so
+ * every allocation made by margin, sonLib and htslib goes through these functions.
+ */
+
+#ifdef MARGIN_BENCH_COUNT_ALLOCATIONS
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+static int64_t allocationNo = 0;
+static int64_t allocatedBytes = 0;
+
+static void countAllocation(size_t size) {
+    __atomic_fetch_add(&allocationNo, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&allocatedBytes, (int64_t) size, __ATOMIC_RELAXED);
+}
+
+void *__wrap_malloc(size_t size) {
+    countAllocation(size);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size) {
+    countAllocation(nmemb * size);
+    return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    countAllocation(size);
+    return __real_realloc(ptr, size);
+}
+#endif
+
+/*
+ * The fixed inputs of the kernels, made once from the chunk of the benchmark region
+ */
+
+typedef struct _benchInput {
+    Params *params;
+    char *refSeqName;
+    RleString *reference;
+    char *referenceString; // non-rle
+    stList *reads;
+    stList *alignments;
+    // read and reference windows for the pairwise kernels
+    int64_t pairNo;
+    SymbolString referenceWindows[BENCH_PAIRWISE_READS];
+    SymbolString readWindows[BENCH_PAIRWISE_READS];
+    bool forwardStrands[BENCH_PAIRWISE_READS];
+    // the results of the earlier kernels, as inputs to the later
+    Poa *poa;
+    BubbleGraph *bg;
+    stReference *ref;
+    stHash *readsToPSeqs;
+    stRPHmm *hmm;
+} BenchInput;
+
+static int64_t getPairwiseCells(BenchInput *input) {
+    int64_t cells = 0;
+    for (int64_t i = 0; i < input->pairNo; i++) {
+        cells += input->referenceWindows[i].length * input->readWindows[i].length;
+    }
+    return cells;
+}
+
+static StateMachine *getStateMachine(BenchInput *input, int64_t i) {
+    return input->forwardStrands[i] ? input->params->polishParams->stateMachineForForwardStrandRead :
+           input->params->polishParams->stateMachineForReverseStrandRead;
+}
+
+static int64_t bench_getAlignedPairsWithIndels(BenchInput *input) {
+    for (int64_t i = 0; i < input->pairNo; i++) {
+        stList *alignedPairs, *gapXPairs, *gapYPairs;
+        getAlignedPairsWithIndels(getStateMachine(input, i), input->referenceWindows[i], input->readWindows[i],
+                                  input->params->polishParams->p, &alignedPairs, &gapXPairs, &gapYPairs, 0, 0);
+        stList_destruct(alignedPairs);
+        stList_destruct(gapXPairs);
+        stList_destruct(gapYPairs);
+    }
+    return getPairwiseCells(input);
+}
+
+static int64_t bench_computeForwardProbability(BenchInput *input) {
+    stList *anchorPairs = stList_construct();
+    for (int64_t i = 0; i < input->pairNo; i++) {
+        computeForwardProbability(input->referenceWindows[i], input->readWindows[i], anchorPairs,
+                                  input->params->polishParams->p, getStateMachine(input, i), 0, 0);
+    }
+    stList_destruct(anchorPairs);
+    return getPairwiseCells(input);
+}
+
+static int64_t bench_poa_realignAll(BenchInput *input) {
+    poa_destruct(poa_realignAll(input->reads, input->alignments, input->reference, input->params->polishParams));
+    int64_t readBases = 0;
+    for (int64_t i = 0; i < stList_length(input->reads); i++) {
+        readBases += ((BamChunkRead *) stList_get(input->reads, i))->rleRead->length;
+    }
+    return readBases;
+}
+
+static void setPoa(BenchInput *input) {
+    if (input->poa == NULL) {
+        input->poa = poa_realignAll(input->reads, input->alignments, input->reference, input->params->polishParams);
+    }
+}
+
+static int64_t bench_bubbleGraph_constructFromPoa(BenchInput *input) {
+    bubbleGraph_destruct(bubbleGraph_constructFromPoa(input->poa, input->reads, input->params->polishParams));
+    return stList_length(input->poa->nodes);
+}
+
+static void setPhasingHmm(BenchInput *input) {
+    /*
+     * Makes the hmm of the chunk's reads, as bubbleGraph_phaseBubbleGraph, but not splitting the strands.
+     */
+    if (input->bg != NULL) {
+        return;
+    }
+    setPoa(input);
+    input->bg = bubbleGraph_constructFromPoa(input->poa, input->reads, input->params->polishParams);
+    input->ref = bubbleGraph_getReference(input->bg, input->refSeqName, input->params);
+    input->readsToPSeqs = bubbleGraph_getProfileSeqs(input->bg, input->ref);
+    stList *profileSeqs = stHash_getValues(input->readsToPSeqs);
+    stList *filteredProfileSeqs = stList_construct();
+    stList *discardedProfileSeqs = stList_construct();
+    filterReadsByCoverageDepth(profileSeqs, input->params->phaseParams, filteredProfileSeqs, discardedProfileSeqs);
+    stList *tilingPath = getRPHmms(filteredProfileSeqs, input->params->phaseParams);
+    stList_setDestructor(tilingPath, NULL);
+    input->hmm = stList_length(tilingPath) == 0 ? NULL : fuseTilingPath(tilingPath);
+    stList_destruct(profileSeqs);
+    stList_destruct(filteredProfileSeqs);
+    stList_destruct(discardedProfileSeqs);
+}
+
+static int64_t bench_stRPHmm_forwardBackward(BenchInput *input) {
+    if (input->hmm == NULL) {
+        return 0;
+    }
+    stRPHmm_forwardBackward(input->hmm);
+
+    int64_t cells = 0;
+    stRPColumn *column = input->hmm->firstColumn;
+    while (1) {
+        for (stRPCell *cell = column->head; cell != NULL; cell = cell->nCell) {
+            cells++;
+        }
+        if (column->nColumn == NULL) {
+            break;
+        }
+        column = column->nColumn->nColumn;
+    }
+    return cells;
+}
+
+static int64_t bench_calculateCountBitVectors(BenchInput *input) {
+    if (input->hmm == NULL) {
+        return 0;
+    }
+    int64_t readAlleles = 0;
+    stRPColumn *column = input->hmm->firstColumn;
+    while (1) {
+        if (column->depth <= 64 && column->length > 0) {
+            uint64_t *bitCountVectors = calculateCountBitVectors(column->seqs, input->ref, column->refStart,
+                                                                 column->length, column->depth);
+            free(bitCountVectors);
+            uint64_t lastSite = column->refStart + column->length;
+            uint64_t alleles = (lastSite < input->ref->length ? input->ref->sites[lastSite].alleleOffset :
+                                input->ref->totalAlleles) - input->ref->sites[column->refStart].alleleOffset;
+            readAlleles += alleles * column->depth;
+        }
+        if (column->nColumn == NULL) {
+            break;
+        }
+        column = column->nColumn->nColumn;
+    }
+    return readAlleles;
+}
+
+static int64_t bench_rleString_construct(BenchInput *input) {
+    int64_t bases = 0;
+    for (int64_t j = 0; j < BENCH_REPEATS; j++) {
+        RleString *rleString = rleString_construct(input->referenceString);
+        bases += rleString->nonRleLength;
+        rleString_destruct(rleString);
+    }
+    return bases;
+}
+
+static int64_t bench_removeOverlap(BenchInput *input) {
+    // the halves of the reference, overlapping by the chunk boundary, as adjacent chunks are
+    int64_t length = strlen(input->referenceString);
+    int64_t overlap = length / 10;
+    char *prefixString = stString_getSubString(input->referenceString, 0, length / 2 + overlap);
+    char *suffixString = stString_getSubString(input->referenceString, length / 2 - overlap,
+                                               length - (length / 2 - overlap));
+    for (int64_t j = 0; j < BENCH_REPEATS; j++) {
+        int64_t prefixStringCropEnd, suffixStringCropStart;
+        removeOverlap(prefixString, strlen(prefixString), suffixString, strlen(suffixString), 2 * overlap,
+                      input->params->polishParams, &prefixStringCropEnd, &suffixStringCropStart);
+    }
+    free(prefixString);
+    free(suffixString);
+    return 2 * overlap * BENCH_REPEATS;
+}
+
+typedef struct _benchmark {
+    char *name;
+    char *unit; // of the work counted by run
+    void (*setup)(BenchInput *input); // makes the input the kernel needs, if not already made; may be NULL
+    int64_t (*run)(BenchInput *input);
+} Benchmark;
+
+static Benchmark benchmarks[] = {
+        { "getAlignedPairsWithIndels", "cells", NULL, bench_getAlignedPairsWithIndels },
+        { "computeForwardProbability", "cells", NULL, bench_computeForwardProbability },
+        { "rleString_construct", "bases", NULL, bench_rleString_construct },
+        { "removeOverlap", "overlapBases", NULL, bench_removeOverlap },
+        { "poa_realignAll", "readBases", NULL, bench_poa_realignAll },
+        { "bubbleGraph_constructFromPoa", "poaNodes", setPoa, bench_bubbleGraph_constructFromPoa },
+        { "stRPHmm_forwardBackward", "cells", setPhasingHmm, bench_stRPHmm_forwardBackward },
+        { "calculateCountBitVectors", "readAlleles", setPhasingHmm, bench_calculateCountBitVectors },
+        { NULL, NULL, NULL, NULL } };
+
+static int64_t getBenchTime() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (int64_t) time.tv_sec * 1000000000 + (int64_t) time.tv_nsec;
+}
+
+static int cmpTimes(const void *a, const void *b) {
+    int64_t i = *(int64_t *) a, j = *(int64_t *) b;
+    return i < j ? -1 : (i > j ? 1 : 0);
+}
+
+static void setPairwiseWindows(BenchInput *input) {
+    /*
+     * Takes the windows of the first reads whose anchor alignments span the middle of the reference.
+     */
+    PolishParams *polishParams = input->params->polishParams;
+    uint64_t maxRL = polishParams->useRunLengthEncoding ? (uint64_t) polishParams->repeatSubMatrix->maximumRepeatLength
+                                                        : 2;
+    int64_t windowStart = (int64_t) input->reference->length / 2 - BENCH_PAIRWISE_WINDOW / 2;
+    int64_t windowEnd = windowStart + BENCH_PAIRWISE_WINDOW;
+    input->pairNo = 0;
+    for (int64_t i = 0; i < stList_length(input->reads) && input->pairNo < BENCH_PAIRWISE_READS; i++) {
+        BamChunkRead *read = stList_get(input->reads, i);
+        stList *anchorPairs = stList_get(input->alignments, i);
+        int64_t readStart = -1, readEnd = -1;
+        for (int64_t j = 0; j < stList_length(anchorPairs); j++) {
+            stIntTuple *anchorPair = stList_get(anchorPairs, j);
+            if (readStart == -1 && stIntTuple_get(anchorPair, 0) >= windowStart) {
+                readStart = stIntTuple_get(anchorPair, 0) == windowStart ? stIntTuple_get(anchorPair, 1) : -2;
+            }
+            if (stIntTuple_get(anchorPair, 0) < windowEnd) {
+                readEnd = stIntTuple_get(anchorPair, 1) + 1;
+            } else {
+                break;
+            }
+        }
+        if (readStart < 0 || readEnd <= readStart) {
+            continue;
+        }
+        input->referenceWindows[input->pairNo] = rleString_constructSymbolString(input->reference, windowStart,
+                BENCH_PAIRWISE_WINDOW, polishParams->alphabet, polishParams->useRepeatCountsInAlignment, maxRL);
+        input->readWindows[input->pairNo] = rleString_constructSymbolString(read->rleRead, readStart,
+                readEnd - readStart, polishParams->alphabet, polishParams->useRepeatCountsInAlignment, maxRL);
+        input->forwardStrands[input->pairNo++] = read->forwardStrand;
+    }
+}
+
+void usage() {
+    fprintf(stderr, "usage: marginBench [options]\n");
+    fprintf(stderr, "Version: %s \n\n", MARGIN_POLISH_VERSION_H);
+    fprintf(stderr, "Times the core kernels over a fixed region of the test data, writing the results as JSON.\n");
+    fprintf(stderr, "Run from the build directory, or give the inputs.\n");
+
+    fprintf(stderr, "\nDefault options:\n");
+    fprintf(stderr, "    -h --help                : Print this help screen\n");
+    fprintf(stderr, "    -a --logLevel            : Set the log level [default = critical]\n");
+# ifdef _OPENMP
+    fprintf(stderr, "    -t --threads             : Set number of concurrent threads [default = 1]\n");
+# endif
+    fprintf(stderr, "    -b --bam                 : Alignments to use [default = %s]\n", BENCH_DEFAULT_BAM);
+    fprintf(stderr, "    -f --reference           : Reference to use [default = %s]\n", BENCH_DEFAULT_REFERENCE);
+    fprintf(stderr, "    -p --params              : Parameters to use [default = %s]\n", BENCH_DEFAULT_PARAMS);
+    fprintf(stderr, "    -r --region              : Region of the single chunk used [default = %s]\n",
+            BENCH_DEFAULT_REGION);
+    fprintf(stderr, "    -i --iterations          : Timed runs of each kernel [default = 5]\n");
+    fprintf(stderr, "    -k --kernel              : Only run kernels whose names contain this\n");
+    fprintf(stderr, "    -o --output              : Write the JSON to this file [default = stdout]\n");
+
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char *argv[]) {
+
+    // Parameters / arguments
+    char *logLevelString = stString_copy("critical");
+    char *bamFile = stString_copy(BENCH_DEFAULT_BAM);
+    char *referenceFastaFile = stString_copy(BENCH_DEFAULT_REFERENCE);
+    char *paramsFile = stString_copy(BENCH_DEFAULT_PARAMS);
+    char *regionStr = stString_copy(BENCH_DEFAULT_REGION);
+    char *kernelFilter = NULL;
+    char *outputFile = NULL;
+    int64_t iterations = 5;
+    int numThreads = 1;
+
+    // Parse the options
+    while (1) {
+        static struct option long_options[] = {
+                { "help", no_argument, 0, 'h' },
+                { "logLevel", required_argument, 0, 'a' },
+# ifdef _OPENMP
+                { "threads", required_argument, 0, 't'},
+# endif
+                { "bam", required_argument, 0, 'b'},
+                { "reference", required_argument, 0, 'f'},
+                { "params", required_argument, 0, 'p'},
+                { "region", required_argument, 0, 'r'},
+                { "iterations", required_argument, 0, 'i'},
+                { "kernel", required_argument, 0, 'k'},
+                { "output", required_argument, 0, 'o'},
+                { 0, 0, 0, 0 } };
+
+        int option_index = 0;
+        int key = getopt_long(argc, argv, "ha:t:b:f:p:r:i:k:o:", long_options, &option_index);
+
+        if (key == -1) {
+            break;
+        }
+
+        switch (key) {
+        case 'a':
+            free(logLevelString);
+            logLevelString = stString_copy(optarg);
+            break;
+        case 'h':
+            usage();
+            return 0;
+        case 't':
+            numThreads = atoi(optarg);
+            if (numThreads <= 0) {
+                st_errAbort("Invalid thread count: %d", numThreads);
+            }
+            break;
+        case 'b':
+            free(bamFile);
+            bamFile = stString_copy(optarg);
+            break;
+        case 'f':
+            free(referenceFastaFile);
+            referenceFastaFile = stString_copy(optarg);
+            break;
+        case 'p':
+            free(paramsFile);
+            paramsFile = stString_copy(optarg);
+            break;
+        case 'r':
+            free(regionStr);
+            regionStr = stString_copy(optarg);
+            break;
+        case 'i':
+            iterations = atoi(optarg);
+            if (iterations <= 0) {
+                st_errAbort("Invalid iteration count: %s", optarg);
+            }
+            break;
+        case 'k':
+            if (kernelFilter != NULL) free(kernelFilter);
+            kernelFilter = stString_copy(optarg);
+            break;
+        case 'o':
+            if (outputFile != NULL) free(outputFile);
+            outputFile = stString_copy(optarg);
+            break;
+        default:
+            usage();
+            return 0;
+        }
+    }
+
+    st_setLogLevelFromString(logLevelString);
+    free(logLevelString);
+# ifdef _OPENMP
+    omp_set_num_threads(numThreads);
+# endif
+
+    // Make the inputs, from the single chunk of the region
+    BenchInput *input = st_calloc(1, sizeof(BenchInput));
+    input->params = params_readParams(paramsFile);
+    PolishParams *polishParams = input->params->polishParams;
+    polishParams->chunkBoundary = 0;
+    BamChunker *bamChunker = bamChunker_construct2(bamFile, regionStr, NULL, polishParams, FALSE);
+    if (bamChunker->chunkCount == 0) {
+        st_errAbort("Found no chunks for region %s in %s\n", regionStr, bamFile);
+    }
+    BamChunk *bamChunk = bamChunker_getChunk(bamChunker, 0);
+    input->refSeqName = bamChunk->refSeqName;
+    input->reference = bamChunk_getReferenceSubstring(bamChunk, referenceFastaFile, input->params);
+    input->referenceString = rleString_expand(input->reference);
+    input->reads = stList_construct3(0, (void (*)(void *)) bamChunkRead_destruct);
+    input->alignments = stList_construct3(0, (void (*)(void *)) stList_destruct);
+    convertToReadsAndAlignments(bamChunk, input->reference, input->reads, input->alignments, polishParams);
+    setPairwiseWindows(input);
+    st_logCritical("> Benchmarking %s:%"PRId64"-%"PRId64" with %"PRId64" reads and %"PRId64" pairwise windows\n",
+                   bamChunk->refSeqName, bamChunk->chunkStart, bamChunk->chunkEnd, stList_length(input->reads),
+                   input->pairNo);
+
+    // Run the kernels
+    FILE *fh = outputFile == NULL ? stdout : safe_fopen(outputFile, "w");
+    fprintf(fh, "{\"version\": \"%s\", \"region\": \"%s\", \"reads\": %"PRId64", \"threads\": %d, "
+                "\"iterations\": %"PRId64", \"benchmarks\": [", MARGIN_POLISH_VERSION_H, regionStr,
+            stList_length(input->reads), numThreads, iterations);
+    int64_t *times = st_malloc(iterations * sizeof(int64_t));
+    bool first = TRUE;
+    for (Benchmark *benchmark = benchmarks; benchmark->name != NULL; benchmark++) {
+        if (kernelFilter != NULL && strstr(benchmark->name, kernelFilter) == NULL) {
+            continue;
+        }
+        st_randomSeed(1);
+        if (benchmark->setup != NULL) {
+            benchmark->setup(input);
+        }
+
+        // a warm up run, then the timed runs
+        st_randomSeed(1);
+        int64_t units = benchmark->run(input);
+#ifdef MARGIN_BENCH_COUNT_ALLOCATIONS
+        int64_t startAllocationNo = allocationNo, startAllocatedBytes = allocatedBytes;
+#endif
+        int64_t totalTime = 0;
+        for (int64_t i = 0; i < iterations; i++) {
+            st_randomSeed(1);
+            int64_t startTime = getBenchTime();
+            benchmark->run(input);
+            times[i] = getBenchTime() - startTime;
+            totalTime += times[i];
+        }
+        qsort(times, iterations, sizeof(int64_t), cmpTimes);
+        int64_t medianTime = times[iterations / 2];
+        double nsPerUnit = units > 0 ? (double) medianTime / units : 0.0;
+        double unitsPerSecond = medianTime > 0 ? 1.0e9 * units / medianTime : 0.0;
+
+        fprintf(fh, "%s\n  {\"name\": \"%s\", \"unit\": \"%s\", \"units\": %"PRId64", \"minNs\": %"PRId64
+                    ", \"medianNs\": %"PRId64", \"meanNs\": %"PRId64", \"maxNs\": %"PRId64", \"nsPerUnit\": %.4f"
+                    ", \"unitsPerSecond\": %.1f", first ? "" : ",", benchmark->name, benchmark->unit, units, times[0],
+                medianTime, totalTime / iterations, times[iterations - 1], nsPerUnit, unitsPerSecond);
+#ifdef MARGIN_BENCH_COUNT_ALLOCATIONS
+        fprintf(fh, ", \"allocations\": %"PRId64", \"allocatedBytes\": %"PRId64"}",
+                (allocationNo - startAllocationNo) / iterations, (allocatedBytes - startAllocatedBytes) / iterations);
+#else
+        fprintf(fh, ", \"allocations\": null, \"allocatedBytes\": null}");
+#endif
+        first = FALSE;
+        st_logCritical("> %-30s %12.4f ns/%s %16.1f %s/s\n", benchmark->name, nsPerUnit, benchmark->unit,
+                       unitsPerSecond, benchmark->unit);
+    }
+    fprintf(fh, "\n]}\n");
+    if (outputFile != NULL) fclose(fh);
+
+    // cleanup
+    free(times);
+    if (input->hmm != NULL) stRPHmm_destruct2(input->hmm);
+    if (input->readsToPSeqs != NULL) stHash_destruct(input->readsToPSeqs);
+    if (input->ref != NULL) stReference_destruct(input->ref);
+    if (input->bg != NULL) bubbleGraph_destruct(input->bg);
+    if (input->poa != NULL) poa_destruct(input->poa);
+    for (int64_t i = 0; i < input->pairNo; i++) {
+        symbolString_destruct(input->referenceWindows[i]);
+        symbolString_destruct(input->readWindows[i]);
+    }
+    stList_destruct(input->alignments);
+    stList_destruct(input->reads);
+    free(input->referenceString);
+    rleString_destruct(input->reference);
+    params_destruct(input->params);
+    free(input);
+    bamChunker_destruct(bamChunker);
+    free(bamFile);
+    free(referenceFastaFile);
+    free(paramsFile);
+    free(regionStr);
+    if (kernelFilter != NULL) free(kernelFilter);
+    if (outputFile != NULL) free(outputFile);
+
+    return 0;
+}
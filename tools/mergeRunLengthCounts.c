@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2018 by Benedict Paten (benedictpaten@gmail.com)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include "marginVersion.h"
+
+#include "margin.h"
+
+
+void usage() {
+    fprintf(stderr, "usage: mergeRunLengthCounts [options] COUNTS [COUNTS ...]\n");
+    fprintf(stderr, "Version: %s \n\n", MARGIN_POLISH_VERSION_H);
+    fprintf(stderr, "Combines run length counts from runLengthMatrix into one run length matrix and repeat sub matrix.\n");
+
+    fprintf(stderr, "\nRequired arguments:\n");
+    fprintf(stderr, "    COUNTS are run_lengths.bin files written by runLengthMatrix, for different bams or regions.\n");
+
+    fprintf(stderr, "\nDefault options:\n");
+    fprintf(stderr, "    -h --help                : Print this help screen\n");
+    fprintf(stderr, "    -a --logLevel            : Set the log level [default = info]\n");
+    fprintf(stderr, "    -o --outputBase          : Name to use for output files [default = 'output']\n");
+    fprintf(stderr, "    -c --pseudocount         : Pseudocount added to each count for the repeat sub matrix (default 1.0)\n");
+
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char *argv[]) {
+
+    // Parameters / arguments
+    char *logLevelString = stString_copy("critical");
+    char *outputBase = stString_copy("output");
+    double pseudocount = 1.0;
+
+    // Parse the options
+    while (1) {
+        static struct option long_options[] = {
+                { "help", no_argument, 0, 'h' },
+                { "logLevel", required_argument, 0, 'a' },
+                { "outputBase", required_argument, 0, 'o'},
+                { "pseudocount", required_argument, 0, 'c'},
+                { 0, 0, 0, 0 } };
+
+        int option_index = 0;
+        int key = getopt_long(argc, argv, "ha:o:c:", long_options, &option_index);
+
+        if (key == -1) {
+            break;
+        }
+
+        switch (key) {
+        case 'a':
+            free(logLevelString);
+            logLevelString = stString_copy(optarg);
+            break;
+        case 'h':
+            usage();
+            return 0;
+        case 'o':
+            free(outputBase);
+            outputBase = getFileBase(optarg, "output");
+            break;
+        case 'c':
+            pseudocount = atof(optarg);
+            if (pseudocount < 0) {
+                st_errAbort("Invalid pseudocount: %s", optarg);
+            }
+            break;
+        default:
+            usage();
+            free(outputBase);
+            free(logLevelString);
+            return 0;
+        }
+    }
+
+    if (optind >= argc) {
+        free(outputBase);
+        free(logLevelString);
+        usage();
+        return 0;
+    }
+    st_setLogLevelFromString(logLevelString);
+    free(logLevelString);
+
+    // sum the counts of every record in every file
+    RunLengthCounts *mergedRunLengthCounts = NULL;
+    for (int64_t i = optind; i < argc; i++) {
+        FILE *countsFile = fopen(argv[i], "rb");
+        if (countsFile == NULL) {
+            st_errAbort("Could not read from counts file: %s\n", argv[i]);
+        }
+        st_logCritical("> Reading counts from %s\n", argv[i]);
+        RunLengthCounts *runLengthCounts;
+        while ((runLengthCounts = runLengthCounts_read(countsFile)) != NULL) {
+            if (mergedRunLengthCounts == NULL) {
+                mergedRunLengthCounts = runLengthCounts;
+            } else {
+                runLengthCounts_merge(mergedRunLengthCounts, runLengthCounts);
+                runLengthCounts_destruct(runLengthCounts);
+            }
+        }
+        fclose(countsFile);
+    }
+    if (mergedRunLengthCounts == NULL) {
+        st_errAbort("Found no run length counts in the given files\n");
+    }
+
+    // printit
+    runLengthCounts_writeOutputFiles(mergedRunLengthCounts, outputBase, pseudocount);
+
+    // cleanup
+    runLengthCounts_destruct(mergedRunLengthCounts);
+    free(outputBase);
+
+    return 0;
+}
@@ -44,6 +44,9 @@ void usage() {
     fprintf(stderr, "                                 Format: chr:start_pos-end_pos (chr3:2000-3000)\n");
     fprintf(stderr, "    -p --depth               : Will override the downsampling depth set in PARAMS\n");
     fprintf(stderr, "    -l --maxRunLength        : Maximum run length (default 50)\n");
+    fprintf(stderr, "    -c --pseudocount         : Pseudocount added to each count for the repeat sub matrix (default 1.0)\n");
+    fprintf(stderr, "\nCounts are also written to OUTPUT_BASE.run_lengths.bin, counts from many runs can be combined\n");
+    fprintf(stderr, "with mergeRunLengthCounts.\n");
 
     fprintf(stderr, "\n");
 }
@@ -68,53 +71,6 @@ int64_t charToNuclIdx(char nucl, bool forward) {
 }
 
 
-int64_t getRunLengthArrayIndex(int threadIdx, int64_t nuclIdx, uint64_t refRL, uint64_t readRL, int64_t maxRL) {
-    // bad thread
-    assert(threadIdx >= 0);
-    assert(nuclIdx < 4);
-
-    int64_t threadPos = threadIdx * 4 * maxRL * maxRL;
-    int64_t nuclPos = nuclIdx * maxRL * maxRL;
-    int64_t refRlPos = (refRL < maxRL ? refRL : maxRL - 1) * maxRL;
-    int64_t readRlPos = (readRL < maxRL ? readRL : maxRL - 1);
-
-    // bad nucl
-    if (nuclPos < 0) return -1;
-
-    return threadPos + nuclPos + refRlPos + readRlPos;
-}
-
-
-int64_t testRunLengthConstruction() {
-    int64_t threadCount = 10;
-    int64_t maxRunLenght = 10;
-    int64_t nuclCount = 4;
-    int64_t maxArraySize = threadCount * nuclCount * maxRunLenght * maxRunLenght;
-
-    uint64_t *myArray = st_calloc(maxArraySize, sizeof(uint64_t));
-    for (int thread = 0 ; thread < threadCount; thread++) {
-        for (uint64_t refRl = 0; refRl < maxRunLenght; refRl++) {
-            for (uint64_t readRl = 0; readRl < maxRunLenght; readRl++) {
-                for (int64_t nucl = 0; nucl < nuclCount; nucl++) {
-                    char nuc = (nucl==0 ? 'A' : (nucl==1 ? 'C' : (nucl==2 ? 'G' : 'T')));
-                    for (int64_t strand = 0; strand < 2; strand++) {
-                        int64_t idx = getRunLengthArrayIndex(thread, charToNuclIdx(nuc, strand == 0), refRl, readRl, maxRunLenght);
-                        assert(idx < maxArraySize);
-                        myArray[idx] += 1;
-                    }
-                }
-            }
-        }
-    }
-
-    for (int64_t i = 0; i < maxArraySize; i++) {
-        assert(myArray[i] == 2);
-    }
-
-    free(myArray);
-}
-
-
 int main(int argc, char *argv[]) {
 
     // Parameters / arguments
@@ -127,6 +83,7 @@ int main(int argc, char *argv[]) {
     int numThreads = 1;
     int64_t maxDepth = -1;
     int64_t maxRunLengthExcl = 51;
+    double pseudocount = 1.0;
 
     if (argc < 3) {
         free(outputBase);
@@ -152,10 +109,11 @@ int main(int argc, char *argv[]) {
                 { "depth", required_argument, 0, 'p'},
                 { "tempFilesToDisk", no_argument, 0, 'k'},
                 { "maxRunLength", no_argument, 0, 'l'},
+                { "pseudocount", required_argument, 0, 'c'},
                 { 0, 0, 0, 0 } };
 
         int option_index = 0;
-        int key = getopt_long(argc-2, &argv[2], "ha:o:p:t:r:l:", long_options, &option_index);
+        int key = getopt_long(argc-2, &argv[2], "ha:o:p:t:r:l:c:", long_options, &option_index);
 
         if (key == -1) {
             break;
@@ -188,6 +146,12 @@ int main(int argc, char *argv[]) {
                 st_errAbort("Invalid max run length: %s", optarg);
             }
             break;
+        case 'c':
+            pseudocount = atof(optarg);
+            if (pseudocount < 0) {
+                st_errAbort("Invalid pseudocount: %s", optarg);
+            }
+            break;
         default:
             usage();
             free(outputBase);
@@ -230,9 +194,6 @@ int main(int argc, char *argv[]) {
     st_logCritical("Running OpenMP with %d threads.\n", omp_get_max_threads());
 # endif
 
-    //testing
-    testRunLengthConstruction();
-
     // Parse parameters
     st_logCritical("> Parsing model parameters from file: %s\n", paramsFile);
     Params *params = params_readParams(paramsFile);
@@ -256,6 +217,7 @@ int main(int argc, char *argv[]) {
     // get chunker for bam.  if regionStr is NULL, it will be ignored
     time_t chunkingStart = time(NULL);
     BamChunker *bamChunker = bamChunker_construct2(bamInFile, regionStr, NULL, params->polishParams, TRUE);
+    bamChunker_setCramReference(bamChunker, referenceFastaFile);
     st_logCritical(
             "> Set up bam chunker in %"PRId64"s with chunk size %i and overlap %i (for region=%s), resulting in %i total chunks\n",
             time(NULL) - chunkingStart, (int) bamChunker->chunkSize, (int) bamChunker->chunkBoundary,
@@ -280,12 +242,22 @@ int main(int argc, char *argv[]) {
                 st_logCritical("> Randomly shuffling chunks\n");
                 stList_shuffle(chunkOrder);
                 break;
+            case SCM_COST_DESC:
+                st_logCritical("> Ordering chunks by predicted cost\n");
+                break;
         }
     }
 
-    // this is the run length data we want
-    int64_t totalSize = numThreads * 4 * maxRunLengthExcl * maxRunLengthExcl;
-    uint64_t *runLengthDataForAllThreads = st_calloc(totalSize, sizeof(uint64_t));
+    // each thread takes chunks from the scheduler until there are none left
+    bool predictChunkCost = params->polishParams->shuffleChunks &&
+            params->polishParams->shuffleChunksMethod == SCM_COST_DESC;
+    ChunkScheduler *chunkScheduler = chunkScheduler_construct(bamChunker, chunkOrder, numThreads, predictChunkCost);
+
+    // this is the run length data we want, each thread counts into its own shard
+    RunLengthCounts **runLengthCountsForThreads = st_calloc(numThreads, sizeof(RunLengthCounts *));
+    for (int64_t t = 0; t < numThreads; t++) {
+        runLengthCountsForThreads[t] = runLengthCounts_construct(maxRunLengthExcl);
+    }
 
     // multiproccess the chunks, save to results
     st_logCritical("> Setup complete, beginning run\n");
@@ -293,9 +265,9 @@ int main(int argc, char *argv[]) {
     time_t polishStartTime = time(NULL);
 
     # ifdef _OPENMP
-    #pragma omp parallel for schedule(dynamic,1)
+    #pragma omp parallel
     # endif
-    for (int64_t i = 0; i < bamChunker->chunkCount; i++) {
+    for (int64_t i = 0; chunkScheduler_next(chunkScheduler, &i);) {
         int64_t chunkIdx = stIntTuple_get(stList_get(chunkOrder, i), 0);
         // Time all chunks
         time_t chunkStartTime = time(NULL);
@@ -386,6 +358,7 @@ int main(int argc, char *argv[]) {
         // Generate partial order alignment (POA) (destroys rleAlignments in the process)
         poa = poa_realignOnlyAnchorAlignments(reads, alignments, rleReference, params->polishParams);
 
+        RunLengthCounts *runLengthCounts = runLengthCountsForThreads[threadIdx];
         for (int64_t pos = 1; pos < stList_length(poa->nodes); pos++) {
             PoaNode *node = stList_get(poa->nodes, pos);
             char refNucl = node->base;
@@ -394,16 +367,14 @@ int main(int argc, char *argv[]) {
                 PoaBaseObservation *obs = stList_get(node->observations, o);
                 BamChunkRead *read = stList_get(reads, obs->readNo);
                 char readNucl = read->rleRead->rleString[obs->offset];
-                uint64_t readRL = read->rleRead->repeatCounts[obs->offset];
+                uint64_t readRL = rleString_getRepeatCount(read->rleRead, obs->offset);
 
                 if (readNucl == refNucl) {
-                    int64_t idx = getRunLengthArrayIndex(threadIdx, charToNuclIdx(readNucl, read->forwardStrand),
-                            refRL, readRL, maxRunLengthExcl);
-                    if (idx < 0) {
+                    int64_t nuclIdx = charToNuclIdx(readNucl, read->forwardStrand);
+                    if (nuclIdx < 0) {
                         continue;
                     }
-                    assert(idx < totalSize);
-                    runLengthDataForAllThreads[idx] += 1;
+                    (*runLengthCounts_getCount(runLengthCounts, nuclIdx, refRL, readRL))++;
                 }
             }
         }
@@ -423,112 +394,27 @@ int main(int argc, char *argv[]) {
         stList_destruct(filteredReads);
         stList_destruct(filteredAlignments);
         free(logIdentifier);
+        chunkScheduler_finish(chunkScheduler, i);
     }
+    chunkScheduler_destruct(chunkScheduler);
 
     st_logCritical("> Consolidating all run lengths\n");
 
     // condense all values
-    uint64_t *condensedRunLengthArray = st_calloc(4 * maxRunLengthExcl * maxRunLengthExcl, sizeof(uint64_t));
-    for (int t = 0; t < numThreads; t++) {
-        for (int64_t nucl = 0; nucl < 4; nucl++) {
-            for (uint64_t refRL = 1; refRL < maxRunLengthExcl; refRL++) {
-                for (uint64_t readRL = 1; readRL < maxRunLengthExcl; readRL++) {
-                    int64_t fullDataPos = getRunLengthArrayIndex(t, nucl, refRL, readRL, maxRunLengthExcl);
-                    int64_t condensedPos = getRunLengthArrayIndex(0, nucl, refRL, readRL, maxRunLengthExcl);
-                    assert(fullDataPos >= 0);
-                    assert(condensedPos >= 0);
-                    condensedRunLengthArray[condensedPos] += runLengthDataForAllThreads[fullDataPos];
-                }
-            }
-        }
+    RunLengthCounts *condensedRunLengthCounts = runLengthCounts_construct(maxRunLengthExcl);
+    for (int64_t t = 0; t < numThreads; t++) {
+        runLengthCounts_merge(condensedRunLengthCounts, runLengthCountsForThreads[t]);
+        runLengthCounts_destruct(runLengthCountsForThreads[t]);
     }
+    free(runLengthCountsForThreads);
 
     // printit
-    char *countFilenameA = stString_print("%s.run_lengths.A.tsv", outputBase);
-    FILE *countFileA = fopen(countFilenameA, "w");
-    char *countFilenameC = stString_print("%s.run_lengths.C.tsv", outputBase);
-    FILE *countFileC = fopen(countFilenameC, "w");
-    char *countFilenameG = stString_print("%s.run_lengths.G.tsv", outputBase);
-    FILE *countFileG = fopen(countFilenameG, "w");
-    char *countFilenameT = stString_print("%s.run_lengths.T.tsv", outputBase);
-    FILE *countFileT = fopen(countFilenameT, "w");
-    if (countFileA == NULL || countFileC == NULL || countFileG == NULL || countFileT == NULL) {
-        st_errAbort("Could not open output files for writing!", countFilenameA);
-    } else {
-        st_logCritical("> Writing counts to %s, %s, %s %s\n", countFilenameA, countFilenameC, countFilenameG, countFilenameT);
-    }
-
-    for (uint64_t refRL = 0; refRL < maxRunLengthExcl; refRL++) {
-        for (uint64_t readRL = 0; readRL < maxRunLengthExcl; readRL++) {
-            if (refRL == 0) {
-                // header
-                if (readRL == 0) {
-                    fprintf(countFileA, "#ref_rl");
-                    fprintf(countFileC, "#ref_rl");
-                    fprintf(countFileG, "#ref_rl");
-                    fprintf(countFileT, "#ref_rl");
-                } else {
-                    fprintf(countFileA, "read_%"PRId64"%s", readRL, readRL == maxRunLengthExcl - 1 ? "+" : "");
-                    fprintf(countFileC, "read_%"PRId64"%s", readRL, readRL == maxRunLengthExcl - 1 ? "+" : "");
-                    fprintf(countFileG, "read_%"PRId64"%s", readRL, readRL == maxRunLengthExcl - 1 ? "+" : "");
-                    fprintf(countFileT, "read_%"PRId64"%s", readRL, readRL == maxRunLengthExcl - 1 ? "+" : "");
-                }
-            } else {
-                if (readRL == 0) {
-                    // header (ish)
-                    fprintf(countFileA, "%"PRIu64, refRL);
-                    fprintf(countFileC, "%"PRIu64, refRL);
-                    fprintf(countFileG, "%"PRIu64, refRL);
-                    fprintf(countFileT, "%"PRIu64, refRL);
-                } else {
-                    // data
-                    int64_t condensedPosA = getRunLengthArrayIndex(0, charToNuclIdx('A', TRUE), refRL, readRL, maxRunLengthExcl);
-                    int64_t condensedPosC = getRunLengthArrayIndex(0, charToNuclIdx('C', TRUE), refRL, readRL, maxRunLengthExcl);
-                    int64_t condensedPosG = getRunLengthArrayIndex(0, charToNuclIdx('G', TRUE), refRL, readRL, maxRunLengthExcl);
-                    int64_t condensedPosT = getRunLengthArrayIndex(0, charToNuclIdx('T', TRUE), refRL, readRL, maxRunLengthExcl);
-
-                    uint64_t countA = condensedRunLengthArray[condensedPosA];
-                    uint64_t countC = condensedRunLengthArray[condensedPosC];
-                    uint64_t countG = condensedRunLengthArray[condensedPosG];
-                    uint64_t countT = condensedRunLengthArray[condensedPosT];
-
-                    fprintf(countFileA, "%"PRIu64, countA);
-                    fprintf(countFileC, "%"PRIu64, countC);
-                    fprintf(countFileG, "%"PRIu64, countG);
-                    fprintf(countFileT, "%"PRIu64, countT);
-                }
-            }
-
-            // increment
-            if (readRL == maxRunLengthExcl - 1) {
-                fprintf(countFileA, "\n");
-                fprintf(countFileC, "\n");
-                fprintf(countFileG, "\n");
-                fprintf(countFileT, "\n");
-            } else {
-                fprintf(countFileA, "\t");
-                fprintf(countFileC, "\t");
-                fprintf(countFileG, "\t");
-                fprintf(countFileT, "\t");
-            }
-        }
-    }
-
-
-    // close files
-    fclose(countFileA);
-    fclose(countFileC);
-    fclose(countFileG);
-    fclose(countFileT);
+    runLengthCounts_writeOutputFiles(condensedRunLengthCounts, outputBase, pseudocount);
 
     // cleanup
-    free(countFilenameA);
-    free(countFilenameC);
-    free(countFilenameG);
-    free(countFilenameT);
-    free(condensedRunLengthArray);
-    free(runLengthDataForAllThreads);
+    runLengthCounts_destruct(condensedRunLengthCounts);
     bamChunker_destruct(bamChunker);
+    htsThreadPool_destruct();
     params_destruct(params);
     if (regionStr != NULL) free(regionStr);
     stList_destruct(chunkOrder);
@@ -0,0 +1,747 @@
+/*
+ * Copyright (C) 2020 by Benedict Paten (benedictpaten@gmail.com)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <math.h>
+#include <unistd.h>
+#include "marginVersion.h"
+
+#include "margin.h"
+#include "htsIntegration.h"
+#include <htslib/faidx.h>
+
+/*
+ * Simulates a synthetic workload for benchmarking: a random reference, a diploid genome made from it by phased
+ * variants, and long reads sampled from the two haplotypes with the errors of the read model in a params file.
+ * Writes the reference as fasta, the variants as a truth vcf and the reads as a sorted, indexed bam.
+ */
+
+// Variants are at least this far apart, so they do not overlap
+#define SIM_VARIANT_SPACING 10
+#define SIM_MAX_INDEL_LENGTH 50
+// The reads' lengths are log normal, with this standard deviation of their log
+#define SIM_READ_LENGTH_SIGMA 0.5
+#define SIM_MIN_READ_LENGTH 100
+
+typedef struct _simVariant {
+    int64_t pos; // 0-based position of the first reference base
+    char *ref;
+    char *alt;
+    bool onHap[2];
+} SimVariant;
+
+static void simVariant_destruct(SimVariant *variant) {
+    free(variant->ref);
+    free(variant->alt);
+    free(variant);
+}
+
+typedef struct _simOptions {
+    int64_t contigNo;
+    int64_t contigLength;
+    double depth;
+    int64_t meanReadLength;
+    double hetRate;
+    double homRate;
+    double indelFraction;
+    double homopolymerIndelFraction;
+    double indelExtension;
+    double homopolymerExtension;
+} SimOptions;
+
+/*
+ * Sampling
+ */
+
+static const char *simBases = "ACGT";
+
+static Symbol sim_baseSymbol(char base) {
+    // the bases are simulated in upper case
+    return (Symbol) (strchr(simBases, base) - simBases);
+}
+
+static int64_t sim_sampleLogProbs(double *logProbs, int64_t length) {
+    // samples an index from the given, possibly unnormalised, log probabilities
+    double total = 0.0;
+    for (int64_t i = 0; i < length; i++) {
+        total += exp(logProbs[i]);
+    }
+    double p = st_random() * total;
+    for (int64_t i = 0; i < length; i++) {
+        p -= exp(logProbs[i]);
+        if (p < 0) {
+            return i;
+        }
+    }
+    return length - 1;
+}
+
+static int64_t sim_sampleGeometric(double extension, int64_t max) {
+    // 1 plus the number of times the extension probability is hit, up to max
+    int64_t length = 1;
+    while (length < max && st_random() < extension) {
+        length++;
+    }
+    return length;
+}
+
+static char sim_otherBase(char base) {
+    char other;
+    while ((other = simBases[st_randomInt(0, 4)]) == base);
+    return other;
+}
+
+static int64_t sim_sampleReadLength(int64_t meanReadLength) {
+    // log normal with the given mean, from a Box-Muller normal
+    double z = sqrt(-2.0 * log(1.0 - st_random())) * cos(2.0 * M_PI * st_random());
+    double mu = log((double) meanReadLength) - SIM_READ_LENGTH_SIGMA * SIM_READ_LENGTH_SIGMA / 2.0;
+    int64_t length = (int64_t) exp(mu + SIM_READ_LENGTH_SIGMA * z);
+    return length < SIM_MIN_READ_LENGTH ? SIM_MIN_READ_LENGTH : length;
+}
+
+/*
+ * The genome
+ */
+
+static char *sim_reference(int64_t length, SimOptions *options) {
+    // runs of bases, each extended by another base with the homopolymer extension probability
+    char *reference = st_malloc(length + 1);
+    char base = 'N';
+    for (int64_t i = 0; i < length;) {
+        base = sim_otherBase(base);
+        int64_t runLength = sim_sampleGeometric(options->homopolymerExtension, length - i);
+        for (int64_t j = 0; j < runLength; j++) {
+            reference[i++] = base;
+        }
+    }
+    reference[length] = '\0';
+    return reference;
+}
+
+static SimVariant *sim_variant(char *reference, int64_t length, int64_t pos, int64_t minPos, SimOptions *options) {
+    /*
+     * Makes a variant at pos, or at the start of the homopolymer after it. Its first reference base is not before
+     * minPos.
+     */
+    SimVariant *variant = st_calloc(1, sizeof(SimVariant));
+    variant->pos = pos;
+    if (st_random() >= options->indelFraction) {
+        variant->ref = stString_print("%c", reference[pos]);
+        variant->alt = stString_print("%c", sim_otherBase(reference[pos]));
+        return variant;
+    }
+    int64_t indelLength = sim_sampleGeometric(options->indelExtension, SIM_MAX_INDEL_LENGTH);
+    bool insertion = st_random() < 0.5;
+
+    // homopolymer indels lengthen or shorten the run after pos, anchored on the base before it
+    if (st_random() < options->homopolymerIndelFraction) {
+        int64_t runStart = pos + 1, runEnd = pos + 2;
+        while (runStart > minPos + 1 && reference[runStart - 1] == reference[pos + 1]) {
+            runStart--;
+        }
+        while (runEnd < length - 1 && reference[runEnd] == reference[pos + 1]) {
+            runEnd++;
+        }
+        if (runStart > minPos && reference[runStart - 1] != reference[runStart]) {
+            variant->pos = runStart - 1;
+            if (!insertion && runEnd - runStart >= 2) {
+                if (indelLength >= runEnd - runStart) {
+                    indelLength = runEnd - runStart - 1;
+                }
+                variant->ref = stString_getSubString(reference, variant->pos, indelLength + 1);
+                variant->alt = stString_print("%c", reference[variant->pos]);
+            } else {
+                variant->ref = stString_print("%c", reference[variant->pos]);
+                variant->alt = st_malloc(indelLength + 2);
+                variant->alt[0] = reference[variant->pos];
+                memset(variant->alt + 1, reference[runStart], indelLength);
+                variant->alt[indelLength + 1] = '\0';
+            }
+            return variant;
+        }
+    }
+
+    // otherwise random sequence is inserted or deleted after pos
+    if (!insertion && pos + indelLength < length - 1) {
+        variant->ref = stString_getSubString(reference, pos, indelLength + 1);
+        variant->alt = stString_print("%c", reference[pos]);
+    } else {
+        variant->ref = stString_print("%c", reference[pos]);
+        variant->alt = st_malloc(indelLength + 2);
+        variant->alt[0] = reference[pos];
+        for (int64_t i = 1; i <= indelLength; i++) {
+            variant->alt[i] = simBases[st_randomInt(0, 4)];
+        }
+        variant->alt[indelLength + 1] = '\0';
+    }
+    return variant;
+}
+
+static stList *sim_variants(char *reference, int64_t length, SimOptions *options) {
+    /*
+     * Places phased variants along the reference, in order, heterozygous at the het rate and homozygous at the
+     * hom rate.
+     */
+    stList *variants = stList_construct3(0, (void (*)(void *)) simVariant_destruct);
+    int64_t minPos = 1;
+    for (int64_t pos = 1; pos < length - SIM_MAX_INDEL_LENGTH - 2; pos++) {
+        if (pos < minPos) {
+            continue;
+        }
+        double p = st_random();
+        if (p >= options->hetRate + options->homRate) {
+            continue;
+        }
+        SimVariant *variant = sim_variant(reference, length, pos, minPos, options);
+        if (p < options->homRate) {
+            variant->onHap[0] = variant->onHap[1] = TRUE;
+        } else {
+            variant->onHap[st_randomInt(0, 2)] = TRUE;
+        }
+        stList_append(variants, variant);
+        minPos = variant->pos + strlen(variant->ref) + SIM_VARIANT_SPACING;
+    }
+    return variants;
+}
+
+static char *sim_haplotype(char *reference, int64_t length, stList *variants, int64_t hap, int64_t **hapToRef) {
+    /*
+     * Applies the variants on the haplotype to the reference. Each haplotype base's reference position is put in
+     * hapToRef, -1 for inserted bases.
+     */
+    int64_t maxLength = length;
+    for (int64_t i = 0; i < stList_length(variants); i++) {
+        SimVariant *variant = stList_get(variants, i);
+        maxLength += strlen(variant->alt);
+    }
+    char *haplotype = st_malloc(maxLength + 1);
+    *hapToRef = st_malloc(maxLength * sizeof(int64_t));
+    int64_t h = 0, r = 0;
+    for (int64_t i = 0; i <= stList_length(variants); i++) {
+        SimVariant *variant = i < stList_length(variants) ? stList_get(variants, i) : NULL;
+        if (variant != NULL && !variant->onHap[hap]) {
+            continue;
+        }
+        int64_t end = variant == NULL ? length : variant->pos;
+        for (; r < end; r++) {
+            haplotype[h] = reference[r];
+            (*hapToRef)[h++] = r;
+        }
+        if (variant != NULL) {
+            int64_t refLength = strlen(variant->ref), altLength = strlen(variant->alt);
+            for (int64_t j = 0; j < altLength; j++) {
+                haplotype[h] = variant->alt[j];
+                (*hapToRef)[h++] = j < refLength ? r + j : -1;
+            }
+            r += refLength;
+        }
+    }
+    haplotype[h] = '\0';
+    return haplotype;
+}
+
+/*
+ * The reads
+ */
+
+typedef struct _simCigar {
+    uint32_t *ops;
+    int64_t length;
+    int64_t maxLength;
+} SimCigar;
+
+static void simCigar_add(SimCigar *cigar, int op, int64_t length) {
+    if (length == 0) {
+        return;
+    }
+    if (cigar->length > 0 && bam_cigar_op(cigar->ops[cigar->length - 1]) == op) {
+        cigar->ops[cigar->length - 1] += (uint32_t) length << BAM_CIGAR_SHIFT;
+        return;
+    }
+    if (cigar->length == cigar->maxLength) {
+        cigar->maxLength = cigar->maxLength * 2 + 16;
+        cigar->ops = st_realloc(cigar->ops, cigar->maxLength * sizeof(uint32_t));
+    }
+    cigar->ops[cigar->length++] = bam_cigar_gen(length, op);
+}
+
+typedef struct _simRead {
+    int64_t pos; // 0-based reference position of its first aligned base
+    char *samLine;
+} SimRead;
+
+static void simRead_destruct(SimRead *read) {
+    free(read->samLine);
+    free(read);
+}
+
+static int simRead_cmp(const void *a, const void *b) {
+    int64_t i = ((SimRead *) a)->pos, j = ((SimRead *) b)->pos;
+    return i < j ? -1 : (i > j ? 1 : 0);
+}
+
+typedef struct _simReadBuilder {
+    int64_t *hapToRef;
+    SimCigar cigar;
+    char *sequence;
+    int64_t length;
+    int64_t maxLength;
+    int64_t lastRef; // reference position of the last haplotype base aligned to the reference, -1 if none
+    int64_t firstRef;
+} SimReadBuilder;
+
+static void simReadBuilder_addBase(SimReadBuilder *builder, char base) {
+    if (builder->length == builder->maxLength) {
+        builder->maxLength = builder->maxLength * 2 + 16;
+        builder->sequence = st_realloc(builder->sequence, builder->maxLength + 1);
+    }
+    builder->sequence[builder->length++] = base;
+}
+
+static void simReadBuilder_addHapBase(SimReadBuilder *builder, int64_t h, char base, bool emitted) {
+    /*
+     * Adds the haplotype base at h, with the read base emitted for it or deleted in the read, to the read's alignment
+     * to the reference.
+     */
+    int64_t r = builder->hapToRef[h];
+    if (emitted) {
+        simReadBuilder_addBase(builder, base);
+    }
+    if (r < 0) {
+        if (emitted) {
+            simCigar_add(&builder->cigar, BAM_CINS, 1);
+        }
+        return;
+    }
+    if (builder->lastRef >= 0) {
+        simCigar_add(&builder->cigar, BAM_CDEL, r - builder->lastRef - 1);
+    } else {
+        builder->firstRef = r;
+    }
+    simCigar_add(&builder->cigar, emitted ? BAM_CMATCH : BAM_CDEL, 1);
+    builder->lastRef = r;
+}
+
+static void simReadBuilder_addInsert(SimReadBuilder *builder, char base, int64_t length) {
+    for (int64_t i = 0; i < length; i++) {
+        simReadBuilder_addBase(builder, base);
+    }
+    simCigar_add(&builder->cigar, BAM_CINS, length);
+}
+
+static int64_t sim_sampleRepeatCount(RepeatSubMatrix *repeatSubMatrix, char base, bool forwardStrand,
+                                     int64_t repeatCount) {
+    // the read's count of a run, from the repeat count model when there is one
+    if (repeatSubMatrix == NULL) {
+        return repeatCount;
+    }
+    int64_t max = repeatSubMatrix->maximumRepeatLength;
+    int64_t underlyingRepeatCount = repeatCount < max ? repeatCount : max - 1;
+    double *logProbs = repeatSubMatrix_setLogProb(repeatSubMatrix, sim_baseSymbol(base), forwardStrand, 0,
+                                                  underlyingRepeatCount);
+    int64_t observedRepeatCount = sim_sampleLogProbs(logProbs, max);
+    // runs are not dropped by the repeat count model, that is left to the gap states
+    if (observedRepeatCount < 1) {
+        observedRepeatCount = 1;
+    }
+    return observedRepeatCount + (repeatCount - underlyingRepeatCount);
+}
+
+static SimRead *sim_read(char *readName, char *contig, char *haplotype, int64_t *hapToRef, int64_t hapStart,
+                         int64_t hapEnd, bool forwardStrand, PolishParams *polishParams) {
+    /*
+     * Samples a read of haplotype[hapStart, hapEnd) with the errors of the read model for its strand. The read is
+     * sampled in the reference's orientation, as the read models are, a run of bases at a time when run length
+     * encoding.
+     */
+    StateMachine3 *sM3 = (StateMachine3 *) (forwardStrand ? polishParams->stateMachineForForwardStrandRead :
+                                            polishParams->stateMachineForReverseStrandRead);
+    NucleotideEmissions *ne = (NucleotideEmissions *) sM3->model.emissions;
+    RepeatSubMatrix *repeatSubMatrix = polishParams->useRunLengthEncoding ? polishParams->repeatSubMatrix : NULL;
+    double matchTransitions[] = { sM3->TRANSITION_MATCH_CONTINUE, sM3->TRANSITION_GAP_OPEN_X,
+                                  sM3->TRANSITION_GAP_OPEN_Y };
+    double gapXTransitions[] = { sM3->TRANSITION_MATCH_FROM_GAP_X, sM3->TRANSITION_GAP_EXTEND_X,
+                                 sM3->TRANSITION_GAP_SWITCH_TO_Y };
+    double gapYTransitions[] = { sM3->TRANSITION_MATCH_FROM_GAP_Y, sM3->TRANSITION_GAP_SWITCH_TO_X,
+                                 sM3->TRANSITION_GAP_EXTEND_Y };
+    double *transitions[] = { matchTransitions, gapXTransitions, gapYTransitions };
+
+    SimReadBuilder builder = { hapToRef, { NULL, 0, 0 }, NULL, 0, 0, -1, -1 };
+    int64_t state = SM3_MATCH;
+    for (int64_t h = hapStart; h < hapEnd;) {
+        if (state == SM3_GAP_Y) {
+            // a run inserted in the read
+            char base = simBases[sim_sampleLogProbs(ne->EMISSION_GAP_Y_PROBS, 4)];
+            simReadBuilder_addInsert(&builder, base, sim_sampleRepeatCount(repeatSubMatrix, base, forwardStrand, 1));
+        } else {
+            // the next run of the haplotype, matched or deleted in the read
+            int64_t runLength = 1;
+            while (repeatSubMatrix != NULL && h + runLength < hapEnd && haplotype[h + runLength] == haplotype[h]) {
+                runLength++;
+            }
+            int64_t s = sim_baseSymbol(haplotype[h]);
+            char base = haplotype[h];
+            int64_t readLength = 0;
+            if (state == SM3_MATCH) {
+                base = s < 4 ? simBases[sim_sampleLogProbs(&ne->EMISSION_MATCH_PROBS[s * 4], 4)] : base;
+                readLength = sim_sampleRepeatCount(repeatSubMatrix, base, forwardStrand, runLength);
+            }
+            for (int64_t i = 0; i < runLength; i++) {
+                simReadBuilder_addHapBase(&builder, h + i, base, i < readLength);
+            }
+            if (readLength > runLength) {
+                simReadBuilder_addInsert(&builder, base, readLength - runLength);
+            }
+            h += runLength;
+        }
+        state = sim_sampleLogProbs(transitions[state], 3);
+    }
+
+    // the alignment starts and ends with a match, inserts before or after becoming soft clips
+    SimCigar *cigar = &builder.cigar;
+    int64_t first = 0, last = cigar->length - 1;
+    while (first < cigar->length && bam_cigar_op(cigar->ops[first]) != BAM_CMATCH) first++;
+    while (last >= 0 && bam_cigar_op(cigar->ops[last]) != BAM_CMATCH) last--;
+    if (first > last) {
+        free(cigar->ops);
+        free(builder.sequence);
+        return NULL;
+    }
+    int64_t pos = builder.firstRef, startClip = 0, endClip = 0;
+    for (int64_t i = 0; i < first; i++) {
+        if (bam_cigar_op(cigar->ops[i]) == BAM_CINS) {
+            startClip += bam_cigar_oplen(cigar->ops[i]);
+        } else {
+            pos += bam_cigar_oplen(cigar->ops[i]);
+        }
+    }
+    for (int64_t i = last + 1; i < cigar->length; i++) {
+        if (bam_cigar_op(cigar->ops[i]) == BAM_CINS) {
+            endClip += bam_cigar_oplen(cigar->ops[i]);
+        }
+    }
+    stList *cigarStrings = stList_construct3(0, free);
+    if (startClip > 0) stList_append(cigarStrings, stString_print("%" PRId64 "S", startClip));
+    for (int64_t i = first; i <= last; i++) {
+        stList_append(cigarStrings, stString_print("%" PRIu32 "%c", bam_cigar_oplen(cigar->ops[i]),
+                                                   bam_cigar_opchr(cigar->ops[i])));
+    }
+    if (endClip > 0) stList_append(cigarStrings, stString_print("%" PRId64 "S", endClip));
+    char *cigarString = stString_join2("", cigarStrings);
+    builder.sequence[builder.length] = '\0';
+
+    SimRead *read = st_calloc(1, sizeof(SimRead));
+    read->pos = pos;
+    read->samLine = stString_print("%s\t%d\t%s\t%" PRId64 "\t60\t%s\t*\t0\t0\t%s\t*", readName,
+                                   forwardStrand ? 0 : BAM_FREVERSE, contig, pos + 1, cigarString, builder.sequence);
+
+    // cleanup
+    free(cigarString);
+    stList_destruct(cigarStrings);
+    free(cigar->ops);
+    free(builder.sequence);
+    return read;
+}
+
+static stList *sim_reads(char *contig, char *haplotypes[2], int64_t *hapToRefs[2], int64_t contigLength,
+                         SimOptions *options, PolishParams *polishParams) {
+    /*
+     * Samples reads from the two haplotypes until they cover the contig to the depth, sorted by position.
+     */
+    stList *reads = stList_construct3(0, (void (*)(void *)) simRead_destruct);
+    int64_t hapLengths[2] = { strlen(haplotypes[0]), strlen(haplotypes[1]) };
+    double totalLength = 0.0;
+    for (int64_t readNo = 0; totalLength < options->depth * contigLength; readNo++) {
+        int64_t hap = st_randomInt(0, 2);
+        int64_t length = sim_sampleReadLength(options->meanReadLength);
+        if (length > hapLengths[hap]) {
+            length = hapLengths[hap];
+        }
+        int64_t start = st_randomInt(0, hapLengths[hap] - length + 1);
+        char *readName = stString_print("%s_read%" PRId64 "_hap%" PRId64, contig, readNo, hap + 1);
+        SimRead *read = sim_read(readName, contig, haplotypes[hap], hapToRefs[hap], start, start + length,
+                                 st_random() < 0.5, polishParams);
+        if (read != NULL) {
+            stList_append(reads, read);
+        }
+        totalLength += length;
+        free(readName);
+    }
+    stList_sort(reads, simRead_cmp);
+    return reads;
+}
+
+/*
+ * Output
+ */
+
+static void sim_writeVcfHeader(FILE *fh, char **contigs, int64_t contigNo, int64_t contigLength) {
+    fprintf(fh, "##fileformat=VCFv4.2\n");
+    fprintf(fh, "##source=simulateWorkload %s\n", MARGIN_POLISH_VERSION_H);
+    for (int64_t i = 0; i < contigNo; i++) {
+        fprintf(fh, "##contig=<ID=%s,length=%" PRId64 ">\n", contigs[i], contigLength);
+    }
+    fprintf(fh, "##FORMAT=<ID=GT,Number=1,Type=String,Description=\"Genotype\">\n");
+    fprintf(fh, "##FORMAT=<ID=PS,Number=1,Type=Integer,Description=\"Phase set\">\n");
+    fprintf(fh, "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\tFORMAT\tSAMPLE\n");
+}
+
+static void sim_writeVcfEntries(FILE *fh, char *contig, stList *variants) {
+    // the variants of each contig are in a single phase set
+    for (int64_t i = 0; i < stList_length(variants); i++) {
+        SimVariant *variant = stList_get(variants, i);
+        fprintf(fh, "%s\t%" PRId64 "\t.\t%s\t%s\t60\tPASS\t.\tGT:PS\t%d|%d:1\n", contig, variant->pos + 1,
+                variant->ref, variant->alt, variant->onHap[0] ? 1 : 0, variant->onHap[1] ? 1 : 0);
+    }
+}
+
+static void sim_writeReads(samFile *out, bam_hdr_t *bamHdr, stList *reads) {
+    bam1_t *aln = bam_init1();
+    for (int64_t i = 0; i < stList_length(reads); i++) {
+        SimRead *read = stList_get(reads, i);
+        kstring_t str = { strlen(read->samLine), strlen(read->samLine) + 1, read->samLine };
+        if (sam_parse1(&str, bamHdr, aln) < 0 || sam_write1(out, bamHdr, aln) < 0) {
+            st_errAbort("Could not write simulated read: %s\n", read->samLine);
+        }
+    }
+    bam_destroy1(aln);
+}
+
+void usage() {
+    fprintf(stderr, "usage: simulateWorkload [options] PARAMS OUTPUT_BASE\n");
+    fprintf(stderr, "Version: %s \n\n", MARGIN_POLISH_VERSION_H);
+    fprintf(stderr, "Simulates a diploid genome and long reads of it, with the errors of the read model in PARAMS,\n");
+    fprintf(stderr, "for benchmarking. Writes the reference to OUTPUT_BASE.fa, the phased variants of the genome to\n");
+    fprintf(stderr, "OUTPUT_BASE.truth.vcf and the reads' alignments to OUTPUT_BASE.bam, with their indices.\n");
+    fprintf(stderr, "The reads of a contig are held in memory while they are sorted.\n");
+
+    fprintf(stderr, "\nDefault options:\n");
+    fprintf(stderr, "    -h --help                   : Print this help screen\n");
+    fprintf(stderr, "    -a --logLevel               : Set the log level [default = critical]\n");
+    fprintf(stderr, "    -s --seed                   : Seed of the random numbers [default = 1]\n");
+    fprintf(stderr, "    -c --contigs                : Number of contigs [default = 1]\n");
+    fprintf(stderr, "    -l --contigLength           : Length of each contig [default = 1000000]\n");
+    fprintf(stderr, "    -d --depth                  : Depth of the reads [default = 30]\n");
+    fprintf(stderr, "    -L --readLength             : Mean read length, log normally distributed [default = 10000]\n");
+    fprintf(stderr, "    -H --hetRate                : Heterozygous variants per base [default = 0.001]\n");
+    fprintf(stderr, "    -O --homRate                : Homozygous variants per base [default = 0.0005]\n");
+    fprintf(stderr, "    -i --indelFraction          : Fraction of variants that are indels [default = 0.15]\n");
+    fprintf(stderr, "    -m --homopolymerIndels      : Fraction of indels that change a homopolymer's length\n");
+    fprintf(stderr, "                                  [default = 0.5]\n");
+    fprintf(stderr, "    -n --indelExtension         : Probability an indel is extended by another base\n");
+    fprintf(stderr, "                                  [default = 0.5]\n");
+    fprintf(stderr, "    -x --homopolymerExtension   : Probability a reference homopolymer is extended by another\n");
+    fprintf(stderr, "                                  base [default = 0.35]\n");
+
+    fprintf(stderr, "\n");
+}
+
+static double sim_parseFraction(char *optarg, char *name) {
+    double value = atof(optarg);
+    if (value < 0.0 || value > 1.0) {
+        st_errAbort("Invalid %s, expected a value from 0 to 1: %s", name, optarg);
+    }
+    return value;
+}
+
+int main(int argc, char *argv[]) {
+
+    // Parameters / arguments
+    char *logLevelString = stString_copy("critical");
+    int64_t seed = 1;
+    SimOptions options = { 1, 1000000, 30.0, 10000, 0.001, 0.0005, 0.15, 0.5, 0.5, 0.35 };
+
+    // Parse the options
+    while (1) {
+        static struct option long_options[] = {
+                { "help", no_argument, 0, 'h' },
+                { "logLevel", required_argument, 0, 'a' },
+                { "seed", required_argument, 0, 's'},
+                { "contigs", required_argument, 0, 'c'},
+                { "contigLength", required_argument, 0, 'l'},
+                { "depth", required_argument, 0, 'd'},
+                { "readLength", required_argument, 0, 'L'},
+                { "hetRate", required_argument, 0, 'H'},
+                { "homRate", required_argument, 0, 'O'},
+                { "indelFraction", required_argument, 0, 'i'},
+                { "homopolymerIndels", required_argument, 0, 'm'},
+                { "indelExtension", required_argument, 0, 'n'},
+                { "homopolymerExtension", required_argument, 0, 'x'},
+                { 0, 0, 0, 0 } };
+
+        int option_index = 0;
+        int key = getopt_long(argc, argv, "ha:s:c:l:d:L:H:O:i:m:n:x:", long_options, &option_index);
+
+        if (key == -1) {
+            break;
+        }
+
+        switch (key) {
+        case 'a':
+            free(logLevelString);
+            logLevelString = stString_copy(optarg);
+            break;
+        case 'h':
+            usage();
+            return 0;
+        case 's':
+            seed = atol(optarg);
+            break;
+        case 'c':
+            options.contigNo = atol(optarg);
+            if (options.contigNo <= 0) {
+                st_errAbort("Invalid contig count: %s", optarg);
+            }
+            break;
+        case 'l':
+            options.contigLength = atol(optarg);
+            if (options.contigLength < 2 * SIM_MAX_INDEL_LENGTH) {
+                st_errAbort("Invalid contig length, expected at least %d: %s", 2 * SIM_MAX_INDEL_LENGTH, optarg);
+            }
+            break;
+        case 'd':
+            options.depth = atof(optarg);
+            if (options.depth <= 0) {
+                st_errAbort("Invalid depth: %s", optarg);
+            }
+            break;
+        case 'L':
+            options.meanReadLength = atol(optarg);
+            if (options.meanReadLength < SIM_MIN_READ_LENGTH) {
+                st_errAbort("Invalid read length, expected at least %d: %s", SIM_MIN_READ_LENGTH, optarg);
+            }
+            break;
+        case 'H':
+            options.hetRate = sim_parseFraction(optarg, "het rate");
+            break;
+        case 'O':
+            options.homRate = sim_parseFraction(optarg, "hom rate");
+            break;
+        case 'i':
+            options.indelFraction = sim_parseFraction(optarg, "indel fraction");
+            break;
+        case 'm':
+            options.homopolymerIndelFraction = sim_parseFraction(optarg, "homopolymer indel fraction");
+            break;
+        case 'n':
+            options.indelExtension = sim_parseFraction(optarg, "indel extension");
+            break;
+        case 'x':
+            options.homopolymerExtension = sim_parseFraction(optarg, "homopolymer extension");
+            break;
+        default:
+            usage();
+            return 0;
+        }
+    }
+
+    if (optind + 2 != argc) {
+        usage();
+        return 1;
+    }
+    char *paramsFile = argv[optind];
+    char *outputBase = argv[optind + 1];
+    if (options.hetRate + options.homRate > 1.0) {
+        st_errAbort("The het and hom rates sum to more than 1\n");
+    }
+
+    st_setLogLevelFromString(logLevelString);
+    free(logLevelString);
+    st_randomSeed(seed);
+
+    // the read model
+    if (access(paramsFile, R_OK) != 0) {
+        st_errAbort("Could not read from params file: %s\n", paramsFile);
+    }
+    Params *params = params_readParams(paramsFile);
+    PolishParams *polishParams = params->polishParams;
+    if (polishParams->stateMachineForForwardStrandRead->stateNumber != SM3_STATES ||
+        polishParams->stateMachineForReverseStrandRead->stateNumber != SM3_STATES) {
+        st_errAbort("Reads can only be simulated with three state read models\n");
+    }
+
+    // the outputs
+    char *fastaFile = stString_print("%s.fa", outputBase);
+    char *vcfFile = stString_print("%s.truth.vcf", outputBase);
+    char *bamFile = stString_print("%s.bam", outputBase);
+    char **contigs = st_malloc(options.contigNo * sizeof(char *));
+    stList *headerLines = stList_construct3(0, free);
+    stList_append(headerLines, stString_print("@HD\tVN:1.6\tSO:coordinate"));
+    for (int64_t i = 0; i < options.contigNo; i++) {
+        contigs[i] = stString_print("sim%" PRId64, i + 1);
+        stList_append(headerLines, stString_print("@SQ\tSN:%s\tLN:%" PRId64, contigs[i], options.contigLength));
+    }
+    stList_append(headerLines, stString_print("@PG\tID:simulateWorkload\tPN:simulateWorkload\tVN:%s\n",
+                                              MARGIN_POLISH_VERSION_H));
+    char *headerText = stString_join2("\n", headerLines);
+    bam_hdr_t *bamHdr = sam_hdr_parse(strlen(headerText), headerText);
+    samFile *out = hts_open(bamFile, "wb");
+    if (bamHdr == NULL || out == NULL || sam_hdr_write(out, bamHdr) < 0) {
+        st_errAbort("Could not write to bam file: %s\n", bamFile);
+    }
+    FILE *fastaFh = safe_fopen(fastaFile, "w");
+    FILE *vcfFh = safe_fopen(vcfFile, "w");
+    sim_writeVcfHeader(vcfFh, contigs, options.contigNo, options.contigLength);
+
+    // each contig is simulated and written in turn
+    int64_t totalVariants = 0, totalReads = 0;
+    for (int64_t i = 0; i < options.contigNo; i++) {
+        char *reference = sim_reference(options.contigLength, &options);
+        stList *variants = sim_variants(reference, options.contigLength, &options);
+        char *haplotypes[2];
+        int64_t *hapToRefs[2];
+        for (int64_t hap = 0; hap < 2; hap++) {
+            haplotypes[hap] = sim_haplotype(reference, options.contigLength, variants, hap, &hapToRefs[hap]);
+        }
+        stList *reads = sim_reads(contigs[i], haplotypes, hapToRefs, options.contigLength, &options, polishParams);
+        st_logCritical("> Simulated %s with %" PRId64 " variants and %" PRId64 " reads\n", contigs[i],
+                       stList_length(variants), stList_length(reads));
+
+        fastaWrite(reference, contigs[i], fastaFh);
+        sim_writeVcfEntries(vcfFh, contigs[i], variants);
+        sim_writeReads(out, bamHdr, reads);
+        totalVariants += stList_length(variants);
+        totalReads += stList_length(reads);
+
+        // cleanup
+        stList_destruct(reads);
+        for (int64_t hap = 0; hap < 2; hap++) {
+            free(haplotypes[hap]);
+            free(hapToRefs[hap]);
+        }
+        stList_destruct(variants);
+        free(reference);
+    }
+    fclose(fastaFh);
+    fclose(vcfFh);
+    hts_close(out);
+
+    // the indices
+    if (fai_build(fastaFile) != 0) {
+        st_errAbort("Could not index fasta file: %s\n", fastaFile);
+    }
+    if (sam_index_build(bamFile, 0) != 0) {
+        st_errAbort("Could not index bam file: %s\n", bamFile);
+    }
+    st_logCritical("> Wrote %" PRId64 " contigs, %" PRId64 " variants and %" PRId64 " reads to %s.*\n",
+                   options.contigNo, totalVariants, totalReads, outputBase);
+
+    // cleanup
+    bam_hdr_destroy(bamHdr);
+    free(headerText);
+    stList_destruct(headerLines);
+    for (int64_t i = 0; i < options.contigNo; i++) {
+        free(contigs[i]);
+    }
+    free(contigs);
+    free(fastaFile);
+    free(vcfFile);
+    free(bamFile);
+    params_destruct(params);
+
+    return 0;
+}
@@ -13,11 +13,170 @@
 #include <time.h>
 #include "marginVersion.h"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <htslib/thread_pool.h>
 #include "margin.h"
 #include "htsIntegration.h"
 #include "helenFeatures.h"
 
+// number of records read, tagged in parallel, and written at a time
+#define TAG_BATCH_SIZE 65536
+
+
+/*
+ * Read haplotags, held in an open addressing hash table whose keys point into the memory mapped info file, so there
+ * is no per-read allocation however many reads are tagged
+ */
+
+typedef struct _readTag {
+    uint64_t hash; // zero for an empty slot
+    const char *readName; // not NUL terminated, points into the mapped file
+    uint32_t readNameLength;
+    int8_t haplotag; // -1 for untagged (none/H0), 1 or 2
+} ReadTag;
+
+typedef struct _readTagTable {
+    ReadTag *slots;
+    uint64_t mask;
+    int64_t size;
+    char *mappedFile;
+    size_t mappedFileLength;
+} ReadTagTable;
+
+static uint64_t readTag_hash(const char *readName, uint32_t readNameLength) {
+    // FNV-1a, never zero
+    uint64_t hash = 14695981039346656037ULL;
+    for (uint32_t i = 0; i < readNameLength; i++) {
+        hash = (hash ^ (uint8_t) readName[i]) * 1099511628211ULL;
+    }
+    return hash == 0 ? 1 : hash;
+}
+
+static ReadTag *readTagTable_getSlot(ReadTagTable *table, const char *readName, uint32_t readNameLength,
+                                     uint64_t hash) {
+    // linear probing, returns the read's slot or the empty slot it would go in
+    for (uint64_t i = hash & table->mask;; i = (i + 1) & table->mask) {
+        ReadTag *slot = &(table->slots[i]);
+        if (slot->hash == 0 || (slot->hash == hash && slot->readNameLength == readNameLength &&
+                                memcmp(slot->readName, readName, readNameLength) == 0)) {
+            return slot;
+        }
+    }
+}
+
+static ReadTag *readTagTable_search(ReadTagTable *table, const char *readName) {
+    uint32_t readNameLength = (uint32_t) strlen(readName);
+    ReadTag *slot = readTagTable_getSlot(table, readName, readNameLength, readTag_hash(readName, readNameLength));
+    return slot->hash == 0 ? NULL : slot;
+}
+
+static bool readTag_fieldEq(const char *field, int64_t fieldLength, const char *str) {
+    return fieldLength == strlen(str) && strncmp(field, str, fieldLength) == 0;
+}
+
+static ReadTagTable *readTagTable_construct(char *readInfoFile, int64_t *hap1Count, int64_t *hap2Count) {
+    ReadTagTable *table = st_calloc(1, sizeof(ReadTagTable));
+    *hap1Count = 0;
+    *hap2Count = 0;
+
+    // map the file
+    int fd = open(readInfoFile, O_RDONLY);
+    struct stat fileStat;
+    if (fd < 0 || fstat(fd, &fileStat) != 0) {
+        st_errAbort("Could not open read info file %s\n", readInfoFile);
+    }
+    table->mappedFileLength = (size_t) fileStat.st_size;
+    if (table->mappedFileLength > 0) {
+        table->mappedFile = mmap(NULL, table->mappedFileLength, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (table->mappedFile == MAP_FAILED) {
+            st_errAbort("Could not map read info file %s\n", readInfoFile);
+        }
+        madvise(table->mappedFile, table->mappedFileLength, MADV_SEQUENTIAL);
+    }
+    close(fd);
+    char *file = table->mappedFile, *fileEnd = table->mappedFile + table->mappedFileLength;
+
+    // size the table for at most half full
+    int64_t lineCount = 1;
+    for (char *c = file; c < fileEnd && (c = memchr(c, '\n', fileEnd - c)) != NULL; c++) {
+        lineCount++;
+    }
+    uint64_t capacity = 16;
+    while (capacity < 2 * (uint64_t) lineCount) {
+        capacity *= 2;
+    }
+    table->slots = st_calloc(capacity, sizeof(ReadTag));
+    table->mask = capacity - 1;
+
+    // parse lines of "read_id\thaplotag\t..."
+    int64_t linenr = -1;
+    for (char *line = file; line < fileEnd;) {
+        char *lineEnd = memchr(line, '\n', fileEnd - line);
+        if (lineEnd == NULL) lineEnd = fileEnd;
+        linenr++;
+
+        // header
+        if (lineEnd == line || line[0] == '#') {
+            line = lineEnd + 1;
+            continue;
+        }
+
+        // get line parts
+        char *field = line;
+        while (field < lineEnd && isspace(*field)) field++;
+        char *readName = field;
+        while (field < lineEnd && !isspace(*field)) field++;
+        uint32_t readNameLength = (uint32_t) (field - readName);
+        while (field < lineEnd && isspace(*field)) field++;
+        char *htInfo = field;
+        while (field < lineEnd && !isspace(*field)) field++;
+        int64_t htInfoLength = field - htInfo;
+        if (readNameLength == 0 || htInfoLength == 0) {
+            st_errAbort("Expected read id and haplotag descriptor on line %"PRId64": \"%.*s\"", linenr,
+                        (int) (lineEnd - line), line);
+        }
+
+        // haplotag
+        int8_t ht = -1;
+        if (readTag_fieldEq(htInfo, htInfoLength, "H1") || readTag_fieldEq(htInfo, htInfoLength, "HP:i:1")) {
+            ht = 1;
+            (*hap1Count)++;
+        } else if (readTag_fieldEq(htInfo, htInfoLength, "H2") || readTag_fieldEq(htInfo, htInfoLength, "HP:i:2")) {
+            ht = 2;
+            (*hap2Count)++;
+        } else if (!(readTag_fieldEq(htInfo, htInfoLength, "none") || readTag_fieldEq(htInfo, htInfoLength, "H0") ||
+                     readTag_fieldEq(htInfo, htInfoLength, "HP:i:0"))) {
+            st_errAbort("Unexpected haplotag descriptor, see --help for possible values: %.*s\n\tline %"PRId64": \"%.*s\"",
+                        (int) htInfoLength, htInfo, linenr, (int) (lineEnd - line), line);
+        }
+
+        // save, a later line for the same read replaces an earlier one
+        uint64_t hash = readTag_hash(readName, readNameLength);
+        ReadTag *slot = readTagTable_getSlot(table, readName, readNameLength, hash);
+        if (slot->hash == 0) {
+            slot->hash = hash;
+            slot->readName = readName;
+            slot->readNameLength = readNameLength;
+            table->size++;
+        }
+        slot->haplotag = ht;
+
+        line = lineEnd + 1;
+    }
+
+    return table;
+}
+
+static void readTagTable_destruct(ReadTagTable *table) {
+    if (table->mappedFile != NULL) {
+        munmap(table->mappedFile, table->mappedFileLength);
+    }
+    free(table->slots);
+    free(table);
+}
+
 
 /*
  * Main functions
@@ -58,6 +217,9 @@ int main(int argc, char *argv[]) {
         tc = atoi(argv[4]);
         st_logCritical("Using %d threads.\n", tc);
     }
+    # ifdef _OPENMP
+    omp_set_num_threads(tc > 0 ? tc : 1);
+    # endif
 
     // for logging
     st_setLogLevel(critical);
@@ -71,49 +233,11 @@ int main(int argc, char *argv[]) {
     }
 
     // get read info
-    stHash *readInfo = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, free, NULL);
-    FILE *fp = fopen(readInfoFile, "r");
-    if (fp == NULL) {
-        st_errAbort("Could not open read info file %s\n", readInfoFile);
-    }
-    char *line = NULL;
-    int linenr = -1;
-    int hap1Count = 0;
-    int hap2Count = 0;
-    while ((line = stFile_getLineFromFile(fp)) != NULL) {
-        linenr++;
-        // header
-        if (strlen(line) == 0 || line[0] == '#') {
-            free(line);
-            continue;
-        }
-        // get line parts
-        stList *elements = stString_split(line);
-        assert(stList_length(elements) >= 2);
-        // read name
-        char *readName = stString_copy(stList_get(elements, 0));
-        // haplotag
-        int64_t ht = -1;
-        char *htInfo = stList_get(elements, 1);
-        if (stString_eq(htInfo, "H1") || stString_eq(htInfo, "HP:i:1")) {
-            ht = 1;
-            hap1Count++;
-        } else if (stString_eq(htInfo, "H2") || stString_eq(htInfo, "HP:i:2")) {
-            ht = 2;
-            hap2Count++;
-        } else if (!(stString_eq(htInfo, "none") || stString_eq(htInfo, "H0") || stString_eq(htInfo, "HP:i:0"))) {
-            st_errAbort("Unexpected haplotag descriptor, see --help for possible values: %s\n\tline %d: \"%s\"",
-                        htInfo, linenr, line);
-        }
-        // save
-        st_logInfo("  Saving %s with tag value %"PRId64"\n", readName, ht);
-        stHash_insert(readInfo, readName, (void*)ht);
-        // cleanup
-        stList_destruct(elements);
-        free(line);
-    }
-    fclose(fp);
-    st_logCritical("Read %"PRId64" read haplotags, with %d H1 and %d H2\n", stHash_size(readInfo), hap1Count, hap2Count);
+    int64_t hap1Count = 0;
+    int64_t hap2Count = 0;
+    ReadTagTable *readInfo = readTagTable_construct(readInfoFile, &hap1Count, &hap2Count);
+    st_logCritical("Read %"PRId64" read haplotags, with %"PRId64" H1 and %"PRId64" H2\n", readInfo->size,
+                   hap1Count, hap2Count);
 
     // counting
     int64_t h1Count = 0;
@@ -129,7 +253,6 @@ int main(int argc, char *argv[]) {
         st_errAbort("ERROR: Cannot open bam file %s\n", bamInFile);
     }
     bam_hdr_t *bamHdr = sam_hdr_read(in);
-    bam1_t *aln = bam_init1();
     int r;
 
     // open bam to write to
@@ -146,48 +269,71 @@ int main(int argc, char *argv[]) {
     hts_set_opt(in, HTS_OPT_THREAD_POOL, &threadPool);
     hts_set_opt(out, HTS_OPT_THREAD_POOL, &threadPool);
 
-    // fetch alignments
-    while (sam_read1(in,bamHdr,aln) >= 0) {
-        // get haplotag value
-        char *readName = bam_get_qname(aln);
-        int32_t hp = 0;
-        if (stHash_search(readInfo, readName) == NULL) {
-            st_logInfo("Did not find %s in read info\n", readName);
-            hUnCount++;
-        } else {
-            int64_t foundTag = (int64_t) stHash_search(readInfo, readName);
-            if (foundTag == -1) {
+    // fetch alignments in batches, tagging each batch in parallel and writing it in order
+    bam1_t **alns = st_malloc(sizeof(bam1_t *) * TAG_BATCH_SIZE);
+    for (int64_t i = 0; i < TAG_BATCH_SIZE; i++) {
+        alns[i] = bam_init1();
+    }
+    int64_t batchLength = TAG_BATCH_SIZE;
+    while (batchLength == TAG_BATCH_SIZE) {
+        batchLength = 0;
+        while (batchLength < TAG_BATCH_SIZE && (r = sam_read1(in, bamHdr, alns[batchLength])) >= 0) {
+            batchLength++;
+        }
+        if (r < -1) {
+            st_errAbort("ERROR: Could not read from bam file %s\n", bamInFile);
+        }
+
+        # ifdef _OPENMP
+        #pragma omp parallel for schedule(static) reduction(+:h0Count,h1Count,h2Count,hUnCount)
+        # endif
+        for (int64_t i = 0; i < batchLength; i++) {
+            bam1_t *aln = alns[i];
+
+            // get haplotag value
+            char *readName = bam_get_qname(aln);
+            int32_t hp = 0;
+            ReadTag *foundTag = readTagTable_search(readInfo, readName);
+            if (foundTag == NULL) {
+                st_logInfo("Did not find %s in read info\n", readName);
+                hUnCount++;
+            } else if (foundTag->haplotag == -1) {
                 h0Count++;
-            } else if (foundTag == 1) {
+            } else if (foundTag->haplotag == 1) {
                 hp = 1;
                 h1Count++;
-            } else if (foundTag == 2) {
+            } else {
                 hp = 2;
                 h2Count++;
+            }
+
+            if (bam_aux_get(aln, "HP") != NULL) {
+                bam_aux_update_int(aln, "HP", hp);
             } else {
-                st_errAbort("Got haplotag value %"PRId64" for read %s!", foundTag, readName);
+                bam_aux_append(aln, "HP", 'i', sizeof(hp), (uint8_t*) &hp);
             }
         }
 
-        st_logInfo("Writing read %s with tag %"PRId32"\n", readName, hp);
-        if (bam_aux_get(aln, "HP") != NULL) {
-            bam_aux_update_int(aln, "HP", hp);
-        } else {
-            bam_aux_append(aln, "HP", 'i', sizeof(hp), (uint8_t*) &hp);
+        for (int64_t i = 0; i < batchLength; i++) {
+            if (sam_write1(out, bamHdr, alns[i]) < 0) {
+                st_errAbort("ERROR: Could not write to bam file %s\n", bamOutFile);
+            }
         }
-        r = sam_write1(out, bamHdr, aln);
     }
     st_logCritical("Wrote reads with divisions: H1 %"PRId64", H2 %"PRId64", and H0 %"PRId64"\n",
                h1Count, h2Count, h0Count);
     st_logCritical("Found %"PRId64" reads which were not annotated in info file (tagged as H0, but not counted above).\n", hUnCount);
 
     // Cleanup
-    bam_destroy1(aln);
+    for (int64_t i = 0; i < TAG_BATCH_SIZE; i++) {
+        bam_destroy1(alns[i]);
+    }
+    free(alns);
     bam_hdr_destroy(bamHdr);
     sam_close(in);
     sam_close(out);
     hts_tpool_destroy(threadPool.pool);
-    stHash_destruct(readInfo);
+    readTagTable_destruct(readInfo);
 
     st_logInfo("Fin.");
 
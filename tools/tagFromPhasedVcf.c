@@ -44,7 +44,7 @@ void usage() {
     fprintf(stderr, "    -o --outputBase          : Name to use for output files [default = 'output']\n");
     fprintf(stderr, "    -r --region              : If set, will only compute for given chromosomal region\n");
     fprintf(stderr, "                                 Format: chr:start_pos-end_pos (chr3:2000-3000)\n");
-    fprintf(stderr, "    -k --tempFilesToDisk     : Write temporary files to disk (for --diploid or supplementary output)\n");
+    fprintf(stderr, "    -k --tempFilesToDisk     : Ignored, no temporary files are written (kept for compatibility)\n");
 
     fprintf(stderr, "\n");
 }
@@ -61,7 +61,6 @@ int main(int argc, char *argv[]) {
     char *regionStr = NULL;
     char *vcfFile = NULL;
     int numThreads = 1;
-    bool inMemory = TRUE;
 
     if (argc < 4) {
         free(outputBase);
@@ -117,7 +116,6 @@ int main(int argc, char *argv[]) {
             }
             break;
         case 'k':
-            inMemory = FALSE;
             break;
         default:
             usage();
@@ -189,6 +187,7 @@ int main(int argc, char *argv[]) {
     // get chunker for bam.  if regionStr is NULL, it will be ignored
     time_t chunkingStart = time(NULL);
     BamChunker *bamChunker = bamChunker_construct2(bamInFile, regionStr, vcfContigs, params->polishParams, TRUE);
+    bamChunker_setCramReference(bamChunker, referenceFastaFile);
     char *regionStrInformative = regionStr != NULL ? stString_copy(regionStr) : stString_join2(",", vcfContigsTmp);
     st_logCritical(
             "> Set up bam chunker in %"PRId64"s with chunk size %i and overlap %i (for region=%s), resulting in %i total chunks\n",
@@ -201,9 +200,8 @@ int main(int argc, char *argv[]) {
     stList_destruct(vcfContigsTmp);
     stSet_destruct(vcfContigs);
 
-    // output chunker tracks intermediate output files
-    OutputChunkers *outputChunkers = outputChunkers_construct(numThreads, params, NULL, NULL, NULL, NULL,
-            ".hap1", ".hap2", inMemory);
+    // summed haplotype scores of each read (by name) over all chunks
+    stHash *readScores = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, free, free);
 
     // (may) need to shuffle chunks
     stList *chunkOrder = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
@@ -221,18 +219,26 @@ int main(int argc, char *argv[]) {
                 st_logCritical("> Randomly shuffling chunks\n");
                 stList_shuffle(chunkOrder);
                 break;
+            case SCM_COST_DESC:
+                st_logCritical("> Ordering chunks by predicted cost\n");
+                break;
         }
     }
 
+    // each thread takes chunks from the scheduler until there are none left
+    bool predictChunkCost = params->polishParams->shuffleChunks &&
+            params->polishParams->shuffleChunksMethod == SCM_COST_DESC;
+    ChunkScheduler *chunkScheduler = chunkScheduler_construct(bamChunker, chunkOrder, numThreads, predictChunkCost);
+
     // multiproccess the chunks, save to results
     st_logCritical("> Setup complete, beginning run\n");
     int64_t lastReportedPercentage = 0;
     time_t polishStartTime = time(NULL);
 
     # ifdef _OPENMP
-    #pragma omp parallel for schedule(dynamic,1)
+    #pragma omp parallel
     # endif
-    for (int64_t i = 0; i < bamChunker->chunkCount; i++) {
+    for (int64_t i = 0; chunkScheduler_next(chunkScheduler, &i);) {
         int64_t chunkIdx = stIntTuple_get(stList_get(chunkOrder, i), 0);
         // Time all chunks
         time_t chunkStartTime = time(NULL);
@@ -291,36 +297,32 @@ int main(int argc, char *argv[]) {
         stList *reads = stList_construct3(0, (void (*)(void *)) bamChunkRead_destruct);
         extractReadSubstringsAtVariantPositions(bamChunk, chunkVcfEntries, reads, NULL, params->polishParams);
 
-        time_t primaryPhasingStart = time(NULL);
-
-        // iteratively find bubbles
-        int64_t bubbleFindingIteration = 0;
-        BubbleGraph *bg = NULL;
-        stSet *readsBelongingToHap1 = stSet_construct(), *readsBelongingToHap2 = stSet_construct();
-        stList *vcfEntriesToBubbles = NULL;
-
-        // Get the bubble graph representation
-        bg =  bubbleGraph_constructFromVCFAndBamChunkReadVcfEntrySubstrings(reads, chunkVcfEntries, params,
-                &vcfEntriesToBubbles);
+        // score the reads against the phased variants of the chunk's core, so that reads spanning a chunk
+        // boundary are scored against each of their variants exactly once over the run
+        stHash *chunkReadScores = bubbleGraph_scoreReadsAgainstPhasedVcfEntries(reads, chunkVcfEntries,
+                bamChunk->chunkStart, bamChunk->chunkEnd, params);
 
-        bubbleGraph_partitionFilteredReadsFromPhasedVcfEntries(reads, bg, vcfEntriesToBubbles, readsBelongingToHap1,
-                readsBelongingToHap2, params, logIdentifier);
-
-        // Output
-        stGenomeFragment *gF = stGenomeFragment_constructEmpty(NULL, 0, 1,
-                stSet_construct3(stHash_stringKey, stHash_stringEqualKey, free),
-                stSet_construct3(stHash_stringKey, stHash_stringEqualKey, free));
-        outputChunkers_processChunkSequencePhased(outputChunkers, threadIdx, chunkIdx, bamChunk->refSeqName,
-                                                  NULL, NULL, reads, readsBelongingToHap1, readsBelongingToHap2, gF,
-                                                  params);
+        // add to the scores of the whole run
+        # ifdef _OPENMP
+        #pragma omp critical
+        # endif
+        {
+            for (int64_t j = 0; j < stList_length(reads); j++) {
+                BamChunkRead *bcr = stList_get(reads, j);
+                double *chunkReadScore = stHash_search(chunkReadScores, bcr);
+                double *readScore = stHash_search(readScores, bcr->readName);
+                if (readScore == NULL) {
+                    readScore = st_calloc(2, sizeof(double));
+                    stHash_insert(readScores, stString_copy(bcr->readName), readScore);
+                }
+                readScore[0] += chunkReadScore[0];
+                readScore[1] += chunkReadScore[1];
+            }
+        }
 
         // Cleanup
         if (chunkVcfEntries != NULL) stList_destruct(chunkVcfEntries);
-        stSet_destruct(readsBelongingToHap1);
-        stSet_destruct(readsBelongingToHap2);
-        bubbleGraph_destruct(bg);
-        stGenomeFragment_destruct(gF);
-        stList_destruct(vcfEntriesToBubbles);
+        stHash_destruct(chunkReadScores);
         free(chunkReference);
 
         // report timing
@@ -332,40 +334,31 @@ int main(int argc, char *argv[]) {
         // final post-completion logging cleanup
         stList_destruct(reads);
         free(logIdentifier);
+        chunkScheduler_finish(chunkScheduler, i);
     }
+    chunkScheduler_destruct(chunkScheduler);
 
-    // for writing haplotyped chunks
-    stList *allReadIdsHap1 = stList_construct3(0, free);
-    stList *allReadIdsHap2 = stList_construct3(0, free);
-
-    // merge chunks
-    time_t mergeStartTime = time(NULL);
-    st_logCritical("> Starting merge\n");
-    outputChunkers_stitchAndTrackExtraData(outputChunkers, TRUE, bamChunker->chunkCount, allReadIdsHap1, allReadIdsHap2,
-            NULL);
-    time_t mergeEndTime = time(NULL);
-    char *tds = getTimeDescriptorFromSeconds((int) mergeEndTime - mergeStartTime);
-    st_logCritical("> Merging took %s\n", tds);
-    outputChunkers_destruct(outputChunkers);
-    free(tds);
-    tds = getTimeDescriptorFromSeconds((int) time(NULL) - mergeEndTime);
-    st_logCritical("> Merge cleanup took %s\n", tds);
-    free(tds);
-
-    // maybe write final haplotyped bams
-    // logging
-    time_t hapBamStart = time(NULL);
-    st_logInfo("> Writing final haplotyped BAMs\n");
-
-    // get all reads
+    // assign each read to the haplotype it scored best against
     stSet *allReadIdsForHaplotypingHap1 = stSet_construct3(stHash_stringKey, stHash_stringEqualKey, NULL);
     stSet *allReadIdsForHaplotypingHap2 = stSet_construct3(stHash_stringKey, stHash_stringEqualKey, NULL);
-    for (int64_t i = 0; i < stList_length(allReadIdsHap1); i++) {
-        stSet_insert(allReadIdsForHaplotypingHap1, stList_get(allReadIdsHap1, i));
-    }
-    for (int64_t i = 0; i < stList_length(allReadIdsHap2); i++) {
-        stSet_insert(allReadIdsForHaplotypingHap2, stList_get(allReadIdsHap2, i));
+    stHashIterator *readScoreItor = stHash_getIterator(readScores);
+    char *readName;
+    while ((readName = stHash_getNext(readScoreItor)) != NULL) {
+        double *readScore = stHash_search(readScores, readName);
+        if (readScore[0] > readScore[1]) {
+            stSet_insert(allReadIdsForHaplotypingHap1, readName);
+        } else if (readScore[1] > readScore[0]) {
+            stSet_insert(allReadIdsForHaplotypingHap2, readName);
+        }
     }
+    stHash_destructIterator(readScoreItor);
+    st_logCritical("> Of %"PRId64" reads: %"PRId64" were hap1, %"PRId64" were hap2\n", stHash_size(readScores),
+                   stSet_size(allReadIdsForHaplotypingHap1), stSet_size(allReadIdsForHaplotypingHap2));
+
+    // write final haplotyped bams
+    // logging
+    time_t hapBamStart = time(NULL);
+    st_logInfo("> Writing final haplotyped BAMs\n");
 
     // write it
     writeHaplotaggedBam(bamChunker->bamFile, outputBase, regionStr,
@@ -379,16 +372,17 @@ int main(int argc, char *argv[]) {
     free(hapBamTDS);
     stSet_destruct(allReadIdsForHaplotypingHap1);
     stSet_destruct(allReadIdsForHaplotypingHap2);
+    stHash_destruct(readScores);
 
     // cleanup
     bamChunker_destruct(bamChunker);
+    referenceCache_destruct();
+    htsThreadPool_destruct();
     params_destruct(params);
     if (regionStr != NULL) free(regionStr);
     stList_destruct(chunkOrder);
     free(vcfFile);
     stHash_destruct(vcfEntries);
-    if (allReadIdsHap1 != NULL) stList_destruct(allReadIdsHap1);
-    if (allReadIdsHap2 != NULL) stList_destruct(allReadIdsHap2);
     free(outputBase);
     free(bamInFile);
     free(referenceFastaFile);
@@ -0,0 +1,355 @@
+/*
+ * Copyright (C) 2018 by Benedict Paten (benedictpaten@gmail.com)
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <memory.h>
+#include <hashTableC.h>
+#include <unistd.h>
+#include <time.h>
+#include "marginVersion.h"
+
+#include "margin.h"
+#include "htsIntegration.h"
+#include "helenFeatures.h"
+
+
+/*
+ * Main functions
+ */
+
+void usage() {
+    fprintf(stderr, "usage: trainHmm <ALIGN_BAM> <REFERENCE_FASTA> <PARAMS> [options]\n");
+    fprintf(stderr, "Version: %s \n\n", MARGIN_POLISH_VERSION_H);
+    fprintf(stderr, "Trains the read to reference hmm of PARAMS by Baum-Welch on the reads in ALIGN_BAM.\n");
+
+    fprintf(stderr, "\nRequired arguments:\n");
+    fprintf(stderr, "    ALIGN_BAM is the alignment of reads to the reference.\n");
+    fprintf(stderr, "    REFERENCE_FASTA is the reference sequence BAM file in fasta format.\n");
+    fprintf(stderr, "    PARAMS is the file with margin parameters, whose hmm is the starting point.\n");
+
+    fprintf(stderr, "\nDefault options:\n");
+    fprintf(stderr, "    -h --help                : Print this help screen\n");
+    fprintf(stderr, "    -a --logLevel            : Set the log level [default = info]\n");
+# ifdef _OPENMP
+    fprintf(stderr, "    -t --threads             : Set number of concurrent threads [default = 1]\n");
+#endif
+    fprintf(stderr, "    -o --outputBase          : Name to use for output files [default = 'output']\n");
+    fprintf(stderr, "    -r --region              : If set, will only train on the given chromosomal region\n");
+    fprintf(stderr, "                                 Format: chr:start_pos-end_pos (chr3:2000-3000)\n");
+    fprintf(stderr, "    -p --depth               : Will override the downsampling depth set in PARAMS\n");
+    fprintf(stderr, "    -i --iterations          : Number of Baum-Welch iterations (default 3)\n");
+    fprintf(stderr, "    -c --pseudocount         : Pseudocount added to each expectation (default 0.000000000001)\n");
+    fprintf(stderr, "\nThe trained hmm is written to OUTPUT_BASE.hmm.json, in the form of params that can be included\n");
+    fprintf(stderr, "in a params file.\n");
+
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char *argv[]) {
+
+    // Parameters / arguments
+    char *logLevelString = stString_copy("critical");
+    char *bamInFile = NULL;
+    char *referenceFastaFile = NULL;
+    char *paramsFile = NULL;
+    char *outputBase = stString_copy("output");
+    char *regionStr = NULL;
+    int numThreads = 1;
+    int64_t maxDepth = -1;
+    int64_t iterations = 3;
+    double pseudocount = 0.000000000001;
+
+    if (argc < 4) {
+        free(outputBase);
+        free(logLevelString);
+        usage();
+        return 0;
+    }
+
+    bamInFile = stString_copy(argv[1]);
+    referenceFastaFile = stString_copy(argv[2]);
+    paramsFile = stString_copy(argv[3]);
+
+    // Parse the options
+    while (1) {
+        static struct option long_options[] = {
+                { "help", no_argument, 0, 'h' },
+                { "logLevel", required_argument, 0, 'a' },
+# ifdef _OPENMP
+                { "threads", required_argument, 0, 't'},
+#endif
+                { "outputBase", required_argument, 0, 'o'},
+                { "region", required_argument, 0, 'r'},
+                { "depth", required_argument, 0, 'p'},
+                { "iterations", required_argument, 0, 'i'},
+                { "pseudocount", required_argument, 0, 'c'},
+                { 0, 0, 0, 0 } };
+
+        int option_index = 0;
+        int key = getopt_long(argc-2, &argv[2], "ha:o:p:t:r:i:c:", long_options, &option_index);
+
+        if (key == -1) {
+            break;
+        }
+
+        switch (key) {
+        case 'a':
+            free(logLevelString);
+            logLevelString = stString_copy(optarg);
+            break;
+        case 'h':
+            usage();
+            return 0;
+        case 'o':
+            free(outputBase);
+            outputBase = getFileBase(optarg, "output");
+            break;
+        case 'r':
+            regionStr = stString_copy(optarg);
+            break;
+        case 'p':
+            maxDepth = atoi(optarg);
+            if (maxDepth < 0) {
+                st_errAbort("Invalid maxDepth: %s", optarg);
+            }
+            break;
+        case 't':
+            numThreads = atoi(optarg);
+            if (numThreads <= 0) {
+                st_errAbort("Invalid thread count: %d", numThreads);
+            }
+            break;
+        case 'i':
+            iterations = atoi(optarg);
+            if (iterations < 1) {
+                st_errAbort("Invalid iteration count: %s", optarg);
+            }
+            break;
+        case 'c':
+            pseudocount = atof(optarg);
+            if (pseudocount < 0) {
+                st_errAbort("Invalid pseudocount: %s", optarg);
+            }
+            break;
+        default:
+            usage();
+            free(outputBase);
+            free(logLevelString);
+            free(bamInFile);
+            free(referenceFastaFile);
+            free(paramsFile);
+            return 0;
+        }
+    }
+
+    // sanity check (verify files exist)
+    if (access(bamInFile, R_OK) != 0) {
+        st_errAbort("Could not read from input bam file: %s\n", bamInFile);
+        char *idx = stString_print("%s.bai", bamInFile);
+        if (access(idx, R_OK) != 0) {
+            st_errAbort("BAM does not appear to be indexed: %s\n", bamInFile);
+        }
+        free(idx);
+    }
+    if (access(referenceFastaFile, R_OK) != 0) {
+        st_errAbort("Could not read from reference fastafile: %s\n", referenceFastaFile);
+    }
+    if (access(paramsFile, R_OK) != 0) {
+        st_errAbort("Could not read from params file: %s\n", paramsFile);
+    }
+
+    // Initialization from arguments
+    time_t startTime = time(NULL);
+    st_setLogLevelFromString(logLevelString);
+    free(logLevelString);
+    if (st_getLogLevel() >= info) {
+        st_setCallocDebug(true);
+    }
+# ifdef _OPENMP
+    if (numThreads <= 0) {
+        numThreads = 1;
+    }
+    omp_set_num_threads(numThreads);
+    st_logCritical("Running OpenMP with %d threads.\n", omp_get_max_threads());
+# endif
+
+    // Parse parameters
+    st_logCritical("> Parsing model parameters from file: %s\n", paramsFile);
+    Params *params = params_readParams(paramsFile);
+    StateMachineType hmmType = params->polishParams->stateMachineForForwardStrandRead->type;
+
+    // parameter updates, each base of the reads is counted once
+    st_logInfo("  Setting chunkBoundary to 0\n");
+    params->polishParams->chunkBoundary = 0;
+
+    // update depth (if set)
+    if (maxDepth >= 0) {
+        st_logCritical("> Changing maxDepth parameter from %"PRId64" to %"PRId64"\n", params->polishParams->maxDepth,
+                       maxDepth);
+        params->polishParams->maxDepth = (uint64_t) maxDepth;
+    }
+
+    // Print a report of the parsed parameters
+    if (st_getLogLevel() == debug) {
+        params_printParameters(params, stderr);
+    }
+
+    // get chunker for bam.  if regionStr is NULL, it will be ignored
+    time_t chunkingStart = time(NULL);
+    BamChunker *bamChunker = bamChunker_construct2(bamInFile, regionStr, NULL, params->polishParams, TRUE);
+    bamChunker_setCramReference(bamChunker, referenceFastaFile);
+    st_logCritical(
+            "> Set up bam chunker in %"PRId64"s with chunk size %i and overlap %i (for region=%s), resulting in %i total chunks\n",
+            time(NULL) - chunkingStart, (int) bamChunker->chunkSize, (int) bamChunker->chunkBoundary,
+            regionStr == NULL ? "all" : regionStr, bamChunker->chunkCount);
+    if (bamChunker->chunkCount == 0) {
+        st_errAbort("> Found no valid reads!\n");
+    }
+
+    // the biggest chunks first, so no thread is left with a big chunk at the end of an iteration
+    stList *chunkOrder = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
+    for (int64_t i = 0; i < bamChunker->chunkCount; i++) {
+        stList_append(chunkOrder, stIntTuple_construct1(i));
+    }
+    stList_sort2(chunkOrder, compareBamChunkDepthByIndexInList, bamChunker->chunks);
+    stList_reverse(chunkOrder);
+
+    Hmm *hmm = NULL;
+    for (int64_t iteration = 0; iteration < iterations; iteration++) {
+        time_t iterationStartTime = time(NULL);
+        ChunkScheduler *chunkScheduler = chunkScheduler_construct(bamChunker, chunkOrder, numThreads, FALSE);
+
+        // each thread accumulates the expectations of its reads into its own shard
+        Hmm **hmmForThreads = st_calloc(numThreads, sizeof(Hmm *));
+        for (int64_t t = 0; t < numThreads; t++) {
+            hmmForThreads[t] = hmm_constructEmpty(0.0, hmmType, nucleotideEmissions);
+        }
+
+        # ifdef _OPENMP
+        #pragma omp parallel
+        # endif
+        for (int64_t i = 0; chunkScheduler_next(chunkScheduler, &i);) {
+            int64_t chunkIdx = stIntTuple_get(stList_get(chunkOrder, i), 0);
+            time_t chunkStartTime = time(NULL);
+            BamChunk *bamChunk = bamChunker_getChunk(bamChunker, chunkIdx);
+
+            # ifdef _OPENMP
+            int64_t threadIdx = omp_get_thread_num();
+            char *logIdentifier = stString_print(" T%02d_C%05"PRId64, threadIdx, chunkIdx);
+            # else
+            int64_t threadIdx = 0;
+            char *logIdentifier = stString_copy("");
+            # endif
+
+            RleString *rleReference = bamChunk_getReferenceSubstring(bamChunk, referenceFastaFile, params);
+
+            // Convert bam lines into corresponding reads and alignments
+            stList *reads = stList_construct3(0, (void (*)(void *)) bamChunkRead_destruct);
+            stList *alignments = stList_construct3(0, (void (*)(void *)) stList_destruct);
+            stList *filteredReads = stList_construct3(0, (void (*)(void *)) bamChunkRead_destruct);
+            stList *filteredAlignments = stList_construct3(0, (void (*)(void *)) stList_destruct);
+            convertToReadsAndAlignments(bamChunk, rleReference, reads, alignments, params->polishParams);
+
+            // do downsampling if appropriate
+            if (params->polishParams->maxDepth > 0) {
+                stList *maintainedReads = stList_construct3(0, (void (*)(void *)) bamChunkRead_destruct);
+                stList *maintainedAlignments = stList_construct3(0, (void (*)(void *)) stList_destruct);
+                bool didDownsample = downsampleViaReadLikelihood(params->polishParams->maxDepth, bamChunk, reads,
+                                                                 alignments, maintainedReads, maintainedAlignments,
+                                                                 filteredReads, filteredAlignments);
+                if (didDownsample) {
+                    st_logInfo(" %s Downsampled from %"PRId64" to %"PRId64" reads\n", logIdentifier,
+                               stList_length(reads), stList_length(maintainedReads));
+                    stList_setDestructor(reads, NULL);
+                    stList_setDestructor(alignments, NULL);
+                    stList_destruct(reads);
+                    stList_destruct(alignments);
+                    reads = maintainedReads;
+                    alignments = maintainedAlignments;
+                } else {
+                    stList_destruct(maintainedReads);
+                    stList_destruct(maintainedAlignments);
+                }
+            }
+
+            // Anchor the alignments of the reads on their alignments in the bam, as for polishing
+            Poa *poa = poa_realignOnlyAnchorAlignments(reads, alignments, rleReference, params->polishParams);
+            stList *anchorAlignments = poa_getAnchorAlignments(poa, NULL, stList_length(reads), params->polishParams);
+            for (int64_t j = 0; j < stList_length(reads); j++) {
+                BamChunkRead *read = stList_get(reads, j);
+                getExpectationsCroppingReference(rleReference, read->rleRead, read->forwardStrand,
+                                                 stList_get(anchorAlignments, j), hmmForThreads[threadIdx],
+                                                 params->polishParams);
+            }
+
+            if (st_getLogLevel() >= info) {
+                st_logInfo(">%s Chunk with ~%"PRId64" reads processed in %d sec\n",
+                           logIdentifier, stList_length(reads), (int) (time(NULL) - chunkStartTime));
+            }
+
+            // cleanup
+            stList_destruct(anchorAlignments);
+            poa_destruct(poa);
+            rleString_destruct(rleReference);
+            stList_destruct(reads);
+            stList_destruct(alignments);
+            stList_destruct(filteredReads);
+            stList_destruct(filteredAlignments);
+            free(logIdentifier);
+            chunkScheduler_finish(chunkScheduler, i);
+        }
+        chunkScheduler_destruct(chunkScheduler);
+
+        // reduce the shards, in thread order, and get the new hmm
+        if (hmm != NULL) {
+            hmm_destruct(hmm);
+        }
+        hmm = hmm_constructEmpty(pseudocount, hmmType, nucleotideEmissions);
+        for (int64_t t = 0; t < numThreads; t++) {
+            hmm_addExpectations(hmm, hmmForThreads[t]);
+            hmm_destruct(hmmForThreads[t]);
+        }
+        free(hmmForThreads);
+        hmm_normalise(hmm);
+        polishParams_setReadHmm(params->polishParams, hmm);
+
+        char *timeDescriptor = getTimeDescriptorFromSeconds(time(NULL) - iterationStartTime);
+        st_logCritical("> Baum-Welch iteration %"PRId64" of %"PRId64" got expected likelihood %f in %s\n",
+                       iteration + 1, iterations, hmm->likelihood, timeDescriptor);
+        free(timeDescriptor);
+    }
+
+    // write the trained hmm as params
+    char *outputFile = stString_print("%s.hmm.json", outputBase);
+    st_logCritical("> Writing trained hmm to %s\n", outputFile);
+    FILE *fh = safe_fopen(outputFile, "w");
+    fprintf(fh, "{\n\t\"polish\": {\n\t\t\"hmmForwardStrandReadGivenReference\" : ");
+    hmm_printJson(hmm, fh, "\t\t");
+    fprintf(fh, "\n\t}\n}\n");
+    fclose(fh);
+    free(outputFile);
+
+    // cleanup
+    hmm_destruct(hmm);
+    bamChunker_destruct(bamChunker);
+    htsThreadPool_destruct();
+    params_destruct(params);
+    if (regionStr != NULL) free(regionStr);
+    stList_destruct(chunkOrder);
+    free(outputBase);
+    free(bamInFile);
+    free(referenceFastaFile);
+    free(paramsFile);
+
+    // log completion
+    char *timeDescriptor = getTimeDescriptorFromSeconds(time(NULL) - startTime);
+    st_logCritical("> Finished training hmm in %s.\n", timeDescriptor);
+    free(timeDescriptor);
+
+    return 0;
+}